@@ -0,0 +1,71 @@
+#include "bench_port.h"
+#include <string.h>
+#include "common.h"
+#include "rio_spi.h"
+#include "rio_bench.h"
+
+#ifdef BENCH_ENABLED
+
+/* One frame of the largest request, only its first two bytes are set. The check runs over
+ * every byte whatever they hold, so the frame need not be valid. */
+uint8_t bench_frame[SPI_PACKET_BUF_SIZE];
+
+void bench_run( uint8_t kernel, uint16_t runs, uint8_t *buf )
+{
+    /* The caller checked kernel < BENCH_COUNT and runs 1 to BENCH_RUNS_MAX */
+
+    bench_kernel_t fn = bench_kernels[kernel];
+    uint32_t total = 0;
+    uint32_t hz;
+    uint16_t min = 0xFFFF;
+    uint16_t max = 0;
+    uint16_t start;
+    uint16_t ticks;
+    uint16_t i;
+
+    for ( i=0; i<runs; i++ )
+    {
+        BENCH_PORT_LOCK();
+        start = BENCH_PORT_NOW();
+        fn();
+        ticks = (uint16_t)( BENCH_PORT_NOW() - start );
+        BENCH_PORT_UNLOCK();
+
+        total += ticks;
+        if ( ticks < min )
+            min = ticks;
+        if ( ticks > max )
+            max = ticks;
+    }
+
+    buf[0] = BENCH_COUNT;
+    buf[1] = kernel;
+    memcpy( &buf[2], &runs, sizeof(uint16_t) );             // Little endian
+    hz = BENCH_PORT_TIMER_HZ;
+    memcpy( &buf[4], &hz, sizeof(uint32_t) );
+    hz = BENCH_PORT_CPU_HZ;
+    memcpy( &buf[8], &hz, sizeof(uint32_t) );
+    memcpy( &buf[12], &total, sizeof(uint32_t) );
+    memcpy( &buf[16], &min, sizeof(uint16_t) );
+    memcpy( &buf[18], &max, sizeof(uint16_t) );
+}
+
+void bench_null( void )
+{
+}
+
+void bench_frame_checksum( void )
+{
+    bench_frame[0] = SPI_FRAME_STX;
+    bench_frame[1] = SPI_PACKET_BUF_SIZE;
+    spi_frame_check( bench_frame );
+}
+
+void bench_frame_crc( void )
+{
+    bench_frame[0] = SPI_FRAME_STX_CRC;
+    bench_frame[1] = SPI_PACKET_BUF_SIZE;
+    spi_frame_check( bench_frame );
+}
+
+#endif
@@ -0,0 +1,51 @@
+/*
+ * File:   rio_bench.h
+ *
+ * On-target benchmark of firmware kernels, shared by the Rio modules. A
+ * kernel is a board function run on canned inputs; bench_run() times it a
+ * number of times on a hardware timer and reports the total, min and max in
+ * timer ticks with the CPU clock, so the host can compare compiler options
+ * and code changes on the real part. Board specifics (kernel names, timer)
+ * live in each project's bench_port.h. Without BENCH_ENABLED nothing is built.
+ */
+
+#ifndef RIO_BENCH_H
+#define	RIO_BENCH_H
+
+#include <stdint.h>
+#include "bench_port.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/* Report: [kernels U8][kernel U8][runs U16][timer hz U32][cpu hz U32][total ticks U32][min ticks U16][max ticks U16] */
+#define BENCH_REPORT_SIZE               ( ( 2 * sizeof(uint8_t) ) + ( 3 * sizeof(uint16_t) ) + ( 3 * sizeof(uint32_t) ) )
+
+/* Kernel 0 of every board, bench_null(): the call and timer overhead */
+#define BENCH_NULL                      0
+
+/* Runs per request, each holds the main loop for the kernel's time */
+#ifndef BENCH_RUNS_MAX
+#define BENCH_RUNS_MAX                  1000
+#endif
+
+#ifdef BENCH_ENABLED
+typedef void (*bench_kernel_t)( void );
+
+/* In the board's main.c, in the order of the ids in bench_port.h */
+extern const bench_kernel_t bench_kernels[BENCH_COUNT];
+
+extern void bench_run( uint8_t kernel, uint16_t runs, uint8_t *buf );
+
+/* Kernels any board can list */
+extern void bench_null( void );
+extern void bench_frame_checksum( void );
+extern void bench_frame_crc( void );
+#endif
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* RIO_BENCH_H */
@@ -0,0 +1,62 @@
+#include <stdint.h>
+#include <string.h>
+#include "rio_delta.h"
+
+void delta_init( delta_coder_t *coder, uint16_t *prev, uint8_t count, uint8_t key_every )
+{
+    /* <prev> holds <count> words and belongs to the coder from here on */
+    coder->prev = prev;
+    coder->count = count;
+    coder->key_every = key_every;
+    delta_key( coder );
+}
+
+void delta_key( delta_coder_t *coder )
+{
+    /* The next record is a keyframe. Call it when a record was encoded but not sent, e.g. the
+     * write ring had no room, as the host would decode the one after against the wrong words. */
+    coder->key_pending = 1;
+}
+
+uint8_t delta_encode( delta_coder_t *coder, const uint16_t *words, uint8_t *buf )
+{
+    /* Writes the record of <words> to <buf>, at most DELTA_RECORD_MAX( count ) bytes, and
+     * returns its size. The words become the previous record of the next one. */
+    uint8_t *mask = &buf[1];
+    uint8_t *buf_ptr = &buf[1 + DELTA_MASK_SIZE( coder->count )];
+    uint8_t key;
+    uint8_t w;
+    uint16_t diff;
+    uint16_t zz;
+    
+    key = coder->key_pending || ( coder->key_every && ( coder->since_key >= coder->key_every ) );
+    if ( key )
+    {
+        memset( coder->prev, 0, coder->count * sizeof(uint16_t) );
+        coder->key_pending = 0;
+        coder->since_key = 0;
+    }
+    coder->since_key++;
+    
+    buf[0] = key ? DELTA_FLAG_KEY : 0;
+    memset( mask, 0, DELTA_MASK_SIZE( coder->count ) );
+    for ( w=0; w<coder->count; w++ )
+    {
+        diff = words[w] - coder->prev[w];
+        if ( diff == 0 )
+            continue;
+        mask[w >> 3] |= 1 << ( w & 7 );
+        coder->prev[w] = words[w];
+        
+        /* Zig-zag: 0, -1, 1, -2 ... -> 0, 1, 2, 3 ..., so small changes either way are short */
+        zz = ( diff << 1 ) ^ ( ( diff & 0x8000 ) ? 0xFFFF : 0 );
+        while ( zz >= 0x80 )
+        {
+            *buf_ptr++ = ( zz & 0x7F ) | 0x80;
+            zz >>= 7;
+        }
+        *buf_ptr++ = zz;
+    }
+    
+    return buf_ptr - buf;
+}
@@ -0,0 +1,44 @@
+/*
+ * File:   rio_delta.h
+ *
+ * Compact records for the dsPIC Rio telemetry and history streams. A record
+ * is a fixed list of 16-bit words, sent as the differences from the previous
+ * record: a mask of the words that changed, then each change as a zig-zag
+ * varint. A keyframe is coded against zeros, so a host can start decoding
+ * there, or pick up again after a lost record.
+ */
+
+#ifndef RIO_DELTA_H
+#define	RIO_DELTA_H
+
+#include <stdint.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/* Record: [flags U8][mask U8 x DELTA_MASK_SIZE(n)], bit w & 7 of byte w >> 3 set for each word
+ * w that changed, then for those words in order the zig-zag varint of ( word - previous ),
+ * modulo 2^16: 7 bits per byte, least significant first, bit 7 set on all but the last. */
+#define DELTA_FLAG_KEY                  0x01    // Coded against zeros
+#define DELTA_MASK_SIZE(n)              ( ( (n) + 7 ) / 8 )
+#define DELTA_RECORD_MAX(n)             ( 1 + DELTA_MASK_SIZE(n) + ( 3 * (n) ) )    // Under 256 up to 84 words
+
+typedef struct
+{
+    uint16_t *prev;                 // count words, the last record sent
+    uint8_t count;
+    uint8_t key_every;              // Records per keyframe, 0 -> only when asked
+    uint8_t since_key;
+    uint8_t key_pending;
+} delta_coder_t;
+
+extern void delta_init( delta_coder_t *coder, uint16_t *prev, uint8_t count, uint8_t key_every );
+extern void delta_key( delta_coder_t *coder );
+extern uint8_t delta_encode( delta_coder_t *coder, const uint16_t *words, uint8_t *buf );
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* RIO_DELTA_H */
@@ -0,0 +1,261 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "fault_port.h"
+#include "rio_fault.h"
+
+#define FAULT_ADDR( slot )              ( FAULT_PORT_LOG_ADDR + ( (uint16_t)(slot) * FAULT_RECORD_SIZE ) )
+#define FAULT_CHECK                     0xA5    // Byte sum of a valid record, neither blank 0xFF nor 0x00 fill sums to it
+
+/* Fails to build if the record layout or the log size is off */
+typedef char fault_rec_size_check[ ( sizeof(fault_rec_t) == FAULT_RECORD_SIZE ) ? 1 : -1 ];
+typedef char fault_log_size_check[ ( ( FAULT_PORT_LOG_SIZE % FAULT_PAGE_SIZE ) == 0 ) && ( FAULT_LOG_RECORDS <= 0x8000 ) ? 1 : -1 ];
+
+/* RAM copy of the EEPROM page being filled, from its first slot. Records before
+ * fault_dirty are in the EEPROM (or queued to it), the rest wait for fault_task(). */
+fault_rec_t fault_page[FAULT_PAGE_RECORDS];
+uint16_t fault_page_slot;
+uint8_t fault_used;
+uint8_t fault_dirty;
+
+uint16_t fault_seq;                 // Of the next record
+uint16_t fault_boot;
+uint16_t fault_total;               // Readable records, up to FAULT_LOG_RECORDS
+uint8_t fault_lost;
+bool fault_eeprom;
+
+volatile uint16_t *fault_ticks;
+uint16_t fault_ticks_per_s;
+uint16_t fault_tick_prev;
+uint32_t fault_uptime_s;
+uint32_t fault_pending_s;           // Uptime when the oldest unwritten change was made
+uint32_t fault_write_s;             // Uptime of the last write
+
+void fault_uptime_update( void );
+bool fault_rec_valid( fault_rec_t *rec );
+void fault_rec_seal( fault_rec_t *rec );
+void fault_mark_dirty( uint8_t index );
+
+void fault_init( volatile uint16_t *ticks, uint16_t ticks_per_s, bool eeprom_present, int32_t reset_cause )
+{
+    /* Scans the log for the newest valid record and carries on after it, then logs the reset */
+    fault_rec_t page[FAULT_PAGE_RECORDS];
+    fault_rec_t rec;
+    bool found = false;
+    uint16_t newest = 0;
+    uint16_t slot;
+    uint8_t i;
+
+    fault_ticks = ticks;
+    fault_ticks_per_s = ticks_per_s;
+    fault_tick_prev = *ticks;
+    fault_uptime_s = 0;
+    fault_pending_s = 0;
+    fault_write_s = 0;
+
+    fault_eeprom = eeprom_present;
+    fault_page_slot = 0;
+    fault_used = 0;
+    fault_dirty = 0;
+    fault_seq = 0;
+    fault_boot = 0;
+    fault_total = 0;
+    fault_lost = 0;
+
+    if ( fault_eeprom )
+    {
+        for ( slot = 0; slot < FAULT_LOG_RECORDS; slot += FAULT_PAGE_RECORDS )
+        {
+            FAULT_PORT_READ( FAULT_ADDR( slot ), sizeof(page), (uint8_t *)page );
+            for ( i = 0; i < FAULT_PAGE_RECORDS; i++ )
+            {
+                if ( !fault_rec_valid( &page[i] ) )
+                    continue;
+                if ( found && ( (int16_t)( page[i].seq - fault_seq ) <= 0 ) )
+                    continue;
+
+                found = true;
+                newest = slot + i;
+                fault_seq = page[i].seq;
+                fault_boot = page[i].boot;
+            }
+        }
+    }
+
+    if ( found )
+    {
+        /* Readable records run back from the newest while the seqs follow on */
+        do
+        {
+            fault_total++;
+            slot = ( newest + FAULT_LOG_RECORDS - fault_total ) % FAULT_LOG_RECORDS;
+            FAULT_PORT_READ( FAULT_ADDR( slot ), sizeof(rec), (uint8_t *)&rec );
+        }
+        while ( ( fault_total < FAULT_LOG_RECORDS ) && fault_rec_valid( &rec ) &&
+                ( rec.seq == (uint16_t)( fault_seq - fault_total ) ) );
+
+        fault_seq++;
+        fault_boot++;
+
+        slot = ( newest + 1 ) % FAULT_LOG_RECORDS;
+        fault_used = slot % FAULT_PAGE_RECORDS;
+        fault_page_slot = slot - fault_used;
+        fault_dirty = fault_used;
+        if ( fault_used > 0 )
+            FAULT_PORT_READ( FAULT_ADDR( fault_page_slot ), fault_used * FAULT_RECORD_SIZE, (uint8_t *)fault_page );
+    }
+
+    fault_log( FAULT_ID_RESET, reset_cause );
+}
+
+void fault_log( uint8_t id, int32_t arg )
+{
+    /* Main loop only, never waits. A repeat of the newest record this boot is counted in it.
+     * A written record is rewritten only as its count reaches a power of two, so a fault
+     * repeating forever costs at most eight writes. */
+    fault_rec_t *rec;
+
+    fault_uptime_update();
+
+    if ( fault_used > 0 )
+    {
+        rec = &fault_page[fault_used - 1];
+        if ( ( rec->id == id ) && ( rec->arg == arg ) && ( rec->boot == fault_boot ) )
+        {
+            if ( rec->count < UINT8_MAX )
+            {
+                rec->count++;
+                fault_rec_seal( rec );
+                if ( ( rec->count & ( rec->count - 1 ) ) == 0 )
+                    fault_mark_dirty( fault_used - 1 );
+            }
+            return;
+        }
+    }
+
+    if ( fault_used == FAULT_PAGE_RECORDS )
+    {
+        if ( fault_dirty < fault_used )
+        {
+            /* Page not written yet */
+            if ( fault_lost < UINT8_MAX )
+                fault_lost++;
+            return;
+        }
+
+        fault_page_slot = ( fault_page_slot + FAULT_PAGE_RECORDS ) % FAULT_LOG_RECORDS;
+        fault_used = 0;
+        fault_dirty = 0;
+    }
+
+    rec = &fault_page[fault_used];
+    rec->seq = fault_seq++;
+    rec->boot = fault_boot;
+    rec->uptime_s = fault_uptime_s;
+    rec->id = id;
+    rec->count = 1;
+    rec->arg = arg;
+    rec->lost = fault_lost;
+    fault_rec_seal( rec );
+    fault_lost = 0;
+
+    fault_mark_dirty( fault_used );
+    fault_used++;
+    if ( fault_total < FAULT_LOG_RECORDS )
+        fault_total++;
+}
+
+void fault_task( void )
+{
+    /* Queues the unwritten records once they have waited FAULT_PORT_BATCH_S, or fill the
+     * page, and FAULT_PORT_WRITE_INTERVAL_S has passed since the last write. Only while
+     * the EEPROM write queue is empty, so it never waits and never delays a settings save. */
+    fault_uptime_update();
+
+    if ( !fault_eeprom || ( fault_dirty == fault_used ) )
+        return;
+    if ( ( fault_used < FAULT_PAGE_RECORDS ) && ( ( fault_uptime_s - fault_pending_s ) < FAULT_PORT_BATCH_S ) )
+        return;
+    if ( ( fault_uptime_s - fault_write_s ) < FAULT_PORT_WRITE_INTERVAL_S )
+        return;
+    if ( !FAULT_PORT_WRITE_READY() )
+        return;
+
+    FAULT_PORT_WRITE( FAULT_ADDR( fault_page_slot + fault_dirty ), ( fault_used - fault_dirty ) * FAULT_RECORD_SIZE, (uint8_t *)&fault_page[fault_dirty] );
+    fault_dirty = fault_used;
+    fault_write_s = fault_uptime_s;
+}
+
+uint8_t fault_list( uint16_t index, uint8_t *buf )
+{
+    /* Fills up to FAULT_LIST_SIZE bytes from the <index>th newest record, returns the size.
+     * Records of the page being filled come from RAM, so unwritten ones are included. */
+    uint8_t *rec = &buf[FAULT_LIST_HEADER_SIZE];
+    uint8_t count = 0;
+    uint16_t back;
+    uint16_t slot;
+
+    while ( ( count < FAULT_LIST_RECORDS_MAX ) && ( ( index + count ) < fault_total ) )
+    {
+        back = index + count;
+        if ( back < fault_used )
+            memcpy( rec, &fault_page[fault_used - 1 - back], FAULT_RECORD_SIZE );
+        else
+        {
+            slot = ( fault_page_slot + FAULT_LOG_RECORDS - 1 - ( back - fault_used ) ) % FAULT_LOG_RECORDS;
+            FAULT_PORT_READ( FAULT_ADDR( slot ), FAULT_RECORD_SIZE, rec );
+        }
+        rec += FAULT_RECORD_SIZE;
+        count++;
+    }
+
+    buf[0] = (uint8_t)fault_total;
+    buf[1] = (uint8_t)( fault_total >> 8 );
+    buf[2] = fault_used - fault_dirty;
+    buf[3] = count;
+
+    return FAULT_LIST_HEADER_SIZE + ( count * FAULT_RECORD_SIZE );
+}
+
+void fault_uptime_update( void )
+{
+    uint16_t now = *fault_ticks;
+
+    while ( (uint16_t)( now - fault_tick_prev ) >= fault_ticks_per_s )
+    {
+        fault_tick_prev += fault_ticks_per_s;
+        fault_uptime_s++;
+    }
+}
+
+bool fault_rec_valid( fault_rec_t *rec )
+{
+    uint8_t *ptr = (uint8_t *)rec;
+    uint8_t sum = 0;
+    uint8_t i;
+
+    for ( i = 0; i < FAULT_RECORD_SIZE; i++ )
+        sum += ptr[i];
+
+    return ( sum == FAULT_CHECK );
+}
+
+void fault_rec_seal( fault_rec_t *rec )
+{
+    uint8_t *ptr = (uint8_t *)rec;
+    uint8_t sum = 0;
+    uint8_t i;
+
+    for ( i = 0; i < ( FAULT_RECORD_SIZE - 1 ); i++ )
+        sum += ptr[i];
+
+    rec->check = FAULT_CHECK - sum;
+}
+
+void fault_mark_dirty( uint8_t index )
+{
+    if ( fault_dirty == fault_used )
+        fault_pending_s = fault_uptime_s;
+    if ( index < fault_dirty )
+        fault_dirty = index;
+}
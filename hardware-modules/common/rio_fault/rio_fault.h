@@ -0,0 +1,57 @@
+/*
+ * File:   rio_fault.h
+ *
+ * Fault log shared by the dsPIC Rio modules. Faults are kept as compact
+ * records in a circular log in the spare space of the board EEPROM, so they
+ * survive a reset. fault_log() only updates a RAM copy of the current EEPROM
+ * page; fault_task() writes it from the main loop, batched and at most once
+ * per FAULT_PORT_WRITE_INTERVAL_S, through the EEPROM write queue.
+ */
+
+#ifndef RIO_FAULT_H
+#define	RIO_FAULT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "fault_port.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#define FAULT_RECORD_SIZE               16
+#define FAULT_PAGE_SIZE                 64      // 25AA128 page, records are written a page at a time
+#define FAULT_PAGE_RECORDS              ( FAULT_PAGE_SIZE / FAULT_RECORD_SIZE )
+#define FAULT_LOG_RECORDS               ( FAULT_PORT_LOG_SIZE / FAULT_RECORD_SIZE )
+
+/* GET_FAULT_LOG reply: [total U16][pending U8][count U8] + count x record, newest first */
+#define FAULT_LIST_HEADER_SIZE          4
+#define FAULT_LIST_RECORDS_MAX          4
+#define FAULT_LIST_SIZE                 ( FAULT_LIST_HEADER_SIZE + ( FAULT_LIST_RECORDS_MAX * FAULT_RECORD_SIZE ) )
+
+/* Logged by fault_init(), arg is the board's reset cause register. Board ids start at 1. */
+#define FAULT_ID_RESET                  0
+
+typedef struct __attribute__((packed))
+{
+    uint16_t seq;                   // Counts up across resets, the newest valid record is found by it
+    uint16_t boot;                  // Resets since the log was blank
+    uint32_t uptime_s;              // Seconds since that reset, at the first occurrence
+    uint8_t id;                     // FAULT_ID_*
+    uint8_t count;                  // Occurrences with the same id and arg in a row, saturating
+    int32_t arg;
+    uint8_t lost;                   // Faults dropped before this record, saturating
+    uint8_t check;                  // Makes the byte sum FAULT_CHECK, so a blank or torn record fails
+} fault_rec_t;
+
+extern void fault_init( volatile uint16_t *ticks, uint16_t ticks_per_s, bool eeprom_present, int32_t reset_cause );
+extern void fault_log( uint8_t id, int32_t arg );
+extern void fault_task( void );
+
+extern uint8_t fault_list( uint16_t index, uint8_t *buf );
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* RIO_FAULT_H */
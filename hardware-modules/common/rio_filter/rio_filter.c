@@ -0,0 +1,93 @@
+#include <stdint.h>
+#include <stdbool.h>
+#ifdef __XC16__
+#include <xc.h>
+#endif
+#include "rio_filter.h"
+
+void filter_passthrough( filter_coeffs_t *coeffs )
+{
+    coeffs->b0 = FILTER_COEFF_ONE;
+    coeffs->b1 = 0;
+    coeffs->b2 = 0;
+    coeffs->a1 = 0;
+    coeffs->a2 = 0;
+}
+
+bool filter_is_passthrough( const filter_coeffs_t *coeffs )
+{
+    return ( coeffs->b0 == FILTER_COEFF_ONE ) && ( coeffs->b1 == 0 ) && ( coeffs->b2 == 0 ) &&
+           ( coeffs->a1 == 0 ) && ( coeffs->a2 == 0 );
+}
+
+bool filter_coeffs_valid( const filter_coeffs_t *coeffs )
+{
+    /* Poles inside the unit circle: |a2| < 1 and |a1| < 1 + a2 */
+    int32_t a1 = coeffs->a1;
+    int32_t a2 = coeffs->a2;
+
+    if ( ( a2 <= -FILTER_COEFF_ONE ) || ( a2 >= FILTER_COEFF_ONE ) )
+        return false;
+    if ( ( a1 >= ( FILTER_COEFF_ONE + a2 ) ) || ( a1 <= -( FILTER_COEFF_ONE + a2 ) ) )
+        return false;
+
+    return true;
+}
+
+void filter_reset( filter_state_t *st, int16_t x )
+{
+    /* As if <x> had been the input for ever, exact for a filter with a DC gain of 1 */
+    st->x1 = x;
+    st->x2 = x;
+    st->y1 = x;
+    st->y2 = x;
+    st->round = (int16_t)1 << ( FILTER_COEFF_SHIFT - 1 );
+}
+
+int16_t filter_biquad( const filter_coeffs_t *coeffs, filter_state_t *st, int16_t x )
+{
+    /* Main loop only, no interrupt uses the accumulators. The sum is rounded by a term added
+     * in the accumulator rather than by SACR, so the result does not depend on CORCON.RND.
+     * What the rounding leaves is the next rounding term: with a low cutoff, 1 + a1 + a2 is
+     * small and a plain round would hold the output up to 0.5 / ( 1 + a1 + a2 ) LSB away
+     * from a steady input. */
+    int16_t y;
+
+#ifdef __XC16__
+    /* Fractional mode: each product is 2 x b x, so the Q14 sum is stored << 1 */
+    register int acc asm("A");
+
+    acc = __builtin_mpy( x, coeffs->b0, 0, 0, 0, 0, 0, 0 );
+    acc = __builtin_mac( acc, st->x1, coeffs->b1, 0, 0, 0, 0, 0, 0, 0, 0 );
+    acc = __builtin_mac( acc, st->x2, coeffs->b2, 0, 0, 0, 0, 0, 0, 0, 0 );
+    acc = __builtin_msc( acc, st->y1, coeffs->a1, 0, 0, 0, 0, 0, 0, 0, 0 );
+    acc = __builtin_msc( acc, st->y2, coeffs->a2, 0, 0, 0, 0, 0, 0, 0, 0 );
+    acc = __builtin_mac( acc, st->round, 1, 0, 0, 0, 0, 0, 0, 0, 0 );
+    y = __builtin_sac( acc, -1 );                   // Saturates with CORCON.SATDW, set at reset
+
+    /* The remainder, 0 to just under 1 in Q14, from the low word of the accumulator */
+    acc = __builtin_msc( acc, y, FILTER_COEFF_ONE, 0, 0, 0, 0, 0, 0, 0, 0 );
+    acc = __builtin_sftac( acc, -16 );
+    st->round = __builtin_sac( acc, 1 );
+#else
+    /* 64-bit, as the 40-bit accumulator does not overflow either */
+    int64_t sum;
+
+    sum = ( (int64_t)x * coeffs->b0 ) + ( (int64_t)st->x1 * coeffs->b1 ) + ( (int64_t)st->x2 * coeffs->b2 ) -
+          ( (int64_t)st->y1 * coeffs->a1 ) - ( (int64_t)st->y2 * coeffs->a2 ) + st->round;
+    y = ( ( sum >> FILTER_COEFF_SHIFT ) > INT16_MAX ) ? INT16_MAX :
+        ( ( ( sum >> FILTER_COEFF_SHIFT ) < INT16_MIN ) ? INT16_MIN : ( sum >> FILTER_COEFF_SHIFT ) );
+    st->round = sum - ( (int64_t)y << FILTER_COEFF_SHIFT );
+#endif
+
+    /* A saturated output leaves no remainder to carry */
+    if ( ( y == INT16_MAX ) || ( y == INT16_MIN ) )
+        st->round = (int16_t)1 << ( FILTER_COEFF_SHIFT - 1 );
+
+    st->x2 = st->x1;
+    st->x1 = x;
+    st->y2 = st->y1;
+    st->y1 = y;
+
+    return y;
+}
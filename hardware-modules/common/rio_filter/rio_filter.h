@@ -0,0 +1,55 @@
+/*
+ * File:   rio_filter.h
+ *
+ * Biquad filter for the dsPIC Rio sensor readings, run on the DSP engine:
+ * five MACs into one accumulator and a saturating store. The rounding error of
+ * each output is carried into the next, so a filter with a DC gain of 1 has no
+ * dead band. A portable C version gives the same result bit for bit on a host
+ * build.
+ */
+
+#ifndef RIO_FILTER_H
+#define	RIO_FILTER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/* Coefficients are Q14, so -2.0 to just under 2.0 */
+#define FILTER_COEFF_SHIFT              14
+#define FILTER_COEFF_ONE                ( (int16_t)1 << FILTER_COEFF_SHIFT )
+#define FILTER_COEFFS_SIZE              10      // Five I16, b0 b1 b2 a1 a2, little endian
+
+/* y = b0 x + b1 x1 + b2 x2 - a1 y1 - a2 y2, a0 is 1. a1 = a2 = 0 is a 3-tap FIR. */
+typedef struct
+{
+    int16_t b0;
+    int16_t b1;
+    int16_t b2;
+    int16_t a1;
+    int16_t a2;
+} filter_coeffs_t;
+
+typedef struct
+{
+    int16_t x1;
+    int16_t x2;
+    int16_t y1;
+    int16_t y2;
+    int16_t round;                  // Rounding term, Q14: a half plus the error of the last output
+} filter_state_t;
+
+void filter_passthrough( filter_coeffs_t *coeffs );
+bool filter_is_passthrough( const filter_coeffs_t *coeffs );
+bool filter_coeffs_valid( const filter_coeffs_t *coeffs );
+void filter_reset( filter_state_t *st, int16_t x );
+int16_t filter_biquad( const filter_coeffs_t *coeffs, filter_state_t *st, int16_t x );
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* RIO_FILTER_H */
@@ -0,0 +1,317 @@
+#include <stdint.h>
+#include <xc.h>
+#include "common.h"
+#include "rio_flash.h"
+
+#define FLASH_NVMOP_DWORD               0x4001  // WREN, double word program
+#define FLASH_NVMOP_PAGE_ERASE          0x4003  // WREN, page erase
+#define FLASH_LATCH_PAGE                0x00FA  // TBLPAG of the write latches
+#define FLASH_ERASED                    0xFFFFFFUL
+#define FLASH_VERIFY_WORDS              64      // Instructions checked per flash_task() pass
+#define FLASH_CRC_POLY                  0xEDB88320UL    // CRC-32, reflected, as zlib
+
+/* Fails to build if a page or FBTSEQ is not where the erase and commit assume */
+typedef char flash_layout_check[ ( ( FLASH_PORT_PARTITION_SIZE % FLASH_PORT_PAGE_SIZE ) == 0 ) &&
+                                 ( ( FLASH_PORT_FBTSEQ % 4 ) == 0 ) && ( FLASH_PORT_FBTSEQ < FLASH_PORT_PARTITION_SIZE ) ? 1 : -1 ];
+
+uint8_t flash_state;
+uint32_t flash_next;                // Next program address to erase or check, from 0
+uint32_t flash_size;                // Of the image being verified
+uint32_t flash_crc;                 // Running, inverted
+uint32_t flash_crc_expect;
+uint32_t flash_words;               // Instructions written since the erase
+
+uint8_t flash_reset;
+uint16_t flash_reset_tick;
+uint16_t flash_reset_ticks;         // FLASH_RESET_TIMEOUT_MS and the tick in progress
+volatile uint16_t *flash_ticks;
+
+uint32_t flash_get_u32( uint8_t *buf );
+uint8_t *flash_put_u32( uint8_t *buf, uint32_t value );
+uint32_t flash_read_word( uint32_t addr );
+void flash_nvm_start( uint16_t op, uint32_t addr );
+err flash_write_dword( uint32_t addr, uint32_t word0, uint32_t word1 );
+uint16_t flash_seq( uint32_t addr );
+err flash_write( uint8_t *data, uint8_t data_size );
+err flash_commit( void );
+
+void flash_init( volatile uint16_t *ticks, uint16_t ticks_per_s )
+{
+    flash_ticks = ticks;
+    flash_reset_ticks = 1 + (uint16_t)( ( (uint32_t)FLASH_RESET_TIMEOUT_MS * ticks_per_s ) / 1000 );
+    flash_state = FLASH_STATE_IDLE;
+    flash_next = 0;
+    flash_size = 0;
+    flash_crc = 0xFFFFFFFFUL;
+    flash_crc_expect = 0;
+    flash_words = 0;
+    flash_reset = 0;
+}
+
+err flash_command( uint8_t *data, uint8_t data_size )
+{
+    /* Main loop only. Data as FLASH, see rio_flash.h. STATUS always goes through, so the host
+     * can follow an erase or verify. */
+    uint32_t size;
+
+    switch ( data[0] )
+    {
+        case FLASH_OP_STATUS:
+            if ( data_size != 1 )
+                return ERR_PACKET_INVALID;
+            return ERR_OK;
+
+        case FLASH_OP_ERASE:
+            /* Also the way out of any other state, a committed image included */
+            if ( data_size != 1 )
+                return ERR_PACKET_INVALID;
+            flash_state = FLASH_STATE_ERASING;
+            flash_next = 0;
+            flash_size = 0;
+            flash_crc = 0xFFFFFFFFUL;
+            flash_words = 0;
+            return ERR_OK;
+
+        case FLASH_OP_WRITE:
+            return flash_write( data, data_size );
+
+        case FLASH_OP_VERIFY:
+            if ( data_size != FLASH_VERIFY_SIZE )
+                return ERR_PACKET_INVALID;
+            if ( ( flash_state != FLASH_STATE_READY ) && ( flash_state != FLASH_STATE_VERIFIED ) )
+                return ERR_FLASH_STATE;
+            size = flash_get_u32( &data[1] );
+            if ( ( size == 0 ) || ( size % 2 ) || ( size > FLASH_PORT_PARTITION_SIZE ) )
+                return ERR_FLASH_ADDRESS;
+            flash_state = FLASH_STATE_VERIFYING;
+            flash_next = 0;
+            flash_size = size;
+            flash_crc = 0xFFFFFFFFUL;
+            flash_crc_expect = flash_get_u32( &data[5] );
+            return ERR_OK;
+
+        case FLASH_OP_COMMIT:
+            if ( data_size != 1 )
+                return ERR_PACKET_INVALID;
+            return flash_commit();
+
+        case FLASH_OP_RESET:
+            if ( data_size != 1 )
+                return ERR_PACKET_INVALID;
+            flash_reset = 1;
+            flash_reset_tick = *flash_ticks;
+            return ERR_OK;
+    }
+
+    return ERR_PACKET_INVALID;
+}
+
+void flash_task( void )
+{
+    /* Main loop, every pass. Starts the next page erase once the last is done, or checks
+     * FLASH_VERIFY_WORDS more instructions. The inactive partition erases and writes while
+     * the CPU runs on from the active one. */
+    uint32_t word;
+    uint8_t i;
+    uint8_t byte;
+    uint8_t bit;
+
+    if ( flash_reset )
+    {
+        /* Once the RESET reply has left, so the host sees it */
+        if ( FLASH_PORT_REPLY_SENT() || ( (uint16_t)( *flash_ticks - flash_reset_tick ) >= flash_reset_ticks ) )
+        {
+            flash_reset = 0;
+            FLASH_PORT_RESET();
+        }
+        return;
+    }
+
+    if ( flash_state == FLASH_STATE_ERASING )
+    {
+        if ( NVMCONbits.WR )
+            return;
+        if ( NVMCONbits.WRERR )
+        {
+            flash_state = FLASH_STATE_FAILED;
+            return;
+        }
+        if ( flash_next >= FLASH_PORT_PARTITION_SIZE )
+        {
+            flash_state = FLASH_STATE_READY;
+            return;
+        }
+        flash_nvm_start( FLASH_NVMOP_PAGE_ERASE, FLASH_PORT_INACTIVE + flash_next );
+        flash_next += FLASH_PORT_PAGE_SIZE;
+    }
+    else if ( flash_state == FLASH_STATE_VERIFYING )
+    {
+        for ( i = 0; ( i < FLASH_VERIFY_WORDS ) && ( flash_next < flash_size ); i++ )
+        {
+            word = flash_read_word( FLASH_PORT_INACTIVE + flash_next );
+            for ( byte = 0; byte < FLASH_WORD_SIZE; byte++, word >>= 8 )
+            {
+                flash_crc ^= word & 0xFF;
+                for ( bit = 0; bit < 8; bit++ )
+                    flash_crc = ( flash_crc & 1 ) ? ( ( flash_crc >> 1 ) ^ FLASH_CRC_POLY ) : ( flash_crc >> 1 );
+            }
+            flash_next += 2;
+        }
+        if ( flash_next >= flash_size )
+            flash_state = ( (uint32_t)( flash_crc ^ 0xFFFFFFFFUL ) == flash_crc_expect ) ? FLASH_STATE_VERIFIED : FLASH_STATE_FAILED;
+    }
+}
+
+uint16_t flash_boot_seq( void )
+{
+    /* Of the running image, FLASH_SEQ_INVALID if its FBTSEQ was never programmed */
+    return flash_seq( FLASH_PORT_FBTSEQ );
+}
+
+void flash_status( uint8_t *buf )
+{
+    uint16_t seq = flash_boot_seq();
+
+    buf[0] = flash_state;
+    buf[1] = seq & 0xFF;
+    buf[2] = seq >> 8;
+    buf = flash_put_u32( &buf[3], FLASH_PORT_PARTITION_SIZE );
+    buf = flash_put_u32( buf, flash_words );
+    buf = flash_put_u32( buf, flash_next );
+    flash_put_u32( buf, flash_crc ^ 0xFFFFFFFFUL );
+}
+
+err flash_write( uint8_t *data, uint8_t data_size )
+{
+    /* [op][address U32][n x instruction U24]. Each dword is checked as it is written, and
+     * one that was not leaves the partition FAILED until the next erase. An all erased
+     * dword is skipped. */
+    uint32_t addr;
+    uint32_t end;
+    uint32_t word0;
+    uint32_t word1;
+    uint8_t *word_ptr;
+    uint8_t count;
+
+    if ( ( data_size < ( FLASH_WRITE_HEADER_SIZE + ( 2 * FLASH_WORD_SIZE ) ) ) ||
+         ( ( data_size - FLASH_WRITE_HEADER_SIZE ) % ( 2 * FLASH_WORD_SIZE ) ) )
+        return ERR_PACKET_INVALID;
+    if ( flash_state != FLASH_STATE_READY )
+        return ERR_FLASH_STATE;
+
+    count = ( data_size - FLASH_WRITE_HEADER_SIZE ) / FLASH_WORD_SIZE;
+    addr = flash_get_u32( &data[1] );
+    end = addr + ( 2 * (uint32_t)count );
+    if ( ( addr % 4 ) || ( addr >= FLASH_PORT_PARTITION_SIZE ) || ( end > FLASH_PORT_PARTITION_SIZE ) ||
+         ( ( addr < ( FLASH_PORT_FBTSEQ + 4 ) ) && ( end > FLASH_PORT_FBTSEQ ) ) )
+        return ERR_FLASH_ADDRESS;
+
+    for ( word_ptr = &data[FLASH_WRITE_HEADER_SIZE]; addr < end; addr += 4, word_ptr += 2 * FLASH_WORD_SIZE )
+    {
+        word0 = word_ptr[0] | ( (uint32_t)word_ptr[1] << 8 ) | ( (uint32_t)word_ptr[2] << 16 );
+        word1 = word_ptr[3] | ( (uint32_t)word_ptr[4] << 8 ) | ( (uint32_t)word_ptr[5] << 16 );
+        if ( ( word0 == FLASH_ERASED ) && ( word1 == FLASH_ERASED ) )
+            continue;
+        if ( flash_write_dword( FLASH_PORT_INACTIVE + addr, word0, word1 ) != ERR_OK )
+        {
+            flash_state = FLASH_STATE_FAILED;
+            return ERR_FLASH_WRITE;
+        }
+    }
+    flash_words += count;
+
+    return ERR_OK;
+}
+
+err flash_commit( void )
+{
+    /* Programs the new image's FBTSEQ one below the running one, the lower valid sequence
+     * boots. Until this dword is written the partition never boots. */
+    uint16_t active = flash_boot_seq();
+    uint16_t seq;
+
+    if ( flash_state != FLASH_STATE_VERIFIED )
+        return ERR_FLASH_STATE;
+    if ( active == 0 )
+        return ERR_FLASH_STATE;     // Nothing lower, reprogram both partitions with MPLAB
+
+    seq = ( active == FLASH_SEQ_INVALID ) ? ( FLASH_SEQ_INVALID - 1 ) : ( active - 1 );
+    if ( ( flash_write_dword( FLASH_PORT_INACTIVE + FLASH_PORT_FBTSEQ, ( (uint32_t)( ~seq & 0xFFF ) << 12 ) | seq, FLASH_ERASED ) != ERR_OK ) ||
+         ( flash_seq( FLASH_PORT_INACTIVE + FLASH_PORT_FBTSEQ ) != seq ) )
+    {
+        flash_state = FLASH_STATE_FAILED;
+        return ERR_FLASH_WRITE;
+    }
+    flash_state = FLASH_STATE_COMMITTED;
+
+    return ERR_OK;
+}
+
+uint16_t flash_seq( uint32_t addr )
+{
+    /* FBTSEQ at <addr>: [IBSEQ 23:12][BSEQ 11:0], valid only with IBSEQ the complement */
+    uint32_t word = flash_read_word( addr );
+    uint16_t seq = word & 0xFFF;
+
+    if ( ( ( word >> 12 ) & 0xFFF ) != ( ~seq & 0xFFF ) )
+        return FLASH_SEQ_INVALID;
+    return seq;
+}
+
+uint32_t flash_read_word( uint32_t addr )
+{
+    uint16_t tblpag = TBLPAG;
+    uint32_t word;
+
+    TBLPAG = (uint16_t)( addr >> 16 );
+    word = __builtin_tblrdl( (uint16_t)addr );
+    word |= (uint32_t)( __builtin_tblrdh( (uint16_t)addr ) & 0xFF ) << 16;
+    TBLPAG = tblpag;
+
+    return word;
+}
+
+void flash_nvm_start( uint16_t op, uint32_t addr )
+{
+    /* __builtin_write_NVM() runs the unlock sequence with interrupts off and sets WR */
+    NVMCON = op;
+    NVMCONbits.WRERR = 0;
+    NVMADRU = (uint16_t)( addr >> 16 );
+    NVMADR = (uint16_t)addr;
+    __builtin_write_NVM();
+}
+
+err flash_write_dword( uint32_t addr, uint32_t word0, uint32_t word1 )
+{
+    /* Waits for the write, about 50 us, then reads it back */
+    uint16_t tblpag = TBLPAG;
+
+    TBLPAG = FLASH_LATCH_PAGE;
+    __builtin_tblwtl( 0, (uint16_t)word0 );
+    __builtin_tblwth( 0, (uint16_t)( word0 >> 16 ) );
+    __builtin_tblwtl( 2, (uint16_t)word1 );
+    __builtin_tblwth( 2, (uint16_t)( word1 >> 16 ) );
+    TBLPAG = tblpag;
+
+    flash_nvm_start( FLASH_NVMOP_DWORD, addr );
+    while ( NVMCONbits.WR )
+        ;
+
+    if ( NVMCONbits.WRERR || ( flash_read_word( addr ) != word0 ) || ( flash_read_word( addr + 2 ) != word1 ) )
+        return ERR_FLASH_WRITE;
+    return ERR_OK;
+}
+
+uint32_t flash_get_u32( uint8_t *buf )
+{
+    return buf[0] | ( (uint32_t)buf[1] << 8 ) | ( (uint32_t)buf[2] << 16 ) | ( (uint32_t)buf[3] << 24 );
+}
+
+uint8_t *flash_put_u32( uint8_t *buf, uint32_t value )
+{
+    buf[0] = value & 0xFF;
+    buf[1] = ( value >> 8 ) & 0xFF;
+    buf[2] = ( value >> 16 ) & 0xFF;
+    buf[3] = value >> 24;
+    return &buf[4];
+}
@@ -0,0 +1,63 @@
+/*
+ * File:   rio_flash.h
+ *
+ * In-field firmware update over SPI, shared by the dsPIC Rio modules. The
+ * dsPIC33CK runs in dual partition mode: the firmware runs from the active
+ * partition while it erases and writes a new image into the inactive one,
+ * so control goes on during an update. Once the image's CRC checks out, its
+ * boot sequence is written lower than the running one and a reset starts
+ * it. A power cut at any point before that boots the running image again.
+ * Partition layout and reset live in each project's flash_port.h.
+ */
+
+#ifndef RIO_FLASH_H
+#define	RIO_FLASH_H
+
+#include <stdint.h>
+#include "common.h"
+#include "flash_port.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/* FLASH data: [op U8][...], little endian. Addresses are program addresses of the image as
+ * linked, from 0, and land in the inactive partition. */
+#define FLASH_OP_STATUS                 0       // No data
+#define FLASH_OP_ERASE                  1       // No data, the partition is erased in flash_task()
+#define FLASH_OP_WRITE                  2       // [address U32][n x instruction U24], n even
+#define FLASH_OP_VERIFY                 3       // [size U32][CRC-32 U32], checked in flash_task()
+#define FLASH_OP_COMMIT                 4       // No data, the verified image boots at the next reset
+#define FLASH_OP_RESET                  5       // No data, reset once the reply is read
+
+#define FLASH_WRITE_HEADER_SIZE         ( sizeof(uint8_t) + sizeof(uint32_t) )
+#define FLASH_WORD_SIZE                 3       // Bytes per instruction on the wire
+#define FLASH_VERIFY_SIZE               ( sizeof(uint8_t) + ( 2 * sizeof(uint32_t) ) )
+
+#define FLASH_STATE_IDLE                0       // Nothing started since reset
+#define FLASH_STATE_ERASING             1
+#define FLASH_STATE_READY               2       // Erased, WRITE accepted
+#define FLASH_STATE_VERIFYING           3
+#define FLASH_STATE_VERIFIED            4
+#define FLASH_STATE_COMMITTED           5       // Boots at the next reset
+#define FLASH_STATE_FAILED              6       // Erase or write error, or a CRC mismatch
+
+#define FLASH_SEQ_INVALID               0xFFF   // Boot sequence of an unprogrammed FBTSEQ
+
+/* Status: [state U8][boot sequence U16][partition size U32][words written U32][progress U32]
+ * [CRC-32 U32], little endian. Progress is the program addresses erased or checked so far. */
+#define FLASH_STATUS_SIZE               ( sizeof(uint8_t) + sizeof(uint16_t) + ( 4 * sizeof(uint32_t) ) )
+
+#define FLASH_RESET_TIMEOUT_MS          100     // Reset anyway if the host does not read the reply
+
+extern void flash_init( volatile uint16_t *ticks, uint16_t ticks_per_s );
+extern err flash_command( uint8_t *data, uint8_t data_size );
+extern void flash_task( void );
+extern uint16_t flash_boot_seq( void );
+extern void flash_status( uint8_t *buf );
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* RIO_FLASH_H */
@@ -0,0 +1,127 @@
+#include "latency_port.h"
+#include <string.h>
+#include "rio_time.h"
+#include "rio_latency.h"
+
+latency_loop_t latency_loops[LATENCY_COUNT];
+
+void latency_reset( latency_loop_t *loop );
+
+void latency_init( void )
+{
+    uint8_t loop;
+
+    memset( latency_loops, 0, sizeof(latency_loops) );
+    for ( loop=0; loop<LATENCY_COUNT; loop++ )
+        latency_reset( &latency_loops[loop] );
+}
+
+void latency_hist_reset( latency_hist_t *hist )
+{
+    memset( hist, 0, sizeof(latency_hist_t) );
+    hist->min = 0xFFFFFFFF;
+}
+
+void latency_reset( latency_loop_t *loop )
+{
+    /* Keeps the pending sample and the previous output, so the next output is still timed */
+    latency_hist_reset( &loop->latency );
+    latency_hist_reset( &loop->period );
+}
+
+void latency_hist_add( latency_hist_t *hist, uint32_t value, uint32_t bin_value )
+{
+    uint8_t bin = 0;
+
+    bin_value >>= LATENCY_BIN0_SHIFT;
+    while ( bin_value && ( bin < ( LATENCY_BINS - 1 ) ) )
+    {
+        bin_value >>= 1;
+        bin++;
+    }
+
+    if ( hist->count < 0xFFFFFFFF )
+        hist->count++;
+    if ( hist->bins[bin] < 0xFFFF )
+        hist->bins[bin]++;
+    if ( value < hist->min )
+        hist->min = value;
+    if ( value > hist->max )
+        hist->max = value;
+    hist->sum += value;
+}
+
+void latency_sample( uint8_t loop )
+{
+    /* Main loop or ISR, when a sample the loop uses is complete. Of several before one output
+     * the first is kept, so the latency is that of the oldest input. */
+    uint32_t now = time_local_us();     // Outside the lock, rio_time takes its own
+    latency_loop_t *lat = &latency_loops[loop];
+
+    LATENCY_PORT_LOCK();
+    if ( !lat->sampled )
+    {
+        lat->sample_us = now;
+        lat->sampled = 1;
+    }
+    LATENCY_PORT_UNLOCK();
+}
+
+void latency_output( uint8_t loop, uint32_t period_us )
+{
+    /* Main loop, once the output is written. <period_us> is the loop's nominal period, for
+     * the jitter. An output with no sample since the last one only counts in the period. */
+    uint32_t now = time_local_us();
+    latency_loop_t *lat = &latency_loops[loop];
+    uint32_t period;
+    uint32_t sample_us;
+    uint8_t sampled;
+
+    LATENCY_PORT_LOCK();
+    sample_us = lat->sample_us;
+    sampled = lat->sampled;
+    lat->sampled = 0;
+    LATENCY_PORT_UNLOCK();
+
+    if ( sampled )
+        latency_hist_add( &lat->latency, now - sample_us, now - sample_us );
+
+    if ( lat->started )
+    {
+        period = now - lat->output_us;
+        latency_hist_add( &lat->period, period, ( period > period_us ) ? ( period - period_us ) : ( period_us - period ) );
+    }
+    lat->output_us = now;
+    lat->period_us = period_us;
+    lat->started = 1;
+}
+
+void latency_report_hist( uint8_t *buf, latency_hist_t *hist )
+{
+    uint32_t min = hist->count ? hist->min : 0;
+    uint32_t mean = hist->count ? (uint32_t)( hist->sum / hist->count ) : 0;
+
+    memcpy( buf, &hist->count, sizeof(uint32_t) );          // Little endian
+    memcpy( buf + 4, &min, sizeof(uint32_t) );
+    memcpy( buf + 8, &hist->max, sizeof(uint32_t) );
+    memcpy( buf + 12, &mean, sizeof(uint32_t) );
+    memcpy( buf + 16, hist->bins, sizeof(hist->bins) );
+}
+
+void latency_report( uint8_t *buf, uint8_t loop, uint8_t reset )
+{
+    /* Main loop. Fills LATENCY_REPORT_SIZE bytes for <loop>, which the caller has checked. The
+     * histograms are only written from the main loop, so need no lock. */
+    latency_loop_t *lat = &latency_loops[loop];
+
+    buf[0] = LATENCY_COUNT;
+    buf[1] = loop;
+    memcpy( &buf[2], &lat->period_us, sizeof(uint32_t) );
+    buf += LATENCY_REPORT_HEADER_SIZE;
+
+    latency_report_hist( buf, &lat->latency );
+    latency_report_hist( buf + LATENCY_REPORT_HIST_SIZE, &lat->period );
+
+    if ( reset )
+        latency_reset( lat );
+}
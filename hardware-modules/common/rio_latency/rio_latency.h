@@ -0,0 +1,64 @@
+/*
+ * File:   rio_latency.h
+ *
+ * Control loop timing shared by the dsPIC Rio modules. For each named loop
+ * the board marks the sensor sample with latency_sample() and the output
+ * write with latency_output(). The module keeps the sample to output
+ * latency, and the output period against the loop's nominal period, as
+ * count, min, max, mean and a log2 histogram in us on the rio_time clock.
+ * Board specifics (loop names, lock) live in each project's latency_port.h.
+ */
+
+#ifndef RIO_LATENCY_H
+#define	RIO_LATENCY_H
+
+#include <stdint.h>
+#include "latency_port.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/* Histogram bins: bin 0 is under LATENCY_BIN0_US, bin b up to LATENCY_BINS - 2 is
+ * [LATENCY_BIN0_US << ( b - 1 ), LATENCY_BIN0_US << b), the last bin everything above */
+#define LATENCY_BINS                    16
+#define LATENCY_BIN0_SHIFT              4
+#define LATENCY_BIN0_US                 ( 1UL << LATENCY_BIN0_SHIFT )
+
+/* Report of one loop: [loops U8][loop U8][nominal period us U32], then the latency and the
+ * period, each [count U32][min us U32][max us U32][mean us U32] + LATENCY_BINS x [count U16].
+ * The period bins hold | period - nominal |, its jitter. */
+#define LATENCY_REPORT_HEADER_SIZE      ( ( 2 * sizeof(uint8_t) ) + sizeof(uint32_t) )
+#define LATENCY_REPORT_HIST_SIZE        ( ( 4 * sizeof(uint32_t) ) + ( LATENCY_BINS * sizeof(uint16_t) ) )
+#define LATENCY_REPORT_SIZE             ( LATENCY_REPORT_HEADER_SIZE + ( 2 * LATENCY_REPORT_HIST_SIZE ) )
+
+typedef struct
+{
+    uint32_t count;                 // Saturating, as the bins
+    uint32_t min;
+    uint32_t max;
+    uint64_t sum;                   // For the mean only
+    uint16_t bins[LATENCY_BINS];
+} latency_hist_t;
+
+typedef struct
+{
+    uint32_t sample_us;             // Oldest sample not yet followed by an output
+    uint32_t output_us;             // Previous output
+    uint32_t period_us;             // Nominal period of the last output
+    uint8_t sampled;
+    uint8_t started;                // output_us is valid
+    latency_hist_t latency;
+    latency_hist_t period;
+} latency_loop_t;
+
+extern void latency_init( void );
+extern void latency_sample( uint8_t loop );
+extern void latency_output( uint8_t loop, uint32_t period_us );
+extern void latency_report( uint8_t *buf, uint8_t loop, uint8_t reset );
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* RIO_LATENCY_H */
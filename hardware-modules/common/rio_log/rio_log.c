@@ -0,0 +1,94 @@
+#include "log_port.h"
+#include <stdio.h>
+#include <string.h>
+#include "rio_log.h"
+
+#define LOG_BUF_SIZE_MASK       ( RIO_LOG_BUF_SIZE - 1 )
+
+#if ( RIO_LOG_BUF_SIZE & LOG_BUF_SIZE_MASK ) || ( RIO_LOG_BUF_SIZE > 128 )
+#error "RIO_LOG_BUF_SIZE must be a power of two, 128 max"
+#endif
+
+#if ( RIO_LOG_LEVEL > RIO_LOG_NONE )
+/* Pushed and drained from the main loop only, so no interrupt masking */
+rio_log_rec_t log_buf[RIO_LOG_BUF_SIZE];
+uint8_t log_buf_head;
+uint8_t log_buf_tail;
+
+/* Line being sent, [line_pos, line_len) still to go */
+char log_line[RIO_LOG_LINE_SIZE];
+uint8_t log_line_pos;
+uint8_t log_line_len;
+#endif
+
+uint16_t rio_log_dropped;
+
+void rio_log_push( uint8_t id, const int32_t *args, uint8_t argc )
+{
+#if ( RIO_LOG_LEVEL > RIO_LOG_NONE )
+    rio_log_rec_t *rec;
+    
+    if ( ( ( log_buf_head - log_buf_tail ) & 0xFF ) >= RIO_LOG_BUF_SIZE )
+    {
+        rio_log_dropped += ( rio_log_dropped != 0xFFFF );
+        return;
+    }
+    
+    if ( argc > RIO_LOG_ARGS )
+        argc = RIO_LOG_ARGS;
+    
+    rec = &log_buf[log_buf_head & LOG_BUF_SIZE_MASK];
+    rec->id = id;
+    rec->argc = argc;
+    memcpy( rec->args, args, argc * sizeof(int32_t) );
+    log_buf_head++;
+#endif
+}
+
+void rio_log_drain( void )
+{
+    /* Called every main loop pass. Formats at most one record, and never waits for the UART. */
+#if ( RIO_LOG_LEVEL > RIO_LOG_NONE )
+    int len;
+    
+    if ( log_line_pos >= log_line_len )
+    {
+        len = 0;
+        
+        if ( rio_log_dropped )
+        {
+            len = snprintf( log_line, sizeof(log_line), "Log dropped %u\n", rio_log_dropped );
+            rio_log_dropped = 0;
+        }
+        else if ( log_buf_head != log_buf_tail )
+        {
+            rio_log_rec_t *rec = &log_buf[log_buf_tail & LOG_BUF_SIZE_MASK];
+            int32_t a[RIO_LOG_ARGS];
+            
+            memset( a, 0, sizeof(a) );
+            memcpy( a, rec->args, rec->argc * sizeof(int32_t) );
+            
+            if ( rec->id < rio_log_format_count )
+                len = snprintf( log_line, sizeof(log_line), rio_log_formats[rec->id], a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7] );
+            
+            log_buf_tail++;
+        }
+        
+        if ( len <= 0 )
+            return;
+        
+        if ( len >= (int)sizeof(log_line) )
+        {
+            /* Truncated, keep the line ending */
+            len = sizeof(log_line) - 1;
+            log_line[len - 1] = '\n';
+        }
+        
+        log_line_len = len;
+        log_line_pos = 0;
+    }
+    
+    while ( ( log_line_pos < log_line_len ) && RIO_LOG_TX_READY() )
+        RIO_LOG_TX( log_line[log_line_pos++] );
+#endif
+}
@@ -0,0 +1,76 @@
+/*
+ * File:   rio_log.h
+ *
+ * Deferred debug log shared by the dsPIC Rio modules. The control loop pushes
+ * fixed size binary records into a RAM ring, and rio_log_drain() formats them
+ * one line at a time into the UART TX queue, only while it has room. Board
+ * specifics (level, ring size, UART access) live in each project's log_port.h.
+ */
+
+#ifndef RIO_LOG_H
+#define	RIO_LOG_H
+
+#include <stdint.h>
+#include "log_port.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/* Log levels. A record is only built into the firmware if its level is <= RIO_LOG_LEVEL. */
+#define RIO_LOG_NONE                    0
+#define RIO_LOG_ERROR                   1
+#define RIO_LOG_INFO                    2
+#define RIO_LOG_DEBUG                   3
+#ifndef RIO_LOG_LEVEL
+#define RIO_LOG_LEVEL                   RIO_LOG_INFO
+#endif
+
+/* Ring size in records, must be a power of two, 128 max */
+#ifndef RIO_LOG_BUF_SIZE
+#define RIO_LOG_BUF_SIZE                16
+#endif
+#define RIO_LOG_ARGS                    8
+#define RIO_LOG_LINE_SIZE               96
+
+typedef struct
+{
+    uint8_t id;                     // Index into rio_log_formats[]
+    uint8_t argc;
+    int32_t args[RIO_LOG_ARGS];
+} rio_log_rec_t;
+
+/* Provided by main.c: one printf format per record id, arguments as %li */
+extern const char * const rio_log_formats[];
+extern const uint8_t rio_log_format_count;
+
+/* Records not pushed because the ring was full, saturating. Reported by rio_log_drain(). */
+extern uint16_t rio_log_dropped;
+
+extern void rio_log_push( uint8_t id, const int32_t *args, uint8_t argc );
+extern void rio_log_drain( void );
+
+/* LOG_xxx( id, args... ): up to RIO_LOG_ARGS integer arguments, nothing at all below the level */
+#define RIO_LOG_PUSH( id, ... )         rio_log_push( (id), (const int32_t[]){ __VA_ARGS__ }, sizeof( (int32_t[]){ __VA_ARGS__ } ) / sizeof( int32_t ) )
+
+#if ( RIO_LOG_LEVEL >= RIO_LOG_ERROR )
+#define LOG_ERROR( id, ... )            RIO_LOG_PUSH( id, __VA_ARGS__ )
+#else
+#define LOG_ERROR( id, ... )
+#endif
+#if ( RIO_LOG_LEVEL >= RIO_LOG_INFO )
+#define LOG_INFO( id, ... )             RIO_LOG_PUSH( id, __VA_ARGS__ )
+#else
+#define LOG_INFO( id, ... )
+#endif
+#if ( RIO_LOG_LEVEL >= RIO_LOG_DEBUG )
+#define LOG_DEBUG( id, ... )            RIO_LOG_PUSH( id, __VA_ARGS__ )
+#else
+#define LOG_DEBUG( id, ... )
+#endif
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* RIO_LOG_H */
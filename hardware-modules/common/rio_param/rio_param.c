@@ -0,0 +1,159 @@
+#include <stdint.h>
+#include <string.h>
+#include "common.h"
+#include "rio_param.h"
+
+const param_desc_t *param_table;
+uint8_t param_count;
+
+const param_desc_t *param_find( uint8_t id );
+int32_t param_read( const param_desc_t *param );
+int32_t param_decode( const param_desc_t *param, uint8_t *ptr );
+void param_encode( uint8_t *ptr, int32_t value );
+
+void param_init( const param_desc_t *table, uint8_t count )
+{
+    param_table = table;
+    param_count = count;
+}
+
+const param_desc_t *param_find( uint8_t id )
+{
+    uint8_t i;
+
+    for ( i=0; i<param_count; i++ )
+    {
+        if ( param_table[i].id == id )
+            return &param_table[i];
+    }
+
+    return NULL;
+}
+
+int32_t param_read( const param_desc_t *param )
+{
+    int32_t value;
+
+    if ( param->get != NULL )
+        value = param->get( param );
+    else if ( param->type == PARAM_TYPE_U8 )
+        value = *(uint8_t *)param->value;
+    else if ( param->type == PARAM_TYPE_U16 )
+        value = *(uint16_t *)param->value;
+    else
+        value = *(int16_t *)param->value;
+
+    return value;
+}
+
+int32_t param_decode( const param_desc_t *param, uint8_t *ptr )
+{
+    uint16_t raw = ( (uint16_t)ptr[1] << 8 ) | ptr[0];
+
+    /* Wire values are 16 bits, the type sets the sign */
+    if ( param->type == PARAM_TYPE_I16 )
+        return (int16_t)raw;
+
+    return raw;
+}
+
+void param_encode( uint8_t *ptr, int32_t value )
+{
+    ptr[0] = (uint8_t)value;
+    ptr[1] = (uint8_t)( value >> 8 );
+}
+
+uint8_t param_list( uint8_t start, uint8_t *buf )
+{
+    /* Fills up to PARAM_LIST_SIZE bytes from table entry <start>, returns the size */
+    uint8_t count = 0;
+    uint8_t *rec = &buf[PARAM_LIST_HEADER_SIZE];
+    const param_desc_t *param;
+
+    while ( ( ( start + count ) < param_count ) && ( count < PARAM_LIST_RECORDS_MAX ) )
+    {
+        param = &param_table[start + count];
+        rec[0] = param->id;
+        rec[1] = param->type;
+        rec[2] = param->flags;
+        param_encode( &rec[3], param->min );
+        param_encode( &rec[5], param->max );
+        rec += PARAM_LIST_RECORD_SIZE;
+        count++;
+    }
+
+    buf[0] = param_count;
+    buf[1] = count;
+
+    return PARAM_LIST_HEADER_SIZE + ( count * PARAM_LIST_RECORD_SIZE );
+}
+
+err param_get_many( uint8_t *ids, uint8_t num, uint8_t *buf )
+{
+    /* Fills num x PARAM_VALUE_RECORD_SIZE bytes */
+    const param_desc_t *param;
+    uint8_t i;
+
+    if ( num > PARAM_MANY_MAX )
+        return ERR_PACKET_INVALID;
+
+    for ( i=0; i<num; i++ )
+    {
+        param = param_find( ids[i] );
+        if ( param == NULL )
+            return ERR_PARAM_UNKNOWN;
+
+        buf[0] = param->id;
+        param_encode( &buf[1], param_read( param ) );
+        buf += PARAM_VALUE_RECORD_SIZE;
+    }
+
+    return ERR_OK;
+}
+
+err param_set_many( uint8_t *data, uint8_t data_size )
+{
+    /* Every record is checked against the table before any is applied, so a bad id or
+     * range changes nothing. A set() hook can still refuse, which stops at that record. */
+    err rc = ERR_OK;
+    const param_desc_t *param;
+    int32_t value;
+    uint8_t num;
+    uint8_t i;
+
+    if ( ( data_size % PARAM_VALUE_RECORD_SIZE ) != 0 )
+        return ERR_PACKET_INVALID;
+    num = data_size / PARAM_VALUE_RECORD_SIZE;
+    if ( num > PARAM_MANY_MAX )
+        return ERR_PACKET_INVALID;
+
+    for ( i=0; i<num; i++ )
+    {
+        param = param_find( data[i * PARAM_VALUE_RECORD_SIZE] );
+        if ( param == NULL )
+            return ERR_PARAM_UNKNOWN;
+        if ( param->flags & PARAM_FLAG_READ_ONLY )
+            return ERR_PARAM_READ_ONLY;
+
+        value = param_decode( param, &data[i * PARAM_VALUE_RECORD_SIZE + 1] );
+        if ( ( value < param->min ) || ( value > param->max ) )
+            return ERR_PARAM_RANGE;
+    }
+
+    for ( i=0; ( i<num ) && ( rc == ERR_OK ); i++ )
+    {
+        param = param_find( data[i * PARAM_VALUE_RECORD_SIZE] );
+        value = param_decode( param, &data[i * PARAM_VALUE_RECORD_SIZE + 1] );
+
+        if ( param->set != NULL )
+            rc = param->set( param, value );
+        else if ( param->type == PARAM_TYPE_U8 )
+            *(uint8_t *)param->value = (uint8_t)value;
+        else if ( param->type == PARAM_TYPE_U16 )
+            *(uint16_t *)param->value = (uint16_t)value;
+        else
+            *(int16_t *)param->value = (int16_t)value;
+    }
+
+    return rc;
+}
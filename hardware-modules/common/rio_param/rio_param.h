@@ -0,0 +1,64 @@
+/*
+ * File:   rio_param.h
+ *
+ * Parameter descriptor table shared by the dsPIC Rio modules. Each board
+ * lists its tunable and persisted parameters once, as a const table of
+ * (id, type, range, value or hooks), and rio_param answers the generic
+ * PARAM_LIST / PARAM_GET_MANY / PARAM_SET_MANY packets from it, so the host
+ * can enumerate, back up and restore a configuration in one or two packets.
+ * Values are 16 bits little endian on the wire, as in the rio_probe report.
+ */
+
+#ifndef RIO_PARAM_H
+#define	RIO_PARAM_H
+
+#include <stdint.h>
+#include "common.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/* Type of the value, *value is read and written with this width */
+#define PARAM_TYPE_U8                   0
+#define PARAM_TYPE_U16                  1
+#define PARAM_TYPE_I16                  2
+
+#define PARAM_FLAG_READ_ONLY            0x01    // Rejected by param_set_many()
+#define PARAM_FLAG_STORED               0x02    // Saved to EEPROM when set
+
+/* PARAM_LIST reply: [total U8][count U8] + count x [id U8][type U8][flags U8][min 16][max 16] */
+#define PARAM_LIST_HEADER_SIZE          2
+#define PARAM_LIST_RECORD_SIZE          7
+#define PARAM_LIST_RECORDS_MAX          16
+#define PARAM_LIST_SIZE                 ( PARAM_LIST_HEADER_SIZE + ( PARAM_LIST_RECORDS_MAX * PARAM_LIST_RECORD_SIZE ) )
+
+/* PARAM_GET_MANY reply and PARAM_SET_MANY data: n x [id U8][value 16] */
+#define PARAM_VALUE_RECORD_SIZE         3
+#define PARAM_MANY_MAX                  24
+
+typedef struct param_desc param_desc_t;
+
+struct param_desc
+{
+    uint8_t id;                     // Unique, sent by the host; need not be contiguous
+    uint8_t type;                   // PARAM_TYPE_*
+    uint8_t flags;                  // PARAM_FLAG_*
+    int32_t min;                    // Inclusive range, checked before set()
+    int32_t max;
+    void *value;                    // Read and written directly when get() / set() are NULL, else theirs to use
+    int32_t (*get)( const param_desc_t *param );
+    err (*set)( const param_desc_t *param, int32_t value );   // Further checks, side effects and saving
+};
+
+extern void param_init( const param_desc_t *table, uint8_t count );
+
+extern uint8_t param_list( uint8_t start, uint8_t *buf );
+extern err param_get_many( uint8_t *ids, uint8_t num, uint8_t *buf );
+extern err param_set_many( uint8_t *data, uint8_t data_size );
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* RIO_PARAM_H */
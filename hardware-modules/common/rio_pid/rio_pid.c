@@ -0,0 +1,28 @@
+#include <stdint.h>
+#include "rio_pid.h"
+
+void pid_reset( pid_state_t *st, int16_t actual )
+{
+    /* Starting from the present measurement, so the first D term is 0 */
+    st->integrated = 0;
+    st->diff = 0;
+    st->p_term = 0;
+    st->actual_prev = actual;
+}
+
+int32_t pid_back_calculate( const pid_config_t *cfg, pid_state_t *st, int32_t output, uint8_t shift )
+{
+    /* Output outside out_min..out_max: the excess, << <shift> to integrator units, comes out
+     * of the integrator. Only as far as 0, so a saturating P or D term never winds it the
+     * other way. Returns the limited output. */
+    int32_t limited = PID_CONSTRAIN( output, cfg->out_min, cfg->out_max );
+    int32_t excess = output - limited;
+    int32_t unwind = st->integrated >> shift;
+
+    if ( ( excess > 0 ) && ( st->integrated > 0 ) )
+        st->integrated = ( excess < unwind ) ? st->integrated - ( excess << shift ) : 0;
+    else if ( ( excess < 0 ) && ( st->integrated < 0 ) )
+        st->integrated = ( excess > unwind ) ? st->integrated - ( excess << shift ) : 0;
+
+    return limited;
+}
@@ -0,0 +1,98 @@
+/*
+ * File:   rio_pid.h
+ *
+ * Fixed-point PID shared by the dsPIC Rio control loops. A loop is a
+ * pid_config_t of gains and limits and a pid_state_t, stepped by a function
+ * made with PID_STEP_DEFINE() so its shifts are compile-time constants. The
+ * D term acts on the measurement, and an output past its limits is taken back
+ * out of the integrator (back-calculation).
+ */
+
+#ifndef RIO_PID_H
+#define	RIO_PID_H
+
+#include <stdint.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/* I16 x U16 -> I32 in one MUL.SU on the dsPIC, instead of the 32 x 32 library multiply */
+#ifdef __XC16__
+#define PID_MUL( a, b )                 __builtin_mulsu( (int16_t)(a), (uint16_t)(b) )
+#else
+#define PID_MUL( a, b )                 ( (int32_t)(int16_t)(a) * (uint16_t)(b) )
+#endif
+
+#define PID_CONSTRAIN( v, lo, hi )      ( ( (v) < (lo) ) ? (lo) : ( ( (v) > (hi) ) ? (hi) : (v) ) )
+
+typedef struct
+{
+    uint16_t kp;
+    uint16_t ki;
+    uint16_t kd;
+    int32_t p_limit;                // |P term|, after P_SHR
+    int32_t d_limit;                // |D term| before the filter, << D_FILT_SHIFT must fit I32
+    int32_t i_change_limit;         // |Integrator change| per step
+    int32_t i_min;                  // Integrator range, << I_SHR of the P term
+    int32_t i_max;
+    int32_t out_min;                // Output range, back-calculated into the integrator
+    int32_t out_max;
+} pid_config_t;
+
+typedef struct
+{
+    int32_t integrated;
+    int32_t diff;                   // Filtered D term
+    int32_t p_term;                 // Of the last step
+    int16_t actual_prev;
+} pid_state_t;
+
+/*
+ * Defines int32_t name( cfg, st, error, error_p, actual, bias ), one step of a loop:
+ *
+ *   P = error_p * kp >> P_SHR
+ *   I += error * ki, in units of P << I_SHR
+ *   D = ( actual_prev - actual ) * kd << D_SHL, low pass filtered by D_FILT_SHIFT
+ *   output = ( ( P + I >> I_SHR + D ) >> OUT_SHR ) + bias, within out_min..out_max
+ *
+ * error and error_p are the same unless P sees a weighted setpoint. Each product is
+ * I16 x U16, so it fits I32 without a clamp.
+ */
+#define PID_STEP_DEFINE( name, P_SHR, I_SHR, D_SHL, OUT_SHR, D_FILT_SHIFT )                                     \
+int32_t name( const pid_config_t *cfg, pid_state_t *st, int16_t error, int16_t error_p, int16_t actual, int32_t bias ) \
+{                                                                                                               \
+    int32_t term;                                                                                               \
+    int32_t output;                                                                                             \
+                                                                                                                \
+    term = PID_MUL( error_p, cfg->kp ) >> (P_SHR);                                                              \
+    st->p_term = PID_CONSTRAIN( term, -cfg->p_limit, cfg->p_limit );                                            \
+                                                                                                                \
+    term = PID_MUL( error, cfg->ki );                                                                           \
+    st->integrated += PID_CONSTRAIN( term, -cfg->i_change_limit, cfg->i_change_limit );                         \
+    st->integrated = PID_CONSTRAIN( st->integrated, cfg->i_min, cfg->i_max );                                   \
+                                                                                                                \
+    term = (int32_t)st->actual_prev - actual;                                                                   \
+    term = PID_MUL( PID_CONSTRAIN( term, INT16_MIN, INT16_MAX ), cfg->kd );                                     \
+    term = PID_CONSTRAIN( term, -( cfg->d_limit >> (D_SHL) ), cfg->d_limit >> (D_SHL) ) << (D_SHL);            \
+    st->diff = ( ( st->diff * ( ( 1 << (D_FILT_SHIFT) ) - 1 ) ) + term ) >> (D_FILT_SHIFT);                     \
+    st->actual_prev = actual;                                                                                   \
+                                                                                                                \
+    output = ( ( st->p_term + ( st->integrated >> (I_SHR) ) + st->diff ) >> (OUT_SHR) ) + bias;                 \
+    if ( ( output < cfg->out_min ) || ( output > cfg->out_max ) )                                               \
+        output = pid_back_calculate( cfg, st, output, (I_SHR) + (OUT_SHR) );                                    \
+                                                                                                                \
+    return output;                                                                                              \
+}
+
+#define PID_STEP_DECLARE( name ) \
+int32_t name( const pid_config_t *cfg, pid_state_t *st, int16_t error, int16_t error_p, int16_t actual, int32_t bias )
+
+void pid_reset( pid_state_t *st, int16_t actual );
+int32_t pid_back_calculate( const pid_config_t *cfg, pid_state_t *st, int32_t output, uint8_t shift );
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* RIO_PID_H */
@@ -0,0 +1,198 @@
+#include "probe_port.h"
+#include <string.h>
+#include "rio_probe.h"
+
+#if defined( PROBE_TRACE_PINS ) && ( PROBE_TRACE_PINS > 0 )
+
+#if ( PROBE_TRACE_PINS > PROBE_TRACE_PINS_MAX ) || ( TRACE_COUNT > PROBE_TRACE_REGIONS_MAX )
+#error "probe_port.h: too many trace pins or regions"
+#endif
+
+/* Written by the main loop through probe_trace_select(), read by the markers in interrupts */
+volatile uint16_t probe_trace_mask[PROBE_TRACE_PINS];
+
+void probe_trace_init( void )
+{
+    uint8_t pin;
+    
+    PROBE_PORT_TRACE_INIT();
+    for ( pin=0; pin<PROBE_TRACE_PINS; pin++ )
+        probe_trace_select( pin, ( pin == 0 ) ? PROBE_TRACE_MASK_DEFAULT : 0 );
+}
+
+void probe_trace_select( uint8_t pin, uint16_t mask )
+{
+    /* Starts the pin low, a region it was high over may not end while deselected */
+    PROBE_PORT_LOCK();
+    probe_trace_mask[pin] = mask;
+    if ( pin == 0 )
+        PROBE_PORT_TRACE( 0, 0 )
+#if PROBE_TRACE_PINS > 1
+    else
+        PROBE_PORT_TRACE( 1, 0 )
+#endif
+    PROBE_PORT_UNLOCK();
+}
+
+#endif
+
+#ifdef PROBE_ENABLED
+
+/* Sum is for the mean only. Halving sum and count together before count
+ * overflows keeps the mean while ( 0xFFFF * 0xFFFF ) still fits in 32 bits.
+ */
+probe_stats_t probe_stats[PROBE_COUNT];
+uint16_t probe_start_ticks[PROBE_COUNT];
+
+/* CPU load: main loop passes in a window against the shortest pass, an idle one. A pass with
+ * work or interrupts in it takes longer, so there are fewer passes than fit in the window. */
+probe_load_t probe_load;
+volatile uint8_t probe_isr_depth;
+volatile uint16_t probe_isr_start;
+
+void probe_reset( void );
+
+void probe_init( void )
+{
+    PROBE_PORT_INIT();
+    memset( &probe_load, 0, sizeof(probe_load) );
+    probe_load.idle = 0xFFFF;
+    probe_isr_depth = 0;
+    probe_reset();
+}
+
+void probe_reset( void )
+{
+    uint8_t probe;
+    
+    memset( probe_stats, 0, sizeof(probe_stats) );
+    
+    for ( probe=0; probe<PROBE_COUNT; probe++ )
+        probe_stats[probe].min = 0xFFFF;
+    
+    probe_load.pass_max = 0;
+    probe_load.isr_max = 0;
+    probe_load.peak_permille = 0;
+}
+
+void probe_record( uint8_t probe, uint16_t ticks )
+{
+    probe_stats_t *stats = &probe_stats[probe];
+    
+    if ( stats->count < 0xFFFFFFFF )
+        stats->count++;
+    
+    if ( ticks < stats->min )
+        stats->min = ticks;
+    if ( ticks > stats->max )
+        stats->max = ticks;
+    
+    if ( stats->sum_count == 0xFFFF )
+    {
+        stats->sum >>= 1;
+        stats->sum_count >>= 1;
+    }
+    stats->sum += ticks;
+    stats->sum_count++;
+}
+
+void probe_pass( void )
+{
+    /* From the main loop, once per pass. A pass must be shorter than one timer wrap. */
+    uint16_t now = PROBE_PORT_NOW();
+    uint16_t ticks = now - probe_load.last;
+    uint32_t idle;
+    uint32_t isr;
+    
+    probe_load.last = now;
+    if ( !probe_load.started )
+    {
+        /* Start-up before the first pass is not a pass */
+        probe_load.started = 1;
+        return;
+    }
+    
+    if ( ticks < probe_load.idle )
+        probe_load.idle = ticks;
+    if ( ticks > probe_load.pass_max )
+        probe_load.pass_max = ticks;
+    probe_load.window += ticks;
+    probe_load.passes++;
+    
+    if ( probe_load.window < PROBE_LOAD_WINDOW_TICKS )
+        return;
+    
+    PROBE_PORT_LOCK();
+    isr = probe_load.isr;
+    probe_load.isr = 0;
+    PROBE_PORT_UNLOCK();
+    
+    /* The passes as if all were idle, at most the window */
+    idle = (uint32_t)probe_load.idle * probe_load.passes;
+    if ( idle > probe_load.window )
+        idle = probe_load.window;
+    if ( isr > probe_load.window )
+        isr = probe_load.window;
+    
+    probe_load.permille = 1000 - (uint16_t)( ( idle * 1000 ) / probe_load.window );
+    probe_load.isr_permille = ( isr * 1000 ) / probe_load.window;
+    if ( probe_load.permille > probe_load.peak_permille )
+        probe_load.peak_permille = probe_load.permille;
+    probe_load.window_passes = probe_load.passes;
+    probe_load.window = 0;
+    probe_load.passes = 0;
+}
+
+void probe_isr_record( uint16_t ticks )
+{
+    /* From PROBE_ISR_EXIT() of the outermost interrupt */
+    probe_load.isr += ticks;
+    if ( ticks > probe_load.isr_max )
+        probe_load.isr_max = ticks;
+}
+
+void probe_report( uint8_t *buf, uint8_t reset )
+{
+    /* Fills PROBE_REPORT_SIZE bytes. Probes may run in interrupts, so copy them out in one go. */
+    probe_stats_t stats[PROBE_COUNT];
+    probe_load_t load;
+    uint32_t timer_hz = PROBE_PORT_TIMER_HZ;
+    uint16_t mean;
+    uint8_t probe;
+    
+    PROBE_PORT_LOCK();
+    memcpy( stats, probe_stats, sizeof(stats) );
+    load = probe_load;
+    if ( reset )
+        probe_reset();
+    PROBE_PORT_UNLOCK();
+    
+    memcpy( buf, &timer_hz, sizeof(timer_hz) );
+    buf += sizeof(timer_hz);
+    *buf++ = PROBE_COUNT;
+    
+    for ( probe=0; probe<PROBE_COUNT; probe++ )
+    {
+        if ( stats[probe].count == 0 )
+            stats[probe].min = 0;
+        mean = stats[probe].sum_count ? ( stats[probe].sum / stats[probe].sum_count ) : 0;
+        
+        memcpy( buf, &stats[probe].count, sizeof(uint32_t) );
+        memcpy( buf + 4, &stats[probe].min, sizeof(uint16_t) );
+        memcpy( buf + 6, &stats[probe].max, sizeof(uint16_t) );
+        memcpy( buf + 8, &mean, sizeof(uint16_t) );
+        buf += PROBE_REPORT_RECORD_SIZE;
+    }
+    
+    if ( load.idle == 0xFFFF )
+        load.idle = 0;
+    memcpy( buf, &load.permille, sizeof(uint16_t) );
+    memcpy( buf + 2, &load.peak_permille, sizeof(uint16_t) );
+    memcpy( buf + 4, &load.isr_permille, sizeof(uint16_t) );
+    memcpy( buf + 6, &load.isr_max, sizeof(uint16_t) );
+    memcpy( buf + 8, &load.idle, sizeof(uint16_t) );
+    memcpy( buf + 10, &load.pass_max, sizeof(uint16_t) );
+    memcpy( buf + 12, &load.window_passes, sizeof(uint32_t) );
+}
+
+#endif
@@ -0,0 +1,122 @@
+/*
+ * File:   rio_probe.h
+ *
+ * Execution time probes shared by the dsPIC Rio modules. Each named probe
+ * times the code between PROBE_BEGIN() and PROBE_END() on a free running
+ * hardware timer and keeps its count, min, max and mean. PROBE_PASS() and
+ * PROBE_ISR_ENTER()/PROBE_ISR_EXIT() add the CPU load and interrupt time.
+ * TRACE_BEGIN()/TRACE_END() drive a spare pin over a named region instead,
+ * for a logic analyzer, on the regions selected in probe_trace_mask[].
+ * Board specifics (probe and trace names, timer, pins) live in each
+ * project's probe_port.h. Without PROBE_ENABLED the probe macros, state and
+ * report are all built out, and without PROBE_TRACE_PINS the trace markers.
+ */
+
+#ifndef RIO_PROBE_H
+#define	RIO_PROBE_H
+
+#include <stdint.h>
+#include "probe_port.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/* Report: [timer hz U32][probes U8] + probes x [count U32][min U16][max U16][mean U16], in timer ticks */
+#define PROBE_REPORT_HEADER_SIZE        ( sizeof(uint32_t) + sizeof(uint8_t) )
+#define PROBE_REPORT_RECORD_SIZE        ( sizeof(uint32_t) + ( 3 * sizeof(uint16_t) ) )
+
+/* Then the load: [load permille U16][load peak permille U16][isr permille U16][isr max U16]
+ * [idle pass U16][pass max U16][passes U32], permille and passes over the last load window */
+#define PROBE_LOAD_REPORT_SIZE          ( ( 6 * sizeof(uint16_t) ) + sizeof(uint32_t) )
+#define PROBE_LOAD_WINDOW_TICKS         PROBE_PORT_TIMER_HZ     // 1 s
+
+#ifdef PROBE_ENABLED
+#define PROBE_REPORT_SIZE               ( PROBE_REPORT_HEADER_SIZE + ( PROBE_COUNT * PROBE_REPORT_RECORD_SIZE ) + PROBE_LOAD_REPORT_SIZE )
+
+typedef struct
+{
+    uint32_t count;                 // Saturating
+    uint32_t sum;                   // For the mean only, halved with sum_count
+    uint16_t sum_count;
+    uint16_t min;
+    uint16_t max;
+} probe_stats_t;
+
+typedef struct
+{
+    uint16_t last;                  // Timer at the previous pass
+    uint16_t idle;                  // Shortest pass, the calibrated idle pass. Kept by the reset.
+    uint16_t pass_max;
+    uint16_t isr_max;
+    uint32_t window;                // Ticks, passes and outermost interrupt ticks in the window so far
+    uint32_t passes;
+    uint32_t isr;
+    uint32_t window_passes;         // Last complete window
+    uint16_t permille;
+    uint16_t isr_permille;
+    uint16_t peak_permille;
+    uint8_t started;
+} probe_load_t;
+
+extern uint16_t probe_start_ticks[PROBE_COUNT];
+extern volatile uint8_t probe_isr_depth;
+extern volatile uint16_t probe_isr_start;
+
+extern void probe_init( void );
+extern void probe_record( uint8_t probe, uint16_t ticks );
+extern void probe_pass( void );
+extern void probe_isr_record( uint16_t ticks );
+extern void probe_report( uint8_t *buf, uint8_t reset );
+
+/* A probe must begin and end in the same context (main loop or one ISR) */
+#define PROBE_BEGIN( probe )            { probe_start_ticks[probe] = PROBE_PORT_NOW(); }
+#define PROBE_END( probe )              probe_record( (probe), (uint16_t)( PROBE_PORT_NOW() - probe_start_ticks[probe] ) )
+
+/* Once per main loop pass */
+#define PROBE_PASS()                    probe_pass()
+
+/* First and last thing in an interrupt handler. Only the outermost of nested handlers is timed,
+ * so the time is all of them together. */
+#define PROBE_ISR_ENTER()               { if ( probe_isr_depth++ == 0 ) probe_isr_start = PROBE_PORT_NOW(); }
+#define PROBE_ISR_EXIT()                { if ( --probe_isr_depth == 0 ) probe_isr_record( (uint16_t)( PROBE_PORT_NOW() - probe_isr_start ) ); }
+#else
+#define PROBE_REPORT_SIZE               PROBE_REPORT_HEADER_SIZE
+
+#define PROBE_BEGIN( probe )
+#define PROBE_END( probe )
+#define PROBE_PASS()
+#define PROBE_ISR_ENTER()
+#define PROBE_ISR_EXIT()
+#endif
+
+/* Trace markers: each pin is high over the regions set in its mask. Regions nest only across
+ * pins, a region inside another on the same pin ends it early. A pin costs a load and a test
+ * per marker while its mask is clear. */
+#define PROBE_TRACE_PINS_MAX            2
+#define PROBE_TRACE_REGIONS_MAX         16      // Bits of a mask
+
+#if defined( PROBE_TRACE_PINS ) && ( PROBE_TRACE_PINS > 0 )
+extern volatile uint16_t probe_trace_mask[PROBE_TRACE_PINS];
+
+extern void probe_trace_init( void );
+extern void probe_trace_select( uint8_t pin, uint16_t mask );
+
+#define PROBE_TRACE_PIN( pin, region, on )  { if ( probe_trace_mask[pin] & ( 1U << (region) ) ) PROBE_PORT_TRACE( pin, on ); }
+#if PROBE_TRACE_PINS > 1
+#define TRACE_BEGIN( region )           { PROBE_TRACE_PIN( 0, region, 1 ); PROBE_TRACE_PIN( 1, region, 1 ); }
+#define TRACE_END( region )             { PROBE_TRACE_PIN( 0, region, 0 ); PROBE_TRACE_PIN( 1, region, 0 ); }
+#else
+#define TRACE_BEGIN( region )           PROBE_TRACE_PIN( 0, region, 1 )
+#define TRACE_END( region )             PROBE_TRACE_PIN( 0, region, 0 )
+#endif
+#else
+#define TRACE_BEGIN( region )
+#define TRACE_END( region )
+#endif
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* RIO_PROBE_H */
@@ -0,0 +1,214 @@
+#!/usr/bin/env python3
+"""
+Generate a board's packet types and packed layouts from its protocol.json.
+
+Writes the firmware header, packed C structs the handlers fill in place of byte copy
+loops, and the host module, the same layouts as drivers/packet_layout.py PacketLayouts
+and the packet types as a class the driver inherits. Both paths are relative to the
+definition. --check writes nothing and fails if either is out of date.
+
+    common/rio_protocol/gen_protocol.py [--check] <board>/protocol.json
+"""
+import json
+import os
+import sys
+
+C_TYPES = {"u8": "uint8_t", "i8": "int8_t", "u16": "uint16_t", "i16": "int16_t",
+           "u32": "uint32_t", "i32": "int32_t"}
+SIZES = {"u8": 1, "i8": 1, "u16": 2, "i16": 2, "u32": 4, "i32": 4}
+
+C_HEADER = """/*
+ * File:   {header}
+ *
+ * Generated by common/rio_protocol/gen_protocol.py from protocol.json, edit that and
+ * run it again. Packet types and the packed layouts of the replies and records, little
+ * endian as the dsPIC stores them, N x fields once per channel, {channels}.
+ */
+
+#ifndef {guard}
+#define	{guard}
+
+#include <stdint.h>
+#include "board_config.h"
+
+#ifdef	__cplusplus
+extern "C" {{
+#endif
+"""
+
+C_FOOTER = """#ifdef	__cplusplus
+}}
+#endif
+
+#endif	/* {guard} */
+"""
+
+PY_HEADER = '''"""
+Generated by hardware-modules/common/rio_protocol/gen_protocol.py from
+{source}, edit that
+and run it again. Packet types and reply layouts of the {board} firmware,
+see drivers/packet_layout.py.
+"""
+
+from drivers.packet_layout import PacketLayout
+
+'''
+
+
+def field_count(field):
+    """1, "N" or ("N", k) of a [name, type, count...] field"""
+    if len(field) == 2:
+        return 1
+    if len(field) == 3:
+        return field[2]
+    return (field[2], field[3])
+
+
+def c_member(field, channels):
+    name, type_ = field[0], field[1]
+    count = field_count(field)
+    dims = ""
+    if count == "N" or isinstance(count, tuple):
+        dims = "[%s]" % channels
+    if isinstance(count, tuple):
+        dims += "[%d]" % count[1]
+    elif isinstance(count, int) and count > 1:
+        dims = "[%d]" % count
+    return "    %s %s%s;" % (C_TYPES[type_], name, dims)
+
+
+def layout_sizes(layout):
+    """Bytes of the layout as (fixed, per channel)"""
+    fixed = 0
+    per_channel = 0
+    for field in layout["fields"]:
+        count = field_count(field)
+        if count == "N":
+            per_channel += SIZES[field[1]]
+        elif isinstance(count, tuple):
+            per_channel += SIZES[field[1]] * count[1]
+        else:
+            fixed += SIZES[field[1]] * count
+    per_channel += sum(SIZES[type_] for _, type_ in layout.get("channel", []))
+    return fixed, per_channel
+
+
+def c_source(spec):
+    header = spec["c_header"]
+    guard = header.upper().replace(".", "_")
+    channels = spec["channels"]
+    lines = [C_HEADER.format(header=header, guard=guard, channels=channels)]
+
+    lines.append("/* Packet types */")
+    for packet in spec["packets"]:
+        define = "#define PACKET_TYPE_%s" % packet["name"]
+        define = "%-44s%d" % (define + " ", packet["type"])
+        if packet.get("board_sent"):
+            define += "  // Pushed by the firmware, never sent by the host"
+        lines.append(define)
+    lines.append("")
+
+    for layout in spec["layouts"]:
+        name = layout["name"]
+        lines.append("/* %s */" % layout["doc"])
+        if layout.get("channel"):
+            lines.append("typedef struct __attribute__((packed))")
+            lines.append("{")
+            lines.extend(c_member(field, channels) for field in layout["channel"])
+            lines.append("} pkt_%s_chan_t;" % name)
+            lines.append("")
+        lines.append("typedef struct __attribute__((packed))")
+        lines.append("{")
+        lines.extend(c_member(field, channels) for field in layout["fields"])
+        if layout.get("channel"):
+            lines.append("    pkt_%s_chan_t chan[%s];" % (name, channels))
+        lines.append("} pkt_%s_t;" % name)
+        lines.append("")
+
+    lines.append("/* Sizes, as the host decodes them */")
+    for layout in spec["layouts"]:
+        fixed, per_channel = layout_sizes(layout)
+        size = "( %d + ( %s * %d ) )" % (fixed, channels, per_channel)
+        lines.append("typedef char pkt_%s_size_check[ ( sizeof(pkt_%s_t) == %s ) ? 1 : -1 ];"
+                     % (layout["name"], layout["name"], size))
+    lines.append("")
+
+    lines.append(C_FOOTER.format(guard=guard))
+    return "\n".join(lines)
+
+
+def py_field(field):
+    count = field_count(field)
+    if isinstance(count, tuple):
+        count = '("%s", %d)' % count
+    elif count == "N":
+        count = '"N"'
+    return '("%s", "%s", %s)' % (field[0], field[1], count)
+
+
+def py_source(spec, source):
+    lines = [PY_HEADER.format(source=source, board=spec["board"])]
+
+    lines.append("class %s:" % spec["python_class"])
+    for packet in spec["packets"]:
+        comment = "  # Pushed by the firmware" if packet.get("board_sent") else ""
+        lines.append("    PACKET_TYPE_%s = %d%s" % (packet["name"], packet["type"], comment))
+    lines.append("")
+
+    for layout in spec["layouts"]:
+        lines.append("")
+        lines.append("# %s" % layout["doc"])
+        lines.append("%s = PacketLayout(" % layout["name"].upper())
+        lines.append('    "%s",' % layout["name"])
+        lines.append("    [")
+        lines.extend("        %s," % py_field(field) for field in layout["fields"])
+        lines.append("    ],")
+        if layout.get("channel"):
+            lines.append("    channel=[")
+            lines.extend('        ("%s", "%s"),' % tuple(field) for field in layout["channel"])
+            lines.append("    ],")
+        lines.append(")")
+    lines.append("")
+    return "\n".join(lines)
+
+
+def main():
+    args = sys.argv[1:]
+    check = "--check" in args
+    args = [arg for arg in args if arg != "--check"]
+    if len(args) != 1:
+        sys.exit(__doc__)
+    definition = args[0]
+    base = os.path.dirname(os.path.abspath(definition))
+    with open(definition) as f:
+        spec = json.load(f)
+
+    source = "hardware-modules/%s/protocol.json" % os.path.relpath(
+        base, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "..")
+    ).replace(os.sep, "/")
+    outputs = [
+        (os.path.join(base, spec["c_header"]), c_source(spec)),
+        (os.path.normpath(os.path.join(base, spec["python_module"])), py_source(spec, source)),
+    ]
+
+    stale = []
+    for path, text in outputs:
+        try:
+            with open(path) as f:
+                current = f.read()
+        except FileNotFoundError:
+            current = None
+        if current == text:
+            continue
+        stale.append(path)
+        if not check:
+            with open(path, "w") as f:
+                f.write(text)
+    if check and stale:
+        sys.exit("Out of date, run gen_protocol.py %s: %s" % (definition, ", ".join(stale)))
+    for path in stale:
+        print("Wrote %s" % path)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,162 @@
+#include <stdint.h>
+#include <string.h>
+#include "common.h"
+#include "rio_time.h"
+#include "rio_report.h"
+
+typedef struct
+{
+    int16_t last;                   // Value last sent
+    int16_t value;                  // Value in the REPORT being queued
+    uint16_t deadband;
+    uint16_t interval_ms;           // 0 -> never on the interval alone
+    uint32_t sent_us;               // Local clock, a SYNC_TIME step does not move it
+    uint8_t on;
+    uint8_t force;                  // Send at the next poll, the host has no value yet
+    uint8_t due;                    // In the REPORT being queued
+} report_signal_t;
+
+report_signal_t report_signals[REPORT_SIGNALS_MAX];
+uint8_t report_count;               // Signals the board offers
+uint8_t report_subscribed;
+uint16_t report_sent;
+uint16_t report_dropped;            // Write ring full, the signals are sent at a later poll
+uint32_t report_poll_us;
+
+void report_init( uint8_t count )
+{
+    memset( report_signals, 0, sizeof(report_signals) );
+    report_count = ( count < REPORT_SIGNALS_MAX ) ? count : REPORT_SIGNALS_MAX;
+    report_subscribed = 0;
+    report_sent = 0;
+    report_dropped = 0;
+}
+
+err report_subscribe( uint8_t *data, uint8_t data_size )
+{
+    /* Main loop only. Data as SUBSCRIBE, all checked before any is applied. */
+    report_signal_t *signal;
+    uint8_t offset;
+    uint8_t index;
+
+    if ( data_size == 0 )
+        return ERR_OK;
+
+    if ( data_size == 1 )
+    {
+        if ( data[0] != REPORT_CANCEL )
+            return ERR_PACKET_INVALID;
+        for ( index=0; index<report_count; index++ )
+            report_signals[index].on = 0;
+        report_subscribed = 0;
+        return ERR_OK;
+    }
+
+    if ( ( data_size % REPORT_SUBSCRIBE_SIZE ) != 0 )
+        return ERR_PACKET_INVALID;
+    for ( offset=0; offset<data_size; offset+=REPORT_SUBSCRIBE_SIZE )
+    {
+        if ( data[offset] >= report_count )
+            return ERR_PACKET_INVALID;
+    }
+
+    for ( offset=0; offset<data_size; offset+=REPORT_SUBSCRIBE_SIZE )
+    {
+        signal = &report_signals[data[offset]];
+        memcpy( &signal->deadband, &data[offset + 1], sizeof(uint16_t) );      // Little endian
+        memcpy( &signal->interval_ms, &data[offset + 3], sizeof(uint16_t) );
+        signal->on = ( signal->deadband != REPORT_DEADBAND_OFF ) || ( signal->interval_ms != 0 );
+        signal->force = signal->on;
+    }
+
+    report_subscribed = 0;
+    for ( index=0; index<report_count; index++ )
+        report_subscribed += report_signals[index].on;
+
+    return ERR_OK;
+}
+
+uint8_t report_active( void )
+{
+    return report_subscribed != 0;
+}
+
+uint8_t report_poll( const int16_t *values, uint8_t *buf )
+{
+    /* Main loop, once per control cycle, with one value per signal the board offers. Fills
+     * buf with the REPORT of the signals due, REPORT_SIZE_MAX( count ) at most, and returns its
+     * size, 0 when none is. The board then calls report_done(). */
+    report_signal_t *signal;
+    uint32_t now_us;
+    int32_t change;
+    uint8_t size = REPORT_HEADER_SIZE;
+    uint8_t index;
+
+    if ( report_subscribed == 0 )
+        return 0;
+
+    report_poll_us = time_local_us();
+    for ( index=0; index<report_count; index++ )
+    {
+        signal = &report_signals[index];
+        if ( !signal->on )
+            continue;
+
+        change = (int32_t)values[index] - signal->last;
+        if ( change < 0 )
+            change = -change;
+        signal->due = signal->force ||
+                      ( ( signal->deadband != REPORT_DEADBAND_OFF ) && ( change > signal->deadband ) ) ||
+                      ( ( signal->interval_ms != 0 ) &&
+                        ( ( report_poll_us - signal->sent_us ) >= ( signal->interval_ms * 1000UL ) ) );
+        if ( !signal->due )
+            continue;
+
+        signal->value = values[index];
+        buf[size] = index;
+        memcpy( &buf[size + 1], &signal->value, sizeof(int16_t) );
+        size += REPORT_ENTRY_SIZE;
+    }
+
+    if ( size == REPORT_HEADER_SIZE )
+        return 0;
+
+    now_us = time_now_us();
+    memcpy( buf, &now_us, sizeof(uint32_t) );
+    return size;
+}
+
+void report_done( uint8_t sent )
+{
+    /* After a report_poll() that returned a REPORT. Unsent, its signals stay due and go in a
+     * later one, against the value the host last got. */
+    report_signal_t *signal;
+    uint8_t index;
+
+    if ( sent )
+        report_sent += ( report_sent != 0xFFFF );
+    else
+        report_dropped += ( report_dropped != 0xFFFF );
+
+    for ( index=0; index<report_count; index++ )
+    {
+        signal = &report_signals[index];
+        if ( !signal->due )
+            continue;
+        signal->due = 0;
+        if ( sent )
+        {
+            signal->last = signal->value;
+            signal->sent_us = report_poll_us;
+            signal->force = 0;
+        }
+    }
+}
+
+void report_status( uint8_t *buf )
+{
+    /* Fills REPORT_STATUS_SIZE bytes */
+    buf[0] = report_subscribed;
+    memcpy( &buf[1], &report_sent, sizeof(uint16_t) );
+    memcpy( &buf[3], &report_dropped, sizeof(uint16_t) );
+}
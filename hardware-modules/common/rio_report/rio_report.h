@@ -0,0 +1,50 @@
+/*
+ * File:   rio_report.h
+ *
+ * Report by exception, shared by the dsPIC Rio modules. The host subscribes
+ * to some of a board's signals, each with a deadband and a maximum interval.
+ * Once per control cycle the board hands report_poll() the present values,
+ * and a REPORT packet is queued only for the signals that moved past their
+ * deadband since they were last sent, or were not sent for their interval.
+ * In a steady state nothing is queued, so the host has nothing to read and,
+ * with the data-ready line, is not woken either.
+ */
+
+#ifndef RIO_REPORT_H
+#define	RIO_REPORT_H
+
+#include <stdint.h>
+#include "common.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#define REPORT_SIGNALS_MAX              16      // Signals a board may offer
+
+/* SUBSCRIBE data: none reads the status, [REPORT_CANCEL] drops every subscription, else
+ * n x [signal U8][deadband U16][max interval ms U16], little endian */
+#define REPORT_CANCEL                   0xFF
+#define REPORT_SUBSCRIBE_SIZE           ( sizeof(uint8_t) + ( 2 * sizeof(uint16_t) ) )
+#define REPORT_DEADBAND_OFF             0xFFFF  // Sent on the interval only, with 0 unsubscribes
+
+/* REPORT: [time us U32] then n x [signal U8][value I16], little endian */
+#define REPORT_HEADER_SIZE              sizeof(uint32_t)
+#define REPORT_ENTRY_SIZE               ( sizeof(uint8_t) + sizeof(int16_t) )
+#define REPORT_SIZE_MAX( n )            ( REPORT_HEADER_SIZE + ( (n) * REPORT_ENTRY_SIZE ) )
+
+/* Status: [subscribed U8][reports U16][dropped U16], little endian */
+#define REPORT_STATUS_SIZE              ( sizeof(uint8_t) + ( 2 * sizeof(uint16_t) ) )
+
+extern void report_init( uint8_t count );
+extern err report_subscribe( uint8_t *data, uint8_t data_size );
+extern uint8_t report_active( void );
+extern uint8_t report_poll( const int16_t *values, uint8_t *buf );
+extern void report_done( uint8_t sent );
+extern void report_status( uint8_t *buf );
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* RIO_REPORT_H */
@@ -0,0 +1,1304 @@
+#include "spi_port.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "rio_spi.h"
+
+#define READ_BUF_SIZE           SPI_READ_BUF_SIZE
+#define READ_BUF_SIZE_MASK      ( READ_BUF_SIZE - 1 )
+#define WRITE_BUF_SIZE          SPI_WRITE_BUF_SIZE
+#define WRITE_BUF_SIZE_MASK     ( WRITE_BUF_SIZE - 1 )
+
+#if ( READ_BUF_SIZE & READ_BUF_SIZE_MASK ) || ( READ_BUF_SIZE > 256 )
+#error "SPI_READ_BUF_SIZE must be a power of two, 256 max"
+#endif
+#if ( WRITE_BUF_SIZE & WRITE_BUF_SIZE_MASK ) || ( WRITE_BUF_SIZE > 256 )
+#error "SPI_WRITE_BUF_SIZE must be a power of two, 256 max"
+#endif
+#if ( SPI_PACKET_BUF_SIZE > 255 )
+#error "SPI_PACKET_BUF_SIZE must fit the U8 packet size"
+#endif
+#if defined( SPI_BATCH_SUPPORTED ) && ( ( SPI_BATCH_BUF_SIZE > 251 ) || !defined( SPI_WRITE_SUPPORTED ) )
+#error "SPI_BATCH_BUF_SIZE must fit a packet payload (251 max) and needs SPI_WRITE_SUPPORTED"
+#endif
+#if defined( SPI_STREAM_SUPPORTED ) && ( ( ( SPI_STREAM_HEADER_SIZE + SPI_STREAM_CHUNK_SIZE ) > 251 ) || !defined( SPI_WRITE_SUPPORTED ) )
+#error "SPI_STREAM_CHUNK_SIZE must fit a packet payload with its header (246 max) and needs SPI_WRITE_SUPPORTED"
+#endif
+
+#define SPI_STAT_INC( c )       ( (c) += ( (c) != 0xFFFF ) )      // Saturating increment
+
+#ifdef SPI_STREAM_SUPPORTED
+#define SPI_STREAM_FRAME_MAX    ( SPI_STREAM_HEADER_SIZE + SPI_STREAM_CHUNK_SIZE + 5 )   // STX, size, type, CRC-16 at most
+#define SPI_STREAM_ON()         ( stream_fill != NULL )
+#if ( SPI_STREAM_FRAME_MAX > WRITE_BUF_SIZE )
+#error "SPI_STREAM_CHUNK_SIZE must leave a chunk frame room in the write ring"
+#endif
+#else
+#define SPI_STREAM_ON()         0
+#endif
+
+#define STX                     SPI_FRAME_STX
+#define STX_CRC                 SPI_FRAME_STX_CRC
+
+#if ( SPI_CRC_MODE == SPI_CRC_16 )
+typedef uint16_t spi_crc_t;
+#define SPI_CRC_BYTES           2
+#define SPI_CRC_INIT            0xFFFF
+#elif ( SPI_CRC_MODE == SPI_CRC_8 )
+typedef uint8_t spi_crc_t;
+#define SPI_CRC_BYTES           1
+#define SPI_CRC_INIT            0x00
+#elif ( SPI_CRC_MODE != SPI_CRC_NONE )
+#error "SPI_CRC_MODE must be SPI_CRC_NONE, SPI_CRC_8 or SPI_CRC_16"
+#endif
+
+#if ( SPI_CRC_MODE != SPI_CRC_NONE )
+#define SPI_IS_STX( byte )      ( ( (byte) == STX ) || ( (byte) == STX_CRC ) )
+static spi_crc_t spi_crc_byte( spi_crc_t crc, uint8_t byte );
+#else
+#define SPI_IS_STX( byte )      ( (byte) == STX )
+#endif
+
+#if defined( SPI_PORT_DMA ) && !( defined( SPI_READ_SUPPORTED ) && defined( SPI_WRITE_SUPPORTED ) )
+#error "SPI_PORT_DMA needs both SPI_READ_SUPPORTED and SPI_WRITE_SUPPORTED"
+#endif
+#if defined( SPI_DESELECT_SUPPORTED ) && !defined( SPI_READ_SUPPORTED )
+#error "SPI_DESELECT_SUPPORTED needs SPI_READ_SUPPORTED"
+#endif
+
+#ifdef SPI_PORT_DMA
+/* TX DMA mode: write_buf is linear. Bytes [tail, head) are queued but not yet
+ * handed to the DMA, write_buf_remaining is the free space after head. */
+static void spi_write_kick( void );
+static err spi_write_queue( uint8_t byte );
+#endif
+
+#ifdef SPI_WRITE_SUPPORTED
+static void spi_ready_update( uint8_t ready );
+static void spi_write_reset( void );
+static void spi_write_frame( const uint8_t *head, uint8_t head_size, const uint8_t *data, uint8_t data_size, const uint8_t *check, uint8_t check_size );
+static void spi_write_copy( const uint8_t *bytes, uint8_t count );
+#endif
+
+#ifdef SPI_DESELECT_SUPPORTED
+static spi_buf_count_t spi_read_frame_bytes( void );
+static uint8_t spi_read_frame_done( void );
+#endif
+
+#ifdef SPI_READ_SUPPORTED
+volatile uint8_t read_buf[READ_BUF_SIZE];
+volatile spi_buf_count_t read_buf_head;
+volatile spi_buf_count_t read_buf_tail;
+volatile spi_buf_count_t read_buf_remaining;
+#endif
+
+#ifdef SPI_DESELECT_SUPPORTED
+volatile spi_buf_count_t read_frame_end;    // Read ring head at the last deselect
+volatile uint8_t read_frame_pending;        // Deselected, spi_packet_peek() has not reached read_frame_end yet
+#endif
+
+#ifdef SPI_WRITE_SUPPORTED
+volatile uint8_t write_buf[WRITE_BUF_SIZE];
+volatile spi_buf_count_t write_buf_head;
+volatile spi_buf_count_t write_buf_tail;
+volatile spi_buf_count_t write_buf_remaining;
+uint8_t write_seq_replies;          // A sequenced reply was written since the last clear
+uint8_t write_reply_ready;          // Level of the data-ready line, see SPI_PORT_READY()
+uint8_t write_hold;                 // Replies outlive the transaction, see spi_write_hold()
+#endif
+
+volatile spi_stats_t spi_stats;
+
+uint8_t packet_seq;
+uint8_t packet_seq_valid;           // Replies echo packet_seq until the packet is consumed
+uint8_t packet_crc;                 // Replies are STX_CRC frames until the packet is consumed
+
+#ifdef SPI_BATCH_SUPPORTED
+static err spi_batch_add( uint8_t packet_type, uint8_t *data, uint8_t data_size );
+
+uint8_t batch_buf[SPI_BATCH_BUF_SIZE];
+uint8_t batch_bytes;                // 0 -> not batching
+uint8_t batch_overflow;
+
+uint8_t spi_module_addr = SPI_MODULE_ADDR_ANY;
+#endif
+
+#ifdef SPI_STREAM_SUPPORTED
+spi_stream_fill_t stream_fill;      // NULL -> no stream
+spi_packet_buf_t *stream_packet;    // Its tick counter times the stream out
+uint8_t stream_type;
+uint8_t stream_crc;                 // Chunks are STX_CRC frames, as the request was
+uint8_t stream_queued;              // The last chunk is in the write ring
+uint16_t stream_total;
+uint16_t stream_offset;
+uint16_t stream_time;               // Tick the last chunk was queued
+uint8_t stream_buf[SPI_STREAM_HEADER_SIZE + SPI_STREAM_CHUNK_SIZE];
+#endif
+
+// Extern Functions --------------------------------------------------------
+
+extern void spi_init( void )
+{
+#ifdef SPI_READ_SUPPORTED
+    read_buf_head = 0;
+    read_buf_tail = 0;
+    read_buf_remaining = READ_BUF_SIZE;
+#endif
+    
+#ifdef SPI_WRITE_SUPPORTED
+    write_buf_head = 0;
+    write_buf_tail = 0;
+    write_buf_remaining = WRITE_BUF_SIZE;
+    write_seq_replies = 0;
+    write_hold = 0;
+    spi_ready_update( 0 );
+#endif
+    
+#ifdef SPI_STREAM_SUPPORTED
+    stream_fill = NULL;
+#endif
+    
+#ifdef SPI_DESELECT_SUPPORTED
+    read_frame_pending = 0;
+#endif
+    
+    memset( (void *)&spi_stats, 0, sizeof(spi_stats) );
+    packet_seq_valid = 0;
+    packet_crc = 0;
+    
+#ifdef SPI_PORT_DMA
+    spi_port_rx_dma_start( read_buf, READ_BUF_SIZE );
+#endif
+    spi_port_init();
+}
+
+#ifdef SPI_READ_SUPPORTED
+extern spi_buf_count_t spi_read_bytes_available( void )
+{
+#ifdef SPI_PORT_DMA
+    /* RX DMA fills read_buf circularly, the head comes from its transfer count */
+    spi_buf_count_t bytes = ( spi_port_rx_dma_head() - read_buf_tail ) & READ_BUF_SIZE_MASK;
+    
+    if ( bytes > spi_stats.read_peak )
+        spi_stats.read_peak = bytes;
+    
+    return bytes;
+#else
+    return ( READ_BUF_SIZE - read_buf_remaining );
+#endif
+}
+#endif
+
+#ifdef SPI_WRITE_SUPPORTED
+extern void spi_clear_write( void )
+{
+    SPI_PORT_INT_OFF();
+    spi_write_reset();
+    SPI_PORT_INT_ON();
+    
+#ifdef SPI_STREAM_SUPPORTED
+    /* The host moved on, or stopped reading */
+    stream_fill = NULL;
+#endif
+}
+
+extern void spi_write_hold( uint8_t hold )
+{
+    /* Non-zero keeps the write ring over a deselect, for replies the host drains over several
+     * transactions (e.g. telemetry). Sequenced replies are always kept. */
+    
+    write_hold = hold;
+}
+
+extern uint8_t spi_write_sequenced( void )
+{
+    /* Non-zero if the write ring may hold sequenced replies, see spi_packet_sequenced() */
+    
+    return write_seq_replies;
+}
+
+extern uint8_t spi_reply_ready( void )
+{
+    /* Non-zero while the data-ready line is asserted */
+    
+    return write_reply_ready;
+}
+#endif
+
+#ifdef SPI_WRITE_SUPPORTED
+extern spi_buf_count_t spi_write_bytes_written( void )
+{
+#ifdef SPI_PORT_DMA
+    spi_buf_count_t bytes;
+    
+    SPI_PORT_INT_OFF();
+    bytes = ( write_buf_head - write_buf_tail ) + spi_port_tx_dma_pending();
+    SPI_PORT_INT_ON();
+    
+    return bytes;
+#else
+    return ( WRITE_BUF_SIZE - write_buf_remaining );
+#endif
+}
+#endif
+
+#ifdef SPI_READ_SUPPORTED
+extern uint8_t spi_read_byte( void )
+{
+    uint8_t byte = 0;
+    
+#ifdef SPI_PORT_DMA
+    if ( spi_read_bytes_available() )
+    {
+        byte = read_buf[read_buf_tail];
+        read_buf_tail = ( read_buf_tail + 1 ) & READ_BUF_SIZE_MASK;
+    }
+#else
+    if ( READ_BUF_SIZE != read_buf_remaining )
+    {
+        SPI_PORT_INT_OFF();
+        byte = read_buf[read_buf_tail];
+        read_buf_tail = ( read_buf_tail + 1 ) & READ_BUF_SIZE_MASK;
+        read_buf_remaining++;
+        SPI_PORT_INT_ON();
+    }
+#endif
+    
+    return byte;
+}
+#endif
+
+#ifdef SPI_WRITE_SUPPORTED
+extern err spi_write_byte( uint8_t byte )
+{
+#ifdef SPI_PORT_DMA
+    err rc = spi_write_queue( byte );
+    
+    SPI_PORT_INT_OFF();
+    spi_write_kick();
+    SPI_PORT_INT_ON();
+    
+    return rc;
+#else
+    err rc = ERR_OK;
+    uint8_t add_to_buf = 1;
+    
+    if ( write_buf_remaining )
+    {
+        SPI_PORT_INT_OFF();
+        SPI_PORT_TX_PREPARE();
+    
+        if ( WRITE_BUF_SIZE == write_buf_remaining )
+        {
+            /* Empty transmit buffer -> write byte directly */
+            /* If the port reports a collision -> just add to buffer instead */
+            add_to_buf = SPI_PORT_TX_DIRECT( byte );
+        }
+    
+        if ( add_to_buf )
+        {
+            write_buf[write_buf_head] = byte;
+            write_buf_head = ( write_buf_head + 1 ) & WRITE_BUF_SIZE_MASK;
+            SPI_PORT_TX_CLEAR_COLLISION();
+        }
+    
+        write_buf_remaining--;
+        if ( ( WRITE_BUF_SIZE - write_buf_remaining ) > spi_stats.write_peak )
+            spi_stats.write_peak = WRITE_BUF_SIZE - write_buf_remaining;
+        SPI_PORT_INT_ON();
+    }
+    else
+    {
+        rc = ERR_SPI_WRITE_OVERFLOW;
+        SPI_STAT_INC( spi_stats.write_overflows );
+    }
+    
+    return rc;
+#endif
+}
+#endif
+
+extern void spi_stats_report( uint8_t *buf, uint8_t reset )
+{
+    /* Fills SPI_STATS_REPORT_SIZE bytes, all U16 little endian:
+     * [read_size][write_size][packet_size][read_dropped][write_overflows]
+     * [packet_overflows][packet_invalid][read_peak][write_peak]
+     */
+    
+    uint16_t values[SPI_STATS_REPORT_SIZE / 2];
+    uint8_t i;
+    
+    values[0] = READ_BUF_SIZE;
+    values[1] = WRITE_BUF_SIZE;
+    values[2] = SPI_PACKET_BUF_SIZE;
+    
+    SPI_PORT_INT_OFF();
+    values[3] = spi_stats.read_dropped;
+    values[4] = spi_stats.write_overflows;
+    values[5] = spi_stats.packet_overflows;
+    values[6] = spi_stats.packet_invalid;
+    values[7] = spi_stats.read_peak;
+    values[8] = spi_stats.write_peak;
+    if ( reset )
+        memset( (void *)&spi_stats, 0, sizeof(spi_stats) );
+    SPI_PORT_INT_ON();
+    
+    for ( i=0; i<( SPI_STATS_REPORT_SIZE / 2 ); i++ )
+    {
+        *buf++ = values[i] & 0xFF;
+        *buf++ = values[i] >> 8;
+    }
+}
+
+extern void spi_packet_clear( spi_packet_buf_t *packet )
+{
+    packet->buf_bytes = 0;
+    packet->buf_start = 0;
+    packet->pending = 0;
+    packet_seq_valid = 0;
+    packet_crc = 0;
+}
+
+extern void spi_packet_init( spi_packet_buf_t *packet, uint16_t *timer_ptr, uint16_t timeout )
+{
+    /* <timer_ptr> is a free running tick counter, NULL disables the packet timeout */
+    
+    spi_packet_clear( packet );
+    
+    packet->timer_ptr = timer_ptr;
+    packet->timeout = timeout;
+}
+
+extern uint8_t spi_packet_timeout( spi_packet_buf_t *packet )
+{
+    if ( packet->timer_ptr == NULL )
+        return 0;
+    
+#ifdef SPI_STREAM_SUPPORTED
+    /* Replies of a stream the host keeps reading are not stale */
+    if ( SPI_STREAM_ON() && ( (uint16_t)( *packet->timer_ptr - stream_time ) <= packet->timeout ) )
+        return 0;
+#endif
+    
+    return ( ( *packet->timer_ptr - packet->start_time ) > packet->timeout );
+}
+
+#ifdef SPI_READ_SUPPORTED
+extern uint8_t spi_frame_check( const uint8_t *frame )
+{
+    /* Check bytes of a whole frame, calculated in place: 0 if they match */
+    
+    uint8_t packet_size = frame[1];
+    uint8_t checksum = 0;
+    uint8_t i;
+#if ( SPI_CRC_MODE != SPI_CRC_NONE )
+    spi_crc_t crc;
+    
+    if ( frame[0] == STX_CRC )
+    {
+        crc = SPI_CRC_INIT;
+        for ( i=0; i<( packet_size - SPI_CRC_BYTES ); i++ )
+            crc = spi_crc_byte( crc, *frame++ );
+        crc ^= frame[0];
+#if ( SPI_CRC_BYTES == 2 )
+        crc ^= (spi_crc_t)frame[1] << 8;
+#endif
+        return ( crc != 0 );
+    }
+#endif
+    
+    for ( i=0; i<packet_size; i++ )
+        checksum += *frame++;
+    
+    return checksum;
+}
+
+extern err spi_packet_peek( spi_packet_buf_t *packet, uint8_t *packet_type, uint8_t **data, uint8_t *data_size )
+{
+    /* Returns ERR_OK(0) if good packet, non-zero error otherwise */
+    
+    /* Packet format:
+     * [STX U8=2][size U8][packet type U8][data...][checksum U8]
+     * [STX_CRC U8=3][size U8][packet type U8][data...][CRC, SPI_CRC_BYTES little endian]
+     */
+    
+    /* On a good packet *data points at the payload inside packet->buf. It stays
+     * valid until spi_packet_consume() or the next peek, whichever comes first.
+     * Bytes are copied once, from the ring into packet->buf. */
+    
+    err rc = ERR_OK;
+    uint8_t invalidate = 0;
+#ifdef SPI_DESELECT_SUPPORTED
+    uint8_t framed = 0;
+#endif
+    spi_buf_count_t available;
+    uint8_t packet_size;
+    uint8_t type;
+    uint8_t checksum;
+    uint8_t *start_ptr;
+    uint8_t *buf_ptr;
+    uint8_t bytes;
+    uint8_t trailer;
+    uint8_t byte;
+    uint8_t i;
+    
+    *packet_type = 0;
+    *data_size = 0;
+    
+    spi_packet_consume( packet );
+    
+#ifdef SPI_DESELECT_SUPPORTED
+    /* Bytes after a deselect wait until the frame before it is done */
+    available = spi_read_frame_bytes();
+    if ( !available && !packet->buf_bytes && spi_read_frame_done() )
+        available = spi_read_frame_bytes();
+#else
+    available = spi_read_bytes_available();
+#endif
+    
+    /* Read until we find STX. */
+    while ( ( packet->buf_bytes == 0 ) && available )
+    {
+        byte = spi_read_byte();
+        available--;
+        if ( SPI_IS_STX( byte ) )
+        {
+            packet->buf[0] = byte;
+            packet->buf_bytes = 1;
+            if ( packet->timer_ptr != NULL )
+                packet->start_time = *packet->timer_ptr;
+        }
+    }
+    
+    if ( packet->buf_bytes > 0 )
+    {
+        /* Buffer full behind consumed packets -> move the rest down, the only copy back */
+        if ( ( packet->buf_bytes == SPI_PACKET_BUF_SIZE ) && packet->buf_start )
+        {
+            packet->buf_bytes -= packet->buf_start;
+            memmove( packet->buf, &packet->buf[packet->buf_start], packet->buf_bytes );
+            packet->buf_start = 0;
+        }
+        
+        /* We have an STX already. Keep reading. */
+        while ( available && ( packet->buf_bytes < SPI_PACKET_BUF_SIZE ) )
+        {
+            packet->buf[packet->buf_bytes++] = spi_read_byte();
+            available--;
+        }
+        
+        start_ptr = &packet->buf[packet->buf_start];
+        bytes = packet->buf_bytes - packet->buf_start;
+    
+        if ( spi_packet_timeout( packet ) )
+        {
+            rc = ERR_PACKET_TIMEOUT;
+            invalidate = 1;
+        }
+        else if ( bytes >= 3 )
+        {
+            /* We have at minimum: STX, size and packet type */
+    
+            packet_size = start_ptr[1];
+#if ( SPI_CRC_MODE != SPI_CRC_NONE )
+            trailer = ( start_ptr[0] == STX_CRC ) ? SPI_CRC_BYTES : 1;
+#else
+            trailer = 1;
+#endif
+    
+            if ( packet_size > SPI_PACKET_BUF_SIZE )
+            {
+                rc = ERR_PACKET_OVERFLOW;
+                invalidate = 1;
+            }
+            else if ( packet_size < ( 3 + trailer ) )
+            {
+                /* Packet size is too small to be valid. */
+                rc = ERR_PACKET_INVALID;
+                invalidate = 1;
+            }
+            else if ( bytes >= packet_size )
+            {
+                type = start_ptr[2];
+                checksum = spi_frame_check( start_ptr );
+    
+                if ( checksum != 0 )
+                {
+                    /* Bad checksum. Search until we find next STX. */
+                    rc = ERR_PACKET_INVALID;
+                    invalidate = 1;
+                }
+                else
+                {
+                    /* Checksum is good. Dropped by the next consume. */
+    
+#ifdef SPI_DESELECT_SUPPORTED
+                    framed = 1;
+#endif
+                    packet->pending = packet_size;
+                    packet_crc = ( start_ptr[0] == STX_CRC );
+#ifdef SPI_WRITE_SUPPORTED
+                    /* The line rises again for this packet's reply, not for older ones */
+                    SPI_PORT_INT_OFF();
+                    spi_ready_update( 0 );
+                    SPI_PORT_INT_ON();
+#endif
+                    buf_ptr = &start_ptr[3];
+                    bytes = packet_size - 3 - trailer;
+                    
+                    if ( ( type & SPI_PACKET_SEQ_FLAG ) && bytes )
+                    {
+                        /* Sequenced -> the first data byte is the host's sequence number */
+                        type &= ~SPI_PACKET_SEQ_FLAG;
+                        packet_seq = *buf_ptr++;
+                        packet_seq_valid = 1;
+                        bytes--;
+                    }
+    
+                    if ( ( type == 0 ) || ( type & SPI_PACKET_SEQ_FLAG ) )
+                    {
+                        rc = ERR_PACKET_INVALID;
+                        spi_packet_consume( packet );
+                    }
+#ifdef SPI_WRITE_SUPPORTED
+                    else if ( type == SPI_PACKET_TYPE_PROTOCOL )
+                    {
+                        /* Answered here for every board, the caller sees no packet */
+                        uint8_t reply[3] = { ERR_OK, SPI_PROTOCOL_VERSION, SPI_CRC_MODE };
+                        
+                        spi_packet_write( type, reply, sizeof(reply) );
+                        spi_packet_consume( packet );
+                    }
+#endif
+                    else
+                    {
+                        *packet_type = type;
+                        *data = buf_ptr;
+                        *data_size = bytes;
+                    }
+                }
+            }
+        }
+    
+        if ( invalidate )
+        {
+            /* Data in buffer is invalid -> look for next STX. */
+    
+            for ( i=1; i<bytes; i++ )
+                if ( SPI_IS_STX( start_ptr[i] ) )
+                    break;
+    
+            packet->pending = i;
+            spi_packet_consume( packet );
+        }
+    }
+    
+#ifdef SPI_DESELECT_SUPPORTED
+    /* Read up to the deselect without a packet -> the rest of that frame never comes */
+    if ( !framed && ( rc == ERR_OK ) && spi_read_frame_done() )
+        spi_packet_clear( packet );
+#endif
+    
+    if ( rc == ERR_PACKET_OVERFLOW )
+        SPI_STAT_INC( spi_stats.packet_overflows );
+    else if ( rc != ERR_OK )
+        SPI_STAT_INC( spi_stats.packet_invalid );
+    
+    return rc;
+}
+#endif
+
+extern void spi_packet_consume( spi_packet_buf_t *packet )
+{
+    /* Drop the packet returned by the last spi_packet_peek() */
+    
+    packet->buf_start += packet->pending;
+    packet->pending = 0;
+    packet_seq_valid = 0;
+    packet_crc = 0;
+    
+    if ( packet->buf_start >= packet->buf_bytes )
+    {
+        packet->buf_start = 0;
+        packet->buf_bytes = 0;
+    }
+}
+
+extern uint8_t spi_packet_sequenced( void )
+{
+    /* Non-zero if the packet being handled was sequenced. Its replies are matched by
+     * sequence number, so earlier unread replies need not be cleared. */
+    
+    return packet_seq_valid;
+}
+
+#ifdef SPI_READ_SUPPORTED
+extern err spi_packet_read( spi_packet_buf_t *packet, uint8_t *packet_type, uint8_t *data, uint8_t *data_size, uint8_t data_buf_size )
+{
+    /* Copying wrapper around spi_packet_peek() */
+    
+    err rc;
+    uint8_t *packet_data;
+    uint8_t seq_valid;
+    uint8_t crc_frame;
+    
+    rc = spi_packet_peek( packet, packet_type, &packet_data, data_size );
+    
+    if ( *packet_type != 0 )
+    {
+        if ( ( *data_size + 4 ) > data_buf_size )
+        {
+            rc = ERR_PACKET_OVERFLOW;
+            SPI_STAT_INC( spi_stats.packet_overflows );
+            *packet_type = 0;
+        }
+        else
+            memcpy( data, packet_data, *data_size );
+        
+        /* The caller replies after this returns -> keep the reply framing */
+        seq_valid = packet_seq_valid;
+        crc_frame = packet_crc;
+        spi_packet_consume( packet );
+        packet_seq_valid = seq_valid;
+        packet_crc = crc_frame;
+    }
+    
+    return rc;
+}
+#endif
+
+#ifdef SPI_WRITE_SUPPORTED
+extern err spi_packet_write( uint8_t packet_type, uint8_t *data, uint8_t data_size )
+{
+    /* Returns ERR_OK(0) if write successful, non-zero error otherwise */
+    
+    /* Packet format:
+     * [STX U8=2][size U8][packet type U8][data...][checksum U8]
+     * [STX_CRC U8=3][size U8][packet type U8][data...][CRC] in reply to an STX_CRC packet
+     */
+    
+    uint8_t rc = ERR_OK;
+    uint8_t packet_size;
+    uint8_t checksum = 0;
+    uint8_t head[4];                // [STX][size][type][seq]
+    uint8_t head_size = 3;
+    uint8_t check[2];
+    uint8_t check_size = 1;
+    uint8_t i;
+    uint8_t stx = STX;
+#if ( SPI_CRC_MODE != SPI_CRC_NONE )
+    spi_crc_t crc = SPI_CRC_INIT;
+#endif
+    
+#ifdef SPI_BATCH_SUPPORTED
+    /* Batching -> collect as a sub-reply instead */
+    if ( batch_bytes )
+        return spi_batch_add( packet_type, data, data_size );
+#endif
+    
+    packet_size = data_size + 4 + packet_seq_valid;
+#if ( SPI_CRC_MODE != SPI_CRC_NONE )
+    if ( packet_crc )
+    {
+        stx = STX_CRC;
+        packet_size += SPI_CRC_BYTES - 1;
+    }
+#endif
+    
+#ifdef SPI_PORT_DMA
+    /* Reclaim the buffer if the previous reply has been sent */
+    SPI_PORT_INT_OFF();
+    spi_write_kick();
+    SPI_PORT_INT_ON();
+#endif
+    
+    if ( write_buf_remaining < packet_size )
+    {
+        rc = ERR_SPI_WRITE_OVERFLOW;
+        SPI_STAT_INC( spi_stats.write_overflows );
+    }
+    else
+    {
+        /* The whole frame is made before it goes in the ring, so the port
+         * interrupt is masked once per frame instead of once per byte */
+        head[0] = stx;
+        head[1] = packet_size;
+        head[2] = packet_type;
+        if ( packet_seq_valid )
+        {
+            head[2] |= SPI_PACKET_SEQ_FLAG;
+            head[3] = packet_seq;
+            head_size = 4;
+            write_seq_replies = 1;
+        }
+        
+#if ( SPI_CRC_MODE != SPI_CRC_NONE )
+        if ( packet_crc )
+        {
+            for ( i=0; i<head_size; i++ )
+                crc = spi_crc_byte( crc, head[i] );
+            for ( i=0; i<data_size; i++ )
+                crc = spi_crc_byte( crc, data[i] );
+            check[0] = crc & 0xFF;
+#if ( SPI_CRC_BYTES == 2 )
+            check[1] = crc >> 8;
+#endif
+            check_size = SPI_CRC_BYTES;
+        }
+        else
+#endif
+        {
+            for ( i=0; i<head_size; i++ )
+                checksum += head[i];
+            for ( i=0; i<data_size; i++ )
+                checksum += data[i];
+            check[0] = -checksum;
+        }
+        
+        spi_write_frame( head, head_size, data, data_size, check, check_size );
+    }
+    
+    return rc;
+}
+#endif
+
+#ifdef SPI_WRITE_SUPPORTED
+extern uint8_t *spi_reply_cache_slot( spi_reply_cache_t *cache )
+{
+    /* The slot to fill before spi_reply_cache_publish(), not the one being sent */
+    
+    return cache->buf[cache->live ^ 1];
+}
+
+extern void spi_reply_cache_publish( spi_reply_cache_t *cache, uint8_t size )
+{
+    /* Call from one context only, the main loop or one interrupt */
+    
+    uint8_t slot = cache->live ^ 1;
+    
+    cache->size[slot] = size;
+    cache->live = slot;
+    cache->publishes++;
+}
+
+extern err spi_reply_cache_write( spi_reply_cache_t *cache, uint8_t packet_type )
+{
+    /* Sends the last published payload. The framing still follows the request (sequence
+     * number, CRC), so only the payload is cached. A publish from an interrupt during the
+     * copy may reuse the slot being copied, so the copy is repeated until none came. */
+    
+    uint8_t buf[SPI_REPLY_CACHE_SIZE];
+    uint8_t publishes;
+    uint8_t slot;
+    uint8_t size;
+    
+    do
+    {
+        publishes = cache->publishes;
+        slot = cache->live;
+        size = cache->size[slot];
+        memcpy( buf, cache->buf[slot], size );
+    } while ( publishes != cache->publishes );
+    
+    if ( size == 0 )
+        return ERR_PACKET_INVALID;
+    
+    return spi_packet_write( packet_type, buf, size );
+}
+#endif
+
+#ifdef SPI_BATCH_SUPPORTED
+extern void spi_batch_begin( void )
+{
+    batch_buf[0] = ERR_OK;
+    batch_bytes = 1;
+    batch_overflow = 0;
+}
+
+extern err spi_batch_end( uint8_t packet_type )
+{
+    /* Returns ERR_SPI_WRITE_OVERFLOW without sending if a sub-reply did not fit */
+    
+    err rc = ERR_SPI_WRITE_OVERFLOW;
+    uint8_t bytes = batch_bytes;
+    
+    batch_bytes = 0;
+    
+    if ( !batch_overflow )
+        rc = spi_packet_write( packet_type, batch_buf, bytes );
+    
+    return rc;
+}
+
+extern void spi_batch_discard( void )
+{
+    /* Ends the batch without sending, for packets run on the board's own behalf */
+    batch_bytes = 0;
+}
+
+extern uint8_t spi_module_addressed( uint8_t addr )
+{
+    return ( addr == SPI_MODULE_ADDR_ANY ) || ( spi_module_addr == SPI_MODULE_ADDR_ANY ) || ( addr == spi_module_addr );
+}
+#endif
+
+#ifdef SPI_STREAM_SUPPORTED
+extern err spi_stream_start( spi_packet_buf_t *packet, uint8_t packet_type, uint16_t total, spi_stream_fill_t fill )
+{
+    /* From a packet handler, in place of its reply. The chunks go out from spi_stream_poll()
+     * once the request is consumed, so they are never sequenced. Replaces a stream in
+     * progress. spi_clear_write() or the packet timeout of <packet> ends it. */
+    
+#ifdef SPI_BATCH_SUPPORTED
+    if ( batch_bytes )
+        return ERR_PACKET_INVALID;  // Not a sub-reply
+#endif
+    
+    stream_packet = packet;
+    stream_type = packet_type;
+    stream_crc = packet_crc;
+    stream_queued = 0;
+    stream_total = total;
+    stream_offset = 0;
+    stream_time = ( packet->timer_ptr != NULL ) ? *packet->timer_ptr : 0;
+    stream_fill = fill;
+    
+    return ERR_OK;
+}
+
+extern void spi_stream_poll( void )
+{
+    /* Main loop, outside packet handling. Queues the next chunk once the write ring has room
+     * for its whole frame, and ends the stream once the host has read the last one. */
+    
+    uint16_t left;
+    uint8_t size;
+    uint8_t crc;
+    
+    if ( !SPI_STREAM_ON() )
+        return;
+    
+    if ( stream_queued )
+    {
+        if ( spi_write_bytes_written() == 0 )
+            stream_fill = NULL;
+        return;
+    }
+    
+    if ( ( WRITE_BUF_SIZE - spi_write_bytes_written() ) < SPI_STREAM_FRAME_MAX )
+        return;
+    
+    left = stream_total - stream_offset;
+    size = stream_fill( stream_offset, &stream_buf[SPI_STREAM_HEADER_SIZE], ( left < SPI_STREAM_CHUNK_SIZE ) ? left : SPI_STREAM_CHUNK_SIZE );
+    if ( size == 0 )
+        stream_total = stream_offset;   // Cut short, this chunk tells the host
+    
+    stream_buf[0] = ERR_OK;
+    stream_buf[1] = stream_total & 0xFF;
+    stream_buf[2] = stream_total >> 8;
+    stream_buf[3] = stream_offset & 0xFF;
+    stream_buf[4] = stream_offset >> 8;
+    
+    crc = packet_crc;
+    packet_crc = stream_crc;
+    if ( spi_packet_write( stream_type, stream_buf, SPI_STREAM_HEADER_SIZE + size ) == ERR_OK )
+    {
+        stream_offset += size;
+        stream_queued = ( stream_offset >= stream_total );
+        if ( stream_packet->timer_ptr != NULL )
+            stream_time = *stream_packet->timer_ptr;
+    }
+    packet_crc = crc;
+}
+
+extern uint8_t spi_stream_active( void )
+{
+    /* Non-zero until the host has read the last chunk, or the stream was ended */
+    
+    return SPI_STREAM_ON();
+}
+#endif
+
+extern err spi_packet_dispatch( const spi_packet_entry_t *table, uint8_t count, uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+{
+    /* Runs the handler for <packet_type> from a table of <count> rows indexed by type.
+     * Returns ERR_PACKET_INVALID for an unknown type or a data size out of its bounds, otherwise the handler's rc. */
+    
+    const spi_packet_entry_t *entry;
+    
+    if ( packet_type >= count )
+        return ERR_PACKET_INVALID;
+    
+    entry = &table[packet_type];
+    if ( ( entry->handler == NULL ) || ( packet_data_size < entry->size_min ) || ( packet_data_size > entry->size_max ) )
+        return ERR_PACKET_INVALID;
+    
+    return entry->handler( packet_type, packet_data, packet_data_size );
+}
+
+extern void spi_caps_report( uint8_t *buf, uint16_t firmware_version, uint32_t loop_period_us )
+{
+    /* Fills the first 14 bytes of SPI_CAPS_REPORT_SIZE, little endian, the board adds the
+     * packet types with spi_caps_types() */
+    
+    uint16_t values[5];
+    uint8_t i;
+    
+    values[0] = firmware_version;
+    values[1] = SPI_PROTOCOL_VERSION | ( SPI_CRC_MODE << 8 );
+    values[2] = SPI_PACKET_BUF_SIZE;
+    values[3] = WRITE_BUF_SIZE;
+#ifdef SPI_BATCH_SUPPORTED
+    values[4] = SPI_BATCH_BUF_SIZE;
+#else
+    values[4] = 0;
+#endif
+    
+    for ( i=0; i<5; i++ )
+    {
+        *buf++ = values[i] & 0xFF;
+        *buf++ = values[i] >> 8;
+    }
+    for ( i=0; i<4; i++ )
+    {
+        *buf++ = loop_period_us & 0xFF;
+        loop_period_us >>= 8;
+    }
+}
+
+extern void spi_caps_types( uint8_t *buf, const spi_packet_entry_t *table, uint8_t count )
+{
+    /* SPI_CAPS_TYPES/8 bytes, bit ( type & 7 ) of byte ( type >> 3 ) set for each type with a handler */
+    
+    uint8_t type;
+    
+    memset( buf, 0, SPI_CAPS_TYPES / 8 );
+    for ( type=0; ( type<count ) && ( type<SPI_CAPS_TYPES ); type++ )
+        if ( table[type].handler != NULL )
+            buf[type >> 3] |= 1 << ( type & 7 );
+}
+
+// Static Functions --------------------------------------------------------
+
+#if ( SPI_CRC_MODE == SPI_CRC_8 )
+/* CRC-8 a nibble at a time, table[n] = n << 4 reduced by poly 0x07 */
+static const uint8_t crc_table[16] =
+{
+    0x00, 0x07, 0x0E, 0x09, 0x1C, 0x1B, 0x12, 0x15,
+    0x38, 0x3F, 0x36, 0x31, 0x24, 0x23, 0x2A, 0x2D
+};
+
+static spi_crc_t spi_crc_byte( spi_crc_t crc, uint8_t byte )
+{
+    crc ^= byte;
+    crc = (uint8_t)( crc << 4 ) ^ crc_table[crc >> 4];
+    crc = (uint8_t)( crc << 4 ) ^ crc_table[crc >> 4];
+    
+    return crc;
+}
+#elif ( SPI_CRC_MODE == SPI_CRC_16 )
+/* CRC-16 a byte at a time, table[n] = n << 8 reduced by poly 0x1021 */
+static const uint16_t crc_table[256] =
+{
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+    0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF,
+    0x1231, 0x0210, 0x3273, 0x2252, 0x52B5, 0x4294, 0x72F7, 0x62D6,
+    0x9339, 0x8318, 0xB37B, 0xA35A, 0xD3BD, 0xC39C, 0xF3FF, 0xE3DE,
+    0x2462, 0x3443, 0x0420, 0x1401, 0x64E6, 0x74C7, 0x44A4, 0x5485,
+    0xA56A, 0xB54B, 0x8528, 0x9509, 0xE5EE, 0xF5CF, 0xC5AC, 0xD58D,
+    0x3653, 0x2672, 0x1611, 0x0630, 0x76D7, 0x66F6, 0x5695, 0x46B4,
+    0xB75B, 0xA77A, 0x9719, 0x8738, 0xF7DF, 0xE7FE, 0xD79D, 0xC7BC,
+    0x48C4, 0x58E5, 0x6886, 0x78A7, 0x0840, 0x1861, 0x2802, 0x3823,
+    0xC9CC, 0xD9ED, 0xE98E, 0xF9AF, 0x8948, 0x9969, 0xA90A, 0xB92B,
+    0x5AF5, 0x4AD4, 0x7AB7, 0x6A96, 0x1A71, 0x0A50, 0x3A33, 0x2A12,
+    0xDBFD, 0xCBDC, 0xFBBF, 0xEB9E, 0x9B79, 0x8B58, 0xBB3B, 0xAB1A,
+    0x6CA6, 0x7C87, 0x4CE4, 0x5CC5, 0x2C22, 0x3C03, 0x0C60, 0x1C41,
+    0xEDAE, 0xFD8F, 0xCDEC, 0xDDCD, 0xAD2A, 0xBD0B, 0x8D68, 0x9D49,
+    0x7E97, 0x6EB6, 0x5ED5, 0x4EF4, 0x3E13, 0x2E32, 0x1E51, 0x0E70,
+    0xFF9F, 0xEFBE, 0xDFDD, 0xCFFC, 0xBF1B, 0xAF3A, 0x9F59, 0x8F78,
+    0x9188, 0x81A9, 0xB1CA, 0xA1EB, 0xD10C, 0xC12D, 0xF14E, 0xE16F,
+    0x1080, 0x00A1, 0x30C2, 0x20E3, 0x5004, 0x4025, 0x7046, 0x6067,
+    0x83B9, 0x9398, 0xA3FB, 0xB3DA, 0xC33D, 0xD31C, 0xE37F, 0xF35E,
+    0x02B1, 0x1290, 0x22F3, 0x32D2, 0x4235, 0x5214, 0x6277, 0x7256,
+    0xB5EA, 0xA5CB, 0x95A8, 0x8589, 0xF56E, 0xE54F, 0xD52C, 0xC50D,
+    0x34E2, 0x24C3, 0x14A0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
+    0xA7DB, 0xB7FA, 0x8799, 0x97B8, 0xE75F, 0xF77E, 0xC71D, 0xD73C,
+    0x26D3, 0x36F2, 0x0691, 0x16B0, 0x6657, 0x7676, 0x4615, 0x5634,
+    0xD94C, 0xC96D, 0xF90E, 0xE92F, 0x99C8, 0x89E9, 0xB98A, 0xA9AB,
+    0x5844, 0x4865, 0x7806, 0x6827, 0x18C0, 0x08E1, 0x3882, 0x28A3,
+    0xCB7D, 0xDB5C, 0xEB3F, 0xFB1E, 0x8BF9, 0x9BD8, 0xABBB, 0xBB9A,
+    0x4A75, 0x5A54, 0x6A37, 0x7A16, 0x0AF1, 0x1AD0, 0x2AB3, 0x3A92,
+    0xFD2E, 0xED0F, 0xDD6C, 0xCD4D, 0xBDAA, 0xAD8B, 0x9DE8, 0x8DC9,
+    0x7C26, 0x6C07, 0x5C64, 0x4C45, 0x3CA2, 0x2C83, 0x1CE0, 0x0CC1,
+    0xEF1F, 0xFF3E, 0xCF5D, 0xDF7C, 0xAF9B, 0xBFBA, 0x8FD9, 0x9FF8,
+    0x6E17, 0x7E36, 0x4E55, 0x5E74, 0x2E93, 0x3EB2, 0x0ED1, 0x1EF0
+};
+
+static spi_crc_t spi_crc_byte( spi_crc_t crc, uint8_t byte )
+{
+    return (uint16_t)( crc << 8 ) ^ crc_table[( crc >> 8 ) ^ byte];
+}
+#endif
+
+#ifdef SPI_BATCH_SUPPORTED
+static err spi_batch_add( uint8_t packet_type, uint8_t *data, uint8_t data_size )
+{
+    /* Appends [type][size][data...] to the batch reply */
+    
+    err rc = ERR_OK;
+    
+    if ( ( SPI_BATCH_BUF_SIZE - batch_bytes ) < ( data_size + 2 ) )
+    {
+        rc = ERR_SPI_WRITE_OVERFLOW;
+        SPI_STAT_INC( spi_stats.write_overflows );
+        batch_overflow = 1;
+    }
+    else
+    {
+        batch_buf[batch_bytes++] = packet_type;
+        batch_buf[batch_bytes++] = data_size;
+        memcpy( &batch_buf[batch_bytes], data, data_size );
+        batch_bytes += data_size;
+    }
+    
+    return rc;
+}
+#endif
+
+#ifdef SPI_PORT_DMA
+static err spi_write_queue( uint8_t byte )
+{
+    err rc = ERR_OK;
+    
+    SPI_PORT_INT_OFF();
+    
+    if ( write_buf_remaining )
+    {
+        write_buf[write_buf_head++] = byte;
+        write_buf_remaining--;
+        if ( ( WRITE_BUF_SIZE - write_buf_remaining ) > spi_stats.write_peak )
+            spi_stats.write_peak = WRITE_BUF_SIZE - write_buf_remaining;
+    }
+    else
+    {
+        rc = ERR_SPI_WRITE_OVERFLOW;
+        SPI_STAT_INC( spi_stats.write_overflows );
+    }
+    
+    SPI_PORT_INT_ON();
+    
+    return rc;
+}
+
+static void spi_write_kick( void )
+{
+    /* Caller masks the port interrupt. Starts the TX DMA on everything queued
+     * if it is idle, or rewinds the buffer once everything has been sent. */
+    
+    if ( spi_port_tx_dma_pending() == 0 )
+    {
+        if ( write_buf_tail != write_buf_head )
+        {
+            spi_port_tx_dma_start( &write_buf[write_buf_tail], write_buf_head - write_buf_tail );
+            write_buf_tail = write_buf_head;
+        }
+        else
+        {
+            write_buf_head = 0;
+            write_buf_tail = 0;
+            write_buf_remaining = WRITE_BUF_SIZE;
+        }
+    }
+}
+#endif
+
+#ifdef SPI_WRITE_SUPPORTED
+static void spi_write_frame( const uint8_t *head, uint8_t head_size, const uint8_t *data, uint8_t data_size, const uint8_t *check, uint8_t check_size )
+{
+    /* The caller checked there is room for the whole frame. One critical
+     * section: the host cannot clock out part of a frame while it goes in. */
+    
+    SPI_PORT_INT_OFF();
+#ifdef SPI_PORT_DMA
+    spi_write_copy( head, head_size );
+    spi_write_copy( data, data_size );
+    spi_write_copy( check, check_size );
+    
+    /* Hand the whole packet to the TX DMA in one block */
+    spi_write_kick();
+    if ( spi_port_tx_dma_pending() )
+        spi_ready_update( 1 );
+#else
+    SPI_PORT_TX_PREPARE();
+    if ( WRITE_BUF_SIZE == write_buf_remaining )
+    {
+        /* Empty transmit buffer -> the first byte goes directly, once per
+         * frame. If the port reports a collision it is buffered instead. */
+        if ( !SPI_PORT_TX_DIRECT( head[0] ) )
+        {
+            head++;
+            head_size--;
+            write_buf_remaining--;
+        }
+        SPI_PORT_TX_CLEAR_COLLISION();
+    }
+    spi_write_copy( head, head_size );
+    spi_write_copy( data, data_size );
+    spi_write_copy( check, check_size );
+    
+    spi_ready_update( 1 );
+#endif
+    if ( ( WRITE_BUF_SIZE - write_buf_remaining ) > spi_stats.write_peak )
+        spi_stats.write_peak = WRITE_BUF_SIZE - write_buf_remaining;
+    SPI_PORT_INT_ON();
+}
+
+static void spi_write_copy( const uint8_t *bytes, uint8_t count )
+{
+    /* Caller masks the port interrupt and checked the room */
+    
+    write_buf_remaining -= count;
+#ifdef SPI_PORT_DMA
+    memcpy( (void *)&write_buf[write_buf_head], bytes, count );
+    write_buf_head += count;
+#else
+    while ( count-- )
+    {
+        write_buf[write_buf_head] = *bytes++;
+        write_buf_head = ( write_buf_head + 1 ) & WRITE_BUF_SIZE_MASK;
+    }
+#endif
+}
+
+static void spi_ready_update( uint8_t ready )
+{
+    /* Caller masks the port interrupt, or runs in it */
+    
+    write_reply_ready = ready;
+    SPI_PORT_READY( ready );
+}
+
+static void spi_write_reset( void )
+{
+    /* Caller masks the port interrupt, or runs in it */
+    
+#ifdef SPI_PORT_DMA
+    spi_port_tx_dma_stop();
+#endif
+    write_buf_head = 0;
+    write_buf_tail = 0;
+    write_buf_remaining = WRITE_BUF_SIZE;
+    write_seq_replies = 0;
+    spi_ready_update( 0 );
+}
+#endif
+
+#ifdef SPI_DESELECT_SUPPORTED
+static spi_buf_count_t spi_read_frame_bytes( void )
+{
+    /* Bytes up to the last deselect while spi_packet_peek() has not reached it, else all */
+    
+    spi_buf_count_t bytes;
+    spi_buf_count_t frame_bytes;
+    
+    SPI_PORT_INT_OFF();
+    bytes = spi_read_bytes_available();
+    if ( read_frame_pending )
+    {
+        frame_bytes = ( read_frame_end - read_buf_tail ) & READ_BUF_SIZE_MASK;
+        if ( frame_bytes < bytes )
+            bytes = frame_bytes;
+    }
+    SPI_PORT_INT_ON();
+    
+    return bytes;
+}
+
+static uint8_t spi_read_frame_done( void )
+{
+    /* Non-zero, once, when every byte before the last deselect has been read */
+    
+    uint8_t done;
+    
+    SPI_PORT_INT_OFF();
+    done = read_frame_pending && ( read_buf_tail == read_frame_end );
+    if ( done )
+        read_frame_pending = 0;
+    SPI_PORT_INT_ON();
+    
+    return done;
+}
+#endif
+
+// Port Functions ----------------------------------------------------------
+
+#ifdef SPI_DESELECT_SUPPORTED
+extern void spi_deselect( void )
+{
+    /* Slave select rose, the transaction is over. Runs in the board's SS change interrupt,
+     * which SPI_PORT_INT_OFF() masks along with the SPI interrupt. */
+    
+    /* Marks where the transaction ended in the read ring. A packet still incomplete there
+     * is dropped by spi_packet_peek(), the bytes after it start a new frame. */
+#ifdef SPI_PORT_DMA
+    read_frame_end = spi_port_rx_dma_head();
+#else
+    read_frame_end = read_buf_head;
+#endif
+    read_frame_pending = 1;
+    
+#ifdef SPI_WRITE_SUPPORTED
+    /* Replies not clocked out by now are stale, unless the host reads them later */
+    if ( !write_seq_replies && !write_hold && !SPI_STREAM_ON() )
+        spi_write_reset();
+#endif
+}
+#endif
+
+#ifdef SPI_PORT_DMA
+extern void spi_dma_tx_done( void )
+{
+    /* Send anything queued while the last block was going out */
+    spi_write_kick();
+    if ( spi_port_tx_dma_pending() == 0 )
+        spi_ready_update( 0 );
+}
+#else
+extern uint8_t spi_handler( uint8_t byte_in, uint8_t *byte_out )
+{
+    uint8_t send = 0;
+    
+#ifdef SPI_READ_SUPPORTED
+    if ( read_buf_remaining )
+    {
+        read_buf[read_buf_head] = byte_in;
+        read_buf_head = ( read_buf_head + 1 ) & READ_BUF_SIZE_MASK;
+        read_buf_remaining--;
+        if ( ( READ_BUF_SIZE - read_buf_remaining ) > spi_stats.read_peak )
+            spi_stats.read_peak = READ_BUF_SIZE - read_buf_remaining;
+    }
+    else
+        SPI_STAT_INC( spi_stats.read_dropped );
+#endif
+    
+#ifdef SPI_WRITE_SUPPORTED
+    /* Decrease buffer count since previous byte just sent */
+    if ( WRITE_BUF_SIZE != write_buf_remaining )
+    {
+        write_buf_remaining++;
+    
+        if ( WRITE_BUF_SIZE != write_buf_remaining )
+        {
+            *byte_out = write_buf[write_buf_tail];
+            send = 1;
+            write_buf_tail = ( write_buf_tail + 1 ) & WRITE_BUF_SIZE_MASK;
+        }
+        else
+            spi_ready_update( 0 );
+    }
+#endif
+    
+    return send;
+}
+#endif
@@ -0,0 +1,232 @@
+/*
+ * File:   rio_spi.h
+ *
+ * SPI slave ring buffers and packet framing shared by all Rio PIC modules.
+ * Board specifics (buffer sizes, SPI register access, interrupt glue) live in
+ * each project's spi_port.h / spi_port.c.
+ */
+
+#ifndef RIO_SPI_H
+#define	RIO_SPI_H
+
+#include "spi_port.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/* Comms Constants */
+/* Ring buffer sizes must be a power of two, 256 max. Packet buffer is 255 max (packet size is U8). */
+#ifndef SPI_READ_BUF_SIZE
+#define SPI_READ_BUF_SIZE               32
+#endif
+#ifndef SPI_WRITE_BUF_SIZE
+#define SPI_WRITE_BUF_SIZE              32
+#endif
+#ifndef SPI_PACKET_BUF_SIZE
+#define SPI_PACKET_BUF_SIZE             32
+#endif
+
+#ifndef SPI_BATCH_BUF_SIZE
+#define SPI_BATCH_BUF_SIZE              128
+#endif
+
+#ifndef SPI_REPLY_CACHE_SIZE
+#define SPI_REPLY_CACHE_SIZE            16
+#endif
+
+/* Frame check of STX_CRC frames, chosen per board in spi_port.h. STX frames always use the checksum. */
+#define SPI_CRC_NONE                    0
+#define SPI_CRC_8                       1   // CRC-8/SMBUS, poly 0x07, 16 byte table
+#define SPI_CRC_16                      2   // CRC-16/CCITT-FALSE, poly 0x1021, 512 byte table
+#ifndef SPI_CRC_MODE
+#define SPI_CRC_MODE                    SPI_CRC_NONE
+#endif
+
+/* First byte of a frame */
+#define SPI_FRAME_STX                   2
+#define SPI_FRAME_STX_CRC               3   // Frame ends in a CRC instead of the checksum
+
+/* Answered inside spi_packet_peek(): [err U8][SPI_PROTOCOL_VERSION U8][SPI_CRC_MODE U8] */
+#define SPI_PACKET_TYPE_PROTOCOL        0x7F
+#define SPI_PROTOCOL_VERSION            2   // 1 = checksum only, no protocol query
+
+#define SPI_STATS_REPORT_SIZE           18
+
+/* GET_CAPABILITIES: [firmware version U16][protocol version U8][CRC mode U8][packet buf U16][write buf U16]
+ * [batch buf U16, 0 -> no BATCH][loop period us U32][packet types U8 x SPI_CAPS_TYPES/8], see spi_caps_report() */
+#define SPI_CAPS_TYPES                  64  // Board packet types 0-63 in the bitmap, PROTOCOL is always answered
+#define SPI_CAPS_REPORT_SIZE            ( 14 + ( SPI_CAPS_TYPES / 8 ) )
+
+/* Dispatch table size bound for packets of any size */
+#define SPI_PACKET_SIZE_ANY             0xFF
+
+/* Sequenced packets: [type | SPI_PACKET_SEQ_FLAG][seq U8][data...]. spi_packet_peek() strips
+ * both, and spi_packet_write() adds them back to replies until spi_packet_consume(). */
+#define SPI_PACKET_SEQ_FLAG             0x80
+
+/* Data-ready line: SPI_PORT_READY( 1 ) once a reply is queued, ( 0 ) when the host has read
+ * the write ring empty or the next request is accepted. No line by default. */
+#ifndef SPI_PORT_READY
+#define SPI_PORT_READY( on )
+#endif
+
+#if ( SPI_READ_BUF_SIZE > 128 ) || ( SPI_WRITE_BUF_SIZE > 128 )
+typedef uint16_t spi_buf_count_t;
+#else
+typedef uint8_t spi_buf_count_t;
+#endif
+
+/* Diagnostic counters, saturating */
+typedef struct
+{
+    uint16_t read_dropped;          // Bytes received while the read ring was full
+    uint16_t write_overflows;       // Bytes/packets refused because the write ring was full
+    uint16_t packet_overflows;      // Packets larger than the packet buffer
+    uint16_t packet_invalid;        // Bad size, checksum, timeout or type
+    spi_buf_count_t read_peak;      // Most bytes ever waiting in the read ring
+    spi_buf_count_t write_peak;     // Most bytes ever waiting in the write ring
+} spi_stats_t;
+
+typedef struct
+{
+    uint8_t buf[SPI_PACKET_BUF_SIZE];
+    uint8_t buf_bytes;              // End of received data
+    uint8_t buf_start;              // First byte not yet consumed
+    uint8_t pending;                // Size of the peeked packet, dropped by spi_packet_consume()
+    uint16_t *timer_ptr;            // NULL -> no packet timeout
+    uint16_t timeout;
+    uint16_t start_time;
+} spi_packet_buf_t;
+
+/* A "get" reply payload built ahead by the control loop, see spi_reply_cache_publish() */
+typedef struct
+{
+    uint8_t buf[2][SPI_REPLY_CACHE_SIZE];
+    uint8_t size[2];                // 0 -> nothing published yet
+    volatile uint8_t live;          // Slot sent by spi_reply_cache_write(), the other is filled
+    volatile uint8_t publishes;     // Counts publishes, a send that sees it change copies again
+} spi_reply_cache_t;
+
+/* One row of a board's dispatch table, indexed by packet type. A NULL handler is an unknown type. */
+typedef err (*spi_packet_handler_t)( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size );
+
+typedef struct
+{
+    spi_packet_handler_t handler;
+    uint8_t size_min;               // Data sizes outside these are refused before the handler runs
+    uint8_t size_max;
+} spi_packet_entry_t;
+
+/* SPI Core Functions */
+extern void spi_init( void );
+
+#ifdef SPI_READ_SUPPORTED
+extern spi_buf_count_t spi_read_bytes_available( void );
+extern uint8_t spi_read_byte( void );
+#endif
+
+#ifdef SPI_WRITE_SUPPORTED
+extern void spi_clear_write( void );
+extern void spi_write_hold( uint8_t hold );
+extern spi_buf_count_t spi_write_bytes_written( void );
+extern err spi_write_byte( uint8_t byte );
+extern uint8_t spi_write_sequenced( void );
+extern uint8_t spi_reply_ready( void );
+#endif
+
+extern void spi_stats_report( uint8_t *buf, uint8_t reset );
+
+/* SPI Packet Functions */
+extern void spi_packet_clear( spi_packet_buf_t *packet );
+extern void spi_packet_init( spi_packet_buf_t *packet, uint16_t *timer_ptr, uint16_t timeout );
+extern uint8_t spi_packet_timeout( spi_packet_buf_t *packet );
+
+extern void spi_packet_consume( spi_packet_buf_t *packet );
+extern uint8_t spi_packet_sequenced( void );
+
+#ifdef SPI_READ_SUPPORTED
+/* 0 if the check bytes of a whole frame, [STX][size]...[check], match. spi_packet_peek() runs
+ * it on every frame, rio_bench times it. */
+extern uint8_t spi_frame_check( const uint8_t *frame );
+extern err spi_packet_peek( spi_packet_buf_t *packet, uint8_t *packet_type, uint8_t **data, uint8_t *data_size );
+extern err spi_packet_read( spi_packet_buf_t *packet, uint8_t *packet_type, uint8_t *data, uint8_t *data_size, uint8_t data_buf_size );
+#endif
+
+#ifdef SPI_WRITE_SUPPORTED
+extern err spi_packet_write( uint8_t packet_type, uint8_t *data, uint8_t data_size );
+extern uint8_t *spi_reply_cache_slot( spi_reply_cache_t *cache );
+extern void spi_reply_cache_publish( spi_reply_cache_t *cache, uint8_t size );
+extern err spi_reply_cache_write( spi_reply_cache_t *cache, uint8_t packet_type );
+#endif
+
+#ifdef SPI_BATCH_SUPPORTED
+/* Between these, spi_packet_write() collects [type][size][data...] sub-replies
+ * and spi_batch_end() sends them as one [err U8][sub-replies...] packet */
+extern void spi_batch_begin( void );
+extern err spi_batch_end( uint8_t packet_type );
+extern void spi_batch_discard( void );
+
+/* Module address, telling apart several boards of one kind on a rig. An addressed BATCH
+ * runs only on the module it names. SPI_MODULE_ADDR_ANY, as on a blank EEPROM, answers
+ * every address, and addressing SPI_MODULE_ADDR_ANY reaches every module. */
+#define SPI_MODULE_ADDR_ANY             0xFF
+
+extern uint8_t spi_module_addr;
+extern uint8_t spi_module_addressed( uint8_t addr );
+#endif
+
+#ifdef SPI_STREAM_SUPPORTED
+/* Streamed replies: a transfer larger than a frame, sent as a run of chunk frames of the
+ * request's type, [err U8][total U16][offset U16][data...] little endian, total and offset
+ * in bytes of the whole transfer. spi_stream_poll() queues each chunk once the write ring
+ * has room for it, so the host reads the transfer as fast as it clocks the ring out. */
+#define SPI_STREAM_HEADER_SIZE          5
+#ifndef SPI_STREAM_CHUNK_SIZE
+#define SPI_STREAM_CHUNK_SIZE           64
+#endif
+
+/* Fills up to <max> bytes of the transfer from <offset> into <buf>, returns how many. 0 before
+ * the end cuts the transfer short, e.g. once the records it reads have been overwritten. */
+typedef uint8_t (*spi_stream_fill_t)( uint16_t offset, uint8_t *buf, uint8_t max );
+
+extern err spi_stream_start( spi_packet_buf_t *packet, uint8_t packet_type, uint16_t total, spi_stream_fill_t fill );
+extern void spi_stream_poll( void );
+extern uint8_t spi_stream_active( void );
+#endif
+
+/* Packet Dispatch */
+extern err spi_packet_dispatch( const spi_packet_entry_t *table, uint8_t count, uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size );
+extern void spi_caps_report( uint8_t *buf, uint16_t firmware_version, uint32_t loop_period_us );
+extern void spi_caps_types( uint8_t *buf, const spi_packet_entry_t *table, uint8_t count );
+
+/* Port Interface */
+/* Provided by spi_port.c */
+extern void spi_port_init( void );
+
+#ifdef SPI_DESELECT_SUPPORTED
+/* Called by spi_port.c on the slave select rising edge, from an interrupt that
+ * SPI_PORT_INT_OFF() masks */
+extern void spi_deselect( void );
+#endif
+
+#ifdef SPI_PORT_DMA
+/* DMA ports: RX DMA writes <buf> circularly, TX DMA sends <count> bytes from <buf> once */
+extern void spi_port_rx_dma_start( volatile uint8_t *buf, uint16_t size );
+extern spi_buf_count_t spi_port_rx_dma_head( void );
+extern void spi_port_tx_dma_start( volatile uint8_t *buf, uint16_t count );
+extern uint16_t spi_port_tx_dma_pending( void );
+extern void spi_port_tx_dma_stop( void );
+
+/* Called by spi_port.c when a TX DMA block is done */
+extern void spi_dma_tx_done( void );
+#else
+/* Called by spi_port.c for every SPI byte exchanged. Returns 1 if *byte_out must be sent next. */
+extern uint8_t spi_handler( uint8_t byte_in, uint8_t *byte_out );
+#endif
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* RIO_SPI_H */
@@ -0,0 +1,125 @@
+#include <stdint.h>
+#include <string.h>
+#include "common.h"
+#include "rio_spi.h"
+#include "rio_time.h"
+#include "rio_stage.h"
+
+typedef struct
+{
+    uint32_t apply_us;              // On the synchronized clock
+    uint8_t packet_type;            // 0 -> slot free
+    uint8_t data_size;
+    uint8_t data[STAGE_DATA_MAX];
+} stage_slot_t;
+
+stage_slot_t stage_slots[STAGE_SLOTS];
+stage_run_t stage_run;
+uint8_t stage_batch_type;
+uint8_t stage_type;
+uint8_t stage_pending;
+uint16_t stage_applied;
+uint16_t stage_late;
+uint16_t stage_failed;              // Refused by the board's parser when run
+int32_t stage_error_us;             // Run time - apply time of the last packet run
+
+void stage_init( stage_run_t run, uint8_t batch_type, uint8_t stage_packet_type )
+{
+    memset( stage_slots, 0, sizeof(stage_slots) );
+    stage_run = run;
+    stage_batch_type = batch_type;
+    stage_type = stage_packet_type;
+    stage_pending = 0;
+    stage_applied = 0;
+    stage_late = 0;
+    stage_failed = 0;
+    stage_error_us = 0;
+}
+
+err stage_packet( uint8_t *data, uint8_t data_size )
+{
+    /* Main loop only. Data as STAGE, none only reads the status. */
+    uint8_t slot;
+    uint8_t packet_type;
+
+    if ( data_size == 0 )
+        return ERR_OK;
+
+    if ( data_size == 1 )
+    {
+        if ( data[0] != STAGE_CANCEL )
+            return ERR_PACKET_INVALID;
+        memset( stage_slots, 0, sizeof(stage_slots) );
+        stage_pending = 0;
+        return ERR_OK;
+    }
+
+    /* Staged packets are run alone, so no batches or nested stages. Only the type byte is
+     * checked here, the board's parser checks the rest when it runs. */
+    if ( ( data_size < STAGE_HEADER_SIZE ) || ( ( data_size - STAGE_HEADER_SIZE ) > STAGE_DATA_MAX ) )
+        return ERR_PACKET_INVALID;
+    packet_type = data[sizeof(uint32_t)];
+    if ( ( packet_type == 0 ) || ( packet_type == stage_batch_type ) || ( packet_type == stage_type ) ||
+         ( packet_type == SPI_PACKET_TYPE_PROTOCOL ) )
+        return ERR_PACKET_INVALID;
+
+    for ( slot=0; slot<STAGE_SLOTS; slot++ )
+    {
+        if ( stage_slots[slot].packet_type == 0 )
+            break;
+    }
+    if ( slot == STAGE_SLOTS )
+        return ERR_PACKET_INVALID;
+
+    memcpy( &stage_slots[slot].apply_us, data, sizeof(uint32_t) );     // Little endian
+    stage_slots[slot].data_size = data_size - STAGE_HEADER_SIZE;
+    memcpy( stage_slots[slot].data, &data[STAGE_HEADER_SIZE], stage_slots[slot].data_size );
+    stage_slots[slot].packet_type = packet_type;
+    stage_pending++;
+
+    return ERR_OK;
+}
+
+void stage_poll( void )
+{
+    /* Main loop, every pass. Packets whose time has come run in slot order, which is staging
+     * order unless a slot was reused. Their replies are collected as a batch and dropped. */
+    stage_slot_t *stage;
+    uint32_t now_us;
+    int32_t error_us;
+    uint8_t slot;
+
+    if ( stage_pending == 0 )
+        return;
+
+    now_us = time_now_us();
+    for ( slot=0; slot<STAGE_SLOTS; slot++ )
+    {
+        stage = &stage_slots[slot];
+        error_us = (int32_t)( now_us - stage->apply_us );
+        if ( ( stage->packet_type == 0 ) || ( error_us < 0 ) )
+            continue;
+
+        spi_batch_begin();
+        if ( stage_run( stage->packet_type, stage->data, stage->data_size ) != ERR_OK )
+            stage_failed += ( stage_failed != 0xFFFF );
+        spi_batch_discard();
+
+        stage_applied += ( stage_applied != 0xFFFF );
+        if ( error_us > STAGE_LATE_US )
+            stage_late += ( stage_late != 0xFFFF );
+        stage_error_us = error_us;
+        stage->packet_type = 0;
+        stage_pending--;
+    }
+}
+
+void stage_report( uint8_t *buf )
+{
+    /* Fills STAGE_REPORT_SIZE bytes */
+    buf[0] = stage_pending;
+    memcpy( &buf[1], &stage_applied, sizeof(uint16_t) );
+    memcpy( &buf[3], &stage_late, sizeof(uint16_t) );
+    memcpy( &buf[5], &stage_failed, sizeof(uint16_t) );
+    memcpy( &buf[7], &stage_error_us, sizeof(int32_t) );
+}
@@ -0,0 +1,48 @@
+/*
+ * File:   rio_stage.h
+ *
+ * Staged commands shared by the dsPIC Rio modules. A STAGE packet carries
+ * another packet and a time on the synchronized clock (rio_time). The
+ * packet is kept until that time and then run from the main loop as if it
+ * had just arrived, with its reply dropped. The host stages the changes for
+ * several modules, one after the other, for the same time, and they all
+ * take effect together rather than one SPI transaction apart.
+ */
+
+#ifndef RIO_STAGE_H
+#define	RIO_STAGE_H
+
+#include <stdint.h>
+#include "common.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#define STAGE_SLOTS                     8       // Packets held at once
+#define STAGE_DATA_MAX                  24      // Bytes of packet data per slot
+
+/* STAGE data: none reads the status, [STAGE_CANCEL] drops all held packets, else
+ * [apply time us U32][packet type U8][packet data...], little endian */
+#define STAGE_CANCEL                    0
+#define STAGE_HEADER_SIZE               ( sizeof(uint32_t) + sizeof(uint8_t) )
+
+/* A packet run more than STAGE_LATE_US after its time counts as late */
+#define STAGE_LATE_US                   1000
+
+/* Report: [pending U8][applied U16][late U16][failed U16][last error us I32], little endian */
+#define STAGE_REPORT_SIZE               ( sizeof(uint8_t) + ( 3 * sizeof(uint16_t) ) + sizeof(int32_t) )
+
+/* Runs a packet through the board's parser, returns its error code */
+typedef err (*stage_run_t)( uint8_t packet_type, uint8_t *data, uint8_t data_size );
+
+extern void stage_init( stage_run_t run, uint8_t batch_type, uint8_t stage_type );
+extern err stage_packet( uint8_t *data, uint8_t data_size );
+extern void stage_poll( void );
+extern void stage_report( uint8_t *buf );
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* RIO_STAGE_H */
@@ -0,0 +1,109 @@
+#include "time_port.h"
+#include <string.h>
+#include "rio_time.h"
+
+/* Whole ticks since time_init(), and the host offset. The offset is 32 bits, so
+ * it is only read and written with TIME_PORT_LOCK() held. Both wrap with the
+ * us clock, every 71.6 minutes.
+ */
+volatile uint32_t time_ticks;
+uint32_t time_offset_us;
+uint16_t time_syncs;
+
+void time_init( void )
+{
+    TIME_PORT_LOCK();
+    time_ticks = 0;
+    time_offset_us = 0;
+    TIME_PORT_UNLOCK();
+    time_syncs = 0;
+}
+
+void time_tick( void )
+{
+    /* From the tick interrupt, once per TIME_PORT_TICK_US */
+    time_ticks++;
+}
+
+uint32_t time_local_us( void )
+{
+    /* Main loop or ISR. A tick that has wrapped the timer but not yet reached
+     * time_tick() is counted here, as timebase_read_isr() does on the strobe board. */
+    uint32_t ticks;
+    uint16_t count;
+
+    TIME_PORT_LOCK();
+    ticks = time_ticks;
+    count = TIME_PORT_COUNT();
+    if ( TIME_PORT_TICK_PENDING() && ( count < ( TIME_PORT_COUNT_PERIOD / 2 ) ) )
+        ticks++;
+    TIME_PORT_UNLOCK();
+
+    return ( ticks * TIME_PORT_TICK_US ) + TIME_PORT_COUNT_TO_US( count );
+}
+
+uint32_t time_now_us( void )
+{
+    /* Main loop or ISR, the local clock on the host's timebase */
+    uint32_t offset;
+
+    TIME_PORT_LOCK();
+    offset = time_offset_us;
+    TIME_PORT_UNLOCK();
+
+    return time_local_us() + offset;
+}
+
+err time_sync( uint8_t *data, uint8_t data_size )
+{
+    /* Main loop only. Data as SYNC_TIME, none leaves the clock as it is. */
+    uint32_t value;
+    uint32_t local_us;
+
+    if ( data_size == 0 )
+        return ERR_OK;
+    if ( data_size != ( sizeof(uint8_t) + sizeof(uint32_t) ) )
+        return ERR_PACKET_INVALID;
+
+    memcpy( &value, &data[1], sizeof(value) );     // Little endian
+
+    switch ( data[0] )
+    {
+        case TIME_SYNC_SET:
+            local_us = time_local_us();
+            TIME_PORT_LOCK();
+            time_offset_us = value - local_us;
+            TIME_PORT_UNLOCK();
+            break;
+        case TIME_SYNC_ADJUST:
+            TIME_PORT_LOCK();
+            time_offset_us += value;
+            TIME_PORT_UNLOCK();
+            break;
+        default:
+            return ERR_PACKET_INVALID;
+    }
+
+    if ( time_syncs < 0xFFFF )
+        time_syncs++;
+
+    return ERR_OK;
+}
+
+void time_report( uint8_t *buf )
+{
+    /* Fills TIME_REPORT_SIZE bytes, both clocks from the same read */
+    uint32_t local_us;
+    uint32_t offset;
+    uint32_t synced_us;
+
+    local_us = time_local_us();
+    TIME_PORT_LOCK();
+    offset = time_offset_us;
+    TIME_PORT_UNLOCK();
+    synced_us = local_us + offset;
+
+    memcpy( &buf[0], &synced_us, sizeof(uint32_t) );
+    memcpy( &buf[4], &local_us, sizeof(uint32_t) );
+    memcpy( &buf[8], &time_syncs, sizeof(uint16_t) );
+}
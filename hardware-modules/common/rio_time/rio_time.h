@@ -0,0 +1,42 @@
+/*
+ * File:   rio_time.h
+ *
+ * Microsecond timebase shared by the dsPIC Rio modules. The board's tick
+ * interrupt counts whole ticks with time_tick(), and time_local_us() adds
+ * the tick timer's count for the part of a tick, giving a free running
+ * 32-bit us clock. The host aligns all modules to its own clock with the
+ * SYNC_TIME packet, and time_now_us() is the local clock plus that offset,
+ * so samples from every module carry comparable timestamps. Board
+ * specifics (tick length, timer) live in each project's time_port.h.
+ */
+
+#ifndef RIO_TIME_H
+#define	RIO_TIME_H
+
+#include <stdint.h>
+#include "common.h"
+#include "time_port.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/* SYNC_TIME data: none reads the clock, else [mode U8][value U32], little endian */
+#define TIME_SYNC_SET                   0       // value is the host time now, in us
+#define TIME_SYNC_ADJUST                1       // value is an I32 step in us, added to the offset
+
+/* Report: [synced time us U32][local time us U32][syncs U16], little endian */
+#define TIME_REPORT_SIZE                ( ( 2 * sizeof(uint32_t) ) + sizeof(uint16_t) )
+
+extern void time_init( void );
+extern void time_tick( void );
+extern uint32_t time_local_us( void );
+extern uint32_t time_now_us( void );
+extern err time_sync( uint8_t *data, uint8_t data_size );
+extern void time_report( uint8_t *buf );
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* RIO_TIME_H */
@@ -0,0 +1,107 @@
+/*
+ * File:   board_config.h
+ *
+ * Build profile of the heater and stirrer board: control periods, load currents, SPI buffer
+ * sizes and the EEPROM part. Every value is a default a variant can override, either one at a time with
+ * -D or all together in its own header named by -DBOARD_PROFILE="<file>.h", which is
+ * included first. The checks at the end stop a build whose profile the firmware cannot run.
+ */
+
+#ifndef BOARD_CONFIG_H
+#define	BOARD_CONFIG_H
+
+#ifdef BOARD_PROFILE
+#include BOARD_PROFILE
+#endif
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/* Heater and stirrer control period, ms. TMR1 counts Fosc/2 / 64, 62.5 kHz, and init()
+ * sets its period from this. */
+#ifndef HEATER_PERIOD_MS
+#define HEATER_PERIOD_MS                    100
+#endif
+#define HEATER_TMR1_HZ                      62500UL
+#define HEATER_TMR1_PERIOD                  ( ( ( HEATER_PERIOD_MS * HEATER_TMR1_HZ ) / 1000 ) - 1 )
+
+/* Stirrer control period, ms, on its own timer. SCCP7 counts Fosc/2 / 64 like TMR1, and
+ * init() sets its period from this; PARAM_ID_STIR_PERIOD_MS changes it at run time. */
+#ifndef STIR_PERIOD_MS_DEFAULT
+#define STIR_PERIOD_MS_DEFAULT              10
+#endif
+#define STIR_PERIOD_MS_MIN                  2
+#define STIR_PERIOD_MS_MAX                  100
+#define STIR_TMR_HZ                         62500UL
+#define STIR_TMR_PERIOD( ms )               ( (uint16_t)( ( ( (uint32_t)(ms) * STIR_TMR_HZ ) / 1000 ) - 1 ) )
+
+/* Supply current of each load at full duty, mA, for the budget of PARAM_ID_SUPPLY_BUDGET_MA.
+ * Two 3.3 ohm cartridges at 12 V, and a 40 mm 12 V fan as the stirrer motor. */
+#ifndef HEATER_CURRENT_MA
+#define HEATER_CURRENT_MA                   7273
+#endif
+#ifndef STIR_CURRENT_MA
+#define STIR_CURRENT_MA                     150
+#endif
+
+/* Heater zones, each a thermistor and a heater output. Zone 0 is the board's heater, AN0 on
+ * ADC core 0 and SCCP1, with autotune, the model, the guard and the profile. A second zone
+ * takes AN1 on ADC core 1 and SCCP8 on RB13, a PID of its own on gains set by the host with
+ * HEATER_ZONE, see main.c hzone_*. The dsPIC33CK256MP502 has no third dedicated core. */
+#ifndef HEATER_ZONES
+#define HEATER_ZONES                        1
+#endif
+
+/* rio_spi rings and packet buffers, bytes */
+#ifndef SPI_READ_BUF_SIZE
+#define SPI_READ_BUF_SIZE                   256
+#endif
+#ifndef SPI_WRITE_BUF_SIZE
+#define SPI_WRITE_BUF_SIZE                  256
+#endif
+#ifndef SPI_PACKET_BUF_SIZE
+#define SPI_PACKET_BUF_SIZE                 128
+#endif
+#ifndef SPI_BATCH_BUF_SIZE
+#define SPI_BATCH_BUF_SIZE                  128
+#endif
+#ifndef SPI_STREAM_CHUNK_SIZE
+#define SPI_STREAM_CHUNK_SIZE               120     // Payload of a chunk frame, five history records
+#endif
+
+/* SPI EEPROM, 25AA128 (16 KB, 64 byte pages) unless the profile defines EEPROM_25AA040 */
+#if defined EEPROM_25AA040 && defined EEPROM_25AA128
+#error "Define one of EEPROM_25AA040 and EEPROM_25AA128"
+#elif defined EEPROM_25AA040
+#define EEPROM_SIZE                         0x0200
+#else
+#define EEPROM_25AA128
+#define EEPROM_SIZE                         0x4000
+#endif
+
+/* Checks. The rings are checked by rio_spi.c, the EEPROM layout by storage.c. */
+#if ( HEATER_PERIOD_MS < 1 ) || ( 1000 % HEATER_PERIOD_MS )
+#error "HEATER_PERIOD_MS must divide 1000, the loops count whole periods per second"
+#endif
+#if ( HEATER_TMR1_PERIOD > 0xFFFF )
+#error "HEATER_PERIOD_MS overflows the 16-bit TMR1 period"
+#endif
+#if ( STIR_PERIOD_MS_DEFAULT < STIR_PERIOD_MS_MIN ) || ( STIR_PERIOD_MS_DEFAULT > STIR_PERIOD_MS_MAX )
+#error "STIR_PERIOD_MS_DEFAULT must be within STIR_PERIOD_MS_MIN and STIR_PERIOD_MS_MAX"
+#endif
+#if ( HEATER_CURRENT_MA < 1 ) || ( HEATER_CURRENT_MA > 0xFFFF ) || ( STIR_CURRENT_MA > 0xFFFF )
+#error "HEATER_CURRENT_MA and STIR_CURRENT_MA must be 1 to 65535 mA"
+#endif
+#if ( HEATER_ZONES < 1 ) || ( HEATER_ZONES > 2 )
+#error "HEATER_ZONES must be 1 or 2, zone 1 takes the last dedicated ADC core"
+#endif
+#if ( SPI_PACKET_BUF_SIZE > SPI_READ_BUF_SIZE )
+#error "SPI_PACKET_BUF_SIZE must fit the read ring"
+#endif
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* BOARD_CONFIG_H */
@@ -1,6 +1,8 @@
 #ifndef COMMON_H
 #define	COMMON_H
 
+#include "board_config.h"
+
 #ifdef	__cplusplus
 extern "C" {
 #endif
@@ -8,6 +10,7 @@ extern "C" {
 /* Errors */
 #define ERR_OK                      0
 #define ERR_ERROR                   1
+#define ERR_BOOTING                 2   // No measurement yet since reset, see GET_BOOT_STATUS
 
 #define ERR_SPI_WRITE_OVERFLOW      20
 
@@ -15,16 +18,29 @@ extern "C" {
 #define ERR_PACKET_INVALID          31
 #define ERR_PACKET_TIMEOUT          32
 #define ERR_PACKET_PID_INVALID      33
+#define ERR_MODULE_ADDRESS          34      // Addressed BATCH for another module
     
 #define ERR_HEAT_TARGET_INVALID     40
 #define ERR_HEAT_PID_NOT_READY      41
 #define ERR_HEAT_AUTOTUNE_ACTIVE    42
 #define ERR_HEAT_MAX_POWER_INVALID  43
+#define ERR_HEAT_PROFILE_INVALID    44
+#define ERR_HEAT_PROFILE_ACTIVE     45
+#define ERR_HEAT_ADC_CONFIG_INVALID 46
+#define ERR_HEAT_ZONE_INVALID       47      // No such zone in this build, see HEATER_ZONES
 
 #define ERR_STIR_PID_NOT_READY      51
 
 #define ERR_EEPROM_VERIFY_FAIL      60
 
+#define ERR_PARAM_UNKNOWN           110
+#define ERR_PARAM_RANGE             111
+#define ERR_PARAM_READ_ONLY         112
+
+#define ERR_FLASH_STATE             120     // Not in a state that takes this FLASH op, see rio_flash.h
+#define ERR_FLASH_ADDRESS           121     // Unaligned, outside the partition or over FBTSEQ
+#define ERR_FLASH_WRITE             122     // Erase or write did not read back
+
 typedef uint8_t err;
 
 extern volatile uint16_t timer_ms;
@@ -1,9 +1,8 @@
 #include <stdio.h>
+#include <string.h>
 #include "mcc_generated_files/mcc.h"
 #include "eeprom.h"
-
-//#define EEPROM_25AA040
-#define EEPROM_25AA128
+#include "board_config.h"     // EEPROM part
 
 #if defined EEPROM_25AA040
     #define READ_INSTR_BYTES 2
@@ -24,7 +23,25 @@
 #define EE_CMD_RDSR     0b101   // Read Status Register
 #define EE_CMD_WRSR     0b001   // Write Status Register
 
+typedef struct
+{
+    uint16_t addr;
+    uint8_t num;
+    uint8_t done;                   // Bytes written or found already equal
+    uint8_t data[EE_QUEUE_DATA_MAX];
+} ee_queue_entry_t;
+
+/* Write queue, a FIFO of EE_QUEUE_LEN entries from ee_queue_tail */
+static ee_queue_entry_t ee_queue[EE_QUEUE_LEN];
+static uint8_t ee_queue_tail;
+static uint8_t ee_queue_count;
+static bool ee_queue_wip;           // Waiting for the page write of the oldest entry
+static ee_queue_stats_t ee_queue_counts;
+
+#ifdef EEPROM_PRINT_WRITES
 static void eeprom_print_write( uint16_t addr, uint8_t num, uint8_t *data );
+#endif
+static void eeprom_write_page_start( uint16_t addr, uint8_t num, uint8_t *data );
 
 extern bool eeprom_comms_check( void )
 {
@@ -218,7 +235,9 @@ extern void eeprom_write_bytes( uint16_t addr, uint8_t num, uint8_t *data )
     uint8_t count;
     uint8_t buf[WRITE_INSTR_BYTES];
     
-//    eeprom_print_write( addr, num, data );
+#ifdef EEPROM_PRINT_WRITES
+    eeprom_print_write( addr, num, data );
+#endif
     
     while ( num )
     {
@@ -339,6 +358,173 @@ extern void eeprom_read_write_bytes( uint16_t addr, uint8_t num, uint8_t *data )
         eeprom_write_bytes( write_addr, write_bytes, write_buf_addr );
 }
 
+extern void eeprom_queue_write( uint16_t addr, uint8_t num, uint8_t *data )
+{
+    /* Copies the data and returns, unless the queue is full. A write to the same bytes as
+     * the newest queued write that overlaps them replaces its data, so repeated saves of a
+     * value only commit the last one. */
+    uint8_t count;
+    uint8_t i;
+    uint8_t index;
+    ee_queue_entry_t *entry;
+    
+    while ( num )
+    {
+        count = ( num > EE_QUEUE_DATA_MAX ) ? EE_QUEUE_DATA_MAX : num;
+        entry = NULL;
+        
+        /* Newest overlapping entry, if not yet started */
+        for ( i = ee_queue_count; i > 0; i-- )
+        {
+            index = ( ee_queue_tail + i - 1 ) & ( EE_QUEUE_LEN - 1 );
+            if ( ( ee_queue[index].addr < ( addr + count ) ) &&
+                 ( addr < ( ee_queue[index].addr + ee_queue[index].num ) ) )
+            {
+                if ( ( ee_queue[index].addr == addr ) && ( ee_queue[index].num == count ) &&
+                     ( ( i > 1 ) || ( ( ee_queue[index].done == 0 ) && !ee_queue_wip ) ) )
+                    entry = &ee_queue[index];
+                break;
+            }
+        }
+        
+        if ( entry == NULL )
+        {
+            if ( ee_queue_count == EE_QUEUE_LEN )
+            {
+                if ( ee_queue_counts.full_waits < UINT16_MAX )
+                    ee_queue_counts.full_waits++;
+                while ( ee_queue_count == EE_QUEUE_LEN )
+                    eeprom_queue_task();
+            }
+            
+            entry = &ee_queue[( ee_queue_tail + ee_queue_count ) & ( EE_QUEUE_LEN - 1 )];
+            entry->addr = addr;
+            entry->num = count;
+            entry->done = 0;
+            ee_queue_count++;
+        }
+        memcpy( entry->data, data, count );
+        
+        num -= count;
+        addr += count;
+        data += count;
+    }
+}
+
+extern bool eeprom_queue_task( void )
+{
+    /* One step of the oldest queued write, without waiting: poll the page write in
+     * progress, start the next page that differs from the EEPROM, or verify and retire
+     * the entry. Returns true while writes are pending. */
+    ee_queue_entry_t *entry;
+    uint8_t page_buf[EE_QUEUE_DATA_MAX];
+    uint16_t addr;
+    uint8_t count;
+    
+    if ( ee_queue_count == 0 )
+        return false;
+    
+    if ( ee_queue_wip )
+    {
+        if ( eeprom_read_status().WIP )
+            return true;
+        ee_queue_wip = false;
+    }
+    
+    entry = &ee_queue[ee_queue_tail];
+    
+    if ( entry->done < entry->num )
+    {
+        addr = entry->addr + entry->done;
+        count = PAGE_SIZE - ( addr & ( PAGE_SIZE - 1 ) );
+        if ( count > ( entry->num - entry->done ) )
+            count = entry->num - entry->done;
+        
+        /* Unchanged bytes are not rewritten, to save EEPROM wear */
+        eeprom_read_bytes( addr, count, page_buf );
+        if ( memcmp( page_buf, &entry->data[entry->done], count ) != 0 )
+        {
+            eeprom_write_page_start( addr, count, &entry->data[entry->done] );
+            ee_queue_wip = true;
+        }
+        entry->done += count;
+        return true;
+    }
+    
+    if ( eeprom_verify_bytes( entry->addr, entry->num, entry->data ) == 0 )
+    {
+        if ( ee_queue_counts.committed < UINT16_MAX )
+            ee_queue_counts.committed++;
+    }
+    else if ( ee_queue_counts.verify_failed < UINT16_MAX )
+        ee_queue_counts.verify_failed++;
+    
+    ee_queue_tail = ( ee_queue_tail + 1 ) & ( EE_QUEUE_LEN - 1 );
+    ee_queue_count--;
+    
+    return ( ee_queue_count > 0 );
+}
+
+extern uint8_t eeprom_queue_pending( void )
+{
+    return ee_queue_count;
+}
+
+extern uint16_t eeprom_queue_flush( void )
+{
+    /* Commits all queued writes, waiting for each page. For start-up, before values are
+     * read back. Returns the number of writes that failed to verify. */
+    uint16_t verify_failed = ee_queue_counts.verify_failed;
+    
+    while ( eeprom_queue_task() );
+    
+    return ee_queue_counts.verify_failed - verify_failed;
+}
+
+extern void eeprom_queue_stats( ee_queue_stats_t *stats, bool reset )
+{
+    *stats = ee_queue_counts;
+    stats->pending = ee_queue_count;
+    stats->busy = ee_queue_wip;
+    
+    if ( reset )
+    {
+        ee_queue_counts.committed = 0;
+        ee_queue_counts.verify_failed = 0;
+        ee_queue_counts.full_waits = 0;
+    }
+}
+
+static void eeprom_write_page_start( uint16_t addr, uint8_t num, uint8_t *data )
+{
+    /* Starts a write within one page and returns, the EEPROM sets WIP until it is done */
+    uint8_t buf[WRITE_INSTR_BYTES];
+    
+    /* Write Enable */
+    buf[0] = EE_CMD_WREN;
+    EE_SS2OUT_SetLow();
+    SPI2_Exchange8bitBuffer( buf, 1, NULL );
+    EE_SS2OUT_SetHigh();
+    
+    /* Write */
+#if ADDR_MODE == 2
+    buf[0] = EE_CMD_WRITE | ( ( addr & 0x100 ) >> 5 );
+    buf[1] = addr & 0xFF;
+#elif ADDR_MODE == 3
+    buf[0] = EE_CMD_WRITE;
+    buf[1] = addr >> 8;
+    buf[2] = addr & 0xFF;
+#else
+    return;
+#endif
+    
+    EE_SS2OUT_SetLow();
+    SPI2_Exchange8bitBuffer( buf, WRITE_INSTR_BYTES, NULL );
+    SPI2_Exchange8bitBuffer( data, num, NULL );
+    EE_SS2OUT_SetHigh();
+}
+
+#ifdef EEPROM_PRINT_WRITES
 static void eeprom_print_write( uint16_t addr, uint8_t num, uint8_t *data )
 {
     printf( "Write block from %hu to %hu, %hu bytes =", addr, addr+num-1, num );
@@ -348,3 +534,4 @@ static void eeprom_print_write( uint16_t addr, uint8_t num, uint8_t *data )
     
     printf( "\n" );
 }
+#endif
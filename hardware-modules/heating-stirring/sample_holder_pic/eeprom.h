@@ -8,6 +8,18 @@ extern "C" {
 #define EEPROM_BLANK_U8     0xFF
 #define EEPROM_BLANK_U16    0xFFFF
 
+#define EE_QUEUE_LEN        4       // Queued writes, more wait in eeprom_queue_write()
+#define EE_QUEUE_DATA_MAX   64      // Bytes per queued write, one 25AA128 page; longer writes take several
+
+typedef struct
+{
+    uint8_t pending;                // Writes queued, including the one in progress
+    bool busy;                      // A page write is in progress
+    uint16_t committed;             // Writes committed and verified, saturating
+    uint16_t verify_failed;         // Writes that read back wrong, saturating
+    uint16_t full_waits;            // Writes that waited for a full queue, saturating
+} ee_queue_stats_t;
+
 typedef enum __attribute__((packed))
 {
     EE_PROTECT_NONE          = 0,
@@ -37,6 +49,13 @@ extern void eeprom_write_byte( uint16_t addr, uint8_t byte );
 extern void eeprom_write_bytes( uint16_t addr, uint8_t num, uint8_t *data );
 extern void eeprom_read_write_bytes( uint16_t addr, uint8_t num, uint8_t *data );
 
+/* Deferred writes, committed a page at a time by eeprom_queue_task() from the main loop */
+extern void eeprom_queue_write( uint16_t addr, uint8_t num, uint8_t *data );
+extern bool eeprom_queue_task( void );
+extern uint8_t eeprom_queue_pending( void );
+extern uint16_t eeprom_queue_flush( void );
+extern void eeprom_queue_stats( ee_queue_stats_t *stats, bool reset );
+
 #ifdef	__cplusplus
 }
 #endif
@@ -0,0 +1,37 @@
+/*
+ * File:   fault_port.h
+ *
+ * dsPIC33CK (25AA128 EEPROM) shim for the shared rio_fault module, see
+ * hardware-modules/common/rio_fault.
+ */
+
+#ifndef FAULT_PORT_H
+#define	FAULT_PORT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "eeprom.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/* EEPROM region, after the page 0 layout and the A/B slots of storage.c (0x0000-0x00BF) */
+#define FAULT_PORT_LOG_ADDR             0x0100
+#define FAULT_PORT_LOG_SIZE             0x1000  // 4 KB, 256 records
+
+/* Unwritten records wait FAULT_PORT_BATCH_S for others to join them, and writes are at least
+ * FAULT_PORT_WRITE_INTERVAL_S apart */
+#define FAULT_PORT_BATCH_S              2
+#define FAULT_PORT_WRITE_INTERVAL_S     10
+
+/* EEPROM access, writes go through the write queue committed by eeprom_queue_task() */
+#define FAULT_PORT_READ( addr, num, data )          eeprom_read_bytes( addr, num, data )
+#define FAULT_PORT_WRITE( addr, num, data )         eeprom_queue_write( addr, num, data )
+#define FAULT_PORT_WRITE_READY()                    ( eeprom_queue_pending() == 0 )
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* FAULT_PORT_H */
@@ -0,0 +1,41 @@
+/*
+ * File:   flash_port.h
+ *
+ * dsPIC33CK256MP502 (dual partition) shim for the shared rio_flash module, see
+ * hardware-modules/common/rio_flash.
+ */
+
+#ifndef FLASH_PORT_H
+#define	FLASH_PORT_H
+
+#include <xc.h>
+#include "rio_spi.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/* Program addresses with FBOOT set for dual partition (BTMODE DUAL): each partition is half
+ * of the 256 KB, the active one at 0 and the inactive one mapped at 0x400000. FBTSEQ is the
+ * last dword of a partition, after the configuration words, check the datasheet's Dual
+ * Partition Flash Configuration table for another part. */
+#define FLASH_PORT_INACTIVE             0x400000UL
+#define FLASH_PORT_PARTITION_SIZE       0x016000UL
+#define FLASH_PORT_PAGE_SIZE            0x000800UL      // 1024 instructions
+#define FLASH_PORT_FBTSEQ               0x015FFCUL
+
+/* The reply queued before the reset has been clocked out */
+#define FLASH_PORT_REPLY_SENT()         ( spi_write_bytes_written() == 0 )
+
+#ifdef __XC16__
+#define FLASH_PORT_RESET()              { __asm__ volatile ( "reset" ); }
+#else
+#define FLASH_PORT_RESET()              { hal_reset(); }
+extern void hal_reset( void );
+#endif
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* FLASH_PORT_H */
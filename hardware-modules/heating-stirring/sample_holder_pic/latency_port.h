@@ -0,0 +1,30 @@
+/*
+ * File:   latency_port.h
+ *
+ * dsPIC33CK shim for the shared rio_latency module, see
+ * hardware-modules/common/rio_latency.
+ */
+
+#ifndef LATENCY_PORT_H
+#define	LATENCY_PORT_H
+
+#include <xc.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/* Loops */
+#define LATENCY_HEATER                  0   // _ADFLTR0Interrupt() sample to heater_task(), which writes or holds the output
+#define LATENCY_STIR                    1   // CCP3 captures drained by _CCT7Interrupt() to stir_task()
+#define LATENCY_COUNT                   2
+
+/* Samples are marked in interrupts, the outputs in the main loop */
+#define LATENCY_PORT_LOCK()             { __builtin_disi( 0x3FFF ); }
+#define LATENCY_PORT_UNLOCK()           { __builtin_disi( 0x0000 ); }
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* LATENCY_PORT_H */
@@ -0,0 +1,31 @@
+/*
+ * File:   log_port.h
+ *
+ * dsPIC33CK (UART1) shim for the shared rio_log module, see
+ * hardware-modules/common/rio_log.
+ */
+
+#ifndef LOG_PORT_H
+#define	LOG_PORT_H
+
+#include <xc.h>
+#include <stdbool.h>
+#include "mcc_generated_files/uart1.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/* RIO_LOG_DEBUG adds per-cycle records, RIO_LOG_NONE builds the log out */
+#define RIO_LOG_LEVEL                   RIO_LOG_INFO
+#define RIO_LOG_BUF_SIZE                16
+
+/* UART1 TX queue, emptied by the MCC TX interrupt */
+#define RIO_LOG_TX_READY()              UART1_IsTxReady()
+#define RIO_LOG_TX( byte )              UART1_Write( byte )
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* LOG_PORT_H */
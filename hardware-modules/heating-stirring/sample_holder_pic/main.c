@@ -8,9 +8,22 @@
 #include "mcc_generated_files/mcc.h"
 #include <libpic30.h>
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
 #include "common.h"
-#include "spi.h"
+#include "rio_spi.h"
+#include "rio_log.h"
+#include "rio_probe.h"
+#include "rio_param.h"
+#include "rio_fault.h"
+#include "rio_pid.h"
+#include "rio_time.h"
+#include "rio_stage.h"
+#include "rio_latency.h"
+#include "rio_delta.h"
+#include "rio_bench.h"
+#include "rio_report.h"
+#include "rio_flash.h"
 #include "eeprom.h"
 #include "storage.h"
 
@@ -21,7 +34,7 @@
 #define PTR_TO_16BIT(ptr)               ( ( (*((uint8_t *)ptr+1)) << 8 ) | *(uint8_t *)ptr )
 #define COPY_16BIT_TO_PTR(ptr,val)      {*(ptr+1)=*((uint8_t *)&val+1); *ptr=*(uint8_t *)&val;}
 #define COPY_16BIT_TO_PTR_REV(ptr,val)  {*ptr=*((uint8_t *)&val+1); *(ptr+1)=*(uint8_t *)&val;}
-#define COPY_32BIT_TO_PTR_REV(ptr,val)  {*ptr=*((uint8_t *)&val+3); *(ptr+1)=*(uint8_t *)&val+2;\
+#define COPY_32BIT_TO_PTR_REV(ptr,val)  {*ptr=*((uint8_t *)&val+3); *(ptr+1)=*((uint8_t *)&val+2);\
                                          *(ptr+2)=*((uint8_t *)&val+1); *(ptr+3)=*(uint8_t *)&val;}
 //#define EEPROM_NSS                      PORTBbits.RB3
 
@@ -29,26 +42,45 @@
 #define PI                          3.14159265359
 
 /* Application Macros */
-#define SET_HEATER_OUTPUT(output)   { heater_output = output; CCP1RA = 0x100-((uint16_t)(output)>>8); }
+#define SET_HEATER_OUTPUT(output)   { heater_output = output; CCP1RA = pwm_hires ? ( HEATER_PWM_PRL_HIRES + 1 ) - heater_output : 0x100-((uint16_t)(output)>>8); }
 #define SET_LED_OUTPUT(output)      { CCP6RA = (LED_OUTPUT_MAX+1)-(output); }
 #define SET_STIR_OUTPUT(output)     { CCP2RA = 0x100-(output); }
 #define HPID_INTERRUPT_ON()         { IEC7bits.ADFLTR0IE = 1; }
 #define HPID_INTERRUPT_OFF()        { IEC7bits.ADFLTR0IE = 0; }
+#define STIR_INTERRUPT_ON()         { _CCT7IE = 1; }
+#define STIR_INTERRUPT_OFF()        { _CCT7IE = 0; }
 
 /* LED Constants */
 #define LED_OUTPUT_MAX              0x7FFFu
 #define LED_OUTPUT_CLIP_MAX         (uint16_t)( ( (uint32_t)LED_OUTPUT_MAX * 15 ) >> 4 )
 #define LED_OUTPUT_CLIP_MIN         (uint16_t)( ( (uint32_t)LED_OUTPUT_MAX * 1 ) >> 7 )
 
+/* PWM Constants. The heater takes the full 16 bits of heater_output on a longer period, the
+ * stirrer keeps its period and dithers the fraction of stir_output_scaled instead. */
+#define PWM_HIRES_DEFAULT           1
+#define HEATER_PWM_PRL              0xFF    // As MCC: 8 bits at TMRPS 1:64, 4.1 ms
+#define HEATER_PWM_TMRPS            3
+#define HEATER_PWM_PRL_HIRES        0xFFFE  // 16 bits at TMRPS 1:1, 16.4 ms. A compare of 0xFFFF never matches, output off.
+#define HEATER_PWM_TMRPS_HIRES      0
+
 /* Heater Read Constants */
 #define HEATER_POWER_MAX                    0xFFFF  // Timer overflow scaling
-#define HEATER_PERIOD_MS                    100
 #define HEATER_PERIOD_S_COUNTS              ( 1000 / HEATER_PERIOD_MS )
+#define SPI_PACKET_TIMEOUT_COUNTS           ( 1 + ( 200 / HEATER_PERIOD_MS ) )  // 300 ms at 100 ms, 2 periods at least
 #define HEATER_ADC_SHIFT                    8   // 16-bit ADC SHL 8 = 24-bit -> fits float
-#define HEATER_ADC_FILT_SHIFT               4
-#define HEATER_ADC_FILT_MUL                 ( ( 1 << HEATER_ADC_FILT_SHIFT ) - 1 )
+#define HEATER_ADC_FILT_SHIFT_DEFAULT       4
+#define HEATER_ADC_FILT_SHIFT_MAX           8
+#define HEATER_ADC_OVRSAM_DEFAULT           7   // ADFL0CON OVRSAM, as set by MCC
+#define HEATER_ADC_OVRSAM_MAX               7
+#define HEATER_ADC_MODE_OVERSAMPLE          0   // ADFL0CON MODE 0b00, 13 to 16-bit result
+#define HEATER_ADC_MODE_AVERAGE             1   // ADFL0CON MODE 0b11, 12-bit result
+#define HEATER_ADC_MODE_DEFAULT             HEATER_ADC_MODE_OVERSAMPLE
+#define HEATER_ADC_AVERAGE_BITS             12
+#define HEATER_NOISE_FILT_SHIFT             5   // EWMA of squared sample differences, about 3 s
+#define HEATER_NOISE_FRAC_BITS              4
+#define HEATER_NOISE_DIFF_MAX               4095
+#define HEATER_NOISE_SLOPE_COUNTS           64  // Half width of the counts to degC slope estimate
 #define HEATER_DIFF_FILT_SHIFT              7
-#define HEATER_DIFF_FILT_MUL                ( ( 1 << HEATER_DIFF_FILT_SHIFT ) - 1 )
 #define HEATER_ADC_BITS                     16
 #define HEATER_ADC_MAX                      ( ( (int32_t)1 << HEATER_ADC_BITS ) - 1 )
 #define HEATER_ADC_REG                      ADCBUF0
@@ -59,6 +91,10 @@
 #define HEATER_THERM_REF_TEMP               25
 #define HEATER_THERM_B_COEFF                3950
 #define HEATER_THERM_RES_R                  3300
+#define HEATER_THERM_TABLE_ADC_MIN          32768   // 16-bit reading at about 128 degC, first table entry
+#define HEATER_THERM_TABLE_SEG_BITS         7       // 128 counts per segment
+#define HEATER_THERM_TABLE_LEN              ( ( ( HEATER_ADC_MAX + 1 - HEATER_THERM_TABLE_ADC_MIN ) >> HEATER_THERM_TABLE_SEG_BITS ) + 1 )
+#define HEATER_THERM_FRAC_BITS              ( HEATER_THERM_TABLE_SEG_BITS + HEATER_ADC_SHIFT )  // Position in a segment of heater_adc_avg
 #define HEATER_TEMP_PRESENT_THRESHOLD       65000
 #define HEATER_TEMP_SCALE                   100
 #define HEATER_TEMP_MIN_SCALED              ( 0 * HEATER_TEMP_SCALE )
@@ -67,6 +103,19 @@
 #define HEATER_RUN_ON_START_DEFAULT         0
 #define HEATER_HEAT_POWER_LIMIT_PC_DEFAULT  100
 
+/* Heater Zone Constants, see hzone_task(). Zone 1 samples as zone 0 at its defaults. */
+#define HZONE_COUNT                         ( HEATER_ZONES - 1 )    // Zones past zone 0
+#define HZONE_ADFL_CON                      0x1C01  // ADFLxCON OVRSAM 256x, MODE oversampling, FLCHSEL AN1: 16-bit result
+#define HZONE_PPS_OCM8                      0x0016  // RPxR code of SCCP8 OCM8
+#define HZONE_FLT_EN                        0x8000  // ADFLxCON FLEN
+#define HZONE_FLT_RDY                       0x0100  // ADFLxCON RDY
+#define HZONE_CCP_ON                        0x8000  // CCPxCON1L CCPON
+#define HZONE_CCP_TMRPS_MASK                0x00C0  // CCPxCON1L TMRPS
+#define HZONE_CCP_TMRPS_SHL                 6
+#define HZONE_CCP_MOD_DUAL_EDGE             0x0005  // CCPxCON1L MOD as SCCP1: set on RA, cleared on RB at 0
+#define HZONE_OVER_SCALED                   ( HEATER_TEMP_MAX_SCALED + HGUARD_OVER_SCALED )  // Cut off above this
+#define HZONE_REPLY_SIZE                    ( sizeof(err) + 4*sizeof(uint8_t) + 6*sizeof(uint16_t) )
+
 /* Heater Autotune Constants */
 #define HTUNE_POWER_MAX                     ( heater_output_max >> 0 )
 #define HTUNE_NO_OVERSHOOT
@@ -88,8 +137,75 @@
 #define HTUNE_CONV_PASS_COUNT_THRESHOLD     3
 #define HTUNE_CONV_CYCLE_MAX_MS_PER_DEGC    ( 50 * 60 * (int32_t)1000 )
 #define HTUNE_TEMP_DEFAULT_SCALED           ( 35 * HEATER_TEMP_SCALE)
+/* Fast mode, see autotune_check_fast() */
+#define HTUNE_FLAG_FAST                     0x01
+#define HTUNE_FAST_CYCLES_MIN               3       // Log from the first full cycle
+#define HTUNE_FAST_CONV_COUNT               3       // Consecutive settled estimates needed to finish
+#define HTUNE_FAST_SPREAD_PC                10      // Max - min of ku and of tu over those, percent of the mean
+#define HTUNE_FAST_DELTA_STEP_PC            50      // Relay amplitude scale per settled cycle
+#define HTUNE_FAST_DELTA_MIN_PC             25      // Smallest relay amplitude, percent of the largest for the bias
+#define HTUNE_FAST_SWING_MIN                ( 20 * HTUNE_TRANS_TEMP_HYST )  // Smallest peak to peak temp, well above the hysteresis
+#define HTUNE_REMAINING_UNKNOWN             UINT16_MAX
+
+/* Heater Model Constants, see heater_model_identify() */
+#define HMODEL_FLAG_FEEDFORWARD             0x01
+#define HMODEL_FLAG_BOOST                   0x02    // Full power to the braking point on a step up, see heater_boost_start()
+#define HMODEL_FLAGS_ALL                    ( HMODEL_FLAG_FEEDFORWARD | HMODEL_FLAG_BOOST )
+#define HMODEL_SPAN_MIN                     ( 5 * HEATER_TEMP_SCALE )   // Smallest autotune target over ambient to identify from
+#define HMODEL_SP_WEIGHT_PC_DEFAULT         100     // Plain PID
+#define HMODEL_TRIM_PC                      25      // Integrator range with feedforward, percent of the output range
+#define HMODEL_SP_OFFSET_SHL                8
+
+/* Heater Boost Constants, see heater_boost_start() */
+#define HBOOST_STEP_MIN                     ( 2 * HEATER_TEMP_SCALE )   // Smaller steps are left to the PID
+#define HBOOST_TIMEOUT_PC                   200     // Hands over after this share of the model's boost time regardless
+
+/* Heater Observer Constants, see heater_observer_run() */
+#define HOBS_SHL                            8       // Fraction bits of the observer temperatures
+#define HOBS_SHIFT_MAX                      10      // Reading filter against the model, 2^n heater periods
+#define HOBS_ALPHA_SHL                      16      // Model step per period, HEATER_PERIOD_MS / tau
+#define HOBS_DELAY_LEN                      64      // Model temps kept, one a second, the longest dead time, power of two
+
+/* Heater Guard Constants, see heater_guard_sample() */
+#define HGUARD_STEP_MAX_SCALED              ( 2 * HEATER_TEMP_SCALE )   // Largest change between two readings, more is a sensor fault
+#define HGUARD_OVER_SCALED                  ( 5 * HEATER_TEMP_SCALE )   // Over the target with the heater on
+#define HGUARD_OVER_S                       10      // for this long, the loop cuts it within a run on a target step down
+#define HGUARD_DRIVE_PC                     75      // Output over this share of the cap is driving hard
+#define HGUARD_BAND_SCALED                  ( 2 * HEATER_TEMP_SCALE )   // Driving hard this far under the target must raise the temp
+#define HGUARD_RISE_SCALED                  ( HEATER_TEMP_SCALE / 2 )   // by this much
+#define HGUARD_RISE_S                       120     // within this time
+
+/* Heater Warm Start Constants, see heater_pid_warm_track() */
+#define HPID_WARM_BAND                      ( HEATER_TEMP_SCALE / 5 )   // Settled while this close to the target
+#define HPID_WARM_SETTLE_COUNT              ( 120 * HEATER_PERIOD_S_COUNTS )    // Recorded every 2 min while settled
+#define HPID_WARM_TARGET_BAND               ( HEATER_TEMP_SCALE / 2 )   // Without feedforward, restored for a target this close
+#define HPID_WARM_SAVE_DELTA                ( HEATER_POWER_MAX / 100 )  // Stored again only on a larger change
+#define HPID_MAP_POINTS                     4       // Settled targets kept, see heater_pid_map_record()
+#define HPID_MAP_STEP_MIN                   HPID_WARM_TARGET_BAND       // Smaller target steps, as a profile ramp's, are left to the loop
+
+/* Heater Profile Constants, see heater_profile_run() */
+#define HPROF_SEGMENTS_MAX                  16      // Fits hprof_loaded
+#define HPROF_SETPOINT_SHL                  16
+#define HPROF_SETTLE_BAND                   ( HEATER_TEMP_SCALE / 2 )   // Hold starts once the temp is this close
+#define HPROF_STATUS_SIZE                   ( 3*sizeof(uint8_t) + 3*sizeof(uint16_t) )
+
+/* History Constants, see history_capture() */
+#define HISTORY_LEN                         128 // Heater periods kept, power of two, 256 max
+#define HISTORY_REPLY_MAX                   10  // Records per GET_HISTORY reply, keeps the frame under 255 bytes
+#define HISTORY_REPLY_HEADER                ( sizeof(err) + (2*sizeof(uint16_t)) + sizeof(uint8_t) )
+#define HISTORY_RECORD_SIZE                 ( sizeof(uint32_t) + (8*sizeof(uint16_t)) + (2*sizeof(uint8_t)) )
+#define HISTORY_TERM_SHR                    1   // P, I, D terms kept in half output counts, so +-UINT16_MAX fits I16
+#define HISTORY_FLAG_HEATER_PID             0x01
+#define HISTORY_FLAG_AUTOTUNE               0x02
+#define HISTORY_FLAG_PROFILE                0x04
+#define HISTORY_FLAG_STIR                   0x08
+#define HISTORY_FLAG_BOOST                  0x10
+#define HISTORY_WORDS                       ( HISTORY_RECORD_SIZE / sizeof(uint16_t) )
+#define HISTORY_FORMAT_PLAIN                0
+#define HISTORY_FORMAT_COMPACT              1   // rio_delta records, see history_stream_fill_compact()
 
 /* Comms Constants */
+#define FIRMWARE_VERSION                    0x0100  // [major U8][minor U8], reported by GET_CAPABILITIES
 #define PACKET_TYPE_GET_ID                  1
 #define PACKET_TYPE_TEMP_SET_TARGET         2
 #define PACKET_TYPE_TEMP_GET_TARGET         3
@@ -106,6 +222,72 @@
 #define PACKET_TYPE_STIR_SPEED_GET_ACTUAL   14
 #define PACKET_TYPE_HEAT_POWER_LIMIT_SET    15
 #define PACKET_TYPE_HEAT_POWER_LIMIT_GET    16
+#define PACKET_TYPE_GET_SPI_STATS           17
+#define PACKET_TYPE_BATCH                   18
+#define PACKET_TYPE_GET_PROBE_STATS         19
+#define PACKET_TYPE_GET_TASK_STATS          20
+#define PACKET_TYPE_PID_MODEL               21
+#define PACKET_TYPE_PROFILE_SET_SEGMENT     22
+#define PACKET_TYPE_PROFILE_SET_RUNNING     23
+#define PACKET_TYPE_GET_HISTORY             24
+#define PACKET_TYPE_ADC_FILTER              25
+#define PACKET_TYPE_GET_EEPROM_STATUS       26
+#define PACKET_TYPE_PARAM_LIST              27
+#define PACKET_TYPE_PARAM_GET_MANY          28
+#define PACKET_TYPE_PARAM_SET_MANY          29
+#define PACKET_TYPE_GET_FAULT_LOG           30
+#define PACKET_TYPE_ECHO                    31
+#define PACKET_TYPE_SYNC_TIME               32
+#define PACKET_TYPE_STAGE                   33
+#define PACKET_TYPE_GET_CAPABILITIES        34
+#define PACKET_TYPE_GET_BOOT_STATUS         35
+#define PACKET_TYPE_GET_LATENCY_STATS       36
+#define PACKET_TYPE_HISTORY_STREAM          37
+#define PACKET_TYPE_BENCHMARK               38
+#define PACKET_TYPE_HEATER_ZONE             39
+#define PACKET_TYPE_SUBSCRIBE               40
+#define PACKET_TYPE_REPORT                  41  // Pushed by the firmware, never sent by the host
+#define PACKET_TYPE_FLASH                   42
+
+/* SUBSCRIBE signals, REPORT entries: the temperature as TEMP_GET_ACTUAL, the stirrer speed as
+ * STIR_SPEED_GET_ACTUAL, then the temperature of each zone past zone 0 */
+#define REPORT_SIGNAL_TEMP                  0
+#define REPORT_SIGNAL_STIR_SPEED            1
+#define REPORT_SIGNAL_ZONE                  2
+#define REPORT_SIGNALS                      ( REPORT_SIGNAL_ZONE + HZONE_COUNT )
+#define REPORT_TX_RESERVE                   64  // Write ring bytes kept free for replies
+
+/* Parameter ids of the descriptor table, see params[]. Never renumber, hosts save them. */
+#define PARAM_ID_HPID_P                     1
+#define PARAM_ID_HPID_I                     2
+#define PARAM_ID_HPID_D                     3
+#define PARAM_ID_HPID_TARGET                4
+#define PARAM_ID_HTUNE_TARGET               5
+#define PARAM_ID_HEAT_POWER_LIMIT_PC        6
+#define PARAM_ID_RUN_ON_START               7
+#define PARAM_ID_HMODEL_FLAGS               8
+#define PARAM_ID_HMODEL_SP_WEIGHT_PC        9
+#define PARAM_ID_STIR_ACCEL_RPS_S           10
+#define PARAM_ID_ADC_OVRSAM                 11
+#define PARAM_ID_ADC_MODE                   12
+#define PARAM_ID_ADC_FILT_SHIFT             13
+#define PARAM_ID_HPID_WARM_START            14
+#define PARAM_ID_PWM_HIRES                  15
+#define PARAM_ID_MODULE_ADDR                16  // Address of addressed BATCHes, SPI_MODULE_ADDR_ANY answers all
+#define PARAM_ID_STIR_PERIOD_MS             17
+#define PARAM_ID_SUPPLY_BUDGET_MA           18
+#define PARAM_ID_HOBS_SHIFT                 19  // Heater observer reading filter, 2^n periods, 0 off
+#define PARAM_ID_TRACE_MASK                 20  // TRACE_* regions on the trace pin, not stored
+#define PARAM_ID_TEMP_ACTUAL                32  // Read only from here on
+#define PARAM_ID_STIR_SPEED_RPS             33
+#define PARAM_ID_HEATER_OUTPUT_CAP          34
+#define PARAM_ID_HOBS_TEMP                  35  // Observer temperature, the reading while it is off
+
+/* Task Constants, in priority order */
+#define TASK_HEATER                         0   // Heater PID or autotune, released by the ADC filter interrupt
+#define TASK_STIR                           1   // Stirrer PID, released by the SCCP7 interrupt
+#define TASK_COUNT                          2
+#define TASK_STATS_SIZE                     ( sizeof(uint32_t) + sizeof(uint16_t) )
 
 /* Stirrer Constants*/
 //#define STIR_DEBUG
@@ -116,16 +298,84 @@
 #define STIR_SHIFT                          8
 #define STIR_AVG_SHIFT                      3
 #define STIR_AVG_MUL                        ( ( 1 << STIR_AVG_SHIFT ) - 1 )
-#define STIR_TMRH_STOP_THRESHOLD            50
+#define STIR_PERIODS_SIZE                   4   // Capture periods averaged per speed estimate, power of two.
+                                                // ( STIR_SPEED_TICKS_PER_SEC << STIR_SHIFT ) * size must fit 32 bits
+#define STIR_STALL_MS                       800 // Without a capture edge before the stirrer counts as stopped
 #define STIR_LOOP_I_SHIFT                   2
 #define STIR_LOOP_P_SHIFT                   2
 #define STIR_LOOP_I_SHIFT_BOOST             10
+#define STIR_LOOP_I_PERIOD_MS               100 // The integrator steps are per 100 ms, the rate they were tuned at
 #define STIR_SPEED_RPS_DEFAULT              10
+#define STIR_ACCEL_RPS_S_DEFAULT            5   // Setpoint ramp in rps per second, 0 steps straight to the target
+#define STIR_SPINUP_MS                      10000   // To break away from rest before a retry
+#define STIR_RECOUPLE_MS                    2000    // With the output off for the bar to recouple
+#define STIR_RETRY_MAX                      3   // Stall retries in a row before STIR_STATE_ERROR
+
+/* Log Records, see rio_log_formats[] */
+#define LOG_ID_HTUNE_START                  0
+#define LOG_ID_HTUNE_NEAREST                1
+#define LOG_ID_HTUNE_INDEX                  2
+#define LOG_ID_HTUNE_PASS                   3
+#define LOG_ID_HTUNE_SUCCESS                4
+#define LOG_ID_HTUNE_FAIL_CYCLES            5
+#define LOG_ID_HTUNE_FAIL_RATE              6
+#define LOG_ID_HTUNE_ABORT                  7
+#define LOG_ID_HTUNE_STATUS                 8
+#define LOG_ID_HTUNE_CYCLE                  9
+#define LOG_ID_HTUNE_PID                    10
+#define LOG_ID_HPID_STATUS                  11
+#define LOG_ID_HPID_TERMS                   12
+#define LOG_ID_STIR                         13
+#define LOG_ID_STIR_EXTRA                   14
+#define LOG_ID_SPI_CLEARED                  15
+#define LOG_ID_HMODEL                       16
+#define LOG_ID_HMODEL_SKIP                  17
+#define LOG_ID_STIR_STALL                   18
+#define LOG_ID_HBOOST                       19
+#define LOG_ID_HBOOST_END                   20
+#define LOG_ID_HGUARD                       21
+
+/* Fault Records, see rio_fault. Never renumber, the log outlives the firmware. */
+#define FAULT_ID_HPID_ERROR                 1   // arg E_HPID_ERROR
+#define FAULT_ID_HTUNE_FAIL                 2   // arg E_HTUNE_FAIL
+#define FAULT_ID_STIR_ERROR                 3   // arg stall retries
+#define FAULT_ID_HGUARD                     4   // arg E_HGUARD
+#define FAULT_ID_HZONE_ERROR                5   // arg ( zone << 8 ) | E_HPID_ERROR
+
+/* Scaled temperature as two record arguments, printed as "%li.%02li" */
+#define LOG_TEMP_ARGS( t )                  ( (int32_t)(t) / HEATER_TEMP_SCALE ), labs( (int32_t)(t) % HEATER_TEMP_SCALE )
 
 /* String Constants */
 const char *OK_STR = "OK";
 const char *FAIL_STR = "FAIL";
 
+const char * const rio_log_formats[] =
+{
+    [LOG_ID_HTUNE_START]        = "Autotune started at %li\n",
+    [LOG_ID_HTUNE_NEAREST]      = "Nearest %li to bias %li:\n",
+    [LOG_ID_HTUNE_INDEX]        = " index %2li bias %6li asym %6li =%3li%%\n",
+    [LOG_ID_HTUNE_PASS]         = "Pass: %li of %li\n",
+    [LOG_ID_HTUNE_SUCCESS]      = "Autotune Finished: Success\n",
+    [LOG_ID_HTUNE_FAIL_CYCLES]  = "Autotune Fail: Max Cycles\n",
+    [LOG_ID_HTUNE_FAIL_RATE]    = "Autotune Fail: Rate\n",
+    [LOG_ID_HTUNE_ABORT]        = "Autotune User Abort\n",
+    [LOG_ID_HTUNE_STATUS]       = "Temp %li.%02li (%5li), Output %5li, heating %1li, bias %5li, delta %5li, cycles %2li\n",
+    [LOG_ID_HTUNE_CYCLE]        = "  min %3li, max %3li, heattime %6li, cooltime %6li, ku x10 %li, tu ms %li\n",
+    [LOG_ID_HTUNE_PID]          = "  PID %5li %5li %5li\n",
+    [LOG_ID_HPID_STATUS]        = "State %li (%li), Temp %li.%02li / %li.%02li (%5li), Output %5li\n",
+    [LOG_ID_HPID_TERMS]         = "  PID %5li %5li %5li, i_int %6li, hdiff %6li, pt %6li, it %6li, dt %6li\n",
+    [LOG_ID_STIR]               = "Output %-3li  error %-4li  Speed avg %-3li raw %-3li window %-7li  idle %-2li  stopped %1li  at target %1li\n",
+    [LOG_ID_STIR_EXTRA]         = "    [ Captured %li  timer3 flag %li  count speed avg %3li  rps %3li ]\n",
+    [LOG_ID_SPI_CLEARED]        = "Cleared\n",
+    [LOG_ID_HMODEL]             = "Model ambient %li, ref %li at output %li, tau %li s, dead %li s\n",
+    [LOG_ID_HMODEL_SKIP]        = "Model not identified: start not cold or span %li too small\n",
+    [LOG_ID_STIR_STALL]         = "Stir stalled in phase %li, retry %li of %li\n",
+    [LOG_ID_HBOOST]             = "Boost to %li.%02li, braking at %li.%02li, within %li s\n",
+    [LOG_ID_HBOOST_END]         = "Boost ended at %li.%02li after %li s\n",
+    [LOG_ID_HGUARD]             = "Heater guard %li: temp %li.%02li, target %li.%02li, heater off\n",
+};
+const uint8_t rio_log_format_count = sizeof(rio_log_formats) / sizeof(rio_log_formats[0]);
+
 /* Defined range limits
  * - HTUNE_PERIOD_TIMEOUT_S max is UINT16_MAX / ( 1000 / HEATER_PERIOD_MS )
  *   = ( 65535 / ( 1000 / 100 ) ) = 6553s
@@ -148,11 +398,28 @@ bool status_pid_valid;
 
 /* Heater Variables */
 uint16_t heater_output_max;
+uint16_t heater_output_cap;                     // heater_output_max, less the stirrer's and other zones' share of supply_budget_ma
+uint16_t supply_budget_ma;                      // Heater and stirrer supply current, 0 for no budget
 volatile uint16_t heater_output;
+uint8_t pwm_hires;                              // Heater and stirrer PWM beyond 8 bits, see pwm_config()
 volatile uint32_t heater_adc_avg;
-volatile uint16_t heater_temp_filt;
+volatile uint16_t heater_temp_filt;           // Last filter result, scaled to 16 bits
 volatile int16_t heater_temp_c_scaled;
+volatile uint32_t heater_sample_us;             // time_now_us() when the filtered sample completed
 volatile bool heater_temp_present;
+volatile bool heater_temp_ready;                // First filtered sample taken, heater_adc_avg starts from it
+uint16_t boot_ms;                               // Reset to the first temperature sample seen by the main loop, 0 while booting
+int16_t heater_therm_table[HEATER_THERM_TABLE_LEN];    // Temperature x HEATER_TEMP_SCALE at each segment start
+
+/* Heater ADC filter configuration, RAM only. Applied by the ADC filter ISR while the filter is stopped. */
+uint8_t heater_adc_ovrsam;
+uint8_t heater_adc_mode;
+volatile uint8_t heater_adc_filt_shift;
+volatile uint8_t heater_adc_norm_shift;         // Left shift of the filter result to 16 bits
+volatile bool heater_adc_config_pending;
+volatile uint32_t heater_noise_diff_sq;         // EWMA of ( sample - previous )^2, HEATER_NOISE_FRAC_BITS fraction bits
+uint16_t heater_noise_prev;
+bool heater_noise_valid;
 
 /* Heater PID Types */
 typedef enum
@@ -168,21 +435,141 @@ typedef enum
 {
     HPID_ERROR_NONE,
     HPID_ERROR_INVALID_PID_CONSTANTS,
-    HPID_ERROR_TEMP_NOT_PRESENT
+    HPID_ERROR_TEMP_NOT_PRESENT,
+    HPID_ERROR_HEATER_GUARD
 } E_HPID_ERROR;
 
+/* Heater guard causes, the fault log argument of FAULT_ID_HGUARD */
+typedef enum
+{
+    HGUARD_OK,
+    HGUARD_TEMP_STEP,                   // Reading jumped, thermistor or wiring fault
+    HGUARD_OVER_TARGET,                 // Heating well past the target
+    HGUARD_NO_RISE,                     // Driving hard without the temperature rising, thermistor off the block
+    HGUARD_NO_SENSOR                    // Thermistor open, logged as the PID or autotune error
+} E_HGUARD;
+
 /* Heater PID Data */
 E_HPID_STATE hpid_state;
 E_HPID_ERROR hpid_error;
 int32_t hpid_p;
 int32_t hpid_i;
 int32_t hpid_d;
-int32_t hpid_integrated;
 int32_t hpid_windup_limit;
-int32_t hpid_diff;
-int32_t hpid_error_prev;
+pid_config_t hpid_config;               // Gains copied from hpid_p, hpid_i, hpid_d on each run
+pid_state_t hpid_loop;
 int16_t hpid_target;
 volatile uint16_t hpid_counter;
+int16_t hpid_target_prev;               // Target of the last heater_pid() run
+int32_t hpid_ff;                        // Feedforward output for hpid_target, see heater_pid_update_ff()
+bool hpid_ff_enabled;
+bool hpid_ff_stale;
+int32_t hpid_sp_offset;                 // Unweighted part of target steps, << HMODEL_SP_OFFSET_SHL
+store_hpid_warm_t hpid_warm;            // Last settled, output EEPROM_BLANK_U16 until the loop first settles
+uint8_t hpid_warm_enable;               // heater_pid_start() resumes from hpid_warm
+uint16_t hpid_warm_count;               // heater_pid() runs settled at hpid_warm_count_target
+int16_t hpid_warm_count_target;
+store_hpid_warm_t hpid_map[HPID_MAP_POINTS];    // Settled outputs, most recent first, output blank for a free point
+
+/* Heater Model Data */
+store_heater_model_t hmodel;
+bool hmodel_valid;
+
+/* Heater Boost Data */
+bool hboost_active;                     // heater_pid() holds full power until hboost_brake_c_scaled
+int16_t hboost_brake_c_scaled;
+uint16_t hboost_runs;                   // heater_pid() runs at full power so far
+uint16_t hboost_runs_max;
+uint16_t hboost_hold;                   // Runs left at hboost_output once braked, 0 at full power
+int32_t hboost_output;                  // Steady output for hpid_target
+
+/* Heater Observer Data */
+uint8_t hobs_shift;                     // Reading filter against the model, 0 runs heater_pid() on the reading
+bool hobs_valid;                        // Started from a reading on the present model
+int32_t hobs_alpha;                     // HEATER_PERIOD_MS / tau << HOBS_ALPHA_SHL
+int32_t hobs_model;                     // Model temp driven by heater_output, scaled << HOBS_SHL
+int32_t hobs_offset;                    // Unfiltered reading less the model, low passed, same scale
+int16_t hobs_c_scaled;                  // Observer temp, model plus offset
+int16_t hobs_delay[HOBS_DELAY_LEN];     // Model temp of the last seconds, scaled, for the dead time
+uint8_t hobs_delay_head;                // Next written
+uint8_t hobs_delay_periods;             // Heater periods into the present second
+
+/* Heater Guard Data */
+volatile uint8_t hguard_trip;           // E_HGUARD, set by the ADC filter interrupt, handled by heater_task()
+int16_t hguard_raw_prev;                // Last unfiltered reading
+bool hguard_raw_valid;
+int16_t hguard_watch_c_scaled;          // Temp when the heater started driving hard
+uint16_t hguard_watch_count;            // Samples driving hard without HGUARD_RISE_SCALED over it
+uint16_t hguard_over_count;             // Samples over the target with the heater on
+
+/* Heater Zone Data. Each zone past zone 0 runs a PID of its own on gains set by the host,
+ * without the autotune, model, boost, guard and profile of zone 0. hzone[0] is zone 1. */
+typedef struct
+{
+    E_HPID_STATE state;                 // UNCONFIGURED until the host sets gains
+    E_HPID_ERROR error;
+    int16_t target;
+    uint16_t p;
+    uint16_t i;
+    uint16_t d;
+    pid_config_t config;
+    pid_state_t loop;
+    uint32_t adc_avg;                   // IIR of the filter results, << HEATER_ADC_SHIFT
+    int16_t temp_c_scaled;
+    bool present;
+    bool ready;                         // adc_avg holds a sample
+    uint16_t output;
+} heater_zone_t;
+
+/* Hardware of each zone past zone 0, its ADC filter and the SCCP driving its heater */
+typedef struct
+{
+    volatile uint16_t *flt_con;         // ADFLxCON
+    volatile uint16_t *flt_dat;         // ADFLxDAT
+    volatile uint16_t *ccp_con;         // CCPxCON1L
+    volatile uint16_t *ccp_prl;         // CCPxPRL
+    volatile uint16_t *ccp_ra;          // CCPxRA
+} heater_zone_hw_t;
+
+#if HEATER_ZONES > 1
+heater_zone_t hzone[HZONE_COUNT];
+
+const heater_zone_hw_t hzone_hw[HZONE_COUNT] =
+{
+    { &ADFL1CON, &ADFL1DAT, &CCP8CON1L, &CCP8PRL, &CCP8RA },   // Zone 1: AN1 on core 1, SCCP8 on RB13
+};
+#endif
+
+/* Heater Profile Types */
+typedef enum
+{
+    HPROF_STATE_IDLE,
+    HPROF_STATE_RAMP,               // Setpoint moving to the segment target
+    HPROF_STATE_SETTLE,             // Setpoint at target, waiting for the temp to reach it
+    HPROF_STATE_HOLD,
+    HPROF_STATE_DONE,
+    HPROF_STATE_ABORTED
+} E_HPROF_STATE;
+
+typedef struct
+{
+    int16_t target;                 // Scaled temp
+    uint16_t ramp_rate;             // Scaled temp per minute, 0 steps straight to the target
+    uint16_t hold_s;
+} hprof_segment_t;
+
+/* Heater Profile Data */
+hprof_segment_t hprof_segments[HPROF_SEGMENTS_MAX];
+uint16_t hprof_loaded;              // Bit per uploaded segment
+E_HPROF_STATE hprof_state;
+bool hprof_active;
+uint8_t hprof_length;
+uint8_t hprof_cycles;               // 0 repeats until stopped
+uint8_t hprof_segment;
+uint16_t hprof_cycle;               // Full passes completed
+int32_t hprof_setpoint;             // Scaled temp << HPROF_SETPOINT_SHL
+int32_t hprof_step;                 // Setpoint change per heater period, same scale
+uint32_t hprof_hold_counts;         // Heater periods of hold left
 
 /* Autotune Types */
 typedef enum
@@ -199,7 +586,8 @@ typedef enum
     HTUNE_FAIL_NONE,
     HTUNE_FAIL_RATE,
     HTUNE_FAIL_CYCLES,
-    HTUNE_FAIL_TEMP_NOT_PRESENT
+    HTUNE_FAIL_TEMP_NOT_PRESENT,
+    HTUNE_FAIL_HEATER_GUARD
 } E_HTUNE_FAIL;
 
 /* Autotune Data */
@@ -209,6 +597,13 @@ bool htune_active;
 bool htune_heating;
 uint16_t htune_bias;
 uint16_t htune_delta;
+uint8_t htune_delta_pc;                         // Relay amplitude, percent of the largest for the bias
+bool htune_fast;
+uint8_t htune_fast_start;                       // First htune_log[] index of the settled window
+uint8_t htune_pass_count;                       // From the last autotune_check_cycle()
+uint16_t htune_swing;                           // Peak to peak temp of the last cycle
+int16_t htune_ambient;                          // Heater temp at the start
+bool htune_ambient_valid;                       // Heater was off at the start
 int16_t htune_target;
 uint16_t htune_cycles;
 uint16_t htune_timer;
@@ -230,6 +625,7 @@ int32_t htune_log[HTUNE_CYCLES_MAX][2];
 float htune_log_ku[HTUNE_CYCLES_MAX];
 float htune_log_tu[HTUNE_CYCLES_MAX];
 uint8_t htune_log_index;
+uint8_t htune_log_sorted[HTUNE_CYCLES_MAX];     // htune_log[] indices in bias order, see autotune_log_insert()
 bool htune_run_checks;
 uint16_t htune_cycle_start_time;
 int16_t htune_cycle_start_temp_scaled;
@@ -240,9 +636,16 @@ typedef enum
     STIR_STATE_UNCONFIGURED,
     STIR_STATE_READY,
     STIR_STATE_RUNNING,
-    STIR_STATE_ERROR
+    STIR_STATE_ERROR                                // Still stalled after STIR_RETRY_MAX retries
 } E_STIR_STATE;
 
+typedef enum
+{
+    STIR_PHASE_SPINUP,                              // Integrator boost until the stirrer turns
+    STIR_PHASE_RAMP,                                // Acceleration limited setpoint, then at target
+    STIR_PHASE_RECOUPLE                             // Output off after a stall, before spinning up again
+} E_STIR_PHASE;
+
 /* Stirrer Data */
 #ifdef STIR_DEBUG_EXTRA
 volatile uint16_t stir_count_speed;
@@ -255,26 +658,109 @@ E_STIR_STATE stir_state;
 uint16_t stir_target;
 volatile uint16_t stir_speed_rps_avg;
 volatile uint16_t stir_speed_rps_avg_scaled;
+uint16_t stir_speed_rps;                        // Latest window estimate, held while no edges arrive
 volatile uint16_t stir_output;
 volatile int32_t stir_output_integrator;
 volatile int32_t stir_output_scaled;
+uint8_t stir_output_dither;                     // Fraction of stir_output_scaled carried to the next loop
 volatile uint8_t stir_at_target;
 volatile uint8_t stir_stopped;
+E_STIR_PHASE stir_phase;
+uint16_t stir_phase_ms;
+uint32_t stir_setpoint_scaled;                  // Ramped target, STIR_SHIFT fraction bits
+uint8_t stir_accel_rps_s;
+uint16_t stir_ramp_rem;                         // Setpoint step carried to the next run, 1/1000 of STIR_SHIFT units
+uint8_t stir_period_ms;                         // Stir task period, SCCP7
+uint8_t stir_retries;                           // Stall retries since last at target
+uint8_t stir_stalls;                            // Stalls since started, saturating
+
+/* History Types */
+typedef struct
+{
+    uint32_t time_us;               // heater_sample_us of the period, first so the record packs to 22 bytes
+    uint16_t seq;                   // Heater periods since reset, wrapping
+    int16_t temp_c_scaled;
+    int16_t target_c_scaled;        // hpid_target, or the autotune target
+    uint16_t heater_output;
+    int16_t hpid_terms[3];          // P, I, D >> HISTORY_TERM_SHR, 0 outside heater_pid()
+    uint16_t stir_speed_rps;        // stir_speed_rps_avg
+    uint8_t stir_output;
+    uint8_t flags;                  // HISTORY_FLAG_*
+} history_record_t;
+
+/* History Data */
+history_record_t history[HISTORY_LEN];
+uint8_t history_head;               // Next record written
+uint16_t history_count;
+uint16_t history_seq;               // Seq of the next record
+int16_t hpid_terms[3];              // Last P, I, D terms of heater_pid(), for the history
+uint16_t history_stream_seq;        // First record of the HISTORY_STREAM transfer, the next one if compact
+uint16_t history_stream_end;        // Seq after its last record
+delta_coder_t history_coder;
+uint16_t history_prev[HISTORY_WORDS];
+uint8_t history_pending[DELTA_RECORD_MAX( HISTORY_WORDS )];    // Compact record being sent, it may span chunks
+uint8_t history_pending_size;
+uint8_t history_pending_pos;
+
+/* Task Types */
+typedef struct
+{
+    void (*run)( void );
+    volatile uint8_t pending;       // Set by the releasing interrupt, cleared when the task starts
+    volatile uint16_t missed;       // Released again before it ran, saturating
+    uint32_t runs;
+} task_t;
+
+/* Task Data */
+void heater_task( void );
+void stir_task( void );
+task_t tasks[TASK_COUNT] =
+{
+    [TASK_HEATER]   = { heater_task },
+    [TASK_STIR]     = { stir_task },
+};
+
+/* CCP3 capture periods, drained from the capture FIFO by _CCT7Interrupt() for stir_pid() */
+volatile uint32_t stir_periods[STIR_PERIODS_SIZE];
+volatile uint8_t stir_periods_head;             // Next entry written
+volatile uint8_t stir_periods_count;            // Valid entries, up to STIR_PERIODS_SIZE
+volatile uint8_t stir_periods_new;              // Entries captured since the last stir_pid()
+volatile uint16_t stir_idle_ms;                 // Since the last edge, saturating at STIR_STALL_MS
+
+/* TEMP_GET_ACTUAL and STIR_SPEED_GET_ACTUAL replies, published as the values change */
+spi_reply_cache_t temp_actual_reply;
+spi_reply_cache_t stir_speed_actual_reply;
 
 /* Packet Data */
-uint8_t slave_select;
 spi_packet_buf_t spi_packet;
 uint8_t packet_type;
-uint8_t packet_data[SPI_PACKET_BUF_SIZE];
+uint8_t *packet_data;               // Points into spi_packet.buf
 uint8_t packet_data_size;
 
 /* Static Function Prototypes */
 void stir_pid();
+void stir_periods_clear( void );
+void stir_capture_read( void );
 void heater_pid_start( void );
+void heater_pid_warm_start( void );
+bool heater_boost_start( void );
+int16_t heater_pid_temp( void );
 void autotune( bool write_output );
 void stir_pid_start( void );
 void stir_pid_stop( void );
+void stir_timer_config( void );
+void stir_setpoint_ramp( void );
+void stir_stall_retry( void );
+uint8_t heater_adc_result_bits( uint8_t ovrsam, uint8_t mode );
+void heater_adc_noise_update( uint16_t sample );
+void heater_guard_sample( int16_t raw_c_scaled );
+void heater_guard_reset( void );
+void heater_guard_stop( void );
 void set_heat_power_limit_pc( uint8_t heat_power_limit_pc );
+void heater_budget_update( void );
+uint16_t heater_zone_cap( uint8_t zone );
+void pwm_config( void );
+uint16_t stir_output_dithered( int32_t output_scaled );
 bool pid_valid( int32_t pid_p, int32_t pid_i, int32_t pid_d );
 void validate_pid_constants_state( void );
 bool status_check( void );
@@ -288,15 +774,24 @@ inline int32_t constrain_i32( int32_t value, int32_t min, int32_t max )
     else return value;
 }
 
+/* Heater loop step, shifts: P, I, D, output, D filter */
+PID_STEP_DEFINE( hpid_step, HTUNE_KP_SHL, HTUNE_KI_SHL, HTUNE_KD_SHR, 0, HEATER_DIFF_FILT_SHIFT )
+
 void heater_pid_start( void )
 {
     if ( ( hpid_state == HPID_STATE_READY ) || ( hpid_state == HPID_STATE_SUSPENDED ) )
     {
         HPID_INTERRUPT_OFF();
 
-        hpid_integrated = 0;
-        hpid_diff = 0;
-        hpid_error_prev = 0;
+        pid_reset( &hpid_loop, heater_pid_temp() );
+        
+        /* Weight the step from the present temperature like any later target step */
+        hpid_target_prev = hpid_target;
+        hpid_sp_offset = ( (int32_t)hpid_target - heater_pid_temp() ) * ( 100 - hmodel.sp_weight_pc ) * ( (int32_t)1 << HMODEL_SP_OFFSET_SHL ) / 100;
+        hpid_ff_stale = true;
+        heater_pid_warm_start();
+        heater_boost_start();
+        heater_guard_reset();
 
         if ( htune_active )
             htune_state = HTUNE_STATE_ABORTED;
@@ -308,6 +803,309 @@ void heater_pid_start( void )
     }
 }
 
+int32_t heater_model_output( int16_t target )
+{
+    /* Steady-state heater output for <target> from the plant model, in proportion to the
+     * temperature rise over ambient */
+    int32_t rise;
+    
+    rise = constrain_i32( (int32_t)target - hmodel.ambient_c_scaled, 0, INT16_MAX );
+    
+    return ( (int32_t)hmodel.ref_output * rise ) / ( (int32_t)hmodel.ref_c_scaled - hmodel.ambient_c_scaled );
+}
+
+void heater_pid_update_ff( void )
+{
+    /* Feedforward output for hpid_target.  Only runs when the target or the model changes. */
+    int32_t ff;
+    int32_t integrated_min;
+    int32_t integrated_max;
+    
+    ff = 0;
+    hpid_ff_enabled = hmodel_valid && ( hmodel.flags & HMODEL_FLAG_FEEDFORWARD );
+    if ( hpid_ff_enabled )
+        ff = heater_model_output( hpid_target );
+    
+    hpid_ff = constrain_i32( ff, 0, heater_output_max );
+    hpid_ff_stale = false;
+    
+    /* Total output stays within [0, hpid_windup_limit].  With feedforward the integrator only
+     * trims the model error, which keeps it from winding up during a step. */
+    integrated_min = -hpid_ff;
+    integrated_max = hpid_windup_limit - hpid_ff;
+    if ( hpid_ff_enabled )
+    {
+        integrated_min = MAX( integrated_min, -( ( (int32_t)heater_output_max * HMODEL_TRIM_PC ) / 100 ) );
+        integrated_max = MIN( integrated_max, ( (int32_t)heater_output_max * HMODEL_TRIM_PC ) / 100 );
+    }
+    
+    hpid_config.p_limit = UINT16_MAX;
+    hpid_config.d_limit = UINT16_MAX;
+    hpid_config.i_change_limit = (int32_t)UINT16_MAX << HTUNE_KI_SHL;
+    hpid_config.i_min = integrated_min << HTUNE_KI_SHL;
+    hpid_config.i_max = integrated_max << HTUNE_KI_SHL;
+    hpid_config.out_min = 0;
+    hpid_config.out_max = heater_output_max;
+}
+
+void heater_pid_map_record( store_hpid_warm_t *warm )
+{
+    /* Puts the settled output <warm> first in hpid_map[], in place of the point for its target
+     * if there is one, else of the least recently settled */
+    uint8_t index;
+    
+    for ( index=0; index<( HPID_MAP_POINTS - 1 ); index++ )
+    {
+        if ( ( hpid_map[index].output != EEPROM_BLANK_U16 ) && ( hpid_map[index].target_c_scaled == warm->target_c_scaled ) )
+            break;
+    }
+    memmove( &hpid_map[1], &hpid_map[0], index * sizeof(store_hpid_warm_t) );
+    hpid_map[0] = *warm;
+}
+
+int32_t heater_pid_map_output( int16_t target )
+{
+    /* Steady output for <target> from hpid_map[]: on the line between the nearest points
+     * either side.  Past them, with feedforward, the model for <target> plus the model error
+     * at the nearest point, which holds at any target; without, the nearest point's output
+     * only near its own target.  -1 if there is none. */
+    store_hpid_warm_t *lo = NULL;
+    store_hpid_warm_t *hi = NULL;
+    store_hpid_warm_t *near;
+    uint8_t index;
+    
+    for ( index=0; index<HPID_MAP_POINTS; index++ )
+    {
+        if ( hpid_map[index].output == EEPROM_BLANK_U16 )
+            continue;
+        if ( ( hpid_map[index].target_c_scaled <= target ) && ( ( lo == NULL ) || ( hpid_map[index].target_c_scaled > lo->target_c_scaled ) ) )
+            lo = &hpid_map[index];
+        if ( ( hpid_map[index].target_c_scaled >= target ) && ( ( hi == NULL ) || ( hpid_map[index].target_c_scaled < hi->target_c_scaled ) ) )
+            hi = &hpid_map[index];
+    }
+    
+    if ( ( lo != NULL ) && ( hi != NULL ) )
+    {
+        if ( lo == hi )
+            return lo->output;
+        return lo->output + ( ( (int32_t)hi->output - lo->output ) * ( target - lo->target_c_scaled ) ) / ( hi->target_c_scaled - lo->target_c_scaled );
+    }
+    
+    near = ( lo != NULL ) ? lo : hi;
+    if ( near == NULL )
+        return -1;
+    if ( hpid_ff_enabled )
+        return constrain_i32( heater_model_output( target ) + (int32_t)near->output - heater_model_output( near->target_c_scaled ), 0, heater_output_max );
+    if ( labs( (int32_t)target - near->target_c_scaled ) <= HPID_WARM_TARGET_BAND )
+        return near->output;
+    return -1;
+}
+
+void heater_pid_map_preload( void )
+{
+    /* Sets the integrator so the output, with the feedforward already updated for
+     * hpid_target, is the steady output the map has for it */
+    int32_t output;
+    
+    output = heater_pid_map_output( hpid_target );
+    if ( output >= 0 )
+        hpid_loop.integrated = constrain_i32( ( output - hpid_ff ) << HTUNE_KI_SHL, hpid_config.i_min, hpid_config.i_max );
+}
+
+void heater_pid_warm_start( void )
+{
+    /* Starts the integrator where the loop last settled, so it resumes near steady state
+     * instead of winding up from zero.  The map holds the last settled output, loaded from
+     * the EEPROM at start-up, and the others since. */
+    hpid_warm_count = 0;
+    if ( !hpid_warm_enable )
+        return;
+    
+    heater_pid_update_ff();
+    heater_pid_map_preload();
+}
+
+void heater_pid_warm_track( int32_t error )
+{
+    /* Each time the loop has held its target within HPID_WARM_BAND for another
+     * HPID_WARM_SETTLE_COUNT runs, records its steady output, feedforward plus integrator,
+     * for heater_pid_warm_start().  Stored only if it moved, so it follows a slow drift
+     * without writing the EEPROM every time. */
+    store_hpid_warm_t warm;
+    
+    if ( hpid_target != hpid_warm_count_target )
+    {
+        hpid_warm_count_target = hpid_target;
+        hpid_warm_count = 0;
+    }
+    
+    if ( labs( error ) > HPID_WARM_BAND )
+    {
+        hpid_warm_count = 0;
+        return;
+    }
+    
+    if ( ++hpid_warm_count < HPID_WARM_SETTLE_COUNT )
+        return;
+    hpid_warm_count = 0;
+    
+    warm.target_c_scaled = hpid_target;
+    warm.output = constrain_i32( hpid_ff + ( hpid_loop.integrated >> HTUNE_KI_SHL ), 0, MIN( heater_output_max, EEPROM_BLANK_U16 - 1 ) );
+    heater_pid_map_record( &warm );
+    if ( ( hpid_warm.output == EEPROM_BLANK_U16 ) || ( warm.target_c_scaled != hpid_warm.target_c_scaled ) ||
+         ( labs( (int32_t)warm.output - hpid_warm.output ) > HPID_WARM_SAVE_DELTA ) )
+    {
+        hpid_warm = warm;
+        store_save_hpid_warm( &hpid_warm );
+    }
+}
+
+int32_t heater_boost_output( void )
+{
+    /* Steady output for hpid_target, the map's or else the model's */
+    int32_t output;
+    
+    output = heater_pid_map_output( hpid_target );
+    if ( output < 0 )
+        output = MIN( heater_model_output( hpid_target ), heater_output_max );
+    
+    return output;
+}
+
+bool heater_boost_start( void )
+{
+    /* Time-optimal warm-up on the plant model: full power, then the steady output from the
+     * braking point on.  At full power the model heads for full = ambient + K max, and the
+     * temperature read lags the heater by the dead time L.  Cut when the reading reaches
+     *   brake = full - ( full - target ) e^( L / tau )
+     * and the heater is at the target already, the reading following it over L, with no
+     * overshoot on the model.  Only for a step up of HBOOST_STEP_MIN or more that full power
+     * can finish short of. */
+    float full;
+    float brake;
+    float time_s;
+    
+    hboost_active = false;
+    if ( !hmodel_valid || !( hmodel.flags & HMODEL_FLAG_BOOST ) || ( hmodel.ref_output == 0 ) )
+        return false;
+    if ( ( (int32_t)hpid_target - heater_temp_c_scaled ) < HBOOST_STEP_MIN )
+        return false;
+    
+    full = hmodel.ambient_c_scaled + (float)( (int32_t)hmodel.ref_c_scaled - hmodel.ambient_c_scaled ) * heater_output_max / hmodel.ref_output;
+    if ( full <= hpid_target )
+        return false;                   // Never gets there, the PID saturates anyway
+    brake = full - ( full - hpid_target ) * exp( (float)hmodel.dead_s / MAX( hmodel.tau_s, 1 ) );
+    if ( brake <= heater_temp_c_scaled )
+        return false;                   // Already within the braking distance
+    
+    /* Full power runs for tau ln( ( full - temp ) / ( full - brake ) ) on the model, allow
+     * HBOOST_TIMEOUT_PC of that before braking on a model that is wrong */
+    time_s = hmodel.tau_s * log( ( full - heater_temp_c_scaled ) / ( full - brake ) );
+    hboost_brake_c_scaled = brake;
+    hboost_runs = 0;
+    hboost_runs_max = constrain_i32( time_s * HEATER_PERIOD_S_COUNTS * HBOOST_TIMEOUT_PC / 100 + HEATER_PERIOD_S_COUNTS, 1, UINT16_MAX );
+    hboost_hold = 0;
+    hboost_active = true;
+    
+    LOG_INFO( LOG_ID_HBOOST, LOG_TEMP_ARGS( hpid_target ), LOG_TEMP_ARGS( hboost_brake_c_scaled ), (int32_t)( time_s + 0.5f ) );
+    return true;
+}
+
+bool heater_boost_run( void )
+{
+    /* One heater_pid() run of the boost: full power to the braking point, then the steady
+     * output for the dead time while the reading catches up.  The PID would see the reading
+     * still rising at the target and D would cut the output, so it waits.  False once done. */
+    if ( hboost_hold == 0 )
+    {
+        if ( ( heater_temp_c_scaled < hboost_brake_c_scaled ) && ( hboost_runs < hboost_runs_max ) )
+        {
+            hboost_runs++;
+            SET_HEATER_OUTPUT( heater_output_cap );
+            return true;
+        }
+        
+        LOG_INFO( LOG_ID_HBOOST_END, LOG_TEMP_ARGS( heater_temp_c_scaled ), (int32_t)( hboost_runs / HEATER_PERIOD_S_COUNTS ) );
+        hboost_output = heater_boost_output();
+        hboost_hold = MIN( (uint32_t)hmodel.dead_s * HEATER_PERIOD_S_COUNTS, UINT16_MAX - 1 ) + 1;
+    }
+    
+    if ( --hboost_hold == 0 )
+        return false;
+    SET_HEATER_OUTPUT( hboost_output );
+    return true;
+}
+
+void heater_boost_end( void )
+{
+    /* Hands over to the PID with the integrator at the steady output for hpid_target.  The
+     * error left is moved into the setpoint offset, so P takes it over at the integral rate
+     * instead of kicking the output, and D starts from the present temperature. */
+    hboost_active = false;
+    
+    heater_pid_update_ff();
+    pid_reset( &hpid_loop, heater_pid_temp() );
+    hpid_loop.integrated = constrain_i32( ( heater_boost_output() - hpid_ff ) << HTUNE_KI_SHL, hpid_config.i_min, hpid_config.i_max );
+    hpid_sp_offset = ( (int32_t)hpid_target - heater_pid_temp() ) * ( (int32_t)1 << HMODEL_SP_OFFSET_SHL );
+}
+
+void heater_observer_run( int16_t raw_c_scaled )
+{
+    /* Temperature for heater_pid() without the lag of the IIR on the reading. The plant model,
+     * K / ( 1 + tau s ) driven by heater_output over the last period, gives the fast part and
+     * the unfiltered reading, low passed against the model over 2^hobs_shift periods, the slow
+     * part. The two add up to the reading at steady state whatever the model error, and the
+     * noise is the reading's through the filter alone. The model leaves out the dead time, so
+     * the observer leads the reading by it, as a Smith predictor would. Off without a model. */
+    int32_t raw;
+    int32_t steady;
+    int16_t delayed;
+    uint8_t index;
+    
+    if ( ( hobs_shift == 0 ) || !hmodel_valid || ( hmodel.ref_output == 0 ) )
+    {
+        hobs_valid = false;
+        return;
+    }
+    
+    raw = (int32_t)raw_c_scaled << HOBS_SHL;
+    if ( !hobs_valid )
+    {
+        hobs_alpha = ( (int32_t)HEATER_PERIOD_MS << HOBS_ALPHA_SHL ) / ( (int32_t)MAX( hmodel.tau_s, 1 ) * 1000 );
+        hobs_model = raw;
+        hobs_offset = 0;
+        hobs_valid = true;
+        for ( index=0; index<HOBS_DELAY_LEN; index++ )
+            hobs_delay[index] = raw_c_scaled;
+        hobs_delay_head = 0;
+        hobs_delay_periods = 0;
+    }
+    else
+    {
+        /* Temp rise over ambient in proportion to the output, as heater_model_output() */
+        steady = hmodel.ambient_c_scaled + ( (int32_t)( hmodel.ref_c_scaled - hmodel.ambient_c_scaled ) * heater_output ) / hmodel.ref_output;
+        hobs_model += ( (int64_t)( ( steady << HOBS_SHL ) - hobs_model ) * hobs_alpha ) >> HOBS_ALPHA_SHL;
+        
+        if ( ++hobs_delay_periods >= HEATER_PERIOD_S_COUNTS )
+        {
+            hobs_delay_periods = 0;
+            hobs_delay[hobs_delay_head] = hobs_model >> HOBS_SHL;
+            hobs_delay_head = ( hobs_delay_head + 1 ) & ( HOBS_DELAY_LEN - 1 );
+        }
+        index = ( hobs_delay_head - 1 - MIN( hmodel.dead_s, HOBS_DELAY_LEN - 1 ) ) & ( HOBS_DELAY_LEN - 1 );
+        delayed = hobs_delay[index];
+        hobs_offset += ( raw - ( (int32_t)delayed << HOBS_SHL ) - hobs_offset ) >> hobs_shift;
+    }
+    
+    hobs_c_scaled = constrain_i32( ( hobs_model + hobs_offset ) >> HOBS_SHL, INT16_MIN, INT16_MAX );
+}
+
+int16_t heater_pid_temp( void )
+{
+    /* The temperature heater_pid() tracks */
+    return hobs_valid ? hobs_c_scaled : heater_temp_c_scaled;
+}
+
 void heater_pid( void )
 {
     /* To prevent overflow, we constrain values and terms such that when
@@ -315,55 +1113,99 @@ void heater_pid( void )
      */
     
     int32_t output;
-    int32_t diff;
     int32_t error;
+    int32_t error_weighted;
+    int32_t decay;
+    int16_t temp;
+    bool boosting;
     
     hpid_counter++;
     
-    error = (int32_t)hpid_target - (int32_t)heater_temp_c_scaled;
+    if ( hpid_target != hpid_target_prev )
+    {
+        hpid_sp_offset += ( (int32_t)hpid_target - hpid_target_prev ) * ( 100 - hmodel.sp_weight_pc ) * ( (int32_t)1 << HMODEL_SP_OFFSET_SHL ) / 100;
+        hpid_sp_offset = constrain_i32( hpid_sp_offset, (int32_t)INT16_MIN * ( (int32_t)1 << HMODEL_SP_OFFSET_SHL ), (int32_t)INT16_MAX * ( (int32_t)1 << HMODEL_SP_OFFSET_SHL ) );
+        hpid_ff_stale = true;
+        
+        /* A step to a target the loop has settled at, or near one, takes the output the map
+         * has for it at once, instead of the integrator working its way there */
+        if ( hpid_warm_enable && ( labs( (int32_t)hpid_target - hpid_target_prev ) > HPID_MAP_STEP_MIN ) )
+        {
+            heater_pid_update_ff();
+            heater_pid_map_preload();
+        }
+        
+        /* A large step up boosts, a step during a boost moves its braking point or ends it */
+        boosting = hboost_active;
+        if ( boosting || ( ( (int32_t)hpid_target - hpid_target_prev ) >= HBOOST_STEP_MIN ) )
+        {
+            if ( !heater_boost_start() && boosting )
+                heater_boost_end();
+        }
+        hpid_target_prev = hpid_target;
+    }
+    
+    if ( hpid_ff_stale )
+        heater_pid_update_ff();
+    
+    if ( hboost_active )
+    {
+        if ( heater_boost_run() )
+            return;
+        heater_boost_end();
+    }
+    
+    temp = heater_pid_temp();
+    error = (int32_t)hpid_target - (int32_t)temp;
     error = constrain_i32( error, INT16_MIN, INT16_MAX );
     
-    hpid_integrated += constrain_i32( error * hpid_i, -(int32_t)UINT16_MAX << HTUNE_KI_SHL, UINT16_MAX << HTUNE_KI_SHL );
-    hpid_integrated = constrain_i32( hpid_integrated, 0, hpid_windup_limit << HTUNE_KI_SHL );
-    diff = ( constrain_i32( error - hpid_error_prev, INT16_MIN, INT16_MAX ) * hpid_d ) << HTUNE_KD_SHR;
-    hpid_diff = ( ( hpid_diff * HEATER_DIFF_FILT_MUL ) + diff ) >> HEATER_DIFF_FILT_SHIFT;
-    hpid_error_prev = error;
+    /* Setpoint weighting: P sees only sp_weight_pc of a target step at first, and D none of
+     * it as it acts on the temperature.  The rest is handed over at the integral rate, ki / kp
+     * per run, which is the usual weighted 2-DOF PID without the integrator having to carry
+     * ( 1 - weight ) * kp * target.  Q16 decay. */
+    if ( hpid_sp_offset != 0 )
+    {
+        decay = MIN( ( hpid_i << ( 16 - ( HTUNE_KI_SHL - HTUNE_KP_SHL ) ) ) / MAX( hpid_p, 1 ), (int32_t)1 << 16 );
+        hpid_sp_offset -= (int32_t)( ( (int64_t)hpid_sp_offset * decay ) >> 16 );
+    }
+    error_weighted = constrain_i32( error - ( hpid_sp_offset >> HMODEL_SP_OFFSET_SHL ), INT16_MIN, INT16_MAX );
     
-//    output = constrain_i32( ( error * hpid_p ) >> HTUNE_KP_SHL, -(int32_t)UINT16_MAX, UINT16_MAX ) +
-//             hpid_integrated >> HTUNE_KI_SHL +
-//             constrain_i32( hpid_diff, -(int32_t)UINT16_MAX, UINT16_MAX );
-    output = constrain_i32( ( error * hpid_p ) >> HTUNE_KP_SHL, -(int32_t)UINT16_MAX, UINT16_MAX ) +
-             ( hpid_integrated >> HTUNE_KI_SHL ) +
-             constrain_i32( hpid_diff, -(int32_t)UINT16_MAX, UINT16_MAX );
-    output = constrain_i32( output, 0, heater_output_max );
+    /* While the output is saturated the integrator is pulled back by the excess, in place of
+     * holding it.  With feedforward it may go negative, to trim the model error. */
+    hpid_config.kp = hpid_p;
+    hpid_config.ki = hpid_i;
+    hpid_config.kd = hpid_d;
+    hpid_config.out_max = heater_output_cap;
+    output = hpid_step( &hpid_config, &hpid_loop, error, error_weighted, temp, hpid_ff );
+    heater_pid_warm_track( error );
+    
+    hpid_terms[0] = constrain_i32( hpid_loop.p_term >> HISTORY_TERM_SHR, INT16_MIN, INT16_MAX );
+    hpid_terms[1] = constrain_i32( ( hpid_loop.integrated >> HTUNE_KI_SHL ) >> HISTORY_TERM_SHR, INT16_MIN, INT16_MAX );
+    hpid_terms[2] = constrain_i32( hpid_loop.diff >> HISTORY_TERM_SHR, INT16_MIN, INT16_MAX );
     
     SET_HEATER_OUTPUT( output );
 }
 
-int32_t select_kth( int32_t *arr, uint8_t n, uint8_t k )
+void autotune_log_insert( uint8_t index )
 {
-    uint8_t i, j;
-    int16_t min;
-    uint8_t min_pos;
-
-    for ( i=0; i<=k; i++ )
+    /* Adds htune_log[index] to htune_log_sorted[], which holds the <index> entries logged
+     * before it. Binary search for the first larger bias, then shift the rest up one. */
+    uint8_t lo = 0;
+    uint8_t hi = index;
+    uint8_t mid;
+    int32_t bias = htune_log[index][0];
+    
+    while ( lo < hi )
     {
-        min = arr[i];
-        min_pos = i;
-
-        for ( j=(i+1); j<n; j++ )
-        {
-            if ( arr[j] < min )
-            {
-                min = arr[j];
-                min_pos = j;
-            }
-        }
-
-        arr[min_pos] = arr[i];
+        mid = ( lo + hi ) >> 1;
+        if ( htune_log[ htune_log_sorted[mid] ][0] > bias )
+            hi = mid;
+        else
+            lo = mid + 1;
     }
-
-    return min;
+    
+    memmove( &htune_log_sorted[lo + 1], &htune_log_sorted[lo], index - lo );
+    htune_log_sorted[lo] = index;
 }
 
 void autotune_calculate_pid( float htune_ku, float htune_tu,
@@ -385,7 +1227,45 @@ void autotune_calculate_pid( float htune_ku, float htune_tu,
     *hpid_d = constrain_i32( *htune_kd * 1000 / ( (uint32_t)HEATER_PERIOD_MS << HTUNE_KD_SHR ), 0, UINT16_MAX );
 }
 
-void autotune_start( int16_t target_temp )
+void heater_model_identify( uint16_t bias )
+{
+    /* First-order-plus-dead-time model K e^(-L s) / ( 1 + tau s ) from the relay test.  The
+     * settled <bias> holds the target, so K = ( htune_target - ambient ) / bias.  At the
+     * oscillation frequency w = 2 pi / tu the loop gain is 1 and the phase -pi:
+     *   ku K = sqrt( 1 + ( w tau )^2 ),   w L + atan( w tau ) = pi
+     * Only K and the ambient are used, for feedforward, tau and L are reported. */
+    int32_t span;
+    float w;
+    float ku_gain;
+    float tau;
+    float dead;
+    
+    span = (int32_t)htune_target - htune_ambient;
+    if ( !htune_ambient_valid || ( span < HMODEL_SPAN_MIN ) || ( bias == 0 ) )
+    {
+        LOG_INFO( LOG_ID_HMODEL_SKIP, span );
+        return;
+    }
+    
+    w = 2.0f * PI / htune_tu;
+    ku_gain = htune_ku * span / bias;
+    tau = ( ku_gain > 1.0f ) ? ( sqrt( ku_gain * ku_gain - 1.0f ) / w ) : 0.0f;
+    dead = ( PI - atan( w * tau ) ) / w;
+    
+    hmodel.ambient_c_scaled = htune_ambient;
+    hmodel.ref_c_scaled = htune_target;
+    hmodel.ref_output = bias;
+    hmodel.tau_s = constrain_i32( tau + 0.5f, 0, UINT16_MAX - 1 );
+    hmodel.dead_s = constrain_i32( dead + 0.5f, 0, UINT16_MAX - 1 );
+    hmodel_valid = true;
+    hpid_ff_stale = true;
+    hobs_valid = false;
+    store_save_heater_model( &hmodel );
+    
+    LOG_INFO( LOG_ID_HMODEL, hmodel.ambient_c_scaled, hmodel.ref_c_scaled, hmodel.ref_output, hmodel.tau_s, hmodel.dead_s );
+}
+
+void autotune_start( int16_t target_temp, uint8_t flags )
 {
     HPID_INTERRUPT_OFF();
     
@@ -393,9 +1273,15 @@ void autotune_start( int16_t target_temp )
         hpid_state = HPID_STATE_SUSPENDED;
     
     htune_active = false;
+    htune_ambient = heater_temp_c_scaled;
+    htune_ambient_valid = ( heater_output == 0 );
     htune_heating = heater_temp_c_scaled <= target_temp;
     htune_bias = HTUNE_POWER_MAX >> 1;
     htune_delta = HTUNE_POWER_MAX >> 1;
+    htune_delta_pc = 100;
+    htune_fast = ( flags & HTUNE_FLAG_FAST ) != 0;
+    htune_fast_start = 0;
+    htune_pass_count = 0;
     htune_cycles = 0;
     htune_timer = 0;
     htune_timer_heating = 0;
@@ -409,6 +1295,7 @@ void autotune_start( int16_t target_temp )
     htune_log_index = 0;
     htune_run_checks = false;
     htune_target = target_temp;
+    heater_guard_reset();
     
     /* This also initialises cycle start temp and time. */
     autotune( true );
@@ -419,7 +1306,7 @@ void autotune_start( int16_t target_temp )
     
     HPID_INTERRUPT_ON();
     
-    printf( "Autotune started at %i\n", target_temp );
+    LOG_INFO( LOG_ID_HTUNE_START, target_temp );
 }
 
 void autotune_stop( E_HTUNE_STATE state )
@@ -489,22 +1376,30 @@ void autotune( bool write_output )
 
             asymmetry = ( labs( (int32_t)htune_period_heating - (int32_t)htune_period_cooling ) << HTUNE_CONV_ASYMMETRY_SHL ) /
                         ( (int32_t)htune_period_heating + (int32_t)htune_period_cooling );
-            htune_log[htune_log_index][0] = htune_bias;
-            htune_log[htune_log_index][1] = asymmetry;
+            if ( htune_log_index < HTUNE_CYCLES_MAX )
+            {
+                htune_log[htune_log_index][0] = htune_bias;
+                htune_log[htune_log_index][1] = asymmetry;
+            }
+            
+            /* ku from the relay amplitude of the cycle just measured, before it is updated */
+            htune_ku = ( 4.0f * htune_delta ) / ( PI * ( htune_temp_max - htune_temp_min ) * 0.5f );
+            htune_tu = ( (float)( htune_period_heating + htune_period_cooling ) * HEATER_PERIOD_MS / 1000.0f );
+            htune_swing = htune_temp_max - htune_temp_min;
             
             bias_i32 = (int32_t)htune_bias + ( (int32_t)htune_delta * ( (int32_t)htune_period_heating - (int32_t)htune_period_cooling ) ) / ( (int32_t)htune_period_heating + (int32_t)htune_period_cooling );
             htune_bias = constrain_i32( bias_i32, HTUNE_BIAS_ALLOWANCE, HTUNE_POWER_MAX - HTUNE_BIAS_ALLOWANCE );
             htune_delta = ( htune_bias > ( HTUNE_POWER_MAX >> 1 ) ) ? ( HTUNE_POWER_MAX - 1 - htune_bias ) : htune_bias;
-            
-            htune_ku = ( 4.0f * htune_delta ) / ( PI * ( htune_temp_max - htune_temp_min ) * 0.5f );
-            htune_tu = ( (float)( htune_period_heating + htune_period_cooling ) * HEATER_PERIOD_MS / 1000.0f );
+            htune_delta = ( (uint32_t)htune_delta * htune_delta_pc ) / 100;
             
             autotune_calculate_pid( htune_ku, htune_tu, &htune_kp, &htune_ki, &htune_kd, &htune_p, &htune_i, &htune_d );
             
-            if ( htune_cycles >= HTUNE_CYCLES_MIN )
+            if ( ( htune_cycles >= ( htune_fast ? HTUNE_FAST_CYCLES_MIN : HTUNE_CYCLES_MIN ) ) &&
+                 ( htune_log_index < HTUNE_CYCLES_MAX ) )
             {
                 htune_log_ku[htune_log_index] = htune_ku;
                 htune_log_tu[htune_log_index] = htune_tu;
+                autotune_log_insert( htune_log_index );
                 htune_log_index++;
                 htune_run_checks = true;
             }
@@ -523,58 +1418,183 @@ void autotune( bool write_output )
         SET_HEATER_OUTPUT( htune_heating ? ( htune_bias + htune_delta ) : ( htune_bias - htune_delta ) );
 }
 
+void autotune_check_fast( void )
+{
+    /* Fast mode: finish on HTUNE_FAST_CONV_COUNT consecutive estimates with the bias settled and
+     * ku and tu within HTUNE_FAST_SPREAD_PC of their mean, instead of waiting for enough cycles
+     * near the median bias.  Each settled cycle first shrinks the relay amplitude, down to
+     * HTUNE_FAST_DELTA_MIN_PC, for a smaller temperature swing around the target.  The swing
+     * is kept above HTUNE_FAST_SWING_MIN, as the fixed transition hysteresis would skew ku and
+     * tu on smaller ones. */
+    uint8_t i;
+    uint8_t last;
+    int32_t asym_pc;
+    bool converged;
+    float ku_min;
+    float ku_max;
+    float ku_sum;
+    float tu_min;
+    float tu_max;
+    float tu_sum;
+    
+    last = htune_log_index - 1;
+    asym_pc = ( htune_log[last][1] * 100 ) >> HTUNE_CONV_ASYMMETRY_SHL;
+    converged = false;
+    
+    if ( asym_pc > HTUNE_CONV_ASYMMETRY_THRESHOLD_PC )
+    {
+        /* Bias still moving, start the window again */
+        htune_fast_start = htune_log_index;
+        htune_pass_count = 0;
+    }
+    else if ( ( htune_delta_pc > HTUNE_FAST_DELTA_MIN_PC ) &&
+              ( ( (uint32_t)htune_swing * HTUNE_FAST_DELTA_STEP_PC ) / 100 >= HTUNE_FAST_SWING_MIN ) )
+    {
+        /* The new amplitude is only applied at the next cycle update, so the cycle
+         * running now is still at the old one and is left out of the window too */
+        htune_delta_pc = MAX( ( htune_delta_pc * HTUNE_FAST_DELTA_STEP_PC ) / 100, HTUNE_FAST_DELTA_MIN_PC );
+        htune_fast_start = htune_log_index + 1;
+        htune_pass_count = 0;
+    }
+    else if ( htune_log_index > htune_fast_start )
+    {
+        htune_pass_count = htune_log_index - htune_fast_start;
+        LOG_INFO( LOG_ID_HTUNE_PASS, htune_pass_count, HTUNE_FAST_CONV_COUNT );
+        
+        if ( htune_pass_count >= HTUNE_FAST_CONV_COUNT )
+        {
+            ku_min = ku_max = ku_sum = htune_log_ku[last];
+            tu_min = tu_max = tu_sum = htune_log_tu[last];
+            for ( i=htune_log_index-HTUNE_FAST_CONV_COUNT; i<last; i++ )
+            {
+                ku_min = MIN( ku_min, htune_log_ku[i] );
+                ku_max = MAX( ku_max, htune_log_ku[i] );
+                ku_sum += htune_log_ku[i];
+                tu_min = MIN( tu_min, htune_log_tu[i] );
+                tu_max = MAX( tu_max, htune_log_tu[i] );
+                tu_sum += htune_log_tu[i];
+            }
+            
+            /* ( max - min ) / mean <= HTUNE_FAST_SPREAD_PC / 100, for both */
+            converged = ( ( ku_max - ku_min ) * ( 100 * HTUNE_FAST_CONV_COUNT ) <= ku_sum * HTUNE_FAST_SPREAD_PC ) &&
+                        ( ( tu_max - tu_min ) * ( 100 * HTUNE_FAST_CONV_COUNT ) <= tu_sum * HTUNE_FAST_SPREAD_PC );
+        }
+    }
+    
+    if ( converged )
+    {
+        htune_ku = ku_sum / HTUNE_FAST_CONV_COUNT;
+        htune_tu = tu_sum / HTUNE_FAST_CONV_COUNT;
+        autotune_calculate_pid( htune_ku, htune_tu, &htune_kp, &htune_ki, &htune_kd, &hpid_p, &hpid_i, &hpid_d );
+        store_save_pid( hpid_p, hpid_i, hpid_d );
+        heater_model_identify( htune_log[last][0] );
+        
+        autotune_stop( HTUNE_STATE_FINISHED );
+        
+        validate_pid_constants_state();
+        
+        LOG_INFO( LOG_ID_HTUNE_SUCCESS, 0 );
+    }
+    else if ( htune_log_index >= HTUNE_CYCLES_MAX )
+    {
+        autotune_stop( HTUNE_STATE_FAILED );
+        htune_fail = HTUNE_FAIL_CYCLES;
+        fault_log( FAULT_ID_HTUNE_FAIL, htune_fail );
+        LOG_INFO( LOG_ID_HTUNE_FAIL_CYCLES, 0 );
+    }
+}
+
+uint16_t autotune_remaining_s( void )
+{
+    /* Estimate only: the cycles still needed at the last measured oscillation period */
+    uint32_t period;
+    uint8_t cycles;
+    uint8_t delta_pc;
+    uint32_t swing;
+    
+    if ( !htune_active )
+        return 0;
+    
+    period = (uint32_t)htune_period_heating + htune_period_cooling;
+    if ( ( htune_period_heating == 0 ) || ( htune_period_cooling == 0 ) )
+        return HTUNE_REMAINING_UNKNOWN;
+    
+    /* Full cycles until the first estimate is logged, two htune_cycles each */
+    cycles = 0;
+    if ( htune_cycles < ( htune_fast ? HTUNE_FAST_CYCLES_MIN : HTUNE_CYCLES_MIN ) )
+        cycles = ( ( htune_fast ? HTUNE_FAST_CYCLES_MIN : HTUNE_CYCLES_MIN ) - htune_cycles + 1 ) >> 1;
+    
+    if ( htune_fast )
+    {
+        /* Each amplitude step takes the settled cycle and the one still at the old amplitude */
+        delta_pc = htune_delta_pc;
+        swing = ( (uint32_t)htune_swing * HTUNE_FAST_DELTA_STEP_PC ) / 100;
+        while ( ( delta_pc > HTUNE_FAST_DELTA_MIN_PC ) && ( swing >= HTUNE_FAST_SWING_MIN ) )
+        {
+            delta_pc = MAX( ( delta_pc * HTUNE_FAST_DELTA_STEP_PC ) / 100, HTUNE_FAST_DELTA_MIN_PC );
+            swing = ( swing * HTUNE_FAST_DELTA_STEP_PC ) / 100;
+            cycles += 2;
+        }
+        cycles += HTUNE_FAST_CONV_COUNT - MIN( htune_pass_count, HTUNE_FAST_CONV_COUNT - 1 );
+    }
+    else
+        cycles += HTUNE_CONV_PASS_COUNT_THRESHOLD - MIN( htune_pass_count, HTUNE_CONV_PASS_COUNT_THRESHOLD - 1 );
+    
+    return MIN( ( cycles * period * HEATER_PERIOD_MS ) / 1000, HTUNE_REMAINING_UNKNOWN - 1 );
+}
+
 void autotune_check_cycle( void )
 {
+    /* htune_log_sorted[] is in bias order, so the median is its middle entry and the
+     * HTUNE_CONV_COUNT entries nearest to it are a window around that, grown on the nearer side */
     uint8_t i;
-    int32_t temp_array[HTUNE_CYCLES_MAX];
     uint8_t htune_log_len;
-    uint8_t temp_array_len;
-    uint8_t start_index;
+    uint8_t lo;
+    uint8_t hi;
+    uint8_t index;
     int32_t median_bias;
-    int32_t nearest_index;
     uint8_t nearest_count;
-    int32_t temp;
     uint8_t pass_count;
     int32_t best_asym;
     uint8_t best_index;
     
     htune_log_len = htune_log_index;
-//    start_index = htune_log_len >> 1;
-    start_index = 0;
-    temp_array_len = htune_log_len - start_index;
-    
-    /* Ignore first half of data. */
-    for ( i=start_index; i<htune_log_len; i++ )
-        temp_array[i-start_index] = htune_log[i][0];
+    if ( htune_log_len == 0 )
+        return;
     
-    median_bias = select_kth( temp_array, temp_array_len, temp_array_len >> 1 );
+    if ( htune_fast )
+    {
+        autotune_check_fast();
+        return;
+    }
     
-    for ( i=0; i<temp_array_len; i++ )
-        temp_array[i] = i + start_index;
+    lo = htune_log_len >> 1;
+    hi = lo + 1;
+    median_bias = htune_log[ htune_log_sorted[lo] ][0];
+    nearest_count = MIN( HTUNE_CONV_COUNT, htune_log_len );
     
-    for ( nearest_count=0; nearest_count<MIN(HTUNE_CONV_COUNT, temp_array_len); nearest_count++ )
+    while ( ( hi - lo ) < nearest_count )
     {
-        nearest_index = nearest_count;
-        
-        for ( i=(nearest_count+1); i<temp_array_len; i++ )
-        {
-            if ( labs( htune_log[ temp_array[i] ][0] - median_bias ) <= labs( htune_log[ temp_array[nearest_index] ][0] - median_bias ) )
-                nearest_index = i;
-        }
-        
-        temp = temp_array[nearest_count];
-        temp_array[nearest_count] = temp_array[nearest_index];
-        temp_array[nearest_index] = temp;
+        if ( ( lo > 0 ) &&
+             ( ( hi >= htune_log_len ) ||
+               ( ( median_bias - htune_log[ htune_log_sorted[lo - 1] ][0] ) <= ( htune_log[ htune_log_sorted[hi] ][0] - median_bias ) ) ) )
+            lo--;
+        else
+            hi++;
     }
     
     pass_count = 0;
     best_asym = INT32_MAX;
+    best_index = 0;                 // Set by the first pass, read only when one passed
     
-    printf( "Nearest %hu to bias %li:\n", nearest_count, median_bias );
+    LOG_INFO( LOG_ID_HTUNE_NEAREST, nearest_count, median_bias );
     
-    for ( i=0; i<nearest_count; i++ )
+    for ( i=lo; i<hi; i++ )
     {
-        int32_t asym_pc = ( htune_log[ temp_array[i] ][1] * 100 ) >> HTUNE_CONV_ASYMMETRY_SHL;
+        int32_t asym_pc;
+        
+        index = htune_log_sorted[i];
+        asym_pc = ( htune_log[index][1] * 100 ) >> HTUNE_CONV_ASYMMETRY_SHL;
         
         if ( asym_pc <= HTUNE_CONV_ASYMMETRY_THRESHOLD_PC )
         {
@@ -583,19 +1603,20 @@ void autotune_check_cycle( void )
             if ( asym_pc <= best_asym )
             {
                 best_asym = asym_pc;
-                best_index = temp_array[i];
+                best_index = index;
             }
         }
         
-        printf( " index %2li bias %6li asym %6li =%3li%%\n",
-                temp_array[i],
-                htune_log[ temp_array[i] ][0],
-                htune_log[ temp_array[i] ][1],
-                asym_pc
-              );
+        LOG_INFO( LOG_ID_HTUNE_INDEX,
+                  index,
+                  htune_log[index][0],
+                  htune_log[index][1],
+                  asym_pc
+                );
     }
     
-    printf( "Pass: %hu of %hu\n", pass_count, (uint8_t)HTUNE_CONV_PASS_COUNT_THRESHOLD );
+    LOG_INFO( LOG_ID_HTUNE_PASS, pass_count, HTUNE_CONV_PASS_COUNT_THRESHOLD );
+    htune_pass_count = pass_count;
     
     if ( pass_count >= HTUNE_CONV_PASS_COUNT_THRESHOLD )
     {
@@ -603,18 +1624,20 @@ void autotune_check_cycle( void )
         htune_tu = htune_log_tu[best_index];
         autotune_calculate_pid( htune_ku, htune_tu, &htune_kp, &htune_ki, &htune_kd, &hpid_p, &hpid_i, &hpid_d );
         store_save_pid( hpid_p, hpid_i, hpid_d );
+        heater_model_identify( htune_log[best_index][0] );
         
         autotune_stop( HTUNE_STATE_FINISHED );
         
         validate_pid_constants_state();
         
-        printf( "Autotune Finished: Success\n" );
+        LOG_INFO( LOG_ID_HTUNE_SUCCESS, 0 );
     }
-    else if ( temp_array_len >= HTUNE_CYCLES_MAX )
+    else if ( htune_log_len >= HTUNE_CYCLES_MAX )
     {
         autotune_stop( HTUNE_STATE_FAILED );
         htune_fail = HTUNE_FAIL_CYCLES;
-        printf( "Autotune Fail: Max Cycles\n" );
+        fault_log( FAULT_ID_HTUNE_FAIL, htune_fail );
+        LOG_INFO( LOG_ID_HTUNE_FAIL_CYCLES, 0 );
     }
 }
 
@@ -639,22 +1662,19 @@ void autotune_check_timeout( void )
         
         autotune_stop( HTUNE_STATE_FAILED );
         htune_fail = HTUNE_FAIL_RATE;
-        printf( "Autotune Fail: Rate\n" );
+        fault_log( FAULT_ID_HTUNE_FAIL, htune_fail );
+        LOG_INFO( LOG_ID_HTUNE_FAIL_RATE, 0 );
     }
     
 //    printf( "Temp Rate: %li / %li\n", temp_rate, HTUNE_CONV_CYCLE_MAX_MS_PER_DEGC );
 }
 
-int16_t get_heater_temp( void )
+int16_t heater_therm_temp( uint32_t adc_temp )
 {
-    uint32_t adc_temp;
+    /* Steinhart-Hart (B parameter) equation in float, only used to build heater_therm_table[] */
     float steinhart;
     float R;
     
-    HPID_INTERRUPT_OFF();
-    adc_temp = heater_adc_avg;
-    HPID_INTERRUPT_ON();
-    
     if ( adc_temp > 0 )
     {
         R = ( (float)( (int64_t)HEATER_ADC_MAX << HEATER_ADC_SHIFT ) / adc_temp ) - 1;
@@ -672,307 +1692,2101 @@ int16_t get_heater_temp( void )
     return (int16_t)( steinhart * HEATER_TEMP_SCALE );
 }
 
-void timer1_isr( void )
+void heater_therm_table_init( void )
 {
-    timer1_counter++;
-    
-    /* Run stir PID if required */
-    if ( stir_state == STIR_STATE_RUNNING )
-        stir_pid();
-    else
-        SET_STIR_OUTPUT( 0 );
+    uint16_t index;
+    uint32_t adc;
     
-    /* Start temperature sampling by enabling ADC filter */
-    ADFL0CONbits.FLEN = 1;
-    PORTBbits.RB13 = 0;
+    for ( index=0; index<HEATER_THERM_TABLE_LEN; index++ )
+    {
+        adc = MIN( HEATER_THERM_TABLE_ADC_MIN + ( (uint32_t)index << HEATER_THERM_TABLE_SEG_BITS ), HEATER_ADC_MAX );
+        heater_therm_table[index] = heater_therm_temp( adc << HEATER_ADC_SHIFT );
+    }
+}
+
+int16_t get_heater_temp( uint32_t adc_temp )
+{
+    /* Piecewise-linear interpolation of heater_therm_table[], one 16 x 16-bit multiply.
+     * Readings hotter than the first entry are clamped to it. */
+    uint32_t offset;
+    uint16_t index;
+    uint16_t frac;
+    int16_t temp;
+    
+    if ( adc_temp < ( (uint32_t)HEATER_THERM_TABLE_ADC_MIN << HEATER_ADC_SHIFT ) )
+        return heater_therm_table[0];
+    
+    offset = adc_temp - ( (uint32_t)HEATER_THERM_TABLE_ADC_MIN << HEATER_ADC_SHIFT );
+    index = offset >> HEATER_THERM_FRAC_BITS;
+    if ( index >= ( HEATER_THERM_TABLE_LEN - 1 ) )
+        return heater_therm_table[HEATER_THERM_TABLE_LEN - 1];
+    
+    frac = offset & ( ( (uint16_t)1 << HEATER_THERM_FRAC_BITS ) - 1 );
+    temp = heater_therm_table[index];
+    
+    return temp + ( __builtin_mulsu( heater_therm_table[index + 1] - temp, frac ) >> HEATER_THERM_FRAC_BITS );
+}
+
+void task_release( uint8_t task )
+{
+    /* Called from the task's interrupt. The deadline is the next release, so a task still
+     * pending then has missed it, and runs once on the newer sample. */
+    if ( tasks[task].pending )
+    {
+        if ( tasks[task].missed < UINT16_MAX )
+            tasks[task].missed++;
+    }
+    else
+        tasks[task].pending = 1;
+}
+
+void task_run( void )
+{
+    /* Runs the highest priority pending task, at most one per main loop pass so packets are
+     * serviced in between */
+    uint8_t task;
+    
+    for ( task=0; task<TASK_COUNT; task++ )
+    {
+        if ( tasks[task].pending )
+        {
+            tasks[task].pending = 0;
+            tasks[task].runs++;
+            tasks[task].run();
+            break;
+        }
+    }
+}
+
+void heater_profile_stop( E_HPROF_STATE state )
+{
+    hprof_active = false;
+    hprof_state = state;
+}
+
+void heater_profile_segment_start( void )
+{
+    hprof_step = ( (uint32_t)hprof_segments[hprof_segment].ramp_rate << HPROF_SETPOINT_SHL ) /
+                 ( 60 * HEATER_PERIOD_S_COUNTS );
+    hprof_state = HPROF_STATE_RAMP;
+}
+
+void heater_profile_start( uint8_t length, uint8_t cycles )
+{
+    /* The first ramp starts from the present temperature */
+    HPID_INTERRUPT_OFF();
+    hprof_setpoint = (int32_t)heater_temp_c_scaled << HPROF_SETPOINT_SHL;
+    HPID_INTERRUPT_ON();
+    
+    hprof_length = length;
+    hprof_cycles = cycles;
+    hprof_segment = 0;
+    hprof_cycle = 0;
+    heater_profile_segment_start();
+    hprof_active = true;
+}
+
+void heater_profile_run( void )
+{
+    /* Runs in the heater task just before heater_pid(), once per heater period.  RAMP moves
+     * the setpoint by hprof_step towards the segment target, SETTLE waits for the temp to be
+     * within HPROF_SETTLE_BAND of it, then HOLD counts hold_s down before the next segment. */
+    hprof_segment_t *segment;
+    int32_t target;
+    int32_t remaining;
+    
+    segment = &hprof_segments[hprof_segment];
+    target = (int32_t)segment->target << HPROF_SETPOINT_SHL;
+    
+    switch ( hprof_state )
+    {
+        case HPROF_STATE_RAMP:
+        {
+            remaining = target - hprof_setpoint;
+            if ( ( hprof_step == 0 ) || ( labs( remaining ) <= hprof_step ) )
+            {
+                hprof_setpoint = target;
+                hprof_state = HPROF_STATE_SETTLE;
+            }
+            else if ( remaining > 0 )
+                hprof_setpoint += hprof_step;
+            else
+                hprof_setpoint -= hprof_step;
+            break;
+        }
+        case HPROF_STATE_SETTLE:
+        {
+            if ( labs( (int32_t)heater_temp_c_scaled - segment->target ) <= HPROF_SETTLE_BAND )
+            {
+                hprof_hold_counts = (uint32_t)segment->hold_s * HEATER_PERIOD_S_COUNTS;
+                hprof_state = HPROF_STATE_HOLD;
+            }
+            break;
+        }
+        case HPROF_STATE_HOLD:
+        {
+            if ( hprof_hold_counts > 1 )
+                hprof_hold_counts--;
+            else if ( ( hprof_segment + 1 ) < hprof_length )
+            {
+                hprof_segment++;
+                heater_profile_segment_start();
+            }
+            else
+            {
+                if ( hprof_cycle < UINT16_MAX )
+                    hprof_cycle++;
+                
+                if ( ( hprof_cycles != 0 ) && ( hprof_cycle >= hprof_cycles ) )
+                {
+                    /* Done, the PID keeps holding the last target */
+                    hprof_hold_counts = 0;
+                    heater_profile_stop( HPROF_STATE_DONE );
+                }
+                else
+                {
+                    hprof_segment = 0;
+                    heater_profile_segment_start();
+                }
+            }
+            break;
+        }
+        default:
+            break;
+    }
+    
+    hpid_target = hprof_setpoint >> HPROF_SETPOINT_SHL;
+}
+
+void push_reports( void )
+{
+    /* Once per heater period, a REPORT of the signals past their deadband or interval */
+    int16_t values[REPORT_SIGNALS];
+    uint8_t report_buf[ REPORT_SIZE_MAX( REPORT_SIGNALS ) ];
+    uint8_t report_size;
+#if HEATER_ZONES > 1
+    uint8_t index;
+#endif
+    
+    if ( !report_active() )
+        return;
+    
+    values[REPORT_SIGNAL_TEMP] = heater_temp_c_scaled;
+    values[REPORT_SIGNAL_STIR_SPEED] = (int16_t)stir_speed_rps_avg;
+#if HEATER_ZONES > 1
+    for ( index=0; index<HZONE_COUNT; index++ )
+        values[REPORT_SIGNAL_ZONE + index] = hzone[index].temp_c_scaled;
+#endif
+    
+    report_size = report_poll( values, report_buf );
+    if ( report_size == 0 )
+        return;
+    
+    /* Leave room for replies, unsent signals go in a later REPORT */
+    if ( ( SPI_WRITE_BUF_SIZE - spi_write_bytes_written() ) < ( report_size + 4 + REPORT_TX_RESERVE ) )
+    {
+        report_done( false );
+        return;
+    }
+    
+    spi_packet_write( PACKET_TYPE_REPORT, report_buf, report_size );
+    report_done( true );
+}
+
+void history_capture( void )
+{
+    /* Once per heater period, after the heater task has set its output. Overwrites the
+     * oldest record once the ring is full. The stirrer values are from its latest run. */
+    history_record_t *record = &history[history_head];
+    
+    record->seq = history_seq++;
+    HPID_INTERRUPT_OFF();
+    record->time_us = heater_sample_us;
+    HPID_INTERRUPT_ON();
+    record->temp_c_scaled = heater_temp_c_scaled;
+    record->target_c_scaled = htune_active ? htune_target : hpid_target;
+    record->heater_output = heater_output;
+    memcpy( record->hpid_terms, hpid_terms, sizeof(hpid_terms) );
+    record->stir_speed_rps = stir_speed_rps_avg;
+    record->stir_output = stir_output;
+    record->flags = ( ( hpid_state == HPID_STATE_RUNNING ) ? HISTORY_FLAG_HEATER_PID : 0 ) |
+                    ( htune_active ? HISTORY_FLAG_AUTOTUNE : 0 ) |
+                    ( hprof_active ? HISTORY_FLAG_PROFILE : 0 ) |
+                    ( ( stir_state == STIR_STATE_RUNNING ) ? HISTORY_FLAG_STIR : 0 ) |
+                    ( ( ( hpid_state == HPID_STATE_RUNNING ) && hboost_active ) ? HISTORY_FLAG_BOOST : 0 );
+    
+    history_head = ( history_head + 1 ) & ( HISTORY_LEN - 1 );
+    if ( history_count < HISTORY_LEN )
+        history_count++;
+}
+
+#if HEATER_ZONES > 1
+void hzone_init( void )
+{
+    /* Zone 1 converts AN1 on dedicated core 1 at the SCCP5 trigger of AN0, so its filter,
+     * enabled with zone 0's by timer1_isr(), is ready when heater_task() runs. SCCP8 runs as
+     * SCCP1, its output on RB13, the trace pin of a single zone build. pwm_config()
+     * sets the period and turns it on. */
+    uint8_t index;
+    
+    for ( index=0; index<HZONE_COUNT; index++ )
+    {
+        memset( &hzone[index], 0, sizeof(hzone[index]) );
+        hzone[index].state = HPID_STATE_UNCONFIGURED;
+        hzone[index].error = HPID_ERROR_NONE;
+        hzone[index].target = HEATER_TEMP_DEFAULT_SCALED;
+    }
+    
+    ADTRIG0L = ( ADTRIG0L & 0x00FF ) | ( ( ADTRIG0L & 0x001F ) << 8 );    // TRGSRC1 as TRGSRC0
+    ADFL1CON = HZONE_ADFL_CON;
+    
+    CCP8CON1L = HZONE_CCP_MOD_DUAL_EDGE;
+    CCP8CON1H = 0;
+    CCP8CON2L = 0;
+    CCP8CON2H = 0x0100;             // OCAEN
+    CCP8TMRL = 0;
+    CCP8RB = 0;
+    
+    __builtin_write_RPCON( 0x0000 );
+    RPOR6 = ( RPOR6 & 0x00FF ) | ( HZONE_PPS_OCM8 << 8 );                // RP45R, RB13
+    __builtin_write_RPCON( 0x0800 );
+    TRISBbits.TRISB13 = 0;
+}
+
+void hzone_set_output( uint8_t index, uint16_t output )
+{
+    /* As SET_HEATER_OUTPUT(), at the resolution of pwm_config() */
+    hzone[index].output = output;
+    *hzone_hw[index].ccp_ra = pwm_hires ? ( HEATER_PWM_PRL_HIRES + 1 ) - output : 0x100 - ( output >> 8 );
+}
+
+void hzone_sample( uint8_t index )
+{
+    /* The filter result of the period, read and filtered as _ADFLTR0Interrupt() does zone 0's
+     * at its defaults. A zone 0 filter made shorter by ADC_FILTER runs heater_task() before
+     * this one is ready, and the zone a period behind. An open thermistor keeps the last
+     * temperature, and the filter starts over from the first reading once it is back. */
+    heater_zone_t *zone = &hzone[index];
+    const heater_zone_hw_t *hw = &hzone_hw[index];
+    uint16_t raw;
+    
+    if ( !( *hw->flt_con & HZONE_FLT_RDY ) )
+        return;
+    
+    *hw->flt_con &= ~HZONE_FLT_EN;
+    raw = *hw->flt_dat;
+    zone->present = raw < HEATER_TEMP_PRESENT_THRESHOLD;
+    if ( !zone->present )
+        zone->ready = false;
+    else if ( zone->ready )
+        zone->adc_avg = (int32_t)zone->adc_avg + ( ( ( (int32_t)raw << HEATER_ADC_SHIFT ) - (int32_t)zone->adc_avg ) >> HEATER_ADC_FILT_SHIFT_DEFAULT );
+    else
+    {
+        zone->adc_avg = (uint32_t)raw << HEATER_ADC_SHIFT;
+        zone->ready = true;
+    }
+    if ( zone->ready )
+        zone->temp_c_scaled = get_heater_temp( zone->adc_avg );
+}
+
+void hzone_pid( uint8_t index )
+{
+    /* Plain PID on hpid_step(), the integrator within the output range */
+    heater_zone_t *zone = &hzone[index];
+    int32_t error;
+    
+    error = constrain_i32( (int32_t)zone->target - zone->temp_c_scaled, INT16_MIN, INT16_MAX );
+    
+    zone->config.kp = zone->p;
+    zone->config.ki = zone->i;
+    zone->config.kd = zone->d;
+    zone->config.p_limit = UINT16_MAX;
+    zone->config.d_limit = UINT16_MAX;
+    zone->config.i_change_limit = (int32_t)UINT16_MAX << HTUNE_KI_SHL;
+    zone->config.i_min = 0;
+    zone->config.i_max = (int32_t)heater_output_max << HTUNE_KI_SHL;
+    zone->config.out_min = 0;
+    zone->config.out_max = heater_zone_cap( index + 1 );
+    hzone_set_output( index, hpid_step( &zone->config, &zone->loop, error, error, zone->temp_c_scaled, 0 ) );
+}
+
+void hzone_stop( uint8_t index, E_HPID_ERROR error )
+{
+    hzone[index].state = HPID_STATE_ERROR;
+    hzone[index].error = error;
+    hzone_set_output( index, 0 );
+    fault_log( FAULT_ID_HZONE_ERROR, ( (int32_t)( index + 1 ) << 8 ) | error );
+}
+
+void hzone_task( void )
+{
+    /* Each zone past zone 0, once per heater period. A thermistor lost or a reading over
+     * HZONE_OVER_SCALED stops the zone as the guard does zone 0. */
+    uint8_t index;
+    
+    for ( index=0; index<HZONE_COUNT; index++ )
+    {
+        hzone_sample( index );
+        
+        if ( hzone[index].state != HPID_STATE_RUNNING )
+            continue;
+        if ( !hzone[index].present )
+            hzone_stop( index, HPID_ERROR_TEMP_NOT_PRESENT );
+        else if ( hzone[index].temp_c_scaled > HZONE_OVER_SCALED )
+            hzone_stop( index, HPID_ERROR_HEATER_GUARD );
+        else
+            hzone_pid( index );
+    }
+    
+    /* Zone 0's cap follows the zones' new outputs before its next PID step */
+    heater_budget_update();
+}
+#endif
+
+void heater_task( void )
+{
+    /* Run heater PID or autotune as required, once per filtered temperature sample */
+    memset( hpid_terms, 0, sizeof(hpid_terms) );
+    
+    if ( hguard_trip != HGUARD_OK )
+        heater_guard_stop();
+    
+    if ( hprof_active && ( htune_active || ( hpid_state != HPID_STATE_RUNNING ) ) )
+        heater_profile_stop( HPROF_STATE_ABORTED );
+    
+    /* On the unfiltered reading heater_guard_sample() kept, and the output of the last period */
+    heater_observer_run( hguard_raw_prev );
+    
+    if ( htune_active )
+    {
+        autotune( false );
+        htune_timer++;
+    }
+    else if ( hpid_state == HPID_STATE_RUNNING )
+    {
+        PROBE_BEGIN( PROBE_HEATER_PID );
+        TRACE_BEGIN( TRACE_HEATER_PID );
+        if ( hprof_active )
+            heater_profile_run();
+        heater_pid();
+        TRACE_END( TRACE_HEATER_PID );
+        PROBE_END( PROBE_HEATER_PID );
+    }
+    else
+        SET_HEATER_OUTPUT( 0 );
+    
+    /* Autotune and the boost write the output themselves, the budget holds for them too */
+    if ( heater_output > heater_output_cap )
+        SET_HEATER_OUTPUT( heater_output_cap );
+    
+#if HEATER_ZONES > 1
+    hzone_task();
+#endif
+    
+    latency_output( LATENCY_HEATER, HEATER_PERIOD_MS * 1000UL );
+    history_capture();
+    push_reports();
+}
+
+void stir_speed_reply_publish( void )
+{
+    uint8_t *buf_ptr = spi_reply_cache_slot( &stir_speed_actual_reply );
+    
+    buf_ptr[0] = ERR_OK;
+    COPY_16BIT_TO_PTR_REV( &buf_ptr[1], stir_speed_rps_avg );
+    spi_reply_cache_publish( &stir_speed_actual_reply, sizeof(err) + sizeof(stir_speed_rps_avg) );
+}
+
+void stir_task( void )
+{
+    /* Run stir PID if required, once per SCCP7 period */
+    if ( stir_state == STIR_STATE_RUNNING )
+    {
+        PROBE_BEGIN( PROBE_STIR_PID );
+        TRACE_BEGIN( TRACE_STIR_PID );
+        stir_pid();
+        TRACE_END( TRACE_STIR_PID );
+        PROBE_END( PROBE_STIR_PID );
+    }
+    else
+        SET_STIR_OUTPUT( 0 );
+    heater_budget_update();
+    
+    latency_output( LATENCY_STIR, stir_period_ms * 1000UL );
+    stir_speed_reply_publish();
+}
+
+void timer1_isr( void )
+{
+#if HEATER_ZONES > 1
+    uint8_t index;
+    
+#endif
+    PROBE_ISR_ENTER();
+    TRACE_BEGIN( TRACE_ISR_TIMER1 );
+    timer1_counter++;
+    time_tick();
+    
+    /* Start temperature sampling by enabling ADC filter */
+    ADFL0CONbits.FLEN = 1;
+#if HEATER_ZONES > 1
+    for ( index=0; index<HZONE_COUNT; index++ )
+        *hzone_hw[index].flt_con |= HZONE_FLT_EN;
+#endif
+    TRACE_END( TRACE_ISR_TIMER1 );
+    PROBE_ISR_EXIT();
+}
+
+void __attribute__ ( ( interrupt, no_auto_psv ) ) _CCT7Interrupt( void )
+{
+    /* SCCP7 period, every stir_period_ms. Collects the stirrer periods for the stir task,
+     * apart from the heater's TMR1 so the stirrer runs at its own, faster rate. */
+    PROBE_ISR_ENTER();
+    TRACE_BEGIN( TRACE_ISR_STIR );
+    if ( stir_state == STIR_STATE_RUNNING )
+        stir_capture_read();
+    latency_sample( LATENCY_STIR );
+    task_release( TASK_STIR );
+    _CCT7IF = 0;
+    TRACE_END( TRACE_ISR_STIR );
+    PROBE_ISR_EXIT();
+}
+
+void stir_timer_config( void )
+{
+    /* SCCP7 as a 16-bit timer on Fosc/2 / 64, its period interrupt releasing the stir task.
+     * Priority 1, as TMR1. Restarts the count, so a shorter period never waits for a wrap. */
+    _CCT7IE = 0;
+    CCP7CON1L = 0x00C0;             // 16-bit timer, TMRPS 1:64, CLKSEL Fosc/2, off
+    CCP7CON1H = 0;
+    CCP7CON2L = 0;
+    CCP7CON2H = 0;
+    CCP7TMRL = 0;
+    CCP7PRL = STIR_TMR_PERIOD( stir_period_ms );
+    _CCT7IP = 1;
+    _CCT7IF = 0;
+    CCP7CON1Lbits.CCPON = 1;
+    _CCT7IE = 1;
+}
+
+void stir_periods_clear( void )
+{
+    /* Unused entries are 0, so stir_pid() can sum the whole window */
+    uint8_t i;
+    
+    for ( i = 0; i < STIR_PERIODS_SIZE; i++ )
+        stir_periods[i] = 0;
+    stir_periods_count = 0;
+}
+
+void stir_capture_read( void )
+{
+    /* Called from _CCT7Interrupt(). Drains the CCP3 capture FIFO into stir_periods[], so no
+     * edge is lost to a FIFO overflow at high speed. The timer restarts on each edge, so each
+     * capture is one period. A period ending a stall is dropped, it only restarts timing. */
+    uint32_t period;
+    bool edge = false;
+    
+    while ( CCP3STATLbits.ICBNE )
+    {
+        period = (uint32_t)CCP3BUFL | ( (uint32_t)CCP3BUFH << 16 );
+        edge = true;
+        
+        if ( stir_idle_ms >= STIR_STALL_MS )
+        {
+            stir_idle_ms = 0;
+            stir_periods_clear();
+            continue;
+        }
+        
+        stir_periods[stir_periods_head] = period;
+        stir_periods_head = ( stir_periods_head + 1 ) & ( STIR_PERIODS_SIZE - 1 );
+        if ( stir_periods_count < STIR_PERIODS_SIZE )
+            stir_periods_count++;
+        if ( stir_periods_new < UINT8_MAX )
+            stir_periods_new++;
+    }
+    CCP3STATLbits.ICOV = 0;
+    
+    /* Stall timeout */
+    if ( edge )
+        stir_idle_ms = 0;
+    else
+        stir_idle_ms = MIN( stir_idle_ms + stir_period_ms, STIR_STALL_MS );
+}
+
+uint8_t heater_adc_result_bits( uint8_t ovrsam, uint8_t mode )
+{
+    /* Oversampling codes 0-3 are 4x, 16x, 64x and 256x, 4-7 are 2x, 8x, 32x and 128x,
+     * each pair of codes in turn giving one more result bit. Averaging always gives 12 bits. */
+    if ( mode == HEATER_ADC_MODE_AVERAGE )
+        return HEATER_ADC_AVERAGE_BITS;
+    return HEATER_ADC_AVERAGE_BITS + 1 + ( ovrsam & 0x03 );
+}
+
+void heater_adc_noise_update( uint16_t sample )
+{
+    /* Called from the ADC filter ISR. Differences of successive samples cancel the slow
+     * temperature signal, leaving twice the sample noise variance. */
+    int32_t diff;
+    int32_t diff_sq;
+    
+    if ( heater_noise_valid )
+    {
+        diff = (int32_t)sample - heater_noise_prev;
+        diff = constrain_i32( diff, -HEATER_NOISE_DIFF_MAX, HEATER_NOISE_DIFF_MAX );
+        diff_sq = ( diff * diff ) << HEATER_NOISE_FRAC_BITS;
+        heater_noise_diff_sq = (int32_t)heater_noise_diff_sq + ( ( diff_sq - (int32_t)heater_noise_diff_sq ) >> HEATER_NOISE_FILT_SHIFT );
+    }
+    heater_noise_prev = sample;
+    heater_noise_valid = true;
+}
+
+void heater_guard_reset( void )
+{
+    /* Called with the ADC filter interrupt off, on starting the PID or autotune.  The step
+     * check starts over, the reading before may be the fault that stopped the last run. */
+    hguard_trip = HGUARD_OK;
+    hguard_raw_valid = false;
+    hguard_watch_count = 0;
+    hguard_over_count = 0;
+}
+
+void heater_guard_sample( int16_t raw_c_scaled )
+{
+    /* From the ADC filter interrupt, once per sample: cuts the heater before the task runs
+     * on a reading the heater cannot have caused or a heater that is not heating.  The step
+     * check is on the unfiltered reading, the filter would spread a jump over many samples. */
+    bool armed = htune_active || ( hpid_state == HPID_STATE_RUNNING );
+    int16_t target = htune_active ? htune_target : hpid_target;
+    int16_t step = raw_c_scaled - hguard_raw_prev;
+    uint8_t trip = HGUARD_OK;
+    
+    if ( armed && ( hguard_trip == HGUARD_OK ) )
+    {
+        if ( ( heater_output > 0 ) && ( heater_temp_c_scaled > ( (int32_t)target + HGUARD_OVER_SCALED ) ) )
+            hguard_over_count++;
+        else
+            hguard_over_count = 0;
+        
+        if ( !heater_temp_present )
+            trip = HGUARD_NO_SENSOR;
+        else if ( hguard_raw_valid && ( ( step > HGUARD_STEP_MAX_SCALED ) || ( step < -HGUARD_STEP_MAX_SCALED ) ) )
+            trip = HGUARD_TEMP_STEP;
+        else if ( hguard_over_count >= ( HGUARD_OVER_S * HEATER_PERIOD_S_COUNTS ) )
+            trip = HGUARD_OVER_TARGET;
+        else if ( ( heater_output > 0 ) &&
+                  ( heater_output >= ( (uint32_t)heater_output_cap * HGUARD_DRIVE_PC ) / 100 ) &&
+                  ( heater_temp_c_scaled < ( (int32_t)target - HGUARD_BAND_SCALED ) ) )
+        {
+            /* Driving hard well under the target, the temperature must rise */
+            if ( ( hguard_watch_count == 0 ) || ( heater_temp_c_scaled < hguard_watch_c_scaled ) )
+            {
+                hguard_watch_c_scaled = heater_temp_c_scaled;
+                hguard_watch_count = 0;
+            }
+            if ( heater_temp_c_scaled >= ( hguard_watch_c_scaled + HGUARD_RISE_SCALED ) )
+                hguard_watch_count = 0;
+            else if ( ++hguard_watch_count >= ( HGUARD_RISE_S * HEATER_PERIOD_S_COUNTS ) )
+                trip = HGUARD_NO_RISE;
+        }
+        else
+            hguard_watch_count = 0;
+        
+        if ( trip != HGUARD_OK )
+        {
+            SET_HEATER_OUTPUT( 0 );
+            hguard_trip = trip;
+        }
+    }
+    
+    hguard_raw_prev = raw_c_scaled;
+    hguard_raw_valid = true;
+}
+
+void heater_guard_stop( void )
+{
+    /* The ADC filter interrupt cut the heater, stop what was driving it */
+    E_HGUARD trip = (E_HGUARD)hguard_trip;
+    bool no_sensor = ( trip == HGUARD_NO_SENSOR );
+    int16_t target = htune_active ? htune_target : hpid_target;
+    
+    HPID_INTERRUPT_OFF();
+    
+    if ( htune_active )
+    {
+        htune_active = false;
+        htune_run_checks = false;
+        htune_state = HTUNE_STATE_FAILED;
+        htune_fail = no_sensor ? HTUNE_FAIL_TEMP_NOT_PRESENT : HTUNE_FAIL_HEATER_GUARD;
+        fault_log( FAULT_ID_HTUNE_FAIL, htune_fail );
+    }
+    else if ( hpid_state == HPID_STATE_RUNNING )
+    {
+        hpid_state = HPID_STATE_ERROR;
+        hpid_error = no_sensor ? HPID_ERROR_TEMP_NOT_PRESENT : HPID_ERROR_HEATER_GUARD;
+        fault_log( FAULT_ID_HPID_ERROR, hpid_error );
+    }
+    if ( !no_sensor )
+    {
+        fault_log( FAULT_ID_HGUARD, trip );
+        LOG_INFO( LOG_ID_HGUARD, trip, LOG_TEMP_ARGS( heater_temp_c_scaled ), LOG_TEMP_ARGS( target ) );
+    }
+    hguard_trip = HGUARD_OK;
+    SET_HEATER_OUTPUT( 0 );
+    
+    HPID_INTERRUPT_ON();
+}
+
+void temp_reply_publish( void )
+{
+    /* From the ADC filter interrupt, so TEMP_GET_ACTUAL no longer masks it to read the value */
+    uint8_t *buf_ptr = spi_reply_cache_slot( &temp_actual_reply );
+    
+    buf_ptr[0] = ERR_OK;
+    COPY_16BIT_TO_PTR_REV( &buf_ptr[1], heater_temp_c_scaled );
+    spi_reply_cache_publish( &temp_actual_reply, sizeof(err) + sizeof(heater_temp_c_scaled) );
 }
 
 void __attribute__ ( ( interrupt, no_auto_psv ) ) _ADFLTR0Interrupt ( void )
 {
-    /* Note:
-     * For the filter to be read correctly, the order is important.
-     * 1. Turn off filter. We do this to stop conversion until next timer call.
-     * 2. Read filter. This resets the RDY flag, which allows ADFLTR0IF to be cleared.
-     * 3. Clear ADFLTR0IF to prevent further interrupts.
-     */
+    /* Note:
+     * For the filter to be read correctly, the order is important.
+     * 1. Turn off filter. We do this to stop conversion until next timer call.
+     * 2. Read filter. This resets the RDY flag, which allows ADFLTR0IF to be cleared.
+     * 3. Clear ADFLTR0IF to prevent further interrupts.
+     */
+    
+    PROBE_ISR_ENTER();
+    TRACE_BEGIN( TRACE_ISR_ADC );
+    
+    /* Stop filter and read sample */
+    ADFL0CONbits.FLEN = 0;  // Disable filter until timer re-enables it
+    heater_temp_filt = HEATER_ADC_FLT_REG << heater_adc_norm_shift;
+    
+    /* New configuration takes effect from the next sample */
+    if ( heater_adc_config_pending )
+    {
+        ADFL0CONbits.OVRSAM = heater_adc_ovrsam;
+        ADFL0CONbits.MODE = ( heater_adc_mode == HEATER_ADC_MODE_AVERAGE ) ? 0b11 : 0b00;
+        heater_adc_norm_shift = HEATER_ADC_BITS - heater_adc_result_bits( heater_adc_ovrsam, heater_adc_mode );
+        heater_noise_valid = false;
+        hguard_raw_valid = false;
+        heater_adc_config_pending = false;
+    }
+    
+    heater_temp_present = heater_temp_filt < HEATER_TEMP_PRESENT_THRESHOLD;
+    heater_adc_noise_update( heater_temp_filt );
+    if ( heater_temp_ready )
+        heater_adc_avg = (int32_t)heater_adc_avg + ( ( ( (int32_t)heater_temp_filt << HEATER_ADC_SHIFT ) - (int32_t)heater_adc_avg ) >> heater_adc_filt_shift );
+    else
+    {
+        /* The IIR filter starts from the first sample rather than rising from 0 */
+        heater_adc_avg = (uint32_t)heater_temp_filt << HEATER_ADC_SHIFT;
+        heater_temp_ready = true;
+    }
+    heater_temp_c_scaled = get_heater_temp( heater_adc_avg );
+    heater_guard_sample( get_heater_temp( (uint32_t)heater_temp_filt << HEATER_ADC_SHIFT ) );
+    temp_reply_publish();
+    heater_sample_us = time_now_us();
+    latency_sample( LATENCY_HEATER );
+    IFS7bits.ADFLTR0IF = 0;
+    
+    task_release( TASK_HEATER );
+    
+    TRACE_END( TRACE_ISR_ADC );
+    PROBE_ISR_EXIT();
+}
+
+err temp_valid( int16_t temp_c_scaled )
+{
+    err rc = ERR_OK;
+    
+    if ( ( temp_c_scaled < HEATER_TEMP_MIN_SCALED ) ||
+         ( temp_c_scaled > HEATER_TEMP_MAX_SCALED ) )
+        rc = ERR_HEAT_TARGET_INVALID;
+    
+    return rc;
+}
+
+err parse_packet_get_id( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+{
+    err rc = ERR_OK;
+    uint8_t i;
+    uint8_t return_buf[ sizeof(err) + sizeof(device_id)];
+    return_buf[0] = ERR_OK;
+    for ( i=0; i<sizeof(device_id); i++ )
+        return_buf[i+1] = device_id[i];
+//    memcpy( &return_buf[1], device_id, sizeof(device_id) );
+    
+    spi_packet_write( packet_type, return_buf, sizeof(return_buf) );
+    
+    return rc;
+}
+
+err parse_packet_temp_set_target( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+{
+    err rc = ERR_OK;
+    int16_t temp_target;
+    
+    if ( packet_data_size != sizeof(temp_target) )    
+        rc = ERR_PACKET_INVALID;
+    else
+    {
+        temp_target = (int16_t)PTR_TO_16BIT( packet_data );
+        
+        rc = temp_valid( temp_target );
+        
+        if ( rc == ERR_OK )
+        {
+            if ( hprof_active )
+                heater_profile_stop( HPROF_STATE_ABORTED );
+            hpid_target = temp_target;
+            store_save_hpid_temp( hpid_target );
+            spi_packet_write( packet_type, &rc, 1 );
+        }
+    }
+    
+    return rc;
+}
+
+err parse_packet_temp_get_target( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+{
+    err rc = ERR_OK;
+    uint8_t return_buf[ sizeof(err) + sizeof(hpid_target) ];
+    
+    return_buf[0] = ERR_OK;
+    COPY_16BIT_TO_PTR_REV( &return_buf[1], hpid_target );
+    
+    spi_packet_write( packet_type, return_buf, sizeof(return_buf) );
+    
+    return rc;
+}
+
+err parse_packet_temp_get_actual( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+{
+    /* Return: [err U8][temp C I16 big endian], published by the ADC filter interrupt */
+    
+    spi_reply_cache_write( &temp_actual_reply, packet_type );
+    
+    return ERR_OK;
+}
+
+err parse_packet_pid_set_coeffs( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+{
+    err rc = ERR_OK;
+    uint16_t pid_p;
+    uint16_t pid_i;
+    uint16_t pid_d;
+    
+    if ( packet_data_size != ( 3 * sizeof(pid_p) ) )
+        rc = ERR_PACKET_INVALID;
+    else
+    {
+        pid_p = PTR_TO_16BIT( &packet_data[0] );
+        pid_i = PTR_TO_16BIT( &packet_data[2] );
+        pid_d = PTR_TO_16BIT( &packet_data[4] );
+        
+        if ( !pid_valid( pid_p, pid_i, pid_d ) )
+            rc = ERR_PACKET_PID_INVALID;
+        {
+            HPID_INTERRUPT_OFF();
+            hpid_p = pid_p;
+            hpid_i = pid_i;
+            hpid_d = pid_d;
+            HPID_INTERRUPT_ON();
+
+            status_pid_valid = true;
+            
+            validate_pid_constants_state();
+        }
+    }
+
+    if ( rc == ERR_OK )
+        spi_packet_write( packet_type, &rc, 1 );
+    
+    return rc;
+}
+
+err parse_packet_pid_get_coeffs( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+{
+    err rc = ERR_OK;
+    uint16_t coeff;
+    uint8_t return_buf[ sizeof(err) + 3*sizeof(coeff) ];
+    
+    return_buf[0] = ERR_OK;
+    
+    HPID_INTERRUPT_OFF();
+    coeff = (uint16_t)hpid_p;
+    COPY_16BIT_TO_PTR_REV( &return_buf[1], coeff );
+    coeff = (uint16_t)hpid_i;
+    COPY_16BIT_TO_PTR_REV( &return_buf[3], coeff );
+    coeff = (uint16_t)hpid_d;
+    COPY_16BIT_TO_PTR_REV( &return_buf[5], coeff );
+    HPID_INTERRUPT_ON();
+    
+    spi_packet_write( packet_type, return_buf, sizeof(return_buf) );
+    
+    return rc;
+}
+
+err parse_packet_pid_set_running( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+{
+    err rc = ERR_OK;
+    uint8_t run;
+    int16_t temp_target;
+    
+    if ( packet_data_size < 1 )
+        rc = ERR_PACKET_INVALID;
+    {
+        run = packet_data[0];
+
+        if ( run )
+        {
+            if ( packet_data_size == ( 1 + sizeof(temp_target) ) )
+                temp_target = (int16_t)PTR_TO_16BIT( &packet_data[1] );
+            else
+                temp_target = hpid_target;
+            
+            switch ( hpid_state )
+            {
+                case HPID_STATE_UNCONFIGURED:
+                    rc = ERR_HEAT_PID_NOT_READY;
+                    break;
+                case HPID_STATE_ERROR:
+                    if ( !status_check() )
+                    {
+                        rc = ERR_HEAT_PID_NOT_READY;
+                        break;
+                    }
+                    else
+                        hpid_state = HPID_STATE_READY;
+                case HPID_STATE_READY:
+                case HPID_STATE_SUSPENDED:
+                {
+                    rc = temp_valid( temp_target );
+                    if ( rc == ERR_OK )
+                    {
+                        hpid_target = temp_target;
+                        store_save_hpid_temp( hpid_target );
+                        heater_pid_start();
+                    }
+                    break;
+                }
+                case HPID_STATE_RUNNING:
+                    rc = temp_valid( temp_target );
+                    if ( rc == ERR_OK )
+                    {
+                        /* An explicit target takes over from a running profile */
+                        if ( hprof_active && ( packet_data_size == ( 1 + sizeof(temp_target) ) ) )
+                            heater_profile_stop( HPROF_STATE_ABORTED );
+                        hpid_target = temp_target;
+                        store_save_hpid_temp( hpid_target );
+                    }
+                    break;
+                default:
+                    rc = ERR_ERROR;
+            }
+        } else if ( hpid_state == HPID_STATE_RUNNING )
+            hpid_state = HPID_STATE_READY;
+    }
+    
+    if ( rc == ERR_OK )
+        spi_packet_write( packet_type, &rc, 1 );
+    
+    return rc;
+}
+
+err parse_packet_pid_get_status( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+{
+    err rc = ERR_OK;
+    uint8_t return_buf[ sizeof(err) + 2*sizeof(uint8_t) ];
+    
+    return_buf[0] = ERR_OK;
+    return_buf[1] = hpid_state;
+    return_buf[2] = hpid_error;
+    
+    spi_packet_write( packet_type, return_buf, sizeof(return_buf) );
+    
+    return rc;
+}
+
+err parse_packet_autotune_set_running( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+{
+    err rc = ERR_OK;
+    uint8_t run;
+    int16_t temp_target;
+    uint8_t flags;
+    
+    if ( packet_data_size < 1 )
+        rc = ERR_PACKET_INVALID;
+    else
+    {
+        run = packet_data[0];
+
+        if ( run )
+        {
+            if ( packet_data_size >= ( 1 + sizeof(temp_target) ) )
+                temp_target = (int16_t)PTR_TO_16BIT( &packet_data[1] );
+            else
+                temp_target = htune_target;
+            
+            if ( packet_data_size >= ( 1 + sizeof(temp_target) + sizeof(flags) ) )
+                flags = packet_data[1 + sizeof(temp_target)];
+            else
+                flags = 0;
+            
+            store_save_htune_temp( temp_target );
+            autotune_start( temp_target, flags );
+        } else if ( htune_active )
+        {
+            autotune_stop( HTUNE_STATE_ABORTED );
+            LOG_INFO( LOG_ID_HTUNE_ABORT, 0 );
+        }
+    }
+    
+    if ( rc == ERR_OK )
+        spi_packet_write( packet_type, &rc, 1 );
+    
+    return rc;
+}
+
+err parse_packet_autotune_get_running( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+{
+    err rc = ERR_OK;
+    uint8_t return_buf[ sizeof(err) + sizeof(uint8_t) ];
+    
+    return_buf[0] = ERR_OK;
+    return_buf[1] = htune_active ? 1 : 0;
+    
+    spi_packet_write( packet_type, return_buf, sizeof(return_buf) );
+    
+    return rc;
+}
+
+err parse_packet_autotune_get_status( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+{
+    err rc = ERR_OK;
+    uint8_t return_buf[ sizeof(err) + 2*sizeof(uint8_t) + sizeof(uint16_t) ];
+    uint16_t remaining_s;
+    
+    remaining_s = autotune_remaining_s();
+    
+    return_buf[0] = ERR_OK;
+    return_buf[1] = htune_state;
+    return_buf[2] = htune_fail;
+    COPY_16BIT_TO_PTR_REV( &return_buf[3], remaining_s );
+    
+    spi_packet_write( packet_type, return_buf, sizeof(return_buf) );
+    
+    return rc;
+}
+
+err parse_packet_stir_set_running( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+{
+    err rc = ERR_OK;
+    uint8_t run;
+    uint16_t stir_speed_rps;
+    
+    /* Data: [Run U8][Speed U16][Accel rps/s U8], speed and accel optional */
+    
+    if ( packet_data_size < 1 )
+        rc = ERR_PACKET_INVALID;
+    else
+    {
+        run = packet_data[0];
+
+        if ( run )
+        {
+            if ( packet_data_size >= ( 1 + sizeof(stir_speed_rps) ) )
+                stir_speed_rps = (uint16_t)PTR_TO_16BIT( &packet_data[1] );
+            else
+                stir_speed_rps = stir_target;
+            
+            if ( packet_data_size >= ( 1 + sizeof(stir_speed_rps) + 1 ) )
+                stir_accel_rps_s = packet_data[3];
+            
+            /* Retrying after a stall error is a fresh start */
+            if ( stir_state == STIR_STATE_ERROR )
+                stir_state = STIR_STATE_READY;
+            
+            switch ( stir_state )
+            {
+                case STIR_STATE_UNCONFIGURED:
+                    rc = ERR_STIR_PID_NOT_READY;
+                    break;
+                case STIR_STATE_READY:
+                {
+                    stir_target = stir_speed_rps;
+                    stir_pid_start();
+                    break;
+                }
+                case STIR_STATE_RUNNING:
+                    stir_target = stir_speed_rps;
+                    break;
+                default:
+                    rc = ERR_ERROR;
+            }
+        } else if ( stir_state == STIR_STATE_RUNNING )
+            stir_pid_stop();
+        else if ( stir_state == STIR_STATE_ERROR )
+            stir_state = STIR_STATE_READY;
+    }
+    
+    if ( rc == ERR_OK )
+        spi_packet_write( packet_type, &rc, 1 );
+    
+    return rc;
+}
+
+err parse_packet_stir_get_status( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+{
+    /* Return: [err U8][State U8][Phase U8][Stalls U8][Setpoint rps U16] */
+    
+    err rc = ERR_OK;
+    uint8_t return_buf[ sizeof(err) + 3*sizeof(uint8_t) + sizeof(uint16_t) ];
+    uint16_t setpoint_rps;
+    
+    setpoint_rps = ( stir_state == STIR_STATE_RUNNING ) ? ( stir_setpoint_scaled + ( 1 << ( STIR_SHIFT - 1 ) ) ) >> STIR_SHIFT : 0;
+    
+    return_buf[0] = ERR_OK;
+    return_buf[1] = stir_state;
+    return_buf[2] = stir_phase;
+    return_buf[3] = stir_stalls;
+    COPY_16BIT_TO_PTR_REV( &return_buf[4], setpoint_rps );
+    
+    spi_packet_write( packet_type, return_buf, sizeof(return_buf) );
+    
+    return rc;
+}
+
+err parse_packet_stir_speed_get_actual( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+{
+    /* Return: [err U8][speed rps U16 big endian], published each stir task run */
+    
+    spi_reply_cache_write( &stir_speed_actual_reply, packet_type );
+    
+    return ERR_OK;
+}
+
+err parse_packet_heat_power_limit_pc_set( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+{
+    err rc = ERR_OK;
+    uint8_t heat_power_limit_pc;
+    
+    if ( packet_data_size != sizeof(heat_power_limit_pc) )
+        rc = ERR_PACKET_INVALID;
+    else
+    {
+        heat_power_limit_pc = packet_data[0];
+        
+        /* Can't change this while autotuning */
+        if ( htune_active )
+            rc = ERR_HEAT_AUTOTUNE_ACTIVE;
+        else if ( heat_power_limit_pc > 100 )
+            rc = ERR_HEAT_MAX_POWER_INVALID;
+        else
+        {
+            HPID_INTERRUPT_OFF();
+            set_heat_power_limit_pc( heat_power_limit_pc );
+            store_save_heat_power_limit_pc( heat_power_limit_pc );
+            HPID_INTERRUPT_ON();
+        }
+    }
+    
+    if ( rc == ERR_OK )
+        spi_packet_write( packet_type, &rc, 1 );
+    
+    return rc;
+}
+
+err parse_packet_heat_power_limit_pc_get( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+{
+    err rc = ERR_OK;
+    uint8_t heat_power_limit_pc;
+    uint8_t return_buf[ sizeof(err) + 1*sizeof(uint8_t) ];
+    
+    heat_power_limit_pc = ( (uint32_t)heater_output_max * 100 + ( HEATER_POWER_MAX >> 1 ) ) / HEATER_POWER_MAX;
+    
+    return_buf[0] = ERR_OK;
+    return_buf[1] = heat_power_limit_pc;
+    
+    spi_packet_write( packet_type, return_buf, sizeof(return_buf) );
+    
+    return rc;
+}
+
+err parse_packet_get_spi_stats( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+{
+    /* Data: [Reset U8] optional */
+    /* Return: [err U8][spi_stats_report() U16 * 9] */
+    
+    err rc = ERR_OK;
+    uint8_t return_buf[ sizeof(err) + SPI_STATS_REPORT_SIZE ];
+    
+    if ( packet_data_size > 1 )
+        rc = ERR_PACKET_INVALID;
+    else
+    {
+        spi_stats_report( &return_buf[1], ( packet_data_size == 1 ) && packet_data[0] );
+        return_buf[0] = ERR_OK;
+        
+        spi_packet_write( packet_type, return_buf, sizeof(return_buf) );
+    }
+    
+    return rc;
+}
+
+err parse_packet_echo( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+{
+    /* Data: [payload...], any size, for timing the SPI link */
+    /* Return: [err U8][payload...] */
+    
+    err rc = ERR_OK;
+    uint8_t return_buf[ sizeof(err) + SPI_PACKET_BUF_SIZE ];
+    
+    return_buf[0] = ERR_OK;
+    memcpy( &return_buf[1], packet_data, packet_data_size );
+    
+    spi_packet_write( packet_type, return_buf, sizeof(err) + packet_data_size );
+    
+    return rc;
+}
+
+err parse_packet_sync_time( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+{
+    /* Data: none to read the clock, or [Mode U8][Value U32], see rio_time.h TIME_SYNC_* */
+    /* Return: [err U8][Synced time us U32][Local time us U32][Syncs U16], little endian as the other shared module reports */
+    
+    err rc = ERR_OK;
+    uint8_t return_buf[ sizeof(err) + TIME_REPORT_SIZE ];
+    
+    rc = time_sync( packet_data, packet_data_size );
+    if ( rc == ERR_OK )
+    {
+        return_buf[0] = ERR_OK;
+        time_report( &return_buf[1] );
+        spi_packet_write( packet_type, return_buf, sizeof(return_buf) );
+    }
+    
+    return rc;
+}
+
+err parse_packet_stage( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+{
+    /* Data: none to read, [0] to cancel, or [Apply time us U32][Packet Type U8][Data...], see rio_stage.h */
+    /* Return: [err U8][Pending U8][Applied U16][Late U16][Failed U16][Last error us I32], little endian as SYNC_TIME */
+    
+    err rc = ERR_OK;
+    uint8_t return_buf[ sizeof(err) + STAGE_REPORT_SIZE ];
+    
+    rc = stage_packet( packet_data, packet_data_size );
+    if ( rc == ERR_OK )
+    {
+        return_buf[0] = ERR_OK;
+        stage_report( &return_buf[1] );
+        spi_packet_write( packet_type, return_buf, sizeof(return_buf) );
+    }
+    
+    return rc;
+}
+
+err parse_packet_get_probe_stats( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+{
+    /* Data: [Reset U8] optional */
+    /* Return: [err U8][Timer Hz U32][Probes U8] Probes x ([Count U32][Min U16][Max U16][Mean U16]), then the
+     * load, [Load permille U16][Peak U16][ISR permille U16][ISR max U16][Idle pass U16][Pass max U16][Passes U32] */
+    
+    err rc = ERR_OK;
+    uint8_t return_buf[ sizeof(err) + PROBE_REPORT_SIZE ];
+    
+    if ( packet_data_size > 1 )
+        rc = ERR_PACKET_INVALID;
+    else
+    {
+#ifdef PROBE_ENABLED
+        probe_report( &return_buf[1], ( packet_data_size == 1 ) && packet_data[0] );
+#else
+        memset( &return_buf[1], 0, PROBE_REPORT_SIZE );
+#endif
+        return_buf[0] = ERR_OK;
+        
+        spi_packet_write( packet_type, return_buf, sizeof(return_buf) );
+    }
+    
+    return rc;
+}
+
+err parse_packet_get_task_stats( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+{
+    /* Data: [Reset U8] optional */
+    /* Return: [err U8][Tasks U8] Tasks x ([Runs U32][Missed U16]) */
+    
+    err rc = ERR_OK;
+    uint8_t task;
+    uint8_t return_buf[ sizeof(err) + sizeof(uint8_t) + ( TASK_COUNT * TASK_STATS_SIZE ) ];
+    uint8_t *return_buf_ptr;
+    
+    if ( packet_data_size > 1 )
+        rc = ERR_PACKET_INVALID;
+    else
+    {
+        return_buf_ptr = return_buf;
+        *return_buf_ptr++ = ERR_OK;
+        *return_buf_ptr++ = TASK_COUNT;
+        
+        for ( task=0; task<TASK_COUNT; task++ )
+        {
+            memcpy( return_buf_ptr, &tasks[task].runs, sizeof(uint32_t) );
+            return_buf_ptr += sizeof(uint32_t);
+            COPY_16BIT_TO_PTR( return_buf_ptr, tasks[task].missed );
+            return_buf_ptr += sizeof(uint16_t);
+            
+            if ( ( packet_data_size == 1 ) && packet_data[0] )
+            {
+                tasks[task].runs = 0;
+                tasks[task].missed = 0;
+            }
+        }
+        
+        spi_packet_write( packet_type, return_buf, sizeof(return_buf) );
+    }
+    
+    return rc;
+}
+
+err parse_packet_pid_model( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+{
+    /* Data: [Flags U8][Setpoint Weight % U8], or none to query */
+    /* Return: [err U8][Valid U8][Flags U8][Setpoint Weight % U8][Ambient I16][Ref Temp I16]
+     *         [Ref Output U16][Tau s U16][Dead s U16][Feedforward U16] */
+    
+    err rc = ERR_OK;
+    uint8_t return_buf[ sizeof(err) + 3*sizeof(uint8_t) + 6*sizeof(uint16_t) ];
+    uint16_t ff;
+    
+    if ( ( packet_data_size != 0 ) && ( packet_data_size != 2 ) )
+        rc = ERR_PACKET_INVALID;
+    else if ( ( packet_data_size == 2 ) && ( packet_data[1] > 100 ) )
+        rc = ERR_PACKET_INVALID;
+    else
+    {
+        if ( packet_data_size == 2 )
+        {
+            hmodel.flags = packet_data[0];
+            hmodel.sp_weight_pc = packet_data[1];
+            hpid_ff_stale = true;
+            store_save_heater_model( &hmodel );
+        }
+        
+        ff = hpid_ff;
+        return_buf[0] = ERR_OK;
+        return_buf[1] = hmodel_valid ? 1 : 0;
+        return_buf[2] = hmodel.flags;
+        return_buf[3] = hmodel.sp_weight_pc;
+        COPY_16BIT_TO_PTR_REV( &return_buf[4], hmodel.ambient_c_scaled );
+        COPY_16BIT_TO_PTR_REV( &return_buf[6], hmodel.ref_c_scaled );
+        COPY_16BIT_TO_PTR_REV( &return_buf[8], hmodel.ref_output );
+        COPY_16BIT_TO_PTR_REV( &return_buf[10], hmodel.tau_s );
+        COPY_16BIT_TO_PTR_REV( &return_buf[12], hmodel.dead_s );
+        COPY_16BIT_TO_PTR_REV( &return_buf[14], ff );
+        
+        spi_packet_write( packet_type, return_buf, sizeof(return_buf) );
+    }
+    
+    return rc;
+}
+
+err parse_packet_profile_set_segment( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+{
+    /* Data: [Index U8][Target I16][Ramp Rate U16][Hold s U16] */
+    /* Return: [err U8] */
     
-    /* Stop filter and read sample */
-    ADFL0CONbits.FLEN = 0;  // Disable filter until timer re-enables it
-    heater_temp_filt = HEATER_ADC_FLT_REG;
-    heater_temp_present = heater_temp_filt < HEATER_TEMP_PRESENT_THRESHOLD;
-    heater_adc_avg = ( ( heater_adc_avg * HEATER_ADC_FILT_MUL ) + ( (int64_t)( heater_temp_filt & HEATER_ADC_MAX ) << HEATER_ADC_SHIFT ) ) >> HEATER_ADC_FILT_SHIFT;
-    heater_temp_c_scaled = get_heater_temp();
-    IFS7bits.ADFLTR0IF = 0;
-    PORTBbits.RB13 = 1;
+    err rc = ERR_OK;
+    uint8_t index;
+    int16_t target;
     
-    /* Run heater PID or autotune as required */
-    if ( htune_active )
+    if ( packet_data_size != ( sizeof(uint8_t) + 3*sizeof(uint16_t) ) )
+        rc = ERR_PACKET_INVALID;
+    else if ( hprof_active )
+        rc = ERR_HEAT_PROFILE_ACTIVE;
+    else
     {
-        autotune( false );
-        htune_timer++;
+        index = packet_data[0];
+        target = (int16_t)PTR_TO_16BIT( &packet_data[1] );
+        
+        if ( index >= HPROF_SEGMENTS_MAX )
+            rc = ERR_HEAT_PROFILE_INVALID;
+        else
+            rc = temp_valid( target );
+        
+        if ( rc == ERR_OK )
+        {
+            hprof_segments[index].target = target;
+            hprof_segments[index].ramp_rate = PTR_TO_16BIT( &packet_data[3] );
+            hprof_segments[index].hold_s = PTR_TO_16BIT( &packet_data[5] );
+            hprof_loaded |= (uint16_t)1 << index;
+            
+            spi_packet_write( packet_type, &rc, 1 );
+        }
     }
-    else if ( hpid_state == HPID_STATE_RUNNING )
-        heater_pid();
+    
+    return rc;
+}
+
+err parse_packet_profile_set_running( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+{
+    /* Data: [Length U8][Cycles U8] to start, [0] to stop, or none to query */
+    /* Return: [err U8][State U8][Segment U8][Length U8][Cycle U16][Setpoint I16][Hold Left s U16] */
+    
+    err rc = ERR_OK;
+    uint8_t length;
+    uint16_t mask;
+    int16_t setpoint;
+    uint16_t hold_left_s;
+    uint8_t return_buf[ sizeof(err) + HPROF_STATUS_SIZE ];
+    
+    if ( packet_data_size > 2 )
+        rc = ERR_PACKET_INVALID;
+    else if ( packet_data_size > 0 )
+    {
+        length = packet_data[0];
+        mask = (uint16_t)( ( (uint32_t)1 << MIN( length, HPROF_SEGMENTS_MAX ) ) - 1 );
+        
+        if ( length == 0 )
+        {
+            if ( hprof_active )
+                heater_profile_stop( HPROF_STATE_IDLE );
+        }
+        else if ( packet_data_size != 2 )
+            rc = ERR_PACKET_INVALID;
+        else if ( ( length > HPROF_SEGMENTS_MAX ) || ( ( hprof_loaded & mask ) != mask ) )
+            rc = ERR_HEAT_PROFILE_INVALID;
+        else if ( htune_active )
+            rc = ERR_HEAT_AUTOTUNE_ACTIVE;
+        else if ( hpid_state != HPID_STATE_RUNNING )
+            rc = ERR_HEAT_PID_NOT_READY;
+        else
+            heater_profile_start( length, packet_data[1] );
+    }
+    
+    if ( rc == ERR_OK )
+    {
+        setpoint = hprof_setpoint >> HPROF_SETPOINT_SHL;
+        if ( hprof_state == HPROF_STATE_HOLD )
+            hold_left_s = MIN( ( hprof_hold_counts + HEATER_PERIOD_S_COUNTS - 1 ) / HEATER_PERIOD_S_COUNTS, UINT16_MAX );
+        else if ( hprof_active )
+            hold_left_s = hprof_segments[hprof_segment].hold_s;
+        else
+            hold_left_s = 0;
+        
+        return_buf[0] = ERR_OK;
+        return_buf[1] = hprof_state;
+        return_buf[2] = hprof_segment;
+        return_buf[3] = hprof_length;
+        COPY_16BIT_TO_PTR_REV( &return_buf[4], hprof_cycle );
+        COPY_16BIT_TO_PTR_REV( &return_buf[6], setpoint );
+        COPY_16BIT_TO_PTR_REV( &return_buf[8], hold_left_s );
+        
+        spi_packet_write( packet_type, return_buf, sizeof(return_buf) );
+    }
+    
+    return rc;
+}
+
+uint8_t *history_record_pack( history_record_t *record, uint8_t *buf )
+{
+    /* HISTORY_RECORD_SIZE bytes of GET_HISTORY and HISTORY_STREAM, returns the end */
+    
+    uint8_t term;
+    
+    COPY_16BIT_TO_PTR_REV( buf, record->seq );
+    buf += sizeof(uint16_t);
+    COPY_32BIT_TO_PTR_REV( buf, record->time_us );
+    buf += sizeof(uint32_t);
+    COPY_16BIT_TO_PTR_REV( buf, record->temp_c_scaled );
+    buf += sizeof(int16_t);
+    COPY_16BIT_TO_PTR_REV( buf, record->target_c_scaled );
+    buf += sizeof(int16_t);
+    COPY_16BIT_TO_PTR_REV( buf, record->heater_output );
+    buf += sizeof(uint16_t);
+    for ( term=0; term<3; term++ )
+    {
+        COPY_16BIT_TO_PTR_REV( buf, record->hpid_terms[term] );
+        buf += sizeof(int16_t);
+    }
+    COPY_16BIT_TO_PTR_REV( buf, record->stir_speed_rps );
+    buf += sizeof(uint16_t);
+    *buf++ = record->stir_output;
+    *buf++ = record->flags;
+    
+    return buf;
+}
+
+void history_record_words( history_record_t *record, uint16_t *words )
+{
+    /* HISTORY_WORDS words, the GET_HISTORY record read as big endian words */
+    
+    uint8_t term;
+    
+    *words++ = record->seq;
+    *words++ = (uint16_t)( record->time_us >> 16 );
+    *words++ = (uint16_t)record->time_us;
+    *words++ = record->temp_c_scaled;
+    *words++ = record->target_c_scaled;
+    *words++ = record->heater_output;
+    for ( term=0; term<3; term++ )
+        *words++ = record->hpid_terms[term];
+    *words++ = record->stir_speed_rps;
+    *words++ = ( record->stir_output << 8 ) | record->flags;
+}
+
+history_record_t *history_find( uint16_t seq )
+{
+    /* The record of <seq>, or NULL if it is not in the ring, not yet or no longer */
+    
+    if ( (uint16_t)( history_seq - 1 - seq ) >= history_count )
+        return NULL;
+    
+    return &history[ ( history_head - 1 - (uint8_t)( history_seq - 1 - seq ) ) & ( HISTORY_LEN - 1 ) ];
+}
+
+uint8_t history_stream_fill( uint16_t offset, uint8_t *buf, uint8_t max )
+{
+    /* spi_stream_fill_t of HISTORY_STREAM: whole records from history_stream_seq, until one
+     * has been overwritten since the transfer started */
+    
+    uint16_t seq = history_stream_seq + ( offset / HISTORY_RECORD_SIZE );
+    uint8_t *buf_ptr = buf;
+    history_record_t *record;
+    
+    while ( ( ( buf_ptr - buf ) + HISTORY_RECORD_SIZE ) <= max )
+    {
+        record = history_find( seq++ );
+        if ( record == NULL )
+            break;
+        buf_ptr = history_record_pack( record, buf_ptr );
+    }
+    
+    return buf_ptr - buf;
+}
+
+uint8_t history_stream_fill_compact( uint16_t offset, uint8_t *buf, uint8_t max )
+{
+    /* spi_stream_fill_t of a compact HISTORY_STREAM: rio_delta records, the first a keyframe,
+     * as a byte stream across the chunks. Ends the transfer, which was sized for records at
+     * their largest, after the last record or at one overwritten since it started. */
+    
+    uint16_t words[HISTORY_WORDS];
+    history_record_t *record;
+    uint8_t size = 0;
+    uint8_t n;
+    
+    while ( size < max )
+    {
+        if ( history_pending_pos == history_pending_size )
+        {
+            if ( history_stream_seq == history_stream_end )
+                break;
+            record = history_find( history_stream_seq );
+            if ( record == NULL )
+                break;
+            history_record_words( record, words );
+            history_pending_size = delta_encode( &history_coder, words, history_pending );
+            history_pending_pos = 0;
+            history_stream_seq++;
+        }
+        
+        n = MIN( history_pending_size - history_pending_pos, max - size );
+        memcpy( &buf[size], &history_pending[history_pending_pos], n );
+        history_pending_pos += n;
+        size += n;
+    }
+    
+    return size;
+}
+
+err parse_packet_get_history( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+{
+    /* Data: [Start seq U16][Max records U8] */
+    /* Return: [err U8][Oldest seq U16][Newest seq U16][Count U8] Count x ([Seq U16][Time us U32][Temp I16]
+     *         [Target I16][Heater output U16][P I16][I I16][D I16][Stir rps U16][Stir output U8][Flags U8]) */
+    
+    err rc = ERR_OK;
+    uint8_t count;
+    uint8_t index;
+    uint16_t start_seq;
+    uint16_t oldest_seq;
+    uint16_t newest_seq;
+    spi_buf_count_t write_free;
+    uint8_t return_buf[ HISTORY_REPLY_HEADER + (HISTORY_REPLY_MAX*HISTORY_RECORD_SIZE) ];
+    uint8_t *return_buf_ptr;
+    
+    if ( packet_data_size != 3 )
+        rc = ERR_PACKET_INVALID;
     else
-        SET_HEATER_OUTPUT( 0 );
+    {
+        start_seq = (uint16_t)PTR_TO_16BIT( &packet_data[0] );
+        
+        /* The heater task also runs from the main loop, so the ring does not move under us */
+        newest_seq = history_seq - 1;
+        oldest_seq = history_seq - history_count;
+        
+        /* Records older than the ring start at the oldest kept, the host sees the gap */
+        if ( (int16_t)( start_seq - oldest_seq ) < 0 )
+            start_seq = oldest_seq;
+        
+        /* As many as asked for, kept, and fit the write ring */
+        count = 0;
+        if ( ( history_count > 0 ) && ( (int16_t)( newest_seq - start_seq ) >= 0 ) )
+            count = MIN( (uint16_t)( newest_seq - start_seq ) + 1, HISTORY_REPLY_MAX );
+        if ( count > packet_data[2] )
+            count = packet_data[2];
+        write_free = SPI_WRITE_BUF_SIZE - spi_write_bytes_written();
+        while ( ( count > 0 ) && ( ( HISTORY_REPLY_HEADER + ( count * HISTORY_RECORD_SIZE ) + 6 ) > write_free ) )
+            count--;
+        
+        return_buf_ptr = return_buf;
+        *return_buf_ptr++ = ERR_OK;
+        COPY_16BIT_TO_PTR_REV( return_buf_ptr, oldest_seq );
+        return_buf_ptr += sizeof(uint16_t);
+        COPY_16BIT_TO_PTR_REV( return_buf_ptr, newest_seq );
+        return_buf_ptr += sizeof(uint16_t);
+        *return_buf_ptr++ = count;
+        
+        index = ( history_head - 1 - (uint8_t)( newest_seq - start_seq ) ) & ( HISTORY_LEN - 1 );
+        while ( count-- > 0 )
+        {
+            return_buf_ptr = history_record_pack( &history[index], return_buf_ptr );
+            index = ( index + 1 ) & ( HISTORY_LEN - 1 );
+        }
+        
+        spi_packet_write( packet_type, return_buf, return_buf_ptr - return_buf );
+    }
+    
+    return rc;
+}
+
+err parse_packet_history_stream( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+{
+    /* Data: [Start seq U16][Max records U16][Format U8], format optional, HISTORY_FORMAT_PLAIN by default */
+    /* Return: a streamed transfer, see rio_spi, of Count x GET_HISTORY records from the
+     *         oldest kept at or after Start seq up to the newest, at most Max records. Compact,
+     *         the rio_delta records of their HISTORY_WORDS words, the first a keyframe. */
+    
+    uint16_t start_seq = (uint16_t)PTR_TO_16BIT( &packet_data[0] );
+    uint16_t max = (uint16_t)PTR_TO_16BIT( &packet_data[2] );
+    uint8_t format = ( packet_data_size > 4 ) ? packet_data[4] : HISTORY_FORMAT_PLAIN;
+    uint16_t newest_seq = history_seq - 1;
+    uint16_t oldest_seq = history_seq - history_count;
+    uint16_t count = 0;
+    
+    if ( (int16_t)( start_seq - oldest_seq ) < 0 )
+        start_seq = oldest_seq;
+    if ( ( history_count > 0 ) && ( (int16_t)( newest_seq - start_seq ) >= 0 ) )
+        count = MIN( (uint16_t)( newest_seq - start_seq ) + 1, max );
+    
+    if ( format > HISTORY_FORMAT_COMPACT )
+        return ERR_PACKET_INVALID;
+    
+    history_stream_seq = start_seq;
+    if ( format == HISTORY_FORMAT_PLAIN )
+        return spi_stream_start( &spi_packet, packet_type, count * HISTORY_RECORD_SIZE, history_stream_fill );
+    
+    history_stream_end = start_seq + count;
+    delta_init( &history_coder, history_prev, HISTORY_WORDS, 0 );
+    history_pending_size = 0;
+    history_pending_pos = 0;
+    
+    return spi_stream_start( &spi_packet, packet_type, count * DELTA_RECORD_MAX( HISTORY_WORDS ), history_stream_fill_compact );
+}
+
+err parse_packet_adc_filter( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+{
+    /* Data: [Oversampling U8][Mode U8][IIR Shift U8], or none to query */
+    /* Return: [err U8][Oversampling U8][Mode U8][IIR Shift U8][Result Bits U8]
+     *         [Raw RMS counts x16 U16][Raw RMS mdegC U16][Filtered RMS mdegC U16] */
+    
+    err rc = ERR_OK;
+    uint8_t return_buf[ sizeof(err) + 4*sizeof(uint8_t) + 3*sizeof(uint16_t) ];
+    uint32_t adc_avg;
+    uint32_t diff_sq;
+    float rms_counts;
+    float slope;
+    float alpha;
+    uint16_t raw_counts;
+    uint16_t raw_mc;
+    uint16_t filt_mc;
+    
+    if ( ( packet_data_size != 0 ) && ( packet_data_size != 3 ) )
+        rc = ERR_PACKET_INVALID;
+    else if ( ( packet_data_size == 3 ) &&
+              ( ( packet_data[0] > HEATER_ADC_OVRSAM_MAX ) ||
+                ( packet_data[1] > HEATER_ADC_MODE_AVERAGE ) ||
+                ( packet_data[2] > HEATER_ADC_FILT_SHIFT_MAX ) ) )
+        rc = ERR_HEAT_ADC_CONFIG_INVALID;
+    else
+    {
+        if ( packet_data_size == 3 )
+        {
+            HPID_INTERRUPT_OFF();
+            heater_adc_ovrsam = packet_data[0];
+            heater_adc_mode = packet_data[1];
+            heater_adc_filt_shift = packet_data[2];
+            heater_adc_config_pending = true;
+            HPID_INTERRUPT_ON();
+        }
+        
+        HPID_INTERRUPT_OFF();
+        adc_avg = heater_adc_avg;
+        diff_sq = heater_noise_diff_sq;
+        HPID_INTERRUPT_ON();
+        
+        /* Sample noise from the difference variance, then to degC with the local slope of the
+         * thermistor table. An IIR of gain a = 2^-shift passes a / ( 2 - a ) of white noise power. */
+        rms_counts = sqrt( (float)diff_sq / ( 2 << HEATER_NOISE_FRAC_BITS ) );
+        slope = (float)( get_heater_temp( adc_avg - ( (uint32_t)HEATER_NOISE_SLOPE_COUNTS << HEATER_ADC_SHIFT ) ) -
+                         get_heater_temp( adc_avg + ( (uint32_t)HEATER_NOISE_SLOPE_COUNTS << HEATER_ADC_SHIFT ) ) )
+                / ( 2 * HEATER_NOISE_SLOPE_COUNTS );
+        alpha = 1.0f / (float)( (uint16_t)1 << heater_adc_filt_shift );
+        raw_counts = (uint16_t)MIN( rms_counts * 16.0f, (float)UINT16_MAX );
+        raw_mc = (uint16_t)MIN( rms_counts * fabsf( slope ) * ( 1000.0f / HEATER_TEMP_SCALE ), (float)UINT16_MAX );
+        filt_mc = (uint16_t)( raw_mc * sqrt( alpha / ( 2.0f - alpha ) ) );
+        
+        return_buf[0] = ERR_OK;
+        return_buf[1] = heater_adc_ovrsam;
+        return_buf[2] = heater_adc_mode;
+        return_buf[3] = heater_adc_filt_shift;
+        return_buf[4] = heater_adc_result_bits( heater_adc_ovrsam, heater_adc_mode );
+        COPY_16BIT_TO_PTR_REV( &return_buf[5], raw_counts );
+        COPY_16BIT_TO_PTR_REV( &return_buf[7], raw_mc );
+        COPY_16BIT_TO_PTR_REV( &return_buf[9], filt_mc );
+        
+        spi_packet_write( packet_type, return_buf, sizeof(return_buf) );
+    }
+    
+    return rc;
 }
 
-void wait_initial_temp( void )
+err parse_packet_subscribe( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
 {
-    printf( "Waiting for temperature measurement..." );
-//    while ( HEATER_ADC_FLT_RDY_REG == 0 );
-//    while ( heater_adc_avg == 0 );
-    __delay_ms( 100 );
-    printf( "Ready\n" );
-    printf( "Temperature sensor present: %s\n", heater_temp_present ? "YES" : "NO" );
+    /* Data: none to read, [0xFF] to cancel, or n x [Signal U8][Deadband U16][Max interval ms U16],
+     * see rio_report.h and REPORT_SIGNAL_* */
+    /* Return: [err U8][Subscribed U8][Reports U16][Dropped U16], little endian */
+    
+    err rc = ERR_OK;
+    uint8_t return_buf[ sizeof(err) + REPORT_STATUS_SIZE ];
+    
+    rc = report_subscribe( packet_data, packet_data_size );
+    if ( rc == ERR_OK )
+    {
+        /* Reports are drained over several transactions, keep them over a deselect */
+        spi_write_hold( report_active() );
+        
+        return_buf[0] = ERR_OK;
+        report_status( &return_buf[1] );
+        spi_packet_write( packet_type, return_buf, sizeof(return_buf) );
+    }
     
-    heater_adc_avg = (int64_t)( HEATER_ADC_FLT_REG & HEATER_ADC_MAX ) << HEATER_ADC_SHIFT;
-    heater_temp_c_scaled = get_heater_temp();
+    return rc;
 }
 
-err temp_valid( int16_t temp_c_scaled )
+err parse_packet_flash( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
 {
+    /* Data: [Op U8][...], see rio_flash.h. The new image goes into the inactive partition
+     * while the heater and stirrer run on, and boots at the reset after COMMIT. */
+    /* Return: [err U8][State U8][Boot sequence U16][Partition size U32][Words written U32]
+     * [Progress U32][CRC-32 U32], little endian */
+    
     err rc = ERR_OK;
+    uint8_t return_buf[ sizeof(err) + FLASH_STATUS_SIZE ];
     
-    if ( ( temp_c_scaled < HEATER_TEMP_MIN_SCALED ) ||
-         ( temp_c_scaled > HEATER_TEMP_MAX_SCALED ) )
-        rc = ERR_HEAT_TARGET_INVALID;
+    rc = flash_command( packet_data, packet_data_size );
+    if ( rc == ERR_OK )
+    {
+        return_buf[0] = ERR_OK;
+        flash_status( &return_buf[1] );
+        spi_packet_write( packet_type, return_buf, sizeof(return_buf) );
+    }
     
     return rc;
 }
 
-err parse_packet_get_id( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+#if HEATER_ZONES > 1
+err parse_packet_heater_zone( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
 {
+    /* Data: [Zone U8] to query, [Zone U8][Run U8][Target I16] to start or stop, or
+     *       [Zone U8][Run U8][Target I16][P U16][I U16][D U16] with the gains */
+    /* Return: [err U8][Zone U8][State U8][Error U8][Present U8][Target I16][Temp I16][Output U16]
+     *         [P U16][I U16][D U16] */
+    /* Zones past 0 only, zone 0 is the heater of packets 2 to 11 */
+    
     err rc = ERR_OK;
-    uint8_t i;
-    uint8_t return_buf[ sizeof(err) + sizeof(device_id)];
+    uint8_t return_buf[ HZONE_REPLY_SIZE ];
+    heater_zone_t *zone;
+    uint8_t index;
+    int16_t target = 0;
+    uint16_t pid_p = 0;
+    uint16_t pid_i = 0;
+    uint16_t pid_d = 0;
+    bool configured;
+    
+    if ( ( packet_data_size != 1 ) && ( packet_data_size != 4 ) && ( packet_data_size != 10 ) )
+        return ERR_PACKET_INVALID;
+    if ( ( packet_data[0] < 1 ) || ( packet_data[0] > HZONE_COUNT ) )
+        return ERR_HEAT_ZONE_INVALID;
+    
+    index = packet_data[0] - 1;
+    zone = &hzone[index];
+    
+    /* Checked whole before any of it is applied */
+    if ( packet_data_size >= 4 )
+    {
+        target = (int16_t)PTR_TO_16BIT( &packet_data[2] );
+        rc = temp_valid( target );
+        configured = zone->state != HPID_STATE_UNCONFIGURED;
+        if ( ( rc == ERR_OK ) && ( packet_data_size == 10 ) )
+        {
+            pid_p = PTR_TO_16BIT( &packet_data[4] );
+            pid_i = PTR_TO_16BIT( &packet_data[6] );
+            pid_d = PTR_TO_16BIT( &packet_data[8] );
+            if ( !pid_valid( pid_p, pid_i, pid_d ) )
+                rc = ERR_PACKET_PID_INVALID;
+            configured = true;
+        }
+        if ( ( rc == ERR_OK ) && packet_data[1] && ( !configured || !zone->present ) )
+            rc = ERR_HEAT_PID_NOT_READY;
+        if ( rc != ERR_OK )
+            return rc;
+        
+        if ( packet_data_size == 10 )
+        {
+            zone->p = pid_p;
+            zone->i = pid_i;
+            zone->d = pid_d;
+        }
+        zone->target = target;
+        if ( packet_data[1] )
+        {
+            if ( zone->state != HPID_STATE_RUNNING )
+                pid_reset( &zone->loop, zone->temp_c_scaled );
+            zone->state = HPID_STATE_RUNNING;
+            zone->error = HPID_ERROR_NONE;
+        }
+        else
+        {
+            if ( configured )
+                zone->state = HPID_STATE_READY;
+            hzone_set_output( index, 0 );
+        }
+    }
+    
     return_buf[0] = ERR_OK;
-    for ( i=0; i<sizeof(device_id); i++ )
-        return_buf[i+1] = device_id[i];
-//    memcpy( &return_buf[1], device_id, sizeof(device_id) );
+    return_buf[1] = packet_data[0];
+    return_buf[2] = zone->state;
+    return_buf[3] = zone->error;
+    return_buf[4] = zone->present ? 1 : 0;
+    COPY_16BIT_TO_PTR_REV( &return_buf[5], zone->target );
+    COPY_16BIT_TO_PTR_REV( &return_buf[7], zone->temp_c_scaled );
+    COPY_16BIT_TO_PTR_REV( &return_buf[9], zone->output );
+    COPY_16BIT_TO_PTR_REV( &return_buf[11], zone->p );
+    COPY_16BIT_TO_PTR_REV( &return_buf[13], zone->i );
+    COPY_16BIT_TO_PTR_REV( &return_buf[15], zone->d );
     
     spi_packet_write( packet_type, return_buf, sizeof(return_buf) );
     
     return rc;
 }
+#endif
 
-err parse_packet_temp_set_target( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+err parse_packet_get_eeprom_status( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
 {
+    /* Data: [Reset U8] optional */
+    /* Return: [err U8][Pending U8][Busy U8][Committed U16][Verify Failed U16][Full Waits U16] */
+    
     err rc = ERR_OK;
-    int16_t temp_target;
+    uint8_t return_buf[ sizeof(err) + 2*sizeof(uint8_t) + 3*sizeof(uint16_t) ];
+    ee_queue_stats_t stats;
     
-    if ( packet_data_size != sizeof(temp_target) )    
+    if ( packet_data_size > 1 )
         rc = ERR_PACKET_INVALID;
     else
     {
-        temp_target = (int16_t)PTR_TO_16BIT( packet_data );
+        eeprom_queue_stats( &stats, ( packet_data_size == 1 ) && packet_data[0] );
         
-        rc = temp_valid( temp_target );
+        return_buf[0] = ERR_OK;
+        return_buf[1] = stats.pending + ( store_dirty() ? 1 : 0 );   // Saves not yet queued count as one
+        return_buf[2] = stats.busy ? 1 : 0;
+        COPY_16BIT_TO_PTR_REV( &return_buf[3], stats.committed );
+        COPY_16BIT_TO_PTR_REV( &return_buf[5], stats.verify_failed );
+        COPY_16BIT_TO_PTR_REV( &return_buf[7], stats.full_waits );
         
-        if ( rc == ERR_OK )
-        {
-            hpid_target = temp_target;
-            store_save_hpid_temp( hpid_target );
-            spi_packet_write( packet_type, &rc, 1 );
-        }
+        spi_packet_write( packet_type, return_buf, sizeof(return_buf) );
     }
     
     return rc;
 }
 
-err parse_packet_temp_get_target( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+/* Parameter hooks, for values that need a lock, a check or a save when set */
+int32_t param_get_pid_coeff( const param_desc_t *param )
 {
-    err rc = ERR_OK;
-    uint8_t return_buf[ sizeof(err) + sizeof(hpid_target) ];
+    int32_t value;
     
-    return_buf[0] = ERR_OK;
-    COPY_16BIT_TO_PTR_REV( &return_buf[1], hpid_target );
+    HPID_INTERRUPT_OFF();
+    value = (uint16_t)*(int32_t *)param->value;
+    HPID_INTERRUPT_ON();
     
-    spi_packet_write( packet_type, return_buf, sizeof(return_buf) );
+    return value;
+}
+
+err param_set_pid_coeff( const param_desc_t *param, int32_t value )
+{
+    HPID_INTERRUPT_OFF();
+    *(int32_t *)param->value = value;
+    HPID_INTERRUPT_ON();
     
-    return rc;
+    status_pid_valid = pid_valid( hpid_p, hpid_i, hpid_d );
+    if ( status_pid_valid )
+        validate_pid_constants_state();
+    
+    return store_save_pid( hpid_p, hpid_i, hpid_d );
+}
+
+err param_set_hpid_target( const param_desc_t *param, int32_t value )
+{
+    if ( hprof_active )
+        heater_profile_stop( HPROF_STATE_ABORTED );
+    hpid_target = value;
+    
+    return store_save_hpid_temp( hpid_target );
+}
+
+err param_set_htune_target( const param_desc_t *param, int32_t value )
+{
+    if ( htune_active )
+        return ERR_HEAT_AUTOTUNE_ACTIVE;
+    htune_target = value;
+    
+    return store_save_htune_temp( htune_target );
+}
+
+int32_t param_get_heat_power_limit_pc( const param_desc_t *param )
+{
+    return ( (uint32_t)heater_output_max * 100 + ( HEATER_POWER_MAX >> 1 ) ) / HEATER_POWER_MAX;
+}
+
+err param_set_heat_power_limit_pc( const param_desc_t *param, int32_t value )
+{
+    if ( htune_active )
+        return ERR_HEAT_AUTOTUNE_ACTIVE;
+    
+    HPID_INTERRUPT_OFF();
+    set_heat_power_limit_pc( value );
+    HPID_INTERRUPT_ON();
+    
+    return store_save_heat_power_limit_pc( value );
+}
+
+int32_t param_get_run_on_start( const param_desc_t *param )
+{
+    uint8_t run_on_start;
+    
+    store_load_run_on_start( &run_on_start );
+    
+    return ( run_on_start == 1 );
+}
+
+err param_set_run_on_start( const param_desc_t *param, int32_t value )
+{
+    return store_save_run_on_start( value );
+}
+
+err param_set_module_addr( const param_desc_t *param, int32_t value )
+{
+    spi_module_addr = value;
+    
+    return store_save_module_addr( value );
+}
+
+err param_set_hmodel( const param_desc_t *param, int32_t value )
+{
+    *(uint8_t *)param->value = value;
+    hpid_ff_stale = true;
+    
+    return store_save_heater_model( &hmodel );
+}
+
+err param_set_hobs_shift( const param_desc_t *param, int32_t value )
+{
+    /* The observer starts again from the next reading */
+    hobs_shift = value;
+    hobs_valid = false;
+    
+    return ERR_OK;
+}
+
+#if PROBE_TRACE_PINS > 0
+err param_set_trace_mask( const param_desc_t *param, int32_t value )
+{
+    probe_trace_select( 0, value );
+    
+    return ERR_OK;
+}
+#endif
+
+int32_t param_get_hobs_temp( const param_desc_t *param )
+{
+    return heater_pid_temp();
 }
 
-err parse_packet_temp_get_actual( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+err param_set_adc_config( const param_desc_t *param, int32_t value )
 {
-    err rc = ERR_OK;
-    uint8_t return_buf[ sizeof(err) + sizeof(heater_temp_c_scaled) ];
-    int16_t temp_c_scaled;
-    
+    /* Applied by the ADC filter interrupt, as for ADC_FILTER */
     HPID_INTERRUPT_OFF();
-    temp_c_scaled = heater_temp_c_scaled;
+    *(uint8_t *)param->value = value;
+    heater_adc_config_pending = true;
     HPID_INTERRUPT_ON();
     
-    return_buf[0] = ERR_OK;
-    COPY_16BIT_TO_PTR_REV( &return_buf[1], temp_c_scaled );
-    
-    spi_packet_write( packet_type, return_buf, sizeof(return_buf) );
-    
-    return rc;
+    return ERR_OK;
 }
 
-err parse_packet_pid_set_coeffs( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+void pwm_config( void )
 {
-    err rc = ERR_OK;
-    uint16_t pid_p;
-    uint16_t pid_i;
-    uint16_t pid_d;
+    /* Heater CCP1 period for <pwm_hires>, with the output written again in its resolution.
+     * Called with the heater and stirrer interrupts off. The other zones follow. */
+#if HEATER_ZONES > 1
+    uint8_t index;
     
-    if ( packet_data_size != ( 3 * sizeof(pid_p) ) )
-        rc = ERR_PACKET_INVALID;
-    else
+#endif
+    CCP1CON1Lbits.CCPON = 0;
+    CCP1CON1Lbits.TMRPS = pwm_hires ? HEATER_PWM_TMRPS_HIRES : HEATER_PWM_TMRPS;
+    CCP1PRL = pwm_hires ? HEATER_PWM_PRL_HIRES : HEATER_PWM_PRL;
+    SET_HEATER_OUTPUT( heater_output );
+    CCP1CON1Lbits.CCPON = 1;
+    
+#if HEATER_ZONES > 1
+    for ( index=0; index<HZONE_COUNT; index++ )
     {
-        pid_p = PTR_TO_16BIT( &packet_data[0] );
-        pid_i = PTR_TO_16BIT( &packet_data[2] );
-        pid_d = PTR_TO_16BIT( &packet_data[4] );
-        
-        if ( !pid_valid( pid_p, pid_i, pid_d ) )
-            rc = ERR_PACKET_PID_INVALID;
-        {
-            HPID_INTERRUPT_OFF();
-            hpid_p = pid_p;
-            hpid_i = pid_i;
-            hpid_d = pid_d;
-            HPID_INTERRUPT_ON();
-
-            status_pid_valid = true;
-            
-            validate_pid_constants_state();
-        }
+        *hzone_hw[index].ccp_con &= ~HZONE_CCP_ON;
+        *hzone_hw[index].ccp_con = ( *hzone_hw[index].ccp_con & ~HZONE_CCP_TMRPS_MASK ) |
+                                   ( ( pwm_hires ? HEATER_PWM_TMRPS_HIRES : HEATER_PWM_TMRPS ) << HZONE_CCP_TMRPS_SHL );
+        *hzone_hw[index].ccp_prl = pwm_hires ? HEATER_PWM_PRL_HIRES : HEATER_PWM_PRL;
+        hzone_set_output( index, hzone[index].output );
+        *hzone_hw[index].ccp_con |= HZONE_CCP_ON;
     }
-
-    if ( rc == ERR_OK )
-        spi_packet_write( packet_type, &rc, 1 );
+#endif
     
-    return rc;
+    stir_output_dither = 0;
 }
 
-err parse_packet_pid_get_coeffs( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+err param_set_pwm_hires( const param_desc_t *param, int32_t value )
 {
-    err rc = ERR_OK;
-    uint16_t coeff;
-    uint8_t return_buf[ sizeof(err) + 3*sizeof(coeff) ];
-    
-    return_buf[0] = ERR_OK;
-    
     HPID_INTERRUPT_OFF();
-    coeff = (uint16_t)hpid_p;
-    COPY_16BIT_TO_PTR_REV( &return_buf[1], coeff );
-    coeff = (uint16_t)hpid_i;
-    COPY_16BIT_TO_PTR_REV( &return_buf[3], coeff );
-    coeff = (uint16_t)hpid_d;
-    COPY_16BIT_TO_PTR_REV( &return_buf[5], coeff );
+    STIR_INTERRUPT_OFF();
+    *(uint8_t *)param->value = value;
+    pwm_config();
+    STIR_INTERRUPT_ON();
     HPID_INTERRUPT_ON();
     
-    spi_packet_write( packet_type, return_buf, sizeof(return_buf) );
+    return ERR_OK;
+}
+
+err param_set_supply_budget_ma( const param_desc_t *param, int32_t value )
+{
+    supply_budget_ma = value;
+    heater_budget_update();
     
-    return rc;
+    return store_save_supply_budget_ma( supply_budget_ma );
 }
 
-err parse_packet_pid_set_running( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+err param_set_stir_period( const param_desc_t *param, int32_t value )
+{
+    *(uint8_t *)param->value = value;
+    stir_timer_config();
+    
+    return ERR_OK;
+}
+
+const param_desc_t params[] =
+{
+    /* Id, type, flags, min, max, value, get, set */
+    { PARAM_ID_HPID_P,              PARAM_TYPE_U16, PARAM_FLAG_STORED,    0,                      EEPROM_BLANK_U16 - 1,      &hpid_p,                        param_get_pid_coeff, param_set_pid_coeff },
+    { PARAM_ID_HPID_I,              PARAM_TYPE_U16, PARAM_FLAG_STORED,    0,                      EEPROM_BLANK_U16 - 1,      &hpid_i,                        param_get_pid_coeff, param_set_pid_coeff },
+    { PARAM_ID_HPID_D,              PARAM_TYPE_U16, PARAM_FLAG_STORED,    0,                      EEPROM_BLANK_U16 - 1,      &hpid_d,                        param_get_pid_coeff, param_set_pid_coeff },
+    { PARAM_ID_HPID_TARGET,         PARAM_TYPE_I16, PARAM_FLAG_STORED,    HEATER_TEMP_MIN_SCALED, HEATER_TEMP_MAX_SCALED,    &hpid_target,                   NULL, param_set_hpid_target },
+    { PARAM_ID_HTUNE_TARGET,        PARAM_TYPE_I16, PARAM_FLAG_STORED,    HEATER_TEMP_MIN_SCALED, HEATER_TEMP_MAX_SCALED,    &htune_target,                  NULL, param_set_htune_target },
+    { PARAM_ID_HEAT_POWER_LIMIT_PC, PARAM_TYPE_U8,  PARAM_FLAG_STORED,    0,                      100,                       NULL,                           param_get_heat_power_limit_pc, param_set_heat_power_limit_pc },
+    { PARAM_ID_RUN_ON_START,        PARAM_TYPE_U8,  PARAM_FLAG_STORED,    0,                      1,                         NULL,                           param_get_run_on_start, param_set_run_on_start },
+    { PARAM_ID_HMODEL_FLAGS,        PARAM_TYPE_U8,  PARAM_FLAG_STORED,    0,                      HMODEL_FLAGS_ALL,          &hmodel.flags,                  NULL, param_set_hmodel },
+    { PARAM_ID_HMODEL_SP_WEIGHT_PC, PARAM_TYPE_U8,  PARAM_FLAG_STORED,    0,                      100,                       &hmodel.sp_weight_pc,           NULL, param_set_hmodel },
+    { PARAM_ID_STIR_ACCEL_RPS_S,    PARAM_TYPE_U8,  0,                    0,                      UINT8_MAX,                 &stir_accel_rps_s,              NULL, NULL },
+    { PARAM_ID_ADC_OVRSAM,          PARAM_TYPE_U8,  0,                    0,                      HEATER_ADC_OVRSAM_MAX,     &heater_adc_ovrsam,             NULL, param_set_adc_config },
+    { PARAM_ID_ADC_MODE,            PARAM_TYPE_U8,  0,                    0,                      HEATER_ADC_MODE_AVERAGE,   &heater_adc_mode,               NULL, param_set_adc_config },
+    { PARAM_ID_ADC_FILT_SHIFT,      PARAM_TYPE_U8,  0,                    0,                      HEATER_ADC_FILT_SHIFT_MAX, (void *)&heater_adc_filt_shift, NULL, param_set_adc_config },
+    { PARAM_ID_HPID_WARM_START,     PARAM_TYPE_U8,  0,                    0,                      1,                         &hpid_warm_enable,              NULL, NULL },
+    { PARAM_ID_PWM_HIRES,           PARAM_TYPE_U8,  0,                    0,                      1,                         &pwm_hires,                     NULL, param_set_pwm_hires },
+    { PARAM_ID_MODULE_ADDR,         PARAM_TYPE_U8,  PARAM_FLAG_STORED,    0,                      SPI_MODULE_ADDR_ANY,       &spi_module_addr,               NULL, param_set_module_addr },
+    { PARAM_ID_STIR_PERIOD_MS,      PARAM_TYPE_U8,  0,                    STIR_PERIOD_MS_MIN,     STIR_PERIOD_MS_MAX,        &stir_period_ms,                NULL, param_set_stir_period },
+    { PARAM_ID_SUPPLY_BUDGET_MA,    PARAM_TYPE_U16, PARAM_FLAG_STORED,    0,                      EEPROM_BLANK_U16 - 1,      &supply_budget_ma,              NULL, param_set_supply_budget_ma },
+    { PARAM_ID_HOBS_SHIFT,          PARAM_TYPE_U8,  0,                    0,                      HOBS_SHIFT_MAX,            &hobs_shift,                    NULL, param_set_hobs_shift },
+#if PROBE_TRACE_PINS > 0
+    { PARAM_ID_TRACE_MASK,          PARAM_TYPE_U16, 0,                    0,                      ( 1U << TRACE_COUNT ) - 1, (void *)&probe_trace_mask[0],   NULL, param_set_trace_mask },
+#endif
+    { PARAM_ID_TEMP_ACTUAL,         PARAM_TYPE_I16, PARAM_FLAG_READ_ONLY, INT16_MIN,              INT16_MAX,                 (void *)&heater_temp_c_scaled,  NULL, NULL },
+    { PARAM_ID_STIR_SPEED_RPS,      PARAM_TYPE_U16, PARAM_FLAG_READ_ONLY, 0,                      UINT16_MAX,                (void *)&stir_speed_rps_avg,    NULL, NULL },
+    { PARAM_ID_HEATER_OUTPUT_CAP,   PARAM_TYPE_U16, PARAM_FLAG_READ_ONLY, 0,                      UINT16_MAX,                &heater_output_cap,             NULL, NULL },
+    { PARAM_ID_HOBS_TEMP,           PARAM_TYPE_I16, PARAM_FLAG_READ_ONLY, INT16_MIN,              INT16_MAX,                 NULL,                           param_get_hobs_temp, NULL },
+};
+
+err parse_packet_param_list( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
 {
+    /* Data: [Start U8] optional, index into the table */
+    /* Return: [err U8][Total U8][Count U8] + Count x [Id U8][Type U8][Flags U8][Min 16][Max 16], little endian */
+    
     err rc = ERR_OK;
-    uint8_t run;
-    int16_t temp_target;
+    uint8_t return_buf[ sizeof(err) + PARAM_LIST_SIZE ];
+    uint8_t size;
     
-    if ( packet_data_size < 1 )
+    if ( packet_data_size > 1 )
         rc = ERR_PACKET_INVALID;
+    else
     {
-        run = packet_data[0];
-
-        if ( run )
-        {
-            if ( packet_data_size == ( 1 + sizeof(temp_target) ) )
-                temp_target = (int16_t)PTR_TO_16BIT( &packet_data[1] );
-            else
-                temp_target = hpid_target;
-            
-            switch ( hpid_state )
-            {
-                case HPID_STATE_UNCONFIGURED:
-                    rc = ERR_HEAT_PID_NOT_READY;
-                    break;
-                case HPID_STATE_ERROR:
-                    if ( !status_check() )
-                    {
-                        rc = ERR_HEAT_PID_NOT_READY;
-                        break;
-                    }
-                    else
-                        hpid_state = HPID_STATE_READY;
-                case HPID_STATE_READY:
-                case HPID_STATE_SUSPENDED:
-                {
-                    rc = temp_valid( temp_target );
-                    if ( rc == ERR_OK )
-                    {
-                        hpid_target = temp_target;
-                        store_save_hpid_temp( hpid_target );
-                        heater_pid_start();
-                    }
-                    break;
-                }
-                case HPID_STATE_RUNNING:
-                    rc = temp_valid( temp_target );
-                    if ( rc == ERR_OK )
-                    {
-                        hpid_target = temp_target;
-                        store_save_hpid_temp( hpid_target );
-                    }
-                    break;
-                default:
-                    rc = ERR_ERROR;
-            }
-        } else if ( hpid_state == HPID_STATE_RUNNING )
-            hpid_state = HPID_STATE_READY;
+        size = param_list( ( packet_data_size == 1 ) ? packet_data[0] : 0, &return_buf[1] );
+        
+        return_buf[0] = ERR_OK;
+        spi_packet_write( packet_type, return_buf, sizeof(err) + size );
     }
     
-    if ( rc == ERR_OK )
-        spi_packet_write( packet_type, &rc, 1 );
-    
     return rc;
 }
 
-err parse_packet_pid_get_status( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+err parse_packet_param_get_many( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
 {
+    /* Data: n x [Id U8] */
+    /* Return: [err U8] + n x [Id U8][Value 16], little endian */
+    
     err rc = ERR_OK;
-    uint8_t return_buf[ sizeof(err) + 2*sizeof(uint8_t) ];
+    uint8_t return_buf[ sizeof(err) + ( PARAM_MANY_MAX * PARAM_VALUE_RECORD_SIZE ) ];
     
-    return_buf[0] = ERR_OK;
-    return_buf[1] = hpid_state;
-    return_buf[2] = hpid_error;
+    rc = param_get_many( packet_data, packet_data_size, &return_buf[1] );
     
-    spi_packet_write( packet_type, return_buf, sizeof(return_buf) );
+    if ( rc == ERR_OK )
+    {
+        return_buf[0] = ERR_OK;
+        spi_packet_write( packet_type, return_buf, sizeof(err) + ( packet_data_size * PARAM_VALUE_RECORD_SIZE ) );
+    }
     
     return rc;
 }
 
-err parse_packet_autotune_set_running( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+err parse_packet_param_set_many( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
 {
+    /* Data: n x [Id U8][Value 16], little endian */
+    /* Return: [err U8] */
+    
     err rc = ERR_OK;
-    uint8_t run;
-    int16_t temp_target;
     
-    if ( packet_data_size < 1 )
-        rc = ERR_PACKET_INVALID;
-    {
-        run = packet_data[0];
-
-        if ( run )
-        {
-            if ( packet_data_size == ( 1 + sizeof(temp_target) ) )
-                temp_target = (int16_t)PTR_TO_16BIT( &packet_data[1] );
-            else
-                temp_target = htune_target;
-            
-            store_save_htune_temp( temp_target );
-            autotune_start( temp_target );
-        } else if ( htune_active )
-        {
-            autotune_stop( HTUNE_STATE_ABORTED );
-            printf( "Autotune User Abort\n" );
-        }
-    }
+    rc = param_set_many( packet_data, packet_data_size );
     
     if ( rc == ERR_OK )
         spi_packet_write( packet_type, &rc, 1 );
@@ -980,171 +3794,299 @@ err parse_packet_autotune_set_running( uint8_t packet_type, uint8_t *packet_data
     return rc;
 }
 
-err parse_packet_autotune_get_running( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+err parse_packet_get_fault_log( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
 {
-    err rc = ERR_OK;
-    uint8_t return_buf[ sizeof(err) + sizeof(uint8_t) ];
+    /* Data: [Index U16] optional, 0 for the newest record */
+    /* Return: [err U8][Total U16][Pending U8][Count U8] + Count x [Record 16], little endian, newest first */
     
-    return_buf[0] = ERR_OK;
-    return_buf[1] = htune_active ? 1 : 0;
+    err rc = ERR_OK;
+    uint8_t return_buf[ sizeof(err) + FAULT_LIST_SIZE ];
+    uint8_t size;
     
-    spi_packet_write( packet_type, return_buf, sizeof(return_buf) );
+    if ( ( packet_data_size != 0 ) && ( packet_data_size != 2 ) )
+        rc = ERR_PACKET_INVALID;
+    else
+    {
+        size = fault_list( ( packet_data_size == 2 ) ? PTR_TO_16BIT( packet_data ) : 0, &return_buf[1] );
+        
+        return_buf[0] = ERR_OK;
+        spi_packet_write( packet_type, return_buf, sizeof(err) + size );
+    }
     
     return rc;
 }
 
-err parse_packet_autotune_get_status( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+err parse_packet_get_boot_status( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
 {
-    err rc = ERR_OK;
-    uint8_t return_buf[ sizeof(err) + 2*sizeof(uint8_t) ];
+    /* Return: [err U8][Booting U8][Temp present U8][Boot ms U16 big endian] */
+    
+    uint8_t return_buf[ sizeof(err) + 2 + sizeof(boot_ms) ];
     
     return_buf[0] = ERR_OK;
-    return_buf[1] = htune_state;
-    return_buf[2] = htune_fail;
+    return_buf[1] = ( boot_ms == 0 );
+    return_buf[2] = heater_temp_ready && heater_temp_present;
+    COPY_16BIT_TO_PTR_REV( &return_buf[3], boot_ms );
     
     spi_packet_write( packet_type, return_buf, sizeof(return_buf) );
     
-    return rc;
+    return ERR_OK;
 }
 
-err parse_packet_stir_set_running( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+#ifdef BENCH_ENABLED
+/* Benchmark kernels on canned inputs, see bench_port.h. The results go to bench_sink so the
+ * compiler keeps the work. The PID kernel steps its own state on the heater gains. */
+volatile int32_t bench_sink;
+pid_state_t bench_pid_state;
+
+void bench_heater_pid( void )
 {
-    err rc = ERR_OK;
-    uint8_t run;
-    uint16_t stir_speed_rps;
-    
-    if ( packet_data_size < 1 )
-        rc = ERR_PACKET_INVALID;
-    {
-        run = packet_data[0];
+    bench_sink = hpid_step( &hpid_config, &bench_pid_state, 1000, 1000, 2000, 0 );
+}
 
-        if ( run )
-        {
-            if ( packet_data_size == ( 1 + sizeof(stir_speed_rps) ) )
-                stir_speed_rps = (uint16_t)PTR_TO_16BIT( &packet_data[1] );
-            else
-                stir_speed_rps = stir_target;
-            
-            switch ( stir_state )
-            {
-                case STIR_STATE_UNCONFIGURED:
-                case STIR_STATE_ERROR:
-                    rc = ERR_STIR_PID_NOT_READY;
-                    break;
-                case STIR_STATE_READY:
-                {
-                    stir_target = stir_speed_rps;
-                    stir_pid_start();
-                    break;
-                }
-                case STIR_STATE_RUNNING:
-                    stir_target = stir_speed_rps;
-                    break;
-                default:
-                    rc = ERR_ERROR;
-            }
-        } else if ( stir_state == STIR_STATE_RUNNING )
-            stir_pid_stop();
-    }
-    
-    if ( rc == ERR_OK )
-        spi_packet_write( packet_type, &rc, 1 );
-    
-    return rc;
+void bench_heater_temp( void )
+{
+    /* Half way along the table, part way into a segment */
+    bench_sink = get_heater_temp( ( (uint32_t)HEATER_THERM_TABLE_ADC_MIN << HEATER_ADC_SHIFT ) +
+                                  ( (uint32_t)( HEATER_THERM_TABLE_LEN / 2 ) << HEATER_THERM_FRAC_BITS ) + 12345 );
 }
 
-err parse_packet_stir_get_status( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+const bench_kernel_t bench_kernels[BENCH_COUNT] =
 {
-    err rc = ERR_OK;
-    uint8_t return_buf[ sizeof(err) + 1*sizeof(uint8_t) ];
+    [BENCH_NULL]           = bench_null,
+    [BENCH_FRAME_CHECKSUM] = bench_frame_checksum,
+    [BENCH_FRAME_CRC]      = bench_frame_crc,
+    [BENCH_HEATER_PID]     = bench_heater_pid,
+    [BENCH_HEATER_TEMP]    = bench_heater_temp,
+};
+
+err parse_packet_benchmark( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+{
+    /* Data: [Kernel U8][Runs U16] */
+    /* Return: [err U8][Kernels U8][Kernel U8][Runs U16][Timer Hz U32][CPU Hz U32][Total ticks U32]
+     * [Min ticks U16][Max ticks U16], see rio_bench.h. The main loop waits for all the runs. */
+    
+    uint8_t return_buf[ sizeof(err) + BENCH_REPORT_SIZE ];
+    uint16_t runs = packet_data[1] | ( (uint16_t)packet_data[2] << 8 );
     
+    if ( ( packet_data[0] >= BENCH_COUNT ) || ( runs == 0 ) || ( runs > BENCH_RUNS_MAX ) )
+        return ERR_PACKET_INVALID;
+    
+    pid_reset( &bench_pid_state, 0 );
     return_buf[0] = ERR_OK;
-    return_buf[1] = stir_state;
-//    return_buf[2] = htune_fail;
+    bench_run( packet_data[0], runs, &return_buf[1] );
     
     spi_packet_write( packet_type, return_buf, sizeof(return_buf) );
     
-    return rc;
+    return ERR_OK;
 }
+#endif
 
-err parse_packet_stir_speed_get_actual( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+err parse_packet_get_latency_stats( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
 {
-    err rc = ERR_OK;
-    uint8_t return_buf[ sizeof(err) + sizeof(stir_speed_rps_avg) ];
+    /* Data: [Loop U8][Reset U8], loop 0 heater and 1 stirrer, reset optional */
+    /* Return: [err U8][Loops U8][Loop U8][Period us U32], then the latency and the period, each
+     * [Count U32][Min us U32][Max us U32][Mean us U32] + LATENCY_BINS x [Count U16], see rio_latency.h */
+    
+    uint8_t return_buf[ sizeof(err) + LATENCY_REPORT_SIZE ];
+    
+    if ( packet_data[0] >= LATENCY_COUNT )
+        return ERR_PACKET_INVALID;
     
     return_buf[0] = ERR_OK;
-    COPY_16BIT_TO_PTR_REV( &return_buf[1], stir_speed_rps_avg );
+    latency_report( &return_buf[1], packet_data[0], ( packet_data_size == 2 ) && packet_data[1] );
     
     spi_packet_write( packet_type, return_buf, sizeof(return_buf) );
     
-    return rc;
+    return ERR_OK;
 }
 
-err parse_packet_heat_power_limit_pc_set( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+err parse_packet_batch( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size );
+err parse_packet_get_capabilities( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size );
+
+/* Indexed by packet type: [handler][data size min][data size max]. Handlers still check the layout within the bounds. */
+const spi_packet_entry_t packet_table[] =
+{
+    [PACKET_TYPE_GET_ID]                = { parse_packet_get_id,                  0, 0 },
+    [PACKET_TYPE_TEMP_SET_TARGET]       = { parse_packet_temp_set_target,         2, 2 },
+    [PACKET_TYPE_TEMP_GET_TARGET]       = { parse_packet_temp_get_target,         0, 0 },
+    [PACKET_TYPE_TEMP_GET_ACTUAL]       = { parse_packet_temp_get_actual,         0, 0 },
+    [PACKET_TYPE_PID_SET_COEFFS]        = { parse_packet_pid_set_coeffs,          6, 6 },
+    [PACKET_TYPE_PID_GET_COEFFS]        = { parse_packet_pid_get_coeffs,          0, 0 },
+    [PACKET_TYPE_PID_SET_RUNNING]       = { parse_packet_pid_set_running,         1, 3 },
+    [PACKET_TYPE_PID_GET_STATUS]        = { parse_packet_pid_get_status,          0, 0 },
+    [PACKET_TYPE_AUTOTUNE_SET_RUNNING]  = { parse_packet_autotune_set_running,    1, 4 },
+    [PACKET_TYPE_AUTOTUNE_GET_RUNNING]  = { parse_packet_autotune_get_running,    0, 0 },
+    [PACKET_TYPE_AUTOTUNE_GET_STATUS]   = { parse_packet_autotune_get_status,     0, 0 },
+    [PACKET_TYPE_STIR_SET_RUNNING]      = { parse_packet_stir_set_running,        1, 4 },
+    [PACKET_TYPE_STIR_GET_STATUS]       = { parse_packet_stir_get_status,         0, 0 },
+    [PACKET_TYPE_STIR_SPEED_GET_ACTUAL] = { parse_packet_stir_speed_get_actual,   0, 0 },
+    [PACKET_TYPE_HEAT_POWER_LIMIT_SET]  = { parse_packet_heat_power_limit_pc_set, 1, 1 },
+    [PACKET_TYPE_HEAT_POWER_LIMIT_GET]  = { parse_packet_heat_power_limit_pc_get, 0, 0 },
+    [PACKET_TYPE_GET_SPI_STATS]         = { parse_packet_get_spi_stats,           0, 1 },
+    [PACKET_TYPE_BATCH]                 = { parse_packet_batch,                   0, SPI_PACKET_SIZE_ANY },
+    [PACKET_TYPE_GET_PROBE_STATS]       = { parse_packet_get_probe_stats,         0, 1 },
+    [PACKET_TYPE_GET_TASK_STATS]        = { parse_packet_get_task_stats,          0, 1 },
+    [PACKET_TYPE_PID_MODEL]             = { parse_packet_pid_model,               0, 2 },
+    [PACKET_TYPE_PROFILE_SET_SEGMENT]   = { parse_packet_profile_set_segment,     7, 7 },
+    [PACKET_TYPE_PROFILE_SET_RUNNING]   = { parse_packet_profile_set_running,     0, 2 },
+    [PACKET_TYPE_GET_HISTORY]           = { parse_packet_get_history,             3, 3 },
+    [PACKET_TYPE_ADC_FILTER]            = { parse_packet_adc_filter,              0, 3 },
+    [PACKET_TYPE_GET_EEPROM_STATUS]     = { parse_packet_get_eeprom_status,       0, 1 },
+    [PACKET_TYPE_PARAM_LIST]            = { parse_packet_param_list,              0, 1 },
+    [PACKET_TYPE_PARAM_GET_MANY]        = { parse_packet_param_get_many,          0, SPI_PACKET_SIZE_ANY },
+    [PACKET_TYPE_PARAM_SET_MANY]        = { parse_packet_param_set_many,          0, SPI_PACKET_SIZE_ANY },
+    [PACKET_TYPE_GET_FAULT_LOG]         = { parse_packet_get_fault_log,           0, 2 },
+    [PACKET_TYPE_ECHO]                  = { parse_packet_echo,                    0, SPI_PACKET_SIZE_ANY },
+    [PACKET_TYPE_SYNC_TIME]             = { parse_packet_sync_time,               0, 5 },
+    [PACKET_TYPE_STAGE]                 = { parse_packet_stage,                   0, SPI_PACKET_SIZE_ANY },
+    [PACKET_TYPE_GET_CAPABILITIES]      = { parse_packet_get_capabilities,        0, 0 },
+    [PACKET_TYPE_GET_BOOT_STATUS]       = { parse_packet_get_boot_status,         0, 0 },
+    [PACKET_TYPE_GET_LATENCY_STATS]     = { parse_packet_get_latency_stats,       1, 2 },
+    [PACKET_TYPE_HISTORY_STREAM]        = { parse_packet_history_stream,          4, 5 },
+#ifdef BENCH_ENABLED
+    [PACKET_TYPE_BENCHMARK]             = { parse_packet_benchmark,               3, 3 },
+#endif
+#if HEATER_ZONES > 1
+    [PACKET_TYPE_HEATER_ZONE]           = { parse_packet_heater_zone,             1, 10 },
+#endif
+    [PACKET_TYPE_SUBSCRIBE]             = { parse_packet_subscribe,               0, SPI_PACKET_SIZE_ANY },
+    [PACKET_TYPE_FLASH]                 = { parse_packet_flash,                   1, SPI_PACKET_SIZE_ANY },
+};
+
+err parse_packet( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+{
+    /* Runs one command, which writes its own reply. Returns non-zero if the caller must reply [err U8] instead */
+    
+    return spi_packet_dispatch( packet_table, sizeof(packet_table) / sizeof(packet_table[0]), packet_type, packet_data, packet_data_size );
+}
+
+err parse_packet_batch( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
 {
+    /* Data: {[0][1][Module Address U8]} n*[ [Packet Type U8][Size U8][Data...] ] */
+    /* Return: [err U8] {[0][1][Module Address U8]} n*[ [Packet Type U8][Size U8][Reply...] ] */
+    /* An addressed batch runs only on the module of that address, see spi_module_addressed(),
+     * others reply [ERR_MODULE_ADDRESS]. Its reply starts with this module's address. */
+    
     err rc = ERR_OK;
-    uint8_t heat_power_limit_pc;
+    err sub_rc;
+    uint8_t addressed = 0;
+    uint8_t *data_ptr = packet_data;
+    int16_t data_size = packet_data_size;
     
-    if ( packet_data_size != sizeof(heat_power_limit_pc) )
-        rc = ERR_PACKET_INVALID;
-    else
-    {
-        heat_power_limit_pc = packet_data[0];
-        
-        /* Can't change this while autotuning */
-        if ( htune_active )
-            rc = ERR_HEAT_AUTOTUNE_ACTIVE;
-        else if ( heat_power_limit_pc > 100 )
-            rc = ERR_HEAT_MAX_POWER_INVALID;
+    if ( ( data_size >= 3 ) && ( data_ptr[0] == 0 ) && ( data_ptr[1] == 1 ) )
+    {
+        if ( !spi_module_addressed( data_ptr[2] ) )
+            return ERR_MODULE_ADDRESS;
+        addressed = 1;
+        packet_data += 3;
+        packet_data_size -= 3;
+        data_ptr = packet_data;
+        data_size = packet_data_size;
+    }
+    
+    /* Check the whole batch before running any of it. No nesting. */
+    while ( ( rc == ERR_OK ) && ( data_size > 0 ) )
+    {
+        if ( ( data_size < 2 ) || ( ( 2 + data_ptr[1] ) > data_size ) || ( data_ptr[0] == 0 ) || ( data_ptr[0] == PACKET_TYPE_BATCH ) )
+            rc = ERR_PACKET_INVALID;
         else
         {
-            HPID_INTERRUPT_OFF();
-            set_heat_power_limit_pc( heat_power_limit_pc );
-            store_save_heat_power_limit_pc( heat_power_limit_pc );
-            HPID_INTERRUPT_ON();
+            data_size -= 2 + data_ptr[1];
+            data_ptr += 2 + data_ptr[1];
         }
     }
     
     if ( rc == ERR_OK )
-        spi_packet_write( packet_type, &rc, 1 );
+    {
+        spi_batch_begin();
+        if ( addressed )
+            spi_packet_write( 0, &spi_module_addr, 1 );
+        
+        data_ptr = packet_data;
+        data_size = packet_data_size;
+        while ( data_size > 0 )
+        {
+            sub_rc = parse_packet( data_ptr[0], &data_ptr[2], data_ptr[1] );
+            if ( sub_rc != ERR_OK )
+                spi_packet_write( data_ptr[0], &sub_rc, 1 );
+            
+            data_size -= 2 + data_ptr[1];
+            data_ptr += 2 + data_ptr[1];
+        }
+        
+        rc = spi_batch_end( packet_type );
+    }
     
     return rc;
 }
 
-err parse_packet_heat_power_limit_pc_get( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+err parse_packet_get_capabilities( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
 {
-    err rc = ERR_OK;
-    uint8_t heat_power_limit_pc;
-    uint8_t return_buf[ sizeof(err) + 1*sizeof(uint8_t) ];
+    /* Return: [err U8][spi_caps_report(), loop period HEATER_PERIOD_MS][packet types, from packet_table], little endian */
     
-    heat_power_limit_pc = ( (uint32_t)heater_output_max * 100 + ( HEATER_POWER_MAX >> 1 ) ) / HEATER_POWER_MAX;
+    uint8_t return_buf[ sizeof(err) + SPI_CAPS_REPORT_SIZE ];
     
     return_buf[0] = ERR_OK;
-    return_buf[1] = heat_power_limit_pc;
+    spi_caps_report( &return_buf[1], FIRMWARE_VERSION, (uint32_t)HEATER_PERIOD_MS * 1000 );
+    spi_caps_types( &return_buf[1 + SPI_CAPS_REPORT_SIZE - ( SPI_CAPS_TYPES / 8 )], packet_table, sizeof(packet_table) / sizeof(packet_table[0]) );
     
     spi_packet_write( packet_type, return_buf, sizeof(return_buf) );
     
-    return rc;
+    return ERR_OK;
 }
 
 void init( void )
 {
     timer1_counter = 0;
-    
-    /* Comms */
-    slave_select = 1;
+    PR1 = HEATER_TMR1_PERIOD;       // MCC sets 100 ms, HEATER_PERIOD_MS of board_config.h
+    time_init();
     
     /* Heater PID init */
     HPID_INTERRUPT_OFF();
-    SET_HEATER_OUTPUT( 0 );
+    pwm_hires = PWM_HIRES_DEFAULT;
+    heater_output = 0;
+#if HEATER_ZONES > 1
+    hzone_init();
+#endif
+    pwm_config();
     hpid_state = HPID_STATE_UNCONFIGURED;
     hpid_error = HPID_ERROR_NONE;
     hpid_p = 0;
     hpid_i = 0;
     hpid_d = 0;
     hpid_counter = 0;
+    supply_budget_ma = 0;
     set_heat_power_limit_pc( 100 );
     hpid_target = 3500;
+    hpid_ff = 0;
+    hpid_sp_offset = 0;
+    memset( &hpid_warm, EEPROM_BLANK_U8, sizeof(hpid_warm) );
+    memset( hpid_map, EEPROM_BLANK_U8, sizeof(hpid_map) );
+    hpid_warm_enable = 1;
+    hpid_warm_count = 0;
+    hpid_warm_count_target = hpid_target;
+    
+    /* Heater profile init */
+    hprof_state = HPROF_STATE_IDLE;
+    hprof_active = false;
+    hprof_loaded = 0;
+    hprof_hold_counts = 0;
+    
+    /* History init */
+    history_head = 0;
+    history_count = 0;
+    history_seq = 0;
+    memset( hpid_terms, 0, sizeof(hpid_terms) );
+    
+    /* Heater model init, replaced from storage */
+    hmodel_valid = false;
+    hmodel.flags = 0;
+    hmodel.sp_weight_pc = HMODEL_SP_WEIGHT_PC_DEFAULT;
+    hboost_active = false;
+    hobs_shift = 0;
+    hobs_valid = false;
+    hobs_c_scaled = 0;
+    heater_guard_reset();
     
     /* Heater autotune init */
     htune_state = HTUNE_STATE_DEFAULT;
@@ -1155,16 +4097,36 @@ void init( void )
     /* Stirrer init */
     stir_state = STIR_STATE_UNCONFIGURED;
     stir_target = STIR_SPEED_RPS_DEFAULT;
+    stir_accel_rps_s = STIR_ACCEL_RPS_S_DEFAULT;
+    stir_phase = STIR_PHASE_SPINUP;
+    stir_setpoint_scaled = 0;
+    stir_stalls = 0;
     stir_state = STIR_STATE_READY;
+    stir_period_ms = STIR_PERIOD_MS_DEFAULT;
+    stir_timer_config();
     
     /* Start ADC */
+    heater_therm_table_init();
     heater_temp_present = false;
+    heater_temp_ready = false;
+    boot_ms = 0;
     heater_adc_avg = 0;
+    heater_adc_ovrsam = HEATER_ADC_OVRSAM_DEFAULT;
+    heater_adc_mode = HEATER_ADC_MODE_DEFAULT;
+    heater_adc_filt_shift = HEATER_ADC_FILT_SHIFT_DEFAULT;
+    heater_adc_norm_shift = HEATER_ADC_BITS - heater_adc_result_bits( heater_adc_ovrsam, heater_adc_mode );
+    heater_adc_config_pending = false;
+    heater_noise_diff_sq = 0;
+    heater_noise_valid = false;
     heater_temp_c_scaled = 0;
+    
+    /* TEMP_GET_ACTUAL answers this until the first sample, a few ms */
+    *spi_reply_cache_slot( &temp_actual_reply ) = ERR_BOOTING;
+    spi_reply_cache_publish( &temp_actual_reply, sizeof(err) );
+    
     HPID_INTERRUPT_ON();    // ADC Filter ISR enable
     ADFL0CONbits.IE = 1;    // ADC Filter Interrupt enable
     ADFL0CONbits.FLEN = 1;  // ADC Filter enable
-    wait_initial_temp();
 }
 
 void storage_save_defaults()
@@ -1181,6 +4143,63 @@ void set_heat_power_limit_pc( uint8_t heat_power_limit_pc )
 {
     heater_output_max = (uint32_t)HEATER_POWER_MAX * heat_power_limit_pc / 100;
     hpid_windup_limit = heater_output_max;
+    hpid_ff_stale = true;
+    heater_budget_update();
+}
+
+uint16_t heater_zone_cap( uint8_t zone )
+{
+    /* Output cap of heater <zone>, 0 the main heater and n hzone[n-1]: heater_output_max, less
+     * what the stirrer and the other zones draw of supply_budget_ma on their present duty.
+     * Draws are rounded up, so the zones' caps never add up past the budget. */
+    int32_t left_ma;
+#if HEATER_ZONES > 1
+    uint8_t index;
+#endif
+    
+    if ( supply_budget_ma == 0 )
+        return heater_output_max;
+    
+    left_ma = supply_budget_ma;
+    if ( stir_state == STIR_STATE_RUNNING )
+        left_ma -= ( (int32_t)STIR_CURRENT_MA * stir_output ) / STIR_POWER_MAX;
+    if ( zone != 0 )
+        left_ma -= ( (int32_t)HEATER_CURRENT_MA * heater_output + HEATER_POWER_MAX - 1 ) / HEATER_POWER_MAX;
+#if HEATER_ZONES > 1
+    for ( index=0; index<HZONE_COUNT; index++ )
+    {
+        if ( index + 1 != zone )
+            left_ma -= ( (int32_t)HEATER_CURRENT_MA * hzone[index].output + HEATER_POWER_MAX - 1 ) / HEATER_POWER_MAX;
+    }
+#endif
+    if ( left_ma <= 0 )
+        return 0;
+    return MIN( heater_output_max, ( (uint32_t)left_ma * HEATER_POWER_MAX ) / HEATER_CURRENT_MA );
+}
+
+void heater_budget_update( void )
+{
+    /* Shares supply_budget_ma between the loads on their present duty: the stirrer takes what
+     * stir_output needs, it is the smaller load and stalls without it, and the heaters get
+     * the rest, up to heater_output_max.  Run after every stirrer output and heater zone
+     * period, so an idle or slow stirrer leaves the heaters the whole supply, and an output
+     * over its new cap is cut at once rather than at the next heater period.  The extra zones
+     * give way first, then zone 0 is capped at what they leave. */
+#if HEATER_ZONES > 1
+    uint8_t index;
+    uint16_t cap;
+    
+    for ( index=0; index<HZONE_COUNT; index++ )
+    {
+        cap = heater_zone_cap( index + 1 );
+        if ( hzone[index].output > cap )
+            hzone_set_output( index, cap );
+    }
+#endif
+    
+    heater_output_cap = heater_zone_cap( 0 );
+    if ( heater_output > heater_output_cap )
+        SET_HEATER_OUTPUT( heater_output_cap );
 }
 
 bool pid_valid( int32_t pid_p, int32_t pid_i, int32_t pid_d )
@@ -1223,6 +4242,7 @@ bool status_check( void )
 
 void storage_startup()
 {
+    E_STORE_SOURCE store_source;
     uint8_t eeprom_ver;
     uint16_t pid_p;
     uint16_t pid_i;
@@ -1239,6 +4259,9 @@ void storage_startup()
     }
     
     printf( "Reading EEPROM...\n" );
+    store_source = store_init();
+    printf( "EEPROM store %s\n", ( store_source == STORE_SOURCE_SLOT ) ? "valid" :
+                                  ( store_source == STORE_SOURCE_LEGACY ) ? "older layout" : "blank or corrupt" );
     store_load_eeprom_ver( &eeprom_ver );
     printf( "EEPROM Version %hu\n", eeprom_ver );
     
@@ -1247,6 +4270,7 @@ void storage_startup()
         /* Blank EEPROM */
         printf( "Saving Defaults\n" );
         storage_save_defaults();
+        store_flush_wait();
     }
     
     pid_p = EEPROM_BLANK_U16;
@@ -1271,6 +4295,26 @@ void storage_startup()
         HPID_INTERRUPT_ON();
     }
     
+    store_load_heater_model( &hmodel );
+    if ( hmodel.flags == EEPROM_BLANK_U8 )
+        hmodel.flags = 0;
+    if ( hmodel.sp_weight_pc > 100 )
+        hmodel.sp_weight_pc = HMODEL_SP_WEIGHT_PC_DEFAULT;
+    hmodel_valid = ( hmodel.ref_output != EEPROM_BLANK_U16 ) &&
+                   ( ( (int32_t)hmodel.ref_c_scaled - hmodel.ambient_c_scaled ) >= HMODEL_SPAN_MIN );
+    printf( "model valid=%hu flags=%hu sp weight=%hu%%\n", hmodel_valid, hmodel.flags, hmodel.sp_weight_pc );
+    
+    store_load_hpid_warm( &hpid_warm );
+    if ( hpid_warm.output != EEPROM_BLANK_U16 )
+        heater_pid_map_record( &hpid_warm );
+    printf( "warm start temp=%i output=%u\n", hpid_warm.target_c_scaled, hpid_warm.output );
+    
+    /* Blank is no budget, the heater limited by its power limit alone */
+    store_load_supply_budget_ma( &supply_budget_ma );
+    if ( supply_budget_ma == EEPROM_BLANK_U16 )
+        supply_budget_ma = 0;
+    printf( "supply budget=%u mA\n", supply_budget_ma );
+    
     store_load_heat_power_limit_pc( &heat_power_limit_pc );
     heat_power_limit_pc = constrain_i32( heat_power_limit_pc, 0, 100 );
     store_load_hpid_temp( &hpid_temp_c_scaled );
@@ -1303,6 +4347,7 @@ void storage_startup()
         {
             printf( "PID Running\n" );
             HPID_INTERRUPT_OFF();
+            heater_pid_warm_start();
             hpid_state = HPID_STATE_RUNNING;
             HPID_INTERRUPT_ON();
         }
@@ -1316,6 +4361,10 @@ void storage_startup()
         HPID_INTERRUPT_ON();
     }
     
+    /* Blank is SPI_MODULE_ADDR_ANY, a module answering every address */
+    store_load_module_addr( &spi_module_addr );
+    printf( "module address=%hu\n", spi_module_addr );
+    
     printf( "\n" );
     
 //    while (1);
@@ -1327,10 +4376,28 @@ void stir_pid_start( void )
     {
         stir_output = 0;
         stir_output_scaled = 0;
+        stir_output_dither = 0;
         stir_output_integrator = 0;
         stir_speed_rps_avg_scaled = 0;
+        stir_speed_rps = 0;
         stir_stopped = 0;
+        stir_phase = STIR_PHASE_SPINUP;
+        stir_phase_ms = 0;
+        stir_setpoint_scaled = 0;
+        stir_ramp_rem = 0;
+        stir_retries = 0;
+        stir_stalls = 0;
+        
+        /* Drop stale captures. The first edge then only restarts timing, as after a stall. */
+        STIR_INTERRUPT_OFF();
+        while ( CCP3STATLbits.ICBNE )
+            (void)( (uint32_t)CCP3BUFL | ( (uint32_t)CCP3BUFH << 16 ) );
+        CCP3STATLbits.ICOV = 0;
+        stir_periods_clear();
+        stir_periods_new = 0;
+        stir_idle_ms = STIR_STALL_MS;
         stir_state = STIR_STATE_RUNNING;
+        STIR_INTERRUPT_ON();
         
         #ifdef STIR_DEBUG_EXTRA
         stir_count_speed_rps_avg_scaled = 0;
@@ -1351,20 +4418,105 @@ void stir_pid_stop( void )
     }
 }
 
+void stir_setpoint_ramp( void )
+{
+    /* Moves the setpoint towards stir_target by stir_accel_rps_s per second. The step of
+     * one run is carried to the next in 1/1000 parts, so a short period loses no rate. */
+    uint32_t target = (uint32_t)stir_target << STIR_SHIFT;
+    uint32_t step;
+    
+    step = ( ( (uint32_t)stir_accel_rps_s << STIR_SHIFT ) * stir_period_ms ) + stir_ramp_rem;
+    stir_ramp_rem = step % 1000;
+    step /= 1000;
+    
+    if ( ( stir_accel_rps_s == 0 ) || ( target == stir_setpoint_scaled ) )
+    {
+        stir_setpoint_scaled = target;
+        stir_ramp_rem = 0;
+    }
+    else if ( target > stir_setpoint_scaled )
+        stir_setpoint_scaled = MIN( stir_setpoint_scaled + step, target );
+    else
+        stir_setpoint_scaled = ( stir_setpoint_scaled > ( target + step ) ) ? ( stir_setpoint_scaled - step ) : target;
+}
+
+void stir_stall_retry( void )
+{
+    /* Output off and spin up again from rest, or give up after STIR_RETRY_MAX in a row */
+    if ( stir_stalls < UINT8_MAX )
+        stir_stalls++;
+    stir_retries++;
+    LOG_INFO( LOG_ID_STIR_STALL, stir_phase, stir_retries, STIR_RETRY_MAX );
+    
+    stir_output = 0;
+    stir_output_scaled = 0;
+    stir_output_dither = 0;
+    stir_output_integrator = 0;
+    stir_setpoint_scaled = 0;
+    stir_speed_rps_avg_scaled = 0;
+    stir_speed_rps_avg = 0;
+    SET_STIR_OUTPUT( stir_output );
+    
+    if ( stir_retries > STIR_RETRY_MAX )
+    {
+        stir_state = STIR_STATE_ERROR;
+        fault_log( FAULT_ID_STIR_ERROR, stir_retries );
+    }
+    else
+    {
+        stir_phase = STIR_PHASE_RECOUPLE;
+        stir_phase_ms = STIR_RECOUPLE_MS;
+    }
+}
+
+uint16_t stir_output_dithered( int32_t output_scaled )
+{
+    /* First order sigma-delta on the STIR_LOOP_I_SHIFT fraction bits: the whole step of the
+     * 8-bit PWM, one higher on the loops where the carried fraction overflows, so the mean
+     * follows <output_scaled>. A 10-bit period would bring the PWM down into the audible range. */
+    uint16_t output = output_scaled >> STIR_LOOP_I_SHIFT;
+    
+    if ( !pwm_hires )
+        return output;
+    
+    stir_output_dither += output_scaled & ( ( 1 << STIR_LOOP_I_SHIFT ) - 1 );
+    if ( stir_output_dither >> STIR_LOOP_I_SHIFT )
+    {
+        stir_output_dither &= ( 1 << STIR_LOOP_I_SHIFT ) - 1;
+        if ( output < STIR_POWER_MAX )
+            output++;
+    }
+    
+    return output;
+}
+
 void stir_pid()
 {
 #ifdef STIR_DEBUG_EXTRA
     uint8_t capture_has_data = CCP3STATLbits.ICBNE;
     uint8_t timer_flag = IFS2bits.CCT3IF;
-    uint16_t stir_count_speed_rps = ( (uint32_t)stir_count_speed_avg * HEATER_PERIOD_S_COUNTS ) >> STIR_SHIFT;
+    uint16_t stir_count_speed_rps = ( (uint32_t)stir_count_speed_avg * ( 1000 / stir_period_ms ) ) >> STIR_SHIFT;
 #endif
     
-    uint32_t stir_speed_time = (uint32_t)CCP3BUFL | ( (uint32_t)CCP3BUFH << 16 );
-    uint16_t stir_speed_rps;
+    uint32_t periods_sum = 0;
+    uint32_t stir_speed_rps_scaled;
+    uint16_t setpoint_rps;
+    uint8_t periods_count;
+    uint8_t periods_new;
+    uint8_t i;
     int16_t error;
     int16_t error_avg;
     int32_t stir_output_proportional;
     
+    STIR_INTERRUPT_OFF();
+    periods_count = stir_periods_count;
+    periods_new = stir_periods_new;
+    stir_periods_new = 0;
+    for ( i = 0; i < STIR_PERIODS_SIZE; i++ )
+        periods_sum += stir_periods[i];
+    stir_stopped = stir_idle_ms >= STIR_STALL_MS;
+    STIR_INTERRUPT_ON();
+    
 #ifdef STIR_DEBUG_EXTRA
     stir_count_speed = CCP4TMRL - stir_count_tmr_prev;
     stir_count_tmr_prev = CCP4TMRL;
@@ -1379,54 +4531,101 @@ void stir_pid()
     CCP3STATLbits.SCEVT = 0;
 #endif
     
-    stir_stopped = CCP3TMRH >= STIR_TMRH_STOP_THRESHOLD;
     if ( stir_stopped )
-    {
-        CCP3TMRH = STIR_TMRH_STOP_THRESHOLD;
-        stir_speed_time = 0;
-        stir_output_integrator += STIR_LOOP_I_SHIFT_BOOST;
-    }
-
-    if ( stir_speed_time == 0 )
     {
         stir_speed_rps = 0;
         stir_speed_rps_avg_scaled = 0;
+        stir_speed_rps_avg = 0;
+        stir_output_integrator += STIR_LOOP_I_SHIFT_BOOST * stir_period_ms;
 #ifdef STIR_DEBUG_EXTRA
         stir_count_speed_rps_avg = 0;
         stir_count_speed_rps_avg_scaled = 0;
 #endif
     }
-    else
+    else if ( ( periods_new > 0 ) && ( periods_sum > 0 ) )
     {
-        stir_speed_rps = STIR_SPEED_TICKS_PER_SEC / stir_speed_time;
-        stir_speed_rps_avg_scaled = ( ( (uint32_t)stir_speed_rps_avg_scaled * STIR_AVG_MUL ) + ( (uint32_t)stir_speed_rps << STIR_SHIFT ) ) >> STIR_AVG_SHIFT;
+        /* One reciprocal of the window mean period, kept with STIR_SHIFT fraction bits */
+        stir_speed_rps_scaled = ( ( STIR_SPEED_TICKS_PER_SEC << STIR_SHIFT ) * periods_count ) / periods_sum;
+        stir_speed_rps = ( stir_speed_rps_scaled + ( 1 << ( STIR_SHIFT - 1 ) ) ) >> STIR_SHIFT;
+        stir_speed_rps_avg_scaled = ( ( (uint32_t)stir_speed_rps_avg_scaled * STIR_AVG_MUL ) + stir_speed_rps_scaled ) >> STIR_AVG_SHIFT;
         stir_speed_rps_avg = ( stir_speed_rps_avg_scaled + ( 1 << ( STIR_SHIFT - 1 ) ) ) >> STIR_SHIFT;
 #ifdef STIR_DEBUG_EXTRA
         stir_count_speed_rps_avg_scaled = ( ( (uint32_t)stir_count_speed_rps_avg_scaled * STIR_AVG_MUL ) + ( (uint32_t)stir_count_speed_rps << STIR_SHIFT ) ) >> STIR_AVG_SHIFT;
         stir_count_speed_rps_avg = ( stir_count_speed_rps_avg_scaled + ( 1 << ( STIR_SHIFT - 1 ) ) ) >> STIR_SHIFT;
 #endif
     }
-
-    error = (int16_t)stir_target - (int16_t)stir_speed_rps;
-    error_avg = (int16_t)stir_target - (int16_t)stir_speed_rps_avg;
+    
+    /* Soft start. SPINUP only boosts the integrator, so the output is just enough to break
+     * away, and the setpoint then ramps from the speed reached. A stall while turning, or
+     * no breakaway within STIR_SPINUP_MS, turns the output off for the bar to recouple. */
+    switch ( stir_phase )
+    {
+        case STIR_PHASE_RECOUPLE:
+        {
+            if ( stir_phase_ms > 0 )
+                stir_phase_ms -= MIN( stir_phase_ms, stir_period_ms );
+            else
+            {
+                stir_output_integrator = 0;
+                stir_phase = STIR_PHASE_SPINUP;
+            }
+            SET_STIR_OUTPUT( 0 );
+            return;
+        }
+        case STIR_PHASE_SPINUP:
+        {
+            if ( !stir_stopped && ( periods_count > 0 ) )
+            {
+                stir_setpoint_scaled = MIN( (uint32_t)stir_speed_rps, stir_target ) << STIR_SHIFT;
+                stir_phase = STIR_PHASE_RAMP;
+            }
+            else if ( ( stir_phase_ms += stir_period_ms ) >= STIR_SPINUP_MS )
+            {
+                stir_stall_retry();
+                return;
+            }
+            break;
+        }
+        case STIR_PHASE_RAMP:
+        {
+            if ( stir_stopped )
+            {
+                stir_stall_retry();
+                return;
+            }
+            stir_setpoint_ramp();
+            break;
+        }
+        default:
+            break;
+    }
+    
+    setpoint_rps = ( stir_setpoint_scaled + ( 1 << ( STIR_SHIFT - 1 ) ) ) >> STIR_SHIFT;
+    error = (int16_t)setpoint_rps - (int16_t)stir_speed_rps;
+    error_avg = (int16_t)setpoint_rps - (int16_t)stir_speed_rps_avg;
     stir_at_target = abs( error_avg ) <= 1;
     
+    if ( stir_at_target && ( setpoint_rps == stir_target ) )
+        stir_retries = 0;
+    
     if ( stir_at_target )
     {
 //        stir_output_integrator += SIGN( error ) << STIR_LOOP_I_SHIFT;
-        stir_output_integrator += SIGN( error_avg );
+        stir_output_integrator += SIGN( error_avg ) * stir_period_ms;
         stir_output_proportional = 0;
     }
     else
     {
-        stir_output_integrator += error;
+        stir_output_integrator += (int32_t)error * stir_period_ms;
         stir_output_proportional = error << ( STIR_LOOP_I_SHIFT + STIR_LOOP_P_SHIFT );
     }
     
-    stir_output_integrator = constrain_i32( stir_output_integrator, 0, STIR_POWER_MAX_SCALED );
-    stir_output_scaled = stir_output_integrator + stir_output_proportional;
+    /* The integrator holds STIR_LOOP_I_PERIOD_MS times the output, so its gain per second
+     * is the same at any stir_period_ms */
+    stir_output_integrator = constrain_i32( stir_output_integrator, 0, (int32_t)STIR_POWER_MAX_SCALED * STIR_LOOP_I_PERIOD_MS );
+    stir_output_scaled = ( stir_output_integrator / STIR_LOOP_I_PERIOD_MS ) + stir_output_proportional;
     stir_output_scaled = constrain_i32( stir_output_scaled, 0, STIR_POWER_MAX_SCALED );
-    stir_output = stir_output_scaled >> STIR_LOOP_I_SHIFT;
+    stir_output = stir_output_dithered( stir_output_scaled );
     
     /* Some power is required in order to generate feedback */
 //    stir_output = constrain_i32( stir_output, 1, STIR_POWER_MAX );
@@ -1434,11 +4633,10 @@ void stir_pid()
     SET_STIR_OUTPUT( stir_output );
 
 #ifdef STIR_DEBUG
-    printf( "Output %-3u  error %-4i  Speed avg %-3u raw %-3u time %-7lu  timer3 high %-2u  stopped %1hu  at target %1u", stir_output, error, stir_speed_rps_avg, stir_speed_rps, stir_speed_time, CCP3TMRH, stir_stopped, stir_at_target );
+    LOG_DEBUG( LOG_ID_STIR, stir_output, error, stir_speed_rps_avg, stir_speed_rps, periods_sum, stir_idle_ms, stir_stopped, stir_at_target );
     #ifdef STIR_DEBUG_EXTRA
-    printf( "    [ Captured %hu  timer3 flag %hu  count speed avg %3u  rps %3u ]", capture_has_data, timer_flag, stir_count_speed_avg, stir_count_speed_rps );
+    LOG_DEBUG( LOG_ID_STIR_EXTRA, capture_has_data, timer_flag, stir_count_speed_avg, stir_count_speed_rps );
     #endif
-    printf( "\n" );
 #endif
 }
 
@@ -1463,26 +4661,43 @@ void startup_test( void )
     }
 }
 
-int main(void)
+void main_setup( void )
 {
-    err rc = 0;
-    err comms_rc;
-    uint16_t time;
-    int16_t temp_c_scaled;
+    /* Start-up, up to the main loop. main() then calls main_loop() forever, the host build
+     * in hardware-modules/host_test calls both to run the firmware in the loop. */
     
     SYSTEM_Initialize();
     
+    init();
+    
+    /* Init SPI first: requests wait in the read ring and are answered from the first main
+     * loop pass, TEMP_GET_ACTUAL with ERR_BOOTING until the first ADC filter sample */
+    spi_init();
+    spi_packet_init( &spi_packet, (uint16_t *)&timer1_counter, SPI_PACKET_TIMEOUT_COUNTS );
+    stir_speed_reply_publish();
+    
+    param_init( params, sizeof(params) / sizeof(params[0]) );
+    stage_init( parse_packet, PACKET_TYPE_BATCH, PACKET_TYPE_STAGE );
+    report_init( REPORT_SIGNALS );
+    flash_init( &timer1_counter, HEATER_PERIOD_S_COUNTS );
+    
     printf( "\n\nStarting...\n\n" );
     
     startup_test();
     
-    init();
-    
     storage_startup();
     
-    /* Init SPI */
-    spi_init();
-    spi_packet_init( &spi_packet, (uint16_t *)&timer1_counter, 3 );
+    /* Continue the EEPROM fault log, logging this reset with its cause */
+    fault_init( &timer1_counter, 1000 / HEATER_PERIOD_MS, eeprom_okay, RESET_GetCause() );
+    RESET_CauseClearAll();
+    
+#ifdef PROBE_ENABLED
+    probe_init();
+#endif
+#if PROBE_TRACE_PINS > 0
+    probe_trace_init();
+#endif
+    latency_init();
     
     TMR1_SetInterruptHandler( timer1_isr );
     
@@ -1499,208 +4714,171 @@ int main(void)
         heater_pid_start();
     }
     else
-        autotune_start( 4000 );
+        autotune_start( 4000, 0 );
+#endif
+}
+
+void main_loop( void )
+{
+    /* One pass of the main loop */
+    static uint16_t time;
+    err rc;
+    err comms_rc;
+#if ( RIO_LOG_LEVEL >= RIO_LOG_DEBUG )
+    int16_t temp_c_scaled;
 #endif
     
-    while (1)
+    PROBE_PASS();                   // CPU load, from the passes that fit in a second
+    PROBE_BEGIN( PROBE_LOOP );
+    
+    /* Control laws, released by the sampling interrupts */
+    task_run();
+    
+    if ( ( timer1_counter - time ) >= 5 )
     {
-        if ( ( timer1_counter - time ) >= 5 )
-        {
-            time = timer1_counter;
-            
-            HPID_INTERRUPT_OFF();
-            temp_c_scaled = heater_temp_c_scaled;
-            HPID_INTERRUPT_ON();
-            
-#if 1
-            if ( htune_active )
-            {
-                printf( "Temp %0.2f (%5u), Output %5u, heating %1d, bias %5u, delta %5u, cycles %2u, min %3d, max %3d, heattime %6d, cooltime %6d, ku %0.1f, tu %0.3f, PID %5li %5li %5li\n",
-                        (double)temp_c_scaled / HEATER_TEMP_SCALE, heater_temp_filt,
-                        heater_output,
-                        htune_heating,
-                        htune_bias,
-                        htune_delta,
-                        htune_cycles,
-                        htune_temp_min, htune_temp_max,
-                        htune_period_heating, htune_period_cooling,
-                        (double)htune_ku, (double)htune_tu,
-                        htune_p, htune_i, htune_d );
-                autotune_check_timeout();
-            }
-            else
-                printf( "State %u (%hu), Temp %0.2f / %0.2f (%5u), Output %5u, PID %5li %5li %5li, i_int %6li, hdiff %6li, pt %6li, it %6li, dt %6li\n",
-                        hpid_state,
-                        hpid_error,
-                        (double)temp_c_scaled / HEATER_TEMP_SCALE, (double)hpid_target / HEATER_TEMP_SCALE, heater_temp_filt,
-                        heater_output,
-                        hpid_p, hpid_i, hpid_d,
-                        hpid_integrated >> HTUNE_KI_SHL, hpid_diff >> HEATER_ADC_SHIFT,
-                        constrain_i32( ( hpid_error_prev * hpid_p ) >> HTUNE_KP_SHL, -(int32_t)UINT16_MAX, UINT16_MAX ),
-                        hpid_integrated >> HTUNE_KI_SHL,
-                        constrain_i32( hpid_diff, -(int32_t)UINT16_MAX, UINT16_MAX ) );
+        time = timer1_counter;
+        
+#if ( RIO_LOG_LEVEL >= RIO_LOG_DEBUG )
+        /* Only the debug status logs use it */
+        HPID_INTERRUPT_OFF();
+        temp_c_scaled = heater_temp_c_scaled;
+        HPID_INTERRUPT_ON();
 #endif
-        }
         
-        /* Set LED output */
-        if ( ( hpid_state == HPID_STATE_RUNNING ) || ( htune_state == HTUNE_STATE_RUNNING ) )
+        if ( htune_active )
         {
-            uint16_t led_output = heater_output >> 1;
-            if ( led_output > LED_OUTPUT_CLIP_MAX )
-                led_output = LED_OUTPUT_CLIP_MAX;
-            else if ( led_output < LED_OUTPUT_CLIP_MIN )
-                led_output = LED_OUTPUT_CLIP_MIN;
-            SET_LED_OUTPUT( led_output );
+            LOG_DEBUG( LOG_ID_HTUNE_STATUS,
+                       LOG_TEMP_ARGS( temp_c_scaled ), heater_temp_filt,
+                       heater_output,
+                       htune_heating,
+                       htune_bias,
+                       htune_delta,
+                       htune_cycles );
+            LOG_DEBUG( LOG_ID_HTUNE_CYCLE,
+                       htune_temp_min, htune_temp_max,
+                       htune_period_heating, htune_period_cooling,
+                       (int32_t)( htune_ku * 10 ), (int32_t)( htune_tu * 1000 ) );
+            LOG_DEBUG( LOG_ID_HTUNE_PID, htune_p, htune_i, htune_d );
+            autotune_check_timeout();
         }
         else
-            SET_LED_OUTPUT( LED_OUTPUT_MAX )
+        {
+            LOG_DEBUG( LOG_ID_HPID_STATUS,
+                       hpid_state,
+                       hpid_error,
+                       LOG_TEMP_ARGS( temp_c_scaled ), LOG_TEMP_ARGS( hpid_target ), heater_temp_filt,
+                       heater_output );
+            LOG_DEBUG( LOG_ID_HPID_TERMS,
+                       hpid_p, hpid_i, hpid_d,
+                       hpid_loop.integrated >> HTUNE_KI_SHL, hpid_loop.diff >> HEATER_ADC_SHIFT,
+                       hpid_loop.p_term,
+                       hpid_loop.integrated >> HTUNE_KI_SHL,
+                       hpid_loop.diff );
+        }
+    }
+    
+    /* Set LED output */
+    if ( ( hpid_state == HPID_STATE_RUNNING ) || ( htune_state == HTUNE_STATE_RUNNING ) )
+    {
+        uint16_t led_output = heater_output >> 1;
+        if ( led_output > LED_OUTPUT_CLIP_MAX )
+            led_output = LED_OUTPUT_CLIP_MAX;
+        else if ( led_output < LED_OUTPUT_CLIP_MIN )
+            led_output = LED_OUTPUT_CLIP_MIN;
+        SET_LED_OUTPUT( led_output );
+    }
+    else
+        SET_LED_OUTPUT( LED_OUTPUT_MAX )
+    
+    /* Boot done at the first temperature sample */
+    if ( ( boot_ms == 0 ) && heater_temp_ready )
+    {
+        boot_ms = ( time_local_us() / 1000 ) | 1;      // Never 0, that is booting
+        printf( "Temperature sensor present: %s, %u ms\n", heater_temp_present ? "YES" : "NO", boot_ms );
+    }
+    
+    /* System checks, once there is a sample to check */
+    if ( !heater_temp_ready )
+    {}
+    else if ( !heater_temp_present )
+    {
+        /* Check heater temp sensor present */
         
-        /* System checks */
-        if ( !heater_temp_present )
+        if ( htune_state == HTUNE_STATE_RUNNING )
         {
-            /* Check heater temp sensor present */
-            
-            if ( htune_state == HTUNE_STATE_RUNNING )
-            {
-                htune_active = false;
-                htune_state = HTUNE_STATE_FAILED;
-                htune_fail = HTUNE_FAIL_TEMP_NOT_PRESENT;
-            }
-            if ( hpid_state == HPID_STATE_RUNNING )
-            {
-                hpid_state = HPID_STATE_ERROR;
-                hpid_error = HPID_ERROR_TEMP_NOT_PRESENT;
-            }
+            htune_active = false;
+            htune_state = HTUNE_STATE_FAILED;
+            htune_fail = HTUNE_FAIL_TEMP_NOT_PRESENT;
+            fault_log( FAULT_ID_HTUNE_FAIL, htune_fail );
         }
-        else if ( htune_run_checks )
+        if ( hpid_state == HPID_STATE_RUNNING )
         {
-            /* Check autotune progress */
-            
-            htune_run_checks = false;
-            autotune_check_cycle();
+            hpid_state = HPID_STATE_ERROR;
+            hpid_error = HPID_ERROR_TEMP_NOT_PRESENT;
+            fault_log( FAULT_ID_HPID_ERROR, hpid_error );
         }
+    }
+    else if ( htune_run_checks )
+    {
+        /* Check autotune progress */
         
-        comms_rc = spi_packet_read( &spi_packet, &packet_type, (uint8_t *)&packet_data, &packet_data_size, SPI_PACKET_BUF_SIZE );
-        
-        if ( ( comms_rc == ERR_OK ) && ( packet_type != 0 ) )
-        {
-            rc = ERR_OK;
-            
+        htune_run_checks = false;
+        autotune_check_cycle();
+    }
+    
+    /* Staged packets whose time has come, ahead of any new packet */
+    stage_poll();
+    
+    /* Next chunk of a HISTORY_STREAM transfer, once the host has made room for it */
+    spi_stream_poll();
+    
+    PROBE_BEGIN( PROBE_PACKET );
+    comms_rc = spi_packet_peek( &spi_packet, &packet_type, &packet_data, &packet_data_size );
+    
+    if ( ( comms_rc == ERR_OK ) && ( packet_type != 0 ) )
+    {
 //            printf( "Packet received: Cmd %hu\n", packet_type );
+        
+        /* Sequenced replies are matched by the host and reports are drained in bulk, so
+         * leave earlier ones queued */
+        if ( !spi_packet_sequenced() && !report_active() )
             spi_clear_write();
-            
-            switch ( packet_type )
-            {
-                case 0:
-                {
-                    /* No or invalid packet */
-                    rc = ERR_PACKET_INVALID;
-                    break;
-                }
-                case PACKET_TYPE_GET_ID:
-                {
-                    rc = parse_packet_get_id( packet_type, packet_data, packet_data_size );
-                    break;
-                }
-                case PACKET_TYPE_TEMP_SET_TARGET:
-                {
-                    rc = parse_packet_temp_set_target( packet_type, packet_data, packet_data_size );
-                    break;
-                }
-                case PACKET_TYPE_TEMP_GET_TARGET:
-                {
-                    rc = parse_packet_temp_get_target( packet_type, packet_data, packet_data_size );
-                    break;
-                }
-                case PACKET_TYPE_TEMP_GET_ACTUAL:
-                {
-                    rc = parse_packet_temp_get_actual( packet_type, packet_data, packet_data_size );
-                    break;
-                }
-                case PACKET_TYPE_PID_SET_COEFFS:
-                {
-                    rc = parse_packet_pid_set_coeffs( packet_type, packet_data, packet_data_size );
-                    break;
-                }
-                case PACKET_TYPE_PID_GET_COEFFS:
-                {
-                    rc = parse_packet_pid_get_coeffs( packet_type, packet_data, packet_data_size );
-                    break;
-                }
-                case PACKET_TYPE_PID_SET_RUNNING:
-                {
-                    rc = parse_packet_pid_set_running( packet_type, packet_data, packet_data_size );
-                    break;
-                }
-                case PACKET_TYPE_PID_GET_STATUS:
-                {
-                    rc = parse_packet_pid_get_status( packet_type, packet_data, packet_data_size );
-                    break;
-                }
-                case PACKET_TYPE_AUTOTUNE_SET_RUNNING:
-                {
-                    rc = parse_packet_autotune_set_running( packet_type, packet_data, packet_data_size );
-                    break;
-                }
-                case PACKET_TYPE_AUTOTUNE_GET_RUNNING:
-                {
-                    rc = parse_packet_autotune_get_running( packet_type, packet_data, packet_data_size );
-                    break;
-                }
-                case PACKET_TYPE_AUTOTUNE_GET_STATUS:
-                {
-                    rc = parse_packet_autotune_get_status( packet_type, packet_data, packet_data_size );
-                    break;
-                }
-                case PACKET_TYPE_STIR_SET_RUNNING:
-                {
-                    rc = parse_packet_stir_set_running( packet_type, packet_data, packet_data_size );
-                    break;
-                }
-                case PACKET_TYPE_STIR_GET_STATUS:
-                {
-                    rc = parse_packet_stir_get_status( packet_type, packet_data, packet_data_size );
-                    break;
-                }
-                case PACKET_TYPE_STIR_SPEED_GET_ACTUAL:
-                {
-                    rc = parse_packet_stir_speed_get_actual( packet_type, packet_data, packet_data_size );
-                    break;
-                }
-                case PACKET_TYPE_HEAT_POWER_LIMIT_SET:
-                {
-                    rc = parse_packet_heat_power_limit_pc_set( packet_type, packet_data, packet_data_size );
-                    break;
-                }
-                case PACKET_TYPE_HEAT_POWER_LIMIT_GET:
-                {
-                    rc = parse_packet_heat_power_limit_pc_get( packet_type, packet_data, packet_data_size );
-                    break;
-                }
-                default:
-                    rc = ERR_PACKET_INVALID;
-            }
-            
-            if ( rc != ERR_OK )
-                spi_packet_write( packet_type, &rc, 1 );
-        }
-        else if ( ( spi_write_bytes_written() > 0 ) && spi_packet_timeout( &spi_packet ) )
-        {
-            spi_clear_write();
-            printf( "Cleared\n" );
-        }
-        else if ( SS1_GetValue() != slave_select )
-        {
-            /* If slave select dropped, clear SPI interface */
-            
-            slave_select = !slave_select;
-            
-            if ( slave_select == 1 )
-            {
-                spi_packet_clear( &spi_packet );
-                spi_clear_write();
-            }
-        }
         
+        TRACE_BEGIN( TRACE_PACKET );
+        rc = parse_packet( packet_type, packet_data, packet_data_size );
+        TRACE_END( TRACE_PACKET );
+        
+        if ( rc != ERR_OK )
+            spi_packet_write( packet_type, &rc, 1 );
+        
+        spi_packet_consume( &spi_packet );
+        PROBE_END( PROBE_PACKET );
+    }
+    else if ( !report_active() && ( spi_write_bytes_written() > 0 ) && spi_packet_timeout( &spi_packet ) )
+    {
+        spi_clear_write();
+        LOG_INFO( LOG_ID_SPI_CLEARED, 0 );
     }
+    
+    /* Changed settings and fault records to the EEPROM write queue, and one step of that, never waits for the EEPROM */
+    store_flush();
+    fault_task();
+    eeprom_queue_task();
+    
+    /* One page erase or a slice of the image CRC, while a firmware update runs */
+    flash_task();
+    
+    rio_log_drain();
+    
+    PROBE_END( PROBE_LOOP );
+}
+
+int main(void)
+{
+    main_setup();
+    
+    while (1)
+        main_loop();
+    
+    return 1;
 }
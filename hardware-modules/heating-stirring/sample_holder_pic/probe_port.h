@@ -0,0 +1,63 @@
+/*
+ * File:   probe_port.h
+ *
+ * dsPIC33CK (SCCP9) shim for the shared rio_probe module, see
+ * hardware-modules/common/rio_probe.
+ */
+
+#ifndef PROBE_PORT_H
+#define	PROBE_PORT_H
+
+#include <xc.h>
+#include "board_config.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/* Comment out to build the probes out, GET_PROBE_STATS then reports none */
+#define PROBE_ENABLED
+
+/* Probes */
+#define PROBE_LOOP                      0   // One main loop pass
+#define PROBE_HEATER_PID                1   // heater_pid() in the heater task
+#define PROBE_STIR_PID                  2   // stir_pid() in the stir task
+#define PROBE_PACKET                    3   // spi_packet_peek() to spi_packet_consume() of a packet
+#define PROBE_COUNT                     4
+
+/* SCCP9 as a free running 16-bit timer on Fcy / 4, 1 MHz, wraps after 65.5 ms */
+#define PROBE_PORT_TIMER_HZ             ( 4000000UL / 4 )
+#define PROBE_PORT_INIT()               { CCP9CON1L = 0x0040; CCP9CON1H = 0; CCP9CON2L = 0; CCP9CON2H = 0; CCP9TMRL = 0; CCP9PRL = 0xFFFF; CCP9CON1Lbits.CCPON = 1; }
+#define PROBE_PORT_NOW()                ( (uint16_t)CCP9TMRL )
+
+/* Trace regions, TRACE_BEGIN() to TRACE_END(), bits of probe_trace_mask[]. The host
+ * driver's TRACE_NAMES must list them in the same order. */
+#define TRACE_ISR_TIMER1                0   // timer1_isr(), the heater period tick
+#define TRACE_ISR_ADC                   1   // _ADFLTR0Interrupt, the zone 0 sample
+#define TRACE_ISR_STIR                  2   // _CCT7Interrupt, the stirrer period tick
+#define TRACE_ISR_SPI                   3   // SPI receive or DMA, and the slave select release
+#define TRACE_HEATER_PID                4   // heater_pid()
+#define TRACE_STIR_PID                  5   // stir_pid()
+#define TRACE_PACKET                    6   // parse_packet() of a host packet
+#define TRACE_COUNT                     7
+
+/* Trace pins: RB13, otherwise spare, the zone 1 output with HEATER_ZONES 2; 0 builds the
+ * markers out. Pin 0 starts on the ADC interrupt, the RB13 pulse of earlier firmware. */
+#if HEATER_ZONES > 1
+#define PROBE_TRACE_PINS                0
+#else
+#define PROBE_TRACE_PINS                1
+#define PROBE_TRACE_MASK_DEFAULT        ( 1U << TRACE_ISR_ADC )
+#define PROBE_PORT_TRACE_INIT()         { LATBbits.LATB13 = 0; TRISBbits.TRISB13 = 0; }
+#define PROBE_PORT_TRACE( pin, on )     { LATBbits.LATB13 = (on); }
+#endif
+
+/* Kept so a probe can also be placed in an interrupt */
+#define PROBE_PORT_LOCK()               { __builtin_disi( 0x3FFF ); }
+#define PROBE_PORT_UNLOCK()             { __builtin_disi( 0x0000 ); }
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* PROBE_PORT_H */
@@ -0,0 +1,179 @@
+#include "spi_port.h"
+#include "common.h"
+#include "rio_spi.h"
+#include "rio_probe.h"
+
+// Static Prototypes -------------------------------------------------------
+
+#ifdef SPI_PORT_DMA
+static void __attribute__( ( __interrupt__, auto_psv ) ) _DMA1Interrupt( void );
+#else
+static void __attribute__( ( __interrupt__, auto_psv ) ) _SPI1RXInterrupt( void );
+#endif
+static void __attribute__( ( __interrupt__, auto_psv ) ) _CNBInterrupt( void );
+static void spi_port_ss_init( void );
+
+// Extern Functions --------------------------------------------------------
+
+#ifdef SPI_PORT_DMA
+extern void spi_port_init( void )
+{
+    /* Channel 1: write_buf -> SPI1BUFL, one byte per SPI1 TX event, stops at count */
+    DMACH1 = 0;
+    DMAINT1 = 0;
+    DMADST1 = (uint16_t)&SPI1BUFL;
+    DMACH1bits.SIZE = 1;
+    DMACH1bits.SAMODE = 0b01;
+    DMACH1bits.DAMODE = 0b00;
+    DMACH1bits.TRMODE = 0b00;
+    DMAINT1bits.CHSEL = SPI_PORT_DMA_TRIG_SPI1TX;
+    
+    SPI1STATL = 0;
+    SPI1IMSKLbits.SPITBEN = 1;
+    IEC0bits.SPI1RXIE = 0;
+    IEC0bits.SPI1TXIE = 0;
+    IFS0bits.SPI1RXIF = 0;
+    IFS0bits.SPI1TXIF = 0;
+    IFS0bits.DMA1IF = 0;
+    spi_port_ss_init();
+    SPI_PORT_INT_ON();
+}
+
+extern void spi_port_rx_dma_start( volatile uint8_t *buf, uint16_t size )
+{
+    /* Called before spi_port_init() */
+    DMACONbits.DMAEN = 1;
+    DMAL = SPI_PORT_DMA_RAM_START;
+    DMAH = SPI_PORT_DMA_RAM_END;
+    
+    /* Channel 0: SPI1BUFL -> <buf>, one byte per SPI1 RX event, reloads at the end */
+    DMACH0 = 0;
+    DMAINT0 = 0;
+    DMASRC0 = (uint16_t)&SPI1BUFL;
+    DMADST0 = (uint16_t)buf;
+    DMACNT0 = size;
+    DMACH0bits.SIZE = 1;
+    DMACH0bits.SAMODE = 0b00;
+    DMACH0bits.DAMODE = 0b01;
+    DMACH0bits.TRMODE = 0b01;
+    DMACH0bits.RELOAD = 1;
+    DMAINT0bits.CHSEL = SPI_PORT_DMA_TRIG_SPI1RX;
+    DMACH0bits.CHEN = 1;
+}
+
+extern spi_buf_count_t spi_port_rx_dma_head( void )
+{
+    /* DMACNT0 counts down from SPI_READ_BUF_SIZE and reloads after the last byte */
+    return ( SPI_READ_BUF_SIZE - DMACNT0 ) & ( SPI_READ_BUF_SIZE - 1 );
+}
+
+extern void spi_port_tx_dma_start( volatile uint8_t *buf, uint16_t count )
+{
+    DMACH1bits.CHEN = 0;
+    DMASRC1 = (uint16_t)buf;
+    DMACNT1 = count;
+    DMAINT1bits.DONEIF = 0;
+    SPI1STATLbits.SPITUR = 0;
+    DMACH1bits.CHEN = 1;
+    
+    /* Transmit buffer already empty -> no TX event will come, load the first byte now */
+    if ( SPI1STATLbits.SPITBE )
+        DMACH1bits.CHREQ = 1;
+}
+
+extern uint16_t spi_port_tx_dma_pending( void )
+{
+    return DMACH1bits.CHEN ? DMACNT1 : 0;
+}
+
+extern void spi_port_tx_dma_stop( void )
+{
+    DMACH1bits.CHEN = 0;
+    DMACNT1 = 0;
+}
+#else
+extern void spi_port_init( void )
+{
+    SPI1STATL = 0;
+    IFS0bits.SPI1RXIF = 0;
+    spi_port_ss_init();
+    SPI_PORT_INT_ON();
+}
+#endif
+
+// Static Functions --------------------------------------------------------
+
+static void spi_port_ss_init( void )
+{
+    /* Edge style change notification, rising edge of SS only, nothing else on port B uses it.
+     * Same priority as the SPI interrupt, so neither preempts the other mid ring update. */
+    CNCONBbits.ON = 0;
+    CNCONBbits.CNSTYLE = 1;
+    SPI_PORT_SS_CNEN = 1;
+    SPI_PORT_SS_CNF = 0;
+#ifdef SPI_PORT_DMA
+    IPC0bits.CNBIP = IPC2bits.DMA1IP;
+#else
+    IPC0bits.CNBIP = IPC2bits.SPI1RXIP;
+#endif
+    IFS0bits.CNBIF = 0;
+    CNCONBbits.ON = 1;
+}
+
+static void __attribute__( ( __interrupt__, auto_psv ) ) _CNBInterrupt( void )
+{
+    PROBE_ISR_ENTER();
+    TRACE_BEGIN( TRACE_ISR_SPI );
+    
+    if ( SPI_PORT_SS_CNF )
+    {
+        SPI_PORT_SS_CNF = 0;
+        spi_deselect();
+    }
+    
+    IFS0bits.CNBIF = 0;
+    
+    TRACE_END( TRACE_ISR_SPI );
+    PROBE_ISR_EXIT();
+}
+
+#ifdef SPI_PORT_DMA
+static void __attribute__( ( __interrupt__, auto_psv ) ) _DMA1Interrupt( void )
+{
+    PROBE_ISR_ENTER();
+    TRACE_BEGIN( TRACE_ISR_SPI );
+    
+    IFS0bits.DMA1IF = 0;
+    DMAINT1bits.DONEIF = 0;
+    
+    /* Receive side needs no service, only keep the SPI status clear */
+    SPI1STATLbits.SPIROV = 0;
+    
+    spi_dma_tx_done();
+    
+    TRACE_END( TRACE_ISR_SPI );
+    PROBE_ISR_EXIT();
+}
+#else
+static void __attribute__( ( __interrupt__, auto_psv ) ) _SPI1RXInterrupt( void )
+{
+    uint8_t byte_out;
+    
+    PROBE_ISR_ENTER();
+    TRACE_BEGIN( TRACE_ISR_SPI );
+    
+    IFS0bits.SPI1RXIF = 0;
+    
+    SPI1STATLbits.SPIROV = 0;
+    SPI1STATLbits.SPITUR = 0;
+    
+    if ( SPI1IMSKLbits.SPIRBFEN && SPI1STATLbits.SPIRBF )
+    {
+        if ( spi_handler( SPI1BUFL, &byte_out ) )
+            SPI1BUFL = byte_out;
+    }
+    
+    TRACE_END( TRACE_ISR_SPI );
+    PROBE_ISR_EXIT();
+}
+#endif
@@ -1,8 +1,10 @@
 #include <stdio.h>
+#include <string.h>
 #include "mcc_generated_files/mcc.h"
 #include "common.h"
 #include "storage.h"
 #include "eeprom.h"
+#include "fault_port.h"
 
 #define GET_STORE_OFFSET( member )  offsetof( store_t, member )
 
@@ -21,32 +23,139 @@ typedef struct __attribute__((packed))
     int16_t htune_temp_c_scaled;
     uint8_t run_on_start;
     uint8_t heat_power_limit_pc;
+    store_heater_model_t heater_model;
+    store_hpid_warm_t hpid_warm;
+    uint8_t module_addr;
+    uint16_t supply_budget_ma;
 } store_t;
 
 /* Static Function Prototypes */
 
 static err store_save_data( uint16_t offset, uint8_t data_len, uint8_t *data );
+static void store_load_data( uint16_t offset, uint8_t data_len, uint8_t *data );
+
+/* A/B slots, one EEPROM page each, after the page 0 layout of EEPROMs written before them.
+ * A commit writes the older slot, so a power loss mid-write leaves the other one valid. */
+#define STORE_SLOT_A_ADDR       0x0040
+#define STORE_SLOT_SIZE         64
+#define STORE_SLOT_COUNT        2
+#define STORE_LEGACY_ADDR       0x0000
+#define STORE_MAGIC             0x5A
+#define STORE_CRC_INIT          0xFFFF      // CRC-16/CCITT-FALSE
+#define STORE_CRC_POLY          0x1021
+
+typedef struct __attribute__((packed))
+{
+    uint8_t magic;
+    uint8_t layout;                 // EEPROM_VER of the body
+    uint8_t size;                   // Body bytes, fields appended later read as blank from a shorter body
+    uint16_t seq;                   // Incremented each commit, the newest valid slot is loaded
+    uint16_t crc;                   // Over the header up to here and the body
+} store_header_t;
+
+typedef struct __attribute__((packed))
+{
+    store_header_t header;
+    store_t body;
+} store_slot_t;
+
+static bool store_slot_valid( store_slot_t *slot );
+static uint16_t store_slot_crc( store_slot_t *slot );
+static uint16_t store_crc16( uint16_t crc, uint8_t *data, uint8_t num );
+static void store_commit( void );
+
+/* Fails to build if a slot does not fit in one EEPROM page */
+typedef char store_slot_size_check[ ( sizeof(store_slot_t) <= STORE_SLOT_SIZE ) ? 1 : -1 ];
+
+/* Fails to build unless the slots, then the fault log, fit the EEPROM part */
+typedef char store_layout_check[ ( ( STORE_SLOT_A_ADDR + ( STORE_SLOT_COUNT * STORE_SLOT_SIZE ) ) <= FAULT_PORT_LOG_ADDR ) && ( ( FAULT_PORT_LOG_ADDR + FAULT_PORT_LOG_SIZE ) <= EEPROM_SIZE ) ? 1 : -1 ];
+
+/* RAM shadow of the active slot body. Saves change it and set it dirty, store_flush()
+ * commits it to the other slot. Loads read it, so they include saves not yet committed. */
+static store_t store_shadow;
+static bool store_shadow_dirty;
+static uint8_t store_slot_active;
+static uint16_t store_seq;
+static store_slot_t store_slot_buf;
 
 /* Extern Functions */
 
-extern err store_save_eeprom_ver( uint8_t eeprom_ver )
+extern E_STORE_SOURCE store_init( void )
 {
-    err rc = ERR_OK;
-    uint8_t verify_rc;
-    
-    eeprom_read_write_bytes( GET_STORE_OFFSET(eeprom_ver), sizeof(eeprom_ver), &eeprom_ver );
-    verify_rc = eeprom_verify_bytes( GET_STORE_OFFSET(eeprom_ver), sizeof(eeprom_ver), &eeprom_ver );
-    
-    rc = ( verify_rc == 0 ) ? ERR_OK : ERR_EEPROM_VERIFY_FAIL;
+    /* Bulk reads both slots and loads the newest valid one. Without one, loads the page 0
+     * layout of older firmware, to be committed to a slot on the first flush. */
+    uint8_t buf[STORE_SLOT_COUNT * STORE_SLOT_SIZE];
+    store_slot_t *slot;
+    E_STORE_SOURCE source = STORE_SOURCE_BLANK;
+    uint8_t i;
+    
+    store_shadow_dirty = false;
+    store_slot_active = STORE_SLOT_COUNT - 1;
+    store_seq = 0;
+    memset( &store_shadow, EEPROM_BLANK_U8, sizeof(store_shadow) );
+    
+    eeprom_read_bytes( STORE_SLOT_A_ADDR, sizeof(buf), buf );
+    
+    for ( i = 0; i < STORE_SLOT_COUNT; i++ )
+    {
+        slot = (store_slot_t *)&buf[i * STORE_SLOT_SIZE];
+        if ( !store_slot_valid( slot ) )
+            continue;
+        if ( ( source == STORE_SOURCE_SLOT ) && ( (int16_t)( slot->header.seq - store_seq ) <= 0 ) )
+            continue;
+        
+        memset( &store_shadow, EEPROM_BLANK_U8, sizeof(store_shadow) );
+        memcpy( &store_shadow, &slot->body, ( slot->header.size < sizeof(store_shadow) ) ? slot->header.size : sizeof(store_shadow) );
+        store_slot_active = i;
+        store_seq = slot->header.seq;
+        source = STORE_SOURCE_SLOT;
+    }
+    
+    if ( source != STORE_SOURCE_SLOT )
+    {
+        eeprom_read_bytes( STORE_LEGACY_ADDR, sizeof(store_shadow), (uint8_t *)&store_shadow );
+        if ( store_shadow.eeprom_ver != EEPROM_BLANK_U8 )
+        {
+            source = STORE_SOURCE_LEGACY;
+            store_shadow_dirty = true;
+        }
+        else
+            memset( &store_shadow, EEPROM_BLANK_U8, sizeof(store_shadow) );
+    }
+    
+    return source;
+}
+
+extern void store_flush( void )
+{
+    /* Called from the main loop. Commits only once earlier writes are done, so saves made
+     * meanwhile go out together. */
+    if ( store_shadow_dirty && ( eeprom_queue_pending() == 0 ) )
+        store_commit();
+}
+
+extern bool store_dirty( void )
+{
+    return store_shadow_dirty;
+}
+
+extern uint16_t store_flush_wait( void )
+{
+    /* Commits every save, waiting for the EEPROM. Returns the number of writes that failed to verify. */
+    if ( store_shadow_dirty )
+        store_commit();
     
-    return rc;
+    return eeprom_queue_flush();
+}
+
+extern err store_save_eeprom_ver( uint8_t eeprom_ver )
+{
+    return store_save_data( GET_STORE_OFFSET(eeprom_ver), sizeof(eeprom_ver), (uint8_t *)&eeprom_ver );
 }
 
 extern err store_save_pid( uint16_t pid_p, uint16_t pid_i, uint16_t pid_d )
 {
-    err rc;
     store_pid_t pid;
-    uint8_t verify_rc;
     
 //    printf( "store size %i, offset %i\n", sizeof(store_t), GET_STORE_OFFSET(pid) );
     
@@ -54,51 +163,22 @@ extern err store_save_pid( uint16_t pid_p, uint16_t pid_i, uint16_t pid_d )
     pid.pid_i = pid_i;
     pid.pid_d = pid_d;
     
-    eeprom_read_write_bytes( GET_STORE_OFFSET(pid), sizeof(pid), (uint8_t *)&pid );
-    verify_rc = eeprom_verify_bytes( GET_STORE_OFFSET(pid), sizeof(pid), (uint8_t *)&pid );
-    
-    rc = ( verify_rc == 0 ) ? ERR_OK : ERR_EEPROM_VERIFY_FAIL;
-    
-    return rc;
+    return store_save_data( GET_STORE_OFFSET(pid), sizeof(pid), (uint8_t *)&pid );
 }
 
 extern err store_save_hpid_temp( int16_t hpid_temp_c_scaled )
 {
-    err rc = ERR_OK;
-    uint8_t verify_rc;
-    
-    eeprom_read_write_bytes( GET_STORE_OFFSET(hpid_temp_c_scaled), sizeof(hpid_temp_c_scaled), (uint8_t *)&hpid_temp_c_scaled );
-    verify_rc = eeprom_verify_bytes( GET_STORE_OFFSET(hpid_temp_c_scaled), sizeof(hpid_temp_c_scaled), (uint8_t *)&hpid_temp_c_scaled );
-    
-    rc = ( verify_rc == 0 ) ? ERR_OK : ERR_EEPROM_VERIFY_FAIL;
-    
-    return rc;
+    return store_save_data( GET_STORE_OFFSET(hpid_temp_c_scaled), sizeof(hpid_temp_c_scaled), (uint8_t *)&hpid_temp_c_scaled );
 }
 
 extern err store_save_htune_temp( int16_t htune_temp_c_scaled )
 {
-    err rc = ERR_OK;
-    uint8_t verify_rc;
-    
-    eeprom_read_write_bytes( GET_STORE_OFFSET(htune_temp_c_scaled), sizeof(htune_temp_c_scaled), (uint8_t *)&htune_temp_c_scaled );
-    verify_rc = eeprom_verify_bytes( GET_STORE_OFFSET(htune_temp_c_scaled), sizeof(htune_temp_c_scaled), (uint8_t *)&htune_temp_c_scaled );
-    
-    rc = ( verify_rc == 0 ) ? ERR_OK : ERR_EEPROM_VERIFY_FAIL;
-    
-    return rc;
+    return store_save_data( GET_STORE_OFFSET(htune_temp_c_scaled), sizeof(htune_temp_c_scaled), (uint8_t *)&htune_temp_c_scaled );
 }
 
 extern err store_save_run_on_start( uint8_t run_on_start )
 {
-    err rc = ERR_OK;
-    uint8_t verify_rc;
-    
-    eeprom_read_write_bytes( GET_STORE_OFFSET(run_on_start), sizeof(run_on_start), &run_on_start );
-    verify_rc = eeprom_verify_bytes( GET_STORE_OFFSET(run_on_start), sizeof(run_on_start), &run_on_start );
-    
-    rc = ( verify_rc == 0 ) ? ERR_OK : ERR_EEPROM_VERIFY_FAIL;
-    
-    return rc;
+    return store_save_data( GET_STORE_OFFSET(run_on_start), sizeof(run_on_start), (uint8_t *)&run_on_start );
 }
 
 extern err store_save_heat_power_limit_pc( uint8_t heat_power_limit_pc )
@@ -106,12 +186,32 @@ extern err store_save_heat_power_limit_pc( uint8_t heat_power_limit_pc )
     return store_save_data( GET_STORE_OFFSET(heat_power_limit_pc), sizeof(heat_power_limit_pc), &heat_power_limit_pc );
 }
 
+extern err store_save_heater_model( store_heater_model_t *model )
+{
+    return store_save_data( GET_STORE_OFFSET(heater_model), sizeof(*model), (uint8_t *)model );
+}
+
+extern err store_save_hpid_warm( store_hpid_warm_t *warm )
+{
+    return store_save_data( GET_STORE_OFFSET(hpid_warm), sizeof(*warm), (uint8_t *)warm );
+}
+
+extern err store_save_module_addr( uint8_t module_addr )
+{
+    return store_save_data( GET_STORE_OFFSET(module_addr), sizeof(module_addr), &module_addr );
+}
+
+extern err store_save_supply_budget_ma( uint16_t supply_budget_ma )
+{
+    return store_save_data( GET_STORE_OFFSET(supply_budget_ma), sizeof(supply_budget_ma), (uint8_t *)&supply_budget_ma );
+}
+
 extern err store_load_eeprom_ver( uint8_t *eeprom_ver_p )
 {
     err rc = ERR_OK;
     uint8_t eeprom_ver;
     
-    eeprom_read_bytes( GET_STORE_OFFSET(eeprom_ver), sizeof(eeprom_ver), (uint8_t *)&eeprom_ver );
+    store_load_data( GET_STORE_OFFSET(eeprom_ver), sizeof(eeprom_ver), (uint8_t *)&eeprom_ver );
     
     *eeprom_ver_p = eeprom_ver;
     
@@ -123,7 +223,7 @@ extern err store_load_pid( uint16_t *pid_p, uint16_t *pid_i, uint16_t *pid_d )
     err rc = ERR_OK;
     store_pid_t pid;
     
-    eeprom_read_bytes( GET_STORE_OFFSET(pid), sizeof(pid), (uint8_t *)&pid );
+    store_load_data( GET_STORE_OFFSET(pid), sizeof(pid), (uint8_t *)&pid );
     
     *pid_p = pid.pid_p;
     *pid_i = pid.pid_i;
@@ -137,7 +237,7 @@ extern err store_load_hpid_temp( int16_t *hpid_temp_c_scaled_p )
     err rc = ERR_OK;
     int16_t hpid_temp_c_scaled;
     
-    eeprom_read_bytes( GET_STORE_OFFSET(hpid_temp_c_scaled), sizeof(hpid_temp_c_scaled), (uint8_t *)&hpid_temp_c_scaled );
+    store_load_data( GET_STORE_OFFSET(hpid_temp_c_scaled), sizeof(hpid_temp_c_scaled), (uint8_t *)&hpid_temp_c_scaled );
     
     *hpid_temp_c_scaled_p = hpid_temp_c_scaled;
     
@@ -149,7 +249,7 @@ extern err store_load_htune_temp( int16_t *htune_temp_c_scaled_p )
     err rc = ERR_OK;
     int16_t htune_temp_c_scaled;
     
-    eeprom_read_bytes( GET_STORE_OFFSET(htune_temp_c_scaled), sizeof(htune_temp_c_scaled), (uint8_t *)&htune_temp_c_scaled );
+    store_load_data( GET_STORE_OFFSET(htune_temp_c_scaled), sizeof(htune_temp_c_scaled), (uint8_t *)&htune_temp_c_scaled );
     
     *htune_temp_c_scaled_p = htune_temp_c_scaled;
     
@@ -161,7 +261,7 @@ extern err store_load_run_on_start( uint8_t *run_on_start_p )
     err rc = ERR_OK;
     uint8_t run_on_start;
     
-    eeprom_read_bytes( GET_STORE_OFFSET(run_on_start), sizeof(run_on_start), (uint8_t *)&run_on_start );
+    store_load_data( GET_STORE_OFFSET(run_on_start), sizeof(run_on_start), (uint8_t *)&run_on_start );
     
     *run_on_start_p = run_on_start;
     
@@ -170,20 +270,92 @@ extern err store_load_run_on_start( uint8_t *run_on_start_p )
 
 extern void store_load_heat_power_limit_pc( uint8_t *heat_power_limit_pc )
 {
-    eeprom_read_bytes( GET_STORE_OFFSET(heat_power_limit_pc), sizeof(heat_power_limit_pc), (uint8_t *)heat_power_limit_pc );
+    store_load_data( GET_STORE_OFFSET(heat_power_limit_pc), sizeof(*heat_power_limit_pc), (uint8_t *)heat_power_limit_pc );
+}
+
+extern void store_load_heater_model( store_heater_model_t *model )
+{
+    store_load_data( GET_STORE_OFFSET(heater_model), sizeof(*model), (uint8_t *)model );
+}
+
+extern void store_load_hpid_warm( store_hpid_warm_t *warm )
+{
+    store_load_data( GET_STORE_OFFSET(hpid_warm), sizeof(*warm), (uint8_t *)warm );
+}
+
+extern void store_load_module_addr( uint8_t *module_addr )
+{
+    store_load_data( GET_STORE_OFFSET(module_addr), sizeof(*module_addr), module_addr );
+}
+
+extern void store_load_supply_budget_ma( uint16_t *supply_budget_ma )
+{
+    store_load_data( GET_STORE_OFFSET(supply_budget_ma), sizeof(*supply_budget_ma), (uint8_t *)supply_budget_ma );
 }
 
 /* Static Functions */
 
 static err store_save_data( uint16_t offset, uint8_t data_len, uint8_t *data )
 {
-    err rc = ERR_OK;
-    uint8_t verify_rc;
+    /* Into the shadow, committed by store_flush(). Commit and verify results are in eeprom_queue_stats(). */
+    if ( memcmp( (uint8_t *)&store_shadow + offset, data, data_len ) == 0 )
+        return ERR_OK;
     
-    eeprom_read_write_bytes( offset, data_len, data );
-    verify_rc = eeprom_verify_bytes( offset, data_len, data );
+    memcpy( (uint8_t *)&store_shadow + offset, data, data_len );
+    store_shadow_dirty = true;
     
-    rc = ( verify_rc == 0 ) ? ERR_OK : ERR_EEPROM_VERIFY_FAIL;
+    return ERR_OK;
+}
+
+static void store_load_data( uint16_t offset, uint8_t data_len, uint8_t *data )
+{
+    memcpy( data, (uint8_t *)&store_shadow + offset, data_len );
+}
+
+static bool store_slot_valid( store_slot_t *slot )
+{
+    if ( ( slot->header.magic != STORE_MAGIC ) || ( slot->header.size > ( STORE_SLOT_SIZE - sizeof(store_header_t) ) ) )
+        return false;
     
-    return rc;
+    return ( store_slot_crc( slot ) == slot->header.crc );
+}
+
+static uint16_t store_slot_crc( store_slot_t *slot )
+{
+    /* Header up to the CRC, then the body */
+    uint16_t crc;
+    
+    crc = store_crc16( STORE_CRC_INIT, (uint8_t *)&slot->header, offsetof( store_header_t, crc ) );
+    return store_crc16( crc, (uint8_t *)&slot->body, slot->header.size );
+}
+
+static uint16_t store_crc16( uint16_t crc, uint8_t *data, uint8_t num )
+{
+    uint8_t bit;
+    
+    while ( num-- )
+    {
+        crc ^= (uint16_t)*data++ << 8;
+        for ( bit = 0; bit < 8; bit++ )
+            crc = ( crc & 0x8000 ) ? ( ( crc << 1 ) ^ STORE_CRC_POLY ) : ( crc << 1 );
+    }
+    
+    return crc;
+}
+
+static void store_commit( void )
+{
+    /* Queues the shadow to the slot not holding the last commit */
+    store_slot_active = ( store_slot_active + 1 ) % STORE_SLOT_COUNT;
+    store_seq++;
+    
+    store_slot_buf.header.magic = STORE_MAGIC;
+    store_slot_buf.header.layout = EEPROM_VER;
+    store_slot_buf.header.size = sizeof(store_t);
+    store_slot_buf.header.seq = store_seq;
+    store_slot_buf.body = store_shadow;
+    store_slot_buf.header.crc = store_slot_crc( &store_slot_buf );
+    
+    eeprom_queue_write( STORE_SLOT_A_ADDR + ( store_slot_active * STORE_SLOT_SIZE ), sizeof(store_slot_buf), (uint8_t *)&store_slot_buf );
+    store_shadow_dirty = false;
 }
@@ -7,12 +7,52 @@ extern "C" {
 
 #define EEPROM_VER  1
 
+/* Heater plant model, see heater_model_identify() in main.c. Blank (ref_output
+ * EEPROM_BLANK_U16) on EEPROMs written before it was added. */
+typedef struct __attribute__((packed))
+{
+    int16_t ambient_c_scaled;       // Heater temp at the start of autotune
+    int16_t ref_c_scaled;           // Autotune target
+    uint16_t ref_output;            // Settled autotune bias, heater output holding ref_c_scaled
+    uint16_t tau_s;                 // First-order time constant
+    uint16_t dead_s;                // Dead time
+    uint8_t flags;                  // HMODEL_FLAG_*
+    uint8_t sp_weight_pc;           // Setpoint weight of the P and D terms
+} store_heater_model_t;
+
+/* Heater loop as it last settled, see heater_pid_warm_track() in main.c. Blank (output
+ * EEPROM_BLANK_U16) until it first settles. */
+typedef struct __attribute__((packed))
+{
+    int16_t target_c_scaled;        // Target it settled at
+    uint16_t output;                // Feedforward plus integrator, the steady heater output
+} store_hpid_warm_t;
+
+/* Where store_init() loaded the settings from */
+typedef enum
+{
+    STORE_SOURCE_BLANK,             // No valid slot or older layout, all fields blank
+    STORE_SOURCE_SLOT,              // Newest slot with a valid CRC
+    STORE_SOURCE_LEGACY,            // Page 0 layout of older firmware, moved to a slot on the first flush
+} E_STORE_SOURCE;
+
+/* Saves go to a RAM shadow of the EEPROM, committed by store_flush() from the main loop.
+ * store_init() fills the shadow before any load. */
+extern E_STORE_SOURCE store_init( void );
+extern void store_flush( void );
+extern uint16_t store_flush_wait( void );
+extern bool store_dirty( void );
+
 extern err store_save_eeprom_ver( uint8_t eeprom_ver );
 extern err store_save_pid( uint16_t pid_p, uint16_t pid_i, uint16_t pid_d );
 extern err store_save_hpid_temp( int16_t hpid_temp_c_scaled );
 extern err store_save_htune_temp( int16_t htune_temp_c_scaled );
 extern err store_save_run_on_start( uint8_t run_on_start );
 extern err store_save_heat_power_limit_pc( uint8_t heat_power_limit_pc );
+extern err store_save_heater_model( store_heater_model_t *model );
+extern err store_save_hpid_warm( store_hpid_warm_t *warm );
+extern err store_save_module_addr( uint8_t module_addr );
+extern err store_save_supply_budget_ma( uint16_t supply_budget_ma );
 
 extern err store_load_eeprom_ver( uint8_t *eeprom_ver_p );
 extern err store_load_pid( uint16_t *pid_p, uint16_t *pid_i, uint16_t *pid_d );
@@ -20,6 +60,10 @@ extern err store_load_hpid_temp( int16_t *hpid_temp_c_scaled_p );
 extern err store_load_htune_temp( int16_t *htune_temp_c_scaled_p );
 extern err store_load_run_on_start( uint8_t *run_on_start_p );
 extern void store_load_heat_power_limit_pc( uint8_t *heat_power_limit_pc );
+extern void store_load_heater_model( store_heater_model_t *model );
+extern void store_load_hpid_warm( store_hpid_warm_t *warm );
+extern void store_load_module_addr( uint8_t *module_addr );
+extern void store_load_supply_budget_ma( uint16_t *supply_budget_ma );
 
 #ifdef	__cplusplus
 }
@@ -0,0 +1,32 @@
+/*
+ * File:   time_port.h
+ *
+ * dsPIC33CK (TMR1) shim for the shared rio_time module, see
+ * hardware-modules/common/rio_time.
+ */
+
+#ifndef TIME_PORT_H
+#define	TIME_PORT_H
+
+#include <xc.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/* TMR1 on 4 MHz / 64, 6250 counts = the 100 ms tick of timer1_isr(), 16 us per count */
+#define TIME_PORT_TICK_US               100000UL
+#define TIME_PORT_COUNT_PERIOD          6250
+#define TIME_PORT_COUNT()               ( (uint16_t)TMR1 )
+#define TIME_PORT_COUNT_TO_US( count )  ( (uint32_t)(count) << 4 )
+#define TIME_PORT_TICK_PENDING()        ( IFS0bits.T1IF )
+
+/* time_now_us() is also read in interrupts, so the 32-bit values are copied with them held off */
+#define TIME_PORT_LOCK()                { __builtin_disi( 0x3FFF ); }
+#define TIME_PORT_UNLOCK()              { __builtin_disi( 0x0000 ); }
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* TIME_PORT_H */
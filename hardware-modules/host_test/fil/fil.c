@@ -0,0 +1,141 @@
+/*
+ * Firmware in the loop, the part shared by the dsPIC33CK boards: simulated time, the main
+ * loop passes and SPI1, see fil.h.
+ */
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <xc.h>
+#include "hal.h"
+#include "common.h"
+#include "rio_spi.h"
+#include "fil.h"
+
+static uint64_t fil_now;
+static uint32_t fil_passes;
+static uint32_t fil_loop_ns = FIL_LOOP_NS_DEFAULT;
+static uint32_t fil_spi_byte_ns = 8000000000ull / FIL_SPI_HZ_DEFAULT;
+static bool fil_selected;
+
+static void fil_advance( uint64_t ns )
+{
+    /* The events due within <ns>, in time order */
+    uint64_t end = fil_now + ns;
+    uint64_t next;
+
+    while ( ( next = fil_board_next_event_ns() ) <= end )
+    {
+        if ( next > fil_now )
+            fil_now = next;
+        fil_board_event( fil_now );
+    }
+    fil_now = end;
+}
+
+static void fil_delay( uint32_t us )
+{
+    /* A delay spins while the interrupts run, a pass that delays takes that much longer */
+    fil_advance( (uint64_t)us * 1000 );
+}
+
+void fil_setup( bool quiet )
+{
+    /* main_setup() with the device models in place, its start-up printout dropped if <quiet> */
+    int saved = -1;
+    int null_fd;
+
+    hal_delay_handler = fil_delay;
+    fil_board_setup();
+
+    if ( quiet )
+    {
+        fflush( stdout );
+        saved = dup( STDOUT_FILENO );
+        null_fd = open( "/dev/null", O_WRONLY );
+        if ( null_fd >= 0 )
+        {
+            dup2( null_fd, STDOUT_FILENO );
+            close( null_fd );
+        }
+    }
+
+    main_setup();
+
+    if ( saved >= 0 )
+    {
+        fflush( stdout );
+        dup2( saved, STDOUT_FILENO );
+        close( saved );
+    }
+}
+
+void fil_run_ns( uint64_t ns )
+{
+    /* Whole passes, so up to one pass past <ns> */
+    uint64_t end = fil_now + ns;
+
+    while ( fil_now < end )
+    {
+        fil_board_pass( fil_now );
+        main_loop();
+        fil_passes++;
+        fil_advance( fil_loop_ns );
+    }
+}
+
+uint64_t fil_now_ns( void )
+{
+    return fil_now;
+}
+
+uint32_t fil_loop_passes( void )
+{
+    return fil_passes;
+}
+
+void fil_set_loop_ns( uint32_t ns )
+{
+    fil_loop_ns = ( ns > 0 ) ? ns : 1;
+}
+
+void fil_set_spi_hz( uint32_t hz )
+{
+    fil_spi_byte_ns = 8000000000ull / ( ( hz > 0 ) ? hz : 1 );
+}
+
+void fil_spi_select( bool selected )
+{
+    /* Releasing it is the SS change interrupt of spi_port.c */
+    if ( fil_selected && !selected )
+        spi_deselect();
+    fil_selected = selected;
+}
+
+uint8_t fil_spi_exchange( uint8_t byte_in )
+{
+    /* One byte time of passes, then the SPI1 receive interrupt of spi_port.c.  SPI1BUFL holds
+     * what the firmware loaded to send, a byte of spi_handler() or the first byte of a reply
+     * from spi_packet_write(), and 0 when it loaded none. */
+    uint8_t byte_out;
+    uint8_t byte_next;
+
+    fil_run_ns( fil_spi_byte_ns );
+    if ( !fil_selected )
+        return 0;
+
+    byte_out = (uint8_t)SPI1BUFL;
+    SPI1BUFL = 0;
+    if ( spi_handler( byte_in, &byte_next ) )
+        SPI1BUFL = byte_next;
+
+    return byte_out;
+}
+
+void fil_spi_transfer( const uint8_t *tx, uint8_t *rx, uint16_t count )
+{
+    uint16_t i;
+
+    for ( i=0; i<count; i++ )
+        rx[i] = fil_spi_exchange( tx[i] );
+}
@@ -0,0 +1,53 @@
+/*
+ * Firmware in the loop: a dsPIC33CK board's firmware, main_setup() and then main_loop()
+ * passes, run in simulated time against plant models and driven by the host over a virtual
+ * SPI1.  Built as build/libfil_<board>.so and loaded by software/simulation/
+ * firmware_simulated.py.
+ *
+ * Time only moves between main loop passes, fil_loop_ns per pass, and through the delays.
+ * The interrupts that fall due in that time run in time order after the pass, as the ISRs
+ * of the board would, and the plant follows the outputs the firmware left.
+ */
+
+#ifndef FIL_H
+#define	FIL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define FIL_LOOP_NS_DEFAULT             20000   // One main loop pass
+#define FIL_SPI_HZ_DEFAULT              30000   // software/drivers/spi_handler.py default clock
+
+/* Host API, see firmware_simulated.py */
+void fil_setup( bool quiet );
+void fil_run_ns( uint64_t ns );
+uint64_t fil_now_ns( void );
+uint32_t fil_loop_passes( void );
+void fil_set_loop_ns( uint32_t ns );
+void fil_set_spi_hz( uint32_t hz );
+void fil_spi_select( bool selected );
+uint8_t fil_spi_exchange( uint8_t byte_in );
+void fil_spi_transfer( const uint8_t *tx, uint8_t *rx, uint16_t count );
+
+/* Plant of the pressure and flow board, fil_pressure.c: regulator lag and the flow through
+ * the channel, and their state */
+void fil_pressure_set_plant( uint8_t chan, double tau_s, double ul_hr_per_mbar );
+double fil_pressure_mbar( uint8_t chan );
+double fil_flow_ul_hr( uint8_t chan );
+
+/* Plant of the heater board, fil_heater.c: the sample holder as a first order lag with dead
+ * time, <gain_c> over <ambient_c> at full power */
+void fil_heater_set_plant( double ambient_c, double gain_c, double tau_s, double dead_s );
+double fil_heater_temp_c( void );
+
+/* Firmware entry points, in the board's main.c */
+void main_setup( void );
+void main_loop( void );
+
+/* Implemented by each board's fil_<board>.c */
+void fil_board_setup( void );                   // Device models, before main_setup()
+uint64_t fil_board_next_event_ns( void );       // Time of the next interrupt or plant event, UINT64_MAX for none
+void fil_board_event( uint64_t now_ns );        // Runs the events due at <now_ns>
+void fil_board_pass( uint64_t now_ns );         // Before each pass: the plant to <now_ns>, interrupts left pending
+
+#endif	/* FIL_H */
@@ -0,0 +1,175 @@
+/*
+ * Firmware in the loop, heater board.  The ADC filter, enabled by init() and then by each
+ * TMR1 interrupt, completes 1 ms later on the thermistor reading of the sample holder
+ * temperature and interrupts on ADFLTR0.
+ * The sample holder is a first order lag with dead time on heater_output.  The stirrer is
+ * not simulated, its capture FIFO stays empty, but SCCP7 still releases its task.
+ */
+
+#include <math.h>
+#include <string.h>
+#include <xc.h>
+#include "hal.h"
+#include "fil.h"
+
+/* From sample_holder_pic/main.c */
+#define HEATER_PERIOD_MS                    100
+#define HEATER_POWER_MAX                    0xFFFF
+#define HEATER_ADC_SHIFT                    8
+#define HEATER_TEMP_PRESENT_THRESHOLD       65000
+
+extern volatile uint16_t heater_output;
+extern volatile uint8_t heater_adc_norm_shift;
+
+int16_t get_heater_temp( uint32_t adc_temp );
+void _ADFLTR0Interrupt( void );
+void _CCT7Interrupt( void );
+
+#define FIL_TMR1_NS                         ( HEATER_PERIOD_MS * 1000000ull )   // timer1_isr(), timer1_counter
+#define FIL_ADC_FILTER_NS                   1000000ull                          // FLEN to ADFLTR0IF, the oversampled conversions
+#define FIL_STIR_COUNT_NS                   16000ull                            // SCCP7 count, Fosc/2 / 64
+#define FIL_NONE                            UINT64_MAX
+
+#define PLANT_AMBIENT_C_DEFAULT             22.0
+#define PLANT_GAIN_C_DEFAULT                40.0
+#define PLANT_TAU_S_DEFAULT                 300.0
+#define PLANT_DEAD_S_DEFAULT                15.0
+#define PLANT_DEAD_STEPS_MAX                1200    // 120 s in heater periods
+
+static double plant_ambient_c;
+static double plant_gain_c;
+static double plant_tau_s;
+static uint16_t plant_dead_steps;
+static double plant_temp_c;
+static uint16_t plant_delay[PLANT_DEAD_STEPS_MAX];
+static uint16_t plant_delay_head;
+
+static uint64_t fil_tmr1_next_ns;
+static uint64_t fil_adc_done_ns;
+static uint64_t fil_stir_next_ns;
+
+static void plant_step( void )
+{
+    /* One heater period on the output of <plant_dead_steps> periods ago */
+    uint16_t output = heater_output;
+    double steady_c;
+
+    if ( plant_dead_steps > 0 )
+    {
+        output = plant_delay[plant_delay_head];
+        plant_delay[plant_delay_head] = heater_output;
+        plant_delay_head = ( plant_delay_head + 1 ) % plant_dead_steps;
+    }
+
+    steady_c = plant_ambient_c + plant_gain_c * output / HEATER_POWER_MAX;
+    plant_temp_c += ( steady_c - plant_temp_c ) * ( 1 - exp( -( HEATER_PERIOD_MS / 1000.0 ) / plant_tau_s ) );
+}
+
+static uint16_t thermistor_reading( void )
+{
+    /* The 16-bit filter result get_heater_temp() turns into the plant temperature: it falls
+     * as the temperature rises, so the first reading at or below it */
+    int16_t temp_scaled = (int16_t)lround( plant_temp_c * 100 );
+    uint32_t low = 0;
+    uint32_t high = HEATER_TEMP_PRESENT_THRESHOLD - 1;
+    uint32_t mid;
+
+    while ( low < high )
+    {
+        mid = ( low + high ) / 2;
+        if ( get_heater_temp( mid << HEATER_ADC_SHIFT ) <= temp_scaled )
+            high = mid;
+        else
+            low = mid + 1;
+    }
+
+    return (uint16_t)low;
+}
+
+static void adc_filter_done( void )
+{
+    fil_adc_done_ns = FIL_NONE;
+    if ( !ADFL0CONbits.FLEN )
+        return;
+
+    plant_step();
+    ADFL0DAT = thermistor_reading() >> heater_adc_norm_shift;
+    if ( IEC7bits.ADFLTR0IE )
+        _ADFLTR0Interrupt();
+    else
+        IFS7bits.ADFLTR0IF = 1;
+}
+
+void fil_board_setup( void )
+{
+    fil_heater_set_plant( PLANT_AMBIENT_C_DEFAULT, PLANT_GAIN_C_DEFAULT, PLANT_TAU_S_DEFAULT, PLANT_DEAD_S_DEFAULT );
+    fil_tmr1_next_ns = FIL_TMR1_NS;
+    fil_adc_done_ns = FIL_NONE;
+    fil_stir_next_ns = FIL_NONE;
+}
+
+uint64_t fil_board_next_event_ns( void )
+{
+    /* FLEN is a plain variable, so a filter the firmware just enabled starts here */
+    uint64_t next_ns;
+
+    if ( ADFL0CONbits.FLEN && ( fil_adc_done_ns == FIL_NONE ) )
+        fil_adc_done_ns = fil_now_ns() + FIL_ADC_FILTER_NS;
+    /* SCCP7 from when init() starts it, at the period it has then */
+    if ( CCP7CON1Lbits.CCPON && ( fil_stir_next_ns == FIL_NONE ) )
+        fil_stir_next_ns = fil_now_ns() + ( CCP7PRL + 1ull ) * FIL_STIR_COUNT_NS;
+
+    next_ns = ( fil_adc_done_ns < fil_tmr1_next_ns ) ? fil_adc_done_ns : fil_tmr1_next_ns;
+    return ( fil_stir_next_ns < next_ns ) ? fil_stir_next_ns : next_ns;
+}
+
+void fil_board_event( uint64_t now_ns )
+{
+    if ( fil_tmr1_next_ns <= now_ns )
+    {
+        fil_tmr1_next_ns += FIL_TMR1_NS;
+        if ( hal_tmr1_handler != NULL )
+            hal_tmr1_handler();
+    }
+    if ( fil_stir_next_ns <= now_ns )
+    {
+        fil_stir_next_ns += ( CCP7PRL + 1ull ) * FIL_STIR_COUNT_NS;
+        if ( _CCT7IE )
+            _CCT7Interrupt();
+        else
+            _CCT7IF = 1;
+    }
+    if ( fil_adc_done_ns <= now_ns )
+        adc_filter_done();
+}
+
+void fil_board_pass( uint64_t now_ns )
+{
+    /* ADFLTR0 and SCCP7 latched while the main loop held them off */
+    (void)now_ns;
+    if ( IFS7bits.ADFLTR0IF && IEC7bits.ADFLTR0IE )
+        _ADFLTR0Interrupt();
+    if ( _CCT7IF && _CCT7IE )
+        _CCT7Interrupt();
+}
+
+/* Plant, for the host */
+
+void fil_heater_set_plant( double ambient_c, double gain_c, double tau_s, double dead_s )
+{
+    /* Starts the sample holder at <ambient_c> with the heater off */
+    long steps = lround( dead_s * 1000 / HEATER_PERIOD_MS );
+
+    plant_ambient_c = ambient_c;
+    plant_gain_c = gain_c;
+    plant_tau_s = ( tau_s > 0 ) ? tau_s : HEATER_PERIOD_MS / 1000.0;
+    plant_dead_steps = ( steps < 0 ) ? 0 : ( steps > PLANT_DEAD_STEPS_MAX ) ? PLANT_DEAD_STEPS_MAX : (uint16_t)steps;
+    plant_temp_c = ambient_c;
+    memset( plant_delay, 0, sizeof(plant_delay) );
+    plant_delay_head = 0;
+}
+
+double fil_heater_temp_c( void )
+{
+    return plant_temp_c;
+}
@@ -0,0 +1,341 @@
+/*
+ * Firmware in the loop, pressure and flow board.  On I2C2 the ADS1115 with its ALERT/RDY
+ * pin on INT1, the PCA9544A and a Sensirion LG16 behind each of its channels.  Each
+ * pressure channel is a regulator, a first order lag on the pressure of its DAC code in
+ * dac_codes[], into a fluidic resistance that sets the flow.
+ */
+
+#include <math.h>
+#include <xc.h>
+#include "hal.h"
+#include "common.h"
+#include "fil.h"
+
+/* From pressure_and_flow_pic/main.c */
+#define PRESSURE_CTLR_REF_MV                5000
+#define PRESSURE_CTLR_ZERO_MV               1000
+#define PRESSURE_CTLR_MBAR                  5000
+
+extern uint16_t dac_codes[NUM_PRESSURE_CLTRLS];
+extern const uint8_t adc_map[NUM_PRESSURE_CLTRLS];
+extern const uint8_t flow_map[NUM_PRESSURE_CLTRLS];
+extern const uint8_t adc_i2c_addrs[];
+extern const uint8_t pca9544a_i2c_addrs[];
+
+void _INT1Interrupt( void );
+
+#define FIL_TMR1_NS                         1000000ull  // timer_isr(), timer_ms
+#define FIL_NONE                            UINT64_MAX
+
+#define ADS1115_REG_CONVERSION              0x00
+#define ADS1115_REG_CONFIG                  0x01
+#define ADS1115_REG_LO_THRESH               0x02
+#define ADS1115_REG_HI_THRESH               0x03
+#define ADS1115_CONFIG_OS                   0x8000
+
+#define PCA9544A_ENABLE                     0b100
+
+#define LG16_I2C_ADDR                       0x40
+#define LG16_CMD_MEASURE                    0xF1
+#define LG16_CMD_READ_EEPROM                0xFA
+#define LG16_CMD_RESET                      0xFE
+#define LG16_CMD_ADV_USER_WRITE             0xE4
+#define LG16_CMD_ADV_USER_READ              0xE5
+#define LG16_EEPROM_ADDR_SCALE0             0x2B60
+#define LG16_ADV_USER_DEFAULT               0x7E96
+#define LG16_SCALE                          13          // Counts per ul/min
+
+#define PLANT_TAU_S_DEFAULT                 0.05
+#define PLANT_UL_HR_PER_MBAR_DEFAULT        1.0
+
+typedef struct
+{
+    double tau_s;                   // Regulator lag, 0 follows the DAC at once
+    double ul_hr_per_mbar;          // Flow through the channel's fluidic path
+    double mbar;
+} fil_channel_t;
+
+typedef struct
+{
+    uint8_t cmd;                    // Last command written, selects what a read returns
+    uint16_t adv_user;
+    uint16_t eeprom_addr;
+} fil_lg16_t;
+
+static fil_channel_t fil_channels[NUM_PRESSURE_CLTRLS];
+static uint64_t fil_plant_ns;
+
+static uint64_t fil_tmr1_next_ns;
+
+static uint8_t ads_pointer;
+static uint16_t ads_regs[4];
+static uint64_t ads_done_ns;
+
+static uint8_t mux_ctrl;
+static fil_lg16_t lg16[4];          // Per PCA9544A channel
+
+static const uint16_t ads_fsr_mv[8] = {6144, 4096, 2048, 1024, 512, 256, 256, 256};
+static const uint16_t ads_sps[8] = {8, 16, 32, 64, 128, 250, 475, 860};
+static const int8_t ads_mux_pos[8] = {0, 0, 1, 2, 0, 1, 2, 3};
+static const int8_t ads_mux_neg[8] = {1, 3, 3, 3, -1, -1, -1, -1};
+
+static void plant_to( uint64_t now_ns )
+{
+    /* Each regulator from the last update to <now_ns>, on the DAC codes in between */
+    double dt_s = ( now_ns - fil_plant_ns ) * 1e-9;
+    double set_mbar;
+    uint8_t chan;
+
+    if ( now_ns <= fil_plant_ns )
+        return;
+    fil_plant_ns = now_ns;
+
+    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+    {
+        set_mbar = dac_codes[chan] * (double)PRESSURE_CTLR_MBAR / 0xFFFF;
+        if ( fil_channels[chan].tau_s > 0 )
+            fil_channels[chan].mbar += ( set_mbar - fil_channels[chan].mbar ) * ( 1 - exp( -dt_s / fil_channels[chan].tau_s ) );
+        else
+            fil_channels[chan].mbar = set_mbar;
+    }
+}
+
+static double ads_input_mv( int8_t input )
+{
+    /* The pressure sensor of the channel on <input>, adc_map[] of the ADC inputs, at
+     * PRESSURE_CTLR_ZERO_MV for 0 mbar */
+    uint8_t chan;
+
+    if ( input < 0 )
+        return 0;
+    chan = adc_map[input];
+
+    return PRESSURE_CTLR_ZERO_MV + fil_channels[chan].mbar * ( PRESSURE_CTLR_REF_MV - PRESSURE_CTLR_ZERO_MV ) / PRESSURE_CTLR_MBAR;
+}
+
+static void ads_conversion_done( void )
+{
+    /* The result on the configured inputs and gain, then ALERT/RDY low if the thresholds
+     * select the conversion ready function, which falls on INT1 */
+    uint16_t config = ads_regs[ADS1115_REG_CONFIG];
+    uint8_t mux = ( config >> 12 ) & 0x7;
+    double mv = ads_input_mv( ads_mux_pos[mux] ) - ads_input_mv( ads_mux_neg[mux] );
+    long code = lround( mv * 32768 / ads_fsr_mv[( config >> 9 ) & 0x7] );
+
+    if ( code > INT16_MAX )
+        code = INT16_MAX;
+    else if ( code < INT16_MIN )
+        code = INT16_MIN;
+    ads_regs[ADS1115_REG_CONVERSION] = (uint16_t)(int16_t)code;
+    ads_regs[ADS1115_REG_CONFIG] |= ADS1115_CONFIG_OS;
+    ads_done_ns = FIL_NONE;
+
+    if ( ( ads_regs[ADS1115_REG_HI_THRESH] & 0x8000 ) && !( ads_regs[ADS1115_REG_LO_THRESH] & 0x8000 ) && _RB14 )
+    {
+        _RB14 = 0;
+        if ( _INT1IE )
+            _INT1Interrupt();
+        else
+            _INT1IF = 1;
+    }
+}
+
+static bool ads_transfer( bool read, uint8_t *buf, uint8_t length )
+{
+    uint16_t config;
+
+    if ( read )
+    {
+        if ( length >= 2 )
+        {
+            buf[0] = ads_regs[ads_pointer] >> 8;
+            buf[1] = ads_regs[ads_pointer] & 0xFF;
+        }
+        return true;
+    }
+
+    if ( length >= 1 )
+        ads_pointer = buf[0] & 0x3;
+    if ( length < 3 )
+        return true;
+
+    config = ( (uint16_t)buf[1] << 8 ) | buf[2];
+    if ( ads_pointer != ADS1115_REG_CONFIG )
+    {
+        ads_regs[ads_pointer] = config;
+        return true;
+    }
+
+    /* Single shot: OS starts a conversion, and reads 0 until it is done */
+    ads_regs[ADS1115_REG_CONFIG] = config & ~ADS1115_CONFIG_OS;
+    if ( config & ADS1115_CONFIG_OS )
+    {
+        _RB14 = 1;
+        ads_done_ns = fil_now_ns() + 1000000000ull / ads_sps[( config >> 5 ) & 0x7];
+    }
+
+    return true;
+}
+
+static bool mux_transfer( bool read, uint8_t *buf, uint8_t length )
+{
+    if ( length == 0 )
+        return true;
+    if ( read )
+        buf[0] = mux_ctrl;
+    else
+        mux_ctrl = buf[0] & 0x7;
+
+    return true;
+}
+
+static uint8_t lg16_crc( const uint8_t *data, uint8_t bytes )
+{
+    /* x^8 + x^5 + x^4 + 1, from 0 */
+    uint8_t crc = 0;
+    uint8_t bit;
+
+    while ( bytes-- )
+    {
+        crc ^= *data++;
+        for ( bit=0; bit<8; bit++ )
+            crc = ( crc & 0x80 ) ? ( ( crc << 1 ) ^ 0x31 ) : ( crc << 1 );
+    }
+
+    return crc;
+}
+
+static void lg16_word( uint8_t *buf, uint8_t length, uint16_t word )
+{
+    /* A reply word, MSB first, and its CRC if the read asks for it */
+    uint8_t reply[3];
+    uint8_t i;
+
+    reply[0] = word >> 8;
+    reply[1] = word & 0xFF;
+    reply[2] = lg16_crc( reply, 2 );
+    for ( i=0; i<length; i++ )
+        buf[i] = ( i < 3 ) ? reply[i] : 0;
+}
+
+static bool lg16_transfer( uint8_t mux_chan, bool read, uint8_t *buf, uint8_t length )
+{
+    /* Always ready: a measurement read returns the flow now, there is no hold-master NACK */
+    fil_lg16_t *sensor = &lg16[mux_chan];
+    uint8_t chan;
+    long code = 0;
+
+    if ( !read )
+    {
+        if ( length == 0 )
+            return true;
+        sensor->cmd = buf[0];
+        if ( sensor->cmd == LG16_CMD_RESET )
+            sensor->adv_user = LG16_ADV_USER_DEFAULT;
+        else if ( ( sensor->cmd == LG16_CMD_ADV_USER_WRITE ) && ( length >= 3 ) )
+            sensor->adv_user = ( (uint16_t)buf[1] << 8 ) | buf[2];
+        else if ( ( sensor->cmd == LG16_CMD_READ_EEPROM ) && ( length >= 3 ) )
+            sensor->eeprom_addr = ( (uint16_t)buf[1] << 8 ) | buf[2];
+        return true;
+    }
+
+    if ( sensor->cmd == LG16_CMD_ADV_USER_READ )
+        lg16_word( buf, length, sensor->adv_user );
+    else if ( sensor->cmd == LG16_CMD_READ_EEPROM )
+        lg16_word( buf, length, ( sensor->eeprom_addr == LG16_EEPROM_ADDR_SCALE0 ) ? LG16_SCALE : 0 );
+    else if ( length >= 2 )
+    {
+        for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+            if ( flow_map[chan] == mux_chan )
+                code = lround( fil_flow_ul_hr( chan ) * LG16_SCALE / 60 );
+        if ( code > INT16_MAX )
+            code = INT16_MAX;
+        else if ( code < INT16_MIN )
+            code = INT16_MIN;
+        lg16_word( buf, length, (uint16_t)(int16_t)code );
+    }
+    else
+        lg16_word( buf, length, 0 );
+
+    return true;
+}
+
+static bool fil_i2c_device( uint8_t address, bool read, uint8_t *buf, uint8_t length )
+{
+    if ( address == adc_i2c_addrs[0] )
+        return ads_transfer( read, buf, length );
+    if ( address == pca9544a_i2c_addrs[0] )
+        return mux_transfer( read, buf, length );
+    if ( ( address == LG16_I2C_ADDR ) && ( mux_ctrl & PCA9544A_ENABLE ) )
+        return lg16_transfer( mux_ctrl & 0x3, read, buf, length );
+
+    return false;
+}
+
+void fil_board_setup( void )
+{
+    uint8_t chan;
+
+    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+    {
+        fil_channels[chan].tau_s = PLANT_TAU_S_DEFAULT;
+        fil_channels[chan].ul_hr_per_mbar = PLANT_UL_HR_PER_MBAR_DEFAULT;
+        fil_channels[chan].mbar = 0;
+        lg16[chan].adv_user = LG16_ADV_USER_DEFAULT;
+    }
+    ads_regs[ADS1115_REG_CONFIG] = 0x8583;
+    ads_regs[ADS1115_REG_LO_THRESH] = 0x8000;
+    ads_regs[ADS1115_REG_HI_THRESH] = 0x7FFF;
+    ads_done_ns = FIL_NONE;
+    fil_tmr1_next_ns = FIL_TMR1_NS;
+
+    hal_i2c_device = fil_i2c_device;
+    _RB14 = 1;
+}
+
+uint64_t fil_board_next_event_ns( void )
+{
+    return ( ads_done_ns < fil_tmr1_next_ns ) ? ads_done_ns : fil_tmr1_next_ns;
+}
+
+void fil_board_event( uint64_t now_ns )
+{
+    plant_to( now_ns );
+
+    if ( fil_tmr1_next_ns <= now_ns )
+    {
+        fil_tmr1_next_ns += FIL_TMR1_NS;
+        if ( hal_tmr1_handler != NULL )
+            hal_tmr1_handler();
+    }
+    if ( ads_done_ns <= now_ns )
+        ads_conversion_done();
+}
+
+void fil_board_pass( uint64_t now_ns )
+{
+    /* INT1 latched while the main loop held it off */
+    plant_to( now_ns );
+    if ( _INT1IF && _INT1IE )
+        _INT1Interrupt();
+}
+
+/* Plant, for the host */
+
+void fil_pressure_set_plant( uint8_t chan, double tau_s, double ul_hr_per_mbar )
+{
+    if ( chan >= NUM_PRESSURE_CLTRLS )
+        return;
+    fil_channels[chan].tau_s = tau_s;
+    fil_channels[chan].ul_hr_per_mbar = ul_hr_per_mbar;
+}
+
+double fil_pressure_mbar( uint8_t chan )
+{
+    return ( chan < NUM_PRESSURE_CLTRLS ) ? fil_channels[chan].mbar : 0;
+}
+
+double fil_flow_ul_hr( uint8_t chan )
+{
+    return ( chan < NUM_PRESSURE_CLTRLS ) ? fil_channels[chan].mbar * fil_channels[chan].ul_hr_per_mbar : 0;
+}
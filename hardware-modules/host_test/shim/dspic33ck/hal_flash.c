@@ -0,0 +1,146 @@
+/*
+ * The dual partition program flash of the dsPIC33CK256MP502, faked on the host.  Both
+ * partitions start blank, as a new part, and an erase or write completes at once, so WR
+ * never reads back set.  Only the inactive partition can be erased or written, anything
+ * else sets WRERR.
+ */
+
+#include <string.h>
+#include <xc.h>
+#include "hal.h"
+
+#define FL_INACTIVE                     0x400000UL
+#define FL_PARTITION_SIZE               0x016000UL      // Program addresses, two per instruction
+#define FL_PAGE_SIZE                    0x000800UL
+#define FL_FBTSEQ                       0x015FFCUL
+#define FL_LATCH_PAGE                   0x00FA
+#define FL_NVMOP_DWORD                  0x0001
+#define FL_NVMOP_PAGE_ERASE             0x0003
+#define FL_ERASED                       0xFFFFFFUL
+
+static uint32_t hal_flash_mem[2][FL_PARTITION_SIZE / 2];
+static bool hal_flash_blanked;
+static uint32_t hal_flash_latch[2] = { FL_ERASED, FL_ERASED };
+
+uint8_t hal_flash_active;
+uint32_t hal_resets;
+
+static uint32_t *hal_flash_word( uint32_t addr )
+{
+    /* The instruction at program address <addr>, NULL off both partitions */
+    uint8_t partition = hal_flash_active;
+    uint32_t i;
+
+    if ( !hal_flash_blanked )
+    {
+        for ( i = 0; i < ( FL_PARTITION_SIZE / 2 ); i++ )
+            hal_flash_mem[0][i] = hal_flash_mem[1][i] = FL_ERASED;
+        hal_flash_blanked = true;
+    }
+
+    if ( addr >= FL_INACTIVE )
+    {
+        addr -= FL_INACTIVE;
+        partition ^= 1;
+    }
+    if ( addr >= FL_PARTITION_SIZE )
+        return NULL;
+    return &hal_flash_mem[partition][addr / 2];
+}
+
+static uint16_t hal_flash_seq( uint8_t partition )
+{
+    /* BSEQ of a partition's FBTSEQ, 0xFFF if IBSEQ is not its complement */
+    uint32_t word;
+
+    hal_flash_word( 0 );
+    word = hal_flash_mem[partition][FL_FBTSEQ / 2];
+    if ( ( ( word >> 12 ) & 0xFFF ) != ( ~word & 0xFFF ) )
+        return 0xFFF;
+    return word & 0xFFF;
+}
+
+uint16_t hal_tblrd( uint16_t page, uint16_t offset, bool high )
+{
+    uint32_t *word = hal_flash_word( ( (uint32_t)page << 16 ) | ( offset & ~1 ) );
+
+    if ( word == NULL )
+        return 0;
+    return high ? ( ( *word >> 16 ) & 0xFF ) : ( *word & 0xFFFF );
+}
+
+void hal_tblwt( uint16_t page, uint16_t offset, uint16_t value, bool high )
+{
+    /* Only the write latches, at 0xFA0000 and 0xFA0002 */
+    uint32_t *latch = &hal_flash_latch[( offset >> 1 ) & 1];
+
+    if ( page != FL_LATCH_PAGE )
+        return;
+    if ( high )
+        *latch = ( *latch & 0xFFFF ) | ( (uint32_t)( value & 0xFF ) << 16 );
+    else
+        *latch = ( *latch & 0xFF0000 ) | value;
+}
+
+void hal_write_nvm( void )
+{
+    /* Runs the NVMCON operation at NVMADRU:NVMADR.  Programming only clears bits. */
+    uint32_t addr = ( (uint32_t)NVMADRU << 16 ) | NVMADR;
+    uint32_t *word;
+    uint32_t i;
+
+    NVMCONbits.WR = 0;
+    if ( ( addr < FL_INACTIVE ) || ( ( word = hal_flash_word( addr ) ) == NULL ) )
+    {
+        NVMCONbits.WRERR = 1;
+        return;
+    }
+
+    switch ( NVMCON & 0x000F )
+    {
+        case FL_NVMOP_PAGE_ERASE:
+            word = hal_flash_word( addr & ~( FL_PAGE_SIZE - 1 ) );
+            for ( i = 0; i < ( FL_PAGE_SIZE / 2 ); i++ )
+                word[i] = FL_ERASED;
+            break;
+
+        case FL_NVMOP_DWORD:
+            if ( addr % 4 )
+            {
+                NVMCONbits.WRERR = 1;
+                break;
+            }
+            word[0] &= hal_flash_latch[0];
+            word[1] &= hal_flash_latch[1];
+            hal_flash_latch[0] = hal_flash_latch[1] = FL_ERASED;
+            break;
+
+        default:
+            NVMCONbits.WRERR = 1;
+            break;
+    }
+}
+
+uint32_t hal_flash_read( uint32_t addr )
+{
+    uint32_t *word = hal_flash_word( addr );
+
+    return ( word != NULL ) ? *word : 0;
+}
+
+void hal_flash_program( uint32_t addr, uint32_t word )
+{
+    /* As a programmer would, into either partition */
+    uint32_t *dest = hal_flash_word( addr );
+
+    if ( dest != NULL )
+        *dest = word & FL_ERASED;
+}
+
+void hal_reset( void )
+{
+    /* Boots the partition with the lower valid FBTSEQ, the first if neither is valid.  The
+     * firmware's RAM is left as it was, run its setup again to start it over. */
+    hal_resets++;
+    hal_flash_active = ( hal_flash_seq( 1 ) < hal_flash_seq( 0 ) ) ? 1 : 0;
+}
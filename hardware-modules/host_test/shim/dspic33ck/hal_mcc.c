@@ -0,0 +1,47 @@
+/*
+ * MCC drivers shared by the two dsPIC33CK boards, faked on the host.
+ */
+
+#include <xc.h>
+#include "hal.h"
+
+uint32_t hal_uart_bytes;
+void (*hal_tmr1_handler)( void );
+
+void SYSTEM_Initialize( void )
+{
+    hal_idle();
+}
+
+uint16_t RESET_GetCause( void )
+{
+    return 0;
+}
+
+void RESET_CauseClearAll( void )
+{
+}
+
+void TMR1_SetInterruptHandler( void (* InterruptHandler)( void ) )
+{
+    hal_tmr1_handler = InterruptHandler;
+}
+
+void UART1_Write( uint8_t byte )
+{
+    (void)byte;
+    hal_uart_bytes++;
+}
+
+bool UART1_IsTxReady( void )
+{
+    return true;
+}
+
+void hal_idle( void )
+{
+    /* SPI2 (DAC on the pressure board): TX FIFO and shift register empty, RX FIFO empty */
+    SPI2STATLbits.SPITBE = 1;
+    SPI2STATLbits.SRMT = 1;
+    SPI2STATLbits.SPIRBE = 1;
+}
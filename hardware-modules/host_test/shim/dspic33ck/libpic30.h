@@ -0,0 +1,15 @@
+/*
+ * Host shim of the XC16 <libpic30.h>. Delays return at once, see hal_delay_us() in hal.h.
+ */
+
+#ifndef LIBPIC30_H
+#define	LIBPIC30_H
+
+#include <stdint.h>
+
+void hal_delay_us( uint32_t us );
+
+#define __delay_ms( ms )                hal_delay_us( 1000ul * (ms) )
+#define __delay_us( us )                hal_delay_us( us )
+
+#endif	/* LIBPIC30_H */
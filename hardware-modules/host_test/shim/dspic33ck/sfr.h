@@ -0,0 +1,121 @@
+/*
+ * Generated by tools/gen_sfr.py, registers used by the firmware sources. Every
+ * register is a plain RAM variable on the host, defined once by hal_sfr.c.
+ */
+
+#ifndef SFR
+#define SFR( name )                     extern volatile SFR_TYPE name;
+#define SFR_BITS( name, members )       extern volatile struct members name;
+#endif
+
+SFR( ADCBUF0 )
+SFR( ADCBUF1 )
+SFR( ADCMP0HI )
+SFR( ADCMP0LO )
+SFR( ADCMP1HI )
+SFR( ADCMP1LO )
+SFR( ADCMP2HI )
+SFR( ADCMP2LO )
+SFR( ADCMP3HI )
+SFR( ADCMP3LO )
+SFR( ADFL0DAT )
+SFR( ADFL1CON )
+SFR( ADFL1DAT )
+SFR( ADTRIG0L )
+SFR( CCP1PRL )
+SFR( CCP1RA )
+SFR( CCP2RA )
+SFR( CCP3BUFH )
+SFR( CCP3BUFL )
+SFR( CCP6RA )
+SFR( CCP7CON1H )
+SFR( CCP7CON1L )
+SFR( CCP7CON2H )
+SFR( CCP7CON2L )
+SFR( CCP7PRL )
+SFR( CCP7TMRL )
+SFR( CCP8CON1H )
+SFR( CCP8CON1L )
+SFR( CCP8CON2H )
+SFR( CCP8CON2L )
+SFR( CCP8PRL )
+SFR( CCP8RA )
+SFR( CCP8RB )
+SFR( CCP8TMRL )
+SFR( CCP9CON1H )
+SFR( CCP9CON1L )
+SFR( CCP9CON2H )
+SFR( CCP9CON2L )
+SFR( CCP9PRL )
+SFR( CCP9TMRL )
+SFR( CORCON )
+SFR( I2C2BRG )
+SFR( NVMADR )
+SFR( NVMADRU )
+SFR( NVMCON )
+SFR( PR1 )
+SFR( RPOR6 )
+SFR( SPI1BUFL )
+SFR( SPI1STATL )
+SFR( SPI2BUFH )
+SFR( SPI2BUFL )
+SFR( TBLPAG )
+SFR( TMR1 )
+SFR( WDTCONH )
+SFR( _CCT7IE )
+SFR( _CCT7IF )
+SFR( _CCT7IP )
+SFR( _INT1EP )
+SFR( _INT1IE )
+SFR( _INT1IF )
+SFR( _INT1IP )
+SFR( _INT1R )
+SFR( _INT2EP )
+SFR( _INT2IE )
+SFR( _INT2IF )
+SFR( _INT2IP )
+SFR( _INT2R )
+SFR( _LATA1 )
+SFR( _LATB7 )
+SFR( _RB0 )
+SFR( _RB14 )
+SFR( _RB4 )
+SFR( __DEVID_BASE )
+SFR_BITS( ADCMP0CONbits, { unsigned CHNL:1; unsigned CMPEN:1; unsigned STAT:1; } )
+SFR_BITS( ADCMP1CONbits, { unsigned CHNL:1; unsigned CMPEN:1; unsigned STAT:1; } )
+SFR_BITS( ADCMP2CONbits, { unsigned CHNL:1; unsigned CMPEN:1; unsigned STAT:1; } )
+SFR_BITS( ADCMP3CONbits, { unsigned CHNL:1; unsigned CMPEN:1; unsigned STAT:1; } )
+SFR_BITS( ADCON1Hbits, { unsigned FORM:1; unsigned SHRRES:1; } )
+SFR_BITS( ADCON1Lbits, { unsigned ADON:1; } )
+SFR_BITS( ADCON2Lbits, { unsigned SHRADCS:1; } )
+SFR_BITS( ADCON3Lbits, { unsigned SWCTRG:1; unsigned SWLCTRG:1; } )
+SFR_BITS( ADCON4Hbits, { unsigned C0CHS:1; unsigned C1CHS:1; } )
+SFR_BITS( ADCORE0Hbits, { unsigned ADCS:1; unsigned RES:1; } )
+SFR_BITS( ADCORE1Hbits, { unsigned ADCS:1; unsigned RES:1; } )
+SFR_BITS( ADFL0CONbits, { unsigned FLEN:1; unsigned IE:1; unsigned MODE:1; unsigned OVRSAM:1; } )
+SFR_BITS( ADSTATLbits, { unsigned AN0RDY:1; unsigned AN1RDY:1; } )
+SFR_BITS( CCP1CON1Lbits, { unsigned CCPON:1; unsigned TMRPS:1; } )
+SFR_BITS( CCP3STATLbits, { unsigned ICBNE:1; unsigned ICOV:1; } )
+SFR_BITS( CCP7CON1Lbits, { unsigned CCPON:1; } )
+SFR_BITS( CCP9CON1Lbits, { unsigned CCPON:1; } )
+SFR_BITS( CNCONBbits, { unsigned CNSTYLE:1; unsigned ON:1; } )
+SFR_BITS( CNEN0Bbits, { unsigned CNEN0B0:1; unsigned CNEN0B4:1; } )
+SFR_BITS( CNFBbits, { unsigned CNFB0:1; unsigned CNFB4:1; } )
+SFR_BITS( I2C2CONLbits, { unsigned DISSLW:1; unsigned I2CEN:1; } )
+SFR_BITS( I2C2STATbits, { unsigned S:1; } )
+SFR_BITS( IEC0bits, { unsigned CNBIE:1; unsigned SPI1RXIE:1; unsigned T1IE:1; } )
+SFR_BITS( IEC5bits, { unsigned ADCIE:1; } )
+SFR_BITS( IEC7bits, { unsigned ADFLTR0IE:1; } )
+SFR_BITS( IFS0bits, { unsigned CNBIF:1; unsigned SPI1RXIF:1; unsigned T1IF:1; } )
+SFR_BITS( IFS5bits, { unsigned ADCIF:1; } )
+SFR_BITS( IFS7bits, { unsigned ADFLTR0IF:1; } )
+SFR_BITS( IPC0bits, { unsigned CNBIP:1; } )
+SFR_BITS( IPC2bits, { unsigned SPI1RXIP:1; } )
+SFR_BITS( LATBbits, { unsigned LATB13:1; unsigned LATB5:1; unsigned LATB6:1; } )
+SFR_BITS( NVMCONbits, { unsigned WR:1; unsigned WRERR:1; } )
+SFR_BITS( PORTBbits, { unsigned RB13:1; unsigned RB5:1; } )
+SFR_BITS( SPI1IMSKLbits, { unsigned SPIRBF:1; unsigned SPIRBFEN:1; } )
+SFR_BITS( SPI1STATLbits, { unsigned SPIRBF:1; unsigned SPIROV:1; unsigned SPITUR:1; } )
+SFR_BITS( SPI2STATLbits, { unsigned SPIRBE:1; unsigned SPITBE:1; unsigned SRMT:1; } )
+SFR_BITS( TRISBbits, { unsigned TRISB13:1; unsigned TRISB5:1; unsigned TRISB6:1; } )
+SFR_BITS( WDTCONLbits, { unsigned ON:1; } )
@@ -0,0 +1,41 @@
+/*
+ * Host shim of the XC16 <xc.h> for the dsPIC33CK boards. __XC16__ stays undefined, so the
+ * shared modules take their portable paths; the single-cycle builtins the board code
+ * calls directly are plain C here.
+ */
+
+#ifndef XC_H
+#define	XC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define __builtin_mulss( a, b )         ( (int32_t)(int16_t)(a) * (int16_t)(b) )
+#define __builtin_mulsu( a, b )         ( (int32_t)(int16_t)(a) * (uint16_t)(b) )
+#define __builtin_muluu( a, b )         ( (uint32_t)(uint16_t)(a) * (uint16_t)(b) )
+#define __builtin_divud( a, b )         ( (uint16_t)( (uint32_t)(a) / (uint16_t)(b) ) )
+#define __builtin_divsd( a, b )         ( (int16_t)( (int32_t)(a) / (int16_t)(b) ) )
+#define __builtin_disi( cycles )        ( (void)(cycles) )
+#define __builtin_write_RPCON( value )  ( (void)(value) )
+#define __builtin_nop()                 ( (void)0 )
+#define __builtin_enable_interrupts()   ( (void)0 )
+#define __builtin_disable_interrupts()  ( (void)0 )
+#define Nop()                           ( (void)0 )
+#define ClrWdt()                        ( (void)0 )
+
+#define SFR_TYPE                        uint16_t
+#include "sfr.h"
+
+/* Table reads and writes and NVM operations go to the flash model of hal_flash.c, through
+ * TBLPAG and NVMCON as on the part */
+uint16_t hal_tblrd( uint16_t page, uint16_t offset, bool high );
+void hal_tblwt( uint16_t page, uint16_t offset, uint16_t value, bool high );
+void hal_write_nvm( void );
+#define __builtin_tblrdl( offset )              hal_tblrd( TBLPAG, offset, false )
+#define __builtin_tblrdh( offset )              hal_tblrd( TBLPAG, offset, true )
+#define __builtin_tblwtl( offset, value )       hal_tblwt( TBLPAG, offset, value, false )
+#define __builtin_tblwth( offset, value )       hal_tblwt( TBLPAG, offset, value, true )
+#define __builtin_write_NVM()                   hal_write_nvm()
+
+#endif	/* XC_H */
@@ -0,0 +1,66 @@
+/*
+ * Host side of the HAL shim: what a test can see and drive of the faked MCC drivers and
+ * registers.  Every register is a RAM variable, every driver call returns at once.
+ */
+
+#ifndef HAL_H
+#define	HAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Total of all __delay_ms() / __delay_us() calls, in us.  Delays do not wait, on the dsPIC33CK
+ * boards they call hal_delay_handler instead if one is set, as the firmware in the loop does
+ * to run its interrupts through a delay. */
+extern uint32_t hal_delay_us_total;
+extern void (*hal_delay_handler)( uint32_t us );
+void hal_delay_us( uint32_t us );
+
+/* Bytes passed to UART1_Write(), the firmware's printf() goes to stdout instead */
+extern uint32_t hal_uart_bytes;
+
+/* TMR1 period callback installed by the firmware, NULL until TMR1_SetInterruptHandler() */
+extern void (*hal_tmr1_handler)( void );
+
+/* I2C2 device model, pressure board.  Called once per TRB with the 7-bit address, returns
+ * false to NACK the address.  NULL NACKs every address, as with nothing on the bus. */
+typedef bool (*hal_i2c_device_t)( uint8_t address, bool read, uint8_t *buf, uint8_t length );
+extern hal_i2c_device_t hal_i2c_device;
+extern uint32_t hal_i2c_transfers;
+
+/* SDA as I2C2_Abort() leaves it: true models a slave holding it low through the bus
+ * recovery, false the pull-up.  The firmware reads it from PORTBbits.RB5. */
+extern bool hal_i2c_sda_stuck;
+
+/* Blocking DAC writes, pressure board: SPI2_Exchange32bit() calls.  set_pressures() loads
+ * SPI2BUFL/H directly, read those for the last queued word. */
+extern uint32_t hal_dac_words;
+
+/* DAC_SELECT() of the two bank pressure build, the bank of the DAC last selected */
+extern uint8_t hal_dac_bank;
+void hal_dac_select( uint8_t bank );
+
+/* Strobe board: SPI1 byte exchange callback installed by spi_port_init(), and the TMR1
+ * count read by TMR1_ReadTimer() */
+extern uint8_t (*hal_spi1_handler)( uint8_t byte_in );
+extern uint16_t hal_tmr1_value;
+
+/* SPI EEPROM of the dsPIC33CK boards, for their SPI exchange fakes: reads as 0x00 and never
+ * busy, writes are dropped.  The write enable latch follows WREN and WRDI, so
+ * eeprom_comms_check() passes. */
+void hal_eeprom_exchange( const uint8_t *tx, uint16_t count, uint8_t *rx );
+
+/* Dual partition program flash of the dsPIC33CK boards, see hal_flash.c.  hal_flash_active
+ * is the physical partition mapped at 0, hal_resets counts the firmware's resets.  Addresses
+ * are program addresses, the inactive partition at 0x400000. */
+extern uint8_t hal_flash_active;
+extern uint32_t hal_resets;
+uint32_t hal_flash_read( uint32_t addr );
+void hal_flash_program( uint32_t addr, uint32_t word );
+void hal_reset( void );
+
+/* Sets the status flags the firmware busy-waits on to idle, e.g. SPI TX empty and
+ * shift register empty.  Call after the firmware init() and before each step. */
+void hal_idle( void );
+
+#endif	/* HAL_H */
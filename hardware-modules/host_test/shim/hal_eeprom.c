@@ -0,0 +1,95 @@
+/*
+ * The 25AA128 SPI EEPROM of the dsPIC33CK boards, faked on the host.  It starts blank, as a
+ * new board, and a write completes at once, so WIP never reads back set.
+ */
+
+#include <string.h>
+#include "hal.h"
+
+#define EE_CMD_READ                     0b011
+#define EE_CMD_WRITE                    0b010
+#define EE_CMD_WRDI                     0b100
+#define EE_CMD_WREN                     0b110
+#define EE_CMD_RDSR                     0b101
+#define EE_STATUS_WEL                   0x02
+#define EE_INSTR_BYTES                  3       // Command and 16-bit address
+#define EE_SIZE                         16384
+#define EE_PAGE_SIZE                    64
+
+static uint8_t hal_eeprom_mem[EE_SIZE];
+static bool hal_eeprom_erased;
+static uint8_t hal_eeprom_status;
+static uint16_t hal_eeprom_addr;
+static uint8_t hal_eeprom_cont;         // Command a header-only exchange left open, or 0
+
+static void hal_eeprom_write( const uint8_t *data, uint16_t count )
+{
+    /* A page write wraps within its page */
+    uint16_t page = hal_eeprom_addr & ~( EE_PAGE_SIZE - 1 );
+    uint16_t i;
+
+    if ( !( hal_eeprom_status & EE_STATUS_WEL ) )
+        return;
+    for ( i=0; i<count; i++ )
+        hal_eeprom_mem[page | ( ( hal_eeprom_addr + i ) & ( EE_PAGE_SIZE - 1 ) )] = data[i];
+    hal_eeprom_status &= ~EE_STATUS_WEL;
+}
+
+static void hal_eeprom_read( uint8_t *rx, uint16_t count )
+{
+    uint16_t i;
+
+    for ( i=0; i<count; i++ )
+        rx[i] = hal_eeprom_mem[( hal_eeprom_addr + i ) % EE_SIZE];
+    hal_eeprom_addr = ( hal_eeprom_addr + count ) % EE_SIZE;
+}
+
+void hal_eeprom_exchange( const uint8_t *tx, uint16_t count, uint8_t *rx )
+{
+    /* eeprom.c sends the command and address in the first exchange after the chip select,
+     * with the data of a single byte, and a page in later ones: one exchange for a write,
+     * any number of receive-only ones for a read.  rx can be tx, so the command and address
+     * are taken first. */
+    uint8_t cmd = ( ( tx != NULL ) && ( count > 0 ) ) ? tx[0] : 0;
+    uint16_t addr = ( ( tx != NULL ) && ( count >= EE_INSTR_BYTES ) ) ? ( ( (uint16_t)tx[1] << 8 ) | tx[2] ) % EE_SIZE : 0;
+    uint8_t cont = hal_eeprom_cont;
+
+    if ( !hal_eeprom_erased )
+    {
+        memset( hal_eeprom_mem, 0xFF, sizeof(hal_eeprom_mem) );
+        hal_eeprom_erased = true;
+    }
+
+    hal_eeprom_cont = 0;
+    if ( cont == EE_CMD_WRITE )
+    {
+        if ( tx != NULL )
+            hal_eeprom_write( tx, count );
+        return;
+    }
+    if ( ( cont == EE_CMD_READ ) && ( tx == NULL ) && ( rx != NULL ) )
+    {
+        hal_eeprom_read( rx, count );
+        hal_eeprom_cont = EE_CMD_READ;
+        return;
+    }
+
+    if ( rx != NULL )
+        memset( rx, 0, count );
+    if ( ( cmd == EE_CMD_WREN ) && ( count == 1 ) )
+        hal_eeprom_status |= EE_STATUS_WEL;
+    else if ( ( cmd == EE_CMD_WRDI ) && ( count == 1 ) )
+        hal_eeprom_status &= ~EE_STATUS_WEL;
+    else if ( ( cmd == EE_CMD_RDSR ) && ( count == 2 ) && ( rx != NULL ) )
+        rx[1] = hal_eeprom_status;
+    else if ( ( ( cmd == EE_CMD_READ ) || ( cmd == EE_CMD_WRITE ) ) && ( count >= EE_INSTR_BYTES ) )
+    {
+        hal_eeprom_addr = addr;
+        if ( count == EE_INSTR_BYTES )
+            hal_eeprom_cont = cmd;
+        else if ( cmd == EE_CMD_WRITE )
+            hal_eeprom_write( &tx[EE_INSTR_BYTES], count - EE_INSTR_BYTES );
+        else if ( rx != NULL )
+            hal_eeprom_read( &rx[EE_INSTR_BYTES], count - EE_INSTR_BYTES );
+    }
+}
@@ -0,0 +1,13 @@
+/*
+ * MCC drivers of the heater and stirrer board, faked on the host.  The EEPROM on SPI2
+ * reads as 0x00, never busy, and drops writes, see hal_eeprom.c.
+ */
+
+#include "mcc_generated_files/mcc.h"
+#include "hal.h"
+
+uint16_t SPI2_Exchange8bitBuffer( uint8_t *dataTransmitted, uint16_t byteCount, uint8_t *dataReceived )
+{
+    hal_eeprom_exchange( dataTransmitted, byteCount, dataReceived );
+    return byteCount;
+}
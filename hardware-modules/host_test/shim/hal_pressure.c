@@ -0,0 +1,98 @@
+/*
+ * MCC drivers of the pressure and flow board, faked on the host.  I2C2 transactions run to
+ * completion inside the call, against hal_i2c_device.  The EEPROM on SPI3 reads as 0x00,
+ * never busy, and drops writes, see hal_eeprom.c.
+ */
+
+#include "mcc_generated_files/mcc.h"
+#include "hal.h"
+
+hal_i2c_device_t hal_i2c_device;
+uint32_t hal_i2c_transfers;
+bool hal_i2c_sda_stuck;
+uint32_t hal_dac_words;
+uint8_t hal_dac_bank;
+
+static bool hal_i2c_transfer( I2C2_TRANSACTION_REQUEST_BLOCK *ptrb )
+{
+    hal_i2c_transfers++;
+    
+    if ( hal_i2c_device == NULL )
+        return false;
+    
+    return hal_i2c_device( ( ptrb->address >> 1 ) & 0x7F, ( ptrb->address & 0x01 ) != 0, ptrb->pbuffer, ptrb->length );
+}
+
+void I2C2_MasterReadTRBBuild( I2C2_TRANSACTION_REQUEST_BLOCK *ptrb, uint8_t *pdata, uint8_t length, uint16_t address )
+{
+    ptrb->address = ( address << 1 ) | 0x01;
+    ptrb->length = length;
+    ptrb->pbuffer = pdata;
+}
+
+void I2C2_MasterWriteTRBBuild( I2C2_TRANSACTION_REQUEST_BLOCK *ptrb, uint8_t *pdata, uint8_t length, uint16_t address )
+{
+    ptrb->address = address << 1;
+    ptrb->length = length;
+    ptrb->pbuffer = pdata;
+}
+
+void I2C2_MasterTRBInsert( uint8_t count, I2C2_TRANSACTION_REQUEST_BLOCK *ptrb_list, I2C2_MESSAGE_STATUS *pflag )
+{
+    uint8_t i;
+    
+    *pflag = I2C2_MESSAGE_COMPLETE;
+    for ( i=0; i<count; i++ )
+    {
+        if ( !hal_i2c_transfer( &ptrb_list[i] ) )
+        {
+            *pflag = I2C2_MESSAGE_ADDRESS_NO_ACK;
+            break;
+        }
+    }
+}
+
+void I2C2_MasterWrite( uint8_t *pdata, uint8_t length, uint16_t address, I2C2_MESSAGE_STATUS *pstatus )
+{
+    I2C2_TRANSACTION_REQUEST_BLOCK trb;
+    
+    I2C2_MasterWriteTRBBuild( &trb, pdata, length, address );
+    I2C2_MasterTRBInsert( 1, &trb, pstatus );
+}
+
+void I2C2_Initialize( void )
+{
+}
+
+bool I2C2_MasterQueueIsEmpty( void )
+{
+    return true;
+}
+
+void I2C2_Abort( void )
+{
+    PORTBbits.RB5 = !hal_i2c_sda_stuck;
+}
+
+bool I2C2_Aborted( void )
+{
+    return false;
+}
+
+uint32_t SPI2_Exchange32bit( uint32_t data )
+{
+    (void)data;
+    hal_dac_words++;
+    return 0;
+}
+
+void hal_dac_select( uint8_t bank )
+{
+    hal_dac_bank = bank;
+}
+
+uint16_t SPI3_Exchange8bitBuffer( uint8_t *dataTransmitted, uint16_t byteCount, uint8_t *dataReceived )
+{
+    hal_eeprom_exchange( dataTransmitted, byteCount, dataReceived );
+    return byteCount;
+}
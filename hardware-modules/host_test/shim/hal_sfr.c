@@ -0,0 +1,22 @@
+/*
+ * Defines every register of the family's sfr.h as a plain RAM variable, and the delay
+ * counter of the <libpic30.h> / <xc.h> delays.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SFR( name )                     volatile SFR_TYPE name;
+#define SFR_BITS( name, members )       volatile struct members name;
+
+#include <xc.h>
+
+uint32_t hal_delay_us_total;
+void (*hal_delay_handler)( uint32_t us );
+
+void hal_delay_us( uint32_t us )
+{
+    hal_delay_us_total += us;
+    if ( hal_delay_handler != NULL )
+        hal_delay_handler( us );
+}
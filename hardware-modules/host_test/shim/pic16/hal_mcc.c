@@ -0,0 +1,38 @@
+/*
+ * MCC drivers of the PIC16F18857 strobe board, faked on the host.
+ */
+
+#include <xc.h>
+#include "hal.h"
+
+uint8_t (*hal_spi1_handler)( uint8_t byte_in );
+uint16_t hal_tmr1_value;
+
+void SYSTEM_Initialize( void )
+{
+    hal_idle();
+}
+
+void SPI1_setExchangeHandler( uint8_t (* InterruptHandler)( uint8_t ) )
+{
+    hal_spi1_handler = InterruptHandler;
+}
+
+uint16_t TMR1_ReadTimer( void )
+{
+    return hal_tmr1_value;
+}
+
+void TMR1_WriteTimer( uint16_t timerVal )
+{
+    hal_tmr1_value = timerVal;
+}
+
+void TMR1_StartSinglePulseAcquisition( void )
+{
+}
+
+void hal_idle( void )
+{
+    /* Nothing on this board busy-waits on a status flag */
+}
@@ -0,0 +1,5 @@
+/*
+ * Host shim of the XC8 device header, the registers are in sfr.h.
+ */
+
+#include <xc.h>
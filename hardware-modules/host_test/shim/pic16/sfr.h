@@ -0,0 +1,119 @@
+/*
+ * Generated by tools/gen_sfr.py, registers used by the firmware sources. Every
+ * register is a plain RAM variable on the host, defined once by hal_sfr.c.
+ */
+
+#ifndef SFR
+#define SFR( name )                     extern volatile SFR_TYPE name;
+#define SFR_BITS( name, members )       extern volatile struct members name;
+#endif
+
+SFR( CCP1CAP )
+SFR( CCP1CON )
+SFR( CCP1PPS )
+SFR( CCP2CAP )
+SFR( CCP2CON )
+SFR( CCP2PPS )
+SFR( CCP3CON )
+SFR( CCPR1H )
+SFR( CCPR1L )
+SFR( CCPR2H )
+SFR( CCPR2L )
+SFR( CCPR3H )
+SFR( CCPR3L )
+SFR( CCPTMRS0 )
+SFR( CCPTMRS1 )
+SFR( CLC4CON )
+SFR( CLC4GLS0 )
+SFR( CLC4GLS1 )
+SFR( CLC4GLS2 )
+SFR( CLC4GLS3 )
+SFR( CLC4POL )
+SFR( CLC4SEL0 )
+SFR( CLC4SEL1 )
+SFR( CLC4SEL2 )
+SFR( CLC4SEL3 )
+SFR( CLCIN0PPS )
+SFR( LC3G3POL )
+SFR( LC4G3POL )
+SFR( PR2 )
+SFR( PR4 )
+SFR( PR6 )
+SFR( PWM6CON )
+SFR( PWM6DCH )
+SFR( PWM6DCL )
+SFR( PWM7CON )
+SFR( PWM7DCH )
+SFR( PWM7DCL )
+SFR( RA0PPS )
+SFR( RC4PPS )
+SFR( SMT1CLK )
+SFR( SMT1CON0 )
+SFR( SMT1CON1 )
+SFR( SMT1PRH )
+SFR( SMT1PRL )
+SFR( SMT1PRU )
+SFR( SMT2CLK )
+SFR( SMT2CON0 )
+SFR( SMT2CON1 )
+SFR( SMT2CPRH )
+SFR( SMT2CPRL )
+SFR( SMT2CPRU )
+SFR( SMT2PRH )
+SFR( SMT2PRL )
+SFR( SMT2PRU )
+SFR( SMT2SIG )
+SFR( SMT2SIGPPS )
+SFR( SSP1BUF )
+SFR( T0CON0 )
+SFR( T0CON1 )
+SFR( T1GPPS )
+SFR( T2AINPPS )
+SFR( T2CON )
+SFR( T2RST )
+SFR( T3CLK )
+SFR( T3CON )
+SFR( T3GCON )
+SFR( T4CON )
+SFR( T5CLK )
+SFR( T5CON )
+SFR( T5GCON )
+SFR( T6CLKCON )
+SFR( T6CON )
+SFR( T6HLT )
+SFR( T6RST )
+SFR( TMR0H )
+SFR( TMR0L )
+SFR( TMR2 )
+SFR( TMR3H )
+SFR( TMR3L )
+SFR( TMR5H )
+SFR( TMR5L )
+SFR( TMR6 )
+SFR_BITS( ANSELAbits, { unsigned ANSA0:1; } )
+SFR_BITS( ANSELCbits, { unsigned ANSC4:1; } )
+SFR_BITS( CLC3CONbits, { unsigned LC3OUT:1; } )
+SFR_BITS( INTCONbits, { unsigned GIE:1; unsigned PEIE:1; } )
+SFR_BITS( LATAbits, { unsigned LATA0:1; } )
+SFR_BITS( LATCbits, { unsigned LATC4:1; } )
+SFR_BITS( PIE0bits, { unsigned TMR0IE:1; } )
+SFR_BITS( PIE3bits, { unsigned SSP1IE:1; } )
+SFR_BITS( PIE4bits, { unsigned TMR1GIE:1; unsigned TMR4IE:1; } )
+SFR_BITS( PIE8bits, { unsigned SMT1IE:1; } )
+SFR_BITS( PIR0bits, { unsigned TMR0IF:1; } )
+SFR_BITS( PIR3bits, { unsigned SSP1IF:1; } )
+SFR_BITS( PIR4bits, { unsigned TMR1GIF:1; unsigned TMR4IF:1; } )
+SFR_BITS( PIR5bits, { unsigned CLC4IF:1; } )
+SFR_BITS( PIR6bits, { unsigned CCP1IF:1; unsigned CCP2IF:1; } )
+SFR_BITS( PIR8bits, { unsigned SMT1IF:1; unsigned SMT2IF:1; unsigned SMT2PRAIF:1; } )
+SFR_BITS( SMT1CON0bits, { unsigned EN:1; } )
+SFR_BITS( SMT1CON1bits, { unsigned SMT1GO:1; } )
+SFR_BITS( SMT1STATbits, { unsigned RST:1; } )
+SFR_BITS( SMT2CON0bits, { unsigned EN:1; } )
+SFR_BITS( SMT2CON1bits, { unsigned SMT2GO:1; } )
+SFR_BITS( SSP1CON1bits, { unsigned WCOL:1; } )
+SFR_BITS( T2CONbits, { unsigned T2ON:1; } )
+SFR_BITS( T4CONbits, { unsigned T4ON:1; } )
+SFR_BITS( T6CONbits, { unsigned T6ON:1; } )
+SFR_BITS( TRISAbits, { unsigned TRISA0:1; } )
+SFR_BITS( TRISCbits, { unsigned TRISC4:1; } )
@@ -0,0 +1,28 @@
+/*
+ * Host shim of the XC8 <xc.h> for the PIC16F18857 strobe board, 8-bit registers.
+ */
+
+#ifndef XC_H
+#define	XC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define __interrupt( ... )
+#define __at( address )
+#define __bit                           bool
+#define NOP()                           ( (void)0 )
+#define CLRWDT()                        ( (void)0 )
+#define di()                            ( (void)0 )
+#define ei()                            ( (void)0 )
+
+extern uint32_t hal_delay_us_total;
+
+#define __delay_ms( ms )                ( hal_delay_us_total += 1000ul * (ms) )
+#define __delay_us( us )                ( hal_delay_us_total += (us) )
+
+#define SFR_TYPE                        uint8_t
+#include "sfr.h"
+
+#endif	/* XC_H */
@@ -0,0 +1,95 @@
+/*
+ * Minimal test and benchmark macros for the host builds.  Each test binary is one board
+ * image linked with its tests, so there is no registry: main() calls the tests in turn and
+ * returns TEST_RESULT().
+ *
+ *     CHECK( expr )                   counts a failure and prints the line if expr is false
+ *     CHECK_EQ( a, b )                the same for a == b, printing both as long
+ *     BENCH( name, iters, stmt )      runs stmt iters times, prints ns per call
+ *
+ * Benchmarks only run with --bench on the command line, see bench_enabled().
+ */
+
+#ifndef TEST_H
+#define	TEST_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+static int test_checks;
+static int test_failures;
+static int test_bench;
+
+#define CHECK( expr )                                                               \
+    do {                                                                            \
+        test_checks++;                                                              \
+        if ( !( expr ) )                                                            \
+        {                                                                           \
+            test_failures++;                                                        \
+            fprintf( stderr, "%s:%d: CHECK( %s ) failed\n", __FILE__, __LINE__, #expr ); \
+        }                                                                           \
+    } while ( 0 )
+
+#define CHECK_EQ( a, b )                                                            \
+    do {                                                                            \
+        long check_a = (long)( a );                                                 \
+        long check_b = (long)( b );                                                 \
+        test_checks++;                                                              \
+        if ( check_a != check_b )                                                   \
+        {                                                                           \
+            test_failures++;                                                        \
+            fprintf( stderr, "%s:%d: CHECK_EQ( %s, %s ) failed: %ld != %ld\n",      \
+                     __FILE__, __LINE__, #a, #b, check_a, check_b );                \
+        }                                                                           \
+    } while ( 0 )
+
+#define RUN_TEST( test )                                                            \
+    do {                                                                            \
+        int run_failures = test_failures;                                           \
+        test();                                                                     \
+        printf( "%-32s %s\n", #test, ( test_failures == run_failures ) ? "ok" : "FAIL" ); \
+    } while ( 0 )
+
+#define TEST_RESULT()                                                               \
+    ( printf( "%d checks, %d failed\n", test_checks, test_failures ), test_failures != 0 )
+
+static inline uint64_t test_now_ns( void )
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static inline void bench_init( int argc, char **argv )
+{
+    int i;
+
+    for ( i=1; i<argc; i++ )
+        if ( strcmp( argv[i], "--bench" ) == 0 )
+            test_bench = 1;
+}
+
+static inline int bench_enabled( void )
+{
+    return test_bench;
+}
+
+/* One line per benchmark: "bench <name> <ns per call> ns <iters>", for diffing runs */
+#define BENCH( name, iters, stmt )                                                  \
+    do {                                                                            \
+        uint64_t bench_start;                                                       \
+        uint64_t bench_i;                                                           \
+        bench_start = test_now_ns();                                                \
+        for ( bench_i=0; bench_i<(uint64_t)( iters ); bench_i++ )                   \
+        {                                                                           \
+            stmt;                                                                   \
+        }                                                                           \
+        printf( "bench %-32s %10.1f ns %lu\n", name,                                \
+                (double)( test_now_ns() - bench_start ) / (double)( iters ),        \
+                (unsigned long)( iters ) );                                         \
+    } while ( 0 )
+
+#endif	/* TEST_H */
@@ -0,0 +1,1029 @@
+/*
+ * Heater board: autotune() and heater_pid() against a simulated sample holder, the warm
+ * start and output map of the heater loop, the 16-bit heater PWM, the sorted autotune log
+ * behind the median selection of autotune_check_cycle(), the temperature observer, the
+ * first ADC filter sample at start-up, the sample to output latency of the heater loop, the
+ * stirrer task on its own timer, and the trace pin.
+ */
+
+#include <stdlib.h>
+#include <math.h>
+#include <xc.h>
+#include "test.h"
+#include "hal.h"
+#include "common.h"
+#include "rio_fault.h"
+#include "rio_time.h"
+#include "rio_latency.h"
+#include "rio_param.h"
+#include "rio_probe.h"
+#include "storage.h"
+#include "board_config.h"
+
+/* From sample_holder_pic/main.c */
+#define HEATER_PERIOD_MS                    100
+#define HEATER_POWER_MAX                    0xFFFF
+#define HTUNE_CYCLES_MAX                    50
+#define PARAM_ID_TRACE_MASK                 20
+
+typedef enum
+{
+    HPID_STATE_UNCONFIGURED,
+    HPID_STATE_READY,
+    HPID_STATE_RUNNING,
+    HPID_STATE_SUSPENDED,
+    HPID_STATE_ERROR
+} E_HPID_STATE;
+
+typedef enum
+{
+    HTUNE_STATE_DEFAULT,
+    HTUNE_STATE_RUNNING,
+    HTUNE_STATE_ABORTED,
+    HTUNE_STATE_FINISHED,
+    HTUNE_STATE_FAILED
+} E_HTUNE_STATE;
+
+typedef enum
+{
+    STIR_STATE_UNCONFIGURED,
+    STIR_STATE_READY,
+    STIR_STATE_RUNNING,
+    STIR_STATE_ERROR
+} E_STIR_STATE;
+
+typedef enum
+{
+    STIR_PHASE_SPINUP,
+    STIR_PHASE_RAMP,
+    STIR_PHASE_RECOUPLE
+} E_STIR_PHASE;
+
+extern volatile uint16_t timer1_counter;
+extern volatile uint16_t heater_output;
+extern volatile int16_t heater_temp_c_scaled;
+extern volatile bool heater_temp_present;
+extern volatile bool heater_temp_ready;
+extern volatile uint32_t heater_adc_avg;
+extern volatile uint8_t heater_adc_norm_shift;
+extern E_HPID_STATE hpid_state;
+extern int32_t hpid_p;
+extern int32_t hpid_i;
+extern int32_t hpid_d;
+extern int16_t hpid_target;
+extern store_hpid_warm_t hpid_warm;
+extern uint8_t hpid_warm_enable;
+extern uint16_t heater_output_cap;
+extern uint16_t supply_budget_ma;
+extern store_heater_model_t hmodel;
+extern bool hmodel_valid;
+extern bool hboost_active;
+extern uint8_t hobs_shift;
+extern bool hobs_valid;
+extern int16_t hobs_c_scaled;
+extern uint8_t pwm_hires;
+extern E_HTUNE_STATE htune_state;
+extern bool htune_run_checks;
+extern int32_t htune_log[HTUNE_CYCLES_MAX][2];
+extern uint8_t htune_log_sorted[HTUNE_CYCLES_MAX];
+extern E_STIR_STATE stir_state;
+extern E_STIR_PHASE stir_phase;
+extern uint16_t stir_target;
+extern uint32_t stir_setpoint_scaled;
+extern uint8_t stir_accel_rps_s;
+extern uint8_t stir_period_ms;
+extern volatile uint16_t stir_output;
+extern volatile int32_t stir_output_integrator;
+
+void init( void );
+void main_setup( void );
+void heater_task( void );
+void heater_pid( void );
+void heater_pid_start( void );
+void pwm_config( void );
+int32_t heater_pid_map_output( int16_t target );
+void autotune( bool write_output );
+void autotune_start( int16_t target_temp, uint8_t flags );
+void autotune_check_cycle( void );
+void autotune_check_timeout( void );
+void autotune_log_insert( uint8_t index );
+int16_t get_heater_temp( uint32_t adc_temp );
+void _ADFLTR0Interrupt( void );
+void _CCT7Interrupt( void );
+void timer1_isr( void );
+void stir_timer_config( void );
+void task_run( void );
+void stir_pid_start( void );
+void stir_task( void );
+void set_heat_power_limit_pc( uint8_t heat_power_limit_pc );
+void heater_budget_update( void );
+void stir_setpoint_ramp( void );
+void heater_guard_sample( int16_t raw_c_scaled );
+int16_t heater_pid_temp( void );
+
+/* Sample holder: first order lag with dead time, PLANT_GAIN_C over ambient at full power */
+#define PLANT_AMBIENT_C                     22.0
+#define PLANT_GAIN_C                        40.0
+#define PLANT_TAU_S                         300.0
+#define PLANT_DEAD_S                        15
+#define PLANT_DEAD_STEPS                    ( PLANT_DEAD_S * 1000 / HEATER_PERIOD_MS )
+
+typedef struct
+{
+    double temp_c;
+    uint16_t delay[PLANT_DEAD_STEPS];
+    uint16_t delay_head;
+} plant_t;
+
+static plant_t plant;
+
+static void plant_init( double temp_c )
+{
+    memset( &plant, 0, sizeof(plant) );
+    plant.temp_c = temp_c;
+    heater_temp_c_scaled = (int16_t)lround( temp_c * 100 );
+}
+
+static uint16_t plant_duty( void )
+{
+    /* Heater power as CCP1 puts it out, in HEATER_POWER_MAX: on from the CCP1RA compare to
+     * the end of the period, never for a compare past CCP1PRL */
+    uint32_t period = (uint32_t)CCP1PRL + 1;
+
+    if ( CCP1RA > CCP1PRL )
+        return 0;
+    return (uint32_t)HEATER_POWER_MAX * ( period - CCP1RA ) / period;
+}
+
+static void plant_step( void )
+{
+    /* One heater period on the output of the last one, then the new temperature reading */
+    uint16_t output = plant.delay[plant.delay_head];
+    double steady_c;
+
+    plant.delay[plant.delay_head] = plant_duty();
+    plant.delay_head = ( plant.delay_head + 1 ) % PLANT_DEAD_STEPS;
+
+    steady_c = PLANT_AMBIENT_C + PLANT_GAIN_C * output / HEATER_POWER_MAX;
+    plant.temp_c += ( steady_c - plant.temp_c ) * ( HEATER_PERIOD_MS / 1000.0 ) / PLANT_TAU_S;
+    heater_temp_c_scaled = (int16_t)lround( plant.temp_c * 100 );
+}
+
+static void heater_period( void )
+{
+    /* As the firmware: the guard and the heater task once per filtered sample, then the
+     * main loop checks */
+    plant_step();
+    heater_guard_sample( heater_temp_c_scaled );
+    timer1_counter++;
+    heater_task();
+    if ( htune_run_checks )
+    {
+        htune_run_checks = false;
+        autotune_check_cycle();
+    }
+    autotune_check_timeout();
+}
+
+static void heater_setup( void )
+{
+    init();
+    hal_idle();
+    heater_temp_present = true;
+    fault_init( &timer1_counter, 1000 / HEATER_PERIOD_MS, false, 0 );
+    plant_init( PLANT_AMBIENT_C );
+}
+
+static void test_autotune( void )
+{
+    uint32_t periods;
+
+    heater_setup();
+
+    autotune_start( 3500, 0 );
+    CHECK_EQ( htune_state, HTUNE_STATE_RUNNING );
+    for ( periods=0; ( periods < 8ul * 3600 * 1000 / HEATER_PERIOD_MS ) && ( htune_state == HTUNE_STATE_RUNNING ); periods++ )
+        heater_period();
+
+    CHECK_EQ( htune_state, HTUNE_STATE_FINISHED );
+    CHECK_EQ( hpid_state, HPID_STATE_READY );
+    CHECK( ( hpid_p > 0 ) && ( hpid_i > 0 ) && ( hpid_d > 0 ) );
+    printf( "autotune: finished after %lu s, P %ld I %ld D %ld\n", (unsigned long)( periods * HEATER_PERIOD_MS / 1000 ),
+            (long)hpid_p, (long)hpid_i, (long)hpid_d );
+}
+
+static void test_heater_pid( void )
+{
+    /* On the gains of test_autotune(): a 22 -> 35 C step, +-0.2 C within 30 min */
+    int32_t p = hpid_p;
+    int32_t i = hpid_i;
+    int32_t d = hpid_d;
+    uint32_t periods;
+    uint32_t settled = 0;
+    int16_t peak_scaled = 0;
+    int16_t error_scaled;
+
+    heater_setup();
+    hpid_p = p;
+    hpid_i = i;
+    hpid_d = d;
+    hpid_state = HPID_STATE_READY;
+    hpid_target = 3500;
+    heater_pid_start();
+    CHECK_EQ( hpid_state, HPID_STATE_RUNNING );
+
+    for ( periods=1; periods<=3600ul * 1000 / HEATER_PERIOD_MS; periods++ )
+    {
+        heater_period();
+
+        if ( heater_temp_c_scaled > peak_scaled )
+            peak_scaled = heater_temp_c_scaled;
+        error_scaled = heater_temp_c_scaled - hpid_target;
+        if ( abs( error_scaled ) > 20 )
+            settled = 0;
+        else if ( settled == 0 )
+            settled = periods;
+    }
+
+    CHECK( ( settled > 0 ) && ( settled < 1800ul * 1000 / HEATER_PERIOD_MS ) );
+    CHECK( peak_scaled - hpid_target < 200 );
+    printf( "heater_pid: 22 -> 35 C overshoot %d.%02d C, settled to +-0.2 C after %lu s\n",
+            ( peak_scaled - hpid_target ) / 100, ( peak_scaled - hpid_target ) % 100,
+            (unsigned long)( settled * HEATER_PERIOD_MS / 1000 ) );
+}
+
+static void test_heater_warm_start( void )
+{
+    /* On the gains of test_autotune(): the loop records its steady output once settled at
+     * 35 C, and a restart resumes from it where a cold start drops the output to P alone */
+    int32_t p = hpid_p;
+    int32_t i = hpid_i;
+    int32_t d = hpid_d;
+    uint32_t periods;
+    uint16_t warm_output;
+    int16_t error_max = 0;
+    store_hpid_warm_t stored;
+
+    heater_setup();
+    hpid_p = p;
+    hpid_i = i;
+    hpid_d = d;
+    hpid_state = HPID_STATE_READY;
+    hpid_target = 3500;
+    heater_pid_start();
+    CHECK_EQ( hpid_warm.output, EEPROM_BLANK_U16 );
+    for ( periods=0; ( periods < 3600ul * 1000 / HEATER_PERIOD_MS ) && ( hpid_warm.output == EEPROM_BLANK_U16 ); periods++ )
+        heater_period();
+    CHECK_EQ( hpid_warm.target_c_scaled, 3500 );
+    printf( "heater warm start: first recorded after %lu s, output %u\n", (unsigned long)( periods * HEATER_PERIOD_MS / 1000 ), hpid_warm.output );
+
+    /* Follows the loop as it settles further; steady output for 35 C is 13 / 40 of full power */
+    for ( periods=0; periods < 1800ul * 1000 / HEATER_PERIOD_MS; periods++ )
+        heater_period();
+    warm_output = hpid_warm.output;
+    CHECK( labs( (int32_t)warm_output - ( 13l * HEATER_POWER_MAX / 40 ) ) < HEATER_POWER_MAX / 50 );
+    store_load_hpid_warm( &stored );
+    CHECK_EQ( stored.output, warm_output );
+
+    /* Mode toggle: resumes at the settled output and holds +-0.2 C */
+    hpid_state = HPID_STATE_READY;
+    heater_pid_start();
+    heater_period();
+    CHECK( abs( (int32_t)heater_output - warm_output ) < HEATER_POWER_MAX / 50 );
+    for ( periods=0; periods < 600ul * 1000 / HEATER_PERIOD_MS; periods++ )
+    {
+        heater_period();
+        if ( abs( heater_temp_c_scaled - hpid_target ) > error_max )
+            error_max = abs( heater_temp_c_scaled - hpid_target );
+    }
+    CHECK( error_max <= 20 );
+
+    /* Off, or a far target without feedforward: from zero */
+    hpid_warm_enable = 0;
+    hpid_state = HPID_STATE_READY;
+    heater_pid_start();
+    heater_period();
+    CHECK( heater_output < warm_output / 4 );
+
+    hpid_warm_enable = 1;
+    hpid_target = 4500;
+    hpid_state = HPID_STATE_READY;
+    heater_pid_start();
+    heater_period();
+    CHECK( heater_output != warm_output );
+    CHECK_EQ( hpid_warm.target_c_scaled, 3500 );
+}
+
+static uint32_t heater_settle( int16_t target, uint32_t seconds )
+{
+    /* Periods until the heater stays within +-0.2 C of <target>, 0 if it never does */
+    uint32_t periods;
+    uint32_t settled = 0;
+
+    hpid_target = target;
+    for ( periods=1; periods<=seconds * 1000 / HEATER_PERIOD_MS; periods++ )
+    {
+        heater_period();
+        if ( abs( heater_temp_c_scaled - target ) > 20 )
+            settled = 0;
+        else if ( settled == 0 )
+            settled = periods;
+    }
+
+    return settled;
+}
+
+static void test_heater_output_map( void )
+{
+    /* On the gains of test_autotune() with a slower integrator: 35, 40 and 36 C settle into
+     * the map, and a step back to 35 C starts from its output rather than from the integrator
+     * of 36 C. Larger steps saturate the output, which back-calculation already unwinds. */
+    int32_t p = hpid_p;
+    int32_t i = hpid_i;
+    int32_t d = hpid_d;
+    uint32_t settled_map;
+    uint32_t settled_pid;
+
+    heater_setup();
+    hpid_p = p;
+    hpid_i = i / 4;
+    hpid_d = d;
+    CHECK_EQ( heater_pid_map_output( 3500 ), -1 );
+    hpid_state = HPID_STATE_READY;
+    hpid_target = 3500;
+    heater_pid_start();
+    CHECK( heater_settle( 3500, 3600 ) > 0 );
+    CHECK( heater_settle( 4000, 3600 ) > 0 );
+    CHECK( labs( heater_pid_map_output( 3500 ) - ( 13l * HEATER_POWER_MAX / 40 ) ) < HEATER_POWER_MAX / 50 );
+    CHECK( labs( heater_pid_map_output( 4000 ) - ( 18l * HEATER_POWER_MAX / 40 ) ) < HEATER_POWER_MAX / 50 );
+    CHECK( labs( heater_pid_map_output( 3750 ) - ( 31l * HEATER_POWER_MAX / 80 ) ) < HEATER_POWER_MAX / 50 );
+    CHECK_EQ( heater_pid_map_output( 2500 ), -1 );      // Far from both, no model
+
+    CHECK( heater_settle( 3600, 3600 ) > 0 );
+    settled_map = heater_settle( 3500, 1800 );
+    heater_settle( 3600, 1800 );
+    hpid_warm_enable = 0;
+    settled_pid = heater_settle( 3500, 1800 );
+    hpid_warm_enable = 1;
+    CHECK( ( settled_map > 0 ) && ( settled_pid > 0 ) && ( settled_map < settled_pid ) );
+    printf( "heater output map: 36 -> 35 C settled to +-0.2 C after %lu s, %lu s without\n",
+            (unsigned long)( settled_map * HEATER_PERIOD_MS / 1000 ), (unsigned long)( settled_pid * HEATER_PERIOD_MS / 1000 ) );
+}
+
+static void heater_boost_step( const int32_t *gains, bool boost, uint16_t tau_s, uint32_t *settled, int16_t *overshoot, bool *boosted )
+{
+    /* A 22 -> 35 C step on <gains>, with the plant as the model but for <tau_s> */
+    uint32_t periods;
+    int16_t peak_scaled = 0;
+
+    heater_setup();
+    hpid_p = gains[0];
+    hpid_i = gains[1];
+    hpid_d = gains[2];
+    hmodel.ambient_c_scaled = lround( PLANT_AMBIENT_C * 100 );
+    hmodel.ref_c_scaled = 3500;
+    hmodel.ref_output = 13l * HEATER_POWER_MAX / 40;
+    hmodel.tau_s = tau_s;
+    hmodel.dead_s = PLANT_DEAD_S;
+    hmodel.flags = boost ? 0x02 : 0;
+    hmodel_valid = true;
+    hpid_state = HPID_STATE_READY;
+    hpid_target = 3500;
+    heater_pid_start();
+    *boosted = hboost_active;
+
+    *settled = 0;
+    for ( periods=1; periods<=3600ul * 1000 / HEATER_PERIOD_MS; periods++ )
+    {
+        heater_period();
+        if ( heater_temp_c_scaled > peak_scaled )
+            peak_scaled = heater_temp_c_scaled;
+        if ( abs( heater_temp_c_scaled - hpid_target ) > 20 )
+            *settled = 0;
+        else if ( *settled == 0 )
+            *settled = periods;
+    }
+    *overshoot = peak_scaled - hpid_target;
+}
+
+static void test_heater_boost( void )
+{
+    /* Full power to the braking point of the model, then the PID: settles sooner with no
+     * more overshoot than the PID alone. Not for a step too small or a model switched off. */
+    const int32_t gains[3] = { hpid_p, hpid_i, hpid_d };
+    uint32_t settled_boost;
+    uint32_t settled_pid;
+    int16_t overshoot_boost;
+    int16_t overshoot_pid;
+    bool boosted;
+
+    heater_boost_step( gains, false, PLANT_TAU_S, &settled_pid, &overshoot_pid, &boosted );
+    CHECK( !boosted );
+    heater_boost_step( gains, true, PLANT_TAU_S, &settled_boost, &overshoot_boost, &boosted );
+    CHECK( boosted );
+    CHECK( !hboost_active );
+    CHECK( ( settled_boost > 0 ) && ( settled_pid > 0 ) && ( settled_boost < settled_pid ) );
+    CHECK( overshoot_boost <= ( ( overshoot_pid > 20 ) ? overshoot_pid : 20 ) );
+    printf( "heater boost: 22 -> 35 C settled to +-0.2 C after %lu s, overshoot %d.%02d C; PID alone %lu s, %d.%02d C\n",
+            (unsigned long)( settled_boost * HEATER_PERIOD_MS / 1000 ), overshoot_boost / 100, abs( overshoot_boost % 100 ),
+            (unsigned long)( settled_pid * HEATER_PERIOD_MS / 1000 ), overshoot_pid / 100, abs( overshoot_pid % 100 ) );
+
+    /* A model with tau 20 % long brakes late, and the PID takes back the overshoot */
+    heater_boost_step( gains, true, PLANT_TAU_S * 6 / 5, &settled_boost, &overshoot_boost, &boosted );
+    CHECK( boosted );
+    CHECK( ( settled_boost > 0 ) && ( settled_boost < settled_pid ) );
+    CHECK( overshoot_boost <= ( ( overshoot_pid > 20 ) ? overshoot_pid : 20 ) );
+    printf( "heater boost: tau 20 %% long in the model, settled after %lu s, overshoot %d.%02d C\n",
+            (unsigned long)( settled_boost * HEATER_PERIOD_MS / 1000 ), overshoot_boost / 100, abs( overshoot_boost % 100 ) );
+
+    /* A step of 1 C, and one the heater cannot reach at full power, are left to the PID */
+    hpid_state = HPID_STATE_READY;
+    hpid_target = heater_temp_c_scaled + 100;
+    heater_pid_start();
+    CHECK( !hboost_active );
+    hpid_state = HPID_STATE_READY;
+    hpid_target = 7000;
+    heater_pid_start();
+    CHECK( !hboost_active );
+}
+
+static void heater_observer_step( const int32_t *gains, uint8_t shift, uint32_t *settled, int16_t *overshoot )
+{
+    /* A 22 -> 35 C step on <gains>, the observer on <shift> with a model 8 % high in K, tau
+     * 20 % long and 3 s of dead time too many */
+    uint32_t periods;
+    int16_t peak_scaled = 0;
+
+    heater_setup();
+    hpid_p = gains[0];
+    hpid_i = gains[1];
+    hpid_d = gains[2];
+    hmodel.ambient_c_scaled = lround( PLANT_AMBIENT_C * 100 );
+    hmodel.ref_c_scaled = 3500;
+    hmodel.ref_output = 14l * HEATER_POWER_MAX / 40;
+    hmodel.tau_s = PLANT_TAU_S * 6 / 5;
+    hmodel.dead_s = PLANT_DEAD_S + 3;
+    hmodel.flags = 0;
+    hmodel_valid = true;
+    hobs_shift = shift;
+    hpid_state = HPID_STATE_READY;
+    hpid_target = 3500;
+    heater_pid_start();
+
+    *settled = 0;
+    for ( periods=1; periods<=3600ul * 1000 / HEATER_PERIOD_MS; periods++ )
+    {
+        heater_period();
+        if ( heater_temp_c_scaled > peak_scaled )
+            peak_scaled = heater_temp_c_scaled;
+        if ( abs( heater_temp_c_scaled - hpid_target ) > 20 )
+            *settled = 0;
+        else if ( *settled == 0 )
+            *settled = periods;
+    }
+    *overshoot = peak_scaled - hpid_target;
+}
+
+static void test_heater_observer( void )
+{
+    /* Three times the autotune gains keep the loop ringing on the reading, which lags the
+     * heater by the dead time. On the observer they settle sooner, with less overshoot, than
+     * the autotune gains on the reading, and it ends on the reading itself. */
+    const int32_t gains[3] = { hpid_p, hpid_i, hpid_d };
+    const int32_t fast[3] = { hpid_p * 3, hpid_i * 3, hpid_d * 3 };
+    uint32_t settled_obs;
+    uint32_t settled_pid;
+    int16_t overshoot_obs;
+    int16_t overshoot_pid;
+
+    heater_observer_step( gains, 0, &settled_pid, &overshoot_pid );
+    CHECK( !hobs_valid );
+    CHECK_EQ( heater_pid_temp(), heater_temp_c_scaled );
+    heater_observer_step( fast, 0, &settled_obs, &overshoot_obs );
+    CHECK_EQ( settled_obs, 0 );
+
+    heater_observer_step( fast, 4, &settled_obs, &overshoot_obs );
+    CHECK( hobs_valid );
+    CHECK( abs( heater_pid_temp() - heater_temp_c_scaled ) <= 2 );
+    CHECK( ( settled_obs > 0 ) && ( settled_pid > 0 ) && ( settled_obs < settled_pid ) );
+    CHECK( overshoot_obs < overshoot_pid );
+    printf( "heater observer: 3x gains settled to +-0.2 C after %lu s, overshoot %d.%02d C; autotune gains on the reading %lu s, %d.%02d C\n",
+            (unsigned long)( settled_obs * HEATER_PERIOD_MS / 1000 ), overshoot_obs / 100, abs( overshoot_obs % 100 ),
+            (unsigned long)( settled_pid * HEATER_PERIOD_MS / 1000 ), overshoot_pid / 100, abs( overshoot_pid % 100 ) );
+
+    /* Without a model it stays off */
+    hmodel_valid = false;
+    heater_period();
+    CHECK( !hobs_valid );
+    hobs_shift = 0;
+    hpid_p = gains[0];
+    hpid_i = gains[1];
+    hpid_d = gains[2];
+}
+
+static void test_power_budget( void )
+{
+    /* The stirrer takes its share of the supply budget on its present duty, the heater the
+     * rest up to its power limit, cut at the next stirrer output */
+    const int32_t gains[3] = { hpid_p, hpid_i, hpid_d };
+    uint32_t periods;
+    uint32_t warm_shared;
+    uint32_t warm_fixed;
+
+    heater_setup();
+    CHECK_EQ( heater_output_cap, HEATER_POWER_MAX );    // No budget
+
+    supply_budget_ma = HEATER_CURRENT_MA / 2 + STIR_CURRENT_MA;
+    heater_budget_update();
+    CHECK_EQ( heater_output_cap, ( ( HEATER_CURRENT_MA / 2 + STIR_CURRENT_MA ) * (uint32_t)HEATER_POWER_MAX ) / HEATER_CURRENT_MA );
+    stir_state = STIR_STATE_RUNNING;
+    stir_output = 0xFF;
+    CHECK_EQ( heater_output_cap, ( ( HEATER_CURRENT_MA / 2 + STIR_CURRENT_MA ) * (uint32_t)HEATER_POWER_MAX ) / HEATER_CURRENT_MA );
+    heater_output = HEATER_POWER_MAX;
+    heater_budget_update();
+    CHECK_EQ( heater_output_cap, ( ( HEATER_CURRENT_MA / 2 ) * (uint32_t)HEATER_POWER_MAX ) / HEATER_CURRENT_MA );
+    CHECK_EQ( heater_output, heater_output_cap );
+    stir_state = STIR_STATE_READY;
+    stir_task();
+    CHECK_EQ( heater_output_cap, ( ( HEATER_CURRENT_MA / 2 + STIR_CURRENT_MA ) * (uint32_t)HEATER_POWER_MAX ) / HEATER_CURRENT_MA );
+
+    /* The power limit stays the upper bound, a budget short of the stirrer leaves the heater none */
+    set_heat_power_limit_pc( 10 );
+    CHECK_EQ( heater_output_cap, HEATER_POWER_MAX / 10 );
+    set_heat_power_limit_pc( 100 );
+    supply_budget_ma = STIR_CURRENT_MA / 2;
+    stir_state = STIR_STATE_RUNNING;
+    heater_budget_update();
+    CHECK_EQ( heater_output_cap, 0 );
+
+    /* Warm-up with the stirrer idle on half the heater current: the static limit that leaves
+     * room for the stirrer at full duty against the shared budget */
+    heater_setup();
+    hpid_p = gains[0];
+    hpid_i = gains[1];
+    hpid_d = gains[2];
+    supply_budget_ma = HEATER_CURRENT_MA / 2;
+    set_heat_power_limit_pc( 100 * ( HEATER_CURRENT_MA / 2 - STIR_CURRENT_MA ) / HEATER_CURRENT_MA );
+    supply_budget_ma = 0;
+    warm_fixed = 0;
+    hpid_state = HPID_STATE_READY;
+    hpid_target = 3000;
+    heater_pid_start();
+    for ( periods=1; ( periods <= 3600ul * 1000 / HEATER_PERIOD_MS ) && ( warm_fixed == 0 ); periods++ )
+    {
+        heater_period();
+        if ( heater_temp_c_scaled >= 2900 )
+            warm_fixed = periods;
+    }
+
+    heater_setup();
+    hpid_p = gains[0];
+    hpid_i = gains[1];
+    hpid_d = gains[2];
+    supply_budget_ma = HEATER_CURRENT_MA / 2;
+    heater_budget_update();
+    warm_shared = 0;
+    hpid_state = HPID_STATE_READY;
+    hpid_target = 3000;
+    heater_pid_start();
+    for ( periods=1; ( periods <= 3600ul * 1000 / HEATER_PERIOD_MS ) && ( warm_shared == 0 ); periods++ )
+    {
+        heater_period();
+        CHECK( heater_output <= heater_output_cap );
+        if ( heater_temp_c_scaled >= 2900 )
+            warm_shared = periods;
+    }
+    CHECK( ( warm_shared > 0 ) && ( warm_fixed > 0 ) && ( warm_shared < warm_fixed ) );
+    printf( "power budget: 22 -> 29 C on half the heater current in %lu s, %lu s with the stirrer's share reserved\n",
+            (unsigned long)( warm_shared * HEATER_PERIOD_MS / 1000 ), (unsigned long)( warm_fixed * HEATER_PERIOD_MS / 1000 ) );
+}
+
+static void guard_period( int16_t reading )
+{
+    /* heater_period() on a reading of the sensor's own rather than the plant's */
+    plant_step();
+    heater_temp_c_scaled = reading;
+    heater_guard_sample( reading );
+    timer1_counter++;
+    heater_task();
+}
+
+static uint8_t guard_fault( uint8_t *arg )
+{
+    /* Id and arg of the newest fault record */
+    uint8_t buf[FAULT_LIST_SIZE];
+    fault_rec_t rec;
+
+    fault_list( 0, buf );
+    memcpy( &rec, &buf[FAULT_LIST_HEADER_SIZE], sizeof(rec) );
+    *arg = (uint8_t)rec.arg;
+    return rec.id;
+}
+
+static void test_heater_guard( void )
+{
+    /* A thermistor off the block, a reading that jumps and heat past the target each cut
+     * the heater in the sample that shows them, and stop the loop with a fault record */
+    const int32_t gains[3] = { hpid_p, hpid_i, hpid_d };
+    uint32_t periods;
+    int16_t stuck;
+    uint8_t arg;
+
+    /* Thermistor off the block: stuck at ambient with the heater flat out */
+    heater_setup();
+    hpid_p = gains[0];
+    hpid_i = gains[1];
+    hpid_d = gains[2];
+    hpid_state = HPID_STATE_READY;
+    hpid_target = 3500;
+    heater_pid_start();
+    for ( periods=1; ( periods <= 600ul * 1000 / HEATER_PERIOD_MS ) && ( hpid_state == HPID_STATE_RUNNING ); periods++ )
+    {
+        plant_step();
+        heater_temp_c_scaled = 2200;
+        heater_guard_sample( 2200 );
+        timer1_counter++;
+        heater_task();
+    }
+    CHECK_EQ( hpid_state, HPID_STATE_ERROR );
+    CHECK_EQ( heater_output, 0 );
+    CHECK( ( periods > 1000 ) && ( periods <= 1300 ) );
+    CHECK_EQ( guard_fault( &arg ), 4 );
+    CHECK_EQ( arg, 3 );
+    printf( "heater guard: thermistor off the block cut after %lu s\n", (unsigned long)( periods * HEATER_PERIOD_MS / 1000 ) );
+
+    /* A restart clears it, the thermistor back on the block heats and never trips */
+    plant_init( PLANT_AMBIENT_C );
+    hpid_state = HPID_STATE_READY;
+    heater_pid_start();
+    for ( periods=0; periods < 600ul * 1000 / HEATER_PERIOD_MS; periods++ )
+        heater_period();
+    CHECK_EQ( hpid_state, HPID_STATE_RUNNING );
+
+    /* A jump of 5 C between two samples: the output is off before the task runs */
+    fault_init( &timer1_counter, 1000 / HEATER_PERIOD_MS, false, 0 );
+    guard_period( heater_temp_c_scaled );
+    CHECK( heater_output > 0 );
+    heater_guard_sample( heater_temp_c_scaled + 500 );
+    CHECK_EQ( heater_output, 0 );
+    timer1_counter++;
+    heater_task();
+    CHECK_EQ( heater_output, 0 );
+    CHECK_EQ( hpid_state, HPID_STATE_ERROR );
+    CHECK_EQ( guard_fault( &arg ), 4 );
+    CHECK_EQ( arg, 1 );
+
+    /* A target step down past the temperature is cut by the loop, not the guard */
+    fault_init( &timer1_counter, 1000 / HEATER_PERIOD_MS, false, 0 );
+    hpid_state = HPID_STATE_READY;
+    heater_pid_start();
+    for ( periods=0; periods < 60ul * 1000 / HEATER_PERIOD_MS; periods++ )
+        heater_period();
+    hpid_target = heater_temp_c_scaled - 1000;
+    for ( periods=0; periods < 60ul * 1000 / HEATER_PERIOD_MS; periods++ )
+        heater_period();
+    CHECK_EQ( hpid_state, HPID_STATE_RUNNING );
+
+    /* Heat left on 6 C over the target: cut after 10 s */
+    hpid_target = heater_temp_c_scaled - 600;
+    for ( periods=1; periods <= 60ul * 1000 / HEATER_PERIOD_MS; periods++ )
+    {
+        heater_output = HEATER_POWER_MAX / 2;
+        heater_guard_sample( heater_temp_c_scaled );
+        if ( heater_output == 0 )
+            break;
+    }
+    CHECK_EQ( periods, 10ul * 1000 / HEATER_PERIOD_MS );
+    heater_task();
+    CHECK_EQ( hpid_state, HPID_STATE_ERROR );
+    CHECK_EQ( guard_fault( &arg ), 4 );
+    CHECK_EQ( arg, 2 );
+
+    /* Autotune too: the thermistor comes off mid run */
+    heater_setup();
+    autotune_start( 3500, 0 );
+    for ( periods=0; periods < 60ul * 1000 / HEATER_PERIOD_MS; periods++ )
+        heater_period();
+    stuck = heater_temp_c_scaled;
+    for ( periods=0; ( periods < 600ul * 1000 / HEATER_PERIOD_MS ) && ( htune_state == HTUNE_STATE_RUNNING ); periods++ )
+        guard_period( stuck );
+    CHECK_EQ( htune_state, HTUNE_STATE_FAILED );
+    CHECK_EQ( heater_output, 0 );
+    CHECK_EQ( guard_fault( &arg ), 4 );
+    CHECK_EQ( arg, 3 );
+
+    /* The next tests run on the same gains */
+    hpid_p = gains[0];
+    hpid_i = gains[1];
+    hpid_d = gains[2];
+}
+
+static void heater_pwm_ripple( uint8_t hires, int16_t *error_max, uint16_t *output_min, uint16_t *output_max )
+{
+    /* Settled at 35 C on the gains of test_autotune(), the temperature error and heater output
+     * range over the next 30 min */
+    uint32_t periods;
+
+    pwm_hires = hires;
+    pwm_config();
+    hpid_state = HPID_STATE_READY;
+    heater_pid_start();
+    heater_settle( 3500, 3600 );
+    *error_max = 0;
+    *output_min = UINT16_MAX;
+    *output_max = 0;
+    for ( periods=0; periods < 1800ul * 1000 / HEATER_PERIOD_MS; periods++ )
+    {
+        heater_period();
+        if ( abs( heater_temp_c_scaled - hpid_target ) > *error_max )
+            *error_max = abs( heater_temp_c_scaled - hpid_target );
+        if ( heater_output < *output_min )
+            *output_min = heater_output;
+        if ( heater_output > *output_max )
+            *output_max = heater_output;
+    }
+}
+
+static void test_heater_pwm_resolution( void )
+{
+    /* The 8-bit PWM steps the power 0.16 C of the plant at a time and the loop hunts across
+     * steps; at 16 bits the output holds within one of them */
+    int32_t p = hpid_p;
+    int32_t i = hpid_i;
+    int32_t d = hpid_d;
+    int16_t error_8;
+    int16_t error_16;
+    uint16_t output_min;
+    uint16_t output_max;
+
+    heater_setup();
+    CHECK_EQ( pwm_hires, 1 );
+    CHECK_EQ( CCP1PRL, 0xFFFE );
+    CHECK_EQ( CCP1RA, 0xFFFF );             // Off, past the period
+    CHECK_EQ( plant_duty(), 0 );
+    heater_output = HEATER_POWER_MAX;
+    pwm_config();
+    CHECK_EQ( plant_duty(), HEATER_POWER_MAX );
+    heater_output = 12345;
+    pwm_config();
+    CHECK_EQ( plant_duty(), 12345 );
+    heater_output = 0;
+    pwm_config();
+
+    hpid_p = p;
+    hpid_i = i;
+    hpid_d = d;
+    hpid_warm_enable = 0;
+    heater_pwm_ripple( 0, &error_8, &output_min, &output_max );
+    CHECK_EQ( CCP1PRL, 0xFF );
+    CHECK( output_max - output_min >= 0x100 );
+    printf( "heater pwm: 8-bit error +-%d.%02d C, output %u to %u\n", error_8 / 100, error_8 % 100, output_min, output_max );
+    heater_pwm_ripple( 1, &error_16, &output_min, &output_max );
+    CHECK( output_max - output_min < 0x100 );
+    CHECK( error_16 <= error_8 );
+    printf( "heater pwm: 16-bit error +-%d.%02d C, output %u to %u\n", error_16 / 100, error_16 % 100, output_min, output_max );
+}
+
+static void test_autotune_log_insert( void )
+{
+    /* htune_log_sorted[] stays the indices in bias order, ties in log order */
+    uint8_t index;
+    uint8_t i;
+    uint8_t run;
+
+    srand( 2 );
+    for ( run=0; run<100; run++ )
+    {
+        for ( index=0; index<HTUNE_CYCLES_MAX; index++ )
+        {
+            htune_log[index][0] = ( rand() % 64 ) * 1000;
+            autotune_log_insert( index );
+
+            for ( i=1; i<=index; i++ )
+            {
+                CHECK( htune_log[ htune_log_sorted[i - 1] ][0] <= htune_log[ htune_log_sorted[i] ][0] );
+                if ( htune_log[ htune_log_sorted[i - 1] ][0] == htune_log[ htune_log_sorted[i] ][0] )
+                    CHECK( htune_log_sorted[i - 1] < htune_log_sorted[i] );
+            }
+        }
+    }
+}
+
+static void test_first_sample( void )
+{
+    /* The IIR filter starts from the first sample, the next ones are filtered */
+    uint16_t filt;
+
+    init();
+    CHECK( !heater_temp_ready );
+    CHECK_EQ( heater_adc_avg, 0 );
+
+    ADFL0DAT = 30000 >> heater_adc_norm_shift;
+    filt = ADFL0DAT << heater_adc_norm_shift;
+    _ADFLTR0Interrupt();
+    CHECK( heater_temp_ready );
+    CHECK( heater_temp_present );
+    CHECK_EQ( heater_adc_avg, (uint32_t)filt << 8 );
+    CHECK_EQ( heater_temp_c_scaled, get_heater_temp( heater_adc_avg ) );
+
+    ADFL0DAT = 40000 >> heater_adc_norm_shift;
+    _ADFLTR0Interrupt();
+    CHECK( heater_adc_avg > ( (uint32_t)filt << 8 ) );
+    CHECK( heater_adc_avg < ( 40000ul << 8 ) );
+}
+
+static void test_latency( void )
+{
+    /* Heater sample at 160 us, its heater task at 1.6 ms, the next task 100 ms on without a
+     * new sample. The stirrer has neither sample nor output. */
+    uint8_t report[LATENCY_REPORT_SIZE];
+    uint8_t *latency = &report[LATENCY_REPORT_HEADER_SIZE];
+    uint8_t *period = &latency[LATENCY_REPORT_HIST_SIZE];
+
+    init();
+    time_init();
+    latency_init();
+    TMR1 = 10;
+    IFS0bits.T1IF = 0;
+    _ADFLTR0Interrupt();
+    TMR1 = 100;
+    heater_task();
+    time_tick();
+    heater_task();
+
+    latency_report( report, LATENCY_HEATER, 0 );
+    CHECK_EQ( report[0], LATENCY_COUNT );
+    CHECK_EQ( *(uint32_t *)&report[2], HEATER_PERIOD_MS * 1000 );
+    CHECK_EQ( *(uint32_t *)&latency[0], 1 );
+    CHECK_EQ( *(uint32_t *)&latency[4], 1440 );
+    CHECK_EQ( *(uint16_t *)&latency[16 + 2 * 7], 1 );      // [1024, 2048) us
+    CHECK_EQ( *(uint32_t *)&period[0], 1 );
+    CHECK_EQ( *(uint32_t *)&period[8], 100000 );
+    CHECK_EQ( *(uint16_t *)&period[16], 1 );               // No jitter
+
+    latency_report( report, LATENCY_STIR, 1 );
+    CHECK_EQ( report[1], LATENCY_STIR );
+    CHECK_EQ( *(uint32_t *)&latency[0], 0 );
+    CHECK_EQ( *(uint32_t *)&period[0], 0 );
+}
+
+static void stir_stalled_runs( uint16_t runs )
+{
+    /* SCCP7 periods with no capture edge, each running the released stir task */
+    uint16_t i;
+
+    for ( i=0; i<runs; i++ )
+    {
+        _CCT7Interrupt();
+        task_run();
+    }
+}
+
+static void test_stir_rate( void )
+{
+    /* The stirrer task released by SCCP7 at its own period, 10 ms by default, not by TMR1.
+     * With no edges, the spin-up boost per second and the retry after 10 s are the same at
+     * 10 and 50 ms, and at 2 ms the setpoint ramps at accel_rps_s with no step lost. */
+    uint8_t report[LATENCY_REPORT_SIZE];
+    const uint8_t periods[2] = { 10, 50 };
+    int32_t boost[2];
+    uint16_t output[2];
+    uint8_t i;
+
+    init();
+    CHECK_EQ( stir_period_ms, 10 );
+    CHECK_EQ( CCP7PRL, 624 );
+    CHECK( CCP7CON1Lbits.CCPON );
+    CHECK( _CCT7IE );
+
+    latency_init();
+    ADFL0CONbits.FLEN = 0;
+    _CCT7Interrupt();
+    task_run();
+    CHECK( !ADFL0CONbits.FLEN );                        // The heater samples on TMR1 only
+    timer1_isr();
+    task_run();
+    CHECK( ADFL0CONbits.FLEN );
+    latency_report( report, LATENCY_STIR, 0 );
+    CHECK_EQ( *(uint32_t *)&report[2], 10000 );
+    CHECK_EQ( *(uint32_t *)&report[LATENCY_REPORT_HEADER_SIZE], 1 );
+
+    for ( i=0; i<2; i++ )
+    {
+        stir_period_ms = periods[i];
+        stir_timer_config();
+        CHECK_EQ( CCP7PRL, periods[i] * 62500ul / 1000 - 1 );
+        stir_state = STIR_STATE_READY;
+        stir_pid_start();
+
+        stir_stalled_runs( 1000 / periods[i] );
+        boost[i] = stir_output_integrator;
+        output[i] = stir_output;
+        stir_stalled_runs( ( 10000 - 1000 ) / periods[i] - 1 );
+        CHECK_EQ( stir_phase, STIR_PHASE_SPINUP );
+        stir_stalled_runs( 1 );
+        CHECK_EQ( stir_phase, STIR_PHASE_RECOUPLE );
+        CHECK_EQ( stir_output, 0 );
+    }
+    CHECK_EQ( boost[0], boost[1] );
+    CHECK_EQ( output[0], output[1] );
+    CHECK( output[0] > 0 );
+
+    stir_period_ms = 2;
+    stir_timer_config();
+    stir_accel_rps_s = 1;
+    stir_target = 20;
+    stir_setpoint_scaled = 0;
+    for ( i=0; i<250; i++ )
+        stir_setpoint_ramp();
+    CHECK_EQ( stir_setpoint_scaled, 128 );              // 0.5 s at 1 rps/s, 8 fraction bits
+    for ( i=0; i<250; i++ )
+        stir_setpoint_ramp();
+    CHECK_EQ( stir_setpoint_scaled, 256 );
+
+}
+
+static void bench_heater( void )
+{
+    uint8_t index;
+
+    heater_setup();
+    autotune_start( 3500, 0 );
+    BENCH( "autotune", 1000000,
+           plant_step();
+           autotune( false ) );
+
+    heater_setup();
+    hpid_p = 2000;
+    hpid_i = 20;
+    hpid_d = 20000;
+    hpid_state = HPID_STATE_READY;
+    heater_pid_start();
+    BENCH( "heater_pid", 1000000,
+           plant_step();
+           heater_pid() );
+
+    srand( 3 );
+    for ( index=0; index<HTUNE_CYCLES_MAX; index++ )
+        htune_log[index][0] = rand();
+    BENCH( "autotune_log_insert 50 entries", 100000,
+           for ( index=0; index<HTUNE_CYCLES_MAX; index++ )
+               autotune_log_insert( index ) );
+}
+
+static void test_trace( void )
+{
+    /* RB13 follows the regions in its mask: the ADC interrupt from reset, then timer1_isr()
+     * alone once set over PARAM_SET_MANY, which starts the pin low */
+    uint8_t set[3] = { PARAM_ID_TRACE_MASK, 1 << TRACE_ISR_TIMER1, 0 };
+    uint8_t bad[3] = { PARAM_ID_TRACE_MASK, 1 << TRACE_COUNT, 0 };
+
+    LATBbits.LATB13 = 1;
+    TRISBbits.TRISB13 = 1;
+    main_setup();
+    CHECK_EQ( probe_trace_mask[0], 1 << TRACE_ISR_ADC );
+    CHECK( !LATBbits.LATB13 );
+    CHECK( !TRISBbits.TRISB13 );
+
+    LATBbits.LATB13 = 1;
+    timer1_isr();
+    CHECK( LATBbits.LATB13 );                           // Not selected, left alone
+    _ADFLTR0Interrupt();
+    CHECK( !LATBbits.LATB13 );                          // Ended low
+
+    CHECK_EQ( param_set_many( set, sizeof(set) ), ERR_OK );
+    CHECK_EQ( probe_trace_mask[0], 1 << TRACE_ISR_TIMER1 );
+    LATBbits.LATB13 = 1;
+    _ADFLTR0Interrupt();
+    CHECK( LATBbits.LATB13 );
+    timer1_isr();
+    CHECK( !LATBbits.LATB13 );
+
+    CHECK( param_set_many( bad, sizeof(bad) ) != ERR_OK );
+    CHECK_EQ( probe_trace_mask[0], 1 << TRACE_ISR_TIMER1 );
+}
+
+int main( int argc, char **argv )
+{
+    bench_init( argc, argv );
+
+    RUN_TEST( test_autotune );
+    RUN_TEST( test_heater_pid );
+    RUN_TEST( test_heater_warm_start );
+    RUN_TEST( test_heater_output_map );
+    RUN_TEST( test_heater_boost );
+    RUN_TEST( test_heater_observer );
+    RUN_TEST( test_power_budget );
+    RUN_TEST( test_heater_guard );
+    RUN_TEST( test_heater_pwm_resolution );
+    RUN_TEST( test_autotune_log_insert );
+    RUN_TEST( test_first_sample );
+    RUN_TEST( test_latency );
+    RUN_TEST( test_stir_rate );
+    RUN_TEST( test_trace );
+
+    if ( bench_enabled() )
+        bench_heater();
+
+    return TEST_RESULT();
+}
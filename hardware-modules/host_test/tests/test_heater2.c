@@ -0,0 +1,416 @@
+/*
+ * Heater board built with HEATER_ZONES 2: the HEATER_ZONE packet of the second zone, its
+ * PID on a simulated sample holder read through ADC filter 1 and driving SCCP8, and the
+ * checks that stop it, and its temperature as a REPORT signal.
+ */
+
+#include <stdlib.h>
+#include <math.h>
+#include <xc.h>
+#include "test.h"
+#include "hal.h"
+#include "common.h"
+#include "rio_spi.h"
+#include "rio_fault.h"
+#include "rio_report.h"
+#include "board_config.h"
+
+/* From sample_holder_pic/main.c */
+#define HEATER_PERIOD_MS                    100
+#define HEATER_POWER_MAX                    0xFFFF
+#define HEATER_ADC_SHIFT                    8
+#define PACKET_TYPE_HEATER_ZONE             39
+#define FAULT_ID_HZONE_ERROR                5
+#define HZONE_FLT_RDY                       0x0100
+#define HZONE_REPLY_SIZE                    17
+#define PACKET_TYPE_SUBSCRIBE               40
+#define PACKET_TYPE_REPORT                  41
+#define REPORT_SIGNAL_ZONE                  2
+#define REPORT_SIGNALS                      ( REPORT_SIGNAL_ZONE + HEATER_ZONES - 1 )
+
+#define HPID_STATE_UNCONFIGURED             0
+#define HPID_STATE_READY                    1
+#define HPID_STATE_RUNNING                  2
+#define HPID_STATE_ERROR                    4
+#define HPID_ERROR_TEMP_NOT_PRESENT         2
+#define HPID_ERROR_HEATER_GUARD             3
+
+extern volatile uint16_t timer1_counter;
+extern volatile uint16_t heater_output;
+extern uint16_t heater_output_cap;
+extern uint16_t supply_budget_ma;
+
+void init( void );
+void heater_task( void );
+void timer1_isr( void );
+int16_t get_heater_temp( uint32_t adc_temp );
+err parse_packet( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size );
+void heater_budget_update( void );
+uint16_t heater_zone_cap( uint8_t zone );
+
+/* The plant of test_heater.c: first order lag with dead time, PLANT_GAIN_C over ambient */
+#define PLANT_AMBIENT_C                     22.0
+#define PLANT_GAIN_C                        40.0
+#define PLANT_TAU_S                         300.0
+#define PLANT_DEAD_S                        15
+#define PLANT_DEAD_STEPS                    ( PLANT_DEAD_S * 1000 / HEATER_PERIOD_MS )
+
+static double plant_c;
+static uint16_t plant_delay[PLANT_DEAD_STEPS];
+static uint16_t plant_head;
+
+static uint16_t zone_adc( double temp_c )
+{
+    /* 16-bit filter result that reads as temp_c, the thermistor falling with temperature */
+    int16_t target = (int16_t)lround( temp_c * 100 );
+    uint16_t lo = 32768;
+    uint16_t hi = 65000;
+    uint16_t mid;
+
+    while ( lo < hi )
+    {
+        mid = lo + ( ( hi - lo ) >> 1 );
+        if ( get_heater_temp( (uint32_t)mid << HEATER_ADC_SHIFT ) > target )
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static uint16_t zone_duty( void )
+{
+    /* SCCP8 as plant_duty() of test_heater.c reads SCCP1 */
+    uint32_t period = (uint32_t)CCP8PRL + 1;
+
+    if ( CCP8RA > CCP8PRL )
+        return 0;
+    return (uint32_t)HEATER_POWER_MAX * ( period - CCP8RA ) / period;
+}
+
+static void zone_period( uint16_t raw )
+{
+    /* timer1_isr() enables both filters, filter 1 is ready by the heater task */
+    timer1_isr();
+    ADFL1DAT = raw;
+    ADFL1CON |= HZONE_FLT_RDY;
+    heater_task();
+}
+
+static void plant_period( void )
+{
+    uint16_t output = plant_delay[plant_head];
+    double steady_c;
+
+    plant_delay[plant_head] = zone_duty();
+    plant_head = ( plant_head + 1 ) % PLANT_DEAD_STEPS;
+    steady_c = PLANT_AMBIENT_C + PLANT_GAIN_C * output / HEATER_POWER_MAX;
+    plant_c += ( steady_c - plant_c ) * ( HEATER_PERIOD_MS / 1000.0 ) / PLANT_TAU_S;
+    zone_period( zone_adc( plant_c ) );
+}
+
+static uint8_t drain( uint8_t *buf )
+{
+    /* The write ring as the host clocks it out, the first byte already in SPI1BUFL */
+    uint8_t len = spi_write_bytes_written();
+    uint8_t i;
+
+    buf[0] = SPI1BUFL;
+    for ( i=1; i<=len; i++ )
+        spi_handler( 0, &buf[i] );
+    return len;
+}
+
+static err zone_packet( uint8_t *data, uint8_t size, uint8_t *reply )
+{
+    /* Runs HEATER_ZONE, the reply after the frame header and err in reply[] */
+    uint8_t buf[64];
+    err rc;
+
+    rc = parse_packet( PACKET_TYPE_HEATER_ZONE, data, size );
+    if ( rc == ERR_OK )
+    {
+        CHECK_EQ( drain( buf ), 4 + HZONE_REPLY_SIZE );
+        CHECK_EQ( buf[2], PACKET_TYPE_HEATER_ZONE );
+        CHECK_EQ( buf[3], ERR_OK );
+        memcpy( reply, &buf[4], HZONE_REPLY_SIZE - 1 );
+    }
+    return rc;
+}
+
+static int16_t be16( uint8_t *p )
+{
+    return (int16_t)( ( p[0] << 8 ) | p[1] );
+}
+
+static void zone_setup( void )
+{
+    init();
+    hal_idle();
+    spi_init();
+    fault_init( &timer1_counter, 1000 / HEATER_PERIOD_MS, false, 0 );
+    memset( plant_delay, 0, sizeof(plant_delay) );
+    plant_head = 0;
+    plant_c = PLANT_AMBIENT_C;
+}
+
+static void test_zone_packet( void )
+{
+    /* Gains and a target: [zone][run][target LE][P LE][I LE][D LE] */
+    uint8_t set[10] = { 1, 1, 0xAC, 0x0D, 0xFC, 0x07, 0x81, 0x01, 0x3E, 0x1C };
+    uint8_t reply[HZONE_REPLY_SIZE];
+    uint8_t data[4];
+
+    zone_setup();
+
+    /* SCCP8 on RB13 at the 16-bit period of SCCP1, AN1 on the trigger of AN0 */
+    CHECK_EQ( CCP8PRL, CCP1PRL );
+    CHECK_EQ( CCP8CON1L & 0x8000, 0x8000 );
+    CHECK_EQ( RPOR6 >> 8, 0x16 );
+    CHECK_EQ( ADTRIG0L >> 8, ADTRIG0L & 0x1F );
+    CHECK_EQ( ADFL1CON & 0x1F, 1 );
+    CHECK_EQ( zone_duty(), 0 );
+
+    /* Only zone 1, zone 0 has packets of its own */
+    data[0] = 1;
+    CHECK_EQ( zone_packet( data, 1, reply ), ERR_OK );
+    CHECK_EQ( reply[0], 1 );
+    CHECK_EQ( reply[1], HPID_STATE_UNCONFIGURED );
+    CHECK_EQ( reply[3], 0 );
+    data[0] = 0;
+    CHECK_EQ( zone_packet( data, 1, reply ), ERR_HEAT_ZONE_INVALID );
+    data[0] = 2;
+    CHECK_EQ( zone_packet( data, 1, reply ), ERR_HEAT_ZONE_INVALID );
+    CHECK_EQ( zone_packet( set, 5, reply ), ERR_PACKET_INVALID );
+
+    /* No gains yet, then no thermistor */
+    memcpy( data, set, 4 );
+    CHECK_EQ( zone_packet( data, 4, reply ), ERR_HEAT_PID_NOT_READY );
+    CHECK_EQ( zone_packet( set, 10, reply ), ERR_HEAT_PID_NOT_READY );
+    zone_period( 65535 );
+    CHECK_EQ( zone_packet( set, 10, reply ), ERR_HEAT_PID_NOT_READY );
+
+    /* Nothing of a refused packet is applied */
+    data[0] = 1;
+    CHECK_EQ( zone_packet( data, 1, reply ), ERR_OK );
+    CHECK_EQ( reply[1], HPID_STATE_UNCONFIGURED );
+    CHECK_EQ( be16( &reply[10] ), 0 );
+
+    zone_period( zone_adc( 22.0 ) );
+    set[2] = 0x41;
+    set[3] = 0x1F;
+    CHECK_EQ( zone_packet( set, 10, reply ), ERR_HEAT_TARGET_INVALID );
+    set[2] = 0xAC;
+    set[3] = 0x0D;
+    CHECK_EQ( zone_packet( set, 10, reply ), ERR_OK );
+    CHECK_EQ( reply[1], HPID_STATE_RUNNING );
+    CHECK_EQ( reply[3], 1 );
+    CHECK_EQ( be16( &reply[4] ), 3500 );
+    CHECK( abs( be16( &reply[6] ) - 2200 ) <= 2 );
+    CHECK_EQ( be16( &reply[10] ), 2044 );
+    CHECK_EQ( be16( &reply[12] ), 385 );
+    CHECK_EQ( be16( &reply[14] ), 7230 );
+
+    /* Heats zone 1 only */
+    zone_period( zone_adc( 22.0 ) );
+    CHECK( zone_duty() > 0 );
+    CHECK_EQ( heater_output, 0 );
+
+    /* Stopped: off, gains kept */
+    data[0] = 1;
+    data[1] = 0;
+    CHECK_EQ( zone_packet( data, 4, reply ), ERR_OK );
+    CHECK_EQ( reply[1], HPID_STATE_READY );
+    CHECK_EQ( be16( &reply[8] ), 0 );
+    CHECK_EQ( be16( &reply[10] ), 2044 );
+    CHECK_EQ( zone_duty(), 0 );
+    zone_period( zone_adc( 22.0 ) );
+    CHECK_EQ( zone_duty(), 0 );
+}
+
+static void test_zone_pid( void )
+{
+    /* The gains test_autotune() finds for zone 0, a 22 -> 35 C step of zone 1 settled to
+     * +-0.3 C within 30 min. The zone has no model or boost, only the PID. */
+    uint8_t set[10] = { 1, 1, 0xAC, 0x0D, 0xFC, 0x07, 0x81, 0x01, 0x3E, 0x1C };
+    uint8_t reply[HZONE_REPLY_SIZE];
+    uint32_t periods;
+    uint32_t settled = 0;
+    double peak_c = 0;
+
+    zone_setup();
+    zone_period( zone_adc( plant_c ) );
+    CHECK_EQ( zone_packet( set, 10, reply ), ERR_OK );
+
+    for ( periods=1; periods<=3600ul * 1000 / HEATER_PERIOD_MS; periods++ )
+    {
+        plant_period();
+        if ( plant_c > peak_c )
+            peak_c = plant_c;
+        if ( fabs( plant_c - 35.0 ) > 0.3 )
+            settled = 0;
+        else if ( settled == 0 )
+            settled = periods;
+    }
+
+    CHECK( ( settled > 0 ) && ( settled < 1800ul * 1000 / HEATER_PERIOD_MS ) );
+    CHECK( peak_c - 35.0 < 2.5 );
+    CHECK_EQ( heater_output, 0 );
+    printf( "zone_pid: 22 -> 35 C overshoot %.2f C, settled to +-0.3 C after %lu s\n", peak_c - 35.0,
+            (unsigned long)( settled * HEATER_PERIOD_MS / 1000 ) );
+}
+
+static int32_t zone_fault( uint8_t *id )
+{
+    /* Id and arg of the newest fault record */
+    uint8_t buf[FAULT_LIST_SIZE];
+    fault_rec_t rec;
+
+    fault_list( 0, buf );
+    memcpy( &rec, &buf[FAULT_LIST_HEADER_SIZE], sizeof(rec) );
+    *id = rec.id;
+    return rec.arg;
+}
+
+static void test_zone_stop( void )
+{
+    /* A thermistor lost, or a reading past 85 C, turns the zone off with a fault record */
+    uint8_t set[10] = { 1, 1, 0xAC, 0x0D, 0xFC, 0x07, 0x81, 0x01, 0x3E, 0x1C };
+    uint8_t reply[HZONE_REPLY_SIZE];
+    uint8_t id;
+
+    zone_setup();
+    zone_period( zone_adc( 22.0 ) );
+    CHECK_EQ( zone_packet( set, 10, reply ), ERR_OK );
+    zone_period( zone_adc( 22.0 ) );
+    CHECK( zone_duty() > 0 );
+
+    zone_period( 65535 );
+    CHECK_EQ( zone_duty(), 0 );
+    CHECK_EQ( zone_packet( set, 1, reply ), ERR_OK );
+    CHECK_EQ( reply[1], HPID_STATE_ERROR );
+    CHECK_EQ( reply[2], HPID_ERROR_TEMP_NOT_PRESENT );
+    CHECK_EQ( reply[3], 0 );
+    CHECK_EQ( zone_fault( &id ), ( 1 << 8 ) | HPID_ERROR_TEMP_NOT_PRESENT );
+    CHECK_EQ( id, FAULT_ID_HZONE_ERROR );
+
+    /* Run again once it is back, the filter starting over from the new reading */
+    zone_period( zone_adc( 30.0 ) );
+    CHECK_EQ( zone_packet( set, 10, reply ), ERR_OK );
+    CHECK_EQ( reply[1], HPID_STATE_RUNNING );
+    CHECK_EQ( reply[2], 0 );
+
+    zone_period( zone_adc( 90.0 ) );
+    zone_period( zone_adc( 90.0 ) );
+    CHECK_EQ( zone_packet( set, 1, reply ), ERR_OK );
+    CHECK_EQ( reply[1], HPID_STATE_RUNNING );
+    while ( reply[1] == HPID_STATE_RUNNING )
+    {
+        zone_period( zone_adc( 90.0 ) );
+        CHECK_EQ( zone_packet( set, 1, reply ), ERR_OK );
+    }
+    CHECK_EQ( reply[1], HPID_STATE_ERROR );
+    CHECK_EQ( reply[2], HPID_ERROR_HEATER_GUARD );
+    CHECK( be16( &reply[6] ) > 8500 );
+    CHECK_EQ( zone_duty(), 0 );
+    CHECK_EQ( zone_fault( &id ), ( 1 << 8 ) | HPID_ERROR_HEATER_GUARD );
+}
+
+static void test_zone_budget( void )
+{
+    /* Both heaters share the supply budget: zone 1 cold and driving flat out gets what zone 0
+     * leaves, and gives way first when zone 0 draws more.  The budget is half of one heater. */
+    uint8_t set[10] = { 1, 1, 0xAC, 0x0D, 0xFC, 0x07, 0x81, 0x01, 0x3E, 0x1C };
+    uint8_t reply[HZONE_REPLY_SIZE];
+    const int32_t half = HEATER_POWER_MAX / 2;
+    uint8_t periods;
+
+    zone_setup();
+    supply_budget_ma = HEATER_CURRENT_MA / 2;
+    zone_period( zone_adc( 22.0 ) );
+    CHECK_EQ( zone_packet( set, 10, reply ), ERR_OK );
+    for ( periods=0; periods<10; periods++ )
+    {
+        zone_period( zone_adc( 22.0 ) );
+        CHECK( zone_duty() <= half + 256 );
+        CHECK( (int32_t)zone_duty() + heater_output_cap <= half + 256 );
+    }
+    CHECK( zone_duty() + 256 >= half );
+    CHECK( heater_output_cap <= 2 );
+
+    /* Zone 0 drawing a quarter: zone 1 cut to the other quarter at the next update */
+    heater_output = HEATER_POWER_MAX / 4;
+    heater_budget_update();
+    CHECK( zone_duty() <= half / 2 + 256 );
+    CHECK( zone_duty() + 256 >= half / 2 - 2 );
+    CHECK( heater_output <= heater_output_cap );
+    CHECK( (int32_t)heater_zone_cap( 1 ) + heater_output <= half );
+    /* Zone 0 not running is turned off by the heater task, and zone 1 takes the half back */
+    zone_period( zone_adc( 22.0 ) );
+    CHECK_EQ( heater_output, 0 );
+    CHECK( zone_duty() + 256 >= half );
+
+    /* No budget, the power limit alone */
+    supply_budget_ma = 0;
+    heater_budget_update();
+    CHECK_EQ( heater_zone_cap( 1 ), HEATER_POWER_MAX );
+    CHECK_EQ( heater_output_cap, HEATER_POWER_MAX );
+}
+
+static void test_zone_report( void )
+{
+    /* Zone 1 on a 0.5 C deadband, sent when it is subscribed and when it moves past that */
+    uint8_t req[5] = { REPORT_SIGNAL_ZONE, 50, 0, 0, 0 };
+    uint8_t cancel = REPORT_CANCEL;
+    uint8_t buf[64];
+    int16_t value;
+    int16_t first;
+    uint8_t periods = 0;
+
+    zone_setup();
+    report_init( REPORT_SIGNALS );
+    zone_period( zone_adc( 22.0 ) );
+    CHECK_EQ( parse_packet( PACKET_TYPE_SUBSCRIBE, req, sizeof(req) ), ERR_OK );
+    CHECK_EQ( drain( buf ), 4 + 1 + REPORT_STATUS_SIZE );
+    CHECK_EQ( buf[4], 1 );
+
+    zone_period( zone_adc( 22.0 ) );
+    spi_deselect();
+    CHECK_EQ( drain( buf ), 4 + REPORT_SIZE_MAX( 1 ) );
+    CHECK_EQ( buf[2], PACKET_TYPE_REPORT );
+    CHECK_EQ( buf[3 + 4], REPORT_SIGNAL_ZONE );
+    memcpy( &first, &buf[3 + 5], sizeof(first) );
+    CHECK( abs( first - 2200 ) <= 2 );
+
+    /* The filtered reading creeps up to 23 C, one REPORT once it is 0.5 C up */
+    while ( spi_write_bytes_written() == 0 )
+    {
+        zone_period( zone_adc( 23.0 ) );
+        periods++;
+        CHECK( periods < 100 );
+    }
+    CHECK( periods > 1 );
+    CHECK_EQ( drain( buf ), 4 + REPORT_SIZE_MAX( 1 ) );
+    memcpy( &value, &buf[3 + 5], sizeof(value) );
+    CHECK( ( value > first + 50 ) && ( value < 2300 ) );
+    zone_period( zone_adc( 23.0 ) );
+    CHECK_EQ( spi_write_bytes_written(), 0 );
+
+    CHECK_EQ( parse_packet( PACKET_TYPE_SUBSCRIBE, &cancel, 1 ), ERR_OK );
+    drain( buf );
+    zone_period( zone_adc( 40.0 ) );
+    CHECK_EQ( spi_write_bytes_written(), 0 );
+}
+
+int main( int argc, char **argv )
+{
+    bench_init( argc, argv );
+
+    RUN_TEST( test_zone_packet );
+    RUN_TEST( test_zone_pid );
+    RUN_TEST( test_zone_stop );
+    RUN_TEST( test_zone_budget );
+    RUN_TEST( test_zone_report );
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,2912 @@
+/*
+ * Pressure and flow board: rio_spi packet framing through spi_handler(), the
+ * rio_time timebase on TMR1, frame sync on INT2, the rio_probe load meter, the I2C
+ * bus counters and recovery, the flow read schedule and sensor flags, the clog and leak watch, the flow estimate between readings,
+ * the overpressure cut-off, update_outputs() closing the pressure loop around a simulated
+ * regulator, the event driven per channel updates and their latency, the warm start of the loops, the resume after a watchdog reset, the flow relay autotune on a simulated chip, and a firmware update through
+ * rio_flash into the dual partition flash model.
+ */
+
+#include <stdlib.h>
+#include "test.h"
+#include "hal.h"
+#include "common.h"
+#include "mcc_generated_files/mcc.h"
+#include "ads1115.h"
+#include "pca9544a.h"
+#include "sensirion_lg16.h"
+#include "i2c_bus.h"
+#include "rio_spi.h"
+#include "rio_time.h"
+#include "rio_stage.h"
+#include "rio_latency.h"
+#include "rio_delta.h"
+#include "rio_probe.h"
+#include "rio_bench.h"
+#include "rio_report.h"
+#include "rio_flash.h"
+#include "rio_fault.h"
+#include "rio_param.h"
+#include "rio_pid.h"
+#include "storage.h"
+#include "protocol.h"
+
+/* From pressure_and_flow_pic/main.c */
+#define PRESSURE_SHL                        3
+#define PRESSURE_CTLR_MBAR                  5000
+#define PPID_SHIFT                          12
+#define PRESSURE_CAL_SPAN_ONE               16384
+#define REPORT_SIGNALS                      ( 2 * NUM_PRESSURE_CLTRLS )
+
+typedef enum
+{
+    ADC_STATE_START,
+    ADC_STATE_SAMPLE,
+    ADC_STATE_WAIT,
+} E_ADC_STATE;
+
+typedef enum
+{
+    CTRL_MODE_ZERO,
+    CTRL_MODE_PRESSURE_OPEN_LOOP,
+    CTRL_MODE_PRESSURE,
+    CTRL_MODE_FLOW,
+    CTRL_MODE_FLOW_CASCADE
+} E_CTRL_MODE;
+
+typedef enum
+{
+    PCAL_STATE_DEFAULT,
+    PCAL_STATE_RUNNING,
+    PCAL_STATE_ABORTED,
+    PCAL_STATE_FINISHED,
+    PCAL_STATE_FAILED
+} E_PCAL_STATE;
+
+extern E_CTRL_MODE ctrl_modes[NUM_PRESSURE_CLTRLS];
+extern volatile int16_t pressure_mbar_shl_actual[NUM_PRESSURE_CLTRLS];
+extern volatile uint16_t pressure_mbar_shl_output[NUM_PRESSURE_CLTRLS];
+extern uint16_t pressure_mbar_shl_target[NUM_PRESSURE_CLTRLS];
+extern volatile E_ADC_STATE adc_state;
+extern volatile bool adc_i2c_wait;
+extern uint8_t adc_cycle_done;
+extern volatile uint32_t frame_sync_count;
+extern volatile uint32_t frame_sync_frame;
+extern volatile uint16_t frame_sync_missed;
+extern uint8_t bench_frame[SPI_PACKET_BUF_SIZE];
+extern uint8_t frame_sync_mode;
+extern uint8_t frame_sync_divider;
+
+void init( void );
+err parse_packet( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size );
+void frame_sync_set( uint8_t mode, uint8_t divider );
+void frame_sync_isr( void );
+void update_outputs( void );
+void update_outputs_ready( bool cycle_end );
+void set_pressures( void );
+extern uint8_t adc_read_pending;
+extern uint8_t flow_read_pending;
+extern uint8_t ctrl_updated;
+err pressure_ctrl_start( uint8_t chan );
+void capture_status_snapshot( void );
+void capture_history( void );
+void push_telemetry( void );
+void push_reports( void );
+uint8_t push_active( void );
+void publish_replies( void );
+void flow_boot_start( void );
+void flow_probe_poll( void );
+void read_flows_start( void );
+void read_flows_poll( void );
+extern uint8_t flow_monitor_div;
+extern bool flow_present[NUM_PRESSURE_CLTRLS];
+extern uint8_t flow_boot_pending;
+extern uint16_t boot_ms;
+extern volatile int16_t flow_raw_actual[NUM_PRESSURE_CLTRLS];
+extern int16_t flow_raw_target[NUM_PRESSURE_CLTRLS];
+extern err flow_read_rc[NUM_PRESSURE_CLTRLS];
+extern pid_config_t fpid_config[NUM_PRESSURE_CLTRLS];
+extern uint16_t flow_ramp_raw[NUM_PRESSURE_CLTRLS];
+extern pid_state_t fpid_loop[NUM_PRESSURE_CLTRLS];
+extern uint8_t flow_flags_gate[NUM_PRESSURE_CLTRLS];
+extern uint16_t flow_flags[NUM_PRESSURE_CLTRLS];
+extern uint16_t flow_air_events[NUM_PRESSURE_CLTRLS];
+extern uint16_t flow_high_events[NUM_PRESSURE_CLTRLS];
+extern uint16_t flow_res_r[NUM_PRESSURE_CLTRLS];
+extern uint16_t flow_res_ref[NUM_PRESSURE_CLTRLS];
+extern uint8_t flow_res_state[NUM_PRESSURE_CLTRLS];
+void flow_res_update( uint8_t chan );
+extern uint8_t flow_est_shift[NUM_PRESSURE_CLTRLS];
+extern int16_t flow_raw_est[NUM_PRESSURE_CLTRLS];
+bool flow_est_valid( uint8_t chan );
+void flow_est_predict( uint8_t chan, int16_t pressure );
+void flow_est_correct( uint8_t chan );
+int16_t flow_loop_actual( uint8_t chan );
+bool flow_loop_input_ok( uint8_t chan );
+err param_set_flow_est_shift( const param_desc_t *param, int32_t value );
+err param_set_flow_res_ref( const param_desc_t *param, int32_t value );
+extern uint16_t pressure_limit_mbar[NUM_PRESSURE_CLTRLS];
+extern uint16_t pressure_trips[NUM_PRESSURE_CLTRLS];
+extern pid_state_t ppid_loop[NUM_PRESSURE_CLTRLS];
+extern uint16_t flow_cascade_setpoint[NUM_PRESSURE_CLTRLS];
+extern uint8_t loop_warm_enable;
+extern uint16_t loop_warm[NUM_PRESSURE_CLTRLS][STORE_WARM_WORDS];
+void set_ctrl_modes( E_CTRL_MODE *ctrl_modes_new );
+extern const uint8_t adc_map[NUM_PRESSURE_CLTRLS];
+extern ads1115_fsr_gain adc_gains[NUM_PRESSURE_CLTRLS];
+extern uint8_t adc_bursts[NUM_PRESSURE_CLTRLS];
+extern volatile uint8_t adc_burst_left;
+extern volatile uint8_t adc_chan;
+void adc_read_start( int8_t read_chan, int8_t start_chan );
+void adc_sample_next( void );
+bool adc_burst_add( uint8_t chan, uint16_t adc_value, uint16_t *average );
+int16_t adc_code_mbar_shl( uint8_t chan, uint16_t adc_value );
+err param_set_adc_burst( const param_desc_t *param, int32_t value );
+void flow_out_map_record( uint8_t chan, int16_t target_raw, uint16_t output );
+int32_t flow_out_map_output( uint8_t chan, int16_t target_raw );
+void pressure_limit_check( uint8_t chan, int16_t pressure );
+err param_set_pressure_limit( const param_desc_t *param, int32_t value );
+extern int16_t pressure_cal_zero[NUM_PRESSURE_CLTRLS];
+extern uint16_t pressure_cal_span[NUM_PRESSURE_CLTRLS];
+extern E_PCAL_STATE pressure_cal_state[NUM_PRESSURE_CLTRLS];
+int16_t pressure_cal_apply( uint8_t chan, int16_t pressure );
+void pressure_cal_sample( uint8_t chan, int16_t pressure );
+err param_set_pressure_cal_zero( const param_desc_t *param, int32_t value );
+int32_t param_get_pressure_cal_trim( const param_desc_t *param );
+err param_set_pressure_cal_trim( const param_desc_t *param, int32_t value );
+err flow_ctrl_start( uint8_t chan, int16_t flow_rate_raw );
+err flow_autotune_start( uint8_t chan, int16_t target_raw, uint16_t delta );
+extern int16_t flow_raw_setpoint[NUM_PRESSURE_CLTRLS];
+extern pid_config_t fpid_sched_config[NUM_PRESSURE_CLTRLS];
+void flow_set_scale( uint8_t chan, uint16_t flow_scale );
+int32_t flow_pid_step( uint8_t chan );
+void storage_startup( void );
+extern uint16_t flow_scales_ul_min[NUM_PRESSURE_CLTRLS];
+extern uint8_t retain[];                    // The retain block, as bytes
+extern uint8_t retain_status;
+void retain_save( void );
+bool retain_restore( uint16_t reset_cause );
+
+/* Regulator: first order lag of REGULATOR_SHR cycles on the commanded pressure */
+#define REGULATOR_SHR                       2
+
+/* Chip: flow raw = pressure mbar << PRESSURE_SHL / 2, behind a first order lag of CHIP_SHR cycles */
+#define CHIP_SHR                            3
+
+#define PACKET_TYPE_TEST                    0x21
+
+/* Sizes on the wire, as the host decodes them, not from protocol.h so they check its layouts */
+#define HISTORY_RECORD_SIZE                 ( 6 + ( NUM_PRESSURE_CLTRLS * 12 ) )
+#define HISTORY_LEN                         64
+#define TELEMETRY_SAMPLE_SIZE               ( 10 + ( NUM_PRESSURE_CLTRLS * 4 ) )
+
+static spi_packet_buf_t packet;
+static uint16_t packet_timer;
+
+static uint16_t crc16( const uint8_t *buf, uint8_t len )
+{
+    /* CRC-16/CCITT-FALSE, bitwise, independent of the rio_spi table */
+    uint16_t crc = 0xFFFF;
+    uint8_t bit;
+
+    while ( len-- )
+    {
+        crc ^= (uint16_t)*buf++ << 8;
+        for ( bit=0; bit<8; bit++ )
+            crc = ( crc & 0x8000 ) ? ( ( crc << 1 ) ^ 0x1021 ) : ( crc << 1 );
+    }
+
+    return crc;
+}
+
+static uint8_t frame( uint8_t *buf, bool crc, uint8_t type, const uint8_t *data, uint8_t size )
+{
+    /* [STX][size][type][data...][checksum U8], or [STX_CRC][size][type][data...][CRC U16 LE] */
+    uint8_t len = 3 + size + ( crc ? 2 : 1 );
+    uint8_t sum = 0;
+    uint16_t crc16_value;
+    uint8_t i;
+
+    buf[0] = crc ? 3 : 2;
+    buf[1] = len;
+    buf[2] = type;
+    memcpy( &buf[3], data, size );
+
+    if ( crc )
+    {
+        crc16_value = crc16( buf, len - 2 );
+        buf[len - 2] = crc16_value & 0xFF;
+        buf[len - 1] = crc16_value >> 8;
+    }
+    else
+    {
+        for ( i=0; i<( len - 1 ); i++ )
+            sum += buf[i];
+        buf[len - 1] = -sum;
+    }
+
+    return len;
+}
+
+static void feed( const uint8_t *buf, uint8_t len )
+{
+    uint8_t byte_out;
+
+    while ( len-- )
+        spi_handler( *buf++, &byte_out );
+}
+
+static void spi_reset( void )
+{
+    spi_init();
+    spi_packet_init( &packet, &packet_timer, 3 );
+}
+
+static void test_spi_packet_read( void )
+{
+    uint8_t data[32];
+    uint8_t buf[48];
+    uint8_t read_data[SPI_PACKET_BUF_SIZE];
+    uint8_t read_type;
+    uint8_t read_size;
+    uint8_t len;
+    uint8_t i;
+    err rc;
+
+    for ( i=0; i<sizeof(data); i++ )
+        data[i] = i * 37 + 1;
+
+    spi_reset();
+
+    /* Nothing received */
+    spi_packet_read( &packet, &read_type, read_data, &read_size, sizeof(read_data) );
+    CHECK_EQ( read_type, 0 );
+
+    /* Checksum and CRC frames of every payload size */
+    for ( i=0; i<=sizeof(data); i++ )
+    {
+        len = frame( buf, ( i & 1 ) != 0, PACKET_TYPE_TEST, data, i );
+        feed( buf, len );
+        rc = spi_packet_read( &packet, &read_type, read_data, &read_size, sizeof(read_data) );
+        CHECK_EQ( rc, ERR_OK );
+        CHECK_EQ( read_type, PACKET_TYPE_TEST );
+        CHECK_EQ( read_size, i );
+        CHECK( memcmp( read_data, data, i ) == 0 );
+    }
+
+    /* A frame split over several calls only completes with its last byte */
+    len = frame( buf, true, PACKET_TYPE_TEST, data, 8 );
+    feed( buf, len - 1 );
+    spi_packet_read( &packet, &read_type, read_data, &read_size, sizeof(read_data) );
+    CHECK_EQ( read_type, 0 );
+    feed( &buf[len - 1], 1 );
+    rc = spi_packet_read( &packet, &read_type, read_data, &read_size, sizeof(read_data) );
+    CHECK_EQ( rc, ERR_OK );
+    CHECK_EQ( read_type, PACKET_TYPE_TEST );
+
+    /* A corrupted frame is dropped, and the good frame after it is still found */
+    len = frame( buf, true, PACKET_TYPE_TEST, data, 8 );
+    buf[5] ^= 0x10;
+    feed( buf, len );
+    len = frame( buf, false, PACKET_TYPE_TEST + 1, data, 4 );
+    feed( buf, len );
+    for ( i=0; i<8; i++ )
+    {
+        rc = spi_packet_read( &packet, &read_type, read_data, &read_size, sizeof(read_data) );
+        if ( read_type != 0 )
+            break;
+    }
+    CHECK_EQ( read_type, PACKET_TYPE_TEST + 1 );
+    CHECK_EQ( read_size, 4 );
+    CHECK( memcmp( read_data, data, 4 ) == 0 );
+}
+
+static void test_spi_packet_write( void )
+{
+    uint8_t data[16];
+    uint8_t buf[32];
+    uint8_t byte_out;
+    uint8_t len;
+    uint8_t i;
+
+    for ( i=0; i<sizeof(data); i++ )
+        data[i] = 0xA0 + i;
+
+    spi_reset();
+
+    /* A reply is framed as the request was, CRC here */
+    len = frame( buf, true, PACKET_TYPE_TEST, data, 0 );
+    feed( buf, len );
+    spi_packet_read( &packet, &i, buf, &len, sizeof(buf) );
+    CHECK_EQ( spi_packet_write( PACKET_TYPE_TEST, data, sizeof(data) ), ERR_OK );
+
+    len = 3 + sizeof(data) + 2;
+    CHECK_EQ( spi_write_bytes_written(), len );
+    /* The first byte goes straight to SPI1BUFL, each exchange after it shifts out the next */
+    buf[0] = SPI1BUFL;
+    for ( i=1; i<len; i++ )
+    {
+        byte_out = 0;
+        spi_handler( 0, &byte_out );
+        buf[i] = byte_out;
+    }
+    CHECK_EQ( buf[0], 3 );
+    CHECK_EQ( buf[1], len );
+    CHECK_EQ( buf[2], PACKET_TYPE_TEST );
+    CHECK( memcmp( &buf[3], data, sizeof(data) ) == 0 );
+    CHECK_EQ( buf[len - 2] | ( buf[len - 1] << 8 ), crc16( buf, len - 2 ) );
+
+    /* A frame goes in the ring whole, behind one still queued, with the port interrupt back on */
+    spi_reset();
+    CHECK_EQ( spi_packet_write( PACKET_TYPE_TEST, data, 2 ), ERR_OK );
+    CHECK_EQ( spi_packet_write( PACKET_TYPE_TEST + 1, &data[2], 2 ), ERR_OK );
+    CHECK_EQ( IEC0bits.CNBIE, 1 );
+    len = 2 * ( 3 + 2 + 1 );
+    CHECK_EQ( spi_write_bytes_written(), len );
+    buf[0] = SPI1BUFL;
+    for ( i=1; i<len; i++ )
+        spi_handler( 0, &buf[i] );
+    CHECK_EQ( buf[0], 2 );
+    CHECK_EQ( buf[6], 2 );
+    CHECK_EQ( buf[8], PACKET_TYPE_TEST + 1 );
+    CHECK( memcmp( &buf[9], &data[2], 2 ) == 0 );
+    CHECK_EQ( (uint8_t)( buf[6] + buf[7] + buf[8] + buf[9] + buf[10] + buf[11] ), 0 );
+}
+
+static void test_spi_reply_ready( void )
+{
+    uint8_t data[4] = { 1, 2, 3, 4 };
+    uint8_t buf[16];
+    uint8_t byte_out;
+    uint8_t len;
+    uint8_t type;
+    uint8_t i;
+
+    spi_reset();
+    CHECK_EQ( spi_reply_ready(), 0 );
+
+    /* Rises once the whole reply is queued, not while it is being built */
+    len = frame( buf, false, PACKET_TYPE_TEST, data, 0 );
+    feed( buf, len );
+    spi_packet_read( &packet, &type, buf, &len, sizeof(buf) );
+    CHECK_EQ( spi_reply_ready(), 0 );
+    CHECK_EQ( spi_packet_write( PACKET_TYPE_TEST, data, sizeof(data) ), ERR_OK );
+    CHECK_EQ( spi_reply_ready(), 1 );
+
+    /* Falls when the host has clocked the last reply byte out */
+    len = spi_write_bytes_written();
+    for ( i=1; i<len; i++ )
+        spi_handler( 0, &byte_out );
+    CHECK_EQ( spi_reply_ready(), 1 );
+    spi_handler( 0, &byte_out );
+    CHECK_EQ( spi_reply_ready(), 0 );
+
+    /* A new request drops it, so it rises again for that request's reply only */
+    CHECK_EQ( spi_packet_write( PACKET_TYPE_TEST, data, sizeof(data) ), ERR_OK );
+    CHECK_EQ( spi_reply_ready(), 1 );
+    len = frame( buf, false, PACKET_TYPE_TEST, data, 0 );
+    feed( buf, len );
+    spi_packet_read( &packet, &type, buf, &len, sizeof(buf) );
+    CHECK_EQ( type, PACKET_TYPE_TEST );
+    CHECK_EQ( spi_reply_ready(), 0 );
+
+    /* Cleared with the write ring */
+    CHECK_EQ( spi_packet_write( PACKET_TYPE_TEST, data, sizeof(data) ), ERR_OK );
+    spi_clear_write();
+    CHECK_EQ( spi_reply_ready(), 0 );
+}
+
+static void test_spi_deselect( void )
+{
+    uint8_t data[8] = { 9, 8, 7, 6, 5, 4, 3, 2 };
+    uint8_t buf[32];
+    uint8_t stats[SPI_STATS_REPORT_SIZE];
+    uint8_t read_data[SPI_PACKET_BUF_SIZE];
+    uint8_t read_type;
+    uint8_t read_size;
+    uint8_t len;
+
+    spi_reset();
+
+    /* A frame cut short by the deselect is dropped there, the next one is read whole */
+    len = frame( buf, true, PACKET_TYPE_TEST, data, sizeof(data) );
+    feed( buf, 5 );
+    spi_deselect();
+    len = frame( buf, false, PACKET_TYPE_TEST + 1, data, 4 );
+    feed( buf, len );
+    spi_packet_read( &packet, &read_type, read_data, &read_size, sizeof(read_data) );
+    CHECK_EQ( read_type, 0 );
+    spi_packet_read( &packet, &read_type, read_data, &read_size, sizeof(read_data) );
+    CHECK_EQ( read_type, PACKET_TYPE_TEST + 1 );
+    CHECK_EQ( read_size, 4 );
+    spi_stats_report( stats, 0 );
+    CHECK_EQ( stats[12] | ( stats[13] << 8 ), 0 );     // packet_invalid, no resync needed
+
+    /* Whole packets before the deselect still count, however late they are read */
+    len = frame( buf, false, PACKET_TYPE_TEST, data, 2 );
+    feed( buf, len );
+    spi_deselect();
+    len = frame( buf, true, PACKET_TYPE_TEST + 1, data, 3 );
+    feed( buf, len );
+    spi_packet_read( &packet, &read_type, read_data, &read_size, sizeof(read_data) );
+    CHECK_EQ( read_type, PACKET_TYPE_TEST );
+    spi_packet_read( &packet, &read_type, read_data, &read_size, sizeof(read_data) );
+    CHECK_EQ( read_type, PACKET_TYPE_TEST + 1 );
+    CHECK_EQ( read_size, 3 );
+
+    /* Replies left in the write ring are stale, unless held */
+    CHECK_EQ( spi_packet_write( PACKET_TYPE_TEST, data, sizeof(data) ), ERR_OK );
+    spi_deselect();
+    CHECK_EQ( spi_write_bytes_written(), 0 );
+    CHECK_EQ( spi_reply_ready(), 0 );
+    spi_write_hold( 1 );
+    CHECK_EQ( spi_packet_write( PACKET_TYPE_TEST, data, sizeof(data) ), ERR_OK );
+    spi_deselect();
+    CHECK( spi_write_bytes_written() > 0 );
+    spi_write_hold( 0 );
+    spi_clear_write();
+}
+
+static uint8_t drain( uint8_t *buf )
+{
+    /* The write ring as the host clocks it out, the first byte already in SPI1BUFL */
+    uint8_t len = spi_write_bytes_written();
+    uint8_t i;
+
+    buf[0] = SPI1BUFL;
+    for ( i=1; i<=len; i++ )
+        spi_handler( 0, &buf[i] );
+    return len;
+}
+
+static void test_reply_cache( void )
+{
+    spi_reply_cache_t cache;
+    uint8_t *slot;
+    uint8_t buf[32];
+    uint8_t len;
+    int16_t actual;
+
+    spi_reset();
+    memset( &cache, 0, sizeof(cache) );
+
+    /* Nothing published yet */
+    CHECK_EQ( spi_reply_cache_write( &cache, PACKET_TYPE_TEST ), ERR_PACKET_INVALID );
+    CHECK_EQ( spi_write_bytes_written(), 0 );
+
+    /* Filled in the idle slot, sent only once published */
+    slot = spi_reply_cache_slot( &cache );
+    slot[0] = ERR_OK;
+    slot[1] = 0x5A;
+    CHECK_EQ( spi_reply_cache_write( &cache, PACKET_TYPE_TEST ), ERR_PACKET_INVALID );
+    spi_reply_cache_publish( &cache, 2 );
+    CHECK( spi_reply_cache_slot( &cache ) != slot );
+    CHECK_EQ( spi_reply_cache_write( &cache, PACKET_TYPE_TEST ), ERR_OK );
+    len = drain( buf );
+    CHECK_EQ( len, 6 );
+    CHECK_EQ( buf[2], PACKET_TYPE_TEST );
+    CHECK_EQ( buf[3], ERR_OK );
+    CHECK_EQ( buf[4], 0x5A );
+
+    /* The board publishes GET_PRESSURE_ACTUAL at the end of a cycle, not when asked */
+    init();
+    spi_reset();
+    pressure_mbar_shl_actual[1] = 1234;
+    capture_status_snapshot();
+    publish_replies();
+    pressure_mbar_shl_actual[1] = 4321;
+    CHECK_EQ( parse_packet( PACKET_TYPE_GET_PRESSURE_ACTUAL, NULL, 0 ), ERR_OK );
+    len = drain( buf );
+    CHECK_EQ( len, 4 + 1 + ( NUM_PRESSURE_CLTRLS * 2 ) );
+    CHECK_EQ( buf[2], PACKET_TYPE_GET_PRESSURE_ACTUAL );
+    memcpy( &actual, &buf[4 + 2], sizeof(actual) );
+    CHECK_EQ( actual, 1234 );
+    pressure_mbar_shl_actual[1] = 0;
+}
+
+static void test_history_stream( void )
+{
+    uint8_t req[4] = { 0, 0, 0xFF, 0xFF };
+    uint8_t buf[SPI_WRITE_BUF_SIZE + 1];
+    uint8_t *frame_ptr;
+    uint16_t received = 0;
+    uint16_t total = 0;
+    uint16_t len;
+    uint8_t frames = 0;
+    uint8_t i;
+    
+    init();
+    spi_reset();
+    for ( i=0; i<5; i++ )
+    {
+        capture_status_snapshot();
+        capture_history();
+    }
+    
+    /* Nothing is written by the handler, the chunks go out from the main loop */
+    CHECK_EQ( parse_packet( PACKET_TYPE_HISTORY_STREAM, req, sizeof(req) ), ERR_OK );
+    CHECK_EQ( spi_write_bytes_written(), 0 );
+    CHECK( spi_stream_active() );
+    
+    /* Queued only while the write ring has room for a whole chunk frame, and read in order */
+    while ( spi_stream_active() && ( frames < 10 ) )
+    {
+        spi_stream_poll();
+        spi_stream_poll();
+        spi_stream_poll();
+        CHECK( spi_write_bytes_written() <= SPI_WRITE_BUF_SIZE );
+        spi_deselect();
+        len = drain( buf );
+        for ( frame_ptr = buf; frame_ptr < &buf[len]; frame_ptr += frame_ptr[1] )
+        {
+            CHECK_EQ( frame_ptr[2], PACKET_TYPE_HISTORY_STREAM );
+            CHECK_EQ( frame_ptr[3], ERR_OK );
+            total = frame_ptr[4] | ( frame_ptr[5] << 8 );
+            CHECK_EQ( frame_ptr[6] | ( frame_ptr[7] << 8 ), received );
+            received += frame_ptr[1] - 4 - 5;
+            frames++;
+        }
+        spi_stream_poll();
+    }
+    CHECK( !spi_stream_active() );
+    CHECK_EQ( total, 5 * HISTORY_RECORD_SIZE );
+    CHECK_EQ( received, total );
+    CHECK_EQ( frames, ( total + ( ( SPI_STREAM_CHUNK_SIZE / HISTORY_RECORD_SIZE ) * HISTORY_RECORD_SIZE ) - 1 ) / ( ( SPI_STREAM_CHUNK_SIZE / HISTORY_RECORD_SIZE ) * HISTORY_RECORD_SIZE ) );
+    
+    /* Records overwritten before they are sent: the chunk carries total = offset, the end */
+    CHECK_EQ( parse_packet( PACKET_TYPE_HISTORY_STREAM, req, sizeof(req) ), ERR_OK );
+    spi_stream_poll();
+    drain( buf );
+    for ( i=0; i<64; i++ )
+    {
+        capture_status_snapshot();
+        capture_history();
+    }
+    spi_stream_poll();
+    len = drain( buf );
+    CHECK_EQ( len, 4 + 5 );
+    CHECK_EQ( buf[4] | ( buf[5] << 8 ), buf[6] | ( buf[7] << 8 ) );
+    spi_stream_poll();
+    CHECK( !spi_stream_active() );
+    
+    /* A new request ends a stream the host gave up on */
+    CHECK_EQ( parse_packet( PACKET_TYPE_HISTORY_STREAM, req, sizeof(req) ), ERR_OK );
+    spi_stream_poll();
+    spi_clear_write();
+    CHECK( !spi_stream_active() );
+}
+
+static uint8_t delta_decode( const uint8_t *buf, uint16_t *prev, uint8_t count )
+{
+    /* The host's side of rio_delta: updates <prev> to the record, returns its size */
+    const uint8_t *buf_ptr = &buf[1 + DELTA_MASK_SIZE( count )];
+    uint16_t zz;
+    uint8_t shift;
+    uint8_t w;
+
+    if ( buf[0] & DELTA_FLAG_KEY )
+        memset( prev, 0, count * sizeof(uint16_t) );
+    for ( w=0; w<count; w++ )
+    {
+        if ( !( buf[1 + ( w >> 3 )] & ( 1 << ( w & 7 ) ) ) )
+            continue;
+        zz = 0;
+        shift = 0;
+        do
+        {
+            zz |= (uint16_t)( *buf_ptr & 0x7F ) << shift;
+            shift += 7;
+        } while ( *buf_ptr++ & 0x80 );
+        prev[w] += ( zz >> 1 ) ^ ( ( zz & 1 ) ? 0xFFFF : 0 );
+    }
+
+    return buf_ptr - buf;
+}
+
+static void test_delta( void )
+{
+    delta_coder_t coder;
+    uint16_t prev[12];
+    uint16_t words[12];
+    uint16_t decoded[12];
+    uint8_t buf[DELTA_RECORD_MAX( 12 )];
+    uint8_t size;
+    uint8_t i;
+    uint8_t w;
+
+    for ( w=0; w<12; w++ )
+        words[w] = 1000 * w;
+    memset( decoded, 0x55, sizeof(decoded) );
+
+    /* The first record is a keyframe, decodable from nothing */
+    delta_init( &coder, prev, 12, 4 );
+    size = delta_encode( &coder, words, buf );
+    CHECK_EQ( buf[0], DELTA_FLAG_KEY );
+    CHECK_EQ( delta_decode( buf, decoded, 12 ), size );
+    CHECK( memcmp( decoded, words, sizeof(words) ) == 0 );
+
+    /* Unchanged words cost a mask bit, small changes either way a byte, wraps are small */
+    words[1] += 5;
+    words[2] -= 60;
+    words[0] = 0xFFFF;
+    words[11] = 0x8000;
+    size = delta_encode( &coder, words, buf );
+    CHECK_EQ( buf[0], 0 );
+    CHECK_EQ( size, 1 + 2 + 1 + 1 + 1 + 3 );
+    CHECK_EQ( delta_decode( buf, decoded, 12 ), size );
+    CHECK( memcmp( decoded, words, sizeof(words) ) == 0 );
+    words[0] = 0;
+    size = delta_encode( &coder, words, buf );
+    CHECK_EQ( size, 1 + 2 + 1 );
+    delta_decode( buf, decoded, 12 );
+    CHECK( memcmp( decoded, words, sizeof(words) ) == 0 );
+
+    /* A keyframe every key_every records, and on request */
+    size = delta_encode( &coder, words, buf );
+    CHECK_EQ( size, 1 + 2 );
+    CHECK_EQ( buf[0], 0 );
+    delta_encode( &coder, words, buf );
+    CHECK_EQ( buf[0], DELTA_FLAG_KEY );
+    delta_encode( &coder, words, buf );
+    CHECK_EQ( buf[0], 0 );
+    delta_key( &coder );
+    delta_encode( &coder, words, buf );
+    CHECK_EQ( buf[0], DELTA_FLAG_KEY );
+
+    /* Any words, any order: the decoder follows */
+    srand( 87 );
+    for ( i=0; i<200; i++ )
+    {
+        for ( w=0; w<12; w++ )
+        {
+            if ( rand() & 1 )
+                words[w] += ( rand() & 3 ) ? ( rand() % 64 ) - 32 : rand();
+        }
+        size = delta_encode( &coder, words, buf );
+        CHECK( size <= DELTA_RECORD_MAX( 12 ) );
+        CHECK_EQ( delta_decode( buf, decoded, 12 ), size );
+        CHECK( memcmp( decoded, words, sizeof(words) ) == 0 );
+    }
+}
+
+static void test_telemetry_compact( void )
+{
+    uint8_t req[2] = { 1, 1 };
+    uint8_t buf[SPI_WRITE_BUF_SIZE + 1];
+    uint8_t plain[TELEMETRY_SAMPLE_SIZE];
+    uint16_t words[TELEMETRY_SAMPLE_SIZE / 2];
+    uint8_t chan;
+    uint8_t i;
+
+    init();
+    spi_reset();
+    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+        pressure_mbar_shl_actual[chan] = 1000 + chan;
+    capture_status_snapshot();
+
+    /* A plain sample, then the same as a compact keyframe */
+    req[1] = 0;
+    CHECK_EQ( parse_packet( PACKET_TYPE_SET_TELEMETRY, req, 1 ), ERR_OK );
+    spi_clear_write();
+    push_telemetry();
+    spi_deselect();
+    drain( buf );
+    CHECK_EQ( buf[2], PACKET_TYPE_TELEMETRY_SAMPLE );
+    memcpy( plain, &buf[3], sizeof(plain) );
+
+    req[1] = 1;
+    CHECK_EQ( parse_packet( PACKET_TYPE_SET_TELEMETRY, req, 2 ), ERR_OK );
+    spi_clear_write();
+    push_telemetry();
+    spi_deselect();
+    drain( buf );
+    CHECK_EQ( buf[2], PACKET_TYPE_TELEMETRY_COMPACT );
+    CHECK_EQ( delta_decode( &buf[3], words, TELEMETRY_SAMPLE_SIZE / 2 ), buf[1] - 4 );
+    CHECK( memcmp( words, plain, sizeof(plain) ) == 0 );     // Little endian host
+
+    /* The next cycle changes the seq, time and one pressure: a third of a plain sample */
+    for ( i=0; i<3; i++ )
+    {
+        pressure_mbar_shl_actual[2] += 3;
+        capture_status_snapshot();
+        push_telemetry();
+        spi_deselect();
+        drain( buf );
+        CHECK_EQ( buf[2], PACKET_TYPE_TELEMETRY_COMPACT );
+        CHECK_EQ( delta_decode( &buf[3], words, TELEMETRY_SAMPLE_SIZE / 2 ), buf[1] - 4 );
+        CHECK_EQ( (int16_t)words[5 + 2], 1002 + ( 3 * ( i + 1 ) ) );
+        CHECK( ( buf[1] - 4 ) < ( TELEMETRY_SAMPLE_SIZE / 2 ) );
+    }
+
+    req[1] = 2;
+    CHECK_EQ( parse_packet( PACKET_TYPE_SET_TELEMETRY, req, 2 ), ERR_PACKET_INVALID );
+    req[0] = 0;
+    req[1] = 0;
+    CHECK_EQ( parse_packet( PACKET_TYPE_SET_TELEMETRY, req, 1 ), ERR_OK );
+    spi_clear_write();
+    pressure_mbar_shl_actual[2] = 0;
+}
+
+static void test_report( void )
+{
+    /* Pressure 1 on a deadband of 8 LSB, flow 0 on a 100 ms interval alone */
+    uint8_t req[10] = { 1, 8, 0, 0, 0, NUM_PRESSURE_CLTRLS, 0xFF, 0xFF, 100, 0 };
+    uint8_t bad_req[10] = { 2, 0, 0, 0, 0, REPORT_SIGNALS, 0, 0, 0, 0 };
+    uint8_t off_req[5] = { 1, 0xFF, 0xFF, 0, 0 };
+    uint8_t cancel = REPORT_CANCEL;
+    uint8_t filler[100];
+    uint8_t buf[SPI_WRITE_BUF_SIZE + 1];
+    uint16_t count;
+    int16_t value;
+    uint8_t chan;
+    uint8_t i;
+
+    init();
+    spi_reset();
+    time_init();
+    TMR1 = 0;
+    IFS0bits.T1IF = 0;
+    report_init( REPORT_SIGNALS );
+    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+        pressure_mbar_shl_actual[chan] = 1000 + chan;
+    capture_status_snapshot();
+
+    /* Nothing subscribed, nothing pushed */
+    push_reports();
+    CHECK_EQ( spi_write_bytes_written(), 0 );
+
+    /* A bad signal or size refuses the lot */
+    CHECK_EQ( parse_packet( PACKET_TYPE_SUBSCRIBE, bad_req, sizeof(bad_req) ), ERR_PACKET_INVALID );
+    CHECK_EQ( parse_packet( PACKET_TYPE_SUBSCRIBE, req, 4 ), ERR_PACKET_INVALID );
+    CHECK_EQ( parse_packet( PACKET_TYPE_SUBSCRIBE, req, 1 ), ERR_PACKET_INVALID );
+    CHECK( !push_active() );
+
+    CHECK_EQ( parse_packet( PACKET_TYPE_SUBSCRIBE, req, sizeof(req) ), ERR_OK );
+    CHECK_EQ( drain( buf ), 4 + 1 + REPORT_STATUS_SIZE );
+    CHECK_EQ( buf[2], PACKET_TYPE_SUBSCRIBE );
+    CHECK_EQ( buf[3], ERR_OK );
+    CHECK_EQ( buf[4], 2 );
+    CHECK( push_active() );
+
+    /* Both sent at once, the host has no value yet */
+    push_reports();
+    spi_deselect();
+    CHECK_EQ( drain( buf ), 4 + REPORT_SIZE_MAX( 2 ) );
+    CHECK_EQ( buf[2], PACKET_TYPE_REPORT );
+    CHECK_EQ( buf[3 + 4], 1 );
+    memcpy( &value, &buf[3 + 5], sizeof(value) );
+    CHECK_EQ( value, 1001 );
+    CHECK_EQ( buf[3 + 7], NUM_PRESSURE_CLTRLS );
+    memcpy( &value, &buf[3 + 8], sizeof(value) );
+    CHECK_EQ( value, 0 );
+
+    /* Unchanged, or moved up to the deadband from the value sent, nothing */
+    for ( i=0; i<8; i++ )
+    {
+        pressure_mbar_shl_actual[1]++;
+        pressure_mbar_shl_actual[2] += 100;     // Not subscribed
+        capture_status_snapshot();
+        push_reports();
+        CHECK_EQ( spi_write_bytes_written(), 0 );
+    }
+    pressure_mbar_shl_actual[1]++;
+    capture_status_snapshot();
+    push_reports();
+    spi_deselect();
+    CHECK_EQ( drain( buf ), 4 + REPORT_SIZE_MAX( 1 ) );
+    CHECK_EQ( buf[3 + 4], 1 );
+    memcpy( &value, &buf[3 + 5], sizeof(value) );
+    CHECK_EQ( value, 1010 );
+
+    /* The flow on its interval alone */
+    for ( i=0; i<99; i++ )
+        time_tick();
+    push_reports();
+    CHECK_EQ( spi_write_bytes_written(), 0 );
+    time_tick();
+    push_reports();
+    CHECK_EQ( drain( buf ), 4 + REPORT_SIZE_MAX( 1 ) );
+    CHECK_EQ( buf[3 + 4], NUM_PRESSURE_CLTRLS );
+
+    /* No room left for replies: dropped, then sent once the host has drained the ring */
+    memset( filler, 0, sizeof(filler) );
+    spi_packet_write( PACKET_TYPE_GET_ID, filler, sizeof(filler) );
+    spi_packet_write( PACKET_TYPE_GET_ID, filler, sizeof(filler) );
+    pressure_mbar_shl_actual[1] -= 20;
+    capture_status_snapshot();
+    push_reports();
+    CHECK_EQ( spi_write_bytes_written(), 2 * ( 4 + sizeof(filler) ) );
+    spi_clear_write();
+    push_reports();
+    CHECK_EQ( drain( buf ), 4 + REPORT_SIZE_MAX( 1 ) );
+    memcpy( &value, &buf[3 + 5], sizeof(value) );
+    CHECK_EQ( value, 990 );
+
+    /* Reports and drops counted, one signal off, then all */
+    CHECK_EQ( parse_packet( PACKET_TYPE_SUBSCRIBE, off_req, sizeof(off_req) ), ERR_OK );
+    CHECK_EQ( drain( buf ), 4 + 1 + REPORT_STATUS_SIZE );
+    CHECK_EQ( buf[4], 1 );
+    memcpy( &count, &buf[5], sizeof(count) );
+    CHECK_EQ( count, 4 );
+    memcpy( &count, &buf[7], sizeof(count) );
+    CHECK_EQ( count, 1 );
+    CHECK_EQ( parse_packet( PACKET_TYPE_SUBSCRIBE, &cancel, 1 ), ERR_OK );
+    drain( buf );
+    CHECK_EQ( buf[4], 0 );
+    CHECK( !push_active() );
+    for ( i=0; i<200; i++ )
+        time_tick();
+    push_reports();
+    CHECK_EQ( spi_write_bytes_written(), 0 );
+}
+
+static uint16_t history_stream_read( uint8_t format, uint8_t *data )
+{
+    /* The data of a whole HISTORY_STREAM of every record kept */
+    uint8_t req[5] = { 0, 0, 0xFF, 0xFF, format };
+    uint8_t buf[SPI_WRITE_BUF_SIZE + 1];
+    uint8_t *frame_ptr;
+    uint16_t received = 0;
+    uint16_t len;
+
+    CHECK_EQ( parse_packet( PACKET_TYPE_HISTORY_STREAM, req, sizeof(req) ), ERR_OK );
+    while ( spi_stream_active() )
+    {
+        spi_stream_poll();
+        spi_deselect();
+        len = drain( buf );
+        for ( frame_ptr = buf; frame_ptr < &buf[len]; frame_ptr += frame_ptr[1] )
+        {
+            memcpy( &data[received], &frame_ptr[3 + 5], frame_ptr[1] - 4 - 5 );
+            received += frame_ptr[1] - 4 - 5;
+        }
+    }
+
+    return received;
+}
+
+static void test_history_stream_compact( void )
+{
+    static uint8_t plain[HISTORY_LEN * HISTORY_RECORD_SIZE];
+    static uint8_t compact[HISTORY_LEN * DELTA_RECORD_MAX( HISTORY_RECORD_SIZE / 2 )];
+    uint16_t words[HISTORY_RECORD_SIZE / 2];
+    uint8_t bad_req[5] = { 0, 0, 0xFF, 0xFF, 2 };
+    uint16_t plain_size;
+    uint16_t compact_size;
+    uint16_t pos = 0;
+    uint8_t records = 0;
+    uint8_t i;
+
+    init();
+    spi_reset();
+    for ( i=0; i<20; i++ )
+    {
+        pressure_mbar_shl_actual[0] = 800 + ( i & 3 );
+        capture_status_snapshot();
+        capture_history();
+    }
+
+    /* The same records, decoded from a byte stream that splits them across chunks */
+    plain_size = history_stream_read( 0, plain );
+    CHECK_EQ( plain_size, 20 * HISTORY_RECORD_SIZE );
+    compact_size = history_stream_read( 1, compact );
+    CHECK( compact_size < ( plain_size / 3 ) );
+    while ( pos < compact_size )
+    {
+        CHECK_EQ( compact[pos] & DELTA_FLAG_KEY, ( records == 0 ) );
+        pos += delta_decode( &compact[pos], words, HISTORY_RECORD_SIZE / 2 );
+        CHECK( memcmp( words, &plain[records * HISTORY_RECORD_SIZE], HISTORY_RECORD_SIZE ) == 0 );
+        records++;
+    }
+    CHECK_EQ( pos, compact_size );
+    CHECK_EQ( records, 20 );
+
+    /* An unknown format is refused */
+    CHECK_EQ( parse_packet( PACKET_TYPE_HISTORY_STREAM, bad_req, sizeof(bad_req) ), ERR_PACKET_INVALID );
+    CHECK( !spi_stream_active() );
+    pressure_mbar_shl_actual[0] = 0;
+}
+
+static void test_capabilities( void )
+{
+    uint8_t buf[40];
+    uint8_t *caps = &buf[4];
+    uint8_t *types = &caps[SPI_CAPS_REPORT_SIZE - ( SPI_CAPS_TYPES / 8 )];
+    uint8_t history_req[2] = { 0, 0 };
+    
+    init();
+    spi_reset();
+    
+    /* Out of the table, or a size outside the row's bounds: refused before any handler */
+    CHECK_EQ( parse_packet( 0, NULL, 0 ), ERR_PACKET_INVALID );
+    CHECK_EQ( parse_packet( PACKET_TYPE_GET_LATENCY_STATS + 1, NULL, 0 ), ERR_PACKET_INVALID );
+    CHECK_EQ( parse_packet( PACKET_TYPE_GET_HISTORY, history_req, sizeof(history_req) ), ERR_PACKET_INVALID );
+    CHECK_EQ( parse_packet( PACKET_TYPE_GET_CAPABILITIES, history_req, 1 ), ERR_PACKET_INVALID );
+    CHECK_EQ( spi_write_bytes_written(), 0 );
+    
+    CHECK_EQ( parse_packet( PACKET_TYPE_GET_CAPABILITIES, NULL, 0 ), ERR_OK );
+    CHECK_EQ( drain( buf ), 4 + 1 + SPI_CAPS_REPORT_SIZE );
+    CHECK_EQ( buf[2], PACKET_TYPE_GET_CAPABILITIES );
+    CHECK_EQ( buf[3], ERR_OK );
+    CHECK_EQ( caps[2], SPI_PROTOCOL_VERSION );
+    CHECK_EQ( caps[3], SPI_CRC_MODE );
+    CHECK_EQ( caps[4] | ( caps[5] << 8 ), SPI_PACKET_BUF_SIZE );
+    CHECK_EQ( caps[6] | ( caps[7] << 8 ), SPI_WRITE_BUF_SIZE );
+    CHECK_EQ( caps[8] | ( caps[9] << 8 ), SPI_BATCH_BUF_SIZE );
+    CHECK_EQ( caps[10] | ( caps[11] << 8 ) | ( (uint32_t)caps[12] << 16 ), 100000 );
+    
+    /* Types 1 to 49 except 16, TELEMETRY_SAMPLE, 44, TELEMETRY_COMPACT, and 48, REPORT, which only the board sends */
+    CHECK_EQ( types[0], 0xFE );
+    CHECK_EQ( types[1], 0xFF );
+    CHECK_EQ( types[2], 0xFE );
+    CHECK_EQ( types[3], 0xFF );
+    CHECK_EQ( types[4], 0xFF );
+    CHECK_EQ( types[5], 0xEF );
+    CHECK_EQ( types[6], 0x02 );
+    CHECK_EQ( types[7], 0 );
+}
+
+static void test_benchmark( void )
+{
+    uint8_t buf[40];
+    uint8_t *report = &buf[4];
+    uint8_t req[3] = { BENCH_FRAME_CRC, 10, 0 };
+    uint32_t value;
+    uint16_t crc;
+    
+    init();
+    spi_reset();
+    
+    /* A kernel past the board's, or runs outside 1 to BENCH_RUNS_MAX, is refused */
+    req[0] = BENCH_COUNT;
+    CHECK_EQ( parse_packet( PACKET_TYPE_BENCHMARK, req, sizeof(req) ), ERR_PACKET_INVALID );
+    req[0] = BENCH_FRAME_CRC;
+    req[1] = 0;
+    CHECK_EQ( parse_packet( PACKET_TYPE_BENCHMARK, req, sizeof(req) ), ERR_PACKET_INVALID );
+    req[1] = ( BENCH_RUNS_MAX + 1 ) & 0xFF;
+    req[2] = ( BENCH_RUNS_MAX + 1 ) >> 8;
+    CHECK_EQ( parse_packet( PACKET_TYPE_BENCHMARK, req, sizeof(req) ), ERR_PACKET_INVALID );
+    CHECK_EQ( spi_write_bytes_written(), 0 );
+    
+    req[1] = 10;
+    req[2] = 0;
+    CHECK_EQ( parse_packet( PACKET_TYPE_BENCHMARK, req, sizeof(req) ), ERR_OK );
+    CHECK_EQ( drain( buf ), 4 + 1 + BENCH_REPORT_SIZE );
+    CHECK_EQ( buf[3], ERR_OK );
+    CHECK_EQ( report[0], BENCH_COUNT );
+    CHECK_EQ( report[1], BENCH_FRAME_CRC );
+    CHECK_EQ( report[2] | ( report[3] << 8 ), 10 );
+    memcpy( &value, &report[4], sizeof(value) );
+    CHECK_EQ( value, PROBE_PORT_TIMER_HZ );
+    memcpy( &value, &report[8], sizeof(value) );
+    CHECK_EQ( value, 75000000UL );
+    
+    /* The kernel checks the whole frame as spi_packet_peek() would */
+    bench_frame_crc();
+    crc = crc16( bench_frame, SPI_PACKET_BUF_SIZE - 2 );
+    bench_frame[SPI_PACKET_BUF_SIZE - 2] = crc & 0xFF;
+    bench_frame[SPI_PACKET_BUF_SIZE - 1] = crc >> 8;
+    CHECK_EQ( spi_frame_check( bench_frame ), 0 );
+    bench_frame[SPI_PACKET_BUF_SIZE / 2] ^= 1;
+    CHECK( spi_frame_check( bench_frame ) != 0 );
+    bench_frame[SPI_PACKET_BUF_SIZE / 2] ^= 1;
+}
+
+static void test_boot_status( void )
+{
+    uint8_t buf[16];
+    uint16_t i;
+    
+    init();
+    spi_reset();
+    fault_init( &timer_ms, 1000, false, 0 );
+    
+    /* Nothing on the I2C bus: every start-up probe fails its first step */
+    hal_i2c_device = NULL;
+    flow_boot_start();
+    CHECK_EQ( parse_packet( PACKET_TYPE_GET_BOOT_STATUS, NULL, 0 ), ERR_OK );
+    CHECK_EQ( drain( buf ), 4 + 5 );
+    CHECK_EQ( buf[3], ERR_OK );
+    CHECK_EQ( buf[4], 1 );
+    CHECK_EQ( buf[5], 0 );
+    CHECK_EQ( buf[6] | ( buf[7] << 8 ), 0 );
+    
+    /* One probe step per pass, never waiting on the bus */
+    for ( i=0; ( i<100 ) && flow_boot_pending; i++ )
+    {
+        flow_probe_poll();
+        timer_ms++;
+    }
+    CHECK_EQ( flow_boot_pending, 0 );
+    CHECK( i <= 2 * NUM_PRESSURE_CLTRLS );
+    CHECK( boot_ms != 0 );
+    CHECK( !flow_present[0] );
+    
+    CHECK_EQ( parse_packet( PACKET_TYPE_GET_BOOT_STATUS, NULL, 0 ), ERR_OK );
+    CHECK_EQ( drain( buf ), 4 + 5 );
+    CHECK_EQ( buf[4], 0 );
+    CHECK_EQ( buf[5], 0 );
+    CHECK_EQ( buf[6] | ( buf[7] << 8 ), boot_ms );
+}
+
+static void test_time_sync( void )
+{
+    uint8_t data[5];
+    uint8_t report[TIME_REPORT_SIZE];
+    uint32_t value;
+    uint16_t syncs;
+
+    time_init();
+    TMR1 = 0;
+    IFS0bits.T1IF = 0;
+
+    /* Whole 1 ms ticks plus 8 us per TMR1 count */
+    time_tick();
+    time_tick();
+    TMR1 = 62;
+    CHECK_EQ( time_local_us(), 2496 );
+    CHECK_EQ( time_now_us(), 2496 );
+
+    /* TMR1 wrapped with the tick interrupt still pending */
+    TMR1 = 3;
+    IFS0bits.T1IF = 1;
+    CHECK_EQ( time_local_us(), 3024 );
+    IFS0bits.T1IF = 0;
+    time_tick();
+    CHECK_EQ( time_local_us(), 3024 );
+
+    /* Set to the host time, just before the 32-bit wrap, then step back 100 us */
+    data[0] = TIME_SYNC_SET;
+    value = 0xFFFFFF00;
+    memcpy( &data[1], &value, sizeof(value) );
+    CHECK_EQ( time_sync( data, sizeof(data) ), ERR_OK );
+    CHECK_EQ( time_now_us(), 0xFFFFFF00 );
+    time_tick();
+    CHECK_EQ( time_now_us(), (uint32_t)( 0xFFFFFF00 + 1000 ) );
+    CHECK_EQ( time_local_us(), 4024 );
+
+    data[0] = TIME_SYNC_ADJUST;
+    value = (uint32_t)-100;
+    memcpy( &data[1], &value, sizeof(value) );
+    CHECK_EQ( time_sync( data, sizeof(data) ), ERR_OK );
+    CHECK_EQ( time_now_us(), 900 - 0x100 );
+
+    /* Reads leave the clock, bad modes and sizes are refused */
+    CHECK_EQ( time_sync( data, 0 ), ERR_OK );
+    data[0] = 2;
+    CHECK_EQ( time_sync( data, sizeof(data) ), ERR_PACKET_INVALID );
+    CHECK_EQ( time_sync( data, 4 ), ERR_PACKET_INVALID );
+    CHECK_EQ( time_now_us(), 900 - 0x100 );
+
+    time_report( report );
+    memcpy( &value, &report[0], sizeof(value) );
+    CHECK_EQ( value, 900 - 0x100 );
+    memcpy( &value, &report[4], sizeof(value) );
+    CHECK_EQ( value, 4024 );
+    memcpy( &syncs, &report[8], sizeof(syncs) );
+    CHECK_EQ( syncs, 2 );
+
+    TMR1 = 0;
+}
+
+static void test_frame_sync( void )
+{
+    init();
+    adc_state = ADC_STATE_WAIT;
+    adc_i2c_wait = 0;
+    adc_cycle_done = 0;
+
+    /* Rising edges, every second one starts a cycle */
+    frame_sync_set( 1, 2 );
+    CHECK_EQ( _INT2IE, 1 );
+    CHECK_EQ( _INT2EP, 0 );
+    frame_sync_isr();
+    CHECK_EQ( frame_sync_count, 1 );
+    CHECK_EQ( frame_sync_frame, 0 );
+    frame_sync_isr();
+    CHECK_EQ( frame_sync_frame, 2 );
+
+    /* The main loop has not started frame 2 yet, so frame 4 is missed */
+    frame_sync_isr();
+    frame_sync_isr();
+    CHECK_EQ( frame_sync_frame, 2 );
+    CHECK_EQ( frame_sync_missed, 1 );
+
+    /* Nor while a cycle samples or waits for its outputs */
+    frame_sync_frame = 0;
+    adc_state = ADC_STATE_SAMPLE;
+    frame_sync_isr();
+    frame_sync_isr();
+    adc_state = ADC_STATE_WAIT;
+    adc_cycle_done = 1;
+    frame_sync_isr();
+    frame_sync_isr();
+    CHECK_EQ( frame_sync_frame, 0 );
+    CHECK_EQ( frame_sync_missed, 3 );
+    adc_cycle_done = 0;
+    frame_sync_isr();
+    frame_sync_isr();
+    CHECK_EQ( frame_sync_frame, 10 );
+
+    /* Setting again restarts the count, off holds INT2 off */
+    frame_sync_set( 2, 1 );
+    CHECK_EQ( _INT2EP, 1 );
+    CHECK_EQ( frame_sync_count, 0 );
+    CHECK_EQ( frame_sync_frame, 0 );
+    CHECK_EQ( frame_sync_missed, 0 );
+    frame_sync_isr();
+    CHECK_EQ( frame_sync_frame, 1 );
+    frame_sync_set( 0, 1 );
+    CHECK_EQ( _INT2IE, 0 );
+}
+
+static uint8_t stage_build( uint8_t *buf, uint32_t apply_us, uint8_t type, uint8_t mode, uint8_t divider )
+{
+    /* STAGE data for SET_FRAME_SYNC, [apply time us U32][type U8][mode U8][divider U8] */
+    memcpy( &buf[0], &apply_us, sizeof(apply_us) );
+    buf[4] = type;
+    buf[5] = mode;
+    buf[6] = divider;
+
+    return STAGE_HEADER_SIZE + 2;
+}
+
+static void test_stage( void )
+{
+    uint8_t data[STAGE_HEADER_SIZE + STAGE_DATA_MAX + 1];
+    uint8_t report[STAGE_REPORT_SIZE];
+    uint8_t size;
+    uint8_t i;
+    uint16_t count;
+    int32_t error_us;
+
+    init();
+    spi_reset();
+    time_init();
+    TMR1 = 0;
+    IFS0bits.T1IF = 0;
+    stage_init( parse_packet, PACKET_TYPE_BATCH, PACKET_TYPE_STAGE );
+    frame_sync_set( 0, 1 );
+
+    /* Two packets for 5 ms, the later one staged wins */
+    size = stage_build( data, 5000, PACKET_TYPE_SET_FRAME_SYNC, 1, 2 );
+    CHECK_EQ( stage_packet( data, size ), ERR_OK );
+    size = stage_build( data, 5000, PACKET_TYPE_SET_FRAME_SYNC, 2, 3 );
+    CHECK_EQ( stage_packet( data, size ), ERR_OK );
+
+    for ( i=0; i<4; i++ )
+        time_tick();
+    TMR1 = 124;
+    stage_poll();
+    CHECK_EQ( frame_sync_mode, 0 );
+    stage_report( report );
+    CHECK_EQ( report[0], 2 );
+
+    /* Due 8 us after its time, the replies go nowhere */
+    TMR1 = 126;
+    stage_poll();
+    CHECK_EQ( frame_sync_mode, 2 );
+    CHECK_EQ( frame_sync_divider, 3 );
+    CHECK_EQ( spi_write_bytes_written(), 0 );
+    stage_report( report );
+    CHECK_EQ( report[0], 0 );
+    memcpy( &count, &report[1], sizeof(count) );
+    CHECK_EQ( count, 2 );
+    memcpy( &count, &report[3], sizeof(count) );
+    CHECK_EQ( count, 0 );
+    memcpy( &error_us, &report[7], sizeof(error_us) );
+    CHECK_EQ( error_us, 8 );
+
+    /* Refused by the parser when run, and late */
+    size = stage_build( data, 0, PACKET_TYPE_SET_FRAME_SYNC, 9, 1 );
+    CHECK_EQ( stage_packet( data, size ), ERR_OK );
+    stage_poll();
+    CHECK_EQ( frame_sync_mode, 2 );
+    stage_report( report );
+    memcpy( &count, &report[3], sizeof(count) );
+    CHECK_EQ( count, 1 );
+    memcpy( &count, &report[5], sizeof(count) );
+    CHECK_EQ( count, 1 );
+
+    /* Cancel drops what is pending */
+    size = stage_build( data, 9000, PACKET_TYPE_SET_FRAME_SYNC, 1, 1 );
+    CHECK_EQ( stage_packet( data, size ), ERR_OK );
+    data[0] = STAGE_CANCEL;
+    CHECK_EQ( stage_packet( data, 1 ), ERR_OK );
+    for ( i=0; i<5; i++ )
+        time_tick();
+    stage_poll();
+    CHECK_EQ( frame_sync_mode, 2 );
+
+    /* Batches, stages and protocol packets can not be staged, nor too much data, nor more than the slots */
+    CHECK_EQ( stage_packet( data, 2 ), ERR_PACKET_INVALID );
+    data[0] = 1;
+    CHECK_EQ( stage_packet( data, 1 ), ERR_PACKET_INVALID );
+    size = stage_build( data, 20000, PACKET_TYPE_BATCH, 1, 1 );
+    CHECK_EQ( stage_packet( data, size ), ERR_PACKET_INVALID );
+    size = stage_build( data, 20000, PACKET_TYPE_STAGE, 1, 1 );
+    CHECK_EQ( stage_packet( data, size ), ERR_PACKET_INVALID );
+    size = stage_build( data, 20000, SPI_PACKET_TYPE_PROTOCOL, 1, 1 );
+    CHECK_EQ( stage_packet( data, size ), ERR_PACKET_INVALID );
+    size = stage_build( data, 20000, PACKET_TYPE_SET_FRAME_SYNC, 1, 1 );
+    CHECK_EQ( stage_packet( data, sizeof(data) ), ERR_PACKET_INVALID );
+    for ( i=0; i<STAGE_SLOTS; i++ )
+        CHECK_EQ( stage_packet( data, size ), ERR_OK );
+    CHECK_EQ( stage_packet( data, size ), ERR_PACKET_INVALID );
+
+    stage_init( parse_packet, PACKET_TYPE_BATCH, PACKET_TYPE_STAGE );
+    TMR1 = 0;
+}
+
+static int16_t regulator_step( int16_t actual, uint16_t output )
+{
+    return actual + ( ( (int32_t)output - actual ) >> REGULATOR_SHR );
+}
+
+static uint16_t pressure_settle( uint16_t target_mbar, uint16_t cycles )
+{
+    /* Cycles until channel 0 stays within +-1 mbar of <target_mbar>, 0 if it never does */
+    uint16_t cycle;
+    uint16_t settled = 0;
+    int16_t error;
+
+    pressure_mbar_shl_target[0] = (uint16_t)target_mbar << PRESSURE_SHL;
+    for ( cycle=1; cycle<=cycles; cycle++ )
+    {
+        update_outputs();
+        CHECK( pressure_mbar_shl_output[0] <= ( (uint16_t)PRESSURE_CTLR_MBAR << PRESSURE_SHL ) );
+        pressure_mbar_shl_actual[0] = regulator_step( pressure_mbar_shl_actual[0], pressure_mbar_shl_output[0] );
+
+        error = pressure_mbar_shl_actual[0] - pressure_mbar_shl_target[0];
+        if ( ( error > ( 1 << PRESSURE_SHL ) ) || ( error < -( 1 << PRESSURE_SHL ) ) )
+            settled = 0;
+        else if ( settled == 0 )
+            settled = cycle;
+    }
+
+    return settled;
+}
+
+static void test_probe_load( void )
+{
+    uint8_t report[PROBE_REPORT_SIZE];
+    uint8_t *load = &report[PROBE_REPORT_HEADER_SIZE + ( PROBE_COUNT * PROBE_REPORT_RECORD_SIZE )];
+    uint16_t i;
+
+    probe_init();
+    CCP9TMRL = 0xFF00;
+    PROBE_PASS();
+
+    /* Idle passes, then busy ones with a nested interrupt, to a 1171875 tick window */
+    for ( i=0; i<6000; i++ )
+    {
+        CCP9TMRL += 100;
+        PROBE_PASS();
+    }
+    for ( i=0; i<1430; i++ )
+    {
+        CCP9TMRL += 150;
+        PROBE_ISR_ENTER();
+        CCP9TMRL += 40;
+        PROBE_ISR_ENTER();
+        CCP9TMRL += 20;
+        PROBE_ISR_EXIT();
+        CCP9TMRL += 40;
+        PROBE_ISR_EXIT();
+        CCP9TMRL += 150;
+        PROBE_PASS();
+    }
+    CHECK_EQ( probe_isr_depth, 0 );
+
+    probe_report( report, 1 );
+    CHECK_EQ( *(uint16_t *)&load[0], 367 );         // 1 - 7430 x 100 / 1172000
+    CHECK_EQ( *(uint16_t *)&load[2], 367 );
+    CHECK_EQ( *(uint16_t *)&load[4], 122 );         // 1430 x 100 / 1172000, nested counted once
+    CHECK_EQ( *(uint16_t *)&load[6], 100 );
+    CHECK_EQ( *(uint16_t *)&load[8], 100 );
+    CHECK_EQ( *(uint16_t *)&load[10], 400 );
+    CHECK_EQ( *(uint32_t *)&load[12], 7430 );
+
+    probe_report( report, 0 );
+    CHECK_EQ( *(uint16_t *)&load[0], 367 );
+    CHECK_EQ( *(uint16_t *)&load[2], 0 );
+    CHECK_EQ( *(uint16_t *)&load[8], 100 );         // The idle pass is kept
+    probe_init();
+}
+
+static bool i2c_ack_all( uint8_t address, bool read, uint8_t *buf, uint8_t length )
+{
+    (void)address;
+    (void)read;
+    (void)buf;
+    (void)length;
+    return true;
+}
+
+static void test_i2c_bus( void )
+{
+    uint8_t buf[64];
+    uint8_t *report = &buf[4];
+    ads1115_task_t task;
+    uint16_t value;
+    int8_t channel;
+    bool recovered;
+    uint32_t delay_us;
+
+    init();
+    spi_reset();
+    i2c_bus_init();
+
+    /* A MUX write, then an ADC read whose address is not acknowledged */
+    hal_i2c_device = i2c_ack_all;
+    CHECK_EQ( pca9544a_write( 0x70, 1, 0 ), ERR_OK );
+    hal_i2c_device = NULL;
+    ads1115_read_adc_start( 0x48, 0, 0x48, -1, MUX_AIN0_GND, DATARATE_860SPS, FSR_4_096, &task );
+    CHECK_EQ( ads1115_read_adc_return( &value, &channel, &task ), 0 );
+
+    /* SDA released by the abort: no recovery */
+    hal_i2c_sda_stuck = false;
+    timer_ms += 3;
+    CHECK_EQ( ads1115_read_adc_return( &value, &channel, &task ), -1 );
+    CHECK( !i2c_bus_stuck( &recovered ) );
+
+    /* SDA held low through it: nine clocks, a STOP, and a failed recovery */
+    delay_us = hal_delay_us_total;
+    hal_i2c_sda_stuck = true;
+    ads1115_read_adc_start( 0x48, 0, 0x48, -1, MUX_AIN0_GND, DATARATE_860SPS, FSR_4_096, &task );
+    timer_ms += 3;
+    CHECK_EQ( ads1115_read_adc_return( &value, &channel, &task ), -1 );
+    CHECK( i2c_bus_stuck( &recovered ) );
+    CHECK( !recovered );
+    CHECK( !i2c_bus_stuck( &recovered ) );
+    CHECK_EQ( hal_delay_us_total - delay_us, ( 2 * I2C_BUS_RECOVERY_CLOCKS + 3 ) * I2C_BUS_RECOVERY_HALF_US );
+    hal_i2c_sda_stuck = false;
+
+    /* Fast-mode Plus from the next idle bus */
+    i2c_bus_set_fast_plus( true );
+    I2C2STATbits.S = 1;
+    i2c_bus_poll();
+    CHECK_EQ( I2C2BRG, I2C_BUS_BRG );
+    I2C2STATbits.S = 0;
+    i2c_bus_poll();
+    CHECK_EQ( I2C2BRG, I2C_BUS_BRG_FAST_PLUS );
+    CHECK_EQ( I2C2CONLbits.DISSLW, 1 );
+    CHECK_EQ( I2C2CONLbits.I2CEN, 1 );
+
+    CHECK_EQ( parse_packet( PACKET_TYPE_GET_I2C_STATS, (uint8_t[]){ 1 }, 1 ), ERR_OK );
+    CHECK_EQ( drain( buf ), 4 + 1 + I2C_BUS_REPORT_SIZE );
+    CHECK_EQ( buf[3], ERR_OK );
+    CHECK_EQ( *(uint32_t *)&report[0], 2 );                                 // ADC transfers
+    CHECK_EQ( *(uint16_t *)&report[4], 2 );                                 // NACKs
+    CHECK_EQ( *(uint16_t *)&report[8], 0 );                                 // Timeouts
+    CHECK_EQ( *(uint16_t *)&report[10], 2 );                                // Aborts
+    CHECK_EQ( *(uint32_t *)&report[I2C_BUS_DEV_REPORT_SIZE], 1 );           // MUX transfers
+    CHECK_EQ( *(uint16_t *)&report[I2C_BUS_DEV_REPORT_SIZE + 10], 0 );
+    CHECK_EQ( *(uint32_t *)&report[2 * I2C_BUS_DEV_REPORT_SIZE], 0 );       // Flow
+    CHECK_EQ( *(uint16_t *)&report[3 * I2C_BUS_DEV_REPORT_SIZE], 0 );       // Recoveries
+    CHECK_EQ( *(uint16_t *)&report[3 * I2C_BUS_DEV_REPORT_SIZE + 2], 1 );   // Recovery fails
+    CHECK_EQ( *(uint16_t *)&report[3 * I2C_BUS_DEV_REPORT_SIZE + 4], 1000 );
+
+    /* Reset by the request, the clock kept */
+    CHECK_EQ( parse_packet( PACKET_TYPE_GET_I2C_STATS, NULL, 0 ), ERR_OK );
+    CHECK_EQ( drain( buf ), 4 + 1 + I2C_BUS_REPORT_SIZE );
+    CHECK_EQ( *(uint32_t *)&report[0], 0 );
+    CHECK_EQ( *(uint16_t *)&report[3 * I2C_BUS_DEV_REPORT_SIZE + 2], 0 );
+    CHECK_EQ( *(uint16_t *)&report[3 * I2C_BUS_DEV_REPORT_SIZE + 4], 1000 );
+
+    i2c_bus_init();
+}
+
+static uint8_t flow_mux_writes;
+static uint8_t flow_sensor_reads[NUM_PRESSURE_CLTRLS];
+static uint8_t flow_mux_chan;
+static uint8_t flow_sensor_read_bytes[NUM_PRESSURE_CLTRLS];
+static uint16_t flow_sensor_flags;
+static uint8_t flow_sensor_flags_crc_xor;
+
+static bool i2c_flow_bus( uint8_t address, bool read, uint8_t *buf, uint8_t length )
+{
+    /* PCA9544A at 0x70 and the LG16 of the selected channel at 0x40: flow and temperature 0,
+     * then flow_sensor_flags */
+    static const uint8_t mux_to_chan[4] = { 1, 0, 2, 3 };   // Inverse of main.c flow_map[]
+
+    if ( address == 0x70 )
+    {
+        flow_mux_writes++;
+        flow_mux_chan = mux_to_chan[buf[0] & 0x03];
+    }
+    else if ( read && ( ( length == SENSIRION_READ_FLOW_BYTES ) || ( length == SENSIRION_READ_FLAGS_BYTES ) ) )
+    {
+        flow_sensor_reads[flow_mux_chan]++;
+        flow_sensor_read_bytes[flow_mux_chan] = length;
+        memset( buf, 0, length );
+        buf[2] = sensirion_crc( &buf[0], 2 );
+        if ( length == SENSIRION_READ_FLAGS_BYTES )
+        {
+            buf[5] = sensirion_crc( &buf[3], 2 );
+            buf[6] = flow_sensor_flags >> 8;
+            buf[7] = flow_sensor_flags & 0xFF;
+            buf[8] = sensirion_crc( &buf[6], 2 ) ^ flow_sensor_flags_crc_xor;
+        }
+    }
+    return true;
+}
+
+#define ADC_STARTS_MAX                      16
+
+static uint8_t adc_start_mux[ADC_STARTS_MAX];
+static uint8_t adc_start_pga[ADC_STARTS_MAX];
+static uint8_t adc_starts;
+
+static bool i2c_adc_starts( uint8_t address, bool read, uint8_t *buf, uint8_t length )
+{
+    /* Logs the mux and PGA of each conversion started, a config write with OS set */
+    (void)address;
+
+    if ( !read && ( length == 3 ) && ( buf[0] == ADS1115_REG_CONFIG ) && ( buf[1] & 0x80 ) && ( adc_starts < ADC_STARTS_MAX ) )
+    {
+        adc_start_mux[adc_starts] = ( buf[1] >> 4 ) & 0x07;
+        adc_start_pga[adc_starts] = ( buf[1] >> 1 ) & 0x07;
+        adc_starts++;
+    }
+    if ( read )
+        memset( buf, 0, length );
+    return true;
+}
+
+static void test_adc_burst( void )
+{
+    /* Channel 1 converts three times in a row at the gain of the first, and its codes read
+     * back as one rounded mean; the other channels once each as before */
+    const param_desc_t burst = { .id = 0x71 };
+    uint8_t input_1;
+    uint8_t i;
+    uint16_t average;
+
+    init();
+    hal_i2c_device = i2c_adc_starts;
+    for ( input_1=0; adc_map[input_1] != 1; input_1++ )
+        ;
+    CHECK_EQ( param_set_adc_burst( &burst, 3 ), ERR_OK );
+    CHECK_EQ( adc_bursts[1], 3 );
+
+    adc_starts = 0;
+    adc_chan = 0;
+    adc_burst_left = adc_bursts[adc_map[0]] - 1;
+    adc_state = ADC_STATE_SAMPLE;
+    adc_read_start( -1, 0 );
+    while ( adc_state == ADC_STATE_SAMPLE )
+    {
+        /* Auto-ranging of channel 1 moving mid burst waits for the next cycle */
+        if ( adc_start_mux[adc_starts - 1] == 4 + input_1 )
+            adc_gains[1] = FSR_2_048;
+        adc_sample_next();
+    }
+    CHECK_EQ( adc_starts, NUM_PRESSURE_CLTRLS + 2 );
+    for ( i=0; i<adc_starts; i++ )
+    {
+        if ( i <= input_1 )
+            CHECK_EQ( adc_start_mux[i], 4 + i );
+        else if ( i <= input_1 + 2 )
+            CHECK_EQ( adc_start_mux[i], 4 + input_1 );
+        else
+            CHECK_EQ( adc_start_mux[i], 4 + i - 2 );
+    }
+    CHECK_EQ( adc_start_pga[input_1], 0 );
+    CHECK_EQ( adc_start_pga[input_1 + 1], 0 );
+    CHECK_EQ( adc_start_pga[input_1 + 2], 0 );
+
+    /* The mean, rounded half away from 0, only once the burst is in */
+    CHECK( !adc_burst_add( 1, 100, &average ) );
+    CHECK( !adc_burst_add( 1, 101, &average ) );
+    CHECK( adc_burst_add( 1, 103, &average ) );
+    CHECK_EQ( average, 101 );
+    CHECK( !adc_burst_add( 1, (uint16_t)-3, &average ) );
+    CHECK( !adc_burst_add( 1, (uint16_t)-4, &average ) );
+    CHECK( adc_burst_add( 1, (uint16_t)-4, &average ) );
+    CHECK_EQ( (int16_t)average, -4 );
+    CHECK( adc_burst_add( 0, 0x7FFF, &average ) );
+    CHECK_EQ( average, 0x7FFF );
+
+    hal_i2c_device = NULL;
+}
+
+static void test_flow_schedule( void )
+{
+    uint8_t chan;
+    uint8_t cycle;
+    uint8_t pass;
+
+    init();
+    hal_i2c_device = i2c_flow_bus;
+    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+    {
+        flow_present[chan] = true;
+        ctrl_modes[chan] = CTRL_MODE_ZERO;
+    }
+    ctrl_modes[1] = CTRL_MODE_FLOW;
+    flow_mux_writes = 0;
+    memset( flow_sensor_reads, 0, sizeof(flow_sensor_reads) );
+
+    /* Eight cycles at the default divider of 4: the flow loop every cycle, the others twice */
+    for ( cycle=0; cycle<8; cycle++ )
+    {
+        read_flows_start();
+        for ( pass=0; pass<NUM_PRESSURE_CLTRLS; pass++ )
+            read_flows_poll();
+    }
+    CHECK_EQ( flow_sensor_reads[1], 8 );
+    CHECK_EQ( flow_sensor_reads[0], 2 );
+    CHECK_EQ( flow_sensor_reads[2], 2 );
+    CHECK_EQ( flow_sensor_reads[3], 2 );
+
+    /* A MUX write for every read but one: cycle 5 starts on channel 1, where cycle 4 ended */
+    CHECK_EQ( flow_mux_writes, 8 + 6 - 1 );
+
+    /* Divider 1 reads every channel every cycle, as before */
+    flow_monitor_div = 1;
+    memset( flow_sensor_reads, 0, sizeof(flow_sensor_reads) );
+    read_flows_start();
+    for ( pass=0; pass<NUM_PRESSURE_CLTRLS; pass++ )
+        read_flows_poll();
+    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+        CHECK_EQ( flow_sensor_reads[chan], 1 );
+
+    ctrl_modes[1] = CTRL_MODE_ZERO;
+    hal_i2c_device = NULL;
+    init();
+}
+
+static void flow_flags_cycle( void )
+{
+    /* One flow read round and control step */
+    uint8_t pass;
+
+    read_flows_start();
+    for ( pass=0; pass<NUM_PRESSURE_CLTRLS; pass++ )
+        read_flows_poll();
+    update_outputs();
+}
+
+static void test_flow_flags( void )
+{
+    uint16_t output;
+    int32_t integrated;
+    uint8_t cycle;
+
+    init();
+    hal_idle();
+    hal_i2c_device = i2c_flow_bus;
+    flow_sensor_flags = 0;
+    flow_sensor_flags_crc_xor = 0;
+    flow_present[0] = true;
+    ctrl_modes[0] = CTRL_MODE_FLOW;
+    CHECK_EQ( flow_ctrl_start( 0, 1000 ), ERR_OK );
+
+    /* Reading 0 against 1000, the loop drives the output up */
+    flow_flags_cycle();
+    CHECK_EQ( flow_sensor_read_bytes[0], SENSIRION_READ_FLAGS_BYTES );
+    CHECK_EQ( flow_read_rc[0], ERR_OK );
+    output = pressure_mbar_shl_output[0];
+    flow_flags_cycle();
+    CHECK( pressure_mbar_shl_output[0] > output );
+
+    /* Air in line: output and integrator held, one event however long it lasts */
+    flow_sensor_flags = SENSIRION_FLAG_AIR_IN_LINE | SENSIRION_FLAG_EXP_SMOOTHING;
+    flow_flags_cycle();
+    output = pressure_mbar_shl_output[0];
+    integrated = fpid_loop[0].integrated;
+    for ( cycle=0; cycle<5; cycle++ )
+        flow_flags_cycle();
+    CHECK_EQ( pressure_mbar_shl_output[0], output );
+    CHECK_EQ( fpid_loop[0].integrated, integrated );
+    CHECK_EQ( flow_flags[0], SENSIRION_FLAG_AIR_IN_LINE | SENSIRION_FLAG_EXP_SMOOTHING );
+    CHECK_EQ( flow_air_events[0], 1 );
+
+    /* Cleared, the loop carries on from where it stopped */
+    flow_sensor_flags = SENSIRION_FLAG_EXP_SMOOTHING;
+    flow_flags_cycle();
+    CHECK( pressure_mbar_shl_output[0] > output );
+
+    /* A second bubble, then high flow, counted apart */
+    flow_sensor_flags = SENSIRION_FLAG_AIR_IN_LINE;
+    flow_flags_cycle();
+    flow_sensor_flags = SENSIRION_FLAG_AIR_IN_LINE | SENSIRION_FLAG_HIGH_FLOW;
+    output = pressure_mbar_shl_output[0];
+    flow_flags_cycle();
+    CHECK_EQ( pressure_mbar_shl_output[0], output );
+    CHECK_EQ( flow_air_events[0], 2 );
+    CHECK_EQ( flow_high_events[0], 1 );
+
+    /* A flags word failing its CRC, or with reserved bits, is not taken, the flow reading is */
+    flow_sensor_flags_crc_xor = 0x01;
+    flow_flags_cycle();
+    CHECK_EQ( flow_read_rc[0], ERR_OK );
+    CHECK_EQ( flow_flags[0], 0 );
+    flow_sensor_flags_crc_xor = 0;
+    flow_sensor_flags = 0x8001;
+    flow_flags_cycle();
+    CHECK_EQ( flow_flags[0], 0 );
+
+    /* Gate off: the flow word alone, the loop never held */
+    flow_flags_gate[0] = 0;
+    flow_sensor_flags = SENSIRION_FLAG_AIR_IN_LINE;
+    output = pressure_mbar_shl_output[0];
+    flow_flags_cycle();
+    CHECK_EQ( flow_sensor_read_bytes[0], SENSIRION_READ_FLOW_BYTES );
+    CHECK_EQ( flow_flags[0], 0 );
+    CHECK( pressure_mbar_shl_output[0] > output );
+    CHECK_EQ( flow_air_events[0], 2 );
+
+    ctrl_modes[0] = CTRL_MODE_ZERO;
+    hal_i2c_device = NULL;
+    init();
+}
+
+static uint8_t flow_res_readings( int16_t flow_raw, uint8_t count )
+{
+    /* <count> readings of channel 0 at 1000 mbar, returns the state after them */
+    pressure_mbar_shl_actual[0] = 1000 << PRESSURE_SHL;
+    flow_raw_actual[0] = flow_raw;
+    while ( count-- )
+        flow_res_update( 0 );
+    return flow_res_state[0];
+}
+
+static void test_flow_res( void )
+{
+    const param_desc_t ref = { .id = 0x60 };   // Reference R of channel 0
+    uint8_t buf[FAULT_LIST_SIZE];
+    fault_rec_t rec;
+    uint8_t count;
+
+    init();
+    hal_idle();
+    fault_init( &timer_ms, 1000, false, 0 );        // An empty page, the reset its first record
+    flow_set_scale( 0, 60 );        // 1 count per ul/hr
+
+    /* 1000 mbar at 500 ul/hr is R 2000, the first reading taken whole. No reference, no state. */
+    CHECK_EQ( flow_res_readings( 500, 1 ), 0 );
+    CHECK_EQ( flow_res_r[0], 2000 );
+    CHECK_EQ( flow_res_readings( 250, 20 ), 0 );
+    CHECK( flow_res_r[0] > 3900 );
+
+    /* With the reference: back to normal, then a clog flagged within a few readings */
+    CHECK_EQ( param_set_flow_res_ref( &ref, 2000 ), ERR_OK );
+    CHECK_EQ( flow_res_ref[0], 2000 );
+    CHECK_EQ( flow_res_readings( 500, 20 ), 0 );
+    for ( count=1; ( count < 20 ) && ( flow_res_readings( 250, 1 ) == 0 ); count++ )
+        ;
+    CHECK_EQ( flow_res_state[0], 1 );
+    CHECK( count <= 6 );
+    fault_list( 0, buf );
+    memcpy( &rec, &buf[FAULT_LIST_HEADER_SIZE], sizeof(rec) );
+    CHECK_EQ( rec.id, 10 );
+    CHECK_EQ( rec.arg >> 8, 0 );
+    CHECK( ( rec.arg & 0xFF ) > 150 );
+
+    /* No flow at all is a clog too, not a missing estimate */
+    CHECK_EQ( flow_res_readings( 0, 10 ), 1 );
+
+    /* A leak past the sensor: more flow for the pressure */
+    CHECK_EQ( flow_res_readings( 500, 20 ), 0 );
+    CHECK_EQ( flow_res_readings( 1000, 20 ), 2 );
+    fault_list( 0, buf );
+    memcpy( &rec, &buf[FAULT_LIST_HEADER_SIZE], sizeof(rec) );
+    CHECK_EQ( rec.id, 11 );
+    CHECK( ( rec.arg & 0xFF ) < 70 );
+
+    /* A single odd reading does not change the state, low pressure changes nothing */
+    CHECK_EQ( flow_res_readings( 500, 20 ), 0 );
+    CHECK_EQ( flow_res_readings( 100, 1 ), 0 );
+    CHECK_EQ( flow_res_readings( 500, 1 ), 0 );
+    pressure_mbar_shl_actual[0] = 10 << PRESSURE_SHL;
+    flow_raw_actual[0] = 0;
+    for ( count=0; count<20; count++ )
+        flow_res_update( 0 );
+    CHECK_EQ( flow_res_state[0], 0 );
+
+    /* A new reference starts from OK */
+    CHECK_EQ( flow_res_readings( 250, 20 ), 1 );
+    CHECK_EQ( param_set_flow_res_ref( &ref, 4000 ), ERR_OK );
+    CHECK_EQ( flow_res_state[0], 0 );
+
+    init();
+}
+
+static void test_flow_est( void )
+{
+    /* Channel 0 at R 2000, its flow estimate moved by each pressure sample and pulled to each reading */
+    const param_desc_t shift = { .id = 0x7C };
+    uint8_t count;
+
+    init();
+    hal_idle();
+    flow_set_scale( 0, 60 );        // 1 count per ul/hr
+    CHECK_EQ( flow_res_readings( 500, 1 ), 0 );
+    CHECK_EQ( flow_res_r[0], 2000 );
+
+    /* Off, or before the first reading, the loop runs on the readings */
+    flow_est_predict( 0, 1000 << PRESSURE_SHL );
+    flow_est_correct( 0 );
+    CHECK( !flow_est_valid( 0 ) );
+    CHECK_EQ( param_set_flow_est_shift( &shift, 2 ), ERR_OK );
+    CHECK( !flow_est_valid( 0 ) );
+    flow_est_correct( 0 );
+    CHECK( flow_est_valid( 0 ) );
+    CHECK_EQ( flow_loop_actual( 0 ), 500 );
+
+    /* +100 mbar through R 2000 is +50 ul/hr, then a reading of 580 pulls it by a quarter */
+    flow_est_predict( 0, 1100 << PRESSURE_SHL );
+    CHECK_EQ( flow_raw_est[0], 550 );
+    CHECK_EQ( flow_loop_actual( 0 ), 550 );
+    flow_raw_actual[0] = 580;
+    flow_est_correct( 0 );
+    CHECK_EQ( flow_raw_est[0], 557 );
+
+    /* It carries a failed read, but not past FLOW_EST_AGE_MAX samples, nor a held one */
+    flow_read_rc[0] = ERR_SENSIRION_COMMS_FAIL;
+    CHECK( flow_loop_input_ok( 0 ) );
+    flow_flags[0] = SENSIRION_FLAG_AIR_IN_LINE;
+    CHECK( !flow_loop_input_ok( 0 ) );
+    flow_flags[0] = 0;
+    for ( count=0; count<4; count++ )
+        flow_est_predict( 0, 1100 << PRESSURE_SHL );
+    CHECK( flow_est_valid( 0 ) );
+    flow_est_predict( 0, 1000 << PRESSURE_SHL );
+    CHECK( !flow_est_valid( 0 ) );
+    CHECK( !flow_loop_input_ok( 0 ) );
+    CHECK_EQ( flow_loop_actual( 0 ), 580 );
+    flow_raw_actual[0] = 520;
+    flow_est_correct( 0 );
+    CHECK_EQ( flow_raw_est[0], 520 );
+
+    /* An event driven flow loop on the estimate does not wait for its reading */
+    ctrl_modes[0] = CTRL_MODE_FLOW;
+    ctrl_updated = 0;
+    adc_read_pending = 0x0E;
+    flow_read_pending = 0x01;
+    update_outputs_ready( false );
+    CHECK_EQ( ctrl_updated & 0x01, 0x01 );
+    CHECK_EQ( param_set_flow_est_shift( &shift, 0 ), ERR_OK );
+    ctrl_updated = 0;
+    update_outputs_ready( false );
+    CHECK_EQ( ctrl_updated & 0x01, 0 );
+
+    ctrl_modes[0] = CTRL_MODE_ZERO;
+    init();
+}
+
+static void test_update_outputs_pressure( void )
+{
+    uint16_t settled;
+    uint32_t dac_word;
+
+    init();
+    hal_idle();
+
+    ctrl_modes[0] = CTRL_MODE_PRESSURE;
+    CHECK_EQ( pressure_ctrl_start( 0 ), ERR_OK );
+
+    settled = pressure_settle( 1000, 400 );
+    CHECK( ( settled > 0 ) && ( settled < 200 ) );
+    printf( "update_outputs: 0 -> 1000 mbar settled in %u cycles\n", settled );
+
+    settled = pressure_settle( 400, 400 );
+    CHECK( ( settled > 0 ) && ( settled < 200 ) );
+    printf( "update_outputs: 1000 -> 400 mbar settled in %u cycles\n", settled );
+
+    /* set_pressures() loaded the changed codes into the SPI2 FIFO */
+    dac_word = ( (uint32_t)SPI2BUFH << 16 ) | SPI2BUFL;
+    CHECK( dac_word != 0 );
+
+    /* Open loop passes the target through, zero drives 0 */
+    ctrl_modes[1] = CTRL_MODE_PRESSURE_OPEN_LOOP;
+    pressure_mbar_shl_target[1] = 1234;
+    ctrl_modes[2] = CTRL_MODE_ZERO;
+    update_outputs();
+    CHECK_EQ( pressure_mbar_shl_output[1], 1234 );
+    CHECK_EQ( pressure_mbar_shl_output[2], 0 );
+}
+
+static uint32_t dac_last_word( void )
+{
+    return ( (uint32_t)SPI2BUFH << 16 ) | SPI2BUFL;
+}
+
+static void test_ctrl_event( void )
+{
+    /* Each channel updates on its own samples, chan 2 follows its flow, chan 3's ADC timed out */
+    uint8_t chan;
+
+    init();
+    hal_idle();
+    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+    {
+        ctrl_modes[chan] = CTRL_MODE_PRESSURE_OPEN_LOOP;
+        pressure_mbar_shl_target[chan] = (uint16_t)( 1000 * ( chan + 1 ) ) << PRESSURE_SHL;
+    }
+    ctrl_modes[2] = CTRL_MODE_FLOW;
+    set_pressures();
+
+    ctrl_updated = 0;
+    adc_read_pending = 0x0F;
+    flow_read_pending = 0x06;       // Chan 1 only reports its flow
+    update_outputs_ready( false );
+    CHECK_EQ( ctrl_updated, 0 );
+
+    /* Chan 0 alone, with write and update of its own output */
+    adc_read_pending &= ~0x01;
+    update_outputs_ready( false );
+    CHECK_EQ( ctrl_updated, 0x01 );
+    CHECK_EQ( pressure_mbar_shl_output[0], 1000 << PRESSURE_SHL );
+    CHECK_EQ( pressure_mbar_shl_output[1], 0 );
+    CHECK_EQ( ( dac_last_word() >> 24 ) & 0x3F, ( 0b011 << 3 ) | 0 );
+
+    /* Chan 1 does not wait for a flow it does not use */
+    adc_read_pending &= ~0x02;
+    update_outputs_ready( false );
+    CHECK_EQ( ctrl_updated, 0x03 );
+    CHECK_EQ( pressure_mbar_shl_output[1], 2000 << PRESSURE_SHL );
+    CHECK_EQ( ( dac_last_word() >> 24 ) & 0x3F, ( 0b011 << 3 ) | 1 );
+
+    adc_read_pending &= ~0x04;
+    update_outputs_ready( false );
+    CHECK_EQ( ctrl_updated, 0x03 );
+    flow_read_pending &= ~0x04;
+    update_outputs_ready( false );
+    CHECK_EQ( ctrl_updated, 0x07 );
+
+    /* The end of the cycle takes the rest, and updates all outputs together */
+    update_outputs_ready( true );
+    CHECK_EQ( ctrl_updated, 0x0F );
+    CHECK_EQ( pressure_mbar_shl_output[3], 4000 << PRESSURE_SHL );
+    CHECK_EQ( ( dac_last_word() >> 24 ) & 0x3F, ( 0b010 << 3 ) | 3 );
+
+    /* Nothing left, nothing runs again */
+    pressure_mbar_shl_target[0] = 0;
+    update_outputs_ready( false );
+    CHECK_EQ( pressure_mbar_shl_output[0], 1000 << PRESSURE_SHL );
+}
+
+static void test_latency( void )
+{
+    /* Chan 0 sampled twice then written 1.2 ms after the first, the next output 100.304 ms on */
+    uint8_t buf[4 + 1 + LATENCY_REPORT_SIZE];
+    uint8_t *report = &buf[4];
+    uint8_t *latency = &report[LATENCY_REPORT_HEADER_SIZE];
+    uint8_t *period = &latency[LATENCY_REPORT_HIST_SIZE];
+    uint8_t i;
+
+    init();
+    hal_idle();
+    spi_reset();
+    time_init();
+    latency_init();
+    TMR1 = 0;
+    IFS0bits.T1IF = 0;
+
+    ctrl_updated = 0;
+    adc_read_pending = 0x0F;
+    flow_read_pending = 0;
+    latency_sample( 0 );
+    TMR1 = 50;
+    latency_sample( 0 );
+    time_tick();
+    TMR1 = 25;
+    adc_read_pending &= ~0x01;
+    update_outputs_ready( false );
+    CHECK_EQ( ctrl_updated, 0x01 );
+
+    /* No sample since, so only the period counts */
+    ctrl_updated = 0;
+    for ( i=0; i<100; i++ )
+        time_tick();
+    TMR1 = 63;
+    update_outputs_ready( false );
+
+    CHECK_EQ( parse_packet( PACKET_TYPE_GET_LATENCY_STATS, (uint8_t[]){ 0, 1 }, 2 ), ERR_OK );
+    CHECK_EQ( drain( buf ), 4 + 1 + LATENCY_REPORT_SIZE );
+    CHECK_EQ( buf[3], ERR_OK );
+    CHECK_EQ( report[0], LATENCY_COUNT );
+    CHECK_EQ( report[1], 0 );
+    CHECK_EQ( *(uint32_t *)&report[2], 100000 );
+    CHECK_EQ( *(uint32_t *)&latency[0], 1 );
+    CHECK_EQ( *(uint32_t *)&latency[4], 1200 );
+    CHECK_EQ( *(uint32_t *)&latency[8], 1200 );
+    CHECK_EQ( *(uint32_t *)&latency[12], 1200 );
+    CHECK_EQ( *(uint16_t *)&latency[16 + 2 * 7], 1 );      // [1024, 2048) us
+    CHECK_EQ( *(uint32_t *)&period[0], 1 );
+    CHECK_EQ( *(uint32_t *)&period[4], 100304 );
+    CHECK_EQ( *(uint16_t *)&period[16 + 2 * 5], 1 );       // 304 us of jitter, [256, 512) us
+
+    /* Reset by the request, other channels never sampled */
+    CHECK_EQ( parse_packet( PACKET_TYPE_GET_LATENCY_STATS, (uint8_t[]){ 0 }, 1 ), ERR_OK );
+    CHECK_EQ( drain( buf ), 4 + 1 + LATENCY_REPORT_SIZE );
+    CHECK_EQ( *(uint32_t *)&latency[0], 0 );
+    CHECK_EQ( *(uint32_t *)&latency[4], 0 );
+    CHECK_EQ( *(uint32_t *)&period[0], 0 );
+    CHECK_EQ( parse_packet( PACKET_TYPE_GET_LATENCY_STATS, (uint8_t[]){ 3 }, 1 ), ERR_OK );
+    CHECK_EQ( drain( buf ), 4 + 1 + LATENCY_REPORT_SIZE );
+    CHECK_EQ( report[1], 3 );
+    CHECK_EQ( *(uint32_t *)&latency[0], 0 );
+    CHECK_EQ( parse_packet( PACKET_TYPE_GET_LATENCY_STATS, (uint8_t[]){ LATENCY_COUNT }, 1 ), ERR_PACKET_INVALID );
+    CHECK_EQ( parse_packet( PACKET_TYPE_GET_LATENCY_STATS, NULL, 0 ), ERR_PACKET_INVALID );
+}
+
+static void test_module_addr( void )
+{
+    uint8_t buf[48];
+    uint8_t batch[5] = { 0, 1, 3, PACKET_TYPE_GET_CAPABILITIES, 0 };
+    uint8_t twice[6] = { 0, 1, 3, 0, 1, 3 };
+    
+    init();
+    spi_reset();
+    
+    /* Unset, as on a blank EEPROM, the module runs a batch of any address */
+    spi_module_addr = SPI_MODULE_ADDR_ANY;
+    CHECK_EQ( parse_packet( PACKET_TYPE_BATCH, batch, sizeof(batch) ), ERR_OK );
+    CHECK_EQ( drain( buf ), 4 + 1 + 3 + 2 + 1 + SPI_CAPS_REPORT_SIZE );
+    CHECK_EQ( buf[2], PACKET_TYPE_BATCH );
+    CHECK_EQ( buf[3], ERR_OK );
+    CHECK_EQ( buf[4], 0 );
+    CHECK_EQ( buf[5], 1 );
+    CHECK_EQ( buf[6], SPI_MODULE_ADDR_ANY );
+    CHECK_EQ( buf[7], PACKET_TYPE_GET_CAPABILITIES );
+    CHECK_EQ( buf[8], 1 + SPI_CAPS_REPORT_SIZE );
+    
+    /* Another module's batch is refused before any of it runs */
+    spi_module_addr = 2;
+    CHECK_EQ( parse_packet( PACKET_TYPE_BATCH, batch, sizeof(batch) ), ERR_MODULE_ADDRESS );
+    CHECK_EQ( spi_write_bytes_written(), 0 );
+    
+    spi_module_addr = 3;
+    CHECK_EQ( parse_packet( PACKET_TYPE_BATCH, batch, sizeof(batch) ), ERR_OK );
+    drain( buf );
+    CHECK_EQ( buf[6], 3 );
+    
+    /* Addressed to every module, the reply still names this one */
+    batch[2] = SPI_MODULE_ADDR_ANY;
+    CHECK_EQ( parse_packet( PACKET_TYPE_BATCH, batch, sizeof(batch) ), ERR_OK );
+    drain( buf );
+    CHECK_EQ( buf[6], 3 );
+    
+    /* The address leads the batch, a type 0 entry anywhere else is invalid */
+    CHECK_EQ( parse_packet( PACKET_TYPE_BATCH, twice, sizeof(twice) ), ERR_PACKET_INVALID );
+    CHECK_EQ( spi_write_bytes_written(), 0 );
+    
+    spi_module_addr = SPI_MODULE_ADDR_ANY;
+}
+
+static void test_pressure_limit( void )
+{
+    const param_desc_t limit = { .id = 0x69 };     // Limit of channel 1
+    uint8_t buf[FAULT_LIST_SIZE];
+    fault_rec_t rec;
+    uint16_t limits[NUM_PRESSURE_CLTRLS];
+    uint32_t dac_words;
+    uint16_t average;
+    uint16_t low;
+    uint16_t spike;
+
+    init();
+    hal_idle();
+    spi_reset();
+    storage_startup();
+    fault_init( &timer_ms, 1000, false, 0 );
+    CHECK_EQ( pressure_limit_mbar[1], 0 );
+
+    /* Open loop at 1000 mbar, a limit of 800 stored */
+    ctrl_modes[1] = CTRL_MODE_PRESSURE_OPEN_LOOP;
+    pressure_mbar_shl_target[1] = 1000 << PRESSURE_SHL;
+    update_outputs();
+    CHECK_EQ( pressure_mbar_shl_output[1], 1000 << PRESSURE_SHL );
+    CHECK_EQ( param_set_pressure_limit( &limit, 800 ), ERR_OK );
+    store_flush_wait();
+    store_load_pressure_limits( limits );
+    CHECK_EQ( limits[1], 800 );
+
+    /* Under it nothing happens, over it the DAC channel is written 0 then and there */
+    dac_words = hal_dac_words;
+    pressure_limit_check( 1, 790 << PRESSURE_SHL );
+    CHECK_EQ( ctrl_modes[1], CTRL_MODE_PRESSURE_OPEN_LOOP );
+    CHECK_EQ( hal_dac_words, dac_words );
+    pressure_limit_check( 1, 850 << PRESSURE_SHL );
+    CHECK_EQ( hal_dac_words, dac_words + 1 );
+    CHECK_EQ( pressure_mbar_shl_output[1], 0 );
+    CHECK_EQ( ctrl_modes[1], CTRL_MODE_ZERO );
+    CHECK_EQ( pressure_trips[1], 1 );
+    fault_list( 0, buf );
+    memcpy( &rec, &buf[FAULT_LIST_HEADER_SIZE], sizeof(rec) );
+    CHECK_EQ( rec.id, 12 );
+    CHECK_EQ( rec.arg, ( 1L << 16 ) | 850 );
+
+    /* The loop keeps it at 0, and pressure from elsewhere is not another trip */
+    update_outputs();
+    CHECK_EQ( pressure_mbar_shl_output[1], 0 );
+    pressure_limit_check( 1, 900 << PRESSURE_SHL );
+    CHECK_EQ( pressure_trips[1], 1 );
+    CHECK_EQ( hal_dac_words, dac_words + 1 );
+
+    /* Closed loop trips too, the other channels untouched; 0 is no limit */
+    ctrl_modes[0] = CTRL_MODE_PRESSURE;
+    ctrl_modes[1] = CTRL_MODE_PRESSURE;
+    CHECK_EQ( pressure_ctrl_start( 1 ), ERR_OK );
+    pressure_mbar_shl_output[1] = 500 << PRESSURE_SHL;
+    pressure_limit_check( 0, 4000 << PRESSURE_SHL );
+    CHECK_EQ( ctrl_modes[0], CTRL_MODE_PRESSURE );
+    pressure_limit_check( 1, 801 << PRESSURE_SHL );
+    CHECK_EQ( ctrl_modes[1], CTRL_MODE_ZERO );
+    CHECK_EQ( ctrl_modes[0], CTRL_MODE_PRESSURE );
+    CHECK_EQ( pressure_trips[1], 2 );
+
+    /* The top of the measurable range still trips on a saturated sample; above it is refused */
+    CHECK_EQ( param_set_pressure_limit( &limit, 4096 ), ERR_PARAM_RANGE );
+    CHECK_EQ( param_set_pressure_limit( &limit, UINT16_MAX ), ERR_PARAM_RANGE );
+    CHECK_EQ( pressure_limit_mbar[1], 800 );
+    CHECK_EQ( param_set_pressure_limit( &limit, 4095 ), ERR_OK );
+    ctrl_modes[1] = CTRL_MODE_PRESSURE;
+    CHECK_EQ( pressure_ctrl_start( 1 ), ERR_OK );
+    pressure_mbar_shl_output[1] = 4000 << PRESSURE_SHL;
+    pressure_limit_check( 1, 4094 << PRESSURE_SHL );
+    CHECK_EQ( ctrl_modes[1], CTRL_MODE_PRESSURE );
+    pressure_limit_check( 1, INT16_MAX );
+    CHECK_EQ( ctrl_modes[1], CTRL_MODE_ZERO );
+    CHECK_EQ( pressure_trips[1], 3 );
+
+    /* In a burst each conversion is checked as it is read back: one spike over the limit trips
+     * before the burst is in, though the mean of the burst is well under it */
+    CHECK_EQ( param_set_pressure_limit( &limit, 800 ), ERR_OK );
+    adc_bursts[1] = 4;
+    for ( low=0; adc_code_mbar_shl( 1, low ) < ( 200 << PRESSURE_SHL ); low++ )
+        ;
+    for ( spike=low; adc_code_mbar_shl( 1, spike ) < ( 1000 << PRESSURE_SHL ); spike++ )
+        ;
+    ctrl_modes[1] = CTRL_MODE_PRESSURE;
+    CHECK_EQ( pressure_ctrl_start( 1 ), ERR_OK );
+    pressure_mbar_shl_output[1] = 500 << PRESSURE_SHL;
+    CHECK( !adc_burst_add( 1, low, &average ) );
+    CHECK( !adc_burst_add( 1, low, &average ) );
+    CHECK_EQ( ctrl_modes[1], CTRL_MODE_PRESSURE );
+    CHECK( !adc_burst_add( 1, spike, &average ) );
+    CHECK_EQ( ctrl_modes[1], CTRL_MODE_ZERO );
+    CHECK_EQ( pressure_trips[1], 4 );
+    CHECK( adc_burst_add( 1, low, &average ) );
+    CHECK( adc_code_mbar_shl( 1, average ) < ( 800 << PRESSURE_SHL ) );
+    adc_bursts[1] = 1;
+
+    CHECK_EQ( param_set_pressure_limit( &limit, 0 ), ERR_OK );
+    store_flush_wait();
+    init();
+}
+
+static void test_pressure_cal( void )
+{
+    /* Channel 1 reads 5 mbar high and 3 % low, then a zero capture on the board averages
+     * four samples into its zero */
+    const param_desc_t zero = { .id = 0x75 };
+    const param_desc_t trim = { .id = 0x79 };
+    uint8_t start[2] = { 0x02, 4 };
+    uint8_t buf[40];
+    pkt_pressure_cal_reply_t *reply = (pkt_pressure_cal_reply_t *)&buf[3];
+    uint16_t zeros[NUM_PRESSURE_CLTRLS];
+    uint8_t trims[NUM_PRESSURE_CLTRLS];
+
+    init();
+    hal_idle();
+    spi_reset();
+    storage_startup();
+    CHECK_EQ( pressure_cal_zero[1], 0 );
+    CHECK_EQ( pressure_cal_span[1], PRESSURE_CAL_SPAN_ONE );
+    CHECK_EQ( pressure_cal_apply( 1, 1234 ), 1234 );
+    CHECK_EQ( pressure_cal_apply( 1, -1234 ), -1234 );
+
+    /* (8000 - 40) x 1.03125 = 8208.75, stored as the zero and the I8 trim */
+    CHECK_EQ( param_set_pressure_cal_zero( &zero, 40 ), ERR_OK );
+    CHECK_EQ( param_set_pressure_cal_trim( &trim, 64 ), ERR_OK );
+    CHECK_EQ( pressure_cal_span[1], PRESSURE_CAL_SPAN_ONE + 512 );
+    CHECK_EQ( pressure_cal_apply( 1, 1000 << PRESSURE_SHL ), 8209 );
+    CHECK_EQ( pressure_cal_apply( 0, 1000 << PRESSURE_SHL ), 8000 );
+    CHECK_EQ( pressure_cal_apply( 1, INT16_MIN ), INT16_MIN );
+    store_flush_wait();
+    store_load_pressure_cals( zeros, trims );
+    CHECK_EQ( zeros[1], 40 );
+    CHECK_EQ( trims[1], 64 );
+    CHECK_EQ( param_get_pressure_cal_trim( &trim ), 64 );
+
+    /* Only with the regulator held at 0 */
+    ctrl_modes[1] = CTRL_MODE_PRESSURE_OPEN_LOOP;
+    CHECK_EQ( parse_packet( PACKET_TYPE_PRESSURE_CAL, start, sizeof(start) ), ERR_ERROR );
+    CHECK_EQ( parse_packet( PACKET_TYPE_PRESSURE_CAL, start, 1 ), ERR_PACKET_INVALID );
+    ctrl_modes[1] = CTRL_MODE_ZERO;
+    CHECK_EQ( parse_packet( PACKET_TYPE_PRESSURE_CAL, start, sizeof(start) ), ERR_OK );
+    CHECK_EQ( drain( buf ), 4 + sizeof(pkt_pressure_cal_reply_t) );
+    CHECK_EQ( reply->rc, ERR_OK );
+    CHECK_EQ( reply->chan[1].zero, 40 );
+    CHECK_EQ( reply->chan[1].span, PRESSURE_CAL_SPAN_ONE + 512 );
+    CHECK_EQ( reply->chan[1].state, PCAL_STATE_RUNNING );
+    CHECK_EQ( reply->chan[1].left, 4 );
+    CHECK_EQ( reply->chan[0].state, PCAL_STATE_DEFAULT );
+
+    /* Samples before calibration, 81.75 rounds to 82 */
+    pressure_cal_sample( 1, 80 );
+    pressure_cal_sample( 1, 81 );
+    pressure_cal_sample( 1, 82 );
+    CHECK_EQ( pressure_cal_zero[1], 40 );
+    pressure_cal_sample( 1, 84 );
+    CHECK_EQ( pressure_cal_state[1], PCAL_STATE_FINISHED );
+    CHECK_EQ( pressure_cal_zero[1], 82 );
+    pressure_cal_sample( 1, 0 );
+    CHECK_EQ( pressure_cal_zero[1], 82 );
+    store_flush_wait();
+    store_load_pressure_cals( zeros, trims );
+    CHECK_EQ( zeros[1], 82 );
+    CHECK_EQ( parse_packet( PACKET_TYPE_PRESSURE_CAL, NULL, 0 ), ERR_OK );
+    CHECK_EQ( drain( buf ), 4 + sizeof(pkt_pressure_cal_reply_t) );
+    CHECK_EQ( reply->chan[1].state, PCAL_STATE_FINISHED );
+    CHECK_EQ( reply->chan[1].left, 0 );
+
+    /* A mean past PRESSURE_CAL_ZERO_MAX keeps the zero, a mode change aborts */
+    start[1] = 1;
+    CHECK_EQ( parse_packet( PACKET_TYPE_PRESSURE_CAL, start, sizeof(start) ), ERR_OK );
+    drain( buf );
+    pressure_cal_sample( 1, 1000 << PRESSURE_SHL );
+    CHECK_EQ( pressure_cal_state[1], PCAL_STATE_FAILED );
+    CHECK_EQ( pressure_cal_zero[1], 82 );
+    CHECK_EQ( parse_packet( PACKET_TYPE_PRESSURE_CAL, start, sizeof(start) ), ERR_OK );
+    drain( buf );
+    ctrl_modes[1] = CTRL_MODE_PRESSURE_OPEN_LOOP;
+    pressure_cal_sample( 1, 0 );
+    CHECK_EQ( pressure_cal_state[1], PCAL_STATE_ABORTED );
+    CHECK_EQ( pressure_cal_zero[1], 82 );
+
+    /* The stored calibration loads at startup */
+    init();
+    storage_startup();
+    CHECK_EQ( pressure_cal_zero[1], 82 );
+    CHECK_EQ( pressure_cal_span[1], PRESSURE_CAL_SPAN_ONE + 512 );
+
+    CHECK_EQ( param_set_pressure_cal_zero( &zero, 0 ), ERR_OK );
+    CHECK_EQ( param_set_pressure_cal_trim( &trim, 0 ), ERR_OK );
+    store_flush_wait();
+    init();
+}
+
+static void ctrl_mode_set( uint8_t chan, E_CTRL_MODE mode )
+{
+    E_CTRL_MODE modes[NUM_PRESSURE_CLTRLS];
+
+    memcpy( modes, ctrl_modes, sizeof(modes) );
+    modes[chan] = mode;
+    set_ctrl_modes( modes );
+}
+
+static void test_loop_warm_start( void )
+{
+    /* A regulator 50 mbar short: the pressure integrator settles at +50 mbar, is recorded
+     * and stored, and a restart at that target resumes from it */
+    uint16_t warms[NUM_PRESSURE_CLTRLS][STORE_WARM_WORDS];
+    uint16_t cycle;
+    int16_t integrated;
+
+    init();
+    hal_idle();
+    spi_reset();
+    storage_startup();
+    memset( loop_warm, EEPROM_BLANK_U8, sizeof(loop_warm) );
+
+    ctrl_mode_set( 0, CTRL_MODE_PRESSURE );
+    pressure_mbar_shl_target[0] = 1000 << PRESSURE_SHL;
+    for ( cycle=0; cycle<600; cycle++ )
+    {
+        update_outputs();
+        pressure_mbar_shl_actual[0] = regulator_step( pressure_mbar_shl_actual[0], pressure_mbar_shl_output[0] - ( 50 << PRESSURE_SHL ) );
+    }
+    CHECK( abs( pressure_mbar_shl_actual[0] - ( 1000 << PRESSURE_SHL ) ) <= ( 1 << PRESSURE_SHL ) );
+    integrated = (int16_t)loop_warm[0][1];
+    CHECK_EQ( loop_warm[0][0], 1000 << PRESSURE_SHL );
+    CHECK( abs( integrated - ( 50 << PRESSURE_SHL ) ) <= ( 2 << PRESSURE_SHL ) );
+    store_flush_wait();
+    store_load_warms( (uint16_t *)warms );
+    CHECK_EQ( warms[0][0], 1000 << PRESSURE_SHL );
+    CHECK_EQ( warms[0][1], loop_warm[0][1] );
+    CHECK_EQ( warms[0][3], EEPROM_BLANK_U16 );
+
+    /* Mode toggle: from the record near its target, from zero far from it or when off */
+    ctrl_mode_set( 0, CTRL_MODE_ZERO );
+    pressure_mbar_shl_target[0] = 1050 << PRESSURE_SHL;
+    ctrl_mode_set( 0, CTRL_MODE_PRESSURE );
+    CHECK_EQ( ppid_loop[0].integrated >> PPID_SHIFT, integrated );
+    ctrl_mode_set( 0, CTRL_MODE_ZERO );
+    pressure_mbar_shl_target[0] = 2000 << PRESSURE_SHL;
+    ctrl_mode_set( 0, CTRL_MODE_PRESSURE );
+    CHECK_EQ( ppid_loop[0].integrated, 0 );
+    ctrl_mode_set( 0, CTRL_MODE_ZERO );
+    pressure_mbar_shl_target[0] = 1000 << PRESSURE_SHL;
+    loop_warm_enable = 0;
+    ctrl_mode_set( 0, CTRL_MODE_PRESSURE );
+    CHECK_EQ( ppid_loop[0].integrated, 0 );
+    ctrl_mode_set( 0, CTRL_MODE_ZERO );
+    loop_warm_enable = 1;
+
+    /* Flow held at 1000: recorded, then a record of 800 mbar scaled to a new target as pressure / flow */
+    flow_present[0] = true;
+    ctrl_mode_set( 0, CTRL_MODE_FLOW );
+    flow_raw_target[0] = 1000;
+    pressure_mbar_shl_output[0] = 800 << PRESSURE_SHL;
+    for ( cycle=0; cycle<100; cycle++ )
+    {
+        flow_raw_actual[0] = 1000;
+        flow_read_rc[0] = ERR_OK;
+        update_outputs();
+    }
+    CHECK_EQ( loop_warm[0][2], 1000 );
+    CHECK_EQ( loop_warm[0][3], pressure_mbar_shl_output[0] );
+    flow_out_map_record( 0, 1000, 800 << PRESSURE_SHL );
+
+    ctrl_mode_set( 0, CTRL_MODE_ZERO );
+    update_outputs();
+    CHECK_EQ( pressure_mbar_shl_output[0], 0 );
+    flow_raw_target[0] = 1500;
+    ctrl_mode_set( 0, CTRL_MODE_FLOW );
+    CHECK_EQ( pressure_mbar_shl_output[0], 1200 << PRESSURE_SHL );
+    ctrl_mode_set( 0, CTRL_MODE_ZERO );
+    flow_raw_target[0] = 500;
+    ctrl_mode_set( 0, CTRL_MODE_FLOW_CASCADE );
+    CHECK_EQ( flow_cascade_setpoint[0], 400 << PRESSURE_SHL );
+    ctrl_mode_set( 0, CTRL_MODE_ZERO );
+
+    store_flush_wait();
+    init();
+}
+
+static void chip_step( void )
+{
+    pressure_mbar_shl_actual[0] = regulator_step( pressure_mbar_shl_actual[0], pressure_mbar_shl_output[0] );
+    flow_raw_actual[0] += ( ( pressure_mbar_shl_actual[0] / 2 ) - flow_raw_actual[0] ) >> CHIP_SHR;
+    flow_read_rc[0] = ERR_OK;
+}
+
+static uint16_t flow_settle( int16_t target_raw, uint16_t cycles )
+{
+    /* Cycles until channel 0 stays within 2% of <target_raw>, 0 if it never does */
+    uint16_t cycle;
+    uint16_t settled = 0;
+    int16_t error;
+
+    flow_raw_target[0] = target_raw;
+    for ( cycle=1; cycle<=cycles; cycle++ )
+    {
+        update_outputs();
+        chip_step();
+
+        error = flow_raw_actual[0] - target_raw;
+        if ( ( error > ( target_raw / 50 ) ) || ( error < -( target_raw / 50 ) ) )
+            settled = 0;
+        else if ( settled == 0 )
+            settled = cycle;
+    }
+
+    return settled;
+}
+
+static uint8_t *flow_autotune_status( uint8_t *buf )
+{
+    /* [state][fail][transitions][settled] of channel 0, from the SET_FLOW_AUTOTUNE query */
+    CHECK_EQ( parse_packet( PACKET_TYPE_SET_FLOW_AUTOTUNE, NULL, 0 ), ERR_OK );
+    CHECK_EQ( drain( buf ), 4 + 1 + ( NUM_PRESSURE_CLTRLS * 4 ) );
+    CHECK_EQ( buf[3], ERR_OK );
+    return &buf[4];
+}
+
+static uint8_t *flow_sched_reply( uint8_t *buf, uint8_t *data, uint8_t size, err rc )
+{
+    /* [count] then the points and the gains in use, from SET_FLOW_SCHED */
+    CHECK_EQ( parse_packet( PACKET_TYPE_SET_FLOW_SCHED, data, size ), rc );
+    CHECK_EQ( drain( buf ), 4 + 1 + 1 + ( 4 * 8 ) + 6 );
+    CHECK_EQ( buf[3], rc );
+    return &buf[4];
+}
+
+static uint16_t u16_at( uint8_t *p )
+{
+    return p[0] | ( p[1] << 8 );
+}
+
+static void test_flow_out_map( void )
+{
+    /* The map on its own: between points on the line, past them scaled as pressure / flow */
+    uint16_t settled_map;
+    uint16_t settled_pid;
+
+    init();
+    CHECK_EQ( flow_out_map_output( 0, 1000 ), -1 );
+    flow_out_map_record( 0, 1000, 2000 );
+    CHECK_EQ( flow_out_map_output( 0, 1000 ), 2000 );
+    CHECK_EQ( flow_out_map_output( 0, 500 ), 1000 );
+    flow_out_map_record( 0, 2000, 4100 );
+    CHECK_EQ( flow_out_map_output( 0, 1500 ), 3050 );
+    CHECK_EQ( flow_out_map_output( 0, 3000 ), 6150 );
+    CHECK_EQ( flow_out_map_output( 0, 0 ), -1 );
+    CHECK_EQ( flow_out_map_output( 1, 1000 ), -1 );
+
+    /* Settled again at a target: the point moves. A fifth target drops the least recent. */
+    flow_out_map_record( 0, 1000, 2100 );
+    CHECK_EQ( flow_out_map_output( 0, 1000 ), 2100 );
+    flow_out_map_record( 0, 3000, 6000 );
+    flow_out_map_record( 0, 4000, 8000 );
+    flow_out_map_record( 0, 2000, 4000 );
+    flow_out_map_record( 0, 500, 900 );
+    CHECK_EQ( flow_out_map_output( 0, 4000 ), 8000 );
+    CHECK_EQ( flow_out_map_output( 0, 1250 ), 900 + ( 3100 * 750 / 1500 ) );
+    CHECK_EQ( flow_out_map_output( 0, 30000 ), PRESSURE_CTLR_MBAR << PRESSURE_SHL );
+
+    /* On the simulated chip, tuned gains: 1000 and 1500 settle into the map, and a step back
+     * to either goes straight to its output */
+    init();
+    hal_idle();
+    spi_reset();
+    flow_present[0] = true;
+    ctrl_modes[0] = CTRL_MODE_FLOW;
+    CHECK_EQ( flow_ctrl_start( 0, 1000 ), ERR_OK );
+    fpid_config[0].kp = 1502;
+    fpid_config[0].ki = 0;
+    fpid_config[0].kd = 10518;
+    CHECK( flow_settle( 1000, 600 ) > 0 );
+    CHECK( flow_settle( 1500, 600 ) > 0 );
+    CHECK( abs( flow_out_map_output( 0, 1000 ) - 2000 ) <= 2000 / 32 );
+    CHECK( abs( flow_out_map_output( 0, 1500 ) - 3000 ) <= 3000 / 32 );
+    settled_map = flow_settle( 1000, 600 );
+    loop_warm_enable = 0;
+    flow_settle( 1500, 600 );
+    settled_pid = flow_settle( 1000, 600 );
+    CHECK( ( settled_map > 0 ) && ( settled_pid > 0 ) && ( ( settled_map * 3 ) < ( settled_pid * 2 ) ) );
+    printf( "flow output map: 1500 -> 1000 settled in %u cycles, %u without\n", settled_map, settled_pid );
+
+    /* A ramp is left to the loop */
+    loop_warm_enable = 1;
+    flow_ramp_raw[0] = 10;
+    flow_raw_target[0] = 1500;
+    update_outputs();
+    CHECK( pressure_mbar_shl_output[0] < ( 2200 << PRESSURE_SHL ) );
+    flow_ramp_raw[0] = 0;
+
+    init();
+}
+
+static uint32_t flash_image_word( uint32_t addr )
+{
+    /* The image test_flash() writes: 32 instructions from 0 and two at 0x1000 */
+    if ( addr < 0x40 )
+        return 0x010000 + ( addr / 2 );
+    if ( ( addr == 0x1000 ) || ( addr == 0x1002 ) )
+        return 0xABCDEF - addr;
+    return 0xFFFFFF;
+}
+
+static uint32_t flash_image_crc( uint32_t size )
+{
+    /* CRC-32 as zlib over each instruction as three bytes, little endian */
+    uint32_t crc = 0xFFFFFFFF;
+    uint32_t word;
+    uint32_t addr;
+    uint8_t byte;
+    uint8_t bit;
+
+    for ( addr=0; addr<size; addr+=2 )
+    {
+        word = flash_image_word( addr );
+        for ( byte=0; byte<3; byte++, word>>=8 )
+        {
+            crc ^= word & 0xFF;
+            for ( bit=0; bit<8; bit++ )
+                crc = ( crc & 1 ) ? ( ( crc >> 1 ) ^ 0xEDB88320 ) : ( crc >> 1 );
+        }
+    }
+    return crc ^ 0xFFFFFFFF;
+}
+
+static err flash_request( uint8_t op, uint32_t addr, uint8_t count, uint32_t crc, uint8_t *status )
+{
+    /* FLASH <op>, WRITE with <count> instructions of the image from <addr>, VERIFY of <addr>
+     * bytes. The status of the reply to <status>, returns the err of the reply. */
+    uint8_t req[FLASH_WRITE_HEADER_SIZE + ( 32 * FLASH_WORD_SIZE )];
+    uint8_t buf[SPI_WRITE_BUF_SIZE + 1];
+    uint8_t size = 1;
+    uint32_t word;
+    uint8_t i;
+    err rc;
+
+    req[0] = op;
+    if ( ( op == FLASH_OP_WRITE ) || ( op == FLASH_OP_VERIFY ) )
+    {
+        memcpy( &req[1], &addr, sizeof(addr) );
+        size += sizeof(addr);
+    }
+    if ( op == FLASH_OP_VERIFY )
+    {
+        memcpy( &req[size], &crc, sizeof(crc) );
+        size += sizeof(crc);
+    }
+    for ( i=0; ( op == FLASH_OP_WRITE ) && ( i<count ); i++ )
+    {
+        word = flash_image_word( addr + ( 2 * i ) );
+        memcpy( &req[size], &word, FLASH_WORD_SIZE );
+        size += FLASH_WORD_SIZE;
+    }
+
+    rc = parse_packet( PACKET_TYPE_FLASH, req, size );
+    if ( rc != ERR_OK )
+        return rc;
+    CHECK_EQ( drain( buf ), 4 + 1 + FLASH_STATUS_SIZE );
+    CHECK_EQ( buf[2], PACKET_TYPE_FLASH );
+    memcpy( status, &buf[4], FLASH_STATUS_SIZE );
+    return buf[3];
+}
+
+static void test_flash( void )
+{
+    /* An update as software/drivers/flasher.py runs it, into the flash model of hal_flash.c.
+     * The running image was programmed with boot sequence 5. */
+    uint8_t status[FLASH_STATUS_SIZE];
+    uint8_t buf[SPI_WRITE_BUF_SIZE + 1];
+    uint32_t size = 0x1004;
+    uint32_t value;
+    uint16_t seq;
+    uint16_t pass;
+    uint32_t resets;
+    uint8_t active;
+
+    init();
+    spi_reset();
+    flash_init( &timer_ms, 1000 );
+    hal_flash_program( FLASH_PORT_FBTSEQ, ( (uint32_t)( ~5 & 0xFFF ) << 12 ) | 5 );
+    hal_flash_program( FLASH_PORT_INACTIVE + 0x0100, 0x123456 );
+    active = hal_flash_active;
+
+    CHECK_EQ( flash_request( FLASH_OP_STATUS, 0, 0, 0, status ), ERR_OK );
+    CHECK_EQ( status[0], FLASH_STATE_IDLE );
+    memcpy( &seq, &status[1], sizeof(seq) );
+    CHECK_EQ( seq, 5 );
+    memcpy( &value, &status[3], sizeof(value) );
+    CHECK_EQ( value, FLASH_PORT_PARTITION_SIZE );
+    CHECK_EQ( flash_request( FLASH_OP_WRITE, 0, 2, 0, status ), ERR_FLASH_STATE );
+    CHECK_EQ( flash_request( FLASH_OP_COMMIT, 0, 0, 0, status ), ERR_FLASH_STATE );
+    CHECK_EQ( flash_request( 9, 0, 0, 0, status ), ERR_PACKET_INVALID );
+
+    /* The erase takes a page per pass */
+    CHECK_EQ( flash_request( FLASH_OP_ERASE, 0, 0, 0, status ), ERR_OK );
+    CHECK_EQ( status[0], FLASH_STATE_ERASING );
+    for ( pass=0; ( pass<1000 ) && ( flash_request( FLASH_OP_STATUS, 0, 0, 0, status ) == ERR_OK ) &&
+          ( status[0] == FLASH_STATE_ERASING ); pass++ )
+        flash_task();
+    CHECK_EQ( pass, ( FLASH_PORT_PARTITION_SIZE / FLASH_PORT_PAGE_SIZE ) + 1 );
+    CHECK_EQ( status[0], FLASH_STATE_READY );
+    CHECK_EQ( hal_flash_read( FLASH_PORT_INACTIVE + 0x0100 ), 0xFFFFFF );
+
+    /* Written and read back. Unaligned, outside the partition or over FBTSEQ refused. */
+    CHECK_EQ( flash_request( FLASH_OP_WRITE, 0, 32, 0, status ), ERR_OK );
+    CHECK_EQ( flash_request( FLASH_OP_WRITE, 0x1000, 2, 0, status ), ERR_OK );
+    memcpy( &value, &status[7], sizeof(value) );
+    CHECK_EQ( value, 34 );
+    CHECK_EQ( hal_flash_read( FLASH_PORT_INACTIVE + 0x3E ), 0x01001F );
+    CHECK_EQ( hal_flash_read( FLASH_PORT_INACTIVE + 0x1002 ), 0xABCDEF - 0x1002 );
+    CHECK_EQ( hal_flash_read( 0x3E ), 0xFFFFFF );
+    CHECK_EQ( flash_request( FLASH_OP_WRITE, 0x2002, 2, 0, status ), ERR_FLASH_ADDRESS );
+    CHECK_EQ( flash_request( FLASH_OP_WRITE, 0x2000, 1, 0, status ), ERR_PACKET_INVALID );
+    CHECK_EQ( flash_request( FLASH_OP_WRITE, FLASH_PORT_FBTSEQ - 4, 4, 0, status ), ERR_FLASH_ADDRESS );
+    CHECK_EQ( flash_request( FLASH_OP_WRITE, FLASH_PORT_PARTITION_SIZE - 4, 4, 0, status ), ERR_FLASH_ADDRESS );
+    CHECK_EQ( flash_request( FLASH_OP_WRITE, FLASH_PORT_INACTIVE, 2, 0, status ), ERR_FLASH_ADDRESS );
+    CHECK_EQ( flash_request( FLASH_OP_VERIFY, 0x1001, 0, 0, status ), ERR_FLASH_ADDRESS );
+    CHECK_EQ( flash_request( FLASH_OP_COMMIT, 0, 0, 0, status ), ERR_FLASH_STATE );
+
+    /* Checked over several passes, then committed one below the running sequence */
+    CHECK_EQ( flash_request( FLASH_OP_VERIFY, size, 0, flash_image_crc( size ), status ), ERR_OK );
+    CHECK_EQ( flash_request( FLASH_OP_WRITE, 0x2000, 2, 0, status ), ERR_FLASH_STATE );
+    for ( pass=0; ( pass<1000 ) && ( flash_request( FLASH_OP_STATUS, 0, 0, 0, status ) == ERR_OK ) &&
+          ( status[0] == FLASH_STATE_VERIFYING ); pass++ )
+        flash_task();
+    CHECK_EQ( pass, ( size / 2 + 63 ) / 64 );
+    CHECK_EQ( status[0], FLASH_STATE_VERIFIED );
+    memcpy( &value, &status[15], sizeof(value) );
+    CHECK_EQ( value, flash_image_crc( size ) );
+    CHECK_EQ( flash_request( FLASH_OP_COMMIT, 0, 0, 0, status ), ERR_OK );
+    CHECK_EQ( status[0], FLASH_STATE_COMMITTED );
+    CHECK_EQ( hal_flash_read( FLASH_PORT_INACTIVE + FLASH_PORT_FBTSEQ ), ( (uint32_t)( ~4 & 0xFFF ) << 12 ) | 4 );
+
+    /* The reset waits for its reply to be read, and boots the new image */
+    resets = hal_resets;
+    CHECK_EQ( parse_packet( PACKET_TYPE_FLASH, (uint8_t[]){ FLASH_OP_RESET }, 1 ), ERR_OK );
+    flash_task();
+    CHECK_EQ( hal_resets, resets );
+    CHECK_EQ( drain( buf ), 4 + 1 + FLASH_STATUS_SIZE );
+    flash_task();
+    CHECK_EQ( hal_resets, resets + 1 );
+    CHECK_EQ( hal_flash_active, active ^ 1 );
+    CHECK_EQ( hal_flash_read( 0x3E ), 0x01001F );
+    flash_init( &timer_ms, 1000 );
+    CHECK_EQ( flash_boot_seq(), 4 );
+
+    /* Without a reader the reset goes after FLASH_RESET_TIMEOUT_MS anyway */
+    CHECK_EQ( parse_packet( PACKET_TYPE_FLASH, (uint8_t[]){ FLASH_OP_RESET }, 1 ), ERR_OK );
+    timer_ms += FLASH_RESET_TIMEOUT_MS;
+    flash_task();
+    CHECK_EQ( hal_resets, resets + 1 );
+    timer_ms++;
+    flash_task();
+    CHECK_EQ( hal_resets, resets + 2 );
+    CHECK_EQ( hal_flash_active, active ^ 1 );
+    spi_reset();
+    flash_init( &timer_ms, 1000 );
+
+    /* A failed update leaves the old partition erased, so the running image boots again */
+    CHECK_EQ( flash_request( FLASH_OP_ERASE, 0, 0, 0, status ), ERR_OK );
+    while ( flash_request( FLASH_OP_STATUS, 0, 0, 0, status ) == ERR_OK && ( status[0] == FLASH_STATE_ERASING ) )
+        flash_task();
+    CHECK_EQ( hal_flash_read( FLASH_PORT_INACTIVE + FLASH_PORT_FBTSEQ ), 0xFFFFFF );
+    CHECK_EQ( flash_request( FLASH_OP_WRITE, 0, 32, 0, status ), ERR_OK );
+    CHECK_EQ( flash_request( FLASH_OP_VERIFY, size, 0, flash_image_crc( size ), status ), ERR_OK );
+    while ( flash_request( FLASH_OP_STATUS, 0, 0, 0, status ) == ERR_OK && ( status[0] == FLASH_STATE_VERIFYING ) )
+        flash_task();
+    CHECK_EQ( status[0], FLASH_STATE_FAILED );
+    CHECK_EQ( flash_request( FLASH_OP_COMMIT, 0, 0, 0, status ), ERR_FLASH_STATE );
+    CHECK_EQ( flash_request( FLASH_OP_VERIFY, size, 0, 0, status ), ERR_FLASH_STATE );
+
+    /* A dword that does not read back fails the write */
+    CHECK_EQ( flash_request( FLASH_OP_ERASE, 0, 0, 0, status ), ERR_OK );
+    while ( flash_request( FLASH_OP_STATUS, 0, 0, 0, status ) == ERR_OK && ( status[0] == FLASH_STATE_ERASING ) )
+        flash_task();
+    hal_flash_program( FLASH_PORT_INACTIVE + 0x1000, 0 );
+    CHECK_EQ( flash_request( FLASH_OP_WRITE, 0x1000, 2, 0, status ), ERR_FLASH_WRITE );
+    CHECK_EQ( flash_request( FLASH_OP_STATUS, 0, 0, 0, status ), ERR_OK );
+    CHECK_EQ( status[0], FLASH_STATE_FAILED );
+
+    CHECK_EQ( parse_packet( PACKET_TYPE_FLASH, (uint8_t[]){ FLASH_OP_RESET }, 1 ), ERR_OK );
+    spi_reset();
+    flash_task();
+    CHECK_EQ( hal_resets, resets + 3 );
+    CHECK_EQ( hal_flash_active, active ^ 1 );
+    CHECK_EQ( flash_boot_seq(), 4 );
+    flash_init( &timer_ms, 1000 );
+}
+
+static void test_flow_sched( void )
+{
+    /* 500 ul/hr: P 100 I 10 D 1000, 1500 ul/hr: P 300 I 30 D 3000 */
+    uint8_t set[2 + 16] = { 0, 2, 0xF4, 0x01, 100, 0, 10, 0, 0xE8, 0x03,
+                                  0xDC, 0x05, 0x2C, 0x01, 30, 0, 0xB8, 0x0B };
+    uint8_t query[1] = { 0 };
+    uint8_t clear[2] = { 0, 0 };
+    uint8_t bad[2 + 16];
+    uint8_t buf[48];
+    uint8_t *reply;
+    uint16_t scheds[NUM_PRESSURE_CLTRLS][STORE_FLOW_SCHED_WORDS];
+
+    init();
+    hal_idle();
+    spi_reset();
+    storage_startup();
+    flow_set_scale( 0, 60 );        // 1 count per ul/hr
+
+    /* None stored: the FPID constants are in use */
+    reply = flow_sched_reply( buf, query, sizeof(query), ERR_OK );
+    CHECK_EQ( reply[0], 0 );
+    CHECK_EQ( u16_at( &reply[33] ), fpid_config[0].kp );
+    CHECK_EQ( u16_at( &reply[37] ), fpid_config[0].kd );
+
+    /* Set, echoed back, and the gains in use follow the setpoint */
+    flow_raw_setpoint[0] = 1000;
+    reply = flow_sched_reply( buf, set, sizeof(set), ERR_OK );
+    CHECK_EQ( reply[0], 2 );
+    CHECK_EQ( memcmp( &reply[1], &set[2], 16 ), 0 );
+    CHECK_EQ( u16_at( &reply[17] ), 0 );
+    CHECK_EQ( u16_at( &reply[33] ), 200 );
+    CHECK_EQ( u16_at( &reply[35] ), 20 );
+    CHECK_EQ( u16_at( &reply[37] ), 2000 );
+    flow_raw_setpoint[0] = 750;
+    reply = flow_sched_reply( buf, query, sizeof(query), ERR_OK );
+    CHECK_EQ( u16_at( &reply[33] ), 150 );
+    CHECK_EQ( u16_at( &reply[37] ), 1500 );
+    flow_raw_setpoint[0] = 100;
+    reply = flow_sched_reply( buf, query, sizeof(query), ERR_OK );
+    CHECK_EQ( u16_at( &reply[33] ), 100 );
+    flow_raw_setpoint[0] = 3000;
+    reply = flow_sched_reply( buf, query, sizeof(query), ERR_OK );
+    CHECK_EQ( u16_at( &reply[33] ), 300 );
+    CHECK_EQ( u16_at( &reply[35] ), 30 );
+
+    /* The flow loop steps with them, the FPID constants are kept */
+    flow_raw_target[0] = 1250;
+    flow_raw_setpoint[0] = 1250;
+    flow_pid_step( 0 );
+    CHECK_EQ( fpid_sched_config[0].kp, 250 );
+    CHECK_EQ( fpid_sched_config[0].kd, 2500 );
+    CHECK_EQ( fpid_sched_config[0].out_max, fpid_config[0].out_max );
+    CHECK( fpid_config[0].kp != 250 );
+
+    /* Stored, and loaded again at start-up */
+    CHECK_EQ( store_flush_wait(), 0 );
+    store_load_flow_scheds( (uint16_t *)scheds );
+    CHECK_EQ( scheds[0][0], 2 );
+    CHECK_EQ( scheds[0][5], 1500 );
+    CHECK_EQ( scheds[1][0], 0 );
+    init();
+    spi_reset();
+    storage_startup();
+    flow_set_scale( 0, 60 );
+    flow_raw_setpoint[0] = 1000;
+    reply = flow_sched_reply( buf, query, sizeof(query), ERR_OK );
+    CHECK_EQ( reply[0], 2 );
+    CHECK_EQ( u16_at( &reply[33] ), 200 );
+
+    /* Flows not rising, sizes, counts and channels out of range: refused, the schedule kept */
+    memcpy( bad, set, sizeof(bad) );
+    bad[10] = 0xF4;
+    bad[11] = 0x01;
+    CHECK_EQ( parse_packet( PACKET_TYPE_SET_FLOW_SCHED, bad, sizeof(bad) ), ERR_PACKET_INVALID );
+    bad[10] = 0xDC;
+    bad[11] = 0x05;
+    bad[3] = 0x80;
+    CHECK_EQ( parse_packet( PACKET_TYPE_SET_FLOW_SCHED, bad, sizeof(bad) ), ERR_PACKET_INVALID );
+    CHECK_EQ( parse_packet( PACKET_TYPE_SET_FLOW_SCHED, set, sizeof(set) - 1 ), ERR_PACKET_INVALID );
+    bad[1] = 5;
+    CHECK_EQ( parse_packet( PACKET_TYPE_SET_FLOW_SCHED, bad, sizeof(bad) ), ERR_PACKET_INVALID );
+    query[0] = NUM_PRESSURE_CLTRLS;
+    CHECK_EQ( parse_packet( PACKET_TYPE_SET_FLOW_SCHED, query, sizeof(query) ), ERR_PACKET_INVALID );
+    CHECK_EQ( spi_write_bytes_written(), 0 );
+    query[0] = 0;
+    reply = flow_sched_reply( buf, query, sizeof(query), ERR_OK );
+    CHECK_EQ( reply[0], 2 );
+
+    /* Count 0 goes back to the FPID constants */
+    reply = flow_sched_reply( buf, clear, sizeof(clear), ERR_OK );
+    CHECK_EQ( reply[0], 0 );
+    CHECK_EQ( u16_at( &reply[33] ), fpid_config[0].kp );
+
+    CHECK_EQ( store_flush_wait(), 0 );
+    spi_reset();
+    init();
+}
+
+static void test_watchdog_resume( void )
+{
+    /* A pressure loop settled on a regulator 50 mbar short and a flow loop, then a watchdog
+     * reset: init() clears everything but the retain block, and the loops resume from it */
+    uint16_t output[2];
+    int32_t integrated;
+    uint16_t cycle;
+
+    init();
+    hal_idle();
+    spi_reset();
+    storage_startup();
+    memset( loop_warm, EEPROM_BLANK_U8, sizeof(loop_warm) );
+    hal_i2c_device = NULL;
+
+    ctrl_mode_set( 0, CTRL_MODE_PRESSURE );
+    pressure_mbar_shl_target[0] = 1000 << PRESSURE_SHL;
+    flow_set_scale( 1, 60 );
+    flow_raw_target[1] = 500;
+    flow_ramp_raw[1] = 20;
+    ctrl_mode_set( 1, CTRL_MODE_FLOW );
+    pressure_mbar_shl_output[1] = 800 << PRESSURE_SHL;
+    for ( cycle=0; cycle<300; cycle++ )
+    {
+        flow_raw_actual[1] = 500;
+        flow_read_rc[1] = ERR_OK;
+        update_outputs();
+        pressure_mbar_shl_actual[0] = regulator_step( pressure_mbar_shl_actual[0], pressure_mbar_shl_output[0] - ( 50 << PRESSURE_SHL ) );
+        retain_save();
+    }
+    output[0] = pressure_mbar_shl_output[0];
+    output[1] = pressure_mbar_shl_output[1];
+    integrated = ppid_loop[0].integrated;
+    CHECK( abs( ( integrated >> PPID_SHIFT ) - ( 50 << PRESSURE_SHL ) ) <= ( 2 << PRESSURE_SHL ) );
+
+    init();
+    storage_startup();
+    flow_boot_start();
+    CHECK( retain_restore( RESET_MASK_WDTO | RESET_MASK_EXTR ) );
+    CHECK_EQ( retain_status, 1 );
+    CHECK_EQ( ctrl_modes[0], CTRL_MODE_PRESSURE );
+    CHECK_EQ( pressure_mbar_shl_target[0], 1000 << PRESSURE_SHL );
+    CHECK_EQ( pressure_mbar_shl_output[0], output[0] );
+    CHECK_EQ( ppid_loop[0].integrated, integrated );
+    CHECK_EQ( ctrl_modes[1], CTRL_MODE_FLOW );
+    CHECK_EQ( flow_scales_ul_min[1], 60 );
+    CHECK_EQ( flow_raw_target[1], 500 );
+    CHECK_EQ( flow_ramp_raw[1], 20 );
+    CHECK_EQ( pressure_mbar_shl_output[1], output[1] );
+
+    /* The pressure loop carries on from the first cycle, not from zero, and the flow loop
+     * holds its output until its sensor is found */
+    pressure_mbar_shl_actual[0] = 1000 << PRESSURE_SHL;
+    update_outputs();
+    CHECK( abs( pressure_mbar_shl_output[0] - output[0] ) <= ( 1 << PRESSURE_SHL ) );
+    CHECK_EQ( pressure_mbar_shl_output[1], output[1] );
+
+    /* Any other reset starts cold, as does a block that fails its CRC */
+    retain_save();
+    init();
+    CHECK( !retain_restore( RESET_MASK_EXTR ) );
+    CHECK_EQ( retain_status, 0 );
+    CHECK_EQ( ctrl_modes[0], CTRL_MODE_ZERO );
+    retain[2] ^= 0x01;
+    CHECK( !retain_restore( RESET_MASK_WDTO ) );
+    CHECK_EQ( retain_status, 2 );
+    CHECK_EQ( ctrl_modes[0], CTRL_MODE_ZERO );
+    CHECK_EQ( pressure_mbar_shl_output[0], 0 );
+
+    init();
+    hal_idle();
+}
+
+static void test_flow_autotune( void )
+{
+    uint8_t buf[40];
+    uint8_t *status;
+    uint8_t stop[2] = { 0x01, 0 };
+    uint16_t cycle;
+    uint16_t settled_default;
+    uint16_t settled_tuned;
+
+    init();
+    hal_idle();
+    spi_reset();
+    loop_warm_enable = 0;           // The gains alone, without the output map
+    flow_present[0] = true;
+    ctrl_modes[0] = CTRL_MODE_FLOW;
+    CHECK_EQ( flow_ctrl_start( 0, 1000 ), ERR_OK );
+
+    /* Default gains, from 1000 to 1500. Their second integral keeps this chip cycling, 0. */
+    flow_settle( 1000, 600 );
+    settled_default = flow_settle( 1500, 600 );
+    flow_settle( 1000, 600 );
+
+    /* Relay of 50 mbar around 1000, the bias stepping there first, until three estimates
+     * agree, then back to flow control */
+    CHECK_EQ( flow_autotune_start( 0, 1000, 50 << PRESSURE_SHL ), ERR_OK );
+    status = flow_autotune_status( buf );
+    CHECK_EQ( status[0], 1 );
+    for ( cycle=0; ( cycle < 2000 ) && ( status[0] == 1 ); cycle++ )
+    {
+        update_outputs();
+        chip_step();
+        status = flow_autotune_status( buf );
+    }
+    CHECK_EQ( status[0], 3 );
+    CHECK_EQ( status[1], 0 );
+    CHECK( status[2] >= 2 * 3 );
+    CHECK_EQ( status[3], 3 );
+    CHECK_EQ( ctrl_modes[0], CTRL_MODE_FLOW );
+    CHECK_EQ( fpid_config[0].ki, 0 );
+    CHECK( fpid_config[0].kd > 1000 );
+    CHECK( fpid_config[0].kp > 0 );
+    printf( "flow autotune: %u cycles, P %u I %u D %u\n", cycle, fpid_config[0].kp, fpid_config[0].ki, fpid_config[0].kd );
+
+    /* The tuned loop settles, in well under the 600 cycles */
+    CHECK( flow_settle( 1000, 600 ) > 0 );
+    settled_tuned = flow_settle( 1500, 600 );
+    CHECK( ( settled_tuned > 0 ) && ( settled_tuned < 100 ) );
+    CHECK( ( settled_default == 0 ) || ( ( settled_tuned * 2 ) < settled_default ) );
+    printf( "flow autotune: 1000 -> 1500 settled in %u cycles, %u with the default gains\n", settled_tuned, settled_default );
+
+    /* A target the relay cannot reach times out, once the bias has stepped to the top */
+    CHECK_EQ( flow_autotune_start( 0, 20000, 50 << PRESSURE_SHL ), ERR_OK );
+    for ( cycle=0; ( cycle < 20000 ) && ( flow_autotune_status( buf )[0] == 1 ); cycle++ )
+    {
+        update_outputs();
+        chip_step();
+    }
+    status = flow_autotune_status( buf );
+    CHECK_EQ( status[0], 4 );
+    CHECK_EQ( status[1], 2 );
+
+    /* Stopped by the packet, or by a new control mode */
+    CHECK_EQ( flow_autotune_start( 0, 1000, 50 << PRESSURE_SHL ), ERR_OK );
+    CHECK_EQ( parse_packet( PACKET_TYPE_SET_FLOW_AUTOTUNE, stop, sizeof(stop) ), ERR_OK );
+    CHECK_EQ( drain( buf ), 4 + 1 + ( NUM_PRESSURE_CLTRLS * 4 ) );
+    CHECK_EQ( buf[4], 2 );
+    CHECK_EQ( flow_autotune_start( 0, 1000, 50 << PRESSURE_SHL ), ERR_OK );
+    ctrl_modes[0] = CTRL_MODE_PRESSURE;
+    CHECK_EQ( parse_packet( 8, (uint8_t *)"\x01\x00", 2 ), ERR_OK );
+    drain( buf );
+    status = flow_autotune_status( buf );
+    CHECK_EQ( status[0], 2 );
+
+    /* Odd sizes, relay out of range and channels without a sensor are refused */
+    stop[1] = 1;
+    CHECK_EQ( parse_packet( PACKET_TYPE_SET_FLOW_AUTOTUNE, stop, 1 ), ERR_PACKET_INVALID );
+    CHECK_EQ( parse_packet( PACKET_TYPE_SET_FLOW_AUTOTUNE, (uint8_t *)"\x01\x01\x00\x00\x00\x00", 6 ), ERR_PACKET_INVALID );
+    stop[0] = 0x02;
+    flow_present[1] = false;
+    CHECK_EQ( parse_packet( PACKET_TYPE_SET_FLOW_AUTOTUNE, stop, sizeof(stop) ), ERR_ERROR );
+
+    spi_reset();
+    init();
+}
+
+static void bench_pressure( void )
+{
+    uint8_t data[24];
+    uint8_t buf[48];
+    uint8_t read_data[SPI_PACKET_BUF_SIZE];
+    uint8_t read_type;
+    uint8_t read_size;
+    uint8_t len_sum;
+    uint8_t len_crc;
+    uint8_t buf_crc[48];
+    uint8_t chan;
+
+    memset( data, 0x5A, sizeof(data) );
+    len_sum = frame( buf, false, PACKET_TYPE_TEST, data, sizeof(data) );
+    len_crc = frame( buf_crc, true, PACKET_TYPE_TEST, data, sizeof(data) );
+
+    /* Each includes the spi_handler() call per received byte */
+    spi_reset();
+    BENCH( "spi_packet_read 24 B checksum", 1000000,
+           feed( buf, len_sum );
+           spi_packet_read( &packet, &read_type, read_data, &read_size, sizeof(read_data) ) );
+    BENCH( "spi_packet_read 24 B CRC-16", 1000000,
+           feed( buf_crc, len_crc );
+           spi_packet_read( &packet, &read_type, read_data, &read_size, sizeof(read_data) ) );
+
+    init();
+    hal_idle();
+    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+    {
+        ctrl_modes[chan] = CTRL_MODE_PRESSURE;
+        pressure_ctrl_start( chan );
+        pressure_mbar_shl_target[chan] = (uint16_t)( 500 + chan * 250 ) << PRESSURE_SHL;
+    }
+    BENCH( "update_outputs 4 pressure loops", 1000000,
+           update_outputs();
+           for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+               pressure_mbar_shl_actual[chan] = regulator_step( pressure_mbar_shl_actual[chan], pressure_mbar_shl_output[chan] ) );
+}
+
+int main( int argc, char **argv )
+{
+    bench_init( argc, argv );
+
+    RUN_TEST( test_spi_packet_read );
+    RUN_TEST( test_spi_packet_write );
+    RUN_TEST( test_spi_reply_ready );
+    RUN_TEST( test_spi_deselect );
+    RUN_TEST( test_reply_cache );
+    RUN_TEST( test_capabilities );
+    RUN_TEST( test_benchmark );
+    RUN_TEST( test_history_stream );
+    RUN_TEST( test_delta );
+    RUN_TEST( test_telemetry_compact );
+    RUN_TEST( test_report );
+    RUN_TEST( test_history_stream_compact );
+    RUN_TEST( test_boot_status );
+    RUN_TEST( test_time_sync );
+    RUN_TEST( test_frame_sync );
+    RUN_TEST( test_stage );
+    RUN_TEST( test_probe_load );
+    RUN_TEST( test_i2c_bus );
+    RUN_TEST( test_adc_burst );
+    RUN_TEST( test_flow_schedule );
+    RUN_TEST( test_flow_flags );
+    RUN_TEST( test_flow_res );
+    RUN_TEST( test_flow_est );
+    RUN_TEST( test_update_outputs_pressure );
+    RUN_TEST( test_ctrl_event );
+    RUN_TEST( test_latency );
+    RUN_TEST( test_module_addr );
+    RUN_TEST( test_pressure_limit );
+    RUN_TEST( test_pressure_cal );
+    RUN_TEST( test_loop_warm_start );
+    RUN_TEST( test_watchdog_resume );
+    RUN_TEST( test_flow_autotune );
+    RUN_TEST( test_flow_sched );
+    RUN_TEST( test_flow_out_map );
+    RUN_TEST( test_flash );
+
+    if ( bench_enabled() )
+        bench_pressure();
+
+    return TEST_RESULT();
+}
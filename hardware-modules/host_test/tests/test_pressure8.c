@@ -0,0 +1,231 @@
+/*
+ * Pressure and flow board built with NUM_PRESSURE_CLTRLS 8, two banks of four channels:
+ * the ADC sequence across the two ADS1115s, the flow MUX switch between the cascaded
+ * PCA9544As, the DAC select of each bank, the per channel parameter ids and the banked store.
+ */
+
+#include "test.h"
+#include "hal.h"
+#include "common.h"
+#include "mcc_generated_files/mcc.h"
+#include "ads1115.h"
+#include "sensirion_lg16.h"
+#include "rio_param.h"
+#include "storage.h"
+
+/* From pressure_and_flow_pic/main.c */
+#define PRESSURE_SHL                        3
+#define PARAM_ID_PRESSURE_LIMIT             0x68
+
+typedef enum
+{
+    CTRL_MODE_ZERO,
+    CTRL_MODE_PRESSURE_OPEN_LOOP,
+} E_CTRL_MODE;
+
+extern E_CTRL_MODE ctrl_modes[NUM_PRESSURE_CLTRLS];
+extern volatile uint16_t pressure_mbar_shl_output[NUM_PRESSURE_CLTRLS];
+extern uint16_t pressure_limit_mbar[NUM_PRESSURE_CLTRLS];
+extern bool flow_present[NUM_PRESSURE_CLTRLS];
+extern uint8_t flow_monitor_div;
+
+void init( void );
+void adc_read_start( int8_t read_chan, int8_t start_chan );
+void set_pressures( void );
+void set_pressure( uint8_t chan );
+void read_flows_start( void );
+void read_flows_poll( void );
+err param_set_pressure_limit( const param_desc_t *param, int32_t value );
+
+#define I2C_LOG_MAX                         8
+
+static uint8_t i2c_log[I2C_LOG_MAX];
+static uint8_t i2c_log_count;
+static uint8_t i2c_last_write[3];
+
+static bool i2c_adc_bus( uint8_t address, bool read, uint8_t *buf, uint8_t length )
+{
+    if ( i2c_log_count < I2C_LOG_MAX )
+        i2c_log[i2c_log_count++] = address;
+    if ( !read && ( length == 3 ) )
+        memcpy( i2c_last_write, buf, 3 );
+    return true;
+}
+
+static void test_adc_banks( void )
+{
+    init();
+    hal_i2c_device = i2c_adc_bus;
+
+    /* Inputs 0-3 on the ADS1115 at 0x48, 4-7 on the one at 0x49 */
+    i2c_log_count = 0;
+    adc_read_start( -1, 0 );
+    CHECK_EQ( i2c_log_count, 1 );
+    CHECK_EQ( i2c_log[0], 0x48 );
+
+    /* Crossing banks reads the last input of one and starts AIN0 of the other */
+    i2c_log_count = 0;
+    adc_read_start( 3, 4 );
+    CHECK_EQ( i2c_log_count, 3 );
+    CHECK_EQ( i2c_log[0], 0x48 );
+    CHECK_EQ( i2c_log[1], 0x48 );
+    CHECK_EQ( i2c_log[2], 0x49 );
+    CHECK_EQ( i2c_last_write[0], ADS1115_REG_CONFIG );
+    CHECK_EQ( ( i2c_last_write[1] >> 4 ) & 0x07, 0b100 );
+
+    i2c_log_count = 0;
+    adc_read_start( 7, -1 );
+    CHECK_EQ( i2c_log_count, 2 );
+    CHECK_EQ( i2c_log[0], 0x49 );
+    CHECK_EQ( i2c_log[1], 0x49 );
+
+    hal_i2c_device = NULL;
+}
+
+static uint8_t mux_writes[2];
+static uint8_t mux_selected[2];
+static uint8_t flow_sensor_reads[NUM_PRESSURE_CLTRLS];
+static uint8_t flow_sensor_clashes;
+
+static bool i2c_flow_bus( uint8_t address, bool read, uint8_t *buf, uint8_t length )
+{
+    /* PCA9544As at 0x70 and 0x71, the LG16s of both banks at 0x40 behind them */
+    static const uint8_t mux_to_chan[4] = { 1, 0, 2, 3 };   // Inverse of main.c flow_map[]
+    uint8_t bank;
+
+    if ( ( address == 0x70 ) || ( address == 0x71 ) )
+    {
+        mux_writes[address - 0x70]++;
+        mux_selected[address - 0x70] = buf[0];
+    }
+    else if ( read && ( ( length == SENSIRION_READ_FLOW_BYTES ) || ( length == SENSIRION_READ_FLAGS_BYTES ) ) )
+    {
+        if ( ( mux_selected[0] & 0x04 ) && ( mux_selected[1] & 0x04 ) )
+            flow_sensor_clashes++;
+        bank = ( mux_selected[1] & 0x04 ) ? 1 : 0;
+        flow_sensor_reads[( bank * 4 ) + mux_to_chan[mux_selected[bank] & 0x03]]++;
+        memset( buf, 0, length );
+        buf[2] = sensirion_crc( &buf[0], 2 );
+        if ( length == SENSIRION_READ_FLAGS_BYTES )
+        {
+            buf[5] = sensirion_crc( &buf[3], 2 );
+            buf[8] = sensirion_crc( &buf[6], 2 );
+        }
+    }
+    return true;
+}
+
+static void test_flow_banks( void )
+{
+    uint8_t chan;
+    uint8_t pass;
+
+    init();
+    hal_i2c_device = i2c_flow_bus;
+    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+    {
+        flow_present[chan] = true;
+        ctrl_modes[chan] = CTRL_MODE_ZERO;
+    }
+    flow_monitor_div = 1;
+    memset( mux_writes, 0, sizeof(mux_writes) );
+    memset( mux_selected, 0, sizeof(mux_selected) );
+    memset( flow_sensor_reads, 0, sizeof(flow_sensor_reads) );
+    flow_sensor_clashes = 0;
+
+    read_flows_start();
+    for ( pass=0; pass<NUM_PRESSURE_CLTRLS; pass++ )
+        read_flows_poll();
+
+    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+        CHECK_EQ( flow_sensor_reads[chan], 1 );
+    CHECK_EQ( flow_sensor_clashes, 0 );
+
+    /* Each mux is written for its own four channels, and once more turned off as the other
+     * bank starts */
+    CHECK_EQ( mux_writes[0], 5 );
+    CHECK_EQ( mux_writes[1], 5 );
+    CHECK_EQ( mux_selected[0], 0 );
+
+    hal_i2c_device = NULL;
+    init();
+}
+
+static uint32_t dac_last_word( void )
+{
+    return ( (uint32_t)SPI2BUFH << 16 ) | SPI2BUFL;
+}
+
+static void test_dac_banks( void )
+{
+    uint8_t chan;
+
+    init();
+    hal_idle();
+    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+        pressure_mbar_shl_output[chan] = (uint16_t)( 500 * ( chan + 1 ) ) << PRESSURE_SHL;
+    set_pressures();
+    CHECK_EQ( hal_dac_bank, 1 );
+    CHECK_EQ( ( dac_last_word() >> 24 ) & 0x3F, ( 0b010 << 3 ) | 3 );
+
+    /* Only bank 0 changed, its DAC alone is written and updates all its outputs */
+    pressure_mbar_shl_output[1] = 100 << PRESSURE_SHL;
+    set_pressures();
+    CHECK_EQ( hal_dac_bank, 0 );
+    CHECK_EQ( ( dac_last_word() >> 24 ) & 0x3F, ( 0b010 << 3 ) | 1 );
+
+    /* Channel 6 is output C of the second DAC */
+    pressure_mbar_shl_output[6] = 200 << PRESSURE_SHL;
+    set_pressure( 6 );
+    CHECK_EQ( hal_dac_bank, 1 );
+    CHECK_EQ( ( dac_last_word() >> 24 ) & 0x3F, ( 0b011 << 3 ) | 2 );
+}
+
+static void test_param_ids( void )
+{
+    /* Channels 4-7 are channels 0-3 with bit 7 of the id set */
+    const param_desc_t limit1 = { .id = PARAM_ID_PRESSURE_LIMIT + 1 };
+    const param_desc_t limit5 = { .id = PARAM_ID_PRESSURE_LIMIT + 0x80 + 1 };
+
+    init();
+    CHECK_EQ( param_set_pressure_limit( &limit1, 1000 ), ERR_OK );
+    CHECK_EQ( param_set_pressure_limit( &limit5, 2000 ), ERR_OK );
+    CHECK_EQ( pressure_limit_mbar[1], 1000 );
+    CHECK_EQ( pressure_limit_mbar[5], 2000 );
+
+    pressure_limit_mbar[1] = 0;
+    pressure_limit_mbar[5] = 0;
+}
+
+static void test_store_banks( void )
+{
+    uint16_t limits[NUM_PRESSURE_CLTRLS];
+
+    /* A blank EEPROM has no slot in either bank, until each is written */
+    store_init();
+    CHECK_EQ( store_blank_banks(), 0x03 );
+
+    CHECK_EQ( store_save_pressure_limit( 5, 1234 ), ERR_OK );
+    CHECK( store_dirty() );
+    store_load_pressure_limits( limits );
+    CHECK_EQ( limits[5], 1234 );
+    CHECK( limits[1] != 1234 );
+
+    /* Only the bank of channel 5 was saved and committed */
+    store_flush_wait();
+    CHECK( !store_dirty() );
+    CHECK_EQ( store_blank_banks(), 0x01 );
+}
+
+int main( int argc, char **argv )
+{
+    bench_init( argc, argv );
+
+    RUN_TEST( test_adc_banks );
+    RUN_TEST( test_flow_banks );
+    RUN_TEST( test_dac_banks );
+    RUN_TEST( test_param_ids );
+    RUN_TEST( test_store_banks );
+
+    return TEST_RESULT();
+}
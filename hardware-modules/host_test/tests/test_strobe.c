@@ -0,0 +1,835 @@
+/*
+ * Strobe board: find_scalers_time() against the brute-force search it replaced, long waits
+ * on SMT1, raw register timing, the frame period and phase lock, the capture pairing of the trigger path self-test, the frame
+ * clock, the gate of the chained trigger, the second strobe channel, the sequence table and
+ * the CPU load meter.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <xc.h>
+#include "test.h"
+#include "hal.h"
+#include "common.h"
+#include "trig_test.h"
+#include "frame_clock.h"
+#include "strobe_b.h"
+
+/* From strobe_pic/main.c, CLOCK_FREQ 32 MHz: 31.25 ns per FOSC/4 tick */
+#define TICKS_TO_NS( t )    ( ( ( (uint32_t)(t) << 7 ) - ( (uint32_t)(t) << 1 ) - (uint32_t)(t) ) >> 2 )
+#define MAX_TIME_NS         16320000u
+#define MAX_LONG_TIME_NS    524288000u
+#define LONG_WAIT_TICKS     ( 2 + 96 )      // TMR2 tail and SMT1 interrupt entry
+#define STROBE_SEQ_MAX_ENTRIES  16
+
+/* Also from main.c */
+typedef struct
+{
+    uint32_t triggers;
+    uint32_t fired;
+    uint32_t dropped_busy;
+    uint32_t dropped_disabled;
+} strobe_stats_t;
+
+typedef struct
+{
+    uint8_t pr2;
+    uint8_t pr4;
+    uint8_t t2con;
+    uint8_t t4con;
+    uint32_t smt_pr;
+} strobe_timing_t;
+
+extern volatile strobe_stats_t strobe_stats;
+extern volatile uint8_t long_wait_running;
+extern volatile uint8_t strobe_timing_shadow_pending;
+extern uint16_t phase_lock;
+extern uint32_t phase_lock_wait_ns;
+extern uint8_t strobe_seq_length;
+extern volatile uint8_t strobe_seq_active;
+
+uint32_t find_scalers_time( uint32_t target_time_ns, uint8_t *prescale, uint8_t *postscale, uint8_t *period );
+uint8_t calc_strobe_timing( uint32_t *wait_target_ns, uint32_t *duration_target_ns, strobe_timing_t *timing );
+uint8_t decode_strobe_timing( const uint8_t *data, strobe_timing_t *timing, uint32_t *wait_ns, uint32_t *duration_ns );
+void load_strobe_timing( strobe_timing_t *timing );
+void commit_strobe_timing( void );
+void frame_period_init( void );
+void frame_period_capture( void );
+uint32_t frame_period_ticks( void );
+uint32_t phase_lock_ticks( uint32_t period_ticks, uint16_t phase );
+void phase_lock_poll( void );
+void set_strobe_timing( uint32_t *wait_target_ns, uint32_t *duration_target_ns );
+uint8_t hardware_trigger_strobe( void );
+void long_wait_end( void );
+void set_strobe_enable( uint8_t enable );
+void set_trigger_mode( uint8_t mode );
+err set_strobe_pulses( uint8_t count, uint32_t gap_target_ns );
+uint8_t chained_trigger_strobe( void );
+err set_strobe_seq_entry( uint8_t index, uint32_t *wait_target_ns, uint32_t *duration_target_ns, uint8_t repeat );
+err set_strobe_seq( uint8_t length, uint8_t loop );
+uint8_t strobe_events_pop( uint8_t *buf, uint8_t max_events );
+void load_init( void );
+void load_pass( void );
+void load_isr_enter( void );
+void load_isr_exit( void );
+void load_report( uint8_t *buf, uint8_t reset );
+
+static uint32_t find_scalers_time_reference( uint32_t target_time_ns, uint8_t *prescale, uint8_t *postscale, uint8_t *period )
+{
+    /* The brute-force search find_scalers_time() replaced, with the differences taken as
+     * I32 as on the PIC, where long is 32 bits */
+    uint32_t ticks;
+    uint32_t rem;
+    uint32_t period_loop;
+    int8_t postscale_loop;
+    int8_t prescale_loop;
+    uint32_t time_ns_loop;
+    uint32_t time_ns_best;
+    uint8_t postscale_best;
+    uint8_t prescale_best;
+    uint32_t period_best;
+
+    if ( target_time_ns > MAX_TIME_NS )
+        return 0;
+
+    ticks = ( target_time_ns * 100 + 1562 ) / 3125;
+
+    time_ns_best = 0;
+    postscale_best = 0;
+    prescale_best = 0;
+    period_best = 0;
+
+    for ( postscale_loop=16; postscale_loop>=1; postscale_loop-- )
+    {
+        rem = ticks / postscale_loop;
+
+        for ( prescale_loop=7; prescale_loop>=0; prescale_loop-- )
+        {
+            if ( prescale_loop == 0 )
+                period_loop = rem;
+            else
+                period_loop = ( ( rem >> ( prescale_loop - 1 ) ) + 1 ) >> 1;
+
+            if ( ( period_loop > 0 ) && ( period_loop <= 0xFF ) && ( ( period_loop > 1 ) || ( prescale_loop > 0 ) ) )
+            {
+                time_ns_loop = ( ( ( (uint32_t)3125 << prescale_loop ) * period_loop ) * postscale_loop ) / 100;
+
+                if ( labs( (int32_t)( time_ns_loop - target_time_ns ) ) < labs( (int32_t)( time_ns_best - target_time_ns ) ) )
+                {
+                    time_ns_best = time_ns_loop;
+                    postscale_best = postscale_loop;
+                    prescale_best = prescale_loop;
+                    period_best = period_loop;
+                }
+
+                if ( time_ns_loop == target_time_ns )
+                    break;
+            }
+        }
+    }
+
+    *prescale = prescale_best;
+    *postscale = postscale_best - 1;
+    *period = (uint8_t)( period_best - 1 );
+
+    return time_ns_best;
+}
+
+static void check_target( uint32_t target_ns )
+{
+    uint8_t prescale[2];
+    uint8_t postscale[2];
+    uint8_t period[2];
+    uint32_t time_ns[2];
+
+    time_ns[0] = find_scalers_time( target_ns, &prescale[0], &postscale[0], &period[0] );
+    time_ns[1] = find_scalers_time_reference( target_ns, &prescale[1], &postscale[1], &period[1] );
+
+    CHECK_EQ( time_ns[0], time_ns[1] );
+    if ( time_ns[0] != 0 )
+    {
+        CHECK_EQ( prescale[0], prescale[1] );
+        CHECK_EQ( postscale[0], postscale[1] );
+        CHECK_EQ( period[0], period[1] );
+
+        /* The returned time is what the registers give */
+        CHECK_EQ( time_ns[0], TICKS_TO_NS( ( ( (uint32_t)period[0] + 1 ) * ( postscale[0] + 1 ) ) << prescale[0] ) );
+    }
+}
+
+static void test_find_scalers_time( void )
+{
+    uint32_t target_ns;
+    uint32_t i;
+
+    /* Every ns up to 200 us, where the settings are densest, then a random sample.  For
+     * the full sweep, as after a change to the search, raise the first bound to MAX_TIME_NS. */
+    for ( target_ns=0; target_ns<=200000; target_ns++ )
+        check_target( target_ns );
+    srand( 1 );
+    for ( i=0; i<200000; i++ )
+        check_target( ( ( (uint32_t)rand() << 16 ) ^ (uint32_t)rand() ) % ( MAX_TIME_NS + 1 ) );
+    check_target( MAX_TIME_NS );
+}
+
+static void test_find_scalers_time_limits( void )
+{
+    uint8_t prescale;
+    uint8_t postscale;
+    uint8_t period;
+
+    CHECK_EQ( find_scalers_time( MAX_TIME_NS, &prescale, &postscale, &period ), MAX_TIME_NS );
+    CHECK_EQ( prescale, 7 );
+    CHECK_EQ( postscale, 15 );
+    CHECK_EQ( period, 254 );
+
+    CHECK_EQ( find_scalers_time( MAX_TIME_NS + 1, &prescale, &postscale, &period ), 0 );
+}
+
+static void check_long_wait( uint32_t target_ns )
+{
+    /* Waits the 8-bit timers miss by more than 500 ns go to SMT1, to the nearest tick */
+    strobe_timing_t timing;
+    uint32_t wait_ns = target_ns;
+    uint32_t duration_ns = 1000;
+    uint32_t short_ns;
+    uint32_t ticks;
+    uint8_t prescale;
+    uint8_t postscale;
+    uint8_t period;
+
+    short_ns = find_scalers_time( target_ns, &prescale, &postscale, &period );
+    CHECK( calc_strobe_timing( &wait_ns, &duration_ns, &timing ) );
+    if ( ( short_ns != 0 ) && ( labs( (int32_t)( short_ns - target_ns ) ) <= 500 ) )
+    {
+        CHECK_EQ( timing.smt_pr, 0 );
+        CHECK_EQ( wait_ns, short_ns );
+        CHECK_EQ( timing.pr2, period );
+        return;
+    }
+
+    ticks = ( (uint64_t)target_ns * 4 + 62 ) / 125;
+    CHECK_EQ( timing.smt_pr, ticks - LONG_WAIT_TICKS - 1 );
+    CHECK_EQ( timing.pr2, 1 );
+    CHECK_EQ( timing.t2con, 0 );
+    CHECK_EQ( wait_ns, TICKS_TO_NS( ticks ) );
+    CHECK( labs( (int32_t)( wait_ns - target_ns ) ) <= 16 );
+}
+
+static void test_long_wait( void )
+{
+    strobe_timing_t timing;
+    uint32_t wait_ns;
+    uint32_t duration_ns = 1000;
+    uint32_t i;
+
+    /* 6.3 us long on the 8-bit timers */
+    wait_ns = 12345678;
+    CHECK( calc_strobe_timing( &wait_ns, &duration_ns, &timing ) );
+    CHECK_EQ( wait_ns, 12345687 );
+    CHECK_EQ( timing.smt_pr, 395062 - LONG_WAIT_TICKS - 1 );
+
+    wait_ns = MAX_LONG_TIME_NS;
+    CHECK( calc_strobe_timing( &wait_ns, &duration_ns, &timing ) );
+    CHECK_EQ( wait_ns, MAX_LONG_TIME_NS );
+    CHECK( timing.smt_pr < 0x1000000 );
+    wait_ns = MAX_LONG_TIME_NS + 1;
+    CHECK( !calc_strobe_timing( &wait_ns, &duration_ns, &timing ) );
+    CHECK_EQ( wait_ns, 0 );
+
+    srand( 2 );
+    for ( i=0; i<100000; i++ )
+        check_long_wait( 1000 + ( ( ( (uint32_t)rand() << 16 ) ^ (uint32_t)rand() ) % MAX_LONG_TIME_NS ) );
+    for ( i=0; i<100000; i++ )
+        check_long_wait( 1000 + ( ( ( (uint32_t)rand() << 16 ) ^ (uint32_t)rand() ) % MAX_TIME_NS ) );
+
+    /* A frame starts SMT1, not TMR2, and a second edge during the wait is dropped */
+    set_trigger_mode( 1 );
+    set_strobe_enable( 1 );
+    wait_ns = 200000000;
+    duration_ns = 1000;
+    set_strobe_timing( &wait_ns, &duration_ns );
+    CHECK_EQ( wait_ns, 200000000 );
+    CHECK_EQ( ( (uint32_t)SMT1PRU << 16 ) | ( (uint32_t)SMT1PRH << 8 ) | SMT1PRL, 6400000 - LONG_WAIT_TICKS - 1 );
+    memset( (void *)&strobe_stats, 0, sizeof(strobe_stats) );
+    T2CONbits.T2ON = 0;
+    TMR2 = 55;
+    CHECK_EQ( hardware_trigger_strobe(), 1 );
+    CHECK_EQ( long_wait_running, 1 );
+    CHECK_EQ( SMT1CON1bits.SMT1GO, 1 );
+    CHECK_EQ( T2CONbits.T2ON, 0 );
+    CHECK_EQ( hardware_trigger_strobe(), 0 );
+    CHECK_EQ( strobe_stats.dropped_busy, 1 );
+
+    /* The period match starts the tail */
+    long_wait_end();
+    CHECK_EQ( long_wait_running, 0 );
+    CHECK_EQ( SMT1CON1bits.SMT1GO, 0 );
+    CHECK_EQ( TMR2, 0 );
+    CHECK_EQ( T2CONbits.T2ON, 1 );
+
+    /* The chained trigger leaves long waits to the interrupt */
+    set_trigger_mode( 2 );
+    PIR5bits.CLC4IF = 0;
+    CHECK_EQ( chained_trigger_strobe(), 1 );
+    CHECK_EQ( long_wait_running, 1 );
+    long_wait_end();
+    wait_ns = 200000000;
+    set_strobe_timing( &wait_ns, &duration_ns );
+    CHECK_EQ( LC4G3POL, 0 );
+    wait_ns = 10000;
+    set_strobe_timing( &wait_ns, &duration_ns );
+    CHECK_EQ( LC4G3POL, 1 );
+
+    set_strobe_enable( 0 );
+    set_trigger_mode( 0 );
+}
+
+static void trig_test_edge( uint16_t edge, uint16_t entry_delay, int output, uint8_t fired )
+{
+    /* One test edge as strobe_gate_isr() sees it, <output> the last strobe rise or -1 */
+    CCPR1L = (uint8_t)edge;
+    CCPR1H = (uint8_t)( edge >> 8 );
+    PIR6bits.CCP1IF = 1;
+    if ( output >= 0 )
+    {
+        CCPR2L = (uint8_t)output;
+        CCPR2H = (uint8_t)( output >> 8 );
+        PIR6bits.CCP2IF = 1;
+    }
+    trig_test_entry_ticks = edge + entry_delay;
+    trig_test_gate( fired );
+}
+
+static void check_raw_timing( uint32_t wait_target_ns, uint32_t duration_target_ns )
+{
+    /* Registers from calc_strobe_timing(), as the host plans them, decode to the same values
+     * and the same achieved ns */
+    strobe_timing_t timing;
+    strobe_timing_t decoded;
+    uint8_t data[8];
+    uint32_t wait_ns = wait_target_ns;
+    uint32_t duration_ns = duration_target_ns;
+    uint32_t raw_wait_ns;
+    uint32_t raw_duration_ns;
+
+    if ( !calc_strobe_timing( &wait_ns, &duration_ns, &timing ) )
+        return;
+    data[0] = timing.pr2;
+    data[1] = timing.t2con;
+    data[2] = timing.pr4;
+    data[3] = timing.t4con;
+    memcpy( &data[4], &timing.smt_pr, sizeof(uint32_t) );
+
+    CHECK( decode_strobe_timing( data, &decoded, &raw_wait_ns, &raw_duration_ns ) );
+    CHECK_EQ( memcmp( &decoded, &timing, sizeof(timing) ), 0 );
+    CHECK_EQ( raw_wait_ns, wait_ns );
+    CHECK_EQ( raw_duration_ns, duration_ns );
+}
+
+static void test_raw_timing( void )
+{
+    strobe_timing_t timing;
+    uint8_t data[8] = { 0 };
+    uint32_t wait_ns;
+    uint32_t duration_ns;
+    uint32_t i;
+
+    srand( 3 );
+    for ( i=0; i<100000; i++ )
+        check_raw_timing( ( ( (uint32_t)rand() << 16 ) ^ (uint32_t)rand() ) % ( MAX_LONG_TIME_NS + 1 ),
+                          ( ( (uint32_t)rand() << 16 ) ^ (uint32_t)rand() ) % ( MAX_TIME_NS + 1 ) );
+    check_raw_timing( MAX_LONG_TIME_NS, MAX_TIME_NS );
+
+    /* PR 99 at 1:4 prescale, 1:2 postscale: 800 ticks. PR 9 at 1:1: 10 ticks. */
+    data[0] = 99;
+    data[1] = ( 2 << 4 ) | 1;
+    data[2] = 9;
+    CHECK( decode_strobe_timing( data, &timing, &wait_ns, &duration_ns ) );
+    CHECK_EQ( wait_ns, 25000 );
+    CHECK_EQ( duration_ns, 312 );
+
+    /* A long wait counts SMT1, its interrupt entry and the tail */
+    data[0] = 1;
+    data[1] = 0;
+    data[4] = 0xE8;
+    data[5] = 0x03;
+    CHECK( decode_strobe_timing( data, &timing, &wait_ns, &duration_ns ) );
+    CHECK_EQ( timing.smt_pr, 1000 );
+    CHECK_EQ( wait_ns, TICKS_TO_NS( 1000 + 1 + LONG_WAIT_TICKS ) );
+
+    load_strobe_timing( &timing );
+    CHECK_EQ( PR2, 1 );
+    CHECK_EQ( PR4, 9 );
+    CHECK_EQ( ( (uint32_t)SMT1PRU << 16 ) | ( (uint32_t)SMT1PRH << 8 ) | SMT1PRL, 1000 );
+
+    /* What the timers cannot run */
+    data[1] = 0x80;
+    CHECK( !decode_strobe_timing( data, &timing, &wait_ns, &duration_ns ) );
+    data[1] = 0;
+    data[0] = 0;
+    CHECK( !decode_strobe_timing( data, &timing, &wait_ns, &duration_ns ) );
+    data[0] = 1;
+    data[7] = 1;
+    CHECK( !decode_strobe_timing( data, &timing, &wait_ns, &duration_ns ) );
+    data[7] = 0;
+    data[6] = 0xFF;
+    CHECK( decode_strobe_timing( data, &timing, &wait_ns, &duration_ns ) );
+
+    /* Back to TMR2 alone for the tests after */
+    data[4] = data[5] = data[6] = 0;
+    CHECK( decode_strobe_timing( data, &timing, &wait_ns, &duration_ns ) );
+    load_strobe_timing( &timing );
+}
+
+static void frame_edge( uint32_t period_ticks )
+{
+    /* SMT2 captured <period_ticks> at the rising edge, then the gate interrupt reads it */
+    SMT2CPRU = (uint8_t)( period_ticks >> 16 );
+    SMT2CPRH = (uint8_t)( period_ticks >> 8 );
+    SMT2CPRL = (uint8_t)period_ticks;
+    PIR8bits.SMT2PRAIF = 1;
+    frame_period_capture();
+}
+
+static void test_phase_lock( void )
+{
+    uint32_t period;
+    uint32_t i;
+
+    /* The 40 bit product in 32 bits, within a tick of the exact one */
+    srand( 4 );
+    for ( i=0; i<100000; i++ )
+    {
+        uint16_t phase = (uint16_t)rand();
+
+        period = ( ( (uint32_t)rand() << 16 ) ^ (uint32_t)rand() ) & 0xFFFFFF;
+        CHECK( ( ( (uint64_t)period * phase ) >> 16 ) - phase_lock_ticks( period, phase ) <= 1 );
+    }
+    CHECK_EQ( phase_lock_ticks( 0xFFFFFF, 0xFFFF ), 0xFFFEFF );
+
+    /* The first capture after the start is partial, then a running average */
+    frame_period_init();
+    frame_edge( 12345 );
+    CHECK_EQ( frame_period_ticks(), 0 );
+    frame_edge( 800000 );
+    CHECK_EQ( frame_period_ticks(), 800000 );
+    for ( i=0; i<20; i++ )
+        frame_edge( 800400 );
+    CHECK( frame_period_ticks() > 800390 );
+    CHECK( frame_period_ticks() <= 800400 );
+
+    /* A quarter of a 25 ms frame, staged for the next edge */
+    set_trigger_mode( 1 );
+    set_strobe_enable( 1 );
+    phase_lock = 0x4000;
+    phase_lock_poll();
+    CHECK_EQ( strobe_timing_shadow_pending, 1 );
+    CHECK( labs( (int32_t)( phase_lock_wait_ns - TICKS_TO_NS( frame_period_ticks() >> 2 ) ) ) <= 500 );
+    commit_strobe_timing();
+
+    /* Drift inside the deadband restages nothing, past it the wait follows */
+    frame_edge( 800440 );
+    phase_lock_poll();
+    CHECK_EQ( strobe_timing_shadow_pending, 0 );
+    for ( i=0; i<20; i++ )
+        frame_edge( 810000 );
+    phase_lock_poll();
+    CHECK_EQ( strobe_timing_shadow_pending, 1 );
+    CHECK( labs( (int32_t)( phase_lock_wait_ns - TICKS_TO_NS( 810000 >> 2 ) ) ) <= 500 );
+    commit_strobe_timing();
+
+    /* Nothing to follow in software trigger mode */
+    set_trigger_mode( 0 );
+    for ( i=0; i<20; i++ )
+        frame_edge( 700000 );
+    phase_lock_poll();
+    CHECK_EQ( strobe_timing_shadow_pending, 0 );
+
+    /* A stopped camera starts the average over */
+    PIR8bits.SMT2IF = 1;
+    frame_period_capture();
+    CHECK_EQ( frame_period_ticks(), 0 );
+    frame_edge( 700000 );
+    CHECK_EQ( frame_period_ticks(), 0 );
+
+    phase_lock = 0;
+    set_strobe_enable( 0 );
+}
+
+static void test_trig_test( void )
+{
+    uint8_t report[TRIG_TEST_REPORT_SIZE];
+
+    CHECK_EQ( trig_test_start( 3, 8 ), ERR_PACKET_INVALID );
+    CHECK_EQ( trig_test_start( 0, 1000 ), ERR_PACKET_INVALID );
+    CHECK_EQ( trig_test_start( 3, 1000 ), ERR_OK );
+    CHECK_EQ( trig_test_state, TRIG_TEST_RUNNING );
+    CHECK_EQ( trig_test_start( 3, 1000 ), ERR_TRIG_TEST_BUSY );
+    CHECK_EQ( PR6, 62 );
+
+    trig_test_edge( 100, 40, 90, 1 );               // Warm-up, a stale rise
+    trig_test_edge( 1000, 40, -1, 1 );
+    trig_test_edge( 9000, 45, 1300, 1 );            // Rise of the edge before
+    trig_test_edge( 65000, 50, -1, 0 );             // Dropped, and no rise for 9000
+    CHECK_EQ( trig_test_state, TRIG_TEST_RUNNING );
+    trig_test_edge( 7000, 40, -1, 1 );              // Past the last, wrapped
+    CHECK_EQ( trig_test_state, TRIG_TEST_DONE );
+
+    trig_test_report( report );
+    CHECK_EQ( report[0], TRIG_TEST_DONE );
+    CHECK_EQ( *(uint16_t *)&report[1], 1008 );      // Rounded to 16 us
+    CHECK_EQ( *(uint16_t *)&report[3], 3 );         // Edges
+    CHECK_EQ( *(uint16_t *)&report[5], 1 );         // Dropped
+    CHECK_EQ( *(uint16_t *)&report[7], 1 );         // Missed
+    CHECK_EQ( *(uint16_t *)&report[9], 40 );        // ISR entry min, max, mean
+    CHECK_EQ( *(uint16_t *)&report[11], 50 );
+    CHECK_EQ( *(uint16_t *)&report[13], 45 );
+    CHECK_EQ( *(uint16_t *)&report[15], 1 );        // Outputs, min, max, mean
+    CHECK_EQ( *(uint16_t *)&report[17], 300 );
+    CHECK_EQ( *(uint16_t *)&report[19], 300 );
+    CHECK_EQ( *(uint16_t *)&report[21], 300 );
+
+    CHECK_EQ( trig_test_poll(), 1 );
+    CHECK_EQ( trig_test_state, TRIG_TEST_IDLE );
+    CHECK_EQ( trig_test_poll(), 0 );
+
+    /* A wait shorter than the interrupt: the rise is already captured for this edge */
+    CHECK_EQ( trig_test_start( 1, 100 ), ERR_OK );
+    trig_test_edge( 50000, 40, -1, 1 );
+    trig_test_edge( 60000, 40, 60010, 1 );
+    trig_test_edge( 2000, 40, -1, 1 );
+    trig_test_report( report );
+    CHECK_EQ( *(uint16_t *)&report[7], 0 );
+    CHECK_EQ( *(uint16_t *)&report[15], 1 );
+    CHECK_EQ( *(uint16_t *)&report[17], 10 );
+
+    /* Stopped early, nothing measured yet */
+    trig_test_poll();
+    CHECK_EQ( trig_test_start( 5, 100 ), ERR_OK );
+    trig_test_stop();
+    CHECK_EQ( trig_test_state, TRIG_TEST_DONE );
+    trig_test_edge( 100, 40, -1, 1 );
+    trig_test_report( report );
+    CHECK_EQ( *(uint16_t *)&report[3], 0 );
+    CHECK_EQ( *(uint16_t *)&report[9], 0 );
+    CHECK_EQ( trig_test_poll(), 1 );
+}
+
+static void test_frame_clock( void )
+{
+    T1GPPS = 0x15;
+    T2AINPPS = 0x15;
+    CLCIN0PPS = 0x15;
+    SMT2SIGPPS = 0x15;
+
+    CHECK_EQ( frame_clock_start( FRAME_CLOCK_PERIOD_MIN_NS - 1 ), ERR_STROBE_TIMING_INVALID );
+    CHECK_EQ( frame_clock_start( FRAME_CLOCK_PERIOD_MAX_NS + 1 ), ERR_STROBE_TIMING_INVALID );
+    CHECK_EQ( frame_clock_running, 0 );
+    CHECK_EQ( frame_clock_period_ns(), 0 );
+
+    /* 1 ms: 1:1, two compares of 4000 x 125 ns */
+    CHECK_EQ( frame_clock_start( 1000000 ), ERR_OK );
+    CHECK_EQ( frame_clock_period_ns(), 1000000 );
+    CHECK_EQ( ( (uint16_t)CCPR3H << 8 ) | CCPR3L, 3999 );
+    CHECK_EQ( T5CON, 0x03 );
+    CHECK_EQ( CCP3CON, 0x81 );
+    CHECK_EQ( CCPTMRS0 & 0x30, 0x30 );
+    CHECK_EQ( RA0PPS, 0x0B );
+    CHECK_EQ( T1GPPS, 0x00 );
+    CHECK_EQ( T2AINPPS, 0x00 );
+    CHECK_EQ( CLCIN0PPS, 0x00 );
+    CHECK_EQ( SMT2SIGPPS, 0x00 );
+
+    /* 30 fps needs 1:4, rounded to 1 us */
+    CHECK_EQ( frame_clock_start( 33333333 ), ERR_OK );
+    CHECK_EQ( frame_clock_period_ns(), 33333000 );
+    CHECK_EQ( ( (uint16_t)CCPR3H << 8 ) | CCPR3L, 33332 );
+    CHECK_EQ( T5CON, 0x23 );
+
+    CHECK_EQ( frame_clock_start( FRAME_CLOCK_PERIOD_MAX_NS ), ERR_OK );
+    CHECK_EQ( frame_clock_period_ns(), FRAME_CLOCK_PERIOD_MAX_NS );
+    CHECK_EQ( ( (uint16_t)CCPR3H << 8 ) | CCPR3L, 0xFFFF );
+    CHECK_EQ( T5CON, 0x33 );
+
+    /* Stopped after three starts, the camera routing saved at the first comes back */
+    frame_clock_stop();
+    CHECK_EQ( frame_clock_running, 0 );
+    CHECK_EQ( frame_clock_period_ns(), 0 );
+    CHECK_EQ( T5CON, 0 );
+    CHECK_EQ( RA0PPS, 0 );
+    CHECK_EQ( T1GPPS, 0x15 );
+    CHECK_EQ( T2AINPPS, 0x15 );
+    CHECK_EQ( CLCIN0PPS, 0x15 );
+    CHECK_EQ( SMT2SIGPPS, 0x15 );
+    frame_clock_stop();
+    CHECK_EQ( T1GPPS, 0x15 );
+
+    /* The self-test has RA0 */
+    CHECK_EQ( trig_test_start( 1, 1000 ), ERR_OK );
+    CHECK_EQ( frame_clock_start( 1000000 ), ERR_TRIG_TEST_BUSY );
+    CHECK_EQ( frame_clock_running, 0 );
+    trig_test_stop();
+    CHECK_EQ( trig_test_poll(), 1 );
+    CHECK_EQ( T1GPPS, 0x15 );
+}
+
+static void test_chained_trigger( void )
+{
+    set_trigger_mode( 2 );
+    CHECK_EQ( T2RST, 0x11 );                        // LC4_out
+    set_strobe_enable( 1 );
+    CHECK_EQ( LC4G3POL, 0 );                        // TMR2 has not run yet
+    memset( (void *)&strobe_stats, 0, sizeof(strobe_stats) );
+
+    /* First frame started by the interrupt, then the gate opens */
+    PIR5bits.CLC4IF = 0;
+    CHECK_EQ( chained_trigger_strobe(), 1 );
+    CHECK_EQ( T2CONbits.T2ON, 1 );
+    CHECK_EQ( LC4G3POL, 1 );
+
+    /* Started by CLC4, TMR2 is left alone */
+    TMR2 = 77;
+    PIR5bits.CLC4IF = 1;
+    CHECK_EQ( chained_trigger_strobe(), 1 );
+    CHECK_EQ( PIR5bits.CLC4IF, 0 );
+    CHECK_EQ( TMR2, 77 );
+
+    /* Held back by CLC4 while the pulse runs */
+    CHECK_EQ( chained_trigger_strobe(), 0 );
+    CHECK_EQ( strobe_stats.triggers, 3 );
+    CHECK_EQ( strobe_stats.fired, 2 );
+    CHECK_EQ( strobe_stats.dropped_busy, 1 );
+
+    /* Multi-pulse frames need the interrupt */
+    CHECK_EQ( set_strobe_pulses( 2, 10000 ), ERR_OK );
+    CHECK_EQ( LC4G3POL, 0 );
+    CHECK_EQ( set_strobe_pulses( 1, 0 ), ERR_OK );
+    CHECK_EQ( LC4G3POL, 1 );
+
+    set_strobe_enable( 0 );
+    CHECK_EQ( LC4G3POL, 0 );
+    set_trigger_mode( 0 );
+    CHECK_EQ( T2RST, 0x00 );
+}
+
+static void test_strobe_seq( void )
+{
+    uint32_t wait_ns = 10000;
+    uint32_t duration_ns = 1000;
+
+    CHECK_EQ( set_strobe_seq_entry( 0, &wait_ns, &duration_ns, 2 ), ERR_OK );
+    CHECK_EQ( set_strobe_seq_entry( 1, &wait_ns, &duration_ns, 1 ), ERR_OK );
+    CHECK_EQ( set_strobe_seq( 2, 1 ), ERR_OK );
+    CHECK_EQ( strobe_seq_active, 1 );
+
+    /* Rejected requests leave the running sequence alone: too long, and an entry not uploaded */
+    CHECK_EQ( set_strobe_seq( STROBE_SEQ_MAX_ENTRIES + 1, 0 ), ERR_PACKET_INVALID );
+    CHECK_EQ( strobe_seq_active, 1 );
+    CHECK_EQ( strobe_seq_length, 2 );
+    CHECK_EQ( set_strobe_seq( 3, 0 ), ERR_STROBE_SEQ_INVALID );
+    CHECK_EQ( strobe_seq_active, 1 );
+    CHECK_EQ( strobe_seq_length, 2 );
+
+    CHECK_EQ( set_strobe_seq( 0, 0 ), ERR_OK );
+    CHECK_EQ( strobe_seq_active, 0 );
+}
+
+static uint8_t next_event_flags( void )
+{
+    uint8_t buf[7];
+
+    return strobe_events_pop( buf, 1 ) ? buf[6] : 0xFF;
+}
+
+static void test_strobe_b( void )
+{
+    uint8_t report[STROBE_B_REPORT_SIZE];
+    uint8_t buf[7];
+
+    CHECK_EQ( strobe_b_set( 3, 1000, 1000 ), ERR_PACKET_INVALID );
+    CHECK_EQ( strobe_b_set( STROBE_B_SIMULTANEOUS, 1000, 0 ), ERR_STROBE_TIMING_INVALID );
+    CHECK_EQ( strobe_b_set( STROBE_B_SIMULTANEOUS, 1000, STROBE_B_MAX_TIME_NS ), ERR_STROBE_TIMING_INVALID );
+    CHECK_EQ( strobe_b_mode, STROBE_B_OFF );
+
+    /* 10 us and 5 us: 1:1, the period at 120 x 125 ns and the duty at 320 x 31.25 ns */
+    CHECK_EQ( strobe_b_set( STROBE_B_SIMULTANEOUS, 10000, 5000 ), ERR_OK );
+    strobe_b_report( report );
+    CHECK_EQ( report[0], STROBE_B_SIMULTANEOUS );
+    CHECK_EQ( *(uint32_t *)&report[1], 10000 );
+    CHECK_EQ( *(uint32_t *)&report[5], 5000 );
+    CHECK_EQ( PR6, 119 );
+    CHECK_EQ( ( (uint16_t)PWM7DCH << 2 ) | ( PWM7DCL >> 6 ), 320 );
+    CHECK_EQ( T6CON, 0x00 );
+    CHECK_EQ( T6HLT, 0x08 );
+    CHECK_EQ( PWM7CON, 0x90 );
+    CHECK_EQ( CCPTMRS1 & 0x30, 0x30 );
+    CHECK_EQ( RC4PPS, 0 );                          // Priming period on the latch
+    CHECK_EQ( T6CONbits.T6ON, 1 );
+
+    /* 1 ms and 2 ms need 1:128, the end rounds to a count of 4 us */
+    CHECK_EQ( strobe_b_set( STROBE_B_SIMULTANEOUS, 1000000, 2000000 ), ERR_OK );
+    strobe_b_report( report );
+    CHECK_EQ( *(uint32_t *)&report[1], 1000000 );
+    CHECK_EQ( *(uint32_t *)&report[5], 2008000 );
+    CHECK_EQ( PR6, 187 );
+    CHECK_EQ( T6CON, 0x70 );
+
+    /* No wait still takes one duty step */
+    CHECK_EQ( strobe_b_set( STROBE_B_SIMULTANEOUS, 0, STROBE_B_MAX_TIME_NS ), ERR_OK );
+    strobe_b_report( report );
+    CHECK_EQ( *(uint32_t *)&report[1], 4000 );
+    CHECK_EQ( *(uint32_t *)&report[5], STROBE_B_MAX_TIME_NS - 4000 );
+    CHECK_EQ( PR6, 255 );
+    CHECK_EQ( ( (uint16_t)PWM7DCH << 2 ) | ( PWM7DCL >> 6 ), 1 );
+
+    /* Simultaneous: busy while TMR6 runs, then both channels start on each frame */
+    while ( strobe_events_pop( buf, 1 ) );
+    memset( (void *)&strobe_stats, 0, sizeof(strobe_stats) );
+    set_trigger_mode( 1 );
+    set_strobe_enable( 1 );
+    CHECK_EQ( hardware_trigger_strobe(), 0 );
+    CHECK_EQ( next_event_flags(), 0x02 );
+    T6CONbits.T6ON = 0;
+    T2CONbits.T2ON = 0;
+    CHECK_EQ( hardware_trigger_strobe(), 1 );
+    CHECK_EQ( next_event_flags(), 0x01 | 0x08 );
+    CHECK_EQ( T2CONbits.T2ON, 1 );
+    CHECK_EQ( T6CONbits.T6ON, 1 );
+    CHECK_EQ( RC4PPS, 0x0F );
+
+    /* Alternate: A, then B alone, then A */
+    CHECK_EQ( strobe_b_set( STROBE_B_ALTERNATE, 10000, 5000 ), ERR_OK );
+    T6CONbits.T6ON = 0;
+    T2CONbits.T2ON = 0;
+    CHECK_EQ( hardware_trigger_strobe(), 1 );
+    CHECK_EQ( next_event_flags(), 0x01 );
+    CHECK_EQ( T2CONbits.T2ON, 1 );
+    CHECK_EQ( T6CONbits.T6ON, 0 );
+    T2CONbits.T2ON = 0;
+    CHECK_EQ( hardware_trigger_strobe(), 1 );
+    CHECK_EQ( next_event_flags(), 0x01 | 0x08 | 0x10 );
+    CHECK_EQ( T2CONbits.T2ON, 0 );
+    CHECK_EQ( T6CONbits.T6ON, 1 );
+    T6CONbits.T6ON = 0;
+    CHECK_EQ( hardware_trigger_strobe(), 1 );
+    CHECK_EQ( next_event_flags(), 0x01 );
+    CHECK_EQ( T2CONbits.T2ON, 1 );
+    CHECK_EQ( strobe_stats.fired, 4 );
+    CHECK_EQ( strobe_stats.dropped_busy, 1 );
+
+    /* Chained mode takes the interrupt path while channel B is on */
+    set_trigger_mode( 2 );
+    CHECK_EQ( LC4G3POL, 0 );
+
+    /* Off gives the pin back to its latch, and TMR6 to the self-test */
+    CHECK_EQ( strobe_b_set( STROBE_B_OFF, 0, 0 ), ERR_OK );
+    strobe_b_report( report );
+    CHECK_EQ( report[0], STROBE_B_OFF );
+    CHECK_EQ( *(uint32_t *)&report[1], 0 );
+    CHECK_EQ( RC4PPS, 0 );
+    CHECK_EQ( PWM7CON, 0 );
+    CHECK_EQ( trig_test_start( 1, 1000 ), ERR_OK );
+    CHECK_EQ( strobe_b_set( STROBE_B_SIMULTANEOUS, 10000, 5000 ), ERR_TRIG_TEST_BUSY );
+    trig_test_stop();
+    CHECK_EQ( trig_test_poll(), 1 );
+
+    set_strobe_enable( 0 );
+    set_trigger_mode( 0 );
+}
+
+static uint16_t tmr0_us;
+
+static void tmr0_step( uint16_t us )
+{
+    tmr0_us += us;
+    TMR0L = tmr0_us & 0xFF;
+    TMR0H = tmr0_us >> 8;
+}
+
+static void test_load( void )
+{
+    uint8_t report[16];
+    uint16_t i;
+
+    load_init();
+    tmr0_us = 0xFF00;                               // Wraps in the first window
+    tmr0_step( 0 );
+    load_pass();                                    // Only starts the count
+
+    /* Half the second in idle passes, half in busy ones with an interrupt each */
+    for ( i=0; i<5000; i++ )
+    {
+        tmr0_step( 100 );
+        load_pass();
+    }
+    load_report( report, 0 );
+    CHECK_EQ( *(uint32_t *)&report[12], 0 );        // No window complete yet
+    for ( i=0; i<1250; i++ )
+    {
+        tmr0_step( 150 );
+        load_isr_enter();
+        tmr0_step( 100 );
+        load_isr_exit();
+        tmr0_step( 150 );
+        load_pass();
+    }
+
+    load_report( report, 1 );
+    CHECK_EQ( *(uint16_t *)&report[0], 375 );       // 1 - 6250 x 100 us / 1 s
+    CHECK_EQ( *(uint16_t *)&report[2], 375 );
+    CHECK_EQ( *(uint16_t *)&report[4], 125 );
+    CHECK_EQ( *(uint16_t *)&report[6], 100 );
+    CHECK_EQ( *(uint16_t *)&report[8], 100 );
+    CHECK_EQ( *(uint16_t *)&report[10], 400 );
+    CHECK_EQ( *(uint32_t *)&report[12], 6250 );
+
+    /* The reset keeps the idle pass and the last window */
+    load_report( report, 0 );
+    CHECK_EQ( *(uint16_t *)&report[0], 375 );
+    CHECK_EQ( *(uint16_t *)&report[2], 0 );
+    CHECK_EQ( *(uint16_t *)&report[6], 0 );
+    CHECK_EQ( *(uint16_t *)&report[8], 100 );
+    CHECK_EQ( *(uint16_t *)&report[10], 0 );
+}
+
+static void bench_find_scalers_time( void )
+{
+    volatile uint32_t sink;
+    uint8_t prescale;
+    uint8_t postscale;
+    uint8_t period;
+    uint32_t target_ns = 0;
+
+    BENCH( "find_scalers_time", 1000000,
+           target_ns = ( target_ns + 16319 ) % MAX_TIME_NS;
+           sink = find_scalers_time( target_ns, &prescale, &postscale, &period ) );
+    BENCH( "find_scalers_time exact", 1000000,
+           sink = find_scalers_time( 1000000, &prescale, &postscale, &period ) );
+    BENCH( "find_scalers_time reference", 1000000,
+           target_ns = ( target_ns + 16319 ) % MAX_TIME_NS;
+           sink = find_scalers_time_reference( target_ns, &prescale, &postscale, &period ) );
+    (void)sink;
+}
+
+int main( int argc, char **argv )
+{
+    bench_init( argc, argv );
+
+    RUN_TEST( test_find_scalers_time );
+    RUN_TEST( test_find_scalers_time_limits );
+    RUN_TEST( test_long_wait );
+    RUN_TEST( test_raw_timing );
+    RUN_TEST( test_phase_lock );
+    RUN_TEST( test_trig_test );
+    RUN_TEST( test_frame_clock );
+    RUN_TEST( test_chained_trigger );
+    RUN_TEST( test_strobe_seq );
+    RUN_TEST( test_strobe_b );
+    RUN_TEST( test_load );
+
+    if ( bench_enabled() )
+        bench_find_scalers_time();
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,88 @@
+#!/usr/bin/env python3
+"""
+Regenerate a shim/<family>/sfr.h from the registers a board's sources use.
+
+Compiles the sources against the shim until no register is undeclared, collecting
+every undeclared name (a 16-bit register, or a bit struct if it ends in "bits")
+and every bit struct member. Registers already in sfr.h are kept, so running it
+for each board of a family gives their union.
+
+    tools/gen_sfr.py shim/dspic33ck <cc flags...> -- <sources...>
+"""
+import collections
+import os
+import re
+import subprocess
+import sys
+
+HEADER = """/*
+ * Generated by tools/gen_sfr.py, registers used by the firmware sources. Every
+ * register is a plain RAM variable on the host, defined once by hal_sfr.c.
+ */
+
+#ifndef SFR
+#define SFR( name )                     extern volatile SFR_TYPE name;
+#define SFR_BITS( name, members )       extern volatile struct members name;
+#endif
+
+"""
+
+
+def load(path):
+    scalars, structs = set(), collections.defaultdict(set)
+    if os.path.exists(path):
+        for line in open(path):
+            m = re.match(r"SFR\( (\w+) \)", line)
+            if m:
+                scalars.add(m.group(1))
+            m = re.match(r"SFR_BITS\( (\w+), \{(.*)\} \)", line)
+            if m:
+                structs[m.group(1)] = set(re.findall(r"unsigned (\w+):1;", m.group(2)))
+    return scalars, structs
+
+
+def save(path, scalars, structs):
+    with open(path, "w") as f:
+        f.write(HEADER)
+        for name in sorted(scalars):
+            f.write(f"SFR( {name} )\n")
+        for name, members in sorted(structs.items()):
+            body = " ".join(f"unsigned {m}:1;" for m in sorted(members))
+            f.write(f"SFR_BITS( {name}, {{ {body} }} )\n")
+
+
+def main():
+    family, args = sys.argv[1], sys.argv[2:]
+    split = args.index("--")
+    flags, sources = args[:split], args[split + 1:]
+    path = os.path.join(family, "sfr.h")
+    scalars, structs = load(path)
+    env = dict(os.environ, LANG="C", LC_ALL="C")
+    for source in sources:
+        for _ in range(100):
+            save(path, scalars, structs)
+            cmd = ["gcc", "-fsyntax-only", "-w", "-fmax-errors=0", "-I" + family] + flags + [source]
+            err = subprocess.run(cmd, capture_output=True, text=True, env=env).stderr
+            changed = False
+            for name in re.findall(r"'(\w+)' undeclared", err):
+                if name.endswith("bits"):
+                    changed |= name not in structs
+                    structs.setdefault(name, set())
+                elif name not in scalars:
+                    scalars.add(name)
+                    changed = True
+            for file_, line, member in re.findall(r"(\S+):(\d+):\d+: error: '[^']*' has no member named '(\w+)'", err):
+                text = open(file_).read().split("\n")[int(line) - 1]
+                for name in re.findall(r"(\w+bits)\s*\.\s*" + member, text):
+                    changed |= member not in structs[name]
+                    structs[name].add(member)
+            if not changed:
+                break
+        errors = [l for l in err.split("\n") if "error" in l]
+        if errors:
+            print("\n".join(errors[:20]))
+    save(path, scalars, structs)
+
+
+if __name__ == "__main__":
+    main()
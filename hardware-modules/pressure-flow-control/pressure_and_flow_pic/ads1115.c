@@ -1,11 +1,14 @@
 #include "mcc_generated_files/mcc.h"
 #include "common.h"
 #include "ads1115.h"
+#include "i2c_bus.h"
 
-#define I2C_TIMEOUT_MS      2
+#define I2C_TIMEOUT_MS      ADS1115_I2C_TIMEOUT_MS
 
 uint8_t conversion_reg = ADS1115_REG_CONVERSION;
 
+const uint16_t ads1115_fsr_mv[8] = { 6144, 4096, 2048, 1024, 512, 256, 256, 256 };
+
 /* Static Prototypes */
 static err i2c_wait_for_reply( volatile I2C2_MESSAGE_STATUS *status, uint16_t timeout_ms );
 
@@ -55,8 +58,11 @@ err ads1115_set_ready_pin( uint8_t addr )
     return rc;
 }
 
-void ads1115_read_adc_start( uint8_t addr, int8_t read_channel, int8_t start_channel, ads1115_datarate dr, ads1115_fsr_gain gain, ads1115_task_t *task )
+void ads1115_read_adc_start( uint8_t addr, int8_t read_channel, uint8_t start_addr, int8_t start_channel, ads1115_mux mux, ads1115_datarate dr, ads1115_fsr_gain gain, ads1115_task_t *task )
 {
+    /* Reads back <read_channel> from the ADS1115 at <addr> and starts <start_channel> on the
+     * one at <start_addr>, the same or the next of a wire-ORed ALERT/RDY line. Channels are
+     * the caller's numbers, -1 for none, returned by ads1115_read_adc_return(). */
     uint16_t adc_config;
     uint8_t trb_count;
     
@@ -75,7 +81,7 @@ void ads1115_read_adc_start( uint8_t addr, int8_t read_channel, int8_t start_cha
     
     if ( start_channel >= 0 )
     {
-        /* Start new conversion */
+        /* Start new conversion of <start_channel>, on the inputs selected by <mux> */
         
         adc_config =    ADS1115_COMP_QUE_CON1 |
                         ADS1115_COMP_LAT_Latching |
@@ -84,34 +90,14 @@ void ads1115_read_adc_start( uint8_t addr, int8_t read_channel, int8_t start_cha
                         dr |
                         ADS1115_MODE_SINGLE |
                         gain |
+                        mux |
                         ADS1115_OS_SINGLE;
 
-        switch ( start_channel )
-        {
-            case 0:
-                adc_config |= ADS1115_MUX_AIN0_GND;
-                break;
-            case 1:
-                adc_config |= ADS1115_MUX_AIN1_GND;
-                break;
-            case 2:
-                adc_config |= ADS1115_MUX_AIN2_GND;
-                break;
-            case 3:
-                adc_config |= ADS1115_MUX_AIN3_GND;
-                break;
-            default:
-                ;
-        }
-
-        if ( start_channel <= 3 )
-        {
-            task->write_data[0] = ADS1115_REG_CONFIG;
-            task->write_data[1] = adc_config >> 8;
-            task->write_data[2] = adc_config & 0xFF;
-
-            I2C2_MasterWriteTRBBuild( &task->trBlocks[trb_count++], task->write_data, 3, addr );
-        }
+        task->write_data[0] = ADS1115_REG_CONFIG;
+        task->write_data[1] = adc_config >> 8;
+        task->write_data[2] = adc_config & 0xFF;
+
+        I2C2_MasterWriteTRBBuild( &task->trBlocks[trb_count++], task->write_data, 3, start_addr );
     }
     
     I2C2_MasterTRBInsert( trb_count, (I2C2_TRANSACTION_REQUEST_BLOCK *)&task->trBlocks, (I2C2_MESSAGE_STATUS *)&task->status );
@@ -133,14 +119,16 @@ int8_t ads1115_read_adc_return( uint16_t *value, int8_t *channel, ads1115_task_t
     if ( task->status == I2C2_MESSAGE_COMPLETE )
     {
         /* Return conversion */
+        i2c_bus_count( I2C_DEV_ADC, task->status );
         *value = ( ( (uint16_t)(task->read_data[0]) ) << 8 ) | task->read_data[1];
         *channel = task->channel;
         rc = 1;
     }
     else if ( ( timer_ms - task->start_time ) > I2C_TIMEOUT_MS )
     {
-        /* Timeout */
-        I2C2_Abort();
+        /* Timeout, or a NACK or error seen late */
+        i2c_bus_count( I2C_DEV_ADC, task->status );
+        i2c_bus_abort( I2C_DEV_ADC );
         rc = -1;
     }
     else
@@ -203,10 +191,11 @@ static err i2c_wait_for_reply( volatile I2C2_MESSAGE_STATUS *status, uint16_t ti
     
     time = timer_ms;
     while ( ( *status != I2C2_MESSAGE_COMPLETE ) && ( ( timer_ms - time ) <= timeout_ms ) );
+    i2c_bus_count( I2C_DEV_ADC, *status );
     if ( *status != I2C2_MESSAGE_COMPLETE )
     {
         rc = ERR_ADS1115_COMMS_FAIL;
-        I2C2_Abort();
+        i2c_bus_abort( I2C_DEV_ADC );
     }
     
     return rc;
@@ -128,6 +128,25 @@ typedef enum
 	DATARATE_860SPS		= ADS1115_DR_860SPS
 } ads1115_datarate;
 
+typedef enum
+{
+	MUX_AIN0_AIN1		= ADS1115_MUX_AIN0_AIN1,
+	MUX_AIN0_AIN3		= ADS1115_MUX_AIN0_AIN3,
+	MUX_AIN1_AIN3		= ADS1115_MUX_AIN1_AIN3,
+	MUX_AIN2_AIN3		= ADS1115_MUX_AIN2_AIN3,
+	MUX_AIN0_GND		= ADS1115_MUX_AIN0_GND,
+	MUX_AIN1_GND		= ADS1115_MUX_AIN1_GND,
+	MUX_AIN2_GND		= ADS1115_MUX_AIN2_GND,
+	MUX_AIN3_GND		= ADS1115_MUX_AIN3_GND
+} ads1115_mux;
+
+/* Single ended input <channel> 0-3, and whether a mux setting is differential */
+#define ADS1115_MUX_SINGLE( channel )	( (ads1115_mux)( ADS1115_MUX_AIN0_GND + ( (uint16_t)(channel) << ADS1115_IMUX0 ) ) )
+#define ADS1115_MUX_IS_DIFF( mux )		( ( (mux) & ADS1115_MUX_AIN0_GND ) == 0 )
+
+/* Full scale range in mV of each PGA code, 6 and 7 repeat 0.256 V */
+extern const uint16_t ads1115_fsr_mv[8];
+
 typedef struct
 {
     uint8_t write_data[3];
@@ -144,7 +163,7 @@ typedef struct
 /************************************************************************/
 
 err ads1115_set_ready_pin( uint8_t addr );
-void ads1115_read_adc_start( uint8_t addr, int8_t read_channel, int8_t start_channel, ads1115_datarate dr, ads1115_fsr_gain gain, ads1115_task_t *task );
+void ads1115_read_adc_start( uint8_t addr, int8_t read_channel, uint8_t start_addr, int8_t start_channel, ads1115_mux mux, ads1115_datarate dr, ads1115_fsr_gain gain, ads1115_task_t *task );
 int8_t ads1115_read_adc_return( uint16_t *value, int8_t *channel, ads1115_task_t *task );
 err ads1115_start_single( uint8_t addr, uint8_t channel, ads1115_datarate dr, ads1115_fsr_gain gain );
 err ads1115_get_result( uint8_t addr, uint16_t *value  );
@@ -0,0 +1,46 @@
+/*
+ * File:   bench_port.h
+ *
+ * dsPIC33CK shim for the shared rio_bench module, see
+ * hardware-modules/common/rio_bench.
+ */
+
+#ifndef BENCH_PORT_H
+#define	BENCH_PORT_H
+
+#include <xc.h>
+#include "probe_port.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/* Comment out to build the benchmark out, BENCHMARK is then not handled */
+#define BENCH_ENABLED
+
+/* Kernels, 0 is BENCH_NULL */
+#define BENCH_FRAME_CHECKSUM            1   // spi_frame_check() of a SPI_PACKET_BUF_SIZE byte STX frame
+#define BENCH_FRAME_CRC                 2   // Same, STX_CRC frame
+#define BENCH_FLOW_PID                  3   // fpid_step() on channel 0's gains
+#define BENCH_PRESSURE_PID              4   // ppid_step() on channel 0's gains
+#define BENCH_COUNT                     5
+
+/* The rio_probe timer, SCCP9 on Fcy / 64. A run is timed to a tick, the mean over many
+ * runs finer, as each run starts at a different phase of the prescaler. */
+#define BENCH_PORT_TIMER_HZ             PROBE_PORT_TIMER_HZ
+#define BENCH_PORT_CPU_HZ               75000000UL
+#define BENCH_PORT_NOW()                PROBE_PORT_NOW()
+
+/* Held over each run, so interrupts are not counted in it. Up to 16383 cycles, 218 us. */
+#define BENCH_PORT_LOCK()               { __builtin_disi( 0x3FFF ); }
+#define BENCH_PORT_UNLOCK()             { __builtin_disi( 0x0000 ); }
+
+#if defined( BENCH_ENABLED ) && !defined( PROBE_ENABLED )
+#error "BENCH_ENABLED times on the rio_probe timer, it needs PROBE_ENABLED"
+#endif
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* BENCH_PORT_H */
@@ -0,0 +1,103 @@
+/*
+ * File:   board_config.h
+ *
+ * Build profile of the pressure and flow board: channel count and wiring, SPI buffer
+ * sizes, the ADC period, I2C timeouts and the EEPROM part. Every value is a default a
+ * variant can override, either one at a time with -D or all together in its own header
+ * named by -DBOARD_PROFILE="<file>.h", which is included first. The checks at the end
+ * stop a build whose profile the firmware cannot run.
+ */
+
+#ifndef BOARD_CONFIG_H
+#define	BOARD_CONFIG_H
+
+#ifdef BOARD_PROFILE
+#include BOARD_PROFILE
+#endif
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/* Channels, in banks of four each with its own ADS1115, PCA9544A and quad DAC */
+#ifndef NUM_PRESSURE_CLTRLS
+#define NUM_PRESSURE_CLTRLS                 4       // 4 or 8, the channel masks are U8
+#endif
+#define PRESSURE_BANK_CHANS                 4       // Channels per bank, fixed by the parts
+
+/* Pressure channel of each ADC input of bank b in conversion order, input i is AIN( i % 4 ) */
+#ifndef ADC_MAP_BANK
+#define ADC_MAP_BANK(b)                     4*(b)+3, 4*(b)+2, 4*(b)+0, 4*(b)+1
+#endif
+
+/* PCA9544A port of each channel's flow sensor, on the mux of its bank */
+#ifndef FLOW_MAP_BANK
+#define FLOW_MAP_BANK                       1, 0, 2, 3
+#endif
+
+/* rio_spi rings and packet buffers, bytes */
+#ifndef SPI_READ_BUF_SIZE
+#define SPI_READ_BUF_SIZE                   256
+#endif
+#ifndef SPI_WRITE_BUF_SIZE
+#define SPI_WRITE_BUF_SIZE                  256
+#endif
+#ifndef SPI_PACKET_BUF_SIZE
+#define SPI_PACKET_BUF_SIZE                 128
+#endif
+#ifndef SPI_BATCH_BUF_SIZE
+#define SPI_BATCH_BUF_SIZE                  128
+#endif
+#ifndef SPI_STREAM_CHUNK_SIZE
+#define SPI_STREAM_CHUNK_SIZE               120     // Payload of a chunk frame, two records of 4 channels
+#endif
+
+/* Pressure loop period at reset, ms, parameter 0x01 changes it at run time */
+#ifndef ADC_PERIOD_MS
+#define ADC_PERIOD_MS                       100
+#endif
+#define ADC_PERIOD_MS_MIN                   5       // Lowest parameter 0x01 accepts
+
+/* I2C transfer timeouts, ms of timer_ms */
+#ifndef ADS1115_I2C_TIMEOUT_MS
+#define ADS1115_I2C_TIMEOUT_MS              2
+#endif
+#ifndef PCA9544A_I2C_TIMEOUT_MS
+#define PCA9544A_I2C_TIMEOUT_MS             2
+#endif
+#ifndef SENSIRION_I2C_TIMEOUT_MS
+#define SENSIRION_I2C_TIMEOUT_MS            8       // The LG16 stretches the clock while it measures
+#endif
+
+/* SPI EEPROM, 25AA128 (16 KB, 64 byte pages) unless the profile defines EEPROM_25AA040 */
+#if defined EEPROM_25AA040 && defined EEPROM_25AA128
+#error "Define one of EEPROM_25AA040 and EEPROM_25AA128"
+#elif defined EEPROM_25AA040
+#define EEPROM_SIZE                         0x0200
+#else
+#define EEPROM_25AA128
+#define EEPROM_SIZE                         0x4000
+#endif
+
+/* Checks. The rings are checked by rio_spi.c, the EEPROM layout by storage.c. */
+#if ( NUM_PRESSURE_CLTRLS % PRESSURE_BANK_CHANS ) || ( NUM_PRESSURE_CLTRLS < PRESSURE_BANK_CHANS ) || ( NUM_PRESSURE_CLTRLS > 8 )
+#error "NUM_PRESSURE_CLTRLS must be whole banks of PRESSURE_BANK_CHANS and fit the U8 channel masks"
+#endif
+#if ( SPI_PACKET_BUF_SIZE > SPI_READ_BUF_SIZE )
+#error "SPI_PACKET_BUF_SIZE must fit the read ring"
+#endif
+#if ( ADC_PERIOD_MS < ADC_PERIOD_MS_MIN ) || ( ADC_PERIOD_MS > 0xFFFF )
+#error "ADC_PERIOD_MS must be ADC_PERIOD_MS_MIN to 65535, the U16 timer_ms interval"
+#endif
+#if ( ADS1115_I2C_TIMEOUT_MS < 1 ) || ( PCA9544A_I2C_TIMEOUT_MS < 1 ) || ( SENSIRION_I2C_TIMEOUT_MS < 1 )
+#error "I2C timeouts must be 1 ms at least, a timer_ms tick"
+#endif
+#if ( ADS1115_I2C_TIMEOUT_MS >= ADC_PERIOD_MS_MIN ) || ( PCA9544A_I2C_TIMEOUT_MS >= ADC_PERIOD_MS_MIN )
+#error "ADC and mux I2C timeouts must be under ADC_PERIOD_MS_MIN, a failed read cannot take a period"
+#endif
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* BOARD_CONFIG_H */
@@ -8,6 +8,8 @@
 #ifndef COMMON_H
 #define	COMMON_H
 
+#include "board_config.h"
+
 #ifdef	__cplusplus
 extern "C" {
 #endif
@@ -18,8 +20,9 @@ extern "C" {
 /* For __delay_ms */
 #define FCY 75000000UL
 
-/* System Constants */
-#define NUM_PRESSURE_CLTRLS                 4
+/* System Constants, NUM_PRESSURE_CLTRLS and PRESSURE_BANK_CHANS in board_config.h */
+#define NUM_PRESSURE_BANKS                  ( NUM_PRESSURE_CLTRLS / PRESSURE_BANK_CHANS )
+#define NUM_FLOW_SCHED_POINTS               4       // Flow PID gain schedule points per channel
 
 /* Errors */
 #define ERR_OK                      0
@@ -30,6 +33,7 @@ extern "C" {
 #define ERR_PACKET_OVERFLOW         30
 #define ERR_PACKET_INVALID          31
 #define ERR_PACKET_TIMEOUT          32
+#define ERR_MODULE_ADDRESS          34      // Addressed BATCH for another module
     
 #define ERR_HEAT_TARGET_INVALID     40
 #define ERR_HEAT_PID_NOT_READY      41
@@ -39,11 +43,22 @@ extern "C" {
 #define ERR_EEPROM_VERIFY_FAIL      60
 
 #define ERR_SENSIRION_COMMS_FAIL    70
+#define ERR_SENSIRION_CRC_FAIL      71
 
 #define ERR_PCA9544A_COMMS_FAIL     80
 
 #define ERR_ADS1115_COMMS_FAIL      90
 
+#define ERR_PROFILE_INVALID         100
+
+#define ERR_PARAM_UNKNOWN           110
+#define ERR_PARAM_RANGE             111
+#define ERR_PARAM_READ_ONLY         112
+
+#define ERR_FLASH_STATE             120     // Not in a state that takes this FLASH op, see rio_flash.h
+#define ERR_FLASH_ADDRESS           121     // Unaligned, outside the partition or over FBTSEQ
+#define ERR_FLASH_WRITE             122     // Erase or write did not read back
+
 typedef uint8_t err;
 
 extern volatile uint16_t timer_ms;
@@ -0,0 +1,192 @@
+#include "mcc_generated_files/mcc.h"
+#include "common.h"
+#include <libpic30.h>
+#include <string.h>
+#include "i2c_bus.h"
+
+/* Static Variables */
+static i2c_dev_stats_t i2c_dev_stats[I2C_DEV_COUNT];
+static uint16_t i2c_recoveries;
+static uint16_t i2c_recovery_fails;
+static bool i2c_fast_plus;
+static bool i2c_clock_pending;
+static bool i2c_stuck;
+static bool i2c_stuck_recovered;
+
+/* Static Prototypes */
+static void i2c_bus_clock_apply( void );
+static void i2c_bus_inc16( uint16_t *count );
+
+/* Extern Functions */
+
+void i2c_bus_init( void )
+{
+    memset( i2c_dev_stats, 0, sizeof(i2c_dev_stats) );
+    i2c_recoveries = 0;
+    i2c_recovery_fails = 0;
+    i2c_fast_plus = false;
+    i2c_clock_pending = false;
+    i2c_stuck = false;
+}
+
+void i2c_bus_count( uint8_t dev, I2C2_MESSAGE_STATUS status )
+{
+    /* One transaction of <dev> as it ended, or I2C2_MESSAGE_PENDING when its caller timed out */
+    i2c_dev_stats_t *stats = &i2c_dev_stats[dev];
+
+    if ( stats->transfers != UINT32_MAX )
+        stats->transfers++;
+
+    switch ( status )
+    {
+        case I2C2_MESSAGE_COMPLETE:
+            break;
+        case I2C2_MESSAGE_PENDING:
+            i2c_bus_inc16( &stats->timeouts );
+            break;
+        case I2C2_MESSAGE_ADDRESS_NO_ACK:
+        case I2C2_DATA_NO_ACK:
+            i2c_bus_inc16( &stats->nacks );
+            break;
+        default:
+            i2c_bus_inc16( &stats->errors );
+    }
+}
+
+void i2c_bus_abort( uint8_t dev )
+{
+    /* I2C2_Abort() on behalf of <dev>. A slave left driving SDA low, e.g. by a reset of the
+     * master part way through a read, holds the bus against every START that follows, so the
+     * pins are clocked free before the module starts again. */
+    i2c_bus_inc16( &i2c_dev_stats[dev].aborts );
+
+    I2C2_Abort();
+
+    if ( !I2C_BUS_SDA_GET() )
+    {
+        i2c_stuck_recovered = i2c_bus_recover();
+        i2c_stuck = true;
+    }
+
+    /* I2C2_Initialize() restores the MCC clock */
+    i2c_bus_clock_apply();
+}
+
+bool i2c_bus_recover( void )
+{
+    /* Bus clear, as the I2C specification: up to nine clocks on SCL until the slave lets SDA
+     * go, then a STOP. Returns true if SDA is high at the end. */
+    uint8_t clocks;
+    bool sda_high;
+
+    I2C2CONLbits.I2CEN = 0;
+    I2C_BUS_SDA_RELEASE();
+
+    for ( clocks=0; ( clocks < I2C_BUS_RECOVERY_CLOCKS ) && !I2C_BUS_SDA_GET(); clocks++ )
+    {
+        I2C_BUS_SCL_LOW();
+        __delay_us( I2C_BUS_RECOVERY_HALF_US );
+        I2C_BUS_SCL_RELEASE();
+        __delay_us( I2C_BUS_RECOVERY_HALF_US );
+    }
+
+    /* STOP: SDA rises while SCL is high */
+    I2C_BUS_SCL_LOW();
+    I2C_BUS_SDA_LOW();
+    __delay_us( I2C_BUS_RECOVERY_HALF_US );
+    I2C_BUS_SCL_RELEASE();
+    __delay_us( I2C_BUS_RECOVERY_HALF_US );
+    I2C_BUS_SDA_RELEASE();
+    __delay_us( I2C_BUS_RECOVERY_HALF_US );
+
+    sda_high = I2C_BUS_SDA_GET();
+    if ( sda_high )
+        i2c_bus_inc16( &i2c_recoveries );
+    else
+        i2c_bus_inc16( &i2c_recovery_fails );
+
+    I2C2_Initialize();
+
+    return sda_high;
+}
+
+bool i2c_bus_stuck( bool *recovered )
+{
+    /* True once after i2c_bus_abort() found SDA held low, *recovered as i2c_bus_recover() */
+    bool stuck = i2c_stuck;
+
+    *recovered = i2c_stuck_recovered;
+    i2c_stuck = false;
+
+    return stuck;
+}
+
+void i2c_bus_set_fast_plus( bool fast_plus )
+{
+    /* Fast-mode Plus, 1 MHz, if every device on the bus takes it. Applied by i2c_bus_poll()
+     * once the bus is idle. */
+    i2c_fast_plus = fast_plus;
+    i2c_clock_pending = true;
+}
+
+bool i2c_bus_get_fast_plus( void )
+{
+    return i2c_fast_plus;
+}
+
+void i2c_bus_poll( void )
+{
+    /* Called from the main loop with INT1 off, so nothing queues while the clock changes */
+    if ( !i2c_clock_pending )
+        return;
+
+    if ( !I2C2_MasterQueueIsEmpty() || I2C2STATbits.S )
+        return;
+
+    i2c_bus_clock_apply();
+}
+
+void i2c_bus_report( uint8_t *buf, uint8_t reset )
+{
+    /* Fills I2C_BUS_REPORT_SIZE bytes, little endian. <reset> clears the counters after. */
+    uint8_t dev;
+    uint16_t khz = i2c_fast_plus ? I2C_BUS_KHZ_FAST_PLUS : I2C_BUS_KHZ;
+
+    for ( dev=0; dev<I2C_DEV_COUNT; dev++ )
+    {
+        memcpy( buf, &i2c_dev_stats[dev].transfers, sizeof(uint32_t) );
+        memcpy( buf + 4, &i2c_dev_stats[dev].nacks, sizeof(uint16_t) );
+        memcpy( buf + 6, &i2c_dev_stats[dev].errors, sizeof(uint16_t) );
+        memcpy( buf + 8, &i2c_dev_stats[dev].timeouts, sizeof(uint16_t) );
+        memcpy( buf + 10, &i2c_dev_stats[dev].aborts, sizeof(uint16_t) );
+        buf += I2C_BUS_DEV_REPORT_SIZE;
+    }
+    memcpy( buf, &i2c_recoveries, sizeof(uint16_t) );
+    memcpy( buf + 2, &i2c_recovery_fails, sizeof(uint16_t) );
+    memcpy( buf + 4, &khz, sizeof(uint16_t) );
+
+    if ( reset )
+    {
+        memset( i2c_dev_stats, 0, sizeof(i2c_dev_stats) );
+        i2c_recoveries = 0;
+        i2c_recovery_fails = 0;
+    }
+}
+
+/* Static Functions */
+
+static void i2c_bus_clock_apply( void )
+{
+    /* Slew rate control is for 400 kHz only, DISSLW is set at 1 MHz */
+    I2C2CONLbits.I2CEN = 0;
+    I2C2BRG = i2c_fast_plus ? I2C_BUS_BRG_FAST_PLUS : I2C_BUS_BRG;
+    I2C2CONLbits.DISSLW = i2c_fast_plus;
+    I2C2CONLbits.I2CEN = 1;
+    i2c_clock_pending = false;
+}
+
+static void i2c_bus_inc16( uint16_t *count )
+{
+    if ( *count != UINT16_MAX )
+        (*count)++;
+}
@@ -0,0 +1,61 @@
+#ifndef I2C_BUS_H
+#define	I2C_BUS_H
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/* Devices on I2C2, counted apart */
+#define I2C_DEV_ADC                     0   // ADS1115
+#define I2C_DEV_MUX                     1   // PCA9544A
+#define I2C_DEV_FLOW                    2   // Sensirion flow sensors, all channels
+#define I2C_DEV_COUNT                   3
+
+/* Report: I2C_DEV_COUNT x [transfers U32][nacks U16][errors U16][timeouts U16][aborts U16],
+ * then [recoveries U16][recovery fails U16][clock kHz U16] */
+#define I2C_BUS_DEV_REPORT_SIZE         ( sizeof(uint32_t) + ( 4 * sizeof(uint16_t) ) )
+#define I2C_BUS_REPORT_SIZE             ( ( I2C_DEV_COUNT * I2C_BUS_DEV_REPORT_SIZE ) + ( 3 * sizeof(uint16_t) ) )
+
+/* SCL clock. I2C2BRG = FCY / ( 2 x f ) - 2, and the rise time stretches each clock a little. */
+#define I2C_BUS_KHZ                     400
+#define I2C_BUS_BRG                     0x5C    // As I2C2_Initialize()
+#define I2C_BUS_KHZ_FAST_PLUS           1000
+#define I2C_BUS_BRG_FAST_PLUS           35
+
+/* Recovery: up to one byte and its ACK of clocks, at about 100 kHz, frees a slave that holds
+ * SDA low part way through a byte */
+#define I2C_BUS_RECOVERY_CLOCKS         9
+#define I2C_BUS_RECOVERY_HALF_US        5
+
+/* I2C2 pins, SCL2 on RB6 and SDA2 on RB5 (ALTI2C2 off), with the 4.7k pull-ups of the board.
+ * The pins are driven as open drain by their TRIS bit, LAT stays low. */
+#define I2C_BUS_SCL_LOW()               { LATBbits.LATB6 = 0; TRISBbits.TRISB6 = 0; }
+#define I2C_BUS_SCL_RELEASE()           { TRISBbits.TRISB6 = 1; }
+#define I2C_BUS_SDA_LOW()               { LATBbits.LATB5 = 0; TRISBbits.TRISB5 = 0; }
+#define I2C_BUS_SDA_RELEASE()           { TRISBbits.TRISB5 = 1; }
+#define I2C_BUS_SDA_GET()               ( PORTBbits.RB5 )
+
+typedef struct
+{
+    uint32_t transfers;             // Saturating, as the others
+    uint16_t nacks;                 // Address or data not acknowledged
+    uint16_t errors;                // Ended by the driver: failed, stuck START, lost state
+    uint16_t timeouts;              // Still pending at the caller's timeout
+    uint16_t aborts;                // I2C2_Abort() for this device, which drops the whole queue
+} i2c_dev_stats_t;
+
+extern void i2c_bus_init( void );
+extern void i2c_bus_count( uint8_t dev, I2C2_MESSAGE_STATUS status );
+extern void i2c_bus_abort( uint8_t dev );
+extern bool i2c_bus_recover( void );
+extern bool i2c_bus_stuck( bool *recovered );
+extern void i2c_bus_set_fast_plus( bool fast_plus );
+extern bool i2c_bus_get_fast_plus( void );
+extern void i2c_bus_poll( void );
+extern void i2c_bus_report( uint8_t *buf, uint8_t reset );
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* I2C_BUS_H */
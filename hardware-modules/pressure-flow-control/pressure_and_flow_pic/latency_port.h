@@ -0,0 +1,29 @@
+/*
+ * File:   latency_port.h
+ *
+ * dsPIC33CK shim for the shared rio_latency module, see
+ * hardware-modules/common/rio_latency.
+ */
+
+#ifndef LATENCY_PORT_H
+#define	LATENCY_PORT_H
+
+#include <xc.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/* Loops, one per channel: its pressure and, in a flow mode, its flow reading to its DAC output */
+#define LATENCY_CHAN0                   0
+#define LATENCY_COUNT                   4   // NUM_PRESSURE_CLTRLS
+
+/* Samples and outputs are both marked from the main loop here */
+#define LATENCY_PORT_LOCK()             { __builtin_disi( 0x3FFF ); }
+#define LATENCY_PORT_UNLOCK()           { __builtin_disi( 0x0000 ); }
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* LATENCY_PORT_H */
@@ -1,69 +1,275 @@
 /*
  * I2C Addresses:
- *   ADS1115 = 0x48
- *   PCA... = 0x70
+ *   ADS1115 = 0x48, 0x49 for the second bank of channels
+ *   PCA9544A = 0x70, 0x71 for the second bank
  *   Sensirion SLF3S = 0x08
- *   Sensirion LG16 = 0x40
+ *   Sensirion LG16 = 0x40, behind the PCA9544A of its bank
  */
 
 #include <xc.h>
 #include "common.h"
 #include <libpic30.h>
 #include <string.h>
+#include <stddef.h>
+#include <stdlib.h>
 #include <stdio.h>
 #include "mcc_generated_files/mcc.h"
-#include "spi.h"
+#include "rio_spi.h"
+#include "rio_log.h"
+#include "rio_probe.h"
+#include "rio_param.h"
+#include "rio_fault.h"
+#include "rio_pid.h"
+#include "rio_filter.h"
+#include "rio_time.h"
+#include "rio_stage.h"
+#include "rio_latency.h"
+#include "rio_delta.h"
+#include "rio_bench.h"
+#include "rio_report.h"
+#include "rio_flash.h"
 #include "ads1115.h"
 #include "eeprom.h"
 #include "storage.h"
 #include "sensirion_lg16.h"
 #include "pca9544a.h"
+#include "i2c_bus.h"
+#include "protocol.h"
 
 /* Pressure Constants */
 #define PRESSURE_SHL                        3
-#define PRESSURE_ADC_REF_MV                 6144
 #define PRESSURE_ADC_BITRES                 15
 #define PRESSURE_ADC_MAX                    ( ( (uint16_t)1 << PRESSURE_ADC_BITRES ) - 1 )
 #define PRESSURE_CTLR_REF_MV                5000
 #define PRESSURE_CTLR_ZERO_MV               1000
 #define PRESSURE_CTLR_RANGE_MV              ( PRESSURE_CTLR_REF_MV - PRESSURE_CTLR_ZERO_MV )
 #define PRESSURE_CTLR_MBAR                  5000
-#define PRESSURE_ADC_SCALE                  ( (int32_t)PRESSURE_ADC_MAX * PRESSURE_CTLR_RANGE_MV / PRESSURE_ADC_REF_MV )
-#define PRESSURE_ADC_ZERO                   ( (int32_t)PRESSURE_ADC_MAX * PRESSURE_CTLR_ZERO_MV / PRESSURE_ADC_REF_MV )
+#define PRESSURE_ADC_FSR_MBARSHL(mv)        ( (uint32_t)(mv) * ( (uint32_t)PRESSURE_CTLR_MBAR << PRESSURE_SHL ) / PRESSURE_CTLR_RANGE_MV )   // 16 bits up to 6.144 V
+#define PRESSURE_ADC_ZERO_MBARSHL           ( (int32_t)PRESSURE_ADC_FSR_MBARSHL( PRESSURE_CTLR_ZERO_MV ) )
+
+/* Pressure Calibration Constants, per channel, see PRESSURE_CAL */
+#define PRESSURE_CAL_ZERO_MAX               ( 500 << PRESSURE_SHL )    // mbar << PRESSURE_SHL either side of 0
+
+/* Largest overpressure limit, mbar: the I16 pressure in mbar << PRESSURE_SHL saturates here */
+#define PRESSURE_LIMIT_MAX_MBAR             ( INT16_MAX >> PRESSURE_SHL )
+#define PRESSURE_CAL_SPAN_SHIFT             14
+#define PRESSURE_CAL_SPAN_ONE               ( (uint16_t)1 << PRESSURE_CAL_SPAN_SHIFT )
+#define PRESSURE_CAL_TRIM_SHL               3       // Stored span trim, I8 steps of 1/2048, +-6.2 %
+#define PRESSURE_CAL_SPAN(trim)             ( (uint16_t)( PRESSURE_CAL_SPAN_ONE + ( (int16_t)(trim) << PRESSURE_CAL_TRIM_SHL ) ) )
+
+/* Pressure Control Constants */
+/* Gains are >> PPID_SHIFT, on the error in mbar << PRESSURE_SHL. The PID output is a correction
+ * added to the target, so the open loop command stays in as feed-forward. */
+#define PPID_DEFAULT_P                      2048    // 0.5
+#define PPID_DEFAULT_I                      256     // 0.0625 per cycle
+#define PPID_DEFAULT_D                      0
+#define PPID_SHIFT                          12
+#define PPID_DIFF_FILT_SHIFT                3
+#define PPID_TERM_LIMIT                     ( ( (int32_t)500 << PRESSURE_SHL ) << PPID_SHIFT )  // 500 mbar per term
+#define PPID_I_CHANGE_LIMIT                 ( ( (int32_t)50 << PRESSURE_SHL ) << PPID_SHIFT )   // 50 mbar per cycle
 
 /* Flow Constants */
 #define FPID_DEFAULT_P                      200
 #define FPID_DEFAULT_I                      100
 #define FPID_DEFAULT_D                      1000
 #define FPID_DIFF_FILT_SHIFT                3
-#define FPID_DIFF_FILT_MUL                  ( ( 1 << FPID_DIFF_FILT_SHIFT ) - 1 )
 #define FPID_TERM_MAX                       ( INT32_MAX >> 2 )  // Allows for 4 terms to be added in PID
 #define FPID_P_TERM_LIMIT                   ( (int32_t)1000 << FPID_I_SHIFT )
+#define FPID_D_TERM_LIMIT                   ( FPID_TERM_MAX >> FPID_DIFF_FILT_SHIFT )  // So the D filter sum fits I32
 #define FPID_I_CHANGE_LIMIT                 ( (int32_t)1000 << FPID_I_SHIFT )
+#define FPID_I_LIMIT                        ( (int32_t)100 << FPID_I_SHIFT )
 //#define FPID_P_TERM_LIMIT                   FPID_TERM_MAX
 #define FPID_OUTPUT_SLEW_LIMIT              100
 #define FPID_I_SHIFT                        12
+#define FLOW_FF_ENABLE                      0x01    // Add R x setpoint change to the output
+#define FLOW_FF_LEARN                       0x02    // Track R from the measured pressure / flow
+#define FLOW_FF_LEARN_SHIFT                 4       // R filter, 1/16 of the new estimate per cycle
+#define FLOW_FF_LEARN_MIN_UL_HR             60      // Flow too small below this to estimate R
+#define FLOW_CONV_SHIFT_MAX                 26      // 60 << 26 still fits U32
+#define FLOW_SCHED_SLOPE_SHIFT              15      // Gain change per ul/hr, a U16 gain step << 15 still fits I32
+
+/* Clog and Leak Watch Constants, see flow_res_update() */
+#define FLOW_RES_SHIFT                      2       // R estimate, 1/4 of the new one per reading
+#define FLOW_RES_MIN_UL_HR                  FLOW_FF_LEARN_MIN_UL_HR  // Less flow counts as this, so a blocked chip reads a large R
+#define FLOW_RES_MIN_MBAR_SHL               ( 20 << PRESSURE_SHL )  // Less pressure says nothing of R
+#define FLOW_RES_DEBOUNCE                   3       // Readings in a row past a limit to change the state
+#define FLOW_RES_CLOG_PCT_DEFAULT           50      // R above the reference by this much is a clog
+#define FLOW_RES_LEAK_PCT_DEFAULT           30      // R below the reference by this much is a leak
+#define FLOW_EST_SHIFT_MAX                  6       // Flow estimate, each reading weighs down to 1/64
+#define FLOW_EST_AGE_MAX                    4       // Pressure samples the estimate carries a flow loop without a reading
+
+/* Watchdog Constants, see retain_save(). The timeout, about 1 s, is RWDTPS in mcc.c. */
+#define RETAIN_MAGIC                        0x5257  // Marks a retain block written by retain_save()
+#ifdef __XC16__
+#define RETAIN_PERSISTENT                   __attribute__(( persistent ))   // Not cleared by the start-up code
+#else
+#define RETAIN_PERSISTENT
+#endif
+
+/* Warm Start Constants, see loop_warm_track() */
+#define LOOP_WARM_PPID_TARGET               0       // Words of loop_warm[], as STORE_WARM_WORDS
+#define LOOP_WARM_PPID_INTEGRATED           1
+#define LOOP_WARM_FPID_TARGET               2
+#define LOOP_WARM_FPID_OUTPUT               3
+#define LOOP_WARM_SETTLE_CYCLES             100     // Recorded every 100 cycles settled, 10 s at the default cycle
+#define LOOP_WARM_PPID_BAND_MBAR_SHL        ( 5 << PRESSURE_SHL )   // Pressure loop settled this close to its target
+#define LOOP_WARM_FPID_BAND_SHIFT           5       // Flow loop settled within 1/32 of its target
+#define LOOP_WARM_PPID_TARGET_MBAR_SHL      ( 100 << PRESSURE_SHL ) // Integrator restored for a target this close
+#define LOOP_WARM_SAVE_MBAR_SHL             ( 2 << PRESSURE_SHL )   // Stored again only on a larger change
+#define FLOW_OUT_MAP_POINTS                 4       // Settled flow targets kept per channel, see flow_out_map_record()
+#define FLOW_OUT_MAP_HOLD_CYCLES            50      // Most cycles the loop waits for the flow after a mapped step
+
+/* Flow Autotune Constants, see flow_autotune() */
+#define FTUNE_NO_OVERSHOOT
+#define FTUNE_DELTA_DEFAULT_MBAR            50      // Relay amplitude, either side of the bias
+#define FTUNE_HYST_SHR                      5       // Transition hysteresis, 1/32 of the target
+#define FTUNE_HYST_MIN_RAW                  4
+#define FTUNE_TRANS_CYCLES_MIN              2       // Shortest half cycle, so sensor noise at a transition does not switch back
+#define FTUNE_SEEK_CYCLES                   50      // Cycles before the first transition between bias steps towards the target
+#define FTUNE_HALF_CYCLE_MAX                600     // Cycles without a transition or bias step before giving up, 60 s at 100 ms
+#define FTUNE_CYCLES_MIN                    3       // Log from the first full cycle
+#define FTUNE_CONV_COUNT                    3       // Consecutive settled estimates needed to finish
+#define FTUNE_CONV_ASYMMETRY_PC             10      // Largest half cycle difference of a settled estimate, percent of the period
+#define FTUNE_CONV_SPREAD_PC                10      // Max - min of kd and of tu over those, percent of the mean
+#define FTUNE_ESTIMATES_MAX                 20
+#ifndef FTUNE_NO_OVERSHOOT
+#define FTUNE_KD_NUM                        6259    // 0.6 ku, x 4096 x 8 / pi for the peak to peak flow
+#else
+#define FTUNE_KD_NUM                        2086    // 0.2 ku
+#endif
+
+/* Signal Filter Constants */
+#define FILTER_SIGNAL_PRESSURE              0       // pressure_mbar_shl_actual[], on each ADC reading
+#define FILTER_SIGNAL_FLOW                  1       // flow_raw_actual[], on each successful flow read
+#define FILTER_SIGNALS                      2
 
 /* Flow / Pressure Macros */
 #define ADC_CHAN_MAX                        ( NUM_PRESSURE_CLTRLS - 1 )
-#define ADC_PERIOD_MS                       100
-#define PRESSURE_ADC_TO_MBARSHL(adc)        ( ( ( ( ( (int32_t)( (int16_t)(adc) ) ) - PRESSURE_ADC_ZERO ) << PRESSURE_SHL ) * PRESSURE_CTLR_MBAR / PRESSURE_ADC_SCALE ) )
-//#define PRESSURE_ADC_TO_MBARSHL(adc)        ( ( ( ( ( (int32_t)( (int16_t)(adc) ) ) - PRESSURE_ADC_ZERO ) << PRESSURE_SHL ) * 1000 / PRESSURE_ADC_SCALE ) )
-
-/* Comms Constants */
-#define PACKET_TYPE_GET_ID                  1
-#define PACKET_TYPE_SET_PRESSURE_TARGET     2
-#define PACKET_TYPE_GET_PRESSURE_TARGET     3
-#define PACKET_TYPE_GET_PRESSURE_ACTUAL     4
-#define PACKET_TYPE_SET_FLOW_TARGET         5
-#define PACKET_TYPE_GET_FLOW_TARGET         6
-#define PACKET_TYPE_GET_FLOW_ACTUAL         7
-#define PACKET_TYPE_SET_CONTROL_MODE        8
-#define PACKET_TYPE_GET_CONTROL_MODE        9
-#define PACKET_TYPE_SET_FPID_CONSTS         10
-#define PACKET_TYPE_GET_FPID_CONSTS         11
+#define CTRL_CHAN_ALL                       ( ( 1 << NUM_PRESSURE_CLTRLS ) - 1 )   // Channel bits
+#define CHAN_BANK(chan)                     ( (chan) / PRESSURE_BANK_CHANS )
+#define BANK_CHANS(bank)                    ( ( ( 1 << PRESSURE_BANK_CHANS ) - 1 ) << ( (bank) * PRESSURE_BANK_CHANS ) )  // Channel bits
+
+
+/* ADC Config Constants, per pressure channel, see SET_ADC_CONFIG */
+#define ADC_GAIN_CODES                      6       // PGA codes 0-5, 6.144 V down to 0.256 V
+#define ADC_GAIN_AUTO                       7       // PGA code 7 only repeats 0.256 V, so it selects auto-ranging
+#define ADC_AUTORANGE_UP_CODE               0x7800  // |code| above: the next larger range, before it clips at 0x7FFF
+#define ADC_AUTORANGE_DOWN_CODE             0x3800  // |code| below: the next smaller range, where it reads under 0x7000
+#define ADC_BURST_MAX                       16      // Conversions averaged per channel and cycle, see adc_burst_add()
+#define ADC_CONFIG_PACK(dr, gain, mux, burst)   ( (uint16_t)(dr) | ( (uint16_t)(gain) << 3 ) | ( (uint16_t)(mux) << 6 ) | ( (uint16_t)( (burst) - 1 ) << 9 ) )   // Stored, codes of 3 bits, burst of 4
+#define ADC_CONFIG_DR(config)               ( (config) & 0x07 )
+#define ADC_CONFIG_GAIN(config)             ( ( (config) >> 3 ) & 0x07 )
+#define ADC_CONFIG_MUX(config)              ( ( (config) >> 6 ) & 0x07 )
+#define ADC_CONFIG_BURST(config)            ( ( ( (config) >> 9 ) & 0x0F ) + 1 )     // 0 before bursts, a single conversion
+#define ADC_CONFIG_UNUSED(config)           ( (config) >> 13 )                      // Set in a blank config
+
+/* Comms Constants. Nx[...] in the packet comments is once per channel, NUM_PRESSURE_CLTRLS.
+ * Packet types and the pkt_*_t reply layouts are generated into protocol.h from protocol.json. */
+#define FIRMWARE_VERSION                    0x0100  // [major U8][minor U8], reported by GET_CAPABILITIES
+
+/* Parameter ids of the descriptor table, see params[]. Never renumber, hosts save them.
+ * Per channel parameters take four ids, base + channel, and channels 4-7 of a second bank
+ * the same four with bit 7 set, see PARAM_ID_CHAN(). */
+#define PARAM_ID_ADC_PERIOD_MS              0x01
+#define PARAM_ID_I2C_FAST_PLUS              0x02    // 1 clocks I2C2 at 1 MHz, not stored
+#define PARAM_ID_FLOW_MONITOR_DIV           0x03    // Cycles per flow read of a channel not in a flow mode
+#define PARAM_ID_FLOW_RES_CLOG_PCT          0x04    // R over the reference, % of it, for a clog
+#define PARAM_ID_FLOW_RES_LEAK_PCT          0x05    // R under the reference, % of it, for a leak
+#define PARAM_ID_LOOP_WARM_START            0x06    // 1 starts the loops where they last settled, not stored
+#define PARAM_ID_CTRL_EVENT                 0x07    // 1 updates each channel as soon as its samples are in, not stored
+#define PARAM_ID_MODULE_ADDR                0x08    // Address of addressed BATCHes, SPI_MODULE_ADDR_ANY answers all
+#define PARAM_ID_RETAIN_STATUS              0x09    // E_RETAIN_STATUS of the last reset, read only
+#define PARAM_ID_TRACE_MASK                 0x0A    // TRACE_* regions on trace pin 0, not stored, with a trace pin
+#define PARAM_ID_TRACE_MASK1                0x0B    // On trace pin 1, with two
+#define PARAM_ID_FPID_P                     0x10
+#define PARAM_ID_FPID_I                     0x14
+#define PARAM_ID_FPID_D                     0x18
+#define PARAM_ID_PPID_P                     0x20
+#define PARAM_ID_PPID_I                     0x24
+#define PARAM_ID_PPID_D                     0x28
+#define PARAM_ID_ADC_DATARATE               0x30
+#define PARAM_ID_FLOW_FF_R                  0x34
+#define PARAM_ID_ADC_GAIN                   0x38    // PGA code 0-5, or 7 auto-ranges
+#define PARAM_ID_ADC_MUX                    0x3C    // ADS1115 mux code 0-7
+#define PARAM_ID_FLOW_RAW_ACTUAL            0x40    // Read only
+#define PARAM_ID_FLOW_RESOLUTION            0x44    // Flow sensor bits, SENSIRION_RES_BITS_MIN-MAX
+#define PARAM_ID_FLOW_CRC_CHECK             0x48    // 0 takes flow readings without checking the CRC
+#define PARAM_ID_FLOW_CRC_ERRORS            0x4C    // Read only, rejected readings since reset
+#define PARAM_ID_FLOW_FLAGS_GATE            0x50    // 0 reads the flow word alone and never holds the loop
+#define PARAM_ID_FLOW_AIR_EVENTS            0x54    // Read only, air-in-line flag rises since reset
+#define PARAM_ID_FLOW_HIGH_EVENTS           0x58    // Read only, high-flow flag rises since reset
+#define PARAM_ID_FLOW_RES_R                 0x5C    // Read only, R estimate, mbar per 1000 ul/hr
+#define PARAM_ID_FLOW_RES_REF               0x60    // Reference R, 0 turns the clog and leak watch off
+#define PARAM_ID_FLOW_RES_STATE             0x64    // Read only, E_FLOW_RES_STATE
+#define PARAM_ID_PRESSURE_LIMIT             0x68    // mbar, 0 off, checked on each ADC sample
+#define PARAM_ID_PRESSURE_TRIPS             0x6C    // Read only, cut-offs by the limit since reset
+#define PARAM_ID_ADC_BURST                  0x70    // Conversions averaged per cycle, 1-ADC_BURST_MAX
+#define PARAM_ID_PRESSURE_CAL_ZERO          0x74    // mbar << PRESSURE_SHL subtracted from each sample
+#define PARAM_ID_PRESSURE_CAL_TRIM          0x78    // Span after the zero, 1 + trim / 2048
+#define PARAM_ID_FLOW_EST_SHIFT             0x7C    // Flow estimate between readings, 0 off, not stored
+#define PARAM_ID_CHAN(base,chan)            ( (base) + ( (chan) & 0x03 ) + ( ( (chan) & 0x04 ) << 5 ) )
+#define PARAM_CHAN(id)                      ( ( (id) & 0x03 ) | ( ( (id) >> 5 ) & 0x04 ) )
+#if NUM_PRESSURE_BANKS > 1
+#define PARAM_ROWS(row)                     row(0) row(1) row(2) row(3) row(4) row(5) row(6) row(7)
+#else
+#define PARAM_ROWS(row)                     row(0) row(1) row(2) row(3)
+#endif
+
+/* Telemetry Constants */
+#define TELEMETRY_SAMPLE_SIZE               sizeof(pkt_telemetry_sample_t)
+#define TELEMETRY_TX_RESERVE                ( 16 + (NUM_PRESSURE_CLTRLS*12) )   // Write ring bytes kept free for replies, fits GET_STATUS_SNAPSHOT
+#define TELEMETRY_WORDS                     ( TELEMETRY_SAMPLE_SIZE / sizeof(uint16_t) )    // The sample as U16 words, for rio_delta
+#define TELEMETRY_KEY_EVERY                 32  // Compact samples per keyframe, bounds what a lost one costs the host
+
+/* SUBSCRIBE signals, REPORT entries: N pressures in mbar << PRESSURE_SHIFT, then N flows in ul/hr */
+#define REPORT_SIGNALS                      ( 2 * NUM_PRESSURE_CLTRLS )
+
+/* SET_TELEMETRY and HISTORY_STREAM record formats */
+#define RECORD_FORMAT_PLAIN                 0
+#define RECORD_FORMAT_COMPACT               1   // rio_delta records, see push_telemetry() and history_stream_fill_compact()
+
+/* History Constants */
+#define HISTORY_LEN                         64  // Control cycles kept, power of two
+#define HISTORY_REPLY_HEADER                ( sizeof(err) + (2*sizeof(uint16_t)) + sizeof(uint8_t) )
+#define HISTORY_RECORD_SIZE                 sizeof(pkt_history_record_t)
+#define HISTORY_REPLY_MAX                   ( ( UINT8_MAX - HISTORY_REPLY_HEADER ) / HISTORY_RECORD_SIZE )  // Records per GET_HISTORY reply, 4 of 4 channels or 2 of 8
+#define HISTORY_WORDS                       ( HISTORY_RECORD_SIZE / sizeof(uint16_t) )
+
+/* Profile Constants */
+#define PROFILE_LEN                         16      // Points per channel
+#define PROFILE_FLAG_LOOP                   0x01
+#define PROFILE_FLAG_PRESSURE               0x02    // Points are pressure targets, else flow targets
+#define PROFILE_FRAC_SHIFT                  15      // Segment fraction, elapsed < duration <= U16
+
+/* Log Records, see rio_log_formats[] */
+#define LOG_ID_FLOW_CHAN                    0
+#define LOG_ID_FLOW_PID                     1
+#define LOG_ID_PACKET                       2
+#define LOG_ID_SPI_CLEARED                  3
+
+/* Fault Records, see rio_fault. Never renumber, the log outlives the firmware. */
+#define FAULT_ID_FLOW_NOT_PRESENT           1   // arg channel, first start-up probe failed, flow control in FLOW_CTRL_STATE_ERROR
+#define FAULT_ID_FLOW_READ_FAIL             2   // arg channel, first failed read after a good one
+#define FAULT_ID_I2C_ABORT                  3
+#define FAULT_ID_ADC_TIMEOUT                4
+#define FAULT_ID_FLOW_CRC_FAIL              5   // arg channel, first rejected reading after a good one
+#define FAULT_ID_FLOW_LOST                  6   // arg channel, FLOW_LOST_READS failed reads, re-probing
+#define FAULT_ID_FLOW_RECOVERED             7   // arg channel, found again by the re-probe
+#define FAULT_ID_I2C_STUCK                  8   // arg 1 if clocking SCL freed SDA, 0 if it is still held low
+#define FAULT_ID_FTUNE_FAIL                 9   // arg ( channel << 8 ) | E_FTUNE_FAIL
+#define FAULT_ID_FLOW_CLOG                  10  // arg ( channel << 8 ) | R as % of the reference, up to 255
+#define FAULT_ID_FLOW_LEAK                  11  // arg ( channel << 8 ) | R as % of the reference
+#define FAULT_ID_OVERPRESSURE               12  // arg ( channel << 16 ) | mbar measured, output cut to 0
 
 /* DAC Constants */
+#define DAC_CMD_WRITE                       0b000   // Write input register
+#define DAC_CMD_WRITE_UPDATE_ALL            0b010   // Write input register, update all outputs
+#define DAC_CMD_WRITE_UPDATE                0b011   // Write input register, update its output only
+#define DAC_SCALE_SHIFT                     15
+#define DAC_SCALE                           ( ( (uint32_t)0xFFFF << DAC_SCALE_SHIFT ) / ( (uint32_t)PRESSURE_CTLR_MBAR << PRESSURE_SHL ) )     // 16 bits, codes within 1 LSB of the divide
+#define DAC_FIFO_WORDS                      4       // SPI2 enhanced buffer depth in 32-bit mode
+#define PRESSURE_MBARSHL_TO_DAC(p)          ( (uint16_t)( __builtin_muluu( (p), DAC_SCALE ) >> DAC_SCALE_SHIFT ) )
+
 typedef enum
 {
     DAC_CHAN_A      = 0b000,
@@ -73,6 +279,18 @@ typedef enum
     DAC_CHAN_ALL    = 0b111,
 } E_DAC_CHAN;
 
+#define DAC_CHAN(chan)                      ( (E_DAC_CHAN)( DAC_CHAN_A + ( (chan) % PRESSURE_BANK_CHANS ) ) )
+
+/* Each bank has its own quad DAC. With a second one SS2 reaches the SYNC of one at a time,
+ * through gates the board switches with DAC_SELECT( bank ), only with the SPI2 FIFO empty. */
+#ifndef DAC_SELECT
+#if NUM_PRESSURE_BANKS == 1
+#define DAC_SELECT(bank)                    ( (void)( bank ) )
+#else
+#error "DAC_SELECT(bank) must route SS2 to the DAC of <bank>"
+#endif
+#endif
+
 /* ADC Constants */
 typedef enum
 {
@@ -81,7 +299,69 @@ typedef enum
     ADC_STATE_WAIT,
 } E_ADC_STATE;
 
-const uint8_t adc_map[NUM_PRESSURE_CLTRLS] = {3, 2, 0, 1};
+/* ADC_RDY (RB14 = RP46) falls at the end of each conversion and drives INT1. The ISR queues I2C
+ * transactions, and I2C2_MasterTRBInsert() is not reentrant, so the main loop holds INT1 off
+ * while it queues or aborts. An edge in that window stays latched in _INT1IF. */
+#define ADC_RDY_RP                      46
+#define ADC_RDY_INT_DISABLE()           ( _INT1IE = 0 )
+#define ADC_RDY_INT_ENABLE()            ( _INT1IE = 1 )
+
+/* Frame Sync Constants. The camera's frame trigger, the strobe's trigger line, wired to the
+ * ICSP clock pin RB9 = RP41 on the module header, drives INT2. Disconnect it to program. */
+#define FRAME_SYNC_RP                   41
+#define FRAME_SYNC_OFF                  0   // Cycles run on adc_period_ms
+#define FRAME_SYNC_RISING               1   // A cycle starts on the frame edge, adc_period_ms without one still runs a cycle
+#define FRAME_SYNC_FALLING              2
+#define FRAME_SYNC_INT_DISABLE()        ( _INT2IE = 0 )
+#define FRAME_SYNC_INT_ENABLE()         ( _INT2IE = 1 )
+
+/* Flow Read Constants */
+typedef enum
+{
+    FLOW_READ_IDLE,
+    FLOW_READ_CHANNEL,              // MUX switch, read and restart of flow_read_chan queued
+    FLOW_READ_DONE,
+} E_FLOW_READ_STATE;
+
+#define FLOW_READ_TIMEOUT_MS                4   // Per channel, 672us each at 400kHz plus an ADC transaction
+#define FLOW_MONITOR_DIV_DEFAULT            4   // Channels outside the flow modes are read every 4th cycle
+#define FLOW_MUX_UNKNOWN                    0xFF
+
+/* Flow Sensor Re-probe Constants */
+typedef enum
+{
+    FLOW_PROBE_IDLE,                // Sensor present
+    FLOW_PROBE_WAIT,                // Backing off before the next attempt
+    FLOW_PROBE_RESET,               // MUX switch and soft reset
+    FLOW_PROBE_BOOT,                // SENSIRION_BOOT_MS after the reset
+    FLOW_PROBE_READ_REG,            // Advanced user register read
+    FLOW_PROBE_WRITE_REG,           // Resolution and hold-master written back
+    FLOW_PROBE_READ_SCALE,
+    FLOW_PROBE_START,               // First measurement started, then present again
+} E_FLOW_PROBE_STATE;
+
+#define FLOW_LOST_READS                     5       // Failed reads in a row before a sensor is re-probed
+#define FLOW_PROBE_TIMEOUT_MS               4       // Per step
+#define FLOW_PROBE_BACKOFF_MIN_MS           100     // Doubles on each failed attempt
+#define FLOW_PROBE_BACKOFF_MAX_MS           10000
+
+/* Pressure channel of each ADC input in conversion order. Input i is AIN( i % 4 ) of the
+ * ADS1115 of bank i / 4, each bank wired as the first, see ADC_MAP_BANK in board_config.h. */
+const uint8_t adc_map[NUM_PRESSURE_CLTRLS] =
+{
+    ADC_MAP_BANK(0),
+#if NUM_PRESSURE_BANKS > 1
+    ADC_MAP_BANK(1),
+#endif
+};
+const uint8_t adc_i2c_addrs[NUM_PRESSURE_BANKS] =
+{
+    ADS1115_ADDR_GND,
+#if NUM_PRESSURE_BANKS > 1
+    ADS1115_ADDR_VDD,               // ALERT/RDY wired-OR with the first, one converts at a time
+#endif
+};
+#define ADC_INPUT_ADDR(input)               ( adc_i2c_addrs[ (input) / PRESSURE_BANK_CHANS ] )
 
 typedef enum
 {
@@ -92,7 +372,21 @@ typedef enum
 } E_PRESSURE_CTRL_STATE;
 
 /* Flow Constants */
-const uint8_t flow_map[NUM_PRESSURE_CLTRLS] = {1, 0, 2, 3};
+/* PCA9544A port of each channel's flow sensor, on the mux of its bank, see board_config.h */
+const uint8_t flow_map[NUM_PRESSURE_CLTRLS] =
+{
+    FLOW_MAP_BANK,
+#if NUM_PRESSURE_BANKS > 1
+    FLOW_MAP_BANK,
+#endif
+};
+const uint8_t pca9544a_i2c_addrs[NUM_PRESSURE_BANKS] =
+{
+    0b1110000,
+#if NUM_PRESSURE_BANKS > 1
+    0b1110001,                      // Cascaded, only one mux is on at a time as every LG16 is at 0x40
+#endif
+};
 
 typedef enum
 {
@@ -102,19 +396,173 @@ typedef enum
     FLOW_CTRL_STATE_ERROR
 } E_FLOW_CTRL_STATE;
 
+typedef enum
+{
+    FTUNE_STATE_DEFAULT,
+    FTUNE_STATE_RUNNING,
+    FTUNE_STATE_ABORTED,
+    FTUNE_STATE_FINISHED,
+    FTUNE_STATE_FAILED
+} E_FTUNE_STATE;
+
+typedef enum
+{
+    FTUNE_FAIL_NONE,
+    FTUNE_FAIL_CYCLES,              // No FTUNE_CONV_COUNT settled estimates in FTUNE_ESTIMATES_MAX
+    FTUNE_FAIL_TIMEOUT,             // No transition in FTUNE_HALF_CYCLE_MAX, the relay cannot reach the target
+    FTUNE_FAIL_FLOW_LOST            // Sensor lost while tuning
+} E_FTUNE_FAIL;
+
+typedef enum
+{
+    PCAL_STATE_DEFAULT,
+    PCAL_STATE_RUNNING,             // Averaging samples into the zero
+    PCAL_STATE_ABORTED,             // Stopped by the host, or the channel left CTRL_MODE_ZERO
+    PCAL_STATE_FINISHED,            // New zero set and stored
+    PCAL_STATE_FAILED               // Mean beyond PRESSURE_CAL_ZERO_MAX, the zero kept
+} E_PCAL_STATE;
+
+typedef enum
+{
+    FLOW_RES_STATE_OK,
+    FLOW_RES_STATE_CLOG,
+    FLOW_RES_STATE_LEAK
+} E_FLOW_RES_STATE;
+
+/* Relay autotune of a flow channel, as the heater's */
+typedef struct
+{
+    E_FTUNE_STATE state;
+    E_FTUNE_FAIL fail;
+    bool high;                      // Output at bias + delta, until the flow passes target + hyst
+    int16_t target;                 // Raw flow
+    int16_t hyst;
+    uint16_t bias;                  // mbar << PRESSURE_SHL, moved each cycle to even out the half cycles
+    uint16_t delta;
+    uint16_t timer;                 // Control cycles since the start
+    uint16_t switch_time;           // timer at the last transition
+    uint16_t period_high;           // Of the last half cycles, control cycles
+    uint16_t period_low;
+    int16_t flow_max;               // Of the half cycles running and just ended
+    int16_t flow_min;
+    uint8_t cycles;                 // Transitions, saturating
+    uint8_t estimates;              // Full cycles estimated
+    uint8_t settled;                // Consecutive estimates within FTUNE_CONV_ASYMMETRY_PC
+    uint16_t log_kd[FTUNE_CONV_COUNT];  // Of the settled estimates, by settled % FTUNE_CONV_COUNT
+    uint16_t log_tu[FTUNE_CONV_COUNT];
+} flow_tune_t;
+
+/* Flow and ADC unit conversion, value x factor >> shift with a 16 bit factor, see flow_conv_init() */
+typedef struct
+{
+    uint16_t factor;
+    uint8_t shift;
+} flow_conv_t;
+
+/* Status Snapshot */
+typedef struct
+{
+    uint16_t seq;                                           // Incremented every control cycle
+    uint32_t time_us;                                       // time_now_us() when the cycle's sampling started
+    uint32_t frame;                                         // Frame edge that started the cycle, 0 if the timer did
+    int16_t pressure_mbar_shl_actual[NUM_PRESSURE_CLTRLS];
+    uint16_t pressure_mbar_shl_output[NUM_PRESSURE_CLTRLS];
+    uint16_t pressure_mbar_shl_target[NUM_PRESSURE_CLTRLS];
+    int16_t flow_raw_actual[NUM_PRESSURE_CLTRLS];
+    int16_t flow_raw_target[NUM_PRESSURE_CLTRLS];
+    uint8_t ctrl_modes[NUM_PRESSURE_CLTRLS];
+    uint8_t flow_ctrl_state[NUM_PRESSURE_CLTRLS];
+} status_snapshot_t;
+
+typedef struct
+{
+    uint16_t seq;                   // status_snapshot.seq of the cycle
+    uint32_t time_us;               // status_snapshot.time_us of the cycle
+    int16_t pressure_mbar_shl_actual[NUM_PRESSURE_CLTRLS];
+    uint16_t pressure_mbar_shl_output[NUM_PRESSURE_CLTRLS];
+    int16_t flow_raw_actual[NUM_PRESSURE_CLTRLS];
+    int16_t fpid_terms[NUM_PRESSURE_CLTRLS][3];     // P, I, D of the flow or pressure loop, 0 in open loop
+} history_record_t;
+
+typedef struct
+{
+    uint32_t cycles;                // Control cycles completed
+    uint16_t overruns;              // Cycles busy for a whole period or longer, saturating
+    uint16_t period_ms_last;        // Between the last two completed cycles
+    uint16_t period_ms_max;
+    uint16_t busy_ms_last;          // ADC cycle start to outputs updated
+    uint16_t busy_ms_max;
+} loop_stats_t;
+
+typedef struct
+{
+    int16_t target_raw;             // Settled flow target, 0 for a free point
+    uint16_t output;                // Regulator command, or cascade setpoint, that held it
+} flow_out_map_t;
+
+typedef struct
+{
+    uint16_t duration_ms;           // To go from the previous point to this one, 0 steps
+    uint16_t value;                 // Pressure mbar << PRESSURE_SHL U16, or flow ul/hr I16
+} profile_point_t;
+
+typedef struct
+{
+    profile_point_t points[PROFILE_LEN];
+    uint16_t uploaded;              // Bit per point
+    uint8_t length;
+    uint8_t flags;                  // PROFILE_FLAG_*
+    uint8_t active;
+    uint8_t index;                  // Point being moved to
+    uint16_t segment_start_ms;      // timer_ms at the start of the segment to points[index]
+    int32_t segment_from;           // Target at segment_start_ms, in point value units
+} profile_t;
+
 /* String Constants */
 const char *OK_STR = "OK";
 const char *FAIL_STR = "FAIL";
 
+const char * const rio_log_formats[] =
+{
+    [LOG_ID_FLOW_CHAN]   = "Chan %li mode %li, Pressure %li / %li mbar, Flow %li ul/hr rc=%li present=%li\n",
+    [LOG_ID_FLOW_PID]    = "Chan %li, error %li, output %li, %li, %li, %li, change %li\n",
+    [LOG_ID_PACKET]      = "Packet received: Cmd %li\n",
+    [LOG_ID_SPI_CLEARED] = "Cleared\n",
+};
+const uint8_t rio_log_format_count = sizeof(rio_log_formats) / sizeof(rio_log_formats[0]);
+
 /* System Constants */
 typedef enum
 {
     CTRL_MODE_ZERO,
     CTRL_MODE_PRESSURE_OPEN_LOOP,
     CTRL_MODE_PRESSURE,
-    CTRL_MODE_FLOW
+    CTRL_MODE_FLOW,
+    CTRL_MODE_FLOW_CASCADE          // Flow loop sets the pressure loop's setpoint
 } E_CTRL_MODE;
 
+typedef enum
+{
+    RETAIN_STATUS_COLD,             // Power-on or any other reset, the loops start in CTRL_MODE_ZERO
+    RETAIN_STATUS_RESUMED,          // Watchdog reset, the loops resumed from the retain block
+    RETAIN_STATUS_LOST              // Watchdog reset, but the retain block failed its CRC
+} E_RETAIN_STATUS;
+
+/* What a watchdog reset keeps of the control cycle before it */
+typedef struct
+{
+    uint16_t magic;
+    E_CTRL_MODE ctrl_modes[NUM_PRESSURE_CLTRLS];
+    uint16_t pressure_target[NUM_PRESSURE_CLTRLS];
+    uint16_t pressure_output[NUM_PRESSURE_CLTRLS];
+    uint16_t flow_cascade_setpoint[NUM_PRESSURE_CLTRLS];
+    int16_t flow_target[NUM_PRESSURE_CLTRLS];
+    uint16_t flow_ramp[NUM_PRESSURE_CLTRLS];
+    uint16_t flow_scale[NUM_PRESSURE_CLTRLS];      // Counts per ul/min the flow values are in
+    pid_state_t ppid_loop[NUM_PRESSURE_CLTRLS];
+    uint16_t crc;                                   // Over everything before it
+} retain_t;
+
 /* System Data */
 uint8_t device_id[] = "MICROFLOW";
 bool eeprom_okay;
@@ -122,41 +570,175 @@ bool adc_okay;
 bool mux_okay;
 volatile uint16_t timer_ms;
 E_CTRL_MODE ctrl_modes[NUM_PRESSURE_CLTRLS];
+retain_t retain RETAIN_PERSISTENT;
+uint8_t retain_status;
 
 /* Pressure Data */
 E_PRESSURE_CTRL_STATE pressure_ctrl_state[NUM_PRESSURE_CLTRLS];
 volatile int16_t pressure_mbar_shl_actual[NUM_PRESSURE_CLTRLS];
 volatile uint16_t pressure_mbar_shl_output[NUM_PRESSURE_CLTRLS];
 uint16_t pressure_mbar_shl_target[NUM_PRESSURE_CLTRLS];
-E_ADC_STATE adc_state;
-uint8_t adc_go = 0;
-uint8_t adc_chan;
+pid_config_t ppid_config[NUM_PRESSURE_CLTRLS];
+pid_state_t ppid_loop[NUM_PRESSURE_CLTRLS];
+uint16_t flow_cascade_setpoint[NUM_PRESSURE_CLTRLS];    // Pressure loop target in CTRL_MODE_FLOW_CASCADE
+uint16_t pressure_limit_mbar[NUM_PRESSURE_CLTRLS];      // 0 is no limit
+uint16_t pressure_trips[NUM_PRESSURE_CLTRLS];           // Cut-offs by pressure_limit_check()
+int16_t pressure_cal_zero[NUM_PRESSURE_CLTRLS];         // mbar << PRESSURE_SHL read at 0 mbar, see pressure_cal_apply()
+int8_t pressure_cal_trim[NUM_PRESSURE_CLTRLS];          // Stored span trim
+uint16_t pressure_cal_span[NUM_PRESSURE_CLTRLS];        // PRESSURE_CAL_SPAN() of the trim, >> PRESSURE_CAL_SPAN_SHIFT
+E_PCAL_STATE pressure_cal_state[NUM_PRESSURE_CLTRLS];   // Zero capture of PRESSURE_CAL
+uint8_t pressure_cal_left[NUM_PRESSURE_CLTRLS];         // Samples still to average
+uint8_t pressure_cal_count[NUM_PRESSURE_CLTRLS];
+int32_t pressure_cal_sum[NUM_PRESSURE_CLTRLS];
+uint8_t loop_warm_enable;                               // loop_warm_start() resumes from loop_warm[]
+uint16_t loop_warm[NUM_PRESSURE_CLTRLS][STORE_WARM_WORDS];  // As stored, each pair blank until its loop settles
+uint8_t loop_warm_cycles[NUM_PRESSURE_CLTRLS];          // Cycles settled at loop_warm_cycles_target[]
+uint16_t loop_warm_cycles_target[NUM_PRESSURE_CLTRLS];
+flow_out_map_t flow_out_map[NUM_PRESSURE_CLTRLS][FLOW_OUT_MAP_POINTS];  // Most recently settled first
+uint8_t flow_out_map_hold[NUM_PRESSURE_CLTRLS];         // Cycles left waiting after a mapped step
+volatile E_ADC_STATE adc_state;
+volatile uint8_t adc_chan;
+volatile bool adc_i2c_wait;     // ADC transaction queued, cleared by the main loop when it returns
 uint16_t adc_time;
-ads1115_datarate adc_datarate = DATARATE_128SPS;
-ads1115_fsr_gain adc_gain = FSR_6_144;
-uint8_t adc_i2c_addr = ADS1115_ADDR_GND;
+uint16_t adc_period_ms;
+ads1115_datarate adc_datarates[NUM_PRESSURE_CLTRLS];     // Per pressure channel, set by SET_LOOP_CONFIG or SET_ADC_CONFIG
+uint8_t adc_gain_settings[NUM_PRESSURE_CLTRLS];         // PGA code 0-5, or ADC_GAIN_AUTO
+ads1115_mux adc_muxes[NUM_PRESSURE_CLTRLS];
+ads1115_fsr_gain adc_gains[NUM_PRESSURE_CLTRLS];        // In use, chosen by auto-ranging
+volatile ads1115_fsr_gain adc_gains_started[NUM_PRESSURE_CLTRLS];  // Of the last conversion started, also from the ADC_RDY interrupt
+uint8_t adc_bursts[NUM_PRESSURE_CLTRLS];                // Conversions per cycle, averaged into one sample
+volatile uint8_t adc_burst_left;                        // Conversions of adc_chan still to start after the running one
+int32_t adc_burst_sum[NUM_PRESSURE_CLTRLS];             // Codes of this cycle's burst so far
+uint8_t adc_burst_count[NUM_PRESSURE_CLTRLS];
+flow_conv_t adc_conv[ADC_GAIN_CODES];                   // ADC code -> mbar << PRESSURE_SHL above 0 V, per PGA code
 ads1115_task_t adc_task;
 
 /* Flow Data */
 E_FLOW_CTRL_STATE flow_ctrl_state[NUM_PRESSURE_CLTRLS];
 volatile int16_t flow_raw_actual[NUM_PRESSURE_CLTRLS];
 int16_t flow_raw_target[NUM_PRESSURE_CLTRLS];
+int16_t flow_raw_setpoint[NUM_PRESSURE_CLTRLS];     // Ramps to flow_raw_target, tracked by the flow PID
+uint16_t flow_ramp_raw[NUM_PRESSURE_CLTRLS];        // Most setpoint change per cycle, 0 steps
+uint16_t flow_ff_r[NUM_PRESSURE_CLTRLS];            // Hydraulic resistance, mbar per 1000 ul/hr
+uint8_t flow_ff_flags[NUM_PRESSURE_CLTRLS];         // FLOW_FF_*
 uint16_t flow_scales_ul_min[NUM_PRESSURE_CLTRLS];
+flow_conv_t flow_conv_ul_hr[NUM_PRESSURE_CLTRLS];   // Raw -> ul/hr, 60 / scale
+flow_conv_t flow_conv_raw[NUM_PRESSURE_CLTRLS];     // ul/hr -> raw, scale / 60
+int16_t flow_ul_hr_max[NUM_PRESSURE_CLTRLS];        // Largest ul/hr target that fits the I16 raw flow
 bool flow_present[NUM_PRESSURE_CLTRLS];
-uint8_t pca9544a_i2c_addr = 0b1110000;
-volatile int32_t fpid_integrated[NUM_PRESSURE_CLTRLS];
-int32_t fpid_windup_limit = 100;
-uint16_t fpid_p[NUM_PRESSURE_CLTRLS];
-uint16_t fpid_i[NUM_PRESSURE_CLTRLS];
-uint16_t fpid_d[NUM_PRESSURE_CLTRLS];
-volatile int32_t fpid_diff[NUM_PRESSURE_CLTRLS];
-volatile int32_t fpid_error_prev[NUM_PRESSURE_CLTRLS];
+uint8_t flow_resolution[NUM_PRESSURE_CLTRLS];       // Sensor resolution bits
+uint8_t flow_crc_check[NUM_PRESSURE_CLTRLS];        // 0 takes readings without the CRC check
+uint16_t flow_crc_errors[NUM_PRESSURE_CLTRLS];      // Readings rejected by the CRC check
+uint8_t flow_flags_gate[NUM_PRESSURE_CLTRLS];       // 1 reads the sensor flags, which hold the flow loop
+uint16_t flow_flags[NUM_PRESSURE_CLTRLS];           // SENSIRION_FLAG_* of the last reading
+uint16_t flow_air_events[NUM_PRESSURE_CLTRLS];      // Air-in-line flag rises
+uint16_t flow_high_events[NUM_PRESSURE_CLTRLS];     // High-flow flag rises
+uint16_t flow_res_r[NUM_PRESSURE_CLTRLS];           // Pressure / flow estimate, mbar per 1000 ul/hr, 0 before the first
+uint16_t flow_res_ref[NUM_PRESSURE_CLTRLS];         // Reference R of the chip, 0 watches nothing
+uint8_t flow_res_state[NUM_PRESSURE_CLTRLS];        // E_FLOW_RES_STATE
+uint8_t flow_res_count[NUM_PRESSURE_CLTRLS];        // Readings in a row calling for another state
+uint8_t flow_est_shift[NUM_PRESSURE_CLTRLS];        // Weight of a reading in the estimate, 1/2^n, 0 runs on the readings
+int16_t flow_raw_est[NUM_PRESSURE_CLTRLS];          // Flow from the pressure samples, pulled to each reading
+int16_t flow_est_pressure[NUM_PRESSURE_CLTRLS];     // Pressure of the last sample, mbar << PRESSURE_SHL
+uint8_t flow_est_age[NUM_PRESSURE_CLTRLS];          // Pressure samples since the last reading
+uint8_t flow_res_clog_pct;
+uint8_t flow_res_leak_pct;
+uint8_t flow_sensor_config_pending;                 // Channel bits, resolution written before the next reads
+uint8_t flow_read_fails[NUM_PRESSURE_CLTRLS];       // Failed reads in a row, FLOW_LOST_READS re-probes
+E_FLOW_PROBE_STATE flow_probe_state[NUM_PRESSURE_CLTRLS];
+uint16_t flow_probe_time[NUM_PRESSURE_CLTRLS];      // Start of the step or the backoff
+uint16_t flow_probe_backoff_ms[NUM_PRESSURE_CLTRLS];
+uint16_t flow_probe_word;                           // Register or scale read by the last step
+uint8_t flow_probe_chan;                            // Channel with a step queued, NUM_PRESSURE_CLTRLS for none
+pca9544a_task_t flow_probe_mux_task;
+sensirion_cmd_task_t flow_probe_task;
+uint8_t flow_boot_pending;                          // Channel bits, first probe since reset not finished
+uint16_t boot_ms;                                   // Reset to the last start-up probe done, 0 while booting
+E_FLOW_READ_STATE flow_read_state;
+uint8_t flow_read_chan;             // Channel being read in FLOW_READ_CHANNEL
+uint16_t flow_read_time;
+uint8_t flow_read_round;            // Cycles, picks the monitoring channels read in this one
+uint8_t flow_monitor_div;           // Cycles per read of a channel not in a flow mode, 1 reads every cycle
+uint8_t flow_mux_selected;          // Channel the muxes were last switched to, FLOW_MUX_UNKNOWN after any other write or an abort
+bool flow_mux_queued;               // False if flow_read_chan's read needed no MUX write
+err flow_read_rc[NUM_PRESSURE_CLTRLS];
+pca9544a_task_t flow_mux_task;
+sensirion_task_t flow_sensor_task;
+flow_tune_t ftune[NUM_PRESSURE_CLTRLS];
+uint8_t adc_cycle_done;             // All ADC channels read, outputs wait for the flow reads
+uint8_t adc_read_pending;           // Channel bits, pressures of this cycle not yet read back
+uint8_t flow_read_pending;          // Channel bits, flows due this cycle not yet read back
+uint8_t ctrl_event_enable;          // 1 updates each channel as its samples come in, from the next cycle
+uint8_t ctrl_event_cycle;           // ctrl_event_enable as the running cycle started
+uint8_t ctrl_updated;               // Channel bits, outputs already updated in this cycle
+
+/* Signal Filter Data */
+filter_coeffs_t signal_filters[NUM_PRESSURE_CLTRLS][FILTER_SIGNALS];
+filter_state_t signal_filter_states[NUM_PRESSURE_CLTRLS][FILTER_SIGNALS];
+bool signal_filter_on[NUM_PRESSURE_CLTRLS][FILTER_SIGNALS];    // false passes readings through
+
+/* Loop Statistics */
+loop_stats_t loop_stats;
+uint16_t loop_cycle_start;
+uint32_t loop_cycle_start_us;       // time_now_us() at loop_cycle_start, stamps the cycle's samples
+uint32_t loop_cycle_frame;          // Frame that started the cycle, 0 if the timer did
+uint16_t loop_cycle_end;
+
+/* Frame Sync Data */
+uint8_t frame_sync_mode;
+uint8_t frame_sync_divider;         // Frame edges per cycle
+uint8_t frame_sync_countdown;       // Edges to the next cycle, from the frame interrupt
+volatile uint32_t frame_sync_count; // Edges since SET_FRAME_SYNC, the host counts its triggers the same way
+volatile uint32_t frame_sync_frame; // Edge waiting to start a cycle, 0 -> none
+volatile uint16_t frame_sync_missed;    // Cycle edges that came while a cycle was running
+
+pid_config_t fpid_config[NUM_PRESSURE_CLTRLS];
+pid_state_t fpid_loop[NUM_PRESSURE_CLTRLS];
+int16_t fpid_terms[NUM_PRESSURE_CLTRLS][3];     // Last P, I, D terms of either loop, for the history
+
+/* Flow Gain Schedule Data, see flow_sched_gains() */
+uint16_t flow_sched[NUM_PRESSURE_CLTRLS][STORE_FLOW_SCHED_WORDS];   // As stored, [count] then points of [flow ul/hr][P][I][D]
+int32_t flow_sched_slope[NUM_PRESSURE_CLTRLS][NUM_FLOW_SCHED_POINTS-1][3];  // P, I, D change per ul/hr << FLOW_SCHED_SLOPE_SHIFT
+pid_config_t fpid_sched_config[NUM_PRESSURE_CLTRLS];    // fpid_config with the scheduled gains
+
+/* Status Snapshot Data */
+status_snapshot_t status_snapshot;
+
+/* GET_PRESSURE_ACTUAL and GET_FLOW_ACTUAL replies, published each cycle by publish_replies() */
+spi_reply_cache_t pressure_actual_reply;
+spi_reply_cache_t flow_actual_reply;
+
+/* Telemetry Data */
+uint8_t telemetry_period;           // Control cycles per sample, 0 -> off
+uint8_t telemetry_count;
+uint16_t telemetry_dropped;         // Samples not pushed because the write ring was full
+uint8_t telemetry_format;           // RECORD_FORMAT_*
+delta_coder_t telemetry_coder;
+uint16_t telemetry_prev[TELEMETRY_WORDS];
+
+/* History Data */
+history_record_t history[HISTORY_LEN];
+uint8_t history_head;               // Next record written
+uint8_t history_count;
+uint16_t history_stream_seq;        // First record of the HISTORY_STREAM transfer, the next one if compact
+uint16_t history_stream_end;        // Seq after its last record
+delta_coder_t history_coder;
+uint16_t history_prev[HISTORY_WORDS];
+uint8_t history_pending[DELTA_RECORD_MAX( HISTORY_WORDS )];    // Compact record being sent, it may span chunks
+uint8_t history_pending_size;
+uint8_t history_pending_pos;
+
+/* Profile Data */
+profile_t profiles[NUM_PRESSURE_CLTRLS];
 
 /* Packet Data */
-uint8_t slave_select;
+/* DAC Variables */
+uint16_t dac_codes[NUM_PRESSURE_CLTRLS];    // Last codes queued by set_pressures()
+uint8_t dac_codes_valid;                    // 0 -> set_pressures() writes every channel
+
 spi_packet_buf_t spi_packet;
 uint8_t packet_type;
-uint8_t packet_data[SPI_PACKET_BUF_SIZE];
+uint8_t *packet_data;               // Points into spi_packet.buf
 uint8_t packet_data_size;
 
 inline int32_t constrain_i32( int32_t value, int32_t min, int32_t max )
@@ -168,57 +750,255 @@ inline int32_t constrain_i32( int32_t value, int32_t min, int32_t max )
     else return value;
 }
 
-void dac_cmd( uint8_t cmd, E_DAC_CHAN chan, uint16_t value )
+/* Loop steps, shifts: P, I, D, output, D filter */
+PID_STEP_DEFINE( ppid_step, 0, 0, 0, PPID_SHIFT, PPID_DIFF_FILT_SHIFT )
+PID_STEP_DEFINE( fpid_step, 0, 0, 0, FPID_I_SHIFT, FPID_DIFF_FILT_SHIFT )
+
+void flow_conv_init( flow_conv_t *conv, uint16_t num, uint16_t den )
+{
+    /* Largest shift that keeps the rounded num / den factor in 16 bits, at least 1 for the
+     * rounding in flow_conv(). den = 0 converts to 0. */
+    uint32_t factor;
+    
+    conv->factor = 0;
+    conv->shift = 1;
+    
+    if ( den == 0 )
+        return;
+    
+    while ( conv->shift <= FLOW_CONV_SHIFT_MAX )
+    {
+        factor = ( ( (uint32_t)num << conv->shift ) + ( den / 2 ) ) / den;
+        if ( factor > UINT16_MAX )
+            break;
+        conv->factor = factor;
+        conv->shift++;
+    }
+    
+    conv->shift--;
+}
+
+inline int32_t flow_conv( const flow_conv_t *conv, int16_t value )
+{
+    /* I16 x U16 fits I32. Rounded to nearest by shifting one bit less, so nothing is added to
+     * a product that may be close to INT32_MAX. */
+    return ( ( __builtin_mulsu( value, conv->factor ) >> ( conv->shift - 1 ) ) + 1 ) >> 1;
+}
+
+inline int32_t flow_conv_u16( const flow_conv_t *conv, uint16_t value )
+{
+    return ( ( __builtin_muluu( value, conv->factor ) >> ( conv->shift - 1 ) ) + 1 ) >> 1;
+}
+
+inline int16_t flow_raw_to_ul_hr( uint8_t chan, int16_t flow_raw )
+{
+    return constrain_i32( flow_conv( &flow_conv_ul_hr[chan], flow_raw ), INT16_MIN, INT16_MAX );
+}
+
+void adc_config_set( uint8_t chan, uint8_t dr, uint8_t gain, uint8_t mux )
+{
+    /* Codes as in SET_ADC_CONFIG, checked with adc_config_valid(). Auto-ranging starts from the
+     * largest range, and any change applies from the next conversion of the channel. */
+    adc_datarates[chan] = (ads1115_datarate)( dr << ADS1115_DR0 );
+    adc_gain_settings[chan] = gain;
+    adc_gains[chan] = ( gain == ADC_GAIN_AUTO ) ? FSR_6_144 : (ads1115_fsr_gain)( gain << ADS1115_PGA0 );
+    adc_muxes[chan] = (ads1115_mux)( (uint16_t)mux << ADS1115_IMUX0 );
+}
+
+bool adc_config_valid( uint8_t dr, uint8_t gain, uint8_t mux )
+{
+    return ( dr <= ( DATARATE_860SPS >> ADS1115_DR0 ) ) &&
+           ( ( gain < ADC_GAIN_CODES ) || ( gain == ADC_GAIN_AUTO ) ) &&
+           ( mux <= ( MUX_AIN3_GND >> ADS1115_IMUX0 ) );
+}
+
+void adc_config_defaults( void )
+{
+    /* 128 SPS in the 6.144 V range, each channel single ended on its input of adc_map[], one
+     * conversion a cycle */
+    uint8_t adc_input;
+    
+    for ( adc_input=0; adc_input<=ADC_CHAN_MAX; adc_input++ )
+    {
+        adc_config_set( adc_map[adc_input], DATARATE_128SPS >> ADS1115_DR0, FSR_6_144 >> ADS1115_PGA0, ADS1115_MUX_SINGLE( adc_input % PRESSURE_BANK_CHANS ) >> ADS1115_IMUX0 );
+        adc_bursts[adc_map[adc_input]] = 1;
+    }
+}
+
+err adc_config_save( uint8_t chan )
+{
+    return store_save_adc_config( chan, ADC_CONFIG_PACK( adc_datarates[chan] >> ADS1115_DR0, adc_gain_settings[chan], adc_muxes[chan] >> ADS1115_IMUX0, adc_bursts[chan] ) );
+}
+
+int16_t adc_code_mbar_shl( uint8_t chan, uint16_t adc_value );
+int16_t pressure_cal_apply( uint8_t chan, int16_t pressure );
+void pressure_limit_check( uint8_t chan, int16_t pressure );
+
+bool adc_burst_add( uint8_t chan, uint16_t adc_value, uint16_t *average )
+{
+    /* A conversion of pressure channel <chan> read back. True with the mean code, rounded, once
+     * the channel's burst is in. The gain holds over a burst: auto-ranging only moves it on the
+     * mean, after the last conversion of the burst has started. The overpressure limit is
+     * checked on every conversion, so a spike is not averaged away or held for the burst;
+     * only the filter and the loops see the mean. */
+    int32_t sum;
+    uint8_t count;
+    
+    pressure_limit_check( chan, pressure_cal_apply( chan, adc_code_mbar_shl( chan, adc_value ) ) );
+    
+    if ( adc_bursts[chan] <= 1 )
+    {
+        *average = adc_value;
+        return true;
+    }
+    
+    sum = adc_burst_sum[chan] + (int16_t)adc_value;
+    count = adc_burst_count[chan] + 1;
+    if ( count < adc_bursts[chan] )
+    {
+        adc_burst_sum[chan] = sum;
+        adc_burst_count[chan] = count;
+        return false;
+    }
+    
+    adc_burst_sum[chan] = 0;
+    adc_burst_count[chan] = 0;
+    sum += ( sum < 0 ) ? -( count >> 1 ) : ( count >> 1 );
+    *average = (uint16_t)(int16_t)( sum / count );
+    return true;
+}
+
+uint32_t dac_word( uint8_t cmd, E_DAC_CHAN chan, uint16_t value )
 {
-    struct
+    /* Unused bits are sent as 0 */
+    union
     {
-        uint8_t unused_byte;
-        uint8_t value_low;
-        uint8_t value_high;
-        uint8_t chan : 3;
-        uint8_t cmd : 3;
-        uint8_t unused : 2;
-    } data;
+        uint32_t word;
+        struct
+        {
+            uint8_t unused_byte;
+            uint8_t value_low;
+            uint8_t value_high;
+            uint8_t chan : 3;
+            uint8_t cmd : 3;
+            uint8_t unused : 2;
+        } fields;
+    } data = { 0 };
+    
+    data.fields.cmd = cmd;
+    data.fields.chan = chan;
+    data.fields.value_high = value >> 8;
+    data.fields.value_low = value & 0xFF;
+    
+    return data.word;
+}
+
+void dac_flush( void )
+{
+    /* Waits for queued DAC words to be shifted out, then drops what came back */
+    while ( !SPI2STATLbits.SPITBE || !SPI2STATLbits.SRMT );
     
-    data.cmd = cmd;
-    data.chan = chan;
-    data.value_high = value >> 8;
-    data.value_low = value & 0xFF;
+    while ( !SPI2STATLbits.SPIRBE )
+    {
+        (void)SPI2BUFL;
+        (void)SPI2BUFH;
+    }
+}
+
+void dac_queue( uint8_t cmd, E_DAC_CHAN chan, uint16_t value )
+{
+    /* Loads one word into the SPI2 TX FIFO and returns. At most DAC_FIFO_WORDS after a dac_flush(). */
+    uint32_t word = dac_word( cmd, chan, value );
     
-    SPI2_Exchange32bit( *(uint32_t *)&data );
+    SPI2BUFL = (uint16_t)word;
+    SPI2BUFH = (uint16_t)( word >> 16 );
 }
 
-void dac_reset( void )
+void dac_cmd( uint8_t bank, uint8_t cmd, E_DAC_CHAN chan, uint16_t value )
 {
-    dac_cmd( 0b101, 0, 0 );                 // Software reset
+    /* Blocking write to the DAC of <bank>, for start-up. The DAC no longer matches dac_codes[]. */
+    dac_flush();
+    DAC_SELECT( bank );
+    SPI2_Exchange32bit( dac_word( cmd, chan, value ) );
+    dac_codes_valid = 0;
 }
 
-void dac_ref_internal( uint8_t internal )
+void dac_reset( uint8_t bank )
 {
-    dac_cmd( 0b111, 0, internal ? 1 : 0 );  // Internal reference -> 5V range
+    dac_cmd( bank, 0b101, 0, 0 );                   // Software reset
 }
 
-void dac_write_and_update( E_DAC_CHAN dac_chan, uint16_t value )
+void dac_ref_internal( uint8_t bank, uint8_t internal )
 {
-    dac_cmd( 0b011, dac_chan, value );
+    dac_cmd( bank, 0b111, 0, internal ? 1 : 0 );    // Internal reference -> 5V range
 }
 
-void dac_write_ldac( E_DAC_CHAN dac_chan, uint16_t value, uint8_t update_all )
+void dac_write_and_update( uint8_t chan, uint16_t value )
 {
-    dac_cmd( update_all ? 0b010 : 0b000, dac_chan, value );
+    dac_cmd( CHAN_BANK( chan ), 0b011, DAC_CHAN( chan ), value );
+}
+
+void dac_write_ldac( uint8_t chan, uint16_t value, uint8_t update_all )
+{
+    dac_cmd( CHAN_BANK( chan ), update_all ? DAC_CMD_WRITE_UPDATE_ALL : DAC_CMD_WRITE, DAC_CHAN( chan ), value );
 }
 
 void set_pressures( void )
 {
-    dac_write_ldac( DAC_CHAN_A, ( ( (int32_t)pressure_mbar_shl_output[0] * 0xFFFF ) >> PRESSURE_SHL ) / PRESSURE_CTLR_MBAR, 0 );
-    dac_write_ldac( DAC_CHAN_B, ( ( (int32_t)pressure_mbar_shl_output[1] * 0xFFFF ) >> PRESSURE_SHL ) / PRESSURE_CTLR_MBAR, 0 );
-    dac_write_ldac( DAC_CHAN_C, ( ( (int32_t)pressure_mbar_shl_output[2] * 0xFFFF ) >> PRESSURE_SHL ) / PRESSURE_CTLR_MBAR, 0 );
-    dac_write_ldac( DAC_CHAN_D, ( ( (int32_t)pressure_mbar_shl_output[3] * 0xFFFF ) >> PRESSURE_SHL ) / PRESSURE_CTLR_MBAR, 1 );
-    /*
-    dac_write_ldac( DAC_CHAN_B, pressure_mbar_shl_output[1], 0 );
-    dac_write_ldac( DAC_CHAN_C, pressure_mbar_shl_output[2], 0 );
-    dac_write_ldac( DAC_CHAN_D, pressure_mbar_shl_output[3], 1 );
-    */
+    /* Queues only the changed channels as one SPI2 burst per DAC, the last one of each
+     * updating all its outputs, and returns while the FIFO shifts out the last burst */
+    uint16_t codes[NUM_PRESSURE_CLTRLS];
+    int8_t last[NUM_PRESSURE_BANKS];
+    uint8_t chan;
+    uint8_t bank;
+    
+    for ( bank=0; bank<NUM_PRESSURE_BANKS; bank++ )
+        last[bank] = -1;
+    
+    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+    {
+        codes[chan] = PRESSURE_MBARSHL_TO_DAC( pressure_mbar_shl_output[chan] );
+        
+        if ( !dac_codes_valid || ( codes[chan] != dac_codes[chan] ) )
+            last[CHAN_BANK( chan )] = chan;
+    }
+    
+    for ( bank=0; bank<NUM_PRESSURE_BANKS; bank++ )
+    {
+        if ( last[bank] < 0 )
+            continue;
+        
+        /* The previous burst is normally long gone, this only drops its replies. Between two
+         * DACs it waits for the first burst, at most DAC_FIFO_WORDS words. */
+        dac_flush();
+        DAC_SELECT( bank );
+        
+        for ( chan=bank*PRESSURE_BANK_CHANS; chan<=last[bank]; chan++ )
+        {
+            if ( dac_codes_valid && ( codes[chan] == dac_codes[chan] ) )
+                continue;
+            
+            dac_queue( ( chan == last[bank] ) ? DAC_CMD_WRITE_UPDATE_ALL : DAC_CMD_WRITE, DAC_CHAN( chan ), codes[chan] );
+            dac_codes[chan] = codes[chan];
+        }
+    }
+    
+    dac_codes_valid = 1;
+}
+
+void set_pressure( uint8_t chan )
+{
+    /* One channel on its own, updating only its output, for the event driven cycle. Leaves
+     * the others to the next set_pressures() if they are all to be written. */
+    uint16_t code = PRESSURE_MBARSHL_TO_DAC( pressure_mbar_shl_output[chan] );
+    
+    if ( dac_codes_valid && ( code == dac_codes[chan] ) )
+        return;
+    
+    dac_flush();
+    DAC_SELECT( CHAN_BANK( chan ) );
+    dac_queue( DAC_CMD_WRITE_UPDATE, DAC_CHAN( chan ), code );
+    dac_codes[chan] = code;
 }
 
 err parse_packet_get_id( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
@@ -280,49 +1060,26 @@ err parse_packet_set_pressure_target( uint8_t packet_type, uint8_t *packet_data,
 
 err parse_packet_get_pressure_target( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
 {
-    /* Return: [err U8]4x[Pressure mbar U16>>PRESSURE_SHL] */
+    /* Return: [err U8]Nx[Pressure mbar U16>>PRESSURE_SHL], pkt_pressure_target_reply_t */
     
     err rc = ERR_OK;
-    uint8_t i;
-    uint8_t return_buf[ sizeof(err) + (NUM_PRESSURE_CLTRLS*sizeof(int16_t)) ];
-    uint8_t *return_buf_ptr;
+    pkt_pressure_target_reply_t reply;
     
-    return_buf_ptr = return_buf;
-    *return_buf_ptr++ = ERR_OK;
-    
-    for ( i=0; i<NUM_PRESSURE_CLTRLS; i++ )
-    {
-        COPY_16BIT_TO_PTR( return_buf_ptr, pressure_mbar_shl_target[i] );
-        return_buf_ptr += sizeof(int16_t);
-    }
+    reply.rc = ERR_OK;
+    memcpy( reply.pressure, pressure_mbar_shl_target, sizeof(reply.pressure) );
     
-    spi_packet_write( packet_type, return_buf, sizeof(return_buf) );
+    spi_packet_write( packet_type, (uint8_t *)&reply, sizeof(reply) );
     
     return rc;
 }
 
 err parse_packet_get_pressure_actual( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
 {
-    /* Return: [err U8]4x[Pressure mbar I16>>PRESSURE_SHL] */
-    
-    err rc = ERR_OK;
-    uint8_t i;
-    uint8_t return_buf[ sizeof(err) + (NUM_PRESSURE_CLTRLS*sizeof(int16_t)) ];
-    uint8_t *return_buf_ptr;
-    
-    return_buf_ptr = return_buf;
-    *return_buf_ptr++ = ERR_OK;
-    
-    for ( i=0; i<NUM_PRESSURE_CLTRLS; i++ )
-    {
-        COPY_16BIT_TO_PTR( return_buf_ptr, pressure_mbar_shl_actual[i] );
-//        *(int16_t *)return_buf_ptr = pressure_mbar_shl_actual[i];
-        return_buf_ptr += sizeof(int16_t);
-    }
+    /* Return: [err U8]Nx[Pressure mbar I16>>PRESSURE_SHL], as of the last control cycle */
     
-    spi_packet_write( packet_type, return_buf, sizeof(return_buf) );
+    spi_reply_cache_write( &pressure_actual_reply, packet_type );
     
-    return rc;
+    return ERR_OK;
 }
 
 err parse_packet_set_flow_target( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
@@ -348,19 +1105,16 @@ err parse_packet_set_flow_target( uint8_t packet_type, uint8_t *packet_data, uin
         flow_data_ptr += sizeof(flow_target_ul_hr);
         data_size -= ( 1 + sizeof(flow_target_ul_hr) );
         
-        if ( flow_target_ul_hr > ( (int32_t)INT16_MAX * 60 / flow_scales_ul_min[chan] ) )
-        {
-            /* Target too large to fit */
-            valid = false;
-        }
-        else
+        for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
         {
-            for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+            if ( chan_mask & 0x01 )
             {
-                if ( chan_mask & 0x01 )
-                    flows_raw_target[chan] = (int32_t)flow_target_ul_hr * flow_scales_ul_min[chan] / 60;
-                chan_mask >>= 1;
+                if ( flow_target_ul_hr > flow_ul_hr_max[chan] )
+                    valid = false;      // Target too large to fit
+                else
+                    flows_raw_target[chan] = constrain_i32( flow_conv( &flow_conv_raw[chan], flow_target_ul_hr ), INT16_MIN, INT16_MAX );
             }
+            chan_mask >>= 1;
         }
     }
     
@@ -377,50 +1131,43 @@ err parse_packet_set_flow_target( uint8_t packet_type, uint8_t *packet_data, uin
 
 err parse_packet_get_flow_target( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
 {
-    /* Return: [err U8]4x[Flow target ul/hr I16] */
+    /* Return: [err U8]Nx[Flow target ul/hr I16], pkt_flow_reply_t */
     
     err rc = ERR_OK;
     uint8_t chan;
-    uint8_t return_buf[ sizeof(err) + (NUM_PRESSURE_CLTRLS*sizeof(int16_t)) ];
-    uint8_t *return_buf_ptr;
-    
-    return_buf_ptr = return_buf;
-    *return_buf_ptr++ = ERR_OK;
+    pkt_flow_reply_t reply;
     
+    reply.rc = ERR_OK;
     for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
-    {
-        int16_t flow_scaled = (int32_t)flow_raw_target[chan] * 60 / flow_scales_ul_min[chan];
-        COPY_16BIT_TO_PTR( return_buf_ptr, flow_scaled );
-        return_buf_ptr += sizeof(int16_t);
-    }
+        reply.flow[chan] = flow_raw_to_ul_hr( chan, flow_raw_target[chan] );
     
-    spi_packet_write( packet_type, return_buf, sizeof(return_buf) );
+    spi_packet_write( packet_type, (uint8_t *)&reply, sizeof(reply) );
     
     return rc;
 }
 
 err parse_packet_get_flow_actual( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
 {
-    /* Return: [err U8]4x[Flow ul/hr I16] */
+    /* Return: [err U8]Nx[Flow ul/hr I16], as of the last control cycle */
     
-    err rc = ERR_OK;
-    uint8_t chan;
-    uint8_t return_buf[ sizeof(err) + (NUM_PRESSURE_CLTRLS*sizeof(int16_t)) ];
-    uint8_t *return_buf_ptr;
+    spi_reply_cache_write( &flow_actual_reply, packet_type );
     
-    return_buf_ptr = return_buf;
-    *return_buf_ptr++ = ERR_OK;
+    return ERR_OK;
+}
+
+err pressure_ctrl_start( uint8_t chan )
+{
+    err rc = ERR_OK;
     
-    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+    if ( ( pressure_ctrl_state[chan] != PRESSURE_CTRL_STATE_READY ) &&
+         ( pressure_ctrl_state[chan] != PRESSURE_CTRL_STATE_RUNNING ) )
+        rc = ERR_ERROR;
+    else
     {
-        int16_t flow_scaled = (int32_t)flow_raw_actual[chan] * 60 / flow_scales_ul_min[chan];   // ul/hr
-        COPY_16BIT_TO_PTR( return_buf_ptr, flow_scaled );
-//        *(int16_t *)return_buf_ptr = flow_raw_actual[chan] / flow_scales_ul_min[chan];
-        return_buf_ptr += sizeof(int16_t);
+        pid_reset( &ppid_loop[chan], pressure_mbar_shl_actual[chan] );
+        pressure_ctrl_state[chan] = PRESSURE_CTRL_STATE_RUNNING;
     }
     
-    spi_packet_write( packet_type, return_buf, sizeof(return_buf) );
-    
     return rc;
 }
 
@@ -435,58 +1182,306 @@ err flow_ctrl_start( uint8_t chan, int16_t flow_rate_raw )
     {
         /** Disable interrupt */
         flow_raw_target[chan] = flow_rate_raw;
-        fpid_integrated[chan] = 0;
-        fpid_error_prev[chan] = flow_raw_target[chan] - flow_raw_actual[chan];
+        flow_raw_setpoint[chan] = ( flow_ramp_raw[chan] != 0 ) ? flow_raw_actual[chan] : flow_rate_raw;
+        pid_reset( &fpid_loop[chan], flow_raw_actual[chan] );
+        flow_out_map_hold[chan] = 0;
         flow_ctrl_state[chan] = FLOW_CTRL_STATE_RUNNING;
-        ctrl_modes[chan] = CTRL_MODE_FLOW;
+        if ( ctrl_modes[chan] != CTRL_MODE_FLOW_CASCADE )
+            ctrl_modes[chan] = CTRL_MODE_FLOW;
         /** Enable interrupt */
     }
     
     return rc;
 }
 
-void set_ctrl_modes( E_CTRL_MODE *ctrl_modes_new )
+void flow_autotune_stop( uint8_t chan, E_FTUNE_STATE state )
 {
-    uint8_t chan;
+    /* Hands the channel back to its control mode. The relay's bias held the target, so the
+     * regulator command starts from there, and the loops start again from it. */
+    ftune[chan].state = state;
+    pressure_mbar_shl_output[chan] = ftune[chan].bias;
     
-    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+    if ( pressure_ctrl_state[chan] == PRESSURE_CTRL_STATE_RUNNING )
+        pressure_ctrl_start( chan );
+    if ( ctrl_modes[chan] == CTRL_MODE_FLOW_CASCADE )
+        flow_cascade_setpoint[chan] = ftune[chan].bias;
+    if ( flow_ctrl_state[chan] == FLOW_CTRL_STATE_RUNNING )
+        flow_ctrl_start( chan, flow_raw_target[chan] );
+}
+
+void flow_out_map_record( uint8_t chan, int16_t target_raw, uint16_t output )
+{
+    /* Puts <output>, settled at <target_raw>, first in the map of <chan>, in place of the point
+     * for that target if there is one, else of the least recently settled */
+    flow_out_map_t *map = flow_out_map[chan];
+    uint8_t index;
+    
+    if ( target_raw <= 0 )
+        return;
+    
+    for ( index=0; index<( FLOW_OUT_MAP_POINTS - 1 ); index++ )
     {
-        ctrl_modes[chan] = ctrl_modes_new[chan];
-        
-        switch ( ctrl_modes[chan] )
-        {
-            case CTRL_MODE_ZERO:
-                // Intentional drop-through
-            case CTRL_MODE_PRESSURE_OPEN_LOOP:
-                if ( pressure_ctrl_state[chan] == PRESSURE_CTRL_STATE_RUNNING )
-                    pressure_ctrl_state[chan] = PRESSURE_CTRL_STATE_READY;
-                if ( flow_ctrl_state[chan] == FLOW_CTRL_STATE_RUNNING )
-                    flow_ctrl_state[chan] = FLOW_CTRL_STATE_READY;
-                break;
-            case CTRL_MODE_PRESSURE:
-                if ( flow_ctrl_state[chan] == FLOW_CTRL_STATE_RUNNING )
-                    flow_ctrl_state[chan] = FLOW_CTRL_STATE_READY;
-//                if ( pressure_ctrl_state[chan] == PRESSURE_CTRL_STATE_READY )
-//                    pressure_ctrl_state[chan] = PRESSURE_CTRL_STATE_RUNNING;
-                break;
-            case CTRL_MODE_FLOW:
-                if ( pressure_ctrl_state[chan] == PRESSURE_CTRL_STATE_RUNNING )
-                    pressure_ctrl_state[chan] = PRESSURE_CTRL_STATE_READY;
-                if ( flow_ctrl_state[chan] == FLOW_CTRL_STATE_READY )
-                {
-                    flow_ctrl_start( chan, flow_raw_target[chan] );
-//                    flow_ctrl_state[chan] = FLOW_CTRL_STATE_RUNNING;
-                }
-                break;
-            default:;
-        }
+        if ( map[index].target_raw == target_raw )
+            break;
     }
+    memmove( &map[1], &map[0], index * sizeof(flow_out_map_t) );
+    map[0].target_raw = target_raw;
+    map[0].output = output;
 }
 
-err parse_packet_set_control_mode( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+int32_t flow_out_map_output( uint8_t chan, int16_t target_raw )
 {
-    /* Data: n*[ [Controller Mask U8][Control Mode U8] ] */
-
+    /* Output for <target_raw> from the map of <chan>: on the line between the nearest points
+     * either side, else scaled from the nearest one, as pressure / flow is the R of the chip.
+     * -1 if the map is empty. */
+    flow_out_map_t *map = flow_out_map[chan];
+    flow_out_map_t *lo = NULL;
+    flow_out_map_t *hi = NULL;
+    uint8_t index;
+    int32_t output;
+    
+    if ( target_raw <= 0 )
+        return -1;
+    
+    for ( index=0; index<FLOW_OUT_MAP_POINTS; index++ )
+    {
+        if ( map[index].target_raw <= 0 )
+            continue;
+        if ( ( map[index].target_raw <= target_raw ) && ( ( lo == NULL ) || ( map[index].target_raw > lo->target_raw ) ) )
+            lo = &map[index];
+        if ( ( map[index].target_raw >= target_raw ) && ( ( hi == NULL ) || ( map[index].target_raw < hi->target_raw ) ) )
+            hi = &map[index];
+    }
+    
+    if ( ( lo != NULL ) && ( hi != NULL ) && ( lo != hi ) )
+        output = lo->output + ( ( (int32_t)hi->output - lo->output ) * ( target_raw - lo->target_raw ) ) / ( hi->target_raw - lo->target_raw );
+    else if ( lo != NULL )
+        output = (int32_t)lo->output * target_raw / lo->target_raw;
+    else if ( hi != NULL )
+        output = (int32_t)hi->output * target_raw / hi->target_raw;
+    else
+        return -1;
+    
+    return constrain_i32( output, 0, (int32_t)PRESSURE_CTLR_MBAR << PRESSURE_SHL );
+}
+
+void loop_warm_start( uint8_t chan )
+{
+    /* Starts the loop of the mode just selected on <chan> where it last settled, instead of
+     * winding up from zero. The pressure integrator, the regulator error, is restored for a
+     * target near the settled one. The flow output, the pressure for that flow, comes from
+     * the output map, which holds the settled record too. A flow ramp starts from the present
+     * flow as before. */
+    uint16_t *warm = loop_warm[chan];
+    int32_t output;
+    
+    loop_warm_cycles[chan] = 0;
+    if ( !loop_warm_enable )
+        return;
+    
+    switch ( ctrl_modes[chan] )
+    {
+        case CTRL_MODE_PRESSURE:
+            if ( ( pressure_ctrl_state[chan] == PRESSURE_CTRL_STATE_RUNNING ) &&
+                 ( warm[LOOP_WARM_PPID_TARGET] != EEPROM_BLANK_U16 ) &&
+                 ( labs( (int32_t)pressure_mbar_shl_target[chan] - warm[LOOP_WARM_PPID_TARGET] ) <= LOOP_WARM_PPID_TARGET_MBAR_SHL ) )
+                ppid_loop[chan].integrated = (int32_t)(int16_t)warm[LOOP_WARM_PPID_INTEGRATED] << PPID_SHIFT;
+            break;
+        case CTRL_MODE_FLOW:
+            // Intentional drop-through
+        case CTRL_MODE_FLOW_CASCADE:
+            if ( ( flow_ctrl_state[chan] != FLOW_CTRL_STATE_RUNNING ) || ( flow_ramp_raw[chan] != 0 ) )
+                break;
+            output = flow_out_map_output( chan, flow_raw_target[chan] );
+            if ( output < 0 )
+                break;
+            if ( ctrl_modes[chan] == CTRL_MODE_FLOW_CASCADE )
+                flow_cascade_setpoint[chan] = output;
+            else
+                pressure_mbar_shl_output[chan] = output;
+            break;
+        default:;
+    }
+}
+
+bool loop_warm_track( uint8_t chan, uint8_t word, uint16_t target, uint16_t value, bool settled )
+{
+    /* Each time the loop with words <word> of loop_warm[<chan>] has held <target> for another
+     * LOOP_WARM_SETTLE_CYCLES cycles, records <value> for it and returns true. Stored only if
+     * it moved, so a steady run does not keep writing the EEPROM. */
+    uint16_t *warm = &loop_warm[chan][word];
+    
+    if ( target != loop_warm_cycles_target[chan] )
+    {
+        loop_warm_cycles_target[chan] = target;
+        loop_warm_cycles[chan] = 0;
+    }
+    
+    if ( !settled )
+    {
+        loop_warm_cycles[chan] = 0;
+        return false;
+    }
+    
+    if ( ++loop_warm_cycles[chan] < LOOP_WARM_SETTLE_CYCLES )
+        return false;
+    loop_warm_cycles[chan] = 0;
+    
+    if ( ( warm[0] != target ) || ( abs( (int16_t)( warm[1] - value ) ) > LOOP_WARM_SAVE_MBAR_SHL ) )
+    {
+        warm[0] = target;
+        warm[1] = value;
+        store_save_warm( chan, loop_warm[chan] );
+    }
+    
+    return true;
+}
+
+bool loop_warm_flow_settled( uint8_t chan )
+{
+    /* Flow loop at its final target, not ramping, within 1 / 2^LOOP_WARM_FPID_BAND_SHIFT of it */
+    return ( flow_raw_target[chan] > 0 ) && ( flow_raw_setpoint[chan] == flow_raw_target[chan] ) &&
+           ( labs( (int32_t)flow_raw_target[chan] - flow_raw_actual[chan] ) <= ( flow_raw_target[chan] >> LOOP_WARM_FPID_BAND_SHIFT ) );
+}
+
+void set_ctrl_modes( E_CTRL_MODE *ctrl_modes_new )
+{
+    uint8_t chan;
+    
+    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+    {
+        /* A new mode takes the channel back from an autotune */
+        if ( ( ftune[chan].state == FTUNE_STATE_RUNNING ) && ( ctrl_modes_new[chan] != ctrl_modes[chan] ) )
+            flow_autotune_stop( chan, FTUNE_STATE_ABORTED );
+        
+        ctrl_modes[chan] = ctrl_modes_new[chan];
+        
+        switch ( ctrl_modes[chan] )
+        {
+            case CTRL_MODE_ZERO:
+                // Intentional drop-through
+            case CTRL_MODE_PRESSURE_OPEN_LOOP:
+                if ( pressure_ctrl_state[chan] == PRESSURE_CTRL_STATE_RUNNING )
+                    pressure_ctrl_state[chan] = PRESSURE_CTRL_STATE_READY;
+                if ( flow_ctrl_state[chan] == FLOW_CTRL_STATE_RUNNING )
+                    flow_ctrl_state[chan] = FLOW_CTRL_STATE_READY;
+                break;
+            case CTRL_MODE_PRESSURE:
+                if ( flow_ctrl_state[chan] == FLOW_CTRL_STATE_RUNNING )
+                    flow_ctrl_state[chan] = FLOW_CTRL_STATE_READY;
+                if ( pressure_ctrl_state[chan] == PRESSURE_CTRL_STATE_READY )
+                {
+                    pressure_ctrl_start( chan );
+                    loop_warm_start( chan );
+                }
+                break;
+            case CTRL_MODE_FLOW:
+                if ( pressure_ctrl_state[chan] == PRESSURE_CTRL_STATE_RUNNING )
+                    pressure_ctrl_state[chan] = PRESSURE_CTRL_STATE_READY;
+                if ( flow_ctrl_state[chan] == FLOW_CTRL_STATE_READY )
+                {
+                    flow_ctrl_start( chan, flow_raw_target[chan] );
+                    loop_warm_start( chan );
+//                    flow_ctrl_state[chan] = FLOW_CTRL_STATE_RUNNING;
+                }
+                break;
+            case CTRL_MODE_FLOW_CASCADE:
+                if ( pressure_ctrl_state[chan] == PRESSURE_CTRL_STATE_READY )
+                {
+                    /* Start the pressure loop from the present command */
+                    flow_cascade_setpoint[chan] = pressure_mbar_shl_output[chan];
+                    pressure_ctrl_start( chan );
+                }
+                if ( flow_ctrl_state[chan] == FLOW_CTRL_STATE_READY )
+                {
+                    flow_ctrl_start( chan, flow_raw_target[chan] );
+                    loop_warm_start( chan );
+                }
+                break;
+            default:;
+        }
+    }
+}
+
+void pressure_limit_check( uint8_t chan, int16_t pressure )
+{
+    /* On each ADC sample of <chan>, before the signal filter. Over the limit the regulator goes
+     * to 0 at once by a blocking DAC write, rather than at the next control cycle, and the
+     * channel stays in CTRL_MODE_ZERO until the host sets a mode again. */
+    E_CTRL_MODE modes[NUM_PRESSURE_CLTRLS];
+    
+    if ( ( pressure_limit_mbar[chan] == 0 ) || ( pressure < ( (int32_t)pressure_limit_mbar[chan] << PRESSURE_SHL ) ) )
+        return;
+    
+    /* Already cut off, the pressure comes from elsewhere */
+    if ( ( ctrl_modes[chan] == CTRL_MODE_ZERO ) && ( ftune[chan].state != FTUNE_STATE_RUNNING ) && ( pressure_mbar_shl_output[chan] == 0 ) )
+        return;
+    
+    if ( ftune[chan].state == FTUNE_STATE_RUNNING )
+        flow_autotune_stop( chan, FTUNE_STATE_ABORTED );
+    memcpy( modes, ctrl_modes, sizeof(modes) );
+    modes[chan] = CTRL_MODE_ZERO;
+    set_ctrl_modes( modes );
+    
+    pressure_mbar_shl_output[chan] = 0;
+    dac_write_and_update( chan, 0 );
+    
+    if ( pressure_trips[chan] != UINT16_MAX )
+        pressure_trips[chan]++;
+    fault_log( FAULT_ID_OVERPRESSURE, ( (int32_t)chan << 16 ) | ( pressure >> PRESSURE_SHL ) );
+}
+
+err pressure_cal_save( uint8_t chan )
+{
+    return store_save_pressure_cal( chan, (uint16_t)pressure_cal_zero[chan], (uint8_t)pressure_cal_trim[chan] );
+}
+
+int16_t pressure_cal_apply( uint8_t chan, int16_t pressure )
+{
+    /* A reading of <chan> from adc_to_mbar_shl(), less the channel's zero and times its span.
+     * One multiply, rounded as flow_conv(). */
+    int16_t x = constrain_i32( (int32_t)pressure - pressure_cal_zero[chan], INT16_MIN, INT16_MAX );
+    
+    return constrain_i32( ( ( __builtin_mulsu( x, pressure_cal_span[chan] ) >> ( PRESSURE_CAL_SPAN_SHIFT - 1 ) ) + 1 ) >> 1, INT16_MIN, INT16_MAX );
+}
+
+void pressure_cal_sample( uint8_t chan, int16_t pressure )
+{
+    /* Each sample of <chan> before calibration. A zero capture averages its samples with the
+     * regulator at 0, and stores the rounded mean as the new zero. */
+    int32_t zero;
+    
+    if ( pressure_cal_state[chan] != PCAL_STATE_RUNNING )
+        return;
+    
+    if ( ctrl_modes[chan] != CTRL_MODE_ZERO )
+    {
+        pressure_cal_state[chan] = PCAL_STATE_ABORTED;
+        return;
+    }
+    
+    pressure_cal_sum[chan] += pressure;
+    if ( --pressure_cal_left[chan] > 0 )
+        return;
+    
+    zero = pressure_cal_sum[chan];
+    zero += ( zero < 0 ) ? -( pressure_cal_count[chan] >> 1 ) : ( pressure_cal_count[chan] >> 1 );
+    zero /= pressure_cal_count[chan];
+    if ( ( zero > PRESSURE_CAL_ZERO_MAX ) || ( zero < -PRESSURE_CAL_ZERO_MAX ) )
+    {
+        pressure_cal_state[chan] = PCAL_STATE_FAILED;
+        return;
+    }
+    
+    pressure_cal_zero[chan] = zero;
+    pressure_cal_state[chan] = PCAL_STATE_FINISHED;
+    pressure_cal_save( chan );
+}
+
+err parse_packet_set_control_mode( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+{
+    /* Data: n*[ [Controller Mask U8][Control Mode U8] ] */
+
     err rc = ERR_OK;
     uint8_t *ctrl_mode_data_ptr = packet_data;
     uint8_t chan_mask;
@@ -506,7 +1501,7 @@ err parse_packet_set_control_mode( uint8_t packet_type, uint8_t *packet_data, ui
         ctrl_mode_data_ptr += sizeof(ctrl_mode);
         data_size -= ( 1 + sizeof(ctrl_mode) );
         
-        if ( ctrl_mode > CTRL_MODE_FLOW )
+        if ( ctrl_mode > CTRL_MODE_FLOW_CASCADE )
             valid = false;
         else
         {
@@ -532,7 +1527,7 @@ err parse_packet_set_control_mode( uint8_t packet_type, uint8_t *packet_data, ui
 
 err parse_packet_get_control_mode( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
 {
-    /* Return: [err U8]4x[Control Mode U8] */
+    /* Return: [err U8]Nx[Control Mode U8] */
     
     err rc = ERR_OK;
     uint8_t chan;
@@ -580,9 +1575,9 @@ err parse_packet_set_fpid_consts( uint8_t packet_type, uint8_t *packet_data, uin
             if ( chan_mask & 0x01 )
             {
                 /** Disable interrupt */
-                fpid_p[chan] = pid_consts[0];
-                fpid_i[chan] = pid_consts[1];
-                fpid_d[chan] = pid_consts[2];
+                fpid_config[chan].kp = pid_consts[0];
+                fpid_config[chan].ki = pid_consts[1];
+                fpid_config[chan].kd = pid_consts[2];
                 /** Enable interrupt */
                 rc = store_save_fpid_consts( chan, pid_consts );
             }
@@ -600,7 +1595,7 @@ err parse_packet_set_fpid_consts( uint8_t packet_type, uint8_t *packet_data, uin
 
 err parse_packet_get_fpid_consts( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
 {
-    /* Return: [err U8]4x([PID_P U16][PID_I U16][PID_D U16]) */
+    /* Return: [err U8]Nx([PID_P U16][PID_I U16][PID_D U16]) */
     
     err rc = ERR_OK;
     uint8_t chan;
@@ -612,11 +1607,11 @@ err parse_packet_get_fpid_consts( uint8_t packet_type, uint8_t *packet_data, uin
     
     for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
     {
-        COPY_16BIT_TO_PTR( return_buf_ptr, fpid_p[chan] );
+        COPY_16BIT_TO_PTR( return_buf_ptr, fpid_config[chan].kp );
         return_buf_ptr += sizeof(uint16_t);
-        COPY_16BIT_TO_PTR( return_buf_ptr, fpid_i[chan] );
+        COPY_16BIT_TO_PTR( return_buf_ptr, fpid_config[chan].ki );
         return_buf_ptr += sizeof(uint16_t);
-        COPY_16BIT_TO_PTR( return_buf_ptr, fpid_d[chan] );
+        COPY_16BIT_TO_PTR( return_buf_ptr, fpid_config[chan].kd );
         return_buf_ptr += sizeof(uint16_t);
     }
     
@@ -625,243 +1620,3715 @@ err parse_packet_get_fpid_consts( uint8_t packet_type, uint8_t *packet_data, uin
     return rc;
 }
 
-void init( void )
-{
-    uint8_t chan;
-    
-    /* Comms */
-    slave_select = 1;
-    
-    /* System Init */
-    eeprom_okay = false;
-    adc_okay = false;
-    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
-        ctrl_modes[chan] = CTRL_MODE_ZERO;
-    
-    /* ADC Init */
-    adc_state = ADC_STATE_START;
-    adc_chan = 0;
-    adc_time = 0;
-    timer_ms = 0;
-    
-    /* Pressure Control Init */
-    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
-        pressure_ctrl_state[chan] = PRESSURE_CTRL_STATE_UNCONFIGURED;
-    memset( (void *)pressure_mbar_shl_output, 0, sizeof(pressure_mbar_shl_output) );
-    memset( (void *)pressure_mbar_shl_target, 0, sizeof(pressure_mbar_shl_target) );
-    memset( (void *)pressure_mbar_shl_actual, 0, sizeof(pressure_mbar_shl_actual) );
-    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
-        pressure_ctrl_state[chan] = PRESSURE_CTRL_STATE_READY;
-    
-    /* Flow Control Init */
-    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
-    {
-        flow_ctrl_state[chan] = FLOW_CTRL_STATE_UNCONFIGURED;
-        fpid_p[chan] = FPID_DEFAULT_P;
-        fpid_i[chan] = FPID_DEFAULT_I;
-        fpid_d[chan] = FPID_DEFAULT_D;
-    }
-    memset( (void *)flow_raw_target, 0, sizeof(flow_raw_target) );
-    memset( (void *)flow_raw_actual, 0, sizeof(flow_raw_actual) );
-    memset( (void *)fpid_integrated, 0, sizeof(fpid_integrated) );
-    memset( (void *)fpid_diff, 0, sizeof(fpid_diff) );
-    memset( (void *)fpid_error_prev, 0, sizeof(fpid_error_prev) );
-    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
-        flow_ctrl_state[chan] = FLOW_CTRL_STATE_READY;
-}
-
-void adc_rdy_isr( void )
-{
-    /*
-    switch ( adc_state )
-    {
-        case ADC_STATE_INIT:
-            ads1115_start_single( adc_i2c_addr, 0, DATARATE_128SPS, FSR_6_144 );
-            adc_state = ADC_STATE_SAMPLE;
-            break;
-        case ADC_STATE_SAMPLE:
-            pressure_mbar_shl_actual[0] = PRESSURE_ADC_TO_MBARSHL( ads1115_get_result( adc_i2c_addr ) );
-            ads1115_start_single( adc_i2c_addr, 0, DATARATE_128SPS, FSR_6_144 );
-            break;
-        default:;
-    }
-    */
-    adc_go = 1;
-}
-
-void __attribute__ ((weak)) timer_isr(void)
+err parse_packet_set_ppid_consts( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
 {
-//    PORTAbits.RA1 = ( ( !PORTAbits.RA1 ) && OSCCONbits.LOCK ) ? 1 : 0;
-//    PORTAbits.RA1 = !PORTAbits.RA1;
-//    PORTAbits.RA1 = OSCCONbits.LOCK ? 1 : 0;
-//    PORTAbits.RA1 = OSCCONbits.OSWEN;
-    timer_ms++;
-}
+    /* Data: n*[ [Controller Mask U8][PID_P U16][PID_I U16][PID_D U16] ] */
 
-void storage_save_defaults()
-{
-    err rc;
+    err rc = ERR_OK;
+    uint8_t *data_ptr = packet_data;
+    uint8_t chan_mask;
     uint8_t chan;
-    uint16_t pid_consts[3] = {FPID_DEFAULT_P, FPID_DEFAULT_I, FPID_DEFAULT_D};
-    
-    /* Store EEPROM version */
-    rc = store_save_eeprom_ver( EEPROM_VER );
+    uint16_t pid_consts[3];
+    int16_t data_size = packet_data_size;
     
-    /* Store default Flow PID Constants */
-    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+    while ( ( data_size >= ( 1 + ( 3 * sizeof(uint16_t) ) ) ) && ( rc == ERR_OK ) )
     {
-        if ( rc == ERR_OK )
-           rc = store_save_fpid_consts( chan, pid_consts );
+        /* U8 mask + 3x U16 PID  */
+        chan_mask = *data_ptr++;
+        pid_consts[0] = ( data_ptr[1] << 8 ) | data_ptr[0];
+        pid_consts[1] = ( data_ptr[3] << 8 ) | data_ptr[2];
+        pid_consts[2] = ( data_ptr[5] << 8 ) | data_ptr[4];
+        data_ptr += 3 * sizeof(uint16_t);
+        data_size -= ( 1 + ( 3 * sizeof(uint16_t) ) );
+        
+        for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+        {
+            if ( chan_mask & 0x01 )
+            {
+                ppid_config[chan].kp = pid_consts[0];
+                ppid_config[chan].ki = pid_consts[1];
+                ppid_config[chan].kd = pid_consts[2];
+                rc = store_save_ppid_consts( chan, pid_consts );
+            }
+            chan_mask >>= 1;
+        }
     }
     
-    printf( "Save Defaults %s\n", (rc==ERR_OK) ? "OK" : "FAIL" );
+    if ( data_size != 0 )
+        rc = ERR_PACKET_INVALID;
+    else
+        spi_packet_write( packet_type, &rc, 1 );
+    
+    return rc;
 }
 
-void storage_startup()
+err parse_packet_get_ppid_consts( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
 {
-    uint8_t eeprom_ver;
+    /* Return: [err U8]Nx([PID_P U16][PID_I U16][PID_D U16]) */
+    
+    err rc = ERR_OK;
     uint8_t chan;
-    uint16_t pid_consts[NUM_PRESSURE_CLTRLS][3];
-
-    store_load_eeprom_ver( &eeprom_ver );
-    printf( "EEPROM Version %hu\n", eeprom_ver );
+    uint8_t return_buf[ sizeof(err) + (NUM_PRESSURE_CLTRLS*3*sizeof(uint16_t)) ];
+    uint8_t *return_buf_ptr;
+    
+    return_buf_ptr = return_buf;
+    *return_buf_ptr++ = ERR_OK;
     
-    store_load_fpid_consts( (uint16_t *)pid_consts );
     for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
     {
-        fpid_p[chan] = pid_consts[chan][0];
-        fpid_i[chan] = pid_consts[chan][1];
-        fpid_d[chan] = pid_consts[chan][2];
-        printf( "Flow %hu PID Constants P %u I %u D %u\n", chan, fpid_p[chan], fpid_i[chan], fpid_d[chan] );
+        COPY_16BIT_TO_PTR( return_buf_ptr, ppid_config[chan].kp );
+        return_buf_ptr += sizeof(uint16_t);
+        COPY_16BIT_TO_PTR( return_buf_ptr, ppid_config[chan].ki );
+        return_buf_ptr += sizeof(uint16_t);
+        COPY_16BIT_TO_PTR( return_buf_ptr, ppid_config[chan].kd );
+        return_buf_ptr += sizeof(uint16_t);
     }
     
-    if ( eeprom_ver == EEPROM_BLANK_U8 )
-    {
-        /* Blank EEPROM */
-        printf( "Saving Defaults\n" );
-        storage_save_defaults();
-    }
+    spi_packet_write( packet_type, return_buf, sizeof(return_buf) );
     
-    printf( "\n" );
+    return rc;
 }
 
-void read_flows( void )
+err parse_packet_set_flow_ff( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
 {
+    /* Data: n*[ [Controller Mask U8][R mbar per 1000 ul/hr U16][Ramp ul/hr per cycle U16][Flags U8] ], none to query */
+    /* Return: [err U8]Nx[ [R U16][Ramp U16][Flags U8] ] */
+    
     err rc = ERR_OK;
+    uint8_t *data_ptr = packet_data;
+    uint8_t chan_mask;
     uint8_t chan;
-    int16_t flow;
-    float pressure_actual;
-    float pressure_target;
-//    uint16_t elapsed;
-    
-    /* 672us to set MUX and read one channel = 16us * 42 ticks at 400kHz I2C */
+    uint16_t ff_r;
+    uint16_t ramp_ul_hr;
+    uint8_t flags;
+    int16_t data_size = packet_data_size;
+    uint8_t return_buf[ sizeof(err) + ( NUM_PRESSURE_CLTRLS * 5 ) ];
+    uint8_t *return_buf_ptr;
     
-    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+    while ( ( data_size >= 6 ) && ( rc == ERR_OK ) )
     {
-//        if ( chan == 0 )
-//            elapsed = TMR1;
+        chan_mask = data_ptr[0];
+        ff_r = ( data_ptr[2] << 8 ) | data_ptr[1];
+        ramp_ul_hr = ( data_ptr[4] << 8 ) | data_ptr[3];
+        flags = data_ptr[5];
+        data_ptr += 6;
+        data_size -= 6;
         
-        if ( flow_present[chan] )
+        if ( flags & ~( FLOW_FF_ENABLE | FLOW_FF_LEARN ) )
+            rc = ERR_PACKET_INVALID;
+        else
         {
-            /* Set Sensirion I2C MUX channel */
-            rc = pca9544a_write( pca9544a_i2c_addr, 1, flow_map[chan] );
-
-            /* Read Sensirion flow rate */
-            if ( rc == ERR_OK )
+            for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
             {
-                rc = sensirion_measurement_read( &flow );
-                sensirion_measurement_start();
+                if ( chan_mask & 0x01 )
+                {
+                    flow_ff_r[chan] = ff_r;
+                    flow_ff_flags[chan] = flags;
+                    flow_ramp_raw[chan] = constrain_i32( flow_conv_u16( &flow_conv_raw[chan], ramp_ul_hr ), 0, UINT16_MAX );
+                    if ( ( ramp_ul_hr != 0 ) && ( flow_ramp_raw[chan] == 0 ) )
+                        flow_ramp_raw[chan] = 1;
+                }
+                chan_mask >>= 1;
             }
-        
-            if ( rc == ERR_OK )
-                flow_raw_actual[chan] = flow;
         }
-        else
-            flow = 0;
-        
-//        if ( chan == 0 )
-//            elapsed = TMR1 - elapsed;
-        
-        pressure_actual = (float)pressure_mbar_shl_actual[chan] / ( 1 << PRESSURE_SHL );
-        pressure_target = (float)pressure_mbar_shl_output[chan] / ( 1 << PRESSURE_SHL );
-        printf( "Chan %hu mode %u, Pressure %8.2f / %7.2f, Flow %8.3f ul/hr rc=%3hu present=%u\n", chan+1, ctrl_modes[chan], (double)pressure_actual, (double)pressure_target, (double)flow*60/flow_scales_ul_min[chan], rc, flow_present[chan] );
     }
     
-    printf( "\n" );
+    if ( data_size != 0 )
+        rc = ERR_PACKET_INVALID;
+    
+    if ( rc == ERR_OK )
+    {
+        return_buf_ptr = return_buf;
+        *return_buf_ptr++ = ERR_OK;
+        
+        for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+        {
+            ramp_ul_hr = constrain_i32( flow_conv_u16( &flow_conv_ul_hr[chan], flow_ramp_raw[chan] ), 0, UINT16_MAX );
+            COPY_16BIT_TO_PTR( return_buf_ptr, flow_ff_r[chan] );
+            return_buf_ptr += sizeof(uint16_t);
+            COPY_16BIT_TO_PTR( return_buf_ptr, ramp_ul_hr );
+            return_buf_ptr += sizeof(uint16_t);
+            *return_buf_ptr++ = flow_ff_flags[chan];
+        }
+        
+        spi_packet_write( packet_type, return_buf, sizeof(return_buf) );
+    }
+    
+    return rc;
+}
+
+int32_t profile_value( profile_t *profile, uint8_t index )
+{
+    if ( profile->flags & PROFILE_FLAG_PRESSURE )
+        return profile->points[index].value;
+    else
+        return (int16_t)profile->points[index].value;
+}
+
+void profile_apply( uint8_t chan, int32_t target )
+{
+    if ( profiles[chan].flags & PROFILE_FLAG_PRESSURE )
+        pressure_mbar_shl_target[chan] = constrain_i32( target, 0, (int32_t)PRESSURE_CTLR_MBAR << PRESSURE_SHL );
+    else
+        flow_raw_target[chan] = constrain_i32( flow_conv( &flow_conv_raw[chan], (int16_t)target ), INT16_MIN, INT16_MAX );
+}
+
+err profile_start( uint8_t chan, uint8_t length, uint8_t flags )
+{
+    err rc = ERR_OK;
+    profile_t *profile = &profiles[chan];
+    uint32_t length_mask = ( (uint32_t)1 << length ) - 1;
+    uint32_t loop_ms = 0;
+    uint8_t index;
+    
+    profile->active = 0;
+    
+    if ( ( length > PROFILE_LEN ) || ( flags & ~( PROFILE_FLAG_LOOP | PROFILE_FLAG_PRESSURE ) ) )
+        rc = ERR_PACKET_INVALID;
+    else if ( length > 0 )
+    {
+        for ( index=0; index<length; index++ )
+            loop_ms += profile->points[index].duration_ms;
+        
+        /* All points uploaded, and a loop must take some time */
+        if ( ( ( profile->uploaded & length_mask ) != length_mask ) ||
+             ( ( flags & PROFILE_FLAG_LOOP ) && ( loop_ms == 0 ) ) )
+            rc = ERR_PROFILE_INVALID;
+        else
+        {
+            profile->length = length;
+            profile->flags = flags;
+            profile->index = 0;
+            profile->segment_start_ms = timer_ms;
+            
+            /* First segment starts from the present target */
+            if ( flags & PROFILE_FLAG_PRESSURE )
+                profile->segment_from = pressure_mbar_shl_target[chan];
+            else
+                profile->segment_from = flow_raw_to_ul_hr( chan, flow_raw_target[chan] );
+            
+            profile->active = 1;
+        }
+    }
+    
+    return rc;
+}
+
+void run_profiles( void )
+{
+    /* Called once per control cycle, before update_outputs(), so a point is reached at most
+     * one cycle late. Segments follow on from each other's end time, so errors do not add up. */
+    uint8_t chan;
+    profile_t *profile;
+    uint16_t duration_ms;
+    uint16_t elapsed;
+    int32_t target;
+    int32_t frac;
+    
+    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+    {
+        profile = &profiles[chan];
+        if ( !profile->active )
+            continue;
+        
+        elapsed = timer_ms - profile->segment_start_ms;
+        duration_ms = profile->points[profile->index].duration_ms;
+        
+        while ( profile->active && ( elapsed >= duration_ms ) )
+        {
+            /* Point reached, start the next segment from it */
+            profile->segment_from = profile_value( profile, profile->index );
+            profile->segment_start_ms += duration_ms;
+            elapsed -= duration_ms;
+            
+            profile->index++;
+            if ( profile->index >= profile->length )
+            {
+                if ( profile->flags & PROFILE_FLAG_LOOP )
+                    profile->index = 0;
+                else
+                    profile->active = 0;
+            }
+            
+            if ( profile->active )
+                duration_ms = profile->points[profile->index].duration_ms;
+        }
+        
+        target = profile->segment_from;
+        if ( profile->active )
+        {
+            /* Linear from segment_from to the point, each product fits I32 */
+            frac = ( (int32_t)elapsed << PROFILE_FRAC_SHIFT ) / duration_ms;
+            target += ( ( profile_value( profile, profile->index ) - profile->segment_from ) * frac ) >> PROFILE_FRAC_SHIFT;
+        }
+        
+        profile_apply( chan, target );
+    }
+}
+
+err parse_packet_set_profile_points( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+{
+    /* Data: [Channel U8][First index U8] n*[ [Duration ms U16][Value U16] ] */
+    /* Value: pressure mbar U16>>PRESSURE_SHL or flow ul/hr I16, as in the SET_*_TARGET packets */
+    
+    err rc = ERR_OK;
+    uint8_t chan;
+    uint8_t index;
+    uint8_t count;
+    uint8_t *data_ptr = packet_data + 2;
+    profile_t *profile;
+    
+    count = ( packet_data_size - 2 ) / sizeof(profile_point_t);
+    
+    if ( ( packet_data_size < ( 2 + sizeof(profile_point_t) ) ) ||
+         ( ( ( packet_data_size - 2 ) % sizeof(profile_point_t) ) != 0 ) ||
+         ( packet_data[0] >= NUM_PRESSURE_CLTRLS ) ||
+         ( ( packet_data[1] + count ) > PROFILE_LEN ) )
+        rc = ERR_PACKET_INVALID;
+    else
+    {
+        chan = packet_data[0];
+        profile = &profiles[chan];
+        
+        /* Points are only read while running, so stop rather than run a half-written table */
+        profile->active = 0;
+        
+        for ( index=packet_data[1]; index<( packet_data[1] + count ); index++ )
+        {
+            profile->points[index].duration_ms = ( data_ptr[1] << 8 ) | data_ptr[0];
+            profile->points[index].value = ( data_ptr[3] << 8 ) | data_ptr[2];
+            profile->uploaded |= (uint16_t)1 << index;
+            data_ptr += sizeof(profile_point_t);
+        }
+        
+        spi_packet_write( packet_type, &rc, 1 );
+    }
+    
+    return rc;
+}
+
+err parse_packet_set_profile( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+{
+    /* Data: n*[ [Controller Mask U8][Length U8, 0 stops][Flags U8] ], or none to query */
+    /* Return: [err U8]Nx[ [Length U8][Flags U8][Active U8][Index U8] ] */
+    
+    err rc = ERR_OK;
+    uint8_t *data_ptr = packet_data;
+    uint8_t chan_mask;
+    uint8_t chan;
+    int16_t data_size = packet_data_size;
+    uint8_t return_buf[ sizeof(err) + ( NUM_PRESSURE_CLTRLS * 4 ) ];
+    uint8_t *return_buf_ptr;
+    
+    if ( ( data_size % 3 ) != 0 )
+        rc = ERR_PACKET_INVALID;
+    
+    while ( ( data_size >= 3 ) && ( rc == ERR_OK ) )
+    {
+        chan_mask = data_ptr[0];
+        for ( chan=0; ( chan<NUM_PRESSURE_CLTRLS ) && ( rc == ERR_OK ); chan++ )
+        {
+            if ( chan_mask & 0x01 )
+                rc = profile_start( chan, data_ptr[1], data_ptr[2] );
+            chan_mask >>= 1;
+        }
+        data_ptr += 3;
+        data_size -= 3;
+    }
+    
+    if ( rc == ERR_OK )
+    {
+        return_buf_ptr = return_buf;
+        *return_buf_ptr++ = ERR_OK;
+        
+        for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+        {
+            *return_buf_ptr++ = profiles[chan].length;
+            *return_buf_ptr++ = profiles[chan].flags;
+            *return_buf_ptr++ = profiles[chan].active;
+            *return_buf_ptr++ = profiles[chan].index;
+        }
+        
+        spi_packet_write( packet_type, return_buf, sizeof(return_buf) );
+    }
+    
+    return rc;
+}
+
+err parse_packet_get_spi_stats( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+{
+    /* Data: [Reset U8] optional */
+    /* Return: [err U8][spi_stats_report() U16 * 9] */
+    
+    err rc = ERR_OK;
+    uint8_t return_buf[ sizeof(err) + SPI_STATS_REPORT_SIZE ];
+    
+    if ( packet_data_size > 1 )
+        rc = ERR_PACKET_INVALID;
+    else
+    {
+        spi_stats_report( &return_buf[1], ( packet_data_size == 1 ) && packet_data[0] );
+        return_buf[0] = ERR_OK;
+        
+        spi_packet_write( packet_type, return_buf, sizeof(return_buf) );
+    }
+    
+    return rc;
+}
+
+err parse_packet_echo( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+{
+    /* Data: [payload...], any size, for timing the SPI link */
+    /* Return: [err U8][payload...] */
+    
+    err rc = ERR_OK;
+    uint8_t return_buf[ sizeof(err) + SPI_PACKET_BUF_SIZE ];
+    
+    return_buf[0] = ERR_OK;
+    memcpy( &return_buf[1], packet_data, packet_data_size );
+    
+    spi_packet_write( packet_type, return_buf, sizeof(err) + packet_data_size );
+    
+    return rc;
+}
+
+err parse_packet_sync_time( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+{
+    /* Data: none to read the clock, or [Mode U8][Value U32], see rio_time.h TIME_SYNC_* */
+    /* Return: [err U8][Synced time us U32][Local time us U32][Syncs U16] */
+    
+    err rc = ERR_OK;
+    uint8_t return_buf[ sizeof(err) + TIME_REPORT_SIZE ];
+    
+    rc = time_sync( packet_data, packet_data_size );
+    if ( rc == ERR_OK )
+    {
+        return_buf[0] = ERR_OK;
+        time_report( &return_buf[1] );
+        spi_packet_write( packet_type, return_buf, sizeof(return_buf) );
+    }
+    
+    return rc;
+}
+
+err parse_packet_stage( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+{
+    /* Data: none to read, [0] to cancel, or [Apply time us U32][Packet Type U8][Data...], see rio_stage.h */
+    /* Return: [err U8][Pending U8][Applied U16][Late U16][Failed U16][Last error us I32] */
+    
+    err rc = ERR_OK;
+    uint8_t return_buf[ sizeof(err) + STAGE_REPORT_SIZE ];
+    
+    rc = stage_packet( packet_data, packet_data_size );
+    if ( rc == ERR_OK )
+    {
+        return_buf[0] = ERR_OK;
+        stage_report( &return_buf[1] );
+        spi_packet_write( packet_type, return_buf, sizeof(return_buf) );
+    }
+    
+    return rc;
+}
+
+void frame_sync_set( uint8_t mode, uint8_t divider )
+{
+    /* Main loop. Restarts the count, so the host can number its frame triggers from here. */
+    FRAME_SYNC_INT_DISABLE();
+    frame_sync_mode = mode;
+    frame_sync_divider = divider;
+    frame_sync_countdown = divider;
+    frame_sync_count = 0;
+    frame_sync_frame = 0;
+    frame_sync_missed = 0;
+    _INT2EP = ( mode == FRAME_SYNC_FALLING );
+    _INT2IF = 0;                        // Changing the edge can latch a false one
+    if ( mode != FRAME_SYNC_OFF )
+        FRAME_SYNC_INT_ENABLE();
+}
+
+err parse_packet_set_frame_sync( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+{
+    /* Data: [Mode U8, FRAME_SYNC_*][Divider U8, edges per cycle], or none to query.
+     * Setting restarts the frame count, the first edge after it is frame 1. */
+    /* Return: [err U8][Mode U8][Divider U8][Frames U32][Missed U16] */
+    
+    err rc = ERR_OK;
+    uint8_t return_buf[ sizeof(err) + 2*sizeof(uint8_t) + sizeof(uint32_t) + sizeof(uint16_t) ];
+    uint32_t frames;
+    
+    if ( packet_data_size == 2 )
+    {
+        if ( ( packet_data[0] > FRAME_SYNC_FALLING ) || ( packet_data[1] == 0 ) )
+            rc = ERR_PACKET_INVALID;
+        else
+            frame_sync_set( packet_data[0], packet_data[1] );
+    }
+    else if ( packet_data_size != 0 )
+        rc = ERR_PACKET_INVALID;
+    
+    if ( rc == ERR_OK )
+    {
+        FRAME_SYNC_INT_DISABLE();
+        frames = frame_sync_count;
+        COPY_16BIT_TO_PTR( &return_buf[7], frame_sync_missed );
+        if ( frame_sync_mode != FRAME_SYNC_OFF )
+            FRAME_SYNC_INT_ENABLE();
+        
+        return_buf[0] = ERR_OK;
+        return_buf[1] = frame_sync_mode;
+        return_buf[2] = frame_sync_divider;
+        memcpy( &return_buf[3], &frames, sizeof(uint32_t) );   // Little endian
+        
+        spi_packet_write( packet_type, return_buf, sizeof(return_buf) );
+    }
+    
+    return rc;
+}
+
+err parse_packet_get_status_snapshot( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+{
+    /* Return: [err U8][Seq U16][Time us U32][Frame U32]Nx([Pressure actual I16][Pressure output U16][Pressure target U16]
+     *                            [Flow actual ul/hr I16][Flow target ul/hr I16][Control Mode U8][Flow State U8]),
+     *         pkt_status_snapshot_reply_t */
+    
+    err rc = ERR_OK;
+    uint8_t chan;
+    pkt_status_snapshot_reply_t reply;
+    pkt_status_snapshot_reply_chan_t *reply_chan;
+    
+    reply.rc = ERR_OK;
+    reply.seq = status_snapshot.seq;
+    reply.time_us = status_snapshot.time_us;
+    reply.frame = status_snapshot.frame;
+    
+    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+    {
+        reply_chan = &reply.chan[chan];
+        reply_chan->pressure_actual = status_snapshot.pressure_mbar_shl_actual[chan];
+        reply_chan->pressure_output = status_snapshot.pressure_mbar_shl_output[chan];
+        reply_chan->pressure_target = status_snapshot.pressure_mbar_shl_target[chan];
+        reply_chan->flow_actual = flow_raw_to_ul_hr( chan, status_snapshot.flow_raw_actual[chan] );
+        reply_chan->flow_target = flow_raw_to_ul_hr( chan, status_snapshot.flow_raw_target[chan] );
+        reply_chan->control_mode = status_snapshot.ctrl_modes[chan];
+        reply_chan->flow_ctrl_state = status_snapshot.flow_ctrl_state[chan];
+    }
+    
+    spi_packet_write( packet_type, (uint8_t *)&reply, sizeof(reply) );
+    
+    return rc;
+}
+
+uint8_t push_active( void )
+{
+    /* Telemetry samples or reports are queued unrequested and drained over several
+     * transactions, so replies are kept over a deselect and past the packet timeout */
+    return ( telemetry_period != 0 ) || report_active();
+}
+
+err parse_packet_set_telemetry( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+{
+    /* Data: [Period cycles U8, 0 -> off][Format U8], format optional, RECORD_FORMAT_PLAIN by default */
+    /* Return: [err U8][Dropped samples U16], dropped since the last SET_TELEMETRY */
+    
+    err rc = ERR_OK;
+    uint8_t return_buf[ sizeof(err) + sizeof(uint16_t) ];
+    uint8_t format = ( packet_data_size > 1 ) ? packet_data[1] : RECORD_FORMAT_PLAIN;
+    
+    if ( format > RECORD_FORMAT_COMPACT )
+        rc = ERR_PACKET_INVALID;
+    else
+    {
+        telemetry_period = packet_data[0];
+        telemetry_count = 0;
+        telemetry_format = format;
+        delta_init( &telemetry_coder, telemetry_prev, TELEMETRY_WORDS, TELEMETRY_KEY_EVERY );
+        /* Samples are drained over several transactions, keep them over a deselect */
+        spi_write_hold( push_active() );
+        
+        return_buf[0] = ERR_OK;
+        COPY_16BIT_TO_PTR( &return_buf[1], telemetry_dropped );
+        telemetry_dropped = 0;
+        
+        spi_packet_write( packet_type, return_buf, sizeof(return_buf) );
+    }
+    
+    return rc;
+}
+
+err parse_packet_subscribe( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+{
+    /* Data: none to read, [0xFF] to cancel, or n x [Signal U8][Deadband U16][Max interval ms U16],
+     * see rio_report.h. Signals 0 to N-1 are the pressures, N to 2N-1 the flows. */
+    /* Return: [err U8][Subscribed U8][Reports U16][Dropped U16] */
+    
+    err rc = ERR_OK;
+    uint8_t return_buf[ sizeof(err) + REPORT_STATUS_SIZE ];
+    
+    rc = report_subscribe( packet_data, packet_data_size );
+    if ( rc == ERR_OK )
+    {
+        spi_write_hold( push_active() );
+        
+        return_buf[0] = ERR_OK;
+        report_status( &return_buf[1] );
+        spi_packet_write( packet_type, return_buf, sizeof(return_buf) );
+    }
+    
+    return rc;
+}
+
+err parse_packet_flash( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+{
+    /* Data: [Op U8][...], see rio_flash.h. The new image goes into the inactive partition
+     * while the loops run on, and boots at the reset after COMMIT. */
+    /* Return: [err U8][State U8][Boot sequence U16][Partition size U32][Words written U32]
+     * [Progress U32][CRC-32 U32] */
+    
+    err rc = ERR_OK;
+    uint8_t return_buf[ sizeof(err) + FLASH_STATUS_SIZE ];
+    
+    rc = flash_command( packet_data, packet_data_size );
+    if ( rc == ERR_OK )
+    {
+        return_buf[0] = ERR_OK;
+        flash_status( &return_buf[1] );
+        spi_packet_write( packet_type, return_buf, sizeof(return_buf) );
+    }
+    
+    return rc;
+}
+
+uint8_t *history_record_pack( history_record_t *record, uint8_t *buf )
+{
+    /* pkt_history_record_t of GET_HISTORY and HISTORY_STREAM at <buf>, returns the end */
+    
+    pkt_history_record_t *pkt = (pkt_history_record_t *)buf;
+    uint8_t chan;
+    
+    pkt->seq = record->seq;
+    pkt->time_us = record->time_us;
+    memcpy( pkt->pressure_actual, record->pressure_mbar_shl_actual, sizeof(pkt->pressure_actual) );
+    memcpy( pkt->pressure_output, record->pressure_mbar_shl_output, sizeof(pkt->pressure_output) );
+    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+        pkt->flow_actual[chan] = flow_raw_to_ul_hr( chan, record->flow_raw_actual[chan] );
+    memcpy( pkt->pid_terms, record->fpid_terms, sizeof(pkt->pid_terms) );
+    
+    return buf + sizeof(pkt_history_record_t);
+}
+
+void history_record_words( history_record_t *record, uint16_t *words )
+{
+    /* HISTORY_WORDS words of the packed record, the time low word first, for rio_delta */
+    
+    history_record_pack( record, (uint8_t *)words );
+}
+
+history_record_t *history_find( uint16_t seq )
+{
+    /* The record of <seq>, or NULL if it is not in the ring, not yet or no longer */
+    
+    uint16_t newest_seq;
+    
+    if ( history_count == 0 )
+        return NULL;
+    
+    newest_seq = history[ ( history_head - 1 ) & ( HISTORY_LEN - 1 ) ].seq;
+    if ( (uint16_t)( newest_seq - seq ) >= history_count )
+        return NULL;
+    
+    return &history[ ( history_head - 1 - ( newest_seq - seq ) ) & ( HISTORY_LEN - 1 ) ];
+}
+
+uint8_t history_stream_fill( uint16_t offset, uint8_t *buf, uint8_t max )
+{
+    /* spi_stream_fill_t of HISTORY_STREAM: whole records from history_stream_seq, until one
+     * has been overwritten since the transfer started */
+    
+    uint16_t seq = history_stream_seq + ( offset / HISTORY_RECORD_SIZE );
+    uint8_t *buf_ptr = buf;
+    history_record_t *record;
+    
+    while ( ( ( buf_ptr - buf ) + HISTORY_RECORD_SIZE ) <= max )
+    {
+        record = history_find( seq++ );
+        if ( record == NULL )
+            break;
+        buf_ptr = history_record_pack( record, buf_ptr );
+    }
+    
+    return buf_ptr - buf;
+}
+
+uint8_t history_stream_fill_compact( uint16_t offset, uint8_t *buf, uint8_t max )
+{
+    /* spi_stream_fill_t of a compact HISTORY_STREAM: rio_delta records, the first a keyframe,
+     * as a byte stream across the chunks. Ends the transfer, which was sized for records at
+     * their largest, after the last record or at one overwritten since it started. */
+    
+    uint16_t words[HISTORY_WORDS];
+    history_record_t *record;
+    uint8_t size = 0;
+    uint8_t n;
+    
+    while ( size < max )
+    {
+        if ( history_pending_pos == history_pending_size )
+        {
+            if ( history_stream_seq == history_stream_end )
+                break;
+            record = history_find( history_stream_seq );
+            if ( record == NULL )
+                break;
+            history_record_words( record, words );
+            history_pending_size = delta_encode( &history_coder, words, history_pending );
+            history_pending_pos = 0;
+            history_stream_seq++;
+        }
+        
+        n = history_pending_size - history_pending_pos;
+        if ( n > ( max - size ) )
+            n = max - size;
+        memcpy( &buf[size], &history_pending[history_pending_pos], n );
+        history_pending_pos += n;
+        size += n;
+    }
+    
+    return size;
+}
+
+err parse_packet_get_history( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+{
+    /* Data: [Start seq U16][Max records U8] */
+    /* Return: [err U8][Oldest seq U16][Newest seq U16][Count U8] Count x ([Seq U16][Time us U32]
+     *         Nx[Pressure actual I16] Nx[Pressure output U16] Nx[Flow actual ul/hr I16] Nx[P I16][I I16][D I16]) */
+    
+    err rc = ERR_OK;
+    uint8_t count;
+    uint8_t index;
+    uint16_t start_seq;
+    uint16_t oldest_seq;
+    uint16_t newest_seq;
+    spi_buf_count_t write_free;
+    uint8_t return_buf[ HISTORY_REPLY_HEADER + (HISTORY_REPLY_MAX*HISTORY_RECORD_SIZE) ];
+    uint8_t *return_buf_ptr;
+    
+    if ( packet_data_size != 3 )
+        rc = ERR_PACKET_INVALID;
+    else
+    {
+        start_seq = ( packet_data[1] << 8 ) | packet_data[0];
+        
+        if ( history_count == 0 )
+        {
+            oldest_seq = status_snapshot.seq + 1;
+            newest_seq = status_snapshot.seq;
+        }
+        else
+        {
+            newest_seq = history[ ( history_head - 1 ) & ( HISTORY_LEN - 1 ) ].seq;
+            oldest_seq = newest_seq - ( history_count - 1 );
+        }
+        
+        /* Records older than the ring start at the oldest kept, the host sees the gap */
+        if ( (int16_t)( start_seq - oldest_seq ) < 0 )
+            start_seq = oldest_seq;
+        
+        /* As many as asked for, kept, and fit the write ring */
+        count = 0;
+        if ( (int16_t)( newest_seq - start_seq ) >= 0 )
+            count = newest_seq - start_seq + 1;
+        if ( count > packet_data[2] )
+            count = packet_data[2];
+        if ( count > HISTORY_REPLY_MAX )
+            count = HISTORY_REPLY_MAX;
+        write_free = SPI_WRITE_BUF_SIZE - spi_write_bytes_written();
+        while ( ( count > 0 ) && ( ( HISTORY_REPLY_HEADER + ( count * HISTORY_RECORD_SIZE ) + 6 ) > write_free ) )
+            count--;
+        
+        return_buf_ptr = return_buf;
+        *return_buf_ptr++ = ERR_OK;
+        COPY_16BIT_TO_PTR( return_buf_ptr, oldest_seq );
+        return_buf_ptr += sizeof(uint16_t);
+        COPY_16BIT_TO_PTR( return_buf_ptr, newest_seq );
+        return_buf_ptr += sizeof(uint16_t);
+        *return_buf_ptr++ = count;
+        
+        index = ( history_head - 1 - ( newest_seq - start_seq ) ) & ( HISTORY_LEN - 1 );
+        while ( count-- > 0 )
+        {
+            return_buf_ptr = history_record_pack( &history[index], return_buf_ptr );
+            index = ( index + 1 ) & ( HISTORY_LEN - 1 );
+        }
+        
+        spi_packet_write( packet_type, return_buf, return_buf_ptr - return_buf );
+    }
+    
+    return rc;
+}
+
+err parse_packet_history_stream( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+{
+    /* Data: [Start seq U16][Max records U16][Format U8], format optional, RECORD_FORMAT_PLAIN by default */
+    /* Return: a streamed transfer, see rio_spi, of Count x GET_HISTORY records from the
+     *         oldest kept at or after Start seq up to the newest, at most Max records. Compact,
+     *         the rio_delta records of their HISTORY_WORDS words, the first a keyframe. */
+    
+    uint16_t start_seq = ( packet_data[1] << 8 ) | packet_data[0];
+    uint16_t max = ( packet_data[3] << 8 ) | packet_data[2];
+    uint8_t format = ( packet_data_size > 4 ) ? packet_data[4] : RECORD_FORMAT_PLAIN;
+    uint16_t oldest_seq;
+    uint16_t newest_seq;
+    uint16_t count = 0;
+    
+    if ( history_count > 0 )
+    {
+        newest_seq = history[ ( history_head - 1 ) & ( HISTORY_LEN - 1 ) ].seq;
+        oldest_seq = newest_seq - ( history_count - 1 );
+        if ( (int16_t)( start_seq - oldest_seq ) < 0 )
+            start_seq = oldest_seq;
+        if ( (int16_t)( newest_seq - start_seq ) >= 0 )
+            count = newest_seq - start_seq + 1;
+        if ( count > max )
+            count = max;
+    }
+    
+    if ( format > RECORD_FORMAT_COMPACT )
+        return ERR_PACKET_INVALID;
+    
+    history_stream_seq = start_seq;
+    if ( format == RECORD_FORMAT_PLAIN )
+        return spi_stream_start( &spi_packet, packet_type, count * HISTORY_RECORD_SIZE, history_stream_fill );
+    
+    history_stream_end = start_seq + count;
+    delta_init( &history_coder, history_prev, HISTORY_WORDS, 0 );
+    history_pending_size = 0;
+    history_pending_pos = 0;
+    
+    return spi_stream_start( &spi_packet, packet_type, count * DELTA_RECORD_MAX( HISTORY_WORDS ), history_stream_fill_compact );
+}
+
+err parse_packet_set_loop_config( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+{
+    /* Data: [Period ms U16]Nx[ADS1115 data rate U8, 0-7 = 8-860 SPS], or none to query */
+    /* Return: [err U8][Period ms U16]Nx[Data rate U8] */
+    
+    err rc = ERR_OK;
+    uint8_t chan;
+    uint16_t period_ms;
+    uint8_t return_buf[ sizeof(err) + sizeof(uint16_t) + NUM_PRESSURE_CLTRLS ];
+    
+    if ( packet_data_size == ( sizeof(uint16_t) + NUM_PRESSURE_CLTRLS ) )
+    {
+        period_ms = ( packet_data[1] << 8 ) | packet_data[0];
+        if ( period_ms < ADC_PERIOD_MS_MIN )
+            rc = ERR_PACKET_INVALID;
+        for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+        {
+            if ( packet_data[sizeof(uint16_t)+chan] > ( DATARATE_860SPS >> ADS1115_DR0 ) )
+                rc = ERR_PACKET_INVALID;
+        }
+        
+        if ( rc == ERR_OK )
+        {
+            /* Takes effect from the next cycle, restarting the period from now */
+            adc_period_ms = period_ms;
+            adc_time = timer_ms;
+            for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+            {
+                adc_datarates[chan] = (ads1115_datarate)( packet_data[sizeof(uint16_t)+chan] << ADS1115_DR0 );
+                adc_config_save( chan );
+            }
+        }
+    }
+    else if ( packet_data_size != 0 )
+        rc = ERR_PACKET_INVALID;
+    
+    if ( rc == ERR_OK )
+    {
+        return_buf[0] = ERR_OK;
+        COPY_16BIT_TO_PTR( &return_buf[1], adc_period_ms );
+        for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+            return_buf[sizeof(err)+sizeof(uint16_t)+chan] = adc_datarates[chan] >> ADS1115_DR0;
+        
+        spi_packet_write( packet_type, return_buf, sizeof(return_buf) );
+    }
+    
+    return rc;
+}
+
+err parse_packet_get_loop_stats( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+{
+    /* Data: [Reset U8] optional */
+    /* Return: [err U8][Cycles U32][Overruns U16][Period ms last U16][Period ms max U16]
+     *         [Busy ms last U16][Busy ms max U16] */
+    
+    err rc = ERR_OK;
+    uint8_t return_buf[ sizeof(err) + sizeof(uint32_t) + (5*sizeof(uint16_t)) ];
+    uint8_t *return_buf_ptr;
+    
+    if ( packet_data_size > 1 )
+        rc = ERR_PACKET_INVALID;
+    else
+    {
+        return_buf_ptr = return_buf;
+        *return_buf_ptr++ = ERR_OK;
+        memcpy( return_buf_ptr, &loop_stats.cycles, sizeof(uint32_t) );    // Little endian
+        return_buf_ptr += sizeof(uint32_t);
+        COPY_16BIT_TO_PTR( return_buf_ptr, loop_stats.overruns );
+        return_buf_ptr += sizeof(uint16_t);
+        COPY_16BIT_TO_PTR( return_buf_ptr, loop_stats.period_ms_last );
+        return_buf_ptr += sizeof(uint16_t);
+        COPY_16BIT_TO_PTR( return_buf_ptr, loop_stats.period_ms_max );
+        return_buf_ptr += sizeof(uint16_t);
+        COPY_16BIT_TO_PTR( return_buf_ptr, loop_stats.busy_ms_last );
+        return_buf_ptr += sizeof(uint16_t);
+        COPY_16BIT_TO_PTR( return_buf_ptr, loop_stats.busy_ms_max );
+        
+        if ( ( packet_data_size == 1 ) && packet_data[0] )
+            memset( &loop_stats, 0, sizeof(loop_stats) );
+        
+        spi_packet_write( packet_type, return_buf, sizeof(return_buf) );
+    }
+    
+    return rc;
+}
+
+err parse_packet_get_probe_stats( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+{
+    /* Data: [Reset U8] optional */
+    /* Return: [err U8][Timer Hz U32][Probes U8] Probes x ([Count U32][Min U16][Max U16][Mean U16]), then the
+     * load, [Load permille U16][Peak U16][ISR permille U16][ISR max U16][Idle pass U16][Pass max U16][Passes U32] */
+    
+    err rc = ERR_OK;
+    uint8_t return_buf[ sizeof(err) + PROBE_REPORT_SIZE ];
+    
+    if ( packet_data_size > 1 )
+        rc = ERR_PACKET_INVALID;
+    else
+    {
+#ifdef PROBE_ENABLED
+        probe_report( &return_buf[1], ( packet_data_size == 1 ) && packet_data[0] );
+#else
+        memset( &return_buf[1], 0, PROBE_REPORT_SIZE );
+#endif
+        return_buf[0] = ERR_OK;
+        
+        spi_packet_write( packet_type, return_buf, sizeof(return_buf) );
+    }
+    
+    return rc;
+}
+
+err parse_packet_get_eeprom_status( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+{
+    /* Data: [Reset U8] optional */
+    /* Return: [err U8][Pending U8][Busy U8][Committed U16][Verify Failed U16][Full Waits U16] */
+    
+    err rc = ERR_OK;
+    uint8_t return_buf[ sizeof(err) + 2*sizeof(uint8_t) + 3*sizeof(uint16_t) ];
+    ee_queue_stats_t stats;
+    
+    if ( packet_data_size > 1 )
+        rc = ERR_PACKET_INVALID;
+    else
+    {
+        eeprom_queue_stats( &stats, ( packet_data_size == 1 ) && packet_data[0] );
+        
+        return_buf[0] = ERR_OK;
+        return_buf[1] = stats.pending + ( store_dirty() ? 1 : 0 );   // Saves not yet queued count as one
+        return_buf[2] = stats.busy ? 1 : 0;
+        COPY_16BIT_TO_PTR( &return_buf[3], stats.committed );
+        COPY_16BIT_TO_PTR( &return_buf[5], stats.verify_failed );
+        COPY_16BIT_TO_PTR( &return_buf[7], stats.full_waits );
+        
+        spi_packet_write( packet_type, return_buf, sizeof(return_buf) );
+    }
+    
+    return rc;
+}
+
+/* Parameter hooks, for values that need a check or a save when set */
+err param_set_adc_period_ms( const param_desc_t *param, int32_t value )
+{
+    /* Takes effect from the next cycle, as for SET_LOOP_CONFIG */
+    adc_period_ms = value;
+    adc_time = timer_ms;
+    
+    return ERR_OK;
+}
+
+err param_set_pressure_limit( const param_desc_t *param, int32_t value )
+{
+    uint8_t chan = PARAM_CHAN( param->id );
+    
+    /* A pressure sample never reaches a higher limit, it would never trip */
+    if ( ( value < 0 ) || ( value > PRESSURE_LIMIT_MAX_MBAR ) )
+        return ERR_PARAM_RANGE;
+    pressure_limit_mbar[chan] = value;
+    
+    return store_save_pressure_limit( chan, value );
+}
+
+err param_set_module_addr( const param_desc_t *param, int32_t value )
+{
+    spi_module_addr = value;
+    
+    return store_save_module_addr( value );
+}
+
+err param_set_fpid( const param_desc_t *param, int32_t value )
+{
+    uint8_t chan = PARAM_CHAN( param->id );
+    uint16_t pid_consts[3];
+    
+    *(uint16_t *)param->value = value;
+    pid_consts[0] = fpid_config[chan].kp;
+    pid_consts[1] = fpid_config[chan].ki;
+    pid_consts[2] = fpid_config[chan].kd;
+    
+    return store_save_fpid_consts( chan, pid_consts );
+}
+
+err param_set_ppid( const param_desc_t *param, int32_t value )
+{
+    uint8_t chan = PARAM_CHAN( param->id );
+    uint16_t pid_consts[3];
+    
+    *(uint16_t *)param->value = value;
+    pid_consts[0] = ppid_config[chan].kp;
+    pid_consts[1] = ppid_config[chan].ki;
+    pid_consts[2] = ppid_config[chan].kd;
+    
+    return store_save_ppid_consts( chan, pid_consts );
+}
+
+int32_t param_get_adc_datarate( const param_desc_t *param )
+{
+    return adc_datarates[PARAM_CHAN( param->id )] >> ADS1115_DR0;
+}
+
+err param_set_adc_datarate( const param_desc_t *param, int32_t value )
+{
+    adc_datarates[PARAM_CHAN( param->id )] = (ads1115_datarate)( value << ADS1115_DR0 );
+    
+    return adc_config_save( PARAM_CHAN( param->id ) );
+}
+
+err param_set_pressure_cal_zero( const param_desc_t *param, int32_t value )
+{
+    uint8_t chan = PARAM_CHAN( param->id );
+    
+    pressure_cal_zero[chan] = value;
+    
+    return pressure_cal_save( chan );
+}
+
+int32_t param_get_pressure_cal_trim( const param_desc_t *param )
+{
+    return pressure_cal_trim[PARAM_CHAN( param->id )];
+}
+
+err param_set_pressure_cal_trim( const param_desc_t *param, int32_t value )
+{
+    uint8_t chan = PARAM_CHAN( param->id );
+    
+    pressure_cal_trim[chan] = value;
+    pressure_cal_span[chan] = PRESSURE_CAL_SPAN( value );
+    
+    return pressure_cal_save( chan );
+}
+
+err param_set_adc_burst( const param_desc_t *param, int32_t value )
+{
+    /* From the next cycle, a burst under way runs to its old length */
+    uint8_t chan = PARAM_CHAN( param->id );
+    
+    adc_bursts[chan] = value;
+    
+    return adc_config_save( chan );
+}
+
+int32_t param_get_adc_gain( const param_desc_t *param )
+{
+    return adc_gain_settings[PARAM_CHAN( param->id )];
+}
+
+err param_set_adc_gain( const param_desc_t *param, int32_t value )
+{
+    uint8_t chan = PARAM_CHAN( param->id );
+    
+    if ( !adc_config_valid( 0, value, 0 ) )
+        return ERR_PACKET_INVALID;
+    adc_config_set( chan, adc_datarates[chan] >> ADS1115_DR0, value, adc_muxes[chan] >> ADS1115_IMUX0 );
+    
+    return adc_config_save( chan );
+}
+
+int32_t param_get_adc_mux( const param_desc_t *param )
+{
+    return adc_muxes[PARAM_CHAN( param->id )] >> ADS1115_IMUX0;
+}
+
+err param_set_adc_mux( const param_desc_t *param, int32_t value )
+{
+    uint8_t chan = PARAM_CHAN( param->id );
+    
+    adc_config_set( chan, adc_datarates[chan] >> ADS1115_DR0, adc_gain_settings[chan], value );
+    
+    return adc_config_save( chan );
+}
+
+err param_set_flow_resolution( const param_desc_t *param, int32_t value )
+{
+    /* Written to the sensor before the next flow reads */
+    uint8_t chan = PARAM_CHAN( param->id );
+    
+    flow_resolution[chan] = value;
+    flow_sensor_config_pending |= 1 << chan;
+    
+    return ERR_OK;
+}
+
+err param_set_flow_res_ref( const param_desc_t *param, int32_t value )
+{
+    /* A new reference starts the clog and leak watch again from OK */
+    uint8_t chan = PARAM_CHAN( param->id );
+    
+    flow_res_ref[chan] = value;
+    flow_res_state[chan] = FLOW_RES_STATE_OK;
+    flow_res_count[chan] = 0;
+    
+    return ERR_OK;
+}
+
+err param_set_flow_est_shift( const param_desc_t *param, int32_t value )
+{
+    /* The estimate starts again from the next reading */
+    uint8_t chan = PARAM_CHAN( param->id );
+    
+    flow_est_shift[chan] = value;
+    flow_est_age[chan] = FLOW_EST_AGE_MAX + 1;
+    
+    return ERR_OK;
+}
+
+int32_t param_get_i2c_fast_plus( const param_desc_t *param )
+{
+    return i2c_bus_get_fast_plus();
+}
+
+err param_set_i2c_fast_plus( const param_desc_t *param, int32_t value )
+{
+    /* Only if every device on the bus takes 1 MHz, the PCA9544A and LG16 are 400 kHz parts */
+    i2c_bus_set_fast_plus( value != 0 );
+    
+    return ERR_OK;
+}
+
+#if PROBE_TRACE_PINS > 0
+err param_set_trace_mask( const param_desc_t *param, int32_t value )
+{
+    probe_trace_select( ( param->id == PARAM_ID_TRACE_MASK ) ? 0 : 1, value );
+    
+    return ERR_OK;
+}
+#endif
+
+/* Rows of the per channel parameters, PARAM_ROWS() repeats one for each channel */
+#define PARAM_ROW_FPID_P(c)                 { PARAM_ID_CHAN( PARAM_ID_FPID_P, c ), PARAM_TYPE_U16, PARAM_FLAG_STORED, 0, UINT16_MAX, &fpid_config[c].kp, NULL, param_set_fpid },
+#define PARAM_ROW_FPID_I(c)                 { PARAM_ID_CHAN( PARAM_ID_FPID_I, c ), PARAM_TYPE_U16, PARAM_FLAG_STORED, 0, UINT16_MAX, &fpid_config[c].ki, NULL, param_set_fpid },
+#define PARAM_ROW_FPID_D(c)                 { PARAM_ID_CHAN( PARAM_ID_FPID_D, c ), PARAM_TYPE_U16, PARAM_FLAG_STORED, 0, UINT16_MAX, &fpid_config[c].kd, NULL, param_set_fpid },
+#define PARAM_ROW_PPID_P(c)                 { PARAM_ID_CHAN( PARAM_ID_PPID_P, c ), PARAM_TYPE_U16, PARAM_FLAG_STORED, 0, UINT16_MAX, &ppid_config[c].kp, NULL, param_set_ppid },
+#define PARAM_ROW_PPID_I(c)                 { PARAM_ID_CHAN( PARAM_ID_PPID_I, c ), PARAM_TYPE_U16, PARAM_FLAG_STORED, 0, UINT16_MAX, &ppid_config[c].ki, NULL, param_set_ppid },
+#define PARAM_ROW_PPID_D(c)                 { PARAM_ID_CHAN( PARAM_ID_PPID_D, c ), PARAM_TYPE_U16, PARAM_FLAG_STORED, 0, UINT16_MAX, &ppid_config[c].kd, NULL, param_set_ppid },
+#define PARAM_ROW_ADC_DATARATE(c)           { PARAM_ID_CHAN( PARAM_ID_ADC_DATARATE, c ), PARAM_TYPE_U8, PARAM_FLAG_STORED, 0, DATARATE_860SPS >> ADS1115_DR0, NULL, param_get_adc_datarate, param_set_adc_datarate },
+#define PARAM_ROW_ADC_GAIN(c)               { PARAM_ID_CHAN( PARAM_ID_ADC_GAIN, c ), PARAM_TYPE_U8, PARAM_FLAG_STORED, 0, ADC_GAIN_AUTO, NULL, param_get_adc_gain, param_set_adc_gain },
+#define PARAM_ROW_ADC_MUX(c)                { PARAM_ID_CHAN( PARAM_ID_ADC_MUX, c ), PARAM_TYPE_U8, PARAM_FLAG_STORED, 0, MUX_AIN3_GND >> ADS1115_IMUX0, NULL, param_get_adc_mux, param_set_adc_mux },
+#define PARAM_ROW_FLOW_FF_R(c)              { PARAM_ID_CHAN( PARAM_ID_FLOW_FF_R, c ), PARAM_TYPE_U16, 0, 0, UINT16_MAX, &flow_ff_r[c], NULL, NULL },
+#define PARAM_ROW_FLOW_RAW_ACTUAL(c)        { PARAM_ID_CHAN( PARAM_ID_FLOW_RAW_ACTUAL, c ), PARAM_TYPE_I16, PARAM_FLAG_READ_ONLY, INT16_MIN, INT16_MAX, (void *)&flow_raw_actual[c], NULL, NULL },
+#define PARAM_ROW_FLOW_RESOLUTION(c)        { PARAM_ID_CHAN( PARAM_ID_FLOW_RESOLUTION, c ), PARAM_TYPE_U8, 0, SENSIRION_RES_BITS_MIN, SENSIRION_RES_BITS_MAX, &flow_resolution[c], NULL, param_set_flow_resolution },
+#define PARAM_ROW_FLOW_CRC_CHECK(c)         { PARAM_ID_CHAN( PARAM_ID_FLOW_CRC_CHECK, c ), PARAM_TYPE_U8, 0, 0, 1, &flow_crc_check[c], NULL, NULL },
+#define PARAM_ROW_FLOW_CRC_ERRORS(c)        { PARAM_ID_CHAN( PARAM_ID_FLOW_CRC_ERRORS, c ), PARAM_TYPE_U16, PARAM_FLAG_READ_ONLY, 0, UINT16_MAX, &flow_crc_errors[c], NULL, NULL },
+#define PARAM_ROW_FLOW_FLAGS_GATE(c)        { PARAM_ID_CHAN( PARAM_ID_FLOW_FLAGS_GATE, c ), PARAM_TYPE_U8, 0, 0, 1, &flow_flags_gate[c], NULL, NULL },
+#define PARAM_ROW_FLOW_AIR_EVENTS(c)        { PARAM_ID_CHAN( PARAM_ID_FLOW_AIR_EVENTS, c ), PARAM_TYPE_U16, PARAM_FLAG_READ_ONLY, 0, UINT16_MAX, &flow_air_events[c], NULL, NULL },
+#define PARAM_ROW_FLOW_HIGH_EVENTS(c)       { PARAM_ID_CHAN( PARAM_ID_FLOW_HIGH_EVENTS, c ), PARAM_TYPE_U16, PARAM_FLAG_READ_ONLY, 0, UINT16_MAX, &flow_high_events[c], NULL, NULL },
+#define PARAM_ROW_FLOW_RES_R(c)             { PARAM_ID_CHAN( PARAM_ID_FLOW_RES_R, c ), PARAM_TYPE_U16, PARAM_FLAG_READ_ONLY, 0, UINT16_MAX, &flow_res_r[c], NULL, NULL },
+#define PARAM_ROW_FLOW_RES_REF(c)           { PARAM_ID_CHAN( PARAM_ID_FLOW_RES_REF, c ), PARAM_TYPE_U16, 0, 0, UINT16_MAX, &flow_res_ref[c], NULL, param_set_flow_res_ref },
+#define PARAM_ROW_FLOW_RES_STATE(c)         { PARAM_ID_CHAN( PARAM_ID_FLOW_RES_STATE, c ), PARAM_TYPE_U8, PARAM_FLAG_READ_ONLY, 0, FLOW_RES_STATE_LEAK, &flow_res_state[c], NULL, NULL },
+#define PARAM_ROW_PRESSURE_LIMIT(c)         { PARAM_ID_CHAN( PARAM_ID_PRESSURE_LIMIT, c ), PARAM_TYPE_U16, PARAM_FLAG_STORED, 0, PRESSURE_LIMIT_MAX_MBAR, &pressure_limit_mbar[c], NULL, param_set_pressure_limit },
+#define PARAM_ROW_PRESSURE_TRIPS(c)         { PARAM_ID_CHAN( PARAM_ID_PRESSURE_TRIPS, c ), PARAM_TYPE_U16, PARAM_FLAG_READ_ONLY, 0, UINT16_MAX, &pressure_trips[c], NULL, NULL },
+#define PARAM_ROW_ADC_BURST(c)              { PARAM_ID_CHAN( PARAM_ID_ADC_BURST, c ), PARAM_TYPE_U8, PARAM_FLAG_STORED, 1, ADC_BURST_MAX, &adc_bursts[c], NULL, param_set_adc_burst },
+#define PARAM_ROW_PRESSURE_CAL_ZERO(c)      { PARAM_ID_CHAN( PARAM_ID_PRESSURE_CAL_ZERO, c ), PARAM_TYPE_I16, PARAM_FLAG_STORED, -PRESSURE_CAL_ZERO_MAX, PRESSURE_CAL_ZERO_MAX, &pressure_cal_zero[c], NULL, param_set_pressure_cal_zero },
+#define PARAM_ROW_PRESSURE_CAL_TRIM(c)      { PARAM_ID_CHAN( PARAM_ID_PRESSURE_CAL_TRIM, c ), PARAM_TYPE_I16, PARAM_FLAG_STORED, INT8_MIN, INT8_MAX, NULL, param_get_pressure_cal_trim, param_set_pressure_cal_trim },
+#define PARAM_ROW_FLOW_EST_SHIFT(c)         { PARAM_ID_CHAN( PARAM_ID_FLOW_EST_SHIFT, c ), PARAM_TYPE_U8, 0, 0, FLOW_EST_SHIFT_MAX, &flow_est_shift[c], NULL, param_set_flow_est_shift },
+
+const param_desc_t params[] =
+{
+    /* Id, type, flags, min, max, value, get, set */
+    { PARAM_ID_ADC_PERIOD_MS,       PARAM_TYPE_U16, 0,                    ADC_PERIOD_MS_MIN,      UINT16_MAX,                     &adc_period_ms,              NULL, param_set_adc_period_ms },
+    { PARAM_ID_I2C_FAST_PLUS,       PARAM_TYPE_U8,  0,                    0,                      1,                              NULL,                        param_get_i2c_fast_plus, param_set_i2c_fast_plus },
+    { PARAM_ID_FLOW_MONITOR_DIV,    PARAM_TYPE_U8,  0,                    1,                      UINT8_MAX,                      &flow_monitor_div,           NULL, NULL },
+    { PARAM_ID_FLOW_RES_CLOG_PCT,   PARAM_TYPE_U8,  0,                    1,                      UINT8_MAX,                      &flow_res_clog_pct,          NULL, NULL },
+    { PARAM_ID_FLOW_RES_LEAK_PCT,   PARAM_TYPE_U8,  0,                    1,                      99,                             &flow_res_leak_pct,          NULL, NULL },
+    { PARAM_ID_LOOP_WARM_START,     PARAM_TYPE_U8,  0,                    0,                      1,                              &loop_warm_enable,           NULL, NULL },
+    { PARAM_ID_CTRL_EVENT,          PARAM_TYPE_U8,  0,                    0,                      1,                              &ctrl_event_enable,          NULL, NULL },
+    { PARAM_ID_MODULE_ADDR,         PARAM_TYPE_U8,  PARAM_FLAG_STORED,    0,                      SPI_MODULE_ADDR_ANY,            &spi_module_addr,            NULL, param_set_module_addr },
+    { PARAM_ID_RETAIN_STATUS,       PARAM_TYPE_U8,  PARAM_FLAG_READ_ONLY, 0,                      RETAIN_STATUS_LOST,             &retain_status,              NULL, NULL },
+#if PROBE_TRACE_PINS > 0
+    { PARAM_ID_TRACE_MASK,          PARAM_TYPE_U16, 0,                    0,                      ( 1U << TRACE_COUNT ) - 1,      (void *)&probe_trace_mask[0], NULL, param_set_trace_mask },
+#endif
+#if PROBE_TRACE_PINS > 1
+    { PARAM_ID_TRACE_MASK1,         PARAM_TYPE_U16, 0,                    0,                      ( 1U << TRACE_COUNT ) - 1,      (void *)&probe_trace_mask[1], NULL, param_set_trace_mask },
+#endif
+    PARAM_ROWS( PARAM_ROW_FPID_P )
+    PARAM_ROWS( PARAM_ROW_FPID_I )
+    PARAM_ROWS( PARAM_ROW_FPID_D )
+    PARAM_ROWS( PARAM_ROW_PPID_P )
+    PARAM_ROWS( PARAM_ROW_PPID_I )
+    PARAM_ROWS( PARAM_ROW_PPID_D )
+    PARAM_ROWS( PARAM_ROW_ADC_DATARATE )
+    PARAM_ROWS( PARAM_ROW_ADC_GAIN )
+    PARAM_ROWS( PARAM_ROW_ADC_MUX )
+    PARAM_ROWS( PARAM_ROW_FLOW_FF_R )
+    PARAM_ROWS( PARAM_ROW_FLOW_RAW_ACTUAL )
+    PARAM_ROWS( PARAM_ROW_FLOW_RESOLUTION )
+    PARAM_ROWS( PARAM_ROW_FLOW_CRC_CHECK )
+    PARAM_ROWS( PARAM_ROW_FLOW_CRC_ERRORS )
+    PARAM_ROWS( PARAM_ROW_FLOW_FLAGS_GATE )
+    PARAM_ROWS( PARAM_ROW_FLOW_AIR_EVENTS )
+    PARAM_ROWS( PARAM_ROW_FLOW_HIGH_EVENTS )
+    PARAM_ROWS( PARAM_ROW_FLOW_RES_R )
+    PARAM_ROWS( PARAM_ROW_FLOW_RES_REF )
+    PARAM_ROWS( PARAM_ROW_FLOW_RES_STATE )
+    PARAM_ROWS( PARAM_ROW_PRESSURE_LIMIT )
+    PARAM_ROWS( PARAM_ROW_PRESSURE_TRIPS )
+    PARAM_ROWS( PARAM_ROW_ADC_BURST )
+    PARAM_ROWS( PARAM_ROW_PRESSURE_CAL_ZERO )
+    PARAM_ROWS( PARAM_ROW_PRESSURE_CAL_TRIM )
+    PARAM_ROWS( PARAM_ROW_FLOW_EST_SHIFT )
+};
+
+err parse_packet_param_list( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+{
+    /* Data: [Start U8] optional, index into the table */
+    /* Return: [err U8][Total U8][Count U8] + Count x [Id U8][Type U8][Flags U8][Min 16][Max 16] */
+    
+    err rc = ERR_OK;
+    uint8_t return_buf[ sizeof(err) + PARAM_LIST_SIZE ];
+    uint8_t size;
+    
+    if ( packet_data_size > 1 )
+        rc = ERR_PACKET_INVALID;
+    else
+    {
+        size = param_list( ( packet_data_size == 1 ) ? packet_data[0] : 0, &return_buf[1] );
+        
+        return_buf[0] = ERR_OK;
+        spi_packet_write( packet_type, return_buf, sizeof(err) + size );
+    }
+    
+    return rc;
+}
+
+err parse_packet_param_get_many( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+{
+    /* Data: n x [Id U8] */
+    /* Return: [err U8] + n x [Id U8][Value 16] */
+    
+    err rc = ERR_OK;
+    uint8_t return_buf[ sizeof(err) + ( PARAM_MANY_MAX * PARAM_VALUE_RECORD_SIZE ) ];
+    
+    rc = param_get_many( packet_data, packet_data_size, &return_buf[1] );
+    
+    if ( rc == ERR_OK )
+    {
+        return_buf[0] = ERR_OK;
+        spi_packet_write( packet_type, return_buf, sizeof(err) + ( packet_data_size * PARAM_VALUE_RECORD_SIZE ) );
+    }
+    
+    return rc;
+}
+
+err parse_packet_param_set_many( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+{
+    /* Data: n x [Id U8][Value 16] */
+    /* Return: [err U8] */
+    
+    err rc = ERR_OK;
+    
+    rc = param_set_many( packet_data, packet_data_size );
+    
+    if ( rc == ERR_OK )
+        spi_packet_write( packet_type, &rc, 1 );
+    
+    return rc;
+}
+
+err parse_packet_get_fault_log( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+{
+    /* Data: [Index U16] optional, 0 for the newest record */
+    /* Return: [err U8][Total U16][Pending U8][Count U8] + Count x [Record 16], newest first */
+    
+    err rc = ERR_OK;
+    uint8_t return_buf[ sizeof(err) + FAULT_LIST_SIZE ];
+    uint8_t size;
+    
+    if ( ( packet_data_size != 0 ) && ( packet_data_size != 2 ) )
+        rc = ERR_PACKET_INVALID;
+    else
+    {
+        size = fault_list( ( packet_data_size == 2 ) ? ( ( packet_data[1] << 8 ) | packet_data[0] ) : 0, &return_buf[1] );
+        
+        return_buf[0] = ERR_OK;
+        spi_packet_write( packet_type, return_buf, sizeof(err) + size );
+    }
+    
+    return rc;
+}
+
+err parse_packet_set_signal_filter( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+{
+    /* Data: n*[ [Controller Mask U8][Signal U8][b0 I16][b1 I16][b2 I16][a1 I16][a2 I16] ], none to query */
+    /* Return: [err U8]Nx[ Pressure [b0..a2 I16], Flow [b0..a2 I16] ] */
+    
+    err rc = ERR_OK;
+    uint8_t *data_ptr = packet_data;
+    uint8_t chan_mask;
+    uint8_t chan;
+    uint8_t signal;
+    uint8_t i;
+    filter_coeffs_t coeffs;
+    int16_t *coeff_ptr;
+    int16_t data_size = packet_data_size;
+    uint8_t return_buf[ sizeof(err) + ( NUM_PRESSURE_CLTRLS * FILTER_SIGNALS * FILTER_COEFFS_SIZE ) ];
+    uint8_t *return_buf_ptr;
+    
+    while ( ( data_size >= ( 2 + FILTER_COEFFS_SIZE ) ) && ( rc == ERR_OK ) )
+    {
+        chan_mask = data_ptr[0];
+        signal = data_ptr[1];
+        coeff_ptr = (int16_t *)&coeffs;
+        for ( i = 0; i < ( FILTER_COEFFS_SIZE / sizeof(int16_t) ); i++ )
+            coeff_ptr[i] = ( data_ptr[3 + ( 2 * i )] << 8 ) | data_ptr[2 + ( 2 * i )];
+        data_ptr += 2 + FILTER_COEFFS_SIZE;
+        data_size -= 2 + FILTER_COEFFS_SIZE;
+        
+        if ( ( signal >= FILTER_SIGNALS ) || !filter_coeffs_valid( &coeffs ) )
+            rc = ERR_PACKET_INVALID;
+        else
+        {
+            /* The new filter starts settled at the present reading */
+            for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+            {
+                if ( chan_mask & 0x01 )
+                {
+                    signal_filters[chan][signal] = coeffs;
+                    signal_filter_on[chan][signal] = !filter_is_passthrough( &coeffs );
+                    filter_reset( &signal_filter_states[chan][signal],
+                                  ( signal == FILTER_SIGNAL_PRESSURE ) ? pressure_mbar_shl_actual[chan] : flow_raw_actual[chan] );
+                }
+                chan_mask >>= 1;
+            }
+        }
+    }
+    
+    if ( data_size != 0 )
+        rc = ERR_PACKET_INVALID;
+    
+    if ( rc == ERR_OK )
+    {
+        return_buf_ptr = return_buf;
+        *return_buf_ptr++ = ERR_OK;
+        
+        for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+        {
+            for ( signal=0; signal<FILTER_SIGNALS; signal++ )
+            {
+                coeff_ptr = (int16_t *)&signal_filters[chan][signal];
+                for ( i = 0; i < ( FILTER_COEFFS_SIZE / sizeof(int16_t) ); i++ )
+                {
+                    COPY_16BIT_TO_PTR( return_buf_ptr, coeff_ptr[i] );
+                    return_buf_ptr += sizeof(int16_t);
+                }
+            }
+        }
+        
+        spi_packet_write( packet_type, return_buf, sizeof(return_buf) );
+    }
+    
+    return rc;
+}
+
+err parse_packet_set_adc_config( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+{
+    /* Data: n*[ [Controller Mask U8][Data rate U8, 0-7][Gain U8, PGA 0-5 or 7 auto][Mux U8, 0-7] ], none to query */
+    /* Return: [err U8]Nx[ [Data rate U8][Gain U8][Mux U8][Gain in use U8, PGA 0-5] ] */
+    
+    err rc = ERR_OK;
+    uint8_t *data_ptr = packet_data;
+    uint8_t chan_mask;
+    uint8_t chan;
+    int16_t data_size = packet_data_size;
+    uint8_t return_buf[ sizeof(err) + ( NUM_PRESSURE_CLTRLS * 4 ) ];
+    
+    while ( ( data_size >= 4 ) && ( rc == ERR_OK ) )
+    {
+        if ( !adc_config_valid( data_ptr[1], data_ptr[2], data_ptr[3] ) )
+            rc = ERR_PACKET_INVALID;
+        else
+        {
+            chan_mask = data_ptr[0];
+            for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+            {
+                if ( chan_mask & 0x01 )
+                {
+                    adc_config_set( chan, data_ptr[1], data_ptr[2], data_ptr[3] );
+                    rc = adc_config_save( chan );
+                }
+                chan_mask >>= 1;
+            }
+        }
+        data_ptr += 4;
+        data_size -= 4;
+    }
+    
+    if ( data_size != 0 )
+        rc = ERR_PACKET_INVALID;
+    
+    if ( rc == ERR_OK )
+    {
+        return_buf[0] = ERR_OK;
+        for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+        {
+            return_buf[sizeof(err)+(chan*4)+0] = adc_datarates[chan] >> ADS1115_DR0;
+            return_buf[sizeof(err)+(chan*4)+1] = adc_gain_settings[chan];
+            return_buf[sizeof(err)+(chan*4)+2] = adc_muxes[chan] >> ADS1115_IMUX0;
+            return_buf[sizeof(err)+(chan*4)+3] = adc_gains[chan] >> ADS1115_PGA0;
+        }
+        
+        spi_packet_write( packet_type, return_buf, sizeof(return_buf) );
+    }
+    
+    return rc;
+}
+
+err parse_packet_get_boot_status( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+{
+    /* Return: [err U8][Booting U8][Flow present mask U8][Boot ms U16] */
+    
+    uint8_t return_buf[ sizeof(err) + 2 + sizeof(uint16_t) ];
+    uint8_t present = 0;
+    uint8_t chan;
+    
+    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+        if ( flow_present[chan] )
+            present |= 1 << chan;
+    
+    return_buf[0] = ERR_OK;
+    return_buf[1] = ( flow_boot_pending != 0 );
+    return_buf[2] = present;
+    COPY_16BIT_TO_PTR( &return_buf[3], boot_ms );
+    
+    spi_packet_write( packet_type, return_buf, sizeof(return_buf) );
+    
+    return ERR_OK;
+}
+
+err parse_packet_get_i2c_stats( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+{
+    /* Data: [Reset U8] optional */
+    /* Return: [err U8] 3 x ([Transfers U32][NACKs U16][Errors U16][Timeouts U16][Aborts U16]) for the
+     * ADS1115, PCA9544A and flow sensors, then [Recoveries U16][Recovery fails U16][Clock kHz U16] */
+    
+    uint8_t return_buf[ sizeof(err) + I2C_BUS_REPORT_SIZE ];
+    
+    return_buf[0] = ERR_OK;
+    i2c_bus_report( &return_buf[1], ( packet_data_size == 1 ) && packet_data[0] );
+    
+    spi_packet_write( packet_type, return_buf, sizeof(return_buf) );
+    
+    return ERR_OK;
+}
+
+#ifdef BENCH_ENABLED
+/* Benchmark kernels on canned inputs, see bench_port.h. The results go to bench_sink so the
+ * compiler keeps the work. The PID kernels step their own state on channel 0's gains. */
+volatile int32_t bench_sink;
+pid_state_t bench_pid_state;
+
+void bench_flow_pid( void )
+{
+    bench_sink = fpid_step( &fpid_config[0], &bench_pid_state, 1000, 1000, 2000, 0 );
+}
+
+void bench_pressure_pid( void )
+{
+    bench_sink = ppid_step( &ppid_config[0], &bench_pid_state, 1000, 1000, 2000, 0 );
+}
+
+const bench_kernel_t bench_kernels[BENCH_COUNT] =
+{
+    [BENCH_NULL]           = bench_null,
+    [BENCH_FRAME_CHECKSUM] = bench_frame_checksum,
+    [BENCH_FRAME_CRC]      = bench_frame_crc,
+    [BENCH_FLOW_PID]       = bench_flow_pid,
+    [BENCH_PRESSURE_PID]   = bench_pressure_pid,
+};
+
+err parse_packet_benchmark( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+{
+    /* Data: [Kernel U8][Runs U16] */
+    /* Return: [err U8][Kernels U8][Kernel U8][Runs U16][Timer Hz U32][CPU Hz U32][Total ticks U32]
+     * [Min ticks U16][Max ticks U16], see rio_bench.h. The main loop waits for all the runs. */
+    
+    uint8_t return_buf[ sizeof(err) + BENCH_REPORT_SIZE ];
+    uint16_t runs = packet_data[1] | ( (uint16_t)packet_data[2] << 8 );
+    
+    if ( ( packet_data[0] >= BENCH_COUNT ) || ( runs == 0 ) || ( runs > BENCH_RUNS_MAX ) )
+        return ERR_PACKET_INVALID;
+    
+    pid_reset( &bench_pid_state, 0 );
+    return_buf[0] = ERR_OK;
+    bench_run( packet_data[0], runs, &return_buf[1] );
+    
+    spi_packet_write( packet_type, return_buf, sizeof(return_buf) );
+    
+    return ERR_OK;
+}
+#endif
+
+err flow_autotune_start( uint8_t chan, int16_t target_raw, uint16_t delta );
+
+err parse_packet_get_latency_stats( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+{
+    /* Data: [Channel U8][Reset U8], reset optional */
+    /* Return: [err U8][Loops U8][Channel U8][Period us U32], then the latency and the period, each
+     * [Count U32][Min us U32][Max us U32][Mean us U32] + LATENCY_BINS x [Count U16], see rio_latency.h */
+    
+    uint8_t return_buf[ sizeof(err) + LATENCY_REPORT_SIZE ];
+    
+    if ( packet_data[0] >= LATENCY_COUNT )
+        return ERR_PACKET_INVALID;
+    
+    return_buf[0] = ERR_OK;
+    latency_report( &return_buf[1], LATENCY_CHAN0 + packet_data[0], ( packet_data_size == 2 ) && packet_data[1] );
+    
+    spi_packet_write( packet_type, return_buf, sizeof(return_buf) );
+    
+    return ERR_OK;
+}
+
+err parse_packet_set_flow_autotune( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+{
+    /* Data: [Controller Mask U8][Run U8][Flow ul/hr I16][Relay mbar U16], flow and relay optional, none to query */
+    /* Return: [err U8]Nx[ [State U8][Fail U8][Transitions U8][Settled U8] ] */
+    
+    err rc = ERR_OK;
+    uint8_t chan_mask = 0;
+    uint8_t run = 0;
+    uint8_t chan;
+    int16_t flow_ul_hr;
+    int16_t targets_raw[NUM_PRESSURE_CLTRLS];
+    uint16_t relay_mbar = FTUNE_DELTA_DEFAULT_MBAR;
+    uint8_t return_buf[ sizeof(err) + ( NUM_PRESSURE_CLTRLS * 4 ) ];
+    uint8_t *return_buf_ptr;
+    
+    if ( ( packet_data_size == 1 ) || ( packet_data_size == 3 ) || ( packet_data_size == 5 ) )
+        return ERR_PACKET_INVALID;
+    
+    if ( packet_data_size >= 2 )
+    {
+        chan_mask = packet_data[0];
+        run = packet_data[1];
+    }
+    if ( packet_data_size >= 6 )
+        relay_mbar = ( packet_data[5] << 8 ) | packet_data[4];
+    if ( ( relay_mbar == 0 ) || ( relay_mbar > ( PRESSURE_CTLR_MBAR / 2 ) ) )
+        return ERR_PACKET_INVALID;
+    
+    /* Every masked channel is checked before any starts */
+    memcpy( targets_raw, flow_raw_target, sizeof(targets_raw) );
+    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+    {
+        if ( run && ( chan_mask & ( 1 << chan ) ) )
+        {
+            if ( !flow_present[chan] ||
+                 ( ( flow_ctrl_state[chan] != FLOW_CTRL_STATE_READY ) && ( flow_ctrl_state[chan] != FLOW_CTRL_STATE_RUNNING ) ) )
+            {
+                rc = ERR_ERROR;
+                continue;
+            }
+            if ( packet_data_size >= 4 )
+            {
+                flow_ul_hr = ( packet_data[3] << 8 ) | packet_data[2];
+                if ( flow_ul_hr > flow_ul_hr_max[chan] )
+                    return ERR_PACKET_INVALID;
+                targets_raw[chan] = constrain_i32( flow_conv( &flow_conv_raw[chan], flow_ul_hr ), INT16_MIN, INT16_MAX );
+            }
+            if ( targets_raw[chan] <= 0 )
+                return ERR_PACKET_INVALID;
+        }
+    }
+    
+    for ( chan=0; ( chan<NUM_PRESSURE_CLTRLS ) && ( rc == ERR_OK ); chan++ )
+    {
+        if ( chan_mask & ( 1 << chan ) )
+        {
+            if ( run )
+                rc = flow_autotune_start( chan, targets_raw[chan], relay_mbar << PRESSURE_SHL );
+            else if ( ftune[chan].state == FTUNE_STATE_RUNNING )
+                flow_autotune_stop( chan, FTUNE_STATE_ABORTED );
+        }
+    }
+    
+    if ( rc == ERR_OK )
+    {
+        return_buf_ptr = return_buf;
+        *return_buf_ptr++ = ERR_OK;
+        
+        for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+        {
+            *return_buf_ptr++ = ftune[chan].state;
+            *return_buf_ptr++ = ftune[chan].fail;
+            *return_buf_ptr++ = ftune[chan].cycles;
+            *return_buf_ptr++ = ftune[chan].settled;
+        }
+        
+        spi_packet_write( packet_type, return_buf, sizeof(return_buf) );
+    }
+    
+    return rc;
+}
+
+bool flow_sched_set( uint8_t chan, uint16_t *sched )
+{
+    /* Takes <sched>, as stored, for <chan> if its points rise in flow from 0. The slopes
+     * between points are worked out here, so flow_sched_gains() needs no divide. */
+    uint8_t count = sched[0];
+    uint16_t *point;
+    int32_t flow_step;
+    uint8_t i;
+    uint8_t k;
+    
+    if ( count > NUM_FLOW_SCHED_POINTS )
+        return false;
+    for ( i=0; i<count; i++ )
+    {
+        point = &sched[1 + ( 4 * i )];
+        if ( ( (int16_t)point[0] < 0 ) || ( ( i > 0 ) && ( (int16_t)point[0] <= (int16_t)point[-4] ) ) )
+            return false;
+    }
+    
+    if ( sched != flow_sched[chan] )
+        memcpy( flow_sched[chan], sched, sizeof(flow_sched[chan]) );
+    memset( flow_sched_slope[chan], 0, sizeof(flow_sched_slope[chan]) );
+    
+    for ( i=0; ( i + 1 ) < count; i++ )
+    {
+        point = &flow_sched[chan][1 + ( 4 * i )];
+        flow_step = (int32_t)(int16_t)point[4] - (int16_t)point[0];
+        for ( k=0; k<3; k++ )
+            flow_sched_slope[chan][i][k] = ( ( (int32_t)point[5 + k] - point[1 + k] ) << FLOW_SCHED_SLOPE_SHIFT ) / flow_step;
+    }
+    
+    return true;
+}
+
+void flow_sched_gains( uint8_t chan, int16_t setpoint_raw )
+{
+    /* The gains of fpid_sched_config[chan] for the flow setpoint: between two points on the
+     * line through them, below the first or above the last those of that point */
+    uint8_t count = flow_sched[chan][0];
+    int16_t flow = flow_raw_to_ul_hr( chan, setpoint_raw );
+    uint16_t *point;
+    uint16_t gains[3];
+    int32_t flow_step;
+    uint8_t i;
+    uint8_t k;
+    
+    for ( i=0; ( ( i + 1 ) < count ) && ( flow >= (int16_t)flow_sched[chan][1 + ( 4 * ( i + 1 ) )] ); i++ )
+        ;
+    point = &flow_sched[chan][1 + ( 4 * i )];
+    flow_step = (int32_t)flow - (int16_t)point[0];
+    
+    for ( k=0; k<3; k++ )
+    {
+        if ( ( ( i + 1 ) >= count ) || ( flow_step <= 0 ) )
+            gains[k] = point[1 + k];
+        else
+            gains[k] = constrain_i32( point[1 + k] + ( ( ( flow_sched_slope[chan][i][k] * flow_step ) + ( 1L << ( FLOW_SCHED_SLOPE_SHIFT - 1 ) ) ) >> FLOW_SCHED_SLOPE_SHIFT ),
+                                      0, UINT16_MAX );
+    }
+    
+    fpid_sched_config[chan].kp = gains[0];
+    fpid_sched_config[chan].ki = gains[1];
+    fpid_sched_config[chan].kd = gains[2];
+}
+
+err parse_packet_pressure_cal( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+{
+    /* Data: [Controller Mask U8][Samples U8] to start a zero capture, Samples 0 to stop one,
+     *       none to query. Each masked channel must be in CTRL_MODE_ZERO. */
+    /* Return: [err U8] Nx[ [Zero mbar I16 << PRESSURE_SHL][Span U16][State U8][Samples left U8] ],
+     *         pkt_pressure_cal_reply_t */
+    
+    uint8_t chan_mask = 0;
+    uint8_t samples = 0;
+    uint8_t chan;
+    pkt_pressure_cal_reply_t reply;
+    pkt_pressure_cal_reply_chan_t *reply_chan;
+    
+    if ( packet_data_size == 2 )
+    {
+        chan_mask = packet_data[0];
+        samples = packet_data[1];
+    }
+    else if ( packet_data_size != 0 )
+        return ERR_PACKET_INVALID;
+    
+    /* Every masked channel is checked before any starts */
+    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+    {
+        if ( samples && ( chan_mask & ( 1 << chan ) ) && ( ctrl_modes[chan] != CTRL_MODE_ZERO ) )
+            return ERR_ERROR;
+    }
+    
+    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+    {
+        if ( !( chan_mask & ( 1 << chan ) ) )
+            continue;
+        if ( samples )
+        {
+            pressure_cal_sum[chan] = 0;
+            pressure_cal_count[chan] = samples;
+            pressure_cal_left[chan] = samples;
+            pressure_cal_state[chan] = PCAL_STATE_RUNNING;
+        }
+        else if ( pressure_cal_state[chan] == PCAL_STATE_RUNNING )
+            pressure_cal_state[chan] = PCAL_STATE_ABORTED;
+    }
+    
+    reply.rc = ERR_OK;
+    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+    {
+        reply_chan = &reply.chan[chan];
+        reply_chan->zero = pressure_cal_zero[chan];
+        reply_chan->span = pressure_cal_span[chan];
+        reply_chan->state = pressure_cal_state[chan];
+        reply_chan->left = ( pressure_cal_state[chan] == PCAL_STATE_RUNNING ) ? pressure_cal_left[chan] : 0;
+    }
+    
+    spi_packet_write( packet_type, (uint8_t *)&reply, sizeof(reply) );
+    
+    return ERR_OK;
+}
+
+err parse_packet_set_flow_sched( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+{
+    /* Data: [Controller U8][Count U8] Count x [ [Flow ul/hr I16][PID_P U16][PID_I U16][PID_D U16] ], or [Controller U8] to query */
+    /* Return: [err U8][Count U8] NUM_FLOW_SCHED_POINTS x [ [Flow ul/hr I16][PID_P U16][PID_I U16][PID_D U16] ]
+     *         [PID_P U16][PID_I U16][PID_D U16] in use */
+    
+    err rc = ERR_OK;
+    uint8_t chan = packet_data[0];
+    uint8_t count;
+    uint16_t sched[STORE_FLOW_SCHED_WORDS];
+    uint8_t return_buf[ sizeof(err) + 1 + ( ( STORE_FLOW_SCHED_WORDS - 1 ) * sizeof(uint16_t) ) + ( 3 * sizeof(uint16_t) ) ];
+    uint8_t *return_buf_ptr;
+    uint8_t i;
+    
+    if ( chan >= NUM_PRESSURE_CLTRLS )
+        return ERR_PACKET_INVALID;
+    
+    if ( packet_data_size > 1 )
+    {
+        count = packet_data[1];
+        if ( ( count > NUM_FLOW_SCHED_POINTS ) || ( packet_data_size != ( 2 + ( count * 4 * sizeof(uint16_t) ) ) ) )
+            return ERR_PACKET_INVALID;
+        
+        memset( sched, 0, sizeof(sched) );
+        sched[0] = count;
+        for ( i=0; i<( count * 4 ); i++ )
+            sched[1 + i] = ( packet_data[3 + ( 2 * i )] << 8 ) | packet_data[2 + ( 2 * i )];
+        
+        if ( !flow_sched_set( chan, sched ) )
+            return ERR_PACKET_INVALID;
+        rc = store_save_flow_sched( chan, sched );
+    }
+    
+    if ( flow_sched[chan][0] != 0 )
+        flow_sched_gains( chan, flow_raw_setpoint[chan] );
+    else
+        fpid_sched_config[chan] = fpid_config[chan];
+    
+    return_buf_ptr = return_buf;
+    *return_buf_ptr++ = rc;
+    *return_buf_ptr++ = flow_sched[chan][0];
+    for ( i=1; i<STORE_FLOW_SCHED_WORDS; i++ )
+    {
+        COPY_16BIT_TO_PTR( return_buf_ptr, flow_sched[chan][i] );
+        return_buf_ptr += sizeof(uint16_t);
+    }
+    COPY_16BIT_TO_PTR( return_buf_ptr, fpid_sched_config[chan].kp );
+    return_buf_ptr += sizeof(uint16_t);
+    COPY_16BIT_TO_PTR( return_buf_ptr, fpid_sched_config[chan].ki );
+    return_buf_ptr += sizeof(uint16_t);
+    COPY_16BIT_TO_PTR( return_buf_ptr, fpid_sched_config[chan].kd );
+    
+    spi_packet_write( packet_type, return_buf, sizeof(return_buf) );
+    
+    return rc;
+}
+
+
+err parse_packet_batch( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size );
+err parse_packet_get_capabilities( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size );
+
+/* Indexed by packet type: [handler][data size min][data size max]. Handlers still check the layout within the bounds. */
+const spi_packet_entry_t packet_table[] =
+{
+    [PACKET_TYPE_GET_ID]              = { parse_packet_get_id,              0, 0 },
+    [PACKET_TYPE_SET_PRESSURE_TARGET] = { parse_packet_set_pressure_target, 0, SPI_PACKET_SIZE_ANY },
+    [PACKET_TYPE_GET_PRESSURE_TARGET] = { parse_packet_get_pressure_target, 0, 0 },
+    [PACKET_TYPE_GET_PRESSURE_ACTUAL] = { parse_packet_get_pressure_actual, 0, 0 },
+    [PACKET_TYPE_SET_FLOW_TARGET]     = { parse_packet_set_flow_target,     0, SPI_PACKET_SIZE_ANY },
+    [PACKET_TYPE_GET_FLOW_TARGET]     = { parse_packet_get_flow_target,     0, 0 },
+    [PACKET_TYPE_GET_FLOW_ACTUAL]     = { parse_packet_get_flow_actual,     0, 0 },
+    [PACKET_TYPE_SET_CONTROL_MODE]    = { parse_packet_set_control_mode,    0, SPI_PACKET_SIZE_ANY },
+    [PACKET_TYPE_GET_CONTROL_MODE]    = { parse_packet_get_control_mode,    0, 0 },
+    [PACKET_TYPE_SET_FPID_CONSTS]     = { parse_packet_set_fpid_consts,     0, SPI_PACKET_SIZE_ANY },
+    [PACKET_TYPE_GET_FPID_CONSTS]     = { parse_packet_get_fpid_consts,     0, 0 },
+    [PACKET_TYPE_GET_SPI_STATS]       = { parse_packet_get_spi_stats,       0, 1 },
+    [PACKET_TYPE_BATCH]               = { parse_packet_batch,               0, SPI_PACKET_SIZE_ANY },
+    [PACKET_TYPE_GET_STATUS_SNAPSHOT] = { parse_packet_get_status_snapshot, 0, 0 },
+    [PACKET_TYPE_SET_TELEMETRY]       = { parse_packet_set_telemetry,       1, 2 },
+    [PACKET_TYPE_GET_HISTORY]         = { parse_packet_get_history,         3, 3 },
+    [PACKET_TYPE_SET_LOOP_CONFIG]     = { parse_packet_set_loop_config,     0, 2 + NUM_PRESSURE_CLTRLS },
+    [PACKET_TYPE_GET_LOOP_STATS]      = { parse_packet_get_loop_stats,      0, 1 },
+    [PACKET_TYPE_SET_PPID_CONSTS]     = { parse_packet_set_ppid_consts,     0, SPI_PACKET_SIZE_ANY },
+    [PACKET_TYPE_GET_PPID_CONSTS]     = { parse_packet_get_ppid_consts,     0, 0 },
+    [PACKET_TYPE_SET_FLOW_FF]         = { parse_packet_set_flow_ff,         0, SPI_PACKET_SIZE_ANY },
+    [PACKET_TYPE_SET_PROFILE_POINTS]  = { parse_packet_set_profile_points,  2 + sizeof(profile_point_t), SPI_PACKET_SIZE_ANY },
+    [PACKET_TYPE_SET_PROFILE]         = { parse_packet_set_profile,         0, SPI_PACKET_SIZE_ANY },
+    [PACKET_TYPE_GET_PROBE_STATS]     = { parse_packet_get_probe_stats,     0, 1 },
+    [PACKET_TYPE_GET_EEPROM_STATUS]   = { parse_packet_get_eeprom_status,   0, 1 },
+    [PACKET_TYPE_PARAM_LIST]          = { parse_packet_param_list,          0, 1 },
+    [PACKET_TYPE_PARAM_GET_MANY]      = { parse_packet_param_get_many,      0, SPI_PACKET_SIZE_ANY },
+    [PACKET_TYPE_PARAM_SET_MANY]      = { parse_packet_param_set_many,      0, SPI_PACKET_SIZE_ANY },
+    [PACKET_TYPE_GET_FAULT_LOG]       = { parse_packet_get_fault_log,       0, 2 },
+    [PACKET_TYPE_SET_SIGNAL_FILTER]   = { parse_packet_set_signal_filter,   0, SPI_PACKET_SIZE_ANY },
+    [PACKET_TYPE_SET_ADC_CONFIG]      = { parse_packet_set_adc_config,      0, SPI_PACKET_SIZE_ANY },
+    [PACKET_TYPE_ECHO]                = { parse_packet_echo,                0, SPI_PACKET_SIZE_ANY },
+    [PACKET_TYPE_SYNC_TIME]           = { parse_packet_sync_time,           0, 5 },
+    [PACKET_TYPE_SET_FRAME_SYNC]      = { parse_packet_set_frame_sync,      0, 2 },
+    [PACKET_TYPE_STAGE]               = { parse_packet_stage,               0, SPI_PACKET_SIZE_ANY },
+    [PACKET_TYPE_GET_CAPABILITIES]    = { parse_packet_get_capabilities,    0, 0 },
+    [PACKET_TYPE_GET_BOOT_STATUS]     = { parse_packet_get_boot_status,     0, 0 },
+    [PACKET_TYPE_GET_I2C_STATS]       = { parse_packet_get_i2c_stats,       0, 1 },
+    [PACKET_TYPE_SET_FLOW_AUTOTUNE]   = { parse_packet_set_flow_autotune,   0, 6 },
+    [PACKET_TYPE_SET_FLOW_SCHED]      = { parse_packet_set_flow_sched,      1, 2 + ( NUM_FLOW_SCHED_POINTS * 8 ) },
+    [PACKET_TYPE_GET_LATENCY_STATS]   = { parse_packet_get_latency_stats,   1, 2 },
+    [PACKET_TYPE_HISTORY_STREAM]      = { parse_packet_history_stream,      4, 5 },
+    [PACKET_TYPE_PRESSURE_CAL]        = { parse_packet_pressure_cal,        0, 2 },
+    [PACKET_TYPE_SUBSCRIBE]           = { parse_packet_subscribe,           0, SPI_PACKET_SIZE_ANY },
+    [PACKET_TYPE_FLASH]               = { parse_packet_flash,               1, SPI_PACKET_SIZE_ANY },
+#ifdef BENCH_ENABLED
+    [PACKET_TYPE_BENCHMARK]           = { parse_packet_benchmark,           3, 3 },
+#endif
+};
+
+err parse_packet( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+{
+    /* Runs one command, which writes its own reply. Returns non-zero if the caller must reply [err U8] instead */
+    
+    return spi_packet_dispatch( packet_table, sizeof(packet_table) / sizeof(packet_table[0]), packet_type, packet_data, packet_data_size );
+}
+
+err parse_packet_batch( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+{
+    /* Data: {[0][1][Module Address U8]} n*[ [Packet Type U8][Size U8][Data...] ] */
+    /* Return: [err U8] {[0][1][Module Address U8]} n*[ [Packet Type U8][Size U8][Reply...] ] */
+    /* An addressed batch runs only on the module of that address, see spi_module_addressed(),
+     * others reply [ERR_MODULE_ADDRESS]. Its reply starts with this module's address. */
+    
+    err rc = ERR_OK;
+    err sub_rc;
+    uint8_t addressed = 0;
+    uint8_t *data_ptr = packet_data;
+    int16_t data_size = packet_data_size;
+    
+    if ( ( data_size >= 3 ) && ( data_ptr[0] == 0 ) && ( data_ptr[1] == 1 ) )
+    {
+        if ( !spi_module_addressed( data_ptr[2] ) )
+            return ERR_MODULE_ADDRESS;
+        addressed = 1;
+        packet_data += 3;
+        packet_data_size -= 3;
+        data_ptr = packet_data;
+        data_size = packet_data_size;
+    }
+    
+    /* Check the whole batch before running any of it. No nesting. */
+    while ( ( rc == ERR_OK ) && ( data_size > 0 ) )
+    {
+        if ( ( data_size < 2 ) || ( ( 2 + data_ptr[1] ) > data_size ) || ( data_ptr[0] == 0 ) || ( data_ptr[0] == PACKET_TYPE_BATCH ) )
+            rc = ERR_PACKET_INVALID;
+        else
+        {
+            data_size -= 2 + data_ptr[1];
+            data_ptr += 2 + data_ptr[1];
+        }
+    }
+    
+    if ( rc == ERR_OK )
+    {
+        spi_batch_begin();
+        if ( addressed )
+            spi_packet_write( 0, &spi_module_addr, 1 );
+        
+        data_ptr = packet_data;
+        data_size = packet_data_size;
+        while ( data_size > 0 )
+        {
+            sub_rc = parse_packet( data_ptr[0], &data_ptr[2], data_ptr[1] );
+            if ( sub_rc != ERR_OK )
+                spi_packet_write( data_ptr[0], &sub_rc, 1 );
+            
+            data_size -= 2 + data_ptr[1];
+            data_ptr += 2 + data_ptr[1];
+        }
+        
+        rc = spi_batch_end( packet_type );
+    }
+    
+    return rc;
+}
+
+err parse_packet_get_capabilities( uint8_t packet_type, uint8_t *packet_data, uint8_t packet_data_size )
+{
+    /* Return: [err U8][spi_caps_report(), loop period as adc_period_ms][packet types, from packet_table] */
+    
+    uint8_t return_buf[ sizeof(err) + SPI_CAPS_REPORT_SIZE ];
+    
+    return_buf[0] = ERR_OK;
+    spi_caps_report( &return_buf[1], FIRMWARE_VERSION, (uint32_t)adc_period_ms * 1000 );
+    spi_caps_types( &return_buf[1 + SPI_CAPS_REPORT_SIZE - ( SPI_CAPS_TYPES / 8 )], packet_table, sizeof(packet_table) / sizeof(packet_table[0]) );
+    
+    spi_packet_write( packet_type, return_buf, sizeof(return_buf) );
+    
+    return ERR_OK;
+}
+
+void init( void )
+{
+    uint8_t chan;
+    uint8_t signal;
+    uint8_t gain;
+    
+    /* System Init */
+    eeprom_okay = false;
+    adc_okay = false;
+    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+        ctrl_modes[chan] = CTRL_MODE_ZERO;
+    
+    /* ADC Init */
+    adc_state = ADC_STATE_START;
+    adc_chan = 0;
+    adc_time = 0;
+    adc_period_ms = ADC_PERIOD_MS;
+    adc_config_defaults();
+    adc_burst_left = 0;
+    memset( adc_burst_sum, 0, sizeof(adc_burst_sum) );
+    memset( adc_burst_count, 0, sizeof(adc_burst_count) );
+    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+    {
+        pressure_cal_zero[chan] = 0;
+        pressure_cal_trim[chan] = 0;
+        pressure_cal_span[chan] = PRESSURE_CAL_SPAN_ONE;
+        pressure_cal_state[chan] = PCAL_STATE_DEFAULT;
+    }
+    for ( gain=0; gain<ADC_GAIN_CODES; gain++ )
+        flow_conv_init( &adc_conv[gain], PRESSURE_ADC_FSR_MBARSHL( ads1115_fsr_mv[gain] ), PRESSURE_ADC_MAX );
+    memset( &loop_stats, 0, sizeof(loop_stats) );
+    timer_ms = 0;
+    time_init();
+    loop_cycle_frame = 0;
+    frame_sync_mode = FRAME_SYNC_OFF;
+    frame_sync_divider = 1;
+    frame_sync_countdown = 1;
+    frame_sync_count = 0;
+    frame_sync_frame = 0;
+    frame_sync_missed = 0;
+    adc_read_pending = 0;
+    ctrl_event_enable = 0;
+    ctrl_event_cycle = 0;
+    ctrl_updated = CTRL_CHAN_ALL;
+    
+    /* Flow Read Init */
+    flow_read_state = FLOW_READ_IDLE;
+    flow_read_chan = 0;
+    flow_read_round = 0;
+    flow_monitor_div = FLOW_MONITOR_DIV_DEFAULT;
+    flow_mux_selected = FLOW_MUX_UNKNOWN;
+    memset( flow_read_rc, 0, sizeof(flow_read_rc) );
+    memset( flow_crc_errors, 0, sizeof(flow_crc_errors) );
+    memset( flow_crc_check, 1, sizeof(flow_crc_check) );
+    memset( flow_flags_gate, 1, sizeof(flow_flags_gate) );
+    memset( flow_flags, 0, sizeof(flow_flags) );
+    memset( flow_air_events, 0, sizeof(flow_air_events) );
+    memset( flow_high_events, 0, sizeof(flow_high_events) );
+    memset( flow_res_r, 0, sizeof(flow_res_r) );
+    memset( flow_res_ref, 0, sizeof(flow_res_ref) );
+    memset( flow_res_state, FLOW_RES_STATE_OK, sizeof(flow_res_state) );
+    memset( flow_res_count, 0, sizeof(flow_res_count) );
+    memset( flow_est_shift, 0, sizeof(flow_est_shift) );
+    memset( flow_raw_est, 0, sizeof(flow_raw_est) );
+    memset( flow_est_pressure, 0, sizeof(flow_est_pressure) );
+    memset( flow_est_age, FLOW_EST_AGE_MAX + 1, sizeof(flow_est_age) );
+    flow_res_clog_pct = FLOW_RES_CLOG_PCT_DEFAULT;
+    flow_res_leak_pct = FLOW_RES_LEAK_PCT_DEFAULT;
+    memset( flow_resolution, SENSIRION_RES_BITS_MAX, sizeof(flow_resolution) );
+    flow_sensor_config_pending = 0;
+    memset( flow_read_fails, 0, sizeof(flow_read_fails) );
+    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+    {
+        flow_probe_state[chan] = FLOW_PROBE_IDLE;
+        flow_probe_backoff_ms[chan] = FLOW_PROBE_BACKOFF_MIN_MS;
+    }
+    flow_probe_chan = NUM_PRESSURE_CLTRLS;
+    flow_boot_pending = 0;
+    boot_ms = 0;
+    
+    /* Pressure Control Init */
+    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+        pressure_ctrl_state[chan] = PRESSURE_CTRL_STATE_UNCONFIGURED;
+    memset( (void *)pressure_mbar_shl_output, 0, sizeof(pressure_mbar_shl_output) );
+    memset( (void *)pressure_mbar_shl_target, 0, sizeof(pressure_mbar_shl_target) );
+    memset( &status_snapshot, 0, sizeof(status_snapshot) );
+    telemetry_period = 0;
+    telemetry_count = 0;
+    telemetry_dropped = 0;
+    telemetry_format = RECORD_FORMAT_PLAIN;
+    history_head = 0;
+    history_count = 0;
+    memset( profiles, 0, sizeof(profiles) );
+    memset( (void *)pressure_mbar_shl_actual, 0, sizeof(pressure_mbar_shl_actual) );
+    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+    {
+        pressure_ctrl_state[chan] = PRESSURE_CTRL_STATE_READY;
+        ppid_config[chan].kp = PPID_DEFAULT_P;
+        ppid_config[chan].ki = PPID_DEFAULT_I;
+        ppid_config[chan].kd = PPID_DEFAULT_D;
+        ppid_config[chan].p_limit = PPID_TERM_LIMIT;
+        ppid_config[chan].d_limit = PPID_TERM_LIMIT;
+        ppid_config[chan].i_change_limit = PPID_I_CHANGE_LIMIT;
+        ppid_config[chan].i_min = -PPID_TERM_LIMIT;
+        ppid_config[chan].i_max = PPID_TERM_LIMIT;
+        ppid_config[chan].out_min = 0;
+        ppid_config[chan].out_max = (int32_t)PRESSURE_CTLR_MBAR << PRESSURE_SHL;
+    }
+    memset( ppid_loop, 0, sizeof(ppid_loop) );
+    memset( flow_cascade_setpoint, 0, sizeof(flow_cascade_setpoint) );
+    memset( pressure_limit_mbar, 0, sizeof(pressure_limit_mbar) );
+    memset( pressure_trips, 0, sizeof(pressure_trips) );
+    loop_warm_enable = 1;
+    memset( loop_warm, EEPROM_BLANK_U8, sizeof(loop_warm) );
+    memset( loop_warm_cycles, 0, sizeof(loop_warm_cycles) );
+    memset( loop_warm_cycles_target, 0, sizeof(loop_warm_cycles_target) );
+    memset( flow_out_map, 0, sizeof(flow_out_map) );
+    memset( flow_out_map_hold, 0, sizeof(flow_out_map_hold) );
+    
+    /* Flow Control Init */
+    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+    {
+        flow_ctrl_state[chan] = FLOW_CTRL_STATE_UNCONFIGURED;
+        fpid_config[chan].kp = FPID_DEFAULT_P;
+        fpid_config[chan].ki = FPID_DEFAULT_I;
+        fpid_config[chan].kd = FPID_DEFAULT_D;
+        fpid_config[chan].p_limit = FPID_P_TERM_LIMIT;
+        fpid_config[chan].d_limit = FPID_D_TERM_LIMIT;
+        fpid_config[chan].i_change_limit = FPID_I_CHANGE_LIMIT;
+        fpid_config[chan].i_min = -FPID_I_LIMIT;
+        fpid_config[chan].i_max = FPID_I_LIMIT;
+        fpid_config[chan].out_min = -FPID_OUTPUT_SLEW_LIMIT;
+        fpid_config[chan].out_max = FPID_OUTPUT_SLEW_LIMIT;
+        fpid_sched_config[chan] = fpid_config[chan];
+    }
+    memset( flow_sched, 0, sizeof(flow_sched) );
+    memset( flow_sched_slope, 0, sizeof(flow_sched_slope) );
+    memset( (void *)flow_raw_target, 0, sizeof(flow_raw_target) );
+    memset( flow_raw_setpoint, 0, sizeof(flow_raw_setpoint) );
+    memset( flow_ramp_raw, 0, sizeof(flow_ramp_raw) );
+    memset( flow_ff_r, 0, sizeof(flow_ff_r) );
+    memset( flow_ff_flags, 0, sizeof(flow_ff_flags) );
+    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+    {
+        for ( signal=0; signal<FILTER_SIGNALS; signal++ )
+        {
+            filter_passthrough( &signal_filters[chan][signal] );
+            signal_filter_on[chan][signal] = false;
+        }
+    }
+    memset( (void *)flow_raw_actual, 0, sizeof(flow_raw_actual) );
+    memset( fpid_loop, 0, sizeof(fpid_loop) );
+    memset( fpid_terms, 0, sizeof(fpid_terms) );
+    memset( ftune, 0, sizeof(ftune) );
+    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+        flow_ctrl_state[chan] = FLOW_CTRL_STATE_READY;
+}
+
+void adc_read_start( int8_t read_chan, int8_t start_chan )
+{
+    /* Queues the read back of ADC input <read_chan> and the start of <start_chan>, -1 for
+     * none, with the config of its pressure channel. Also called from the ADC_RDY interrupt.
+     * The two are on different ADS1115s where the sequence crosses into the next bank. */
+    uint8_t read_addr = ADC_INPUT_ADDR( ( read_chan < 0 ) ? 0 : read_chan );
+    uint8_t chan;
+    
+    if ( start_chan < 0 )
+    {
+        ads1115_read_adc_start( read_addr, read_chan, read_addr, -1, MUX_AIN0_GND, DATARATE_128SPS, FSR_6_144, &adc_task );
+        return;
+    }
+    
+    /* The conversions of a burst keep the gain of its first, so their codes can be averaged */
+    chan = adc_map[start_chan];
+    if ( start_chan != read_chan )
+        adc_gains_started[chan] = adc_gains[chan];
+    ads1115_read_adc_start( read_addr, read_chan, ADC_INPUT_ADDR( start_chan ), start_chan, adc_muxes[chan], adc_datarates[chan], adc_gains_started[chan], &adc_task );
+}
+
+void adc_sample_next( void )
+{
+    uint8_t read_chan = adc_chan;
+    
+    /* Read back ADC and start next channel, or the same one again for a burst */
+    if ( adc_burst_left > 0 )
+    {
+        adc_burst_left--;
+        adc_read_start( read_chan, read_chan );
+    }
+    else if ( read_chan >= ADC_CHAN_MAX )
+    {
+        /* Read last channel */
+        adc_read_start( read_chan, -1 );
+        adc_state = ADC_STATE_WAIT;
+    }
+    else
+    {
+        /* Read and start next */
+        adc_chan++;
+        adc_burst_left = adc_bursts[adc_map[adc_chan]] - 1;
+        adc_read_start( read_chan, adc_chan );
+    }
+    
+    adc_i2c_wait = 1;
+    TRACE_BEGIN( TRACE_I2C_WAIT );
+}
+
+void adc_rdy_isr( void )
+{
+    /* Conversion done: queue the read and the next start straight away, unless the previous
+     * transaction has not been returned yet, in which case the main loop picks it up */
+    if ( ( adc_state == ADC_STATE_SAMPLE ) && !adc_i2c_wait && !ADC_RDY_GetValue() )
+        adc_sample_next();
+}
+
+void adc_rdy_interrupt_init( void )
+{
+    /* INT1 on the falling edge of ADC_RDY, below the I2C2 interrupt so its transactions can run */
+    __builtin_write_RPCON( 0x0000 );    // unlock PPS
+    _INT1R = ADC_RDY_RP;
+    __builtin_write_RPCON( 0x0800 );    // lock PPS
+    _INT1EP = 1;
+    _INT1IP = 1;
+    _INT1IF = 0;
+    ADC_RDY_INT_ENABLE();
+}
+
+void __attribute__ ( ( interrupt, no_auto_psv ) ) _INT1Interrupt( void )
+{
+    PROBE_ISR_ENTER();
+    TRACE_BEGIN( TRACE_ISR_ADC_RDY );
+    adc_rdy_isr();
+    _INT1IF = 0;
+    TRACE_END( TRACE_ISR_ADC_RDY );
+    PROBE_ISR_EXIT();
+}
+
+void frame_sync_isr( void )
+{
+    /* Frame edge: every divider edges, start a cycle tagged with its frame number if none is
+     * running. A busy edge is counted as missed rather than starting a late sample. */
+    frame_sync_count++;
+    if ( --frame_sync_countdown != 0 )
+        return;
+    frame_sync_countdown = frame_sync_divider;
+    
+    if ( ( adc_state == ADC_STATE_WAIT ) && !adc_i2c_wait && !adc_cycle_done && ( frame_sync_frame == 0 ) )
+        frame_sync_frame = frame_sync_count;
+    else
+        frame_sync_missed += ( frame_sync_missed != 0xFFFF );
+}
+
+void frame_sync_interrupt_init( void )
+{
+    /* INT2 from the frame trigger, off until SET_FRAME_SYNC. Below the I2C2 interrupt, as INT1. */
+    FRAME_SYNC_INT_DISABLE();
+    __builtin_write_RPCON( 0x0000 );    // unlock PPS
+    _INT2R = FRAME_SYNC_RP;
+    __builtin_write_RPCON( 0x0800 );    // lock PPS
+    _INT2IP = 1;
+    _INT2IF = 0;
+}
+
+void __attribute__ ( ( interrupt, no_auto_psv ) ) _INT2Interrupt( void )
+{
+    PROBE_ISR_ENTER();
+    TRACE_BEGIN( TRACE_ISR_FRAME_SYNC );
+    frame_sync_isr();
+    _INT2IF = 0;
+    TRACE_END( TRACE_ISR_FRAME_SYNC );
+    PROBE_ISR_EXIT();
+}
+
+void __attribute__ ((weak)) timer_isr(void)
+{
+//    PORTAbits.RA1 = ( ( !PORTAbits.RA1 ) && OSCCONbits.LOCK ) ? 1 : 0;
+//    PORTAbits.RA1 = !PORTAbits.RA1;
+//    PORTAbits.RA1 = OSCCONbits.LOCK ? 1 : 0;
+//    PORTAbits.RA1 = OSCCONbits.OSWEN;
+    PROBE_ISR_ENTER();
+    TRACE_BEGIN( TRACE_ISR_TIMER );
+    timer_ms++;
+    time_tick();
+    TRACE_END( TRACE_ISR_TIMER );
+    PROBE_ISR_EXIT();
+}
+
+err storage_save_ppid_defaults( uint8_t chans )
+{
+    err rc = ERR_OK;
+    uint8_t chan;
+    uint16_t pid_consts[3] = {PPID_DEFAULT_P, PPID_DEFAULT_I, PPID_DEFAULT_D};
+    
+    /* Store default Pressure PID Constants */
+    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+    {
+        if ( ( rc == ERR_OK ) && ( chans & ( 1 << chan ) ) )
+           rc = store_save_ppid_consts( chan, pid_consts );
+    }
+    
+    return rc;
+}
+
+err storage_save_adc_defaults( uint8_t chans )
+{
+    err rc = ERR_OK;
+    uint8_t chan;
+    
+    /* Store the ADC configs of adc_config_defaults() */
+    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+    {
+        if ( ( rc == ERR_OK ) && ( chans & ( 1 << chan ) ) )
+           rc = adc_config_save( chan );
+    }
+    
+    return rc;
+}
+
+err storage_save_flow_sched_defaults( uint8_t chans )
+{
+    err rc = ERR_OK;
+    uint8_t chan;
+    uint16_t sched[STORE_FLOW_SCHED_WORDS];
+    
+    /* No schedule, the FPID constants apply */
+    memset( sched, 0, sizeof(sched) );
+    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+    {
+        if ( ( rc == ERR_OK ) && ( chans & ( 1 << chan ) ) )
+           rc = store_save_flow_sched( chan, sched );
+    }
+    
+    return rc;
+}
+
+err storage_save_pressure_cal_defaults( uint8_t chans )
+{
+    err rc = ERR_OK;
+    uint8_t chan;
+    
+    /* Zero 0, span 1 */
+    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+    {
+        if ( ( rc == ERR_OK ) && ( chans & ( 1 << chan ) ) )
+           rc = store_save_pressure_cal( chan, 0, 0 );
+    }
+    
+    return rc;
+}
+
+err storage_save_pressure_limit_defaults( uint8_t chans )
+{
+    err rc = ERR_OK;
+    uint8_t chan;
+    
+    /* No limit */
+    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+    {
+        if ( ( rc == ERR_OK ) && ( chans & ( 1 << chan ) ) )
+           rc = store_save_pressure_limit( chan, 0 );
+    }
+    
+    return rc;
+}
+
+void storage_save_defaults( uint8_t chans )
+{
+    err rc;
+    uint8_t chan;
+    uint16_t pid_consts[3] = {FPID_DEFAULT_P, FPID_DEFAULT_I, FPID_DEFAULT_D};
+    
+    /* Store EEPROM version */
+    rc = store_save_eeprom_ver( EEPROM_VER );
+    
+    /* Store default Flow PID Constants */
+    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+    {
+        if ( ( rc == ERR_OK ) && ( chans & ( 1 << chan ) ) )
+           rc = store_save_fpid_consts( chan, pid_consts );
+    }
+    
+    if ( rc == ERR_OK )
+        rc = storage_save_ppid_defaults( chans );
+    
+    if ( rc == ERR_OK )
+        rc = storage_save_adc_defaults( chans );
+    
+    if ( rc == ERR_OK )
+        rc = storage_save_flow_sched_defaults( chans );
+    
+    if ( rc == ERR_OK )
+        rc = storage_save_pressure_limit_defaults( chans );
+    
+    if ( rc == ERR_OK )
+        rc = storage_save_pressure_cal_defaults( chans );
+    
+    if ( ( rc == ERR_OK ) && ( store_flush_wait() != 0 ) )
+        rc = ERR_EEPROM_VERIFY_FAIL;
+    
+    printf( "Save Defaults %s\n", (rc==ERR_OK) ? "OK" : "FAIL" );
+}
+
+void storage_startup()
+{
+    E_STORE_SOURCE store_source;
+    uint8_t eeprom_ver;
+    uint8_t chan;
+    uint8_t bank;
+    uint16_t pid_consts[NUM_PRESSURE_CLTRLS][3];
+    uint16_t adc_configs[NUM_PRESSURE_CLTRLS];
+    uint16_t config;
+    uint16_t pressure_cal_zeros[NUM_PRESSURE_CLTRLS];
+    uint8_t pressure_cal_trims[NUM_PRESSURE_CLTRLS];
+
+    store_source = store_init();
+    printf( "EEPROM store %s\n", ( store_source == STORE_SOURCE_SLOT ) ? "valid" :
+                                  ( store_source == STORE_SOURCE_OLD_SLOT ) ? "older slots" :
+                                  ( store_source == STORE_SOURCE_LEGACY ) ? "older layout" : "blank or corrupt" );
+    store_load_eeprom_ver( &eeprom_ver );
+    printf( "EEPROM Version %hu\n", eeprom_ver );
+    
+    /* A bank added to a board with a store already has blank slots of its own */
+    if ( eeprom_ver != EEPROM_BLANK_U8 )
+    {
+        for ( bank=1; bank<NUM_PRESSURE_BANKS; bank++ )
+        {
+            if ( store_blank_banks() & ( 1 << bank ) )
+            {
+                printf( "Saving Defaults of bank %hu\n", bank );
+                storage_save_defaults( BANK_CHANS( bank ) );
+            }
+        }
+    }
+    
+    store_load_fpid_consts( (uint16_t *)pid_consts );
+    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+    {
+        fpid_config[chan].kp = pid_consts[chan][0];
+        fpid_config[chan].ki = pid_consts[chan][1];
+        fpid_config[chan].kd = pid_consts[chan][2];
+        printf( "Flow %hu PID Constants P %u I %u D %u\n", chan, fpid_config[chan].kp, fpid_config[chan].ki, fpid_config[chan].kd );
+    }
+    
+    if ( eeprom_ver == EEPROM_BLANK_U8 )
+    {
+        /* Blank EEPROM */
+        printf( "Saving Defaults\n" );
+        storage_save_defaults( CTRL_CHAN_ALL );
+    }
+    
+    if ( ( eeprom_ver >= 1 ) && ( eeprom_ver < EEPROM_VER ) )
+    {
+        /* Version 1 has no pressure PID constants, 2 no ADC configs, 3 no flow gain schedules,
+         * 4 no pressure limits, 5 no warm starts, 6 no module address, which start blank, and 7 no pressure
+         * calibrations */
+        printf( "Upgrading EEPROM to version %hu\n", EEPROM_VER );
+        if ( eeprom_ver == 1 )
+            storage_save_ppid_defaults( CTRL_CHAN_ALL );
+        if ( eeprom_ver <= 2 )
+            storage_save_adc_defaults( CTRL_CHAN_ALL );
+        if ( eeprom_ver <= 3 )
+            storage_save_flow_sched_defaults( CTRL_CHAN_ALL );
+        if ( eeprom_ver <= 4 )
+            storage_save_pressure_limit_defaults( CTRL_CHAN_ALL );
+        if ( eeprom_ver <= 7 )
+            storage_save_pressure_cal_defaults( CTRL_CHAN_ALL );
+        if ( store_flush_wait() == 0 )
+        {
+            store_save_eeprom_ver( EEPROM_VER );
+            store_flush_wait();
+        }
+    }
+    
+    /* Loaded after any defaults are saved */
+    store_load_ppid_consts( (uint16_t *)pid_consts );
+    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+    {
+        ppid_config[chan].kp = pid_consts[chan][0];
+        ppid_config[chan].ki = pid_consts[chan][1];
+        ppid_config[chan].kd = pid_consts[chan][2];
+        printf( "Pressure %hu PID Constants P %u I %u D %u\n", chan, ppid_config[chan].kp, ppid_config[chan].ki, ppid_config[chan].kd );
+    }
+    
+    /* A blank or unknown config keeps the default of adc_config_defaults() */
+    store_load_adc_configs( adc_configs );
+    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+    {
+        config = adc_configs[chan];
+        if ( ( ADC_CONFIG_UNUSED( config ) == 0 ) && adc_config_valid( ADC_CONFIG_DR( config ), ADC_CONFIG_GAIN( config ), ADC_CONFIG_MUX( config ) ) )
+        {
+            adc_config_set( chan, ADC_CONFIG_DR( config ), ADC_CONFIG_GAIN( config ), ADC_CONFIG_MUX( config ) );
+            adc_bursts[chan] = ADC_CONFIG_BURST( config );
+        }
+        printf( "Pressure %hu ADC data rate %hu gain %hu mux %hu burst %hu\n", chan, adc_datarates[chan] >> ADS1115_DR0, adc_gain_settings[chan], adc_muxes[chan] >> ADS1115_IMUX0, adc_bursts[chan] );
+    }
+    
+    /* A blank or invalid schedule is none */
+    store_load_flow_scheds( (uint16_t *)flow_sched );
+    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+    {
+        if ( !flow_sched_set( chan, flow_sched[chan] ) )
+        {
+            memset( flow_sched[chan], 0, sizeof(flow_sched[chan]) );
+            flow_sched_set( chan, flow_sched[chan] );
+        }
+        printf( "Flow %hu gain schedule %u points\n", chan, flow_sched[chan][0] );
+    }
+    
+    /* A blank limit is none; one stored above the measurable range is held at its top */
+    store_load_pressure_limits( pressure_limit_mbar );
+    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+    {
+        if ( pressure_limit_mbar[chan] == EEPROM_BLANK_U16 )
+            pressure_limit_mbar[chan] = 0;
+        else if ( pressure_limit_mbar[chan] > PRESSURE_LIMIT_MAX_MBAR )
+            pressure_limit_mbar[chan] = PRESSURE_LIMIT_MAX_MBAR;
+        printf( "Pressure %hu limit %u mbar\n", chan, pressure_limit_mbar[chan] );
+    }
+    
+    /* Blank pairs are loops not settled yet. A flow record is the first point of the map. */
+    store_load_warms( (uint16_t *)loop_warm );
+    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+    {
+        if ( loop_warm[chan][LOOP_WARM_FPID_OUTPUT] != EEPROM_BLANK_U16 )
+            flow_out_map_record( chan, (int16_t)loop_warm[chan][LOOP_WARM_FPID_TARGET], loop_warm[chan][LOOP_WARM_FPID_OUTPUT] );
+        printf( "Warm start %hu pressure %u integral %d flow %d output %u\n", chan,
+                loop_warm[chan][LOOP_WARM_PPID_TARGET], (int16_t)loop_warm[chan][LOOP_WARM_PPID_INTEGRATED],
+                (int16_t)loop_warm[chan][LOOP_WARM_FPID_TARGET], loop_warm[chan][LOOP_WARM_FPID_OUTPUT] );
+    }
+    
+    /* An invalid zero is none, the trim keeps its default with it */
+    store_load_pressure_cals( pressure_cal_zeros, pressure_cal_trims );
+    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+    {
+        if ( ( (int16_t)pressure_cal_zeros[chan] >= -PRESSURE_CAL_ZERO_MAX ) && ( (int16_t)pressure_cal_zeros[chan] <= PRESSURE_CAL_ZERO_MAX ) )
+        {
+            pressure_cal_zero[chan] = (int16_t)pressure_cal_zeros[chan];
+            pressure_cal_trim[chan] = (int8_t)pressure_cal_trims[chan];
+            pressure_cal_span[chan] = PRESSURE_CAL_SPAN( pressure_cal_trim[chan] );
+        }
+        printf( "Pressure %hu calibration zero %d span %u\n", chan, pressure_cal_zero[chan], pressure_cal_span[chan] );
+    }
+    
+    /* Blank is SPI_MODULE_ADDR_ANY, a module answering every address */
+    store_load_module_addr( &spi_module_addr );
+    printf( "Module address %hu\n", spi_module_addr );
+    
+    printf( "\n" );
+}
+
+void flow_mux_start( uint8_t chan, pca9544a_task_t *task )
+{
+    /* Queues the switch to the sensor of <chan>. With a second bank the other bank's mux is
+     * turned off in the same transaction, unless the muxes are known to be on this bank. */
+#if NUM_PRESSURE_BANKS > 1
+    uint8_t bank = CHAN_BANK( chan );
+    
+    if ( ( flow_mux_selected == FLOW_MUX_UNKNOWN ) || ( CHAN_BANK( flow_mux_selected ) != bank ) )
+    {
+        pca9544a_switch_start( pca9544a_i2c_addrs[bank ^ 1], pca9544a_i2c_addrs[bank], flow_map[chan], task );
+        return;
+    }
+#endif
+    pca9544a_write_start( pca9544a_i2c_addrs[CHAN_BANK( chan )], 1, flow_map[chan], task );
+}
+
+err flow_mux_write( uint8_t chan )
+{
+    /* Blocking, as flow_mux_start(). Leaves flow_mux_selected unknown. */
+    err rc = ERR_OK;
+    
+    flow_mux_selected = FLOW_MUX_UNKNOWN;
+#if NUM_PRESSURE_BANKS > 1
+    rc = pca9544a_write( pca9544a_i2c_addrs[CHAN_BANK( chan ) ^ 1], 0, 0 );
+    if ( rc == ERR_OK )
+#endif
+    rc = pca9544a_write( pca9544a_i2c_addrs[CHAN_BANK( chan )], 1, flow_map[chan] );
+    
+    return rc;
+}
+
+err flow_sensor_config( uint8_t chan )
+{
+    /* Blocking, writes flow_resolution[chan] to the sensor of <chan> and restarts it measuring */
+    err rc;
+    
+    rc = flow_mux_write( chan );
+    if ( rc == ERR_OK )
+        rc = sensirion_set_resolution( flow_resolution[chan] );
+    if ( rc == ERR_OK )
+        rc = sensirion_measurement_start();
+    
+    return rc;
+}
+
+void flow_sensor_config_apply( void )
+{
+    /* Resolution changes wait for a cycle with no flow reads queued, a few ms of blocking I2C */
+    uint8_t chan;
+    
+    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+    {
+        if ( ( flow_sensor_config_pending & ( 1 << chan ) ) && flow_present[chan] && ( flow_sensor_config( chan ) != ERR_OK ) )
+        {
+            if ( flow_read_rc[chan] == ERR_OK )
+                fault_log( FAULT_ID_FLOW_READ_FAIL, chan );
+            flow_read_rc[chan] = ERR_SENSIRION_COMMS_FAIL;
+        }
+    }
+    
+    flow_sensor_config_pending = 0;
+}
+
+void flow_set_scale( uint8_t chan, uint16_t flow_scale )
+{
+    /* Scale in counts per ul/min. A flow target already set in counts moves to the new scale,
+     * in case another sensor type was plugged in. */
+    bool rescale = ( flow_scales_ul_min[chan] != 0 ) && ( flow_scale != flow_scales_ul_min[chan] );
+    int16_t target_ul_hr = 0;
+    int16_t setpoint_ul_hr = 0;
+    int32_t ramp_ul_hr = 0;
+    
+    if ( rescale )
+    {
+        target_ul_hr = flow_raw_to_ul_hr( chan, flow_raw_target[chan] );
+        setpoint_ul_hr = flow_raw_to_ul_hr( chan, flow_raw_setpoint[chan] );
+        ramp_ul_hr = flow_conv_u16( &flow_conv_ul_hr[chan], flow_ramp_raw[chan] );
+    }
+    
+    flow_scales_ul_min[chan] = flow_scale;
+    flow_conv_init( &flow_conv_ul_hr[chan], 60, flow_scale );
+    flow_conv_init( &flow_conv_raw[chan], flow_scale, 60 );
+    flow_ul_hr_max[chan] = ( flow_scale > 60 ) ? ( (int32_t)INT16_MAX * 60 / flow_scale ) : INT16_MAX;
+    
+    if ( rescale )
+    {
+        flow_raw_target[chan] = constrain_i32( flow_conv( &flow_conv_raw[chan], target_ul_hr ), INT16_MIN, INT16_MAX );
+        flow_raw_setpoint[chan] = constrain_i32( flow_conv( &flow_conv_raw[chan], setpoint_ul_hr ), INT16_MIN, INT16_MAX );
+        flow_ramp_raw[chan] = constrain_i32( flow_conv_u16( &flow_conv_raw[chan], constrain_i32( ramp_ul_hr, 0, UINT16_MAX ) ), 0, UINT16_MAX );
+    }
+}
+
+void flow_lost( uint8_t chan )
+{
+    /* Stops reading <chan> and starts the re-probe. The flow loop holds its output while the
+     * sensor is missing, and carries on once it is back. */
+    flow_present[chan] = false;
+    flow_read_fails[chan] = 0;
+    flow_flags[chan] = 0;
+    flow_res_r[chan] = 0;
+    flow_res_count[chan] = 0;
+    flow_est_age[chan] = FLOW_EST_AGE_MAX + 1;
+    flow_probe_state[chan] = FLOW_PROBE_WAIT;
+    flow_probe_backoff_ms[chan] = FLOW_PROBE_BACKOFF_MIN_MS;
+    flow_probe_time[chan] = timer_ms;
+    fault_log( FAULT_ID_FLOW_LOST, chan );
+}
+
+void flow_probe_queue( uint8_t chan )
+{
+    /* Queues the MUX switch and the command of the present step of <chan> */
+    uint8_t cmd[3];
+    
+    flow_mux_selected = FLOW_MUX_UNKNOWN;
+    flow_mux_start( chan, &flow_probe_mux_task );
+    
+    switch ( flow_probe_state[chan] )
+    {
+        case FLOW_PROBE_RESET:
+            cmd[0] = SENSIRION_CMD_RESET;
+            sensirion_cmd_start( cmd, 1, 0, &flow_probe_task );
+            break;
+        case FLOW_PROBE_READ_REG:
+            cmd[0] = SENSIRION_REG_ADV_USER_READ;
+            sensirion_cmd_start( cmd, 1, 3, &flow_probe_task );
+            break;
+        case FLOW_PROBE_WRITE_REG:
+            flow_probe_word &= ~( SENSIRION_ADV_USER_HOLD_MASTER | SENSIRION_ADV_USER_RES_MASK );
+            flow_probe_word |= (uint16_t)( flow_resolution[chan] - SENSIRION_RES_BITS_MIN ) << SENSIRION_ADV_USER_RES0;
+            cmd[0] = SENSIRION_REG_ADV_USER_WRITE;
+            cmd[1] = flow_probe_word >> 8;
+            cmd[2] = flow_probe_word & 0xFF;
+            sensirion_cmd_start( cmd, 3, 0, &flow_probe_task );
+            break;
+        case FLOW_PROBE_READ_SCALE:
+            cmd[0] = SENSIRION_CMD_READ_EEPROM;
+            cmd[1] = SENSIRION_EEPROM_ADDR_SCALE0 >> 8;
+            cmd[2] = SENSIRION_EEPROM_ADDR_SCALE0 & 0xFF;
+            sensirion_cmd_start( cmd, 3, 3, &flow_probe_task );
+            break;
+        default:
+            cmd[0] = SENSIRION_CMD_MEASURE;
+            sensirion_cmd_start( cmd, 1, 1, &flow_probe_task );
+    }
+    
+    flow_probe_chan = chan;
+    flow_probe_time[chan] = timer_ms;
+}
+
+void flow_boot_start( void )
+{
+    /* Start-up probe of every flow sensor: the background re-probe, from its soft reset. SPI is
+     * already up, so the host is answered while the sensors boot, see GET_BOOT_STATUS. */
+    uint8_t chan;
+    
+    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+    {
+        /* A unit scale until the sensor's own is read, then targets are moved to it */
+        flow_set_scale( chan, 1 );
+        flow_present[chan] = false;
+        flow_ctrl_state[chan] = FLOW_CTRL_STATE_ERROR;
+        flow_probe_state[chan] = FLOW_PROBE_RESET;
+        flow_probe_time[chan] = timer_ms;
+    }
+    
+    flow_boot_pending = ( 1 << NUM_PRESSURE_CLTRLS ) - 1;
+}
+
+void flow_boot_done( uint8_t chan )
+{
+    /* First probe of <chan> since reset finished, found or not */
+    flow_boot_pending &= ~( 1 << chan );
+    if ( !flow_boot_pending )
+        boot_ms = ( time_local_us() / 1000 ) | 1;      // Never 0, that is booting
+}
+
+void flow_probe_found( uint8_t chan )
+{
+    /* Back to the flow reads from the next cycle. A flow mode set while the sensor was missing
+     * from start-up starts now. */
+    flow_set_scale( chan, flow_probe_word );
+    flow_present[chan] = true;
+    flow_read_fails[chan] = 0;
+    flow_probe_state[chan] = FLOW_PROBE_IDLE;
+    flow_probe_backoff_ms[chan] = FLOW_PROBE_BACKOFF_MIN_MS;
+    
+    if ( flow_ctrl_state[chan] == FLOW_CTRL_STATE_ERROR )
+    {
+        flow_ctrl_state[chan] = FLOW_CTRL_STATE_READY;
+        if ( ( ctrl_modes[chan] == CTRL_MODE_FLOW ) || ( ctrl_modes[chan] == CTRL_MODE_FLOW_CASCADE ) )
+        {
+            flow_ctrl_start( chan, flow_raw_target[chan] );
+            loop_warm_start( chan );
+        }
+    }
+    
+    if ( flow_boot_pending & ( 1 << chan ) )
+        flow_boot_done( chan );
+    else
+        fault_log( FAULT_ID_FLOW_RECOVERED, chan );
+}
+
+void flow_probe_step_done( uint8_t chan, int8_t rc )
+{
+    /* <rc> from sensirion_cmd_return(), or -1 if the MUX switch failed. A failed step starts
+     * the attempt again from the reset, after twice the last backoff. */
+    if ( rc == 1 )
+    {
+        switch ( flow_probe_state[chan] )
+        {
+            case FLOW_PROBE_READ_SCALE:
+                /* A blank scale would leave no flow conversion */
+                if ( ( flow_probe_word == 0 ) || ( flow_probe_word == 0xFFFF ) )
+                    rc = -1;
+                else
+                    flow_probe_state[chan] = FLOW_PROBE_START;
+                break;
+            case FLOW_PROBE_START:
+                flow_probe_found( chan );
+                break;
+            default:
+                flow_probe_state[chan]++;
+        }
+    }
+    
+    if ( rc != 1 )
+    {
+        if ( flow_boot_pending & ( 1 << chan ) )
+        {
+            fault_log( FAULT_ID_FLOW_NOT_PRESENT, chan );
+            flow_boot_done( chan );
+        }
+        flow_probe_state[chan] = FLOW_PROBE_WAIT;
+        flow_probe_backoff_ms[chan] = ( flow_probe_backoff_ms[chan] < ( FLOW_PROBE_BACKOFF_MAX_MS / 2 ) ) ? ( flow_probe_backoff_ms[chan] << 1 ) : FLOW_PROBE_BACKOFF_MAX_MS;
+    }
+}
+
+void flow_probe_poll( void )
+{
+    /* Called every main loop pass, next to read_flows_poll(). Re-probes one missing sensor at a
+     * time, one queued step per pass, so it never waits on the bus. Steps are only queued
+     * between flow read rounds, each behind its own MUX switch. */
+    uint8_t chan;
+    int8_t read_rc;
+    
+    if ( flow_probe_chan < NUM_PRESSURE_CLTRLS )
+    {
+        chan = flow_probe_chan;
+        read_rc = sensirion_cmd_return( ( ( flow_probe_state[chan] == FLOW_PROBE_READ_REG ) || ( flow_probe_state[chan] == FLOW_PROBE_READ_SCALE ) ) ? &flow_probe_word : NULL, &flow_probe_task );
+        if ( ( flow_probe_mux_task.status == I2C2_MESSAGE_PENDING ) || ( read_rc == 0 ) )
+        {
+            if ( ( timer_ms - flow_probe_time[chan] ) <= FLOW_PROBE_TIMEOUT_MS )
+                return;
+            
+            /* Timeout, drop the queue */
+            i2c_bus_count( I2C_DEV_MUX, flow_probe_mux_task.status );
+            i2c_bus_count( I2C_DEV_FLOW, flow_probe_task.status );
+            i2c_bus_abort( ( flow_probe_mux_task.status == I2C2_MESSAGE_PENDING ) ? I2C_DEV_MUX : I2C_DEV_FLOW );
+            read_rc = -1;
+        }
+        else
+        {
+            i2c_bus_count( I2C_DEV_MUX, flow_probe_mux_task.status );
+            i2c_bus_count( I2C_DEV_FLOW, flow_probe_task.status );
+        }
+        
+        if ( flow_probe_mux_task.status != I2C2_MESSAGE_COMPLETE )
+            read_rc = -1;
+        
+        flow_probe_chan = NUM_PRESSURE_CLTRLS;
+        flow_probe_time[chan] = timer_ms;
+        flow_probe_step_done( chan, read_rc );
+        return;
+    }
+    
+    if ( flow_read_state == FLOW_READ_CHANNEL )
+        return;
+    
+    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+    {
+        if ( ( flow_probe_state[chan] == FLOW_PROBE_WAIT ) && ( ( timer_ms - flow_probe_time[chan] ) >= flow_probe_backoff_ms[chan] ) )
+            flow_probe_state[chan] = FLOW_PROBE_RESET;
+        else if ( ( flow_probe_state[chan] == FLOW_PROBE_BOOT ) && ( ( timer_ms - flow_probe_time[chan] ) > SENSIRION_BOOT_MS ) )
+            flow_probe_state[chan] = FLOW_PROBE_READ_REG;
+        
+        if ( ( flow_probe_state[chan] != FLOW_PROBE_IDLE ) && ( flow_probe_state[chan] != FLOW_PROBE_WAIT ) && ( flow_probe_state[chan] != FLOW_PROBE_BOOT ) )
+        {
+            flow_probe_queue( chan );
+            return;
+        }
+    }
+}
+
+bool flow_loop_active( uint8_t chan )
+{
+    /* The output of <chan> follows its flow: a flow loop, or an autotune */
+    return ( ctrl_modes[chan] == CTRL_MODE_FLOW ) || ( ctrl_modes[chan] == CTRL_MODE_FLOW_CASCADE ) ||
+           ( ftune[chan].state == FTUNE_STATE_RUNNING );
+}
+
+bool flow_read_due( uint8_t chan )
+{
+    /* Flow loops and autotunes read their sensor every cycle. The other channels only report
+     * their flow, and are read every flow_monitor_div cycles, staggered so they do not all fall in one. */
+    if ( !flow_present[chan] )
+        return false;
+    
+    if ( flow_loop_active( chan ) )
+        return true;
+    
+    return ( ( flow_read_round + chan ) % flow_monitor_div ) == 0;
+}
+
+void read_flows_queue( void )
+{
+    /* Queue the MUX switch, read and restart of the next channel due from flow_read_chan. The
+     * MUX write is left out if it already points at the channel, as with one flow loop alone. */
+    while ( ( flow_read_chan < NUM_PRESSURE_CLTRLS ) && !flow_read_due( flow_read_chan ) )
+        flow_read_chan++;
+    
+    if ( flow_read_chan >= NUM_PRESSURE_CLTRLS )
+        flow_read_state = FLOW_READ_DONE;
+    else
+    {
+        flow_mux_queued = ( flow_mux_selected != flow_read_chan );
+        if ( flow_mux_queued )
+            flow_mux_start( flow_read_chan, &flow_mux_task );
+        else
+            flow_mux_task.status = I2C2_MESSAGE_COMPLETE;
+        sensirion_measurement_read_start( flow_flags_gate[flow_read_chan], &flow_sensor_task );
+        flow_read_time = timer_ms;
+    }
+}
+
+void read_flows_start( void )
+{
+    /* 672us to set MUX and read one channel = 16us * 42 ticks at 400kHz I2C, so one channel
+     * is queued at a time and ADC transactions get the bus in between. The temperature and
+     * flags words of flow_flags_gate[] add 54 clocks, 135us. */
+    uint8_t chan;
+    
+    if ( flow_read_state == FLOW_READ_CHANNEL )
+        return;
+    
+    if ( flow_sensor_config_pending )
+        flow_sensor_config_apply();
+    
+    flow_read_state = FLOW_READ_CHANNEL;
+    flow_read_chan = 0;
+    flow_read_round++;
+    
+    flow_read_pending = 0;
+    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+    {
+        if ( flow_read_due( chan ) )
+            flow_read_pending |= 1 << chan;
+    }
+    
+    read_flows_queue();
+}
+
+int16_t adc_code_mbar_shl( uint8_t chan, uint16_t adc_value )
+{
+    /* A conversion of pressure channel <chan>, at the gain it was started with. A single ended
+     * input reads from the sensor zero, PRESSURE_CTLR_ZERO_MV, a differential one from 0 V. */
+    uint8_t pga = adc_gains_started[chan] >> ADS1115_PGA0;
+    int32_t pressure;
+    
+    pressure = flow_conv( &adc_conv[pga], (int16_t)adc_value );
+    if ( !ADS1115_MUX_IS_DIFF( adc_muxes[chan] ) )
+        pressure -= PRESSURE_ADC_ZERO_MBARSHL;
+    
+    return constrain_i32( pressure, INT16_MIN, INT16_MAX );
+}
+
+int16_t adc_to_mbar_shl( uint8_t chan, uint16_t adc_value )
+{
+    /* adc_code_mbar_shl(), and auto-ranging picks the gain of the next conversion from this one */
+    int16_t code = (int16_t)adc_value;
+    uint8_t pga = adc_gains_started[chan] >> ADS1115_PGA0;
+    uint16_t code_size = ( code < 0 ) ? -(int32_t)code : code;
+    
+    if ( adc_gain_settings[chan] == ADC_GAIN_AUTO )
+    {
+        if ( ( code_size > ADC_AUTORANGE_UP_CODE ) && ( pga > 0 ) )
+            adc_gains[chan] = (ads1115_fsr_gain)( ( pga - 1 ) << ADS1115_PGA0 );
+        else if ( ( code_size < ADC_AUTORANGE_DOWN_CODE ) && ( pga < ( ADC_GAIN_CODES - 1 ) ) )
+            adc_gains[chan] = (ads1115_fsr_gain)( ( pga + 1 ) << ADS1115_PGA0 );
+    }
+    
+    return adc_code_mbar_shl( chan, adc_value );
+}
+
+int16_t signal_filter( uint8_t chan, uint8_t signal, int16_t x )
+{
+    /* Optional SET_SIGNAL_FILTER biquad in front of the controllers, on the DSP engine */
+    if ( !signal_filter_on[chan][signal] )
+        return x;
+    
+    return filter_biquad( &signal_filters[chan][signal], &signal_filter_states[chan][signal], x );
+}
+
+void flow_flags_update( uint8_t chan, uint16_t flags )
+{
+    /* Flags of a good reading of <chan>, counting each rise of air-in-line and high-flow */
+    uint16_t rises = flags & ~flow_flags[chan];
+    
+    if ( ( rises & SENSIRION_FLAG_AIR_IN_LINE ) && ( flow_air_events[chan] != UINT16_MAX ) )
+        flow_air_events[chan]++;
+    if ( ( rises & SENSIRION_FLAG_HIGH_FLOW ) && ( flow_high_events[chan] != UINT16_MAX ) )
+        flow_high_events[chan]++;
+    
+    flow_flags[chan] = flags;
+}
+
+bool flow_flags_hold( uint8_t chan )
+{
+    /* An air bubble or a flow past the sensor range makes the reading meaningless to the loop */
+    return ( flow_flags[chan] & ( SENSIRION_FLAG_AIR_IN_LINE | SENSIRION_FLAG_HIGH_FLOW ) ) != 0;
+}
+
+void flow_res_update( uint8_t chan )
+{
+    /* Hydraulic resistance of the chip from a good reading, as flow_ff_learn() but on every one
+     * and faster. Against flow_res_ref[] it rises with a clog and falls with a leak past the
+     * sensor, either is logged once it holds for FLOW_RES_DEBOUNCE readings. */
+    int32_t pressure = pressure_mbar_shl_actual[chan];
+    int32_t flow_ul_hr;
+    int32_t r;
+    int32_t r_pct;
+    uint8_t state;
+    
+    if ( ( pressure < FLOW_RES_MIN_MBAR_SHL ) || flow_flags_hold( chan ) )
+        return;
+    
+    flow_ul_hr = flow_raw_to_ul_hr( chan, flow_raw_actual[chan] );
+    if ( flow_ul_hr < FLOW_RES_MIN_UL_HR )
+        flow_ul_hr = FLOW_RES_MIN_UL_HR;
+    r = constrain_i32( pressure * 125 / flow_ul_hr, 0, UINT16_MAX );
+    
+    if ( flow_res_r[chan] == 0 )
+        flow_res_r[chan] = r;
+    else
+        flow_res_r[chan] = flow_res_r[chan] + ( ( r - flow_res_r[chan] ) >> FLOW_RES_SHIFT );
+    
+    if ( flow_res_ref[chan] == 0 )
+        return;
+    
+    /* Compared as % of the reference, without a divide */
+    r = (int32_t)flow_res_r[chan] * 100;
+    if ( r > (int32_t)flow_res_ref[chan] * ( 100 + flow_res_clog_pct ) )
+        state = FLOW_RES_STATE_CLOG;
+    else if ( r < (int32_t)flow_res_ref[chan] * ( 100 - flow_res_leak_pct ) )
+        state = FLOW_RES_STATE_LEAK;
+    else
+        state = FLOW_RES_STATE_OK;
+    
+    if ( state == flow_res_state[chan] )
+    {
+        flow_res_count[chan] = 0;
+        return;
+    }
+    
+    if ( ++flow_res_count[chan] < FLOW_RES_DEBOUNCE )
+        return;
+    
+    flow_res_state[chan] = state;
+    flow_res_count[chan] = 0;
+    if ( state != FLOW_RES_STATE_OK )
+    {
+        r_pct = constrain_i32( r / flow_res_ref[chan], 0, UINT8_MAX );
+        fault_log( ( state == FLOW_RES_STATE_CLOG ) ? FAULT_ID_FLOW_CLOG : FAULT_ID_FLOW_LEAK, ( (int32_t)chan << 8 ) | r_pct );
+    }
+}
+
+bool flow_est_valid( uint8_t chan )
+{
+    /* The estimate stands in for the reading once R is known and a recent reading anchors it */
+    return ( flow_est_shift[chan] != 0 ) && ( flow_res_r[chan] != 0 ) && ( flow_est_age[chan] <= FLOW_EST_AGE_MAX );
+}
+
+void flow_est_predict( uint8_t chan, int16_t pressure )
+{
+    /* Complementary flow estimate, the fast half: each pressure sample moves it by the pressure
+     * change through R, flow_res_r[]. The flow sensor, read later through the MUX and not on
+     * every cycle, corrects its drift in flow_est_correct(). */
+    int32_t flow_ul_hr;
+    
+    if ( flow_est_valid( chan ) )
+    {
+        flow_ul_hr = ( (int32_t)pressure - flow_est_pressure[chan] ) * 125 / flow_res_r[chan];
+        flow_ul_hr = flow_conv( &flow_conv_raw[chan], constrain_i32( flow_ul_hr, INT16_MIN, INT16_MAX ) );
+        flow_raw_est[chan] = constrain_i32( flow_raw_est[chan] + flow_ul_hr, INT16_MIN, INT16_MAX );
+    }
+    
+    flow_est_pressure[chan] = pressure;
+    if ( flow_est_age[chan] <= FLOW_EST_AGE_MAX )
+        flow_est_age[chan]++;
+}
+
+void flow_est_correct( uint8_t chan )
+{
+    /* The slow half: a good reading pulls the estimate by 1/2^flow_est_shift[] of the difference,
+     * or sets it after a gap. A held reading says nothing, and lets the estimate age out. */
+    if ( flow_flags_hold( chan ) )
+        return;
+    
+    if ( flow_est_age[chan] > FLOW_EST_AGE_MAX )
+        flow_raw_est[chan] = flow_raw_actual[chan];
+    else
+        flow_raw_est[chan] += ( (int32_t)flow_raw_actual[chan] - flow_raw_est[chan] ) >> flow_est_shift[chan];
+    flow_est_age[chan] = 0;
+}
+
+int16_t flow_loop_actual( uint8_t chan )
+{
+    /* The flow a flow loop tracks */
+    return flow_est_valid( chan ) ? flow_raw_est[chan] : flow_raw_actual[chan];
+}
+
+bool flow_loop_input_ok( uint8_t chan )
+{
+    /* A flow loop steps on a good reading, or on the estimate between them, but never while
+     * the sensor flags air in line or a flow past its range */
+    return ( ( flow_read_rc[chan] == ERR_OK ) || flow_est_valid( chan ) ) && !flow_flags_hold( chan );
+}
+
+void read_flows_poll( void )
+{
+    /* Called every main loop pass, moves to the next channel once the current one is done.
+     * A channel whose MUX write or read failed, or whose reading failed the CRC check, keeps
+     * its previous flow, and FLOW_LOST_READS failed reads in a row hand it to the re-probe. */
+    int16_t flow;
+    uint16_t flags;
+    int8_t read_rc;
+    
+    if ( flow_read_state != FLOW_READ_CHANNEL )
+        return;
+    
+    read_rc = sensirion_measurement_read_return( &flow, &flags, flow_crc_check[flow_read_chan], &flow_sensor_task );
+    if ( ( flow_mux_task.status == I2C2_MESSAGE_PENDING ) || ( read_rc == 0 ) )
+    {
+        if ( ( timer_ms - flow_read_time ) <= FLOW_READ_TIMEOUT_MS )
+            return;
+        
+        /* Timeout, drop the queue. Counted before the abort ends the transaction in progress. */
+        if ( flow_mux_queued )
+            i2c_bus_count( I2C_DEV_MUX, flow_mux_task.status );
+        i2c_bus_count( I2C_DEV_FLOW, flow_sensor_task.read_status );
+        i2c_bus_count( I2C_DEV_FLOW, flow_sensor_task.start_status );
+        i2c_bus_abort( ( flow_mux_task.status == I2C2_MESSAGE_PENDING ) ? I2C_DEV_MUX : I2C_DEV_FLOW );
+        read_rc = -1;
+    }
+    else
+    {
+        if ( flow_mux_queued )
+            i2c_bus_count( I2C_DEV_MUX, flow_mux_task.status );
+        i2c_bus_count( I2C_DEV_FLOW, flow_sensor_task.read_status );
+        i2c_bus_count( I2C_DEV_FLOW, flow_sensor_task.start_status );
+    }
+    
+    flow_mux_selected = ( flow_mux_task.status == I2C2_MESSAGE_COMPLETE ) ? flow_read_chan : FLOW_MUX_UNKNOWN;
+    
+    /* Without the MUX switch the read came from another channel's sensor */
+    if ( ( flow_mux_task.status == I2C2_MESSAGE_COMPLETE ) && ( read_rc == 1 ) )
+    {
+        flow_raw_actual[flow_read_chan] = signal_filter( flow_read_chan, FILTER_SIGNAL_FLOW, flow );
+        flow_read_rc[flow_read_chan] = ERR_OK;
+        flow_read_fails[flow_read_chan] = 0;
+        flow_flags_update( flow_read_chan, flags );
+        flow_res_update( flow_read_chan );
+        flow_est_correct( flow_read_chan );
+        if ( flow_loop_active( flow_read_chan ) )
+            latency_sample( LATENCY_CHAN0 + flow_read_chan );
+    }
+    else if ( ( flow_mux_task.status == I2C2_MESSAGE_COMPLETE ) && ( read_rc == -2 ) )
+    {
+        flow_crc_errors[flow_read_chan]++;
+        if ( flow_read_rc[flow_read_chan] == ERR_OK )
+            fault_log( FAULT_ID_FLOW_CRC_FAIL, flow_read_chan );
+        flow_read_rc[flow_read_chan] = ERR_SENSIRION_CRC_FAIL;
+    }
+    else
+    {
+        if ( flow_read_rc[flow_read_chan] == ERR_OK )
+            fault_log( FAULT_ID_FLOW_READ_FAIL, flow_read_chan );
+        flow_read_rc[flow_read_chan] = ERR_SENSIRION_COMMS_FAIL;
+        
+        if ( ++flow_read_fails[flow_read_chan] >= FLOW_LOST_READS )
+            flow_lost( flow_read_chan );
+    }
+    
+    flow_read_pending &= ~( 1 << flow_read_chan );
+    flow_read_chan++;
+    read_flows_queue();
+}
+
+void print_flows( void )
+{
+    /* Integer units only, the records are formatted later by rio_log_drain() */
+#if ( RIO_LOG_LEVEL >= RIO_LOG_DEBUG )
+    uint8_t chan;
+    int32_t flow_ul_hr;
+    
+    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+    {
+        flow_ul_hr = flow_present[chan] ? flow_raw_to_ul_hr( chan, flow_raw_actual[chan] ) : 0;
+        LOG_DEBUG( LOG_ID_FLOW_CHAN, chan+1, ctrl_modes[chan], pressure_mbar_shl_actual[chan] >> PRESSURE_SHL, pressure_mbar_shl_output[chan] >> PRESSURE_SHL, flow_ul_hr, flow_read_rc[chan], flow_present[chan] );
+    }
+#endif
+}
+
+int32_t flow_ff_mbar_shl( uint8_t chan, int16_t flow_raw )
+{
+    /* Feedforward pressure for <flow_raw> through resistance flow_ff_r[], mbar << PRESSURE_SHL.
+     * I16 ul/hr x U16 R fits I32, and mbar / 1000 << 3 is / 125. */
+    int32_t flow_ul_hr = flow_raw_to_ul_hr( chan, flow_raw );
+    
+    return flow_ul_hr * flow_ff_r[chan] / 125;
+}
+
+void flow_ff_learn( uint8_t chan )
+{
+    /* R = pressure / flow, low pass filtered. Only called once the setpoint ramp is done. */
+    int32_t flow_ul_hr = flow_raw_to_ul_hr( chan, flow_raw_actual[chan] );
+    int32_t r;
+    
+    if ( ( flow_ul_hr >= FLOW_FF_LEARN_MIN_UL_HR ) && ( pressure_mbar_shl_actual[chan] > 0 ) )
+    {
+        r = constrain_i32( (int32_t)pressure_mbar_shl_actual[chan] * 125 / flow_ul_hr, 0, UINT16_MAX );
+        flow_ff_r[chan] = flow_ff_r[chan] + ( ( r - flow_ff_r[chan] ) >> FLOW_FF_LEARN_SHIFT );
+    }
+}
+
+int32_t flow_pid_step( uint8_t chan )
+{
+    /* Flow PID on the ramped setpoint, returns the change of its output in mbar << PRESSURE_SHL:
+     * the PID part, slew limited, plus the feedforward for the setpoint change. With a gain
+     * schedule its gains are those for the setpoint. It tracks flow_loop_actual(). */
+    
+    const pid_config_t *config = &fpid_config[chan];
+    int16_t setpoint_prev = flow_raw_setpoint[chan];
+    int16_t actual = flow_loop_actual( chan );
+    int32_t step;
+    int32_t error;
+    int32_t band;
+    int32_t output_change;
+    int32_t map_output = -1;
+    
+    step = (int32_t)flow_raw_target[chan] - setpoint_prev;
+    if ( flow_ramp_raw[chan] != 0 )
+        step = constrain_i32( step, -(int32_t)flow_ramp_raw[chan], flow_ramp_raw[chan] );
+    flow_raw_setpoint[chan] = setpoint_prev + step;
+    
+    if ( flow_sched[chan][0] != 0 )
+    {
+        flow_sched_gains( chan, flow_raw_setpoint[chan] );
+        config = &fpid_sched_config[chan];
+    }
+    
+    error = constrain_i32( (int32_t)flow_raw_setpoint[chan] - actual, INT16_MIN, INT16_MAX );
+    band = flow_raw_setpoint[chan] >> LOOP_WARM_FPID_BAND_SHIFT;
+    
+    /* A step past the settled band, not a ramp or a profile segment, goes straight to the
+     * output the map has for it. The loop then waits for the flow to follow, up to
+     * FLOW_OUT_MAP_HOLD_CYCLES, rather than integrate the lag of the chip on top of it. */
+    if ( loop_warm_enable && ( flow_ramp_raw[chan] == 0 ) && ( labs( step ) > band ) )
+        map_output = flow_out_map_output( chan, flow_raw_setpoint[chan] );
+    
+    if ( map_output >= 0 )
+    {
+        pid_reset( &fpid_loop[chan], actual );
+        flow_out_map_hold[chan] = FLOW_OUT_MAP_HOLD_CYCLES;
+        output_change = map_output - ( ( ctrl_modes[chan] == CTRL_MODE_FLOW_CASCADE ) ? flow_cascade_setpoint[chan] : pressure_mbar_shl_output[chan] );
+    }
+    else if ( ( flow_out_map_hold[chan] != 0 ) && ( --flow_out_map_hold[chan] != 0 ) && ( labs( error ) > band ) )
+    {
+        fpid_loop[chan].actual_prev = actual;
+        output_change = 0;
+    }
+    else
+    {
+        flow_out_map_hold[chan] = 0;
+        output_change = fpid_step( config, &fpid_loop[chan], error, error, actual, 0 );
+        
+        /* Same R both sides, so learning R moves only later setpoint changes */
+        if ( flow_ff_flags[chan] & FLOW_FF_ENABLE )
+            output_change += flow_ff_mbar_shl( chan, flow_raw_setpoint[chan] ) - flow_ff_mbar_shl( chan, setpoint_prev );
+        
+        if ( ( flow_ff_flags[chan] & FLOW_FF_LEARN ) && ( step == 0 ) && ( flow_read_rc[chan] == ERR_OK ) )
+            flow_ff_learn( chan );
+    }
+    
+    fpid_terms[chan][0] = constrain_i32( fpid_loop[chan].p_term >> FPID_I_SHIFT, INT16_MIN, INT16_MAX );
+    fpid_terms[chan][1] = constrain_i32( fpid_loop[chan].integrated >> FPID_I_SHIFT, INT16_MIN, INT16_MAX );
+    fpid_terms[chan][2] = constrain_i32( fpid_loop[chan].diff >> FPID_I_SHIFT, INT16_MIN, INT16_MAX );
+    
+    LOG_DEBUG( LOG_ID_FLOW_PID, chan, error, fpid_terms[chan][0] + fpid_terms[chan][1] + fpid_terms[chan][2], fpid_terms[chan][0], fpid_terms[chan][1], fpid_terms[chan][2], output_change );
+    
+    return output_change;
+}
+
+err flow_autotune_start( uint8_t chan, int16_t target_raw, uint16_t delta )
+{
+    /* Relay test around <target_raw>, <delta> mbar << PRESSURE_SHL either side of the bias. The
+     * bias starts at the feedforward pressure for the target if R is set, else at the present
+     * command, and steps towards the target until the flow first passes it. */
+    flow_tune_t *tune = &ftune[chan];
+    int32_t bias;
+    
+    if ( !flow_present[chan] ||
+         ( ( flow_ctrl_state[chan] != FLOW_CTRL_STATE_READY ) && ( flow_ctrl_state[chan] != FLOW_CTRL_STATE_RUNNING ) ) )
+        return ERR_ERROR;
+    
+    bias = ( flow_ff_r[chan] != 0 ) ? flow_ff_mbar_shl( chan, target_raw ) : pressure_mbar_shl_output[chan];
+    
+    memset( tune, 0, sizeof(*tune) );
+    tune->target = target_raw;
+    tune->hyst = constrain_i32( target_raw >> FTUNE_HYST_SHR, FTUNE_HYST_MIN_RAW, INT16_MAX );
+    tune->delta = delta;
+    tune->bias = constrain_i32( bias, delta, ( (int32_t)PRESSURE_CTLR_MBAR << PRESSURE_SHL ) - delta );
+    tune->high = flow_raw_actual[chan] < target_raw;
+    tune->flow_max = flow_raw_actual[chan];
+    tune->flow_min = flow_raw_actual[chan];
+    tune->state = FTUNE_STATE_RUNNING;
+    
+    return ERR_OK;
+}
+
+void flow_autotune_fail( uint8_t chan, E_FTUNE_FAIL fail )
+{
+    ftune[chan].fail = fail;
+    fault_log( FAULT_ID_FTUNE_FAIL, ( (int32_t)chan << 8 ) | fail );
+    flow_autotune_stop( chan, FTUNE_STATE_FAILED );
+}
+
+void flow_autotune_estimate( uint8_t chan )
+{
+    /* At the end of each full cycle: ku = 4 delta / ( pi a ) from the flow swing a and tu from
+     * the period, and the bias moved by the difference of the half cycles. Finishes on
+     * FTUNE_CONV_COUNT estimates in a row with even half cycles and kd and tu within
+     * FTUNE_CONV_SPREAD_PC of their mean, as the heater's fast mode.
+     *
+     * The flow PID is in velocity form, its output is the change of the regulator command. kd,
+     * on the change of the flow, is then the proportional gain, kp the integral gain and ki a
+     * second integral, left at 0. The heater's Ziegler-Nichols PID (0.6 ku, or 0.2 ku with
+     * FTUNE_NO_OVERSHOOT, and ti = tu / 2) has no place for its D term, so it runs as a PI:
+     *   kd = 4096 kc,  kp = kd / ti, per control cycle */
+    flow_tune_t *tune = &ftune[chan];
+    uint16_t tu = tune->period_high + tune->period_low;
+    int32_t diff = (int32_t)tune->period_high - tune->period_low;
+    int32_t swing = constrain_i32( (int32_t)tune->flow_max - tune->flow_min, 1, INT32_MAX );
+    uint16_t kd = constrain_i32( ( (int32_t)tune->delta * FTUNE_KD_NUM ) / swing, 1, UINT16_MAX );
+    uint16_t kd_min;
+    uint16_t kd_max;
+    uint32_t kd_sum;
+    uint16_t tu_min;
+    uint16_t tu_max;
+    uint32_t tu_sum;
+    uint16_t pid_consts[3];
+    uint8_t i;
+    
+    tune->estimates++;
+    tune->bias = constrain_i32( (int32_t)tune->bias + ( ( (int32_t)tune->delta * diff ) / tu ),
+                                tune->delta, ( (int32_t)PRESSURE_CTLR_MBAR << PRESSURE_SHL ) - tune->delta );
+    
+    if ( ( ( ( diff < 0 ) ? -diff : diff ) * 100 ) > ( (int32_t)tu * FTUNE_CONV_ASYMMETRY_PC ) )
+    {
+        /* Bias still moving, start the window again */
+        tune->settled = 0;
+    }
+    else
+    {
+        tune->log_kd[tune->settled % FTUNE_CONV_COUNT] = kd;
+        tune->log_tu[tune->settled % FTUNE_CONV_COUNT] = tu;
+        tune->settled++;
+    }
+    
+    if ( tune->settled >= FTUNE_CONV_COUNT )
+    {
+        kd_min = kd_max = kd_sum = tune->log_kd[0];
+        tu_min = tu_max = tu_sum = tune->log_tu[0];
+        for ( i=1; i<FTUNE_CONV_COUNT; i++ )
+        {
+            kd_min = ( tune->log_kd[i] < kd_min ) ? tune->log_kd[i] : kd_min;
+            kd_max = ( tune->log_kd[i] > kd_max ) ? tune->log_kd[i] : kd_max;
+            kd_sum += tune->log_kd[i];
+            tu_min = ( tune->log_tu[i] < tu_min ) ? tune->log_tu[i] : tu_min;
+            tu_max = ( tune->log_tu[i] > tu_max ) ? tune->log_tu[i] : tu_max;
+            tu_sum += tune->log_tu[i];
+        }
+        
+        /* ( max - min ) / mean <= FTUNE_CONV_SPREAD_PC / 100, for both */
+        if ( ( ( (uint32_t)( kd_max - kd_min ) * ( 100 * FTUNE_CONV_COUNT ) ) <= ( kd_sum * FTUNE_CONV_SPREAD_PC ) ) &&
+             ( ( (uint32_t)( tu_max - tu_min ) * ( 100 * FTUNE_CONV_COUNT ) ) <= ( tu_sum * FTUNE_CONV_SPREAD_PC ) ) )
+        {
+            pid_consts[0] = constrain_i32( ( 2 * kd_sum ) / tu_sum, 1, UINT16_MAX );
+            pid_consts[1] = 0;
+            pid_consts[2] = kd_sum / FTUNE_CONV_COUNT;
+            
+            fpid_config[chan].kp = pid_consts[0];
+            fpid_config[chan].ki = pid_consts[1];
+            fpid_config[chan].kd = pid_consts[2];
+            store_save_fpid_consts( chan, pid_consts );
+            
+            flow_autotune_stop( chan, FTUNE_STATE_FINISHED );
+            return;
+        }
+    }
+    
+    if ( tune->estimates >= FTUNE_ESTIMATES_MAX )
+        flow_autotune_fail( chan, FTUNE_FAIL_CYCLES );
+}
+
+void flow_autotune( uint8_t chan )
+{
+    /* One control cycle of the relay test, in place of the control mode: the regulator command
+     * is bias + delta until the flow rises past target + hyst, then bias - delta until it
+     * falls past target - hyst. The flow is only looked at on a cycle with a new reading. */
+    flow_tune_t *tune = &ftune[chan];
+    int16_t flow = flow_raw_actual[chan];
+    uint16_t bias;
+    bool passed;
+    
+    tune->timer++;
+    
+    if ( !flow_present[chan] )
+    {
+        flow_autotune_fail( chan, FTUNE_FAIL_FLOW_LOST );
+        return;
+    }
+    
+    if ( flow_read_rc[chan] == ERR_OK )
+    {
+        if ( flow > tune->flow_max )
+            tune->flow_max = flow;
+        else if ( flow < tune->flow_min )
+            tune->flow_min = flow;
+        
+        passed = tune->high ? ( flow > ( tune->target + tune->hyst ) ) : ( flow < ( tune->target - tune->hyst ) );
+        if ( passed && ( (uint16_t)( tune->timer - tune->switch_time ) >= FTUNE_TRANS_CYCLES_MIN ) )
+        {
+            if ( tune->high )
+                tune->period_high = tune->timer - tune->switch_time;
+            else
+                tune->period_low = tune->timer - tune->switch_time;
+            tune->switch_time = tune->timer;
+            tune->high = !tune->high;
+            if ( tune->cycles != UINT8_MAX )
+                tune->cycles++;
+            
+            /* The first half cycle is only partial, then both halves of a full cycle are needed */
+            if ( ( tune->cycles >= FTUNE_CYCLES_MIN ) && tune->high )
+                flow_autotune_estimate( chan );
+            
+            if ( tune->high )
+                tune->flow_max = flow;
+            else
+                tune->flow_min = flow;
+        }
+        else if ( ( tune->cycles == 0 ) && ( (uint16_t)( tune->timer - tune->switch_time ) >= FTUNE_SEEK_CYCLES ) )
+        {
+            /* The relay alone does not reach the target from this bias, so move it one delta
+             * at a time, rather than swing the whole pressure range as the heater does */
+            bias = constrain_i32( (int32_t)tune->bias + ( tune->high ? tune->delta : -(int32_t)tune->delta ),
+                                  tune->delta, ( (int32_t)PRESSURE_CTLR_MBAR << PRESSURE_SHL ) - tune->delta );
+            if ( bias != tune->bias )
+            {
+                tune->bias = bias;
+                tune->switch_time = tune->timer;
+            }
+        }
+    }
+    
+    if ( ( tune->state == FTUNE_STATE_RUNNING ) && ( (uint16_t)( tune->timer - tune->switch_time ) > FTUNE_HALF_CYCLE_MAX ) )
+        flow_autotune_fail( chan, FTUNE_FAIL_TIMEOUT );
+    
+    if ( tune->state == FTUNE_STATE_RUNNING )
+        pressure_mbar_shl_output[chan] = tune->high ? ( tune->bias + tune->delta ) : ( tune->bias - tune->delta );
+}
+
+uint16_t pressure_pid_step( uint8_t chan, uint16_t target, int16_t *terms )
+{
+    /* Pressure PID on the measured pressure, returns the regulator command.
+     * <terms> gets P, I, D >> PPID_SHIFT. */
+    
+    int16_t actual = pressure_mbar_shl_actual[chan];
+    int16_t error = constrain_i32( (int32_t)target - actual, INT16_MIN, INT16_MAX );
+    int32_t output;
+    
+    /* The PID output is a correction to the target, the regulator range limits the sum */
+    output = ppid_step( &ppid_config[chan], &ppid_loop[chan], error, error, actual, target );
+    
+    terms[0] = ppid_loop[chan].p_term >> PPID_SHIFT;
+    terms[1] = ppid_loop[chan].integrated >> PPID_SHIFT;
+    terms[2] = ppid_loop[chan].diff >> PPID_SHIFT;
+    
+    return (uint16_t)output;
+}
+
+void update_output( uint8_t chan )
+{
+    /* The control step of one channel, the caller writes the DAC */
+    int32_t output;
+    
+    memset( fpid_terms[chan], 0, sizeof(fpid_terms[chan]) );
+    
+    if ( ftune[chan].state == FTUNE_STATE_RUNNING )
+    {
+        /* Relay autotune, the control mode waits for it */
+        
+        flow_autotune( chan );
+    }
+    else if ( ( flow_ctrl_state[chan] == FLOW_CTRL_STATE_RUNNING ) && flow_present[chan] &&
+              ( ctrl_modes[chan] == CTRL_MODE_FLOW_CASCADE ) )
+    {
+        /* Cascade: the flow loop moves the pressure setpoint on each new flow reading,
+         * and the pressure loop tracks it on every ADC cycle */
+        
+        int16_t ppid_terms[3];      // Not in the history, which keeps the flow terms
+        
+        if ( flow_loop_input_ok( chan ) )
+        {
+            output = flow_pid_step( chan ) + flow_cascade_setpoint[chan];
+            flow_cascade_setpoint[chan] = constrain_i32( output, 0, (int32_t)PRESSURE_CTLR_MBAR << PRESSURE_SHL );
+            if ( loop_warm_track( chan, LOOP_WARM_FPID_TARGET, flow_raw_target[chan], flow_cascade_setpoint[chan], loop_warm_flow_settled( chan ) ) )
+                flow_out_map_record( chan, flow_raw_target[chan], flow_cascade_setpoint[chan] );
+        }
+        
+        pressure_mbar_shl_output[chan] = pressure_pid_step( chan, flow_cascade_setpoint[chan], ppid_terms );
+    }
+    else if ( ( flow_ctrl_state[chan] == FLOW_CTRL_STATE_RUNNING ) && flow_present[chan] )
+    {
+        /* Flow control loop, held on a cycle without a good flow reading or estimate, and with
+         * the integrator frozen while the sensor flags air in line or a flow past its range */
+        
+        if ( flow_loop_input_ok( chan ) )
+        {
+            output = flow_pid_step( chan ) + pressure_mbar_shl_output[chan];
+            output = constrain_i32( output, 0, (int32_t)PRESSURE_CTLR_MBAR << PRESSURE_SHL );
+            pressure_mbar_shl_output[chan] = (uint16_t)output;
+            if ( loop_warm_track( chan, LOOP_WARM_FPID_TARGET, flow_raw_target[chan], output, loop_warm_flow_settled( chan ) ) )
+                flow_out_map_record( chan, flow_raw_target[chan], output );
+        }
+    }
+    else if ( ( pressure_ctrl_state[chan] == PRESSURE_CTRL_STATE_RUNNING ) && ( ctrl_modes[chan] == CTRL_MODE_PRESSURE ) )
+    {
+        /* Pressure control loop */
+        
+        pressure_mbar_shl_output[chan] = pressure_pid_step( chan, pressure_mbar_shl_target[chan], fpid_terms[chan] );
+        loop_warm_track( chan, LOOP_WARM_PPID_TARGET, pressure_mbar_shl_target[chan],
+                         constrain_i32( ppid_loop[chan].integrated >> PPID_SHIFT, INT16_MIN, INT16_MAX ),
+                         ( pressure_mbar_shl_target[chan] > 0 ) &&
+                         ( labs( (int32_t)pressure_mbar_shl_target[chan] - pressure_mbar_shl_actual[chan] ) <= LOOP_WARM_PPID_BAND_MBAR_SHL ) );
+    }
+    else if ( ( ctrl_modes[chan] == CTRL_MODE_PRESSURE_OPEN_LOOP ) || ( ctrl_modes[chan] == CTRL_MODE_PRESSURE ) )
+    {
+        /* Pressure open loop, also CTRL_MODE_PRESSURE while the pressure controller is not ready */
+        
+        pressure_mbar_shl_output[chan] = pressure_mbar_shl_target[chan];
+    }
+    else if ( ctrl_modes[chan] == CTRL_MODE_ZERO )
+    {
+        /* Pressure zero */
+        
+        pressure_mbar_shl_output[chan] = 0;
+    }
+}
+
+void update_outputs( void )
+{
+    /* Every channel, then the changed ones to the DAC in one burst */
+    uint8_t chan;
+    
+    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+        update_output( chan );
+    
+    set_pressures();
+    
+    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+        latency_output( LATENCY_CHAN0 + chan, (uint32_t)adc_period_ms * 1000 );
+}
+
+void update_outputs_ready( bool cycle_end )
+{
+    /* Event driven cycle: each channel as soon as its pressure, and its flow if the output
+     * follows it, are read back, written to its own DAC output. Input to output is then one
+     * channel's sample, not the whole scan. <cycle_end> takes the channels still waiting,
+     * e.g. after an ADC timeout, and writes them together. */
+    uint8_t chan;
+    uint8_t bit;
+    uint8_t waiting;
+    uint8_t updated = 0;
+    
+    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+    {
+        bit = 1 << chan;
+        if ( ctrl_updated & bit )
+            continue;
+        
+        waiting = adc_read_pending & bit;
+        
+        /* A flow loop on the estimate goes with its pressure, the reading corrects the next cycle */
+        if ( flow_loop_active( chan ) && ( !flow_est_valid( chan ) || ( ftune[chan].state == FTUNE_STATE_RUNNING ) ) )
+            waiting |= flow_read_pending & bit;
+        if ( waiting && !cycle_end )
+            continue;
+        
+        update_output( chan );
+        if ( !cycle_end )
+            set_pressure( chan );
+        ctrl_updated |= bit;
+        updated |= bit;
+    }
+    
+    if ( cycle_end )
+        set_pressures();
+    
+    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+    {
+        if ( updated & ( 1 << chan ) )
+            latency_output( LATENCY_CHAN0 + chan, (uint32_t)adc_period_ms * 1000 );
+    }
 }
 
-void update_outputs( void )
+void capture_status_snapshot( void )
 {
+    /* Called from the main loop only, between packets, so no copy can be torn by a SET */
     uint8_t chan;
-    int32_t diff;
     
+    status_snapshot.seq++;
+    status_snapshot.time_us = loop_cycle_start_us;
+    status_snapshot.frame = loop_cycle_frame;
     for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
     {
-        if ( ( flow_ctrl_state[chan] == FLOW_CTRL_STATE_RUNNING ) && flow_present[chan] )
-        {
-            /* Flow control loop */
-            
-            int32_t error;
-            int32_t output;
-            int32_t output_change;
-            int32_t fpid_p_term;
-            int32_t fpid_d_term;
-            
-            error = flow_raw_target[chan] - flow_raw_actual[chan];
-            fpid_p_term = constrain_i32( ( error * fpid_p[chan] ), -(int32_t)FPID_P_TERM_LIMIT, FPID_P_TERM_LIMIT );
-            fpid_integrated[chan] += constrain_i32( error * fpid_i[chan], -(int32_t)FPID_I_CHANGE_LIMIT, FPID_I_CHANGE_LIMIT );
-            fpid_integrated[chan] = constrain_i32( fpid_integrated[chan], -fpid_windup_limit << FPID_I_SHIFT, fpid_windup_limit << FPID_I_SHIFT );
-            diff = ( constrain_i32( error - fpid_error_prev[chan], INT16_MIN, INT16_MAX ) * fpid_d[chan] );
-            fpid_diff[chan] = ( ( fpid_diff[chan] * FPID_DIFF_FILT_MUL ) + diff ) >> FPID_DIFF_FILT_SHIFT;
-            fpid_d_term = constrain_i32( fpid_diff[chan], -(int32_t)FPID_TERM_MAX, FPID_TERM_MAX );
-            fpid_error_prev[chan] = error;
-            
-            output = ( fpid_p_term ) +
-                     ( fpid_integrated[chan] ) +
-                     ( fpid_d_term );
-            
-            output_change = constrain_i32( output >> FPID_I_SHIFT, -(int32_t)FPID_OUTPUT_SLEW_LIMIT, FPID_OUTPUT_SLEW_LIMIT );
-            output = output_change + pressure_mbar_shl_output[chan];
-            output = constrain_i32( output, 0, (int32_t)PRESSURE_CTLR_MBAR << PRESSURE_SHL );
-            pressure_mbar_shl_output[chan] = (uint16_t)output;
-            
-           printf( "Chan %hu, error %6li, output %5li, %6li, %6li, %6li, change %5li\n", chan, error, output, fpid_p_term >> FPID_I_SHIFT, fpid_integrated[chan] >> FPID_I_SHIFT, fpid_d_term >> FPID_I_SHIFT, output_change );
-        }
-        else if ( ( pressure_ctrl_state[chan] == PRESSURE_CTRL_STATE_RUNNING ) && true )
-        {
-            /* Pressure control loop */
-            
-        }
-        else if ( ctrl_modes[chan] == CTRL_MODE_PRESSURE_OPEN_LOOP )
-        {
-            /* Pressure open loop */
-            
-            pressure_mbar_shl_output[chan] = pressure_mbar_shl_target[chan];
-        }
-        else if ( ctrl_modes[chan] == CTRL_MODE_ZERO )
-        {
-            /* Pressure zero */
-            
-            pressure_mbar_shl_output[chan] = 0;
-        }
+        status_snapshot.pressure_mbar_shl_actual[chan] = pressure_mbar_shl_actual[chan];
+        status_snapshot.pressure_mbar_shl_output[chan] = pressure_mbar_shl_output[chan];
+        status_snapshot.pressure_mbar_shl_target[chan] = pressure_mbar_shl_target[chan];
+        status_snapshot.flow_raw_actual[chan] = flow_raw_actual[chan];
+        status_snapshot.flow_raw_target[chan] = flow_raw_target[chan];
+        status_snapshot.ctrl_modes[chan] = ctrl_modes[chan];
+        status_snapshot.flow_ctrl_state[chan] = flow_ctrl_state[chan];
     }
-        
-    set_pressures();
+}
+
+void publish_replies( void )
+{
+    /* After capture_status_snapshot(): the "get actual" replies are built once per cycle,
+     * including the flow scaling, so the packets only copy them out */
+    uint8_t chan;
+    pkt_pressure_actual_reply_t *pressure_reply;
+    pkt_flow_reply_t *flow_reply;
+    
+    pressure_reply = (pkt_pressure_actual_reply_t *)spi_reply_cache_slot( &pressure_actual_reply );
+    pressure_reply->rc = ERR_OK;
+    memcpy( pressure_reply->pressure, status_snapshot.pressure_mbar_shl_actual, sizeof(pressure_reply->pressure) );
+    spi_reply_cache_publish( &pressure_actual_reply, sizeof(pkt_pressure_actual_reply_t) );
+    
+    flow_reply = (pkt_flow_reply_t *)spi_reply_cache_slot( &flow_actual_reply );
+    flow_reply->rc = ERR_OK;
+    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+        flow_reply->flow[chan] = flow_raw_to_ul_hr( chan, status_snapshot.flow_raw_actual[chan] );
+    spi_reply_cache_publish( &flow_actual_reply, sizeof(pkt_flow_reply_t) );
+}
+
+void capture_history( void )
+{
+    /* After capture_status_snapshot(), overwrites the oldest record once the ring is full */
+    uint8_t chan;
+    history_record_t *record = &history[history_head];
+    
+    record->seq = status_snapshot.seq;
+    record->time_us = status_snapshot.time_us;
+    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+    {
+        record->pressure_mbar_shl_actual[chan] = status_snapshot.pressure_mbar_shl_actual[chan];
+        record->pressure_mbar_shl_output[chan] = status_snapshot.pressure_mbar_shl_output[chan];
+        record->flow_raw_actual[chan] = status_snapshot.flow_raw_actual[chan];
+    }
+    memcpy( record->fpid_terms, fpid_terms, sizeof(fpid_terms) );
+    
+    history_head = ( history_head + 1 ) & ( HISTORY_LEN - 1 );
+    if ( history_count < HISTORY_LEN )
+        history_count++;
+}
+
+void push_telemetry( void )
+{
+    /* Sample: [Seq U16][Time us U32][Frame U32]Nx[Pressure actual I16]Nx[Flow actual ul/hr I16], from the snapshot.
+     * Compact, the rio_delta record of its TELEMETRY_WORDS words, as TELEMETRY_COMPACT. */
+    uint8_t chan;
+    uint16_t words[TELEMETRY_WORDS];    // The packed sample, word aligned for rio_delta
+    pkt_telemetry_sample_t *sample = (pkt_telemetry_sample_t *)words;
+    uint8_t sample_buf[ DELTA_RECORD_MAX( TELEMETRY_WORDS ) ];
+    uint8_t *sample_ptr = (uint8_t *)words;
+    uint8_t sample_size = TELEMETRY_SAMPLE_SIZE;
+    
+    if ( ( telemetry_period == 0 ) || ( ++telemetry_count < telemetry_period ) )
+        return;
+    telemetry_count = 0;
+    
+    sample->seq = status_snapshot.seq;
+    sample->time_us = status_snapshot.time_us;
+    sample->frame = status_snapshot.frame;
+    memcpy( sample->pressure_actual, status_snapshot.pressure_mbar_shl_actual, sizeof(sample->pressure_actual) );
+    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+        sample->flow_actual[chan] = flow_raw_to_ul_hr( chan, status_snapshot.flow_raw_actual[chan] );
+    
+    if ( telemetry_format == RECORD_FORMAT_COMPACT )
+    {
+        sample_size = delta_encode( &telemetry_coder, words, sample_buf );
+        sample_ptr = sample_buf;
+    }
+    
+    /* Leave room for replies, the host drains samples in bulk */
+    if ( ( SPI_WRITE_BUF_SIZE - spi_write_bytes_written() ) < ( sample_size + 4 + TELEMETRY_TX_RESERVE ) )
+    {
+        telemetry_dropped += ( telemetry_dropped != 0xFFFF );
+        delta_key( &telemetry_coder );      // The host must not decode the next against this one
+        return;
+    }
+    
+    spi_packet_write( ( telemetry_format == RECORD_FORMAT_COMPACT ) ? PACKET_TYPE_TELEMETRY_COMPACT : PACKET_TYPE_TELEMETRY_SAMPLE, sample_ptr, sample_size );
+}
+
+void push_reports( void )
+{
+    /* REPORT of the signals past their deadband or interval, from the snapshot as telemetry */
+    int16_t values[REPORT_SIGNALS];
+    uint8_t report_buf[ REPORT_SIZE_MAX( REPORT_SIGNALS ) ];
+    uint8_t report_size;
+    uint8_t chan;
+    
+    if ( !report_active() )
+        return;
+    
+    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+    {
+        values[chan] = status_snapshot.pressure_mbar_shl_actual[chan];
+        values[NUM_PRESSURE_CLTRLS + chan] = flow_raw_to_ul_hr( chan, status_snapshot.flow_raw_actual[chan] );
+    }
+    
+    report_size = report_poll( values, report_buf );
+    if ( report_size == 0 )
+        return;
+    
+    /* Leave room for replies as for telemetry, unsent signals go in a later REPORT */
+    if ( ( SPI_WRITE_BUF_SIZE - spi_write_bytes_written() ) < ( report_size + 4 + TELEMETRY_TX_RESERVE ) )
+    {
+        report_done( false );
+        return;
+    }
+    
+    spi_packet_write( PACKET_TYPE_REPORT, report_buf, report_size );
+    report_done( true );
+}
+
+void update_loop_stats( void )
+{
+    /* Called when a control cycle completes */
+    uint16_t now = timer_ms;
+    
+    loop_stats.busy_ms_last = now - loop_cycle_start;
+    if ( loop_stats.busy_ms_last > loop_stats.busy_ms_max )
+        loop_stats.busy_ms_max = loop_stats.busy_ms_last;
+    
+    /* A cycle longer than the period delays or skips the next one */
+    if ( ( loop_stats.busy_ms_last >= adc_period_ms ) && ( loop_stats.overruns != 0xFFFF ) )
+        loop_stats.overruns++;
+    
+    if ( loop_stats.cycles > 0 )
+    {
+        loop_stats.period_ms_last = now - loop_cycle_end;
+        if ( loop_stats.period_ms_last > loop_stats.period_ms_max )
+            loop_stats.period_ms_max = loop_stats.period_ms_last;
+    }
+    
+    loop_stats.cycles++;
+    loop_cycle_end = now;
+}
+
+void retain_save( void )
+{
+    /* Once per control cycle. The block is in a persistent section, so a watchdog reset
+     * leaves it for retain_restore(), and a power-on leaves it random, which the CRC catches. */
+    uint8_t chan;
+    
+    retain.magic = RETAIN_MAGIC;
+    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+    {
+        retain.ctrl_modes[chan] = ctrl_modes[chan];
+        retain.pressure_target[chan] = pressure_mbar_shl_target[chan];
+        retain.pressure_output[chan] = pressure_mbar_shl_output[chan];
+        retain.flow_cascade_setpoint[chan] = flow_cascade_setpoint[chan];
+        retain.flow_target[chan] = flow_raw_target[chan];
+        retain.flow_ramp[chan] = flow_ramp_raw[chan];
+        retain.flow_scale[chan] = flow_scales_ul_min[chan];
+    }
+    memcpy( retain.ppid_loop, ppid_loop, sizeof(retain.ppid_loop) );
+    retain.crc = store_crc16( STORE_CRC_INIT, (uint8_t *)&retain, offsetof( retain_t, crc ) );
+}
+
+bool retain_restore( uint16_t reset_cause )
+{
+    /* At start-up, after storage_startup() and flow_boot_start(). After a watchdog reset with
+     * a valid block, each channel goes back to its mode, targets and output, and a pressure
+     * loop to its integrator, before the DACs are written. The pressure loops carry on from
+     * the first cycle, a flow loop from when its sensor is found again, see flow_probe_found(),
+     * holding its output until then. Returns true if the loops resumed. */
+    uint8_t chan;
+    
+    retain_status = RETAIN_STATUS_COLD;
+    if ( !( reset_cause & RESET_MASK_WDTO ) )
+        return false;
+    
+    retain_status = RETAIN_STATUS_LOST;
+    if ( ( retain.magic != RETAIN_MAGIC ) ||
+         ( store_crc16( STORE_CRC_INIT, (uint8_t *)&retain, offsetof( retain_t, crc ) ) != retain.crc ) )
+        return false;
+    
+    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
+    {
+        /* The flow values are in the counts of the sensor that was there. A different one
+         * found by the probe moves them to its own scale. */
+        if ( retain.flow_scale[chan] != 0 )
+            flow_set_scale( chan, retain.flow_scale[chan] );
+        pressure_mbar_shl_target[chan] = retain.pressure_target[chan];
+        pressure_mbar_shl_output[chan] = retain.pressure_output[chan];
+        flow_cascade_setpoint[chan] = retain.flow_cascade_setpoint[chan];
+        flow_raw_target[chan] = retain.flow_target[chan];
+        flow_ramp_raw[chan] = retain.flow_ramp[chan];
+    }
+    
+    /* Starting a pressure loop resets it, so its state goes back after */
+    set_ctrl_modes( retain.ctrl_modes );
+    memcpy( ppid_loop, retain.ppid_loop, sizeof(ppid_loop) );
+    
+    retain_status = RETAIN_STATUS_RESUMED;
+    return true;
 }
 
 void startup_test( void )
 {
     bool all_okay = true;
+    uint8_t bank;
     
     eeprom_okay = eeprom_comms_check();
     all_okay &= eeprom_okay;
     printf( "EEPROM %s\n", eeprom_okay ? OK_STR : FAIL_STR );
     
-    adc_okay = ( ads1115_set_ready_pin( adc_i2c_addr ) == ERR_OK );
+    adc_okay = true;
+    mux_okay = true;
+    for ( bank=0; bank<NUM_PRESSURE_BANKS; bank++ )
+    {
+        adc_okay &= ( ads1115_set_ready_pin( adc_i2c_addrs[bank] ) == ERR_OK );
+        mux_okay &= ( pca9544a_write( pca9544a_i2c_addrs[bank], 0, 0 ) == ERR_OK );
+    }
     all_okay &= adc_okay;
     printf( "ADC %s\n", adc_okay ? OK_STR : FAIL_STR );
     
-    mux_okay = ( pca9544a_write( pca9544a_i2c_addr, 0, 0 ) == ERR_OK );
     all_okay &= mux_okay;
     printf( "I2C MUX %s\n", mux_okay ? OK_STR : FAIL_STR );
     
@@ -876,102 +5343,42 @@ void startup_test( void )
     }
     else if ( 0 )
     {
-        dac_reset();
-        dac_ref_internal( 1 );
-        dac_write_ldac( DAC_CHAN_A, 1ul * 0xFFFF / 5, 0 );
-        dac_write_ldac( DAC_CHAN_B, 2ul * 0xFFFF / 5, 0 );
-        dac_write_ldac( DAC_CHAN_C, 3ul * 0xFFFF / 5, 0 );
-        dac_write_ldac( DAC_CHAN_D, 4ul * 0xFFFF / 5, 1 );
+        dac_reset( 0 );
+        dac_ref_internal( 0, 1 );
+        dac_write_ldac( 0, 1ul * 0xFFFF / 5, 0 );
+        dac_write_ldac( 1, 2ul * 0xFFFF / 5, 0 );
+        dac_write_ldac( 2, 3ul * 0xFFFF / 5, 0 );
+        dac_write_ldac( 3, 4ul * 0xFFFF / 5, 1 );
         while (1);
     }
 }
 
-void init_sensirion_lg16( void )
-{
-    err rc;
-    uint8_t chan;
-//    char sensirion_part_num[SENSIRION_PART_NAME_STR_LEN];
-    uint16_t adv_user_reg;
-    int16_t flow;
-    uint16_t flow_scale;
-    
-    for ( chan=0; chan<NUM_PRESSURE_CLTRLS; chan++ )
-    {
-        rc = pca9544a_write( pca9544a_i2c_addr, 1, flow_map[chan] );
-        
-        if ( rc == ERR_OK )
-            sensirion_measurement_read( &flow );   // In case we got stuck in a read
-        if ( rc == ERR_OK )
-            rc = sensirion_reset( true );
-        if ( rc == ERR_OK )
-            rc = sensirion_read_reg( SENSIRION_REG_ADV_USER_READ, &adv_user_reg );
-        if ( rc == ERR_OK )
-            adv_user_reg &= ~0x02;  // Disable hold-master
-        if ( rc == ERR_OK )
-            rc = sensirion_write_reg( SENSIRION_REG_ADV_USER_WRITE, adv_user_reg );
-        if ( rc == ERR_OK )
-            rc = sensirion_read_scale( SENSIRION_EEPROM_ADDR_SCALE0, &flow_scale );
-        else
-            flow_scale = 1;
-        if ( rc == ERR_OK )
-            sensirion_measurement_start();
-        
-        flow_scales_ul_min[chan] = flow_scale;
-        flow_present[chan] = ( rc == ERR_OK ) ? true : false;
-        
-        /* We can't start flow loop without flow scaling units */
-        if ( !flow_present[chan] )
-            flow_ctrl_state[chan] = FLOW_CTRL_STATE_ERROR;
-        
-        printf( "Sensirion LG16 channel %hu %s, scale %u\n", chan+1, (rc==ERR_OK)?OK_STR:FAIL_STR, flow_scale );
-    }
-    
-    printf( "\n" );
-    
-    /* Allow enough time for first measurements. */
-    __delay_ms( 100 );
-    
-    /*
-    rc = pca9544a_write( pca9544a_i2c_addr, 1, flow_map[0] );
-    rc = sensirion_read_part_name( sensirion_part_num );
-    printf( "Sensirion Read ID RC: %hu\n", rc );
-    printf( "Sensirion Part Name: %s\n", sensirion_part_num );
-    rc = sensirion_read_reg( SENSIRION_REG_ADV_USER_READ, &adv_user_reg );
-    printf( "Sensirion Read Adv User Reg RC: %u\n", rc );
-    printf( "Sensirion Adv User Reg: %u\n", adv_user_reg );
-    adv_user_reg &= ~0x02;          // Disable hold-master
-    rc = sensirion_write_reg( SENSIRION_REG_ADV_USER_WRITE, adv_user_reg );
-    printf( "Sensirion Write Adv User Reg RC: %u, %u\n", rc, adv_user_reg );
-    rc = sensirion_read_reg( SENSIRION_REG_ADV_USER_READ, &adv_user_reg );
-    printf( "Sensirion Read Adv User Reg RC: %u\n", rc );
-    printf( "Sensirion Adv User Reg: %u\n", adv_user_reg );
-    
-    rc = sensirion_read_scale( SENSIRION_EEPROM_ADDR_SCALE0, &flow_scale );
-    printf( "Sensirion Read Scale RC: %u\n", rc );
-    printf( "Sensirion Scale: %u\n", flow_scale );
-    
-    rc = sensirion_measurement_start();
-    printf( "Sensirion Measurement Start RC: %hu\n", rc );
-    __delay_ms( 100 );
-    rc = sensirion_measurement_read( &flow );
-    printf( "Sensirion Measurement Read RC: %hu\n", rc );
-	printf( "Sensirion Measurement Flow: %i\n", flow );
-    */
-}
-
-int main(void)
+void main_setup( void )
 {
-    err rc = 0;
-    err comms_rc;
-    bool adc_i2c_wait;
+    /* Start-up, up to the main loop. main() then calls main_loop() forever, the host build
+     * in hardware-modules/host_test calls both to run the firmware in the loop. */
+    uint8_t bank;
+    uint16_t reset_cause = RESET_GetCause();
+    bool resumed;
 //    uint8_t ints, enabled, channel;
     
     SYSTEM_Initialize();
+    i2c_bus_init();
     init();
     
+    /* Init SPI first: requests wait in the read ring and are answered from the first main
+     * loop pass, while the flow sensors are still being probed */
+    spi_init();
+    spi_packet_init( &spi_packet, (uint16_t *)&timer_ms, 300 );
+    publish_replies();              // Zeros until the first control cycle
+    
+    param_init( params, sizeof(params) / sizeof(params[0]) );
+    stage_init( parse_packet, PACKET_TYPE_BATCH, PACKET_TYPE_STAGE );
+    report_init( REPORT_SIGNALS );
+    flash_init( &timer_ms, 1000 );
+    
     /* Print Header */
     printf( "\033\143" );  // Clear / reset terminal
-    __delay_ms( 100 );
     printf( "\r\nStarting...\n\n" );
     
     /* Init Timers */
@@ -983,241 +5390,309 @@ int main(void)
     /* Load Settings from EEPROM */
     storage_startup();
     
+    /* Continue the EEPROM fault log, logging this reset with its cause */
+    fault_init( &timer_ms, 1000, eeprom_okay, reset_cause );
+    RESET_CauseClearAll();
+    
+    /* Sensirion flow sensors, probed by flow_probe_poll() from the main loop */
+    flow_boot_start();
+    
+    /* After a watchdog reset, the loops where the last control cycle left them */
+    resumed = retain_restore( reset_cause );
+    printf( "Watchdog resume %s\n", resumed ? OK_STR : ( retain_status == RETAIN_STATUS_LOST ) ? FAIL_STR : "-" );
+    
     /* Init ADC */
-    ads1115_set_ready_pin( adc_i2c_addr );
-//    ADC_RDY_SetInterruptHandler( adc_rdy_isr );
+    for ( bank=0; bank<NUM_PRESSURE_BANKS; bank++ )
+        ads1115_set_ready_pin( adc_i2c_addrs[bank] );
+    adc_rdy_interrupt_init();
+    frame_sync_interrupt_init();
     
-    /* Init DAC */
-    dac_reset();
-    dac_ref_internal( 1 );
+    /* Init DAC. A watchdog reset does not reach the DACs, a resume keeps their outputs. */
+    for ( bank=0; bank<NUM_PRESSURE_BANKS; bank++ )
+    {
+        if ( !resumed )
+            dac_reset( bank );
+        dac_ref_internal( bank, 1 );
+    }
     set_pressures();
     
-    /* Init I2C MUX */
-    rc = pca9544a_write( pca9544a_i2c_addr, 0, flow_map[0] );
+    /* Init I2C MUX, all off */
+    for ( bank=0; bank<NUM_PRESSURE_BANKS; bank++ )
+        pca9544a_write( pca9544a_i2c_addrs[bank], 0, flow_map[0] );
     /*
-    rc = pca9544a_write( pca9544a_i2c_addr, 1, flow_map[0] );
+    rc = pca9544a_write( pca9544a_i2c_addrs[0], 1, flow_map[0] );
     printf( "I2C Mux Write RC: %hu\n", rc );
-    rc = pca9544a_read( pca9544a_i2c_addr, &ints, &enabled, &channel );
+    rc = pca9544a_read( pca9544a_i2c_addrs[0], &ints, &enabled, &channel );
     printf( "I2C Mux Read RC: %hu\n", rc );
     printf( "I2C Mux ints %hu, enabled %hu, channel %hu\n", ints, enabled, channel );
     */
     
-    /* Init Sensirion flow sensor */
-    init_sensirion_lg16();
+#ifdef PROBE_ENABLED
+    probe_init();
+#endif
+#if PROBE_TRACE_PINS > 0
+    probe_trace_init();
+#endif
+    latency_init();
     
-    /* Test Code */
-//    read_flows();
-//    flow_ctrl_start( 0, (int16_t)( (int32_t)10 * flow_scales_ul_min[1] / 60 ) );    // in ul/hr
+    adc_time = timer_ms;
+    adc_i2c_wait = 0;
+    adc_cycle_done = 0;
     
-//    while ( 1 );
+    /* From here every main loop pass clears it */
+    WATCHDOG_TimerSoftwareEnable();
+}
+
+void main_loop( void )
+{
+    /* One pass of the main loop */
+    err rc;
+    err comms_rc;
+    bool i2c_recovered;
     
-    /* Init SPI */
-    spi_init();
-    spi_packet_init( &spi_packet, (uint16_t *)&timer_ms, 300 );
+    PROBE_PASS();                   // CPU load, from the passes that fit in a second
+    PROBE_BEGIN( PROBE_LOOP );
+    WATCHDOG_TimerClear();
     
-    __delay_ms( 100 );
-
-    adc_time = timer_ms;
-    adc_i2c_wait = 0;
+    ADC_RDY_INT_DISABLE();
+    PROBE_BEGIN( PROBE_I2C );
     
-    while (1)
+    if ( I2C2_Aborted() )
     {
-        if ( I2C2_Aborted() )
-        {
-            adc_state = ADC_STATE_WAIT;
-            adc_i2c_wait = 0;
-        }
+        fault_log( FAULT_ID_I2C_ABORT, 0 );
+        adc_state = ADC_STATE_WAIT;
+        adc_i2c_wait = 0;
+        TRACE_END( TRACE_I2C_WAIT );
+        flow_mux_selected = FLOW_MUX_UNKNOWN;
+    }
+    
+    if ( i2c_bus_stuck( &i2c_recovered ) )
+        fault_log( FAULT_ID_I2C_STUCK, i2c_recovered );
+    
+    i2c_bus_poll();                 // Clock change, once the bus is idle
+    
+    if ( adc_i2c_wait )
+    {
+        int8_t adc_rc;
+        uint16_t adc_value;
+        int8_t channel;
         
-        if ( adc_i2c_wait )
-        {
-            int8_t adc_rc;
-            uint16_t adc_value;
-            int8_t channel;
-            
-            /* See what's happening on ADC I2C */
-            adc_rc = ads1115_read_adc_return( &adc_value, &channel, &adc_task );
+        /* See what's happening on ADC I2C */
+        adc_rc = ads1115_read_adc_return( &adc_value, &channel, &adc_task );
 
-            switch ( adc_rc )
-            {
-                case 0:
-                {
-                    /* Still waiting */
-                    break;
-                }
-                case 1:
-                {
-                    /* I2C success */
-                    adc_i2c_wait = 0;
-                    
-                    if ( channel >= 0 )
-                    {
-//                        printf( "Pressure: %u\n", adc_value );
-                        /* Value returned */
-                        pressure_mbar_shl_actual[adc_map[channel]] = PRESSURE_ADC_TO_MBARSHL( adc_value );
-                        /*
-                        printf( "State %u, Channel %hi, Pressures: %i %i %i %i\n",
-                                adc_state, channel,
-                                pressure_mbar_shl_actual[0],
-                                pressure_mbar_shl_actual[1],
-                                pressure_mbar_shl_actual[2],
-                                pressure_mbar_shl_actual[3] );
-                        */
-                    }
-                    
-                    break;
-                }
-                case -1:
-                {
-                    /* Timeout */
-                    adc_state = ADC_STATE_WAIT;
-                    adc_i2c_wait = 0;
-                    break;
-                }
-                default:
-                    ;
-            }
-            
-//            printf( "adc_state=%hu, adc_rc=%hi\n", (uint8_t)adc_state, adc_rc );
-            /* When we have read all ADCs (or error), update outputs */
-            if ( ( adc_state == ADC_STATE_WAIT ) && ( adc_rc != 0 ) )
-            {
-                read_flows();
-                update_outputs();
-            }
-        }
-        else switch ( adc_state )
+        switch ( adc_rc )
         {
-            case ADC_STATE_START:
+            case 0:
             {
-                adc_chan = 0;
-                ads1115_read_adc_start( adc_i2c_addr, -1, adc_chan, adc_datarate, adc_gain, &adc_task );
-//                __delay_ms( 10 );
-                adc_i2c_wait = 1;
-                adc_state = ADC_STATE_SAMPLE;
+                /* Still waiting */
                 break;
             }
-            case ADC_STATE_SAMPLE:
+            case 1:
             {
-                if ( !ADC_RDY_GetValue() )
+                /* I2C success */
+                adc_i2c_wait = 0;
+                TRACE_END( TRACE_I2C_WAIT );
+                
+                if ( ( channel >= 0 ) && adc_burst_add( adc_map[channel], adc_value, &adc_value ) )
                 {
-                    uint8_t read_chan = adc_chan;
-                    
-                    /* Read back ADC and start next channel */
-                    if ( read_chan >= ADC_CHAN_MAX )
-                    {
-                        /* Read last channel */
-                        ads1115_read_adc_start( adc_i2c_addr, read_chan, -1, adc_datarate, adc_gain, &adc_task );
-                        adc_state = ADC_STATE_WAIT;
-                    }
-                    else
-                    {
-                        /* Read and start next */
-                        adc_chan++;
-                        ads1115_read_adc_start( adc_i2c_addr, read_chan, adc_chan, adc_datarate, adc_gain, &adc_task );
-                    }
+//                        printf( "Pressure: %u\n", adc_value );
+                    /* Value returned, the mean of a burst; each conversion was limit checked */
+                    int16_t pressure = adc_to_mbar_shl( adc_map[channel], adc_value );
                     
-                    adc_i2c_wait = 1;
+                    pressure_cal_sample( adc_map[channel], pressure );
+                    pressure = pressure_cal_apply( adc_map[channel], pressure );
+                    pressure_mbar_shl_actual[adc_map[channel]] = signal_filter( adc_map[channel], FILTER_SIGNAL_PRESSURE, pressure );
+                    flow_est_predict( adc_map[channel], pressure_mbar_shl_actual[adc_map[channel]] );
+                    adc_read_pending &= ~( 1 << adc_map[channel] );
+                    latency_sample( LATENCY_CHAN0 + adc_map[channel] );
+                    /*
+                    printf( "State %u, Channel %hi, Pressures: %i %i %i %i\n",
+                            adc_state, channel,
+                            pressure_mbar_shl_actual[0],
+                            pressure_mbar_shl_actual[1],
+                            pressure_mbar_shl_actual[2],
+                            pressure_mbar_shl_actual[3] );
+                    */
                 }
-                /* ** Put below back in */
-                /*
-                else if ( ( timer_ms - adc_time ) > ADC_PERIOD_MS )
-                {
-                    adc_state = ADC_STATE_START;
-                    adc_time += ADC_PERIOD_MS;
-                }*/
                 
                 break;
             }
-            case ADC_STATE_WAIT:
+            case -1:
             {
-//                printf( "State: %hu, time=%u, on=%hu\n", (uint8_t)adc_state, TMR1, T1CONbits.TON );
-        
-                while ( ( timer_ms - adc_time ) > ADC_PERIOD_MS )
-                {
-                    adc_state = ADC_STATE_START;
-                    adc_time += ADC_PERIOD_MS;
-                }
+                /* Timeout */
+                fault_log( FAULT_ID_ADC_TIMEOUT, 0 );
+                adc_state = ADC_STATE_WAIT;
+                adc_i2c_wait = 0;
+                TRACE_END( TRACE_I2C_WAIT );
                 break;
             }
             default:
-                adc_state = ADC_STATE_START;
+                ;
         }
         
-        comms_rc = spi_packet_read( &spi_packet, &packet_type, (uint8_t *)&packet_data, &packet_data_size, SPI_PACKET_BUF_SIZE );
-        
-        if ( ( comms_rc == ERR_OK ) && ( packet_type != 0 ) )
+//            printf( "adc_state=%hu, adc_rc=%hi\n", (uint8_t)adc_state, adc_rc );
+        /* When we have read all ADCs (or error), update outputs once the flows are in */
+        if ( ( adc_state == ADC_STATE_WAIT ) && ( adc_rc != 0 ) )
+            adc_cycle_done = 1;
+    }
+    else switch ( adc_state )
+    {
+        case ADC_STATE_START:
         {
-            rc = ERR_OK;
-            
-            printf( "Packet received: Cmd %hu\n", packet_type );
-            spi_clear_write();
+            adc_chan = 0;
+            loop_cycle_start = timer_ms;
+            loop_cycle_start_us = time_now_us();
+            FRAME_SYNC_INT_DISABLE();
+            loop_cycle_frame = frame_sync_frame;
+            frame_sync_frame = 0;
+            if ( frame_sync_mode != FRAME_SYNC_OFF )
+                FRAME_SYNC_INT_ENABLE();
+            adc_read_pending = CTRL_CHAN_ALL;
+            ctrl_updated = 0;
+            ctrl_event_cycle = ctrl_event_enable;
+            memset( adc_burst_count, 0, sizeof(adc_burst_count) );    // Left over from a timeout
+            memset( adc_burst_sum, 0, sizeof(adc_burst_sum) );
+            adc_burst_left = adc_bursts[adc_map[adc_chan]] - 1;
+            adc_read_start( -1, adc_chan );
+//                __delay_ms( 10 );
+            adc_i2c_wait = 1;
+            TRACE_BEGIN( TRACE_I2C_WAIT );
+            adc_state = ADC_STATE_SAMPLE;
             
-            switch ( packet_type )
-            {
-                case 0:
-                {
-                    /* No or invalid packet */
-                    rc = ERR_PACKET_INVALID;
-                    break;
-                }
-                case PACKET_TYPE_GET_ID:
-                    rc = parse_packet_get_id( packet_type, packet_data, packet_data_size );
-                    break;
-                case PACKET_TYPE_SET_PRESSURE_TARGET:
-                    rc = parse_packet_set_pressure_target( packet_type, packet_data, packet_data_size );
-                    break;
-                case PACKET_TYPE_GET_PRESSURE_TARGET:
-                    rc = parse_packet_get_pressure_target( packet_type, packet_data, packet_data_size );
-                    break;
-                case PACKET_TYPE_GET_PRESSURE_ACTUAL:
-                    rc = parse_packet_get_pressure_actual( packet_type, packet_data, packet_data_size );
-                    break;
-                case PACKET_TYPE_SET_FLOW_TARGET:
-                    rc = parse_packet_set_flow_target( packet_type, packet_data, packet_data_size );
-                    break;
-                case PACKET_TYPE_GET_FLOW_TARGET:
-                    rc = parse_packet_get_flow_target( packet_type, packet_data, packet_data_size );
-                    break;
-                case PACKET_TYPE_GET_FLOW_ACTUAL:
-                    rc = parse_packet_get_flow_actual( packet_type, packet_data, packet_data_size );
-                    break;
-                case PACKET_TYPE_SET_CONTROL_MODE:
-                    rc = parse_packet_set_control_mode( packet_type, packet_data, packet_data_size );
-                    break;
-                case PACKET_TYPE_GET_CONTROL_MODE:
-                    rc = parse_packet_get_control_mode( packet_type, packet_data, packet_data_size );
-                    break;
-                case PACKET_TYPE_SET_FPID_CONSTS:
-                    rc = parse_packet_set_fpid_consts( packet_type, packet_data, packet_data_size );
-                    break;
-                case PACKET_TYPE_GET_FPID_CONSTS:
-                    rc = parse_packet_get_fpid_consts( packet_type, packet_data, packet_data_size );
-                    break;
-                default:
-                    rc = ERR_PACKET_INVALID;
-            }
+            /* Flow reads run on I2C2 alongside the conversions, one channel at a time */
+            read_flows_start();
             
-            if ( rc != ERR_OK )
-                spi_packet_write( packet_type, &rc, 1 );
+            /* Profile points ahead of the first channel update */
+            if ( ctrl_event_cycle )
+                run_profiles();
+            break;
         }
-        else if ( ( spi_write_bytes_written() > 0 ) && spi_packet_timeout( &spi_packet ) )
+        case ADC_STATE_SAMPLE:
         {
-            spi_clear_write();
-            printf( "Cleared\n" );
+            /* Normally done by adc_rdy_isr(), this catches an edge that came while the
+             * previous transaction was still being returned */
+            if ( !ADC_RDY_GetValue() )
+                adc_sample_next();
+            /* ** Put below back in */
+            /*
+            else if ( ( timer_ms - adc_time ) > adc_period_ms )
+            {
+                adc_state = ADC_STATE_START;
+                adc_time += adc_period_ms;
+            }*/
+            
+            break;
         }
-        else if ( SS1_GetValue() != slave_select )
+        case ADC_STATE_WAIT:
         {
-            /* If slave select dropped, clear SPI interface */
-            
-            slave_select = !slave_select;
-            
-            if ( slave_select == 1 )
+//                printf( "State: %hu, time=%u, on=%hu\n", (uint8_t)adc_state, TMR1, T1CONbits.TON );
+    
+            if ( frame_sync_frame != 0 )
+            {
+                /* The timer only runs a cycle after adc_period_ms without a frame */
+                adc_state = ADC_STATE_START;
+                adc_time = timer_ms;
+            }
+            else while ( ( timer_ms - adc_time ) > adc_period_ms )
             {
-                spi_packet_clear( &spi_packet );
-                spi_clear_write();
+                adc_state = ADC_STATE_START;
+                adc_time += adc_period_ms;
             }
+            break;
         }
+        default:
+            adc_state = ADC_STATE_START;
+    }
+    
+    read_flows_poll();
+    flow_probe_poll();
+    
+    PROBE_END( PROBE_I2C );
+    ADC_RDY_INT_ENABLE();
+    
+    if ( ctrl_event_cycle && ( ctrl_updated != CTRL_CHAN_ALL ) )
+        update_outputs_ready( false );
+    
+    if ( adc_cycle_done && ( flow_read_state != FLOW_READ_CHANNEL ) )
+    {
+        adc_cycle_done = 0;
+        PROBE_BEGIN( PROBE_CYCLE );
+        TRACE_BEGIN( TRACE_CYCLE );
+        print_flows();
+        if ( !ctrl_event_cycle )
+            run_profiles();
+        PROBE_BEGIN( PROBE_UPDATE_OUTPUTS );
+        TRACE_BEGIN( TRACE_UPDATE_OUTPUTS );
+        if ( ctrl_event_cycle )
+            update_outputs_ready( true );
+        else
+            update_outputs();
+        TRACE_END( TRACE_UPDATE_OUTPUTS );
+        PROBE_END( PROBE_UPDATE_OUTPUTS );
+        capture_status_snapshot();
+        publish_replies();
+        capture_history();
+        push_telemetry();
+        push_reports();
+        update_loop_stats();
+        retain_save();
+        TRACE_END( TRACE_CYCLE );
+        PROBE_END( PROBE_CYCLE );
+    }
+    
+    /* Staged packets whose time has come, ahead of any new packet */
+    stage_poll();
+    
+    /* Next chunk of a HISTORY_STREAM transfer, once the host has made room for it */
+    spi_stream_poll();
+    
+    PROBE_BEGIN( PROBE_PACKET );
+    comms_rc = spi_packet_peek( &spi_packet, &packet_type, &packet_data, &packet_data_size );
+    
+    if ( ( comms_rc == ERR_OK ) && ( packet_type != 0 ) )
+    {
+        LOG_DEBUG( LOG_ID_PACKET, packet_type );
+        
+        /* Sequenced replies are matched by the host and samples are drained in bulk, so
+         * leave earlier ones queued */
+        if ( !spi_packet_sequenced() && !push_active() )
+            spi_clear_write();
+        
+        TRACE_BEGIN( TRACE_PACKET );
+        rc = parse_packet( packet_type, packet_data, packet_data_size );
+        TRACE_END( TRACE_PACKET );
+        
+        if ( rc != ERR_OK )
+            spi_packet_write( packet_type, &rc, 1 );
+        
+        spi_packet_consume( &spi_packet );
+        PROBE_END( PROBE_PACKET );
     }
+    else if ( !push_active() && ( spi_write_bytes_written() > 0 ) && spi_packet_timeout( &spi_packet ) )
+    {
+        spi_clear_write();
+        LOG_INFO( LOG_ID_SPI_CLEARED, 0 );
+    }
+    
+    /* Changed settings and fault records to the EEPROM write queue, and one step of that, never waits for the EEPROM */
+    store_flush();
+    fault_task();
+    eeprom_queue_task();
+    
+    /* One page erase or a slice of the image CRC, while a firmware update runs */
+    flash_task();
+    
+    rio_log_drain();
+    
+    PROBE_END( PROBE_LOOP );
+}
+
+int main(void)
+{
+    main_setup();
+    
+    while (1)
+        main_loop();
     
-    return 1; 
+    return 1;
 }
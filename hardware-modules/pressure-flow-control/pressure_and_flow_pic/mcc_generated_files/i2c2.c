@@ -151,7 +151,7 @@ typedef enum
 
 
 #ifndef I2C2_CONFIG_TR_QUEUE_LENGTH
-        #define I2C2_CONFIG_TR_QUEUE_LENGTH 1
+        #define I2C2_CONFIG_TR_QUEUE_LENGTH 8      // Hand edit, MCC default 1: one flow channel (3) and the ADC queue together
 #endif
 
 #define I2C2_TRANSMIT_REG                       I2C2TRN			// Defines the transmit register used to send data.
@@ -1,8 +1,9 @@
 #include "mcc_generated_files/mcc.h"
 #include "common.h"
 #include "pca9544a.h"
+#include "i2c_bus.h"
 
-#define I2C_TIMEOUT_MS      2
+#define I2C_TIMEOUT_MS      PCA9544A_I2C_TIMEOUT_MS
 
 extern err pca9544a_write( uint8_t addr, uint8_t enabled, uint8_t channel )
 {
@@ -19,15 +20,39 @@ extern err pca9544a_write( uint8_t addr, uint8_t enabled, uint8_t channel )
     
     time = timer_ms;
     while ( ( status != I2C2_MESSAGE_COMPLETE ) && ( ( timer_ms - time ) <= I2C_TIMEOUT_MS ) );
+    i2c_bus_count( I2C_DEV_MUX, status );
     if ( status != I2C2_MESSAGE_COMPLETE )
     {
         rc = ERR_PCA9544A_COMMS_FAIL;
-        I2C2_Abort();
+        i2c_bus_abort( I2C_DEV_MUX );
     }
     
 	return rc;
 }
 
+extern void pca9544a_write_start( uint8_t addr, uint8_t enabled, uint8_t channel, pca9544a_task_t *task )
+{
+    /* Queues the write and returns, task->status is I2C2_MESSAGE_COMPLETE once it is done */
+    
+    task->write_data[0] = ( enabled ? 0b100 : 0 ) | ( channel & 0b11 );
+    
+    I2C2_MasterWriteTRBBuild( &task->trBlocks[0], task->write_data, 1, addr );
+    I2C2_MasterTRBInsert( 1, task->trBlocks, (I2C2_MESSAGE_STATUS *)&task->status );
+}
+
+extern void pca9544a_switch_start( uint8_t off_addr, uint8_t addr, uint8_t channel, pca9544a_task_t *task )
+{
+    /* Queues turning off the mux at <off_addr> and selecting <channel> on the one at <addr>,
+     * for cascaded muxes with the same device addresses behind each. One status for both. */
+    
+    task->write_data[0] = 0;
+    task->write_data[1] = 0b100 | ( channel & 0b11 );
+    
+    I2C2_MasterWriteTRBBuild( &task->trBlocks[0], &task->write_data[0], 1, off_addr );
+    I2C2_MasterWriteTRBBuild( &task->trBlocks[1], &task->write_data[1], 1, addr );
+    I2C2_MasterTRBInsert( 2, task->trBlocks, (I2C2_MESSAGE_STATUS *)&task->status );
+}
+
 extern err pca9544a_read( uint8_t addr, uint8_t *ints, uint8_t *enabled, uint8_t *channel )
 {
     err rc = ERR_OK;
@@ -41,13 +66,14 @@ extern err pca9544a_read( uint8_t addr, uint8_t *ints, uint8_t *enabled, uint8_t
     
     time = timer_ms;
     while ( ( status != I2C2_MESSAGE_COMPLETE ) && ( ( timer_ms - time ) <= I2C_TIMEOUT_MS ) );
+    i2c_bus_count( I2C_DEV_MUX, status );
     if ( status != I2C2_MESSAGE_COMPLETE )
     {
         rc = ERR_PCA9544A_COMMS_FAIL;
         *ints = 0;
         *enabled = 0;
         *channel = 0;
-        I2C2_Abort();
+        i2c_bus_abort( I2C_DEV_MUX );
     }
     else
     {
@@ -5,7 +5,16 @@
 extern "C" {
 #endif
 
+typedef struct
+{
+    uint8_t write_data[2];
+    I2C2_TRANSACTION_REQUEST_BLOCK trBlocks[2];
+    volatile I2C2_MESSAGE_STATUS status;
+} pca9544a_task_t;
+
 extern err pca9544a_write( uint8_t addr, uint8_t enabled, uint8_t channel );
+extern void pca9544a_write_start( uint8_t addr, uint8_t enabled, uint8_t channel, pca9544a_task_t *task );
+extern void pca9544a_switch_start( uint8_t off_addr, uint8_t addr, uint8_t channel, pca9544a_task_t *task );
 extern err pca9544a_read( uint8_t addr, uint8_t *ints, uint8_t *enabled, uint8_t *channel );
 
 #ifdef	__cplusplus
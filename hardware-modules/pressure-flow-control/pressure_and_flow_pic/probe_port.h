@@ -0,0 +1,61 @@
+/*
+ * File:   probe_port.h
+ *
+ * dsPIC33CK (SCCP9) shim for the shared rio_probe module, see
+ * hardware-modules/common/rio_probe.
+ */
+
+#ifndef PROBE_PORT_H
+#define	PROBE_PORT_H
+
+#include <xc.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/* Comment out to build the probes out, GET_PROBE_STATS then reports none */
+#define PROBE_ENABLED
+
+/* Probes */
+#define PROBE_LOOP                      0   // One main loop pass
+#define PROBE_I2C                       1   // ADC and flow sensor state machines
+#define PROBE_CYCLE                     2   // Control cycle, run_profiles() to update_loop_stats()
+#define PROBE_UPDATE_OUTPUTS            3
+#define PROBE_PACKET                    4   // spi_packet_peek() to spi_packet_consume() of a packet
+#define PROBE_COUNT                     5
+
+/* SCCP9 as a free running 16-bit timer on Fcy / 64, 1171875 Hz, wraps after 55.9 ms */
+#define PROBE_PORT_TIMER_HZ             ( 75000000UL / 64 )
+#define PROBE_PORT_INIT()               { CCP9CON1L = 0x00C0; CCP9CON1H = 0; CCP9CON2L = 0; CCP9CON2H = 0; CCP9TMRL = 0; CCP9PRL = 0xFFFF; CCP9CON1Lbits.CCPON = 1; }
+#define PROBE_PORT_NOW()                ( (uint16_t)CCP9TMRL )
+
+/* Trace regions, TRACE_BEGIN() to TRACE_END(), bits of probe_trace_mask[]. The host
+ * driver's TRACE_NAMES must list them in the same order. */
+#define TRACE_ISR_TIMER                 0   // timer_isr(), the 1 ms tick
+#define TRACE_ISR_ADC_RDY               1   // _INT1Interrupt, an ADS1115 conversion done
+#define TRACE_ISR_FRAME_SYNC            2   // _INT2Interrupt, a camera frame edge
+#define TRACE_ISR_SPI                   3   // SPI receive or DMA, and the slave select release
+#define TRACE_I2C_WAIT                  4   // An ADC transaction queued on I2C2, to its result
+#define TRACE_CYCLE                     5   // Control cycle, as PROBE_CYCLE
+#define TRACE_UPDATE_OUTPUTS            6   // update_outputs()
+#define TRACE_PACKET                    7   // parse_packet() of a host packet
+#define TRACE_COUNT                     8
+
+/* Trace pins, up to 2. The PCB has no spare pin on a test point: to add one, make a free pin
+ * a low output and define e.g.
+ * #define PROBE_TRACE_PINS                1
+ * #define PROBE_TRACE_MASK_DEFAULT        0
+ * #define PROBE_PORT_TRACE_INIT()         { LATBbits.LATBx = 0; TRISBbits.TRISBx = 0; }
+ * #define PROBE_PORT_TRACE( pin, on )     { LATBbits.LATBx = (on); } */
+#define PROBE_TRACE_PINS                0
+
+/* Probes only run in the main loop here, but PROBE_ISR_EXIT() records interrupt time */
+#define PROBE_PORT_LOCK()               { __builtin_disi( 0x3FFF ); }
+#define PROBE_PORT_UNLOCK()             { __builtin_disi( 0x0000 ); }
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* PROBE_PORT_H */
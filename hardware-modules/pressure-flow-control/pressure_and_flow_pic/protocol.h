@@ -0,0 +1,161 @@
+/*
+ * File:   protocol.h
+ *
+ * Generated by common/rio_protocol/gen_protocol.py from protocol.json, edit that and
+ * run it again. Packet types and the packed layouts of the replies and records, little
+ * endian as the dsPIC stores them, N x fields once per channel, NUM_PRESSURE_CLTRLS.
+ */
+
+#ifndef PROTOCOL_H
+#define	PROTOCOL_H
+
+#include <stdint.h>
+#include "board_config.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/* Packet types */
+#define PACKET_TYPE_GET_ID                  1
+#define PACKET_TYPE_SET_PRESSURE_TARGET     2
+#define PACKET_TYPE_GET_PRESSURE_TARGET     3
+#define PACKET_TYPE_GET_PRESSURE_ACTUAL     4
+#define PACKET_TYPE_SET_FLOW_TARGET         5
+#define PACKET_TYPE_GET_FLOW_TARGET         6
+#define PACKET_TYPE_GET_FLOW_ACTUAL         7
+#define PACKET_TYPE_SET_CONTROL_MODE        8
+#define PACKET_TYPE_GET_CONTROL_MODE        9
+#define PACKET_TYPE_SET_FPID_CONSTS         10
+#define PACKET_TYPE_GET_FPID_CONSTS         11
+#define PACKET_TYPE_GET_SPI_STATS           12
+#define PACKET_TYPE_BATCH                   13
+#define PACKET_TYPE_GET_STATUS_SNAPSHOT     14
+#define PACKET_TYPE_SET_TELEMETRY           15
+#define PACKET_TYPE_TELEMETRY_SAMPLE        16  // Pushed by the firmware, never sent by the host
+#define PACKET_TYPE_GET_HISTORY             17
+#define PACKET_TYPE_SET_LOOP_CONFIG         18
+#define PACKET_TYPE_GET_LOOP_STATS          19
+#define PACKET_TYPE_SET_PPID_CONSTS         20
+#define PACKET_TYPE_GET_PPID_CONSTS         21
+#define PACKET_TYPE_SET_FLOW_FF             22
+#define PACKET_TYPE_SET_PROFILE_POINTS      23
+#define PACKET_TYPE_SET_PROFILE             24
+#define PACKET_TYPE_GET_PROBE_STATS         25
+#define PACKET_TYPE_GET_EEPROM_STATUS       26
+#define PACKET_TYPE_PARAM_LIST              27
+#define PACKET_TYPE_PARAM_GET_MANY          28
+#define PACKET_TYPE_PARAM_SET_MANY          29
+#define PACKET_TYPE_GET_FAULT_LOG           30
+#define PACKET_TYPE_SET_SIGNAL_FILTER       31
+#define PACKET_TYPE_SET_ADC_CONFIG          32
+#define PACKET_TYPE_ECHO                    33
+#define PACKET_TYPE_SYNC_TIME               34
+#define PACKET_TYPE_SET_FRAME_SYNC          35
+#define PACKET_TYPE_STAGE                   36
+#define PACKET_TYPE_GET_CAPABILITIES        37
+#define PACKET_TYPE_GET_BOOT_STATUS         38
+#define PACKET_TYPE_GET_I2C_STATS           39
+#define PACKET_TYPE_SET_FLOW_AUTOTUNE       40
+#define PACKET_TYPE_SET_FLOW_SCHED          41
+#define PACKET_TYPE_GET_LATENCY_STATS       42
+#define PACKET_TYPE_HISTORY_STREAM          43
+#define PACKET_TYPE_TELEMETRY_COMPACT       44  // Pushed by the firmware, never sent by the host
+#define PACKET_TYPE_BENCHMARK               45
+#define PACKET_TYPE_PRESSURE_CAL            46
+#define PACKET_TYPE_SUBSCRIBE               47
+#define PACKET_TYPE_REPORT                  48  // Pushed by the firmware, never sent by the host
+#define PACKET_TYPE_FLASH                   49
+
+/* GET_PRESSURE_ACTUAL, mbar << PRESSURE_SHL */
+typedef struct __attribute__((packed))
+{
+    uint8_t rc;
+    int16_t pressure[NUM_PRESSURE_CLTRLS];
+} pkt_pressure_actual_reply_t;
+
+/* GET_PRESSURE_TARGET, mbar << PRESSURE_SHL */
+typedef struct __attribute__((packed))
+{
+    uint8_t rc;
+    uint16_t pressure[NUM_PRESSURE_CLTRLS];
+} pkt_pressure_target_reply_t;
+
+/* GET_FLOW_ACTUAL and GET_FLOW_TARGET, ul/hr */
+typedef struct __attribute__((packed))
+{
+    uint8_t rc;
+    int16_t flow[NUM_PRESSURE_CLTRLS];
+} pkt_flow_reply_t;
+
+/* GET_STATUS_SNAPSHOT, one control cycle, per channel values interleaved */
+typedef struct __attribute__((packed))
+{
+    int16_t pressure_actual;
+    uint16_t pressure_output;
+    uint16_t pressure_target;
+    int16_t flow_actual;
+    int16_t flow_target;
+    uint8_t control_mode;
+    uint8_t flow_ctrl_state;
+} pkt_status_snapshot_reply_chan_t;
+
+typedef struct __attribute__((packed))
+{
+    uint8_t rc;
+    uint16_t seq;
+    uint32_t time_us;
+    uint32_t frame;
+    pkt_status_snapshot_reply_chan_t chan[NUM_PRESSURE_CLTRLS];
+} pkt_status_snapshot_reply_t;
+
+/* PRESSURE_CAL, zero mbar << PRESSURE_SHL, span >> PRESSURE_CAL_SPAN_SHIFT */
+typedef struct __attribute__((packed))
+{
+    int16_t zero;
+    uint16_t span;
+    uint8_t state;
+    uint8_t left;
+} pkt_pressure_cal_reply_chan_t;
+
+typedef struct __attribute__((packed))
+{
+    uint8_t rc;
+    pkt_pressure_cal_reply_chan_t chan[NUM_PRESSURE_CLTRLS];
+} pkt_pressure_cal_reply_t;
+
+/* TELEMETRY_SAMPLE, and the words of TELEMETRY_COMPACT */
+typedef struct __attribute__((packed))
+{
+    uint16_t seq;
+    uint32_t time_us;
+    uint32_t frame;
+    int16_t pressure_actual[NUM_PRESSURE_CLTRLS];
+    int16_t flow_actual[NUM_PRESSURE_CLTRLS];
+} pkt_telemetry_sample_t;
+
+/* A record of GET_HISTORY and HISTORY_STREAM, and the words of a compact one */
+typedef struct __attribute__((packed))
+{
+    uint16_t seq;
+    uint32_t time_us;
+    int16_t pressure_actual[NUM_PRESSURE_CLTRLS];
+    uint16_t pressure_output[NUM_PRESSURE_CLTRLS];
+    int16_t flow_actual[NUM_PRESSURE_CLTRLS];
+    int16_t pid_terms[NUM_PRESSURE_CLTRLS][3];
+} pkt_history_record_t;
+
+/* Sizes, as the host decodes them */
+typedef char pkt_pressure_actual_reply_size_check[ ( sizeof(pkt_pressure_actual_reply_t) == ( 1 + ( NUM_PRESSURE_CLTRLS * 2 ) ) ) ? 1 : -1 ];
+typedef char pkt_pressure_target_reply_size_check[ ( sizeof(pkt_pressure_target_reply_t) == ( 1 + ( NUM_PRESSURE_CLTRLS * 2 ) ) ) ? 1 : -1 ];
+typedef char pkt_flow_reply_size_check[ ( sizeof(pkt_flow_reply_t) == ( 1 + ( NUM_PRESSURE_CLTRLS * 2 ) ) ) ? 1 : -1 ];
+typedef char pkt_status_snapshot_reply_size_check[ ( sizeof(pkt_status_snapshot_reply_t) == ( 11 + ( NUM_PRESSURE_CLTRLS * 12 ) ) ) ? 1 : -1 ];
+typedef char pkt_pressure_cal_reply_size_check[ ( sizeof(pkt_pressure_cal_reply_t) == ( 1 + ( NUM_PRESSURE_CLTRLS * 6 ) ) ) ? 1 : -1 ];
+typedef char pkt_telemetry_sample_size_check[ ( sizeof(pkt_telemetry_sample_t) == ( 10 + ( NUM_PRESSURE_CLTRLS * 4 ) ) ) ? 1 : -1 ];
+typedef char pkt_history_record_size_check[ ( sizeof(pkt_history_record_t) == ( 6 + ( NUM_PRESSURE_CLTRLS * 12 ) ) ) ? 1 : -1 ];
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* PROTOCOL_H */
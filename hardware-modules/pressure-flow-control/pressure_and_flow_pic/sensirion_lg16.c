@@ -2,7 +2,7 @@
  * Advanced User Register:
     adv_user_reg &= ~0x02;          // Disable hold-master
     adv_user_reg &= ~0x0E00;        // Clear resolution
-    adv_user_reg |= 0b111 << 9;     // Add resolution
+    adv_user_reg |= 0b111 << 9;     // Add resolution, 9 + 0b111 = 16 bits
     adv_user_reg &= ~0x1000;        // Clear heater-stay-on
     adv_user_reg |= 0x1000;         // Set heater-stay-on
 */
@@ -11,10 +11,12 @@
 #include "common.h"
 #include <libpic30.h>
 #include <stdio.h>
+#include <string.h>
 #include "sensirion_lg16.h"
+#include "i2c_bus.h"
 
 #define I2C_ADDR            0x40
-#define I2C_TIMEOUT_MS      8
+#define I2C_TIMEOUT_MS      SENSIRION_I2C_TIMEOUT_MS
 
 /* Macros */
 #define COPY_16BIT_TO_PTR_REV(ptr,val)  {*ptr=*((uint8_t *)&val+1); *(ptr+1)=*(uint8_t *)&val;}
@@ -139,6 +141,25 @@ extern err sensirion_read_scale( uint16_t addr, uint16_t *scale )
     return rc;
 }
 
+extern err sensirion_set_resolution( uint8_t bits )
+{
+    /* Measurement resolution, SENSIRION_RES_BITS_MIN..SENSIRION_RES_BITS_MAX, with hold-master
+     * disabled so a read of an unfinished measurement is NACKed rather than stretched. Stops
+     * measuring, follow with sensirion_measurement_start(). */
+    err rc;
+    uint16_t adv_user_reg;
+    
+    rc = sensirion_read_reg( SENSIRION_REG_ADV_USER_READ, &adv_user_reg );
+    if ( rc == ERR_OK )
+    {
+        adv_user_reg &= ~( SENSIRION_ADV_USER_HOLD_MASTER | SENSIRION_ADV_USER_RES_MASK );
+        adv_user_reg |= (uint16_t)( bits - SENSIRION_RES_BITS_MIN ) << SENSIRION_ADV_USER_RES0;
+        rc = sensirion_write_reg( SENSIRION_REG_ADV_USER_WRITE, adv_user_reg );
+    }
+    
+    return rc;
+}
+
 extern err sensirion_measurement_start( void )
 {
     err rc = ERR_OK;
@@ -160,24 +181,147 @@ extern err sensirion_measurement_read( int16_t *flow )
     err rc = ERR_OK;
     volatile I2C2_MESSAGE_STATUS status;
     I2C2_TRANSACTION_REQUEST_BLOCK trBlocks[1];
-    uint16_t buf;
+    uint8_t buf[3];
 
-    I2C2_MasterReadTRBBuild( &trBlocks[0], (void *)&buf, 2, I2C_ADDR );
+    I2C2_MasterReadTRBBuild( &trBlocks[0], buf, 3, I2C_ADDR );
     I2C2_MasterTRBInsert( 1, (I2C2_TRANSACTION_REQUEST_BLOCK *)&trBlocks, (I2C2_MESSAGE_STATUS *)&status );
     rc = i2c_wait_for_reply( &status, I2C_TIMEOUT_MS );
     
+    if ( ( rc == ERR_OK ) && ( sensirion_crc( buf, 2 ) != buf[2] ) )
+        rc = ERR_SENSIRION_CRC_FAIL;
+    
     if ( rc != ERR_OK )
     {
         *flow = 0;
     }
     else
     {
-        COPY_16BIT_TO_PTR_REV( (uint8_t *)flow, buf );
+        *flow = ( ( (uint16_t)buf[0] ) << 8 ) | buf[1];
+    }
+    
+    return rc;
+}
+
+extern void sensirion_measurement_read_start( bool flags, sensirion_task_t *task )
+{
+    /* Queues the measurement read and the next measurement start, as sensirion_measurement_read()
+     * then sensirion_measurement_start(), without waiting for either. With <flags> the read goes
+     * on through the temperature and flags words. */
+    
+    task->start_cmd = 0xF1;
+    task->read_bytes = flags ? SENSIRION_READ_FLAGS_BYTES : SENSIRION_READ_FLOW_BYTES;
+    
+    I2C2_MasterReadTRBBuild( &task->trBlocks[0], (uint8_t *)task->read_data, task->read_bytes, I2C_ADDR );
+    I2C2_MasterTRBInsert( 1, &task->trBlocks[0], (I2C2_MESSAGE_STATUS *)&task->read_status );
+    
+    I2C2_MasterWriteTRBBuild( &task->trBlocks[1], &task->start_cmd, 1, I2C_ADDR );
+    I2C2_MasterReadTRBBuild( &task->trBlocks[2], &task->start_dummy, 1, I2C_ADDR );
+    I2C2_MasterTRBInsert( 2, &task->trBlocks[1], (I2C2_MESSAGE_STATUS *)&task->start_status );
+}
+
+extern int8_t sensirion_measurement_read_return( int16_t *flow, uint16_t *flags, bool crc_check, sensirion_task_t *task )
+{
+    /* Returns: 0 if still waiting
+     *          1 if *flow and *flags are set
+     *          -1 if the read failed, the caller handles timeouts
+     *          -2 if <crc_check> and the CRC byte does not match, *flow is not set
+     * 
+     * *flags is 0 without the flags read, or if the word fails its CRC, always checked, or has
+     * reserved bits set, as from a sensor that has no flags word
+     */
+    
+    int8_t rc;
+    const volatile uint8_t *word = &task->read_data[SENSIRION_FLAGS_OFFSET];
+    
+    if ( ( task->read_status == I2C2_MESSAGE_PENDING ) || ( task->start_status == I2C2_MESSAGE_PENDING ) )
+    {
+        /* Still waiting */
+        rc = 0;
+    }
+    else if ( task->read_status != I2C2_MESSAGE_COMPLETE )
+    {
+        rc = -1;
+    }
+    else if ( crc_check && ( sensirion_crc( task->read_data, 2 ) != task->read_data[2] ) )
+    {
+        rc = -2;
+    }
+    else
+    {
+        *flow = ( ( (uint16_t)(task->read_data[0]) ) << 8 ) | task->read_data[1];
+        *flags = 0;
+        if ( ( task->read_bytes == SENSIRION_READ_FLAGS_BYTES ) && ( sensirion_crc( word, 2 ) == word[2] ) )
+        {
+            *flags = ( ( (uint16_t)word[0] ) << 8 ) | word[1];
+            if ( *flags & SENSIRION_FLAGS_RESERVED )
+                *flags = 0;
+        }
+        rc = 1;
+    }
+    
+    return rc;
+}
+
+extern void sensirion_cmd_start( const uint8_t *cmd, uint8_t cmd_bytes, uint8_t read_bytes, sensirion_cmd_task_t *task )
+{
+    /* Queues <cmd_bytes> of <cmd>, then a read of <read_bytes> (0-3), in one transaction */
+    
+    memcpy( task->cmd, cmd, cmd_bytes );
+    
+    I2C2_MasterWriteTRBBuild( &task->trBlocks[0], task->cmd, cmd_bytes, I2C_ADDR );
+    if ( read_bytes )
+        I2C2_MasterReadTRBBuild( &task->trBlocks[1], (uint8_t *)task->read_data, read_bytes, I2C_ADDR );
+    I2C2_MasterTRBInsert( read_bytes ? 2 : 1, &task->trBlocks[0], (I2C2_MESSAGE_STATUS *)&task->status );
+}
+
+extern int8_t sensirion_cmd_return( uint16_t *word, sensirion_cmd_task_t *task )
+{
+    /* Returns: 0 if still waiting
+     *          1 if done, *word set from a 3 byte reply if <word> is not NULL
+     *          -1 if the command failed, the caller handles timeouts
+     *          -2 if <word> is not NULL and the CRC byte does not match
+     */
+    
+    int8_t rc;
+    
+    if ( task->status == I2C2_MESSAGE_PENDING )
+    {
+        rc = 0;
+    }
+    else if ( task->status != I2C2_MESSAGE_COMPLETE )
+    {
+        rc = -1;
+    }
+    else if ( word && ( sensirion_crc( task->read_data, 2 ) != task->read_data[2] ) )
+    {
+        rc = -2;
+    }
+    else
+    {
+        if ( word )
+            *word = ( ( (uint16_t)(task->read_data[0]) ) << 8 ) | task->read_data[1];
+        rc = 1;
     }
     
     return rc;
 }
 
+extern uint8_t sensirion_crc( const volatile uint8_t *data, uint8_t bytes )
+{
+    /* CRC-8 of the sensor's replies, SENSIRION_CRC_POLY */
+    uint8_t crc = 0;
+    uint8_t bit;
+    
+    while ( bytes-- )
+    {
+        crc ^= *data++;
+        for ( bit=0; bit<8; bit++ )
+            crc = ( crc & 0x80 ) ? ( ( crc << 1 ) ^ SENSIRION_CRC_POLY ) : ( crc << 1 );
+    }
+    
+    return crc;
+}
+
 /* Static Functions */
 
 static err i2c_wait_for_reply( volatile I2C2_MESSAGE_STATUS *status, uint16_t timeout_ms )
@@ -187,11 +331,12 @@ static err i2c_wait_for_reply( volatile I2C2_MESSAGE_STATUS *status, uint16_t ti
     
     time = timer_ms;
     while ( ( *status != I2C2_MESSAGE_COMPLETE ) && ( ( timer_ms - time ) <= timeout_ms ) );
+    i2c_bus_count( I2C_DEV_FLOW, *status );
     if ( *status != I2C2_MESSAGE_COMPLETE )
     {
         rc = ERR_SENSIRION_COMMS_FAIL;
 //        printf( "Status*: %hu\n", *status );
-        I2C2_Abort();
+        i2c_bus_abort( I2C_DEV_FLOW );
     }
     
     return rc;
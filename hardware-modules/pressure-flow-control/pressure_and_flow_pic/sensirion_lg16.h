@@ -9,15 +9,41 @@ extern "C" {
 #define SENSIRION_PART_NAME_LEN_BYTES   20
 #define SENSIRION_PART_NAME_STR_LEN     21
     
+#define SENSIRION_CMD_MEASURE           0xF1
+#define SENSIRION_CMD_READ_EEPROM       0xFA
+#define SENSIRION_CMD_RESET             0xFE
+#define SENSIRION_BOOT_MS               3       // Soft reset to comms
+    
 #define SENSIRION_REG_ADV_USER_WRITE    0xE4
 #define SENSIRION_REG_ADV_USER_READ     0xE5
 
+/* Advanced user register fields */
+#define SENSIRION_ADV_USER_HOLD_MASTER  0x0002
+#define SENSIRION_ADV_USER_RES_MASK     0x0E00
+#define SENSIRION_ADV_USER_RES0         9
+#define SENSIRION_RES_BITS_MIN          9       // Measurement resolution, fewer bits measure faster and noisier
+#define SENSIRION_RES_BITS_MAX          16      // Sensor default
+
+#define SENSIRION_CRC_POLY              0x31    // x^8 + x^5 + x^4 + 1, start value 0
+
 #define SENSIRION_EEPROM_ADDR_PART_NAME 0x2E80
 #define SENSIRION_EEPROM_ADDR_SCALE0    0x2B60
 
 #define SENSIRION_FLOW_SCALE_ML_MIN     500
 #define SENSIRION_TEMP_SCALE_DEGC       200
 
+/* A measurement read of flow, temperature and flags words, each MSB, LSB, CRC, or of the
+ * flow word alone */
+#define SENSIRION_READ_FLOW_BYTES       3
+#define SENSIRION_READ_FLAGS_BYTES      9
+#define SENSIRION_FLAGS_OFFSET          6
+
+/* Flags word, as sensirion_flags_t */
+#define SENSIRION_FLAG_AIR_IN_LINE      0x0001
+#define SENSIRION_FLAG_HIGH_FLOW        0x0002
+#define SENSIRION_FLAG_EXP_SMOOTHING    0x0020
+#define SENSIRION_FLAGS_RESERVED        0xFFDC  // Set in a word that is not a flags word
+
 typedef struct __attribute__((packed))
 {
     uint8_t air_in_line : 1;
@@ -27,6 +53,27 @@ typedef struct __attribute__((packed))
     uint16_t : 10;
 } sensirion_flags_t;
 
+typedef struct
+{
+    uint8_t start_cmd;
+    uint8_t start_dummy;
+    uint8_t read_bytes;                 // SENSIRION_READ_FLOW_BYTES or SENSIRION_READ_FLAGS_BYTES
+    volatile uint8_t read_data[SENSIRION_READ_FLAGS_BYTES];    // Flow, then temperature and flags
+    I2C2_TRANSACTION_REQUEST_BLOCK trBlocks[3];
+    volatile I2C2_MESSAGE_STATUS read_status;
+    volatile I2C2_MESSAGE_STATUS start_status;
+} sensirion_task_t;
+
+/* One queued command, written then optionally read back, for the start-up steps without
+ * waiting. Replies of a register or EEPROM word are MSB, LSB, CRC. */
+typedef struct
+{
+    uint8_t cmd[3];
+    volatile uint8_t read_data[3];
+    I2C2_TRANSACTION_REQUEST_BLOCK trBlocks[2];
+    volatile I2C2_MESSAGE_STATUS status;
+} sensirion_cmd_task_t;
+
 extern err sensirion_read_eeprom( uint16_t addr, uint8_t bytes, uint8_t *reg_data );
 extern err sensirion_read_reg( uint8_t reg, uint16_t *reg_data );
 extern err sensirion_write_reg( uint8_t reg, uint16_t reg_data );
@@ -34,9 +81,16 @@ extern err sensirion_write_reg( uint8_t reg, uint16_t reg_data );
 extern err sensirion_reset( bool wait );
 extern err sensirion_read_part_name( char *part_name );
 extern err sensirion_read_scale( uint16_t addr, uint16_t *scale );
+extern err sensirion_set_resolution( uint8_t bits );
 extern err sensirion_measurement_start( void );
 extern err sensirion_measurement_read( int16_t *flow );
 
+extern void sensirion_measurement_read_start( bool flags, sensirion_task_t *task );
+extern int8_t sensirion_measurement_read_return( int16_t *flow, uint16_t *flags, bool crc_check, sensirion_task_t *task );
+extern void sensirion_cmd_start( const uint8_t *cmd, uint8_t cmd_bytes, uint8_t read_bytes, sensirion_cmd_task_t *task );
+extern int8_t sensirion_cmd_return( uint16_t *word, sensirion_cmd_task_t *task );
+extern uint8_t sensirion_crc( const volatile uint8_t *data, uint8_t bytes );
+
 #ifdef	__cplusplus
 }
 #endif
@@ -0,0 +1,68 @@
+/*
+ * File:   spi_port.h
+ *
+ * dsPIC33CK (SPI1) shim for the shared rio_spi module, see
+ * hardware-modules/common/rio_spi.
+ */
+
+#ifndef SPI_PORT_H
+#define	SPI_PORT_H
+
+#include <xc.h>
+#include "board_config.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#define SPI_READ_SUPPORTED
+#define SPI_WRITE_SUPPORTED
+
+/* Buffer sizes in board_config.h */
+
+/* BATCH packet replies */
+#define SPI_BATCH_SUPPORTED
+
+/* Streamed replies, HISTORY_STREAM */
+#define SPI_STREAM_SUPPORTED
+
+/* STX_CRC frames, 512 bytes of flash for the table */
+#define SPI_CRC_MODE                    SPI_CRC_16
+
+/* Uncomment to move SPI1 to DMA: channel 0 receives into the read ring, channel 1
+ * streams replies. No per-byte interrupt, only one DMA1 interrupt per reply. */
+//#define SPI_PORT_DMA
+
+#ifdef SPI_PORT_DMA
+#define SPI_PORT_DMA_RAM_START          0x1000                                      // dsPIC33CK256MP502 data RAM, 24 KB
+#define SPI_PORT_DMA_RAM_END            0x6FFF
+#define SPI_PORT_DMA_TRIG_SPI1RX        0x0A                                        // DMAINTn.CHSEL codes, check the
+#define SPI_PORT_DMA_TRIG_SPI1TX        0x0B                                        // datasheet DMA trigger source table
+#endif
+
+/* Slave select is RB4: change notification on its rising edge calls spi_deselect() */
+#define SPI_DESELECT_SUPPORTED
+#define SPI_PORT_SS_CNEN                CNEN0Bbits.CNEN0B4
+#define SPI_PORT_SS_CNF                 CNFBbits.CNFB4
+
+/* SPI1 register access, the SS interrupt is masked with the SPI one */
+#ifdef SPI_PORT_DMA
+#define SPI_PORT_INT_ON()               { IEC0bits.DMA1IE = 1; IEC0bits.CNBIE = 1; }
+#define SPI_PORT_INT_OFF()              { IEC0bits.DMA1IE = 0; IEC0bits.CNBIE = 0; }
+#else
+#define SPI_PORT_INT_ON()               { IEC0bits.SPI1RXIE = 1; IEC0bits.CNBIE = 1; }
+#define SPI_PORT_INT_OFF()              { IEC0bits.SPI1RXIE = 0; IEC0bits.CNBIE = 0; }
+#endif
+#define SPI_PORT_TX_PREPARE()           { SPI1STATLbits.SPITUR = 0; }
+#define SPI_PORT_TX_DIRECT( byte )      ( SPI1BUFL = (byte), 0 )                    // No collision detect, never buffer
+#define SPI_PORT_TX_CLEAR_COLLISION()
+
+/* Data-ready line to the Pi, see rio_spi. The PCB has none: to add one, wire a free pin to a
+ * Pi GPIO, make it a low output in pin_manager.c and define e.g.
+ * #define SPI_PORT_READY( on )        { LATBbits.LATBx = (on); } */
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* SPI_PORT_H */
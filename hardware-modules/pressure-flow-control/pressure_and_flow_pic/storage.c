@@ -1,26 +1,195 @@
 #include <stdio.h>
+#include <string.h>
 #include "mcc_generated_files/mcc.h"
 #include "common.h"
 #include "storage.h"
 #include "eeprom.h"
+#include "fault_port.h"
 
 #define GET_STORE_OFFSET( member )  offsetof( store_t, member )
 
 typedef struct __attribute__((packed))
 {
     uint8_t eeprom_ver;
-    uint16_t pid_consts[NUM_PRESSURE_CLTRLS][3];
+    uint16_t pid_consts[PRESSURE_BANK_CHANS][3];
+    uint16_t ppid_consts[PRESSURE_BANK_CHANS][3];   // Since EEPROM_VER 2
+    uint16_t adc_configs[PRESSURE_BANK_CHANS];      // Since EEPROM_VER 3
+    uint16_t flow_scheds[PRESSURE_BANK_CHANS][STORE_FLOW_SCHED_WORDS];  // Since EEPROM_VER 4
+    uint16_t pressure_limits[PRESSURE_BANK_CHANS];  // Since EEPROM_VER 5
+    uint16_t warms[PRESSURE_BANK_CHANS][STORE_WARM_WORDS];  // Since EEPROM_VER 6
+    uint8_t module_addr;                            // Since EEPROM_VER 7, bank 0 only
+    uint16_t pressure_cal_zeros[PRESSURE_BANK_CHANS];   // Since EEPROM_VER 8
+    uint8_t pressure_cal_trims[PRESSURE_BANK_CHANS];
 } store_t;
 
+/* Static Function Prototypes */
+
+static err store_save_data( uint8_t bank, uint16_t offset, uint8_t data_len, uint8_t *data );
+static void store_load_data( uint8_t bank, uint16_t offset, uint8_t data_len, uint8_t *data );
+static void store_load_chans( uint16_t offset, uint8_t chan_len, uint8_t *data );
+
+/* A/B slots of four EEPROM pages each, after the fault log. A commit writes the older slot,
+ * so a power loss mid-write leaves the other one valid. EEPROMs written before them have
+ * one page slots after the page 0 layout. store_t holds one bank of channels, the slots of
+ * bank b follow those of bank b - 1. */
+#define STORE_SLOT_A_ADDR       0x1100
+#define STORE_SLOT_SIZE         256
+#define STORE_SLOT_COUNT        2
+#define STORE_BANK_ADDR(bank)   ( STORE_SLOT_A_ADDR + ( (uint16_t)(bank) * STORE_SLOT_COUNT * STORE_SLOT_SIZE ) )
+#define STORE_BANK(chan)        ( (chan) / PRESSURE_BANK_CHANS )
+#define STORE_BANK_CHAN(chan)   ( (chan) % PRESSURE_BANK_CHANS )
+#define STORE_OLD_SLOT_A_ADDR   0x0040
+#define STORE_OLD_SLOT_SIZE     64
+#define STORE_LEGACY_ADDR       0x0000
+#define STORE_MAGIC             0x5A
+#define STORE_CRC_POLY          0x1021      // CRC-16/CCITT-FALSE, from STORE_CRC_INIT
+
+typedef struct __attribute__((packed))
+{
+    uint8_t magic;
+    uint8_t layout;                 // EEPROM_VER of the body
+    uint8_t size;                   // Body bytes, fields appended later read as blank from a shorter body
+    uint16_t seq;                   // Incremented each commit, the newest valid slot is loaded
+    uint16_t crc;                   // Over the header up to here and the body
+} store_header_t;
+
+typedef struct __attribute__((packed))
+{
+    store_header_t header;
+    store_t body;
+} store_slot_t;
+
+static bool store_slot_read( uint16_t addr, uint16_t slot_size );
+static bool store_slots_load( uint8_t bank, uint16_t addr, uint16_t slot_size );
+static uint16_t store_slot_crc( store_slot_t *slot );
+static void store_commit( uint8_t bank );
+
+/* Fails to build if a slot does not fit, or its size not in a U8 */
+typedef char store_slot_size_check[ ( sizeof(store_slot_t) <= STORE_SLOT_SIZE ) && ( sizeof(store_t) <= UINT8_MAX ) ? 1 : -1 ];
+
+/* Fails to build unless the fault log and the slots of every bank fit the EEPROM part */
+typedef char store_layout_check[ ( ( FAULT_PORT_LOG_ADDR + FAULT_PORT_LOG_SIZE ) <= STORE_SLOT_A_ADDR ) && ( STORE_BANK_ADDR( NUM_PRESSURE_BANKS ) <= EEPROM_SIZE ) ? 1 : -1 ];
+
+/* RAM shadow of the active slot body of each bank. Saves change it and set it dirty,
+ * store_flush() commits it to the other slot. Loads read it, so they include saves not yet
+ * committed. */
+static store_t store_shadow[NUM_PRESSURE_BANKS];
+static bool store_shadow_dirty[NUM_PRESSURE_BANKS];
+static uint8_t store_slot_active[NUM_PRESSURE_BANKS];
+static uint16_t store_seq[NUM_PRESSURE_BANKS];
+static uint8_t store_banks_blank;      // Bank bits, no valid slot at store_init()
+static union
+{
+    store_slot_t slot;
+    uint8_t bytes[STORE_SLOT_SIZE];     // A body of later firmware, longer than store_t
+} store_slot_buf;
+
+/* Extern Functions */
+
+extern E_STORE_SOURCE store_init( void )
+{
+    /* Loads the newest valid slot of each bank. Without one, bank 0 loads the one page slots
+     * or else the page 0 layout of older firmware, to be committed to a slot on the first
+     * flush. The source returned is bank 0's, later banks came after those layouts. */
+    E_STORE_SOURCE source = STORE_SOURCE_BLANK;
+    uint8_t bank;
+    
+    memset( store_shadow, EEPROM_BLANK_U8, sizeof(store_shadow) );
+    store_banks_blank = 0;
+    for ( bank = 0; bank < NUM_PRESSURE_BANKS; bank++ )
+    {
+        store_shadow_dirty[bank] = false;
+        store_slot_active[bank] = STORE_SLOT_COUNT - 1;
+        store_seq[bank] = 0;
+        if ( bank > 0 )
+            store_slots_load( bank, STORE_BANK_ADDR( bank ), STORE_SLOT_SIZE );
+    }
+    
+    if ( store_slots_load( 0, STORE_BANK_ADDR( 0 ), STORE_SLOT_SIZE ) )
+        source = STORE_SOURCE_SLOT;
+    else if ( store_slots_load( 0, STORE_OLD_SLOT_A_ADDR, STORE_OLD_SLOT_SIZE ) )
+    {
+        source = STORE_SOURCE_OLD_SLOT;
+        store_shadow_dirty[0] = true;
+    }
+    
+    if ( source == STORE_SOURCE_BLANK )
+    {
+        /* Not the fields of the slot firmware, past it are the one page slots */
+        eeprom_read_bytes( STORE_LEGACY_ADDR, GET_STORE_OFFSET(flow_scheds), (uint8_t *)&store_shadow[0] );
+        if ( store_shadow[0].eeprom_ver != EEPROM_BLANK_U8 )
+        {
+            source = STORE_SOURCE_LEGACY;
+            store_shadow_dirty[0] = true;
+        }
+        else
+            memset( &store_shadow[0], EEPROM_BLANK_U8, sizeof(store_t) );
+    }
+    
+    if ( source != STORE_SOURCE_BLANK )
+        store_banks_blank &= ~1;
+    
+    return source;
+}
+
+extern void store_flush( void )
+{
+    /* Called from the main loop. Commits only once earlier writes are done, so saves made
+     * meanwhile go out together. */
+    uint8_t bank;
+    
+    if ( eeprom_queue_pending() != 0 )
+        return;
+    
+    for ( bank = 0; bank < NUM_PRESSURE_BANKS; bank++ )
+    {
+        if ( store_shadow_dirty[bank] )
+            store_commit( bank );
+    }
+}
+
+extern bool store_dirty( void )
+{
+    uint8_t bank;
+    
+    for ( bank = 0; bank < NUM_PRESSURE_BANKS; bank++ )
+    {
+        if ( store_shadow_dirty[bank] )
+            return true;
+    }
+    
+    return false;
+}
+
+extern uint16_t store_flush_wait( void )
+{
+    /* Commits every save, waiting for the EEPROM. Returns the number of writes that failed to verify. */
+    uint8_t bank;
+    
+    for ( bank = 0; bank < NUM_PRESSURE_BANKS; bank++ )
+    {
+        if ( store_shadow_dirty[bank] )
+            store_commit( bank );
+    }
+    
+    return eeprom_queue_flush();
+}
+
+extern uint8_t store_blank_banks( void )
+{
+    /* Bank bits, those store_init() found no slot for. Later banks start blank on an EEPROM
+     * written by a build of fewer channels. */
+    return store_banks_blank;
+}
+
 extern err store_save_eeprom_ver( uint8_t eeprom_ver )
 {
+    /* In every bank, loaded from bank 0 */
     err rc = ERR_OK;
-    uint8_t verify_rc;
-    
-    eeprom_read_write_bytes( GET_STORE_OFFSET(eeprom_ver), sizeof(eeprom_ver), &eeprom_ver );
-    verify_rc = eeprom_verify_bytes( GET_STORE_OFFSET(eeprom_ver), sizeof(eeprom_ver), &eeprom_ver );
+    uint8_t bank;
     
-    rc = ( verify_rc == 0 ) ? ERR_OK : ERR_EEPROM_VERIFY_FAIL;
+    for ( bank = 0; ( bank < NUM_PRESSURE_BANKS ) && ( rc == ERR_OK ); bank++ )
+        rc = store_save_data( bank, GET_STORE_OFFSET(eeprom_ver), sizeof(eeprom_ver), &eeprom_ver );
     
     return rc;
 }
@@ -30,7 +199,7 @@ extern err store_load_eeprom_ver( uint8_t *eeprom_ver_p )
     err rc = ERR_OK;
     uint8_t eeprom_ver;
     
-    eeprom_read_bytes( GET_STORE_OFFSET(eeprom_ver), sizeof(eeprom_ver), (uint8_t *)&eeprom_ver );
+    store_load_data( 0, GET_STORE_OFFSET(eeprom_ver), sizeof(eeprom_ver), (uint8_t *)&eeprom_ver );
     
     *eeprom_ver_p = eeprom_ver;
     
@@ -38,23 +207,230 @@ extern err store_load_eeprom_ver( uint8_t *eeprom_ver_p )
 }
 
 extern err store_save_fpid_consts( uint8_t chan, uint16_t pid_consts[3] )
+{
+    return store_save_data( STORE_BANK( chan ), GET_STORE_OFFSET(pid_consts[STORE_BANK_CHAN( chan )]), 3 * sizeof(uint16_t), (uint8_t *)pid_consts );
+}
+
+extern err store_load_fpid_consts( uint16_t *pid_consts_p )
 {
     err rc = ERR_OK;
-    uint8_t verify_rc;
     
-    eeprom_read_write_bytes( GET_STORE_OFFSET(pid_consts[chan]), 3 * sizeof(uint16_t), (uint8_t *)pid_consts );
-    verify_rc = eeprom_verify_bytes( GET_STORE_OFFSET(pid_consts[chan]), 3 * sizeof(uint16_t), (uint8_t *)pid_consts );
+    store_load_chans( GET_STORE_OFFSET(pid_consts), 3 * sizeof(uint16_t), (uint8_t *)pid_consts_p );
     
-    rc = ( verify_rc == 0 ) ? ERR_OK : ERR_EEPROM_VERIFY_FAIL;
+    return rc;
+}
+
+extern err store_save_ppid_consts( uint8_t chan, uint16_t pid_consts[3] )
+{
+    return store_save_data( STORE_BANK( chan ), GET_STORE_OFFSET(ppid_consts[STORE_BANK_CHAN( chan )]), 3 * sizeof(uint16_t), (uint8_t *)pid_consts );
+}
+
+extern err store_load_ppid_consts( uint16_t *pid_consts_p )
+{
+    err rc = ERR_OK;
+    
+    store_load_chans( GET_STORE_OFFSET(ppid_consts), 3 * sizeof(uint16_t), (uint8_t *)pid_consts_p );
     
     return rc;
 }
 
-extern err store_load_fpid_consts( uint16_t *pid_consts_p )
+extern err store_save_adc_config( uint8_t chan, uint16_t adc_config )
+{
+    return store_save_data( STORE_BANK( chan ), GET_STORE_OFFSET(adc_configs[STORE_BANK_CHAN( chan )]), sizeof(uint16_t), (uint8_t *)&adc_config );
+}
+
+extern err store_load_adc_configs( uint16_t *adc_configs_p )
+{
+    err rc = ERR_OK;
+    
+    store_load_chans( GET_STORE_OFFSET(adc_configs), sizeof(uint16_t), (uint8_t *)adc_configs_p );
+    
+    return rc;
+}
+
+extern err store_save_flow_sched( uint8_t chan, uint16_t sched[STORE_FLOW_SCHED_WORDS] )
+{
+    return store_save_data( STORE_BANK( chan ), GET_STORE_OFFSET(flow_scheds[STORE_BANK_CHAN( chan )]), STORE_FLOW_SCHED_WORDS * sizeof(uint16_t), (uint8_t *)sched );
+}
+
+extern err store_load_flow_scheds( uint16_t *scheds_p )
+{
+    err rc = ERR_OK;
+    
+    store_load_chans( GET_STORE_OFFSET(flow_scheds), STORE_FLOW_SCHED_WORDS * sizeof(uint16_t), (uint8_t *)scheds_p );
+    
+    return rc;
+}
+
+extern err store_save_pressure_limit( uint8_t chan, uint16_t limit )
+{
+    return store_save_data( STORE_BANK( chan ), GET_STORE_OFFSET(pressure_limits[STORE_BANK_CHAN( chan )]), sizeof(uint16_t), (uint8_t *)&limit );
+}
+
+extern err store_load_pressure_limits( uint16_t *limits_p )
 {
     err rc = ERR_OK;
     
-    eeprom_read_bytes( GET_STORE_OFFSET(pid_consts), 3 * NUM_PRESSURE_CLTRLS * sizeof(uint16_t), (uint8_t *)pid_consts_p );
+    store_load_chans( GET_STORE_OFFSET(pressure_limits), sizeof(uint16_t), (uint8_t *)limits_p );
     
     return rc;
 }
+
+extern err store_save_warm( uint8_t chan, uint16_t warm[STORE_WARM_WORDS] )
+{
+    return store_save_data( STORE_BANK( chan ), GET_STORE_OFFSET(warms[STORE_BANK_CHAN( chan )]), STORE_WARM_WORDS * sizeof(uint16_t), (uint8_t *)warm );
+}
+
+extern err store_save_module_addr( uint8_t module_addr )
+{
+    return store_save_data( 0, GET_STORE_OFFSET(module_addr), sizeof(module_addr), &module_addr );
+}
+
+extern err store_load_module_addr( uint8_t *module_addr_p )
+{
+    store_load_data( 0, GET_STORE_OFFSET(module_addr), sizeof(uint8_t), module_addr_p );
+    
+    return ERR_OK;
+}
+
+extern err store_load_warms( uint16_t *warms_p )
+{
+    err rc = ERR_OK;
+    
+    store_load_chans( GET_STORE_OFFSET(warms), STORE_WARM_WORDS * sizeof(uint16_t), (uint8_t *)warms_p );
+    
+    return rc;
+}
+
+extern err store_save_pressure_cal( uint8_t chan, uint16_t zero, uint8_t trim )
+{
+    err rc;
+    
+    rc = store_save_data( STORE_BANK( chan ), GET_STORE_OFFSET(pressure_cal_zeros[STORE_BANK_CHAN( chan )]), sizeof(uint16_t), (uint8_t *)&zero );
+    if ( rc == ERR_OK )
+        rc = store_save_data( STORE_BANK( chan ), GET_STORE_OFFSET(pressure_cal_trims[STORE_BANK_CHAN( chan )]), sizeof(uint8_t), &trim );
+    
+    return rc;
+}
+
+extern err store_load_pressure_cals( uint16_t *zeros_p, uint8_t *trims_p )
+{
+    err rc = ERR_OK;
+    
+    store_load_chans( GET_STORE_OFFSET(pressure_cal_zeros), sizeof(uint16_t), (uint8_t *)zeros_p );
+    store_load_chans( GET_STORE_OFFSET(pressure_cal_trims), sizeof(uint8_t), trims_p );
+    
+    return rc;
+}
+
+/* Static Functions */
+
+static err store_save_data( uint8_t bank, uint16_t offset, uint8_t data_len, uint8_t *data )
+{
+    /* Into the shadow, committed by store_flush(). Commit and verify results are in eeprom_queue_stats(). */
+    if ( memcmp( (uint8_t *)&store_shadow[bank] + offset, data, data_len ) == 0 )
+        return ERR_OK;
+    
+    memcpy( (uint8_t *)&store_shadow[bank] + offset, data, data_len );
+    store_shadow_dirty[bank] = true;
+    
+    return ERR_OK;
+}
+
+static void store_load_data( uint8_t bank, uint16_t offset, uint8_t data_len, uint8_t *data )
+{
+    memcpy( data, (uint8_t *)&store_shadow[bank] + offset, data_len );
+}
+
+static void store_load_chans( uint16_t offset, uint8_t chan_len, uint8_t *data )
+{
+    /* The per channel field at <offset> of every bank, <chan_len> bytes a channel, into
+     * NUM_PRESSURE_CLTRLS entries */
+    uint8_t bank;
+    
+    for ( bank = 0; bank < NUM_PRESSURE_BANKS; bank++ )
+        store_load_data( bank, offset, PRESSURE_BANK_CHANS * chan_len, data + ( bank * PRESSURE_BANK_CHANS * chan_len ) );
+}
+
+static bool store_slot_read( uint16_t addr, uint16_t slot_size )
+{
+    /* Into store_slot_buf, the header and then only as much body as it gives */
+    store_slot_t *slot = &store_slot_buf.slot;
+    
+    eeprom_read_bytes( addr, sizeof(store_header_t), (uint8_t *)&slot->header );
+    if ( ( slot->header.magic != STORE_MAGIC ) || ( slot->header.size > ( slot_size - sizeof(store_header_t) ) ) )
+        return false;
+    
+    eeprom_read_bytes( addr + sizeof(store_header_t), slot->header.size, (uint8_t *)&slot->body );
+    
+    return ( store_slot_crc( slot ) == slot->header.crc );
+}
+
+static bool store_slots_load( uint8_t bank, uint16_t addr, uint16_t slot_size )
+{
+    /* The valid slot with the newest seq of the pair from <addr> into the shadow of <bank> */
+    store_slot_t *slot = &store_slot_buf.slot;
+    bool loaded = false;
+    uint8_t i;
+    
+    for ( i = 0; i < STORE_SLOT_COUNT; i++ )
+    {
+        if ( !store_slot_read( addr + ( i * slot_size ), slot_size ) )
+            continue;
+        if ( loaded && ( (int16_t)( slot->header.seq - store_seq[bank] ) <= 0 ) )
+            continue;
+        
+        memset( &store_shadow[bank], EEPROM_BLANK_U8, sizeof(store_t) );
+        memcpy( &store_shadow[bank], &slot->body, ( slot->header.size < sizeof(store_t) ) ? slot->header.size : sizeof(store_t) );
+        store_slot_active[bank] = i;
+        store_seq[bank] = slot->header.seq;
+        loaded = true;
+    }
+    
+    if ( !loaded )
+        store_banks_blank |= 1 << bank;
+    
+    return loaded;
+}
+
+static uint16_t store_slot_crc( store_slot_t *slot )
+{
+    /* Header up to the CRC, then the body */
+    uint16_t crc;
+    
+    crc = store_crc16( STORE_CRC_INIT, (uint8_t *)&slot->header, offsetof( store_header_t, crc ) );
+    return store_crc16( crc, (uint8_t *)&slot->body, slot->header.size );
+}
+
+extern uint16_t store_crc16( uint16_t crc, const uint8_t *data, uint16_t num )
+{
+    uint8_t bit;
+    
+    while ( num-- )
+    {
+        crc ^= (uint16_t)*data++ << 8;
+        for ( bit = 0; bit < 8; bit++ )
+            crc = ( crc & 0x8000 ) ? ( ( crc << 1 ) ^ STORE_CRC_POLY ) : ( crc << 1 );
+    }
+    
+    return crc;
+}
+
+static void store_commit( uint8_t bank )
+{
+    /* Queues the shadow of <bank> to its slot not holding the last commit. The queue copies
+     * it, so store_slot_buf is free again for the next bank. */
+    store_slot_active[bank] = ( store_slot_active[bank] + 1 ) % STORE_SLOT_COUNT;
+    store_seq[bank]++;
+    
+    store_slot_buf.slot.header.magic = STORE_MAGIC;
+    store_slot_buf.slot.header.layout = EEPROM_VER;
+    store_slot_buf.slot.header.size = sizeof(store_t);
+    store_slot_buf.slot.header.seq = store_seq[bank];
+    store_slot_buf.slot.body = store_shadow[bank];
+    store_slot_buf.slot.header.crc = store_slot_crc( &store_slot_buf.slot );
+    
+    eeprom_queue_write( STORE_BANK_ADDR( bank ) + ( store_slot_active[bank] * STORE_SLOT_SIZE ), sizeof(store_slot_t), (uint8_t *)&store_slot_buf.slot );
+    store_shadow_dirty[bank] = false;
+    store_banks_blank &= ~( 1 << bank );
+}
@@ -5,13 +5,57 @@
 extern "C" {
 #endif
 
-#define EEPROM_VER  1
+#define EEPROM_VER  8     // 2 adds the pressure PID constants, 3 the ADC configs, 4 the flow gain schedules, 5 the pressure limits, 6 the warm starts, 7 the module address, 8 the pressure calibrations
+
+/* Flow gain schedule of a channel, in words: [count] then NUM_FLOW_SCHED_POINTS x [flow ul/hr][P][I][D] */
+#define STORE_FLOW_SCHED_WORDS      ( 1 + ( 4 * NUM_FLOW_SCHED_POINTS ) )
+
+/* Warm start of a channel, in words: [pressure target][pressure integrator][flow target][flow output],
+ * each pair blank until its loop first settles */
+#define STORE_WARM_WORDS            4
+
+#define STORE_CRC_INIT              0xFFFF      // Start of store_crc16()
+
+/* Where store_init() loaded the settings from */
+typedef enum
+{
+    STORE_SOURCE_BLANK,             // No valid slot or older layout, all fields blank
+    STORE_SOURCE_SLOT,              // Newest slot with a valid CRC
+    STORE_SOURCE_OLD_SLOT,          // Page sized slots of older firmware, moved to the new slots on the first flush
+    STORE_SOURCE_LEGACY,            // Page 0 layout of older firmware, moved to a slot on the first flush
+} E_STORE_SOURCE;
+
+/* Saves go to a RAM shadow of the EEPROM, committed by store_flush() from the main loop.
+ * store_init() fills the shadow before any load. Each bank of PRESSURE_BANK_CHANS channels
+ * has its own slots, loads fill NUM_PRESSURE_CLTRLS entries. */
+extern E_STORE_SOURCE store_init( void );
+extern void store_flush( void );
+extern uint16_t store_flush_wait( void );
+extern bool store_dirty( void );
+extern uint8_t store_blank_banks( void );
+
+/* CRC-16/CCITT-FALSE of <num> bytes, as the slots are checked, for other blocks to use */
+extern uint16_t store_crc16( uint16_t crc, const uint8_t *data, uint16_t num );
 
 extern err store_save_eeprom_ver( uint8_t eeprom_ver );
 extern err store_save_fpid_consts( uint8_t chan, uint16_t pid_consts[3] );
+extern err store_save_ppid_consts( uint8_t chan, uint16_t pid_consts[3] );
+extern err store_save_adc_config( uint8_t chan, uint16_t adc_config );
+extern err store_save_flow_sched( uint8_t chan, uint16_t sched[STORE_FLOW_SCHED_WORDS] );
+extern err store_save_pressure_limit( uint8_t chan, uint16_t limit );
+extern err store_save_warm( uint8_t chan, uint16_t warm[STORE_WARM_WORDS] );
+extern err store_save_module_addr( uint8_t module_addr );
+extern err store_save_pressure_cal( uint8_t chan, uint16_t zero, uint8_t trim );
 
 extern err store_load_eeprom_ver( uint8_t *eeprom_ver_p );
 extern err store_load_fpid_consts( uint16_t *pid_consts_p );
+extern err store_load_ppid_consts( uint16_t *pid_consts_p );
+extern err store_load_adc_configs( uint16_t *adc_configs_p );
+extern err store_load_flow_scheds( uint16_t *scheds_p );
+extern err store_load_pressure_limits( uint16_t *limits_p );
+extern err store_load_warms( uint16_t *warms_p );
+extern err store_load_module_addr( uint8_t *module_addr_p );
+extern err store_load_pressure_cals( uint16_t *zeros_p, uint8_t *trims_p );
 
 #ifdef	__cplusplus
 }
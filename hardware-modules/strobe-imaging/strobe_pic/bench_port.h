@@ -0,0 +1,41 @@
+/*
+ * File:   bench_port.h
+ *
+ * PIC16F18856 (TMR0) shim for the shared rio_bench module, see
+ * hardware-modules/common/rio_bench.
+ */
+
+#ifndef BENCH_PORT_H
+#define	BENCH_PORT_H
+
+#include <stdint.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/* Comment out to build the benchmark out, BENCHMARK is then not handled */
+#define BENCH_ENABLED
+
+/* Kernels, 0 is BENCH_NULL */
+#define BENCH_FRAME_CHECKSUM            1   // spi_frame_check() of a SPI_PACKET_BUF_SIZE byte STX frame
+#define BENCH_FRAME_CRC                 2   // Same, STX_CRC frame
+#define BENCH_FIND_SCALERS              3   // find_scalers_time() of a wait that needs pre- and postscale
+#define BENCH_COUNT                     4
+
+/* TMR0, 1 us against the 8 MHz instruction clock, read as in load_pass() */
+#define BENCH_PORT_TIMER_HZ             1000000UL
+#define BENCH_PORT_CPU_HZ               8000000UL
+#define BENCH_PORT_NOW()                tmr0_read()
+uint16_t tmr0_read( void );
+
+/* Interrupts stay on, a trigger must never wait for a benchmark. The min is the run
+ * without one. */
+#define BENCH_PORT_LOCK()
+#define BENCH_PORT_UNLOCK()
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* BENCH_PORT_H */
@@ -0,0 +1,96 @@
+#include "mcc_generated_files/mcc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "cam_stats.h"
+
+/* Sum is for the mean only. Halving sum and count together before count
+ * overflows keeps the mean while ( 0xFFFF * 0xFFFF ) still fits in 32 bits.
+ */
+uint32_t cam_stats_count;
+uint32_t cam_stats_sum;
+uint16_t cam_stats_sum_count;
+uint16_t cam_stats_min;
+uint16_t cam_stats_max;
+uint16_t cam_stats_bins[CAM_STATS_NUM_BINS];
+uint16_t cam_stats_base_us;
+uint8_t cam_stats_bin_shift;
+
+// Extern Functions --------------------------------------------------------
+
+extern void cam_stats_init( void )
+{
+    cam_stats_base_us = CAM_STATS_DEFAULT_BASE_US;
+    cam_stats_bin_shift = CAM_STATS_DEFAULT_BIN_SHIFT;
+    cam_stats_reset();
+}
+
+extern void cam_stats_reset( void )
+{
+    cam_stats_count = 0;
+    cam_stats_sum = 0;
+    cam_stats_sum_count = 0;
+    cam_stats_min = 0xFFFF;
+    cam_stats_max = 0;
+    memset( cam_stats_bins, 0, sizeof( cam_stats_bins ) );
+}
+
+extern err cam_stats_set_hist( uint16_t base_us, uint8_t bin_shift )
+{
+    /* Bins are [ base + i * 2^shift, base + ( i + 1 ) * 2^shift ), values outside go to the end bins */
+    if ( bin_shift > CAM_STATS_MAX_BIN_SHIFT )
+        return ERR_PACKET_INVALID;
+    
+    cam_stats_base_us = base_us;
+    cam_stats_bin_shift = bin_shift;
+    cam_stats_reset();
+    
+    return ERR_OK;
+}
+
+extern void cam_stats_add( uint16_t read_time_us )
+{
+    uint16_t bin;
+    
+    if ( cam_stats_count < 0xFFFFFFFF )
+        cam_stats_count++;
+    
+    if ( read_time_us < cam_stats_min )
+        cam_stats_min = read_time_us;
+    if ( read_time_us > cam_stats_max )
+        cam_stats_max = read_time_us;
+    
+    if ( cam_stats_sum_count == 0xFFFF )
+    {
+        cam_stats_sum >>= 1;
+        cam_stats_sum_count >>= 1;
+    }
+    cam_stats_sum += read_time_us;
+    cam_stats_sum_count++;
+    
+    if ( read_time_us < cam_stats_base_us )
+        bin = 0;
+    else
+    {
+        bin = ( read_time_us - cam_stats_base_us ) >> cam_stats_bin_shift;
+        if ( bin >= CAM_STATS_NUM_BINS )
+            bin = CAM_STATS_NUM_BINS - 1;
+    }
+    
+    if ( cam_stats_bins[bin] < 0xFFFF )
+        cam_stats_bins[bin]++;
+}
+
+extern void cam_stats_report( uint8_t *buf )
+{
+    uint8_t i;
+    
+    *(uint32_t *)&buf[0] = cam_stats_count;
+    *(uint16_t *)&buf[4] = cam_stats_count ? cam_stats_min : 0;
+    *(uint16_t *)&buf[6] = cam_stats_max;
+    *(uint16_t *)&buf[8] = cam_stats_sum_count ? (uint16_t)( cam_stats_sum / cam_stats_sum_count ) : 0;
+    
+    for ( i=0; i<CAM_STATS_NUM_BINS; i++ )
+        *(uint16_t *)&buf[10 + ( 2 * i )] = cam_stats_bins[i];
+}
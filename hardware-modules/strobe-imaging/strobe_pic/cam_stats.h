@@ -0,0 +1,28 @@
+#ifndef CAM_STATS_H
+#define	CAM_STATS_H
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/* Camera read time (T1G gate width) statistics */
+#define CAM_STATS_NUM_BINS              8
+#define CAM_STATS_DEFAULT_BASE_US       0
+#define CAM_STATS_DEFAULT_BIN_SHIFT     12          // 4096us bins -> 0..32767us
+#define CAM_STATS_MAX_BIN_SHIFT         15
+#define CAM_STATS_REPORT_SIZE           ( 10 + ( 2 * CAM_STATS_NUM_BINS ) )
+
+/* Stats Functions */
+extern void cam_stats_init( void );
+extern void cam_stats_reset( void );
+extern err cam_stats_set_hist( uint16_t base_us, uint8_t bin_shift );
+extern void cam_stats_add( uint16_t read_time_us );
+
+/* Writes [count U32][min U16][max U16][mean U16][bins U16 * CAM_STATS_NUM_BINS] */
+extern void cam_stats_report( uint8_t *buf );
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* CAM_STATS_H */
@@ -20,6 +20,12 @@ extern "C" {
 
 #define ERR_PACKET_OVERFLOW         30
 #define ERR_PACKET_INVALID          31
+#define ERR_PACKET_TIMEOUT          32
+
+#define ERR_STROBE_TIMING_INVALID   40
+#define ERR_STROBE_SEQ_INVALID      41
+#define ERR_TRIG_TEST_INVALID       42
+#define ERR_TRIG_TEST_BUSY          43
 
 typedef uint8_t err;
 
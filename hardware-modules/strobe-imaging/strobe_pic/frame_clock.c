@@ -0,0 +1,107 @@
+#include "mcc_generated_files/mcc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "frame_clock.h"
+#include "trig_test.h"
+
+/* PPS codes. PPS is never locked, pin_manager.c leaves PPSLOCKED clear. */
+#define FRAME_CLOCK_PPS_IN_RA0          0x00        // RA0 for xxxPPS inputs, wired to the camera trigger input
+#define FRAME_CLOCK_PPS_OUT_CCP3        0x0B        // RxyPPS CCP3OUT
+
+volatile uint8_t frame_clock_running = 0;
+
+uint32_t frame_clock_period;                        // ns, as made
+uint8_t frame_clock_t1gpps;
+uint8_t frame_clock_t2ainpps;
+uint8_t frame_clock_clcin0pps;
+uint8_t frame_clock_smt2sigpps;
+
+// Extern Functions --------------------------------------------------------
+
+extern err frame_clock_start( uint32_t period_ns )
+{
+    /* Starts the clock, or changes the period of a running one. <period_ns> is rounded to
+     * two compares of TMR5, 250 ns steps up to 16.4 ms and coarser with the prescaler. */
+    uint32_t half_ticks;
+    uint16_t ccpr;
+    uint8_t ps;
+
+    if ( trig_test_state != TRIG_TEST_IDLE )
+        return ERR_TRIG_TEST_BUSY;
+
+    if ( ( period_ns < FRAME_CLOCK_PERIOD_MIN_NS ) || ( period_ns > FRAME_CLOCK_PERIOD_MAX_NS ) )
+        return ERR_STROBE_TIMING_INVALID;
+
+    /* Half the period in TMR5 counts of the smallest prescaler that fits 16 bits */
+    half_ticks = ( period_ns + FRAME_CLOCK_TICK_NS ) / ( 2 * FRAME_CLOCK_TICK_NS );
+    for ( ps=0; ( ps < FRAME_CLOCK_PRESCALE_MAX ) && ( half_ticks > ( 0x10000UL << ps ) ); ps++ );
+    ccpr = (uint16_t)( ( ( half_ticks + ( ( 1UL << ps ) >> 1 ) ) >> ps ) - 1 );
+    frame_clock_period = ( ( (uint32_t)ccpr + 1 ) << ps ) * ( 2 * FRAME_CLOCK_TICK_NS );
+
+    /* TMR5 on Fosc/4, 16-bit reads; CCP3 toggles its output and clears TMR5 on each match */
+    T5CON = 0;
+    T5GCON = 0;
+    T5CLK = 0x01;                   // Fosc/4
+    TMR5H = 0;
+    TMR5L = 0;
+    CCPR3H = (uint8_t)( ccpr >> 8 );
+    CCPR3L = (uint8_t)ccpr;
+    CCPTMRS0 = ( CCPTMRS0 & 0xCF ) | 0b110000;  // C3TSEL TMR5
+    CCP3CON = 0x81;                 // EN; compare, toggle output and clear the timer
+
+    if ( !frame_clock_running )
+    {
+        /* RA0 drives the camera trigger, and stands in for the camera on RC5 as T1G input,
+         * TMR2 reset input, CLC4 input of the chained trigger and SMT2 frame period signal */
+        LATAbits.LATA0 = 0;
+        ANSELAbits.ANSA0 = 0;
+        TRISAbits.TRISA0 = 0;
+        RA0PPS = FRAME_CLOCK_PPS_OUT_CCP3;
+
+        INTERRUPT_GlobalInterruptDisable();
+        frame_clock_t1gpps = T1GPPS;
+        frame_clock_t2ainpps = T2AINPPS;
+        frame_clock_clcin0pps = CLCIN0PPS;
+        frame_clock_smt2sigpps = SMT2SIGPPS;
+        T1GPPS = FRAME_CLOCK_PPS_IN_RA0;
+        T2AINPPS = FRAME_CLOCK_PPS_IN_RA0;
+        CLCIN0PPS = FRAME_CLOCK_PPS_IN_RA0;
+        SMT2SIGPPS = FRAME_CLOCK_PPS_IN_RA0;
+        frame_clock_running = 1;
+        INTERRUPT_GlobalInterruptEnable();
+    }
+
+    T5CON = (uint8_t)( ( ps << 4 ) | 0b00000011 );     // ON; RD16; synchronised; 1:2^ps
+
+    return ERR_OK;
+}
+
+extern void frame_clock_stop( void )
+{
+    /* Gives RA0 and the trigger inputs back to the camera on RC5 */
+    if ( !frame_clock_running )
+        return;
+
+    T5CON = 0;
+    CCP3CON = 0;
+
+    INTERRUPT_GlobalInterruptDisable();
+    T1GPPS = frame_clock_t1gpps;
+    T2AINPPS = frame_clock_t2ainpps;
+    CLCIN0PPS = frame_clock_clcin0pps;
+    SMT2SIGPPS = frame_clock_smt2sigpps;
+    frame_clock_running = 0;
+    INTERRUPT_GlobalInterruptEnable();
+
+    RA0PPS = 0;
+    TRISAbits.TRISA0 = 1;
+    ANSELAbits.ANSA0 = 1;
+    frame_clock_period = 0;
+}
+
+extern uint32_t frame_clock_period_ns( void )
+{
+    return frame_clock_running ? frame_clock_period : 0;
+}
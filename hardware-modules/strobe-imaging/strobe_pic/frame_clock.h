@@ -0,0 +1,32 @@
+#ifndef FRAME_CLOCK_H
+#define	FRAME_CLOCK_H
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/* Frame clock: the strobe PIC as master of the frame rate. CCP3 toggles RA0 on every
+ * compare with TMR5 and clears it, a square wave whose rising edges trigger the camera.
+ * RA0 stands in for the camera on RC5, as in the trigger self-test, so the strobe, the
+ * frame period measurement and phase lock all run off the same edges.
+ */
+#define FRAME_CLOCK_TICK_NS             125         // TMR5 on Fosc/4, 32 MHz
+#define FRAME_CLOCK_PRESCALE_MAX        3           // T5CON CKPS 1:8
+#define FRAME_CLOCK_PERIOD_MIN_NS       100000UL    // 10 kHz, above any camera frame rate
+#define FRAME_CLOCK_PERIOD_MAX_NS       131072000UL // Two compares of 65536 x 1:8 x 125 ns
+#define FRAME_CLOCK_REPORT_SIZE         4           // [period ns U32]
+
+extern volatile uint8_t frame_clock_running;
+
+/* Frame Clock Functions */
+extern err frame_clock_start( uint32_t period_ns );
+extern void frame_clock_stop( void );
+
+/* The period the clock makes, in ns, 0 when stopped */
+extern uint32_t frame_clock_period_ns( void );
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* FRAME_CLOCK_H */
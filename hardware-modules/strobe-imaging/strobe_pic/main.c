@@ -1,6 +1,14 @@
 /*
- * To do:
- * - Report if detected frame rate is slower than configured strobe pulse
+ * Strobe Imaging PIC firmware
+ * 
+ * Trigger modes (PACKET_TYPE_SET_TRIGGER_MODE):
+ * - 0 Software: TMR2 free runs, strobe is not synchronised to the camera
+ * - 1 Hardware: camera frame signal (XVS/fstrobe -> T1G input, pin RC5) starts each strobe
+ * - 2 Hardware chained: the camera edge starts TMR2 through CLC4 and the TMR2 HLT reset,
+ *   with no interrupt in the path; see strobe_chain_update()
+ * 
+ * All T1G gate handling (camera read time, hardware trigger, gate re-arm) runs in the
+ * TMR1 gate interrupt, so it never waits for SPI packet parsing in the main loop.
  * 
  * #include <pic16f18857.h>
  */
@@ -11,7 +19,12 @@
 #include <string.h>
 #include <pic16f18856.h>
 #include "common.h"
-#include "spi.h"
+#include "rio_spi.h"
+#include "rio_bench.h"
+#include "cam_stats.h"
+#include "trig_test.h"
+#include "frame_clock.h"
+#include "strobe_b.h"
 
 #pragma warning disable 520     // Disable "not used" messages
 
@@ -20,35 +33,289 @@
 #define PS_PER_TICK         ( 1000000000 / ( CLOCK_FREQ / 1000 ) )      // 31250 ps/tick
 #define TIME_SCALING        10                                          // 31250 can be divided by 10 whole
 #define MAX_TIME_NS         ( ( ( (uint32_t)PS_PER_TICK << 7 ) / 1000 ) * 16 * 255 )    // Max timer period = 522240 ticks = 16,320,000ns
+#define TICKS_TO_NS( t )    ( ( ( (t) << 7 ) - ( (t) << 1 ) - (t) ) >> 2 )                 // 31.25 ns/tick = 125/4, no multiply/divide. Only valid for CLOCK_FREQ 32MHz
+
+/* Long waits: SMT1, 24 bits on Fosc, counts the wait up to a short TMR2 tail, which its period
+ * match interrupt starts. The interrupt entry, estimated, is taken off the SMT1 period. */
+#define LONG_WAIT_TICKS_MAX     0x1000000ul
+#define MAX_LONG_TIME_NS        ( ( ( (uint32_t)PS_PER_TICK / 1000 ) * LONG_WAIT_TICKS_MAX ) + ( LONG_WAIT_TICKS_MAX >> 2 ) )  // 524,288,000ns
+#define LONG_WAIT_ERR_NS        500                     // 8-bit wait error above which SMT1 takes the wait
+#define LONG_WAIT_TAIL_TICKS    2                       // TMR2 PR2 1 at 1:1, the shortest wait find_scalers_time() gives
+#define LONG_WAIT_TAIL_PR2      1
+#define LONG_WAIT_ISR_TICKS     96                      // About 3 us from the SMT1 match to T2ON
+#define LONG_WAIT_SMT_CLK_FOSC  0x01                    // SMTxCLK CSEL Fosc
+
+/* SET_STROBE_TIMING_RAW: register values planned by the host, see drivers/strobe.py */
+#define TIMER_TCON_SCALERS      0x7F                    // TxCON prescale (6:4) and postscale (3:0), not ON
+#define RAW_TIMING_FLAG_SHADOW  0x01                    // Stage as the shadow instead of applying now
+#define RAW_TIMING_SIZE         8                       // [pr2][t2con][pr4][t4con][smt_pr U32]
+
+/* Frame period: SMT2 in period and duty cycle mode on the camera input counts Fosc ticks between
+ * rising edges, read in strobe_gate_isr(). Its period match, no edge for 524 ms, means the camera
+ * stopped. Phase lock restages the wait at a fraction of the averaged period. */
+#define FRAME_SMT_MODE_PERIOD   0x02                    // SMTxCON1 MODE period and duty cycle
+#define FRAME_SMT_REPEAT        0x40                    // SMTxCON1 REPEAT, every edge
+#define FRAME_SMT_SIG_PIN       0x00                    // SMTxSIG SSEL SMTxSIGPPS
+#define FRAME_SMT_PPS_IN_RC5    0x15                    // SMT2SIGPPS, the camera input
+#define FRAME_PERIOD_AVG_SHIFT  2                       // Running average of about 4 periods
+#define PHASE_LOCK_DEADBAND_TICKS   16                  // 0.5 us of drift before the wait is restaged
+#define PHASE_LOCK_REPORT_SIZE  10                      // [phase U16][frame period ns U32][wait ns U32]
 
 /* Comms Constants */
 #define PACKET_TYPE_SET_STROBE_ENABLE   1
 #define PACKET_TYPE_SET_STROBE_TIMING   2
 #define PACKET_TYPE_SET_STROBE_HOLD     3
 #define PACKET_TYPE_GET_CAM_READ_TIME   4
+#define PACKET_TYPE_SET_TRIGGER_MODE    5
+#define PACKET_TYPE_SET_STROBE_TIMING_SHADOW    6
+#define PACKET_TYPE_COMMIT_STROBE_TIMING        7
+#define PACKET_TYPE_SET_STROBE_SEQ_ENTRY        8
+#define PACKET_TYPE_SET_STROBE_SEQ              9
+#define PACKET_TYPE_SET_STROBE_PULSES           10
+#define PACKET_TYPE_GET_STROBE_STATS            11
+#define PACKET_TYPE_GET_CAM_READ_STATS          12
+#define PACKET_TYPE_SET_CAM_READ_HIST           13
+#define PACKET_TYPE_GET_STROBE_EVENTS           14
+#define PACKET_TYPE_GET_SPI_STATS               15
+#define PACKET_TYPE_ECHO                        16
+#define PACKET_TYPE_TRIG_TEST                   17
+#define PACKET_TYPE_SYNC_TIME                   18
+#define PACKET_TYPE_GET_CAPABILITIES            19
+#define PACKET_TYPE_GET_LOAD_STATS              20
+#define PACKET_TYPE_SET_STROBE_TIMING_RAW       21
+#define PACKET_TYPE_SET_PHASE_LOCK              22
+#define PACKET_TYPE_SET_FRAME_CLOCK             23
+#define PACKET_TYPE_BENCHMARK                   24
+#define PACKET_TYPE_SET_STROBE_B                25
+#define PACKET_TYPE_LAST                        PACKET_TYPE_SET_STROBE_B        // Types 1 to this are all handled, BENCHMARK with BENCH_ENABLED
+#define FIRMWARE_VERSION                        0x0100  // [major U8][minor U8], reported by GET_CAPABILITIES
+#define ECHO_PAYLOAD_MAX                        CAM_STATS_REPORT_SIZE   // return_buf[] after the rc, and a 32 byte reply
+
+/* Timebase sync, SYNC_TIME modes as rio_time.h on the dsPIC boards */
+#define TIME_SYNC_SET               0                       // Value is the host time now, in us
+#define TIME_SYNC_ADJUST            1                       // Value is an I32 step in us, added to the offset
+#define TIME_REPORT_SIZE            10                      // [synced us U32][local us U32][syncs U16]
+
+/* CPU load, as the rio_probe load report on the dsPIC boards, in TMR0 us */
+#define LOAD_WINDOW_US              1000000
+#define LOAD_REPORT_SIZE            16                      // [load permille U16][peak permille U16][isr permille U16][isr max us U16][idle pass us U16][pass max us U16][passes U32]
+
+/* Sequence Constants */
+#define STROBE_SEQ_MAX_ENTRIES      16
+
+/* Multi-pulse Constants */
+#define STROBE_MAX_PULSES           8
+
+/* Event FIFO Constants */
+#define STROBE_EVENT_FIFO_SIZE      32                      // Power of 2
+#define STROBE_EVENT_FIFO_MASK      ( STROBE_EVENT_FIFO_SIZE - 1 )
+#define STROBE_EVENTS_PER_PACKET    3                       // 3 + ( 3 * 7 ) bytes fits SPI_PACKET_BUF_SIZE
+#define STROBE_EVENT_FIRED          0x01
+#define STROBE_EVENT_DROPPED_BUSY   0x02
+#define STROBE_EVENT_DROPPED_OFF    0x04
+#define STROBE_EVENT_CHAN_B         0x08                    // Channel B fired on this frame
+#define STROBE_EVENT_CHAN_A_OFF     0x10                    // Channel A held off, B's frame of the alternate pattern
+
+/* Hardware chained trigger */
+#define STROBE_CHAIN_PPS_IN_RC5     0x15                    // CLCIN0PPS, the camera input
+#define STROBE_CHAIN_SEL_CLCIN0     0x00                    // LCxDyS CLCIN0PPS
+#define STROBE_CHAIN_SEL_TMR4_PR4   0x0E                    // LCxDyS TMR4=PR4, high once a pulse has ended
+#define STROBE_CHAIN_RSEL_CLC4      0x11                    // T2RSEL LC4_out
+#define STROBE_CHAIN_RSEL_T2INPPS   0x00                    // T2RSEL T2INPPS pin, as set by MCC
 
 /* Packet Data */
 spi_packet_buf_t spi_packet;
 uint8_t packet_type;
-uint8_t packet_data[SPI_PACKET_BUF_SIZE];
+uint8_t *packet_data;               // Points into spi_packet.buf
 uint8_t packet_data_size;
-uint8_t return_buf[9];
+uint8_t return_buf[1 + CAM_STATS_REPORT_SIZE];
 
 /* Strobe Data */
-uint16_t cam_read_time_us;
+volatile uint16_t cam_read_time_us;
+uint8_t trigger_mode = 0;  // 0 = software trigger (current), 1 = hardware trigger (T1G input), 2 = hardware chained
+uint8_t trig_test_trigger_mode;  // trigger_mode to restore after the trigger path self-test
+uint8_t strobe_enabled = 0;  // Track if strobe should be enabled (for hardware trigger mode)
+
+/* Timer register values for one wait/duration setting */
+typedef struct
+{
+    uint8_t pr2;
+    uint8_t pr4;
+    uint8_t t2con;      // Prescale/postscale bits only, ON bit is preserved on apply
+    uint8_t t4con;
+    uint32_t smt_pr;    // SMT1 period ahead of the TMR2 tail for a long wait, 0 for TMR2 alone
+} strobe_timing_t;
+
+/* Shadow timing, staged over SPI and applied in one step on commit.
+ * In hardware trigger mode a pending shadow is committed on the next T1G edge.
+ */
+strobe_timing_t strobe_timing_shadow;
+volatile uint8_t strobe_timing_shadow_pending = 0;
+
+/* A shadow staged with an apply time is held, not pending, until the synchronized clock reaches
+ * that time, so a strobe change can land together with setpoints staged on the other modules.
+ * Main loop only.
+ */
+uint8_t strobe_timing_shadow_held = 0;
+uint32_t strobe_timing_shadow_apply_us;
+
+/* Timing currently in the timer registers, so the wait can be restored after multi-pulse gaps */
+strobe_timing_t strobe_timing_active;
+
+/* Sequence table, stepped on each T1G edge in hardware trigger mode.
+ * Each entry is converted to register values once on upload and used for <repeat> frames.
+ * An entry with repeat == 0 has not been uploaded.
+ */
+typedef struct
+{
+    strobe_timing_t timing;
+    uint8_t repeat;
+} strobe_seq_entry_t;
+
+strobe_seq_entry_t strobe_seq[STROBE_SEQ_MAX_ENTRIES];
+uint8_t strobe_seq_length = 0;
+uint8_t strobe_seq_loop = 0;
+uint8_t strobe_seq_index = 0;               // Next entry to load
+uint8_t strobe_seq_repeat_count = 0;        // Frames left on current entry
+volatile uint8_t strobe_seq_active = 0;
+
+/* Multi-pulse per frame: after each pulse ends (TMR4 match) the wait timer is
+ * reloaded with the gap and restarted, until <strobe_pulse_count> pulses have fired.
+ */
+uint8_t strobe_pulse_count = 1;
+uint8_t strobe_gap_pr2;
+uint8_t strobe_gap_t2con;
+uint32_t strobe_gap_ns = 0;
+volatile uint8_t strobe_pulses_left = 0;    // Gaps still to run in this frame
+
+/* SMT1 running the first part of a long wait */
+volatile uint8_t long_wait_running = 0;
+
+/* Camera frame period from SMT2, FRAME_PERIOD_AVG_SHIFT sum of ticks, 0 until the first period.
+ * The capture after a start or a stop is partial and skipped. */
+volatile uint32_t frame_period_sum = 0;
+volatile uint8_t frame_period_skip = 1;
+volatile uint8_t frame_period_new = 0;
+
+/* Phase lock: wait at <phase_lock> / 65536 of the frame period, 0 off. Main loop only. */
+uint16_t phase_lock = 0;
+uint32_t phase_lock_wait_ticks = 0;         // Last staged, 0 to restage on the next period
+uint32_t phase_lock_wait_ns = 0;
+
+/* Trigger statistics, updated in the TMR1 interrupt */
+typedef struct
+{
+    uint32_t triggers;              // T1G edges received
+    uint32_t fired;                 // Strobe sequences started
+    uint32_t dropped_busy;          // Edge arrived while previous pulse(s) still running
+    uint32_t dropped_disabled;      // Edge arrived with strobe disabled
+} strobe_stats_t;
+
+volatile strobe_stats_t strobe_stats;
+
+/* Trigger events, pushed in the TMR1 interrupt and drained over SPI.
+ * Timestamps are from TMR0 (16-bit, 1us) extended to 32 bits by its overflow interrupt.
+ */
+typedef struct
+{
+    uint32_t timestamp_us;
+    uint16_t gate_us;               // TMR1 gate width for this edge
+    uint8_t flags;                  // STROBE_EVENT_*
+} strobe_event_t;
+
+strobe_event_t strobe_events[STROBE_EVENT_FIFO_SIZE];
+volatile uint8_t strobe_events_head = 0;
+volatile uint8_t strobe_events_tail = 0;
+volatile uint8_t strobe_events_lost = 0;
+volatile uint16_t timebase_us_hi = 0;
+uint32_t timebase_offset_us = 0;    // Host time - local time, set by SYNC_TIME. Main loop only.
+uint16_t timebase_syncs = 0;
+
+/* CPU load: main loop passes in a window against the shortest pass, an idle one, and the
+ * interrupt manager's time from entry to exit. A PIC16 does not nest interrupts.
+ */
+typedef struct
+{
+    uint16_t last;                  // TMR0 at the previous pass
+    uint16_t idle;                  // Shortest pass, kept by the reset
+    uint16_t pass_max;
+    uint32_t window;                // us and passes in the window so far
+    uint32_t passes;
+    uint32_t window_passes;         // Last complete window
+    uint16_t permille;
+    uint16_t isr_permille;
+    uint16_t peak_permille;
+    uint8_t started;
+} load_t;
+
+load_t load;
+uint16_t load_isr_start;            // Interrupt only
+volatile uint32_t load_isr_us;      // Interrupt time in the window so far
+volatile uint16_t load_isr_max_us;
+
+/* Forward declarations */
+uint32_t find_scalers_time( uint32_t target_time_ns, uint8_t *prescale, uint8_t *postscale, uint8_t *period );
+uint32_t find_long_wait( uint32_t target_time_ns, uint32_t *smt_period );
+void long_wait_init( void );
+void long_wait_end( void );
+void strobe_wait_start( void );
+void set_strobe_enable( uint8_t enable );
+void set_strobe_hold( uint8_t hold );
+uint8_t calc_strobe_wait( uint32_t *wait_target_ns, strobe_timing_t *timing );
+uint8_t calc_strobe_timing( uint32_t *wait_target_ns, uint32_t *duration_target_ns, strobe_timing_t *timing );
+uint32_t timer_ticks( uint8_t period, uint8_t tcon );
+uint8_t decode_strobe_timing( const uint8_t *data, strobe_timing_t *timing, uint32_t *wait_ns, uint32_t *duration_ns );
+void apply_strobe_timing( strobe_timing_t *timing );
+void load_strobe_timing( strobe_timing_t *timing );
+void stage_strobe_timing( strobe_timing_t *timing, uint8_t held );
+void set_strobe_timing( uint32_t *wait_target_ns, uint32_t *duration_target_ns );
+void set_strobe_timing_shadow( uint32_t *wait_target_ns, uint32_t *duration_target_ns, uint8_t held );
+void release_strobe_timing_shadow( void );
+void commit_strobe_timing( void );
+err set_strobe_seq_entry( uint8_t index, uint32_t *wait_target_ns, uint32_t *duration_target_ns, uint8_t repeat );
+err set_strobe_seq( uint8_t length, uint8_t loop );
+void step_strobe_seq( void );
+err set_strobe_pulses( uint8_t count, uint32_t gap_target_ns );
+void set_trigger_mode( uint8_t mode );
+void strobe_chain_init( void );
+void strobe_chain_update( void );
+uint8_t hardware_trigger_strobe( void );
+uint8_t chained_trigger_strobe( void );
+void strobe_pulse_end( void );
+void strobe_gate_isr( void );
+void frame_period_init( void );
+void frame_period_capture( void );
+uint32_t frame_period_ticks( void );
+uint32_t phase_lock_ticks( uint32_t period_ticks, uint16_t phase );
+void phase_lock_poll( void );
+void timebase_init( void );
+void timebase_overflow( void );
+uint32_t timebase_read_isr( void );
+err timebase_sync( uint8_t *data, uint8_t data_size );
+void timebase_report( uint8_t *buf );
+void load_init( void );
+void load_pass( void );
+uint16_t tmr0_read( void );
+void load_isr_enter( void );
+void load_isr_exit( void );
+void load_report( uint8_t *buf, uint8_t reset );
+void strobe_event_push( uint8_t flags );
+uint8_t strobe_events_pop( uint8_t *buf, uint8_t max_events );
 
 uint32_t find_scalers_time( uint32_t target_time_ns, uint8_t *prescale, uint8_t *postscale, uint8_t *period )
 {
     uint32_t ticks;
-    uint32_t rem;
+    uint32_t rem[17];
     uint32_t period_loop;
-    int8_t postscale_loop;
-    int8_t prescale_loop;
     uint32_t time_ns_loop;
+    uint32_t diff_loop;
+    uint32_t diff_best;
     uint32_t time_ns_best;
+    uint8_t postscale_loop;
+    int8_t prescale_loop;
     uint8_t postscale_best;
     uint8_t prescale_best;
-    uint32_t period_best;
+    uint8_t period_best;
     
     if ( target_time_ns > MAX_TIME_NS )
         return 0;
@@ -60,47 +327,126 @@ uint32_t find_scalers_time( uint32_t target_time_ns, uint8_t *prescale, uint8_t
      */
     ticks = ( target_time_ns * ( 1000 / TIME_SCALING ) + ( ( PS_PER_TICK >> 1 ) / TIME_SCALING ) ) / ( PS_PER_TICK / TIME_SCALING );
 
+    /* ticks / postscale for every postscale. floor( floor( a / b ) / 2 ) == floor( a / ( 2 * b ) ),
+     * so only the odd postscales need a real divide (7 instead of 16).
+     */
+    rem[1] = ticks;
+    for ( postscale_loop=2; postscale_loop<=16; postscale_loop++ )
+    {
+        if ( postscale_loop & 1 )
+            rem[postscale_loop] = ticks / postscale_loop;
+        else
+            rem[postscale_loop] = rem[postscale_loop >> 1] >> 1;
+    }
+
     time_ns_best = 0;
+    diff_best = target_time_ns;
     postscale_best = 0;
     prescale_best = 0;
     period_best = 0;
 
-    for ( postscale_loop=16; postscale_loop>=1; postscale_loop-- )
+    /* Search order is postscale 16..1, prescale 7..0 and the first strictly closer match wins.
+     * Achieved time is TICKS_TO_NS( ( period * postscale ) << prescale ), which equals
+     * ( ( 3125 << prescale ) * period * postscale ) / 100 exactly.
+     */
+    for ( postscale_loop=16; ( postscale_loop>=1 ) && ( diff_best != 0 ); postscale_loop-- )
     {
-        rem = ticks / postscale_loop;
-
         for ( prescale_loop=7; prescale_loop>=0; prescale_loop-- )
         {
             if ( prescale_loop == 0 )
-                period_loop = rem;
+                period_loop = rem[postscale_loop];
             else
-                period_loop = ( ( rem >> ( prescale_loop - 1 ) ) + 1 ) >> 1;  // Round
+                period_loop = ( ( rem[postscale_loop] >> ( prescale_loop - 1 ) ) + 1 ) >> 1;  // Round
+
+            /* Period only grows as the prescale drops, so nothing further fits this postscale */
+            if ( period_loop > 0xFF )
+                break;
 
-            if ( ( period_loop > 0 ) && ( period_loop <= 0xFF ) && ( ( period_loop > 1 ) || ( prescale_loop > 0 ) ) )
+            if ( ( period_loop == 0 ) || ( ( period_loop == 1 ) && ( prescale_loop == 0 ) ) )
+                continue;
+
+            time_ns_loop = (uint32_t)( (uint16_t)period_loop * postscale_loop ) << prescale_loop;
+            time_ns_loop = TICKS_TO_NS( time_ns_loop );
+            diff_loop = ( time_ns_loop > target_time_ns ) ? ( time_ns_loop - target_time_ns ) : ( target_time_ns - time_ns_loop );
+
+            if ( diff_loop < diff_best )
             {
-                time_ns_loop = ( ( ( ( (uint32_t)PS_PER_TICK / TIME_SCALING ) << prescale_loop ) * period_loop ) * postscale_loop ) / ( 1000 / TIME_SCALING );
-                
-                if ( labs( time_ns_loop - target_time_ns ) < labs( time_ns_best - target_time_ns ) )
-                {
-                    time_ns_best = time_ns_loop;
-                    postscale_best = postscale_loop;
-                    prescale_best = prescale_loop;
-                    period_best = period_loop;
-                }
+                time_ns_best = time_ns_loop;
+                diff_best = diff_loop;
+                postscale_best = postscale_loop;
+                prescale_best = prescale_loop;
+                period_best = (uint8_t)period_loop;
 
-                if ( time_ns_loop == target_time_ns )
+                /* An exact match cannot be beaten */
+                if ( diff_best == 0 )
                     break;
             }
         }
     }
-    
+
     *prescale = prescale_best;
     *postscale = postscale_best - 1;
-    *period = (uint8_t)( period_best - 1 );
+    *period = period_best - 1;
 
     return time_ns_best;
 }
 
+uint32_t find_long_wait( uint32_t target_time_ns, uint32_t *smt_period )
+{
+    /* SMT1 period for a wait of <target_time_ns> ending in the TMR2 tail, to the nearest tick.
+     * Returns the achieved ns, or 0 if out of range. */
+    uint32_t ticks;
+    
+    if ( target_time_ns > MAX_LONG_TIME_NS )
+        return 0;
+    
+    ticks = ( ( target_time_ns << 2 ) + 62 ) / 125;    // 31.25 ns = 125/4
+    if ( ticks <= LONG_WAIT_TAIL_TICKS + LONG_WAIT_ISR_TICKS + 1 )
+        return 0;
+    
+    /* SMT1 matches SMT1PR + 1 ticks after the start */
+    *smt_period = ticks - ( LONG_WAIT_TAIL_TICKS + LONG_WAIT_ISR_TICKS ) - 1;
+    
+    return TICKS_TO_NS( ticks );
+}
+
+void long_wait_init( void )
+{
+    /* SMT1 in timer mode on Fosc, single acquisition, started per frame by strobe_wait_start() */
+    SMT1CON0 = 0;
+    SMT1CON1 = 0;
+    SMT1CLK = LONG_WAIT_SMT_CLK_FOSC;
+    SMT1CON0bits.EN = 1;
+    PIR8bits.SMT1IF = 0;
+    PIE8bits.SMT1IE = 1;
+}
+
+/* SMT1 period match Interrupt Handler - called from interrupt manager, ahead of the T1G gate */
+void long_wait_end( void )
+{
+    SMT1CON1bits.SMT1GO = 0;
+    TMR2 = 0;
+    T2CONbits.T2ON = 1;
+    long_wait_running = 0;
+}
+
+void strobe_wait_start( void )
+{
+    /* Reset and start the wait timer for one frame, or SMT1 ahead of it for a long wait */
+    if ( strobe_timing_active.smt_pr )
+    {
+        long_wait_running = 1;
+        SMT1STATbits.RST = 1;
+        PIR8bits.SMT1IF = 0;
+        SMT1CON1bits.SMT1GO = 1;
+    }
+    else
+    {
+        TMR2 = 0;
+        T2CONbits.T2ON = 1;
+    }
+}
+
 void set_strobe_enable( uint8_t enable )
 {
     /* <enable> must be 0 or 1 */
@@ -111,167 +457,1383 @@ void set_strobe_enable( uint8_t enable )
      * CLC3 output to go FALSE.
      */
     
-//    T4CONbits.T4ON = enable;
-    T2CONbits.T2ON = enable;
+    strobe_enabled = enable;
+    
+    /* In hardware trigger modes TMR2 is started by the T1G gate interrupt, in chained mode
+     * only the first frame after this */
+    T2CONbits.T2ON = ( trigger_mode == 0 ) ? enable : 0;
     T4CONbits.T4ON = 1;
-//    CLC3CONbits.LC3EN = enable;
+    PIR5bits.CLC4IF = 0;
+    strobe_chain_update();
 }
 
 void set_strobe_hold( uint8_t hold )
 {
     /* Hold strobe on regardless */
-    
     LC3G3POL = hold ? 1 : 0;
 }
 
-void set_strobe_timing( uint32_t *wait_target_ns, uint32_t *duration_target_ns )
+uint8_t calc_strobe_wait( uint32_t *wait_target_ns, strobe_timing_t *timing )
 {
+    /* The wait of calc_strobe_timing(): pr2, t2con and smt_pr, the duration is left as it is */
     uint8_t wait_prescale;
     uint8_t wait_postscale;
-    uint8_t wait_period;
+    uint32_t wait_ns;
+    uint32_t wait_err_ns;
+    
+    wait_ns = find_scalers_time( *wait_target_ns, &wait_prescale, &wait_postscale, &timing->pr2 );
+    
+    /* Past the 8-bit range, or too coarse in it: SMT1 and a TMR2 tail */
+    timing->smt_pr = 0;
+    wait_err_ns = ( wait_ns > *wait_target_ns ) ? ( wait_ns - *wait_target_ns ) : ( *wait_target_ns - wait_ns );
+    if ( wait_err_ns > LONG_WAIT_ERR_NS )
+    {
+        wait_ns = find_long_wait( *wait_target_ns, &timing->smt_pr );
+        wait_prescale = 0;
+        wait_postscale = 0;
+        timing->pr2 = LONG_WAIT_TAIL_PR2;
+    }
+    *wait_target_ns = wait_ns;
+    timing->t2con = ( wait_prescale << 4 ) | wait_postscale;
+    
+    return ( wait_ns != 0 );
+}
+
+uint8_t calc_strobe_timing( uint32_t *wait_target_ns, uint32_t *duration_target_ns, strobe_timing_t *timing )
+{
     uint8_t duration_prescale;
     uint8_t duration_postscale;
-    uint8_t duration_period;
-    uint32_t wait_ns;
-    uint32_t duration_ns;
+    uint8_t wait_valid;
+    
+    wait_valid = calc_strobe_wait( wait_target_ns, timing );
+    *duration_target_ns = find_scalers_time( *duration_target_ns, &duration_prescale, &duration_postscale, &timing->pr4 );
+    
+    /* If time_ns==0 -> couldn't calculate register values */
+    if ( !wait_valid || ( *duration_target_ns == 0 ) )
+        return 0;
+    
+    timing->t4con = ( duration_prescale << 4 ) | duration_postscale;
+    
+    return 1;
+}
+
+uint32_t timer_ticks( uint8_t period, uint8_t tcon )
+{
+    /* Period of TMR2/TMR4 at PRx <period> and the scalers of TxCON <tcon> */
+    return (uint32_t)( ( (uint16_t)period + 1 ) * ( ( tcon & 0x0F ) + 1 ) ) << ( ( tcon >> 4 ) & 0x07 );
+}
+
+uint8_t decode_strobe_timing( const uint8_t *data, strobe_timing_t *timing, uint32_t *wait_ns, uint32_t *duration_ns )
+{
+    /* RAW_TIMING_SIZE bytes of register values, taken as they are. Checks only what the timers
+     * cannot run: the ON bit, a 1 tick period, which find_scalers_time() never gives either,
+     * and SMT1 past 24 bits. Returns 0 if invalid. */
+    uint32_t ticks;
+    
+    timing->pr2 = data[0];
+    timing->t2con = data[1];
+    timing->pr4 = data[2];
+    timing->t4con = data[3];
+    timing->smt_pr = *(uint32_t *)&data[4];
+    
+    if ( ( timing->t2con & ~TIMER_TCON_SCALERS ) || ( timing->t4con & ~TIMER_TCON_SCALERS ) )
+        return 0;
+    if ( ( ( timing->pr2 == 0 ) && ( timing->t2con == 0 ) ) || ( ( timing->pr4 == 0 ) && ( timing->t4con == 0 ) ) )
+        return 0;
+    if ( timing->smt_pr >= LONG_WAIT_TICKS_MAX )
+        return 0;
+    
+    /* SMT1 matches SMT1PR + 1 ticks after the start, then the interrupt starts the TMR2 tail */
+    ticks = timer_ticks( timing->pr2, timing->t2con );
+    if ( timing->smt_pr )
+        ticks += timing->smt_pr + 1 + LONG_WAIT_ISR_TICKS;
+    *wait_ns = TICKS_TO_NS( ticks );
+    ticks = timer_ticks( timing->pr4, timing->t4con );
+    *duration_ns = TICKS_TO_NS( ticks );
+    
+    return 1;
+}
+
+void apply_strobe_timing( strobe_timing_t *timing )
+{
     uint8_t t4con_copy;
     
-    *wait_target_ns = find_scalers_time( *wait_target_ns, &wait_prescale, &wait_postscale, &wait_period );
-    *duration_target_ns = find_scalers_time( *duration_target_ns, &duration_prescale, &duration_postscale, &duration_period );
+    /* Stop output temporarily */
+    t4con_copy = T4CON;
+    T4CON = 0;
     
-//    duration_prescale = 0;
-//    duration_postscale = 0;
-//    duration_period = 0;
+    /* Configure timers and re-enable output if necessary */
+    PR2 = timing->pr2;
+    PR4 = timing->pr4;
+    T2CON = ( T2CON & 0b10000000 ) | timing->t2con;
+    T4CON = ( t4con_copy & 0b10000000 ) | timing->t4con;
+    SMT1PRU = (uint8_t)( timing->smt_pr >> 16 );
+    SMT1PRH = (uint8_t)( timing->smt_pr >> 8 );
+    SMT1PRL = (uint8_t)timing->smt_pr;
     
-// 7 0 10 8
-// 7 0 20 15
-// 7 0 39 25
-// 7 0 255 188
+    strobe_timing_active = *timing;
+}
+
+void load_strobe_timing( strobe_timing_t *timing )
+{
+    INTERRUPT_GlobalInterruptDisable();
     
-    if ( ( *wait_target_ns > 0 ) && ( *duration_target_ns > 0 ) )
-    {
-        /* If time_ns==0 -> couldn't calculate register values */
-        
-        /* Stop output temporarily */
-        t4con_copy = T4CON;
-        T4CON = 0;
-        
-        /* Configure timers and re-enable output if necessary */
-        PR2 = wait_period;
-        PR4 = duration_period;
-        T2CON = ( T2CON & 0b10000000 ) | ( wait_prescale << 4 ) | wait_postscale;
-        T4CON = ( t4con_copy & 0b10000000 ) | ( duration_prescale << 4 ) | duration_postscale;
-    }
+    /* Immediate write replaces anything staged */
+    strobe_timing_shadow_pending = 0;
+    strobe_timing_shadow_held = 0;
+    apply_strobe_timing( timing );
+    strobe_chain_update();
+    
+    INTERRUPT_GlobalInterruptEnable();
 }
 
-void main(void)
+void stage_strobe_timing( strobe_timing_t *timing, uint8_t held )
 {
-    err rc;
+    /* <held>: keep it back until strobe_timing_shadow_apply_us, see release_strobe_timing_shadow() */
     
-// --------------------------------------------------------------------------
+    /* Clear pending first so the T1G interrupt never applies a half-written shadow */
+    strobe_timing_shadow_pending = 0;
+    strobe_timing_shadow = *timing;
+    strobe_timing_shadow_held = held;
+    strobe_timing_shadow_pending = !held;
+    strobe_chain_update();
+}
+
+void set_strobe_timing( uint32_t *wait_target_ns, uint32_t *duration_target_ns )
+{
+    strobe_timing_t timing;
     
-    SYSTEM_Initialize();
+    if ( calc_strobe_timing( wait_target_ns, duration_target_ns, &timing ) )
+        load_strobe_timing( &timing );
+}
+
+void set_strobe_timing_shadow( uint32_t *wait_target_ns, uint32_t *duration_target_ns, uint8_t held )
+{
+    strobe_timing_t timing;
     
-    spi_init();
-    spi_packet_clear( &spi_packet );
+    if ( calc_strobe_timing( wait_target_ns, duration_target_ns, &timing ) )
+        stage_strobe_timing( &timing, held );
+}
+
+void release_strobe_timing_shadow( void )
+{
+    /* Main loop, every pass. A held shadow becomes pending once its apply time has come: software
+     * trigger mode commits it now, the hardware modes on the next T1G edge as any shadow. */
+    uint32_t now_us;
     
-    cam_read_time_us = 0;
+    if ( !strobe_timing_shadow_held )
+        return;
     
-// --------------------------------------------------------------------------
+    INTERRUPT_GlobalInterruptDisable();
+    now_us = timebase_read_isr();
+    INTERRUPT_GlobalInterruptEnable();
+    if ( (int32_t)( now_us + timebase_offset_us - strobe_timing_shadow_apply_us ) < 0 )
+        return;
     
+    strobe_timing_shadow_held = 0;
+    INTERRUPT_GlobalInterruptDisable();
+    strobe_timing_shadow_pending = 1;
+    if ( trigger_mode == 0 )
+        commit_strobe_timing();
+    else
+        strobe_chain_update();
     INTERRUPT_GlobalInterruptEnable();
-    INTERRUPT_PeripheralInterruptEnable();
-    //INTERRUPT_GlobalInterruptDisable();
-    //INTERRUPT_PeripheralInterruptDisable();
+}
+
+void commit_strobe_timing( void )
+{
+    /* Called from main loop on the commit packet, and from the TMR1 interrupt at the frame edge */
+    if ( strobe_timing_shadow_pending )
+    {
+        apply_strobe_timing( &strobe_timing_shadow );
+        strobe_timing_shadow_pending = 0;
+        strobe_chain_update();
+    }
+}
+
+err set_strobe_seq_entry( uint8_t index, uint32_t *wait_target_ns, uint32_t *duration_target_ns, uint8_t repeat )
+{
+    strobe_timing_t timing;
     
-//    set_strobe_timing( 2000000, 2000000 );
-//    set_strobe_enable( 1 );
+    if ( ( index >= STROBE_SEQ_MAX_ENTRIES ) || ( repeat == 0 ) )
+        return ERR_PACKET_INVALID;
     
-//    while ( 1 );
+    if ( !calc_strobe_timing( wait_target_ns, duration_target_ns, &timing ) )
+        return ERR_STROBE_TIMING_INVALID;
     
-    while ( 1 )
+    /* Entry may be in use by a running sequence */
+    INTERRUPT_GlobalInterruptDisable();
+    strobe_seq[index].timing = timing;
+    strobe_seq[index].repeat = repeat;
+    INTERRUPT_GlobalInterruptEnable();
+    
+    return ERR_OK;
+}
+
+err set_strobe_seq( uint8_t length, uint8_t loop )
+{
+    /* <length> == 0 stops the sequence, otherwise it restarts from entry 0 on the next T1G edge */
+    /* A rejected request leaves a running sequence as it is */
+    uint8_t i;
+    
+    if ( length > STROBE_SEQ_MAX_ENTRIES )
+        return ERR_PACKET_INVALID;
+    
+    for ( i=0; i<length; i++ )
+    {
+        if ( strobe_seq[i].repeat == 0 )
+            return ERR_STROBE_SEQ_INVALID;
+    }
+    
+    strobe_seq_active = 0;
+    strobe_seq_length = length;
+    strobe_seq_loop = loop ? 1 : 0;
+    strobe_seq_index = 0;
+    strobe_seq_repeat_count = 0;
+    strobe_seq_active = ( length > 0 ) ? 1 : 0;
+    strobe_chain_update();
+    
+    return ERR_OK;
+}
+
+void step_strobe_seq( void )
+{
+    /* Called from the TMR1 interrupt at the frame edge */
+    if ( strobe_seq_repeat_count == 0 )
     {
-        if ( spi_packet_read( &spi_packet, &packet_type, (uint8_t *)&packet_data, &packet_data_size, SPI_PACKET_BUF_SIZE ) == ERR_OK )
+        if ( strobe_seq_index >= strobe_seq_length )
         {
-            switch ( packet_type )
+            if ( !strobe_seq_loop )
             {
-                case 0:
-                {
-                    /* No or invalid packet */
-                    break;
-                }
-                case PACKET_TYPE_SET_STROBE_ENABLE:
-                {
-                    if ( packet_data_size == 1 )
-                    {
-                        set_strobe_enable( packet_data[0] ? 1 : 0 );
-                        rc = ERR_OK;
-                    }
-                    else
-                        rc = ERR_PACKET_INVALID;
-                    spi_packet_write( packet_type, &rc, 1 );
-                    break;
-                }
-                case PACKET_TYPE_SET_STROBE_TIMING:
-                {
-                    if ( packet_data_size == 8 )
-                    {
-                        uint32_t *strobe_wait_ns = (uint32_t *)&return_buf[1];
-                        uint32_t *strobe_period_ns = (uint32_t *)&return_buf[5];
-                        *strobe_wait_ns = *(uint32_t *)&packet_data[0];
-                        *strobe_period_ns = *(uint32_t *)&packet_data[4];
-                        set_strobe_timing( strobe_wait_ns, strobe_period_ns );
-                        return_buf[0] = ERR_OK;
-                        spi_packet_write( packet_type, return_buf, 9 );
-                    }
-                    else
-                    {
-                        rc = ERR_PACKET_INVALID;
-                        spi_packet_write( packet_type, &rc, 1 );
-                    }
-                    
-                    break;
-                }
-                case PACKET_TYPE_SET_STROBE_HOLD:
-                {
-                    if ( packet_data_size == 1 )
-                    {
-                        set_strobe_hold( packet_data[0] ? 1 : 0 );
-                        rc = ERR_OK;
-                    }
-                    else
-                        rc = ERR_PACKET_INVALID;
-                    spi_packet_write( packet_type, &rc, 1 );
-                    break;
-                }
-                case PACKET_TYPE_GET_CAM_READ_TIME:
-                {
-                    if ( packet_data_size == 0 )
-                    {
-                        *(uint16_t *)&return_buf[1] = cam_read_time_us;
-                        return_buf[0] = ERR_OK;
-                        spi_packet_write( packet_type, return_buf, 3 );
-                    }
-                    else
-                    {
-                        rc = ERR_PACKET_INVALID;
-                        spi_packet_write( packet_type, &rc, 1 );
-                    }
-                    break;
-                }
-                default:;
+                /* Finished, last entry's timing stays in place */
+                strobe_seq_active = 0;
+                return;
             }
+            strobe_seq_index = 0;
         }
         
-#if 1
-        if ( T1GCONbits.T1GGO == 0 )
-        {
-            /* Strobe input "read back time" measured using Timer 1 */
-            
-            cam_read_time_us = TMR1_ReadTimer();
-            TMR1_WriteTimer( 0 );
-            TMR1_StartSinglePulseAcquisition();
-        }
-#endif
+        apply_strobe_timing( &strobe_seq[strobe_seq_index].timing );
+        strobe_seq_repeat_count = strobe_seq[strobe_seq_index].repeat;
+        strobe_seq_index++;
+    }
+    
+    strobe_seq_repeat_count--;
+}
+
+err set_strobe_pulses( uint8_t count, uint32_t gap_target_ns )
+{
+    uint8_t gap_prescale;
+    uint8_t gap_postscale;
+    uint8_t gap_period;
+    uint32_t gap_ns;
+    
+    if ( ( count == 0 ) || ( count > STROBE_MAX_PULSES ) )
+        return ERR_PACKET_INVALID;
+    
+    if ( count > 1 )
+    {
+        gap_ns = find_scalers_time( gap_target_ns, &gap_prescale, &gap_postscale, &gap_period );
+        if ( gap_ns == 0 )
+            return ERR_STROBE_TIMING_INVALID;
+    }
+    else
+        gap_ns = 0;
+    
+    INTERRUPT_GlobalInterruptDisable();
+    strobe_pulse_count = count;
+    strobe_gap_ns = gap_ns;
+    if ( count > 1 )
+    {
+        strobe_gap_pr2 = gap_period;
+        strobe_gap_t2con = ( gap_prescale << 4 ) | gap_postscale;
+    }
+    strobe_chain_update();
+    INTERRUPT_GlobalInterruptEnable();
+    
+    return ERR_OK;
+}
+
+/* TMR4 Interrupt Handler - called from interrupt manager at the end of each pulse */
+void strobe_pulse_end( void )
+{
+    if ( strobe_pulses_left )
+    {
+        /* Time the gap with the wait timer, duration timer is unchanged */
+        strobe_pulses_left--;
+        T2CONbits.T2ON = 0;
+        PR2 = strobe_gap_pr2;
+        T2CON = strobe_gap_t2con;
+        TMR2 = 0;
+        T2CONbits.T2ON = 1;
+    }
+    else
+    {
+        /* Last pulse done, restore wait for the next frame */
+        PIE4bits.TMR4IE = 0;
+        PR2 = strobe_timing_active.pr2;
+        T2CON = ( T2CON & 0b10000000 ) | strobe_timing_active.t2con;
     }
 }
+
+void timebase_init( void )
+{
+    /* TMR0 16-bit, Fosc/4 / 8 = 1MHz, same tick as TMR1 so timestamps and gate widths are both in us */
+    T0CON0 = 0;
+    T0CON1 = 0b01000011;            // T0CS Fosc/4; T0ASYNC sync; T0CKPS 1:8
+    TMR0H = 0;
+    TMR0L = 0;
+    timebase_us_hi = 0;
+    PIR0bits.TMR0IF = 0;
+    PIE0bits.TMR0IE = 1;
+    T0CON0 = 0b10010000;            // T0EN on; T016BIT 16-bit; T0OUTPS 1:1
+}
+
+/* TMR0 Interrupt Handler - called from interrupt manager */
+void timebase_overflow( void )
+{
+    timebase_us_hi++;
+}
+
+uint32_t timebase_read_isr( void )
+{
+    /* Only valid with interrupts off (in an ISR). An overflow not yet serviced is counted here. */
+    uint16_t lo;
+    uint16_t hi;
+    
+    lo = TMR0L;
+    lo |= (uint16_t)TMR0H << 8;     // TMR0H is latched on TMR0L read
+    hi = timebase_us_hi;
+    if ( PIR0bits.TMR0IF && ( lo < 0x8000 ) )
+        hi++;
+    
+    return ( (uint32_t)hi << 16 ) | lo;
+}
+
+err timebase_sync( uint8_t *data, uint8_t data_size )
+{
+    /* Data as SYNC_TIME: none leaves the clock as it is, else [mode U8][value U32] */
+    uint32_t local_us;
+    
+    if ( data_size == 0 )
+        return ERR_OK;
+    if ( data_size != 5 )
+        return ERR_PACKET_INVALID;
+    
+    if ( data[0] == TIME_SYNC_SET )
+    {
+        INTERRUPT_GlobalInterruptDisable();
+        local_us = timebase_read_isr();
+        INTERRUPT_GlobalInterruptEnable();
+        timebase_offset_us = *(uint32_t *)&data[1] - local_us;
+    }
+    else if ( data[0] == TIME_SYNC_ADJUST )
+        timebase_offset_us += *(uint32_t *)&data[1];
+    else
+        return ERR_PACKET_INVALID;
+    
+    if ( timebase_syncs < 0xFFFF )
+        timebase_syncs++;
+    
+    return ERR_OK;
+}
+
+void timebase_report( uint8_t *buf )
+{
+    /* Fills TIME_REPORT_SIZE bytes as [synced us U32][local us U32][syncs U16] */
+    uint32_t local_us;
+    
+    INTERRUPT_GlobalInterruptDisable();
+    local_us = timebase_read_isr();
+    INTERRUPT_GlobalInterruptEnable();
+    
+    *(uint32_t *)&buf[0] = local_us + timebase_offset_us;
+    *(uint32_t *)&buf[4] = local_us;
+    *(uint16_t *)&buf[8] = timebase_syncs;
+}
+
+void load_init( void )
+{
+    memset( &load, 0, sizeof( load_t ) );
+    load.idle = 0xFFFF;
+    load_isr_us = 0;
+    load_isr_max_us = 0;
+}
+
+void load_pass( void )
+{
+    /* Once per main loop pass. A pass longer than a TMR0 wrap (65 ms) is undercounted. */
+    uint16_t now;
+    uint16_t us;
+    uint32_t idle;
+    uint32_t isr;
+    
+    now = tmr0_read();
+    us = now - load.last;
+    load.last = now;
+    if ( !load.started )
+    {
+        load.started = 1;
+        return;
+    }
+    
+    if ( us < load.idle )
+        load.idle = us;
+    if ( us > load.pass_max )
+        load.pass_max = us;
+    load.window += us;
+    load.passes++;
+    
+    if ( load.window < LOAD_WINDOW_US )
+        return;
+    
+    INTERRUPT_GlobalInterruptDisable();
+    isr = load_isr_us;
+    load_isr_us = 0;
+    INTERRUPT_GlobalInterruptEnable();
+    
+    idle = (uint32_t)load.idle * load.passes;
+    if ( idle > load.window )
+        idle = load.window;
+    if ( isr > load.window )
+        isr = load.window;
+    
+    load.permille = 1000 - (uint16_t)( ( idle * 1000 ) / load.window );
+    load.isr_permille = (uint16_t)( ( isr * 1000 ) / load.window );
+    if ( load.permille > load.peak_permille )
+        load.peak_permille = load.permille;
+    load.window_passes = load.passes;
+    load.window = 0;
+    load.passes = 0;
+}
+
+uint16_t tmr0_read( void )
+{
+    /* Main loop only */
+    uint16_t now;
+    
+    INTERRUPT_GlobalInterruptDisable();     // An interrupt reading TMR0L would relatch TMR0H
+    now = TMR0L;
+    now |= (uint16_t)TMR0H << 8;
+    INTERRUPT_GlobalInterruptEnable();
+    
+    return now;
+}
+
+#ifdef BENCH_ENABLED
+/* Benchmark kernels on canned inputs, see bench_port.h. The results go to bench_sink so the
+ * compiler keeps the work. */
+volatile uint32_t bench_sink;
+
+void bench_find_scalers( void )
+{
+    uint8_t prescale;
+    uint8_t postscale;
+    uint8_t period;
+    
+    bench_sink = find_scalers_time( 1234567, &prescale, &postscale, &period );
+}
+
+const bench_kernel_t bench_kernels[BENCH_COUNT] =
+{
+    [BENCH_NULL]           = bench_null,
+    [BENCH_FRAME_CHECKSUM] = bench_frame_checksum,
+    [BENCH_FRAME_CRC]      = bench_frame_crc,
+    [BENCH_FIND_SCALERS]   = bench_find_scalers,
+};
+#endif
+
+/* Called first and last in the interrupt manager */
+void load_isr_enter( void )
+{
+    load_isr_start = TMR0L;
+    load_isr_start |= (uint16_t)TMR0H << 8;
+}
+
+void load_isr_exit( void )
+{
+    uint16_t now;
+    uint16_t us;
+    
+    now = TMR0L;
+    now |= (uint16_t)TMR0H << 8;
+    us = now - load_isr_start;
+    load_isr_us += us;
+    if ( us > load_isr_max_us )
+        load_isr_max_us = us;
+}
+
+void load_report( uint8_t *buf, uint8_t reset )
+{
+    /* Fills LOAD_REPORT_SIZE bytes. With reset, the peak and the maximums are cleared. */
+    INTERRUPT_GlobalInterruptDisable();
+    *(uint16_t *)&buf[6] = load_isr_max_us;
+    if ( reset )
+        load_isr_max_us = 0;
+    INTERRUPT_GlobalInterruptEnable();
+    
+    *(uint16_t *)&buf[0] = load.permille;
+    *(uint16_t *)&buf[2] = load.peak_permille;
+    *(uint16_t *)&buf[4] = load.isr_permille;
+    *(uint16_t *)&buf[8] = ( load.idle == 0xFFFF ) ? 0 : load.idle;
+    *(uint16_t *)&buf[10] = load.pass_max;
+    *(uint32_t *)&buf[12] = load.window_passes;
+    
+    if ( reset )
+    {
+        load.pass_max = 0;
+        load.peak_permille = 0;
+    }
+}
+
+void strobe_event_push( uint8_t flags )
+{
+    /* Called from the TMR1 interrupt. When full, the newest event is lost. */
+    strobe_event_t *event;
+    
+    if ( ( ( strobe_events_head + 1 ) & STROBE_EVENT_FIFO_MASK ) == strobe_events_tail )
+    {
+        if ( strobe_events_lost < 0xFF )
+            strobe_events_lost++;
+        return;
+    }
+    
+    event = &strobe_events[strobe_events_head];
+    event->timestamp_us = timebase_read_isr();
+    event->gate_us = TMR1_ReadTimer();
+    event->flags = flags;
+    strobe_events_head = ( strobe_events_head + 1 ) & STROBE_EVENT_FIFO_MASK;
+}
+
+uint8_t strobe_events_pop( uint8_t *buf, uint8_t max_events )
+{
+    /* Copies up to <max_events> events as [timestamp_us U32][gate_us U16][flags U8], returns count.
+     * Timestamps are on the host timebase at the time of the copy, so an event queued before a
+     * SYNC_TIME is reported on the new offset. */
+    uint8_t n;
+    strobe_event_t *event;
+    
+    for ( n=0; ( n < max_events ) && ( strobe_events_tail != strobe_events_head ); n++ )
+    {
+        event = &strobe_events[strobe_events_tail];
+        *(uint32_t *)&buf[0] = event->timestamp_us + timebase_offset_us;
+        *(uint16_t *)&buf[4] = event->gate_us;
+        buf[6] = event->flags;
+        buf += 7;
+        strobe_events_tail = ( strobe_events_tail + 1 ) & STROBE_EVENT_FIFO_MASK;
+    }
+    
+    return n;
+}
+
+void set_trigger_mode( uint8_t mode )
+{
+    /* The T1G gate interrupt is always enabled for the camera read time, the mode only
+     * decides whether it also starts the strobe.
+     */
+    trigger_mode = ( mode <= 2 ) ? mode : 1;
+    
+    /* Chained mode takes the TMR2 reset from CLC4, the camera edge gated by strobe_chain_update() */
+    LC4G3POL = 0;
+    T2RST = ( trigger_mode == 2 ) ? STROBE_CHAIN_RSEL_CLC4 : STROBE_CHAIN_RSEL_T2INPPS;
+    set_strobe_enable( strobe_enabled );
+}
+
+void strobe_chain_init( void )
+{
+    /* CLC4, 4-input AND: camera edge (CLCIN0 = RC5), TMR4=PR4 (the last pulse has ended), and G3
+     * which has no inputs, so its polarity bit LC4G3POL is the software gate. G4 is always 1.
+     * INTP sets CLC4IF on each edge let through, the interrupt itself stays off.
+     */
+    CLC4CON = 0;
+    CLCIN0PPS = STROBE_CHAIN_PPS_IN_RC5;
+    CLC4SEL0 = STROBE_CHAIN_SEL_CLCIN0;
+    CLC4SEL1 = STROBE_CHAIN_SEL_TMR4_PR4;
+    CLC4SEL2 = STROBE_CHAIN_SEL_TMR4_PR4;
+    CLC4SEL3 = STROBE_CHAIN_SEL_TMR4_PR4;
+    CLC4GLS0 = 0x02;                // G1 = D1
+    CLC4GLS1 = 0x08;                // G2 = D2
+    CLC4GLS2 = 0x00;
+    CLC4GLS3 = 0x00;
+    CLC4POL = 0x08;                 // G4 inverted; G3 (gate) closed
+    PIR5bits.CLC4IF = 0;
+    CLC4CON = 0b10010010;           // EN; INTP; 4-input AND
+}
+
+void strobe_chain_update( void )
+{
+    /* Opens the CLC4 gate when the next frame needs nothing from strobe_gate_isr(): no staged
+     * timing or sequence to apply before the wait starts, one pulse per frame, no long wait to
+     * start on SMT1, no channel B. TMR2 must have
+     * run once, it then stays at its period match between frames (CLC1 stops its clock) and the
+     * HLT reset from CLC4 starts the wait. Otherwise edges take the hardware trigger path.
+     */
+    LC4G3POL = ( ( trigger_mode == 2 ) && strobe_enabled && T2CONbits.T2ON && !strobe_timing_shadow_pending
+                 && !strobe_seq_active && ( strobe_pulse_count == 1 ) && !strobe_timing_active.smt_pr
+                 && ( strobe_b_mode == STROBE_B_OFF ) ) ? 1 : 0;
+}
+
+/* Start the strobe for one camera frame - called from strobe_gate_isr(). Returns 1 if it fired. */
+uint8_t hardware_trigger_strobe( void )
+{
+    uint8_t chan_a;
+    uint8_t chan_b;
+    
+    strobe_stats.triggers++;
+    
+    if ( !strobe_enabled )
+    {
+        strobe_stats.dropped_disabled++;
+        strobe_event_push( STROBE_EVENT_DROPPED_OFF );
+    }
+    else if ( strobe_pulses_left || long_wait_running || ( CLC3CONbits.LC3OUT && !LC3G3POL )
+              || ( strobe_b_mode && T6CONbits.T6ON ) )
+    {
+        /* Frame faster than the configured pulse train, restarting TMR2 now would cut the pulse short */
+        strobe_stats.dropped_busy++;
+        strobe_event_push( STROBE_EVENT_DROPPED_BUSY );
+    }
+    else
+    {
+        strobe_stats.fired++;
+        
+        /* The alternate pattern gives every other frame to channel B alone */
+        chan_a = 1;
+        chan_b = ( strobe_b_mode == STROBE_B_SIMULTANEOUS );
+        if ( strobe_b_mode == STROBE_B_ALTERNATE )
+        {
+            chan_b = strobe_b_phase;
+            chan_a = !chan_b;
+            strobe_b_phase = chan_a;
+        }
+        strobe_event_push( STROBE_EVENT_FIRED | ( chan_b ? STROBE_EVENT_CHAN_B : 0 ) | ( chan_a ? 0 : STROBE_EVENT_CHAN_A_OFF ) );
+        
+        if ( chan_a )
+        {
+            /* Hardware trigger detected - start strobe pulse sequence */
+            /* Frame boundary, previous pulse is done so staged timing can be applied without a glitch.
+             * A running sequence owns the timing, shadow commits wait until it has finished.
+             */
+            if ( strobe_seq_active )
+                step_strobe_seq();
+            else
+                commit_strobe_timing();
+            
+            /* Extra pulses are started from the TMR4 (pulse end) interrupt */
+            strobe_pulses_left = strobe_pulse_count - 1;
+            if ( strobe_pulses_left )
+            {
+                PIR4bits.TMR4IF = 0;
+                PIE4bits.TMR4IE = 1;
+            }
+            
+            strobe_wait_start();
+            /* TMR4 already running (duration timer) */
+        }
+        
+        /* Right after channel A, so the offset between the two is the same every frame */
+        if ( chan_b )
+            strobe_b_start();
+        return 1;
+    }
+    
+    return 0;
+}
+
+/* Count the camera frame in chained mode - called from strobe_gate_isr(). Returns 1 if it fired. */
+uint8_t chained_trigger_strobe( void )
+{
+    uint8_t fired = 0;
+    
+    if ( PIR5bits.CLC4IF )
+    {
+        /* Started by CLC4 at the edge, only the bookkeeping is left */
+        PIR5bits.CLC4IF = 0;
+        strobe_stats.triggers++;
+        strobe_stats.fired++;
+        strobe_event_push( STROBE_EVENT_FIRED );
+        fired = 1;
+    }
+    else if ( LC4G3POL )
+    {
+        /* Gate open, so CLC4 held the edge back: the previous pulse had not ended */
+        strobe_stats.triggers++;
+        strobe_stats.dropped_busy++;
+        strobe_event_push( STROBE_EVENT_DROPPED_BUSY );
+    }
+    else
+        fired = hardware_trigger_strobe();
+    
+    strobe_chain_update();
+    
+    return fired;
+}
+
+/* TMR1 gate Interrupt Handler - called from interrupt manager when a single pulse acquisition completes */
+void strobe_gate_isr( void )
+{
+    uint8_t fired = 0;
+    
+    TRIG_TEST_GATE_ENTRY();
+    
+    if ( trigger_mode == 1 )
+        fired = hardware_trigger_strobe();
+    else if ( trigger_mode == 2 )
+        fired = chained_trigger_strobe();
+    
+    /* Strobe input "read back time" measured using Timer 1, not the self-test edges */
+    if ( trig_test_state != TRIG_TEST_IDLE )
+        trig_test_gate( fired );
+    else
+    {
+        cam_read_time_us = TMR1_ReadTimer();
+        cam_stats_add( cam_read_time_us );
+    }
+    TMR1_WriteTimer( 0 );
+    TMR1_StartSinglePulseAcquisition();
+    
+    frame_period_capture();
+}
+
+void frame_period_init( void )
+{
+    /* SMT2 on Fosc, period and duty cycle acquisition of RC5 on every edge. Polled, its
+     * interrupts stay off. */
+    SMT2CON0 = 0;
+    SMT2CON1 = 0;
+    SMT2CLK = LONG_WAIT_SMT_CLK_FOSC;
+    SMT2SIG = FRAME_SMT_SIG_PIN;
+    SMT2SIGPPS = FRAME_SMT_PPS_IN_RC5;
+    SMT2PRU = 0xFF;
+    SMT2PRH = 0xFF;
+    SMT2PRL = 0xFF;
+    SMT2CON1 = FRAME_SMT_REPEAT | FRAME_SMT_MODE_PERIOD;
+    PIR8bits.SMT2IF = 0;
+    PIR8bits.SMT2PRAIF = 0;
+    frame_period_sum = 0;
+    frame_period_skip = 1;
+    SMT2CON0bits.EN = 1;
+    SMT2CON1bits.SMT2GO = 1;
+}
+
+void frame_period_capture( void )
+{
+    /* Called from strobe_gate_isr(), after the rising edge of this frame captured its period */
+    uint32_t period;
+    
+    if ( PIR8bits.SMT2IF )
+    {
+        /* No edge for the whole SMT2 period: the camera stopped, start over */
+        PIR8bits.SMT2IF = 0;
+        PIR8bits.SMT2PRAIF = 0;
+        frame_period_sum = 0;
+        frame_period_skip = 1;
+        return;
+    }
+    if ( !PIR8bits.SMT2PRAIF )
+        return;
+    PIR8bits.SMT2PRAIF = 0;
+    
+    if ( frame_period_skip )
+    {
+        frame_period_skip = 0;
+        return;
+    }
+    
+    period = ( (uint32_t)SMT2CPRU << 16 ) | ( (uint16_t)SMT2CPRH << 8 ) | SMT2CPRL;
+    if ( frame_period_sum == 0 )
+        frame_period_sum = period << FRAME_PERIOD_AVG_SHIFT;
+    else
+        frame_period_sum += period - ( frame_period_sum >> FRAME_PERIOD_AVG_SHIFT );
+    frame_period_new = 1;
+}
+
+uint32_t frame_period_ticks( void )
+{
+    /* Averaged frame period in Fosc ticks, 0 if none. Main loop. */
+    uint32_t sum;
+    
+    INTERRUPT_GlobalInterruptDisable();
+    sum = frame_period_sum;
+    INTERRUPT_GlobalInterruptEnable();
+    
+    return sum >> FRAME_PERIOD_AVG_SHIFT;
+}
+
+uint32_t phase_lock_ticks( uint32_t period_ticks, uint16_t phase )
+{
+    /* <period_ticks> * <phase> / 65536 for a 24-bit period, in 32 bits: the high 16 bits of the
+     * period and then the low 8 */
+    return ( ( ( period_ticks >> 8 ) * phase ) + ( ( ( period_ticks & 0xFF ) * phase ) >> 8 ) ) >> 8;
+}
+
+void phase_lock_poll( void )
+{
+    /* Main loop, every pass. Once a new period is in, restages the wait at the locked phase if it
+     * has drifted past the deadband; the shadow lands on the next frame edge. Not in software
+     * trigger mode, where nothing starts the wait from the camera, nor against a sequence or a
+     * held shadow from the host. */
+    strobe_timing_t timing;
+    uint32_t wait_ticks;
+    uint32_t wait_ns;
+    uint32_t drift;
+    
+    if ( !frame_period_new )
+        return;
+    frame_period_new = 0;
+    
+    if ( !phase_lock || ( trigger_mode == 0 ) || strobe_seq_active || strobe_timing_shadow_held )
+        return;
+    
+    wait_ticks = phase_lock_ticks( frame_period_ticks(), phase_lock );
+    drift = ( wait_ticks > phase_lock_wait_ticks ) ? ( wait_ticks - phase_lock_wait_ticks ) : ( phase_lock_wait_ticks - wait_ticks );
+    if ( ( phase_lock_wait_ticks != 0 ) && ( drift <= PHASE_LOCK_DEADBAND_TICKS ) )
+        return;
+    
+    /* On top of a shadow the host staged and the frame edge has not taken yet */
+    INTERRUPT_GlobalInterruptDisable();
+    timing = strobe_timing_shadow_pending ? strobe_timing_shadow : strobe_timing_active;
+    INTERRUPT_GlobalInterruptEnable();
+    
+    wait_ns = TICKS_TO_NS( wait_ticks );
+    if ( !calc_strobe_wait( &wait_ns, &timing ) )
+        return;
+    
+    INTERRUPT_GlobalInterruptDisable();
+    stage_strobe_timing( &timing, 0 );
+    INTERRUPT_GlobalInterruptEnable();
+    phase_lock_wait_ticks = wait_ticks;
+    phase_lock_wait_ns = wait_ns;
+}
+
+void main(void)
+{
+    err rc;
+    
+// --------------------------------------------------------------------------
+    
+    SYSTEM_Initialize();
+    
+    spi_init();
+    spi_packet_init( &spi_packet, NULL, 0 );    // No packet timeout
+    
+    cam_read_time_us = 0;
+    cam_stats_init();
+    trigger_mode = 0;  // Default to software trigger mode
+    strobe_enabled = 0;
+    memset( (void *)&strobe_stats, 0, sizeof( strobe_stats_t ) );
+    timebase_init();
+    load_init();
+    strobe_chain_init();
+    long_wait_init();
+    frame_period_init();
+    
+    /* Power-on timing from SYSTEM_Initialize() */
+    strobe_timing_active.pr2 = PR2;
+    strobe_timing_active.pr4 = PR4;
+    strobe_timing_active.t2con = T2CON & 0b01111111;
+    strobe_timing_active.t4con = T4CON & 0b01111111;
+    strobe_timing_active.smt_pr = 0;
+    
+// --------------------------------------------------------------------------
+    
+    /* TMR1 and the T1G input (pin RC5) are configured by SYSTEM_Initialize() */
+    PIR4bits.TMR1GIF = 0;
+    PIE4bits.TMR1GIE = 1;
+    TMR1_WriteTimer( 0 );
+    TMR1_StartSinglePulseAcquisition();
+    
+    INTERRUPT_GlobalInterruptEnable();
+    INTERRUPT_PeripheralInterruptEnable();
+    
+    while ( 1 )
+    {
+        load_pass();
+        
+        if ( trig_test_poll() )
+            set_trigger_mode( trig_test_trigger_mode );
+        
+        release_strobe_timing_shadow();
+        phase_lock_poll();
+        
+        if ( spi_packet_peek( &spi_packet, &packet_type, &packet_data, &packet_data_size ) == ERR_OK )
+        {
+            switch ( packet_type )
+            {
+                case 0:
+                {
+                    /* No or invalid packet */
+                    break;
+                }
+                case PACKET_TYPE_SET_STROBE_ENABLE:
+                {
+                    if ( packet_data_size == 1 )
+                    {
+                        set_strobe_enable( packet_data[0] ? 1 : 0 );
+                        rc = ERR_OK;
+                    }
+                    else
+                        rc = ERR_PACKET_INVALID;
+                    spi_packet_write( packet_type, &rc, 1 );
+                    break;
+                }
+                case PACKET_TYPE_SET_STROBE_TIMING:
+                {
+                    if ( packet_data_size == 8 )
+                    {
+                        uint32_t *strobe_wait_ns = (uint32_t *)&return_buf[1];
+                        uint32_t *strobe_period_ns = (uint32_t *)&return_buf[5];
+                        *strobe_wait_ns = *(uint32_t *)&packet_data[0];
+                        *strobe_period_ns = *(uint32_t *)&packet_data[4];
+                        set_strobe_timing( strobe_wait_ns, strobe_period_ns );
+                        return_buf[0] = ERR_OK;
+                        spi_packet_write( packet_type, return_buf, 9 );
+                    }
+                    else
+                    {
+                        rc = ERR_PACKET_INVALID;
+                        spi_packet_write( packet_type, &rc, 1 );
+                    }
+                    
+                    break;
+                }
+                case PACKET_TYPE_SET_STROBE_HOLD:
+                {
+                    if ( packet_data_size == 1 )
+                    {
+                        set_strobe_hold( packet_data[0] ? 1 : 0 );
+                        rc = ERR_OK;
+                    }
+                    else
+                        rc = ERR_PACKET_INVALID;
+                    spi_packet_write( packet_type, &rc, 1 );
+                    break;
+                }
+                case PACKET_TYPE_GET_CAM_READ_TIME:
+                {
+                    if ( packet_data_size == 0 )
+                    {
+                        INTERRUPT_GlobalInterruptDisable();
+                        *(uint16_t *)&return_buf[1] = cam_read_time_us;
+                        INTERRUPT_GlobalInterruptEnable();
+                        return_buf[0] = ERR_OK;
+                        spi_packet_write( packet_type, return_buf, 3 );
+                    }
+                    else
+                    {
+                        rc = ERR_PACKET_INVALID;
+                        spi_packet_write( packet_type, &rc, 1 );
+                    }
+                    break;
+                }
+                case PACKET_TYPE_SET_TRIGGER_MODE:
+                {
+                    if ( packet_data_size == 1 )
+                    {
+                        set_trigger_mode( packet_data[0] );
+                        rc = ERR_OK;
+                    }
+                    else
+                        rc = ERR_PACKET_INVALID;
+                    spi_packet_write( packet_type, &rc, 1 );
+                    break;
+                }
+                case PACKET_TYPE_SET_STROBE_TIMING_SHADOW:
+                {
+                    /* [wait_ns U32][duration_ns U32], optionally [apply time us U32] on the synchronized clock */
+                    if ( ( packet_data_size == 8 ) || ( packet_data_size == 12 ) )
+                    {
+                        uint32_t *strobe_wait_ns = (uint32_t *)&return_buf[1];
+                        uint32_t *strobe_period_ns = (uint32_t *)&return_buf[5];
+                        *strobe_wait_ns = *(uint32_t *)&packet_data[0];
+                        *strobe_period_ns = *(uint32_t *)&packet_data[4];
+                        if ( packet_data_size == 12 )
+                            strobe_timing_shadow_apply_us = *(uint32_t *)&packet_data[8];
+                        set_strobe_timing_shadow( strobe_wait_ns, strobe_period_ns, packet_data_size == 12 );
+                        return_buf[0] = ERR_OK;
+                        spi_packet_write( packet_type, return_buf, 9 );
+                    }
+                    else
+                    {
+                        rc = ERR_PACKET_INVALID;
+                        spi_packet_write( packet_type, &rc, 1 );
+                    }
+                    break;
+                }
+                case PACKET_TYPE_COMMIT_STROBE_TIMING:
+                {
+                    if ( packet_data_size == 0 )
+                    {
+                        /* Also commits a held shadow ahead of its apply time */
+                        INTERRUPT_GlobalInterruptDisable();
+                        if ( strobe_timing_shadow_held )
+                        {
+                            strobe_timing_shadow_held = 0;
+                            strobe_timing_shadow_pending = 1;
+                        }
+                        commit_strobe_timing();
+                        INTERRUPT_GlobalInterruptEnable();
+                        rc = ERR_OK;
+                    }
+                    else
+                        rc = ERR_PACKET_INVALID;
+                    spi_packet_write( packet_type, &rc, 1 );
+                    break;
+                }
+                case PACKET_TYPE_SET_STROBE_SEQ_ENTRY:
+                {
+                    /* [index U8][wait_ns U32][duration_ns U32][repeat U8] */
+                    if ( packet_data_size == 10 )
+                    {
+                        uint32_t *strobe_wait_ns = (uint32_t *)&return_buf[1];
+                        uint32_t *strobe_period_ns = (uint32_t *)&return_buf[5];
+                        *strobe_wait_ns = *(uint32_t *)&packet_data[1];
+                        *strobe_period_ns = *(uint32_t *)&packet_data[5];
+                        return_buf[0] = set_strobe_seq_entry( packet_data[0], strobe_wait_ns, strobe_period_ns, packet_data[9] );
+                        spi_packet_write( packet_type, return_buf, 9 );
+                    }
+                    else
+                    {
+                        rc = ERR_PACKET_INVALID;
+                        spi_packet_write( packet_type, &rc, 1 );
+                    }
+                    break;
+                }
+                case PACKET_TYPE_SET_STROBE_SEQ:
+                {
+                    /* Set: [length U8][loop U8], get: no data. Reply [rc][length][loop][active] */
+                    if ( packet_data_size == 2 )
+                        return_buf[0] = set_strobe_seq( packet_data[0], packet_data[1] );
+                    else if ( packet_data_size == 0 )
+                        return_buf[0] = ERR_OK;
+                    else
+                        return_buf[0] = ERR_PACKET_INVALID;
+                    return_buf[1] = strobe_seq_length;
+                    return_buf[2] = strobe_seq_loop;
+                    return_buf[3] = strobe_seq_active;
+                    spi_packet_write( packet_type, return_buf, 4 );
+                    break;
+                }
+                case PACKET_TYPE_SET_STROBE_PULSES:
+                {
+                    /* Set: [count U8][gap_ns U32], get: no data. Reply [rc][count U8][gap_ns U32] */
+                    if ( packet_data_size == 5 )
+                        return_buf[0] = set_strobe_pulses( packet_data[0], *(uint32_t *)&packet_data[1] );
+                    else if ( packet_data_size == 0 )
+                        return_buf[0] = ERR_OK;
+                    else
+                        return_buf[0] = ERR_PACKET_INVALID;
+                    return_buf[1] = strobe_pulse_count;
+                    *(uint32_t *)&return_buf[2] = strobe_gap_ns;
+                    spi_packet_write( packet_type, return_buf, 6 );
+                    break;
+                }
+                case PACKET_TYPE_GET_STROBE_STATS:
+                {
+                    /* [reset U8] optional. Reply [rc][triggers U32][fired U32][dropped_busy U32][dropped_disabled U32] */
+                    if ( packet_data_size <= 1 )
+                    {
+                        INTERRUPT_GlobalInterruptDisable();
+                        memcpy( &return_buf[1], (void *)&strobe_stats, sizeof( strobe_stats_t ) );
+                        if ( ( packet_data_size == 1 ) && packet_data[0] )
+                            memset( (void *)&strobe_stats, 0, sizeof( strobe_stats_t ) );
+                        INTERRUPT_GlobalInterruptEnable();
+                        return_buf[0] = ERR_OK;
+                        spi_packet_write( packet_type, return_buf, 1 + sizeof( strobe_stats_t ) );
+                    }
+                    else
+                    {
+                        rc = ERR_PACKET_INVALID;
+                        spi_packet_write( packet_type, &rc, 1 );
+                    }
+                    break;
+                }
+                case PACKET_TYPE_GET_CAM_READ_STATS:
+                {
+                    /* [reset U8] optional. Reply [rc][count U32][min U16][max U16][mean U16][bins U16 * 8] */
+                    if ( packet_data_size <= 1 )
+                    {
+                        INTERRUPT_GlobalInterruptDisable();
+                        cam_stats_report( &return_buf[1] );
+                        if ( ( packet_data_size == 1 ) && packet_data[0] )
+                            cam_stats_reset();
+                        INTERRUPT_GlobalInterruptEnable();
+                        return_buf[0] = ERR_OK;
+                        spi_packet_write( packet_type, return_buf, 1 + CAM_STATS_REPORT_SIZE );
+                    }
+                    else
+                    {
+                        rc = ERR_PACKET_INVALID;
+                        spi_packet_write( packet_type, &rc, 1 );
+                    }
+                    break;
+                }
+                case PACKET_TYPE_SET_CAM_READ_HIST:
+                {
+                    /* [base_us U16][bin_shift U8], also resets the statistics */
+                    if ( packet_data_size == 3 )
+                    {
+                        INTERRUPT_GlobalInterruptDisable();
+                        rc = cam_stats_set_hist( *(uint16_t *)&packet_data[0], packet_data[2] );
+                        INTERRUPT_GlobalInterruptEnable();
+                    }
+                    else
+                        rc = ERR_PACKET_INVALID;
+                    spi_packet_write( packet_type, &rc, 1 );
+                    break;
+                }
+                case PACKET_TYPE_GET_STROBE_EVENTS:
+                {
+                    /* Reply [rc][remaining U8][lost U8][n * ( [timestamp_us U32][gate_us U16][flags U8] )], n <= 3 */
+                    if ( packet_data_size == 0 )
+                    {
+                        uint8_t n;
+                        
+                        n = strobe_events_pop( &return_buf[3], STROBE_EVENTS_PER_PACKET );
+                        INTERRUPT_GlobalInterruptDisable();
+                        return_buf[1] = ( strobe_events_head - strobe_events_tail ) & STROBE_EVENT_FIFO_MASK;
+                        return_buf[2] = strobe_events_lost;
+                        strobe_events_lost = 0;
+                        INTERRUPT_GlobalInterruptEnable();
+                        return_buf[0] = ERR_OK;
+                        spi_packet_write( packet_type, return_buf, 3 + ( 7 * n ) );
+                    }
+                    else
+                    {
+                        rc = ERR_PACKET_INVALID;
+                        spi_packet_write( packet_type, &rc, 1 );
+                    }
+                    break;
+                }
+                case PACKET_TYPE_GET_SPI_STATS:
+                {
+                    /* [reset U8] optional. Reply [rc][spi_stats_report() U16 * 9] */
+                    if ( packet_data_size <= 1 )
+                    {
+                        spi_stats_report( &return_buf[1], ( packet_data_size == 1 ) && packet_data[0] );
+                        return_buf[0] = ERR_OK;
+                        spi_packet_write( packet_type, return_buf, 1 + SPI_STATS_REPORT_SIZE );
+                    }
+                    else
+                    {
+                        rc = ERR_PACKET_INVALID;
+                        spi_packet_write( packet_type, &rc, 1 );
+                    }
+                    break;
+                }
+                case PACKET_TYPE_ECHO:
+                {
+                    /* [payload...], up to ECHO_PAYLOAD_MAX, for timing the SPI link. Reply [rc][payload...] */
+                    if ( packet_data_size <= ECHO_PAYLOAD_MAX )
+                    {
+                        return_buf[0] = ERR_OK;
+                        memcpy( &return_buf[1], packet_data, packet_data_size );
+                        spi_packet_write( packet_type, return_buf, 1 + packet_data_size );
+                    }
+                    else
+                    {
+                        rc = ERR_PACKET_INVALID;
+                        spi_packet_write( packet_type, &rc, 1 );
+                    }
+                    break;
+                }
+                case PACKET_TYPE_TRIG_TEST:
+                {
+                    /* Start: [edges U16][period_us U16], edges 0 stops a running test. Get: no data.
+                     * Reply [rc][trig_test_report()] */
+                    return_buf[0] = ERR_OK;
+                    if ( packet_data_size == 4 )
+                    {
+                        if ( *(uint16_t *)&packet_data[0] == 0 )
+                            trig_test_stop();
+                        else if ( !strobe_enabled || ( strobe_pulse_count != 1 ) || strobe_b_mode )
+                            return_buf[0] = ERR_TRIG_TEST_INVALID;
+                        else if ( ( trig_test_state != TRIG_TEST_IDLE ) || frame_clock_running )
+                            return_buf[0] = ERR_TRIG_TEST_BUSY;
+                        else
+                        {
+                            /* The test edges go through the hardware trigger path, or the chained one */
+                            trig_test_trigger_mode = trigger_mode;
+                            set_trigger_mode( ( trigger_mode == 2 ) ? 2 : 1 );
+                            return_buf[0] = trig_test_start( *(uint16_t *)&packet_data[0], *(uint16_t *)&packet_data[2] );
+                            if ( return_buf[0] != ERR_OK )
+                                set_trigger_mode( trig_test_trigger_mode );
+                        }
+                    }
+                    else if ( packet_data_size != 0 )
+                        return_buf[0] = ERR_PACKET_INVALID;
+                    INTERRUPT_GlobalInterruptDisable();
+                    trig_test_report( &return_buf[1] );
+                    INTERRUPT_GlobalInterruptEnable();
+                    spi_packet_write( packet_type, return_buf, 1 + TRIG_TEST_REPORT_SIZE );
+                    break;
+                }
+                case PACKET_TYPE_SYNC_TIME:
+                {
+                    /* None to read the clock, or [mode U8][value U32], TIME_SYNC_*.
+                     * Reply [rc][synced us U32][local us U32][syncs U16] */
+                    rc = timebase_sync( packet_data, packet_data_size );
+                    if ( rc == ERR_OK )
+                    {
+                        return_buf[0] = ERR_OK;
+                        timebase_report( &return_buf[1] );
+                        spi_packet_write( packet_type, return_buf, 1 + TIME_REPORT_SIZE );
+                    }
+                    else
+                        spi_packet_write( packet_type, &rc, 1 );
+                    break;
+                }
+                case PACKET_TYPE_GET_CAPABILITIES:
+                {
+                    /* Reply [rc][spi_caps_report(), no control loop][packet types 1 to PACKET_TYPE_LAST] */
+                    uint8_t *types = &return_buf[1 + SPI_CAPS_REPORT_SIZE - ( SPI_CAPS_TYPES / 8 )];
+                    uint8_t type;
+                    
+                    return_buf[0] = ERR_OK;
+                    spi_caps_report( &return_buf[1], FIRMWARE_VERSION, 0 );
+                    memset( types, 0, SPI_CAPS_TYPES / 8 );
+                    for ( type=1; type<=PACKET_TYPE_LAST; type++ )
+                        types[type >> 3] |= 1 << ( type & 7 );
+#ifndef BENCH_ENABLED
+                    types[PACKET_TYPE_BENCHMARK >> 3] &= ~( 1 << ( PACKET_TYPE_BENCHMARK & 7 ) );
+#endif
+                    spi_packet_write( packet_type, return_buf, 1 + SPI_CAPS_REPORT_SIZE );
+                    break;
+                }
+                case PACKET_TYPE_GET_LOAD_STATS:
+                {
+                    /* [reset U8] optional. Reply [rc][load_report()] */
+                    if ( packet_data_size <= 1 )
+                    {
+                        load_report( &return_buf[1], ( packet_data_size == 1 ) && packet_data[0] );
+                        return_buf[0] = ERR_OK;
+                        spi_packet_write( packet_type, return_buf, 1 + LOAD_REPORT_SIZE );
+                    }
+                    else
+                    {
+                        rc = ERR_PACKET_INVALID;
+                        spi_packet_write( packet_type, &rc, 1 );
+                    }
+                    break;
+                }
+                case PACKET_TYPE_SET_STROBE_TIMING_RAW:
+                {
+                    /* [flags U8][pr2][t2con][pr4][t4con][smt_pr U32], optionally [apply time us U32]
+                     * for a held shadow as SET_STROBE_TIMING_SHADOW. No search on the chip.
+                     * Reply [rc][wait ns U32][duration ns U32], what the registers give. */
+                    if ( ( packet_data_size == 1 + RAW_TIMING_SIZE ) || ( packet_data_size == 5 + RAW_TIMING_SIZE ) )
+                    {
+                        strobe_timing_t timing;
+                        
+                        if ( decode_strobe_timing( &packet_data[1], &timing, (uint32_t *)&return_buf[1], (uint32_t *)&return_buf[5] ) )
+                        {
+                            if ( packet_data_size == 5 + RAW_TIMING_SIZE )
+                            {
+                                strobe_timing_shadow_apply_us = *(uint32_t *)&packet_data[1 + RAW_TIMING_SIZE];
+                                stage_strobe_timing( &timing, 1 );
+                            }
+                            else if ( packet_data[0] & RAW_TIMING_FLAG_SHADOW )
+                                stage_strobe_timing( &timing, 0 );
+                            else
+                                load_strobe_timing( &timing );
+                            return_buf[0] = ERR_OK;
+                            spi_packet_write( packet_type, return_buf, 9 );
+                            break;
+                        }
+                        rc = ERR_STROBE_TIMING_INVALID;
+                    }
+                    else
+                        rc = ERR_PACKET_INVALID;
+                    spi_packet_write( packet_type, &rc, 1 );
+                    break;
+                }
+                case PACKET_TYPE_SET_PHASE_LOCK:
+                {
+                    /* [phase U16], the wait as a fraction of the frame period / 65536 and 0 off, or
+                     * none to query. Reply [rc][phase U16][frame period ns U32][wait ns U32], the
+                     * period 0 until one is measured, the wait the last one phase lock staged. */
+                    if ( packet_data_size == 2 )
+                    {
+                        phase_lock = *(uint16_t *)&packet_data[0];
+                        phase_lock_wait_ticks = 0;
+                        phase_lock_wait_ns = 0;
+                        frame_period_new = ( frame_period_ticks() != 0 );
+                    }
+                    if ( ( packet_data_size == 0 ) || ( packet_data_size == 2 ) )
+                    {
+                        uint32_t period_ticks = frame_period_ticks();
+                        
+                        return_buf[0] = ERR_OK;
+                        *(uint16_t *)&return_buf[1] = phase_lock;
+                        *(uint32_t *)&return_buf[3] = TICKS_TO_NS( period_ticks );
+                        *(uint32_t *)&return_buf[7] = phase_lock_wait_ns;
+                        spi_packet_write( packet_type, return_buf, 1 + PHASE_LOCK_REPORT_SIZE );
+                    }
+                    else
+                    {
+                        rc = ERR_PACKET_INVALID;
+                        spi_packet_write( packet_type, &rc, 1 );
+                    }
+                    break;
+                }
+                case PACKET_TYPE_SET_FRAME_CLOCK:
+                {
+                    /* [period ns U32], 0 stops the clock, or none to query. Reply [rc][period ns U32],
+                     * the period as made and 0 when stopped. The host sets the trigger mode. */
+                    return_buf[0] = ERR_OK;
+                    if ( packet_data_size == 4 )
+                    {
+                        if ( *(uint32_t *)&packet_data[0] == 0 )
+                            frame_clock_stop();
+                        else
+                            return_buf[0] = frame_clock_start( *(uint32_t *)&packet_data[0] );
+                    }
+                    else if ( packet_data_size != 0 )
+                        return_buf[0] = ERR_PACKET_INVALID;
+                    *(uint32_t *)&return_buf[1] = frame_clock_period_ns();
+                    spi_packet_write( packet_type, return_buf, 1 + FRAME_CLOCK_REPORT_SIZE );
+                    break;
+                }
+                case PACKET_TYPE_SET_STROBE_B:
+                {
+                    /* [mode U8][wait ns U32][duration ns U32], STROBE_B_*, or none to query.
+                     * Reply [rc][strobe_b_report()], the times as made and 0 when off. */
+                    return_buf[0] = ERR_OK;
+                    if ( packet_data_size == 1 + 8 )
+                    {
+                        return_buf[0] = strobe_b_set( packet_data[0], *(uint32_t *)&packet_data[1], *(uint32_t *)&packet_data[5] );
+                        strobe_chain_update();
+                    }
+                    else if ( packet_data_size != 0 )
+                        return_buf[0] = ERR_PACKET_INVALID;
+                    strobe_b_report( &return_buf[1] );
+                    spi_packet_write( packet_type, return_buf, 1 + STROBE_B_REPORT_SIZE );
+                    break;
+                }
+#ifdef BENCH_ENABLED
+                case PACKET_TYPE_BENCHMARK:
+                {
+                    /* [kernel U8][runs U16]. Reply [rc][bench_run() report], see rio_bench.h. The
+                     * main loop waits for all the runs, the strobe interrupts do not. */
+                    if ( ( packet_data_size == 3 ) && ( packet_data[0] < BENCH_COUNT ) &&
+                         ( *(uint16_t *)&packet_data[1] != 0 ) && ( *(uint16_t *)&packet_data[1] <= BENCH_RUNS_MAX ) )
+                    {
+                        return_buf[0] = ERR_OK;
+                        bench_run( packet_data[0], *(uint16_t *)&packet_data[1], &return_buf[1] );
+                        spi_packet_write( packet_type, return_buf, 1 + BENCH_REPORT_SIZE );
+                    }
+                    else
+                    {
+                        rc = ERR_PACKET_INVALID;
+                        spi_packet_write( packet_type, &rc, 1 );
+                    }
+                    break;
+                }
+#endif
+                default:;
+            }
+            
+            spi_packet_consume( &spi_packet );
+        }
+    }
+}
+
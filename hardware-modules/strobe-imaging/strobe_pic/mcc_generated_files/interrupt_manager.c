@@ -49,16 +49,54 @@
 #include "interrupt_manager.h"
 #include "mcc.h"
 
+/* Strobe handlers in main.c.
+ * Hand-added: TMR0, SMT1, TMR1 gate and TMR4 branches below, and the load_isr_* calls, must be kept
+ * if MCC regenerates this file.
+ */
+extern void strobe_gate_isr( void );
+extern void strobe_pulse_end( void );
+extern void long_wait_end( void );
+extern void timebase_overflow( void );
+extern void load_isr_enter( void );
+extern void load_isr_exit( void );
+
 void __interrupt() INTERRUPT_InterruptManager (void)
 {
+    /* Interrupt time for GET_LOAD_STATS, about 1us on every interrupt */
+    load_isr_enter();
+    
     // interrupt handler
     if(PIE0bits.IOCIE == 1 && PIR0bits.IOCIF == 1)
     {
         PIN_MANAGER_IOC();
     }
+    else if(PIE0bits.TMR0IE == 1 && PIR0bits.TMR0IF == 1)
+    {
+        /* Event timestamp timebase */
+        PIR0bits.TMR0IF = 0;
+        timebase_overflow();
+    }
     else if(INTCONbits.PEIE == 1)
     {
-        if(PIE3bits.SSP1IE == 1 && PIR3bits.SSP1IF == 1)
+        /* End of the SMT1 part of a long wait, a few instructions to start the TMR2 tail */
+        if(PIE8bits.SMT1IE == 1 && PIR8bits.SMT1IF == 1)
+        {
+            PIR8bits.SMT1IF = 0;
+            long_wait_end();
+        }
+        /* T1G single pulse acquisition done (camera frame), checked next for trigger latency */
+        else if(PIE4bits.TMR1GIE == 1 && PIR4bits.TMR1GIF == 1)
+        {
+            PIR4bits.TMR1GIF = 0;
+            strobe_gate_isr();
+        }
+        /* End of a strobe pulse, only enabled while multi-pulse gaps are pending */
+        else if(PIE4bits.TMR4IE == 1 && PIR4bits.TMR4IF == 1)
+        {
+            PIR4bits.TMR4IF = 0;
+            strobe_pulse_end();
+        }
+        else if(PIE3bits.SSP1IE == 1 && PIR3bits.SSP1IF == 1)
         {
             SPI1_ISR();
         } 
@@ -71,6 +109,8 @@ void __interrupt() INTERRUPT_InterruptManager (void)
     {
         //Unhandled Interrupt
     }
+    
+    load_isr_exit();
 }
 /**
  End of File
@@ -0,0 +1,30 @@
+#include "spi_port.h"
+#include "common.h"
+#include "rio_spi.h"
+#include "mcc_generated_files/spi1.h"
+
+// Static Prototypes -------------------------------------------------------
+
+static uint8_t spi_port_exchange( uint8_t byte_in );
+
+// Extern Functions --------------------------------------------------------
+
+extern void spi_port_init( void )
+{
+    SPI1_setExchangeHandler( spi_port_exchange );
+}
+
+// Static Functions --------------------------------------------------------
+
+static uint8_t spi_port_exchange( uint8_t byte_in )
+{
+    /* MCC SPI1 exchange handler, the return value is loaded into SSP1BUF */
+    
+    uint8_t byte_out = 0;
+    
+    PIR3bits.SSP1IF = 0;
+    
+    spi_handler( byte_in, &byte_out );
+    
+    return byte_out;
+}
@@ -0,0 +1,43 @@
+/*
+ * File:   spi_port.h
+ *
+ * PIC16F18856 (MSSP1) shim for the shared rio_spi module, see
+ * hardware-modules/common/rio_spi.
+ */
+
+#ifndef SPI_PORT_H
+#define	SPI_PORT_H
+
+#include "mcc_generated_files/mcc.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#define SPI_READ_SUPPORTED
+#define SPI_WRITE_SUPPORTED
+
+/* Buffer sizes, kept small for the PIC16 RAM. The event and statistics replies are laid out for 28 payload bytes. */
+#define SPI_READ_BUF_SIZE               32
+#define SPI_WRITE_BUF_SIZE              32
+#define SPI_PACKET_BUF_SIZE             32
+
+/* STX_CRC frames, CRC-8 with a nibble table to keep flash use at 16 bytes */
+#define SPI_CRC_MODE                    SPI_CRC_8
+
+/* MSSP1 register access */
+#define SPI_PORT_INT_ON()               { PIE3bits.SSP1IE = 1; }
+#define SPI_PORT_INT_OFF()              { PIE3bits.SSP1IE = 0; }
+#define SPI_PORT_TX_PREPARE()
+#define SPI_PORT_TX_DIRECT( byte )      ( SSP1BUF = (byte), SSP1CON1bits.WCOL )    // Non-zero -> write collision, buffer the byte
+#define SPI_PORT_TX_CLEAR_COLLISION()   { SSP1CON1bits.WCOL = 0; }
+
+/* Data-ready line to the Pi, see rio_spi. The PCB has none: to add one, wire a free pin to a
+ * Pi GPIO, make it a low output in pin_manager.c and define e.g.
+ * #define SPI_PORT_READY( on )        { LATxbits.LATxn = (on); } */
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* SPI_PORT_H */
@@ -0,0 +1,117 @@
+#include "mcc_generated_files/mcc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "strobe_b.h"
+#include "trig_test.h"
+
+/* PPS codes. PPS is never locked, pin_manager.c leaves PPSLOCKED clear. */
+#define STROBE_B_PPS_OUT_PWM7           0x0F        // RxyPPS PWM7OUT
+
+#define STROBE_B_HLT_ONE_SHOT           0x08        // TxHLT MODE one-shot, software start
+#define STROBE_B_TICKS_TO_NS( t )       ( ( ( (t) << 7 ) - ( (t) << 1 ) - (t) ) >> 2 )     // TICKS_TO_NS() of main.c, 31.25 ns
+
+volatile uint8_t strobe_b_mode = STROBE_B_OFF;
+volatile uint8_t strobe_b_phase = 0;
+
+uint32_t strobe_b_wait_ns = 0;                      // As made
+uint32_t strobe_b_duration_ns = 0;
+
+// Extern Functions --------------------------------------------------------
+
+extern err strobe_b_set( uint8_t mode, uint32_t wait_ns, uint32_t duration_ns )
+{
+    /* Sets the pattern and the times, or turns channel B off. The times are rounded to
+     * Fosc ticks of 31.25 ns as find_scalers_time() does, then to the steps of the
+     * smallest prescaler whose 256 TMR6 counts cover both: the wait to a PWM7 duty step
+     * of 1 << ps ticks, the end of the pulse to a TMR6 count of 4 << ps ticks. */
+    uint32_t wait_ticks;
+    uint32_t end_ticks;
+    uint16_t counts;
+    uint16_t dc;
+    uint8_t ps;
+
+    if ( mode > STROBE_B_ALTERNATE )
+        return ERR_PACKET_INVALID;
+
+    if ( mode == STROBE_B_OFF )
+    {
+        INTERRUPT_GlobalInterruptDisable();
+        strobe_b_mode = STROBE_B_OFF;
+        INTERRUPT_GlobalInterruptEnable();
+
+        /* RC4 stays an output, held low */
+        RC4PPS = 0;
+        PWM7CON = 0;
+        T6CON = 0;
+        strobe_b_wait_ns = 0;
+        strobe_b_duration_ns = 0;
+        return ERR_OK;
+    }
+
+    /* The self-test edges come from PWM6 on TMR6 */
+    if ( trig_test_state != TRIG_TEST_IDLE )
+        return ERR_TRIG_TEST_BUSY;
+
+    if ( ( duration_ns == 0 ) || ( wait_ns > STROBE_B_MAX_TIME_NS ) || ( duration_ns > STROBE_B_MAX_TIME_NS - wait_ns ) )
+        return ERR_STROBE_TIMING_INVALID;
+
+    wait_ticks = ( wait_ns * 100 + 1562 ) / 3125;
+    end_ticks = ( ( wait_ns + duration_ns ) * 100 + 1562 ) / 3125;
+    for ( ps=0; ( ps < STROBE_B_PRESCALE_MAX ) && ( end_ticks > ( 1024UL << ps ) ); ps++ );
+    counts = (uint16_t)( ( end_ticks + ( 2UL << ps ) ) >> ( ps + 2 ) );
+    if ( counts == 0 )
+        counts = 1;
+
+    /* A duty cycle of 0 never sets the PWM output, which the inverted polarity would hold
+     * high, and one of the whole period never clears it: at least one step each */
+    dc = (uint16_t)( ( wait_ticks + ( ( 1UL << ps ) >> 1 ) ) >> ps );
+    if ( dc == 0 )
+        dc = 1;
+    if ( dc >= ( counts << 2 ) )
+        dc = ( counts << 2 ) - 1;
+    strobe_b_wait_ns = STROBE_B_TICKS_TO_NS( (uint32_t)dc << ps );
+    strobe_b_duration_ns = STROBE_B_TICKS_TO_NS( (uint32_t)counts << ( ps + 2 ) ) - strobe_b_wait_ns;
+
+    /* The gate interrupt must not start TMR6 half way through */
+    INTERRUPT_GlobalInterruptDisable();
+    RC4PPS = 0;
+    T6CON = 0;
+    T6CLKCON = 0x01;                // Fosc/4
+    T6HLT = STROBE_B_HLT_ONE_SHOT;
+    T6RST = 0;
+    PR6 = (uint8_t)( counts - 1 );
+    TMR6 = 0;
+    PWM7DCH = (uint8_t)( dc >> 2 );
+    PWM7DCL = (uint8_t)( ( dc & 0x03 ) << 6 );
+    CCPTMRS1 = ( CCPTMRS1 & 0xCF ) | 0b110000;  // P7TSEL TMR6
+    PWM7CON = 0x90;                 // EN; active low
+    T6CON = (uint8_t)( ps << 4 );   // 1:2^ps; 1:1
+    strobe_b_mode = mode;
+    strobe_b_phase = 0;
+    INTERRUPT_GlobalInterruptEnable();
+
+    LATCbits.LATC4 = 0;
+    ANSELCbits.ANSC4 = 0;
+    TRISCbits.TRISC4 = 0;
+
+    /* One period with RC4 on its latch leaves PWM7 at its period start, RC4 low, whatever
+     * the state it was enabled in. The first frame routes it to the pin. */
+    T6CONbits.T6ON = 1;
+
+    return ERR_OK;
+}
+
+extern void strobe_b_start( void )
+{
+    RC4PPS = STROBE_B_PPS_OUT_PWM7;
+    T6CONbits.T6ON = 1;
+}
+
+extern void strobe_b_report( uint8_t *buf )
+{
+    buf[0] = strobe_b_mode;
+    *(uint32_t *)&buf[1] = strobe_b_wait_ns;
+    *(uint32_t *)&buf[5] = strobe_b_duration_ns;
+}
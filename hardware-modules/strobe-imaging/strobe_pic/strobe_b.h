@@ -0,0 +1,38 @@
+#ifndef STROBE_B_H
+#define	STROBE_B_H
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/* Second strobe channel: PWM7 on TMR6 drives RC4, on pin 21 of the header. TMR6 runs one
+ * period per frame in one-shot mode, started from the same interrupt as the channel A wait.
+ * PWM7 with inverted polarity is low up to its duty cycle and high from there to the period
+ * match, so the duty cycle is the wait and the rest of the period the duration. The four
+ * CLCs of the PIC16F18856 all make channel A and the chained trigger, so there is no CLC
+ * left for a second TMR2/TMR4 style output.
+ */
+#define STROBE_B_OFF                    0
+#define STROBE_B_SIMULTANEOUS           1           // Both channels on every frame
+#define STROBE_B_ALTERNATE              2           // Channel A on one frame, B on the next
+#define STROBE_B_PRESCALE_MAX           7           // T6CON CKPS 1:128
+#define STROBE_B_MAX_TIME_NS            4096000UL   // Wait plus duration, 256 x 1:128 x 125 ns
+#define STROBE_B_REPORT_SIZE            9           // [mode U8][wait ns U32][duration ns U32]
+
+extern volatile uint8_t strobe_b_mode;
+extern volatile uint8_t strobe_b_phase;             // Alternate: 1 when the next frame is B's
+
+/* Strobe B Functions */
+extern err strobe_b_set( uint8_t mode, uint32_t wait_ns, uint32_t duration_ns );
+
+/* From the T1G gate interrupt, once TMR6 has stopped */
+extern void strobe_b_start( void );
+
+/* [mode U8][wait ns U32][duration ns U32], the times as made */
+extern void strobe_b_report( uint8_t *buf );
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* STROBE_B_H */
@@ -0,0 +1,261 @@
+#include "mcc_generated_files/mcc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "trig_test.h"
+
+/* PPS codes. PPS is never locked, pin_manager.c leaves PPSLOCKED clear. */
+#define TRIG_TEST_PPS_IN_RA0            0x00        // RA0 for xxxPPS inputs, not connected on strobe-pcb.sch
+#define TRIG_TEST_PPS_IN_RC7            0x17        // RC7, CLC3OUT (strobe output)
+#define TRIG_TEST_PPS_OUT_PWM6          0x0E        // RxyPPS PWM6OUT
+
+typedef struct
+{
+    uint16_t count;
+    uint16_t min;
+    uint16_t max;
+    uint32_t sum;
+} trig_test_stat_t;
+
+volatile uint8_t trig_test_state = TRIG_TEST_IDLE;
+uint16_t trig_test_entry_ticks;                     // TMR3 at strobe_gate_isr() entry
+
+uint16_t trig_test_period_us;
+uint16_t trig_test_edges_left;
+uint16_t trig_test_edges;                           // Edges measured
+uint16_t trig_test_dropped;                         // Edges hardware_trigger_strobe() did not fire on
+uint16_t trig_test_missed;                          // Fired, but no output rise was captured
+uint8_t trig_test_warmup;                           // First edge after the switch over, not measured
+uint16_t trig_test_prev_edge;
+uint8_t trig_test_prev_pending;                     // Previous edge fired and waits for its output rise
+trig_test_stat_t trig_test_isr;                     // Edge to strobe_gate_isr() entry
+trig_test_stat_t trig_test_output;                  // Edge to strobe output rise
+uint8_t trig_test_t1gpps;
+uint8_t trig_test_t2ainpps;
+uint8_t trig_test_clcin0pps;
+
+// Local Functions ---------------------------------------------------------
+
+void trig_test_stat_reset( trig_test_stat_t *stat )
+{
+    stat->count = 0;
+    stat->min = 0xFFFF;
+    stat->max = 0;
+    stat->sum = 0;
+}
+
+void trig_test_stat_add( trig_test_stat_t *stat, uint16_t ticks )
+{
+    if ( stat->count == 0xFFFF )
+        return;
+
+    stat->count++;
+    stat->sum += ticks;
+    if ( ticks < stat->min )
+        stat->min = ticks;
+    if ( ticks > stat->max )
+        stat->max = ticks;
+}
+
+uint8_t *trig_test_stat_report( uint8_t *buf, trig_test_stat_t *stat )
+{
+    /* [min U16][max U16][mean U16], all 0 before the first sample */
+    *(uint16_t *)&buf[0] = stat->count ? stat->min : 0;
+    *(uint16_t *)&buf[2] = stat->max;
+    *(uint16_t *)&buf[4] = stat->count ? (uint16_t)( stat->sum / stat->count ) : 0;
+
+    return &buf[6];
+}
+
+// Extern Functions --------------------------------------------------------
+
+extern err trig_test_start( uint16_t edges, uint16_t period_us )
+{
+    /* <period_us> is rounded to TRIG_TEST_PERIOD_STEP_US. The caller has set hardware trigger mode. */
+    uint16_t dc;
+    uint8_t pr6;
+
+    if ( trig_test_state != TRIG_TEST_IDLE )
+        return ERR_TRIG_TEST_BUSY;
+
+    if ( ( edges == 0 ) || ( period_us < TRIG_TEST_PERIOD_MIN_US ) || ( period_us > TRIG_TEST_PERIOD_MAX_US ) )
+        return ERR_PACKET_INVALID;
+
+    pr6 = (uint8_t)( ( ( period_us + ( TRIG_TEST_PERIOD_STEP_US / 2 ) ) / TRIG_TEST_PERIOD_STEP_US ) - 1 );
+    trig_test_period_us = ( (uint16_t)pr6 + 1 ) * TRIG_TEST_PERIOD_STEP_US;
+    trig_test_edges_left = edges;
+    trig_test_edges = 0;
+    trig_test_dropped = 0;
+    trig_test_missed = 0;
+    trig_test_warmup = 1;
+    trig_test_prev_pending = 0;
+    trig_test_stat_reset( &trig_test_isr );
+    trig_test_stat_reset( &trig_test_output );
+
+    /* TMR3 free runs on Fosc/4 1:1, 16-bit reads, the timebase of both captures */
+    T3CON = 0;
+    T3GCON = 0;
+    T3CLK = 0x01;                   // Fosc/4
+    TMR3H = 0;
+    TMR3L = 0;
+    T3CON = 0b00000011;             // ON; RD16; synchronised; 1:1
+
+    /* CCP1 captures the rising test edge, CCP2 the rising strobe output, both from TMR3 */
+    CCPTMRS0 = ( CCPTMRS0 & 0xF0 ) | 0b1010;   // C2TSEL TMR3; C1TSEL TMR3
+    CCP1PPS = TRIG_TEST_PPS_IN_RA0;
+    CCP2PPS = TRIG_TEST_PPS_IN_RC7;
+    CCP1CAP = 0;                    // CCP1PPS pin
+    CCP2CAP = 0;                    // CCP2PPS pin
+    CCP1CON = 0x85;                 // EN; capture every rising edge
+    CCP2CON = 0x85;
+    PIR6bits.CCP1IF = 0;
+    PIR6bits.CCP2IF = 0;
+
+    /* PWM6 on TMR6, Fosc/4 1:128 = 16us per count. High for half the period, so the
+     * T1G gate (active low) closes on the rising edge at the start of each period. */
+    T6CON = 0;
+    T6CLKCON = 0x01;                // Fosc/4
+    T6HLT = 0;                      // Free running, software gate
+    T6RST = 0;
+    PR6 = pr6;
+    TMR6 = 0;
+    dc = ( (uint16_t)pr6 + 1 ) * 2;
+    PWM6DCH = (uint8_t)( dc >> 2 );
+    PWM6DCL = (uint8_t)( ( dc & 0x03 ) << 6 );
+    CCPTMRS1 = ( CCPTMRS1 & 0xF3 ) | 0b1100;   // P6TSEL TMR6
+    PWM6CON = 0x80;                 // EN; active high
+
+    /* RA0 drives the edges and stands in for the camera on RC5, as T1G input, as the
+     * TMR2 reset input and as the CLC4 input of the chained trigger */
+    LATAbits.LATA0 = 1;
+    ANSELAbits.ANSA0 = 0;
+    TRISAbits.TRISA0 = 0;
+    RA0PPS = TRIG_TEST_PPS_OUT_PWM6;
+
+    INTERRUPT_GlobalInterruptDisable();
+    trig_test_t1gpps = T1GPPS;
+    trig_test_t2ainpps = T2AINPPS;
+    trig_test_clcin0pps = CLCIN0PPS;
+    T1GPPS = TRIG_TEST_PPS_IN_RA0;
+    T2AINPPS = TRIG_TEST_PPS_IN_RA0;
+    CLCIN0PPS = TRIG_TEST_PPS_IN_RA0;
+    trig_test_state = TRIG_TEST_RUNNING;
+    INTERRUPT_GlobalInterruptEnable();
+
+    T6CON = 0b11110000;             // ON; 1:128; 1:1
+
+    return ERR_OK;
+}
+
+extern void trig_test_stop( void )
+{
+    /* Ends a running test early, trig_test_poll() then gives the pins back */
+    INTERRUPT_GlobalInterruptDisable();
+    if ( trig_test_state == TRIG_TEST_RUNNING )
+        trig_test_state = TRIG_TEST_DONE;
+    INTERRUPT_GlobalInterruptEnable();
+}
+
+extern uint8_t trig_test_poll( void )
+{
+    /* From the main loop. Returns 1 once, when a finished test has given the T1G input back
+     * to the camera, so the caller can restore its trigger mode. */
+    if ( trig_test_state != TRIG_TEST_DONE )
+        return 0;
+
+    PWM6CON = 0;
+    T6CON = 0;
+
+    INTERRUPT_GlobalInterruptDisable();
+    T1GPPS = trig_test_t1gpps;
+    T2AINPPS = trig_test_t2ainpps;
+    CLCIN0PPS = trig_test_clcin0pps;
+    trig_test_state = TRIG_TEST_IDLE;
+    INTERRUPT_GlobalInterruptEnable();
+
+    RA0PPS = 0;
+    TRISAbits.TRISA0 = 1;
+    ANSELAbits.ANSA0 = 1;
+    CCP1CON = 0;
+    CCP2CON = 0;
+    T3CON = 0;
+
+    return 1;
+}
+
+extern void trig_test_gate( uint8_t fired )
+{
+    /* CCP1 holds this edge and CCP2 the last output rise. The rise of the previous edge
+     * comes before this edge, unless the strobe was still running and this edge dropped. */
+    uint16_t edge;
+    uint16_t output;
+    uint8_t fired_output = 0;
+
+    if ( trig_test_state != TRIG_TEST_RUNNING )
+        return;
+
+    edge = CCPR1L;
+    edge |= (uint16_t)CCPR1H << 8;
+    PIR6bits.CCP1IF = 0;
+
+    if ( PIR6bits.CCP2IF )
+    {
+        output = CCPR2L;
+        output |= (uint16_t)CCPR2H << 8;
+        PIR6bits.CCP2IF = 0;
+
+        if ( (uint16_t)( output - edge ) < 0x8000 )
+        {
+            /* Rose after this edge, a wait shorter than this interrupt. It overwrote the
+             * previous edge's rise. */
+            if ( trig_test_prev_pending )
+                trig_test_missed++;
+            if ( fired && !trig_test_warmup && trig_test_edges_left )
+            {
+                trig_test_stat_add( &trig_test_output, output - edge );
+                fired_output = 1;
+            }
+        }
+        else if ( trig_test_prev_pending )
+            trig_test_stat_add( &trig_test_output, output - trig_test_prev_edge );
+    }
+    else if ( trig_test_prev_pending )
+        trig_test_missed++;
+
+    trig_test_prev_pending = 0;
+    if ( trig_test_warmup )
+    {
+        /* The gate was armed on the camera input at the switch over */
+        trig_test_warmup = 0;
+        return;
+    }
+
+    /* One edge past the last, to collect its output rise */
+    if ( trig_test_edges_left == 0 )
+    {
+        trig_test_state = TRIG_TEST_DONE;
+        return;
+    }
+    trig_test_edges_left--;
+
+    trig_test_edges++;
+    trig_test_stat_add( &trig_test_isr, trig_test_entry_ticks - edge );
+    if ( !fired )
+        trig_test_dropped++;
+    trig_test_prev_edge = edge;
+    trig_test_prev_pending = fired && !fired_output;
+}
+
+extern void trig_test_report( uint8_t *buf )
+{
+    /* Called with interrupts off */
+    buf[0] = trig_test_state;
+    *(uint16_t *)&buf[1] = trig_test_period_us;
+    *(uint16_t *)&buf[3] = trig_test_edges;
+    *(uint16_t *)&buf[5] = trig_test_dropped;
+    *(uint16_t *)&buf[7] = trig_test_missed;
+    buf = trig_test_stat_report( &buf[9], &trig_test_isr );
+    *(uint16_t *)&buf[0] = trig_test_output.count;
+    trig_test_stat_report( &buf[2], &trig_test_output );
+}
@@ -0,0 +1,45 @@
+#ifndef TRIG_TEST_H
+#define	TRIG_TEST_H
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/* Trigger path self-test: PWM6 makes camera-like edges on RA0, which stands in for the
+ * T1G pin, and TMR3 timestamps each edge (CCP1), the entry of strobe_gate_isr() and the
+ * rise of the strobe output on RC7 (CCP2), in Fosc/4 instruction cycles.
+ */
+#define TRIG_TEST_TICK_NS               125         // TMR3 on Fosc/4, 32 MHz
+#define TRIG_TEST_PERIOD_STEP_US        16          // PWM6 period unit, TMR6 on Fosc/4 1:128
+#define TRIG_TEST_PERIOD_MIN_US         32
+#define TRIG_TEST_PERIOD_MAX_US         4096        // Under half the TMR3 span, so captures pair up
+#define TRIG_TEST_REPORT_SIZE           23
+
+#define TRIG_TEST_IDLE                  0
+#define TRIG_TEST_RUNNING               1
+#define TRIG_TEST_DONE                  2           // Edges done, pins not yet given back to the camera
+
+extern volatile uint8_t trig_test_state;
+extern uint16_t trig_test_entry_ticks;
+
+/* First thing in strobe_gate_isr(), so the entry time is not taken after the trigger */
+#define TRIG_TEST_GATE_ENTRY()          do { if ( trig_test_state == TRIG_TEST_RUNNING ) { trig_test_entry_ticks = TMR3L; trig_test_entry_ticks |= (uint16_t)TMR3H << 8; } } while ( 0 )
+
+/* Test Functions */
+extern err trig_test_start( uint16_t edges, uint16_t period_us );
+extern void trig_test_stop( void );
+extern uint8_t trig_test_poll( void );
+
+/* Called from strobe_gate_isr() while trig_test_state is not TRIG_TEST_IDLE, <fired> if
+ * hardware_trigger_strobe() started the strobe for this edge */
+extern void trig_test_gate( uint8_t fired );
+
+/* Writes [state U8][period_us U16][edges U16][dropped U16][missed U16]
+ * [isr min U16][isr max U16][isr mean U16][outputs U16][output min U16][output max U16][output mean U16] */
+extern void trig_test_report( uint8_t *buf );
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* TRIG_TEST_H */
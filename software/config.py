@@ -86,6 +86,31 @@ SPI_SPEED_HZ = 30000
 
 # Background Thread Configuration
 BACKGROUND_UPDATE_INTERVAL_S = 1.0  # Update interval for background thread
+# Module status polls (controllers/adaptive_poller.py): every POLL_FAST_S after a command
+# and while readings move, backing off by POLL_BACKOFF per settled poll to POLL_SLOW_S
+POLL_FAST_S = float(os.getenv("RIO_POLL_FAST_S", "0.25"))
+POLL_SLOW_S = float(os.getenv("RIO_POLL_SLOW_S", "4.0"))
+POLL_HOLD_S = 2.0  # Fast polls kept after a command, while the module starts to respond
+POLL_BACKOFF = 2.0
+# Socket.IO state pushes per second at most, coalesced and delta only
+# (rio-webapp/controllers/push_hub.py); RIO_PUSH_RATE_HZ=0 pushes every update at once
+PUSH_RATE_HZ = float(os.getenv("RIO_PUSH_RATE_HZ", "5"))
+# Shared memory name of the latest device states (controllers/state_table.py)
+STATE_TABLE_NAME = os.getenv("RIO_STATE_SHM", "rio_state")
+
+# Droplet detection worker processes (droplet-detection/pipeline.py); 0 detects in the
+# controller's thread
+DROPLET_WORKERS = int(os.getenv("RIO_DROPLET_WORKERS", "0"))
+# Read the strobe event of every frame, for trigger stamps on the droplet latency
+# (GET /api/droplet/latency); costs a strobe SPI read every few frames
+DROPLET_LATENCY_TAGS = os.getenv("RIO_DROPLET_LATENCY_TAGS", "false").strip().lower() == "true"
+# Closed-loop droplet size control (controllers/droplet_size_control.py): flow channels of
+# the dispersed and continuous phase, and seconds the droplets take to settle after a ratio
+# change, on top of the measured trigger to action latency
+DROPLET_SIZE_CHANNELS = tuple(
+    int(c) for c in os.getenv("RIO_DROPLET_SIZE_CHANNELS", "0,1").split(",")
+)
+DROPLET_SIZE_SETTLE_S = float(os.getenv("RIO_DROPLET_SIZE_SETTLE_S", "2.0"))
 
 # ROI Configuration
 ROI_MIN_SIZE_PX = 10  # Minimum ROI size in pixels
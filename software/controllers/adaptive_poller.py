@@ -0,0 +1,64 @@
+"""
+Status poll timing that follows setpoint activity.
+
+Where the firmware cannot stream its status, the background loop polls each module.
+An AdaptivePoller per module polls it every POLL_FAST_S after a command (a setpoint,
+an autotune, a ramp) and while its readings move, and doubles the interval each time
+they come back settled, up to POLL_SLOW_S. A module left alone then costs one status
+poll every few seconds, and one just commanded is followed closely.
+
+Times are spi_handler.clock seconds, so the poll rate follows the simulated clock.
+"""
+
+from typing import Optional
+
+from drivers import spi_handler
+from config import POLL_BACKOFF, POLL_FAST_S, POLL_HOLD_S, POLL_SLOW_S
+
+
+class AdaptivePoller:
+    """When a module's status is next due, from its recent activity."""
+
+    def __init__(
+        self,
+        fast_s: float = POLL_FAST_S,
+        slow_s: float = POLL_SLOW_S,
+        hold_s: float = POLL_HOLD_S,
+        backoff: float = POLL_BACKOFF,
+    ):
+        """
+        Args:
+            fast_s: Poll interval while active
+            slow_s: Longest poll interval once settled
+            hold_s: Seconds kept at fast_s after kick(), even if the readings look settled
+            backoff: Interval factor per settled poll
+        """
+        self.fast_s = fast_s
+        self.slow_s = max(slow_s, fast_s)
+        self.hold_s = hold_s
+        self.backoff = backoff
+        self.interval_s = fast_s
+        self.next_s = 0.0  # Due at once
+        self.hold_until_s = 0.0
+        self.polls = 0
+
+    def kick(self) -> None:
+        """A command changed the module: poll now, then fast for hold_s."""
+        now = spi_handler.clock.monotonic()
+        self.interval_s = self.fast_s
+        self.next_s = now
+        self.hold_until_s = now + self.hold_s
+
+    def due(self, now: Optional[float] = None) -> bool:
+        """True if the module should be polled <now> (default the clock's now)."""
+        return (spi_handler.clock.monotonic() if now is None else now) >= self.next_s
+
+    def polled(self, settled: bool) -> None:
+        """The module was just polled; back off if its readings <settled>, else poll fast."""
+        now = spi_handler.clock.monotonic()
+        if settled and now >= self.hold_until_s:
+            self.interval_s = min(self.interval_s * self.backoff, self.slow_s)
+        else:
+            self.interval_s = self.fast_s
+        self.next_s = now + self.interval_s
+        self.polls += 1
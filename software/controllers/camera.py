@@ -16,7 +16,7 @@ from typing import Optional, Dict, Any, Tuple
 from datetime import datetime
 from PIL import Image
 
-from drivers.spi_handler import PORT_STROBE
+from drivers.spi_handler import PORT_STROBE, host_time_us
 from controllers.strobe_cam import PiStrobeCam
 from config import (
     CAMERA_THREAD_WIDTH,
@@ -606,9 +606,18 @@ class Camera:
                 self.roi["height"],
             )
             roi_frame = self.strobe_cam.get_frame_roi(roi)
+            arrival_us = host_time_us()  # Start of the pipeline latency after the trigger
             if roi_frame is not None:
-                # Add frame to droplet detector processing queue
-                self.droplet_controller.add_frame(roi_frame)
+                # Add frame to droplet detector processing queue, numbered by its trigger
+                # pulse in hardware trigger mode so flow samples can be joined to it
+                frame_index = (
+                    self.strobe_cam.trigger_count if self.strobe_cam.hardware_trigger_mode else None
+                )
+                # Its strobe event, only read from the PIC when the detector uses it
+                tag = None
+                if self.droplet_controller.uses_frame_tags():
+                    tag = self.strobe_cam.frame_tag(frame_index)
+                self.droplet_controller.add_frame(roi_frame, frame_index, tag, arrival_us)
         except Exception as e:
             # Don't break camera thread if droplet detection fails
             logger.debug(f"Error feeding frame to droplet detector: {e}")
@@ -968,10 +977,15 @@ class Camera:
 
         # Decide ROI mode
         active_mode = ROI_MODE_SOFTWARE
+        strobe_cam = getattr(self, "strobe_cam", None)
         if self.roi_mode_config == ROI_MODE_HARDWARE and self.camera:
             if hasattr(self.camera, "set_roi_hardware"):
                 try:
-                    success = bool(self.camera.set_roi_hardware(roi_tuple))
+                    # Through the strobe camera, so that framerate and strobe follow the readout
+                    if strobe_cam is not None:
+                        success = strobe_cam.set_sensor_roi(roi_tuple)
+                    else:
+                        success = bool(self.camera.set_roi_hardware(roi_tuple))
                     if success:
                         active_mode = ROI_MODE_HARDWARE
                     else:
@@ -1030,7 +1044,10 @@ class Camera:
 
         self.roi = None
         self.roi_mode_active = ROI_MODE_SOFTWARE
-        if self.camera and hasattr(self.camera, "set_roi_hardware"):
+        strobe_cam = getattr(self, "strobe_cam", None)
+        if strobe_cam is not None and strobe_cam.sensor_roi is not None:
+            strobe_cam.set_sensor_roi(None)
+        elif self.camera and hasattr(self.camera, "set_roi_hardware"):
             try:
                 max_width, max_height = 0, 0
                 if hasattr(self.camera, "get_max_resolution"):
@@ -9,7 +9,8 @@ import logging
 import threading
 import time
 import queue
-from typing import Optional, Dict, Any, List, cast
+from collections import OrderedDict, deque
+from typing import Optional, Dict, Any, List, Tuple, cast
 import numpy as np
 
 import sys
@@ -30,6 +31,7 @@ if os.path.exists(droplet_detection_path):
     spec.loader.exec_module(droplet_detection)
 
     DropletDetector = droplet_detection.DropletDetector
+    DetectionPipeline = droplet_detection.DetectionPipeline
     DropletDetectionConfig = droplet_detection.DropletDetectionConfig
     DropletHistogram = droplet_detection.DropletHistogram
     load_config = droplet_detection.load_config
@@ -38,6 +40,7 @@ else:
     # Fallback: try direct import (if directory was renamed)
     from droplet_detection import (  # noqa: E402
         DropletDetector,
+        DetectionPipeline,
         DropletDetectionConfig,
         DropletHistogram,
         load_config,
@@ -45,6 +48,8 @@ else:
     )
 from controllers.camera import Camera  # noqa: E402
 from controllers.strobe_cam import PiStrobeCam  # noqa: E402
+from drivers import spi_handler  # noqa: E402
+from config import DROPLET_LATENCY_TAGS, DROPLET_WORKERS  # noqa: E402
 
 logger = logging.getLogger(__name__)
 
@@ -141,6 +146,126 @@ class TimingInstrumentation:
                 self.timings[component].clear()
 
 
+class LatencyTracker:
+    """
+    Latency of the live pipeline, from the strobe trigger to the action taken on a result.
+
+    Stamps are on spi_handler.host_time_us(), the clock the strobe event FIFO is
+    synchronized to:
+    - trigger: FrameTag.time_us of the frame, when it was tagged
+    - arrival: the frame handed over by the camera driver (add_frame())
+    - result: its metrics in the histogram and statistics
+    - action: a flow setpoint or other action taken on the result (mark_action())
+    """
+
+    INTERVALS = (
+        "trigger_to_arrival",
+        "arrival_to_result",
+        "result_to_action",
+        "trigger_to_result",
+        "trigger_to_action",
+    )
+
+    def __init__(self, max_samples: int = 1000):
+        """
+        Initialize latency tracking.
+
+        Args:
+            max_samples: Samples kept per interval, and results kept awaiting an action
+        """
+        self.max_samples = max_samples
+        self.samples: Dict[str, deque] = {
+            name: deque(maxlen=max_samples) for name in self.INTERVALS
+        }
+        # frame -> (trigger_us, result_us) of the latest results, for mark_action()
+        self.results: "OrderedDict[Any, Tuple[Optional[int], int]]" = OrderedDict()
+        self.last_frame: Any = None
+        self.lock = threading.Lock()
+
+    def _add(self, name: str, later_us: int, earlier_us: Optional[int]) -> None:
+        if earlier_us is not None:
+            self.samples[name].append(spi_handler.time_diff_us(later_us, earlier_us) / 1000.0)
+
+    def result(
+        self,
+        frame: Any,
+        trigger_us: Optional[int],
+        arrival_us: int,
+        result_us: Optional[int] = None,
+    ) -> None:
+        """Record the result of <frame>, now unless <result_us> is given."""
+        if result_us is None:
+            result_us = spi_handler.host_time_us()
+        with self.lock:
+            self._add("trigger_to_arrival", arrival_us, trigger_us)
+            self._add("arrival_to_result", result_us, arrival_us)
+            self._add("trigger_to_result", result_us, trigger_us)
+            self.results[frame] = (trigger_us, result_us)
+            self.results.move_to_end(frame)
+            while len(self.results) > self.max_samples:
+                self.results.popitem(last=False)
+            self.last_frame = frame
+
+    def action(self, frame: Any = None, action_us: Optional[int] = None) -> bool:
+        """
+        Record an action taken on the result of <frame>, the latest result if None.
+
+        Returns:
+            False if the result is not known (never recorded, or too old)
+        """
+        if action_us is None:
+            action_us = spi_handler.host_time_us()
+        with self.lock:
+            if frame is None:
+                frame = self.last_frame
+            if frame not in self.results:
+                return False
+            trigger_us, result_us = self.results[frame]
+            self._add("result_to_action", action_us, result_us)
+            self._add("trigger_to_action", action_us, trigger_us)
+            return True
+
+    def get_statistics(self) -> Dict[str, Dict[str, float]]:
+        """
+        Get latency percentiles for each interval, in ms.
+
+        Returns:
+            Dictionary of interval statistics (mean, p50, p90, p99, max, count)
+        """
+        stats = {}
+        with self.lock:
+            for name, samples in self.samples.items():
+                if samples:
+                    values = np.array(samples)
+                    p50, p90, p99 = np.percentile(values, [50, 90, 99])
+                    stats[name] = {
+                        "mean": float(np.mean(values)),
+                        "p50": float(p50),
+                        "p90": float(p90),
+                        "p99": float(p99),
+                        "max": float(np.max(values)),
+                        "count": len(samples),
+                    }
+                else:
+                    stats[name] = {
+                        "mean": 0.0,
+                        "p50": 0.0,
+                        "p90": 0.0,
+                        "p99": 0.0,
+                        "max": 0.0,
+                        "count": 0,
+                    }
+        return stats
+
+    def reset(self) -> None:
+        """Reset all latency data."""
+        with self.lock:
+            for samples in self.samples.values():
+                samples.clear()
+            self.results.clear()
+            self.last_frame = None
+
+
 class DropletDetectorController:
     """
     Controller for droplet detection system.
@@ -155,6 +280,7 @@ class DropletDetectorController:
         strobe_cam: PiStrobeCam,
         config: Optional[DropletDetectionConfig] = None,
         config_path: Optional[str] = None,
+        workers: Optional[int] = None,
     ):
         """
         Initialize droplet detector controller.
@@ -164,6 +290,8 @@ class DropletDetectorController:
             strobe_cam: PiStrobeCam instance for ROI frame access
             config: Optional DropletDetectionConfig (uses default if None)
             config_path: Optional path to load configuration from JSON file
+            workers: Detection worker processes, default DROPLET_WORKERS; 0 to detect in
+                the processing thread
         """
         self.camera = camera
         self.strobe_cam = strobe_cam
@@ -178,6 +306,11 @@ class DropletDetectorController:
         # Initialize detector (will be set when ROI is available)
         self.detector: Optional[DropletDetector] = None
 
+        # Worker processes fed from add_frame() through a shared-memory ring, if any
+        self.workers = DROPLET_WORKERS if workers is None else workers
+        self.pipeline: Optional[Any] = None
+        self.pipeline_lock = threading.Lock()
+
         # Get calibration from camera (camera-specific) or fallback to config
         camera_calibration = camera.get_calibration() if hasattr(camera, "get_calibration") else {}
         um_per_px = camera_calibration.get(
@@ -209,6 +342,14 @@ class DropletDetectorController:
 
         # Timing instrumentation
         self.timing = TimingInstrumentation(max_samples=1000)
+        # Trigger to action latency; trigger stamps need the strobe events read per frame
+        self.latency = LatencyTracker(max_samples=1000)
+        self.latency_tags = DROPLET_LATENCY_TAGS
+        # Called with (frame, metrics) of each result, in the processing thread; frame as
+        # taken by mark_action()
+        self.result_listeners: List[Any] = []
+        # DropletSizeController steering the flows on the results, set by main.py
+        self.size_control: Optional[Any] = None
 
         # Statistics
         self.frame_count = 0
@@ -226,6 +367,13 @@ class DropletDetectorController:
         self.raw_measurements: List[Dict[str, Any]] = []
         self.max_raw_measurements = 10000  # Limit storage to prevent memory issues
 
+        # Frame synchronized flow samples (PiFlow.read_telemetry() with set_frame_sync()),
+        # keyed by frame number and joined to the measurements of that frame on export
+        self.frame_index: Optional[int] = None  # Trigger number of the frame being processed
+        self.flow_samples: "OrderedDict[int, Dict[str, Any]]" = OrderedDict()
+        self.max_flow_samples = 4096
+        self.flow_samples_lock = threading.Lock()
+
     def start(self) -> bool:
         """
         Start droplet detection processing.
@@ -273,6 +421,7 @@ class DropletDetectorController:
 
         # Create detector with current calibration (including radius offset)
         self.detector = DropletDetector(roi, self.config, radius_offset_px=self.radius_offset_px)
+        self._restart_pipeline(roi, self.radius_offset_px)
 
         # Start processing thread
         self.running = True
@@ -297,6 +446,11 @@ class DropletDetectorController:
         if self.processing_thread and self.processing_thread.is_alive():
             self.processing_thread.join(timeout=5.0)
 
+        with self.pipeline_lock:
+            if self.pipeline is not None:
+                self.pipeline.close()
+                self.pipeline = None
+
         # Clear queue
         while not self.frame_queue.empty():
             try:
@@ -306,6 +460,51 @@ class DropletDetectorController:
 
         logger.info("Droplet detection stopped")
 
+    def _restart_pipeline(self, roi: Tuple[int, int, int, int], radius_offset_px: float) -> None:
+        """Start new workers on the current config, after stopping those running."""
+        if self.workers <= 0:
+            return
+        pipeline = DetectionPipeline(
+            roi, self.config, radius_offset_px=radius_offset_px, workers=self.workers
+        )
+        with self.pipeline_lock:
+            old, self.pipeline = self.pipeline, pipeline
+        if old is not None:
+            old.close()
+
+    def _collect_pipeline_results(self) -> bool:
+        """
+        Account the frames the workers have finished, in order.
+
+        Returns:
+            False if none had finished
+        """
+        with self.pipeline_lock:
+            if self.pipeline is None:
+                return False
+            ready = self.pipeline.results()
+        timing_callback = self._create_timing_callback()
+        for (frame_index, trigger_us, arrival_us), metrics, timings in ready:
+            for component, elapsed_ms in timings.items():
+                timing_callback(component, elapsed_ms)
+            timing_callback("total_per_frame", sum(timings.values()))
+            self.frame_index = frame_index
+            self._update_frame_statistics(metrics)
+            self._finish_result(metrics, trigger_us, arrival_us)
+        return bool(ready)
+
+    def _finish_result(
+        self, metrics: List[Any], trigger_us: Optional[int], arrival_us: int
+    ) -> None:
+        """Record the latency of the frame just accounted and hand it to result_listeners."""
+        frame = self.frame_count if self.frame_index is None else self.frame_index
+        self.latency.result(frame, trigger_us, arrival_us)
+        for listener in self.result_listeners:
+            try:
+                listener(frame, metrics)
+            except Exception as e:
+                logger.error(f"Result listener error: {e}", exc_info=True)
+
     def _create_timing_callback(self):
         """Create timing callback for frame processing instrumentation."""
 
@@ -402,12 +601,14 @@ class DropletDetectorController:
                 f"~{fps:.1f} FPS (current rate: {self.processing_rate_hz:.2f} Hz)"
             )
 
-    def _get_next_frame(self) -> Optional[np.ndarray]:
+    def _get_next_frame(
+        self,
+    ) -> Optional[Tuple[np.ndarray, Optional[int], Optional[Any], int]]:
         """
         Get next frame from queue, handling pull-based processing.
 
         Returns:
-            Next frame to process, or None if no frame available
+            (frame, frame_index, tag, arrival_us) to process, or None if no frame available
         """
         if self.processing_busy:
             # Pull-based: clear queue and get only latest frame
@@ -477,18 +678,31 @@ class DropletDetectorController:
 
         while self.running and not self.exit_event.is_set():
             try:
+                if self.pipeline is not None:
+                    # The workers process the frames add_frame() put in the ring
+                    if not self._collect_pipeline_results():
+                        time.sleep(0.005)
+                    continue
+
                 # Get next frame
-                frame = self._get_next_frame()
-                if frame is None:
+                item = self._get_next_frame()
+                if item is None:
                     # No frames available, wait briefly
                     time.sleep(0.01)
                     continue
+                frame, self.frame_index, tag, arrival_us = item
+
+                # Frames the strobe did not light are skipped before they count as processed
+                if tag is not None and self.detector is not None:
+                    if not self.detector.apply_tag(tag):
+                        continue
 
                 # Process frame
                 metrics = self._process_single_frame(frame)
 
                 # Update statistics
                 self._update_frame_statistics(metrics)
+                self._finish_result(metrics, tag.time_us if tag is not None else None, arrival_us)
 
                 # Log periodically
                 self._log_periodic_stats(frame_start_time)
@@ -499,7 +713,22 @@ class DropletDetectorController:
 
         logger.info("Processing loop stopped")
 
-    def add_frame(self, frame: np.ndarray) -> bool:
+    def uses_frame_tags(self) -> bool:
+        """
+        True if add_frame() should be given FrameTags: for strobe gating or exposure, or
+        for the trigger stamps of the latency (latency_tags).
+        """
+        return bool(
+            self.config.strobe_gating or self.config.reference_strobe_ns > 0 or self.latency_tags
+        )
+
+    def add_frame(
+        self,
+        frame: np.ndarray,
+        frame_index: Optional[int] = None,
+        tag: Optional[Any] = None,
+        arrival_us: Optional[int] = None,
+    ) -> bool:
         """
         Add frame to processing queue.
 
@@ -507,6 +736,13 @@ class DropletDetectorController:
 
         Args:
             frame: ROI frame (RGB numpy array)
+            frame_index: Trigger number of the frame (PiStrobeCam.trigger_count), or None.
+                Used as the frame_id of its measurements and to join flow samples.
+            tag: FrameTag of the frame (PiStrobeCam.frame_tag()), or None. Frames tagged
+                as not strobed are skipped with strobe_gating, and the tagged strobe
+                period scales the thresholds, see DropletDetector.apply_tag().
+            arrival_us: spi_handler.host_time_us() when the camera driver returned the
+                frame, default now. The start of its latency, or the trigger if tagged.
 
         Returns:
             True if frame was added, False if queue is full or invalid
@@ -523,14 +759,41 @@ class DropletDetectorController:
             logger.warning(f"Invalid frame shape: {frame.shape}")
             return False
 
+        if arrival_us is None:
+            arrival_us = spi_handler.host_time_us()
+
+        with self.pipeline_lock:
+            if self.pipeline is not None:
+                # Straight into the ring; unstrobed frames are not even copied
+                if tag is not None and self.detector is not None:
+                    if not self.detector.apply_tag(tag):
+                        return False
+                trigger_us = tag.time_us if tag is not None else None
+                return bool(self.pipeline.submit(frame, (frame_index, trigger_us, arrival_us), tag))
+
         try:
-            self.frame_queue.put_nowait(frame)
+            self.frame_queue.put_nowait((frame, frame_index, tag, arrival_us))
             return True
         except queue.Full:
             # Queue full - drop frame (prevent memory buildup)
             logger.debug("Frame queue full, dropping frame")
             return False
 
+    def add_flow_samples(self, samples: List[Dict[str, Any]]) -> None:
+        """
+        Keep frame synchronized pressure/flow samples for joining to frames by index.
+
+        Args:
+            samples: PiFlow.read_telemetry() samples. Those with frame 0 were taken on
+                the firmware timer rather than a frame and are ignored.
+        """
+        with self.flow_samples_lock:
+            for sample in samples:
+                if sample.get("frame"):
+                    self.flow_samples[sample["frame"]] = sample
+            while len(self.flow_samples) > self.max_flow_samples:
+                self.flow_samples.popitem(last=False)
+
     def initialize_background(self, frames: List[np.ndarray]) -> None:
         """
         Initialize background model with multiple frames.
@@ -564,12 +827,39 @@ class DropletDetectorController:
         stats = self.histogram.get_statistics()
         stats["frame_count"] = self.frame_count
         stats["droplet_count_total"] = self.droplet_count_total
+        stats["unstrobed_skipped"] = self.detector.unstrobed_skipped if self.detector else 0
         stats["processing_rate_hz"] = round(
             self.processing_rate_hz, 2
         )  # Current processing rate in Hz
 
         return cast(Dict[str, Any], stats)
 
+    def mark_action(
+        self, frame_index: Optional[int] = None, action_us: Optional[int] = None
+    ) -> bool:
+        """
+        Record an action taken on a result (a flow setpoint change, say), for the latency.
+
+        Args:
+            frame_index: Frame whose result it acted on (frame_id of its measurements),
+                None for the latest result
+            action_us: When it takes effect on spi_handler.host_time_us() (a staged
+                setpoint's apply time), None for now
+
+        Returns:
+            False if that result is not known
+        """
+        return self.latency.action(frame_index, action_us)
+
+    def get_latency_metrics(self) -> Dict[str, Any]:
+        """
+        Get live pipeline latency percentiles (trigger, arrival, result, action).
+
+        Returns:
+            Dictionary with statistics in ms for each LatencyTracker interval
+        """
+        return self.latency.get_statistics()
+
     def get_performance_metrics(self) -> Dict[str, Any]:
         """
         Get performance timing metrics.
@@ -643,6 +933,7 @@ class DropletDetectorController:
                     self.detector = DropletDetector(
                         roi, self.config, radius_offset_px=self.radius_offset_px
                     )
+                    self._restart_pipeline(roi, self.radius_offset_px)
                     logger.info("Detector recreated with updated configuration")
 
             return True
@@ -693,6 +984,7 @@ class DropletDetectorController:
                     self.detector = DropletDetector(
                         roi, self.config, radius_offset_px=radius_offset_px
                     )
+                    self._restart_pipeline(roi, radius_offset_px)
                     logger.info(f"Profile loaded: {profile_path}")
 
             return True
@@ -727,8 +1019,11 @@ class DropletDetectorController:
         """Reset detector state and statistics."""
         if self.detector:
             self.detector.reset()
+            if self.pipeline is not None:
+                self._restart_pipeline(self.detector.roi, self.radius_offset_px)
         self.histogram.clear()
         self.timing.reset()
+        self.latency.reset()
         self.frame_count = 0
         self.droplet_count_total = 0
         self.last_update_time = time.time()
@@ -740,6 +1035,8 @@ class DropletDetectorController:
 
         # Clear raw measurements
         self.raw_measurements.clear()
+        with self.flow_samples_lock:
+            self.flow_samples.clear()
 
         logger.info("Detector reset")
 
@@ -754,7 +1051,7 @@ class DropletDetectorController:
             return
 
         timestamp_ms = int(time.time() * 1000)  # Milliseconds since epoch
-        frame_id = self.frame_count
+        frame_id = self.frame_count if self.frame_index is None else self.frame_index
 
         for metric in metrics:
             # Calculate radius from equivalent diameter
@@ -777,6 +1074,7 @@ class DropletDetectorController:
                 "major_axis_um": round(metric.major_axis * self.um_per_px, 2),
                 "equivalent_diameter_px": round(metric.equivalent_diameter, 2),
                 "equivalent_diameter_um": round(metric.equivalent_diameter * self.um_per_px, 2),
+                "frame_synced": self.frame_index is not None,
             }
 
             self.raw_measurements.append(measurement)
@@ -819,13 +1117,14 @@ class DropletDetectorController:
             "equivalent_diameter_px",
             "equivalent_diameter_um",
         ]
+        measurements = self._join_flow_samples(headers)
 
         if format_type.lower() == "csv":
             # CSV format
             writer = csv.writer(output)
             writer.writerow(headers)
 
-            for measurement in self.raw_measurements:
+            for measurement in measurements:
                 row = [measurement.get(header, "") for header in headers]
                 writer.writerow(row)
 
@@ -833,7 +1132,7 @@ class DropletDetectorController:
             # Tab-separated text format
             output.write("\t".join(headers) + "\n")
 
-            for measurement in self.raw_measurements:
+            for measurement in measurements:
                 row = [str(measurement.get(header, "")) for header in headers]
                 output.write("\t".join(row) + "\n")
 
@@ -841,3 +1140,37 @@ class DropletDetectorController:
             raise ValueError(f"Unsupported format: {format_type}. Use 'csv' or 'txt'")
 
         return output.getvalue()
+
+    def _join_flow_samples(self, headers: List[str]) -> List[Dict[str, Any]]:
+        """
+        Add the pressure and flow sampled on each measurement's frame, matched by frame
+        number. Adds the columns to headers only when some measurement has a sample.
+        """
+        with self.flow_samples_lock:
+            if not self.flow_samples:
+                return self.raw_measurements
+            flow_samples = dict(self.flow_samples)
+
+        measurements = []
+        channels = 0
+        for measurement in self.raw_measurements:
+            sample = None
+            if measurement.get("frame_synced"):
+                sample = flow_samples.get(measurement["frame_id"])
+            if sample is None:
+                measurements.append(measurement)
+                continue
+            joined = dict(measurement)
+            joined["flow_time_us"] = sample["time_us"]
+            for channel, pressure in enumerate(sample["pressure_actual"]):
+                joined[f"pressure_mbar_{channel}"] = pressure
+            for channel, flow in enumerate(sample["flow_actual"]):
+                joined[f"flow_ul_hr_{channel}"] = flow
+            channels = max(channels, len(sample["flow_actual"]))
+            measurements.append(joined)
+
+        if channels:
+            headers.append("flow_time_us")
+            headers.extend(f"pressure_mbar_{channel}" for channel in range(channels))
+            headers.extend(f"flow_ul_hr_{channel}" for channel in range(channels))
+        return measurements
@@ -0,0 +1,283 @@
+"""
+Closed-loop droplet size control.
+
+Takes the droplets the DropletDetectorController measures and steers the ratio of the
+dispersed to the continuous phase flow towards a target diameter: at the same total flow,
+a larger ratio makes larger droplets. Both channels must run in a flow closed loop mode,
+so the firmware holds each flow at its setpoint and this loop only moves the setpoints.
+
+Changes are rate limited to the loop's own latency. After a change, results are ignored
+for settle_s plus the p90 trigger to action latency of the live pipeline (LatencyTracker),
+so the next change is taken only on droplets made at the new ratio, however slow the
+camera, the detection or the flow board happen to be.
+
+Both setpoints go in one SET_FLOW_TARGET packet. Where the flow firmware has STAGE, it is
+staged with spi_handler.stage_together() after sync_time(), so the change takes effect at
+a known time on the synchronized clock; that time is the action given to mark_action().
+"""
+
+import logging
+import math
+import statistics
+import threading
+from typing import Any, Dict, List, Optional, Tuple
+
+from drivers import spi_handler
+from drivers.spi_scheduler import PRIORITY_CONTROL
+from config import DROPLET_SIZE_CHANNELS, DROPLET_SIZE_SETTLE_S
+
+logger = logging.getLogger(__name__)
+
+
+class DropletSizeController:
+    """Steers the dispersed/continuous flow ratio to a target droplet diameter."""
+
+    # Firmware control modes that hold a flow setpoint, see flow_control_modes.py
+    FLOW_CLOSED_LOOP_MODES = (3, 4)
+    # Latency intervals the holdoff is taken from, the first with samples
+    LATENCY_INTERVALS = ("trigger_to_action", "trigger_to_result", "arrival_to_result")
+
+    def __init__(
+        self,
+        droplet_controller: Any,
+        flow_web: Any,
+        dispersed_index: int = DROPLET_SIZE_CHANNELS[0],
+        continuous_index: int = DROPLET_SIZE_CHANNELS[1],
+        scheduler: Optional[Any] = None,
+        settle_s: float = DROPLET_SIZE_SETTLE_S,
+        gain: float = 0.5,
+        max_step: float = 0.2,
+        deadband: float = 0.02,
+        min_droplets: int = 20,
+        min_window_s: float = 0.5,
+        min_frequency_hz: float = 1.0,
+        ratio_limits: Tuple[float, float] = (0.05, 20.0),
+    ):
+        """
+        Listen to the results of <droplet_controller>; disabled until enable().
+
+        Args:
+            droplet_controller: DropletDetectorController
+            flow_web: FlowWeb of the flow board
+            dispersed_index: Flow channel of the dispersed phase
+            continuous_index: Flow channel of the continuous phase
+            scheduler: SpiScheduler to run the changes on at PRIORITY_CONTROL, None to run
+                them in the processing thread
+            settle_s: Seconds ignored after a change, on top of the measured latency
+            gain: Ratio change per diameter error, in log space
+            max_step: Largest ratio change per step, as a fraction
+            deadband: Diameter error left alone, as a fraction of the target
+            min_droplets: Droplets measured before a step
+            min_window_s: Seconds measured before a step
+            min_frequency_hz: Droplet rate under which no step is taken (no droplets
+                forming, or the ROI off the channel)
+            ratio_limits: (min, max) dispersed/continuous flow ratio
+        """
+        self.droplet_controller = droplet_controller
+        self.flow_web = flow_web
+        self.dispersed_index = dispersed_index
+        self.continuous_index = continuous_index
+        self.scheduler = scheduler
+        self.settle_s = settle_s
+        self.gain = gain
+        self.max_step = max_step
+        self.deadband = deadband
+        self.min_droplets = min_droplets
+        self.min_window_s = min_window_s
+        self.min_frequency_hz = min_frequency_hz
+        self.ratio_limits = ratio_limits
+
+        self.lock = threading.Lock()
+        self.enabled = False
+        self.staged = False  # Changes staged on the synchronized clock
+        self.busy = False  # A change is on its way to the flow board
+        self.target_diameter_um: Optional[float] = None
+        self.ratio: Optional[float] = None
+        self.total_ul_hr = 0.0
+        self.diameters: List[float] = []
+        self.window_start_s: Optional[float] = None
+        self.hold_until_s = 0.0
+        self.holdoff_s = settle_s
+        self.measured_diameter_um: Optional[float] = None
+        self.measured_frequency_hz: Optional[float] = None
+        self.changes = 0
+        self.last_change: Optional[Dict[str, Any]] = None
+
+        droplet_controller.result_listeners.append(self.on_result)
+
+    def enable(self, target_diameter_um: float) -> bool:
+        """
+        Start steering to <target_diameter_um> from the current flow setpoints.
+
+        Returns:
+            False if the flow board is offline, a channel is not in flow closed loop, or
+            a setpoint is 0
+        """
+        if target_diameter_um <= 0 or not self.flow_web.enabled:
+            return False
+        indices = (self.dispersed_index, self.continuous_index)
+        modes = self.flow_web.get_control_modes()
+        if len(modes) <= max(indices) or any(
+            modes[i] not in self.FLOW_CLOSED_LOOP_MODES for i in indices
+        ):
+            logger.warning(f"Droplet size control needs flow closed loop on channels {indices}")
+            return False
+        targets = self.flow_web.get_flow_targets()
+        if len(targets) <= max(indices) or min(targets[i] for i in indices) <= 0:
+            logger.warning("Droplet size control needs both flow setpoints above 0")
+            return False
+
+        flow = self.flow_web.flow
+        staged = False
+        if spi_handler.supports(flow, flow.PACKET_TYPE_STAGE):
+            staged, _ = flow.sync_time()
+        with self.lock:
+            self.target_diameter_um = float(target_diameter_um)
+            self.ratio = targets[self.dispersed_index] / targets[self.continuous_index]
+            self.total_ul_hr = float(targets[self.dispersed_index] + targets[self.continuous_index])
+            self.staged = staged
+            self.hold_until_s = 0.0
+            self._restart_window()
+            self.enabled = True
+        logger.info(
+            f"Droplet size control on: target {target_diameter_um} um, ratio {self.ratio:.3f}, "
+            f"{'staged' if staged else 'immediate'} setpoints"
+        )
+        return True
+
+    def disable(self) -> None:
+        """Stop steering; the flow setpoints stay where they are."""
+        with self.lock:
+            self.enabled = False
+            self._restart_window()
+
+    def _restart_window(self) -> None:
+        self.diameters = []
+        self.window_start_s = None
+
+    def on_result(self, frame: Any, metrics: List[Any]) -> None:
+        """Result listener of the droplet controller: measure, and step when due."""
+        if not self.enabled or self.busy:
+            return
+        now = spi_handler.clock.monotonic()
+        um_per_px = getattr(self.droplet_controller, "um_per_px", 1.0)
+        with self.lock:
+            if not self.enabled or now < self.hold_until_s:
+                return
+            if self.window_start_s is None:
+                self.window_start_s = now
+            self.diameters.extend(m.equivalent_diameter * um_per_px for m in metrics)
+            elapsed_s = now - self.window_start_s
+            if len(self.diameters) < self.min_droplets or elapsed_s < max(self.min_window_s, 1e-6):
+                return
+            self.measured_diameter_um = statistics.median(self.diameters)
+            self.measured_frequency_hz = len(self.diameters) / elapsed_s
+            self._restart_window()
+            if self.measured_frequency_hz < self.min_frequency_hz:
+                return
+            step = self._next_step(self.measured_diameter_um)
+            if step is None:
+                return
+            self.busy = True
+
+        flows, ratio = step
+        if self.scheduler is None:
+            try:
+                self._apply(flows, ratio, frame)
+            finally:
+                self.busy = False
+            return
+        future = self.scheduler.call(
+            self._apply,
+            flows,
+            ratio,
+            frame,
+            priority=PRIORITY_CONTROL,
+            device=self.flow_web.flow,
+        )
+        future.add_done_callback(lambda _: setattr(self, "busy", False))
+
+    def _next_step(self, diameter_um: float) -> Optional[Tuple[List[int], float]]:
+        """The setpoints (dispersed, continuous) and ratio for <diameter_um>, None to hold."""
+        error = math.log(self.target_diameter_um / diameter_um) if diameter_um > 0 else 0.0
+        if abs(error) < math.log1p(self.deadband):
+            return None
+        limit = math.log1p(self.max_step)
+        step = max(-limit, min(limit, self.gain * error))
+        ratio = max(self.ratio_limits[0], min(self.ratio_limits[1], self.ratio * math.exp(step)))
+        dispersed = int(round(self.total_ul_hr * ratio / (1.0 + ratio)))
+        continuous = int(round(self.total_ul_hr)) - dispersed
+        if dispersed <= 0 or continuous <= 0 or ratio == self.ratio:
+            return None
+        return ([dispersed, continuous], ratio)
+
+    def _latency_s(self) -> float:
+        """p90 of the first LATENCY_INTERVALS with samples, 0 if none."""
+        latency = self.droplet_controller.get_latency_metrics()
+        for name in self.LATENCY_INTERVALS:
+            if latency.get(name, {}).get("count"):
+                return float(latency[name]["p90"]) / 1000.0
+        return 0.0
+
+    def _apply(self, flows: List[int], ratio: float, frame: Any) -> bool:
+        """Set both flow setpoints in one packet, staged if possible, and mark the action."""
+        flow = self.flow_web.flow
+        indices = [self.dispersed_index, self.continuous_index]
+        apply_us = None
+        if self.staged:
+            # The lead covers the STAGE query's own reply pause
+            lead_us = spi_handler.STAGE_LEAD_US + int(flow.reply_pause_s * 1e6)
+            valid, result = spi_handler.stage_together(
+                [lambda t: flow.set_flow(indices, flows, apply_us=t)], lead_us
+            )
+            if valid:
+                apply_us = result["apply_us"]
+            else:
+                flow.cancel_staged()
+                logger.warning(f"Droplet size control: staging failed: {result}")
+        else:
+            valid = flow.set_flow(indices, flows)
+
+        if valid:
+            self.droplet_controller.mark_action(frame, apply_us)
+            for index, flow_ul_hr in zip(indices, flows):
+                self.flow_web.flow_ul_hr_targets[index] = flow_ul_hr
+            self.flow_web.poller.kick()
+        holdoff_s = self.settle_s + self._latency_s()
+        with self.lock:
+            self.holdoff_s = holdoff_s
+            self.hold_until_s = spi_handler.clock.monotonic() + holdoff_s
+            self._restart_window()
+            if valid:
+                self.last_change = {
+                    "frame": frame,
+                    "diameter_um": self.measured_diameter_um,
+                    "ratio_from": self.ratio,
+                    "ratio_to": ratio,
+                    "flows_ul_hr": list(flows),
+                    "apply_us": apply_us,
+                }
+                self.ratio = ratio
+                self.changes += 1
+        if valid:
+            logger.debug(f"Droplet size control: ratio {ratio:.3f}, flows {flows} ul/hr")
+        else:
+            logger.warning("Droplet size control: failed to set the flow setpoints")
+        return bool(valid)
+
+    def get_status(self) -> Dict[str, Any]:
+        """State for GET /api/droplet/size_control."""
+        with self.lock:
+            return {
+                "enabled": self.enabled,
+                "target_diameter_um": self.target_diameter_um,
+                "measured_diameter_um": self.measured_diameter_um,
+                "measured_frequency_hz": self.measured_frequency_hz,
+                "ratio": self.ratio,
+                "total_ul_hr": self.total_ul_hr,
+                "channels": [self.dispersed_index, self.continuous_index],
+                "staged": self.staged,
+                "holdoff_s": self.holdoff_s,
+                "changes": self.changes,
+                "last_change": self.last_change,
+            }
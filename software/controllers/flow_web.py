@@ -12,7 +12,10 @@ Classes:
 import logging
 from typing import List, cast
 
+from drivers import spi_handler
 from drivers.flow import PiFlow
+from controllers.adaptive_poller import AdaptivePoller
+from controllers.telemetry_recorder import flow_history_layout, flow_telemetry_layout
 from config import (
     FLOW_REPLY_PAUSE_S,
     CONTROL_MODE_FIRMWARE_TO_UI,
@@ -45,6 +48,9 @@ class FlowWeb:
         enabled: Whether the flow controller is enabled
         connected: Whether communication with hardware is active
         reload: Flag indicating state reload is needed
+        recorder: TelemetryRecorder that update() appends history and telemetry to, or None
+        charts: HistoryPyramid that update() adds the pressures and flows to, or None
+        poller: AdaptivePoller telling the background loop when update() is next due
     """
 
     # Control mode display strings (UI indices), sourced from config to avoid drift
@@ -55,6 +61,10 @@ class FlowWeb:
 
     FLOW_STATUS_STR = ["Unconfigured", "Idle", "Active", "Error"]
 
+    # Change between two polls under which the readings count as settled
+    PRESSURE_SETTLED_MBAR = 1.0
+    FLOW_SETTLED_UL_HR = 1.0
+
     def __init__(self, port: int) -> None:
         """
         Initialize the FlowWeb interface.
@@ -81,6 +91,12 @@ class FlowWeb:
             valid, device_id, id_valid = self.flow.get_id()
             logger.info(f"Flow controller ID check: valid={id_valid}, ID={device_id}")
             self.enabled = valid and id_valid
+            if self.enabled:
+                caps_valid, caps = spi_handler.discover(self.flow)
+                logger.info(f"Flow controller capabilities: {caps if caps_valid else 'none'}")
+                if spi_handler.supports(self.flow, self.flow.PACKET_TYPE_GET_BOOT_STATUS):
+                    boot_valid, boot = self.flow.get_boot_status()
+                    logger.info(f"Flow controller boot status: {boot if boot_valid else 'none'}")
             self.connected = self.enabled
         except Exception as e:
             logger.error(f"Error initializing flow controller: {e}")
@@ -88,6 +104,12 @@ class FlowWeb:
             self.connected = False
 
         self.reload = False
+        self.recorder = None
+        self.charts = None
+        self.recording_telemetry = False
+        self.history_seq = None
+        self.poller = AdaptivePoller()
+        self.last_readings: tuple = ([], [])  # (pressures, flows) of the last update()
 
         # Load initial state from hardware
         if self.enabled:
@@ -147,23 +169,27 @@ class FlowWeb:
                 logger.warning("Failed to get control modes from hardware")
                 return []  # Return empty list instead of None
 
-            self.control_modes = control_modes
-            # Map firmware modes to UI display strings
-            # Firmware: 0=Off, 1=Pressure Open Loop, 2=Pressure Closed Loop (hidden), 3=Flow Closed Loop
-            # UI: 0=Off, 1=Set Pressure, 2=Flow Closed Loop
-            self.control_modes_text = []
-            for firmware_mode in control_modes:
-                ui_index = CONTROL_MODE_FIRMWARE_TO_UI.get(firmware_mode, 0)
-                if ui_index < len(self.CTRL_MODE_STR):
-                    self.control_modes_text.append(self.CTRL_MODE_STR[ui_index])
-                else:
-                    logger.warning(f"Invalid UI index {ui_index} for firmware mode {firmware_mode}")
-                    self.control_modes_text.append(self.CTRL_MODE_STR[0])  # Default to "Off"
+            self._set_control_modes(control_modes)
             return cast(List[int], control_modes)
         except Exception as e:
             logger.error(f"Error getting control modes: {e}")
             return []
 
+    def _set_control_modes(self, control_modes: List[int]) -> None:
+        """Store firmware control modes and map them to UI display strings."""
+        self.control_modes = control_modes
+        # Map firmware modes to UI display strings
+        # Firmware: 0=Off, 1=Pressure Open Loop, 2=Pressure Closed Loop (hidden), 3=Flow Closed Loop
+        # UI: 0=Off, 1=Set Pressure, 2=Flow Closed Loop
+        self.control_modes_text = []
+        for firmware_mode in control_modes:
+            ui_index = CONTROL_MODE_FIRMWARE_TO_UI.get(firmware_mode, 0)
+            if ui_index < len(self.CTRL_MODE_STR):
+                self.control_modes_text.append(self.CTRL_MODE_STR[ui_index])
+            else:
+                logger.warning(f"Invalid UI index {ui_index} for firmware mode {firmware_mode}")
+                self.control_modes_text.append(self.CTRL_MODE_STR[0])  # Default to "Off"
+
     def get_flow_pi_consts(self) -> None:
         """
         Retrieve flow PI control constants from hardware.
@@ -201,6 +227,7 @@ class FlowWeb:
             pressure = int(pressure_mbar)
             valid = self.flow.set_pressure([index], [pressure])
             if valid:
+                self.poller.kick()
                 self.get_pressure_targets()
                 logger.debug(f"Pressure set for controller {index}: {pressure} mbar")
             else:
@@ -229,6 +256,7 @@ class FlowWeb:
             flow = int(flow_ul_hr)
             valid = self.flow.set_flow([index], [flow])
             if valid:
+                self.poller.kick()
                 self.get_flow_targets()
                 logger.debug(f"Flow set for controller {index}: {flow} ul/hr")
             else:
@@ -264,6 +292,7 @@ class FlowWeb:
 
             valid = self.flow.set_control_mode([index], [firmware_mode])
             if valid:
+                self.poller.kick()
                 self.get_control_modes()
                 logger.debug(
                     f"Control mode set for controller {index}: "
@@ -302,6 +331,7 @@ class FlowWeb:
             pid_consts = [pi_consts[0], pi_consts[1], 0]
             valid = self.flow.set_flow_pid_consts([index], [pid_consts])
             if valid:
+                self.poller.kick()
                 self.get_flow_pi_consts()
                 logger.debug(
                     f"PI constants set for controller {index}: P={pi_consts[0]}, I={pi_consts[1]}"
@@ -313,6 +343,53 @@ class FlowWeb:
             logger.error(f"Error setting flow PI constants: {e}")
             return False
 
+    def start_recording(self, recorder, telemetry_cycles: int = 0) -> bool:
+        """
+        Append the firmware history records, and the telemetry samples if streamed, to
+        <recorder> on each update() until stop_recording().
+
+        Args:
+            recorder: A TelemetryRecorder
+            telemetry_cycles: Stream a compact telemetry sample every this many control
+                cycles as well, 0 for the history alone
+
+        Returns:
+            bool: False if the telemetry could not be started, the history is recorded anyway
+        """
+        self.recorder = recorder
+        self.history_seq = None
+        if telemetry_cycles and self.enabled:
+            valid, _ = self.flow.set_telemetry(telemetry_cycles, compact=True)
+            self.recording_telemetry = valid
+            return valid
+        return True
+
+    def stop_recording(self) -> None:
+        if self.recording_telemetry:
+            self.flow.set_telemetry(0)
+        self.recorder = None
+        self.recording_telemetry = False
+
+    def _record(self) -> None:
+        """Append the history and telemetry since the last update to the recorder."""
+        channels = self.flow.NUM_CONTROLLERS
+        if self.recording_telemetry:
+            valid, samples = self.flow.read_telemetry()
+            self.recorder.record("flow_telemetry", flow_telemetry_layout(channels), samples)
+        if self.history_seq is None:
+            valid, history = self.flow.get_history(0, 0)
+            if not valid:
+                return
+            self.history_seq = history["oldest_seq"]
+        valid, records, next_seq = self.flow.read_history(self.history_seq)
+        self.recorder.record("flow_history", flow_history_layout(channels), records)
+        if valid and not records:
+            # Nothing new: resync if the firmware restarted its seq, e.g. after a reset
+            valid, history = self.flow.get_history(0, 0)
+            if valid and next_seq != (history["newest_seq"] + 1) & 0xFFFF:
+                next_seq = history["oldest_seq"]
+        self.history_seq = next_seq
+
     def update(self) -> None:
         """
         Update flow controller state from hardware.
@@ -323,52 +400,78 @@ class FlowWeb:
         """
         if not self.enabled:
             self.status_text = ["Offline"] * self.flow.NUM_CONTROLLERS
+            self.poller.polled(settled=True)
             return
 
         try:
             valid, pressures_actual, flows_actual = self._read_hardware_values()
+            self.poller.polled(self._settled(valid, pressures_actual, flows_actual))
             self._handle_connection_restore(valid)
             self._update_status_text(valid)
             self._update_display_strings(pressures_actual, flows_actual)
+            if self.charts is not None and valid:
+                self._chart(pressures_actual, flows_actual)
+            if self.recorder is not None and valid:
+                self._record()
         except Exception as e:
             logger.error(f"Error updating flow controller state: {e}")
             self.connected = False
             self.status_text = ["Error"] * self.flow.NUM_CONTROLLERS
 
+    def _settled(self, valid: bool, pressures_actual: List[float], flows_actual: List[float]) -> bool:
+        """
+        True if no reading moved more than its tolerance since the last update(), a
+        setpoint ramp or a channel still converging keeping it False. A failed read
+        counts as settled, so that an absent board is polled at the slow rate.
+        """
+        if not valid:
+            return True
+        last_pressures, last_flows = self.last_readings
+        self.last_readings = (pressures_actual, flows_actual)
+        if len(last_pressures) != len(pressures_actual) or len(last_flows) != len(flows_actual):
+            return False
+        return all(
+            abs(now - before) <= self.PRESSURE_SETTLED_MBAR
+            for now, before in zip(pressures_actual, last_pressures)
+        ) and all(
+            abs(now - before) <= self.FLOW_SETTLED_UL_HR
+            for now, before in zip(flows_actual, last_flows)
+        )
+
+    def _chart(self, pressures_actual: List[float], flows_actual: List[float]) -> None:
+        now = spi_handler.clock.time()  # Simulated time in simulation
+        for index, pressure in enumerate(pressures_actual):
+            self.charts.add(f"flow.pressure{index}", now, pressure)
+        for index, flow in enumerate(flows_actual):
+            self.charts.add(f"flow.flow{index}", now, flow)
+
     def _read_hardware_values(self) -> tuple[bool, List[float], List[float]]:
-        """Read pressure and flow values from hardware."""
-        valid = True
-        pressures_actual: List[float] = []
-        flows_actual: List[float] = []
+        """
+        Read the controller status from hardware in one SPI transaction.
 
+        Targets, control modes and PI constants come back in the same batch, so
+        they are refreshed here as well.
+        """
         try:
-            valid_pressure, pressures_actual = self.flow.get_pressure_actual()
-            if not valid_pressure:
-                logger.warning("Failed to get pressure actual values")
-            valid = valid and valid_pressure
+            valid, status = self.flow.get_status()
         except Exception as e:
-            logger.error(f"Error reading pressure actual: {e}")
-            valid = False
+            logger.error(f"Error reading flow controller status: {e}")
+            return False, [], []
 
-        try:
-            valid_flow, flows_actual = self.flow.get_flow_actual()
-            if not valid_flow:
-                logger.warning("Failed to get flow actual values")
-            valid = valid and valid_flow
-        except Exception as e:
-            logger.error(f"Error reading flow actual: {e}")
-            valid = False
+        if not valid:
+            logger.warning("Failed to get flow controller status")
+            return False, [], []
 
-        return valid, pressures_actual, flows_actual
+        self.pressure_mbar_targets = status["pressure_target"]
+        self.flow_ul_hr_targets = status["flow_target"]
+        self._set_control_modes(status["control_modes"])
+        self.flow_pi_consts = [[consts[0], consts[1]] for consts in status["pid_consts"]]
+        return True, status["pressure_actual"], status["flow_actual"]
 
     def _handle_connection_restore(self, valid: bool) -> None:
-        """Handle connection restore by reloading state."""
+        """Flag a reload for the UI when the connection comes back."""
         if valid and not self.connected:
             logger.info("Flow controller connection restored, reloading state")
-            self.get_pressure_targets()
-            self.get_flow_targets()
-            self.get_control_modes()
-            self.get_flow_pi_consts()
             self.reload = True
         self.connected = valid
 
@@ -1,5 +1,9 @@
 import logging
+from collections import deque
+from drivers import spi_handler
 from drivers.heater import PiHolder
+from controllers.adaptive_poller import AdaptivePoller
+from controllers.telemetry_recorder import heater_history_layout
 
 # Configure logging
 logger = logging.getLogger(__name__)
@@ -12,7 +16,14 @@ class heater_web:
 
     INIT_TRIES = 3
 
+    HISTORY_KEEP = 3000  # Firmware history records kept for plots, 5 minutes at 100 ms
+
+    # Change between two polls under which the readings count as settled
+    TEMP_SETTLED_C = 0.1
+    STIR_SETTLED_RPS = 0.5
+
     def __init__(self, heater_num, port):
+        self.heater_num = heater_num
         self.holder = PiHolder(port, 0.05)
         self.autotuning = False
         self.pid_enabled = False
@@ -24,6 +35,12 @@ class heater_web:
         self.autotune_status_text = ""
         self.temp_text = ""
         self.stir_speed_text = ""
+        self.history = deque(maxlen=self.HISTORY_KEEP)
+        self.history_seq = None
+        self.recorder = None
+        self.charts = None  # HistoryPyramid fed with the history records
+        self.poller = AdaptivePoller()  # When the background loop next calls update()
+        self.last_readings = None  # (temp_c, stir_rps) of the last update()
 
         for i in range(self.INIT_TRIES):
             valid, id, id_valid = self.holder.get_id()
@@ -37,6 +54,11 @@ class heater_web:
         logger = logging.getLogger(__name__)
         logger.info(f"Heater {heater_num} ID OK: {valid}")
         self.enabled = valid and id_valid
+        if self.enabled:
+            spi_handler.discover(self.holder)
+            if spi_handler.supports(self.holder, self.holder.PACKET_TYPE_GET_BOOT_STATUS):
+                boot_valid, boot = self.holder.get_boot_status()
+                logger.info(f"Heater {heater_num} boot status: {boot if boot_valid else 'none'}")
 
         self.temp_c_target = self.get_temp_target()
         valid, self.heat_power_limit_pc = self.holder.get_heat_power_limit_pc()
@@ -52,6 +74,7 @@ class heater_web:
         try:
             temp = round(float(temp), 2)
             self.holder.set_pid_temp(temp)
+            self.poller.kick()
             self.temp_c_target = self.get_temp_target()
         except Exception:
             pass
@@ -60,6 +83,7 @@ class heater_web:
         try:
             limit_pc = int(power_limit_pc)
             valid = self.holder.set_heat_power_limit_pc(limit_pc)
+            self.poller.kick()
             valid, power_limit_pc = self.holder.get_heat_power_limit_pc()
             if valid:
                 self.heat_power_limit_pc = power_limit_pc
@@ -71,6 +95,7 @@ class heater_web:
             temp = round(float(self.autotune_target_temp), 2)
             # autotuning = 0 if self.autotuning else 1
             self.holder.set_autotune_running(autotuning, temp)
+            self.poller.kick()
         except Exception:
             pass
 
@@ -80,6 +105,7 @@ class heater_web:
             # temp = round( float( self.temp_target_box.value ), 2 )
             # self.holder.set_pid_running( run, temp )
             self.holder.set_pid_running(run)
+            self.poller.kick()
             # self.temp_c_target = self.get_temp_target()
         except Exception:
             pass
@@ -89,6 +115,7 @@ class heater_web:
             # run = 0 if self.stir_enabled else 1
             stir_speed_rps = int(self.stir_target_speed)
             self.holder.set_stir_running(run, stir_speed_rps)
+            self.poller.kick()
         except Exception:
             pass
 
@@ -96,38 +123,98 @@ class heater_web:
         """Update heater controller state from hardware."""
         if not self.enabled:
             self.status_text = "Offline"
+            self.poller.polled(settled=True)
             return
 
         try:
             okay, pid_status, pid_error, autotune_status, stir_status, stir_speed_actual_rps = (
                 self._read_hardware_status()
             )
+            self.poller.polled(self._settled(okay, stir_speed_actual_rps))
             self._update_status_text(okay, pid_status, pid_error, autotune_status)
             self._update_display_strings(stir_speed_actual_rps)
             self._update_control_states(pid_status, stir_status)
             self._update_autotune_status_text(autotune_status)
+            self._read_history()
         except Exception as e:
             logger.error(f"Error updating heater state: {e}")
 
-    def _read_hardware_status(self) -> tuple[bool, int, int, int, int, float]:
-        """Read all hardware status values."""
-        okay = True
-        valid, pid_status, pid_error = self.holder.get_pid_status()
-        okay = okay and valid
+    def _settled(self, okay: bool, stir_speed_actual_rps: float) -> bool:
+        """
+        True if temperature and stirrer speed held since the last update() and no
+        autotune runs; a setpoint or profile ramp keeps the readings moving. A failed
+        read counts as settled, so that an absent board is polled at the slow rate.
+        """
+        if not okay:
+            return True
+        last, self.last_readings = self.last_readings, (self.temp_c_actual, stir_speed_actual_rps)
+        return (
+            not self.autotuning
+            and last is not None
+            and abs(self.temp_c_actual - last[0]) <= self.TEMP_SETTLED_C
+            and abs(stir_speed_actual_rps - last[1]) <= self.STIR_SETTLED_RPS
+        )
 
-        valid, temp_c = self.holder.get_temp_actual()
-        if valid:
-            self.temp_c_actual = round(temp_c, 2)
-        okay = okay and valid
+    def _read_history(self) -> None:
+        """Append the firmware history records since the last update to self.history."""
+        if self.history_seq is None:
+            valid, history = self.holder.get_history(0, 0)
+            if not valid:
+                return
+            self.history_seq = history["oldest_seq"]
+        valid, records, next_seq = self.holder.read_history(self.history_seq)
+        self.history.extend(records)
+        if self.recorder is not None:
+            self.recorder.record(
+                f"heater{self.heater_num}_history",
+                heater_history_layout(),
+                records,
+                convert={"flags": self._flag_bits},
+            )
+        if self.charts is not None and records:
+            self._chart(records)
+        if valid and not records:
+            # Nothing new: resync if the firmware restarted its seq, e.g. after a reset
+            valid, history = self.holder.get_history(0, 0)
+            if valid and next_seq != (history["newest_seq"] + 1) & 0xFFFF:
+                next_seq = history["oldest_seq"]
+        self.history_seq = next_seq
+
+    def _chart(self, records) -> None:
+        """Add the records to the charts at host time, the newest taken as now."""
+        now = spi_handler.clock.time()  # Simulated time in simulation
+        newest_us = records[-1]["time_us"]
+        prefix = f"heater{self.heater_num}."
+        for record in records:
+            t = now - ((newest_us - record["time_us"]) & 0xFFFFFFFF) / 1e6
+            self.charts.add(prefix + "temp_c", t, record["temp_c"])
+            self.charts.add(prefix + "target_c", t, record["target_c"])
+            self.charts.add(prefix + "heater_output", t, record["heater_output"])
+
+    def start_recording(self, recorder) -> None:
+        """Also append the history records to <recorder>, a TelemetryRecorder, until stopped."""
+        self.recorder = recorder
 
-        valid, autotune_status, autotune_fail = self.holder.get_autotune_status()
-        okay = okay and valid
+    def stop_recording(self) -> None:
+        self.recorder = None
 
-        valid, stir_status = self.holder.get_stir_status()
-        okay = okay and valid
+    def _flag_bits(self, flags) -> int:
+        return sum(1 << self.holder.HISTORY_FLAGS.index(name) for name in flags)
 
-        valid, stir_speed_actual_rps = self.holder.get_stir_speed_actual()
-        okay = okay and valid
+    def _read_hardware_status(self) -> tuple[bool, int, int, int, int, float]:
+        """Read all hardware status values in one SPI transaction."""
+        (
+            okay,
+            pid_status,
+            pid_error,
+            temp_c,
+            autotune_status,
+            autotune_fail,
+            stir_status,
+            stir_speed_actual_rps,
+        ) = self.holder.get_status()
+        if okay:
+            self.temp_c_actual = round(temp_c, 2)
 
         self.autotuning = autotune_status == 1
         self.autotune_status = autotune_status
@@ -143,7 +230,8 @@ class heater_web:
         elif self.autotuning:
             self.status_text = "Autotuning"
         elif pid_status == 4:
-            self.status_text = "No Sensor" if pid_error == 2 else f"Error {pid_error}"
+            error_text = {2: "No Sensor", 3: "Heater Fault"}
+            self.status_text = error_text.get(pid_error, f"Error {pid_error}")
         else:
             try:
                 self.status_text = "{}".format(self.pid_status_str[pid_status])
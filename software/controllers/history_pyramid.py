@@ -0,0 +1,172 @@
+"""
+Min/max/mean history at several resolutions, for the UI charts.
+
+Each signal, e.g. "heater1.temp_c" or "flow.pressure0", keeps LEVELS rings of buckets.
+Level k has buckets of BASE_BUCKET_S * FACTOR^k seconds, each with the min, max, sum and
+count of the samples in it, and keeps the last BUCKETS_KEPT of them. A sample updates the
+open bucket of every level as it arrives, so nothing is recomputed when a chart asks.
+
+query() picks the finest level that spans the asked window in at most the asked number
+of points and has not yet dropped its start, so a chart of hours costs about one bucket
+per pixel to read and to send, whatever the sample rate. With the defaults, 0.1 s buckets
+cover the last 100 s and the coarsest, of 27 minutes, the last 19 days. The rings are
+arrays of doubles, about 40 kB per signal and level.
+
+Times are host time.time() seconds.
+"""
+
+import math
+from array import array
+from threading import Lock
+from typing import Any, Dict, List, Optional
+
+BASE_BUCKET_S = 0.1
+FACTOR = 4
+LEVELS = 8
+BUCKETS_KEPT = 1024
+DEFAULT_POINTS = 500
+
+
+class _Level:
+    """One ring of buckets of a signal."""
+
+    __slots__ = ("width", "start", "low", "high", "total", "count", "size", "head")
+
+    def __init__(self, width: float, keep: int):
+        self.width = width
+        zeros = [0.0] * keep
+        self.start = array("d", zeros)
+        self.low = array("d", zeros)
+        self.high = array("d", zeros)
+        self.total = array("d", zeros)
+        self.count = array("d", zeros)
+        self.size = 0  # Buckets in use, the newest (open) one at head
+        self.head = -1
+
+    def add(self, t: float, value: float):
+        start = math.floor(t / self.width) * self.width
+        head = self.head
+        if self.size and start <= self.start[head]:
+            # The open bucket; a sample older than it, e.g. late history, counts there too
+            if value < self.low[head]:
+                self.low[head] = value
+            if value > self.high[head]:
+                self.high[head] = value
+            self.total[head] += value
+            self.count[head] += 1
+            return
+        head = self.head = (head + 1) % len(self.start)
+        self.size = min(self.size + 1, len(self.start))
+        self.start[head] = start
+        self.low[head] = self.high[head] = self.total[head] = value
+        self.count[head] = 1
+
+    def oldest(self) -> Optional[float]:
+        if not self.size:
+            return None
+        return self.start[(self.head - self.size + 1) % len(self.start)]
+
+    def buckets(self, start: float, end: float) -> List[List[float]]:
+        """[start, min, max, mean] of the buckets overlapping start to end, oldest first."""
+        keep = len(self.start)
+        out = []
+        for i in range(self.size):
+            index = (self.head - self.size + 1 + i) % keep
+            bucket_start = self.start[index]
+            if bucket_start + self.width <= start or bucket_start > end:
+                continue
+            out.append(
+                [
+                    bucket_start,
+                    self.low[index],
+                    self.high[index],
+                    self.total[index] / self.count[index],
+                ]
+            )
+        return out
+
+
+class HistoryPyramid:
+    """The min/max/mean rings of every signal."""
+
+    def __init__(
+        self,
+        base_s: float = BASE_BUCKET_S,
+        factor: int = FACTOR,
+        levels: int = LEVELS,
+        keep: int = BUCKETS_KEPT,
+    ):
+        self.widths = [base_s * factor**level for level in range(levels)]
+        self.keep = keep
+        self._signals: Dict[str, List[_Level]] = {}
+        self._first: Dict[str, float] = {}  # signal -> time of its oldest sample
+        self._lock = Lock()
+
+    def add(self, signal: str, t: float, value: float) -> None:
+        """One sample of <signal> at host time <t> s."""
+        if value is None or math.isnan(value):
+            return
+        with self._lock:
+            levels = self._signals.get(signal)
+            if levels is None:
+                levels = self._signals[signal] = [_Level(w, self.keep) for w in self.widths]
+                self._first[signal] = t
+            elif t < self._first[signal]:
+                self._first[signal] = t
+            for level in levels:
+                level.add(t, value)
+
+    def add_many(self, t: float, values: Dict[str, float]) -> None:
+        """Samples of several signals at the same time."""
+        for signal, value in values.items():
+            self.add(signal, t, value)
+
+    def signals(self) -> List[str]:
+        with self._lock:
+            return sorted(self._signals)
+
+    def query(
+        self,
+        signal: str,
+        start: Optional[float] = None,
+        end: Optional[float] = None,
+        points: int = DEFAULT_POINTS,
+    ) -> Optional[Dict[str, Any]]:
+        """
+        The buckets of <signal> from <start> to <end>, at most about <points> of them.
+
+        Args:
+            start: Window start, host time s; None for all that is kept
+            end: Window end; None for the newest sample
+            points: Chart width, in buckets
+
+        Returns:
+            dict: signal, level, bucket_s, and the columns t (bucket starts), min, max and
+            mean, oldest first; None for an unknown signal
+        """
+        points = max(1, int(points))
+        with self._lock:
+            levels = self._signals.get(signal)
+            if levels is None:
+                return None
+            newest = levels[0].start[levels[0].head] + levels[0].width
+            if end is None:
+                end = newest
+            if start is None:
+                start = max(self._first[signal], levels[-1].oldest())
+            chosen = len(levels) - 1
+            for index, level in enumerate(levels):
+                holds_start = level.size < self.keep or level.oldest() <= start
+                if (end - start) / level.width <= points and holds_start:
+                    chosen = index
+                    break
+            buckets = levels[chosen].buckets(start, end)
+        return {
+            "signal": signal,
+            "level": chosen,
+            "bucket_s": self.widths[chosen],
+            "t": [b[0] for b in buckets],
+            "min": [b[1] for b in buckets],
+            "max": [b[2] for b in buckets],
+            "mean": [b[3] for b in buckets],
+        }
@@ -0,0 +1,179 @@
+"""
+Latest device state in shared memory, written by the SPI owner and read lock free.
+
+The background update is the only code that queries the modules for their readings. It
+publishes each formatted state ("heaters", "flows", "strobe", ...) into a table in POSIX
+shared memory, and the web routes, and other processes attached by name, read the latest
+one from there without a lock and without reaching the bus, however many pages are open.
+
+The table is HEADER_SIZE bytes of [magic][version U32][slots U32][slot size U32], then
+one slot per key of [seq U64][time f64][length U32][key 32 bytes], padded to
+SLOT_HEADER_SIZE, then the state as JSON. Each slot is a sequence lock: the writer makes
+seq odd, writes, and makes it even again; a reader copies the slot and keeps the copy if
+seq was even and unchanged around it, else tries again. Writers in the owning process are
+serialized by a lock, readers never wait for one.
+
+    table = StateTable(create=True)  # Owner
+    table.publish("flows", flows_data)
+
+    table = StateTable()  # Any process
+    seq, published, flows = table.read("flows")
+"""
+
+import json
+import struct
+import time
+from multiprocessing import resource_tracker, shared_memory
+from threading import Lock
+from typing import Any, Dict, Optional, Tuple
+
+from config import STATE_TABLE_NAME
+
+TABLE_MAGIC = b"RIOSTATE"
+TABLE_VERSION = 1
+HEADER_SIZE = 64
+_HEADER = struct.Struct("<8sIII")
+_SLOT = struct.Struct("<QdI32s")
+_SEQ = struct.Struct("<Q")
+SLOT_HEADER_SIZE = 56  # _SLOT, payload 8 byte aligned
+SLOTS = 16
+SLOT_SIZE = 16384  # Four heaters are about 1.5 kB of JSON
+READ_TRIES = 1000  # A reader gives up on a slot whose writer died half way
+
+_owned = set()  # Names of the tables created by this process
+
+
+class StateTable:
+    """One table of latest states, see the module docstring."""
+
+    def __init__(
+        self,
+        name: str = STATE_TABLE_NAME,
+        create: bool = False,
+        slots: int = SLOTS,
+        slot_size: int = SLOT_SIZE,
+    ):
+        """
+        Args:
+            name: Shared memory name, /dev/shm/<name> on Linux
+            create: True for the owner, which replaces a table left by a previous run;
+                False to attach to the owner's table, whose geometry is then read from it
+            slots: Keys the table holds, when created
+            slot_size: Bytes per slot, when created
+        """
+        self.owner = create
+        if create:
+            try:
+                shared_memory.SharedMemory(name=name).unlink()  # Left by a crash
+            except FileNotFoundError:
+                pass
+            size = HEADER_SIZE + slots * slot_size
+            self._shm = shared_memory.SharedMemory(name=name, create=True, size=size)
+            self._shm.buf[:size] = bytes(size)
+            _HEADER.pack_into(self._shm.buf, 0, TABLE_MAGIC, TABLE_VERSION, slots, slot_size)
+            _owned.add(name)
+        else:
+            self._shm = shared_memory.SharedMemory(name=name)
+            if name not in _owned:
+                # The owner unlinks it, not the tracker of this process when it exits
+                resource_tracker.unregister(self._shm._name, "shared_memory")
+            magic, version, slots, slot_size = _HEADER.unpack_from(self._shm.buf, 0)
+            if magic != TABLE_MAGIC or version != TABLE_VERSION:
+                self._shm.close()
+                raise ValueError(f"{name} is not a state table")
+        self.name = name
+        self.slots = slots
+        self.slot_size = slot_size
+        self._buf = self._shm.buf
+        self._index: Dict[str, int] = {}  # key -> slot, as found or claimed
+        self._lock = Lock()
+
+    def _offset(self, slot: int) -> int:
+        return HEADER_SIZE + slot * self.slot_size
+
+    def publish(self, key: str, data: Any) -> int:
+        """Set the state of <key>, JSON serializable. Returns its new seq."""
+        encoded_key = key.encode()
+        payload = json.dumps(data, separators=(",", ":")).encode()
+        if len(encoded_key) > 32:
+            raise ValueError(f"key {key} is longer than 32 bytes")
+        if len(payload) > self.slot_size - SLOT_HEADER_SIZE:
+            raise ValueError(f"state of {key} is {len(payload)} bytes, more than a slot")
+        with self._lock:
+            slot = self._find(key)
+            if slot is None:
+                slot = self._claim(key)
+            offset = self._offset(slot)
+            seq = _SEQ.unpack_from(self._buf, offset)[0]
+            _SEQ.pack_into(self._buf, offset, seq + 1)  # Odd: being written
+            start = offset + SLOT_HEADER_SIZE
+            self._buf[start : start + len(payload)] = payload
+            _SLOT.pack_into(self._buf, offset, seq + 1, time.time(), len(payload), encoded_key)
+            _SEQ.pack_into(self._buf, offset, seq + 2)
+        return seq + 2
+
+    def _claim(self, key: str) -> int:
+        for slot in range(self.slots):
+            if _SEQ.unpack_from(self._buf, self._offset(slot))[0] == 0:
+                self._index[key] = slot
+                return slot
+        raise ValueError(f"no free slot for {key}, all {self.slots} are taken")
+
+    def _read_slot(self, slot: int) -> Optional[Tuple[int, float, str, bytes]]:
+        """(seq, time, key, payload) of a consistent copy of <slot>, None if never written."""
+        offset = self._offset(slot)
+        for _ in range(READ_TRIES):
+            seq = _SEQ.unpack_from(self._buf, offset)[0]
+            if seq == 0:
+                return None
+            if seq & 1:
+                continue
+            _, published, length, key = _SLOT.unpack_from(self._buf, offset)
+            start = offset + SLOT_HEADER_SIZE
+            length = min(length, self.slot_size - SLOT_HEADER_SIZE)
+            payload = bytes(self._buf[start : start + length])
+            if _SEQ.unpack_from(self._buf, offset)[0] == seq:
+                return (seq, published, key.rstrip(b"\0").decode(), payload)
+        return None
+
+    def _find(self, key: str) -> Optional[int]:
+        slot = self._index.get(key)
+        if slot is not None:
+            return slot
+        for slot in range(self.slots):
+            found = self._read_slot(slot)
+            if found is None:
+                continue
+            self._index[found[2]] = slot
+            if found[2] == key:
+                return slot
+        return None
+
+    def read(self, key: str) -> Optional[Tuple[int, float, Any]]:
+        """(seq, publish time, state) of <key>, None if it was never published."""
+        slot = self._find(key)
+        if slot is None:
+            return None
+        found = self._read_slot(slot)
+        if found is None:
+            return None
+        seq, published, _, payload = found
+        return (seq, published, json.loads(payload))
+
+    def snapshot(self) -> Dict[str, Dict[str, Any]]:
+        """Every published state, by key: seq, time and data."""
+        states = {}
+        for slot in range(self.slots):
+            found = self._read_slot(slot)
+            if found is not None:
+                seq, published, key, payload = found
+                states[key] = {"seq": seq, "time": published, "data": json.loads(payload)}
+        return states
+
+    def close(self) -> None:
+        """Detach; the owner also removes the table."""
+        self._buf = None
+        self._shm.close()
+        if self.owner:
+            self._shm.unlink()
+            _owned.discard(self.name)
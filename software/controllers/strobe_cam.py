@@ -7,13 +7,17 @@ operation where the camera frame callback triggers the PIC microcontroller
 via GPIO.
 
 Classes:
+    FrameTag: Whether the strobe fired on a frame, and with what timing
     PiStrobeCam: Integrates camera and strobe for synchronized operation
 """
 
 import time
 import logging
+from collections import OrderedDict
+from dataclasses import dataclass
 from typing import Optional, Tuple, Any, cast
 
+from drivers import spi_handler
 from drivers.strobe import PiStrobe
 from drivers.spi_handler import GPIO  # Handles simulation mode automatically
 from drivers.camera import create_camera, BaseCamera
@@ -35,9 +39,34 @@ from config import (
 logger = logging.getLogger(__name__)
 
 # Constants
-MAX_FRAMERATE = 60  # Maximum framerate in FPS
+MAX_FRAMERATE = 60  # Maximum framerate in FPS at full sensor readout
 NS_TO_US = 1000  # Nanoseconds to microseconds conversion
 US_TO_NS = 1000  # Microseconds to nanoseconds conversion
+FRAME_TAGS_KEPT = 256  # Frames tagged ahead of the droplet detector, oldest dropped
+
+
+@dataclass
+class FrameTag:
+    """
+    The strobe event of one hardware-triggered frame, from the strobe event FIFO.
+
+    Attributes:
+        frame: Trigger number of the frame (PiStrobeCam.trigger_count)
+        strobed: True if channel A or B fired on it
+        channel_b: True if it was channel B that fired (alternate pattern), or both
+        period_ns: Strobe pulse period in force, 0 if not strobed
+        wait_ns: Strobe wait in force
+        gate_us: Camera read time (T1G gate width) the PIC measured
+        time_us: Event time on spi_handler.host_time_us() after sync_time()
+    """
+
+    frame: int
+    strobed: bool
+    channel_b: bool
+    period_ns: int
+    wait_ns: int
+    gate_us: int
+    time_us: int
 
 
 class PiStrobeCam:
@@ -105,6 +134,20 @@ class PiStrobeCam:
         # Initialize strobe controller
         self.strobe = PiStrobe(port, reply_pause_s)
         self.trigger_gpio_pin = trigger_gpio_pin
+        # Trigger pulses sent, the frame number of the last frame. The flow board counts
+        # the same pulses in frame sync mode, see reset_trigger_count().
+        self.trigger_count = 0
+        # Strobe events read, numbered as the trigger pulses, see read_frame_tags()
+        self.event_count = 0
+        self.frame_tags: "OrderedDict[int, FrameTag]" = OrderedDict()
+        # Frame period of the strobe PIC's frame clock, 0 while the camera runs freely
+        self.frame_clock_period_ns = 0
+        # Hardware ROI the sensor reads out, None for the full frame, and the framerate
+        # limit at it, see set_sensor_roi()
+        self.sensor_roi: Optional[Tuple[int, int, int, int]] = None
+        self.max_framerate: float = MAX_FRAMERATE
+        # Last (pre_padding_ns, strobe_period_ns, post_padding_ns) given to set_timing()
+        self.timing: Optional[Tuple[int, int, int]] = None
 
         # Initialize camera using abstraction layer (will be created when camera type is selected)
         # Create default camera (rpi) for initialization
@@ -152,12 +195,18 @@ class PiStrobeCam:
                 logger.error(f"Error configuring GPIO trigger pin: {e}")
                 raise
 
+        # What the strobe firmware handles, and CRC frames if it has them
+        caps_valid, caps = spi_handler.discover(self.strobe)
+        logger.info(f"Strobe capabilities: {caps if caps_valid else 'none'}")
+
         # Configure strobe trigger mode only for hardware trigger mode (camera-centric)
         # Old firmware may not support set_trigger_mode command, so only call it when needed
         if self.hardware_trigger_mode:
             try:
-                self.strobe.set_trigger_mode(True)
-                logger.debug("Strobe configured for hardware trigger mode")
+                if self.strobe.set_trigger_mode(True):
+                    logger.debug("Strobe configured for hardware trigger mode")
+                elif not spi_handler.supports(self.strobe, PiStrobe.PACKET_TYPE_SET_TRIGGER_MODE):
+                    logger.warning("Strobe firmware has no hardware trigger mode")
             except Exception as e:
                 logger.error(f"Error configuring strobe trigger mode: {e}")
                 raise
@@ -265,14 +314,69 @@ class PiStrobeCam:
         if not self.hardware_trigger_mode:
             logger.warning("frame_callback_trigger called but hardware trigger mode is disabled")
             return
+        if self.frame_clock_period_ns:
+            # The strobe PIC made this frame's edge itself
+            self.trigger_count += 1
+            return
         try:
             # Generate short pulse to PIC T1G input (hardware trigger)
             GPIO.output(self.trigger_gpio_pin, GPIO.HIGH)
             time.sleep(STROBE_TRIGGER_PULSE_US)  # 1us pulse (PIC detects edge)
             GPIO.output(self.trigger_gpio_pin, GPIO.LOW)
+            self.trigger_count += 1
         except Exception as e:
             logger.error(f"Error in frame callback trigger: {e}")
 
+    def reset_trigger_count(self) -> None:
+        """
+        Number the following trigger pulses from 1.
+
+        Call together with PiFlow.set_frame_sync(), which restarts the flow board's
+        count, so trigger_count is the frame tag of its samples.
+        """
+        self.trigger_count = 0
+        self.event_count = 0
+        self.frame_tags.clear()
+
+    def read_frame_tags(self) -> bool:
+        """
+        Drain the strobe event FIFO into frame_tags (hardware trigger mode).
+
+        The PIC queues one event per trigger edge, so the n-th event read since
+        reset_trigger_count() belongs to frame n. When the FIFO overflowed the count
+        is lost, and the events read are taken as those of the latest frames.
+
+        Returns:
+            bool: False if the events could not be read
+        """
+        valid, events, lost = self.strobe.get_strobe_events()
+        if lost:
+            self.event_count = max(self.event_count, self.trigger_count - len(events))
+        fired_flags = 0x01 | PiStrobe.EVENT_CHAN_B
+        for time_us, gate_us, flags in events:
+            self.event_count += 1
+            strobed = bool(flags & fired_flags)
+            self.frame_tags[self.event_count] = FrameTag(
+                frame=self.event_count,
+                strobed=strobed,
+                channel_b=bool(flags & PiStrobe.EVENT_CHAN_B),
+                period_ns=self.strobe_period_ns if strobed else 0,
+                wait_ns=self.strobe_wait_ns,
+                gate_us=gate_us,
+                time_us=time_us,
+            )
+        while len(self.frame_tags) > FRAME_TAGS_KEPT:
+            self.frame_tags.popitem(last=False)
+        return valid
+
+    def frame_tag(self, frame: Optional[int]) -> Optional[FrameTag]:
+        """The tag of trigger number <frame>, reading new events if it is not there yet."""
+        if frame is None or not self.hardware_trigger_mode:
+            return None
+        if frame not in self.frame_tags:
+            self.read_frame_tags()
+        return self.frame_tags.get(frame)
+
     def set_timing(self, pre_padding_ns: int, strobe_period_ns: int, post_padding_ns: int) -> bool:
         """
         Set strobe timing parameters.
@@ -295,6 +399,7 @@ class PiStrobeCam:
         Returns:
             True if timing was set successfully, False otherwise
         """
+        self.timing = (pre_padding_ns, strobe_period_ns, post_padding_ns)
         try:
             if self.hardware_trigger_mode:
                 # Hardware trigger mode: camera timing is independent, strobe waits for trigger
@@ -360,6 +465,54 @@ class PiStrobeCam:
             logger.error(f"Error in set_timing: {e}")
             return False
 
+    def set_phase_lock(self, phase: float) -> bool:
+        """
+        Hold the strobe at a fixed phase of the camera frame (hardware trigger mode).
+
+        The strobe PIC measures the frame period itself and restages the wait as the
+        camera drifts, so nothing is recalculated here from the requested framerate.
+
+        Args:
+            phase: Wait as a fraction of the frame period, 0 to stop following
+
+        Returns:
+            True if the firmware took it, False otherwise or without phase lock
+        """
+        if not self.hardware_trigger_mode and phase:
+            logger.warning("Strobe phase lock needs hardware trigger mode")
+            return False
+        valid, report = self.strobe.set_phase_lock(phase)
+        if valid:
+            logger.debug(
+                f"Strobe phase lock {report['phase']:.4f}, frame period {report['frame_period_ns']}ns"
+            )
+        return cast(bool, valid)
+
+    def set_frame_clock(self, framerate: float) -> bool:
+        """
+        Let the strobe PIC trigger the camera at a fixed frame rate (hardware trigger mode).
+
+        The PIC drives its frame clock pin, wired to the camera's external trigger
+        input, and fires the strobe from the same edges, so the frame callback only
+        counts frames. The camera itself must be set to external trigger.
+
+        Args:
+            framerate: Frames per second, 0 to stop and go back to the callback pulses
+
+        Returns:
+            True if the firmware took it, False otherwise or without a frame clock
+        """
+        if not self.hardware_trigger_mode and framerate:
+            logger.warning("Strobe frame clock needs hardware trigger mode")
+            return False
+        period_ns = int(round(1e9 / framerate)) if framerate else 0
+        valid, self.frame_clock_period_ns = self.strobe.set_frame_clock(period_ns)
+        if valid:
+            logger.debug(f"Strobe frame clock period {self.frame_clock_period_ns}ns")
+        else:
+            logger.warning(f"Strobe frame clock not set (framerate {framerate})")
+        return cast(bool, valid)
+
     def _set_strobe_timing(self, pre_padding_ns: int, strobe_period_ns: int) -> bool:
         """Set strobe timing on hardware."""
         wait_ns = pre_padding_ns
@@ -384,12 +537,13 @@ class PiStrobeCam:
         shutter_speed_us = int(total_exposure_ns / NS_TO_US)
         framerate = int(1000000 / shutter_speed_us)
 
-        # If framerate exceeds maximum, clamp it and recalculate shutter to match
-        if framerate > MAX_FRAMERATE:
-            framerate = MAX_FRAMERATE
+        # If framerate exceeds maximum at the sensor ROI, clamp it and recalculate shutter to match
+        max_framerate = int(self.max_framerate)
+        if framerate > max_framerate:
+            framerate = max_framerate
             shutter_speed_us = int(1000000 / framerate)
             logger.debug(
-                f"Framerate clamped to {MAX_FRAMERATE} FPS, shutter adjusted to {shutter_speed_us}us"
+                f"Framerate clamped to {max_framerate} FPS, shutter adjusted to {shutter_speed_us}us"
             )
 
         return framerate, shutter_speed_us
@@ -466,10 +620,53 @@ class PiStrobeCam:
         # For strobe-centric mode, camera is already running
         return True
 
+    def set_sensor_roi(self, roi: Optional[Tuple[int, int, int, int]]) -> bool:
+        """
+        Read out only <roi> on the sensor, and retime camera and strobe for it.
+
+        Fewer rows read out allow a higher framerate: the limit is taken from the
+        camera at the new ROI, and the last set_timing() is applied again under it.
+        get_frame_roi() then gets frames already cropped from the camera.
+
+        Args:
+            roi: (x, y, width, height), snapped to the camera's constraints, or None
+                 for the full sensor
+
+        Returns:
+            True if the camera took the ROI, False otherwise (for a ROI, the software
+            crop stays)
+        """
+        camera = self.camera
+        if camera is None or not hasattr(camera, "set_roi_hardware"):
+            return False
+        try:
+            if roi is None:
+                width, height = camera.get_max_resolution()
+                accepted = bool(camera.set_roi_hardware((0, 0, width, height)))
+            else:
+                if hasattr(camera, "validate_and_snap_roi"):
+                    roi = camera.validate_and_snap_roi(roi)
+                accepted = bool(camera.set_roi_hardware(roi))
+        except Exception as e:
+            logger.warning(f"Sensor ROI {roi} not set: {e}")
+            accepted = False
+        if roi is not None and not accepted:
+            return False
+
+        self.sensor_roi = roi
+        get_max_framerate = getattr(camera, "get_max_framerate", None)
+        self.max_framerate = (get_max_framerate and get_max_framerate()) or MAX_FRAMERATE
+        logger.info(f"Sensor ROI {roi or 'full frame'}: framerate limit {self.max_framerate:.1f}fps")
+        if self.timing is not None and not self.set_timing(*self.timing):
+            logger.warning("Strobe timing not applied again at the sensor ROI")
+        return accepted
+
     def get_frame_roi(self, roi: Tuple[int, int, int, int]) -> Optional[Any]:
         """
         Get ROI (Region of Interest) frame for droplet detection.
 
+        With a sensor ROI set (set_sensor_roi()) the camera returns it uncropped.
+
         Args:
             roi: Tuple of (x, y, width, height) defining the ROI
 
@@ -0,0 +1,363 @@
+"""
+Binary recorder for the module telemetry and history, for runs of hours.
+
+Each stream, e.g. "flow_telemetry" or "heater1_history", is a directory of chunk files
+of fixed size records, appended through a memory map, and an index.json with the record
+layout and the chunks in order. A chunk file is preallocated to CHUNK_RECORDS records
+after a HEADER_SIZE byte header, [magic][version U8][0][record size U32][capacity U32]
+[0 U32][count U64], little endian. The count is stored after the records it covers, so a
+chunk cut short by a power cut still reads back to its last whole batch.
+
+read_stream() maps the chunks straight into numpy structured arrays without parsing
+them, also while the recorder is still writing. Writing needs only the standard library.
+Readings are in the drivers' units; seq and time_us are unwrapped into U64s, the
+firmware's U16 and U32 counters running on across the wrap, so a board reset shows as a
+jump rather than a step back.
+
+    recorder = TelemetryRecorder("/data/run1")
+    flow.start_recording(recorder, telemetry_cycles=10)
+    ...
+    records = read_stream("/data/run1/flow_telemetry")
+    records["pressure_actual"][:, 0]
+"""
+
+import json
+import mmap
+import os
+import struct
+import time
+from threading import Lock
+from typing import Any, Callable, Dict, List, Optional, Sequence, Tuple
+
+CHUNK_MAGIC = b"RIOREC"
+CHUNK_VERSION = 1
+HEADER_SIZE = 64  # Records start aligned
+_HEADER = struct.Struct("<6sBxIII")
+_COUNT = struct.Struct("<Q")
+_COUNT_OFFSET = 16
+CHUNK_RECORDS = 65536  # Per chunk file, about two hours of 100 ms history
+INDEX_FILE = "index.json"
+
+# Field type -> (struct code, numpy type)
+FIELD_TYPES = {
+    "u8": ("B", "<u1"),
+    "u16": ("H", "<u2"),
+    "u32": ("I", "<u4"),
+    "u64": ("Q", "<u8"),
+    "i16": ("h", "<i2"),
+    "f32": ("f", "<f4"),
+}
+
+# Fields unwrapped into U64, by the bits of the firmware counter
+UNWRAP_BITS = {"seq": 16, "time_us": 32}
+
+
+class RecordLayout:
+    def __init__(self, fields: Sequence[Tuple[str, str, Tuple[int, ...]]]):
+        """
+        Args:
+            fields: (name, type, shape) in order, type from FIELD_TYPES and shape () for
+                a single value, (n,) for a list of n, (n, k) for n lists of k
+        """
+        self.fields = tuple((name, type_, tuple(shape)) for name, type_, shape in fields)
+        codes = ""
+        for _, type_, shape in self.fields:
+            count = 1
+            for n in shape:
+                count *= n
+            codes += FIELD_TYPES[type_][0] * count
+        self.struct = struct.Struct("<" + codes)
+        self.size = self.struct.size
+
+    def describe(self) -> List[list]:
+        """The fields as stored in index.json"""
+        return [[name, type_, list(shape)] for name, type_, shape in self.fields]
+
+    @classmethod
+    def from_description(cls, description) -> "RecordLayout":
+        return cls([(name, type_, tuple(shape)) for name, type_, shape in description])
+
+    def dtype(self):
+        """The numpy dtype of a record, packed as written"""
+        import numpy as np
+
+        return np.dtype(
+            [
+                (name, FIELD_TYPES[type_][1]) + ((shape,) if shape else ())
+                for name, type_, shape in self.fields
+            ]
+        )
+
+    def pack(self, values: Dict[str, Any]) -> bytes:
+        flat: List[Any] = []
+        for name, _, shape in self.fields:
+            value = values[name]
+            if len(shape) == 2:
+                for row in value:
+                    flat.extend(row)
+            elif shape:
+                flat.extend(value)
+            else:
+                flat.append(value)
+        return self.struct.pack(*flat)
+
+
+def flow_telemetry_layout(channels: int) -> RecordLayout:
+    """PiFlow.read_telemetry() samples"""
+    return RecordLayout(
+        [
+            ("seq", "u64", ()),
+            ("time_us", "u64", ()),
+            ("frame", "u32", ()),
+            ("pressure_actual", "f32", (channels,)),
+            ("flow_actual", "i16", (channels,)),
+        ]
+    )
+
+
+def flow_history_layout(channels: int) -> RecordLayout:
+    """PiFlow.read_history() records"""
+    return RecordLayout(
+        [
+            ("seq", "u64", ()),
+            ("time_us", "u64", ()),
+            ("pressure_actual", "f32", (channels,)),
+            ("pressure_output", "f32", (channels,)),
+            ("flow_actual", "i16", (channels,)),
+            ("pid_terms", "i16", (channels, 3)),
+        ]
+    )
+
+
+def heater_history_layout() -> RecordLayout:
+    """PiHolder.read_history() records, flags as a bit mask of PiHolder.HISTORY_FLAGS"""
+    return RecordLayout(
+        [
+            ("seq", "u64", ()),
+            ("time_us", "u64", ()),
+            ("temp_c", "f32", ()),
+            ("target_c", "f32", ()),
+            ("heater_output", "u16", ()),
+            ("pid_terms", "f32", (3,)),
+            ("stir_speed_rps", "u16", ()),
+            ("stir_output", "u8", ()),
+            ("flags", "u8", ()),
+        ]
+    )
+
+
+class RecordStream:
+    """One stream directory, appended by one writer."""
+
+    def __init__(
+        self,
+        path: str,
+        layout: RecordLayout,
+        chunk_records: int = CHUNK_RECORDS,
+        convert: Optional[Dict[str, Callable[[Any], Any]]] = None,
+    ):
+        """
+        Args:
+            path: Stream directory, created if missing. A stream already there is
+                continued in a new chunk, if its layout matches.
+            layout: Record layout, one field per record dict key
+            chunk_records: Records per chunk file
+            convert: field -> function of a record's value, for values that are not
+                numbers or lists of them
+        """
+        self.path = path
+        self.layout = layout
+        self.chunk_records = chunk_records
+        self.convert = convert or {}
+        self.records = 0
+        self._file = None
+        self._map = None
+        self._count = 0
+        self._last: Dict[str, Tuple[int, int]] = {}  # field -> (last raw, last unwrapped)
+        os.makedirs(path, exist_ok=True)
+        self.index: Dict[str, Any] = {
+            "version": CHUNK_VERSION,
+            "fields": layout.describe(),
+            "chunk_records": chunk_records,
+            "chunks": [],
+        }
+        index_path = os.path.join(path, INDEX_FILE)
+        if os.path.exists(index_path):
+            with open(index_path) as f:
+                index = json.load(f)
+            if index["fields"] != self.index["fields"]:
+                raise ValueError(f"{path} holds records of another layout")
+            self.index["chunks"] = index["chunks"]
+
+    def append(self, records: List[Dict[str, Any]]) -> int:
+        """Add record dicts, as the drivers return them. Returns the records added."""
+        packed = []
+        times = []
+        for record in records:
+            values = dict(record)
+            for name, convert in self.convert.items():
+                values[name] = convert(values[name])
+            for name, bits in UNWRAP_BITS.items():
+                if name in values:
+                    values[name] = self._unwrap(name, bits, values[name])
+            packed.append(self.layout.pack(values))
+            times.append(values.get("time_us"))
+        self._write(packed, times)
+        return len(records)
+
+    def _unwrap(self, name: str, bits: int, raw: int) -> int:
+        last = self._last.get(name)
+        value = raw if last is None else last[1] + ((raw - last[0]) % (1 << bits))
+        self._last[name] = (raw, value)
+        return value
+
+    def _write(self, packed: List[bytes], times: List[Optional[int]]):
+        size = self.layout.size
+        done = 0
+        while done < len(packed):
+            if self._map is None or self._count == self.chunk_records:
+                self._next_chunk()
+            take = min(len(packed) - done, self.chunk_records - self._count)
+            offset = HEADER_SIZE + self._count * size
+            self._map[offset : offset + take * size] = b"".join(packed[done : done + take])
+            self._count += take
+            _COUNT.pack_into(self._map, _COUNT_OFFSET, self._count)  # After the records
+            entry = self.index["chunks"][-1]
+            entry["records"] = self._count
+            if times[done] is not None:
+                entry.setdefault("first_time_us", times[done])
+                entry["last_time_us"] = times[done + take - 1]
+            done += take
+        self.records += len(packed)
+
+    def _next_chunk(self):
+        self._close_chunk()
+        name = f"{len(self.index['chunks']):06d}.rec"
+        self._file = open(os.path.join(self.path, name), "w+b")
+        self._file.write(
+            _HEADER.pack(CHUNK_MAGIC, CHUNK_VERSION, self.layout.size, self.chunk_records, 0)
+        )
+        self._file.truncate(HEADER_SIZE + self.chunk_records * self.layout.size)  # Sparse
+        self._map = mmap.mmap(self._file.fileno(), 0)
+        self._count = 0
+        self.index["chunks"].append({"file": name, "records": 0, "started": time.time()})
+        self._write_index()
+
+    def _close_chunk(self):
+        if self._map is None:
+            return
+        self._map.flush()
+        self._map.close()
+        self._file.close()
+        self._map = self._file = None
+        self._write_index()
+
+    def _write_index(self):
+        index_path = os.path.join(self.path, INDEX_FILE)
+        with open(index_path + ".tmp", "w") as f:
+            json.dump(self.index, f, indent=1)
+        os.replace(index_path + ".tmp", index_path)
+
+    def flush(self):
+        """Write the open chunk and the index out to the file system."""
+        if self._map is not None:
+            self._map.flush()
+            self._write_index()
+
+    def close(self):
+        self._close_chunk()
+
+
+class TelemetryRecorder:
+    """The streams of one run, under one directory."""
+
+    def __init__(self, directory: str, chunk_records: int = CHUNK_RECORDS):
+        self.directory = directory
+        self.chunk_records = chunk_records
+        self.streams: Dict[str, RecordStream] = {}
+        self._lock = Lock()
+        os.makedirs(directory, exist_ok=True)
+
+    def record(
+        self,
+        name: str,
+        layout: RecordLayout,
+        records: List[Dict[str, Any]],
+        convert: Optional[Dict[str, Callable[[Any], Any]]] = None,
+    ) -> int:
+        """Append <records> to the stream <name>, opened on first use. Returns the count."""
+        if not records:
+            return 0
+        with self._lock:
+            stream = self.streams.get(name)
+            if stream is None:
+                stream = self.streams[name] = RecordStream(
+                    os.path.join(self.directory, name), layout, self.chunk_records, convert
+                )
+            return stream.append(records)
+
+    def flush(self):
+        with self._lock:
+            for stream in self.streams.values():
+                stream.flush()
+
+    def close(self):
+        with self._lock:
+            for stream in self.streams.values():
+                stream.close()
+            self.streams = {}
+
+
+def _read_index(path: str) -> Tuple[Dict[str, Any], RecordLayout]:
+    with open(os.path.join(path, INDEX_FILE)) as f:
+        index = json.load(f)
+    return index, RecordLayout.from_description(index["fields"])
+
+
+def stream_chunks(path: str) -> list:
+    """
+    The records of each chunk of the stream directory <path> as numpy arrays, memory
+    mapped read only, up to the count in each chunk's header.
+    """
+    import numpy as np
+
+    index, layout = _read_index(path)
+    dtype = layout.dtype()
+    chunks = []
+    for entry in index["chunks"]:
+        chunk_path = os.path.join(path, entry["file"])
+        with open(chunk_path, "rb") as f:
+            header = f.read(HEADER_SIZE)
+        magic, version, record_size, capacity, _ = _HEADER.unpack_from(header)
+        if magic != CHUNK_MAGIC or version != CHUNK_VERSION or record_size != dtype.itemsize:
+            raise ValueError(f"{chunk_path} is not a chunk of this stream")
+        count = min(_COUNT.unpack_from(header, _COUNT_OFFSET)[0], capacity)
+        if count:
+            chunks.append(
+                np.memmap(chunk_path, dtype=dtype, mode="r", offset=HEADER_SIZE, shape=(count,))
+            )
+    return chunks
+
+
+def read_stream(path: str):
+    """
+    All records of the stream directory <path> as one numpy array. A single chunk is its
+    memory map as it is, more are joined into one array in memory.
+    """
+    import numpy as np
+
+    chunks = stream_chunks(path)
+    if len(chunks) == 1:
+        return chunks[0]
+    if not chunks:
+        return np.empty(0, dtype=_read_index(path)[1].dtype())
+    return np.concatenate(chunks)
+
+
+def read_run(directory: str) -> dict:
+    """read_stream() of every stream of a run, by stream name."""
+    return {
+        name: read_stream(os.path.join(directory, name))
+        for name in sorted(os.listdir(directory))
+        if os.path.exists(os.path.join(directory, name, INDEX_FILE))
+    }
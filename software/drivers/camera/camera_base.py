@@ -185,6 +185,18 @@ class BaseCamera(ABC):
         """
         return int(self.config.get("ShutterSpeed", 10000))
 
+    def get_max_framerate(self) -> Optional[float]:
+        """
+        Get the highest framerate the sensor can read out at the current ROI.
+
+        A hardware ROI with fewer rows reads out faster, so this rises as the ROI
+        shrinks. The default implementation does not know the sensor.
+
+        Returns:
+            float: Maximum framerate in FPS, or None if unknown
+        """
+        return None
+
     def list_features(self) -> list:
         """
         List available camera features for UI
@@ -239,6 +239,22 @@ class MakoCamera(BaseCamera):
             print(f"Failed to set hardware ROI on Mako camera: {e}")
             return False
 
+    def get_max_framerate(self) -> Optional[float]:
+        """
+        Get the highest framerate the sensor can read out at the current ROI.
+
+        Returns:
+            float: AcquisitionFrameRateLimit of the camera, or None if unavailable
+        """
+        if self.cam is None:
+            return None
+        try:
+            with Vimba.get_instance():
+                with self.cam:
+                    return float(self.cam.AcquisitionFrameRateLimit.get())
+        except (AttributeError, VimbaFeatureError, VimbaCameraError):
+            return None
+
     def get_max_resolution(self) -> Tuple[int, int]:
         """
         Get maximum sensor resolution for Mako camera
@@ -532,6 +532,25 @@ class PiCameraV2(BaseCamera):
         except (AttributeError, ValueError):
             return float(self.config.get("FrameRate", 30))
 
+    def get_max_framerate(self) -> Optional[float]:
+        """
+        Get the highest framerate of the sensor mode in use.
+
+        From the shortest FrameDurationLimits libcamera reports for the configured mode.
+        The hardware ROI is a ScalerCrop, cropped by the ISP after a full readout, so it
+        does not raise this.
+
+        Returns:
+            float: Maximum framerate in FPS, or None if the limits are unknown
+        """
+        if self.cam is None:
+            return None
+        try:
+            min_frame_us = self.cam.camera_controls["FrameDurationLimits"][0]
+            return 1e6 / float(min_frame_us) if min_frame_us > 0 else None
+        except (AttributeError, KeyError, IndexError, TypeError, ValueError):
+            return None
+
     def get_actual_shutter_speed(self) -> int:
         """
         Get actual shutter speed from camera hardware.
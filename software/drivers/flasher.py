@@ -0,0 +1,311 @@
+"""
+Firmware update of the dsPIC modules over SPI.
+
+Writes an MPLAB X .hex build into a module's inactive flash partition with the
+FLASH packet (hardware-modules/common/rio_flash) while the module keeps running,
+has the module check its CRC-32, then commits it and resets the module into it.
+A failed or interrupted update leaves the running firmware booting as before, so
+the update can simply be run again.
+
+Usage:
+    python -m drivers.flasher flow=pressure_and_flow_pic.hex
+        heater1,heater2=sample_holder_pic.hex [--clock 30000] [--no-reset]
+
+The modules are updated one after the other, each from its own image. They must
+have been programmed once with a dual partition build, see the rio_flash README.
+Runs against the simulated boards with RIO_SIMULATION=true, and against the real
+firmware with RIO_SIM_FIRMWARE as well (simulation/firmware_simulated.py).
+"""
+
+import argparse
+import binascii
+import json
+import logging
+import time
+from typing import Any, Callable, Dict, List, Optional, Tuple
+
+from drivers import spi_handler
+from drivers.flow import PiFlow
+from drivers.heater import PiHolder
+
+logger = logging.getLogger(__name__)
+
+# device name -> (driver class, port)
+DEVICES = {
+    "flow": (PiFlow, spi_handler.PORT_FLOW),
+    "heater1": (PiHolder, spi_handler.PORT_HEATER1),
+    "heater2": (PiHolder, spi_handler.PORT_HEATER2),
+    "heater3": (PiHolder, spi_handler.PORT_HEATER3),
+    "heater4": (PiHolder, spi_handler.PORT_HEATER4),
+}
+
+ERASED = 0xFFFFFF
+FBTSEQ = 0x015FFC  # Program address of the boot sequence dword, written by COMMIT only
+CHUNK_WORDS = 32  # Instructions per WRITE, 101 bytes of data
+WRITE_RETRIES = 3  # A rewrite of the same words is harmless, flash only clears bits
+POLL_S = 0.02  # Between STATUS queries while the module erases or checks
+
+
+class FlashError(Exception):
+    pass
+
+
+def read_hex(path: str) -> Dict[int, int]:
+    """
+    Instructions of an Intel HEX file from the XC16 toolchain.
+
+    Returns:
+        dict: program address -> instruction U24. The file has four bytes per
+        instruction at twice its program address, the fourth (phantom) byte is dropped.
+    """
+    memory: Dict[int, int] = {}
+    upper = 0
+    with open(path) as f:
+        for number, line in enumerate(f, 1):
+            line = line.strip()
+            if not line:
+                continue
+            try:
+                if not line.startswith(":"):
+                    raise ValueError("no start code")
+                raw = bytes.fromhex(line[1:])
+                if len(raw) < 5 or len(raw) != raw[0] + 5 or sum(raw) & 0xFF:
+                    raise ValueError("bad length or checksum")
+            except ValueError as e:
+                raise FlashError(f"{path}:{number}: {e}") from e
+            count, offset, record = raw[0], int.from_bytes(raw[1:3], "big"), raw[3]
+            payload = raw[4 : 4 + count]
+            if record == 0:
+                for i, byte in enumerate(payload):
+                    memory[upper + offset + i] = byte
+            elif record == 1:
+                break
+            elif record == 2:
+                upper = int.from_bytes(payload, "big") << 4
+            elif record == 4:
+                upper = int.from_bytes(payload, "big") << 16
+
+    words: Dict[int, int] = {}
+    for byte_addr, byte in memory.items():
+        if byte_addr % 4 == 3:
+            continue
+        addr = (byte_addr // 4) * 2
+        shift = 8 * (byte_addr % 4)
+        words[addr] = (words.get(addr, ERASED) & ~(0xFF << shift)) | (byte << shift)
+    return words
+
+
+def image_chunks(words: Dict[int, int], partition_size: int) -> List[Tuple[int, List[int]]]:
+    """
+    The WRITE chunks of an image: runs of whole dwords (two instructions) within the
+    partition, CHUNK_WORDS at most, leaving out the erased dwords and FBTSEQ. Words
+    past the partition (configuration words in FBOOT, the device ID) are not written.
+    """
+    dwords = sorted(
+        {
+            addr & ~3
+            for addr, word in words.items()
+            if addr < partition_size and word != ERASED and addr & ~3 != FBTSEQ
+        }
+    )
+    chunks: List[Tuple[int, List[int]]] = []
+    for base in dwords:
+        pair = [words.get(base, ERASED), words.get(base + 2, ERASED)]
+        if chunks and chunks[-1][0] + 2 * len(chunks[-1][1]) == base:
+            if len(chunks[-1][1]) < CHUNK_WORDS:
+                chunks[-1][1].extend(pair)
+                continue
+        chunks.append((base, pair))
+    return chunks
+
+
+def image_crc(chunks: List[Tuple[int, List[int]]]) -> Tuple[int, int]:
+    """(size, CRC-32) of the partition from 0 to the end of the last chunk, as VERIFY checks it."""
+    if not chunks:
+        return (0, 0)
+    size = chunks[-1][0] + 2 * len(chunks[-1][1])
+    words = {addr + 2 * i: word for addr, run in chunks for i, word in enumerate(run)}
+    image = b"".join(words.get(addr, ERASED).to_bytes(3, "little") for addr in range(0, size, 2))
+    return (size, binascii.crc32(image))
+
+
+class Flasher:
+    """Firmware update of one module, see the module docstring."""
+
+    def __init__(self, device, packet_type: int, timeout_s: float = 30.0):
+        """
+        Args:
+            device: PiFlow or PiHolder of the module
+            packet_type: Its FLASH packet type
+            timeout_s: Longest wait for the erase, the CRC or the module to come back
+        """
+        self.device = device
+        self.packet_type = packet_type
+        self.timeout_s = timeout_s
+
+    def query(self, op: int, data=()) -> Dict[str, Any]:
+        valid, status = spi_handler.flash_query(self.device, self.packet_type, op, data)
+        if not valid:
+            raise FlashError(f"FLASH op {op} failed, rc {status.get('rc', 'none')}")
+        return status
+
+    def status(self) -> Dict[str, Any]:
+        return self.query(spi_handler.FLASH_OP_STATUS)
+
+    def wait_state(self, busy: str) -> Dict[str, Any]:
+        """STATUS until the module leaves the <busy> state."""
+        deadline = time.monotonic() + self.timeout_s
+        status = self.status()
+        while status["state"] == busy:
+            if time.monotonic() > deadline:
+                raise FlashError(f"still {busy} after {self.timeout_s} s")
+            time.sleep(POLL_S)
+            status = self.status()
+        return status
+
+    def write(self, addr: int, run: List[int]):
+        data = list(addr.to_bytes(4, "little"))
+        for word in run:
+            data += list(word.to_bytes(3, "little"))
+        for attempt in range(WRITE_RETRIES):
+            valid, status = spi_handler.flash_query(
+                self.device, self.packet_type, spi_handler.FLASH_OP_WRITE, data
+            )
+            if valid:
+                return
+            if "rc" in status:
+                raise FlashError(f"WRITE at 0x{addr:06X} refused, rc {status['rc']}")
+        raise FlashError(f"WRITE at 0x{addr:06X} lost {WRITE_RETRIES} times")
+
+    def update(
+        self,
+        words: Dict[int, int],
+        reset: bool = True,
+        progress: Optional[Callable[[int, int], None]] = None,
+    ) -> Dict[str, Any]:
+        """
+        Write, check and commit an image, then reset into it.
+
+        Args:
+            words: Image as read_hex()
+            reset: False to leave the committed image to boot at the next power up
+            progress: Called with (chunks written, chunks) after each WRITE
+
+        Returns:
+            dict: ok, error (None when ok), boot_seq before and after, words, chunks,
+            crc and seconds
+        """
+        start = time.monotonic()
+        result: Dict[str, Any] = {"ok": False, "error": None, "boot_seq_after": None}
+        try:
+            status = self.status()
+            result["boot_seq_before"] = status["boot_seq"]
+            chunks = image_chunks(words, status["partition_size"])
+            size, crc = image_crc(chunks)
+            result.update(words=sum(len(run) for _, run in chunks), chunks=len(chunks), crc=crc)
+            if not chunks:
+                raise FlashError("nothing to write in the image")
+
+            self.query(spi_handler.FLASH_OP_ERASE)
+            if self.wait_state("erasing")["state"] != "ready":
+                raise FlashError("erase failed")
+            for index, (addr, run) in enumerate(chunks):
+                self.write(addr, run)
+                if progress:
+                    progress(index + 1, len(chunks))
+
+            verify = list(size.to_bytes(4, "little")) + list(crc.to_bytes(4, "little"))
+            self.query(spi_handler.FLASH_OP_VERIFY, verify)
+            status = self.wait_state("verifying")
+            if status["state"] != "verified":
+                raise FlashError(f"CRC 0x{status['crc']:08X}, expected 0x{crc:08X}")
+            self.query(spi_handler.FLASH_OP_COMMIT)
+
+            if reset:
+                self.query(spi_handler.FLASH_OP_RESET)
+                result["boot_seq_after"] = self.wait_boot()
+                expected = result["boot_seq_before"] - 1
+                if result["boot_seq_before"] == spi_handler.FLASH_SEQ_INVALID:
+                    expected = spi_handler.FLASH_SEQ_INVALID - 1
+                if result["boot_seq_after"] != expected:
+                    raise FlashError(f"booted sequence {result['boot_seq_after']}, not {expected}")
+            result["ok"] = True
+        except FlashError as e:
+            result["error"] = str(e)
+        result["seconds"] = round(time.monotonic() - start, 3)
+        return result
+
+    def wait_boot(self) -> int:
+        """The boot sequence once the module answers again after its reset."""
+        deadline = time.monotonic() + self.timeout_s
+        while True:
+            time.sleep(POLL_S)
+            try:
+                return self.status()["boot_seq"]
+            except FlashError:
+                if time.monotonic() > deadline:
+                    raise FlashError(f"no answer {self.timeout_s} s after the reset")
+
+
+def _updates(text: str) -> Tuple[List[str], str]:
+    names, _, path = text.partition("=")
+    if not path:
+        raise argparse.ArgumentTypeError(f"{text}: expected device[,device...]=image.hex")
+    return ([name for name in names.split(",") if name], path)
+
+
+def main(argv: Optional[List[str]] = None) -> List[Dict[str, Any]]:
+    """Main entry point."""
+    parser = argparse.ArgumentParser(description="Update the firmware of Rio modules over SPI")
+    parser.add_argument(
+        "updates",
+        nargs="+",
+        type=_updates,
+        help="device[,device...]=image.hex, devices from " + ", ".join(DEVICES),
+    )
+    parser.add_argument("--clock", type=int, default=30000, help="SPI clock in Hz")
+    parser.add_argument(
+        "--no-reset", action="store_true", help="Commit only, boot the new image at power up"
+    )
+    parser.add_argument("--timeout-s", type=float, default=30.0, help="Longest wait per step")
+    parser.add_argument("--output", type=str, help="Also save the results to this JSON file")
+    args = parser.parse_args(argv)
+    images = {}
+    for names, path in args.updates:
+        if any(name not in DEVICES for name in names):
+            parser.error(f"devices must be from {', '.join(DEVICES)}")
+        try:
+            images[path] = read_hex(path)
+        except (OSError, FlashError) as e:
+            parser.error(str(e))
+
+    results = []
+    spi_handler.spi_init(0, 2, args.clock)
+    try:
+        for names, path in args.updates:
+            words = images[path]
+            for name in names:
+                cls, port = DEVICES[name]
+                flasher = Flasher(cls(port, 0.002), cls.PACKET_TYPE_FLASH, args.timeout_s)
+                result = flasher.update(words, reset=not args.no_reset)
+                result.update(device=name, image=path)
+                results.append(result)
+                outcome = "ok" if result["ok"] else f"FAILED: {result['error']}"
+                print(
+                    f"{name}: {path}, {result.get('words', 0)} words in "
+                    f"{result['seconds']} s, boot sequence {result.get('boot_seq_before')} -> "
+                    f"{result['boot_seq_after']}, {outcome}"
+                )
+    finally:
+        spi_handler.spi_close()
+
+    if args.output:
+        with open(args.output, "w") as f:
+            json.dump(results, f, indent=2)
+        print(f"\nResults saved to {args.output}")
+    return results
+
+
+if __name__ == "__main__":
+    logging.basicConfig(level=logging.INFO)
+    main()
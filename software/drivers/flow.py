@@ -1,5 +1,6 @@
 import sys
 import os
+import math
 
 # Check for simulation mode
 SIMULATION_MODE = os.getenv("RIO_SIMULATION", "false").lower() == "true"
@@ -14,99 +15,215 @@ parent_dir = os_module.path.dirname(os_module.path.dirname(os_module.path.abspat
 if parent_dir not in sys_module.path:
     sys_module.path.insert(0, parent_dir)
 from drivers import spi_handler  # noqa: E402
+from drivers import pressure_protocol  # noqa: E402
 
 # Note: spi_handler.spi is a global variable set by spi_init()
 # We access it as spi_handler.spi after initialization
 # spi_handler handles simulation mode automatically
 
 
-class PiFlow:
+class PiFlow(pressure_protocol.PressurePackets):
+    # Packet types are generated from pressure_and_flow_pic/protocol.json, as are the
+    # reply layouts decoded below
     DEVICE_ID = "MICROFLOW"
     STX = 2
     PRESSURE_SHIFT = 3
     PRESSURE_SCALE = 1 << PRESSURE_SHIFT
 
-    PACKET_TYPE_GET_ID = 1
-    PACKET_TYPE_SET_PRESSURE_TARGET = 2
-    PACKET_TYPE_GET_PRESSURE_TARGET = 3
-    PACKET_TYPE_GET_PRESSURE_ACTUAL = 4
-    PACKET_TYPE_SET_FLOW_TARGET = 5
-    PACKET_TYPE_GET_FLOW_TARGET = 6
-    PACKET_TYPE_GET_FLOW_ACTUAL = 7
-    PACKET_TYPE_SET_CONTROL_MODE = 8
-    PACKET_TYPE_GET_CONTROL_MODE = 9
-    PACKET_TYPE_SET_FPID_CONSTS = 10
-    PACKET_TYPE_GET_FPID_CONSTS = 11
+    TELEMETRY_TYPES = (
+        pressure_protocol.PressurePackets.PACKET_TYPE_TELEMETRY_SAMPLE,
+        pressure_protocol.PressurePackets.PACKET_TYPE_TELEMETRY_COMPACT,
+    )
 
-    NUM_CONTROLLERS = 4
+    # SET_TELEMETRY and HISTORY_STREAM record formats, main.c RECORD_FORMAT_*
+    RECORD_FORMAT_PLAIN = 0
+    RECORD_FORMAT_COMPACT = 1
+
+    # SET_FRAME_SYNC modes, main.c FRAME_SYNC_*
+    FRAME_SYNC_OFF = 0
+    FRAME_SYNC_RISING = 1
+    FRAME_SYNC_FALLING = 2
+
+    # Parameter ids, main.c PARAM_ID_*, for get_params() / set_params(). Per channel
+    # parameters are base + channel, e.g. PARAM_IDS["fpid_p"] + 2, with bit 7 set for
+    # channels 4-7 of an 8 channel board, see param_id().
+    PARAM_IDS = {
+        "adc_period_ms": 0x01,
+        "i2c_fast_plus": 0x02,  # 1 runs I2C at 1 MHz, not stored
+        "flow_monitor_div": 0x03,  # Cycles per flow read of a channel not in a flow mode
+        "warm_start": 0x06,  # 1 starts a loop from its last settled state or output map, not stored
+        "ctrl_event": 0x07,  # 1 updates each channel as soon as its own samples are in, not stored
+        "module_addr": 0x08,  # Address of addressed BATCHes, see set_module_addr()
+        "retain_status": 0x09,  # Last reset: 0 cold, 1 watchdog with the loops resumed, 2 lost
+        "trace_mask": 0x0A,  # TRACE_NAMES bits on trace pin 0, see set_trace()
+        "trace_mask1": 0x0B,  # And on trace pin 1
+        "fpid_p": 0x10,
+        "fpid_i": 0x14,
+        "fpid_d": 0x18,
+        "ppid_p": 0x20,
+        "ppid_i": 0x24,
+        "ppid_d": 0x28,
+        "adc_data_rate": 0x30,  # ADC_DATA_RATES_SPS code
+        "flow_ff_r": 0x34,
+        "adc_gain": 0x38,  # ADC_FSR_V index, or ADC_GAIN_AUTO
+        "adc_mux": 0x3C,  # ADC_MUX_INPUTS index
+        "flow_raw_actual": 0x40,  # Read only
+        "flow_resolution": 0x44,  # Flow sensor bits, 9-16
+        "flow_crc_check": 0x48,  # 0 takes flow readings without the CRC check
+        "flow_crc_errors": 0x4C,  # Read only, readings rejected by the CRC check
+        "flow_flags_gate": 0x50,  # 0 reads no sensor flags and never holds the flow loop
+        "flow_air_events": 0x54,  # Read only, air-in-line flag rises
+        "flow_high_events": 0x58,  # Read only, high-flow flag rises
+        "flow_res_r": 0x5C,  # Read only, R estimate, mbar per 1000 ul/hr
+        "flow_res_ref": 0x60,  # Reference R, 0 turns the clog and leak watch off
+        "flow_res_state": 0x64,  # Read only, FLOW_RES_STATES index
+        "pressure_limit": 0x68,  # mbar, stored, 0 off; over it the channel is cut to mode 0
+        "pressure_trips": 0x6C,  # Read only, overpressure cut-offs since reset
+        "adc_burst": 0x70,  # Conversions averaged per cycle, 1-16, stored
+        "pressure_cal_zero": 0x74,  # mbar << PRESSURE_SHIFT read at 0 mbar, +-500 mbar, stored
+        "pressure_cal_trim": 0x78,  # Span 1 + trim / 2048, -128 to 127, stored
+        "flow_est_shift": 0x7C,  # Flow estimate between readings, reading weight 1/2**n, 0-6, 0 off
+    }
+
+    # Fault log ids, main.c FAULT_ID_*, see get_fault_log()
+    FAULT_NAMES = {
+        0: "reset",
+        1: "flow_not_present",
+        2: "flow_read_fail",
+        3: "i2c_abort",
+        4: "adc_timeout",
+        5: "flow_crc_fail",
+        6: "flow_lost",
+        7: "flow_recovered",
+        8: "i2c_stuck",  # arg 1 if the bus recovery freed SDA
+        9: "flow_autotune_fail",  # arg channel << 8 | FLOW_AUTOTUNE_FAILS index
+        10: "flow_clog",  # arg channel << 8 | R as % of the reference
+        11: "flow_leak",  # arg channel << 8 | R as % of the reference
+        12: "overpressure",  # arg channel << 16 | mbar
+    }
+
+    # Clog and leak watch states, main.c E_FLOW_RES_STATE
+    FLOW_RES_STATES = ("ok", "clog", "leak")
+
+    # SET_FLOW_AUTOTUNE states and fail reasons, main.c E_FTUNE_STATE and E_FTUNE_FAIL
+    FLOW_AUTOTUNE_STATES = ("none", "running", "stopped", "finished", "failed")
+    FLOW_AUTOTUNE_FAILS = ("none", "cycles", "timeout", "flow_lost")
+
+    # PRESSURE_CAL zero capture states, main.c E_PCAL_STATE
+    PRESSURE_CAL_STATES = ("none", "running", "stopped", "finished", "failed")
+
+    # SET_FLOW_SCHED points per channel, common.h NUM_FLOW_SCHED_POINTS
+    FLOW_SCHED_POINTS = 4
+
+    # GET_I2C_STATS devices, i2c_bus.h I2C_DEV_*
+    I2C_DEVICES = ("adc", "mux", "flow")
+
+    # Execution time probes, in probe_port.h order
+    PROBE_NAMES = ("loop", "i2c", "cycle", "update_outputs", "packet")
+
+    # Trace regions, in probe_port.h TRACE_* order, see set_trace()
+    TRACE_NAMES = (
+        "isr_timer",
+        "isr_adc_rdy",
+        "isr_frame_sync",
+        "isr_spi",
+        "i2c_wait",
+        "cycle",
+        "update_outputs",
+        "packet",
+    )
+
+    # Benchmark kernels, in bench_port.h order
+    BENCH_NAMES = ("null", "frame_checksum", "frame_crc", "flow_pid", "pressure_pid")
+
+    # Setpoint profiles: points per channel, points per SET_PROFILE_POINTS packet, SET_PROFILE flags
+    PROFILE_LEN = 16
+    PROFILE_CHUNK_POINTS = 8
+    PROFILE_FLAG_LOOP = 0x01
+    PROFILE_FLAG_PRESSURE = 0x02
+
+    # SET_FLOW_FF flags
+    FLOW_FF_ENABLE = 0x01
+    FLOW_FF_LEARN = 0x02
+
+    # SET_SIGNAL_FILTER signals, and the Q14 biquad coefficients (b0, b1, b2, a1, a2)
+    FILTER_SIGNAL_PRESSURE = 0
+    FILTER_SIGNAL_FLOW = 1
+    FILTER_COEFF_ONE = 1 << 14
+    FILTER_PASSTHROUGH = (FILTER_COEFF_ONE, 0, 0, 0, 0)
+
+    NUM_CONTROLLERS = 4  # 4 or 8, main.c NUM_PRESSURE_CLTRLS, see detect_channels()
+    HISTORY_REPLY_MAX = 4  # Records per GET_HISTORY reply, 2 with 8 channels
+    ADC_DATA_RATES_SPS = (8, 16, 32, 64, 128, 250, 475, 860)  # ADS1115 data rate codes 0-7
+    ADC_FSR_V = (6.144, 4.096, 2.048, 1.024, 0.512, 0.256)  # ADS1115 PGA codes 0-5
+    ADC_GAIN_AUTO = 7  # SET_ADC_CONFIG gain that auto-ranges
+    ADC_MUX_INPUTS = (  # ADS1115 mux codes 0-7, differential then single ended
+        "AIN0-AIN1",
+        "AIN0-AIN3",
+        "AIN1-AIN3",
+        "AIN2-AIN3",
+        "AIN0",
+        "AIN1",
+        "AIN2",
+        "AIN3",
+    )
+    LOOP_STATS_FIELDS = (
+        "overruns",
+        "period_ms_last",
+        "period_ms_max",
+        "busy_ms_last",
+        "busy_ms_max",
+    )
 
     def __init__(self, device_port, reply_pause_s):
         self.device_port = device_port
         self.reply_pause_s = reply_pause_s
+        self.batch_supported = True
+        self.module_addr = spi_handler.MODULE_ADDR_ANY  # See set_module_addr()
+        self.module_addr_supported = True  # See spi_handler.status_sweep()
+        self.crc_mode = spi_handler.CRC_NONE  # See spi_handler.negotiate_crc()
+        self.capabilities = None  # See spi_handler.discover()
+        self.bulk_read_supported = True  # See spi_handler.read_bytes()
+        self.snapshot_supported = True
+        self.params = {}  # Descriptor table, see list_params()
+        self._telemetry_samples = []  # (type, data) of samples read while waiting for a reply
+        self._telemetry_compact = False
+        self._telemetry_prev = None  # Words of the last compact sample decoded
+        self._reports = []  # REPORT payloads read while waiting for a reply
+        self._pushing = set()  # "telemetry", "reports": the firmware queues unrequested packets
 
-        # In simulation mode, use SimulatedFlow directly
+        # In simulation mode, use SimulatedFlow directly, unless the real firmware
+        # answers over the simulated SPI (RIO_SIM_FIRMWARE)
         self._simulated_flow = None
         sim_mode = os.getenv("RIO_SIMULATION", "false").lower() == "true"
         if sim_mode:
             try:
+                from simulation.firmware_simulated import firmware_enabled
                 from simulation.flow_simulated import SimulatedFlow
 
-                self._simulated_flow = SimulatedFlow(
-                    device_port=device_port, reply_pause_s=reply_pause_s
-                )
+                if not firmware_enabled(device_port):
+                    self._simulated_flow = SimulatedFlow(
+                        device_port=device_port, reply_pause_s=reply_pause_s
+                    )
             except ImportError as e:
                 import logging
 
                 logger = logging.getLogger(__name__)
                 logger.debug(f"Could not import SimulatedFlow: {e}, falling back to SPI")
                 pass  # Fall back to SPI-based communication
+        # spi_handler.pipeline_query() and stream_read() go over SPI, not through SimulatedFlow
+        self.pipeline_supported = self._simulated_flow is None
+        self.stream_supported = self._simulated_flow is None
 
     def read_bytes(self, bytes):
-        data = []
-        # Ensure spi is initialized
-        if spi_handler.spi is None:
-            import logging
-
-            logger = logging.getLogger(__name__)
-            logger.error("SPI not initialized! Call spi_init() before using drivers.")
-            return []
-        for x in range(bytes):
-            data.extend(spi_handler.spi.xfer2([0]))
-        return data
+        return spi_handler.read_bytes(self, bytes)
 
     def packet_read(self):
-        valid = False
-        type_read = 0  # Initialize type_read
-        data = []
-        spi_handler.spi_select_device(self.device_port)
-        data_bytes = self.read_bytes(1)
-        if len(data_bytes) > 0 and data_bytes[0] == self.STX:
-            data_bytes.extend(self.read_bytes(2))
-            if len(data_bytes) >= 3:
-                size = data_bytes[1]
-                type_read = data_bytes[2]
-                data_bytes.extend(self.read_bytes(size - 3))
-                checksum = sum(data_bytes) & 0xFF
-                if checksum == 0:
-                    data = data_bytes[3 : (size - 1)]
-                    valid = True
-        if not valid:
-            data = []
-        return valid, type_read, data
+        return spi_handler.packet_read(self)
 
     def packet_write(self, type, data):
-        # Ensure spi is initialized
-        if spi_handler.spi is None:
-            import logging
-
-            logger = logging.getLogger(__name__)
-            logger.error("SPI not initialized! Call spi_init() before using drivers.")
-            return
-        msg = [2, len(data) + 4, type] + data
-        checksum = (-(sum(msg) & 0xFF)) & 0xFF
-        msg.append(checksum)
-        spi_handler.spi_select_device(self.device_port)
-        spi_handler.spi.xfer2(msg)
+        # Bytes shifted in meanwhile: earlier replies still in the write ring, see pipeline_query()
+        return spi_handler.packet_write(self, type, data)
 
     def packet_query(self, type, data):
         # In simulation mode, use SimulatedFlow directly
@@ -119,14 +236,17 @@ class PiFlow:
         try:
             spi_handler.spi_lock()
             self.packet_write(type, data)
-            #      time.sleep( self.reply_pause_s )
-            spi_handler.pi_wait_s(self.reply_pause_s)
+            spi_handler.wait_reply(self)
             valid = True
             data_read = []
             type_read = 0x100
             try:
                 while valid and (type_read != type) and (type_read != 0):
                     valid, type_read, data_read = self.packet_read()
+                    if valid and type_read in self.TELEMETRY_TYPES:
+                        self._telemetry_samples.append((type_read, data_read))
+                    elif valid and type_read == self.PACKET_TYPE_REPORT:
+                        self._reports.append(data_read)
             except Exception:
                 valid = False
                 data_read = []
@@ -191,63 +311,88 @@ class PiFlow:
         valid, data = self.packet_query(self.PACKET_TYPE_SET_CONTROL_MODE, data_bytes)
         return valid and (data[0] == 0)
 
+    def _decode_reply(self, valid, data, layout):
+        # The channel count from the length, detect_channels() relies on it
+        count = layout.channels(len(data)) if valid else None
+        if count is None:
+            return (False, {})
+        reply = layout.decode(data, count)
+        return (reply["rc"] == 0, reply)
+
+    def _decode_pressures(self, valid, data, signed):
+        layout = pressure_protocol.PRESSURE_TARGET_REPLY
+        if signed:
+            layout = pressure_protocol.PRESSURE_ACTUAL_REPLY
+        valid, reply = self._decode_reply(valid, data, layout)
+        return (valid, [v / self.PRESSURE_SCALE for v in reply.get("pressure", [])])
+
+    def _decode_flows(self, valid, data):
+        valid, reply = self._decode_reply(valid, data, pressure_protocol.FLOW_REPLY)
+        return (valid, reply.get("flow", []))
+
+    def detect_channels(self):
+        """
+        Set NUM_CONTROLLERS and HISTORY_REPLY_MAX from the length of a GET_PRESSURE_ACTUAL
+        reply, for firmware built with NUM_PRESSURE_CLTRLS 8.
+
+        Returns:
+            int: the channel count, or None if the reply was not valid
+        """
+        valid, pressures_mbar = self.get_pressure_actual()
+        if not valid or len(pressures_mbar) not in (4, 8):
+            return None
+        self.NUM_CONTROLLERS = len(pressures_mbar)
+        record_size = pressure_protocol.HISTORY_RECORD.size(self.NUM_CONTROLLERS)
+        self.HISTORY_REPLY_MAX = (255 - 6) // record_size
+        return self.NUM_CONTROLLERS
+
+    def param_id(self, name, chan):
+        """Id of per channel parameter <name> of PARAM_IDS for channel <chan>, 0-7"""
+        return self.PARAM_IDS[name] + (chan & 0x03) + ((chan & 0x04) << 5)
+
     def get_pressure_target(self):
         valid, data = self.packet_query(self.PACKET_TYPE_GET_PRESSURE_TARGET, [])
-        count = int((len(data) - 1) / 2)
-        pressures_mbar = []
-        for i in range(count):
-            index = 1 + (i << 1)
-            pressure_mbar = (
-                int.from_bytes(data[index : index + 2], byteorder="little", signed=False)
-                / self.PRESSURE_SCALE
-            )
-            pressures_mbar.extend([pressure_mbar])
-        return (valid and (data[0] == 0), pressures_mbar)
+        return self._decode_pressures(valid, data, signed=False)
 
     def get_pressure_actual(self):
         valid, data = self.packet_query(self.PACKET_TYPE_GET_PRESSURE_ACTUAL, [])
-        count = int((len(data) - 1) / 2)
-        pressures_mbar = []
-        for i in range(count):
-            index = 1 + (i << 1)
-            pressure_mbar = (
-                int.from_bytes(data[index : index + 2], byteorder="little", signed=True)
-                / self.PRESSURE_SCALE
-            )
-            pressures_mbar.extend([pressure_mbar])
-        return (valid and (data[0] == 0), pressures_mbar)
+        return self._decode_pressures(valid, data, signed=True)
 
     def get_flow_target(self):
         valid, data = self.packet_query(self.PACKET_TYPE_GET_FLOW_TARGET, [])
-        count = int((len(data) - 1) / 2)
-        flows_ul_hr = []
-        for i in range(count):
-            index = 1 + (i << 1)
-            flow_ul_hr = int.from_bytes(data[index : index + 2], byteorder="little", signed=False)
-            flows_ul_hr.extend([flow_ul_hr])
-        return (valid and (data[0] == 0), flows_ul_hr)
+        return self._decode_flows(valid, data)
 
     def get_flow_actual(self):
         valid, data = self.packet_query(self.PACKET_TYPE_GET_FLOW_ACTUAL, [])
-        count = int((len(data) - 1) / 2)
-        flows_ul_hr = []
-        for i in range(count):
-            index = 1 + (i << 1)
-            flow_ul_hr = int.from_bytes(data[index : index + 2], byteorder="little", signed=True)
-            flows_ul_hr.extend([flow_ul_hr])
-        return (valid and (data[0] == 0), flows_ul_hr)
+        return self._decode_flows(valid, data)
 
-    def set_flow(self, indices, flows_ul_hr):
+    def set_flow(self, indices, flows_ul_hr, apply_us=None):
+        """
+        Set the flow targets of some channels, all in one packet.
+
+        Args:
+            apply_us: Time on spi_handler.host_time_us() to stage them for, see stage(),
+                or None to set them now
+
+        Returns:
+            bool: True if set, or staged
+        """
         data_bytes = []
         for i in range(len(indices)):
             mask = 1 << indices[i]
             flow_ul_hr = int(flows_ul_hr[i])
             data_bytes.extend([mask] + list(flow_ul_hr.to_bytes(2, "little", signed=False)))
+        if apply_us is not None:
+            valid, _ = self.stage(apply_us, self.PACKET_TYPE_SET_FLOW_TARGET, data_bytes)
+            return valid
         valid, data = self.packet_query(self.PACKET_TYPE_SET_FLOW_TARGET, data_bytes)
         return valid and (data[0] == 0)
 
     def get_control_modes(self):
         valid, data = self.packet_query(self.PACKET_TYPE_GET_CONTROL_MODE, [])
+        return self._decode_control_modes(valid, data)
+
+    def _decode_control_modes(self, valid, data):
         count = len(data) - 1
         control_modes = []
         for i in range(count):
@@ -257,6 +402,11 @@ class PiFlow:
         return (valid and (data[0] == 0), control_modes)
 
     def set_flow_pid_consts(self, indices, pid_consts):
+        data_bytes = self._encode_pid_consts(indices, pid_consts)
+        valid, data = self.packet_query(self.PACKET_TYPE_SET_FPID_CONSTS, data_bytes)
+        return valid and (data[0] == 0)
+
+    def _encode_pid_consts(self, indices, pid_consts):
         data_bytes = []
         for i in range(len(indices)):
             mask = 1 << indices[i]
@@ -264,11 +414,13 @@ class PiFlow:
             data_bytes.extend([mask] + list(pid_const[0].to_bytes(2, "little", signed=False)))
             data_bytes.extend(list(pid_const[1].to_bytes(2, "little", signed=False)))
             data_bytes.extend(list(pid_const[2].to_bytes(2, "little", signed=False)))
-        valid, data = self.packet_query(self.PACKET_TYPE_SET_FPID_CONSTS, data_bytes)
-        return valid and (data[0] == 0)
+        return data_bytes
 
     def get_flow_pid_consts(self):
         valid, data = self.packet_query(self.PACKET_TYPE_GET_FPID_CONSTS, [])
+        return self._decode_flow_pid_consts(valid, data)
+
+    def _decode_flow_pid_consts(self, valid, data):
         count = int((len(data) - 1) / (3 * 2))  # 3 constants * 2 bytes each
         pid_consts = []
         for i in range(count):
@@ -279,3 +431,1130 @@ class PiFlow:
                 consts.extend([const])
             pid_consts.extend([consts])
         return (valid and (data[0] == 0), pid_consts)
+
+    def set_pressure_pid_consts(self, indices, pid_consts):
+        """
+        Set the closed loop pressure PID gains, stored in the module EEPROM.
+
+        Args:
+            indices: Channel indices
+            pid_consts: [P, I, D] U16 gains per index, in 1/4096, on the error in mbar
+
+        Returns:
+            bool: True if accepted; the EEPROM write is queued, see get_eeprom_status()
+        """
+        data_bytes = self._encode_pid_consts(indices, pid_consts)
+        valid, data = self.packet_query(self.PACKET_TYPE_SET_PPID_CONSTS, data_bytes)
+        return valid and (data[0] == 0)
+
+    def get_pressure_pid_consts(self):
+        """Read the pressure PID gains of all channels, as set_pressure_pid_consts()."""
+        valid, data = self.packet_query(self.PACKET_TYPE_GET_PPID_CONSTS, [])
+        return self._decode_flow_pid_consts(valid, data)
+
+    def get_spi_stats(self, reset=False):
+        """
+        Read SPI buffer sizes, drop/overflow counters and peak ring usage.
+
+        Args:
+            reset: True to clear the counters after reading
+
+        Returns:
+            tuple: (valid, stats) with stats keyed by spi_handler.SPI_STATS_FIELDS
+        """
+        valid, data = self.packet_query(self.PACKET_TYPE_GET_SPI_STATS, [1] if reset else [])
+        return spi_handler.parse_spi_stats(valid, data)
+
+    def benchmark(self, kernel, runs=100):
+        """
+        Time one firmware kernel on the module, for comparing compiler options and code
+        changes, see spi_handler.parse_bench_report().
+
+        Args:
+            kernel: A BENCH_NAMES name or its index
+            runs: 1 to 1000, the module's main loop waits for all of them
+
+        Returns:
+            tuple: (valid, result), (False, {}) if the firmware was built without it
+        """
+        return spi_handler.bench_query(
+            self, self.PACKET_TYPE_BENCHMARK, self.BENCH_NAMES, kernel, runs
+        )
+
+    def echo(self, payload):
+        """
+        Send <payload> and read it back, for drivers/spi_benchmark.py.
+
+        Args:
+            payload: Bytes to echo, up to the packet buffer less the return code
+
+        Returns:
+            tuple: (valid, data) with data the payload the board returned
+        """
+        valid, data = self.packet_query(self.PACKET_TYPE_ECHO, list(payload))
+        if not valid or len(data) < 1 or data[0] != 0:
+            return (False, [])
+        return (True, data[1:])
+
+    def set_loop_config(self, period_ms, data_rates_sps):
+        """
+        Set the control loop period and the ADS1115 data rate of each pressure channel.
+
+        Args:
+            period_ms: Control cycle period, 5 ms or more
+            data_rates_sps: One of ADC_DATA_RATES_SPS per channel
+
+        Returns:
+            tuple: (valid, config) with config keys period_ms and data_rates_sps
+        """
+        if len(data_rates_sps) != self.NUM_CONTROLLERS or any(
+            rate not in self.ADC_DATA_RATES_SPS for rate in data_rates_sps
+        ):
+            return (False, {})
+        data = list((int(period_ms) & 0xFFFF).to_bytes(2, "little"))
+        data.extend([self.ADC_DATA_RATES_SPS.index(rate) for rate in data_rates_sps])
+        valid, data = self.packet_query(self.PACKET_TYPE_SET_LOOP_CONFIG, data)
+        return self._decode_loop_config(valid, data)
+
+    def get_loop_config(self):
+        """Read the control loop period and ADS1115 data rates, as set_loop_config()."""
+        valid, data = self.packet_query(self.PACKET_TYPE_SET_LOOP_CONFIG, [])
+        return self._decode_loop_config(valid, data)
+
+    def _decode_loop_config(self, valid, data):
+        if not valid or len(data) != 3 + self.NUM_CONTROLLERS or data[0] != 0:
+            return (False, {})
+        if any(code >= len(self.ADC_DATA_RATES_SPS) for code in data[3:]):
+            return (False, {})
+        return (
+            True,
+            {
+                "period_ms": int.from_bytes(data[1:3], byteorder="little", signed=False),
+                "data_rates_sps": [self.ADC_DATA_RATES_SPS[code] for code in data[3:]],
+            },
+        )
+
+    def set_adc_config(self, indices, configs):
+        """
+        Set the ADS1115 data rate, gain and input of some pressure channels, stored in EEPROM.
+
+        Args:
+            indices: Channel indices
+            configs: One dict per index with keys data_rate_sps (one of ADC_DATA_RATES_SPS),
+                gain (ADC_FSR_V index, or ADC_GAIN_AUTO) and mux (ADC_MUX_INPUTS index)
+
+        Returns:
+            tuple: (valid, configs) for all channels, as get_adc_config()
+        """
+        data = []
+        for index, config in zip(indices, configs):
+            data.append(1 << index)
+            data.append(self.ADC_DATA_RATES_SPS.index(config["data_rate_sps"]))
+            data.append(config["gain"])
+            data.append(config["mux"])
+        valid, data = self.packet_query(self.PACKET_TYPE_SET_ADC_CONFIG, data)
+        return self._decode_adc_config(valid, data)
+
+    def get_adc_config(self):
+        """Read the ADC config of all channels. gain_in_use is the range auto-ranging reached."""
+        valid, data = self.packet_query(self.PACKET_TYPE_SET_ADC_CONFIG, [])
+        return self._decode_adc_config(valid, data)
+
+    def _decode_adc_config(self, valid, data):
+        if not valid or len(data) != 1 + 4 * self.NUM_CONTROLLERS or data[0] != 0:
+            return (False, [])
+        configs = []
+        for i in range(self.NUM_CONTROLLERS):
+            rate, gain, mux, gain_in_use = data[1 + 4 * i : 5 + 4 * i]
+            configs.append(
+                {
+                    "data_rate_sps": self.ADC_DATA_RATES_SPS[rate],
+                    "gain": gain,
+                    "mux": mux,
+                    "gain_in_use": gain_in_use,
+                }
+            )
+        return (True, configs)
+
+    def set_flow_ff(self, indices, configs):
+        """
+        Set the flow setpoint ramp and resistance feedforward of some channels.
+
+        Args:
+            indices: Channel indices
+            configs: One dict per index with keys resistance (mbar per 1000 ul/hr),
+                ramp_ul_hr (most setpoint change per control cycle, 0 steps),
+                feedforward and learn (bools)
+
+        Returns:
+            tuple: (valid, configs) for all channels, as get_flow_ff()
+        """
+        data = []
+        for index, config in zip(indices, configs):
+            flags = self.FLOW_FF_ENABLE if config.get("feedforward") else 0
+            flags |= self.FLOW_FF_LEARN if config.get("learn") else 0
+            data.append(1 << index)
+            data.extend(list((int(config.get("resistance", 0)) & 0xFFFF).to_bytes(2, "little")))
+            data.extend(list((int(config.get("ramp_ul_hr", 0)) & 0xFFFF).to_bytes(2, "little")))
+            data.append(flags)
+        valid, data = self.packet_query(self.PACKET_TYPE_SET_FLOW_FF, data)
+        return self._decode_flow_ff(valid, data)
+
+    def get_flow_ff(self):
+        """Read the ramp and feedforward of all channels. resistance is the learned value."""
+        valid, data = self.packet_query(self.PACKET_TYPE_SET_FLOW_FF, [])
+        return self._decode_flow_ff(valid, data)
+
+    def _decode_flow_ff(self, valid, data):
+        if not valid or len(data) != 1 + 5 * self.NUM_CONTROLLERS or data[0] != 0:
+            return (False, [])
+        configs = []
+        for i in range(self.NUM_CONTROLLERS):
+            entry = data[1 + 5 * i : 6 + 5 * i]
+            configs.append(
+                {
+                    "resistance": int.from_bytes(entry[0:2], byteorder="little", signed=False),
+                    "ramp_ul_hr": int.from_bytes(entry[2:4], byteorder="little", signed=False),
+                    "feedforward": bool(entry[4] & self.FLOW_FF_ENABLE),
+                    "learn": bool(entry[4] & self.FLOW_FF_LEARN),
+                }
+            )
+        return (True, configs)
+
+    def set_signal_filter(self, indices, signal, coeffs):
+        """
+        Set the biquad filter of a signal, in front of the controllers, on some channels.
+
+        Args:
+            indices: Channel indices
+            signal: FILTER_SIGNAL_PRESSURE or FILTER_SIGNAL_FLOW
+            coeffs: Q14 (b0, b1, b2, a1, a2), e.g. from lowpass_filter_coeffs().
+                FILTER_PASSTHROUGH turns the filter off.
+
+        Returns:
+            tuple: (valid, filters) for all channels, as get_signal_filters()
+        """
+        mask = 0
+        for index in indices:
+            mask |= 1 << index
+        data = [mask, signal]
+        for coeff in coeffs:
+            data.extend(list(int(coeff).to_bytes(2, "little", signed=True)))
+        valid, data = self.packet_query(self.PACKET_TYPE_SET_SIGNAL_FILTER, data)
+        return self._decode_signal_filters(valid, data)
+
+    def get_signal_filters(self):
+        """Read the filters of all channels, a {"pressure", "flow"} dict of coeffs each."""
+        valid, data = self.packet_query(self.PACKET_TYPE_SET_SIGNAL_FILTER, [])
+        return self._decode_signal_filters(valid, data)
+
+    def _decode_signal_filters(self, valid, data):
+        if not valid or len(data) != 1 + 20 * self.NUM_CONTROLLERS or data[0] != 0:
+            return (False, [])
+        coeffs = [
+            int.from_bytes(data[i : i + 2], byteorder="little", signed=True)
+            for i in range(1, len(data), 2)
+        ]
+        filters = []
+        for i in range(self.NUM_CONTROLLERS):
+            filters.append(
+                {
+                    "pressure": tuple(coeffs[10 * i : 10 * i + 5]),
+                    "flow": tuple(coeffs[10 * i + 5 : 10 * i + 10]),
+                }
+            )
+        return (True, filters)
+
+    @classmethod
+    def lowpass_filter_coeffs(cls, cutoff_hz, sample_hz):
+        """
+        Q14 coefficients of a second order Butterworth low pass, for set_signal_filter().
+
+        The sample rate is that of the filtered signal: the control cycle rate for pressure,
+        the rate of new Sensirion readings for flow. b2 takes the rounding, so the DC gain is
+        exactly 1 and a steady reading passes unchanged.
+        """
+        if not 0 < cutoff_hz < sample_hz / 2:
+            raise ValueError("cutoff_hz must be between 0 and half of sample_hz")
+        k = math.tan(math.pi * cutoff_hz / sample_hz)
+        norm = 1 / (1 + math.sqrt(2) * k + k * k)
+        b0 = round(k * k * norm * cls.FILTER_COEFF_ONE)
+        a1 = round(2 * (k * k - 1) * norm * cls.FILTER_COEFF_ONE)
+        a2 = round((1 - math.sqrt(2) * k + k * k) * norm * cls.FILTER_COEFF_ONE)
+        b1 = 2 * b0
+        b2 = cls.FILTER_COEFF_ONE + a1 + a2 - b0 - b1
+        return (b0, b1, b2, a1, a2)
+
+    def upload_profile(self, index, points, pressure=False):
+        """
+        Upload a setpoint profile for one channel, in chunks of PROFILE_CHUNK_POINTS.
+
+        Args:
+            index: Channel index
+            points: Up to PROFILE_LEN (duration_ms, value) pairs. Each point is reached
+                duration_ms after the previous one, moving linearly; 0 steps.
+            pressure: True for values in mbar, False for flow in ul/hr
+
+        Returns:
+            bool: True if every chunk was accepted. Uploading stops the channel's profile.
+        """
+        if len(points) > self.PROFILE_LEN:
+            return False
+        for first in range(0, len(points), self.PROFILE_CHUNK_POINTS):
+            data = [index, first]
+            for duration_ms, value in points[first : first + self.PROFILE_CHUNK_POINTS]:
+                if pressure:
+                    raw = int(value * self.PRESSURE_SCALE) & 0xFFFF
+                else:
+                    raw = int(value) & 0xFFFF
+                data.extend(list((int(duration_ms) & 0xFFFF).to_bytes(2, "little")))
+                data.extend(list(raw.to_bytes(2, "little")))
+            valid, reply = self.packet_query(self.PACKET_TYPE_SET_PROFILE_POINTS, data)
+            if not (valid and reply and reply[0] == 0):
+                return False
+        return True
+
+    def start_profile(self, indices, length, loop=False, pressure=False):
+        """
+        Run the first length uploaded points on each channel, from its present target.
+
+        The profile sets the pressure or flow target; the control mode is left as set.
+
+        Returns:
+            tuple: (valid, status) as get_profile_status()
+        """
+        flags = (self.PROFILE_FLAG_LOOP if loop else 0) | (
+            self.PROFILE_FLAG_PRESSURE if pressure else 0
+        )
+        data = []
+        for index in indices:
+            data.extend([1 << index, length, flags])
+        valid, data = self.packet_query(self.PACKET_TYPE_SET_PROFILE, data)
+        return self._decode_profile_status(valid, data)
+
+    def stop_profile(self, indices):
+        """Stop the profiles of some channels, leaving their targets where they are."""
+        data = []
+        for index in indices:
+            data.extend([1 << index, 0, 0])
+        valid, data = self.packet_query(self.PACKET_TYPE_SET_PROFILE, data)
+        return self._decode_profile_status(valid, data)
+
+    def get_probe_stats(self, reset=False):
+        """
+        Read the firmware execution time probes.
+
+        Args:
+            reset: True to clear the statistics after reading
+
+        Returns:
+            tuple: (valid, stats) with keys timer_hz and probes, see
+            spi_handler.parse_probe_stats(); probes are keyed by PROBE_NAMES
+        """
+        valid, data = self.packet_query(self.PACKET_TYPE_GET_PROBE_STATS, [1] if reset else [])
+        return spi_handler.parse_probe_stats(valid, data, self.PROBE_NAMES)
+
+    def sync_time(self, rounds=spi_handler.TIME_SYNC_ROUNDS):
+        """
+        Align the firmware clock of the snapshot, telemetry and history times with
+        spi_handler.host_time_us(), see spi_handler.sync_time().
+        """
+        return spi_handler.sync_time(self, self.PACKET_TYPE_SYNC_TIME, rounds)
+
+    def get_time(self):
+        """
+        Read the firmware clock.
+
+        Returns:
+            tuple: (valid, report) as spi_handler.parse_time_report()
+        """
+        valid, data = self.packet_query(self.PACKET_TYPE_SYNC_TIME, [])
+        return spi_handler.parse_time_report(valid, data)
+
+    def set_frame_sync(self, mode, divider=1):
+        """
+        Start a control cycle on every divider-th camera frame trigger edge, or run on the
+        timer again with mode FRAME_SYNC_OFF. Restarts the firmware frame count, so number
+        the triggers sent from here on from 1 to match the frame of the samples.
+
+        Returns:
+            tuple: (valid, status) as get_frame_sync()
+        """
+        valid, data = self.packet_query(self.PACKET_TYPE_SET_FRAME_SYNC, [mode & 0xFF, divider & 0xFF])
+        return self._decode_frame_sync(valid, data)
+
+    def get_frame_sync(self):
+        """
+        Read the frame sync mode and counters.
+
+        Returns:
+            tuple: (valid, status) with keys mode, divider, frames (edges since
+            set_frame_sync()) and missed (cycle edges that came while a cycle was running)
+        """
+        valid, data = self.packet_query(self.PACKET_TYPE_SET_FRAME_SYNC, [])
+        return self._decode_frame_sync(valid, data)
+
+    def _decode_frame_sync(self, valid, data):
+        if not valid or len(data) != 9 or data[0] != 0:
+            return (False, {})
+        return (
+            True,
+            {
+                "mode": data[1],
+                "divider": data[2],
+                "frames": int.from_bytes(data[3:7], byteorder="little", signed=False),
+                "missed": int.from_bytes(data[7:9], byteorder="little", signed=False),
+            },
+        )
+
+    def stage(self, apply_us, packet_type, data):
+        """
+        Run a command when the synchronized clock reaches apply_us, with its reply
+        dropped. Stage the setpoints of one change on every module for the same time,
+        see spi_handler.stage_together(). Needs sync_time() first.
+
+        Args:
+            apply_us: time on spi_handler.host_time_us(), e.g. spi_handler.stage_time_us()
+            packet_type: the command, PACKET_TYPE_*
+            data: its data as it would be sent alone, up to spi_handler.STAGE_DATA_MAX bytes
+
+        Returns:
+            tuple: (valid, status) as get_stage_status()
+        """
+        valid, data = self.packet_query(
+            self.PACKET_TYPE_STAGE, spi_handler.stage_data(apply_us, packet_type, data)
+        )
+        return spi_handler.parse_stage_report(valid, data)
+
+    def cancel_staged(self):
+        """Drop every staged command that has not run yet."""
+        valid, data = self.packet_query(self.PACKET_TYPE_STAGE, [spi_handler.STAGE_CANCEL])
+        return spi_handler.parse_stage_report(valid, data)
+
+    def get_stage_status(self):
+        """
+        Read the staged command counters.
+
+        Returns:
+            tuple: (valid, status), see spi_handler.parse_stage_report()
+        """
+        valid, data = self.packet_query(self.PACKET_TYPE_STAGE, [])
+        return spi_handler.parse_stage_report(valid, data)
+
+    def get_eeprom_status(self, reset=False):
+        """
+        Read the firmware EEPROM write queue, see spi_handler.parse_eeprom_status().
+
+        Args:
+            reset: True to clear the committed, verify_failed and full_waits counters
+        """
+        valid, data = self.packet_query(self.PACKET_TYPE_GET_EEPROM_STATUS, [1] if reset else [])
+        return spi_handler.parse_eeprom_status(valid, data, "little")
+
+    def get_boot_status(self):
+        """
+        Read whether the module is still booting (the flow sensor probes), see
+        spi_handler.parse_boot_status().
+        """
+        valid, data = self.packet_query(self.PACKET_TYPE_GET_BOOT_STATUS, [])
+        return spi_handler.parse_boot_status(valid, data, "little")
+
+    def get_i2c_stats(self, reset=False):
+        """
+        Read the I2C bus counters.
+
+        Args:
+            reset: True to clear the counters after reading them
+
+        Returns:
+            tuple: (valid, stats) with a dict per I2C_DEVICES name (transfers, nacks,
+            errors, timeouts, aborts), recoveries and recovery_fails of a stuck bus,
+            and clock_khz
+        """
+        valid, data = self.packet_query(self.PACKET_TYPE_GET_I2C_STATS, [1] if reset else [])
+        size = 1 + 12 * len(self.I2C_DEVICES) + 6
+        if not valid or len(data) != size or data[0] != 0:
+            return (False, {})
+
+        def u16(offset):
+            return int.from_bytes(data[offset : offset + 2], byteorder="little", signed=False)
+
+        stats = {}
+        for i, name in enumerate(self.I2C_DEVICES):
+            offset = 1 + 12 * i
+            stats[name] = {
+                "transfers": int.from_bytes(data[offset : offset + 4], "little", signed=False),
+                "nacks": u16(offset + 4),
+                "errors": u16(offset + 6),
+                "timeouts": u16(offset + 8),
+                "aborts": u16(offset + 10),
+            }
+        offset = 1 + 12 * len(self.I2C_DEVICES)
+        stats["recoveries"] = u16(offset)
+        stats["recovery_fails"] = u16(offset + 2)
+        stats["clock_khz"] = u16(offset + 4)
+        return (True, stats)
+
+    def get_latency_stats(self, index, reset=False):
+        """
+        Read the sample to output latency and output period jitter of one channel's loop,
+        from its pressure reading, and its flow reading in a flow mode, to its DAC write.
+
+        Args:
+            index: Channel 0-3
+            reset: True to clear the channel's statistics after reading them
+
+        Returns:
+            tuple: (valid, stats), see spi_handler.parse_latency_stats()
+        """
+        valid, data = self.packet_query(self.PACKET_TYPE_GET_LATENCY_STATS, [index, 1] if reset else [index])
+        return spi_handler.parse_latency_stats(valid, data)
+
+    def flow_autotune(self, indices, run=True, flow_ul_hr=None, relay_mbar=None):
+        """
+        Start or stop the relay autotune of the flow PID on some channels. While it runs the
+        channel's control mode is suspended; on success the new gains are stored.
+
+        Args:
+            indices: Channel indices, each needs a flow sensor
+            run: False stops a running test
+            flow_ul_hr: Flow to tune around, None for the present flow target
+            relay_mbar: Relay amplitude either side of the bias, None for the firmware
+                default (50 mbar). Needs flow_ul_hr.
+
+        Returns:
+            tuple: (valid, status) for all channels, as get_flow_autotune()
+        """
+        mask = 0
+        for index in indices:
+            mask |= 1 << index
+        data = [mask, 1 if run else 0]
+        if flow_ul_hr is not None:
+            data.extend(list((int(flow_ul_hr) & 0xFFFF).to_bytes(2, "little")))
+            if relay_mbar is not None:
+                data.extend(list((int(relay_mbar) & 0xFFFF).to_bytes(2, "little")))
+        valid, data = self.packet_query(self.PACKET_TYPE_SET_FLOW_AUTOTUNE, data)
+        return self._decode_flow_autotune(valid, data)
+
+    def get_flow_autotune(self):
+        """
+        Read the flow autotune status of all channels.
+
+        Returns:
+            tuple: (valid, status) with a dict per channel: state and fail
+            (FLOW_AUTOTUNE_STATES and FLOW_AUTOTUNE_FAILS names), transitions of the relay
+            and settled estimates so far. get_flow_pid_consts() has the gains once finished.
+        """
+        valid, data = self.packet_query(self.PACKET_TYPE_SET_FLOW_AUTOTUNE, [])
+        return self._decode_flow_autotune(valid, data)
+
+    def _decode_flow_autotune(self, valid, data):
+        if not valid or len(data) != 1 + 4 * self.NUM_CONTROLLERS or data[0] != 0:
+            return (False, [])
+        status = []
+        for i in range(self.NUM_CONTROLLERS):
+            state, fail, transitions, settled = data[1 + 4 * i : 5 + 4 * i]
+            status.append(
+                {
+                    "state": self.FLOW_AUTOTUNE_STATES[state]
+                    if state < len(self.FLOW_AUTOTUNE_STATES)
+                    else state,
+                    "fail": self.FLOW_AUTOTUNE_FAILS[fail]
+                    if fail < len(self.FLOW_AUTOTUNE_FAILS)
+                    else fail,
+                    "transitions": transitions,
+                    "settled": settled,
+                }
+            )
+        return (True, status)
+
+    def capture_pressure_zero(self, indices, samples=32):
+        """
+        Start a zero capture on some channels: the firmware averages their next samples and
+        stores the mean as the channel's zero, subtracted from every reading after. Each
+        channel must be in control mode 0 with its regulator vented; leaving mode 0 stops it.
+
+        Args:
+            indices: Channel indices
+            samples: Samples to average, 1-255, one a control cycle; 0 stops a capture
+
+        Returns:
+            tuple: (valid, calibration) for all channels, as get_pressure_cal()
+        """
+        mask = 0
+        for index in indices:
+            mask |= 1 << index
+        valid, data = self.packet_query(self.PACKET_TYPE_PRESSURE_CAL, [mask, int(samples)])
+        return self._decode_pressure_cal(valid, data)
+
+    def get_pressure_cal(self):
+        """
+        Read the pressure calibration of all channels, applied by the firmware to each sample.
+
+        Returns:
+            tuple: (valid, calibration) with a dict per channel: zero in mbar, span, and the
+            zero capture's state (PRESSURE_CAL_STATES name) and samples still to take.
+            Set zero and span with the pressure_cal_zero and pressure_cal_trim params.
+        """
+        valid, data = self.packet_query(self.PACKET_TYPE_PRESSURE_CAL, [])
+        return self._decode_pressure_cal(valid, data)
+
+    def _decode_pressure_cal(self, valid, data):
+        valid, reply = self._decode_reply(valid, data, pressure_protocol.PRESSURE_CAL_REPLY)
+        if not valid:
+            return (False, [])
+        cal = []
+        for i, state in enumerate(reply["state"]):
+            cal.append(
+                {
+                    "zero": reply["zero"][i] / self.PRESSURE_SCALE,
+                    "span": reply["span"][i] / (1 << 14),
+                    "state": self.PRESSURE_CAL_STATES[state]
+                    if state < len(self.PRESSURE_CAL_STATES)
+                    else state,
+                    "left": reply["left"][i],
+                }
+            )
+        return (True, cal)
+
+    def set_flow_sched(self, index, points):
+        """
+        Set the flow PID gain schedule of one channel, stored in the module EEPROM.
+
+        Args:
+            index: Channel index
+            points: Up to FLOW_SCHED_POINTS (flow_ul_hr, p, i, d), flows rising from 0.
+                Between two points the gains are interpolated on the ramped setpoint,
+                past the ends held. An empty list goes back to the flow PID constants.
+
+        Returns:
+            tuple: (valid, sched) as get_flow_sched()
+        """
+        data = [index, len(points)]
+        for point in points:
+            for value in point:
+                data.extend(list((int(value) & 0xFFFF).to_bytes(2, "little")))
+        valid, data = self.packet_query(self.PACKET_TYPE_SET_FLOW_SCHED, data)
+        return self._decode_flow_sched(valid, data)
+
+    def get_flow_sched(self, index):
+        """
+        Read the flow PID gain schedule of one channel.
+
+        Returns:
+            tuple: (valid, sched) with points, a list of (flow_ul_hr, p, i, d), and
+            in_use, the (p, i, d) the flow PID takes for its present setpoint
+        """
+        valid, data = self.packet_query(self.PACKET_TYPE_SET_FLOW_SCHED, [index])
+        return self._decode_flow_sched(valid, data)
+
+    def _decode_flow_sched(self, valid, data):
+        if not valid or len(data) != 2 + 8 * self.FLOW_SCHED_POINTS + 6 or data[0] != 0:
+            return (False, {})
+
+        def u16(offset, signed=False):
+            return int.from_bytes(data[offset : offset + 2], byteorder="little", signed=signed)
+
+        count = min(data[1], self.FLOW_SCHED_POINTS)
+        points = [
+            (u16(2 + 8 * i, signed=True), u16(4 + 8 * i), u16(6 + 8 * i), u16(8 + 8 * i))
+            for i in range(count)
+        ]
+        offset = 2 + 8 * self.FLOW_SCHED_POINTS
+        in_use = (u16(offset), u16(offset + 2), u16(offset + 4))
+        return (True, {"points": points, "in_use": in_use})
+
+    def list_params(self):
+        """
+        Read the firmware parameter descriptor table, see spi_handler.param_list().
+
+        The table is kept in self.params for get_params().
+        """
+        valid, params = spi_handler.param_list(self)
+        if valid:
+            self.params = params
+        return (valid, params)
+
+    def get_params(self, ids=None):
+        """
+        Read several parameters in one or two packets.
+
+        Args:
+            ids: PARAM_IDS names or numeric ids, None for every parameter in the table
+
+        Returns:
+            tuple: (valid, values) with values keyed by numeric id
+        """
+        if not self.params and not self.list_params()[0]:
+            return (False, {})
+        if ids is None:
+            ids = list(self.params)
+        return spi_handler.param_get_many(
+            self, self.params, [self.PARAM_IDS.get(i, i) for i in ids]
+        )
+
+    def set_params(self, values):
+        """
+        Write several parameters, e.g. a configuration saved with get_params().
+
+        Args:
+            values: dict of PARAM_IDS name or numeric id -> value
+
+        Returns:
+            tuple: (valid, rc) as spi_handler.param_set_many()
+        """
+        return spi_handler.param_set_many(
+            self, {self.PARAM_IDS.get(i, i): value for i, value in values.items()}
+        )
+
+    def get_fault_log(self, max_records=None):
+        """
+        Read the firmware EEPROM fault log, newest first, see spi_handler.fault_log().
+
+        Returns:
+            tuple: (valid, records, pending), each record with its FAULT_NAMES name added
+        """
+        valid, records, pending = spi_handler.fault_log(self, max_records)
+        for record in records:
+            record["name"] = self.FAULT_NAMES.get(record["id"], record["id"])
+        return (valid, records, pending)
+
+    def get_profile_status(self):
+        """
+        Read the profile state of all channels.
+
+        Returns:
+            tuple: (valid, status) with one dict per channel, keys length, loop, pressure,
+            active and index (the point being moved to; length once a profile has ended)
+        """
+        valid, data = self.packet_query(self.PACKET_TYPE_SET_PROFILE, [])
+        return self._decode_profile_status(valid, data)
+
+    def _decode_profile_status(self, valid, data):
+        if not valid or len(data) != 1 + 4 * self.NUM_CONTROLLERS or data[0] != 0:
+            return (False, [])
+        status = []
+        for i in range(self.NUM_CONTROLLERS):
+            length, flags, active, index = data[1 + 4 * i : 5 + 4 * i]
+            status.append(
+                {
+                    "length": length,
+                    "loop": bool(flags & self.PROFILE_FLAG_LOOP),
+                    "pressure": bool(flags & self.PROFILE_FLAG_PRESSURE),
+                    "active": bool(active),
+                    "index": index,
+                }
+            )
+        return (True, status)
+
+    def get_loop_stats(self, reset=False):
+        """
+        Read the control loop rate the firmware achieves.
+
+        Args:
+            reset: True to clear the statistics after reading
+
+        Returns:
+            tuple: (valid, stats) with key cycles plus LOOP_STATS_FIELDS; overruns counts
+            cycles that took the whole period or longer
+        """
+        valid, data = self.packet_query(self.PACKET_TYPE_GET_LOOP_STATS, [1] if reset else [])
+        if not valid or len(data) != 5 + 2 * len(self.LOOP_STATS_FIELDS) or data[0] != 0:
+            return (False, {})
+        stats = {"cycles": int.from_bytes(data[1:5], byteorder="little", signed=False)}
+        for i, name in enumerate(self.LOOP_STATS_FIELDS):
+            stats[name] = int.from_bytes(data[5 + 2 * i : 7 + 2 * i], byteorder="little")
+        return (True, stats)
+
+    def batch_query(self, commands):
+        """
+        Run several commands in one SPI transaction (BATCH packet).
+
+        Args:
+            commands: list of (packet_type, data) pairs
+
+        Returns:
+            tuple: (valid, replies) with one (packet_type, data) reply per command,
+            where data is what packet_query() would have returned for it alone
+        """
+        return spi_handler.batch_query(self, self.PACKET_TYPE_BATCH, commands)
+
+    def get_status_snapshot(self):
+        """
+        Read all channels as captured together at the end of one firmware control cycle.
+
+        Returns:
+            tuple: (valid, snapshot) with snapshot keys seq, time_us (host clock
+            after sync_time()), frame (0 unless set_frame_sync() started the cycle), pressure_actual, pressure_output, pressure_target, flow_actual, flow_target,
+            control_modes, flow_ctrl_states
+        """
+        valid, data = self.packet_query(self.PACKET_TYPE_GET_STATUS_SNAPSHOT, [])
+        return self._decode_status_snapshot(valid, data)
+
+    def _decode_status_snapshot(self, valid, data):
+        valid, snapshot = self._decode_reply(valid, data, pressure_protocol.STATUS_SNAPSHOT_REPLY)
+        if not valid:
+            return (False, {})
+        del snapshot["rc"]
+        for name in ("pressure_actual", "pressure_output", "pressure_target"):
+            snapshot[name] = [v / self.PRESSURE_SCALE for v in snapshot[name]]
+        snapshot["control_modes"] = snapshot.pop("control_mode")
+        snapshot["flow_ctrl_states"] = snapshot.pop("flow_ctrl_state")
+        return (True, snapshot)
+
+    def set_telemetry(self, period_cycles, compact=False):
+        """
+        Start streaming TELEMETRY_SAMPLE packets, one every period_cycles firmware
+        control cycles, or stop with period_cycles = 0. Read them with read_telemetry().
+
+        Args:
+            compact: stream TELEMETRY_COMPACT records instead, the difference from the
+                sample before, a fraction of the SPI traffic. read_telemetry() decodes them.
+
+        Returns:
+            tuple: (valid, dropped) with the number of samples dropped because the
+            firmware write ring was full since the previous set_telemetry()
+        """
+        data = [period_cycles & 0xFF]
+        if compact:
+            data.append(self.RECORD_FORMAT_COMPACT)
+        valid, data = self.packet_query(self.PACKET_TYPE_SET_TELEMETRY, data)
+        if not valid or len(data) != 3 or data[0] != 0:
+            return (False, 0)
+        self._telemetry_compact = compact
+        self._telemetry_prev = None
+        self._set_pushing("telemetry", period_cycles != 0)
+        return (True, int.from_bytes(data[1:3], byteorder="little", signed=False))
+
+    def read_telemetry(self):
+        """
+        Drain the streamed samples queued by the firmware, plus any seen by packet_query().
+
+        Returns:
+            tuple: (valid, samples) with one dict per sample, keys seq, time_us, frame,
+            pressure_actual and flow_actual. seq is the snapshot seq, so gaps larger than the period
+            are dropped samples.
+        """
+        if self._simulated_flow is not None:
+            type_read = self.TELEMETRY_TYPES[self._telemetry_compact]
+            records = [(type_read, data) for data in self._simulated_flow.read_telemetry()]
+        else:
+            records = []
+            valid = True
+            try:
+                spi_handler.spi_lock()
+                while valid:
+                    valid, type_read, data = self.packet_read()
+                    if valid and type_read in self.TELEMETRY_TYPES:
+                        records.append((type_read, data))
+                    elif valid:
+                        valid = False  # Not ours, e.g. a late reply
+                spi_handler.spi_deselect_current()
+            except Exception:
+                return (False, [])
+            finally:
+                spi_handler.spi_release()
+        records, self._telemetry_samples = self._telemetry_samples + records, []
+        samples = [self._decode_telemetry_record(type_read, data) for type_read, data in records]
+        return (True, [sample for sample in samples if sample])
+
+    def report_signals(self):
+        """SUBSCRIBE signal names in firmware order, pressure0.. then flow0.. (main.c)."""
+        return [f"pressure{chan}" for chan in range(self.NUM_CONTROLLERS)] + [
+            f"flow{chan}" for chan in range(self.NUM_CONTROLLERS)
+        ]
+
+    def _report_scale(self, name):
+        return self.PRESSURE_SCALE if name.startswith("pressure") else 1
+
+    def subscribe(self, signals):
+        """
+        Report by exception: the firmware queues a REPORT only when a subscribed signal moves
+        past its deadband from the value last sent, or its max interval passes without one.
+        Read them with read_reports(). Steady readings then cost no SPI traffic at all.
+
+        Args:
+            signals: dict of name from report_signals() to (deadband, max_interval_ms), the
+                deadband in mbar or ul/hr, None to send on the interval only, an interval of 0
+                only on change; None unsubscribes the signal, and {} cancels every one
+
+        Returns:
+            tuple: (valid, status) as spi_handler.parse_report_status()
+        """
+        names = self.report_signals()
+        try:
+            settings = {
+                names.index(name): (
+                    None
+                    if setting is None
+                    else (
+                        None
+                        if setting[0] is None
+                        else round(setting[0] * self._report_scale(name)),
+                        setting[1],
+                    )
+                )
+                for name, setting in signals.items()
+            }
+        except ValueError:
+            return (False, {})
+        valid, data = self.packet_query(
+            self.PACKET_TYPE_SUBSCRIBE, spi_handler.subscribe_data(settings)
+        )
+        valid, status = spi_handler.parse_report_status(valid, data)
+        if valid:
+            self._set_pushing("reports", status["subscribed"] != 0)
+        return (valid, status)
+
+    def _set_pushing(self, source, on):
+        # pipeline_query() would skip the unsequenced samples and reports rather than queue them
+        if on:
+            self._pushing.add(source)
+        else:
+            self._pushing.discard(source)
+        self.pipeline_supported = self._simulated_flow is None and not self._pushing
+
+    def read_reports(self):
+        """
+        Drain the REPORT packets queued by the firmware, plus any seen by packet_query().
+
+        Returns:
+            tuple: (valid, reports) with one dict per REPORT, keys time_us and values, a dict
+            of signal name to its reading in mbar or ul/hr, only the signals that were due
+        """
+        if self._simulated_flow is not None:
+            payloads = self._simulated_flow.read_reports()
+        else:
+            payloads = []
+            valid = True
+            try:
+                spi_handler.spi_lock()
+                while valid:
+                    valid, type_read, data = self.packet_read()
+                    if valid and type_read == self.PACKET_TYPE_REPORT:
+                        payloads.append(data)
+                    elif valid and type_read in self.TELEMETRY_TYPES:
+                        self._telemetry_samples.append((type_read, data))
+                    elif valid:
+                        valid = False  # Not ours, e.g. a late reply
+                spi_handler.spi_deselect_current()
+            except Exception:
+                return (False, [])
+            finally:
+                spi_handler.spi_release()
+        payloads, self._reports = self._reports + payloads, []
+        names = self.report_signals()
+        reports = []
+        for payload in payloads:
+            time_us, values = spi_handler.parse_report(payload)
+            if time_us is None or any(signal >= len(names) for signal in values):
+                continue
+            values = {
+                names[signal]: value / self._report_scale(names[signal])
+                for signal, value in values.items()
+            }
+            reports.append({"time_us": time_us, "values": values})
+        return (True, reports)
+
+    def _decode_telemetry_record(self, type_read, data):
+        if type_read == self.PACKET_TYPE_TELEMETRY_SAMPLE:
+            return self._decode_telemetry_sample(data)
+        # Compact: until the next keyframe, a sample that does not decode whole loses the rest
+        count = pressure_protocol.TELEMETRY_SAMPLE.size(self.NUM_CONTROLLERS) // 2
+        end, words = spi_handler.delta_decode(data, self._telemetry_prev, count)
+        self._telemetry_prev = words if end == len(data) else None
+        if self._telemetry_prev is None:
+            return {}
+        return self._decode_telemetry_sample(spi_handler.delta_record_bytes(words, "little"))
+
+    def _decode_telemetry_sample(self, data):
+        layout = pressure_protocol.TELEMETRY_SAMPLE
+        if len(data) != layout.size(self.NUM_CONTROLLERS):
+            return {}
+        sample = layout.decode(data, self.NUM_CONTROLLERS)
+        sample["pressure_actual"] = [v / self.PRESSURE_SCALE for v in sample["pressure_actual"]]
+        return sample
+
+    def get_history(self, start_seq, max_records=None):
+        """
+        Read control cycle records kept by the firmware, from start_seq onwards.
+
+        Returns:
+            tuple: (valid, history) with history keys oldest_seq, newest_seq (the
+            records the firmware still holds) and records, one dict per cycle with
+            keys seq, time_us, pressure_actual, pressure_output, flow_actual, pid_terms
+        """
+        if max_records is None:
+            max_records = self.HISTORY_REPLY_MAX
+        data = list((start_seq & 0xFFFF).to_bytes(2, "little")) + [max_records & 0xFF]
+        valid, data = self.packet_query(self.PACKET_TYPE_GET_HISTORY, data)
+        record_size = pressure_protocol.HISTORY_RECORD.size(self.NUM_CONTROLLERS)
+        if not valid or len(data) < 6 or data[0] != 0 or len(data) != 6 + data[5] * record_size:
+            return (False, {})
+        history = {
+            "oldest_seq": int.from_bytes(data[1:3], byteorder="little", signed=False),
+            "newest_seq": int.from_bytes(data[3:5], byteorder="little", signed=False),
+            "records": [],
+        }
+        for index in range(6, len(data), record_size):
+            history["records"].append(self._parse_history_record(data, index))
+        return (True, history)
+
+    def _parse_history_record(self, record, offset=0):
+        record = pressure_protocol.HISTORY_RECORD.decode(record, self.NUM_CONTROLLERS, offset)
+        for name in ("pressure_actual", "pressure_output"):
+            record[name] = [v / self.PRESSURE_SCALE for v in record[name]]
+        return record
+
+    def read_history(self, start_seq):
+        """
+        Read every record from start_seq up to the newest, in one HISTORY_STREAM transfer
+        of compact records where the firmware has it, otherwise with as many GET_HISTORY
+        queries as needed. Records the firmware has already overwritten are lost, which
+        shows as the first record's seq being later than start_seq.
+
+        Returns:
+            tuple: (valid, records, next_seq) with next_seq to pass on the next call
+        """
+        if self.stream_supported and spi_handler.supports(self, self.PACKET_TYPE_HISTORY_STREAM):
+            valid, records, next_seq = self._read_history_stream(start_seq)
+            if valid or records:
+                return (valid, records, next_seq)
+            # Nothing came back, e.g. firmware from before HISTORY_STREAM: as before
+        records = []
+        while True:
+            valid, history = self.get_history(start_seq)
+            if not valid:
+                return (False, records, start_seq)
+            records.extend(history["records"])
+            if not history["records"]:
+                return (True, records, start_seq)
+            start_seq = (history["records"][-1]["seq"] + 1) & 0xFFFF
+            if start_seq == (history["newest_seq"] + 1) & 0xFFFF:
+                return (True, records, start_seq)
+
+    def _read_history_stream(self, start_seq):
+        request = list((start_seq & 0xFFFF).to_bytes(2, "little")) + [0xFF, 0xFF]
+        request.append(self.RECORD_FORMAT_COMPACT)
+
+        def other(type_read, data):
+            if type_read in self.TELEMETRY_TYPES:
+                self._telemetry_samples.append((type_read, data))
+            elif type_read == self.PACKET_TYPE_REPORT:
+                self._reports.append(data)
+
+        valid, data = spi_handler.stream_read(
+            self, self.PACKET_TYPE_HISTORY_STREAM, request, on_other=other
+        )
+        # Compact records, the first a keyframe. Whole ones read before a missing chunk are
+        # still good.
+        count = pressure_protocol.HISTORY_RECORD.size(self.NUM_CONTROLLERS) // 2
+        records = []
+        index = 0
+        words = None
+        while index < len(data):
+            index, words = spi_handler.delta_decode(data, words, count, index)
+            if words is None:
+                break
+            records.append(
+                self._parse_history_record(spi_handler.delta_record_bytes(words, "little"))
+            )
+        if records:
+            start_seq = (records[-1]["seq"] + 1) & 0xFFFF
+        return (valid, records, start_seq)
+
+    def get_status(self):
+        """
+        Read actual and target pressures and flows, control modes and flow PID
+        constants in one BATCH transaction. Uses GET_STATUS_SNAPSHOT, so all
+        values come from the same control cycle. Firmware without it gets one
+        getter per value instead, and firmware without BATCH one query per value.
+
+        Returns:
+            tuple: (valid, status) with status keys pressure_actual, flow_actual,
+            pressure_target, flow_target, control_modes, pid_consts, plus the
+            other get_status_snapshot() keys when the firmware has it
+        """
+        snapshot = self.snapshot_supported
+        replies = spi_handler.query_many(self, self.PACKET_TYPE_BATCH, self.status_packet_types())
+        valid, status = self.decode_status(replies)
+        if snapshot and not self.snapshot_supported:
+            return self.get_status()
+        return (valid, status)
+
+    def status_packet_types(self):
+        """Payload-less packet types get_status() reads, in decode_status() order."""
+        if self.snapshot_supported:
+            return [self.PACKET_TYPE_GET_STATUS_SNAPSHOT, self.PACKET_TYPE_GET_FPID_CONSTS]
+        return [
+            self.PACKET_TYPE_GET_PRESSURE_ACTUAL,
+            self.PACKET_TYPE_GET_FLOW_ACTUAL,
+            self.PACKET_TYPE_GET_PRESSURE_TARGET,
+            self.PACKET_TYPE_GET_FLOW_TARGET,
+            self.PACKET_TYPE_GET_CONTROL_MODE,
+            self.PACKET_TYPE_GET_FPID_CONSTS,
+        ]
+
+    def decode_status(self, replies):
+        """
+        Decode the replies to status_packet_types(), as spi_handler.query_many()
+        returns them. Clears snapshot_supported on firmware without the snapshot
+        packet, whose status is then invalid.
+
+        Returns:
+            tuple: (valid, status) as get_status()
+        """
+        if replies is None:
+            return (False, {})
+        if self.snapshot_supported:
+            if replies[0][1] == [spi_handler.ERR_PACKET_INVALID]:
+                # Firmware without the snapshot packet
+                self.snapshot_supported = False
+                return (False, {})
+            valid, status = self._decode_status_snapshot(*replies[0])
+            pid_valid, status["pid_consts"] = self._decode_flow_pid_consts(*replies[1])
+            return (valid and pid_valid, status)
+
+        results = {
+            "pressure_actual": self._decode_pressures(*replies[0], signed=True),
+            "flow_actual": self._decode_flows(*replies[1]),
+            "pressure_target": self._decode_pressures(*replies[2], signed=False),
+            "flow_target": self._decode_flows(*replies[3]),
+            "control_modes": self._decode_control_modes(*replies[4]),
+            "pid_consts": self._decode_flow_pid_consts(*replies[5]),
+        }
+        valid = all(result[0] for result in results.values())
+        return (valid, {name: result[1] for name, result in results.items()})
+
+    def set_trace(self, regions, pin=0):
+        """
+        Select the regions a firmware trace pin is high over, for a logic analyzer. The PCB
+        has no spare pin for one, so this fails unless the build defines them, see
+        probe_port.h.
+
+        Args:
+            regions: TRACE_NAMES, none to leave the pin low
+            pin: 0 or 1
+
+        Returns:
+            bool: True if the board took them
+        """
+        try:
+            mask = spi_handler.trace_mask(self.TRACE_NAMES, regions)
+        except ValueError:
+            return False
+        return self.set_params({"trace_mask1" if pin else "trace_mask": mask})[0]
+
+    def set_module_addr(self, address):
+        """
+        Store the module address in the board's EEPROM, and expect it from
+        spi_handler.status_sweep(). spi_handler.MODULE_ADDR_ANY (a blank EEPROM)
+        answers every address.
+
+        Returns:
+            bool: True if the board stored it
+        """
+        valid, rc = self.set_params({"module_addr": address})
+        if valid:
+            self.module_addr = address
+        return valid
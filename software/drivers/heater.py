@@ -39,57 +39,149 @@ class PiHolder:
     PACKET_TYPE_STIR_SPEED_GET_ACTUAL = 14
     PACKET_TYPE_HEAT_POWER_LIMIT_SET = 15
     PACKET_TYPE_HEAT_POWER_LIMIT_GET = 16
+    PACKET_TYPE_GET_SPI_STATS = 17
+    PACKET_TYPE_BATCH = 18
+    PACKET_TYPE_GET_PROBE_STATS = 19
+    PACKET_TYPE_GET_TASK_STATS = 20
+    PACKET_TYPE_PID_MODEL = 21
+    PACKET_TYPE_PROFILE_SET_SEGMENT = 22
+    PACKET_TYPE_PROFILE_SET_RUNNING = 23
+    PACKET_TYPE_GET_HISTORY = 24
+    PACKET_TYPE_ADC_FILTER = 25
+    PACKET_TYPE_GET_EEPROM_STATUS = 26
+    PACKET_TYPE_PARAM_LIST = 27
+    PACKET_TYPE_PARAM_GET_MANY = 28
+    PACKET_TYPE_PARAM_SET_MANY = 29
+    PACKET_TYPE_GET_FAULT_LOG = 30
+    PACKET_TYPE_ECHO = 31
+    PACKET_TYPE_SYNC_TIME = 32
+    PACKET_TYPE_STAGE = 33
+    PACKET_TYPE_GET_CAPABILITIES = 34
+    PACKET_TYPE_GET_BOOT_STATUS = 35
+    PACKET_TYPE_GET_LATENCY_STATS = 36
+    PACKET_TYPE_HISTORY_STREAM = 37
+    PACKET_TYPE_BENCHMARK = 38
+    PACKET_TYPE_HEATER_ZONE = 39  # Builds with HEATER_ZONES 2 only
+    PACKET_TYPE_SUBSCRIBE = 40
+    PACKET_TYPE_REPORT = 41  # Pushed by the firmware, never sent by the host
+    PACKET_TYPE_FLASH = 42  # Firmware update, see flasher.py
+
+    # Parameter ids, main.c PARAM_ID_*, for get_params() / set_params()
+    PARAM_IDS = {
+        "pid_p": 1,
+        "pid_i": 2,
+        "pid_d": 3,
+        "temp_target": 4,  # degC x 100
+        "autotune_target": 5,
+        "heat_power_limit_pc": 6,
+        "run_on_start": 7,
+        "model_flags": 8,
+        "model_sp_weight_pc": 9,
+        "stir_accel_rps_s": 10,
+        "adc_oversampling": 11,
+        "adc_mode": 12,
+        "adc_iir_shift": 13,
+        "warm_start": 14,  # 1 resumes the PID from its last settled output or output map, not stored
+        "pwm_hires": 15,  # 1 for the 16-bit heater PWM and dithered stirrer output, not stored
+        "module_addr": 16,  # Address of addressed BATCHes, see set_module_addr()
+        "stir_period_ms": 17,  # Stirrer control period, 2-100 ms on its own timer, not stored
+        "supply_budget_ma": 18,  # Heater and stirrer supply current shared on duty, 0 for none
+        "observer_shift": 19,  # PID on the model-based observer, reading filter 2**n periods, 0 off
+        "trace_mask": 20,  # TRACE_NAMES bits on the trace pin, not stored, see set_trace()
+        "temp_actual": 32,  # Read only
+        "stir_speed_rps": 33,
+        "heater_output_cap": 34,  # Heater output limit left by the budget, of 65535
+        "observer_temp": 35,  # degC x 100 the PID tracks, the reading while the observer is off
+    }
+
+    # Fault log ids, main.c FAULT_ID_*, see get_fault_log()
+    FAULT_NAMES = {
+        0: "reset",
+        1: "hpid_error",
+        2: "htune_fail",
+        3: "stir_error",
+        4: "heater_guard",  # arg 1 reading jump, 2 heat over target, 3 no rise
+        5: "heater_zone_error",  # arg zone << 8 | hpid_error
+    }
+
+    # Execution time probes, in probe_port.h order
+    PROBE_NAMES = ("loop", "heater_pid", "stir_pid", "packet")
+
+    # Trace regions, in probe_port.h TRACE_* order, see set_trace()
+    TRACE_NAMES = (
+        "isr_timer1",
+        "isr_adc",
+        "isr_stir",
+        "isr_spi",
+        "heater_pid",
+        "stir_pid",
+        "packet",
+    )
+
+    # Benchmark kernels, in bench_port.h order
+    BENCH_NAMES = ("null", "frame_checksum", "frame_crc", "heater_pid", "heater_temp")
+
+    # Control loops timed by GET_LATENCY_STATS, latency_port.h LATENCY_*
+    LATENCY_LOOPS = ("heater", "stir")
+
+    # Control tasks, in main.c TASK_* order
+    TASK_NAMES = ("heater", "stir")
+
+    # AUTOTUNE_SET_RUNNING flags, main.c HTUNE_FLAG_*
+    AUTOTUNE_FLAG_FAST = 0x01
+    AUTOTUNE_REMAINING_UNKNOWN = 0xFFFF
+
+    # PID_MODEL flags, main.c HMODEL_FLAG_*
+    PID_MODEL_FLAG_FEEDFORWARD = 0x01
+    PID_MODEL_FLAG_BOOST = 0x02
+
+    # GET_HISTORY, main.c HISTORY_*
+    HISTORY_REPLY_MAX = 10  # Records per GET_HISTORY reply
+    HISTORY_RECORD_SIZE = 22
+    HISTORY_TERM_SCALE = 2  # P, I, D terms are kept in half output counts
+    HISTORY_FLAGS = ("heater_pid", "autotune", "profile", "stir", "boost")
+    HISTORY_FORMAT_COMPACT = 1  # HISTORY_STREAM format, rio_delta records
+
+    # ADC_FILTER, main.c HEATER_ADC_*
+    ADC_OVERSAMPLING_MAX = 7
+    ADC_MODES = ("oversample", "average")
+    ADC_IIR_SHIFT_MAX = 8
+
+    # SUBSCRIBE signals, main.c REPORT_SIGNAL_*, then zone1.. on builds with more zones
+    REPORT_SIGNALS = ("temp", "stir_speed")
+
+    # HEATER_ZONE, main.c E_HPID_STATE order
+    ZONE_STATES = ("unconfigured", "ready", "running", "suspended", "error")
+
+    # Stirrer soft start, main.c E_STIR_STATE and E_STIR_PHASE order
+    STIR_STATE_ERROR = 3
+    STIR_PHASES = ("spinup", "ramp", "recouple")
+
+    # Temperature profile, main.c HPROF_* and E_HPROF_STATE order
+    PROFILE_SEGMENTS_MAX = 16
+    PROFILE_STATES = ("idle", "ramp", "settle", "hold", "done", "aborted")
 
     def __init__(self, device_port, reply_pause_s):
         self.device_port = device_port
         self.reply_pause_s = reply_pause_s
+        self.crc_mode = spi_handler.CRC_NONE  # See spi_handler.negotiate_crc()
+        self.capabilities = None  # See spi_handler.discover()
+        self.bulk_read_supported = True  # See spi_handler.read_bytes()
+        self.batch_supported = True
+        self.module_addr = spi_handler.MODULE_ADDR_ANY  # See set_module_addr()
+        self.module_addr_supported = True  # See spi_handler.status_sweep()
+        self.params = {}  # Descriptor table, see list_params()
+        self._reports = []  # REPORT payloads read while waiting for a reply
 
     def read_bytes(self, bytes):
-        data = []
-        # Ensure spi is initialized
-        if spi_handler.spi is None:
-            import logging
-
-            logger = logging.getLogger(__name__)
-            logger.error("SPI not initialized! Call spi_init() before using drivers.")
-            return []
-        for x in range(bytes):
-            data.extend(spi_handler.spi.xfer2([0]))
-        return data
+        return spi_handler.read_bytes(self, bytes)
 
     def packet_read(self):
-        valid = False
-        type_read = 0  # Initialize type_read
-        data = []
-        spi_handler.spi_select_device(self.device_port)
-        data_bytes = self.read_bytes(1)
-        if len(data_bytes) > 0 and data_bytes[0] == self.STX:
-            data_bytes.extend(self.read_bytes(2))
-            if len(data_bytes) >= 3:
-                size = data_bytes[1]
-                type_read = data_bytes[2]
-                data_bytes.extend(self.read_bytes(size - 3))
-                checksum = sum(data_bytes) & 0xFF
-                if checksum == 0:
-                    data = data_bytes[3 : (size - 1)]
-                    valid = True
-        if not valid:
-            data = []
-        return valid, type_read, data
+        return spi_handler.packet_read(self)
 
     def packet_write(self, type, data):
-        # Ensure spi is initialized
-        if spi_handler.spi is None:
-            import logging
-
-            logger = logging.getLogger(__name__)
-            logger.error("SPI not initialized! Call spi_init() before using drivers.")
-            return
-        msg = [2, len(data) + 4, type] + data
-        checksum = (-(sum(msg) & 0xFF)) & 0xFF
-        msg.append(checksum)
-        spi_handler.spi_select_device(self.device_port)
-        spi_handler.spi.xfer2(msg)
+        # Bytes shifted in meanwhile: earlier replies still in the write ring, see pipeline_query()
+        return spi_handler.packet_write(self, type, data)
 
     def packet_query(self, type, data):
         valid = False  # Initialize before try block
@@ -97,14 +189,15 @@ class PiHolder:
         try:
             spi_handler.spi_lock()
             self.packet_write(type, data)
-            #      time.sleep( self.reply_pause_s )
-            spi_handler.pi_wait_s(self.reply_pause_s)
+            spi_handler.wait_reply(self)
             valid = True
             data_read = []
             type_read = 0x100
             try:
                 while valid and (type_read != type) and (type_read != 0):
                     valid, type_read, data_read = self.packet_read()
+                    if valid and type_read == self.PACKET_TYPE_REPORT and type != type_read:
+                        self._reports.append(data_read)
             except Exception:
                 valid = False
                 data_read = []
@@ -185,6 +278,9 @@ class PiHolder:
 
     def get_pid_status(self):
         valid, data = self.packet_query(self.PACKET_TYPE_PID_GET_STATUS, [])
+        return self._decode_pid_status(valid, data)
+
+    def _decode_pid_status(self, valid, data):
         if valid:
             pid_status = data[1]
             pid_error = data[2]
@@ -195,16 +291,21 @@ class PiHolder:
 
     def get_temp_actual(self):
         valid, data = self.packet_query(self.PACKET_TYPE_TEMP_GET_ACTUAL, [])
+        return self._decode_temp_actual(valid, data)
+
+    def _decode_temp_actual(self, valid, data):
         if valid:
             temp_c = int.from_bytes(data[1:3], byteorder="big", signed=True) / self.TEMP_SCALE
         else:
             temp_c = 0
         return (valid and (data[0] == 0), temp_c)
 
-    def set_autotune_running(self, running, temp_c):
+    def set_autotune_running(self, running, temp_c, fast=False):
         temp_c_scaled = round(temp_c * 100)
         send_bytes = list(running.to_bytes(1, "little", signed=False))
         send_bytes.extend(list(temp_c_scaled.to_bytes(2, "little", signed=True)))
+        if fast:
+            send_bytes.append(self.AUTOTUNE_FLAG_FAST)
         valid, data = self.packet_query(self.PACKET_TYPE_AUTOTUNE_SET_RUNNING, send_bytes)
         return valid and (data[0] == 0)
 
@@ -218,6 +319,9 @@ class PiHolder:
 
     def get_autotune_status(self):
         valid, data = self.packet_query(self.PACKET_TYPE_AUTOTUNE_GET_STATUS, [])
+        return self._decode_autotune_status(valid, data)
+
+    def _decode_autotune_status(self, valid, data):
         if valid:
             autotune_status = data[1]
             autotune_fail = data[2]
@@ -226,8 +330,27 @@ class PiHolder:
             autotune_fail = 0
         return (valid and (data[0] == 0), autotune_status, autotune_fail)
 
+    def get_autotune_remaining_s(self):
+        """
+        Read the firmware estimate of the autotune time remaining.
+
+        Returns:
+            tuple: (valid, remaining_s), remaining_s is 0 when autotune is not running and
+            None before the first cycle is measured or on firmware without the estimate
+        """
+        valid, data = self.packet_query(self.PACKET_TYPE_AUTOTUNE_GET_STATUS, [])
+        if not valid or len(data) < 5 or data[0] != 0:
+            return (valid and len(data) >= 3 and data[0] == 0, None)
+        remaining_s = int.from_bytes(data[3:5], byteorder="big", signed=False)
+        if remaining_s == self.AUTOTUNE_REMAINING_UNKNOWN:
+            remaining_s = None
+        return (True, remaining_s)
+
     def get_stir_speed_actual(self):
         valid, data = self.packet_query(self.PACKET_TYPE_STIR_SPEED_GET_ACTUAL, [])
+        return self._decode_stir_speed_actual(valid, data)
+
+    def _decode_stir_speed_actual(self, valid, data):
         if valid:
             stir_speed_rps = int.from_bytes(data[1:3], byteorder="big", signed=False)
         else:
@@ -236,15 +359,44 @@ class PiHolder:
 
     def get_stir_status(self):
         valid, data = self.packet_query(self.PACKET_TYPE_STIR_GET_STATUS, [])
+        return self._decode_stir_status(valid, data)
+
+    def _decode_stir_status(self, valid, data):
         if valid:
             stir_status = data[1]
         else:
             stir_status = 0
         return (valid and (data[0] == 0), stir_status)
 
-    def set_stir_running(self, running, stir_speed_rps):
+    def get_stir_ramp_status(self):
+        """
+        Read the stirrer soft start progress.
+
+        Returns:
+            tuple: (valid, status) with keys state, phase (STIR_PHASES), stalls (since
+            started, saturating at 255) and setpoint_rps (the ramped target)
+        """
+        valid, data = self.packet_query(self.PACKET_TYPE_STIR_GET_STATUS, [])
+        if not valid or len(data) < 6 or data[0] != 0:
+            return (False, {})
+        phase = data[2]
+        status = {
+            "state": data[1],
+            "phase": self.STIR_PHASES[phase] if phase < len(self.STIR_PHASES) else phase,
+            "stalls": data[3],
+            "setpoint_rps": int.from_bytes(data[4:6], byteorder="big", signed=False),
+        }
+        return (True, status)
+
+    def set_stir_running(self, running, stir_speed_rps, accel_rps_per_s=None):
+        """
+        Start, retarget or stop the stirrer. The firmware ramps the setpoint at
+        accel_rps_per_s (0 steps straight to the target); None keeps the last rate.
+        """
         send_bytes = list(running.to_bytes(1, "little", signed=False))
         send_bytes.extend(list(stir_speed_rps.to_bytes(2, "little", signed=False)))
+        if accel_rps_per_s is not None:
+            send_bytes.append(int(accel_rps_per_s))
         valid, data = self.packet_query(self.PACKET_TYPE_STIR_SET_RUNNING, send_bytes)
         return valid and (data[0] == 0)
 
@@ -260,3 +412,677 @@ class PiHolder:
         else:
             heat_power_limit_pc = 0
         return (valid and (data[0] == 0), heat_power_limit_pc)
+
+    def pid_model(self, feedforward=None, sp_weight_pc=None, boost=None):
+        """
+        Read, and optionally set, the heater plant model options.
+
+        The model is identified by autotune. The options are stored in the firmware EEPROM.
+
+        Args:
+            feedforward: True/False to enable the steady-state feedforward, None to keep it
+            sp_weight_pc: setpoint weight of the P and D terms (0-100), None to keep it
+            boost: True/False to run steps up of 2 degC or more at full power to the
+                braking point of the model before the PID, None to keep it
+
+        Returns:
+            tuple: (valid, model) with keys valid, feedforward, boost, sp_weight_pc,
+            ambient_c, ref_c, ref_output, tau_s, dead_s and ff_output
+        """
+        send_bytes = []
+        if feedforward is not None or sp_weight_pc is not None or boost is not None:
+            valid, model = self.pid_model()
+            if not valid:
+                return (False, {})
+            if feedforward is None:
+                feedforward = model["feedforward"]
+            if sp_weight_pc is None:
+                sp_weight_pc = model["sp_weight_pc"]
+            if boost is None:
+                boost = model["boost"]
+            flags = (self.PID_MODEL_FLAG_FEEDFORWARD if feedforward else 0) | (
+                self.PID_MODEL_FLAG_BOOST if boost else 0
+            )
+            send_bytes = [flags, int(sp_weight_pc)]
+        valid, data = self.packet_query(self.PACKET_TYPE_PID_MODEL, send_bytes)
+        if not valid or len(data) < 16 or data[0] != 0:
+            return (False, {})
+
+        def u16(offset, signed=False):
+            return int.from_bytes(data[offset : offset + 2], byteorder="big", signed=signed)
+
+        model = {
+            "valid": bool(data[1]),
+            "feedforward": bool(data[2] & self.PID_MODEL_FLAG_FEEDFORWARD),
+            "boost": bool(data[2] & self.PID_MODEL_FLAG_BOOST),
+            "sp_weight_pc": data[3],
+            "ambient_c": u16(4, signed=True) / self.TEMP_SCALE,
+            "ref_c": u16(6, signed=True) / self.TEMP_SCALE,
+            "ref_output": u16(8),
+            "tau_s": u16(10),
+            "dead_s": u16(12),
+            "ff_output": u16(14),
+        }
+        return (True, model)
+
+    def adc_filter(self, oversampling=None, mode=None, iir_shift=None):
+        """
+        Read, and optionally set, the thermistor ADC filter configuration and its noise.
+
+        The configuration is kept in firmware RAM only, and resets at boot.
+
+        Args:
+            oversampling: ADFL0CON OVRSAM code (0-ADC_OVERSAMPLING_MAX), None to keep it
+            mode: one of ADC_MODES, None to keep it
+            iir_shift: IIR filter shift (0-ADC_IIR_SHIFT_MAX, 0 is off), None to keep it
+
+        Returns:
+            tuple: (valid, config) with keys oversampling, mode, iir_shift, result_bits,
+            raw_rms_counts (16-bit counts), raw_rms_c and filtered_rms_c
+        """
+        send_bytes = []
+        if oversampling is not None or mode is not None or iir_shift is not None:
+            valid, config = self.adc_filter()
+            if not valid:
+                return (False, {})
+            if oversampling is None:
+                oversampling = config["oversampling"]
+            if mode is None:
+                mode = config["mode"]
+            if iir_shift is None:
+                iir_shift = config["iir_shift"]
+            if mode not in self.ADC_MODES:
+                return (False, {})
+            send_bytes = [int(oversampling), self.ADC_MODES.index(mode), int(iir_shift)]
+        valid, data = self.packet_query(self.PACKET_TYPE_ADC_FILTER, send_bytes)
+        if not valid or len(data) < 11 or data[0] != 0:
+            return (False, {})
+
+        def u16(offset):
+            return int.from_bytes(data[offset : offset + 2], byteorder="big", signed=False)
+
+        config = {
+            "oversampling": data[1],
+            "mode": self.ADC_MODES[data[2]] if data[2] < len(self.ADC_MODES) else data[2],
+            "iir_shift": data[3],
+            "result_bits": data[4],
+            "raw_rms_counts": u16(5) / 16,
+            "raw_rms_c": u16(7) / 1000,
+            "filtered_rms_c": u16(9) / 1000,
+        }
+        return (True, config)
+
+    def heater_zone(self, zone, running=None, temp_c=None, pid=None):
+        """
+        Read, and optionally run or stop, a heater zone past zone 0.
+
+        Zone 0 is the heater of the other methods. A zone has a PID of its own on gains set
+        here, with no autotune, model or profile. The firmware stops it with error 2 when its
+        thermistor is lost and 3 over 85 degC.
+
+        Args:
+            zone: 1 on a board built with HEATER_ZONES 2
+            running: True/False to run or stop the zone, None to only read it
+            temp_c: target, None to keep it
+            pid: (p, i, d) gains in the units of set_pid_coeffs(), None to keep them
+
+        Returns:
+            tuple: (valid, status) with keys zone, state, error, present, target_c, temp_c,
+            output (of 65535) and pid
+        """
+        send_bytes = [int(zone)]
+        if running is not None:
+            if temp_c is None:
+                valid, status = self.heater_zone(zone)
+                if not valid:
+                    return (False, {})
+                temp_c = status["target_c"]
+            send_bytes.append(1 if running else 0)
+            send_bytes.extend(round(temp_c * self.TEMP_SCALE).to_bytes(2, "little", signed=True))
+            if pid is not None:
+                for gain in pid:
+                    send_bytes.extend(int(gain).to_bytes(2, "little", signed=False))
+        valid, data = self.packet_query(self.PACKET_TYPE_HEATER_ZONE, send_bytes)
+        if not valid or len(data) < 17 or data[0] != 0:
+            return (False, {})
+
+        def u16(offset, signed=False):
+            return int.from_bytes(data[offset : offset + 2], byteorder="big", signed=signed)
+
+        state = self.ZONE_STATES[data[2]] if data[2] < len(self.ZONE_STATES) else data[2]
+        status = {
+            "zone": data[1],
+            "state": state,
+            "error": data[3],
+            "present": bool(data[4]),
+            "target_c": u16(5, signed=True) / self.TEMP_SCALE,
+            "temp_c": u16(7, signed=True) / self.TEMP_SCALE,
+            "output": u16(9),
+            "pid": (u16(11), u16(13), u16(15)),
+        }
+        return (True, status)
+
+    def _report_signal(self, name):
+        if name in self.REPORT_SIGNALS:
+            return self.REPORT_SIGNALS.index(name)
+        if name.startswith("zone") and name[4:].isdigit() and int(name[4:]) > 0:
+            return len(self.REPORT_SIGNALS) + int(name[4:]) - 1
+        raise ValueError(name)
+
+    def _report_name(self, signal):
+        if signal < len(self.REPORT_SIGNALS):
+            return self.REPORT_SIGNALS[signal]
+        return f"zone{signal - len(self.REPORT_SIGNALS) + 1}"
+
+    def subscribe(self, signals):
+        """
+        Report by exception: the firmware queues a REPORT only when a subscribed signal moves
+        past its deadband from the value last sent, or its max interval passes without one.
+        Read them with read_reports(). Steady readings then cost no SPI traffic at all.
+
+        Args:
+            signals: dict of name to (deadband, max_interval_ms). Names are REPORT_SIGNALS
+                and zone1.. for the temperature of a heater_zone(); deadbands in degC, and
+                for stir_speed in the units of get_stir_speed(). A deadband of None sends on
+                the interval only, an interval of 0 only on change. None unsubscribes the
+                signal, and {} cancels every one.
+
+        Returns:
+            tuple: (valid, status) as spi_handler.parse_report_status(); a zone the board
+            does not have fails
+        """
+        try:
+            settings = {}
+            for name, setting in signals.items():
+                signal = self._report_signal(name)
+                if setting is not None and setting[0] is not None:
+                    scale = 1 if name == "stir_speed" else self.TEMP_SCALE
+                    setting = (round(setting[0] * scale), setting[1])
+                settings[signal] = setting
+        except ValueError:
+            return (False, {})
+        valid, data = self.packet_query(
+            self.PACKET_TYPE_SUBSCRIBE, spi_handler.subscribe_data(settings)
+        )
+        return spi_handler.parse_report_status(valid, data)
+
+    def read_reports(self):
+        """
+        Drain the REPORT packets queued by the firmware, plus any seen by packet_query().
+
+        Returns:
+            tuple: (valid, reports) with one dict per REPORT, keys time_us and values, a dict
+            of signal name to its reading, only the signals that were due
+        """
+        payloads = []
+        valid = True
+        try:
+            spi_handler.spi_lock()
+            while valid:
+                valid, type_read, data = self.packet_read()
+                if valid and type_read == self.PACKET_TYPE_REPORT:
+                    payloads.append(data)
+                elif valid:
+                    valid = False  # Not ours, e.g. a late reply
+            spi_handler.spi_deselect_current()
+        except Exception:
+            return (False, [])
+        finally:
+            spi_handler.spi_release()
+        payloads, self._reports = self._reports + payloads, []
+        reports = []
+        for payload in payloads:
+            time_us, values = spi_handler.parse_report(payload)
+            if time_us is None:
+                continue
+            values = {
+                self._report_name(signal): value / (1 if signal == 1 else self.TEMP_SCALE)
+                for signal, value in values.items()
+            }
+            reports.append({"time_us": time_us, "values": values})
+        return (True, reports)
+
+    def set_profile_segment(self, index, target_c, ramp_c_per_min, hold_s):
+        """
+        Upload one entry of the on-chip temperature profile.
+
+        Args:
+            index: segment index, 0 to PROFILE_SEGMENTS_MAX - 1
+            target_c: segment target temperature
+            ramp_c_per_min: setpoint ramp rate to the target, 0 to step straight to it
+            hold_s: hold time once the temperature has reached the target
+
+        Returns:
+            bool: True if accepted; fails while a profile is running
+        """
+        send_bytes = [index]
+        send_bytes.extend(round(target_c * 100).to_bytes(2, "little", signed=True))
+        send_bytes.extend(round(ramp_c_per_min * 100).to_bytes(2, "little", signed=False))
+        send_bytes.extend(int(hold_s).to_bytes(2, "little", signed=False))
+        valid, data = self.packet_query(self.PACKET_TYPE_PROFILE_SET_SEGMENT, send_bytes)
+        return valid and (data[0] == 0)
+
+    def set_profile_running(self, length, cycles=1):
+        """
+        Run the first <length> profile segments, <cycles> times (0 repeats until stopped).
+
+        The heater PID must be running. A new target from set_pid_temp() or set_pid_running()
+        takes over and aborts the profile. A length of 0 stops it.
+
+        Returns:
+            tuple: (valid, status), see get_profile_status()
+        """
+        send_bytes = [length, cycles] if length else [0]
+        valid, data = self.packet_query(self.PACKET_TYPE_PROFILE_SET_RUNNING, send_bytes)
+        return self._decode_profile_status(valid, data)
+
+    def get_profile_status(self):
+        """
+        Read the temperature profile progress.
+
+        Returns:
+            tuple: (valid, status) with keys state (PROFILE_STATES), segment, length, cycle
+            (full passes done), setpoint_c and hold_left_s
+        """
+        valid, data = self.packet_query(self.PACKET_TYPE_PROFILE_SET_RUNNING, [])
+        return self._decode_profile_status(valid, data)
+
+    def _decode_profile_status(self, valid, data):
+        if not valid or len(data) < 10 or data[0] != 0:
+            return (False, {})
+        state = data[1]
+        status = {
+            "state": self.PROFILE_STATES[state] if state < len(self.PROFILE_STATES) else state,
+            "segment": data[2],
+            "length": data[3],
+            "cycle": int.from_bytes(data[4:6], byteorder="big", signed=False),
+            "setpoint_c": int.from_bytes(data[6:8], byteorder="big", signed=True) / self.TEMP_SCALE,
+            "hold_left_s": int.from_bytes(data[8:10], byteorder="big", signed=False),
+        }
+        return (True, status)
+
+    def get_history(self, start_seq, max_records=HISTORY_REPLY_MAX):
+        """
+        Read heater period records kept by the firmware, from start_seq onwards.
+
+        Returns:
+            tuple: (valid, history) with history keys oldest_seq, newest_seq (the
+            records the firmware still holds) and records, one dict per heater period
+            with keys seq, time_us (host clock after sync_time()), temp_c, target_c, heater_output, pid_terms (P, I, D in output
+            counts), stir_speed_rps, stir_output and the HISTORY_FLAGS names set
+        """
+        data = list((start_seq & 0xFFFF).to_bytes(2, "little")) + [max_records & 0xFF]
+        valid, data = self.packet_query(self.PACKET_TYPE_GET_HISTORY, data)
+        size = self.HISTORY_RECORD_SIZE
+        if not valid or len(data) < 6 or data[0] != 0 or len(data) != 6 + data[5] * size:
+            return (False, {})
+        history = {
+            "oldest_seq": int.from_bytes(data[1:3], byteorder="big", signed=False),
+            "newest_seq": int.from_bytes(data[3:5], byteorder="big", signed=False),
+            "records": [],
+        }
+        for index in range(6, len(data), size):
+            history["records"].append(self._parse_history_record(data[index : index + size]))
+        return (True, history)
+
+    def _parse_history_record(self, record):
+        values = [
+            int.from_bytes(record[i : i + 2], byteorder="big", signed=True) for i in range(6, 20, 2)
+        ]
+        return {
+            "seq": int.from_bytes(record[0:2], byteorder="big", signed=False),
+            "time_us": int.from_bytes(record[2:6], byteorder="big", signed=False),
+            "temp_c": values[0] / self.TEMP_SCALE,
+            "target_c": values[1] / self.TEMP_SCALE,
+            "heater_output": values[2] & 0xFFFF,
+            "pid_terms": [v * self.HISTORY_TERM_SCALE for v in values[3:6]],
+            "stir_speed_rps": values[6] & 0xFFFF,
+            "stir_output": record[20],
+            "flags": [
+                name for bit, name in enumerate(self.HISTORY_FLAGS) if record[21] & (1 << bit)
+            ],
+        }
+
+    def read_history(self, start_seq):
+        """
+        Read every record from start_seq up to the newest, in one HISTORY_STREAM transfer
+        of compact records where the firmware has it, otherwise with as many GET_HISTORY
+        queries as needed. Records the firmware has already overwritten are lost, which
+        shows as the first record's seq being later than start_seq.
+
+        Returns:
+            tuple: (valid, records, next_seq) with next_seq to pass on the next call
+        """
+        if spi_handler.supports(self, self.PACKET_TYPE_HISTORY_STREAM):
+            valid, records, next_seq = self._read_history_stream(start_seq)
+            if valid or records:
+                return (valid, records, next_seq)
+            # Nothing came back, e.g. firmware from before HISTORY_STREAM: as before
+        records = []
+        while True:
+            valid, history = self.get_history(start_seq)
+            if not valid:
+                return (False, records, start_seq)
+            records.extend(history["records"])
+            if not history["records"]:
+                return (True, records, start_seq)
+            start_seq = (history["records"][-1]["seq"] + 1) & 0xFFFF
+            if start_seq == (history["newest_seq"] + 1) & 0xFFFF:
+                return (True, records, start_seq)
+
+    def _read_history_stream(self, start_seq):
+        request = list((start_seq & 0xFFFF).to_bytes(2, "little")) + [0xFF, 0xFF]
+        request.append(self.HISTORY_FORMAT_COMPACT)
+        valid, data = spi_handler.stream_read(self, self.PACKET_TYPE_HISTORY_STREAM, request)
+        # Compact records of the big endian words of the plain one, the first a keyframe.
+        # Whole ones read before a missing chunk are still good.
+        records = []
+        index = 0
+        words = None
+        while index < len(data):
+            index, words = spi_handler.delta_decode(
+                data, words, self.HISTORY_RECORD_SIZE // 2, index
+            )
+            if words is None:
+                break
+            records.append(self._parse_history_record(spi_handler.delta_record_bytes(words, "big")))
+        if records:
+            start_seq = (records[-1]["seq"] + 1) & 0xFFFF
+        return (valid, records, start_seq)
+
+    def get_spi_stats(self, reset=False):
+        """
+        Read SPI buffer sizes, drop/overflow counters and peak ring usage.
+
+        Args:
+            reset: True to clear the counters after reading
+
+        Returns:
+            tuple: (valid, stats) with stats keyed by spi_handler.SPI_STATS_FIELDS
+        """
+        valid, data = self.packet_query(self.PACKET_TYPE_GET_SPI_STATS, [1] if reset else [])
+        return spi_handler.parse_spi_stats(valid, data)
+
+    def benchmark(self, kernel, runs=100):
+        """
+        Time one firmware kernel on the module, for comparing compiler options and code
+        changes, see spi_handler.parse_bench_report().
+
+        Args:
+            kernel: A BENCH_NAMES name or its index
+            runs: 1 to 1000, the module's main loop waits for all of them
+
+        Returns:
+            tuple: (valid, result), (False, {}) if the firmware was built without it
+        """
+        return spi_handler.bench_query(
+            self, self.PACKET_TYPE_BENCHMARK, self.BENCH_NAMES, kernel, runs
+        )
+
+    def echo(self, payload):
+        """
+        Send <payload> and read it back, for drivers/spi_benchmark.py.
+
+        Args:
+            payload: Bytes to echo, up to the packet buffer less the return code
+
+        Returns:
+            tuple: (valid, data) with data the payload the board returned
+        """
+        valid, data = self.packet_query(self.PACKET_TYPE_ECHO, list(payload))
+        if not valid or len(data) < 1 or data[0] != 0:
+            return (False, [])
+        return (True, data[1:])
+
+    def get_probe_stats(self, reset=False):
+        """
+        Read the firmware execution time probes.
+
+        Args:
+            reset: True to clear the statistics after reading
+
+        Returns:
+            tuple: (valid, stats) with keys timer_hz and probes, see
+            spi_handler.parse_probe_stats(); probes are keyed by PROBE_NAMES
+        """
+        valid, data = self.packet_query(self.PACKET_TYPE_GET_PROBE_STATS, [1] if reset else [])
+        return spi_handler.parse_probe_stats(valid, data, self.PROBE_NAMES)
+
+    def sync_time(self, rounds=spi_handler.TIME_SYNC_ROUNDS):
+        """
+        Align the firmware clock of the history times with spi_handler.host_time_us(),
+        see spi_handler.sync_time(). The SYNC_TIME reply is little endian.
+        """
+        return spi_handler.sync_time(self, self.PACKET_TYPE_SYNC_TIME, rounds)
+
+    def stage(self, apply_us, packet_type, data):
+        """
+        Run a command when the synchronized clock reaches apply_us, with its reply
+        dropped. Stage the setpoints of one change on every module for the same time,
+        see spi_handler.stage_together(). Needs sync_time() first.
+
+        Args:
+            apply_us: time on spi_handler.host_time_us(), e.g. spi_handler.stage_time_us()
+            packet_type: the command, PACKET_TYPE_*
+            data: its data as it would be sent alone, up to spi_handler.STAGE_DATA_MAX bytes
+
+        Returns:
+            tuple: (valid, status) as get_stage_status()
+        """
+        valid, data = self.packet_query(
+            self.PACKET_TYPE_STAGE, spi_handler.stage_data(apply_us, packet_type, data)
+        )
+        return spi_handler.parse_stage_report(valid, data)
+
+    def cancel_staged(self):
+        """Drop every staged command that has not run yet."""
+        valid, data = self.packet_query(self.PACKET_TYPE_STAGE, [spi_handler.STAGE_CANCEL])
+        return spi_handler.parse_stage_report(valid, data)
+
+    def get_stage_status(self):
+        """
+        Read the staged command counters.
+
+        Returns:
+            tuple: (valid, status), see spi_handler.parse_stage_report()
+        """
+        valid, data = self.packet_query(self.PACKET_TYPE_STAGE, [])
+        return spi_handler.parse_stage_report(valid, data)
+
+    def get_eeprom_status(self, reset=False):
+        """
+        Read the firmware EEPROM write queue, see spi_handler.parse_eeprom_status().
+
+        Args:
+            reset: True to clear the committed, verify_failed and full_waits counters
+        """
+        valid, data = self.packet_query(self.PACKET_TYPE_GET_EEPROM_STATUS, [1] if reset else [])
+        return spi_handler.parse_eeprom_status(valid, data, "big")
+
+    def get_latency_stats(self, loop="heater", reset=False):
+        """
+        Read the sample to output latency and output period jitter of one control loop: the
+        heater from its ADC filter sample, the stirrer from its speed captures.
+
+        Args:
+            loop: A LATENCY_LOOPS name
+            reset: True to clear that loop's statistics after reading them
+
+        Returns:
+            tuple: (valid, stats), see spi_handler.parse_latency_stats()
+        """
+        index = self.LATENCY_LOOPS.index(loop)
+        valid, data = self.packet_query(self.PACKET_TYPE_GET_LATENCY_STATS, [index, 1] if reset else [index])
+        return spi_handler.parse_latency_stats(valid, data)
+
+    def get_boot_status(self):
+        """
+        Read whether the module is still booting (the first temperature sample), see
+        spi_handler.parse_boot_status().
+        """
+        valid, data = self.packet_query(self.PACKET_TYPE_GET_BOOT_STATUS, [])
+        return spi_handler.parse_boot_status(valid, data, "big")
+
+    def list_params(self):
+        """
+        Read the firmware parameter descriptor table, see spi_handler.param_list().
+
+        The table is kept in self.params for get_params().
+        """
+        valid, params = spi_handler.param_list(self)
+        if valid:
+            self.params = params
+        return (valid, params)
+
+    def get_params(self, ids=None):
+        """
+        Read several parameters in one or two packets.
+
+        Args:
+            ids: PARAM_IDS names or numeric ids, None for every parameter in the table
+
+        Returns:
+            tuple: (valid, values) with values keyed by numeric id
+        """
+        if not self.params and not self.list_params()[0]:
+            return (False, {})
+        if ids is None:
+            ids = list(self.params)
+        return spi_handler.param_get_many(
+            self, self.params, [self.PARAM_IDS.get(i, i) for i in ids]
+        )
+
+    def set_params(self, values):
+        """
+        Write several parameters, e.g. a configuration saved with get_params().
+
+        Args:
+            values: dict of PARAM_IDS name or numeric id -> value
+
+        Returns:
+            tuple: (valid, rc) as spi_handler.param_set_many()
+        """
+        return spi_handler.param_set_many(
+            self, {self.PARAM_IDS.get(i, i): value for i, value in values.items()}
+        )
+
+    def get_fault_log(self, max_records=None):
+        """
+        Read the firmware EEPROM fault log, newest first, see spi_handler.fault_log().
+
+        Returns:
+            tuple: (valid, records, pending), each record with its FAULT_NAMES name added
+        """
+        valid, records, pending = spi_handler.fault_log(self, max_records)
+        for record in records:
+            record["name"] = self.FAULT_NAMES.get(record["id"], record["id"])
+        return (valid, records, pending)
+
+    def get_task_stats(self, reset=False):
+        """
+        Read the run and deadline miss counters of the firmware control tasks.
+
+        Args:
+            reset: True to clear the counters after reading
+
+        Returns:
+            tuple: (valid, tasks) with tasks mapping TASK_NAMES to dicts of runs and missed
+        """
+        valid, data = self.packet_query(self.PACKET_TYPE_GET_TASK_STATS, [1] if reset else [])
+        if not valid or len(data) < 2 or data[0] != 0 or len(data) != 2 + 6 * data[1]:
+            return (False, {})
+        tasks = {}
+        for i in range(min(data[1], len(self.TASK_NAMES))):
+            record = data[2 + 6 * i : 8 + 6 * i]
+            tasks[self.TASK_NAMES[i]] = {
+                "runs": int.from_bytes(record[0:4], byteorder="little", signed=False),
+                "missed": int.from_bytes(record[4:6], byteorder="little", signed=False),
+            }
+        return (True, tasks)
+
+    def batch_query(self, commands):
+        """
+        Run several commands in one SPI transaction (BATCH packet).
+
+        Args:
+            commands: list of (packet_type, data) pairs
+
+        Returns:
+            tuple: (valid, replies) with one (packet_type, data) reply per command,
+            where data is what packet_query() would have returned for it alone
+        """
+        return spi_handler.batch_query(self, self.PACKET_TYPE_BATCH, commands)
+
+    def get_status(self):
+        """
+        Read PID, temperature, autotune and stirrer status in one BATCH
+        transaction. Falls back to one query per value on firmware without
+        BATCH support.
+
+        Returns:
+            tuple: (valid, pid_status, pid_error, temp_c, autotune_status,
+            autotune_fail, stir_status, stir_speed_rps)
+        """
+        return self.decode_status(
+            spi_handler.query_many(self, self.PACKET_TYPE_BATCH, self.status_packet_types())
+        )
+
+    def status_packet_types(self):
+        """Payload-less packet types get_status() reads, in decode_status() order."""
+        return [
+            self.PACKET_TYPE_PID_GET_STATUS,
+            self.PACKET_TYPE_TEMP_GET_ACTUAL,
+            self.PACKET_TYPE_AUTOTUNE_GET_STATUS,
+            self.PACKET_TYPE_STIR_GET_STATUS,
+            self.PACKET_TYPE_STIR_SPEED_GET_ACTUAL,
+        ]
+
+    def decode_status(self, replies):
+        """
+        Decode the replies to status_packet_types(), as spi_handler.query_many()
+        returns them.
+
+        Returns:
+            tuple: as get_status()
+        """
+        if replies is None:
+            return (False, 0, 0, 0, 0, 0, 0, 0)
+        pid = self._decode_pid_status(*replies[0])
+        temp = self._decode_temp_actual(*replies[1])
+        autotune = self._decode_autotune_status(*replies[2])
+        stir = self._decode_stir_status(*replies[3])
+        stir_speed = self._decode_stir_speed_actual(*replies[4])
+        valid = pid[0] and temp[0] and autotune[0] and stir[0] and stir_speed[0]
+        return (valid,) + pid[1:] + temp[1:] + autotune[1:] + stir[1:] + stir_speed[1:]
+
+    def set_trace(self, regions):
+        """
+        Select the regions the firmware trace pin, RB13, is high over, for a logic analyzer.
+        The ADC interrupt is traced from reset. Builds with a second heater zone use RB13 for
+        it and have no trace pin, this then fails.
+
+        Args:
+            regions: TRACE_NAMES, none to leave the pin low
+
+        Returns:
+            bool: True if the board took them
+        """
+        try:
+            mask = spi_handler.trace_mask(self.TRACE_NAMES, regions)
+        except ValueError:
+            return False
+        return self.set_params({"trace_mask": mask})[0]
+
+    def set_module_addr(self, address):
+        """
+        Store the module address in the board's EEPROM, and expect it from
+        spi_handler.status_sweep(). spi_handler.MODULE_ADDR_ANY (a blank EEPROM)
+        answers every address.
+
+        Returns:
+            bool: True if the board stored it
+        """
+        valid, rc = self.set_params({"module_addr": address})
+        if valid:
+            self.module_addr = address
+        return valid
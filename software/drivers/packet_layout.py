@@ -0,0 +1,97 @@
+"""
+Packed packet layouts, the host side of a board's protocol definition.
+
+A layout is the field list of a reply or record as hardware-modules/common/rio_protocol/
+gen_protocol.py writes it into a board's generated module, e.g. pressure_protocol.py:
+little endian, with per channel fields sized by the channel count the host learns at run
+time. decode() and encode() run one precompiled struct.Struct per channel count.
+"""
+
+import struct
+
+TYPE_CODES = {"u8": "B", "i8": "b", "u16": "H", "i16": "h", "u32": "I", "i32": "i"}
+
+
+class PacketLayout:
+    def __init__(self, name, fields, channel=()):
+        """
+        Args:
+            fields: (name, type, count) in order, count 1, "N" for one per channel, or
+                ("N", k) for k per channel, which decodes as one list per channel
+            channel: (name, type) repeated once per channel after the fields, channel 0
+                first, which decodes as one list per name
+        """
+        self.name = name
+        self.fields = tuple(fields)
+        self.channel = tuple(channel)
+        self._structs = {}
+
+    def _struct(self, n):
+        packer = self._structs.get(n)
+        if packer is None:
+            codes = "".join(
+                TYPE_CODES[type_] * self._count(count, n) for _, type_, count in self.fields
+            )
+            codes += "".join(TYPE_CODES[type_] for _, type_ in self.channel) * n
+            packer = self._structs[n] = struct.Struct("<" + codes)
+        return packer
+
+    @staticmethod
+    def _count(count, n):
+        if count == "N":
+            return n
+        if isinstance(count, tuple):
+            return n * count[1]
+        return count
+
+    def size(self, n):
+        """Bytes of the layout for n channels"""
+        return self._struct(n).size
+
+    def channels(self, size):
+        """Channel count of a size byte layout, or None if no count fits"""
+        fixed = self.size(0)
+        per_channel = self.size(1) - fixed
+        if size < fixed or not per_channel or (size - fixed) % per_channel:
+            return None
+        return (size - fixed) // per_channel
+
+    def decode(self, data, n, offset=0):
+        """
+        Fields of the n channel layout at data[offset:], as a dict by field name. The data
+        must hold it whole, check size() first.
+        """
+        values = self._struct(n).unpack_from(bytes(data), offset)
+        decoded = {}
+        index = 0
+        for name, _, count in self.fields:
+            if count == 1:
+                decoded[name] = values[index]
+                index += 1
+            elif count == "N":
+                decoded[name] = list(values[index : index + n])
+                index += n
+            else:
+                k = count[1]
+                rows = values[index : index + k * n]
+                decoded[name] = [list(rows[k * i : k * (i + 1)]) for i in range(n)]
+                index += k * n
+        stride = len(self.channel)
+        for j, (name, _) in enumerate(self.channel):
+            decoded[name] = list(values[index + j : index + stride * n : stride])
+        return decoded
+
+    def encode(self, values, n):
+        """bytes of the n channel layout from values, a dict as decode() returns"""
+        flat = []
+        for name, _, count in self.fields:
+            if count == 1:
+                flat.append(values[name])
+            elif count == "N":
+                flat.extend(values[name])
+            else:
+                for row in values[name]:
+                    flat.extend(row)
+        for chan in range(n):
+            flat.extend(values[name][chan] for name, _ in self.channel)
+        return self._struct(n).pack(*flat)
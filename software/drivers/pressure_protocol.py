@@ -0,0 +1,147 @@
+"""
+Generated by hardware-modules/common/rio_protocol/gen_protocol.py from
+hardware-modules/pressure-flow-control/pressure_and_flow_pic/protocol.json, edit that
+and run it again. Packet types and reply layouts of the pressure_and_flow_pic firmware,
+see drivers/packet_layout.py.
+"""
+
+from drivers.packet_layout import PacketLayout
+
+
+class PressurePackets:
+    PACKET_TYPE_GET_ID = 1
+    PACKET_TYPE_SET_PRESSURE_TARGET = 2
+    PACKET_TYPE_GET_PRESSURE_TARGET = 3
+    PACKET_TYPE_GET_PRESSURE_ACTUAL = 4
+    PACKET_TYPE_SET_FLOW_TARGET = 5
+    PACKET_TYPE_GET_FLOW_TARGET = 6
+    PACKET_TYPE_GET_FLOW_ACTUAL = 7
+    PACKET_TYPE_SET_CONTROL_MODE = 8
+    PACKET_TYPE_GET_CONTROL_MODE = 9
+    PACKET_TYPE_SET_FPID_CONSTS = 10
+    PACKET_TYPE_GET_FPID_CONSTS = 11
+    PACKET_TYPE_GET_SPI_STATS = 12
+    PACKET_TYPE_BATCH = 13
+    PACKET_TYPE_GET_STATUS_SNAPSHOT = 14
+    PACKET_TYPE_SET_TELEMETRY = 15
+    PACKET_TYPE_TELEMETRY_SAMPLE = 16  # Pushed by the firmware
+    PACKET_TYPE_GET_HISTORY = 17
+    PACKET_TYPE_SET_LOOP_CONFIG = 18
+    PACKET_TYPE_GET_LOOP_STATS = 19
+    PACKET_TYPE_SET_PPID_CONSTS = 20
+    PACKET_TYPE_GET_PPID_CONSTS = 21
+    PACKET_TYPE_SET_FLOW_FF = 22
+    PACKET_TYPE_SET_PROFILE_POINTS = 23
+    PACKET_TYPE_SET_PROFILE = 24
+    PACKET_TYPE_GET_PROBE_STATS = 25
+    PACKET_TYPE_GET_EEPROM_STATUS = 26
+    PACKET_TYPE_PARAM_LIST = 27
+    PACKET_TYPE_PARAM_GET_MANY = 28
+    PACKET_TYPE_PARAM_SET_MANY = 29
+    PACKET_TYPE_GET_FAULT_LOG = 30
+    PACKET_TYPE_SET_SIGNAL_FILTER = 31
+    PACKET_TYPE_SET_ADC_CONFIG = 32
+    PACKET_TYPE_ECHO = 33
+    PACKET_TYPE_SYNC_TIME = 34
+    PACKET_TYPE_SET_FRAME_SYNC = 35
+    PACKET_TYPE_STAGE = 36
+    PACKET_TYPE_GET_CAPABILITIES = 37
+    PACKET_TYPE_GET_BOOT_STATUS = 38
+    PACKET_TYPE_GET_I2C_STATS = 39
+    PACKET_TYPE_SET_FLOW_AUTOTUNE = 40
+    PACKET_TYPE_SET_FLOW_SCHED = 41
+    PACKET_TYPE_GET_LATENCY_STATS = 42
+    PACKET_TYPE_HISTORY_STREAM = 43
+    PACKET_TYPE_TELEMETRY_COMPACT = 44  # Pushed by the firmware
+    PACKET_TYPE_BENCHMARK = 45
+    PACKET_TYPE_PRESSURE_CAL = 46
+    PACKET_TYPE_SUBSCRIBE = 47
+    PACKET_TYPE_REPORT = 48  # Pushed by the firmware
+    PACKET_TYPE_FLASH = 49
+
+
+# GET_PRESSURE_ACTUAL, mbar << PRESSURE_SHL
+PRESSURE_ACTUAL_REPLY = PacketLayout(
+    "pressure_actual_reply",
+    [
+        ("rc", "u8", 1),
+        ("pressure", "i16", "N"),
+    ],
+)
+
+# GET_PRESSURE_TARGET, mbar << PRESSURE_SHL
+PRESSURE_TARGET_REPLY = PacketLayout(
+    "pressure_target_reply",
+    [
+        ("rc", "u8", 1),
+        ("pressure", "u16", "N"),
+    ],
+)
+
+# GET_FLOW_ACTUAL and GET_FLOW_TARGET, ul/hr
+FLOW_REPLY = PacketLayout(
+    "flow_reply",
+    [
+        ("rc", "u8", 1),
+        ("flow", "i16", "N"),
+    ],
+)
+
+# GET_STATUS_SNAPSHOT, one control cycle, per channel values interleaved
+STATUS_SNAPSHOT_REPLY = PacketLayout(
+    "status_snapshot_reply",
+    [
+        ("rc", "u8", 1),
+        ("seq", "u16", 1),
+        ("time_us", "u32", 1),
+        ("frame", "u32", 1),
+    ],
+    channel=[
+        ("pressure_actual", "i16"),
+        ("pressure_output", "u16"),
+        ("pressure_target", "u16"),
+        ("flow_actual", "i16"),
+        ("flow_target", "i16"),
+        ("control_mode", "u8"),
+        ("flow_ctrl_state", "u8"),
+    ],
+)
+
+# PRESSURE_CAL, zero mbar << PRESSURE_SHL, span >> PRESSURE_CAL_SPAN_SHIFT
+PRESSURE_CAL_REPLY = PacketLayout(
+    "pressure_cal_reply",
+    [
+        ("rc", "u8", 1),
+    ],
+    channel=[
+        ("zero", "i16"),
+        ("span", "u16"),
+        ("state", "u8"),
+        ("left", "u8"),
+    ],
+)
+
+# TELEMETRY_SAMPLE, and the words of TELEMETRY_COMPACT
+TELEMETRY_SAMPLE = PacketLayout(
+    "telemetry_sample",
+    [
+        ("seq", "u16", 1),
+        ("time_us", "u32", 1),
+        ("frame", "u32", 1),
+        ("pressure_actual", "i16", "N"),
+        ("flow_actual", "i16", "N"),
+    ],
+)
+
+# A record of GET_HISTORY and HISTORY_STREAM, and the words of a compact one
+HISTORY_RECORD = PacketLayout(
+    "history_record",
+    [
+        ("seq", "u16", 1),
+        ("time_us", "u32", 1),
+        ("pressure_actual", "i16", "N"),
+        ("pressure_output", "u16", "N"),
+        ("flow_actual", "i16", "N"),
+        ("pid_terms", "i16", ("N", 3)),
+    ],
+)
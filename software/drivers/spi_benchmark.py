@@ -0,0 +1,315 @@
+"""
+SPI protocol throughput and latency benchmark.
+
+Sends ECHO packets to one module and sweeps the SPI clock, the payload size
+and how the packets are sent: one query at a time, several in one BATCH
+packet (dsPIC modules), or several sequenced requests in flight with
+pipeline_query(). Reports latency percentiles, packet and byte rates, and
+the error rates seen on either side of the link.
+
+Usage:
+    python -m drivers.spi_benchmark --device flow [--clock 30000,100000]
+        [--sizes 1,16,64] [--modes single,batch,pipeline] [--count N] [--crc]
+
+Runs against the simulated boards with RIO_SIMULATION=true, and against the
+real firmware with RIO_SIM_FIRMWARE as well (simulation/firmware_simulated.py).
+"""
+
+import argparse
+import json
+import logging
+import time
+from typing import Any, Dict, List, Optional
+
+from drivers import spi_handler
+from drivers.flow import PiFlow
+from drivers.heater import PiHolder
+from drivers.strobe import PiStrobe
+
+logger = logging.getLogger(__name__)
+
+# device name -> (driver class, port, ECHO packet type, BATCH packet type or None)
+DEVICES = {
+    "flow": (PiFlow, spi_handler.PORT_FLOW, PiFlow.PACKET_TYPE_ECHO, PiFlow.PACKET_TYPE_BATCH),
+    "heater": (
+        PiHolder,
+        spi_handler.PORT_HEATER1,
+        PiHolder.PACKET_TYPE_ECHO,
+        PiHolder.PACKET_TYPE_BATCH,
+    ),
+    "strobe": (PiStrobe, spi_handler.PORT_STROBE, 16, None),
+}
+
+MODES = ("single", "batch", "pipeline")
+RESULTS = ("ok", "no_reply", "frame_error", "mismatch", "rejected")
+
+FRAME_OVERHEAD = 5  # [STX][size][type] and the CRC-16, the largest check
+SEQ_BYTES = 1  # [seq U8] of a sequenced packet
+BATCH_HEADER_BYTES = 2  # [type][size] of each BATCH sub-command
+
+
+def percentile(values: List[float], pct: float) -> float:
+    """Nearest-rank percentile of <values>, 0 when empty."""
+    if not values:
+        return 0.0
+    ordered = sorted(values)
+    index = max(0, min(len(ordered) - 1, int(round(pct / 100 * len(ordered))) - 1))
+    return ordered[index]
+
+
+def make_payload(size: int, index: int) -> List[int]:
+    """A payload that differs from one packet to the next, so stale replies are caught."""
+    return [(index + i) & 0xFF for i in range(size)]
+
+
+class SpiBenchmark:
+    """ECHO benchmark of one module, see the module docstring."""
+
+    def __init__(self, device_name: str, reply_pause_s: float, depth: int = 4, crc: bool = False):
+        """
+        Args:
+            device_name: One of DEVICES
+            reply_pause_s: Pause between a request and reading its reply
+            depth: Echoes per BATCH packet, and requests in flight when pipelined
+            crc: Negotiate CRC frames if the firmware has them
+        """
+        cls, port, self.echo_type, self.batch_type = DEVICES[device_name]
+        self.device_name = device_name
+        self.device = cls(port, reply_pause_s)
+        self.depth = depth
+        self.crc_mode = spi_handler.negotiate_crc(self.device) if crc else spi_handler.CRC_NONE
+        valid, stats = self.device.get_spi_stats()
+        if not valid:
+            raise RuntimeError(f"No GET_SPI_STATS reply from the {device_name} module")
+        self.packet_size = stats["packet_size"]
+        self.write_size = stats["write_size"]
+
+    def max_payload(self, mode: str) -> int:
+        """Largest ECHO payload whose request and reply frames fit the firmware buffers."""
+        if mode == "single":
+            return self.packet_size - FRAME_OVERHEAD - 1
+        if mode == "pipeline":
+            # All the replies wait in the write ring until read
+            per_reply = self.write_size // self.depth - FRAME_OVERHEAD - SEQ_BYTES - 1
+            return min(self.packet_size - FRAME_OVERHEAD - SEQ_BYTES - 1, per_reply)
+        # BATCH: [type][size][payload] per echo, [type][size][err][payload] per reply
+        body = self.packet_size - FRAME_OVERHEAD - 1
+        return body // self.depth - BATCH_HEADER_BYTES - 1
+
+    def _stats_invalid(self) -> Optional[int]:
+        valid, stats = self.device.get_spi_stats()
+        return stats["packet_invalid"] if valid else None
+
+    def echo_single(self, payload: List[int]) -> List[str]:
+        """One ECHO query, as packet_query() but with the failure told apart."""
+        result = "no_reply"
+        try:
+            spi_handler.spi_lock()
+            self.device.packet_write(self.echo_type, payload)
+            spi_handler.wait_reply(self.device)
+            # Skips stale replies of other types, as packet_query()
+            for _ in range(10):
+                valid, type_read, data = self.device.packet_read()
+                if type_read == 0:
+                    break
+                if not valid:
+                    result = "frame_error"
+                    break
+                if type_read == self.echo_type:
+                    if not data or data[0] != 0:
+                        result = "rejected"
+                    else:
+                        result = "ok" if data[1:] == payload else "mismatch"
+                    break
+            spi_handler.spi_deselect_current()
+        finally:
+            spi_handler.spi_release()
+        return [result]
+
+    def echo_batch(self, payloads: List[List[int]]) -> List[str]:
+        """<payloads> as ECHO sub-commands of one BATCH packet."""
+        valid, replies = spi_handler.batch_query(
+            self.device, self.batch_type, [(self.echo_type, p) for p in payloads]
+        )
+        if not valid:
+            return ["no_reply"] * len(payloads)
+        results = []
+        for i, payload in enumerate(payloads):
+            if i >= len(replies) or replies[i][0] != self.echo_type:
+                results.append("no_reply")
+            elif not replies[i][1] or replies[i][1][0] != 0:
+                results.append("rejected")
+            else:
+                results.append("ok" if replies[i][1][1:] == payload else "mismatch")
+        return results
+
+    def echo_pipeline(self, payloads: List[List[int]]) -> List[str]:
+        """<payloads> as sequenced ECHO requests, all sent before the first reply is read."""
+        replies = spi_handler.pipeline_query([(self.device, self.echo_type, p) for p in payloads])
+        results = []
+        for (valid, data), payload in zip(replies, payloads):
+            if not valid:
+                results.append("no_reply")
+            elif not data or data[0] != 0:
+                results.append("rejected")
+            else:
+                results.append("ok" if data[1:] == payload else "mismatch")
+        return results
+
+    def run_case(self, clock_hz: int, size: int, mode: str, count: int) -> Dict[str, Any]:
+        """
+        <count> ECHO packets of <size> bytes at <clock_hz>.
+
+        Returns:
+            dict: the case, counts per RESULTS, latency percentiles per exchange
+            in ms, packet and payload byte rates; "skipped" if it cannot run
+        """
+        case: Dict[str, Any] = {"clock_hz": clock_hz, "size": size, "mode": mode}
+        if mode == "batch" and self.batch_type is None:
+            case["skipped"] = "no BATCH packet on this module"
+            return case
+        if size > self.max_payload(mode):
+            case["skipped"] = f"payload over {self.max_payload(mode)} bytes"
+            return case
+
+        spi_handler.spi.max_speed_hz = clock_hz
+        per_exchange = 1 if mode == "single" else self.depth
+        exchanges = max(1, count // per_exchange)
+        invalid_before = self._stats_invalid()
+
+        counts = {name: 0 for name in RESULTS}
+        latencies_ms = []
+        start = time.perf_counter()
+        for n in range(exchanges):
+            payloads = [make_payload(size, n * per_exchange + i) for i in range(per_exchange)]
+            t0 = time.perf_counter()
+            if mode == "single":
+                results = self.echo_single(payloads[0])
+            elif mode == "batch":
+                results = self.echo_batch(payloads)
+            else:
+                results = self.echo_pipeline(payloads)
+            latencies_ms.append((time.perf_counter() - t0) * 1000)
+            for result in results:
+                counts[result] += 1
+        elapsed_s = time.perf_counter() - start
+
+        invalid_after = self._stats_invalid()
+        packets = exchanges * per_exchange
+        case.update(counts)
+        case["packets"] = packets
+        case["firmware_invalid"] = (
+            (invalid_after - invalid_before) & 0xFFFF
+            if invalid_before is not None and invalid_after is not None
+            else None
+        )
+        case["error_rate"] = (packets - counts["ok"]) / packets
+        case["frame_error_rate"] = counts["frame_error"] / packets
+        for pct in (50, 90, 99):
+            case[f"p{pct}_ms"] = percentile(latencies_ms, pct)
+        case["max_ms"] = max(latencies_ms)
+        case["packets_per_s"] = counts["ok"] / elapsed_s if elapsed_s > 0 else 0.0
+        case["bytes_per_s"] = counts["ok"] * size / elapsed_s if elapsed_s > 0 else 0.0
+        return case
+
+    def run(
+        self, clocks_hz: List[int], sizes: List[int], modes: List[str], count: int
+    ) -> Dict[str, Any]:
+        """Every clock, size and mode combination, see run_case()."""
+        results: Dict[str, Any] = {
+            "timestamp": time.strftime("%Y-%m-%d %H:%M:%S"),
+            "device": self.device_name,
+            "crc_mode": self.crc_mode,
+            "reply_pause_ms": self.device.reply_pause_s * 1000,
+            "depth": self.depth,
+            "packet_size": self.packet_size,
+            "write_size": self.write_size,
+            "cases": [],
+        }
+        for clock_hz in clocks_hz:
+            for mode in modes:
+                for size in sizes:
+                    logger.info(f"Running: {clock_hz} Hz, {mode}, {size} bytes")
+                    results["cases"].append(self.run_case(clock_hz, size, mode, count))
+        return results
+
+    @staticmethod
+    def print_summary(results: Dict[str, Any]) -> None:
+        print("\n" + "=" * 100)
+        print(f"SPI BENCHMARK: {results['device']} module")
+        print("=" * 100)
+        print(
+            f"CRC mode: {results['crc_mode']}, reply pause: {results['reply_pause_ms']:.1f} ms, "
+            f"depth: {results['depth']}, buffers: packet {results['packet_size']} "
+            f"write {results['write_size']}"
+        )
+        print(
+            f"\n{'clock Hz':>9} {'mode':>8} {'size':>5} {'p50 ms':>8} {'p90 ms':>8} "
+            f"{'p99 ms':>8} {'max ms':>8} {'pkt/s':>8} {'B/s':>9} {'errors':>7} {'frame':>6} "
+            f"{'fw bad':>6}"
+        )
+        print("-" * 100)
+        for case in results["cases"]:
+            head = f"{case['clock_hz']:>9} {case['mode']:>8} {case['size']:>5}"
+            if "skipped" in case:
+                print(f"{head}   skipped: {case['skipped']}")
+                continue
+            firmware = "-" if case["firmware_invalid"] is None else case["firmware_invalid"]
+            print(
+                f"{head} {case['p50_ms']:8.2f} {case['p90_ms']:8.2f} {case['p99_ms']:8.2f} "
+                f"{case['max_ms']:8.2f} {case['packets_per_s']:8.1f} {case['bytes_per_s']:9.1f} "
+                f"{case['error_rate']:7.2%} {case['frame_error_rate']:6.2%} {firmware:>6}"
+            )
+
+
+def _int_list(text: str) -> List[int]:
+    return [int(value) for value in text.split(",") if value]
+
+
+def main(argv: Optional[List[str]] = None) -> Dict[str, Any]:
+    """Main entry point."""
+    parser = argparse.ArgumentParser(description="Benchmark the SPI protocol of a Rio module")
+    parser.add_argument("--device", choices=sorted(DEVICES), default="flow")
+    parser.add_argument(
+        "--clock", type=_int_list, default=[30000], help="SPI clocks in Hz (default: 30000)"
+    )
+    parser.add_argument(
+        "--sizes", type=_int_list, default=[1, 8, 16, 64], help="ECHO payload sizes in bytes"
+    )
+    parser.add_argument(
+        "--modes",
+        type=lambda text: [m for m in text.split(",") if m],
+        default=list(MODES),
+        help="single, batch and/or pipeline (default: all)",
+    )
+    parser.add_argument("--count", type=int, default=200, help="ECHO packets per case")
+    parser.add_argument(
+        "--depth", type=int, default=4, help="Echoes per BATCH, or in flight when pipelined"
+    )
+    parser.add_argument(
+        "--reply-pause-ms", type=float, default=2.0, help="Pause before reading a reply"
+    )
+    parser.add_argument("--crc", action="store_true", help="Negotiate CRC frames first")
+    parser.add_argument("--output", type=str, help="Also save the results to this JSON file")
+    args = parser.parse_args(argv)
+    if any(mode not in MODES for mode in args.modes):
+        parser.error(f"--modes must be from {', '.join(MODES)}")
+
+    spi_handler.spi_init(0, 2, args.clock[0])
+    try:
+        benchmark = SpiBenchmark(args.device, args.reply_pause_ms / 1000, args.depth, args.crc)
+        results = benchmark.run(args.clock, args.sizes, args.modes, args.count)
+    finally:
+        spi_handler.spi_close()
+
+    benchmark.print_summary(results)
+    if args.output:
+        with open(args.output, "w") as f:
+            json.dump(results, f, indent=2)
+        print(f"\nResults saved to {args.output}")
+    return results
+
+
+if __name__ == "__main__":
+    logging.basicConfig(level=logging.INFO)
+    main()
@@ -1,4 +1,6 @@
+import binascii
 import os
+import struct
 import time
 from threading import Lock
 
@@ -9,6 +11,8 @@ if SIMULATION_MODE:
     # Use simulated SPI and GPIO
     try:
         from simulation.spi_simulated import SimulatedSPIHandler, SimulatedGPIO
+        # The time of the drivers and controllers, which tests can run faster or step
+        from simulation import clock_simulated as clock
 
         GPIO = SimulatedGPIO
         # Create simulated SPI handler (will be initialized later)
@@ -24,6 +28,8 @@ else:
     try:
         import spidev
         import RPi.GPIO as GPIO  # type: ignore[no-redef]
+
+        clock = time  # type: ignore[no-redef]
     except ImportError as e:
         import logging
 
@@ -97,10 +103,15 @@ def spi_init(bus, mode, speed_hz):
 
     current_device = PORT_NONE
 
+    capture_path = os.getenv("RIO_SPI_CAPTURE", "").strip()
+    if capture_path and _capture is None:
+        capture_start(capture_path)
+
     return spi
 
 
 def spi_close() -> None:
+    capture_stop()
     if SIMULATION_MODE and _simulated_spi_handler and _simulated_spi_handler.spi:
         _simulated_spi_handler.spi.close()
     elif not SIMULATION_MODE and spi:
@@ -160,6 +171,1458 @@ def spi_release():
 
 
 def pi_wait_s(delay_s):
+    if SIMULATION_MODE:
+        clock.sleep(delay_s)  # A busy wait would never end on a stepped clock
+        return
     start_time = time.time()
     while (time.time() - start_time) < delay_s:
         pass
+
+
+# Data-ready lines (rio_spi SPI_PORT_READY): module chip select pin -> Pi input pin, BOARD
+# numbering as the PORT_* pins. Empty by default, the PCBs have none; see ready_setup().
+READY_PINS = {}
+
+
+def ready_setup(device_port, pin):
+    """Wait on the data-ready line at <pin> instead of the reply pause for <device_port>."""
+    if SIMULATION_MODE:
+        return  # No line in simulation, the simulated boards answer at once
+    GPIO.setup(pin, GPIO.IN, pull_up_down=GPIO.PUD_DOWN)
+    GPIO.add_event_detect(pin, GPIO.RISING)
+    READY_PINS[device_port] = pin
+
+
+def _ready_arm(device):
+    """Forget an edge from an earlier reply before writing a request."""
+    pin = READY_PINS.get(device.device_port)
+    if pin is not None:
+        GPIO.event_detected(pin)
+
+
+def wait_reply(device, timeout_s=None):
+    """
+    Wait for the reply to the request just written: until the firmware raises the
+    data-ready line, at most timeout_s, or all of timeout_s if there is no line.
+    The firmware drops the line when it accepts a request, so the edge belongs to
+    that request's reply. A telemetry sample queued meanwhile raises it too; the
+    read loops skip the sample as before.
+
+    Args:
+        timeout_s: defaults to device.reply_pause_s
+
+    Returns:
+        bool: False if the line did not rise in time
+    """
+    if timeout_s is None:
+        timeout_s = device.reply_pause_s
+    pin = READY_PINS.get(device.device_port)
+    if pin is None:
+        pi_wait_s(timeout_s)
+        return True
+    start_time = clock.time()
+    while not GPIO.event_detected(pin):
+        if (clock.time() - start_time) >= timeout_s:
+            return False
+    return True
+
+
+# SPI capture: every request and reply frame, timestamped, replayed by drivers/spi_replay.py.
+# File: CAPTURE_MAGIC, [version U8][0], then records [time us U32][port U8][kind U8][type U8]
+# [crc mode U8][size U16][data], little endian, time on host_time_us()
+CAPTURE_MAGIC = b"RIOSPI"
+CAPTURE_VERSION = 1
+CAPTURE_REQUEST = 0
+CAPTURE_REPLY = 1
+CAPTURE_BAD = 2  # A reply frame that failed its check, no data
+_CAPTURE_RECORD = struct.Struct("<IBBBBH")
+_capture = None  # {"file", "records"} while capturing
+_capture_lock = Lock()
+
+
+def capture_start(path):
+    """
+    Record the packets to and from every module into <path>, until capture_stop().
+    Also started by spi_init() when RIO_SPI_CAPTURE names a file. Empty reads of a
+    module with nothing queued are not recorded.
+    """
+    global _capture
+    capture_stop()
+    with _capture_lock:
+        capture_file = open(path, "wb")
+        capture_file.write(CAPTURE_MAGIC + bytes([CAPTURE_VERSION, 0]))
+        _capture = {"file": capture_file, "records": 0}
+
+
+def capture_stop():
+    """Close the capture file. Returns the records written, 0 if none was open."""
+    global _capture
+    with _capture_lock:
+        if _capture is None:
+            return 0
+        _capture["file"].close()
+        records = _capture["records"]
+        _capture = None
+    return records
+
+
+def capture_record(device, kind, packet_type, data):
+    """Add one frame to the capture, if one is open. Cheap when none is."""
+    if _capture is None:
+        return
+    with _capture_lock:
+        if _capture is None:
+            return
+        head = _CAPTURE_RECORD.pack(
+            host_time_us(),
+            device.device_port,
+            kind,
+            packet_type & 0xFF,
+            getattr(device, "crc_mode", CRC_NONE),
+            len(data),
+        )
+        _capture["file"].write(head + bytes(data))
+        _capture["records"] += 1
+
+
+def read_capture(path):
+    """
+    Load a capture file.
+
+    Returns:
+        list of dicts with time_us (unwrapped, from the first record), port, kind,
+        type, crc_mode and data; two records more than 71 minutes apart read short
+    """
+    with open(path, "rb") as f:
+        content = f.read()
+    if content[: len(CAPTURE_MAGIC)] != CAPTURE_MAGIC or content[6] != CAPTURE_VERSION:
+        raise ValueError(f"{path} is not a version {CAPTURE_VERSION} SPI capture")
+    records = []
+    offset = len(CAPTURE_MAGIC) + 2
+    first_us = None
+    last_us = 0
+    elapsed_us = 0
+    while offset + _CAPTURE_RECORD.size <= len(content):
+        time_us, port, kind, packet_type, crc_mode, size = _CAPTURE_RECORD.unpack_from(
+            content, offset
+        )
+        offset += _CAPTURE_RECORD.size
+        if offset + size > len(content):
+            break  # Cut off by a crash
+        if first_us is None:
+            first_us = last_us = time_us
+        elapsed_us += (time_us - last_us) & 0xFFFFFFFF
+        last_us = time_us
+        records.append(
+            {
+                "time_us": elapsed_us,
+                "port": port,
+                "kind": kind,
+                "type": packet_type,
+                "crc_mode": crc_mode,
+                "data": list(content[offset : offset + size]),
+            }
+        )
+        offset += size
+    return records
+
+
+# Packet framing: [STX][size][type][data...][checksum] or, once negotiated,
+# [STX_CRC][size][type][data...][CRC little endian] (rio_spi SPI_CRC_MODE)
+STX = 2
+STX_CRC = 3
+CRC_NONE = 0
+CRC_8 = 1  # CRC-8/SMBUS, strobe PIC
+CRC_16 = 2  # CRC-16/CCITT-FALSE, dsPIC boards
+CRC_BYTES = {CRC_8: 1, CRC_16: 2}
+PACKET_TYPE_PROTOCOL = 0x7F
+PROTOCOL_VERSION_CRC = 2  # First firmware protocol version with STX_CRC frames
+
+
+def _crc8_entry(index):
+    crc = index
+    for _ in range(8):
+        crc = ((crc << 1) ^ 0x07) if crc & 0x80 else (crc << 1)
+    return crc & 0xFF
+
+
+_CRC8_TABLE = [_crc8_entry(i) for i in range(256)]
+
+
+def frame_crc(data, crc_mode):
+    """CRC of data as the firmware computes it for crc_mode, as little endian bytes."""
+    if crc_mode == CRC_8:
+        crc = 0x00
+        for byte in data:
+            crc = _CRC8_TABLE[crc ^ byte]
+        return [crc]
+    # binascii's CRC-CCITT is poly 0x1021, unreflected: CRC-16/CCITT-FALSE from 0xFFFF
+    crc = binascii.crc_hqx(bytes(data), 0xFFFF)
+    return [crc & 0xFF, crc >> 8]
+
+
+def build_frame(packet_type, data, crc_mode=CRC_NONE):
+    """Frame a packet, with the checksum or, if crc_mode is set, as an STX_CRC frame."""
+    if crc_mode == CRC_NONE:
+        msg = [STX, len(data) + 4, packet_type] + list(data)
+        return msg + [(-(sum(msg) & 0xFF)) & 0xFF]
+    msg = [STX_CRC, len(data) + 3 + CRC_BYTES[crc_mode], packet_type] + list(data)
+    return msg + frame_crc(msg, crc_mode)
+
+
+def parse_frame(frame, crc_mode=CRC_NONE):
+    """
+    Check a received frame, either framing is accepted.
+
+    Returns:
+        tuple: (valid, data) with the payload between the type and the check bytes
+    """
+    if len(frame) < 4 or frame[1] != len(frame):
+        return (False, [])
+    if frame[0] == STX:
+        return (sum(frame) & 0xFF == 0, frame[3:-1])
+    if frame[0] == STX_CRC and crc_mode in CRC_BYTES:
+        check = CRC_BYTES[crc_mode]
+        if len(frame) >= 3 + check and frame[-check:] == frame_crc(frame[:-check], crc_mode):
+            return (True, frame[3:-check])
+    return (False, [])
+
+
+def read_bytes(device, count):
+    """
+    Clock <count> bytes out of the selected device. The dsPIC boards reload the next
+    reply byte well within one SPI clock (interrupt, or DMA with SPI_PORT_DMA), so
+    they are read in one transfer; the slower strobe PIC is read a byte per transfer.
+    """
+    if spi is None:
+        import logging
+
+        logger = logging.getLogger(__name__)
+        logger.error("SPI not initialized! Call spi_init() before using drivers.")
+        return []
+    if count <= 0:
+        return []
+    if getattr(device, "bulk_read_supported", False):
+        return list(spi.xfer2([0] * count))
+    data = []
+    for _ in range(count):
+        data.extend(spi.xfer2([0]))
+    return data
+
+
+def packet_read(device):
+    """
+    Read one reply frame from a PiFlow/PiHolder/PiStrobe: the start byte, then size
+    and type, then the rest of the frame in one read.
+
+    Returns:
+        tuple: (valid, type_read, data), type_read 0 if the write ring was empty
+    """
+    valid = False
+    type_read = 0
+    data = []
+    spi_select_device(device.device_port)
+    frame = device.read_bytes(1)
+    if frame and frame[0] in (STX, STX_CRC):
+        frame.extend(device.read_bytes(2))
+        if len(frame) >= 3:
+            type_read = frame[2]
+            frame.extend(device.read_bytes(frame[1] - 3))
+            valid, data = parse_frame(frame, device.crc_mode)
+    if not valid:
+        data = []
+    if type_read != 0:
+        capture_record(device, CAPTURE_REPLY if valid else CAPTURE_BAD, type_read, data)
+    return valid, type_read, data
+
+
+def packet_write(device, packet_type, data):
+    """
+    Frame and send one packet to a PiFlow/PiHolder/PiStrobe.
+
+    Returns:
+        list: the bytes shifted in while writing
+    """
+    if spi is None:
+        import logging
+
+        logger = logging.getLogger(__name__)
+        logger.error("SPI not initialized! Call spi_init() before using drivers.")
+        return []
+    msg = build_frame(packet_type, data, device.crc_mode)
+    _ready_arm(device)
+    spi_select_device(device.device_port)
+    capture_record(device, CAPTURE_REQUEST, packet_type, data)
+    return spi.xfer2(msg)
+
+
+def negotiate_crc(device):
+    """
+    Ask the firmware for its protocol version and switch the device to CRC
+    frames if it has them. Old firmware does not answer the query and the
+    device stays on checksum frames.
+
+    Returns:
+        int: the CRC_* mode now set in device.crc_mode
+    """
+    device.crc_mode = CRC_NONE
+    valid, data = device.packet_query(PACKET_TYPE_PROTOCOL, [])
+    if valid and len(data) >= 3 and data[0] == 0 and data[1] >= PROTOCOL_VERSION_CRC:
+        if data[2] in CRC_BYTES:
+            device.crc_mode = data[2]
+    return device.crc_mode
+
+
+# GET_CAPABILITIES, rio_spi.h SPI_CAPS_*: packet types 0-63 in the bitmap
+CAPS_TYPES = 64
+CAPS_REPORT_SIZE = 14 + CAPS_TYPES // 8
+
+
+def parse_capabilities(valid, data):
+    """
+    Parse a GET_CAPABILITIES reply, [err][spi_caps_report()][packet types], little endian.
+
+    Returns:
+        tuple: (valid, caps) with keys firmware_version (major, minor), protocol_version,
+        crc_mode, packet_buf, write_buf, batch_buf (0 without BATCH), loop_period_us and
+        packet_types (set of the board types it handles)
+    """
+    if not valid or len(data) < 1 + CAPS_REPORT_SIZE or data[0] != 0:
+        return False, {}
+
+    def u16(offset):
+        return int.from_bytes(bytes(data[offset : offset + 2]), "little")
+
+    types = data[15 : 15 + CAPS_TYPES // 8]
+    return True, {
+        "firmware_version": (data[2], data[1]),
+        "protocol_version": data[3],
+        "crc_mode": data[4],
+        "packet_buf": u16(5),
+        "write_buf": u16(7),
+        "batch_buf": u16(9),
+        "loop_period_us": int.from_bytes(bytes(data[11:15]), "little"),
+        "packet_types": {t for t in range(CAPS_TYPES) if types[t >> 3] & (1 << (t & 7))},
+    }
+
+
+def discover(device):
+    """
+    Ask the firmware what it handles and set the device's paths from the answer at connect
+    time, instead of finding out from a failed query later: CRC frames, batch_supported and,
+    on the flow board, snapshot_supported. device.capabilities keeps the answer for supports().
+
+    Firmware without GET_CAPABILITIES leaves the flags as they are and only negotiates CRC.
+
+    Returns:
+        tuple: (valid, caps) as parse_capabilities()
+    """
+    valid, caps = parse_capabilities(
+        *device.packet_query(device.PACKET_TYPE_GET_CAPABILITIES, [])
+    )
+    if not valid:
+        device.capabilities = None
+        negotiate_crc(device)
+        return False, {}
+    device.capabilities = caps
+    device.crc_mode = caps["crc_mode"] if caps["crc_mode"] in CRC_BYTES else CRC_NONE
+    types = caps["packet_types"]
+    if hasattr(device, "PACKET_TYPE_BATCH"):
+        device.batch_supported = device.PACKET_TYPE_BATCH in types and caps["batch_buf"] > 0
+    if hasattr(device, "PACKET_TYPE_GET_STATUS_SNAPSHOT"):
+        device.snapshot_supported = device.PACKET_TYPE_GET_STATUS_SNAPSHOT in types
+    return True, caps
+
+
+def supports(device, packet_type):
+    """False only if discover() found the firmware does not handle packet_type."""
+    caps = getattr(device, "capabilities", None)
+    return caps is None or packet_type >= CAPS_TYPES or packet_type in caps["packet_types"]
+
+
+# GET_SPI_STATS reply fields, each U16 little endian after the status byte
+SPI_STATS_FIELDS = (
+    "read_size",
+    "write_size",
+    "packet_size",
+    "read_dropped",
+    "write_overflows",
+    "packet_overflows",
+    "packet_invalid",
+    "read_peak",
+    "write_peak",
+)
+
+
+def parse_spi_stats(valid, data):
+    """
+    Decode a GET_SPI_STATS reply from any PIC module.
+
+    Returns:
+        tuple: (valid, stats) where stats maps SPI_STATS_FIELDS names to ints
+    """
+    size = 1 + 2 * len(SPI_STATS_FIELDS)
+    if not valid or len(data) < size:
+        return (False, {})
+    stats = {
+        name: int.from_bytes(data[1 + 2 * i : 3 + 2 * i], byteorder="little", signed=False)
+        for i, name in enumerate(SPI_STATS_FIELDS)
+    }
+    return (data[0] == 0, stats)
+
+
+# CPU load report after the probe records, see rio_probe.h
+PROBE_LOAD_SIZE = 16
+
+
+def parse_probe_stats(valid, data, names):
+    """
+    Decode a GET_PROBE_STATS reply from a dsPIC module (shared rio_probe firmware module).
+
+    Args:
+        names: probe names in firmware order, see the board's probe_port.h
+
+    Returns:
+        tuple: (valid, stats) with stats keys timer_hz and probes. probes maps each name
+        to a dict of count, min_us, max_us and mean_us. It is empty if the firmware was
+        built without probes. If the firmware reports the CPU load, stats also has load:
+        load_pc, peak_pc and isr_pc over the last second, isr_max_us, idle_pass_us,
+        pass_max_us and passes.
+    """
+    if not valid or len(data) < 6 or data[0] != 0:
+        return (False, {})
+    timer_hz = int.from_bytes(data[1:5], byteorder="little", signed=False)
+    count = data[5]
+    end = 6 + 10 * count
+    if len(data) not in (end, end + PROBE_LOAD_SIZE) or (len(data) > 6 and not timer_hz):
+        return (False, {})
+    probes = {}
+    for i in range(min(count, len(names))):
+        record = data[6 + 10 * i : 16 + 10 * i]
+        ticks = [int.from_bytes(record[j : j + 2], byteorder="little") for j in (4, 6, 8)]
+        probes[names[i]] = {
+            "count": int.from_bytes(record[0:4], byteorder="little", signed=False),
+            "min_us": ticks[0] * 1e6 / timer_hz,
+            "max_us": ticks[1] * 1e6 / timer_hz,
+            "mean_us": ticks[2] * 1e6 / timer_hz,
+        }
+    stats = {"timer_hz": timer_hz, "probes": probes}
+    if len(data) > end:
+        stats["load"] = parse_load_report(data[end:], timer_hz)
+    return (True, stats)
+
+
+def parse_load_report(data, timer_hz):
+    """
+    Decode a PROBE_LOAD_SIZE byte CPU load report: [load permille U16][peak permille U16]
+    [isr permille U16][isr max U16][idle pass U16][pass max U16][passes U32], little endian,
+    times in ticks of timer_hz. Shared by the dsPIC probe report and the strobe GET_LOAD_STATS.
+    """
+    fields = [int.from_bytes(data[j : j + 2], byteorder="little") for j in range(0, 12, 2)]
+    return {
+        "load_pc": fields[0] / 10,
+        "peak_pc": fields[1] / 10,
+        "isr_pc": fields[2] / 10,
+        "isr_max_us": fields[3] * 1e6 / timer_hz,
+        "idle_pass_us": fields[4] * 1e6 / timer_hz,
+        "pass_max_us": fields[5] * 1e6 / timer_hz,
+        "passes": int.from_bytes(data[12:16], byteorder="little", signed=False),
+    }
+
+
+def trace_mask(names, regions):
+    """
+    The probe_trace_mask bits of the named trace regions (shared rio_probe firmware module).
+    A firmware trace pin is high over each region in its mask, for a logic analyzer.
+
+    Raises:
+        ValueError: a region not in names
+    """
+    mask = 0
+    for region in regions:
+        mask |= 1 << names.index(region)
+    return mask
+
+
+BENCH_REPORT_SIZE = 20
+
+
+def parse_bench_report(valid, data, names):
+    """
+    Decode a BENCHMARK reply (shared rio_bench firmware module): [rc][kernels U8][kernel U8]
+    [runs U16][timer hz U32][cpu hz U32][total ticks U32][min ticks U16][max ticks U16],
+    little endian.
+
+    Args:
+        names: kernel names in firmware order, see the board's bench_port.h
+
+    Returns:
+        tuple: (valid, result) with keys kernel (its name), runs, timer_hz, cpu_hz, the raw
+        total_ticks, min_ticks and max_ticks, and mean_cycles, min_cycles and max_cycles of
+        one run in CPU cycles. A run is timed to a tick, the mean over many runs finer. The
+        cycles include the call and timer overhead, which kernel "null" measures alone.
+    """
+    if not valid or len(data) != 1 + BENCH_REPORT_SIZE or data[0] != 0:
+        return (False, {})
+    kernels, kernel, runs, timer_hz, cpu_hz, total, min_ticks, max_ticks = struct.unpack(
+        "<BBHIIIHH", bytes(data[1:])
+    )
+    if not runs or not timer_hz:
+        return (False, {})
+    cycles = cpu_hz / timer_hz
+    return (
+        True,
+        {
+            "kernel": names[kernel] if kernel < len(names) else kernel,
+            "kernels": kernels,
+            "runs": runs,
+            "timer_hz": timer_hz,
+            "cpu_hz": cpu_hz,
+            "total_ticks": total,
+            "min_ticks": min_ticks,
+            "max_ticks": max_ticks,
+            "mean_cycles": total * cycles / runs,
+            "min_cycles": min_ticks * cycles,
+            "max_cycles": max_ticks * cycles,
+        },
+    )
+
+
+def bench_query(device, packet_type, names, kernel, runs):
+    """
+    Run one firmware kernel <runs> times with a BENCHMARK packet, see parse_bench_report().
+
+    Args:
+        kernel: A name in <names>, or its index
+        runs: 1 to 1000; the module's main loop waits for all of them
+
+    Returns:
+        tuple: (valid, result), without a query if discover() found firmware built without
+        the benchmark
+    """
+    index = names.index(kernel) if isinstance(kernel, str) else kernel
+    if not supports(device, packet_type):
+        return (False, {})
+    valid, data = device.packet_query(packet_type, [index, runs & 0xFF, runs >> 8])
+    return parse_bench_report(valid, data, names)
+
+
+LATENCY_BINS = 16
+LATENCY_BIN0_US = 16
+LATENCY_HIST_SIZE = 16 + 2 * LATENCY_BINS
+LATENCY_REPORT_SIZE = 6 + 2 * LATENCY_HIST_SIZE
+
+
+def latency_bin_edges_us():
+    """Upper edges of the rio_latency histogram bins in us, None for the open last bin."""
+    return [LATENCY_BIN0_US << b for b in range(LATENCY_BINS - 1)] + [None]
+
+
+def parse_latency_stats(valid, data):
+    """
+    Decode a GET_LATENCY_STATS reply from a dsPIC module (shared rio_latency firmware module):
+    [rc][loops U8][loop U8][period us U32], then the latency and the period, each
+    [count U32][min us U32][max us U32][mean us U32] + LATENCY_BINS x [count U16], little endian.
+
+    Returns:
+        tuple: (valid, stats) with keys loops, loop, period_us (the nominal period, 0 before
+        the loop's first output), latency and period. Each of those two is a dict of count, min_us, max_us, mean_us and bins,
+        the counts per bin of latency_bin_edges_us(). The period bins count the jitter,
+        the distance of each output period from period_us.
+    """
+    if not valid or len(data) != 1 + LATENCY_REPORT_SIZE or data[0] != 0:
+        return (False, {})
+
+    def u32(offset):
+        return int.from_bytes(data[offset : offset + 4], byteorder="little", signed=False)
+
+    def hist(offset):
+        return {
+            "count": u32(offset),
+            "min_us": u32(offset + 4),
+            "max_us": u32(offset + 8),
+            "mean_us": u32(offset + 12),
+            "bins": [
+                int.from_bytes(data[offset + 16 + 2 * b : offset + 18 + 2 * b], byteorder="little")
+                for b in range(LATENCY_BINS)
+            ],
+        }
+
+    return (
+        True,
+        {
+            "loops": data[1],
+            "loop": data[2],
+            "period_us": u32(3),
+            "latency": hist(7),
+            "period": hist(7 + LATENCY_HIST_SIZE),
+        },
+    )
+
+
+def parse_eeprom_status(valid, data, byteorder):
+    """
+    Decode a GET_EEPROM_STATUS reply from a dsPIC module's EEPROM write queue.
+
+    Saves return as soon as they are queued; poll this until pending is 0 to know they
+    are committed.
+
+    Args:
+        byteorder: "big" for the sample holder, "little" for the pressure and flow board
+
+    Returns:
+        tuple: (valid, status) with keys pending, busy, committed, verify_failed and
+        full_waits (writes that had to wait for a full queue)
+    """
+    if not valid or len(data) != 9 or data[0] != 0:
+        return (False, {})
+
+    def u16(offset):
+        return int.from_bytes(data[offset : offset + 2], byteorder=byteorder, signed=False)
+
+    status = {
+        "pending": data[1],
+        "busy": bool(data[2]),
+        "committed": u16(3),
+        "verify_failed": u16(5),
+        "full_waits": u16(7),
+    }
+    return (True, status)
+
+
+def parse_boot_status(valid, data, byteorder):
+    """
+    Decode a GET_BOOT_STATUS reply from a dsPIC module.
+
+    The modules answer SPI from early in start-up and finish booting in the background: the
+    pressure and flow board probes its flow sensors, the sample holder waits for its first
+    temperature sample. Until then their actual-value packets are not yet meaningful.
+
+    Args:
+        byteorder: "big" for the sample holder, "little" for the pressure and flow board
+
+    Returns:
+        tuple: (valid, status) with keys booting, present (bit per flow channel, or bit 0 for
+        the sample holder temperature sensor) and boot_ms (reset to boot done, 0 while booting)
+    """
+    if not valid or len(data) != 5 or data[0] != 0:
+        return (False, {})
+
+    status = {
+        "booting": bool(data[1]),
+        "present": data[2],
+        "boot_ms": int.from_bytes(data[3:5], byteorder=byteorder, signed=False),
+    }
+    return (True, status)
+
+
+# Parameter descriptor table (shared rio_param firmware module), values 16 bits little endian
+PARAM_TYPES = ("u8", "u16", "i16")
+PARAM_FLAG_READ_ONLY = 0x01
+PARAM_FLAG_STORED = 0x02
+PARAM_LIST_RECORD_SIZE = 7
+PARAM_MANY_MAX = 24
+
+
+def _param_value(raw, param_type):
+    value = int.from_bytes(bytes(raw), byteorder="little", signed=False)
+    if param_type == "i16" and value & 0x8000:
+        value -= 0x10000
+    return value
+
+
+def param_list(device):
+    """
+    Read a dsPIC module's parameter descriptor table with PARAM_LIST, one page per reply.
+
+    Returns:
+        tuple: (valid, params) where params maps each id to a dict of type (one of
+        PARAM_TYPES), flags (PARAM_FLAG_*), min and max
+    """
+    params = {}
+    total = None
+    while total is None or len(params) < total:
+        valid, data = device.packet_query(device.PACKET_TYPE_PARAM_LIST, [len(params)])
+        if not valid or len(data) < 3 or data[0] != 0:
+            return (False, {})
+        total, count = data[1], data[2]
+        if count == 0 or len(data) != 3 + PARAM_LIST_RECORD_SIZE * count:
+            return (False, {})
+        for i in range(count):
+            record = data[3 + PARAM_LIST_RECORD_SIZE * i : 3 + PARAM_LIST_RECORD_SIZE * (i + 1)]
+            param_type = PARAM_TYPES[record[1]] if record[1] < len(PARAM_TYPES) else record[1]
+            params[record[0]] = {
+                "type": param_type,
+                "flags": record[2],
+                "min": _param_value(record[3:5], param_type),
+                "max": _param_value(record[5:7], param_type),
+            }
+    return (True, params)
+
+
+def param_get_many(device, params, ids):
+    """
+    Read parameter values with PARAM_GET_MANY, PARAM_MANY_MAX per packet.
+
+    Args:
+        params: the table from param_list(), for the value signs
+        ids: parameter ids to read
+
+    Returns:
+        tuple: (valid, values) where values maps each id to its value
+    """
+    ids = list(ids)
+    values = {}
+    for start in range(0, len(ids), PARAM_MANY_MAX):
+        chunk = ids[start : start + PARAM_MANY_MAX]
+        valid, data = device.packet_query(device.PACKET_TYPE_PARAM_GET_MANY, chunk)
+        if not valid or len(data) != 1 + 3 * len(chunk) or data[0] != 0:
+            return (False, {})
+        for i, param_id in enumerate(chunk):
+            record = data[1 + 3 * i : 4 + 3 * i]
+            if record[0] != param_id or param_id not in params:
+                return (False, {})
+            values[param_id] = _param_value(record[1:3], params[param_id]["type"])
+    return (True, values)
+
+
+def param_set_many(device, values):
+    """
+    Write parameter values with PARAM_SET_MANY, PARAM_MANY_MAX per packet.
+
+    The firmware checks every id and range in a packet before it applies any, so a
+    rejected packet changes nothing unless a board specific check fails part way.
+
+    Args:
+        values: dict of id -> value
+
+    Returns:
+        tuple: (valid, rc) with the firmware error code of the first rejected packet
+    """
+    items = list(values.items())
+    for start in range(0, len(items), PARAM_MANY_MAX):
+        payload = []
+        for param_id, value in items[start : start + PARAM_MANY_MAX]:
+            payload.extend([param_id] + list((int(value) & 0xFFFF).to_bytes(2, "little")))
+        valid, data = device.packet_query(device.PACKET_TYPE_PARAM_SET_MANY, payload)
+        if not valid or len(data) != 1:
+            return (False, None)
+        if data[0] != 0:
+            return (False, data[0])
+    return (True, 0)
+
+
+# EEPROM fault log (shared rio_fault firmware module), records 16 bytes little endian
+FAULT_RECORD_SIZE = 16
+FAULT_ID_RESET = 0
+
+
+def parse_fault_record(record):
+    """Decode one 16 byte fault log record into a dict, None if its check byte is wrong."""
+    record = bytes(record)
+    if len(record) != FAULT_RECORD_SIZE or sum(record) & 0xFF != 0xA5:
+        return None
+    return {
+        "seq": int.from_bytes(record[0:2], "little"),
+        "boot": int.from_bytes(record[2:4], "little"),
+        "uptime_s": int.from_bytes(record[4:8], "little"),
+        "id": record[8],
+        "count": record[9],
+        "arg": int.from_bytes(record[10:14], "little", signed=True),
+        "lost": record[14],
+    }
+
+
+def fault_log(device, max_records=None):
+    """
+    Read a dsPIC module's EEPROM fault log with GET_FAULT_LOG, newest record first.
+
+    Args:
+        max_records: stop after this many records, None for the whole log
+
+    Returns:
+        tuple: (valid, records, pending) with records as parse_fault_record() dicts, a
+        record that fails its check or does not follow on by seq ends the list, and
+        pending the records the firmware has not written to the EEPROM yet
+    """
+    records = []
+    total = None
+    pending = 0
+    while total is None or len(records) < total:
+        index = list(len(records).to_bytes(2, "little"))
+        valid, data = device.packet_query(device.PACKET_TYPE_GET_FAULT_LOG, index)
+        if not valid or len(data) < 5 or data[0] != 0:
+            return (False, [], 0)
+        total = int.from_bytes(bytes(data[1:3]), "little")
+        if max_records is not None:
+            total = min(total, max_records)
+        pending, count = data[3], data[4]
+        if len(data) != 5 + FAULT_RECORD_SIZE * count:
+            return (False, [], 0)
+        if count == 0:
+            break
+        for i in range(count):
+            offset = 5 + FAULT_RECORD_SIZE * i
+            record = parse_fault_record(data[offset : offset + FAULT_RECORD_SIZE])
+            if record is None or (records and record["seq"] != (records[-1]["seq"] - 1) & 0xFFFF):
+                return (True, records[:total], pending)
+            records.append(record)
+    return (True, records[:total], pending)
+
+
+# Streamed replies (rio_spi spi_stream_start()): chunk frames of the request's type,
+# [err U8][total U16][offset U16][data...] little endian, queued as the write ring drains
+STREAM_HEADER_SIZE = 5
+STREAM_IDLE_S = 0.2  # Longest wait for the next chunk, under the firmware packet timeout
+
+
+def stream_read(device, packet_type, data, idle_s=STREAM_IDLE_S, on_other=None):
+    """
+    Send one request whose reply is streamed, and read chunks until the whole transfer is
+    in. The chip select stays low between reads, and an empty write ring only means the
+    board has not queued the next chunk yet.
+
+    Args:
+        idle_s: give up once no chunk has arrived for this long
+        on_other: called as on_other(type_read, data) for any other frame read meanwhile,
+            e.g. a telemetry sample
+
+    Returns:
+        tuple: (valid, data) with the transfer's bytes, or the bytes read in order before
+        an error reply, a missing chunk or the wait ran out
+    """
+    received = []
+    total = None
+    try:
+        spi_lock()
+        device.packet_write(packet_type, data)
+        wait_reply(device)
+        last_s = clock.time()
+        while total is None or len(received) < total:
+            valid, type_read, chunk = device.packet_read()
+            if not valid:
+                break
+            if type_read == 0:
+                if (clock.time() - last_s) >= idle_s:
+                    break
+                continue
+            if type_read != packet_type:
+                if on_other is not None:
+                    on_other(type_read, chunk)
+                continue
+            if len(chunk) < STREAM_HEADER_SIZE or chunk[0] != 0:
+                break
+            offset = int.from_bytes(bytes(chunk[3:5]), "little")
+            if offset != len(received):
+                break
+            total = int.from_bytes(bytes(chunk[1:3]), "little")
+            received.extend(chunk[STREAM_HEADER_SIZE:])
+            last_s = clock.time()
+        spi_deselect_current()
+    except Exception as e:
+        import logging
+
+        logger = logging.getLogger(__name__)
+        logger.error(f"SPI communication error in stream_read: {e}")
+        try:
+            spi_deselect_current()
+        except Exception:
+            pass
+    finally:
+        try:
+            spi_release()
+        except Exception:
+            pass
+    return (total is not None and len(received) == total, received)
+
+
+# Compact records (hardware-modules/common/rio_delta): [flags U8][mask][zig-zag varints], each
+# changed U16 word as its difference from the previous record, a keyframe against zeros
+DELTA_FLAG_KEY = 0x01
+
+
+def delta_decode(data, prev, count, start=0):
+    """
+    Decode the rio_delta record of count words at data[start:].
+
+    Args:
+        prev: the words of the previous record, or None before the first keyframe
+
+    Returns:
+        tuple: (end, words) with the index after the record and its words. words is None
+        for a record that needs a previous one and prev is None, and end is start if the
+        record is cut short.
+    """
+    mask_end = start + 1 + (count + 7) // 8
+    if len(data) < mask_end:
+        return (start, None)
+    if data[start] & DELTA_FLAG_KEY:
+        words = [0] * count
+    else:
+        words = list(prev) if prev is not None else None
+    index = mask_end
+    for w in range(count):
+        if not data[start + 1 + (w >> 3)] & (1 << (w & 7)):
+            continue
+        zz = 0
+        shift = 0
+        while True:
+            if index >= len(data):
+                return (start, None)
+            byte = data[index]
+            index += 1
+            zz |= (byte & 0x7F) << shift
+            shift += 7
+            if not byte & 0x80:
+                break
+        if words is not None:
+            words[w] = (words[w] + ((zz >> 1) ^ -(zz & 1))) & 0xFFFF
+    return (index, words)
+
+
+def delta_record_bytes(words, byteorder):
+    """The plain record of decoded words, as the board packs them."""
+    return [byte for word in words for byte in word.to_bytes(2, byteorder)]
+
+
+# Firmware reply to an unknown packet type
+ERR_PACKET_INVALID = 31
+
+
+def build_batch(commands):
+    """
+    Encode (packet_type, data) pairs as a BATCH packet payload.
+
+    Each sub-command is sent as [type][size][data...].
+    """
+    payload = []
+    for packet_type, data in commands:
+        payload.extend([packet_type, len(data)] + list(data))
+    return payload
+
+
+def parse_batch(valid, data):
+    """
+    Decode a BATCH reply from a dsPIC module.
+
+    The reply is [err] followed by [type][size][reply...] for each sub-command,
+    in the order they were sent. A single-byte reply is the batch error code.
+
+    Returns:
+        tuple: (valid, replies) where replies is a list of (packet_type, data)
+    """
+    if not valid or len(data) < 1 or data[0] != 0:
+        return (False, [])
+    replies = []
+    index = 1
+    while index + 2 <= len(data):
+        packet_type = data[index]
+        size = data[index + 1]
+        if index + 2 + size > len(data):
+            return (False, [])
+        replies.append((packet_type, data[index + 2 : index + 2 + size]))
+        index += 2 + size
+    return (index == len(data), replies)
+
+
+def batch_query(device, batch_type, commands):
+    """
+    Send commands to a PiFlow/PiHolder as one BATCH packet.
+
+    Clears device.batch_supported if the firmware rejects the BATCH type. Nested
+    batches and type 0 are refused here, so an [ERR_PACKET_INVALID] reply can
+    only mean the type is unknown.
+
+    Returns:
+        tuple: (valid, replies) as parse_batch()
+    """
+    if any(packet_type in (0, batch_type) for packet_type, _ in commands):
+        return (False, [])
+    valid, data = device.packet_query(batch_type, build_batch(commands))
+    if valid and commands and data == [ERR_PACKET_INVALID]:
+        device.batch_supported = False
+    return parse_batch(valid, data)
+
+
+def query_many(device, batch_type, packet_types):
+    """
+    Query several payload-less packet types, batched while the firmware supports it.
+
+    Returns:
+        list of (valid, data) in packet_types order, or None if any query failed
+    """
+    if device.batch_supported:
+        valid, replies = batch_query(device, batch_type, [(t, []) for t in packet_types])
+        # batch_query() clears batch_supported on old firmware -> single queries below
+        if device.batch_supported:
+            if not valid or [t for t, _ in replies] != list(packet_types):
+                return None
+            replies = [(True, data) for _, data in replies]
+    if not device.batch_supported:
+        replies = [device.packet_query(t, []) for t in packet_types]
+    if not all(valid and data for valid, data in replies):
+        return None
+    return replies
+
+
+# Addressed BATCH: a leading [0][1][address] entry runs the batch only on the module of
+# that address (rio_spi spi_module_addr), which replies [0][1][its address] first. Other
+# modules reply [ERR_MODULE_ADDRESS], firmware without module addresses [ERR_PACKET_INVALID].
+MODULE_ADDR_ANY = 0xFF  # Blank EEPROM, answers every address; addressed, reaches every module
+ERR_MODULE_ADDRESS = 34
+
+
+def build_addressed_batch(address, commands):
+    """Encode (packet_type, data) pairs as a BATCH payload for the module at <address>."""
+    return [0, 1, address] + build_batch(commands)
+
+
+def parse_addressed_batch(valid, data):
+    """
+    Decode the reply to an addressed BATCH.
+
+    Returns:
+        tuple: (valid, module_addr, replies), replies as parse_batch()
+    """
+    valid, replies = parse_batch(valid, data)
+    if not valid or not replies or replies[0][0] != 0 or len(replies[0][1]) != 1:
+        return (False, None, [])
+    return (True, replies[0][1][0], replies[1:])
+
+
+def status_sweep(devices):
+    """
+    Read the get_status() of several PiFlow/PiHolder modules in one sweep, e.g. the
+    flow boards of a rig. Each module gets its status_packet_types() as one BATCH
+    addressed to its module_addr. Those that pipeline are all written before any
+    reply is read, see pipeline_query(), so one reply pause covers them. A reply
+    from another address, a board on the wrong chip select, is invalid. Modules
+    without BATCH or module addresses fall back to get_status().
+
+    Returns:
+        list of get_status() results, in devices order
+    """
+    sweep = [d for d in devices if d.batch_supported and d.module_addr_supported]
+    requests = []
+    for device in sweep:
+        commands = [(t, []) for t in device.status_packet_types()]
+        data = build_addressed_batch(device.module_addr, commands)
+        requests.append((device, device.PACKET_TYPE_BATCH, data))
+    piped = [r for r in requests if getattr(r[0], "pipeline_supported", True)]
+    answers = dict(zip([id(r[0]) for r in piped], pipeline_query(piped) if piped else []))
+    for device, packet_type, data in requests:
+        if id(device) not in answers:
+            answers[id(device)] = device.packet_query(packet_type, data)
+
+    results = []
+    for device in devices:
+        if id(device) not in answers:
+            results.append(device.get_status())
+            continue
+        valid, data = answers[id(device)]
+        if valid and data == [ERR_PACKET_INVALID]:
+            # Firmware without module addresses
+            device.module_addr_supported = False
+            results.append(device.get_status())
+            continue
+        types = device.status_packet_types()
+        valid, address, replies = parse_addressed_batch(valid, data)
+        if device.module_addr not in (MODULE_ADDR_ANY, address) or [t for t, _ in replies] != types:
+            valid = False
+        results.append(device.decode_status([(True, d) for _, d in replies] if valid else None))
+    return results
+
+
+# Sequenced packets: [type | PACKET_SEQ_FLAG][seq U8][data...], echoed in the reply
+PACKET_SEQ_FLAG = 0x80
+_seq_next = 0
+
+
+def next_seq():
+    """Return the next request sequence number, 0-255."""
+    global _seq_next
+    seq = _seq_next
+    _seq_next = (_seq_next + 1) & 0xFF
+    return seq
+
+
+def read_frames(device, stream):
+    """
+    Replies found in <stream>, bytes the firmware shifted out while a request was
+    written. SPI is full duplex, so a reply the firmware queued before a later
+    request is clocked out during that request's write. A reply cut off at the
+    end of <stream> is completed from the device.
+
+    Returns:
+        list of (valid, type_read, data) as device.packet_read()
+    """
+    frames = []
+    index = 0
+    if stream:
+        spi_select_device(device.device_port)
+    while index < len(stream):
+        if stream[index] not in (STX, STX_CRC):
+            index += 1
+            continue
+        frame = list(stream[index : index + 3])
+        if len(frame) < 3:
+            frame.extend(device.read_bytes(3 - len(frame)))
+        size = frame[1] if len(frame) >= 2 else 0
+        if size < 4:
+            index += 1
+            continue
+        frame = list(stream[index : index + size])
+        if len(frame) < size:
+            frame.extend(device.read_bytes(size - len(frame)))
+        valid, data = parse_frame(frame, device.crc_mode)
+        if valid:
+            frames.append((True, frame[2], data))
+            capture_record(device, CAPTURE_REPLY, frame[2], data)
+            index += size
+        elif index + size > len(stream):
+            # Completed from the device and still bad: a frame error, as packet_read()
+            frames.append((False, frame[2], []))
+            capture_record(device, CAPTURE_BAD, frame[2], [])
+            break
+        else:
+            index += 1
+    return frames
+
+
+def pipeline_query(requests):
+    """
+    Send several sequenced requests before reading any reply, then match the
+    replies by sequence number. Requests can go to different boards, and to
+    the same board more than once; one reply pause covers all of them.
+
+    The device write rings must hold all replies for that board (32 bytes on
+    the strobe PIC), and they must be read within the firmware packet timeout.
+    Replies clocked out while a later request was written are kept, see
+    read_frames().
+
+    Args:
+        requests: list of (device, packet_type, data), where device is a
+            PiFlow/PiHolder/PiStrobe
+
+    Returns:
+        list of (valid, data) in request order, data as packet_query() would
+        have returned it
+    """
+    sent = []
+    replies = {}
+    shifted_in = {}  # id(device) -> bytes received while writing to it
+    try:
+        spi_lock()
+        for device, packet_type, data in requests:
+            seq = next_seq()
+            received = device.packet_write(packet_type | PACKET_SEQ_FLAG, [seq] + list(data))
+            shifted_in.setdefault(id(device), []).extend(received or [])
+            sent.append((device, packet_type | PACKET_SEQ_FLAG, seq))
+        devices = []
+        for device, _, _ in sent:
+            if device not in devices:
+                devices.append(device)
+        # Each board's line rises for the reply to its last request, queued after the others
+        pause_s = max([device.reply_pause_s for device in devices], default=0)
+        start_time = clock.time()
+        for device in devices:
+            wait_reply(device, max(0.0, pause_s - (clock.time() - start_time)))
+        for device in devices:
+            expected = {seq: type_ for d, type_, seq in sent if d is device}
+            early = read_frames(device, shifted_in.get(id(device), []))
+            # Stale and unsequenced replies are skipped; stop when the ring runs dry
+            for i in range(100):
+                if not expected:
+                    break
+                if i < len(early):
+                    valid, type_read, data = early[i]
+                    if not valid:
+                        continue
+                else:
+                    valid, type_read, data = device.packet_read()
+                    if not valid or type_read == 0:
+                        break
+                if data and expected.get(data[0]) == type_read:
+                    del expected[data[0]]
+                    replies[(id(device), data[0])] = data[1:]
+        spi_deselect_current()
+    except Exception as e:
+        import logging
+
+        logger = logging.getLogger(__name__)
+        logger.error(f"SPI communication error in pipeline_query: {e}")
+        try:
+            spi_deselect_current()
+        except Exception:
+            pass
+    finally:
+        try:
+            spi_release()
+        except Exception:
+            pass
+    results = []
+    for device, _, seq in sent:
+        data = replies.get((id(device), seq))
+        results.append((data is not None, data if data is not None else []))
+    results.extend([(False, [])] * (len(requests) - len(sent)))
+    return results
+
+
+# Synchronized timebase (shared rio_time firmware module, and the strobe PIC), little endian
+TIME_SYNC_SET = 0
+TIME_SYNC_ADJUST = 1
+TIME_REPORT_SIZE = 10
+TIME_SYNC_ROUNDS = 8
+
+
+def host_time_us():
+    """The clock the modules are synchronized to, in us, wrapping at 2^32 like theirs."""
+    return (clock.monotonic_ns() // 1000) & 0xFFFFFFFF
+
+
+def time_diff_us(a, b):
+    """a - b for two timestamps in us, taken modulo 2^32 as a signed value."""
+    diff = (a - b) & 0xFFFFFFFF
+    return diff - (1 << 32) if diff & 0x80000000 else diff
+
+
+def parse_time_report(valid, data):
+    """
+    Decode a SYNC_TIME reply.
+
+    Returns:
+        tuple: (valid, report) with keys synced_us (on the host clock), local_us (the
+        module's own clock since power-up) and syncs
+    """
+    if not valid or len(data) != 1 + TIME_REPORT_SIZE or data[0] != 0:
+        return (False, {})
+    data = bytes(data)
+    return (
+        True,
+        {
+            "synced_us": int.from_bytes(data[1:5], "little"),
+            "local_us": int.from_bytes(data[5:9], "little"),
+            "syncs": int.from_bytes(data[9:11], "little"),
+        },
+    )
+
+
+def sync_time(device, packet_type, rounds=TIME_SYNC_ROUNDS):
+    """
+    Align a module's synchronized clock with host_time_us().
+
+    Sets the clock to the host time, then reads it back `rounds` times and times
+    each query. The module answered somewhere inside the query, so the read with
+    the shortest round trip is compared with its midpoint and the error is taken
+    out with one ADJUST. What is left is at most half that round trip.
+
+    Returns:
+        tuple: (valid, result) with keys error_us (the step applied),
+        uncertainty_us (half the shortest round trip) and the final report's keys
+    """
+    value = list(host_time_us().to_bytes(4, "little"))
+    valid, _ = parse_time_report(*device.packet_query(packet_type, [TIME_SYNC_SET] + value))
+    if not valid:
+        return (False, {})
+    best = None
+    for _ in range(rounds):
+        start = host_time_us()
+        valid, report = parse_time_report(*device.packet_query(packet_type, []))
+        end = host_time_us()
+        if not valid:
+            return (False, {})
+        round_trip = time_diff_us(end, start)
+        if best is None or round_trip < best[0]:
+            midpoint = (start + round_trip // 2) & 0xFFFFFFFF
+            best = (round_trip, time_diff_us(report["synced_us"], midpoint))
+    round_trip, error_us = best
+    step = list((-error_us & 0xFFFFFFFF).to_bytes(4, "little"))
+    valid, report = parse_time_report(
+        *device.packet_query(packet_type, [TIME_SYNC_ADJUST] + step)
+    )
+    if not valid:
+        return (False, {})
+    report.update({"error_us": error_us, "uncertainty_us": round_trip / 2})
+    return (True, report)
+
+
+# Staged commands (shared rio_stage firmware module), little endian
+STAGE_CANCEL = 0
+STAGE_DATA_MAX = 24
+STAGE_REPORT_SIZE = 11
+STAGE_LEAD_US = 50000
+
+
+def stage_time_us(lead_us=STAGE_LEAD_US):
+    """An apply time lead_us from now on the synchronized clock, for stage_together()."""
+    return (host_time_us() + lead_us) & 0xFFFFFFFF
+
+
+def stage_data(apply_us, packet_type, data):
+    """STAGE data to run packet_type with data at apply_us: [apply us U32][type U8][data...]."""
+    return list((apply_us & 0xFFFFFFFF).to_bytes(4, "little")) + [packet_type & 0xFF] + list(data)
+
+
+def parse_stage_report(valid, data):
+    """
+    Decode a STAGE reply.
+
+    Returns:
+        tuple: (valid, status) with keys pending (packets waiting for their time),
+        applied, late (run more than 1 ms after their time), failed (refused by the
+        module when run) and error_us (run time - apply time of the last one run)
+    """
+    if not valid or len(data) != 1 + STAGE_REPORT_SIZE or data[0] != 0:
+        return (False, {})
+    data = bytes(data)
+    return (
+        True,
+        {
+            "pending": data[1],
+            "applied": int.from_bytes(data[2:4], "little"),
+            "late": int.from_bytes(data[4:6], "little"),
+            "failed": int.from_bytes(data[6:8], "little"),
+            "error_us": int.from_bytes(data[8:12], "little", signed=True),
+        },
+    )
+
+
+def stage_together(steps, lead_us=STAGE_LEAD_US):
+    """
+    Stage one change across several modules for the same moment.
+
+    Each step is called with the apply time and stages its part, e.g.
+    lambda t: flow.stage(t, PiFlow.PACKET_TYPE_SET_FLOW_TARGET, data), or
+    lambda t: strobe.set_timing_shadow(wait_ns, period_ns, apply_us=t). The modules
+    must have been synchronized with sync_time(). lead_us has to cover staging all
+    steps, one SPI transaction each; the margin left is returned so it can be tuned.
+
+    Returns:
+        tuple: (valid, result) with keys apply_us, staged (steps that succeeded, in
+        order) and margin_us (apply time - time the last step was staged, negative
+        if the moment had already passed). valid is False if any step failed or the
+        margin is negative; the caller then cancels what was staged.
+    """
+    apply_us = stage_time_us(lead_us)
+    staged = 0
+    for step in steps:
+        result = step(apply_us)
+        if not (result[0] if isinstance(result, tuple) else result):
+            break
+        staged += 1
+    margin_us = time_diff_us(apply_us, host_time_us())
+    valid = staged == len(steps) and margin_us >= 0
+    return (valid, {"apply_us": apply_us, "staged": staged, "margin_us": margin_us})
+
+
+# Report by exception, the shared rio_report firmware module
+REPORT_CANCEL = 0xFF
+REPORT_DEADBAND_OFF = 0xFFFF  # Sent on its interval only
+REPORT_STATUS_SIZE = 5
+REPORT_ENTRY_SIZE = 3
+
+
+def subscribe_data(signals):
+    """
+    SUBSCRIBE data for signals, a dict of signal index to (deadband, max_interval_ms) in
+    firmware units, or None to unsubscribe that signal. A deadband of None sends the signal
+    on its interval only; an interval of 0 only when it moves. {} cancels every signal.
+    """
+    if not signals:
+        return [REPORT_CANCEL]
+    data = []
+    for signal, setting in signals.items():
+        deadband, interval_ms = setting if setting is not None else (None, 0)
+        deadband = REPORT_DEADBAND_OFF if deadband is None else min(int(deadband), 0xFFFE)
+        data += [signal] + list(deadband.to_bytes(2, "little"))
+        data += list(min(int(interval_ms), 0xFFFF).to_bytes(2, "little"))
+    return data
+
+
+def parse_report_status(valid, data):
+    """
+    Decode a SUBSCRIBE reply.
+
+    Returns:
+        tuple: (valid, status) with keys subscribed (signals), reports (REPORT packets
+        queued) and dropped (times the write ring had no room, the signals went later)
+    """
+    if not valid or len(data) != 1 + REPORT_STATUS_SIZE or data[0] != 0:
+        return (False, {})
+    data = bytes(data)
+    return (
+        True,
+        {
+            "subscribed": data[1],
+            "reports": int.from_bytes(data[2:4], "little"),
+            "dropped": int.from_bytes(data[4:6], "little"),
+        },
+    )
+
+
+def parse_report(data):
+    """
+    Decode a REPORT payload.
+
+    Returns:
+        tuple: (time_us, values) with values a dict of signal index to its raw I16
+        value, or (None, {}) for a malformed payload
+    """
+    if len(data) < 4 or (len(data) - 4) % REPORT_ENTRY_SIZE:
+        return (None, {})
+    data = bytes(data)
+    values = {}
+    for offset in range(4, len(data), REPORT_ENTRY_SIZE):
+        values[data[offset]] = int.from_bytes(data[offset + 1 : offset + 3], "little", signed=True)
+    return (int.from_bytes(data[0:4], "little"), values)
+
+
+# FLASH, common/rio_flash: firmware update into the inactive flash partition, see flasher.py
+FLASH_OP_STATUS = 0
+FLASH_OP_ERASE = 1
+FLASH_OP_WRITE = 2  # [address U32][n x instruction U24], n even
+FLASH_OP_VERIFY = 3  # [size U32][CRC-32 U32]
+FLASH_OP_COMMIT = 4
+FLASH_OP_RESET = 5
+FLASH_STATES = ("idle", "erasing", "ready", "verifying", "verified", "committed", "failed")
+FLASH_STATUS_SIZE = 19
+FLASH_SEQ_INVALID = 0xFFF  # Boot sequence of an image whose FBTSEQ was never programmed
+ERR_FLASH_STATE = 120
+ERR_FLASH_ADDRESS = 121
+ERR_FLASH_WRITE = 122
+
+
+def parse_flash_status(valid, data):
+    """
+    Decode a FLASH reply.
+
+    Returns:
+        tuple: (valid, status) with keys rc, state (a FLASH_STATES name), boot_seq (of the
+        running image), partition_size, words (written since the erase), progress (program
+        address the erase or CRC reached) and crc (CRC-32 so far). A refused op has rc
+        alone, and a lost reply none.
+    """
+    if not valid or not data:
+        return (False, {})
+    if data[0] != 0 or len(data) != 1 + FLASH_STATUS_SIZE:
+        return (False, {"rc": data[0]})
+    data = bytes(data)
+    state = data[1]
+    return (
+        True,
+        {
+            "rc": 0,
+            "state": FLASH_STATES[state] if state < len(FLASH_STATES) else state,
+            "boot_seq": int.from_bytes(data[2:4], "little"),
+            "partition_size": int.from_bytes(data[4:8], "little"),
+            "words": int.from_bytes(data[8:12], "little"),
+            "progress": int.from_bytes(data[12:16], "little"),
+            "crc": int.from_bytes(data[16:20], "little"),
+        },
+    )
+
+
+def flash_query(device, packet_type, op, data=()):
+    """One FLASH op, see parse_flash_status()."""
+    valid, reply = device.packet_query(packet_type, [op] + list(data))
+    return parse_flash_status(valid, reply)
@@ -0,0 +1,316 @@
+"""
+SPI capture replay.
+
+Sends the requests of a capture (spi_handler.capture_start(), or RIO_SPI_CAPTURE
+set while the web app runs) to the modules again, at the captured pace or sped
+up, and measures how long each reply takes, which never come, and what the
+firmware dropped meanwhile. A production load problem can then be reproduced and
+tuned on a bench: batching, buffer sizes, poll rates.
+
+Usage:
+    python -m drivers.spi_replay capture.bin [--speed 1] [--devices flow,heater1]
+        [--exclude-types 0x10,0x11] [--reply-pause-ms 2] [--timeout-ms 50]
+
+--speed 0 sends each request as soon as the last reply is in. The replayed
+requests are the captured ones, setpoints included: exclude the types that
+must not reach the bench hardware. Runs against the simulated boards with
+RIO_SIMULATION=true, and against the real firmware with RIO_SIM_FIRMWARE as
+well (simulation/firmware_simulated.py).
+"""
+
+import argparse
+import json
+import logging
+import os
+import time
+from typing import Any, Dict, List, Optional
+
+from drivers import spi_handler
+from drivers.flow import PiFlow
+from drivers.heater import PiHolder
+from drivers.spi_benchmark import percentile
+from drivers.strobe import PiStrobe
+
+logger = logging.getLogger(__name__)
+
+# port -> (device name, driver class)
+DEVICES = {
+    spi_handler.PORT_FLOW: ("flow", PiFlow),
+    spi_handler.PORT_HEATER1: ("heater1", PiHolder),
+    spi_handler.PORT_HEATER2: ("heater2", PiHolder),
+    spi_handler.PORT_HEATER3: ("heater3", PiHolder),
+    spi_handler.PORT_HEATER4: ("heater4", PiHolder),
+    spi_handler.PORT_STROBE: ("strobe", PiStrobe),
+}
+
+RESULTS = ("ok", "no_reply", "frame_error", "rc_changed")
+DROP_FIELDS = ("read_dropped", "write_overflows", "packet_overflows", "packet_invalid")
+POLL_S = 0.0002  # Between reads while a reply is not in yet
+
+
+def reply_rc(packet_type: int, data: List[int]) -> Optional[int]:
+    """Status byte of a reply payload, after the sequence number of a sequenced one."""
+    offset = 1 if packet_type & spi_handler.PACKET_SEQ_FLAG else 0
+    return data[offset] if len(data) > offset else None
+
+
+def pair_replies(records: List[Dict[str, Any]]) -> List[Dict[str, Any]]:
+    """
+    The request records of a capture, each with "reply", the reply record the
+    capture saw for it or None: the first one after it from the same port, of
+    the same type and, for a sequenced request, with the same sequence number.
+    """
+    requests = []
+    pending: Dict[Any, List[Dict[str, Any]]] = {}  # (port, type) -> requests yet unanswered
+    for record in records:
+        key = (record["port"], record["type"])
+        if record["kind"] == spi_handler.CAPTURE_REQUEST:
+            request = dict(record, reply=None)
+            requests.append(request)
+            pending.setdefault(key, []).append(request)
+            continue
+        waiting = pending.get(key, [])
+        for i, request in enumerate(waiting):
+            sequenced = record["type"] & spi_handler.PACKET_SEQ_FLAG
+            if sequenced and record["data"] and request["data"][:1] != record["data"][:1]:
+                continue
+            request["reply"] = record
+            del waiting[i]
+            break
+    return requests
+
+
+class SpiReplay:
+    """Replay of one capture, see the module docstring."""
+
+    def __init__(
+        self,
+        records: List[Dict[str, Any]],
+        reply_pause_s: float,
+        timeout_s: float,
+        devices: Optional[List[str]] = None,
+        exclude_types: Optional[List[int]] = None,
+    ):
+        """
+        Args:
+            records: spi_handler.read_capture()
+            reply_pause_s: Pause between a request and the first read of its reply
+            timeout_s: Longest wait for a reply, from the request
+            devices: Names from DEVICES to replay, default all in the capture
+            exclude_types: Packet types not to send, e.g. setpoints
+        """
+        exclude = set(exclude_types or [])
+        self.timeout_s = timeout_s
+        self.requests = [
+            r
+            for r in pair_replies(records)
+            if r["port"] in DEVICES
+            and (devices is None or DEVICES[r["port"]][0] in devices)
+            and r["type"] not in exclude
+        ]
+        self.devices = {}
+        for request in self.requests:
+            port = request["port"]
+            if port not in self.devices:
+                self.devices[port] = DEVICES[port][1](port, reply_pause_s)
+
+    def query(self, device, packet_type: int, data: List[int]):
+        """
+        One request, with its replies read until one of its type comes, as packet_query(),
+        but polled so the time it takes is measured.
+
+        Returns:
+            tuple: (result, rc, latency_s) with result one of RESULTS but "rc_changed"
+        """
+        result = "no_reply"
+        rc = None
+        latency_s = None
+        try:
+            spi_handler.spi_lock()
+            start = time.perf_counter()
+            device.packet_write(packet_type, data)
+            spi_handler.wait_reply(device)
+            while True:
+                valid, type_read, reply = device.packet_read()
+                if type_read == packet_type or (type_read != 0 and not valid):
+                    latency_s = time.perf_counter() - start
+                    result = "ok" if valid else "frame_error"
+                    rc = reply_rc(packet_type, reply) if valid else None
+                    break
+                if type_read == 0:
+                    # Other frames, telemetry or reports, are skipped as packet_query() does
+                    if time.perf_counter() - start >= self.timeout_s:
+                        break
+                    spi_handler.pi_wait_s(POLL_S)
+            spi_handler.spi_deselect_current()
+        finally:
+            spi_handler.spi_release()
+        return result, rc, latency_s
+
+    def firmware_drops(self) -> Dict[int, Optional[Dict[str, int]]]:
+        """GET_SPI_STATS DROP_FIELDS of every device replayed to, None if it did not answer."""
+        drops = {}
+        for port, device in self.devices.items():
+            valid, stats = device.get_spi_stats()
+            drops[port] = {name: stats[name] for name in DROP_FIELDS} if valid else None
+        return drops
+
+    def run(self, speed: float) -> Dict[str, Any]:
+        """
+        Send every request, <speed> times the captured pace, 0 for back to back.
+
+        Returns:
+            dict: per device and packet type the counts per RESULTS and reply latency
+            percentiles in ms, replayed and captured, and the firmware drops per device;
+            late_ms is how far behind its time a request went out
+        """
+        before = self.firmware_drops()
+        cases: Dict[Any, Dict[str, Any]] = {}
+        late_ms = []
+        start = time.perf_counter()
+        for request in self.requests:
+            if speed > 0:
+                due = start + request["time_us"] / 1e6 / speed
+                wait_s = due - time.perf_counter()
+                if wait_s > 0:
+                    time.sleep(wait_s)
+                late_ms.append(max(0.0, time.perf_counter() - due) * 1000)
+            device = self.devices[request["port"]]
+            device.crc_mode = request["crc_mode"]  # As captured, negotiated or not
+            result, rc, latency_s = self.query(device, request["type"], request["data"])
+
+            key = (request["port"], request["type"])
+            case = cases.setdefault(
+                key, dict({name: 0 for name in RESULTS}, latencies=[], captured=[])
+            )
+            captured = request["reply"]
+            if result == "ok" and captured and captured["kind"] == spi_handler.CAPTURE_REPLY:
+                if reply_rc(request["type"], captured["data"]) != rc:
+                    result = "rc_changed"
+            case[result] += 1
+            if latency_s is not None:
+                case["latencies"].append(latency_s * 1000)
+            if captured is not None:
+                case["captured"].append((captured["time_us"] - request["time_us"]) / 1000)
+        elapsed_s = time.perf_counter() - start
+        after = self.firmware_drops()
+
+        results: Dict[str, Any] = {
+            "timestamp": time.strftime("%Y-%m-%d %H:%M:%S"),
+            "speed": speed,
+            "requests": len(self.requests),
+            "captured_s": self.requests[-1]["time_us"] / 1e6 if self.requests else 0.0,
+            "elapsed_s": elapsed_s,
+            "late_p99_ms": percentile(late_ms, 99),
+            "late_max_ms": max(late_ms, default=0.0),
+            "cases": [],
+            "firmware_drops": {},
+        }
+        for (port, packet_type), case in sorted(cases.items()):
+            latencies = case.pop("latencies")
+            captured = case.pop("captured")
+            case.update({"device": DEVICES[port][0], "type": packet_type})
+            case["count"] = sum(case[name] for name in RESULTS)
+            for pct in (50, 90, 99):
+                case[f"p{pct}_ms"] = percentile(latencies, pct)
+            case["max_ms"] = max(latencies, default=0.0)
+            case["captured_p50_ms"] = percentile(captured, 50)
+            case["captured_max_ms"] = max(captured, default=0.0)
+            results["cases"].append(case)
+        for port in self.devices:
+            drops = None
+            if before[port] is not None and after[port] is not None:
+                drops = {
+                    name: (after[port][name] - before[port][name]) & 0xFFFF for name in DROP_FIELDS
+                }
+            results["firmware_drops"][DEVICES[port][0]] = drops
+        return results
+
+    @staticmethod
+    def print_summary(results: Dict[str, Any]) -> None:
+        print("\n" + "=" * 100)
+        print(f"SPI REPLAY: {results['requests']} requests at speed {results['speed']:g}")
+        print("=" * 100)
+        print(
+            f"Captured over {results['captured_s']:.2f} s, replayed in {results['elapsed_s']:.2f}"
+            f" s, sent late p99 {results['late_p99_ms']:.2f} ms max {results['late_max_ms']:.2f}"
+            " ms"
+        )
+        print(
+            f"\n{'device':>8} {'type':>5} {'count':>6} {'p50 ms':>8} {'p90 ms':>8} {'p99 ms':>8} "
+            f"{'max ms':>8} {'was p50':>8} {'was max':>8} {'lost':>5} {'frame':>6} {'rc':>4}"
+        )
+        print("-" * 100)
+        for case in results["cases"]:
+            print(
+                f"{case['device']:>8} {case['type']:#5x} {case['count']:>6} "
+                f"{case['p50_ms']:8.2f} {case['p90_ms']:8.2f} {case['p99_ms']:8.2f} "
+                f"{case['max_ms']:8.2f} {case['captured_p50_ms']:8.2f} "
+                f"{case['captured_max_ms']:8.2f} {case['no_reply']:>5} {case['frame_error']:>6} "
+                f"{case['rc_changed']:>4}"
+            )
+        print("\nFirmware drops (GET_SPI_STATS):")
+        for name, drops in results["firmware_drops"].items():
+            text = "no reply" if drops is None else ", ".join(f"{k} {v}" for k, v in drops.items())
+            print(f"  {name}: {text}")
+
+
+def _int_list(text: str) -> List[int]:
+    return [int(value, 0) for value in text.split(",") if value]
+
+
+def main(argv: Optional[List[str]] = None) -> Dict[str, Any]:
+    """Main entry point."""
+    parser = argparse.ArgumentParser(description="Replay an SPI capture to the Rio modules")
+    parser.add_argument("capture", help="File written by spi_handler.capture_start()")
+    parser.add_argument(
+        "--speed", type=float, default=1.0, help="Times the captured pace, 0 back to back"
+    )
+    parser.add_argument(
+        "--devices",
+        type=lambda text: [d for d in text.split(",") if d],
+        help="Only these, from " + ", ".join(name for name, _ in DEVICES.values()),
+    )
+    parser.add_argument(
+        "--exclude-types", type=_int_list, default=[], help="Packet types not to send"
+    )
+    parser.add_argument(
+        "--reply-pause-ms", type=float, default=2.0, help="Pause before the first reply read"
+    )
+    parser.add_argument("--timeout-ms", type=float, default=50.0, help="Longest wait for a reply")
+    parser.add_argument("--clock", type=int, default=30000, help="SPI clock in Hz")
+    parser.add_argument("--output", type=str, help="Also save the results to this JSON file")
+    args = parser.parse_args(argv)
+    names = [name for name, _ in DEVICES.values()]
+    if args.devices and any(name not in names for name in args.devices):
+        parser.error(f"--devices must be from {', '.join(names)}")
+
+    capturing = os.getenv("RIO_SPI_CAPTURE", "").strip()
+    if capturing and os.path.abspath(capturing) == os.path.abspath(args.capture):
+        parser.error("RIO_SPI_CAPTURE would overwrite the capture being replayed")
+
+    records = spi_handler.read_capture(args.capture)
+    spi_handler.spi_init(0, 2, args.clock)
+    try:
+        replay = SpiReplay(
+            records,
+            args.reply_pause_ms / 1000,
+            args.timeout_ms / 1000,
+            args.devices,
+            args.exclude_types,
+        )
+        results = replay.run(args.speed)
+    finally:
+        spi_handler.spi_close()
+
+    replay.print_summary(results)
+    if args.output:
+        with open(args.output, "w") as f:
+            json.dump(results, f, indent=2)
+        print(f"\nResults saved to {args.output}")
+    return results
+
+
+if __name__ == "__main__":
+    logging.basicConfig(level=logging.INFO)
+    main()
@@ -0,0 +1,224 @@
+"""
+SPI transaction scheduler.
+
+The flow, heater and strobe drivers share one SPI bus behind spi_lock(), and a
+query holds it for its whole reply pause. Called straight from the web
+controllers, a slow UI refresh of one board therefore delays a setpoint for
+another. SpiScheduler puts one worker thread in front of the bus:
+
+- Per-device queues, served round robin so one busy board does not starve
+  the others, at three priorities: PRIORITY_CONTROL (setpoints, commands)
+  before PRIORITY_UI (status refresh) before PRIORITY_BACKGROUND.
+- Coalescing: a request with a key that is already queued gets the queued
+  request's future instead of a second transaction, so repeated getters from
+  a slow poll do not pile up.
+- Pipelining: raw queries for different boards at the same priority are sent
+  together with spi_handler.pipeline_query(), one reply pause for all.
+- Results are concurrent.futures.Future objects; add_done_callback() for a
+  callback, result(timeout) to wait.
+
+Usage:
+    scheduler = SpiScheduler()
+    scheduler.start()
+    future = scheduler.call(flow.set_flow, [0], [100], priority=PRIORITY_CONTROL)
+    future = scheduler.query(heater, heater.PACKET_TYPE_GET_ID, key="heater1 id")
+"""
+
+import collections
+import logging
+import threading
+import time
+from concurrent.futures import Future
+
+from drivers import spi_handler
+
+logger = logging.getLogger(__name__)
+
+PRIORITY_CONTROL = 0
+PRIORITY_UI = 1
+PRIORITY_BACKGROUND = 2
+PRIORITIES = (PRIORITY_CONTROL, PRIORITY_UI, PRIORITY_BACKGROUND)
+
+# Raw queries sent in one pipeline_query(), at most one per board so its reply fits the
+# smallest write ring (32 bytes, strobe PIC)
+PIPELINE_MAX = 4
+
+# target: (device, (packet_type, data)) for a raw query, (device, None) for a call
+_Request = collections.namedtuple(
+    "_Request", "future fn args device_key target priority key queued_s"
+)
+
+
+class SpiScheduler:
+    def __init__(self, pipeline_max=PIPELINE_MAX):
+        self.pipeline_max = pipeline_max
+        self._cond = threading.Condition()
+        # priority -> device key -> deque of _Request; device keys in round robin order
+        self._queues = {p: collections.OrderedDict() for p in PRIORITIES}
+        self._keyed = {}  # coalesce key -> queued _Request
+        self._thread = None
+        self._stop = False
+        self.stats = {
+            "submitted": 0,
+            "coalesced": 0,
+            "run": 0,
+            "pipelined": 0,
+            "wait_ms_max": {p: 0.0 for p in PRIORITIES},
+        }
+
+    def start(self):
+        """Start the worker thread; requests submitted before it are kept."""
+        if self._thread is not None:
+            return
+        self._stop = False
+        self._thread = threading.Thread(target=self._run, name="SpiScheduler", daemon=True)
+        self._thread.start()
+
+    def stop(self, timeout=None):
+        """Stop the worker once the current transaction is done; queued requests are cancelled."""
+        with self._cond:
+            self._stop = True
+            self._cond.notify()
+        if self._thread is not None:
+            self._thread.join(timeout)
+            self._thread = None
+        with self._cond:
+            for queues in self._queues.values():
+                for queue in queues.values():
+                    for request in queue:
+                        request.future.cancel()
+                queues.clear()
+            self._keyed.clear()
+
+    def call(self, fn, *args, priority=PRIORITY_UI, key=None, device=None):
+        """
+        Run fn(*args) on the worker, e.g. a driver method doing several queries.
+
+        Args:
+            priority: PRIORITY_*
+            key: coalesce with a queued request of the same key, None never coalesces
+            device: the driver fn talks to, for the round robin; None shares one queue
+
+        Returns:
+            Future with fn's return value
+        """
+        return self._submit(fn, args, priority, key, device, None)
+
+    def query(self, device, packet_type, data=(), priority=PRIORITY_UI, key=None):
+        """
+        One device.packet_query(); may be pipelined with queries for other boards.
+
+        Returns:
+            Future with (valid, data) as packet_query()
+        """
+        return self._submit(None, (), priority, key, device, (packet_type, list(data)))
+
+    def pending(self):
+        """Requests queued and not yet started."""
+        with self._cond:
+            return sum(len(q) for queues in self._queues.values() for q in queues.values())
+
+    def _submit(self, fn, args, priority, key, device, packet):
+        if priority not in PRIORITIES:
+            raise ValueError(f"Unknown priority {priority}")
+        with self._cond:
+            self.stats["submitted"] += 1
+            if key is not None and key in self._keyed:
+                queued = self._keyed[key]
+                self.stats["coalesced"] += 1
+                if priority < queued.priority:
+                    # Raised: move it up, it keeps its future
+                    self._remove(queued)
+                    queued = queued._replace(priority=priority)
+                    self._append(queued)
+                    self._keyed[key] = queued
+                return queued.future
+            device_key = getattr(device, "device_port", None)
+            request = _Request(
+                Future(), fn, args, device_key, (device, packet), priority, key, time.monotonic()
+            )
+            self._append(request)
+            if key is not None:
+                self._keyed[key] = request
+            self._cond.notify()
+        return request.future
+
+    def _append(self, request):
+        queues = self._queues[request.priority]
+        queues.setdefault(request.device_key, collections.deque()).append(request)
+
+    def _remove(self, request):
+        queue = self._queues[request.priority][request.device_key]
+        queue.remove(request)
+        if not queue:
+            del self._queues[request.priority][request.device_key]
+
+    def _take(self):
+        """Next request, plus raw queries for other boards to pipeline with it. Lock held."""
+        for priority in PRIORITIES:
+            queues = self._queues[priority]
+            if not queues:
+                continue
+            taken = []
+            for device_key in list(queues):
+                request = queues[device_key][0]
+                if taken and not self._pipelinable(request):
+                    continue
+                queues[device_key].popleft()
+                if not queues[device_key]:
+                    del queues[device_key]
+                else:
+                    queues.move_to_end(device_key)  # Round robin
+                taken.append(request)
+                if not self._pipelinable(request) or len(taken) >= self.pipeline_max:
+                    break
+            for request in taken:
+                if request.key is not None:
+                    del self._keyed[request.key]
+            return taken
+        return []
+
+    @staticmethod
+    def _pipelinable(request):
+        device, packet = request.target
+        return packet is not None and getattr(device, "pipeline_supported", True)
+
+    def _run(self):
+        while True:
+            with self._cond:
+                while not self._stop and not any(self._queues.values()):
+                    self._cond.wait()
+                if self._stop:
+                    return
+                taken = self._take()
+            now = time.monotonic()
+            for request in taken:
+                wait_ms = (now - request.queued_s) * 1000
+                if wait_ms > self.stats["wait_ms_max"][request.priority]:
+                    self.stats["wait_ms_max"][request.priority] = wait_ms
+            self._execute([r for r in taken if r.future.set_running_or_notify_cancel()])
+
+    def _execute(self, requests):
+        if not requests:
+            return
+        self.stats["run"] += len(requests)
+        if len(requests) > 1:
+            self.stats["pipelined"] += len(requests)
+            results = spi_handler.pipeline_query(
+                [(device, packet[0], packet[1]) for device, packet in (r.target for r in requests)]
+            )
+            for request, result in zip(requests, results):
+                request.future.set_result(result)
+            return
+        request = requests[0]
+        device, packet = request.target
+        try:
+            if packet is not None:
+                result = device.packet_query(packet[0], packet[1])
+            else:
+                result = request.fn(*request.args)
+        except Exception as e:
+            logger.error(f"SPI scheduler request failed: {e}")
+            request.future.set_exception(e)
+            return
+        request.future.set_result(result)
@@ -1,5 +1,6 @@
 import sys
 import os
+from collections import namedtuple
 
 # Import from sibling module
 # Note: We import from the parent package to ensure we get the same module instance
@@ -16,60 +17,204 @@ from drivers import spi_handler  # noqa: E402
 # We access it as spi_handler.spi after initialization
 # spi_handler handles simulation mode automatically
 
+# Timer planning, bit-exact with find_scalers_time(), find_long_wait() and calc_strobe_timing()
+# in strobe_pic/main.c, so timings can be planned offline and sent with set_timing_raw()
+MAX_TIME_NS = 16320000  # TMR2/TMR4: 8-bit period, 1:128 prescale, 1:16 postscale
+MAX_LONG_TIME_NS = 524288000  # SMT1, 24 bits
+LONG_WAIT_TICKS_MAX = 0x1000000
+LONG_WAIT_ERR_NS = 500  # 8-bit wait error above which SMT1 takes the wait
+LONG_WAIT_TAIL_TICKS = 2
+LONG_WAIT_TAIL_PR2 = 1
+LONG_WAIT_ISR_TICKS = 96
+
+# Register values for one wait/duration setting, as strobe_timing_t, with the ns they give
+StrobeTiming = namedtuple("StrobeTiming", "pr2 t2con pr4 t4con smt_pr wait_ns duration_ns")
+
+
+def ticks_to_ns(ticks):
+    """TICKS_TO_NS(): 31.25 ns per FOSC/4 tick, rounded down."""
+    return (ticks * 125) >> 2
+
+
+def find_scalers_time(target_ns):
+    """
+    TMR2/TMR4 settings closest to target_ns, as the firmware search.
+
+    Returns:
+        tuple: (achieved_ns, prescale, postscale, period) in register values,
+        achieved_ns 0 if out of range
+    """
+    if target_ns < 0 or target_ns > MAX_TIME_NS:
+        return (0, 0, 0, 0)
+    ticks = (target_ns * 100 + 1562) // 3125
+    rem = [0, ticks] + [0] * 15
+    for postscale in range(2, 17):
+        rem[postscale] = ticks // postscale if postscale & 1 else rem[postscale >> 1] >> 1
+
+    best = (0, 0, 0, 0)
+    diff_best = target_ns
+    for postscale in range(16, 0, -1):
+        if diff_best == 0:
+            break
+        for prescale in range(7, -1, -1):
+            if prescale == 0:
+                period = rem[postscale]
+            else:
+                period = ((rem[postscale] >> (prescale - 1)) + 1) >> 1
+            if period > 0xFF:
+                break
+            if period == 0 or (period == 1 and prescale == 0):
+                continue
+            time_ns = ticks_to_ns((period * postscale) << prescale)
+            diff = abs(time_ns - target_ns)
+            if diff < diff_best:
+                best = (time_ns, prescale, postscale - 1, period - 1)
+                diff_best = diff
+                if diff == 0:
+                    break
+    return best
+
+
+def find_long_wait(target_ns):
+    """
+    SMT1 period for a wait ending in the TMR2 tail, to the nearest tick.
+
+    Returns:
+        tuple: (achieved_ns, smt_pr), achieved_ns 0 if out of range
+    """
+    if target_ns < 0 or target_ns > MAX_LONG_TIME_NS:
+        return (0, 0)
+    ticks = ((target_ns << 2) + 62) // 125
+    if ticks <= LONG_WAIT_TAIL_TICKS + LONG_WAIT_ISR_TICKS + 1:
+        return (0, 0)
+    return (ticks_to_ns(ticks), ticks - (LONG_WAIT_TAIL_TICKS + LONG_WAIT_ISR_TICKS) - 1)
+
+
+def plan_timing(wait_ns, duration_ns):
+    """
+    Register values the firmware would pick for SET_STROBE_TIMING.
+
+    Returns:
+        StrobeTiming, or None if either time cannot be represented
+    """
+    wait_achieved, wait_prescale, wait_postscale, pr2 = find_scalers_time(wait_ns)
+    duration_achieved, duration_prescale, duration_postscale, pr4 = find_scalers_time(duration_ns)
+    smt_pr = 0
+    if abs(wait_achieved - wait_ns) > LONG_WAIT_ERR_NS:
+        wait_achieved, smt_pr = find_long_wait(wait_ns)
+        wait_prescale, wait_postscale, pr2 = 0, 0, LONG_WAIT_TAIL_PR2
+    if wait_achieved == 0 or duration_achieved == 0:
+        return None
+    return StrobeTiming(
+        pr2,
+        (wait_prescale << 4) | wait_postscale,
+        pr4,
+        (duration_prescale << 4) | duration_postscale,
+        smt_pr,
+        wait_achieved,
+        duration_achieved,
+    )
+
+
+def timer_ticks(period, tcon):
+    """Period of TMR2/TMR4 at PRx period and the scalers of TxCON tcon, in ticks."""
+    return ((period + 1) * ((tcon & 0x0F) + 1)) << ((tcon >> 4) & 0x07)
+
+
+def raw_timing_ns(pr2, t2con, pr4, t4con, smt_pr=0):
+    """
+    Achieved (wait_ns, duration_ns) of raw register values, as decode_strobe_timing().
+
+    Returns:
+        tuple, or None for values the firmware rejects
+    """
+    if (t2con | t4con) & ~0x7F or not 0 <= smt_pr < LONG_WAIT_TICKS_MAX:
+        return None
+    if (pr2 == 0 and t2con == 0) or (pr4 == 0 and t4con == 0):
+        return None
+    wait_ticks = timer_ticks(pr2, t2con)
+    if smt_pr:
+        wait_ticks += smt_pr + 1 + LONG_WAIT_ISR_TICKS
+    return (ticks_to_ns(wait_ticks), ticks_to_ns(timer_ticks(pr4, t4con)))
+
+
+# Second strobe channel, PWM7 on TMR6 one-shot, as strobe_b_set() in strobe_pic/strobe_b.c
+STROBE_B_MAX_TIME_NS = 4096000  # Wait plus duration, 256 x 1:128 x 125 ns
+
+# Register values for a channel B setting, with the ns they give
+StrobeBTiming = namedtuple("StrobeBTiming", "pr6 t6con dc wait_ns duration_ns")
+
+
+def plan_channel_b(wait_ns, duration_ns):
+    """
+    TMR6 and PWM7 settings the firmware picks for SET_STROBE_B: the smallest prescaler
+    whose 256 counts cover wait + duration, the wait in duty steps of 1 << ps ticks.
+
+    Returns:
+        StrobeBTiming, or None if the times cannot be made
+    """
+    if duration_ns <= 0 or wait_ns < 0 or wait_ns + duration_ns > STROBE_B_MAX_TIME_NS:
+        return None
+    wait_ticks = (wait_ns * 100 + 1562) // 3125
+    end_ticks = ((wait_ns + duration_ns) * 100 + 1562) // 3125
+    ps = 0
+    while ps < 7 and end_ticks > (1024 << ps):
+        ps += 1
+    counts = max((end_ticks + (2 << ps)) >> (ps + 2), 1)
+    dc = min(max((wait_ticks + ((1 << ps) >> 1)) >> ps, 1), (counts << 2) - 1)
+    wait_achieved = ticks_to_ns(dc << ps)
+    return StrobeBTiming(
+        counts - 1, ps << 4, dc, wait_achieved, ticks_to_ns(counts << (ps + 2)) - wait_achieved
+    )
+
 
 class PiStrobe:
     STX = 2
+    ECHO_PAYLOAD_MAX = 26  # main.c ECHO_PAYLOAD_MAX
+    PACKET_TYPE_SET_TRIGGER_MODE = 5
+    PACKET_TYPE_GET_CAPABILITIES = 19
+    PACKET_TYPE_GET_LOAD_STATS = 20
+    PACKET_TYPE_SET_STROBE_TIMING_RAW = 21
+    PACKET_TYPE_SET_PHASE_LOCK = 22
+    PHASE_LOCK_SCALE = 65536  # Phase is the wait / frame period in 1/65536
+    PACKET_TYPE_SET_FRAME_CLOCK = 23
+    FRAME_CLOCK_PERIOD_MIN_NS = 100000  # frame_clock.h
+    FRAME_CLOCK_PERIOD_MAX_NS = 131072000
+    RAW_TIMING_FLAG_SHADOW = 0x01
+    LOAD_TIMER_HZ = 1000000  # TMR0
+    PACKET_TYPE_BENCHMARK = 24
+    BENCH_NAMES = ("null", "frame_checksum", "frame_crc", "find_scalers")  # bench_port.h order
+    PACKET_TYPE_SET_STROBE_B = 25
+    STROBE_B_OFF = 0
+    STROBE_B_SIMULTANEOUS = 1  # Both channels on every frame
+    STROBE_B_ALTERNATE = 2  # Channel A on one frame, B on the next
+    EVENT_CHAN_B = 0x08  # get_strobe_events() flags
+    EVENT_CHAN_A_OFF = 0x10
+
+    # Trigger path self-test (trig_test.h)
+    TRIG_TEST_TICK_NS = 125
+    TRIG_TEST_PERIOD_MIN_US = 32
+    TRIG_TEST_PERIOD_MAX_US = 4096
+    TRIG_TEST_IDLE = 0
+    TRIG_TEST_RUNNING = 1
+    TRIG_TEST_DONE = 2
 
     def __init__(self, device_port, reply_pause_s):
         self.device_port = device_port
         self.reply_pause_s = reply_pause_s
+        self.crc_mode = spi_handler.CRC_NONE  # See spi_handler.negotiate_crc()
+        self.capabilities = None  # See spi_handler.discover()
+        self.bulk_read_supported = False  # Each reply byte is loaded by the SPI interrupt
 
     def read_bytes(self, bytes):
-        data = []
-        # Ensure spi is initialized
-        if spi_handler.spi is None:
-            import logging
-
-            logger = logging.getLogger(__name__)
-            logger.error("SPI not initialized! Call spi_init() before using drivers.")
-            return []
-        for x in range(bytes):
-            data.extend(spi_handler.spi.xfer2([0]))
-        return data
+        return spi_handler.read_bytes(self, bytes)
 
     def packet_read(self):
-        valid = False
-        type_read = 0  # Initialize type_read
-        data = []
-        spi_handler.spi_select_device(self.device_port)
-        data_bytes = self.read_bytes(1)
-        if len(data_bytes) > 0 and data_bytes[0] == self.STX:
-            data_bytes.extend(self.read_bytes(2))
-            if len(data_bytes) >= 3:
-                size = data_bytes[1]
-                type_read = data_bytes[2]
-                data_bytes.extend(self.read_bytes(size - 3))
-                checksum = sum(data_bytes) & 0xFF
-                if checksum == 0:
-                    data = data_bytes[3 : (size - 1)]
-                    valid = True
-        if not valid:
-            data = []
-        return valid, type_read, data
+        return spi_handler.packet_read(self)
 
     def packet_write(self, type, data):
-        # Ensure spi is initialized
-        if spi_handler.spi is None:
-            import logging
-
-            logger = logging.getLogger(__name__)
-            logger.error("SPI not initialized! Call spi_init() before using drivers.")
-            return
-        msg = [2, len(data) + 4, type] + data
-        checksum = (-(sum(msg) & 0xFF)) & 0xFF
-        msg.append(checksum)
-        spi_handler.spi_select_device(self.device_port)
-        spi_handler.spi.xfer2(msg)
+        # Bytes shifted in meanwhile: earlier replies still in the write ring, see pipeline_query()
+        return spi_handler.packet_write(self, type, data)
 
     def packet_query(self, type, data):
         # Initialize return values in case of early exception
@@ -78,8 +223,7 @@ class PiStrobe:
         try:
             spi_handler.spi_lock()
             self.packet_write(type, data)
-            #      time.sleep( self.reply_pause_s )
-            spi_handler.pi_wait_s(self.reply_pause_s)
+            spi_handler.wait_reply(self)
             valid = True
             data_read = []
             type_read = 0x100
@@ -178,17 +322,558 @@ class PiStrobe:
         cam_read_time_us = int.from_bytes(data[1:3], byteorder="little", signed=False)
         return (valid and (data[0] == 0), cam_read_time_us)
 
-    def set_trigger_mode(self, hardware_trigger):
+    def set_trigger_mode(self, hardware_trigger, chained=False):
         """
         Set trigger mode for strobe synchronization.
 
         Args:
             hardware_trigger: True for hardware trigger mode (camera triggers strobe),
                              False for software trigger mode (current behavior)
+            chained: With hardware_trigger, start the strobe wait in hardware (CLC4 and
+                     the TMR2 reset) instead of from the T1G interrupt, mode 2
 
         Returns:
-            bool: True if successful, False otherwise
+            bool: True if successful, False otherwise, without a query if discover()
+            found firmware without trigger modes
         """
-        mode = 1 if hardware_trigger else 0
-        valid, data = self.packet_query(5, [mode])
+        if not spi_handler.supports(self, self.PACKET_TYPE_SET_TRIGGER_MODE):
+            return False
+        mode = (2 if chained else 1) if hardware_trigger else 0
+        valid, data = self.packet_query(self.PACKET_TYPE_SET_TRIGGER_MODE, [mode])
         return valid and (data[0] == 0)
+
+    def set_timing_shadow(self, wait_ns, period_ns, apply_us=None):
+        """
+        Stage strobe timing without touching the running timers.
+
+        The staged timing is applied in one step by commit_timing(), or in
+        hardware trigger mode automatically on the next camera frame edge.
+        With apply_us it is held until the synchronized clock reaches that
+        time, then committed (software trigger) or left for the next edge, to
+        change together with commands staged on the other modules; see
+        spi_handler.stage_together(). Needs sync_time() first.
+
+        Args:
+            wait_ns: Wait time in nanoseconds
+            period_ns: Strobe pulse period in nanoseconds
+            apply_us: Time on spi_handler.host_time_us() to hold it until, or None
+
+        Returns:
+            tuple: (valid, actual_wait_ns, actual_period_ns) as for set_timing()
+        """
+        wait_ns_bytes = list(wait_ns.to_bytes(4, "little", signed=False))
+        period_ns_bytes = list(period_ns.to_bytes(4, "little", signed=False))
+        data = wait_ns_bytes + period_ns_bytes
+        if apply_us is not None:
+            data += list((apply_us & 0xFFFFFFFF).to_bytes(4, "little"))
+        valid, data = self.packet_query(6, data)
+        if not valid or len(data) < 9:
+            return (False, wait_ns, period_ns)
+        actual_wait_ns = int.from_bytes(data[1:5], byteorder="little", signed=False)
+        actual_period_ns = int.from_bytes(data[5:9], byteorder="little", signed=False)
+        return ((valid and (data[0] == 0)), actual_wait_ns, actual_period_ns)
+
+    def set_timing_raw(self, timing, shadow=False, apply_us=None):
+        """
+        Send timer register values planned on the host, e.g. by plan_timing(), with no
+        search on the chip.
+
+        Args:
+            timing: StrobeTiming, or a (pr2, t2con, pr4, t4con, smt_pr) sequence
+            shadow: Stage the values as set_timing_shadow() instead of applying them now
+            apply_us: Hold the staged values until this time, as set_timing_shadow()
+
+        Returns:
+            tuple: (valid, actual_wait_ns, actual_duration_ns), what the registers give,
+            without a query if discover() found firmware without raw timing
+        """
+        if not spi_handler.supports(self, self.PACKET_TYPE_SET_STROBE_TIMING_RAW):
+            return (False, 0, 0)
+        pr2, t2con, pr4, t4con, smt_pr = timing[:5]
+        data = [self.RAW_TIMING_FLAG_SHADOW if shadow else 0, pr2, t2con, pr4, t4con]
+        data += list(smt_pr.to_bytes(4, "little", signed=False))
+        if apply_us is not None:
+            data += list((apply_us & 0xFFFFFFFF).to_bytes(4, "little"))
+        valid, data = self.packet_query(self.PACKET_TYPE_SET_STROBE_TIMING_RAW, data)
+        if not valid or len(data) < 9:
+            return (False, 0, 0)
+        actual_wait_ns = int.from_bytes(data[1:5], byteorder="little", signed=False)
+        actual_duration_ns = int.from_bytes(data[5:9], byteorder="little", signed=False)
+        return ((data[0] == 0), actual_wait_ns, actual_duration_ns)
+
+    def set_phase_lock(self, phase):
+        """
+        Keep the strobe wait at a fixed fraction of the camera frame period, as the
+        firmware measures it on SMT2, in hardware trigger mode.
+
+        Args:
+            phase: Wait / frame period, 0 to stop following and keep the current wait
+
+        Returns:
+            tuple: (valid, report) as get_frame_period()
+        """
+        value = min(max(int(round(phase * self.PHASE_LOCK_SCALE)), 0), self.PHASE_LOCK_SCALE - 1)
+        return self._phase_lock_query(list(value.to_bytes(2, "little")))
+
+    def get_frame_period(self):
+        """
+        Read the camera frame period measured on the strobe PIC.
+
+        Returns:
+            tuple: (valid, report) with report keys phase, frame_period_ns (0 until one is
+            measured) and wait_ns (the last wait phase lock staged), without a query if
+            discover() found firmware without phase lock
+        """
+        return self._phase_lock_query([])
+
+    def _phase_lock_query(self, data):
+        if not spi_handler.supports(self, self.PACKET_TYPE_SET_PHASE_LOCK):
+            return (False, {})
+        valid, data = self.packet_query(self.PACKET_TYPE_SET_PHASE_LOCK, data)
+        if not valid or len(data) != 11 or data[0] != 0:
+            return (False, {})
+        return (
+            True,
+            {
+                "phase": int.from_bytes(data[1:3], "little") / self.PHASE_LOCK_SCALE,
+                "frame_period_ns": int.from_bytes(data[3:7], "little"),
+                "wait_ns": int.from_bytes(data[7:11], "little"),
+            },
+        )
+
+    def set_frame_clock(self, period_ns):
+        """
+        Make the strobe PIC the frame clock: a square wave on RA0, wired to the camera
+        trigger input, whose rising edges start each frame. RA0 also stands in for the
+        camera on RC5, so the strobe follows the clock in hardware or chained trigger
+        mode with no host in the timing path.
+
+        Args:
+            period_ns: Frame period in nanoseconds, FRAME_CLOCK_PERIOD_MIN_NS to
+                FRAME_CLOCK_PERIOD_MAX_NS, or 0 to stop and give the trigger inputs
+                back to the camera
+
+        Returns:
+            tuple: (valid, actual_period_ns), 0 when stopped
+        """
+        return self._frame_clock_query(list(int(period_ns).to_bytes(4, "little", signed=False)))
+
+    def get_frame_clock(self):
+        """
+        Returns:
+            tuple: (valid, period_ns) of the running frame clock, 0 when stopped, without
+            a query if discover() found firmware without the frame clock
+        """
+        return self._frame_clock_query([])
+
+    def _frame_clock_query(self, data):
+        if not spi_handler.supports(self, self.PACKET_TYPE_SET_FRAME_CLOCK):
+            return (False, 0)
+        valid, data = self.packet_query(self.PACKET_TYPE_SET_FRAME_CLOCK, data)
+        if not valid or len(data) != 5:
+            return (False, 0)
+        return ((data[0] == 0), int.from_bytes(data[1:5], "little"))
+
+    def set_channel_b(self, mode, wait_ns=0, duration_ns=0):
+        """
+        Drive the second LED channel on RC4 from the camera frames, with its own wait and
+        duration, for two contrasts from one camera stream.
+
+        Args:
+            mode: STROBE_B_OFF, STROBE_B_SIMULTANEOUS (both channels every frame) or
+                STROBE_B_ALTERNATE (channel A, then B alone on the next frame)
+            wait_ns: Wait from the frame edge, see plan_channel_b()
+            duration_ns: Pulse duration, wait + duration up to STROBE_B_MAX_TIME_NS
+
+        Returns:
+            tuple: (valid, report) as get_channel_b()
+        """
+        data = [mode & 0xFF]
+        data += list(int(wait_ns).to_bytes(4, "little", signed=False))
+        data += list(int(duration_ns).to_bytes(4, "little", signed=False))
+        return self._channel_b_query(data)
+
+    def get_channel_b(self):
+        """
+        Returns:
+            tuple: (valid, report) with report keys mode, wait_ns and duration_ns, the
+            times as made and 0 when off, without a query if discover() found firmware
+            without channel B
+        """
+        return self._channel_b_query([])
+
+    def _channel_b_query(self, data):
+        if not spi_handler.supports(self, self.PACKET_TYPE_SET_STROBE_B):
+            return (False, {})
+        valid, data = self.packet_query(self.PACKET_TYPE_SET_STROBE_B, data)
+        if not valid or len(data) != 10:
+            return (False, {})
+        return (
+            (data[0] == 0),
+            {
+                "mode": data[1],
+                "wait_ns": int.from_bytes(data[2:6], "little"),
+                "duration_ns": int.from_bytes(data[6:10], "little"),
+            },
+        )
+
+    def commit_timing(self):
+        """
+        Apply timing staged by set_timing_shadow() now.
+
+        Returns:
+            bool: True if successful, False otherwise
+        """
+        valid, data = self.packet_query(7, [])
+        return valid and len(data) > 0 and (data[0] == 0)
+
+    def set_sequence_entry(self, index, wait_ns, period_ns, repeat):
+        """
+        Upload one entry of the on-chip strobe sequence table (hardware trigger mode).
+
+        Args:
+            index: Table index (0..15)
+            wait_ns: Wait time in nanoseconds
+            period_ns: Strobe pulse period in nanoseconds
+            repeat: Number of consecutive frames using this entry (1..255)
+
+        Returns:
+            tuple: (valid, actual_wait_ns, actual_period_ns)
+        """
+        data = [index & 0xFF]
+        data += list(wait_ns.to_bytes(4, "little", signed=False))
+        data += list(period_ns.to_bytes(4, "little", signed=False))
+        data += [repeat & 0xFF]
+        valid, data = self.packet_query(8, data)
+        if not valid or len(data) < 9:
+            return (False, wait_ns, period_ns)
+        actual_wait_ns = int.from_bytes(data[1:5], byteorder="little", signed=False)
+        actual_period_ns = int.from_bytes(data[5:9], byteorder="little", signed=False)
+        return ((data[0] == 0), actual_wait_ns, actual_period_ns)
+
+    def set_sequence(self, length, loop):
+        """
+        Start (length > 0) or stop (length == 0) the strobe sequence.
+
+        The sequence starts from entry 0 on the next camera frame edge and advances
+        on every frame edge while hardware trigger mode is enabled.
+
+        Args:
+            length: Number of table entries to use
+            loop: True to restart from entry 0 after the last entry
+
+        Returns:
+            bool: True if successful, False otherwise
+        """
+        valid, data = self.packet_query(9, [length & 0xFF, 1 if loop else 0])
+        return valid and len(data) > 0 and (data[0] == 0)
+
+    def get_sequence(self):
+        """
+        Returns:
+            tuple: (valid, length, loop, active)
+        """
+        valid, data = self.packet_query(9, [])
+        if not valid or len(data) < 4:
+            return (False, 0, False, False)
+        return ((data[0] == 0), data[1], bool(data[2]), bool(data[3]))
+
+    def upload_sequence(self, entries, loop=True):
+        """
+        Upload and start a strobe sequence.
+
+        Args:
+            entries: List of (wait_ns, period_ns, repeat) tuples
+            loop: True to repeat the sequence indefinitely
+
+        Returns:
+            tuple: (valid, [(actual_wait_ns, actual_period_ns), ...])
+        """
+        actual = []
+        for index, (wait_ns, period_ns, repeat) in enumerate(entries):
+            valid, actual_wait_ns, actual_period_ns = self.set_sequence_entry(
+                index, wait_ns, period_ns, repeat
+            )
+            if not valid:
+                return (False, actual)
+            actual.append((actual_wait_ns, actual_period_ns))
+        return (self.set_sequence(len(entries), loop), actual)
+
+    def set_pulses(self, count, gap_ns=0):
+        """
+        Set the number of strobe pulses fired per camera frame (hardware trigger mode).
+
+        Each pulse uses the configured duration; pulses after the first start gap_ns
+        after the previous one ends. The gap also includes PIC interrupt latency.
+
+        Args:
+            count: Pulses per frame (1..8), 1 is the normal single pulse
+            gap_ns: Gap between pulses in nanoseconds (ignored for count == 1)
+
+        Returns:
+            tuple: (valid, count, actual_gap_ns)
+        """
+        data = [count & 0xFF] + list(gap_ns.to_bytes(4, "little", signed=False))
+        valid, data = self.packet_query(10, data)
+        if not valid or len(data) < 6:
+            return (False, count, gap_ns)
+        actual_gap_ns = int.from_bytes(data[2:6], byteorder="little", signed=False)
+        return ((data[0] == 0), data[1], actual_gap_ns)
+
+    def get_strobe_stats(self, reset=False):
+        """
+        Read hardware trigger statistics (hardware trigger mode).
+
+        Args:
+            reset: True to clear the counters after reading
+
+        Returns:
+            tuple: (valid, triggers, fired, dropped_busy, dropped_disabled)
+        """
+        valid, data = self.packet_query(11, [1] if reset else [])
+        if not valid or len(data) < 17:
+            return (False, 0, 0, 0, 0)
+        counters = [
+            int.from_bytes(data[i : i + 4], byteorder="little", signed=False)
+            for i in range(1, 17, 4)
+        ]
+        return tuple([data[0] == 0] + counters)
+
+    def get_cam_read_stats(self, reset=False):
+        """
+        Read camera read time (T1G gate width) statistics.
+
+        Args:
+            reset: True to clear the statistics after reading
+
+        Returns:
+            tuple: (valid, count, min_us, max_us, mean_us, bins) where bins is a
+            list of 8 counts, see set_cam_read_hist() for the bin layout
+        """
+        valid, data = self.packet_query(12, [1] if reset else [])
+        if not valid or len(data) < 27:
+            return (False, 0, 0, 0, 0, [])
+        count = int.from_bytes(data[1:5], byteorder="little", signed=False)
+        min_us, max_us, mean_us = [
+            int.from_bytes(data[i : i + 2], byteorder="little", signed=False) for i in (5, 7, 9)
+        ]
+        bins = [
+            int.from_bytes(data[i : i + 2], byteorder="little", signed=False)
+            for i in range(11, 27, 2)
+        ]
+        return ((data[0] == 0), count, min_us, max_us, mean_us, bins)
+
+    def set_cam_read_hist(self, base_us, bin_shift):
+        """
+        Set the camera read time histogram layout and reset the statistics.
+
+        Bin i covers [base_us + i * 2**bin_shift, base_us + (i + 1) * 2**bin_shift);
+        values below base_us count in the first bin, values above the range in the last.
+
+        Args:
+            base_us: Start of the first bin in microseconds
+            bin_shift: log2 of the bin width in microseconds (0..15)
+
+        Returns:
+            bool: True if successful, False otherwise
+        """
+        data = list(base_us.to_bytes(2, "little", signed=False)) + [bin_shift & 0xFF]
+        valid, data = self.packet_query(13, data)
+        return valid and len(data) > 0 and (data[0] == 0)
+
+    def get_strobe_events(self, max_packets=16):
+        """
+        Drain the trigger event FIFO (hardware trigger mode).
+
+        Each packet returns up to 3 events; packets are read until the FIFO is empty
+        or max_packets have been read.
+
+        Args:
+            max_packets: Upper bound on SPI queries for one drain
+
+        Returns:
+            tuple: (valid, events, lost) where events is a list of
+            (timestamp_us, gate_us, flags) tuples, timestamp_us on the host
+            clock after sync_time(), flags bit0 = fired,
+            bit1 = dropped (busy), bit2 = dropped (disabled), bit3 = channel B fired,
+            bit4 = channel A held off (alternate pattern), and lost is the
+            number of events discarded because the FIFO was full
+        """
+        events = []
+        lost = 0
+        for _ in range(max_packets):
+            valid, data = self.packet_query(14, [])
+            if not valid or len(data) < 3 or data[0] != 0:
+                return (False, events, lost)
+            remaining = data[1]
+            lost += data[2]
+            for i in range(3, len(data) - 6, 7):
+                timestamp_us = int.from_bytes(data[i : i + 4], byteorder="little", signed=False)
+                gate_us = int.from_bytes(data[i + 4 : i + 6], byteorder="little", signed=False)
+                events.append((timestamp_us, gate_us, data[i + 6]))
+            if remaining == 0:
+                break
+        return (True, events, lost)
+
+    def get_spi_stats(self, reset=False):
+        """
+        Read SPI buffer sizes, drop/overflow counters and peak ring usage.
+
+        Args:
+            reset: True to clear the counters after reading
+
+        Returns:
+            tuple: (valid, stats) with stats keyed by spi_handler.SPI_STATS_FIELDS
+        """
+        valid, data = self.packet_query(15, [1] if reset else [])
+        return spi_handler.parse_spi_stats(valid, data)
+
+    def get_load_stats(self, reset=False):
+        """
+        Read the main loop CPU load and interrupt time over the last second.
+
+        Args:
+            reset: True to clear the peak load and the maximums after reading
+
+        Returns:
+            tuple: (valid, load) with load as the load in spi_handler.parse_probe_stats(),
+            without a query if discover() found firmware without the load meter
+        """
+        if not spi_handler.supports(self, self.PACKET_TYPE_GET_LOAD_STATS):
+            return (False, {})
+        valid, data = self.packet_query(self.PACKET_TYPE_GET_LOAD_STATS, [1] if reset else [])
+        if not valid or len(data) != 1 + spi_handler.PROBE_LOAD_SIZE or data[0] != 0:
+            return (False, {})
+        return (True, spi_handler.parse_load_report(data[1:], self.LOAD_TIMER_HZ))
+
+    def benchmark(self, kernel, runs=100):
+        """
+        Time one firmware kernel on the module, for comparing compiler options and code
+        changes, see spi_handler.parse_bench_report().
+
+        Args:
+            kernel: A BENCH_NAMES name or its index
+            runs: 1 to 1000, the module's main loop waits for all of them
+
+        Returns:
+            tuple: (valid, result), (False, {}) if the firmware was built without it
+        """
+        return spi_handler.bench_query(
+            self, self.PACKET_TYPE_BENCHMARK, self.BENCH_NAMES, kernel, runs
+        )
+
+    def echo(self, payload):
+        """
+        Send <payload> and read it back, for drivers/spi_benchmark.py.
+
+        Args:
+            payload: Bytes to echo, up to ECHO_PAYLOAD_MAX
+
+        Returns:
+            tuple: (valid, data) with data the payload the board returned
+        """
+        valid, data = self.packet_query(16, list(payload))
+        if not valid or len(data) < 1 or data[0] != 0:
+            return (False, [])
+        return (True, data[1:])
+
+    def parse_trigger_test(self, data):
+        """
+        Decode the [rc] + 23-byte report of the TRIG_TEST packet.
+
+        Latencies are converted from TMR3 ticks to ns and jitter is max - min.
+
+        Returns:
+            tuple: (valid, report) with report a dict, None if the reply is short
+        """
+        if len(data) < 24:
+            return (False, None)
+        u16 = [
+            int.from_bytes(data[i : i + 2], byteorder="little", signed=False)
+            for i in range(2, 24, 2)
+        ]
+        report = {
+            "rc": data[0],
+            "state": data[1],
+            "period_us": u16[0],
+            "edges": u16[1],
+            "dropped": u16[2],
+            "missed": u16[3],
+            "outputs": u16[7],
+        }
+        for name, (lo, hi, mean) in (("isr", u16[4:7]), ("output", u16[8:11])):
+            report[name + "_min_ns"] = lo * self.TRIG_TEST_TICK_NS
+            report[name + "_max_ns"] = hi * self.TRIG_TEST_TICK_NS
+            report[name + "_mean_ns"] = mean * self.TRIG_TEST_TICK_NS
+            report[name + "_jitter_ns"] = max(hi - lo, 0) * self.TRIG_TEST_TICK_NS
+        return (data[0] == 0, report)
+
+    def start_trigger_test(self, edges, period_us):
+        """
+        Start the trigger path self-test: <edges> camera-like edges every <period_us>
+        (rounded to 16 us) from RA0, timed from edge to strobe_gate_isr() entry and to
+        the strobe output rise. The strobe must be enabled with one pulse per frame and
+        the hardware trigger mode is restored when the test ends.
+
+        Returns:
+            tuple: (valid, report), see parse_trigger_test()
+        """
+        data = list(int(edges).to_bytes(2, "little", signed=False))
+        data += list(int(period_us).to_bytes(2, "little", signed=False))
+        valid, data = self.packet_query(17, data)
+        if not valid:
+            return (False, None)
+        return self.parse_trigger_test(data)
+
+    def stop_trigger_test(self):
+        """
+        End a running self-test early, the report keeps the edges measured so far.
+
+        Returns:
+            tuple: (valid, report), see parse_trigger_test()
+        """
+        valid, data = self.packet_query(17, [0, 0, 0, 0])
+        if not valid:
+            return (False, None)
+        return self.parse_trigger_test(data)
+
+    def get_trigger_test(self):
+        """
+        Read the self-test report, state TRIG_TEST_IDLE once a test has finished.
+
+        Returns:
+            tuple: (valid, report), see parse_trigger_test()
+        """
+        valid, data = self.packet_query(17, [])
+        if not valid:
+            return (False, None)
+        return self.parse_trigger_test(data)
+
+    def run_trigger_test(self, edges=1000, period_us=1000, poll_s=0.1):
+        """
+        Start the self-test and poll until it has finished.
+
+        Returns:
+            tuple: (valid, report), see parse_trigger_test()
+        """
+        valid, report = self.start_trigger_test(edges, period_us)
+        if not valid:
+            return (False, report)
+        timeout_s = 1.0 + 2 * edges * report["period_us"] * 1e-6
+        deadline = spi_handler.clock.monotonic() + timeout_s
+        while report["state"] != self.TRIG_TEST_IDLE:
+            if spi_handler.clock.monotonic() > deadline:
+                self.stop_trigger_test()
+                return (False, report)
+            spi_handler.clock.sleep(poll_s)
+            valid, report = self.get_trigger_test()
+            if not valid:
+                return (False, report)
+        return (True, report)
+
+    def sync_time(self, rounds=spi_handler.TIME_SYNC_ROUNDS):
+        """
+        Align the event timestamps with spi_handler.host_time_us(), see
+        spi_handler.sync_time().
+        """
+        return spi_handler.sync_time(self, 18, rounds)
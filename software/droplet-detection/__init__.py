@@ -12,6 +12,7 @@ from .measurer import Measurer, DropletMetrics
 from .artifact_rejector import ArtifactRejector
 from .histogram import DropletHistogram
 from .config import DropletDetectionConfig, load_config, save_config, extract_droplet_config
+from .pipeline import DetectionPipeline
 
 __all__ = [
     "DropletDetector",
@@ -25,6 +26,7 @@ __all__ = [
     "load_config",
     "save_config",
     "extract_droplet_config",
+    "DetectionPipeline",
 ]
 
 __version__ = "0.1.0"
@@ -38,6 +38,8 @@ class ArtifactRejector:
         self.config = config
         self.prev_centroids: List[Tuple[float, float]] = []
         self.prev_frame: Optional[np.ndarray] = None
+        # Strobe exposure of the frame over the reference one, scales the difference threshold
+        self.exposure_scale: float = 1.0
 
     def filter(
         self, contours: List[np.ndarray], prev_centroids: Optional[List[Tuple[float, float]]] = None
@@ -148,7 +150,10 @@ class ArtifactRejector:
         # Compute frame difference
         frame_diff = cv2.absdiff(current_frame, prev_frame)
         _, diff_mask = cv2.threshold(
-            frame_diff, self.config.frame_diff_threshold, 255, cv2.THRESH_BINARY
+            frame_diff,
+            self.config.frame_diff_threshold * self.exposure_scale,
+            255,
+            cv2.THRESH_BINARY,
         )
 
         # Filter contours: only keep those in changed regions
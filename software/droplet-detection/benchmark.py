@@ -6,15 +6,24 @@ Generates performance reports and frame rate limit recommendations.
 
 Usage:
     python -m droplet_detection.benchmark [--roi-size SMALL|MEDIUM|LARGE] [--iterations N]
+    python -m droplet_detection.benchmark --scenario buffers  # Preprocessor buffer reuse
+    python -m droplet_detection.benchmark --scenario live [--url URL] [--duration S]
+
+The live scenario measures the running application instead of this process: the
+latency from strobe trigger to frame arrival, droplet result and flow action that
+the detector controller keeps (GET /api/droplet/latency). Set
+RIO_DROPLET_LATENCY_TAGS=true on the application for the trigger stamps.
 """
 
 import argparse
 import logging
 import time
+import tracemalloc
 import numpy as np
 import cv2
 from typing import Dict, List, Tuple, Optional, Any, Callable
 import json
+import urllib.request
 
 from path_bootstrap import bootstrap_runtime
 
@@ -150,6 +159,75 @@ class PerformanceBenchmark:
             "p99": float(np.percentile(times_array, 99)),
         }
 
+    def measure_allocations(
+        self, component_func: Callable, test_frame: np.ndarray, iterations: int
+    ) -> Dict[str, float]:
+        """
+        Array memory allocated within each call, as the tracemalloc peak above the memory
+        in use before it. numpy and the arrays OpenCV returns are traced, not OpenCV's
+        internal scratch buffers.
+
+        Returns:
+            Statistics dictionary in kB (mean, max)
+        """
+        tracemalloc.start()
+        try:
+            component_func(test_frame)  # Warm up, e.g. fill a buffer pool
+            allocated = []
+            for _ in range(iterations):
+                tracemalloc.reset_peak()
+                before, _ = tracemalloc.get_traced_memory()
+                component_func(test_frame)
+                _, peak = tracemalloc.get_traced_memory()
+                allocated.append((peak - before) / 1024)
+        finally:
+            tracemalloc.stop()
+        return {"mean": float(np.mean(allocated)), "max": float(np.max(allocated))}
+
+    def benchmark_preprocess_buffers(
+        self, roi_size: Tuple[int, int], num_droplets: int
+    ) -> Dict[str, Any]:
+        """
+        Benchmark Preprocessor.process() allocating its arrays on every frame, writing into
+        buffers kept per ROI size, and with the fused open+close on top.
+
+        Args:
+            roi_size: (width, height) tuple
+            num_droplets: Number of droplets in test frame
+
+        Returns:
+            Benchmark results dictionary, time and allocations per frame of each variant
+        """
+        width, height = roi_size
+        logger.info(f"Benchmarking preprocess buffers: ROI={width}×{height}")
+        gray = self.generate_test_frame(width, height, num_droplets)
+        test_frame = cv2.cvtColor(gray, cv2.COLOR_GRAY2RGB)  # As get_frame_roi() returns
+
+        variants = {
+            "allocating": {"reuse_buffers": False, "fused_morphology": False},
+            "pooled": {"reuse_buffers": True, "fused_morphology": False},
+            "pooled_fused": {"reuse_buffers": True, "fused_morphology": True},
+        }
+        results: Dict[str, Any] = {
+            "roi_size": roi_size,
+            "num_droplets": num_droplets,
+            "iterations": self.iterations,
+        }
+        for name, settings in variants.items():
+            config = DropletDetectionConfig(
+                {"background_method": "highpass", "morph_operation": "both", **settings}
+            )
+            preprocessor = Preprocessor(config)
+            results[name] = {
+                "time_ms": self.benchmark_component(
+                    name, preprocessor.process, test_frame, self.iterations
+                ),
+                "allocated_kb": self.measure_allocations(
+                    preprocessor.process, test_frame, self.iterations
+                ),
+            }
+        return results
+
     def benchmark_pipeline(
         self,
         roi_size: Tuple[int, int],
@@ -312,6 +390,90 @@ class PerformanceBenchmark:
 
         return all_results
 
+    def run_buffer_benchmark(self, roi_sizes: Optional[List[str]] = None) -> Dict[str, Any]:
+        """
+        Run the preprocess buffer scenario for each ROI size, at medium density.
+
+        Returns:
+            Results of benchmark_preprocess_buffers() by ROI size key
+        """
+        if roi_sizes is None:
+            roi_sizes = list(self.ROI_SIZES.keys())
+        min_drops, max_drops = self.DENSITY_SCENARIOS["medium"]
+        all_results: Dict[str, Any] = {
+            "timestamp": time.strftime("%Y-%m-%d %H:%M:%S"),
+            "iterations_per_test": self.iterations,
+            "buffers": {},
+        }
+        for roi_key in roi_sizes:
+            if roi_key not in self.ROI_SIZES:
+                logger.warning(f"Unknown ROI size: {roi_key}")
+                continue
+            all_results["buffers"][roi_key] = self.benchmark_preprocess_buffers(
+                self.ROI_SIZES[roi_key], (min_drops + max_drops) // 2
+            )
+        return all_results
+
+    def print_buffer_summary(self, results: Dict[str, Any]) -> None:
+        """Print the preprocess buffer scenario summary."""
+        print("\n" + "=" * 80)
+        print("PREPROCESS BUFFER REUSE BENCHMARK")
+        print("=" * 80)
+        for roi_key, scenario in results["buffers"].items():
+            roi = scenario["roi_size"]
+            print(f"\nROI={roi_key} ({roi[0]}×{roi[1]})")
+            print("-" * 80)
+            for name in ("allocating", "pooled", "pooled_fused"):
+                stats = scenario[name]
+                if not stats["time_ms"]:
+                    continue
+                print(
+                    f"  {name:14s}: "
+                    f"mean={stats['time_ms']['mean']:6.3f}ms, "
+                    f"p95={stats['time_ms']['p95']:6.3f}ms, "
+                    f"allocated={stats['allocated_kb']['mean']:8.1f}kB/frame"
+                )
+
+    def run_live_benchmark(self, url: str, duration_s: float) -> Dict[str, Any]:
+        """
+        Sample the latency of the running application's detection pipeline.
+
+        Args:
+            url: Base URL of the application
+            duration_s: Seconds to let detection run before reading the percentiles
+
+        Returns:
+            Results with the latency statistics of each interval, in ms
+        """
+        endpoint = url.rstrip("/") + "/api/droplet/latency"
+        logger.info(f"Sampling {endpoint} after {duration_s}s")
+        time.sleep(duration_s)
+        with urllib.request.urlopen(endpoint, timeout=10) as response:
+            latency = json.load(response)
+        return {
+            "timestamp": time.strftime("%Y-%m-%d %H:%M:%S"),
+            "url": url,
+            "duration_s": duration_s,
+            "latency": latency,
+        }
+
+    def print_live_summary(self, results: Dict[str, Any]) -> None:
+        """Print the live latency scenario summary."""
+        print("\n" + "=" * 80)
+        print("LIVE PIPELINE LATENCY (trigger -> arrival -> result -> action)")
+        print("=" * 80)
+        for name, stats in results["latency"].items():
+            if not stats["count"]:
+                print(f"  {name:20s}: no samples")
+                continue
+            print(
+                f"  {name:20s}: "
+                f"p50={stats['p50']:7.2f}ms, "
+                f"p90={stats['p90']:7.2f}ms, "
+                f"p99={stats['p99']:7.2f}ms, "
+                f"max={stats['max']:7.2f}ms (n={stats['count']})"
+            )
+
     def print_summary(self, results: Dict[str, Any]) -> None:
         """Print benchmark summary."""
         print("\n" + "=" * 80)
@@ -387,6 +549,25 @@ def main():
     parser.add_argument(
         "--iterations", type=int, default=100, help="Number of iterations per test (default: 100)"
     )
+    parser.add_argument(
+        "--scenario",
+        choices=["pipeline", "buffers", "live"],
+        default="pipeline",
+        help="Full pipeline per component, preprocess buffer reuse, or the running "
+        "application's trigger to action latency (default: pipeline)",
+    )
+    parser.add_argument(
+        "--url",
+        type=str,
+        default="http://localhost:5000",
+        help="Application URL for --scenario live (default: http://localhost:5000)",
+    )
+    parser.add_argument(
+        "--duration",
+        type=float,
+        default=10.0,
+        help="Seconds to sample for --scenario live (default: 10)",
+    )
     parser.add_argument(
         "--output",
         type=str,
@@ -402,10 +583,17 @@ def main():
 
     # Run benchmark
     benchmark = PerformanceBenchmark(iterations=args.iterations)
-    results = benchmark.run_full_benchmark(roi_sizes=roi_sizes, densities=densities)
-
-    # Print summary
-    benchmark.print_summary(results)
+    if args.scenario == "live":
+        results = benchmark.run_live_benchmark(args.url, args.duration)
+        benchmark.print_live_summary(results)
+    elif args.scenario == "buffers":
+        results = benchmark.run_buffer_benchmark(roi_sizes=roi_sizes)
+        benchmark.print_buffer_summary(results)
+    else:
+        results = benchmark.run_full_benchmark(roi_sizes=roi_sizes, densities=densities)
+
+        # Print summary
+        benchmark.print_summary(results)
 
     # Save results
     benchmark.save_results(results, args.output)
@@ -36,6 +36,8 @@ class DropletDetectionConfig:
         self.adaptive_C: int = 2  # For adaptive thresholding
         self.morph_kernel_size: tuple = (3, 3)  # Morphological kernel size
         self.morph_operation: str = "open"  # "open", "close", or "both"
+        self.fused_morphology: bool = False  # "both" as erode, dilate x2, erode
+        self.reuse_buffers: bool = True  # Preprocess into arrays kept per ROI size
 
         # Segmentation parameters
         self.min_area: int = 20  # Minimum contour area in pixels²
@@ -52,6 +54,10 @@ class DropletDetectionConfig:
         self.use_frame_diff: bool = False  # Use frame difference method
         self.frame_diff_threshold: int = 30  # Threshold for frame difference
 
+        # Strobe gating parameters (frame tags, see controllers/strobe_cam.py)
+        self.strobe_gating: bool = False  # Skip frames tagged as not strobed
+        self.reference_strobe_ns: int = 0  # Strobe period the thresholds are set at, 0: unscaled
+
         # Measurement parameters
         self.min_contour_points: int = 5  # Minimum points for ellipse fitting
 
@@ -97,6 +103,8 @@ class DropletDetectionConfig:
             "adaptive_C": self.adaptive_C,
             "morph_kernel_size": self.morph_kernel_size,
             "morph_operation": self.morph_operation,
+            "fused_morphology": self.fused_morphology,
+            "reuse_buffers": self.reuse_buffers,
             "min_area": self.min_area,
             "max_area": self.max_area,
             "min_aspect_ratio": self.min_aspect_ratio,
@@ -106,6 +114,8 @@ class DropletDetectionConfig:
             "max_perp_drift": self.max_perp_drift,
             "use_frame_diff": self.use_frame_diff,
             "frame_diff_threshold": self.frame_diff_threshold,
+            "strobe_gating": self.strobe_gating,
+            "reference_strobe_ns": self.reference_strobe_ns,
             "min_contour_points": self.min_contour_points,
             "histogram_window_size": self.histogram_window_size,
             "histogram_bins": self.histogram_bins,
@@ -152,6 +162,8 @@ class DropletDetectionConfig:
             errors.append("min_motion must be >= 0")
         if self.max_perp_drift < 0:
             errors.append("max_perp_drift must be >= 0")
+        if self.reference_strobe_ns < 0:
+            errors.append("reference_strobe_ns must be >= 0")
 
         return len(errors) == 0, errors
 
@@ -8,7 +8,7 @@ import logging
 import time
 import numpy as np
 import cv2
-from typing import List, Optional, Tuple, Callable
+from typing import Any, List, Optional, Tuple, Callable
 
 from .config import DropletDetectionConfig
 from .preprocessor import Preprocessor
@@ -56,6 +56,7 @@ class DropletDetector:
         self.prev_centroids: List[Tuple[float, float]] = []
         self.frame_count = 0
         self.background_initialized = False
+        self.unstrobed_skipped = 0  # Frames tagged as not strobed, skipped by strobe_gating
 
     def initialize_background(self, frames: List[np.ndarray]) -> None:
         """
@@ -69,8 +70,32 @@ class DropletDetector:
             self.preprocessor.initialize_background(frame)
         self.background_initialized = self.preprocessor.background_initialized
 
+    def apply_tag(self, tag: Any) -> bool:
+        """
+        Take the strobe exposure of a tagged frame for the thresholds.
+
+        Args:
+            tag: FrameTag of the frame (controllers/strobe_cam.py), with strobed and period_ns
+
+        Returns:
+            False if the frame was not strobed and strobe_gating skips it
+        """
+        if not tag.strobed and self.config.strobe_gating:
+            self.unstrobed_skipped += 1
+            return False
+        scale = 1.0
+        if tag.strobed and self.config.reference_strobe_ns > 0 and tag.period_ns > 0:
+            # Image contrast grows with the light pulse, so do the offsets above background
+            scale = tag.period_ns / self.config.reference_strobe_ns
+        self.preprocessor.exposure_scale = scale
+        self.artifact_rejector.exposure_scale = scale
+        return True
+
     def process_frame(
-        self, frame: np.ndarray, timing_callback: Optional[Callable[[str, float], None]] = None
+        self,
+        frame: np.ndarray,
+        timing_callback: Optional[Callable[[str, float], None]] = None,
+        tag: Optional[Any] = None,
     ) -> List[DropletMetrics]:
         """
         Process a single ROI frame and return detected droplets.
@@ -85,10 +110,15 @@ class DropletDetector:
             frame: ROI frame from camera.get_frame_roi() (RGB numpy array)
             timing_callback: Optional callback function(component_name, elapsed_ms)
                             for timing instrumentation
+            tag: Optional FrameTag of the frame, see apply_tag(); None for untagged frames,
+                processed at the reference exposure
 
         Returns:
             List of DropletMetrics objects
         """
+        if tag is not None and not self.apply_tag(tag):
+            return []
+
         self.frame_count += 1
 
         # Validate frame
@@ -198,4 +228,5 @@ class DropletDetector:
         self.prev_centroids = []
         self.frame_count = 0
         self.background_initialized = False
+        self.unstrobed_skipped = 0
         logger.debug("Droplet detector reset")
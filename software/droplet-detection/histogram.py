@@ -6,6 +6,7 @@ Based on structure from droplet_AInalysis repository.
 """
 
 import logging
+import math
 import numpy as np
 from typing import Dict, Optional, Tuple, List
 from collections import deque
@@ -15,6 +16,98 @@ from .measurer import DropletMetrics
 logger = logging.getLogger(__name__)
 
 
+class SlidingStats:
+    """
+    Mean, std, min, max and mode of the last <maxlen> values, kept up to date on append.
+
+    - mean and std from running sums of the values and their squares, summed again from
+      the window once per <maxlen> evictions so that rounding errors do not build up
+    - min and max from monotonic deques of (index, value)
+    - mode from the count of each rounded value and the values at each count, so the
+      highest count is known without a scan; ties go to the smallest value, as bincount
+    """
+
+    def __init__(self, maxlen: int):
+        self.values: deque = deque(maxlen=maxlen)
+        self.clear()
+
+    def clear(self) -> None:
+        self.values.clear()
+        self._appended = 0  # Index of the next value
+        self._evicted = 0  # Since the sums were last recomputed
+        self._sum = 0.0
+        self._sum_sq = 0.0
+        self._mins: deque = deque()  # (index, value), values increasing
+        self._maxs: deque = deque()  # (index, value), values decreasing
+        self._counts: Dict[int, int] = {}  # Rounded value -> count
+        self._at_count: Dict[int, set] = {}  # Count -> rounded values with it
+        self._top = 0  # Highest count
+        self._mode: Optional[int] = None  # Cached smallest value at the highest count
+
+    def _count(self, key: int, step: int) -> None:
+        count = self._counts.get(key, 0)
+        if count:
+            holders = self._at_count[count]
+            holders.discard(key)
+            if not holders:
+                del self._at_count[count]
+                if count == self._top and step < 0:
+                    self._top -= 1
+        count += step
+        if count:
+            self._counts[key] = count
+            self._at_count.setdefault(count, set()).add(key)
+            self._top = max(self._top, count)
+        else:
+            del self._counts[key]
+        self._mode = None
+
+    def append(self, value: float) -> None:
+        if len(self.values) == self.values.maxlen:
+            old = self.values[0]
+            self._sum -= old
+            self._sum_sq -= old * old
+            self._count(int(round(old)), -1)
+            oldest = self._appended - len(self.values)
+            if self._mins[0][0] == oldest:
+                self._mins.popleft()
+            if self._maxs[0][0] == oldest:
+                self._maxs.popleft()
+            self._evicted += 1
+        self.values.append(value)
+        self._sum += value
+        self._sum_sq += value * value
+        self._count(int(round(value)), 1)
+        while self._mins and self._mins[-1][1] >= value:
+            self._mins.pop()
+        self._mins.append((self._appended, value))
+        while self._maxs and self._maxs[-1][1] <= value:
+            self._maxs.pop()
+        self._maxs.append((self._appended, value))
+        self._appended += 1
+        if self._evicted >= len(self.values):
+            self._sum = math.fsum(self.values)
+            self._sum_sq = math.fsum(v * v for v in self.values)
+            self._evicted = 0
+
+    def summary(self, ratio: float, mode_ratio: float) -> Dict[str, int]:
+        """The statistics scaled by <ratio>, the mode by <mode_ratio>, rounded."""
+        count = len(self.values)
+        if not count:
+            return {"mean": 0, "std": 0, "min": 0, "max": 0, "mode": 0}
+        mean = self._sum / count
+        variance = max(self._sum_sq / count - mean * mean, 0.0)
+        if self._mode is None:
+            self._mode = min(self._at_count[self._top])
+        return {
+            "mean": int(round(mean * ratio)),
+            "std": int(round(math.sqrt(variance) * ratio)),
+            "min": int(round(self._mins[0][1] * ratio)),
+            "max": int(round(self._maxs[0][1] * ratio)),
+            "mode": int(round(self._mode * mode_ratio)),
+        }
+
+
 class DropletHistogram:
     """
     Histogram and statistics module for droplet detection.
@@ -50,10 +143,14 @@ class DropletHistogram:
         # Height = minor axis (from ellipse or bounding box)
         # Diameter = equivalent diameter
         # Area = contour area
-        self.widths = deque(maxlen=maxlen)  # Major axis (length)
-        self.heights = deque(maxlen=maxlen)  # Minor axis
-        self.diameters = deque(maxlen=maxlen)  # Equivalent diameter
-        self.areas = deque(maxlen=maxlen)  # Contour area
+        # Their statistics are kept as they are appended, see SlidingStats
+        self._stats = {
+            metric: SlidingStats(maxlen) for metric in ("width", "height", "diameter", "area")
+        }
+        self.widths = self._stats["width"].values  # Major axis (length)
+        self.heights = self._stats["height"].values  # Minor axis
+        self.diameters = self._stats["diameter"].values  # Equivalent diameter
+        self.areas = self._stats["area"].values  # Contour area
 
     def update(self, metrics: List[DropletMetrics]) -> None:
         """
@@ -65,18 +162,19 @@ class DropletHistogram:
         if not metrics:
             return  # Skip empty lists
 
+        stats = self._stats
         for m in metrics:
             # Width = major axis (droplet length)
-            self.widths.append(m.major_axis)
+            stats["width"].append(m.major_axis)
             # Height = minor axis (from bounding box or ellipse)
             # Use bounding box height as approximation
             _, _, w, h = m.bounding_box
             minor_axis = min(w, h)
-            self.heights.append(minor_axis)
+            stats["height"].append(minor_axis)
             # Diameter = equivalent diameter
-            self.diameters.append(m.equivalent_diameter)
+            stats["diameter"].append(m.equivalent_diameter)
             # Area = contour area
-            self.areas.append(m.area)
+            stats["area"].append(m.area)
 
     def get_histogram(
         self, metric: str = "width", range: Optional[Tuple[float, float]] = None
@@ -178,7 +276,7 @@ class DropletHistogram:
         """
         Get real-time statistics matching AInalysis structure.
 
-        Optimized to use vectorized numpy operations for better performance.
+        O(1) whatever the window size: update() keeps the statistics of each metric.
 
         Returns:
             Dictionary of statistics with width, height, diameter, and area metrics
@@ -189,79 +287,15 @@ class DropletHistogram:
             "pixel_ratio": self.pixel_ratio,
         }
 
-        # Helper function to compute statistics efficiently
-        def _compute_stats(data: deque, ratio: float) -> Dict[str, int]:
-            """Compute statistics for a metric using vectorized operations."""
-            if not data:
-                return {"mean": 0, "std": 0, "min": 0, "max": 0, "mode": 0}
-
-            # Convert to numpy array once (more efficient than multiple list() calls)
-            data_array = np.array(data, dtype=np.float32)
-            scaled = data_array * ratio
-
-            return {
-                "mean": int(round(np.mean(scaled))),
-                "std": int(round(np.std(scaled))),
-                "min": int(round(np.min(scaled))),
-                "max": int(round(np.max(scaled))),
-                "mode": int(round(self._get_mode(data))),
-            }
-
-        # Width statistics (major axis) - rounded to integers in um
-        stats["width"] = _compute_stats(self.widths, self.pixel_ratio)
-
-        # Height statistics (minor axis) - rounded to integers in um
-        stats["height"] = _compute_stats(self.heights, self.pixel_ratio)
-
-        # Diameter statistics - rounded to integers in um
-        stats["diameter"] = _compute_stats(self.diameters, self.pixel_ratio)
+        # Width (major axis), height (minor axis) and diameter - rounded to integers in um
+        for metric in ("width", "height", "diameter"):
+            stats[metric] = self._stats[metric].summary(self.pixel_ratio, self.pixel_ratio)
 
-        # Area statistics (note: area uses pixel_ratio²) - rounded to integers
-        area_ratio = self.pixel_ratio**2
-        stats["area"] = _compute_stats(self.areas, area_ratio)
+        # Area statistics (note: area uses pixel_ratio², its mode pixel_ratio as before)
+        stats["area"] = self._stats["area"].summary(self.pixel_ratio**2, self.pixel_ratio)
 
         return stats
 
-    def _get_mode(self, data: deque) -> float:
-        """
-        Calculate mode (most frequent value) from data.
-
-        Optimized using numpy.bincount for better performance on Raspberry Pi.
-
-        Args:
-            data: Deque of values
-
-        Returns:
-            Mode value in physical units
-        """
-        if not data:
-            return 0.0
-
-        # Convert deque to numpy array directly (more efficient than list() then array())
-        # Use float32 for memory efficiency on Raspberry Pi
-        data_array = np.array(data, dtype=np.float32)
-        rounded = np.round(data_array).astype(np.int32)
-
-        # Use numpy.bincount for efficient counting (faster than dict on large datasets)
-        # This is optimized for Raspberry Pi (works on both 32-bit and 64-bit)
-        if rounded.size == 0:
-            return 0.0
-
-        # Handle negative values by shifting (bincount requires non-negative)
-        min_val = int(rounded.min())
-        if min_val < 0:
-            rounded = rounded - min_val
-
-        counts = np.bincount(rounded)
-        if counts.size == 0:
-            return 0.0
-
-        mode_idx = int(np.argmax(counts))
-        mode_value = mode_idx + min_val if min_val < 0 else mode_idx
-
-        # Return mode in physical units (will be rounded in get_statistics)
-        return float(mode_value * self.pixel_ratio)
-
     def to_json(self) -> Dict:
         """
         Serialize to JSON for API.
@@ -313,8 +347,6 @@ class DropletHistogram:
 
     def clear(self) -> None:
         """Clear all stored measurements."""
-        self.widths.clear()
-        self.heights.clear()
-        self.diameters.clear()
-        self.areas.clear()
+        for stats in self._stats.values():
+            stats.clear()
         logger.debug("Histogram cleared")
@@ -0,0 +1,192 @@
+"""
+Multi-process droplet detection pipeline.
+
+Spreads DropletDetector.process_frame() over worker processes, so preprocessing,
+segmentation and measurement run on the other cores of the Pi instead of competing
+with the web server for the GIL.
+
+The producer (the camera thread) copies each frame into a free slot of a ring in
+shared memory and queues its number; a worker runs its own DropletDetector on the
+slot in place and sends back the metrics; the slot is free again once they are
+collected. results() returns them in submission order.
+
+Each worker keeps its own background model and motion tracking state, over the
+frames it is handed: with N workers, every N-th frame on average. Frame difference
+rejection (use_frame_diff) then compares frames further apart than in one process.
+
+Workers are forked, so they inherit the imported modules and the ring mapping.
+"""
+
+import logging
+import multiprocessing
+import queue
+from multiprocessing import shared_memory
+from typing import Any, Dict, List, Optional, Tuple
+
+import numpy as np
+
+from .config import DropletDetectionConfig
+from .detector import DropletDetector
+
+logger = logging.getLogger(__name__)
+
+SLOTS_PER_WORKER = 2  # One being processed, one waiting
+JOIN_TIMEOUT_S = 2.0
+
+
+def _worker(
+    buf: memoryview,
+    slot_size: int,
+    roi: Tuple[int, int, int, int],
+    config: DropletDetectionConfig,
+    radius_offset_px: float,
+    tasks: Any,
+    results: Any,
+) -> None:
+    detector = DropletDetector(roi, config, radius_offset_px=radius_offset_px)
+    while True:
+        task = tasks.get()
+        if task is None:
+            break
+        seq, slot, shape, dtype, frame_id, tag = task
+        frame = np.ndarray(shape, dtype=dtype, buffer=buf, offset=slot * slot_size)
+        timings: Dict[str, float] = {}
+        try:
+            metrics = detector.process_frame(frame, timing_callback=timings.__setitem__, tag=tag)
+        except Exception as e:
+            logger.error(f"Worker error on frame {frame_id}: {e}")
+            metrics = []
+        results.put((seq, slot, frame_id, metrics, timings))
+
+
+class DetectionPipeline:
+    """
+    Worker processes running the detector on frames in a shared-memory ring.
+
+    submit() and results() may be called from different threads, but each from one.
+    """
+
+    def __init__(
+        self,
+        roi: Tuple[int, int, int, int],
+        config: Optional[DropletDetectionConfig] = None,
+        radius_offset_px: float = 0.0,
+        workers: int = 2,
+        slots: Optional[int] = None,
+    ):
+        """
+        Start the workers.
+
+        Args:
+            roi: Region of interest (x, y, width, height); a slot holds an RGB frame of it
+            config: DropletDetectionConfig instance, copied into each worker
+            radius_offset_px: As for DropletDetector
+            workers: Worker processes, at least 1
+            slots: Frames in the ring, default SLOTS_PER_WORKER per worker
+        """
+        self.roi = roi
+        self.config = config if config is not None else DropletDetectionConfig()
+        self.workers = max(1, int(workers))
+        self.slots = slots if slots is not None else SLOTS_PER_WORKER * self.workers
+        self.slot_size = max(1, roi[2] * roi[3] * 3)
+        self.dropped = 0  # Frames submitted with the ring full, or too large for a slot
+
+        self._shm = shared_memory.SharedMemory(create=True, size=self.slots * self.slot_size)
+        self._free = list(range(self.slots))
+        self._next_seq = 0  # Of the next submitted frame
+        self._next_result = 0  # Seq of the next result to return
+        self._early: Dict[int, Tuple[Any, List[Any], Dict[str, float]]] = {}
+
+        context = multiprocessing.get_context("fork")
+        self._tasks = context.Queue()
+        self._results = context.Queue()
+        self._processes = [
+            context.Process(
+                target=_worker,
+                args=(
+                    self._shm.buf,
+                    self.slot_size,
+                    roi,
+                    self.config,
+                    radius_offset_px,
+                    self._tasks,
+                    self._results,
+                ),
+                name=f"DropletWorker{i}",
+                daemon=True,
+            )
+            for i in range(self.workers)
+        ]
+        for process in self._processes:
+            process.start()
+        logger.info(
+            f"Detection pipeline started: {self.workers} workers, {self.slots} slots of "
+            f"{self.slot_size} bytes"
+        )
+
+    def submit(self, frame: np.ndarray, frame_id: Any = None, tag: Any = None) -> bool:
+        """
+        Copy <frame> into the ring for the next free worker.
+
+        Args:
+            frame: ROI frame (RGB or grayscale numpy array)
+            frame_id: Returned with its metrics by results()
+            tag: FrameTag of the frame, passed to DropletDetector.process_frame()
+
+        Returns:
+            False if the frame was dropped: no free slot, or larger than a slot
+        """
+        if not self._free or frame.nbytes > self.slot_size:
+            self.dropped += 1
+            return False
+        slot = self._free.pop()
+        offset = slot * self.slot_size
+        view = np.ndarray(frame.shape, dtype=frame.dtype, buffer=self._shm.buf, offset=offset)
+        view[...] = frame
+        self._tasks.put((self._next_seq, slot, frame.shape, frame.dtype.str, frame_id, tag))
+        self._next_seq += 1
+        return True
+
+    def results(self, timeout: float = 0.0) -> List[Tuple[Any, List[Any], Dict[str, float]]]:
+        """
+        Collect the finished frames, in submission order.
+
+        Args:
+            timeout: Seconds to wait for the first result, 0 not to wait
+
+        Returns:
+            (frame_id, metrics, timings) of each frame ready, timings as passed to the
+            detector's timing_callback
+        """
+        block = timeout > 0
+        while True:
+            try:
+                seq, slot, frame_id, metrics, timings = self._results.get(block, timeout)
+            except queue.Empty:
+                break
+            block = False
+            self._free.append(slot)
+            self._early[seq] = (frame_id, metrics, timings)
+        ready = []
+        while self._next_result in self._early:
+            ready.append(self._early.pop(self._next_result))
+            self._next_result += 1
+        return ready
+
+    def pending(self) -> int:
+        """Frames submitted and not returned by results() yet."""
+        return self._next_seq - self._next_result
+
+    def close(self) -> None:
+        """Stop the workers and free the ring; frames still in flight are discarded."""
+        for _ in self._processes:
+            self._tasks.put(None)
+        for process in self._processes:
+            process.join(JOIN_TIMEOUT_S)
+            if process.is_alive():
+                process.terminate()
+        self._tasks.close()
+        self._results.close()
+        self._shm.close()
+        self._shm.unlink()
+        logger.info("Detection pipeline stopped")
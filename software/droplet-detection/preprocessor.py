@@ -7,14 +7,17 @@ Handles background correction, thresholding, and morphological operations.
 import logging
 import numpy as np
 import cv2
-from typing import Optional, Tuple
-from collections import deque
+from typing import Dict, Optional, Tuple
+from collections import OrderedDict, deque
 
 from .config import DropletDetectionConfig
 from .utils import ensure_grayscale
 
 logger = logging.getLogger(__name__)
 
+POOLED_BUFFERS = ("gray", "blur", "corr", "mask", "morph")
+MAX_POOLED_SIZES = 4  # ROI sizes whose buffers are kept, the oldest dropped
+
 
 class Preprocessor:
     """
@@ -44,6 +47,10 @@ class Preprocessor:
         self._morph_kernel: Optional[np.ndarray] = (
             None  # Cached morphological kernel for performance
         )
+        # Strobe exposure of the frame over the reference one, scales the adaptive offset
+        self.exposure_scale: float = 1.0
+        # (height, width) -> the arrays process() writes into, see _buffers()
+        self._buffer_pool: "OrderedDict[Tuple[int, int], Dict[str, np.ndarray]]" = OrderedDict()
 
     def initialize_background(self, frame: np.ndarray) -> None:
         """
@@ -106,7 +113,8 @@ class Preprocessor:
             frame: Input frame (RGB numpy array)
 
         Returns:
-            Binary mask (uint8, 0 or 255)
+            Binary mask (uint8, 0 or 255). With reuse_buffers it is overwritten by the
+            next call for the same ROI size, so copy it to keep it.
         """
         # Validate frame
         if not isinstance(frame, np.ndarray):
@@ -115,7 +123,8 @@ class Preprocessor:
             raise ValueError(f"Invalid frame shape: {frame.shape}")
 
         # 1. Grayscale conversion
-        gray = ensure_grayscale(frame)
+        buffers = self._buffers(frame.shape[:2])
+        gray = ensure_grayscale(frame, dst=buffers.get("gray"))
 
         # 2. Background correction
         if self.config.background_method == "static":
@@ -123,7 +132,7 @@ class Preprocessor:
                 # Still collecting background frames
                 self.initialize_background(frame)
                 # Return empty mask while initializing
-                return np.zeros_like(gray, dtype=np.uint8)
+                return self._empty(gray.shape, buffers)
 
             # Check if background size matches current frame size
             if self.background is not None and self.background.shape != gray.shape:
@@ -132,32 +141,36 @@ class Preprocessor:
                 )
                 self.reset_background()
                 self.initialize_background(frame)
-                return np.zeros_like(gray, dtype=np.uint8)
+                return self._empty(gray.shape, buffers)
 
             # Static background subtraction
             if self.background is None:
                 # Background not ready yet
-                return np.zeros_like(gray, dtype=np.uint8)
+                return self._empty(gray.shape, buffers)
 
-            gray_corr = cv2.absdiff(gray, self.background)
+            gray_corr = cv2.absdiff(gray, self.background, dst=buffers.get("corr"))
 
         elif self.config.background_method == "highpass":
             # High-pass filtering (subtract blurred version)
-            blur = cv2.GaussianBlur(gray, self.config.gaussian_blur_kernel, 0)
-            gray_corr = cv2.subtract(gray, blur)
-            # Ensure non-negative
-            gray_corr = np.maximum(gray_corr, 0)
+            blur = cv2.GaussianBlur(
+                gray, self.config.gaussian_blur_kernel, 0, dst=buffers.get("blur")
+            )
+            # Saturating for uint8, so never negative
+            gray_corr = cv2.subtract(gray, blur, dst=buffers.get("corr"))
         else:
             # No background correction
             gray_corr = gray
 
         # Optional: Intensity normalization
-        # Clip to [0, 255] range
-        gray_corr = np.clip(gray_corr, 0, 255).astype(np.uint8)
+        # Clip to [0, 255] range (uint8 frames already are)
+        if gray_corr.dtype != np.uint8:
+            gray_corr = np.clip(gray_corr, 0, 255).astype(np.uint8)
 
         # 3. Thresholding
         if self.config.threshold_method == "otsu":
-            _, mask = cv2.threshold(gray_corr, 0, 255, cv2.THRESH_BINARY + cv2.THRESH_OTSU)
+            _, mask = cv2.threshold(
+                gray_corr, 0, 255, cv2.THRESH_BINARY + cv2.THRESH_OTSU, dst=buffers.get("mask")
+            )
         elif self.config.threshold_method == "adaptive":
             mask = cv2.adaptiveThreshold(
                 gray_corr,
@@ -165,7 +178,8 @@ class Preprocessor:
                 cv2.ADAPTIVE_THRESH_MEAN_C,
                 cv2.THRESH_BINARY,
                 self.config.adaptive_block_size,
-                self.config.adaptive_C,
+                self.config.adaptive_C * self.exposure_scale,
+                dst=buffers.get("mask"),
             )
         else:
             raise ValueError(f"Unknown threshold method: {self.config.threshold_method}")
@@ -177,19 +191,47 @@ class Preprocessor:
                 cv2.MORPH_ELLIPSE, self.config.morph_kernel_size
             )
         kernel = self._morph_kernel
+        spare = buffers.get("morph")
 
         if self.config.morph_operation == "open":
-            mask = cv2.morphologyEx(mask, cv2.MORPH_OPEN, kernel)
+            mask = cv2.morphologyEx(mask, cv2.MORPH_OPEN, kernel, dst=spare)
         elif self.config.morph_operation == "close":
-            mask = cv2.morphologyEx(mask, cv2.MORPH_CLOSE, kernel)
+            mask = cv2.morphologyEx(mask, cv2.MORPH_CLOSE, kernel, dst=spare)
+        elif self.config.morph_operation == "both" and self.config.fused_morphology:
+            # Open then close is erode, dilate, dilate, erode: the two dilations run as one
+            # call, and the passes alternate between the two buffers
+            opened = cv2.erode(mask, kernel, dst=spare)
+            mask = cv2.dilate(opened, kernel, dst=buffers.get("mask"), iterations=2)
+            mask = cv2.erode(mask, kernel, dst=spare)
         elif self.config.morph_operation == "both":
-            # Optimized: combine operations when possible
-            mask = cv2.morphologyEx(mask, cv2.MORPH_OPEN, kernel)
-            mask = cv2.morphologyEx(mask, cv2.MORPH_CLOSE, kernel)
+            opened = cv2.morphologyEx(mask, cv2.MORPH_OPEN, kernel, dst=spare)
+            mask = cv2.morphologyEx(opened, cv2.MORPH_CLOSE, kernel, dst=buffers.get("mask"))
         # else: no morphological operation
 
         return mask
 
+    def _buffers(self, shape: Tuple[int, int]) -> Dict[str, np.ndarray]:
+        """
+        The arrays process() writes into for frames of <shape>, kept per ROI size.
+
+        Empty with reuse_buffers off, so that every OpenCV call allocates its output.
+        """
+        if not self.config.reuse_buffers:
+            return {}
+        buffers = self._buffer_pool.get(shape)
+        if buffers is None:
+            if len(self._buffer_pool) >= MAX_POOLED_SIZES:
+                self._buffer_pool.pop(next(iter(self._buffer_pool)))
+            buffers = {name: np.empty(shape, dtype=np.uint8) for name in POOLED_BUFFERS}
+            buffers["empty"] = np.zeros(shape, dtype=np.uint8)
+            self._buffer_pool[shape] = buffers
+        return buffers
+
+    def _empty(self, shape: Tuple[int, int], buffers: Dict[str, np.ndarray]) -> np.ndarray:
+        """An all-zero mask, the pooled one unless reuse_buffers is off."""
+        empty = buffers.get("empty")
+        return empty if empty is not None else np.zeros(shape, dtype=np.uint8)
+
     def reset_background(self) -> None:
         """Reset background model (for re-initialization)."""
         self.background = None
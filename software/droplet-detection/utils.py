@@ -4,22 +4,23 @@ Utility functions for droplet detection module.
 
 import numpy as np
 import cv2
-from typing import Tuple
+from typing import Optional, Tuple
 
 
-def ensure_grayscale(frame: np.ndarray) -> np.ndarray:
+def ensure_grayscale(frame: np.ndarray, dst: Optional[np.ndarray] = None) -> np.ndarray:
     """
     Convert frame to grayscale if needed.
 
     Args:
         frame: Input frame (RGB, BGR, or grayscale)
+        dst: Optional array to convert a colour frame into, of the frame's height and width
 
     Returns:
         Grayscale frame
     """
     if len(frame.shape) == 3:
         # Assume RGB if 3 channels
-        return cv2.cvtColor(frame, cv2.COLOR_RGB2GRAY)
+        return cv2.cvtColor(frame, cv2.COLOR_RGB2GRAY, dst=dst)
     elif len(frame.shape) == 2:
         return frame
     else:
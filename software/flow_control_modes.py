@@ -18,15 +18,18 @@ FLOW_CTRL_MODE_STR = ["Off", "Set Pressure", "Flow Closed Loop"]
 # Firmware control modes (from the pressure/flow PIC firmware):
 #   0 = Off
 #   1 = Pressure Open Loop
-#   2 = Pressure Closed Loop (deprecated / hidden in UI)
+#   2 = Pressure Closed Loop (hidden in UI)
 #   3 = Flow Closed Loop
+#   4 = Flow Closed Loop, cascaded onto the pressure loop
 #
-# Note: Firmware mode 2 is intentionally mapped to UI mode 0 to hide it.
+# Note: Firmware mode 2 is intentionally mapped to UI mode 0 to hide it. Mode 4 shows as
+# Flow Closed Loop; the UI only selects mode 3.
 CONTROL_MODE_FIRMWARE_TO_UI = {
     0: 0,  # Off -> Off
     1: 1,  # Pressure Open Loop -> Set Pressure
     2: 0,  # Pressure Closed Loop (hidden) -> Off
     3: 2,  # Flow Closed Loop -> Flow Closed Loop
+    4: 2,  # Flow Cascade -> Flow Closed Loop
 }
 
 CONTROL_MODE_UI_TO_FIRMWARE = {
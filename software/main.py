@@ -26,6 +26,7 @@ Usage:
 
 import os
 import logging
+import time
 from threading import Event
 from flask import Flask
 from flask_socketio import SocketIO
@@ -69,12 +70,17 @@ from drivers.spi_handler import (  # noqa: E402
     PORT_HEATER4,
     PORT_FLOW,
 )
+from drivers.spi_scheduler import SpiScheduler  # noqa: E402
 from controllers.heater_web import heater_web  # noqa: E402
 from controllers.camera import Camera  # noqa: E402
 from controllers.flow_web import FlowWeb  # noqa: E402
+from controllers.telemetry_recorder import TelemetryRecorder  # noqa: E402
+from controllers.history_pyramid import HistoryPyramid  # noqa: E402
+from controllers.state_table import StateTable  # noqa: E402
 
 # Import web controllers and routes (paths already bootstrapped)
 from camera_controller import CameraController  # noqa: E402
+from push_hub import PushHub  # noqa: E402
 from flow_controller import FlowController  # noqa: E402
 from heater_controller import HeaterController  # noqa: E402
 from view_model import ViewModel  # noqa: E402
@@ -183,6 +189,34 @@ heaters = [heater1, heater2, heater3, heater4]
 
 flow = FlowWeb(PORT_FLOW)
 
+# Binary recording of the module history and telemetry, one run directory per start
+recorder = None
+record_dir = os.getenv("RIO_RECORD_DIR", "").strip()
+if record_dir:
+    recorder = TelemetryRecorder(os.path.join(record_dir, time.strftime("%Y%m%d-%H%M%S")))
+    flow.start_recording(recorder, int(os.getenv("RIO_RECORD_TELEMETRY_CYCLES", "0")))
+    for heater in heaters:
+        heater.start_recording(recorder)
+    logger.info(f"Recording module history to {recorder.directory}")
+
+# Min/max/mean history at several resolutions for the UI charts (/api/history)
+history = HistoryPyramid()
+flow.charts = history
+for heater in heaters:
+    heater.charts = history
+
+# Latest module states in shared memory, published by the background update, for the
+# page, /api/state and other processes, none of which then reach the SPI bus
+try:
+    state_table = StateTable(create=True)
+except OSError as e:
+    logger.warning(f"No shared memory state table: {e}")
+    state_table = None
+
+# One worker for all SPI traffic from the web controllers and the background update
+spi_scheduler = SpiScheduler()
+spi_scheduler.start()
+
 # Camera needs exit_event and socketio
 logger.info("Step 5: Initializing camera controller...")
 try:
@@ -212,6 +246,13 @@ if droplet_analysis_enabled:
         # Set droplet controller reference in camera for frame feeding
         cam.droplet_controller = droplet_controller
         logger.info("Droplet detector controller initialized")
+
+        from controllers.droplet_size_control import DropletSizeController
+
+        # Off until enabled with a target through /api/droplet/size_control
+        droplet_controller.size_control = DropletSizeController(
+            droplet_controller, flow, scheduler=spi_scheduler
+        )
     except ImportError as e:
         logger.warning(f"Droplet detection not available (missing dependencies): {e}")
     except Exception as e:
@@ -222,9 +263,11 @@ else:
 # Initialize controllers
 logger.info("Step 6: Initializing web controllers...")
 try:
+    # One coalesced, delta-only push of the UI state for all browsers
+    push_hub = PushHub(socketio)
     camera_controller = CameraController(cam, socketio)
-    flow_controller = FlowController(flow, socketio)
-    heater_controller = HeaterController(heaters, socketio)
+    flow_controller = FlowController(flow, socketio, spi_scheduler, push_hub)
+    heater_controller = HeaterController(heaters, socketio, spi_scheduler, push_hub)
     logger.info("Step 6: Web controllers initialized")
 except Exception as e:
     logger.error(f"Step 6: Web controller initialization failed: {e}")
@@ -238,7 +281,7 @@ if droplet_controller is not None:
     try:
         from droplet_web_controller import DropletWebController
 
-        droplet_web_controller = DropletWebController(droplet_controller, socketio)
+        droplet_web_controller = DropletWebController(droplet_controller, socketio, push_hub)
         logger.info("Droplet web controller initialized")
     except Exception as e:
         logger.warning(f"Failed to initialize droplet web controller: {e}")
@@ -253,7 +296,18 @@ view_model = ViewModel(
 # Register Flask routes and WebSocket handlers
 logger.info("Step 7: Registering routes and WebSocket handlers...")
 try:
-    register_routes(app, socketio, view_model, heaters, flow, cam, debug_data, droplet_controller)
+    register_routes(
+        app,
+        socketio,
+        view_model,
+        heaters,
+        flow,
+        cam,
+        debug_data,
+        droplet_controller,
+        history,
+        state_table,
+    )
     logger.info("Step 7: Routes and handlers registered")
 except Exception as e:
     logger.error(f"Step 7: Route registration failed: {e}")
@@ -288,9 +342,19 @@ if __name__ == "__main__":
 
     # Start background update thread
     background_task = create_background_update_task(
-        socketio, view_model, heaters, flow, cam, debug_data, droplet_web_controller
+        socketio,
+        view_model,
+        heaters,
+        flow,
+        cam,
+        debug_data,
+        droplet_web_controller,
+        spi_scheduler,
+        push_hub,
+        state_table,
     )
     socketio.start_background_task(background_task)
+    push_hub.start()
 
     try:
         socketio.run(
@@ -304,4 +368,8 @@ if __name__ == "__main__":
         logger.info("Server shutting down...")
         exit_event.set()
     finally:
+        if recorder is not None:
+            recorder.close()
+        if state_table is not None:
+            state_table.close()
         logger.info("Server stopped")
@@ -8,6 +8,7 @@ Modules:
     camera_controller: Camera and strobe control handlers
     flow_controller: Flow control handlers
     heater_controller: Heater control handlers
+    push_hub: Coalesced, delta-only state pushes
     view_model: View model formatters for template data
 """
 
@@ -15,6 +16,7 @@ Modules:
 from .camera_controller import CameraController
 from .flow_controller import FlowController
 from .heater_controller import HeaterController
+from .push_hub import PushHub
 from .view_model import ViewModel
 
-__all__ = ["CameraController", "FlowController", "HeaterController", "ViewModel"]
+__all__ = ["CameraController", "FlowController", "HeaterController", "PushHub", "ViewModel"]
@@ -10,7 +10,7 @@ Classes:
 
 import logging
 import time
-from typing import Dict, Any, Callable
+from typing import Dict, Any, Callable, Optional
 from flask_socketio import SocketIO
 
 from controllers.droplet_detector_controller import DropletDetectorController
@@ -28,16 +28,24 @@ class DropletWebController:
     from view and model layers.
     """
 
-    def __init__(self, droplet_controller: DropletDetectorController, socketio: SocketIO):
+    def __init__(
+        self,
+        droplet_controller: DropletDetectorController,
+        socketio: SocketIO,
+        push: Optional[Any] = None,
+    ):
         """
         Initialize droplet web controller.
 
         Args:
             droplet_controller: DropletDetectorController instance
             socketio: Flask-SocketIO instance for WebSocket communication
+            push: PushHub to publish the status, histogram, statistics and performance
+                through, or None to emit them
         """
         self.droplet_controller = droplet_controller
         self.socketio = socketio
+        self.push = push
         self.last_emit_time: Dict[str, float] = {}  # Track last emit time for rate limiting
         self.emit_intervals = {
             "histogram": 2.0,  # 0.5 Hz (once every 2 seconds)
@@ -187,13 +195,20 @@ class DropletWebController:
             "droplet_count_total": self.droplet_controller.droplet_count_total,
             "processing_rate_hz": getattr(self.droplet_controller, "processing_rate_hz", 0.0),
         }
-        self.socketio.emit("droplet:status", status)
+        self._publish("droplet:status", status)
 
         # Also force emit histogram and statistics when status is requested
         # Always emit (even if not running) so UI shows current state
         self.emit_histogram(force=True)
         self.emit_statistics(force=True)
 
+    def _publish(self, event: str, data: Any) -> None:
+        """State events go through the push hub if there is one; errors are emitted at once."""
+        if self.push is not None:
+            self.push.publish(event, data)
+        else:
+            self.socketio.emit(event, data)
+
     def emit_histogram(self, force: bool = False) -> None:
         """
         Emit histogram data (with rate limiting).
@@ -214,7 +229,7 @@ class DropletWebController:
                     hasattr(self.droplet_controller, "running") and self.droplet_controller.running
                 ):
                     if histogram_data:
-                        self.socketio.emit("droplet:histogram", histogram_data)
+                        self._publish("droplet:histogram", histogram_data)
                         self.last_emit_time["histogram"] = now
                         # Log once per histogram refresh (every ~2 seconds)
                         count = histogram_data.get("count", 0)
@@ -246,7 +261,7 @@ class DropletWebController:
                     hasattr(self.droplet_controller, "running") and self.droplet_controller.running
                 ):
                     if stats:
-                        self.socketio.emit("droplet:statistics", stats)
+                        self._publish("droplet:statistics", stats)
                         self.last_emit_time["statistics"] = now
                         # Don't log statistics separately - already logged with histogram
             except Exception as e:
@@ -266,7 +281,7 @@ class DropletWebController:
         if force or (now - last_emit) >= interval:
             try:
                 perf = self.droplet_controller.get_performance_metrics()
-                self.socketio.emit("droplet:performance", perf)
+                self._publish("droplet:performance", perf)
                 self.last_emit_time["performance"] = now
             except Exception as e:
                 logger.error(f"Error emitting performance: {e}")
@@ -9,10 +9,12 @@ Classes:
 """
 
 import logging
-from typing import Dict, Any
+from functools import partial
+from typing import Dict, Any, Optional
 from flask_socketio import SocketIO
 
 from controllers.flow_web import FlowWeb
+from drivers.spi_scheduler import PRIORITY_CONTROL, PRIORITY_UI, SpiScheduler
 from view_model import ViewModel
 from config import CONTROL_MODE_UI_TO_FIRMWARE
 
@@ -28,16 +30,27 @@ class FlowController:
     Keeps controller logic separate from view and model.
     """
 
-    def __init__(self, flow: FlowWeb, socketio: SocketIO):
+    def __init__(
+        self,
+        flow: FlowWeb,
+        socketio: SocketIO,
+        scheduler: Optional[SpiScheduler] = None,
+        push: Optional[Any] = None,
+    ):
         """
         Initialize flow controller.
 
         Args:
             flow: FlowWeb model instance
             socketio: Flask-SocketIO instance for WebSocket communication
+            scheduler: SPI scheduler to run commands on ahead of status polling,
+                or None to run them in the calling thread
+            push: PushHub to publish the flow state through, or None to emit it
         """
         self.flow = flow
         self.socketio = socketio
+        self.scheduler = scheduler
+        self.push = push
         self.view_model = ViewModel()
         self._register_handlers()
 
@@ -64,22 +77,20 @@ class FlowController:
                 logger.error(f"Invalid controller index: {index}")
                 return
 
-            valid = False
-
             if cmd == "pressure_mbar_target":
                 pressure_mbar_target = params.get("pressure_mbar_target", 0.0)
-                valid = self.flow.set_pressure(index, pressure_mbar_target)
+                action = partial(self.flow.set_pressure, index, pressure_mbar_target)
                 logger.debug(f"Set pressure for channel {index}: {pressure_mbar_target} mbar")
 
             elif cmd == "flow_ul_hr_target":
                 flow_ul_hr_target = params.get("flow_ul_hr_target", 0.0)
-                valid = self.flow.set_flow(index, flow_ul_hr_target)
+                action = partial(self.flow.set_flow, index, flow_ul_hr_target)
                 logger.debug(f"Set flow for channel {index}: {flow_ul_hr_target} ul/hr")
 
             elif cmd == "control_mode":
                 ui_control_mode = int(params.get("control_mode", 0))
                 firmware_mode = CONTROL_MODE_UI_TO_FIRMWARE.get(ui_control_mode, 0)
-                valid = self.flow.set_control_mode(index, firmware_mode)
+                action = partial(self.flow.set_control_mode, index, firmware_mode)
                 logger.debug(
                     f"Set control mode for channel {index}: UI={ui_control_mode}, Firmware={firmware_mode}"
                 )
@@ -88,20 +99,51 @@ class FlowController:
                 pi_p = int(params.get("p", 0))
                 pi_i = int(params.get("i", 0))
                 pi_consts = [pi_p, pi_i]
-                valid = self.flow.set_flow_pi_consts(index, pi_consts)
+                action = partial(self.flow.set_flow_pi_consts, index, pi_consts)
                 logger.debug(f"Set PI constants for channel {index}: P={pi_p}, I={pi_i}")
             else:
                 logger.warning(f"Unknown flow command: {cmd}")
                 return
 
-            if not valid:
-                logger.warning(f"Flow command '{cmd}' failed for channel {index}")
-
-            # Update model and emit formatted data
-            self.flow.update()
-            flows_data = self.view_model.format_flow_data(self.flow)
-            self.socketio.emit("flows", flows_data)
+            self._apply(action, cmd, index)
 
         except (KeyError, ValueError, TypeError, AttributeError) as e:
             logger.error(f"Error handling flow command: {e}")
             logger.debug(f"Command data: {data}")
+
+    def _apply(self, action, cmd: str, index: int) -> None:
+        """Run a command, then update the model and emit; on the scheduler if there is one."""
+        if self.scheduler is None:
+            self._check(action(), cmd, index)
+            self.flow.update()
+            self._emit()
+            return
+
+        def done(future) -> None:
+            if future.exception() is not None:
+                logger.error(f"Error handling flow command: {future.exception()}")
+            else:
+                self._check(future.result(), cmd, index)
+            # Shares the refresh with the background update if that is queued too
+            refresh = self.scheduler.call(
+                self.flow.update,
+                priority=PRIORITY_UI,
+                key=("update", id(self.flow)),
+                device=self.flow.flow,
+            )
+            refresh.add_done_callback(lambda _: self._emit())
+
+        future = self.scheduler.call(action, priority=PRIORITY_CONTROL, device=self.flow.flow)
+        future.add_done_callback(done)
+
+    @staticmethod
+    def _check(valid: bool, cmd: str, index: int) -> None:
+        if not valid:
+            logger.warning(f"Flow command '{cmd}' failed for channel {index}")
+
+    def _emit(self) -> None:
+        flows_data = self.view_model.format_flow_data(self.flow)
+        if self.push is not None:
+            self.push.publish("flows", flows_data)
+        else:
+            self.socketio.emit("flows", flows_data)
@@ -9,10 +9,13 @@ Classes:
 """
 
 import logging
-from typing import Dict, Any, List
+from functools import partial
+from typing import Dict, Any, List, Optional
 from flask_socketio import SocketIO
 from view_model import ViewModel
 
+from drivers.spi_scheduler import PRIORITY_CONTROL, PRIORITY_UI, SpiScheduler
+
 # Configure logging
 logger = logging.getLogger(__name__)
 
@@ -25,16 +28,27 @@ class HeaterController:
     Keeps controller logic separate from view and model.
     """
 
-    def __init__(self, heaters: List[Any], socketio: SocketIO):
+    def __init__(
+        self,
+        heaters: List[Any],
+        socketio: SocketIO,
+        scheduler: Optional[SpiScheduler] = None,
+        push: Optional[Any] = None,
+    ):
         """
         Initialize heater controller.
 
         Args:
             heaters: List of heater_web model instances
             socketio: Flask-SocketIO instance for WebSocket communication
+            scheduler: SPI scheduler to run commands on ahead of status polling,
+                or None to run them in the calling thread
+            push: PushHub to publish the heater state through, or None to emit it
         """
         self.heaters = heaters
         self.socketio = socketio
+        self.scheduler = scheduler
+        self.push = push
         self.view_model = ViewModel()
         self._register_handlers()
 
@@ -62,48 +76,75 @@ class HeaterController:
                 return
 
             heater = self.heaters[index]
-            valid = False
 
             if cmd == "temp_c_target":
                 temp_c_target = params.get("temp_c_target", 0.0)
-                valid = heater.set_temp(temp_c_target)
+                action = partial(heater.set_temp, temp_c_target)
                 logger.debug(f"Set temperature for heater {index}: {temp_c_target}°C")
 
             elif cmd == "pid_enable":
                 enabled = params.get("on", False)
-                valid = heater.set_pid_running(enabled)
+                action = partial(heater.set_pid_running, enabled)
                 logger.debug(f"Set PID enable for heater {index}: {enabled}")
 
             elif cmd == "power_limit_pc":
                 power_limit_pc = params.get("power_limit_pc", 0)
-                valid = heater.set_heat_power_limit_pc(power_limit_pc)
+                action = partial(heater.set_heat_power_limit_pc, power_limit_pc)
                 logger.debug(f"Set power limit for heater {index}: {power_limit_pc}%")
 
             elif cmd == "autotune":
                 enabled = params.get("on", False)
                 temp = params.get("temp", 50.0)
                 heater.autotune_target_temp = temp
-                valid = heater.set_autotune(enabled)
+                action = partial(heater.set_autotune, enabled)
                 logger.debug(f"Set autotune for heater {index}: enabled={enabled}, temp={temp}°C")
 
             elif cmd == "stir":
                 enabled = params.get("on", False)
                 speed = params.get("speed", 0)
                 heater.stir_target_speed = speed
-                valid = heater.set_stir_running(enabled)
+                action = partial(heater.set_stir_running, enabled)
                 logger.debug(f"Set stir for heater {index}: enabled={enabled}, speed={speed}")
             else:
                 logger.warning(f"Unknown heater command: {cmd}")
                 return
 
-            if not valid:
-                logger.warning(f"Heater command '{cmd}' failed for heater {index}")
-
-            # Update model and emit formatted data
-            heater.update()
-            heaters_data = self.view_model.format_heater_data(self.heaters)
-            self.socketio.emit("heaters", heaters_data)
+            self._apply(heater, action, cmd, index)
 
         except (KeyError, ValueError, TypeError, AttributeError, IndexError) as e:
             logger.error(f"Error handling heater command: {e}")
             logger.debug(f"Command data: {data}")
+
+    def _apply(self, heater: Any, action, cmd: str, index: int) -> None:
+        """Run a command, then update the model and emit; on the scheduler if there is one."""
+        if self.scheduler is None:
+            self._check(action(), cmd, index)
+            heater.update()
+            self._emit()
+            return
+
+        def done(future) -> None:
+            if future.exception() is not None:
+                logger.error(f"Error handling heater command: {future.exception()}")
+            else:
+                self._check(future.result(), cmd, index)
+            # Shares the refresh with the background update if that is queued too
+            refresh = self.scheduler.call(
+                heater.update, priority=PRIORITY_UI, key=("update", id(heater)), device=heater.holder
+            )
+            refresh.add_done_callback(lambda _: self._emit())
+
+        future = self.scheduler.call(action, priority=PRIORITY_CONTROL, device=heater.holder)
+        future.add_done_callback(done)
+
+    @staticmethod
+    def _check(valid: bool, cmd: str, index: int) -> None:
+        if not valid:
+            logger.warning(f"Heater command '{cmd}' failed for heater {index}")
+
+    def _emit(self) -> None:
+        heaters_data = self.view_model.format_heater_data(self.heaters)
+        if self.push is not None:
+            self.push.publish("heaters", heaters_data)
+        else:
+            self.socketio.emit("heaters", heaters_data)
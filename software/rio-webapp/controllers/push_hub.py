@@ -0,0 +1,143 @@
+"""
+Coalesced, delta-only Socket.IO pushes to the browser UI.
+
+The web controllers publish() the whole current state of an event, as they used to emit
+it. The hub keeps the latest state of each event and, at most PUSH_RATE_HZ times a second,
+broadcasts one "push" message with what changed since the message before, for all events
+at once:
+
+    {"seq": n, "events": {event: [[path, value], ...]}}
+
+path is the list of keys and list indices down to a changed value, an empty one replaces
+the event's whole state. A client keeps the state of each event, applies the changes in
+seq order and calls its handlers for the event with the whole state
+(static/push_client.js). A client that connects, or misses a seq, sends "push:sync" and
+gets {"seq": n, "full": true, "events": {event: state}} to itself.
+
+States published between two pushes are coalesced into the last one, and one broadcast
+per push is encoded once for all clients, so the cost does not grow with the number of
+browsers watching the rig.
+
+Classes:
+    PushHub: Latest state per event, and the pushes of its changes
+"""
+
+import logging
+from threading import Lock
+from typing import Any, Dict, List
+
+from config import PUSH_RATE_HZ
+
+# Configure logging
+logger = logging.getLogger(__name__)
+
+PUSH_EVENT = "push"
+SYNC_EVENT = "push:sync"
+
+
+def state_changes(old: Any, new: Any, path: List[Any], changes: List[list]) -> List[list]:
+    """
+    Append [path, value] for each value of <new> that differs from <old> to <changes>.
+    Dicts with the same keys and lists of the same length are compared member by member,
+    anything else is replaced whole.
+    """
+    if isinstance(old, dict) and isinstance(new, dict) and old.keys() == new.keys():
+        for key, value in new.items():
+            state_changes(old[key], value, path + [key], changes)
+    elif isinstance(old, list) and isinstance(new, list) and len(old) == len(new):
+        for index, value in enumerate(new):
+            state_changes(old[index], value, path + [index], changes)
+    elif type(old) is not type(new) or old != new:
+        changes.append([path, new])
+    return changes
+
+
+class PushHub:
+    """
+    Latest state per event, pushed as changes to all clients at a fixed rate.
+
+    Attributes:
+        seq: Sequence number of the last push
+        stats: published (states given to publish()), pushes (broadcasts), changes
+            (values sent), syncs (full states sent to one client)
+    """
+
+    def __init__(self, socketio, rate_hz: float = PUSH_RATE_HZ):
+        """
+        Args:
+            socketio: Flask-SocketIO instance
+            rate_hz: Pushes per second at most, 0 to push each publish() at once
+        """
+        self.socketio = socketio
+        self.interval_s = 1.0 / rate_hz if rate_hz > 0 else 0.0
+        self.seq = 0
+        self.stats = {"published": 0, "pushes": 0, "changes": 0, "syncs": 0}
+        self._pending: Dict[str, Any] = {}  # event -> latest state, not pushed yet
+        self._sent: Dict[str, Any] = {}  # event -> state as clients have it
+        self._lock = Lock()
+        self._register_handlers()
+
+    def _register_handlers(self) -> None:
+        """Register WebSocket event handlers."""
+
+        @self.socketio.on(SYNC_EVENT)
+        def on_sync(*_) -> None:
+            from flask import request
+
+            self.sync(request.sid)
+
+    def start(self) -> None:
+        """Start pushing at the rate, from a Socket.IO background task."""
+        if self.interval_s:
+            self.socketio.start_background_task(self._run)
+
+    def _run(self) -> None:
+        while True:
+            self.socketio.sleep(self.interval_s)
+            try:
+                self.flush()
+            except Exception as e:
+                logger.error(f"Error pushing updates: {e}")
+
+    def publish(self, event: str, data: Any) -> None:
+        """
+        Set the state of <event>, replacing one not pushed yet. The hub keeps <data>, so it
+        must not be changed afterwards; the view model builds a new one each time.
+        """
+        with self._lock:
+            self._pending[event] = data
+            self.stats["published"] += 1
+        if not self.interval_s:
+            self.flush()
+
+    def flush(self) -> bool:
+        """Push the changes of the states published since the last push, if any."""
+        with self._lock:
+            if not self._pending:
+                return False
+            events = {}
+            for event, data in self._pending.items():
+                if event in self._sent:
+                    changes = state_changes(self._sent[event], data, [], [])
+                else:
+                    changes = [[[], data]]
+                if changes:
+                    events[event] = changes
+                    self._sent[event] = data
+            self._pending = {}
+            if not events:
+                return False
+            self.seq += 1
+            self.stats["pushes"] += 1
+            self.stats["changes"] += sum(len(changes) for changes in events.values())
+            # Under the lock, so the pushes go out in seq order
+            self.socketio.emit(PUSH_EVENT, {"seq": self.seq, "events": events})
+        return True
+
+    def sync(self, sid: str) -> None:
+        """Send the whole state of every event to client <sid>."""
+        self.flush()
+        with self._lock:
+            message = {"seq": self.seq, "full": True, "events": dict(self._sent)}
+            self.stats["syncs"] += 1
+            self.socketio.emit(PUSH_EVENT, message, to=sid)
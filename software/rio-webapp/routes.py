@@ -7,6 +7,9 @@ separate from application initialization and business logic.
 Routes:
     /: Main page with device status
     /video: MJPEG video stream
+    /api/history/signals: Names of the charted signals
+    /api/history: Min/max/mean buckets of one signal over a time window
+    /api/state: Latest published device states, from the shared memory state table
 """
 
 import time
@@ -27,6 +30,8 @@ def register_routes(
     cam,
     debug_data: dict,
     droplet_controller: Optional[Any] = None,
+    history: Optional[Any] = None,
+    state: Optional[Any] = None,
 ) -> None:
     """
     Register all Flask routes and WebSocket handlers.
@@ -40,11 +45,16 @@ def register_routes(
         cam: Camera device controller
         debug_data: Dictionary for debug information (mutated)
         droplet_controller: Optional DropletDetectorController instance
+        history: Optional HistoryPyramid of the charted signals
+        state: Optional StateTable the background update publishes to, read by the page
+            instead of the device controllers
     """
     # Pass droplet_controller availability to template
     app.jinja_env.globals["droplet_analysis_enabled"] = droplet_controller is not None
 
-    _register_http_routes(app, view_model, heaters, flow, cam, debug_data, droplet_controller)
+    _register_http_routes(
+        app, view_model, heaters, flow, cam, debug_data, droplet_controller, history, state
+    )
     _register_websocket_handlers(socketio)
 
 
@@ -118,12 +128,26 @@ def _register_droplet_performance_route(app: Flask, droplet_controller: Any) ->
             return _handle_route_error(e, "droplet_performance")
 
 
+def _register_droplet_latency_route(app: Flask, droplet_controller: Any) -> None:
+    """Register droplet latency route."""
+    from flask import jsonify
+
+    @app.route("/api/droplet/latency", methods=["GET"])
+    def droplet_latency():
+        """Get trigger to result/action latency percentiles."""
+        try:
+            return jsonify(droplet_controller.get_latency_metrics())
+        except Exception as e:
+            return _handle_route_error(e, "droplet_latency")
+
+
 def _register_droplet_status_routes(app: Flask, droplet_controller: Any) -> None:
     """Register all droplet status API routes."""
     _register_droplet_status_route(app, droplet_controller)
     _register_droplet_histogram_route(app, droplet_controller)
     _register_droplet_statistics_route(app, droplet_controller)
     _register_droplet_performance_route(app, droplet_controller)
+    _register_droplet_latency_route(app, droplet_controller)
 
 
 def _register_droplet_control_routes(app: Flask, droplet_controller: Any) -> None:
@@ -246,12 +270,101 @@ def _register_droplet_export_route(app: Flask, droplet_controller: Any) -> None:
             return _handle_route_error(e, "droplet_export")
 
 
+def _register_droplet_size_control_route(app: Flask, size_control: Any) -> None:
+    """Register the closed-loop droplet size control route."""
+    from flask import jsonify, request
+
+    @app.route("/api/droplet/size_control", methods=["GET", "POST"])
+    def droplet_size_control():
+        """Get the size control state, or enable it with a target diameter / disable it."""
+        try:
+            if request.method == "GET":
+                return jsonify(size_control.get_status())
+            data = request.get_json()
+            if not data or "enabled" not in data:
+                return jsonify({"error": "enabled not provided"}), 400
+            if not data["enabled"]:
+                size_control.disable()
+            elif not size_control.enable(float(data.get("target_diameter_um", 0))):
+                return (
+                    jsonify(
+                        {
+                            "success": False,
+                            "message": "Failed to enable. Check the target and that both "
+                            "channels run flow closed loop.",
+                        }
+                    ),
+                    400,
+                )
+            return jsonify({"success": True, **size_control.get_status()})
+        except Exception as e:
+            return _handle_route_error(e, "droplet_size_control")
+
+
 def _register_droplet_api_routes(app: Flask, droplet_controller: Any) -> None:
     """Register all droplet detection API routes."""
     _register_droplet_status_routes(app, droplet_controller)
     _register_droplet_control_routes(app, droplet_controller)
     _register_droplet_config_routes(app, droplet_controller)
     _register_droplet_export_route(app, droplet_controller)
+    if getattr(droplet_controller, "size_control", None) is not None:
+        _register_droplet_size_control_route(app, droplet_controller.size_control)
+
+
+def _register_history_routes(app: Flask, history: Any) -> None:
+    """Register the chart history routes."""
+    from flask import jsonify, request
+
+    @app.route("/api/history/signals", methods=["GET"])
+    def history_signals():
+        """Names of the signals with history."""
+        try:
+            return jsonify({"signals": history.signals()})
+        except Exception as e:
+            return _handle_route_error(e, "history_signals")
+
+    @app.route("/api/history", methods=["GET"])
+    def history_query():
+        """
+        Buckets of ?signal= from ?start= to ?end= (host time s, default all kept and now),
+        ?points= of them at most (default 500).
+        """
+        try:
+            signal = request.args.get("signal", "")
+            args = request.args
+            try:
+                start = float(args["start"]) if "start" in args else None
+                end = float(args["end"]) if "end" in args else None
+                points = int(args.get("points", 500))
+            except ValueError:
+                return jsonify({"error": "start, end and points must be numbers"}), 400
+            if start is not None and end is not None and end <= start:
+                return jsonify({"error": "end must be after start"}), 400
+            result = history.query(signal, start, end, points)
+            if result is None:
+                return jsonify({"error": f"No history of signal '{signal}'"}), 404
+            return jsonify(result)
+        except Exception as e:
+            return _handle_route_error(e, "history_query")
+
+
+def _register_state_route(app: Flask, state: Any) -> None:
+    """Register the device state route."""
+    from flask import jsonify
+
+    @app.route("/api/state", methods=["GET"])
+    def device_state():
+        """Latest state of every module, with its seq and publish time; no SPI traffic."""
+        try:
+            return jsonify(state.snapshot())
+        except Exception as e:
+            return _handle_route_error(e, "device_state")
+
+
+def _published(state: Optional[Any], key: str, format_live):
+    """The state of <key> in the state table, else format_live() from the controllers."""
+    found = state.read(key) if state is not None else None
+    return found[2] if found is not None else format_live()
 
 
 def _register_http_routes(
@@ -262,6 +375,8 @@ def _register_http_routes(
     cam,
     debug_data: dict,
     droplet_controller: Optional[Any] = None,
+    history: Optional[Any] = None,
+    state: Optional[Any] = None,
 ) -> None:
     """Register HTTP routes."""
 
@@ -275,11 +390,13 @@ def _register_http_routes(
         try:
             debug_data["update_count"] += 1
 
-            # Format data for template using view model
-            heaters_data = view_model.format_heater_data(heaters)
-            flows_data = view_model.format_flow_data(flow)
+            # Module states as last published, formatted by the view model
+            heaters_data = _published(
+                state, "heaters", lambda: view_model.format_heater_data(heaters)
+            )
+            flows_data = _published(state, "flows", lambda: view_model.format_flow_data(flow))
             camera_data = view_model.format_camera_data(cam)
-            strobe_data = view_model.format_strobe_data(cam)
+            strobe_data = _published(state, "strobe", lambda: view_model.format_strobe_data(cam))
             debug_formatted = view_model.format_debug_data(debug_data["update_count"])
 
             # Determine if flow and heater tabs should be shown
@@ -380,6 +497,12 @@ def _register_http_routes(
     if droplet_controller is not None:
         _register_droplet_api_routes(app, droplet_controller)
 
+    if history is not None:
+        _register_history_routes(app, history)
+
+    if state is not None:
+        _register_state_route(app, state)
+
 
 def _register_websocket_handlers(socketio: SocketIO) -> None:
     """Register WebSocket event handlers."""
@@ -403,6 +526,9 @@ def create_background_update_task(
     cam,
     debug_data: dict,
     droplet_web_controller: Optional[Any] = None,
+    scheduler: Optional[Any] = None,
+    push: Optional[Any] = None,
+    state: Optional[Any] = None,
 ):
     """
     Create and return a background update task function.
@@ -417,6 +543,11 @@ def create_background_update_task(
         flow: Flow device controller
         cam: Camera device controller
         debug_data: Dictionary for debug information (mutated)
+        scheduler: drivers.spi_scheduler.SpiScheduler to run the updates on, behind
+            queued commands, or None to run them in this thread
+        push: PushHub to publish the updates through, coalesced and delta only, or None
+            to emit them whole
+        state: StateTable to also publish the module states to, or None
 
     Returns:
         Function that can be used as a background task
@@ -426,33 +557,61 @@ def create_background_update_task(
         """
         Background thread loop for periodic data updates.
 
-        Updates device data and emits to WebSocket clients at regular intervals.
+        Polls each heater and the flow board when its AdaptivePoller says it is due
+        (every POLL_FAST_S after a command, backing off to POLL_SLOW_S once settled),
+        and updates the camera, strobe and debug data every BACKGROUND_UPDATE_INTERVAL_S.
         Uses ViewModel to format data for clients.
         """
+        from config import BACKGROUND_UPDATE_INTERVAL_S, POLL_FAST_S
+        from drivers.spi_handler import clock
+
+        next_ui_s = 0.0
         while True:
             try:
-                time.sleep(1.0)
-                debug_data["update_count"] += 1
-
-                # Update hardware device controllers
-                cam.update_strobe_data()
-                for heater in heaters:
-                    heater.update()
-                flow.update()
-
-                # Format data for clients
-                heaters_data = view_model.format_heater_data(heaters)
-                flows_data = view_model.format_flow_data(flow)
+                time.sleep(POLL_FAST_S)
+                now = clock.monotonic()
+                modules = [m for m in [*heaters, flow] if m.poller.due(now)]
+                ui_due = now >= next_ui_s
+                if not modules and not ui_due:
+                    continue
+
+                # Update hardware device controllers, with the SPI device each one polls
+                updates = [
+                    (module.update, flow.flow if module is flow else module.holder)
+                    for module in modules
+                ]
+                if ui_due:
+                    next_ui_s = now + BACKGROUND_UPDATE_INTERVAL_S
+                    debug_data["update_count"] += 1
+                    updates.insert(0, (cam.update_strobe_data, None))
+                if scheduler is None:
+                    for update, _ in updates:
+                        update()
+                else:
+                    _scheduled_update(scheduler, updates)
+
+                # Format data for clients, and emit updates to all connected clients
+                emit = push.publish if push is not None else socketio.emit
+                if any(module is not flow for module in modules):
+                    heaters_data = view_model.format_heater_data(heaters)
+                    emit("heaters", heaters_data)
+                    if state is not None:
+                        state.publish("heaters", heaters_data)
+                if flow in modules:
+                    flows_data = view_model.format_flow_data(flow)
+                    emit("flows", flows_data)
+                    if state is not None:
+                        state.publish("flows", flows_data)
+                if not ui_due:
+                    continue
                 camera_data = view_model.format_camera_data(cam)
                 strobe_data = view_model.format_strobe_data(cam)
                 debug_formatted = view_model.format_debug_data(debug_data["update_count"])
-
-                # Emit updates to all connected clients
-                socketio.emit("heaters", heaters_data)
-                socketio.emit("flows", flows_data)
-                socketio.emit("cam", camera_data)
-                socketio.emit("strobe", strobe_data)
-                socketio.emit("debug", debug_formatted)
+                emit("cam", camera_data)
+                emit("strobe", strobe_data)
+                emit("debug", debug_formatted)
+                if state is not None:
+                    state.publish("strobe", strobe_data)
 
                 # Emit droplet detection updates (if controller available and running)
                 if droplet_web_controller is not None:
@@ -473,3 +632,21 @@ def create_background_update_task(
                 time.sleep(1.0)
 
     return background_update_loop
+
+
+def _scheduled_update(scheduler, updates, timeout_s: float = 5.0) -> None:
+    """Queue the periodic (update, device) calls at UI priority and wait for them."""
+    from drivers.spi_scheduler import PRIORITY_UI
+
+    # Same key as a controller's refresh after a command, so only one of them runs
+    futures = [
+        scheduler.call(
+            update, priority=PRIORITY_UI, key=("update", id(update.__self__)), device=device
+        )
+        for update, device in updates
+    ]
+    for future in futures:
+        try:
+            future.result(timeout_s)
+        except Exception as e:
+            logger.error(f"Background update failed: {e}")
@@ -0,0 +1,71 @@
+/**
+ * Client side of the server's coalesced, delta-only state pushes
+ * (controllers/push_hub.py).
+ *
+ * Keeps the whole state of each pushed event, applies the changes of each "push"
+ * message in seq order, and calls the handlers registered with socket.on( event ) with
+ * the event's whole state, as if the server had emitted it. Asks for the whole state
+ * with "push:sync" on connect and when a push is missed.
+ */
+
+function rio_push_init(socket) {
+    var state = {};
+    var seq = null;
+
+    function apply_change(event, path, value) {
+        if (path.length === 0) {
+            state[event] = value;
+            return;
+        }
+        var target = state[event];
+        for (var i = 0; i < path.length - 1; i++) {
+            target = target[path[i]];
+        }
+        target[path[path.length - 1]] = value;
+    }
+
+    function deliver(event) {
+        socket.listeners(event).forEach(function(handler) {
+            handler(state[event]);
+        });
+    }
+
+    socket.on('connect', function() {
+        seq = null;
+        socket.emit('push:sync');
+    });
+
+    socket.on('push', function(message) {
+        var event;
+        if (message.full) {
+            state = message.events;
+            seq = message.seq;
+        } else if (seq === null || message.seq <= seq) {
+            return;  // Before the sync, which has it
+        } else if (message.seq !== seq + 1) {
+            seq = null;
+            socket.emit('push:sync');
+            return;
+        } else {
+            try {
+                for (event in message.events) {
+                    message.events[event].forEach(function(change) {
+                        apply_change(event, change[0], change[1]);
+                    });
+                }
+            } catch (e) {
+                seq = null;  // Out of step with the server
+                socket.emit('push:sync');
+                return;
+            }
+            seq = message.seq;
+        }
+        for (event in message.events) {
+            deliver(event);
+        }
+    });
+
+    return {
+        state: function() { return state; }
+    };
+}
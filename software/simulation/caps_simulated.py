@@ -0,0 +1,38 @@
+"""
+Simulated capability discovery.
+
+Builds the GET_CAPABILITIES reply the way the shared rio_spi spi_caps_report() and
+spi_caps_types() do, from the packet types a simulated board answers. Buffer sizes are the
+firmware's, from each board's spi_port.h.
+"""
+
+from typing import Iterable, List
+
+CAPS_TYPES = 64
+FIRMWARE_VERSION = 0x0100
+PROTOCOL_VERSION = 2
+
+
+def capabilities_report(
+    crc_mode: int,
+    packet_buf: int,
+    write_buf: int,
+    batch_buf: int,
+    loop_period_us: int,
+    packet_types: Iterable[int],
+) -> List[int]:
+    """[err][firmware U16][protocol U8][CRC mode U8][packet, write, batch buf U16][loop us U32][types]."""
+    types = [0] * (CAPS_TYPES // 8)
+    for packet_type in packet_types:
+        if 0 < packet_type < CAPS_TYPES:
+            types[packet_type >> 3] |= 1 << (packet_type & 7)
+    return (
+        [0]
+        + list(FIRMWARE_VERSION.to_bytes(2, "little"))
+        + [PROTOCOL_VERSION, crc_mode]
+        + list(packet_buf.to_bytes(2, "little"))
+        + list(write_buf.to_bytes(2, "little"))
+        + list(batch_buf.to_bytes(2, "little"))
+        + list(int(loop_period_us).to_bytes(4, "little"))
+        + types
+    )
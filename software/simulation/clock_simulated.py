@@ -0,0 +1,115 @@
+"""
+Virtual clock shared by the simulated boards, the drivers and the controllers.
+
+In simulation every model, reply pause and wait reads time from here instead of the host,
+so a test can run minutes of autotune or a long flow profile in seconds:
+
+- real (default): simulated time runs with the host's
+- accelerated: set_rate(rate), simulated time runs <rate> times faster, and a sleep lasts
+  1/<rate> of its simulated length
+- stepped: set_stepped(), simulated time stands still except for step(seconds) and
+  sleep(seconds), which moves it on by <seconds> and returns at once. Meant for
+  single-threaded tests, as every thread's sleeps move the same clock.
+
+RIO_SIM_CLOCK sets the mode at start: unset or 1 real, a number the rate, "step" stepped.
+The functions have the names of those of the time module, which drivers.spi_handler.clock
+is on hardware, so callers use either unchanged.
+
+    from simulation import clock_simulated as clock
+
+    clock.set_stepped()
+    clock.sleep(600)  # Ten simulated minutes, at once
+"""
+
+import os
+import time as host
+from threading import Lock
+
+STEPPED = 0.0  # The rate of a stepped clock
+
+_lock = Lock()
+_wall_start = host.time()
+_monotonic_start = host.monotonic()
+_base_host = _monotonic_start  # Host time of the last change of rate
+_base_elapsed = 0.0  # Simulated seconds since the start, at _base_host
+_rate = 1.0
+
+
+def _elapsed() -> float:
+    return _base_elapsed + (host.monotonic() - _base_host) * _rate
+
+
+def _rebase(rate: float) -> None:
+    global _base_host, _base_elapsed, _rate
+    with _lock:
+        _base_elapsed = _elapsed()
+        _base_host = host.monotonic()
+        _rate = rate
+
+
+def set_real() -> None:
+    """Run with the host's time again, from the simulated time reached."""
+    _rebase(1.0)
+
+
+def set_rate(rate: float) -> None:
+    """Run <rate> times faster than the host, > 0."""
+    if rate <= 0:
+        raise ValueError(f"clock rate {rate} is not > 0, see set_stepped()")
+    _rebase(float(rate))
+
+
+def set_stepped() -> None:
+    """Stop time; only step() and sleep() move it on."""
+    _rebase(STEPPED)
+
+
+def rate() -> float:
+    """Simulated seconds per host second, STEPPED for a stepped clock."""
+    return _rate
+
+
+def step(seconds: float) -> None:
+    """Move simulated time on by <seconds> at once, whatever the mode."""
+    global _base_elapsed
+    if seconds > 0:
+        with _lock:
+            _base_elapsed += seconds
+
+
+def time() -> float:
+    """Simulated seconds since the epoch, as time.time()."""
+    return _wall_start + _elapsed()
+
+
+def monotonic() -> float:
+    """Simulated monotonic seconds, as time.monotonic()."""
+    return _monotonic_start + _elapsed()
+
+
+def monotonic_ns() -> int:
+    """Simulated monotonic ns, as time.monotonic_ns()."""
+    return int(monotonic() * 1e9)
+
+
+def sleep(seconds: float) -> None:
+    """Wait <seconds> of simulated time."""
+    if seconds <= 0:
+        return
+    if _rate == STEPPED:
+        step(seconds)
+    else:
+        host.sleep(seconds / _rate)
+
+
+def _from_env() -> None:
+    setting = os.getenv("RIO_SIM_CLOCK", "").strip().lower()
+    if setting in ("", "1", "real"):
+        return
+    if setting == "step":
+        set_stepped()
+    else:
+        set_rate(float(setting))
+
+
+_from_env()
@@ -0,0 +1,59 @@
+"""
+Simulated EEPROM fault log.
+
+Answers GET_FAULT_LOG the way the shared rio_fault firmware module does, from records kept
+in memory. A simulated board logs FAULT_ID_RESET when it is created and may log its own
+faults with log(); repeats of the newest record are counted in it.
+"""
+
+from typing import Dict, List
+
+from . import clock_simulated as clock
+
+FAULT_ID_RESET = 0
+FAULT_RECORD_SIZE = 16
+FAULT_LOG_RECORDS = 256
+FAULT_LIST_RECORDS_MAX = 4
+FAULT_CHECK = 0xA5
+
+ERR_PACKET_INVALID = 31
+
+
+class SimulatedFaultLog:
+    def __init__(self, reset_cause: int = 0):
+        self.records: List[Dict[str, int]] = []
+        self.start = clock.time()
+        self.log(FAULT_ID_RESET, reset_cause)
+
+    def log(self, fault_id: int, arg: int = 0) -> None:
+        if self.records and (self.records[-1]["id"], self.records[-1]["arg"]) == (fault_id, arg):
+            self.records[-1]["count"] = min(self.records[-1]["count"] + 1, 255)
+            return
+        seq = (self.records[-1]["seq"] + 1) & 0xFFFF if self.records else 0
+        uptime_s = int(clock.time() - self.start)
+        self.records.append(
+            {"seq": seq, "uptime_s": uptime_s, "id": fault_id, "count": 1, "arg": arg}
+        )
+        del self.records[:-FAULT_LOG_RECORDS]
+
+    def _encode(self, record: Dict[str, int]) -> List[int]:
+        raw = (
+            record["seq"].to_bytes(2, "little")
+            + (0).to_bytes(2, "little")
+            + record["uptime_s"].to_bytes(4, "little")
+            + bytes([record["id"], record["count"]])
+            + record["arg"].to_bytes(4, "little", signed=True)
+            + bytes([0])
+        )
+        return list(raw) + [(FAULT_CHECK - sum(raw)) & 0xFF]
+
+    def list(self, data: List[int]) -> List[int]:
+        """GET_FAULT_LOG: [index U16] -> [err][total U16][pending][count] count * record"""
+        if len(data) not in (0, 2):
+            return [ERR_PACKET_INVALID]
+        index = int.from_bytes(bytes(data), "little") if data else 0
+        newest_first = self.records[::-1][index : index + FAULT_LIST_RECORDS_MAX]
+        reply = [0] + list(len(self.records).to_bytes(2, "little")) + [0, len(newest_first)]
+        for record in newest_first:
+            reply += self._encode(record)
+        return reply
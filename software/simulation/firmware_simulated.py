@@ -0,0 +1,206 @@
+"""
+Firmware-in-the-loop boards.
+
+Runs the real pressure/flow and sample-holder firmware, built for the host by
+hardware-modules/host_test (make fil), against plant models in simulated time.
+SimulatedSPIHandler shifts the SPI bytes straight through the firmware's
+spi_handler(), so the drivers talk to the same code that runs on the board.
+
+Activated by RIO_SIM_FIRMWARE, on top of RIO_SIMULATION=true:
+    export RIO_SIM_FIRMWARE=true          # libraries in hardware-modules/host_test/build
+    export RIO_SIM_FIRMWARE=/path/to/dir  # libraries elsewhere
+
+Classes:
+    FirmwareBoard: one board's firmware, loaded from libfil_<board>.so
+"""
+
+import atexit
+import ctypes
+import logging
+import os
+import shutil
+import tempfile
+from pathlib import Path
+from typing import List, Optional
+
+from . import clock_simulated as clock
+
+logger = logging.getLogger(__name__)
+
+DEFAULT_LIBRARY_DIR = Path(__file__).resolve().parents[2] / "hardware-modules/host_test/build"
+BOARDS = ("pressure", "heater")
+
+# Ports each board answers on, see drivers/spi_handler.py
+BOARD_PORTS = {26: "pressure", 31: "heater", 33: "heater", 32: "heater", 36: "heater"}
+
+DEFAULT_LOOP_NS = 20000  # FIL_LOOP_NS_DEFAULT, one main loop pass
+DEFAULT_SPI_HZ = 30000  # FIL_SPI_HZ_DEFAULT
+MAX_CATCH_UP_S = 1.0  # Realtime: longest stretch run before a transfer, the rest is skipped
+
+
+def library_dir() -> Optional[Path]:
+    """Directory named by RIO_SIM_FIRMWARE, or None when firmware-in-the-loop is off."""
+    value = os.getenv("RIO_SIM_FIRMWARE", "").strip()
+    if value.lower() in ("", "false", "0"):
+        return None
+    if value.lower() in ("true", "1"):
+        return DEFAULT_LIBRARY_DIR
+    return Path(value)
+
+
+def library_path(board: str, directory: Optional[Path] = None) -> Path:
+    return Path(directory or DEFAULT_LIBRARY_DIR) / f"libfil_{board}.so"
+
+
+def firmware_available(board: str, directory: Optional[Path] = None) -> bool:
+    """True if libfil_<board>.so has been built (make -C hardware-modules/host_test fil)."""
+    return library_path(board, directory).is_file()
+
+
+def firmware_enabled(port: Optional[int]) -> bool:
+    """True if RIO_SIM_FIRMWARE is set and the board on <port> has its library."""
+    directory = library_dir()
+    board = BOARD_PORTS.get(port) if port is not None else None
+    return directory is not None and board is not None and firmware_available(board, directory)
+
+
+class FirmwareBoard:
+    """
+    One board's firmware, loaded from its libfil_<board>.so.
+
+    The firmware keeps its state in the library's globals, so each instance after
+    the first of a board loads its own copy of the library.
+
+    In realtime mode the firmware runs up to the simulated time (clock_simulated)
+    since it was created before each transfer, so the drivers' reply pauses behave
+    as on the board. Otherwise it only runs while bytes are shifted and in run_ms().
+    """
+
+    _loaded: dict = {}  # board -> instances loaded
+
+    def __init__(
+        self,
+        board: str,
+        library_dir: Optional[Path] = None,
+        loop_ns: int = DEFAULT_LOOP_NS,
+        spi_hz: int = DEFAULT_SPI_HZ,
+        realtime: bool = True,
+    ):
+        if board not in BOARDS:
+            raise ValueError(f"Unknown firmware board: {board}")
+        path = library_path(board, library_dir)
+        if not path.is_file():
+            raise FileNotFoundError(
+                f"{path} not built, run: make -C hardware-modules/host_test fil"
+            )
+
+        if FirmwareBoard._loaded.get(board, 0) > 0:
+            fd, copy = tempfile.mkstemp(prefix=f"libfil_{board}_", suffix=".so")
+            os.close(fd)
+            shutil.copyfile(path, copy)
+            atexit.register(os.remove, copy)
+            path = Path(copy)
+        FirmwareBoard._loaded[board] = FirmwareBoard._loaded.get(board, 0) + 1
+
+        self.board = board
+        self.realtime = realtime
+        self.spi_hz = spi_hz
+        self._lib = ctypes.CDLL(str(path))
+        self._declare()
+
+        self._lib.fil_set_loop_ns(loop_ns)
+        self._lib.fil_set_spi_hz(spi_hz)
+        self._lib.fil_setup(True)
+        self._start_s = clock.monotonic()
+        self._start_ns = self._lib.fil_now_ns()
+        logger.info(f"Firmware board '{board}' started from {path}")
+
+    def _declare(self) -> None:
+        lib = self._lib
+        lib.fil_setup.argtypes = [ctypes.c_bool]
+        lib.fil_run_ns.argtypes = [ctypes.c_uint64]
+        lib.fil_now_ns.restype = ctypes.c_uint64
+        lib.fil_loop_passes.restype = ctypes.c_uint32
+        lib.fil_set_loop_ns.argtypes = [ctypes.c_uint32]
+        lib.fil_set_spi_hz.argtypes = [ctypes.c_uint32]
+        lib.fil_spi_select.argtypes = [ctypes.c_bool]
+        lib.fil_spi_transfer.argtypes = [
+            ctypes.POINTER(ctypes.c_uint8),
+            ctypes.POINTER(ctypes.c_uint8),
+            ctypes.c_uint16,
+        ]
+        if self.board == "pressure":
+            lib.fil_pressure_set_plant.argtypes = [ctypes.c_uint8, ctypes.c_double, ctypes.c_double]
+            lib.fil_pressure_mbar.argtypes = [ctypes.c_uint8]
+            lib.fil_pressure_mbar.restype = ctypes.c_double
+            lib.fil_flow_ul_hr.argtypes = [ctypes.c_uint8]
+            lib.fil_flow_ul_hr.restype = ctypes.c_double
+        else:
+            lib.fil_heater_set_plant.argtypes = [ctypes.c_double] * 4
+            lib.fil_heater_temp_c.restype = ctypes.c_double
+
+    def _catch_up(self) -> None:
+        if not self.realtime:
+            return
+        target_ns = self._start_ns + int((clock.monotonic() - self._start_s) * 1e9)
+        behind_ns = target_ns - self._lib.fil_now_ns()
+        if behind_ns > MAX_CATCH_UP_S * 1e9 and clock.rate() == 1.0:
+            # Skipped, as if the host had been paused; a faster or stepped clock runs it all
+            self._start_ns -= int(behind_ns - MAX_CATCH_UP_S * 1e9)
+            behind_ns = int(MAX_CATCH_UP_S * 1e9)
+        if behind_ns > 0:
+            self._lib.fil_run_ns(behind_ns)
+
+    def set_spi_hz(self, hz: int) -> None:
+        """SPI clock, the firmware time each shifted byte takes."""
+        if hz > 0 and hz != self.spi_hz:
+            self._lib.fil_set_spi_hz(hz)
+            self.spi_hz = hz
+
+    def select(self, selected: bool) -> None:
+        """SPI1 slave select of the board."""
+        self._catch_up()
+        self._lib.fil_spi_select(selected)
+
+    def xfer(self, data: List[int]) -> List[int]:
+        """Shift <data> in, one byte time of firmware per byte, and return the bytes shifted out."""
+        self._catch_up()
+        count = len(data)
+        tx = (ctypes.c_uint8 * count)(*data)
+        rx = (ctypes.c_uint8 * count)()
+        self._lib.fil_spi_transfer(tx, rx, count)
+        return list(rx)
+
+    def run_ms(self, ms: float) -> None:
+        """Run the firmware for <ms> of simulated time."""
+        self._lib.fil_run_ns(int(ms * 1e6))
+
+    def now_s(self) -> float:
+        """Simulated time since the firmware reset."""
+        return self._lib.fil_now_ns() / 1e9
+
+    def loop_passes(self) -> int:
+        return self._lib.fil_loop_passes()
+
+    # Pressure and flow board plant
+
+    def set_pressure_plant(self, channel: int, tau_s: float, ul_hr_per_mbar: float) -> None:
+        """Regulator lag of <channel> and the flow its pressure drives through the chip."""
+        self._lib.fil_pressure_set_plant(channel, tau_s, ul_hr_per_mbar)
+
+    def pressure_mbar(self, channel: int) -> float:
+        return self._lib.fil_pressure_mbar(channel)
+
+    def flow_ul_hr(self, channel: int) -> float:
+        return self._lib.fil_flow_ul_hr(channel)
+
+    # Heater board plant
+
+    def set_heater_plant(
+        self, ambient_c: float, gain_c: float, tau_s: float, dead_s: float
+    ) -> None:
+        """Sample holder lag: <gain_c> over <ambient_c> at full power, restarted at ambient."""
+        self._lib.fil_heater_set_plant(ambient_c, gain_c, tau_s, dead_s)
+
+    def temp_c(self) -> float:
+        return self._lib.fil_heater_temp_c()
@@ -0,0 +1,148 @@
+"""
+Simulated firmware update.
+
+Answers FLASH the way the shared rio_flash firmware module does, on a dsPIC33CK
+dual partition flash kept as the inactive partition's written instructions. The
+simulated boards have no main loop of their own, so an erase or a CRC check that
+the firmware spreads over many passes finishes at the next FLASH packet instead.
+RESET boots the partition with the lower valid boot sequence; the rest of the
+simulated board carries on as it was.
+"""
+
+import binascii
+from typing import Dict, List
+
+FLASH_OP_STATUS = 0
+FLASH_OP_ERASE = 1
+FLASH_OP_WRITE = 2
+FLASH_OP_VERIFY = 3
+FLASH_OP_COMMIT = 4
+FLASH_OP_RESET = 5
+
+FLASH_STATE_IDLE = 0
+FLASH_STATE_ERASING = 1
+FLASH_STATE_READY = 2
+FLASH_STATE_VERIFYING = 3
+FLASH_STATE_VERIFIED = 4
+FLASH_STATE_COMMITTED = 5
+FLASH_STATE_FAILED = 6
+
+FLASH_PARTITION_SIZE = 0x016000
+FLASH_FBTSEQ = 0x015FFC
+FLASH_SEQ_INVALID = 0xFFF
+FLASH_ERASED = 0xFFFFFF
+
+ERR_PACKET_INVALID = 31
+ERR_FLASH_STATE = 120
+ERR_FLASH_ADDRESS = 121
+
+
+def fbtseq_word(seq: int) -> int:
+    """FBTSEQ holding boot sequence <seq>, its complement in bits 23:12."""
+    return ((~seq & 0xFFF) << 12) | seq
+
+
+def fbtseq_seq(word: int) -> int:
+    """Boot sequence of an FBTSEQ word, FLASH_SEQ_INVALID unless the complement matches."""
+    seq = word & 0xFFF
+    return seq if (word >> 12) & 0xFFF == (~seq & 0xFFF) else FLASH_SEQ_INVALID
+
+
+class SimulatedFlash:
+    def __init__(self, boot_seq: int = 0xFFE):
+        self.boot_seq = boot_seq  # Running image, as programmed with MPLAB
+        self.inactive: Dict[int, int] = {}  # Program address -> instruction, others erased
+        self.state = FLASH_STATE_IDLE
+        self.words = 0
+        self.progress = 0
+        self.crc = 0
+        self.verify = (0, 0)  # (size, expected CRC-32)
+        self.resets = 0
+
+    def _advance(self):
+        """What the firmware's flash_task() would have finished by now."""
+        if self.state == FLASH_STATE_ERASING:
+            self.inactive = {}
+            self.progress = FLASH_PARTITION_SIZE
+            self.state = FLASH_STATE_READY
+        elif self.state == FLASH_STATE_VERIFYING:
+            size, expected = self.verify
+            image = bytearray()
+            for addr in range(0, size, 2):
+                image += self.inactive.get(addr, FLASH_ERASED).to_bytes(3, "little")
+            self.crc = binascii.crc32(bytes(image))
+            self.progress = size
+            self.state = FLASH_STATE_VERIFIED if self.crc == expected else FLASH_STATE_FAILED
+
+    def _status(self) -> List[int]:
+        return (
+            [0, self.state]
+            + list(self.boot_seq.to_bytes(2, "little"))
+            + list(FLASH_PARTITION_SIZE.to_bytes(4, "little"))
+            + list(self.words.to_bytes(4, "little"))
+            + list(self.progress.to_bytes(4, "little"))
+            + list(self.crc.to_bytes(4, "little"))
+        )
+
+    def command(self, data: List[int]) -> List[int]:  # noqa: C901
+        """FLASH: [op][...] -> [err][status], or [err] alone when refused."""
+        self._advance()
+        if not data:
+            return [ERR_PACKET_INVALID]
+        op, body = data[0], bytes(data[1:])
+
+        if op in (FLASH_OP_STATUS, FLASH_OP_ERASE, FLASH_OP_COMMIT, FLASH_OP_RESET) and body:
+            return [ERR_PACKET_INVALID]
+        if op == FLASH_OP_ERASE:
+            self.state = FLASH_STATE_ERASING
+            self.words = self.progress = 0
+            self.crc = 0
+        elif op == FLASH_OP_WRITE:
+            if len(body) < 4 + 6 or (len(body) - 4) % 6:
+                return [ERR_PACKET_INVALID]
+            if self.state != FLASH_STATE_READY:
+                return [ERR_FLASH_STATE]
+            addr = int.from_bytes(body[:4], "little")
+            count = (len(body) - 4) // 3
+            end = addr + 2 * count
+            over_fbtseq = addr < FLASH_FBTSEQ + 4 and end > FLASH_FBTSEQ
+            if addr % 4 or end > FLASH_PARTITION_SIZE or over_fbtseq:
+                return [ERR_FLASH_ADDRESS]
+            for i in range(count):
+                word = int.from_bytes(body[4 + 3 * i : 7 + 3 * i], "little")
+                self.inactive[addr + 2 * i] = self.inactive.get(addr + 2 * i, FLASH_ERASED) & word
+            self.words += count
+        elif op == FLASH_OP_VERIFY:
+            if len(body) != 8:
+                return [ERR_PACKET_INVALID]
+            if self.state not in (FLASH_STATE_READY, FLASH_STATE_VERIFIED):
+                return [ERR_FLASH_STATE]
+            size = int.from_bytes(body[:4], "little")
+            if size == 0 or size % 2 or size > FLASH_PARTITION_SIZE:
+                return [ERR_FLASH_ADDRESS]
+            self.verify = (size, int.from_bytes(body[4:], "little"))
+            self.state = FLASH_STATE_VERIFYING
+            self.progress = 0
+        elif op == FLASH_OP_COMMIT:
+            if self.state != FLASH_STATE_VERIFIED or self.boot_seq == 0:
+                return [ERR_FLASH_STATE]
+            seq = FLASH_SEQ_INVALID - 1 if self.boot_seq == FLASH_SEQ_INVALID else self.boot_seq - 1
+            self.inactive[FLASH_FBTSEQ] = fbtseq_word(seq)
+            self.state = FLASH_STATE_COMMITTED
+        elif op == FLASH_OP_RESET:
+            reply = self._status()
+            self.reset()
+            return reply
+        elif op != FLASH_OP_STATUS:
+            return [ERR_PACKET_INVALID]
+        return self._status()
+
+    def reset(self):
+        """Boots the lower valid sequence, the old image stays in the other partition."""
+        seq = fbtseq_seq(self.inactive.get(FLASH_FBTSEQ, FLASH_ERASED))
+        self.resets += 1
+        if seq < self.boot_seq:
+            self.inactive = {FLASH_FBTSEQ: fbtseq_word(self.boot_seq)}
+            self.boot_seq = seq
+        self.state = FLASH_STATE_IDLE
+        self.words = self.progress = self.crc = 0
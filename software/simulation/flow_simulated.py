@@ -9,11 +9,30 @@ Classes:
     SimulatedFlow: Flow controller implementation that simulates PIC behavior
 """
 
-import time
 import logging
 from typing import List, Tuple
 import random
 
+from drivers import pressure_protocol
+
+from . import clock_simulated as clock
+from .caps_simulated import capabilities_report
+from .fault_simulated import SimulatedFaultLog
+from .param_simulated import (
+    PARAM_FLAG_READ_ONLY,
+    PARAM_FLAG_STORED,
+    PARAM_TYPE_I16,
+    PARAM_TYPE_U8,
+    PARAM_TYPE_U16,
+    SimulatedParam,
+    SimulatedParams,
+)
+from .flash_simulated import SimulatedFlash
+from .report_simulated import SimulatedReports
+from .stage_simulated import SimulatedStage
+from .stream_simulated import compact_stream_chunks, delta_encode, record_words, stream_chunks
+from .time_simulated import SimulatedTimebase
+
 # Configure logging
 logger = logging.getLogger(__name__)
 
@@ -22,9 +41,27 @@ DEFAULT_REPLY_PAUSE_S = 0.1
 DEFAULT_NUM_CHANNELS = 4
 DEFAULT_PRESSURE_RANGE = (0, 6000)  # mbar
 DEFAULT_FLOW_RANGE = (0, 1000)  # ul/hr
+CONTROL_CYCLE_S = 0.1  # Default firmware control cycle (ADC_PERIOD_MS), for telemetry
+ADC_DATA_RATES_SPS = (8, 16, 32, 64, 128, 250, 475, 860)
+TELEMETRY_QUEUE_SAMPLES = 6  # Samples that fit the firmware write ring
+TELEMETRY_KEY_EVERY = 32  # Compact samples per keyframe, main.c TELEMETRY_KEY_EVERY
+HISTORY_LEN = 64  # Control cycles kept for GET_HISTORY
+HISTORY_REPLY_MAX = 4
+PPID_DEFAULT_CONSTS = (2048, 256, 0)  # Firmware PPID_DEFAULT_P/I/D
+FTUNE_RESULT_CONSTS = (1500, 0, 10500)  # SET_FLOW_AUTOTUNE gains, as the host test's chip
+FTUNE_STATE_FINISHED = 3
+PCAL_STATE_FINISHED, PCAL_STATE_FAILED = 3, 4
+PRESSURE_CAL_ZERO_MAX = 500 << 3  # mbar << PRESSURE_SHL, main.c PRESSURE_CAL_ZERO_MAX
+FTUNE_RELAY_MBAR_MAX = 2500  # Half the firmware PRESSURE_CTLR_MBAR
+FLOW_SCHED_POINTS = 4  # Firmware NUM_FLOW_SCHED_POINTS
+PROFILE_LEN = 16  # Setpoint profile points per channel
+ADC_GAIN_AUTO = 7
+ADC_MAP = (3, 2, 0, 1)  # Firmware adc_map[], pressure channel of each ADC input
+FLOW_RESOLUTION_BITS_MIN, FLOW_RESOLUTION_BITS_MAX = 9, 16  # SENSIRION_RES_BITS_MIN/MAX
+FILTER_PASSTHROUGH = (1 << 14, 0, 0, 0, 0)  # SET_SIGNAL_FILTER off, Q14 b0 = 1
 
 
-class SimulatedFlow:
+class SimulatedFlow(pressure_protocol.PressurePackets):
     """
     Simulated flow controller (replaces PiFlow).
 
@@ -36,18 +73,22 @@ class SimulatedFlow:
     PRESSURE_SHIFT = 3
     PRESSURE_SCALE = 1 << PRESSURE_SHIFT
 
-    # Packet types (matching real firmware)
-    PACKET_TYPE_GET_ID = 1
-    PACKET_TYPE_SET_PRESSURE_TARGET = 2
-    PACKET_TYPE_GET_PRESSURE_TARGET = 3
-    PACKET_TYPE_GET_PRESSURE_ACTUAL = 4
-    PACKET_TYPE_SET_FLOW_TARGET = 5
-    PACKET_TYPE_GET_FLOW_TARGET = 6
-    PACKET_TYPE_GET_FLOW_ACTUAL = 7
-    PACKET_TYPE_SET_CONTROL_MODE = 8
-    PACKET_TYPE_GET_CONTROL_MODE = 9
-    PACKET_TYPE_SET_FPID_CONSTS = 10
-    PACKET_TYPE_GET_FPID_CONSTS = 11
+    # Packet types and reply layouts from the firmware's protocol.json, as PiFlow
+    PACKET_TYPE_PROTOCOL = 0x7F  # Answered by rio_spi
+
+    # Firmware error codes used in replies
+    ERR_SPI_WRITE_OVERFLOW = 20
+    ERR_ERROR = 1
+    ERR_PACKET_INVALID = 31
+    ERR_MODULE_ADDRESS = 34
+    ERR_PROFILE_INVALID = 100
+
+    # Firmware SPI buffer sizes (read ring, write ring, packet)
+    SPI_BUF_SIZES = (256, 256, 128)
+
+    # Firmware probe timer rate and number of probes (probe_port.h)
+    PROBE_TIMER_HZ = 1171875
+    PROBE_COUNT = 5
 
     NUM_CONTROLLERS = 4
 
@@ -56,6 +97,11 @@ class SimulatedFlow:
     MODE_PRESSURE_OPEN_LOOP = 1
     MODE_PRESSURE_CLOSED_LOOP = 2
     MODE_FLOW_CLOSED_LOOP = 3
+    MODE_FLOW_CASCADE = 4
+
+    # Flow controller states (matching real firmware)
+    FLOW_CTRL_STATE_READY = 1
+    FLOW_CTRL_STATE_RUNNING = 2
 
     def __init__(
         self,
@@ -96,6 +142,235 @@ class SimulatedFlow:
 
         # PID constants (P, I, D) for each channel - stored as U16 values
         self.pid_consts = [[0, 0, 0]] * num_channels  # Default: all zeros
+        self.ppid_consts = [list(PPID_DEFAULT_CONSTS) for _ in range(num_channels)]
+        # EEPROM writes, committed at once in simulation
+        self.eeprom_committed = 0
+
+        # SET_FLOW_FF state per channel: [resistance, ramp ul/hr per cycle, flags]
+        self.flow_ff = [[0, 0, 0] for _ in range(num_channels)]
+        # SET_SIGNAL_FILTER, Q14 (b0, b1, b2, a1, a2) per channel of pressure and flow. Kept
+        # and echoed only; the simulated readings are not filtered.
+        self.signal_filters = [[FILTER_PASSTHROUGH] * 2 for _ in range(num_channels)]
+
+        # Setpoint profiles: uploaded (duration ms, value) points, and the run state, which is
+        # worked out from elapsed time when queried
+        self.profile_points = [[None] * PROFILE_LEN for _ in range(num_channels)]
+        self.profiles = [
+            {"length": 0, "flags": 0, "active": 0, "index": 0, "start": 0.0}
+            for _ in range(num_channels)
+        ]
+
+        # GET_STATUS_SNAPSHOT sequence number, one simulated control cycle per snapshot
+        self.snapshot_seq = 0
+
+        # SET_TELEMETRY streaming state, samples are made from elapsed time when read
+        self.telemetry_period = 0
+        self.telemetry_time = 0.0
+        self.telemetry_dropped = 0
+        self.telemetry_compact = False
+        self.telemetry_prev = None  # Words of the last compact sample, None -> keyframe next
+        self.telemetry_since_key = 0
+
+        # SET_FRAME_SYNC state. There is no camera, so each simulated cycle is started
+        # by a frame and none are missed.
+        self.frame_sync_mode = 0
+        self.frame_sync_divider = 1
+        self.frame_sync_frames = 0
+
+        # SET_LOOP_CONFIG state, GET_LOOP_STATS counts cycles from elapsed time
+        self.control_cycle_s = CONTROL_CYCLE_S
+        self.adc_data_rate_codes = [ADC_DATA_RATES_SPS.index(128)] * num_channels
+        # SET_ADC_CONFIG, PGA code or ADC_GAIN_AUTO and mux code; auto-ranging is not modelled
+        self.adc_gains = [0] * num_channels
+        self.adc_muxes = [4 + ADC_MAP.index(ch) for ch in range(num_channels)]
+        # LG16 resolution bits and CRC check per flow sensor; simulated readings never fail it
+        self.flow_resolutions = [FLOW_RESOLUTION_BITS_MAX] * num_channels
+        self.flow_crc_checks = [1] * num_channels
+        self.flow_crc_errors = [0] * num_channels
+        self.flow_flags_gates = [1] * num_channels
+        self.flow_air_events = [0] * num_channels
+        self.flow_high_events = [0] * num_channels
+        # Clog and leak watch: the simulated chips neither clog nor leak, so the state stays OK
+        # and R is left unestimated
+        self.flow_res_clog_pct = 50
+        self.flow_res_leak_pct = 30
+        self.flow_res_rs = [0] * num_channels
+        self.flow_res_refs = [0] * num_channels
+        self.flow_res_states = [0] * num_channels
+        # Overpressure cut-off, checked where the simulated pressure changes
+        self.pressure_limits = [0] * num_channels
+        self.pressure_trips = [0] * num_channels
+        self.adc_bursts = [1] * num_channels
+        # PRESSURE_CAL zero and span trim, not applied: the simulated sensors read true
+        self.pressure_cal_zeros = [0] * num_channels
+        self.pressure_cal_trims = [0] * num_channels
+        self.pressure_cal_states = [0] * num_channels
+        # Flow estimate between readings, kept as a setting: the simulated flow is always fresh
+        self.flow_est_shifts = [0] * num_channels
+        self.loop_stats_time = clock.time()
+
+        # GET_HISTORY ring, filled from elapsed time with its own cycle count
+        self.history = []
+        self.history_seq = 0
+        self.history_time = clock.time()
+
+        # GET_I2C_STATS: every transaction succeeds, parameter 0x02 picks the clock
+        self.i2c_fast_plus = 0
+        # Kept for the parameter table; every channel's flow is computed every cycle
+        self.flow_monitor_div = 4
+        # Warm start switch; the simulated loops settle at once, so there is nothing to restore
+        self.warm_start = 1
+        # Event driven channel updates; the simulated cycle updates every channel at once anyway
+        self.ctrl_event = 0
+        # Module address of addressed BATCHes, 0xFF (blank EEPROM) answers every address
+        self.module_addr = 0xFF
+        # SET_FLOW_AUTOTUNE [state, fail, transitions, settled] per channel. A test finishes
+        # at once with FTUNE_RESULT_CONSTS, the simulated flow has no loop to tune.
+        self.flow_autotune = [[0, 0, 0, 0] for _ in range(num_channels)]
+        # SET_FLOW_SCHED (flow ul/hr, P, I, D) points per channel, the gains in use are
+        # interpolated on the flow target
+        self.flow_scheds = [[] for _ in range(num_channels)]
+
+        self.params = SimulatedParams(self._param_table())
+        self.faults = SimulatedFaultLog()
+        self.timebase = SimulatedTimebase()
+        self.stage = SimulatedStage(
+            self.timebase, self._run, self.PACKET_TYPE_BATCH, self.PACKET_TYPE_STAGE
+        )
+        # SUBSCRIBE signals: the pressures, then the flows, see read_reports()
+        self.reports = SimulatedReports(self.timebase, 2 * num_channels)
+        self.flash = SimulatedFlash()
+
+    def _param_table(self) -> List[SimulatedParam]:
+        """Firmware params[] in main.c order; PID sets count as one EEPROM write."""
+
+        def pid(table, channel, index):
+            def set_(value):
+                # Replace the row, fpid rows start out as one shared list
+                row = list(getattr(self, table)[channel])
+                row[index] = value
+                getattr(self, table)[channel] = row
+                self.eeprom_committed += 1
+
+            return (lambda: getattr(self, table)[channel][index]), set_
+
+        def item(table, channel, index=None):
+            def get():
+                value = getattr(self, table)[channel]
+                return int(value if index is None else value[index])
+
+            def set_(value):
+                if index is None:
+                    getattr(self, table)[channel] = value
+                else:
+                    getattr(self, table)[channel][index] = value
+
+            return get, set_
+
+        def set_period_ms(value):
+            self.control_cycle_s = value / 1000
+
+        def get_fast_plus():
+            return self.i2c_fast_plus
+
+        def set_fast_plus(value):
+            self.i2c_fast_plus = value
+
+        def get_monitor_div():
+            return self.flow_monitor_div
+
+        def set_monitor_div(value):
+            self.flow_monitor_div = value
+
+        stored, ro = PARAM_FLAG_STORED, PARAM_FLAG_READ_ONLY
+        u8, u16, i16 = PARAM_TYPE_U8, PARAM_TYPE_U16, PARAM_TYPE_I16
+        period_ms = lambda: int(round(self.control_cycle_s * 1000))  # noqa: E731
+        table = [SimulatedParam(0x01, u16, 0, 5, 0xFFFF, period_ms, set_period_ms)]
+        table.append(SimulatedParam(0x02, u8, 0, 0, 1, get_fast_plus, set_fast_plus))
+        table.append(SimulatedParam(0x03, u8, 0, 1, 0xFF, get_monitor_div, set_monitor_div))
+        for id_, name, max_ in ((0x04, "flow_res_clog_pct", 0xFF), (0x05, "flow_res_leak_pct", 99)):
+            get, set_ = (lambda n=name: getattr(self, n)), (lambda v, n=name: setattr(self, n, v))
+            table.append(SimulatedParam(id_, u8, 0, 1, max_, get, set_))
+        warm = (lambda: self.warm_start), (lambda v: setattr(self, "warm_start", v))
+        table.append(SimulatedParam(0x06, u8, 0, 0, 1, *warm))
+        event = (lambda: self.ctrl_event), (lambda v: setattr(self, "ctrl_event", v))
+        table.append(SimulatedParam(0x07, u8, 0, 0, 1, *event))
+        set_addr = lambda v: (setattr(self, "module_addr", v), self._count_eeprom_write())  # noqa: E731
+        table.append(SimulatedParam(0x08, u8, stored, 0, 0xFF, lambda: self.module_addr, set_addr))
+        table.append(SimulatedParam(0x09, u8, ro, 0, 2, lambda: 0))  # Never a watchdog reset
+        for base, name in ((0x10, "pid_consts"), (0x20, "ppid_consts")):
+            for index in range(3):
+                for ch in range(self.num_channels):
+                    id_ = base + 4 * index + ch
+                    table.append(SimulatedParam(id_, u16, stored, 0, 0xFFFF, *pid(name, ch, index)))
+        rate_max = len(ADC_DATA_RATES_SPS) - 1
+        for ch in range(self.num_channels):
+            rate = item("adc_data_rate_codes", ch)
+            table.append(SimulatedParam(0x30 + ch, u8, stored, 0, rate_max, *rate))
+        for ch in range(self.num_channels):
+            table.append(SimulatedParam(0x34 + ch, u16, 0, 0, 0xFFFF, *item("flow_ff", ch, 0)))
+        for base, name, max_ in ((0x38, "adc_gains", ADC_GAIN_AUTO), (0x3C, "adc_muxes", 7)):
+            for ch in range(self.num_channels):
+                table.append(SimulatedParam(base + ch, u8, stored, 0, max_, *item(name, ch)))
+        for ch in range(self.num_channels):
+            flow = item("flow_actuals", ch)
+            table.append(SimulatedParam(0x40 + ch, i16, ro, -32768, 32767, *flow))
+        bits = (FLOW_RESOLUTION_BITS_MIN, FLOW_RESOLUTION_BITS_MAX)
+        for ch in range(self.num_channels):
+            table.append(SimulatedParam(0x44 + ch, u8, 0, *bits, *item("flow_resolutions", ch)))
+        for ch in range(self.num_channels):
+            table.append(SimulatedParam(0x48 + ch, u8, 0, 0, 1, *item("flow_crc_checks", ch)))
+        for ch in range(self.num_channels):
+            errors = item("flow_crc_errors", ch)
+            table.append(SimulatedParam(0x4C + ch, u16, ro, 0, 0xFFFF, *errors))
+        for ch in range(self.num_channels):
+            table.append(SimulatedParam(0x50 + ch, u8, 0, 0, 1, *item("flow_flags_gates", ch)))
+        for base, name in ((0x54, "flow_air_events"), (0x58, "flow_high_events")):
+            for ch in range(self.num_channels):
+                table.append(SimulatedParam(base + ch, u16, ro, 0, 0xFFFF, *item(name, ch)))
+        for ch in range(self.num_channels):
+            table.append(SimulatedParam(0x5C + ch, u16, ro, 0, 0xFFFF, *item("flow_res_rs", ch)))
+        for ch in range(self.num_channels):
+            table.append(SimulatedParam(0x60 + ch, u16, 0, 0, 0xFFFF, *item("flow_res_refs", ch)))
+        for ch in range(self.num_channels):
+            table.append(SimulatedParam(0x64 + ch, u8, ro, 0, 2, *item("flow_res_states", ch)))
+        for ch in range(self.num_channels):
+            get, set_ = item("pressure_limits", ch)
+            set_limit = (lambda v, s=set_: (s(v), self._count_eeprom_write()))  # noqa: E731
+            table.append(SimulatedParam(0x68 + ch, u16, stored, 0, 0xFFFF, get, set_limit))
+        for ch in range(self.num_channels):
+            trips = item("pressure_trips", ch)
+            table.append(SimulatedParam(0x6C + ch, u16, ro, 0, 0xFFFF, *trips))
+        for ch in range(self.num_channels):
+            get, set_ = item("adc_bursts", ch)
+            set_burst = (lambda v, s=set_: (s(v), self._count_eeprom_write()))  # noqa: E731
+            table.append(SimulatedParam(0x70 + ch, u8, stored, 1, 16, get, set_burst))
+        zero_max = PRESSURE_CAL_ZERO_MAX
+        for base, name, min_, max_ in (
+            (0x74, "pressure_cal_zeros", -zero_max, zero_max),
+            (0x78, "pressure_cal_trims", -128, 127),
+        ):
+            for ch in range(self.num_channels):
+                get, set_ = item(name, ch)
+                set_cal = (lambda v, s=set_: (s(v), self._count_eeprom_write()))  # noqa: E731
+                table.append(SimulatedParam(base + ch, i16, stored, min_, max_, get, set_cal))
+        for ch in range(self.num_channels):
+            table.append(SimulatedParam(0x7C + ch, u8, 0, 0, 6, *item("flow_est_shifts", ch)))
+        return table
+
+    def _count_eeprom_write(self) -> None:
+        self.eeprom_committed += 1
+
+    def _pressure_limit_check(self, channel: int) -> None:
+        """As pressure_limit_check(): over the limit the channel is cut to mode 0 and 0 mbar."""
+        limit = self.pressure_limits[channel]
+        pressure = self.pressure_actuals[channel]
+        if limit == 0 or pressure < limit:
+            return
+        self.control_modes[channel] = self.MODE_OFF
+        self.pressure_actuals[channel] = 0.0
+        self.pressure_trips[channel] = min(self.pressure_trips[channel] + 1, 0xFFFF)
+        self.faults.log(12, (channel << 16) | int(pressure))
 
     def packet_query(self, type_: int, data: List[int]) -> Tuple[bool, List[int]]:
         """
@@ -114,9 +389,29 @@ class SimulatedFlow:
             - response_data: Response bytes from simulated device
         """
         # Simulate reply delay (PIC processing time)
-        time.sleep(self.reply_pause_s)
+        clock.sleep(self.reply_pause_s)
+
+        # Staged packets whose time has come, ahead of this one
+        self.stage.poll()
+        handler = self._handlers().get(type_)
+        if handler:
+            valid, response = handler(data)
+        else:
+            valid = False
+            response = []
+            logger.warning(f"Unknown packet type in query: {type_}")
+
+        if not valid:
+            logger.debug(f"Invalid packet query: type={type_}, data_len={len(data)}")
+
+        return valid, response
+
+    def _run(self, type_: int, data: List[int]) -> Tuple[bool, List[int]]:
+        handler = self._handlers().get(type_)
+        return handler(data) if handler else (False, [])
 
-        handlers = {
+    def _handlers(self):
+        return {
             self.PACKET_TYPE_GET_ID: self._handle_get_id,
             self.PACKET_TYPE_SET_PRESSURE_TARGET: self._handle_set_pressure_target,
             self.PACKET_TYPE_GET_PRESSURE_TARGET: self._handle_get_pressure_target,
@@ -128,20 +423,70 @@ class SimulatedFlow:
             self.PACKET_TYPE_GET_CONTROL_MODE: self._handle_get_control_mode,
             self.PACKET_TYPE_SET_FPID_CONSTS: self._handle_set_fpid_consts,
             self.PACKET_TYPE_GET_FPID_CONSTS: self._handle_get_fpid_consts,
+            self.PACKET_TYPE_SET_PPID_CONSTS: self._handle_set_ppid_consts,
+            self.PACKET_TYPE_GET_PPID_CONSTS: self._handle_get_ppid_consts,
+            self.PACKET_TYPE_SET_FLOW_FF: self._handle_set_flow_ff,
+            self.PACKET_TYPE_SET_PROFILE_POINTS: self._handle_set_profile_points,
+            self.PACKET_TYPE_SET_PROFILE: self._handle_set_profile,
+            self.PACKET_TYPE_GET_PROBE_STATS: self._handle_get_probe_stats,
+            self.PACKET_TYPE_GET_EEPROM_STATUS: self._handle_get_eeprom_status,
+            self.PACKET_TYPE_PARAM_LIST: lambda data: (True, self.params.list(data)),
+            self.PACKET_TYPE_PARAM_GET_MANY: lambda data: (True, self.params.get_many(data)),
+            self.PACKET_TYPE_PARAM_SET_MANY: lambda data: (True, self.params.set_many(data)),
+            self.PACKET_TYPE_GET_FAULT_LOG: lambda data: (True, self.faults.list(data)),
+            self.PACKET_TYPE_SET_SIGNAL_FILTER: self._handle_set_signal_filter,
+            self.PACKET_TYPE_SET_ADC_CONFIG: self._handle_set_adc_config,
+            self.PACKET_TYPE_ECHO: lambda data: (True, [0] + list(data)),
+            self.PACKET_TYPE_SYNC_TIME: lambda data: (True, self.timebase.sync(data)),
+            self.PACKET_TYPE_SET_FRAME_SYNC: self._handle_set_frame_sync,
+            self.PACKET_TYPE_STAGE: lambda data: (True, self.stage.stage(data)),
+            self.PACKET_TYPE_GET_SPI_STATS: self._handle_get_spi_stats,
+            self.PACKET_TYPE_BATCH: self._handle_batch,
+            self.PACKET_TYPE_GET_STATUS_SNAPSHOT: self._handle_get_status_snapshot,
+            self.PACKET_TYPE_SET_TELEMETRY: self._handle_set_telemetry,
+            self.PACKET_TYPE_GET_HISTORY: self._handle_get_history,
+            self.PACKET_TYPE_SET_LOOP_CONFIG: self._handle_set_loop_config,
+            self.PACKET_TYPE_GET_LOOP_STATS: self._handle_get_loop_stats,
+            self.PACKET_TYPE_GET_CAPABILITIES: self._handle_get_capabilities,
+            self.PACKET_TYPE_GET_BOOT_STATUS: self._handle_get_boot_status,
+            self.PACKET_TYPE_GET_I2C_STATS: self._handle_get_i2c_stats,
+            self.PACKET_TYPE_SET_FLOW_AUTOTUNE: self._handle_set_flow_autotune,
+            self.PACKET_TYPE_SET_FLOW_SCHED: self._handle_set_flow_sched,
+            self.PACKET_TYPE_GET_LATENCY_STATS: self._handle_get_latency_stats,
+            self.PACKET_TYPE_PRESSURE_CAL: self._handle_pressure_cal,
+            self.PACKET_TYPE_SUBSCRIBE: lambda data: (True, self.reports.subscribe(data)),
+            self.PACKET_TYPE_FLASH: lambda data: (True, self.flash.command(data)),
+            self.PACKET_TYPE_PROTOCOL: self._handle_protocol,
         }
 
-        handler = handlers.get(type_)
-        if handler:
-            valid, response = handler(data)
-        else:
-            valid = False
-            response = []
-            logger.warning(f"Unknown packet type in query: {type_}")
+    def _handle_get_capabilities(self, data: List[int]) -> Tuple[bool, List[int]]:
+        """Handle GET_CAPABILITIES: the pressure board's buffers and every type handled here."""
+        if data:
+            return False, []
+        loop_period_us = int(round(self.control_cycle_s * 1e6))
+        types = list(self._handlers()) + [self.PACKET_TYPE_HISTORY_STREAM]
+        return True, capabilities_report(2, 128, 256, 128, loop_period_us, types)
 
-        if not valid:
-            logger.debug(f"Invalid packet query: type={type_}, data_len={len(data)}")
+    def _handle_get_boot_status(self, data: List[int]) -> Tuple[bool, List[int]]:
+        """Handle GET_BOOT_STATUS: booted when created, every flow sensor found."""
+        if data:
+            return False, []
+        present = (1 << min(self.num_channels, 8)) - 1
+        return True, [0, 0, present] + list((1).to_bytes(2, "little"))
 
-        return valid, response
+    def _handle_get_i2c_stats(self, data: List[int]) -> Tuple[bool, List[int]]:
+        """Handle GET_I2C_STATS: a clean bus, no transfers counted."""
+        if len(data) > 1:
+            return True, [self.ERR_PACKET_INVALID]
+        clock_khz = 1000 if self.i2c_fast_plus else 400
+        return True, [0] + [0] * (3 * 12) + [0] * 4 + list(clock_khz.to_bytes(2, "little"))
+
+    def _handle_get_latency_stats(self, data: List[int]) -> Tuple[bool, List[int]]:
+        """Handle GET_LATENCY_STATS: nothing is timed in simulation, so no samples."""
+        if len(data) not in (1, 2) or data[0] >= self.num_channels:
+            return True, [self.ERR_PACKET_INVALID]
+        period_us = int(round(self.control_cycle_s * 1e6))
+        return True, [0, self.num_channels, data[0]] + list(period_us.to_bytes(4, "little")) + [0] * 96
 
     def _handle_get_id(self, data: List[int]) -> Tuple[bool, List[int]]:
         """Handle GET_ID packet."""
@@ -162,9 +507,15 @@ class SimulatedFlow:
                 for channel in range(self.num_channels):
                     if mask & (1 << channel):
                         self.pressure_targets[channel] = pressure_mbar
-                        self.pressure_actuals[channel] = pressure_mbar * 0.95 + random.uniform(
+                        # Open loop settles short of the target by the regulator error
+                        if self.control_modes[channel] == self.MODE_PRESSURE_CLOSED_LOOP:
+                            gain = 1.0
+                        else:
+                            gain = 0.95
+                        self.pressure_actuals[channel] = pressure_mbar * gain + random.uniform(
                             -10, 10
                         )
+                        self._pressure_limit_check(channel)
                 i += 3
             else:
                 break
@@ -172,21 +523,16 @@ class SimulatedFlow:
 
     def _handle_get_pressure_target(self, data: List[int]) -> Tuple[bool, List[int]]:
         """Handle GET_PRESSURE_TARGET packet."""
-        response = [0]
-        for channel in range(self.num_channels):
-            pressure_raw = int(self.pressure_targets[channel] * self.PRESSURE_SCALE)
-            response.extend(list(pressure_raw.to_bytes(2, "little", signed=False)))
-        return True, response
+        pressures = [int(p * self.PRESSURE_SCALE) for p in self.pressure_targets]
+        return True, self._encode(pressure_protocol.PRESSURE_TARGET_REPLY, pressure=pressures)
 
     def _handle_get_pressure_actual(self, data: List[int]) -> Tuple[bool, List[int]]:
         """Handle GET_PRESSURE_ACTUAL packet."""
-        response = [0]
         for channel in range(self.num_channels):
             self.pressure_actuals[channel] += random.uniform(-5, 5)
             self.pressure_actuals[channel] = max(0, min(self.pressure_actuals[channel], 6000))
-            pressure_raw = int(self.pressure_actuals[channel] * self.PRESSURE_SCALE)
-            response.extend(list(pressure_raw.to_bytes(2, "little", signed=True)))
-        return True, response
+        pressures = [int(p * self.PRESSURE_SCALE) for p in self.pressure_actuals]
+        return True, self._encode(pressure_protocol.PRESSURE_ACTUAL_REPLY, pressure=pressures)
 
     def _handle_set_flow_target(self, data: List[int]) -> Tuple[bool, List[int]]:
         """Handle SET_FLOW_TARGET packet."""
@@ -206,21 +552,16 @@ class SimulatedFlow:
 
     def _handle_get_flow_target(self, data: List[int]) -> Tuple[bool, List[int]]:
         """Handle GET_FLOW_TARGET packet."""
-        response = [0]
-        for channel in range(self.num_channels):
-            flow_ul_hr = int(self.flow_targets[channel])
-            response.extend(list(flow_ul_hr.to_bytes(2, "little", signed=False)))
-        return True, response
+        flows = [int(flow) for flow in self.flow_targets]
+        return True, self._encode(pressure_protocol.FLOW_REPLY, flow=flows)
 
     def _handle_get_flow_actual(self, data: List[int]) -> Tuple[bool, List[int]]:
         """Handle GET_FLOW_ACTUAL packet."""
-        response = [0]
         for channel in range(self.num_channels):
             self.flow_actuals[channel] += random.uniform(-2, 2)
             self.flow_actuals[channel] = max(0, min(self.flow_actuals[channel], 1000))
-            flow_ul_hr = int(self.flow_actuals[channel])
-            response.extend(list(flow_ul_hr.to_bytes(2, "little", signed=True)))
-        return True, response
+        flows = [int(flow) for flow in self.flow_actuals]
+        return True, self._encode(pressure_protocol.FLOW_REPLY, flow=flows)
 
     def _handle_set_control_mode(self, data: List[int]) -> Tuple[bool, List[int]]:
         """Handle SET_CONTROL_MODE packet."""
@@ -231,7 +572,7 @@ class SimulatedFlow:
                 mode = data[i + 1]
                 for channel in range(self.num_channels):
                     if mask & (1 << channel):
-                        if 0 <= mode <= 3:
+                        if 0 <= mode <= self.MODE_FLOW_CASCADE:
                             self.control_modes[channel] = mode
                 i += 2
             else:
@@ -247,6 +588,234 @@ class SimulatedFlow:
 
     def _handle_set_fpid_consts(self, data: List[int]) -> Tuple[bool, List[int]]:
         """Handle SET_FPID_CONSTS packet."""
+        return self._set_pid_consts(self.pid_consts, data)
+
+    def _handle_get_fpid_consts(self, data: List[int]) -> Tuple[bool, List[int]]:
+        """Handle GET_FPID_CONSTS packet."""
+        return self._get_pid_consts(self.pid_consts)
+
+    def _handle_set_ppid_consts(self, data: List[int]) -> Tuple[bool, List[int]]:
+        """Handle SET_PPID_CONSTS packet, same layout as SET_FPID_CONSTS."""
+        return self._set_pid_consts(self.ppid_consts, data)
+
+    def _handle_get_ppid_consts(self, data: List[int]) -> Tuple[bool, List[int]]:
+        """Handle GET_PPID_CONSTS packet."""
+        return self._get_pid_consts(self.ppid_consts)
+
+    def _handle_set_flow_autotune(self, data: List[int]) -> Tuple[bool, List[int]]:
+        """Handle SET_FLOW_AUTOTUNE: [mask][run][flow I16][relay U16], tail optional."""
+        if len(data) not in (0, 2, 4, 6):
+            return True, [self.ERR_PACKET_INVALID]
+        if len(data) == 6:
+            relay_mbar = int.from_bytes(data[4:6], "little", signed=False)
+            if relay_mbar == 0 or relay_mbar > FTUNE_RELAY_MBAR_MAX:
+                return True, [self.ERR_PACKET_INVALID]
+        if len(data) >= 2 and data[1]:
+            for channel in range(self.num_channels):
+                if data[0] & (1 << channel):
+                    self.pid_consts[channel] = list(FTUNE_RESULT_CONSTS)
+                    self.eeprom_committed += 1
+                    self.flow_autotune[channel] = [FTUNE_STATE_FINISHED, 0, 8, 3]
+        response = [0]
+        for status in self.flow_autotune:
+            response.extend(status)
+        return True, response
+
+    def _handle_pressure_cal(self, data: List[int]) -> Tuple[bool, List[int]]:
+        """Handle PRESSURE_CAL: [mask][samples], or none. A capture finishes at once on the
+        reading at hand, about 0 in mode 0."""
+        if len(data) not in (0, 2):
+            return True, [self.ERR_PACKET_INVALID]
+        channels = [ch for ch in range(self.num_channels) if data and data[0] & (1 << ch)]
+        if data and data[1]:
+            if any(self.control_modes[ch] != self.MODE_OFF for ch in channels):
+                return True, [self.ERR_ERROR]
+            for ch in channels:
+                zero = int(round(self.pressure_actuals[ch] * self.PRESSURE_SCALE))
+                if abs(zero) > PRESSURE_CAL_ZERO_MAX:
+                    self.pressure_cal_states[ch] = PCAL_STATE_FAILED
+                    continue
+                self.pressure_cal_zeros[ch] = zero
+                self.pressure_cal_states[ch] = PCAL_STATE_FINISHED
+                self._count_eeprom_write()
+        spans = [(1 << 14) + (trim << 3) for trim in self.pressure_cal_trims]
+        return True, self._encode(
+            pressure_protocol.PRESSURE_CAL_REPLY,
+            zero=self.pressure_cal_zeros,
+            span=spans,
+            state=self.pressure_cal_states,
+            left=[0] * self.num_channels,
+        )
+
+    def _handle_set_flow_sched(self, data: List[int]) -> Tuple[bool, List[int]]:
+        """Handle SET_FLOW_SCHED: [chan][count] count x [flow I16][P][I][D], or [chan]."""
+        if not data or data[0] >= self.num_channels:
+            return True, [self.ERR_PACKET_INVALID]
+        channel = data[0]
+        if len(data) > 1:
+            count = data[1]
+            if count > FLOW_SCHED_POINTS or len(data) != 2 + 8 * count:
+                return True, [self.ERR_PACKET_INVALID]
+            points = []
+            for i in range(count):
+                entry = data[2 + 8 * i : 10 + 8 * i]
+                flow = int.from_bytes(entry[0:2], "little", signed=True)
+                gains = [int.from_bytes(entry[j : j + 2], "little") for j in (2, 4, 6)]
+                if flow < 0 or (points and flow <= points[-1][0]):
+                    return True, [self.ERR_PACKET_INVALID]
+                points.append((flow, *gains))
+            self.flow_scheds[channel] = points
+            self.eeprom_committed += 1
+        points = self.flow_scheds[channel]
+        response = [0, len(points)]
+        for i in range(FLOW_SCHED_POINTS):
+            flow, p, i_val, d = points[i] if i < len(points) else (0, 0, 0, 0)
+            response.extend(list(flow.to_bytes(2, "little", signed=True)))
+            for value in (p, i_val, d):
+                response.extend(list(value.to_bytes(2, "little")))
+        for value in self._flow_sched_gains(channel):
+            response.extend(list(value.to_bytes(2, "little")))
+        return True, response
+
+    def _flow_sched_gains(self, channel: int) -> List[int]:
+        points = self.flow_scheds[channel]
+        if not points:
+            return list(self.pid_consts[channel])
+        flow = self.flow_targets[channel]
+        if flow <= points[0][0]:
+            return list(points[0][1:])
+        for lo, hi in zip(points, points[1:]):
+            if flow < hi[0]:
+                t = (flow - lo[0]) / (hi[0] - lo[0])
+                return [int(round(a + (b - a) * t)) for a, b in zip(lo[1:], hi[1:])]
+        return list(points[-1][1:])
+
+    def _handle_set_flow_ff(self, data: List[int]) -> Tuple[bool, List[int]]:
+        """Handle SET_FLOW_FF: n x [mask][R U16][ramp U16][flags], none to query."""
+        if len(data) % 6 != 0:
+            return True, [self.ERR_PACKET_INVALID]
+        for i in range(0, len(data), 6):
+            if data[i + 5] & ~0x03:
+                return True, [self.ERR_PACKET_INVALID]
+            resistance = int.from_bytes(data[i + 1 : i + 3], "little", signed=False)
+            ramp = int.from_bytes(data[i + 3 : i + 5], "little", signed=False)
+            for channel in range(self.num_channels):
+                if data[i] & (1 << channel):
+                    self.flow_ff[channel] = [resistance, ramp, data[i + 5]]
+        response = [0]
+        for resistance, ramp, flags in self.flow_ff:
+            response.extend(list(resistance.to_bytes(2, "little", signed=False)))
+            response.extend(list(ramp.to_bytes(2, "little", signed=False)))
+            response.append(flags)
+        return True, response
+
+    def _handle_set_signal_filter(self, data: List[int]) -> Tuple[bool, List[int]]:
+        """Handle SET_SIGNAL_FILTER: n x [mask][signal][b0..a2 I16], none to query."""
+        if len(data) % 12 != 0:
+            return True, [self.ERR_PACKET_INVALID]
+        for i in range(0, len(data), 12):
+            coeffs = tuple(
+                int.from_bytes(data[j : j + 2], "little", signed=True)
+                for j in range(i + 2, i + 12, 2)
+            )
+            a1, a2 = coeffs[3], coeffs[4]
+            # Poles inside the unit circle, as filter_coeffs_valid()
+            if data[i + 1] > 1 or abs(a2) >= 1 << 14 or abs(a1) >= (1 << 14) + a2:
+                return True, [self.ERR_PACKET_INVALID]
+            for channel in range(self.num_channels):
+                if data[i] & (1 << channel):
+                    self.signal_filters[channel][data[i + 1]] = coeffs
+        response = [0]
+        for channel_filters in self.signal_filters:
+            for coeffs in channel_filters:
+                for coeff in coeffs:
+                    response.extend(list(coeff.to_bytes(2, "little", signed=True)))
+        return True, response
+
+    def _handle_set_adc_config(self, data: List[int]) -> Tuple[bool, List[int]]:
+        """Handle SET_ADC_CONFIG: n x [mask][rate code][gain][mux], none to query."""
+        if len(data) % 4 != 0:
+            return True, [self.ERR_PACKET_INVALID]
+        for i in range(0, len(data), 4):
+            rate, gain, mux = data[i + 1 : i + 4]
+            if rate >= len(ADC_DATA_RATES_SPS) or gain == 6 or gain > ADC_GAIN_AUTO or mux > 7:
+                return True, [self.ERR_PACKET_INVALID]
+            for channel in range(self.num_channels):
+                if data[i] & (1 << channel):
+                    self.adc_data_rate_codes[channel] = rate
+                    self.adc_gains[channel] = gain
+                    self.adc_muxes[channel] = mux
+                    self.eeprom_committed += 1
+        response = [0]
+        for channel in range(self.num_channels):
+            gain = self.adc_gains[channel]
+            in_use = 0 if gain == ADC_GAIN_AUTO else gain
+            response += [self.adc_data_rate_codes[channel], gain, self.adc_muxes[channel], in_use]
+        return True, response
+
+    def _handle_set_profile_points(self, data: List[int]) -> Tuple[bool, List[int]]:
+        """Handle SET_PROFILE_POINTS: [chan][first index] n x [duration ms U16][value U16]."""
+        if (
+            len(data) < 6
+            or (len(data) - 2) % 4
+            or data[0] >= self.num_channels
+            or data[1] + (len(data) - 2) // 4 > PROFILE_LEN
+        ):
+            return True, [self.ERR_PACKET_INVALID]
+        channel = data[0]
+        self.profiles[channel]["active"] = 0
+        for n, i in enumerate(range(2, len(data), 4)):
+            duration = int.from_bytes(data[i : i + 2], "little", signed=False)
+            value = int.from_bytes(data[i + 2 : i + 4], "little", signed=False)
+            self.profile_points[channel][data[1] + n] = (duration, value)
+        return True, [0]
+
+    def _handle_set_profile(self, data: List[int]) -> Tuple[bool, List[int]]:
+        """Handle SET_PROFILE: n x [mask][length][flags] to start or stop, none to query."""
+        if len(data) % 3:
+            return True, [self.ERR_PACKET_INVALID]
+        for i in range(0, len(data), 3):
+            mask, length, flags = data[i : i + 3]
+            for channel in range(self.num_channels):
+                if not mask & (1 << channel):
+                    continue
+                profile = self.profiles[channel]
+                profile["active"] = 0
+                if length > PROFILE_LEN or flags & ~0x03:
+                    return True, [self.ERR_PACKET_INVALID]
+                if length == 0:
+                    continue
+                points = self.profile_points[channel][:length]
+                if None in points or (flags & 0x01 and sum(p[0] for p in points) == 0):
+                    return True, [self.ERR_PROFILE_INVALID]
+                profile.update(length=length, flags=flags, active=1, index=0, start=clock.time())
+        response = [0]
+        for channel in range(self.num_channels):
+            self._run_profile(channel)
+            profile = self.profiles[channel]
+            response.extend([profile["length"], profile["flags"], profile["active"]])
+            response.append(profile["index"])
+        return True, response
+
+    def _run_profile(self, channel: int) -> None:
+        profile = self.profiles[channel]
+        if not profile["active"]:
+            return
+        elapsed_ms = int((clock.time() - profile["start"]) * 1000)
+        index = 0
+        durations = [p[0] for p in self.profile_points[channel][: profile["length"]]]
+        loop_ms = sum(durations)
+        if profile["flags"] & 0x01:
+            elapsed_ms %= loop_ms
+        for index, duration in enumerate(durations):
+            if elapsed_ms < duration:
+                profile["index"] = index
+                return
+            elapsed_ms -= duration
+        profile["active"] = 0
+        profile["index"] = profile["length"]
+
+    def _set_pid_consts(self, table: List[List[int]], data: List[int]) -> Tuple[bool, List[int]]:
         i = 0
         while i < len(data):
             if i + 6 < len(data):
@@ -256,22 +825,312 @@ class SimulatedFlow:
                 d = int.from_bytes(data[i + 5 : i + 7], "little", signed=False)
                 for channel in range(self.num_channels):
                     if mask & (1 << channel):
-                        self.pid_consts[channel] = [p, i_val, d]
+                        table[channel] = [p, i_val, d]
+                        self.eeprom_committed += 1
                 i += 7
             else:
                 break
         return True, [0]
 
-    def _handle_get_fpid_consts(self, data: List[int]) -> Tuple[bool, List[int]]:
-        """Handle GET_FPID_CONSTS packet."""
+    def _get_pid_consts(self, table: List[List[int]]) -> Tuple[bool, List[int]]:
         response = [0]
         for channel in range(self.num_channels):
-            p, i_val, d = self.pid_consts[channel]
+            p, i_val, d = table[channel]
             response.extend(list(p.to_bytes(2, "little", signed=False)))
             response.extend(list(i_val.to_bytes(2, "little", signed=False)))
             response.extend(list(d.to_bytes(2, "little", signed=False)))
         return True, response
 
+    def _handle_get_spi_stats(self, data: List[int]) -> Tuple[bool, List[int]]:
+        """Handle GET_SPI_STATS packet. Counters never move in simulation."""
+        response = [0]
+        for value in self.SPI_BUF_SIZES + (0,) * 6:
+            response.extend(list(value.to_bytes(2, "little", signed=False)))
+        return True, response
+
+    def _handle_get_probe_stats(self, data: List[int]) -> Tuple[bool, List[int]]:
+        """Handle GET_PROBE_STATS packet. No code is timed in simulation, so no samples or load."""
+        if len(data) > 1:
+            return True, [self.ERR_PACKET_INVALID]
+        response = [0] + list(self.PROBE_TIMER_HZ.to_bytes(4, "little")) + [self.PROBE_COUNT]
+        return True, response + [0] * (10 * self.PROBE_COUNT + 16)
+
+    def _handle_get_eeprom_status(self, data: List[int]) -> Tuple[bool, List[int]]:
+        """Handle GET_EEPROM_STATUS packet. Nothing is ever pending in simulation."""
+        if len(data) > 1:
+            return True, [self.ERR_PACKET_INVALID]
+        response = [0, 0, 0] + list((self.eeprom_committed & 0xFFFF).to_bytes(2, "little"))
+        if data and data[0]:
+            self.eeprom_committed = 0
+        return True, response + [0, 0, 0, 0]
+
+    def _handle_protocol(self, data: List[int]) -> Tuple[bool, List[int]]:
+        """Handle the rio_spi protocol query: [err][version 2][CRC-16]."""
+        return True, [0, 2, 2]
+
+    def _handle_batch(self, data: List[int]) -> Tuple[bool, List[int]]:
+        """Handle BATCH packet: n * [type][size][data...] -> [err] n * [type][size][reply...].
+
+        A leading [0][1][address] runs it only for this module_addr, see the firmware.
+        """
+        commands = []
+        index = 0
+        response = [0]
+        if list(data[:2]) == [0, 1] and len(data) >= 3:
+            if self.module_addr != 0xFF and data[2] not in (0xFF, self.module_addr):
+                return True, [self.ERR_MODULE_ADDRESS]
+            index = 3
+            response.extend([0, 1, self.module_addr])
+        while index < len(data):
+            if index + 2 > len(data) or index + 2 + data[index + 1] > len(data):
+                return True, [self.ERR_PACKET_INVALID]
+            type_, size = data[index], data[index + 1]
+            if type_ in (0, self.PACKET_TYPE_BATCH):
+                return True, [self.ERR_PACKET_INVALID]
+            commands.append((type_, data[index + 2 : index + 2 + size]))
+            index += 2 + size
+
+        handlers = self._handlers()
+        for type_, sub_data in commands:
+            handler = handlers.get(type_)
+            valid, reply = handler(sub_data) if handler else (False, [])
+            if not valid:
+                reply = [self.ERR_PACKET_INVALID]
+            response.extend([type_, len(reply)] + reply)
+        if len(response) > self.SPI_BUF_SIZES[2]:
+            return True, [self.ERR_SPI_WRITE_OVERFLOW]
+        return True, response
+
+    def _handle_get_status_snapshot(self, data: List[int]) -> Tuple[bool, List[int]]:
+        """Handle GET_STATUS_SNAPSHOT packet. Each call runs one simulated control cycle."""
+        self.snapshot_seq = (self.snapshot_seq + 1) & 0xFFFF
+        time_us = self.timebase.now_us()
+        frame = self._next_frame()
+        for channel in range(self.num_channels):
+            self.pressure_actuals[channel] += random.uniform(-5, 5)
+            self.pressure_actuals[channel] = max(0, min(self.pressure_actuals[channel], 6000))
+            self.flow_actuals[channel] += random.uniform(-2, 2)
+            self.flow_actuals[channel] = max(0, min(self.flow_actuals[channel], 1000))
+        pressure_targets = [int(p * self.PRESSURE_SCALE) for p in self.pressure_targets]
+        flow_states = [
+            (
+                self.FLOW_CTRL_STATE_RUNNING
+                if mode in (self.MODE_FLOW_CLOSED_LOOP, self.MODE_FLOW_CASCADE)
+                else self.FLOW_CTRL_STATE_READY
+            )
+            for mode in self.control_modes
+        ]
+        return True, self._encode(
+            pressure_protocol.STATUS_SNAPSHOT_REPLY,
+            seq=self.snapshot_seq,
+            time_us=time_us,
+            frame=frame,
+            pressure_actual=[int(p * self.PRESSURE_SCALE) for p in self.pressure_actuals],
+            pressure_output=pressure_targets,  # Output follows the target in simulation
+            pressure_target=pressure_targets,
+            flow_actual=[int(flow) for flow in self.flow_actuals],
+            flow_target=[int(flow) for flow in self.flow_targets],
+            control_mode=list(self.control_modes),
+            flow_ctrl_state=flow_states,
+        )
+
+    def _encode(self, layout, rc=0, **values) -> List[int]:
+        """Reply of a protocol.json layout, rc first for the replies that have one."""
+        if any(name == "rc" for name, _, _ in layout.fields):
+            values["rc"] = rc
+        return list(layout.encode(values, self.num_channels))
+
+    def _handle_set_telemetry(self, data: List[int]) -> Tuple[bool, List[int]]:
+        """Handle SET_TELEMETRY packet: [period cycles][format, optional] -> [err][dropped U16]."""
+        if len(data) not in (1, 2) or data[1:] not in ([], [0], [1]):
+            return True, [self.ERR_PACKET_INVALID]
+        dropped = min(self.telemetry_dropped, 0xFFFF)
+        self.telemetry_period = data[0]
+        self.telemetry_time = clock.time()
+        self.telemetry_dropped = 0
+        self.telemetry_compact = data[1:] == [1]
+        self.telemetry_prev = None
+        return True, [0] + list(dropped.to_bytes(2, "little", signed=False))
+
+    def read_telemetry(self) -> List[List[int]]:
+        """
+        Return the TELEMETRY_SAMPLE payloads streamed since the last read, or the
+        TELEMETRY_COMPACT ones if SET_TELEMETRY asked for them.
+        """
+        if not self.telemetry_period:
+            return []
+        now = clock.time()
+        count = int((now - self.telemetry_time) / (self.control_cycle_s * self.telemetry_period))
+        self.telemetry_time += count * self.control_cycle_s * self.telemetry_period
+        # The firmware drops samples that do not fit its write ring
+        records = []
+        sample_s = self.control_cycle_s * self.telemetry_period
+        for i in range(min(count, TELEMETRY_QUEUE_SAMPLES)):
+            self.snapshot_seq = (self.snapshot_seq + self.telemetry_period) & 0xFFFF
+            age_s = now - self.telemetry_time + (count - 1 - i) * sample_s
+            record = self._encode(
+                pressure_protocol.TELEMETRY_SAMPLE,
+                seq=self.snapshot_seq,
+                time_us=self.timebase.now_us(age_s),
+                frame=self._next_frame(),
+                pressure_actual=[int(p * self.PRESSURE_SCALE) for p in self.pressure_actuals],
+                flow_actual=[int(flow) for flow in self.flow_actuals],
+            )
+            records.append(self._telemetry_record(record))
+        # The firmware drops samples that do not fit its write ring, they show as a seq gap
+        dropped = max(0, count - TELEMETRY_QUEUE_SAMPLES)
+        if dropped:
+            self.telemetry_prev = None
+        self.telemetry_dropped += dropped
+        self.snapshot_seq = (self.snapshot_seq + self.telemetry_period * dropped) & 0xFFFF
+        for _ in range(dropped):
+            self._next_frame()
+        return records
+
+    def read_reports(self) -> List[List[int]]:
+        """
+        Return the REPORT payload of the subscribed signals past their deadband or interval
+        since the last read, as the firmware's push_reports() would have queued by now.
+        """
+        if not self.reports.active():
+            return []
+        values = [int(p * self.PRESSURE_SCALE) for p in self.pressure_actuals]
+        values += [max(-0x8000, min(0x7FFF, int(flow))) for flow in self.flow_actuals]
+        payload = self.reports.poll(values)
+        return [payload] if payload else []
+
+    def _telemetry_record(self, record: List[int]) -> List[int]:
+        if not self.telemetry_compact:
+            return record
+        # A keyframe every TELEMETRY_KEY_EVERY samples, as main.c push_telemetry()
+        if self.telemetry_since_key >= TELEMETRY_KEY_EVERY:
+            self.telemetry_prev = None
+        words = record_words(record, "little")
+        compact = delta_encode(words, self.telemetry_prev)
+        if self.telemetry_prev is None:
+            self.telemetry_since_key = 0
+        self.telemetry_since_key += 1
+        self.telemetry_prev = words
+        return compact
+
+    def _handle_set_frame_sync(self, data: List[int]) -> Tuple[bool, List[int]]:
+        """Handle SET_FRAME_SYNC packet: none or [mode][divider] -> [err][mode][divider][frames U32][missed U16]."""
+        if data:
+            if len(data) != 2 or data[0] > 2 or data[1] == 0:
+                return True, [self.ERR_PACKET_INVALID]
+            self.frame_sync_mode, self.frame_sync_divider = data
+            self.frame_sync_frames = 0
+        return True, (
+            [0, self.frame_sync_mode, self.frame_sync_divider]
+            + list(self.frame_sync_frames.to_bytes(4, "little"))
+            + [0, 0]
+        )
+
+    def _next_frame(self) -> int:
+        """Frame tag of the next simulated cycle, 0 when it runs on the timer."""
+        if not self.frame_sync_mode:
+            return 0
+        self.frame_sync_frames = (self.frame_sync_frames + self.frame_sync_divider) & 0xFFFFFFFF
+        return self.frame_sync_frames
+
+    def _run_history(self) -> None:
+        """Add one history record per control cycle elapsed since the last call."""
+        now = clock.time()
+        count = int((now - self.history_time) / self.control_cycle_s)
+        self.history_time += count * self.control_cycle_s
+        self.history_seq = (self.history_seq + max(0, count - HISTORY_LEN)) & 0xFFFF
+        for i in range(min(count, HISTORY_LEN), 0, -1):
+            self.history_seq = (self.history_seq + 1) & 0xFFFF
+            age_s = now - self.history_time + (i - 1) * self.control_cycle_s
+            record = self._encode(
+                pressure_protocol.HISTORY_RECORD,
+                seq=self.history_seq,
+                time_us=self.timebase.now_us(age_s),
+                pressure_actual=[int(p * self.PRESSURE_SCALE) for p in self.pressure_actuals],
+                pressure_output=[int(p * self.PRESSURE_SCALE) for p in self.pressure_targets],
+                flow_actual=[int(flow) for flow in self.flow_actuals],
+                pid_terms=[[0, 0, 0]] * self.num_channels,  # No PID terms in simulation
+            )
+            self.history.append(record)
+        del self.history[:-HISTORY_LEN]
+
+    def _handle_get_history(self, data: List[int]) -> Tuple[bool, List[int]]:
+        """Handle GET_HISTORY packet: [start seq U16][max] -> [err][oldest][newest][count]..."""
+        if len(data) != 3:
+            return True, [self.ERR_PACKET_INVALID]
+        self._run_history()
+        newest = self.history_seq
+        oldest = (newest - len(self.history) + 1) & 0xFFFF
+        start = int.from_bytes(data[0:2], "little", signed=False)
+        if (start - oldest) & 0x8000:
+            start = oldest
+        behind = (newest - start) & 0xFFFF
+        count = 0 if behind & 0x8000 else min(behind + 1, data[2], HISTORY_REPLY_MAX)
+        first = len(self.history) - 1 - behind
+        response = [0] + list(oldest.to_bytes(2, "little")) + list(newest.to_bytes(2, "little"))
+        response.append(count)
+        for record in self.history[first : first + count]:
+            response.extend(record)
+        return True, response
+
+    def stream_query(self, type_: int, data: List[int]):
+        """
+        Chunk payloads of a streamed reply, see stream_simulated, or None if type_ is not
+        streamed. HISTORY_STREAM: [start seq U16][max records U16][format U8], format optional.
+        """
+        if type_ != self.PACKET_TYPE_HISTORY_STREAM:
+            return None
+        if len(data) not in (4, 5) or data[4:] not in ([], [0], [1]):
+            return [[self.ERR_PACKET_INVALID]]
+        self._run_history()
+        newest = self.history_seq
+        oldest = (newest - len(self.history) + 1) & 0xFFFF
+        start = int.from_bytes(data[0:2], "little", signed=False)
+        if (start - oldest) & 0x8000:
+            start = oldest
+        behind = (newest - start) & 0xFFFF
+        count = 0
+        if self.history and not behind & 0x8000:
+            count = min(behind + 1, int.from_bytes(data[2:4], "little", signed=False))
+        first = len(self.history) - 1 - behind
+        if data[4:] == [1]:
+            return compact_stream_chunks(self.history[first : first + count], "little")
+        return stream_chunks(self.history[first : first + count])
+
+    def _handle_set_loop_config(self, data: List[int]) -> Tuple[bool, List[int]]:
+        """Handle SET_LOOP_CONFIG packet: [period ms U16] n * [rate code], or none to query."""
+        if len(data) == 2 + self.num_channels:
+            period_ms = int.from_bytes(data[0:2], "little", signed=False)
+            if period_ms < 5 or any(code >= len(ADC_DATA_RATES_SPS) for code in data[2:]):
+                return True, [self.ERR_PACKET_INVALID]
+            self.control_cycle_s = period_ms / 1000
+            self.adc_data_rate_codes = list(data[2:])
+        elif data:
+            return True, [self.ERR_PACKET_INVALID]
+        period_ms = int(round(self.control_cycle_s * 1000))
+        return True, [0] + list(period_ms.to_bytes(2, "little")) + self.adc_data_rate_codes
+
+    def _busy_ms(self) -> int:
+        """Simulated ADC cycle time: a burst of conversions per channel plus the flow reads."""
+        rates = zip(self.adc_data_rate_codes, self.adc_bursts)
+        conversions_s = sum(burst / ADC_DATA_RATES_SPS[code] for code, burst in rates)
+        return int(conversions_s * 1000) + 3
+
+    def _handle_get_loop_stats(self, data: List[int]) -> Tuple[bool, List[int]]:
+        """Handle GET_LOOP_STATS packet: [reset] optional -> [err][cycles U32] 5 * [U16]."""
+        if len(data) > 1:
+            return True, [self.ERR_PACKET_INVALID]
+        period_ms = int(round(self.control_cycle_s * 1000))
+        busy_ms = self._busy_ms()
+        cycles = int((clock.time() - self.loop_stats_time) / self.control_cycle_s)
+        overruns = cycles if busy_ms >= period_ms else 0
+        response = [0] + list(cycles.to_bytes(4, "little"))
+        for value in (min(overruns, 0xFFFF), period_ms, period_ms, busy_ms, busy_ms):
+            response.extend(list(value.to_bytes(2, "little")))
+        if data and data[0]:
+            self.loop_stats_time = clock.time()
+        return True, response
+
     # Convenience methods (matching PiFlow interface)
     def get_id(self) -> Tuple[bool, str]:
         """Get device ID."""
@@ -7,6 +7,24 @@ Provides responses for heater SPI commands to support simulation mode.
 import logging
 from typing import List, Tuple
 
+from . import clock_simulated as clock
+from .caps_simulated import capabilities_report
+from .fault_simulated import SimulatedFaultLog
+from .param_simulated import (
+    PARAM_FLAG_READ_ONLY,
+    PARAM_FLAG_STORED,
+    PARAM_TYPE_I16,
+    PARAM_TYPE_U8,
+    PARAM_TYPE_U16,
+    SimulatedParam,
+    SimulatedParams,
+)
+from .flash_simulated import SimulatedFlash
+from .report_simulated import SimulatedReports
+from .stage_simulated import SimulatedStage
+from .stream_simulated import compact_stream_chunks, stream_chunks
+from .time_simulated import SimulatedTimebase
+
 logger = logging.getLogger(__name__)
 
 
@@ -28,6 +46,74 @@ class SimulatedHeater:
     PACKET_TYPE_STIR_SPEED_GET_ACTUAL = 14
     PACKET_TYPE_HEAT_POWER_LIMIT_SET = 15
     PACKET_TYPE_HEAT_POWER_LIMIT_GET = 16
+    PACKET_TYPE_GET_SPI_STATS = 17
+    PACKET_TYPE_BATCH = 18
+    PACKET_TYPE_GET_PROBE_STATS = 19
+    PACKET_TYPE_GET_TASK_STATS = 20
+    PACKET_TYPE_PID_MODEL = 21
+    PACKET_TYPE_PROFILE_SET_SEGMENT = 22
+    PACKET_TYPE_PROFILE_SET_RUNNING = 23
+    PACKET_TYPE_GET_HISTORY = 24
+    PACKET_TYPE_ADC_FILTER = 25
+    PACKET_TYPE_GET_EEPROM_STATUS = 26
+    PACKET_TYPE_PARAM_LIST = 27
+    PACKET_TYPE_PARAM_GET_MANY = 28
+    PACKET_TYPE_PARAM_SET_MANY = 29
+    PACKET_TYPE_GET_FAULT_LOG = 30
+    PACKET_TYPE_ECHO = 31
+    PACKET_TYPE_SYNC_TIME = 32
+    PACKET_TYPE_STAGE = 33
+    PACKET_TYPE_GET_CAPABILITIES = 34
+    PACKET_TYPE_GET_BOOT_STATUS = 35
+    PACKET_TYPE_GET_LATENCY_STATS = 36
+    PACKET_TYPE_HISTORY_STREAM = 37
+    PACKET_TYPE_HEATER_ZONE = 39
+    PACKET_TYPE_SUBSCRIBE = 40
+    PACKET_TYPE_REPORT = 41
+    PACKET_TYPE_FLASH = 42
+
+    # Firmware error codes used in replies
+    ERR_SPI_WRITE_OVERFLOW = 20
+    ERR_PACKET_INVALID = 31
+    ERR_PACKET_PID_INVALID = 33
+    ERR_MODULE_ADDRESS = 34
+    ERR_HEAT_PID_NOT_READY = 41
+    ERR_HEAT_AUTOTUNE_ACTIVE = 42
+    ERR_HEAT_PROFILE_INVALID = 44
+    ERR_HEAT_PROFILE_ACTIVE = 45
+    ERR_HEAT_TARGET_INVALID = 40
+    ERR_HEAT_ADC_CONFIG_INVALID = 46
+    ERR_HEAT_ZONE_INVALID = 47
+
+    # Zones past zone 0, as a board built with HEATER_ZONES 2, and E_HPID_STATE
+    ZONES = 1
+    ZONE_STATE_UNCONFIGURED = 0
+    ZONE_STATE_READY = 1
+    ZONE_STATE_RUNNING = 2
+
+    PROFILE_SEGMENTS_MAX = 16
+    PROFILE_STATE_IDLE = 0
+    PROFILE_STATE_RAMP = 1
+    PROFILE_STATE_HOLD = 3
+
+    # Firmware SPI buffer sizes (read ring, write ring, packet)
+    SPI_BUF_SIZES = (256, 256, 128)
+
+    # Firmware probe timer rate and number of probes (probe_port.h)
+    PROBE_TIMER_HZ = 1000000
+    PROBE_COUNT = 4
+
+    # Firmware control tasks (main.c TASK_COUNT)
+    TASK_COUNT = 2
+
+    # Load currents at full duty (board_config.h), for the supply budget
+    HEATER_CURRENT_MA = 7273
+    STIR_CURRENT_MA = 150
+
+    # Firmware history ring (main.c HISTORY_*), one record per heater period
+    HISTORY_LEN = 128
+    HISTORY_REPLY_MAX = 10
+    HEATER_PERIOD_S = 0.1
 
     def __init__(self, device_port: int, reply_pause_s: float = 0.05):
         self.device_port = device_port
@@ -38,16 +124,297 @@ class SimulatedHeater:
         self.pid_i = 0
         self.pid_d = 0
         self.pid_running = False
+        self.model_flags = 0
+        self.eeprom_committed = 0  # EEPROM writes, committed at once in simulation
+        self.adc_config = [7, 0, 4]  # Oversampling code, mode, IIR shift
+        # GET_HISTORY ring, filled from elapsed time
+        self.history = []
+        self.history_seq = 0
+        self.history_time = clock.time()
+        self.profile_segments = {}
+        self.profile_state = self.PROFILE_STATE_IDLE
+        self.profile_length = 0
+        self.model_sp_weight_pc = 100
         self.autotune_running = False
         self.autotune_status = 0
         self.autotune_fail = 0
         self.stir_running = False
         self.stir_speed_rps = 0
         self.heat_power_limit_pc = 100
+        self.autotune_target_scaled = 5000
+        self.run_on_start = 0
+        self.stir_accel_rps_s = 5
+        self.warm_start = 1  # The simulated PID has no integrator to warm start
+        self.pwm_hires = 1  # Nor a PWM to quantize its output
+        self.module_addr = 0xFF  # Addressed BATCHes, 0xFF (blank EEPROM) answers every address
+        self.stir_period_ms = 10  # The stirrer task's own period
+        self.supply_budget_ma = 0  # No budget, the heater has its power limit alone
+        self.observer_shift = 0  # The simulated reading has no lag, the observer tracks it
+        self.trace_mask = 0x02  # Trace pin regions, the ADC interrupt from reset; no pin to drive
+        # HEATER_ZONE: state, target and gains of each zone; it reads its target while running
+        self.zones = [
+            {"state": self.ZONE_STATE_UNCONFIGURED, "target": 2500, "pid": (0, 0, 0)}
+            for _ in range(self.ZONES)
+        ]
+        self.params = SimulatedParams(self._param_table())
+        self.faults = SimulatedFaultLog()
+        self.timebase = SimulatedTimebase()
+        self.stage = SimulatedStage(
+            self.timebase, self.packet_query, self.PACKET_TYPE_BATCH, self.PACKET_TYPE_STAGE
+        )
+        # SUBSCRIBE signals: temperature, stir speed, then each zone, see read_reports()
+        self.reports = SimulatedReports(self.timebase, 2 + self.ZONES)
+        self.flash = SimulatedFlash()
 
     def _status_ok(self) -> List[int]:
         return [0]
 
+    def _param_table(self) -> List[SimulatedParam]:
+        """Firmware params[] in main.c order; stored values count as one EEPROM write."""
+
+        def attr(name, stored=False, scale=1):
+            def set_(value):
+                setattr(self, name, value / scale if scale != 1 else value)
+                if stored:
+                    self.eeprom_committed += 1
+
+            return (lambda: int(round(getattr(self, name) * scale))), set_
+
+        def adc(index):
+            def set_(value):
+                self.adc_config[index] = value
+
+            return (lambda: self.adc_config[index]), set_
+
+        stored, ro = PARAM_FLAG_STORED, PARAM_FLAG_READ_ONLY
+        u8, u16, i16 = PARAM_TYPE_U8, PARAM_TYPE_U16, PARAM_TYPE_I16
+        return [
+            SimulatedParam(1, u16, stored, 0, 0xFFFE, *attr("pid_p", True)),
+            SimulatedParam(2, u16, stored, 0, 0xFFFE, *attr("pid_i", True)),
+            SimulatedParam(3, u16, stored, 0, 0xFFFE, *attr("pid_d", True)),
+            SimulatedParam(4, i16, stored, 0, 8000, *attr("temp_c", True, 100)),
+            SimulatedParam(5, i16, stored, 0, 8000, *attr("autotune_target_scaled", True)),
+            SimulatedParam(6, u8, stored, 0, 100, *attr("heat_power_limit_pc", True)),
+            SimulatedParam(7, u8, stored, 0, 1, *attr("run_on_start", True)),
+            SimulatedParam(8, u8, stored, 0, 3, *attr("model_flags", True)),
+            SimulatedParam(9, u8, stored, 0, 100, *attr("model_sp_weight_pc", True)),
+            SimulatedParam(10, u8, 0, 0, 255, *attr("stir_accel_rps_s")),
+            SimulatedParam(11, u8, 0, 0, 7, *adc(0)),
+            SimulatedParam(12, u8, 0, 0, 1, *adc(1)),
+            SimulatedParam(13, u8, 0, 0, 8, *adc(2)),
+            SimulatedParam(14, u8, 0, 0, 1, *attr("warm_start")),
+            SimulatedParam(15, u8, 0, 0, 1, *attr("pwm_hires")),
+            SimulatedParam(16, u8, stored, 0, 0xFF, *attr("module_addr", True)),
+            SimulatedParam(17, u8, 0, 2, 100, *attr("stir_period_ms")),
+            SimulatedParam(18, u16, stored, 0, 0xFFFE, *attr("supply_budget_ma", True)),
+            SimulatedParam(19, u8, 0, 0, 10, *attr("observer_shift")),
+            SimulatedParam(20, u16, 0, 0, 0x7F, *attr("trace_mask")),
+            SimulatedParam(32, i16, ro, -32768, 32767, *attr("temp_c", scale=100)),
+            SimulatedParam(33, u16, ro, 0, 0xFFFF, *attr("stir_speed_rps")),
+            SimulatedParam(34, u16, ro, 0, 0xFFFF, self._heater_output_cap),
+            SimulatedParam(35, i16, ro, -32768, 32767, attr("temp_c", scale=100)[0]),
+        ]
+
+    def _heater_output_cap(self) -> int:
+        # board_config.h currents; the simulated stirrer draws its full current while running
+        cap = 0xFFFF * self.heat_power_limit_pc // 100
+        if self.supply_budget_ma:
+            left_ma = self.supply_budget_ma - (self.STIR_CURRENT_MA if self.stir_running else 0)
+            cap = min(cap, max(left_ma, 0) * 0xFFFF // self.HEATER_CURRENT_MA)
+        return cap
+
+    def _run_history(self) -> None:
+        # One record per heater period elapsed since the last call
+        now = clock.time()
+        count = int((now - self.history_time) / self.HEATER_PERIOD_S)
+        self.history_time += count * self.HEATER_PERIOD_S
+        skipped = max(0, count - self.HISTORY_LEN)
+        self.history_seq = (self.history_seq + skipped) & 0xFFFF
+        temp = int(self.temp_c * 100).to_bytes(2, "big", signed=True)
+        flags = (0x01 if self.pid_running else 0) | (0x08 if self.stir_running else 0)
+        stir_rps = self.stir_speed_rps if self.stir_running else 0
+        for i in range(count - skipped, 0, -1):
+            age_s = now - self.history_time + (i - 1) * self.HEATER_PERIOD_S
+            record = list(self.history_seq.to_bytes(2, "big"))
+            record += list(self.timebase.now_us(age_s).to_bytes(4, "big"))
+            record += list(temp) + list(temp)
+            record += [0] * 8  # No heater output or PID terms in simulation
+            record += list(stir_rps.to_bytes(2, "big")) + [0, flags]
+            self.history.append(record)
+            self.history_seq = (self.history_seq + 1) & 0xFFFF
+        del self.history[: -self.HISTORY_LEN]
+
+    def _get_history(self, data: List[int]) -> List[int]:
+        if len(data) != 3:
+            return [self.ERR_PACKET_INVALID]
+        self._run_history()
+        newest = (self.history_seq - 1) & 0xFFFF
+        oldest = (self.history_seq - len(self.history)) & 0xFFFF
+        start = int.from_bytes(data[0:2], "little", signed=False)
+        if (start - oldest) & 0x8000:
+            start = oldest
+        behind = (newest - start) & 0xFFFF
+        count = 0
+        if self.history and not behind & 0x8000:
+            count = min(behind + 1, data[2], self.HISTORY_REPLY_MAX)
+        first = len(self.history) - 1 - behind
+        response = [0] + list(oldest.to_bytes(2, "big")) + list(newest.to_bytes(2, "big"))
+        response.append(count)
+        for record in self.history[first : first + count]:
+            response.extend(record)
+        return response
+
+    def read_reports(self) -> List[List[int]]:
+        """
+        Return the REPORT payload of the subscribed signals past their deadband or interval
+        since the last read, as the firmware's push_reports() would have queued by now.
+        """
+        if not self.reports.active():
+            return []
+        stir_rps = self.stir_speed_rps if self.stir_running else 0
+        values = [int(self.temp_c * 100), stir_rps]
+        for zone in self.zones:
+            values.append(zone["target"] if zone["state"] == self.ZONE_STATE_RUNNING else 2500)
+        payload = self.reports.poll(values)
+        return [payload] if payload else []
+
+    def stream_query(self, packet_type: int, data: List[int]):
+        """
+        Chunk payloads of a streamed reply, see stream_simulated, or None if packet_type is
+        not streamed. HISTORY_STREAM: [start seq U16][max records U16][format U8], format
+        optional.
+        """
+        if packet_type != self.PACKET_TYPE_HISTORY_STREAM:
+            return None
+        if len(data) not in (4, 5) or data[4:] not in ([], [0], [1]):
+            return [[self.ERR_PACKET_INVALID]]
+        self._run_history()
+        newest = (self.history_seq - 1) & 0xFFFF
+        oldest = (self.history_seq - len(self.history)) & 0xFFFF
+        start = int.from_bytes(data[0:2], "little", signed=False)
+        if (start - oldest) & 0x8000:
+            start = oldest
+        behind = (newest - start) & 0xFFFF
+        count = 0
+        if self.history and not behind & 0x8000:
+            count = min(behind + 1, int.from_bytes(data[2:4], "little", signed=False))
+        first = len(self.history) - 1 - behind
+        if data[4:] == [1]:
+            return compact_stream_chunks(self.history[first : first + count], "big")
+        return stream_chunks(self.history[first : first + count])
+
+    def _profile_active(self) -> bool:
+        return self.PROFILE_STATE_RAMP <= self.profile_state <= self.PROFILE_STATE_HOLD
+
+    def _profile_set_running(self, data: List[int]) -> List[int]:
+        # The profile is not executed in simulation: once started it stays on its first ramp
+        if len(data) == 1 and data[0] == 0:
+            if self._profile_active():
+                self.profile_state = self.PROFILE_STATE_IDLE
+        elif len(data) == 2 and data[0] > 0:
+            length = data[0]
+            if length > self.PROFILE_SEGMENTS_MAX or any(
+                i not in self.profile_segments for i in range(length)
+            ):
+                return [self.ERR_HEAT_PROFILE_INVALID]
+            if self.autotune_running:
+                return [self.ERR_HEAT_AUTOTUNE_ACTIVE]
+            if not self.pid_running:
+                return [self.ERR_HEAT_PID_NOT_READY]
+            self.profile_state = self.PROFILE_STATE_RAMP
+            self.profile_length = length
+        elif len(data) != 0:
+            return [self.ERR_PACKET_INVALID]
+        setpoint = int(self.temp_c * 100).to_bytes(2, "big", signed=True)
+        hold_s = [0, 0]
+        if self._profile_active():
+            hold_s = self.profile_segments[0][4:6][::-1]
+        return [0, self.profile_state, 0, self.profile_length, 0, 0] + list(setpoint) + hold_s
+
+    def _adc_filter(self, data: List[int]) -> List[int]:
+        """ADC_FILTER: quantisation noise only, at about 2 mdegC per 16-bit count"""
+        if len(data) == 3:
+            if data[0] > 7 or data[1] > 1 or data[2] > 8:
+                return [self.ERR_HEAT_ADC_CONFIG_INVALID]
+            self.adc_config = list(data)
+        elif len(data) != 0:
+            return [self.ERR_PACKET_INVALID]
+        oversampling, mode, shift = self.adc_config
+        bits = 12 if mode == 1 else 13 + (oversampling & 3)
+        raw_counts = (1 << (16 - bits)) / 12**0.5
+        alpha = 1 / (1 << shift)
+        raw_mc = raw_counts * 2
+        filt_mc = raw_mc * (alpha / (2 - alpha)) ** 0.5
+        reply = [0, oversampling, mode, shift, bits]
+        for value in (raw_counts * 16, raw_mc, filt_mc):
+            reply.extend(list(int(value).to_bytes(2, "big")))
+        return reply
+
+    def _heater_zone(self, data: List[int]) -> List[int]:
+        """HEATER_ZONE of main.c: checked whole, then applied, then the zone reported."""
+        if len(data) not in (1, 4, 10):
+            return [self.ERR_PACKET_INVALID]
+        if not 1 <= data[0] <= self.ZONES:
+            return [self.ERR_HEAT_ZONE_INVALID]
+        zone = self.zones[data[0] - 1]
+        if len(data) >= 4:
+            target = int.from_bytes(data[2:4], "little", signed=True)
+            if not 0 <= target <= 8000:
+                return [self.ERR_HEAT_TARGET_INVALID]
+            pid = zone["pid"]
+            if len(data) == 10:
+                pid = tuple(int.from_bytes(data[i : i + 2], "little") for i in (4, 6, 8))
+                if 0xFFFF in pid:
+                    return [self.ERR_PACKET_PID_INVALID]
+            configured = len(data) == 10 or zone["state"] != self.ZONE_STATE_UNCONFIGURED
+            if data[1] and not configured:
+                return [self.ERR_HEAT_PID_NOT_READY]
+            zone["pid"], zone["target"] = pid, target
+            if data[1]:
+                zone["state"] = self.ZONE_STATE_RUNNING
+            elif configured:
+                zone["state"] = self.ZONE_STATE_READY
+        running = zone["state"] == self.ZONE_STATE_RUNNING
+        temp = zone["target"] if running else 2500
+        output = 0x8000 if running else 0
+        reply = [0, data[0], zone["state"], 0, 1]
+        for value, signed in ((zone["target"], True), (temp, True), (output, False)):
+            reply.extend(value.to_bytes(2, "big", signed=signed))
+        for gain in zone["pid"]:
+            reply.extend(gain.to_bytes(2, "big"))
+        return reply
+
+    def _batch(self, data: List[int]) -> List[int]:
+        """BATCH payload n * [type][size][data...] -> [err] n * [type][size][reply...].
+
+        A leading [0][1][address] runs it only for this module_addr, see the firmware.
+        """
+        commands = []
+        index = 0
+        payload = [0]
+        if list(data[:2]) == [0, 1] and len(data) >= 3:
+            if self.module_addr != 0xFF and data[2] not in (0xFF, self.module_addr):
+                return [self.ERR_MODULE_ADDRESS]
+            index = 3
+            payload.extend([0, 1, self.module_addr])
+        while index < len(data):
+            if index + 2 > len(data) or index + 2 + data[index + 1] > len(data):
+                return [self.ERR_PACKET_INVALID]
+            packet_type, size = data[index], data[index + 1]
+            if packet_type in (0, self.PACKET_TYPE_BATCH):
+                return [self.ERR_PACKET_INVALID]
+            commands.append((packet_type, data[index + 2 : index + 2 + size]))
+            index += 2 + size
+
+        for packet_type, sub_data in commands:
+            valid, reply = self.packet_query(packet_type, sub_data)
+            if not valid:
+                reply = [self.ERR_PACKET_INVALID]
+            payload.extend([packet_type, len(reply)] + reply)
+        if len(payload) > self.SPI_BUF_SIZES[2]:
+            return [self.ERR_SPI_WRITE_OVERFLOW]
+        return payload
+
     def packet_query(  # noqa: C901
         self, packet_type: int, data: List[int]
     ) -> Tuple[bool, List[int]]:
@@ -58,6 +425,8 @@ class SimulatedHeater:
             (valid, response_data)
             response_data is the payload (without STX/size/type/checksum)
         """
+        # Staged packets whose time has come, ahead of this one
+        self.stage.poll()
         try:
             if packet_type == self.PACKET_TYPE_GET_ID:
                 payload = [0]
@@ -88,6 +457,7 @@ class SimulatedHeater:
                     self.pid_p = int.from_bytes(data[0:2], "little", signed=False)
                     self.pid_i = int.from_bytes(data[2:4], "little", signed=False)
                     self.pid_d = int.from_bytes(data[4:6], "little", signed=False)
+                    self.eeprom_committed += 1
                 return True, self._status_ok()
 
             if packet_type == self.PACKET_TYPE_PID_GET_COEFFS:
@@ -125,7 +495,8 @@ class SimulatedHeater:
                 return True, [0, 1 if self.autotune_running else 0]
 
             if packet_type == self.PACKET_TYPE_AUTOTUNE_GET_STATUS:
-                return True, [0, self.autotune_status, self.autotune_fail]
+                # Estimated time remaining U16 big endian, 0 when not running
+                return True, [0, self.autotune_status, self.autotune_fail, 0, 0]
 
             if packet_type == self.PACKET_TYPE_STIR_SET_RUNNING:
                 if len(data) >= 3:
@@ -135,7 +506,9 @@ class SimulatedHeater:
 
             if packet_type == self.PACKET_TYPE_STIR_GET_STATUS:
                 stir_status = 1 if self.stir_running else 0
-                return True, [0, stir_status]
+                # Soft start phase ramp and no stalls; the setpoint is reached at once
+                setpoint = self.stir_speed_rps if self.stir_running else 0
+                return True, [0, stir_status, 1, 0] + list(setpoint.to_bytes(2, "big"))
 
             if packet_type == self.PACKET_TYPE_STIR_SPEED_GET_ACTUAL:
                 speed_bytes = self.stir_speed_rps.to_bytes(2, "big", signed=False)
@@ -149,6 +522,113 @@ class SimulatedHeater:
             if packet_type == self.PACKET_TYPE_HEAT_POWER_LIMIT_GET:
                 return True, [0, self.heat_power_limit_pc]
 
+            if packet_type == self.PACKET_TYPE_GET_SPI_STATS:
+                # Sizes, then counters that never move in simulation
+                payload = [0]
+                for value in self.SPI_BUF_SIZES + (0,) * 6:
+                    payload.extend(list(value.to_bytes(2, "little", signed=False)))
+                return True, payload
+
+            if packet_type == self.PACKET_TYPE_GET_PROBE_STATS:
+                # No code is timed in simulation, so no samples or load
+                payload = [0] + list(self.PROBE_TIMER_HZ.to_bytes(4, "little"))
+                return True, payload + [self.PROBE_COUNT] + [0] * (10 * self.PROBE_COUNT + 16)
+
+            if packet_type == self.PACKET_TYPE_GET_TASK_STATS:
+                # No tasks are scheduled in simulation, so nothing run or missed
+                return True, [0, self.TASK_COUNT] + [0] * (6 * self.TASK_COUNT)
+
+            if packet_type == self.PACKET_TYPE_PID_MODEL:
+                if len(data) == 2:
+                    if data[1] > 100:
+                        return True, [self.ERR_PACKET_INVALID]
+                    self.model_flags, self.model_sp_weight_pc = data[0], data[1]
+                elif len(data) != 0:
+                    return True, [self.ERR_PACKET_INVALID]
+                # No model identified in simulation
+                return True, [0, 0, self.model_flags, self.model_sp_weight_pc] + [0] * 12
+
+            if packet_type == self.PACKET_TYPE_PROFILE_SET_SEGMENT:
+                if len(data) != 7 or data[0] >= self.PROFILE_SEGMENTS_MAX:
+                    return True, [self.ERR_PACKET_INVALID]
+                if self._profile_active():
+                    return True, [self.ERR_HEAT_PROFILE_ACTIVE]
+                self.profile_segments[data[0]] = list(data[1:7])
+                return True, self._status_ok()
+
+            if packet_type == self.PACKET_TYPE_PROFILE_SET_RUNNING:
+                return True, self._profile_set_running(data)
+
+            if packet_type == self.PACKET_TYPE_GET_HISTORY:
+                return True, self._get_history(data)
+
+            if packet_type == self.PACKET_TYPE_ADC_FILTER:
+                return True, self._adc_filter(data)
+
+            if packet_type == self.PACKET_TYPE_GET_EEPROM_STATUS:
+                if len(data) > 1:
+                    return True, [self.ERR_PACKET_INVALID]
+                reply = [0, 0, 0] + list((self.eeprom_committed & 0xFFFF).to_bytes(2, "big"))
+                if data and data[0]:
+                    self.eeprom_committed = 0
+                return True, reply + [0, 0, 0, 0]
+
+            if packet_type == self.PACKET_TYPE_PARAM_LIST:
+                return True, self.params.list(data)
+
+            if packet_type == self.PACKET_TYPE_PARAM_GET_MANY:
+                return True, self.params.get_many(data)
+
+            if packet_type == self.PACKET_TYPE_PARAM_SET_MANY:
+                return True, self.params.set_many(data)
+
+            if packet_type == self.PACKET_TYPE_GET_FAULT_LOG:
+                return True, self.faults.list(data)
+
+            if packet_type == self.PACKET_TYPE_ECHO:
+                return True, [0] + list(data)
+
+            if packet_type == self.PACKET_TYPE_SYNC_TIME:
+                return True, self.timebase.sync(data)
+
+            if packet_type == self.PACKET_TYPE_BATCH:
+                return True, self._batch(data)
+
+            if packet_type == self.PACKET_TYPE_STAGE:
+                return True, self.stage.stage(data)
+
+            if packet_type == self.PACKET_TYPE_GET_BOOT_STATUS and not data:
+                # Booted when created, with the temperature sensor present
+                return True, [0, 0, 1] + list((1).to_bytes(2, "big"))
+
+            if packet_type == self.PACKET_TYPE_GET_LATENCY_STATS:
+                # Heater and stirrer loops, nothing timed in simulation
+                if len(data) not in (1, 2) or data[0] >= 2:
+                    return True, [self.ERR_PACKET_INVALID]
+                period_us = int(self.HEATER_PERIOD_S * 1e6)
+                if data[0] == 1:
+                    period_us = self.stir_period_ms * 1000
+                return True, [0, 2, data[0]] + list(period_us.to_bytes(4, "little")) + [0] * 96
+
+            if packet_type == self.PACKET_TYPE_HEATER_ZONE:
+                return True, self._heater_zone(data)
+
+            if packet_type == self.PACKET_TYPE_SUBSCRIBE:
+                return True, self.reports.subscribe(data)
+
+            if packet_type == self.PACKET_TYPE_FLASH:
+                return True, self.flash.command(data)
+
+            if packet_type == self.PACKET_TYPE_GET_CAPABILITIES and not data:
+                types = list(range(self.PACKET_TYPE_GET_ID, self.PACKET_TYPE_HISTORY_STREAM + 1))
+                types += [
+                    self.PACKET_TYPE_HEATER_ZONE,
+                    self.PACKET_TYPE_SUBSCRIBE,
+                    self.PACKET_TYPE_FLASH,
+                ]
+                loop_period_us = int(self.HEATER_PERIOD_S * 1e6)
+                return True, capabilities_report(2, 128, 256, 128, loop_period_us, types)
+
             # Unknown packet: return failure
             logger.warning(f"Unknown heater packet type: {packet_type}")
             return False, []
@@ -0,0 +1,85 @@
+"""
+Simulated parameter descriptor table.
+
+Answers PARAM_LIST, PARAM_GET_MANY and PARAM_SET_MANY the way the shared rio_param
+firmware module does, over a table the simulated board builds from its own state.
+"""
+
+from typing import Callable, List, NamedTuple, Optional
+
+PARAM_TYPE_U8 = 0
+PARAM_TYPE_U16 = 1
+PARAM_TYPE_I16 = 2
+PARAM_FLAG_READ_ONLY = 0x01
+PARAM_FLAG_STORED = 0x02
+
+PARAM_LIST_RECORDS_MAX = 16
+PARAM_MANY_MAX = 24
+
+ERR_PACKET_INVALID = 31
+ERR_PARAM_UNKNOWN = 110
+ERR_PARAM_RANGE = 111
+ERR_PARAM_READ_ONLY = 112
+
+
+class SimulatedParam(NamedTuple):
+    id: int
+    type: int
+    flags: int
+    min: int
+    max: int
+    get: Callable[[], int]
+    set: Optional[Callable[[int], None]] = None
+
+
+def _u16(value: int) -> List[int]:
+    return list((value & 0xFFFF).to_bytes(2, "little"))
+
+
+class SimulatedParams:
+    def __init__(self, table: List[SimulatedParam]):
+        self.table = table
+        self.by_id = {param.id: param for param in table}
+
+    def list(self, data: List[int]) -> List[int]:
+        """PARAM_LIST: [start U8] -> [err][total][count] count * [id][type][flags][min][max]"""
+        if len(data) > 1:
+            return [ERR_PACKET_INVALID]
+        start = data[0] if data else 0
+        page = self.table[start : start + PARAM_LIST_RECORDS_MAX]
+        reply = [0, len(self.table), len(page)]
+        for param in page:
+            reply += [param.id, param.type, param.flags] + _u16(param.min) + _u16(param.max)
+        return reply
+
+    def get_many(self, data: List[int]) -> List[int]:
+        """PARAM_GET_MANY: n * [id] -> [err] n * [id][value 16]"""
+        if len(data) > PARAM_MANY_MAX:
+            return [ERR_PACKET_INVALID]
+        reply = [0]
+        for param_id in data:
+            if param_id not in self.by_id:
+                return [ERR_PARAM_UNKNOWN]
+            reply += [param_id] + _u16(self.by_id[param_id].get())
+        return reply
+
+    def set_many(self, data: List[int]) -> List[int]:
+        """PARAM_SET_MANY: n * [id][value 16] -> [err], checked in full before any is applied"""
+        if len(data) % 3 or len(data) > 3 * PARAM_MANY_MAX:
+            return [ERR_PACKET_INVALID]
+        values = []
+        for index in range(0, len(data), 3):
+            param = self.by_id.get(data[index])
+            if param is None:
+                return [ERR_PARAM_UNKNOWN]
+            if param.flags & PARAM_FLAG_READ_ONLY:
+                return [ERR_PARAM_READ_ONLY]
+            value = int.from_bytes(bytes(data[index + 1 : index + 3]), "little")
+            if param.type == PARAM_TYPE_I16 and value & 0x8000:
+                value -= 0x10000
+            if not param.min <= value <= param.max:
+                return [ERR_PARAM_RANGE]
+            values.append((param, value))
+        for param, value in values:
+            param.set(value)
+        return [0]
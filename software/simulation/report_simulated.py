@@ -0,0 +1,81 @@
+"""
+Simulated report by exception.
+
+Answers SUBSCRIBE the way the shared rio_report firmware module does, and makes the REPORT
+payloads. The simulated boards have no control cycle of their own, so poll() compares the
+present values with the ones last sent whenever the host reads, rather than every cycle: a
+signal that moved past its deadband and back in between is not reported.
+"""
+
+from typing import List, Optional
+
+REPORT_CANCEL = 0xFF
+REPORT_DEADBAND_OFF = 0xFFFF
+REPORT_SUBSCRIBE_SIZE = 5
+
+ERR_PACKET_INVALID = 31
+
+
+class SimulatedReports:
+    def __init__(self, timebase, count: int):
+        self.timebase = timebase
+        self.count = count
+        # signal -> {"deadband", "interval_ms", "last", "sent_us"}, last None until sent
+        self.signals = {}
+        self.sent = 0
+        self.dropped = 0
+
+    def active(self) -> bool:
+        return bool(self.signals)
+
+    def subscribe(self, data: List[int]) -> List[int]:
+        """SUBSCRIBE: none, [0xFF] or n * [signal][deadband][interval ms] -> [err][status]."""
+        if len(data) == 1:
+            if data[0] != REPORT_CANCEL:
+                return [ERR_PACKET_INVALID]
+            self.signals = {}
+        elif data:
+            if len(data) % REPORT_SUBSCRIBE_SIZE:
+                return [ERR_PACKET_INVALID]
+            entries = [
+                data[i : i + REPORT_SUBSCRIBE_SIZE]
+                for i in range(0, len(data), REPORT_SUBSCRIBE_SIZE)
+            ]
+            if any(entry[0] >= self.count for entry in entries):
+                return [ERR_PACKET_INVALID]
+            for entry in entries:
+                deadband = int.from_bytes(bytes(entry[1:3]), "little")
+                interval_ms = int.from_bytes(bytes(entry[3:5]), "little")
+                if deadband == REPORT_DEADBAND_OFF and interval_ms == 0:
+                    self.signals.pop(entry[0], None)
+                else:
+                    self.signals[entry[0]] = {
+                        "deadband": deadband,
+                        "interval_ms": interval_ms,
+                        "last": None,
+                        "sent_us": 0,
+                    }
+        return [0, len(self.signals)] + list(self.sent.to_bytes(2, "little")) + list(
+            self.dropped.to_bytes(2, "little")
+        )
+
+    def poll(self, values: List[int]) -> Optional[List[int]]:
+        """The REPORT payload of the signals due, [time us U32] n * [signal][value I16], or None."""
+        now_us = self.timebase.local_us()
+        payload = []
+        for index in sorted(self.signals):
+            signal = self.signals[index]
+            value = values[index]
+            due = signal["last"] is None
+            if not due and signal["deadband"] != REPORT_DEADBAND_OFF:
+                due = abs(value - signal["last"]) > signal["deadband"]
+            if not due and signal["interval_ms"]:
+                due = ((now_us - signal["sent_us"]) & 0xFFFFFFFF) >= signal["interval_ms"] * 1000
+            if due:
+                signal["last"] = value
+                signal["sent_us"] = now_us
+                payload += [index] + list(int(value).to_bytes(2, "little", signed=True))
+        if not payload:
+            return None
+        self.sent = min(self.sent + 1, 0xFFFF)
+        return list(self.timebase.now_us().to_bytes(4, "little")) + payload
@@ -11,11 +11,12 @@ Classes:
     SimulatedSPIHandler: SPI handler replacement
 """
 
-import time
 import logging
 from threading import Lock
 from typing import List, Optional, Any
 
+from . import clock_simulated as clock
+
 # Configure logging
 logger = logging.getLogger(__name__)
 
@@ -178,13 +179,19 @@ class SimulatedSPIDev:
         if self._handler is None:
             return [0] * len(data)
 
-        # Check if this is a read request (single zero byte)
-        if len(data) == 1 and data[0] == 0:
+        # Firmware in the loop: the board's own spi_handler() answers byte by byte
+        board = self._handler.firmware_board()
+        if board is not None:
+            board.set_spi_hz(self.max_speed_hz)
+            return board.xfer(data)
+
+        # Check if this is a read request (zero bytes, one or more)
+        if data and not any(data):
             # Read operation - return stored response from handler
-            return self._handler.get_stored_response()
+            return [byte for _ in data for byte in self._handler.get_stored_response()]
 
         # Check if this is a packet (STX byte = 2)
-        if len(data) >= 3 and data[0] == 2:  # STX byte
+        if len(data) >= 3 and data[0] in (2, 3):  # STX or STX_CRC byte
             # Route packet through handler
             response = self._handler.route_packet(data)
             return response
@@ -253,9 +260,11 @@ class SimulatedSPIHandler:
         self._simulated_flow = None
         self._simulated_strobe = None
         self._simulated_heaters: dict[int, Any] = {}  # port -> heater instance
+        self._firmware_boards: dict[int, Any] = {}  # port -> FirmwareBoard, see firmware_board()
 
-        # Store last response for read operations
-        self._stored_response: List[int] = []
+        # Replies waiting to be read, per port (the firmware write ring)
+        self._stored_responses: dict[Optional[int], List[int]] = {}
+        self._crc_modes: dict[Optional[int], int] = {}  # Framing of each port's last request
 
         # Create SPI device with handler reference
         self.spi = SimulatedSPIDev(handler=self)
@@ -292,11 +301,13 @@ class SimulatedSPIHandler:
         try:
             if (self.current_device is not None) and (device != self.current_device):
                 self.GPIO.output(self.current_device, self.GPIO.HIGH)
+                self._firmware_select(False)
                 self.current_device = None
 
             if (device is not None) and (device != self.current_device):
                 self.GPIO.output(device, self.GPIO.LOW)
                 self.current_device = device
+                self._firmware_select(True)
                 logger.debug(f"SPI device selected: {device}")
         except Exception as e:
             logger.error(f"Error selecting SPI device {device}: {e}")
@@ -310,11 +321,40 @@ class SimulatedSPIHandler:
         try:
             if self.current_device is not None:
                 self.GPIO.output(self.current_device, self.GPIO.HIGH)
+                self._firmware_select(False)
                 self.current_device = None
                 logger.debug("SPI device deselected")
         except Exception as e:
             logger.error(f"Error deselecting SPI device: {e}")
 
+    def firmware_board(self) -> Optional[Any]:
+        """
+        FirmwareBoard of the selected port, created on first use.
+
+        Returns:
+            The board running the real firmware when RIO_SIM_FIRMWARE is set and
+            its library is built, otherwise None (the packet-level simulation answers)
+        """
+        port = self.current_device
+        if port in self._firmware_boards:
+            return self._firmware_boards[port]
+
+        from simulation import firmware_simulated
+
+        if not firmware_simulated.firmware_enabled(port):
+            return None
+        board = firmware_simulated.FirmwareBoard(
+            firmware_simulated.BOARD_PORTS[port], library_dir=firmware_simulated.library_dir()
+        )
+        self._firmware_boards[port] = board
+        return board
+
+    def _firmware_select(self, selected: bool) -> None:
+        """Slave select of the current port's FirmwareBoard, if it has one."""
+        board = self.firmware_board()
+        if board is not None:
+            board.select(selected)
+
     def spi_lock(self) -> None:
         """
         Acquire SPI lock.
@@ -339,7 +379,7 @@ class SimulatedSPIHandler:
 
     def pi_wait_s(self, seconds: float) -> None:
         """
-        Wait for specified time (simulated - uses real time.sleep).
+        Wait for specified time, on the simulated clock (clock_simulated).
 
         Args:
             seconds: Time to wait in seconds
@@ -347,7 +387,7 @@ class SimulatedSPIHandler:
         if seconds < 0:
             logger.warning(f"Invalid wait time: {seconds}s")
             return
-        time.sleep(seconds)
+        clock.sleep(seconds)
 
     def read_bytes(self, bytes_: int) -> List[int]:
         """
@@ -377,14 +417,31 @@ class SimulatedSPIHandler:
         Returns:
             Stored response bytes, or [0] if no response stored
         """
-        if self._stored_response:
+        stored_response = self._stored_responses.get(self.current_device)
+        if not stored_response:
+            stored_response = self._queue_reports()
+        if stored_response:
             # Return one byte at a time (SPI read behavior)
-            if len(self._stored_response) > 0:
-                byte = self._stored_response.pop(0)
-                return [byte]
+            return [stored_response.pop(0)]
         # Return 0 if no response (PIC not ready)
         return [0]
 
+    def _queue_reports(self) -> List[int]:
+        """REPORT frames of the current port's subscriptions, once its replies are all read."""
+        device = self._simulated_flow if self.current_device == 26 else None
+        device = self._simulated_heaters.get(self.current_device, device)
+        if device is None or not device.reports.active():
+            return []
+        from drivers import spi_handler
+
+        crc_mode = self._crc_modes.get(self.current_device, spi_handler.CRC_NONE)
+        self._stored_responses[self.current_device] = [
+            byte
+            for payload in device.read_reports()
+            for byte in spi_handler.build_frame(device.PACKET_TYPE_REPORT, payload, crc_mode)
+        ]
+        return self._stored_responses[self.current_device]
+
     def route_packet(self, packet: List[int]) -> List[int]:
         """
         Route SPI packet to appropriate simulated device.
@@ -396,24 +453,50 @@ class SimulatedSPIHandler:
             Response packet bytes (empty for write, will be read later)
         """
         if len(packet) < 3:
-            self._stored_response = []
+            self._stored_responses[self.current_device] = []
             return []
 
+        from drivers import spi_handler
+
         # Extract packet components
         stx = packet[0]
-        if stx != 2:  # STX byte
-            self._stored_response = []
+        crc_mode = spi_handler.CRC_NONE
+        if stx == spi_handler.STX_CRC:
+            # CRC frame, as the firmware: CRC-8 on the strobe PIC, CRC-16 on the dsPICs
+            crc_mode = spi_handler.CRC_8 if self.current_device == 24 else spi_handler.CRC_16
+            frame_valid, data = spi_handler.parse_frame(packet, crc_mode)
+            if not frame_valid:
+                self._stored_responses[self.current_device] = []
+                return []
+        elif stx == 2:  # STX byte
+            data = packet[3:-1] if len(packet) > 4 else []  # Skip STX, size, type, checksum
+        else:
+            self._stored_responses[self.current_device] = []
             return []
 
         packet_type = packet[2] if len(packet) > 2 else 0
-        data = packet[3:-1] if len(packet) > 4 else []  # Skip STX, size, type, checksum
+        self._crc_modes[self.current_device] = crc_mode
+
+        # Sequenced packet: [type | 0x80][seq][data...], the reply echoes both and
+        # is queued behind earlier replies instead of replacing them
+        seq = None
+        if (packet_type & 0x80) and data:
+            packet_type &= 0x7F
+            seq = data[0]
+            data = data[1:]
 
         # Route to appropriate device based on current_device
         response_data = []
         valid = False
+        chunks = None  # Streamed reply, see stream_simulated
 
         try:
-            if self.current_device == 24:  # PORT_STROBE
+            if packet_type == spi_handler.PACKET_TYPE_PROTOCOL:
+                # Answered by rio_spi on every board
+                port_crc = spi_handler.CRC_8 if self.current_device == 24 else spi_handler.CRC_16
+                valid, response_data = True, [0, spi_handler.PROTOCOL_VERSION_CRC, port_crc]
+
+            elif self.current_device == 24:  # PORT_STROBE
                 if self._simulated_strobe is None:
                     from simulation.strobe_simulated import SimulatedStrobe
 
@@ -425,7 +508,9 @@ class SimulatedSPIHandler:
                     from simulation.flow_simulated import SimulatedFlow
 
                     self._simulated_flow = SimulatedFlow(device_port=26, reply_pause_s=0.1)
-                valid, response_data = self._simulated_flow.packet_query(packet_type, data)
+                chunks = self._simulated_flow.stream_query(packet_type, data)
+                if chunks is None:
+                    valid, response_data = self._simulated_flow.packet_query(packet_type, data)
 
             elif self.current_device in [31, 33, 32, 36]:  # PORT_HEATER1-4
                 port = self.current_device
@@ -435,7 +520,11 @@ class SimulatedSPIHandler:
                     self._simulated_heaters[port] = SimulatedHeater(
                         device_port=port, reply_pause_s=0.05
                     )
-                valid, response_data = self._simulated_heaters[port].packet_query(packet_type, data)
+                chunks = self._simulated_heaters[port].stream_query(packet_type, data)
+                if chunks is None:
+                    valid, response_data = self._simulated_heaters[port].packet_query(
+                        packet_type, data
+                    )
 
             else:
                 logger.warning(f"No simulated device for port {self.current_device}")
@@ -447,6 +536,29 @@ class SimulatedSPIHandler:
             valid = False
             response_data = []
 
+        if chunks is not None:
+            # Every chunk frame at once, framed like the request and never sequenced
+            self._stored_responses[self.current_device] = [
+                byte
+                for chunk in chunks
+                for byte in spi_handler.build_frame(packet_type, chunk, crc_mode)
+            ]
+            return []
+
+        if seq is not None or crc_mode != spi_handler.CRC_NONE:
+            # Reply framed like the request
+            if not (valid and response_data):
+                response_data = [0xFF]
+            if seq is not None:
+                packet_type |= 0x80
+                response_data = [seq] + response_data
+            response = spi_handler.build_frame(packet_type, response_data, crc_mode)
+            if seq is not None:
+                self._stored_responses.setdefault(self.current_device, []).extend(response)
+            else:
+                self._stored_responses[self.current_device] = response
+            return []
+
         # Format response packet: [STX, size, type, ...data, checksum]
         if valid and response_data:
             response = [2]  # STX
@@ -457,7 +569,7 @@ class SimulatedSPIHandler:
             checksum = (-(sum(response) & 0xFF)) & 0xFF
             response.append(checksum)
             # Store response for read operations (packet_read will read this)
-            self._stored_response = response.copy()
+            self._stored_responses[self.current_device] = response.copy()
             # Return empty for write operation (response will be read via xfer2([0]))
             return []
         else:
@@ -465,5 +577,5 @@ class SimulatedSPIHandler:
             error_response = [2, 4, packet_type, 0xFF, 0]  # STX, size, type, error, checksum
             checksum = (-(sum(error_response) & 0xFF)) & 0xFF
             error_response[-1] = checksum
-            self._stored_response = error_response.copy()
+            self._stored_responses[self.current_device] = error_response.copy()
             return []
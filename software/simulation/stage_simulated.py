@@ -0,0 +1,84 @@
+"""
+Simulated staged commands.
+
+Answers STAGE the way the shared rio_stage firmware module does. Staged packets are kept with
+their apply time on the board's SimulatedTimebase and run through the board's own packet
+handler, with the reply dropped, by poll(). The simulated boards poll before each packet, as
+the firmware main loop does before it handles the next one.
+"""
+
+from typing import Callable, List, Tuple
+
+STAGE_SLOTS = 8
+STAGE_DATA_MAX = 24
+STAGE_CANCEL = 0
+STAGE_LATE_US = 1000
+PACKET_TYPE_PROTOCOL = 0x7F
+
+ERR_PACKET_INVALID = 31
+
+
+class SimulatedStage:
+    def __init__(
+        self,
+        timebase,
+        run: Callable[[int, List[int]], Tuple[bool, List[int]]],
+        batch_type: int,
+        stage_type: int,
+    ):
+        self.timebase = timebase
+        self.run = run
+        self.refused = (0, batch_type, stage_type, PACKET_TYPE_PROTOCOL)
+        self.slots: List[Tuple[int, int, List[int]]] = []  # (apply_us, type, data), staging order
+        self.applied = 0
+        self.late = 0
+        self.failed = 0
+        self.error_us = 0
+
+    def stage(self, data: List[int]) -> List[int]:
+        """STAGE: none, [0] or [apply us U32][type][data...] -> [err][pending][applied][late][failed][error]."""
+        if len(data) == 1:
+            if data[0] != STAGE_CANCEL:
+                return [ERR_PACKET_INVALID]
+            self.slots = []
+        elif data:
+            if len(data) < 5 or len(data) - 5 > STAGE_DATA_MAX or data[4] in self.refused:
+                return [ERR_PACKET_INVALID]
+            if len(self.slots) == STAGE_SLOTS:
+                return [ERR_PACKET_INVALID]
+            apply_us = int.from_bytes(bytes(data[0:4]), "little")
+            self.slots.append((apply_us, data[4], list(data[5:])))
+        return [0] + self.report()
+
+    def report(self) -> List[int]:
+        return (
+            [len(self.slots)]
+            + list(self.applied.to_bytes(2, "little"))
+            + list(self.late.to_bytes(2, "little"))
+            + list(self.failed.to_bytes(2, "little"))
+            + list(self.error_us.to_bytes(4, "little", signed=True))
+        )
+
+    def poll(self) -> None:
+        """Run the staged packets whose time has come, in staging order."""
+        if not self.slots:
+            return
+        now_us = self.timebase.now_us()
+        due = []
+        pending = []
+        for slot in self.slots:
+            error_us = (now_us - slot[0]) & 0xFFFFFFFF
+            if error_us & 0x80000000:
+                pending.append(slot)
+            else:
+                due.append((error_us,) + slot[1:])
+        # Taken off first, the board's handler may poll again
+        self.slots = pending
+        for error_us, type_, data in due:
+            valid, reply = self.run(type_, data)
+            if not valid or not reply or reply[0] != 0:
+                self.failed = min(self.failed + 1, 0xFFFF)
+            self.applied = min(self.applied + 1, 0xFFFF)
+            if error_us > STAGE_LATE_US:
+                self.late = min(self.late + 1, 0xFFFF)
+            self.error_us = error_us
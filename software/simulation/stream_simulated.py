@@ -0,0 +1,86 @@
+"""
+Simulated streamed replies.
+
+Splits a transfer into the chunk payloads the shared rio_spi spi_stream_start() sends,
+[err U8][total U16][offset U16][data...] little endian. Each chunk holds whole records up
+to the board's SPI_STREAM_CHUNK_SIZE, as the boards' fill functions pack them. The
+simulated SPI queues every chunk at once, where the firmware queues the next as the write
+ring drains.
+
+Compact records are coded as the shared rio_delta module codes them, the difference of each
+U16 word from the record before, so the drivers' decoding can be checked in simulation.
+"""
+
+from typing import List, Optional
+
+STREAM_CHUNK_SIZE = 120  # board_config.h SPI_STREAM_CHUNK_SIZE
+DELTA_FLAG_KEY = 0x01
+
+
+def _chunk(total: int, offset: int, data: List[int]) -> List[int]:
+    return [0] + list(total.to_bytes(2, "little")) + list(offset.to_bytes(2, "little")) + data
+
+
+def stream_chunks(records: List[List[int]], chunk_size: int = STREAM_CHUNK_SIZE) -> List[List[int]]:
+    """Chunk payloads carrying <records> back to back, one empty chunk if there are none."""
+    data = [byte for record in records for byte in record]
+    total = len(data)
+    step = (chunk_size // len(records[0])) * len(records[0]) if records else chunk_size
+    chunks = []
+    offset = 0
+    while True:
+        chunk = data[offset : offset + step]
+        chunks.append(_chunk(total, offset, chunk))
+        offset += len(chunk)
+        if offset >= total:
+            return chunks
+
+
+def delta_encode(words: List[int], prev: Optional[List[int]]) -> List[int]:
+    """rio_delta record of <words> against <prev>, a keyframe if prev is None."""
+    key = prev is None
+    if key:
+        prev = [0] * len(words)
+    mask = [0] * ((len(words) + 7) // 8)
+    changes = []
+    for w, (word, old) in enumerate(zip(words, prev)):
+        diff = (word - old) & 0xFFFF
+        if not diff:
+            continue
+        mask[w >> 3] |= 1 << (w & 7)
+        zz = ((diff << 1) ^ (0xFFFF if diff & 0x8000 else 0)) & 0xFFFF
+        while zz >= 0x80:
+            changes.append((zz & 0x7F) | 0x80)
+            zz >>= 7
+        changes.append(zz)
+    return [DELTA_FLAG_KEY if key else 0] + mask + changes
+
+
+def record_words(record: List[int], byteorder: str) -> List[int]:
+    """The U16 words a board codes a plain record as."""
+    return [int.from_bytes(bytes(record[i : i + 2]), byteorder) for i in range(0, len(record), 2)]
+
+
+def compact_stream_chunks(
+    records: List[List[int]], byteorder: str, chunk_size: int = STREAM_CHUNK_SIZE
+) -> List[List[int]]:
+    """
+    Chunk payloads of <records> as compact records, the first a keyframe, back to back
+    across full chunks. The total is sized for records at their largest, so a last chunk
+    with total = offset ends the transfer, as the boards end it.
+    """
+    data: List[int] = []
+    prev = None
+    for record in records:
+        words = record_words(record, byteorder)
+        data.extend(delta_encode(words, prev))
+        prev = words
+    count = len(records[0]) // 2 if records else 0
+    total = len(records) * (1 + (count + 7) // 8 + 3 * count)
+    chunks = [
+        _chunk(total, offset, data[offset : offset + chunk_size])
+        for offset in range(0, len(data), chunk_size)
+    ]
+    if len(data) < total or not chunks:
+        chunks.append(_chunk(len(data), len(data), []))
+    return chunks
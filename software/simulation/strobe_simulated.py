@@ -9,9 +9,12 @@ Classes:
     SimulatedStrobe: Strobe controller implementation that simulates PIC behavior
 """
 
-import time
 import logging
-from typing import Optional, Tuple
+from typing import List, Optional, Tuple
+
+from . import clock_simulated as clock
+from .caps_simulated import capabilities_report
+from .time_simulated import SimulatedTimebase
 
 # Configure logging
 logger = logging.getLogger(__name__)
@@ -20,6 +23,19 @@ logger = logging.getLogger(__name__)
 DEFAULT_REPLY_PAUSE_S = 0.1
 DEFAULT_PERIOD_NS = 100000  # 100 microseconds
 DEFAULT_CAM_READ_TIME_US = 10000  # 10 milliseconds
+STROBE_SEQ_MAX_ENTRIES = 16  # Matches firmware sequence table size
+STROBE_MAX_PULSES = 8  # Matches firmware multi-pulse limit
+CAM_STATS_NUM_BINS = 8  # Matches firmware cam_stats.h
+STROBE_EVENT_FIFO_SIZE = 32  # Matches firmware event FIFO (holds SIZE - 1 events)
+STROBE_EVENTS_PER_PACKET = 3
+TRIG_TEST_TICK_NS = 125  # Matches firmware trig_test.h
+TRIG_TEST_PERIOD_STEP_US = 16
+TRIG_TEST_ISR_TICKS = (40, 48)  # Simulated edge to strobe_gate_isr() entry, min/max
+TRIG_TEST_OUTPUT_TICKS = 56  # Simulated strobe_gate_isr() entry to output rise, past the wait
+FRAME_CLOCK_TICK_NS = 125  # Matches firmware frame_clock.h
+FRAME_CLOCK_PERIOD_MIN_NS = 100000
+FRAME_CLOCK_PERIOD_MAX_NS = 131072000
+STROBE_B_MAX_TIME_NS = 4096000  # Matches firmware strobe_b.h
 
 
 class SimulatedStrobe:
@@ -38,6 +54,52 @@ class SimulatedStrobe:
     PACKET_TYPE_SET_HOLD = 3
     PACKET_TYPE_GET_CAM_READ_TIME = 4
     PACKET_TYPE_SET_TRIGGER_MODE = 5
+    PACKET_TYPE_SET_TIMING_SHADOW = 6
+    PACKET_TYPE_COMMIT_TIMING = 7
+    PACKET_TYPE_SET_SEQ_ENTRY = 8
+    PACKET_TYPE_SET_SEQ = 9
+    PACKET_TYPE_SET_PULSES = 10
+    PACKET_TYPE_GET_STROBE_STATS = 11
+    PACKET_TYPE_GET_CAM_READ_STATS = 12
+    PACKET_TYPE_SET_CAM_READ_HIST = 13
+    PACKET_TYPE_GET_STROBE_EVENTS = 14
+    PACKET_TYPE_GET_SPI_STATS = 15
+    PACKET_TYPE_ECHO = 16
+    PACKET_TYPE_TRIG_TEST = 17
+    PACKET_TYPE_SYNC_TIME = 18
+    PACKET_TYPE_GET_CAPABILITIES = 19
+    PACKET_TYPE_GET_LOAD_STATS = 20
+    PACKET_TYPE_SET_TIMING_RAW = 21
+    PACKET_TYPE_SET_PHASE_LOCK = 22
+    PACKET_TYPE_SET_FRAME_CLOCK = 23
+    PACKET_TYPE_SET_STROBE_B = 25
+    ECHO_PAYLOAD_MAX = 26  # Fits return_buf[] and the 32 byte write ring
+
+    # Firmware SPI buffer sizes (read ring, write ring, packet)
+    SPI_BUF_SIZES = (32, 32, 32)
+
+    # Event flags (matching firmware STROBE_EVENT_*)
+    EVENT_FIRED = 0x01
+    EVENT_DROPPED_BUSY = 0x02
+    EVENT_DROPPED_OFF = 0x04
+    EVENT_CHAN_B = 0x08
+    EVENT_CHAN_A_OFF = 0x10
+
+    # Second strobe channel modes (matching firmware STROBE_B_*)
+    STROBE_B_OFF = 0
+    STROBE_B_SIMULTANEOUS = 1
+    STROBE_B_ALTERNATE = 2
+
+    # Error codes (matching firmware common.h)
+    ERR_PACKET_INVALID = 31
+    ERR_STROBE_TIMING_INVALID = 40
+    ERR_STROBE_SEQ_INVALID = 41
+    ERR_TRIG_TEST_INVALID = 42
+    ERR_TRIG_TEST_BUSY = 43
+
+    # Trigger self-test states (matching firmware TRIG_TEST_*)
+    TRIG_TEST_IDLE = 0
+    TRIG_TEST_RUNNING = 1
 
     def __init__(self, device_port: int, reply_pause_s: float = DEFAULT_REPLY_PAUSE_S):
         """
@@ -64,8 +126,54 @@ class SimulatedStrobe:
         self.wait_ns = 0
         self.period_ns = DEFAULT_PERIOD_NS
         self.trigger_mode = False  # Hardware trigger mode
+        self.trigger_chained = False  # Hardware trigger started through CLC4, mode 2
+        self.shadow_timing: Optional[Tuple[int, int]] = None  # Staged (wait_ns, period_ns)
+        self.shadow_apply_us: Optional[int] = None  # Held until this synchronized time
+
+        # Sequence table: (wait_ns, period_ns, repeat) or None if not uploaded
+        self.seq_entries: List[Optional[Tuple[int, int, int]]] = [None] * STROBE_SEQ_MAX_ENTRIES
+        self.seq_length = 0
+        self.seq_loop = False
+        self.seq_active = False
+        self.seq_index = 0
+        self.seq_repeat_count = 0
+
+        # Multi-pulse per frame
+        self.pulse_count = 1
+        self.pulse_gap_ns = 0
+
+        # Trigger statistics [triggers, fired, dropped_busy, dropped_disabled]
+        self.stats = [0, 0, 0, 0]
+
+        # Camera read time statistics (every simulated read reports cam_read_time_us)
+        self.cam_hist_base_us = 0
+        self.cam_hist_bin_shift = 12
+
+        # Trigger event FIFO: (timestamp_us, gate_us, flags)
+        self.events: List[Tuple[int, int, int]] = []
+        self.events_lost = 0
+        # Event timestamps are local, the SYNC_TIME offset is added when they are read out
+        self.timebase = SimulatedTimebase()
+
+        # Trigger self-test: state and the 23-byte report after it, a test finishes
+        # at the first query after its start
+        self.trig_test_state = self.TRIG_TEST_IDLE
+        self.trig_test_report = [0] * 22
         self.cam_read_time_us = DEFAULT_CAM_READ_TIME_US
 
+        # Frame period between frame_edge() calls, and the phase lock on it (1/65536)
+        self.frame_period_ns = 0
+        self.last_edge_us: Optional[int] = None
+        self.phase_lock = 0
+        self.phase_lock_wait_ns = 0
+        # Frame clock on RA0, 0 when stopped
+        self.frame_clock_period_ns = 0
+        # Second strobe channel: mode, (wait_ns, duration_ns) as made, and whether the
+        # next frame of the alternate pattern is channel B's
+        self.strobe_b_mode = self.STROBE_B_OFF
+        self.strobe_b_timing = (0, 0)
+        self.strobe_b_phase = False
+
         logger.debug(
             f"SimulatedStrobe initialized (port={device_port}, reply_pause={reply_pause_s}s)"
         )
@@ -91,12 +199,16 @@ class SimulatedStrobe:
             type_: Packet type (PACKET_TYPE_* constant)
             data: Packet data bytes
         """
+        self.release_shadow_timing()
         try:
             handlers = {
                 self.PACKET_TYPE_SET_ENABLE: self._handle_set_enable,
                 self.PACKET_TYPE_SET_TIMING: self._handle_set_timing,
                 self.PACKET_TYPE_SET_HOLD: self._handle_set_hold,
                 self.PACKET_TYPE_SET_TRIGGER_MODE: self._handle_set_trigger_mode,
+                self.PACKET_TYPE_SET_TIMING_SHADOW: self._handle_set_timing_shadow,
+                self.PACKET_TYPE_COMMIT_TIMING: self._handle_commit_timing,
+                self.PACKET_TYPE_SET_TIMING_RAW: self._handle_set_timing_raw,
             }
             handler = handlers.get(type_)
             if handler:
@@ -117,6 +229,8 @@ class SimulatedStrobe:
         if len(data) >= 8:
             self.wait_ns = int.from_bytes(data[0:4], "little", signed=False)
             self.period_ns = int.from_bytes(data[4:8], "little", signed=False)
+            self.shadow_timing = None  # Immediate write replaces anything staged
+            self.shadow_apply_us = None
             logger.debug(f"Strobe timing: wait={self.wait_ns}ns, period={self.period_ns}ns")
         else:
             logger.warning(f"SET_TIMING packet too short: {len(data)} bytes")
@@ -131,8 +245,279 @@ class SimulatedStrobe:
         """Handle SET_TRIGGER_MODE packet."""
         if len(data) >= 1:
             self.trigger_mode = bool(data[0])
+            self.trigger_chained = data[0] == 2
             logger.debug(f"Strobe trigger mode set to hardware: {self.trigger_mode}")
 
+    def _handle_set_timing_shadow(self, data: list) -> None:
+        """Handle SET_TIMING_SHADOW packet (stage timing until commit)."""
+        if len(data) >= 8:
+            wait_ns = int.from_bytes(data[0:4], "little", signed=False)
+            period_ns = int.from_bytes(data[4:8], "little", signed=False)
+            self.shadow_timing = (wait_ns, period_ns)
+            self.shadow_apply_us = None
+            if len(data) >= 12:
+                self.shadow_apply_us = int.from_bytes(data[8:12], "little", signed=False)
+            logger.debug(f"Strobe shadow timing: wait={wait_ns}ns, period={period_ns}ns")
+        else:
+            logger.warning(f"SET_TIMING_SHADOW packet too short: {len(data)} bytes")
+
+    @staticmethod
+    def _raw_timing_ns(data: list) -> Optional[Tuple[int, int]]:
+        """(wait_ns, duration_ns) of a SET_TIMING_RAW payload, None if the firmware rejects it."""
+        from drivers.strobe import raw_timing_ns
+
+        if len(data) not in (9, 13):
+            return None
+        return raw_timing_ns(data[1], data[2], data[3], data[4], int.from_bytes(data[5:9], "little"))
+
+    def _handle_set_timing_raw(self, data: list) -> None:
+        """Handle SET_TIMING_RAW packet (register values, applied now or staged)."""
+        timing = self._raw_timing_ns(data)
+        if timing is None:
+            logger.warning(f"SET_TIMING_RAW rejected: {list(data)}")
+            return
+        if len(data) == 13 or data[0] & 0x01:
+            self.shadow_timing = timing
+            self.shadow_apply_us = None
+            if len(data) == 13:
+                self.shadow_apply_us = int.from_bytes(data[9:13], "little", signed=False)
+        else:
+            self.wait_ns, self.period_ns = timing
+            self.shadow_timing = None
+            self.shadow_apply_us = None
+        logger.debug(f"Strobe raw timing: wait={timing[0]}ns, period={timing[1]}ns")
+
+    def _handle_commit_timing(self, data: list) -> None:
+        """Handle COMMIT_TIMING packet (apply staged timing, held or not)."""
+        self.shadow_apply_us = None
+        self.commit_shadow_timing()
+
+    def _set_seq_entry(self, data: list) -> int:
+        """Store a sequence table entry, returns firmware error code."""
+        if len(data) != 10:
+            return self.ERR_PACKET_INVALID
+        index, repeat = data[0], data[9]
+        if index >= STROBE_SEQ_MAX_ENTRIES or repeat == 0:
+            return self.ERR_PACKET_INVALID
+        wait_ns = int.from_bytes(data[1:5], "little", signed=False)
+        period_ns = int.from_bytes(data[5:9], "little", signed=False)
+        self.seq_entries[index] = (wait_ns, period_ns, repeat)
+        return 0
+
+    def _set_seq(self, data: list) -> int:
+        """Start/stop the sequence, returns firmware error code."""
+        if len(data) == 0:
+            return 0
+        if len(data) != 2:
+            return self.ERR_PACKET_INVALID
+        length, loop = data[0], data[1]
+        self.seq_active = False
+        if length > STROBE_SEQ_MAX_ENTRIES:
+            return self.ERR_PACKET_INVALID
+        if any(entry is None for entry in self.seq_entries[:length]):
+            return self.ERR_STROBE_SEQ_INVALID
+        self.seq_length = length
+        self.seq_loop = bool(loop)
+        self.seq_index = 0
+        self.seq_repeat_count = 0
+        self.seq_active = length > 0
+        return 0
+
+    def _set_pulses(self, data: list) -> int:
+        """Set pulses per frame, returns firmware error code."""
+        if len(data) == 0:
+            return 0
+        if len(data) != 5:
+            return self.ERR_PACKET_INVALID
+        count = data[0]
+        if count == 0 or count > STROBE_MAX_PULSES:
+            return self.ERR_PACKET_INVALID
+        self.pulse_count = count
+        self.pulse_gap_ns = int.from_bytes(data[1:5], "little", signed=False) if count > 1 else 0
+        return 0
+
+    def _trig_test(self, data: list) -> int:
+        """Start, stop or query the trigger self-test, returns firmware error code."""
+        if self.trig_test_state == self.TRIG_TEST_RUNNING:
+            self.trig_test_state = self.TRIG_TEST_IDLE
+        if len(data) == 0:
+            return 0
+        if len(data) != 4:
+            return self.ERR_PACKET_INVALID
+        edges = int.from_bytes(data[0:2], "little", signed=False)
+        period_us = int.from_bytes(data[2:4], "little", signed=False)
+        if edges == 0:
+            return 0
+        if not self.enabled or self.pulse_count != 1 or self.strobe_b_mode:
+            return self.ERR_TRIG_TEST_INVALID
+        if self.frame_clock_period_ns:
+            return self.ERR_TRIG_TEST_BUSY
+        if period_us < 32 or period_us > 4096:
+            return self.ERR_PACKET_INVALID
+        step = TRIG_TEST_PERIOD_STEP_US
+        period_us = (period_us + step // 2) // step * step
+        isr_min, isr_max = TRIG_TEST_ISR_TICKS
+        output = isr_min + TRIG_TEST_OUTPUT_TICKS + self.wait_ns // TRIG_TEST_TICK_NS
+        output_jitter = isr_max - isr_min
+        values = [period_us, edges, 0, 0, isr_min, isr_max, (isr_min + isr_max) // 2, edges]
+        values += [output, output + output_jitter, output + output_jitter // 2]
+        self.trig_test_report = []
+        for value in values:
+            self.trig_test_report.extend(list((value & 0xFFFF).to_bytes(2, "little")))
+        self.trig_test_state = self.TRIG_TEST_RUNNING
+        self.stats[0] += edges
+        self.stats[1] += edges
+        return 0
+
+    def _frame_clock(self, data: list) -> int:
+        """Start, stop or query the frame clock, returns firmware error code."""
+        if len(data) == 0:
+            return 0
+        if len(data) != 4:
+            return self.ERR_PACKET_INVALID
+        period_ns = int.from_bytes(data[0:4], "little", signed=False)
+        if period_ns == 0:
+            self.frame_clock_period_ns = 0
+            return 0
+        if self.trig_test_state == self.TRIG_TEST_RUNNING:
+            return self.ERR_TRIG_TEST_BUSY
+        if not FRAME_CLOCK_PERIOD_MIN_NS <= period_ns <= FRAME_CLOCK_PERIOD_MAX_NS:
+            return self.ERR_STROBE_TIMING_INVALID
+        # Two compares of TMR5, at the smallest prescaler that fits 16 bits
+        half_ticks = (period_ns + FRAME_CLOCK_TICK_NS) // (2 * FRAME_CLOCK_TICK_NS)
+        ps = 0
+        while ps < 3 and half_ticks > (0x10000 << ps):
+            ps += 1
+        compares = (half_ticks + ((1 << ps) >> 1)) >> ps
+        self.frame_clock_period_ns = (compares << ps) * 2 * FRAME_CLOCK_TICK_NS
+        # SMT2 measures the clock on the looped back pin
+        self.frame_period_ns = self.frame_clock_period_ns
+        return 0
+
+    def _strobe_b(self, data: list) -> int:
+        """Set or query the second strobe channel, returns firmware error code."""
+        if len(data) == 0:
+            return 0
+        if len(data) != 9:
+            return self.ERR_PACKET_INVALID
+        mode = data[0]
+        wait_ns = int.from_bytes(data[1:5], "little", signed=False)
+        duration_ns = int.from_bytes(data[5:9], "little", signed=False)
+        if mode > self.STROBE_B_ALTERNATE:
+            return self.ERR_PACKET_INVALID
+        if mode == self.STROBE_B_OFF:
+            self.strobe_b_mode = mode
+            self.strobe_b_timing = (0, 0)
+            return 0
+        if self.trig_test_state == self.TRIG_TEST_RUNNING:
+            return self.ERR_TRIG_TEST_BUSY
+        if duration_ns == 0 or wait_ns + duration_ns > STROBE_B_MAX_TIME_NS:
+            return self.ERR_STROBE_TIMING_INVALID
+        # TMR6 counts of 4 << ps Fosc ticks and PWM7 duty steps of 1 << ps, 31.25 ns each
+        wait_ticks = (wait_ns * 100 + 1562) // 3125
+        end_ticks = ((wait_ns + duration_ns) * 100 + 1562) // 3125
+        ps = 0
+        while ps < 7 and end_ticks > (1024 << ps):
+            ps += 1
+        counts = max((end_ticks + (2 << ps)) >> (ps + 2), 1)
+        dc = min(max((wait_ticks + ((1 << ps) >> 1)) >> ps, 1), (counts << 2) - 1)
+        wait_ns = ((dc << ps) * 125) >> 2
+        self.strobe_b_timing = (wait_ns, (((counts << (ps + 2)) * 125) >> 2) - wait_ns)
+        self.strobe_b_mode = mode
+        self.strobe_b_phase = False
+        return 0
+
+    def _cam_read_stats_response(self) -> list:
+        """Build GET_CAM_READ_STATS payload after the leading rc byte."""
+        value = self.cam_read_time_us
+        if value < self.cam_hist_base_us:
+            bin_index = 0
+        else:
+            bin_index = min(
+                (value - self.cam_hist_base_us) >> self.cam_hist_bin_shift, CAM_STATS_NUM_BINS - 1
+            )
+        bins = [0] * CAM_STATS_NUM_BINS
+        bins[bin_index] = 1
+        response = list((1).to_bytes(4, "little", signed=False))
+        for item in [value, value, value] + bins:
+            response.extend(list(item.to_bytes(2, "little", signed=False)))
+        return response
+
+    def _push_event(self, flags: int) -> None:
+        """Record a trigger event, newest is lost when the FIFO is full."""
+        if len(self.events) >= STROBE_EVENT_FIFO_SIZE - 1:
+            self.events_lost = min(self.events_lost + 1, 0xFF)
+            return
+        timestamp_us = self.timebase.local_us()
+        self.events.append((timestamp_us, self.cam_read_time_us & 0xFFFF, flags))
+
+    def frame_edge(self) -> None:
+        """Simulate a T1G camera frame edge in hardware trigger mode."""
+        # The firmware main loop has released held timing long before a later edge
+        self.release_shadow_timing()
+        now_us = self.timebase.local_us()
+        if self.last_edge_us is not None:
+            self.frame_period_ns = ((now_us - self.last_edge_us) & 0xFFFFFFFF) * 1000
+        self.last_edge_us = now_us
+        self.stats[0] += 1
+        if not (self.enabled and self.trigger_mode):
+            self.stats[3] += 1
+            self._push_event(self.EVENT_DROPPED_OFF)
+            return
+        self.stats[1] += 1
+        chan_a = True
+        chan_b = self.strobe_b_mode == self.STROBE_B_SIMULTANEOUS
+        if self.strobe_b_mode == self.STROBE_B_ALTERNATE:
+            chan_b = self.strobe_b_phase
+            chan_a = not chan_b
+            self.strobe_b_phase = chan_a
+        flags = self.EVENT_FIRED
+        if chan_b:
+            flags |= self.EVENT_CHAN_B
+        if not chan_a:
+            flags |= self.EVENT_CHAN_A_OFF
+        self._push_event(flags)
+        # Channel B's frames of the alternate pattern leave channel A's timing alone
+        if not chan_a:
+            return
+        if not self.seq_active:
+            self.commit_shadow_timing()
+            self._phase_lock_stage()
+            return
+        if self.seq_repeat_count == 0:
+            if self.seq_index >= self.seq_length:
+                if not self.seq_loop:
+                    self.seq_active = False
+                    return
+                self.seq_index = 0
+            self.wait_ns, self.period_ns, self.seq_repeat_count = self.seq_entries[self.seq_index]
+            self.seq_index += 1
+        self.seq_repeat_count -= 1
+
+    def _phase_lock_stage(self) -> None:
+        """Stage the wait at the locked phase of the frame period for the next edge, as the firmware."""
+        if not self.phase_lock or not self.frame_period_ns or self.shadow_apply_us is not None:
+            return
+        self.phase_lock_wait_ns = (self.frame_period_ns * self.phase_lock) >> 16
+        period_ns = self.shadow_timing[1] if self.shadow_timing else self.period_ns
+        self.shadow_timing = (self.phase_lock_wait_ns, period_ns)
+
+    def release_shadow_timing(self) -> None:
+        """Release timing held for its apply time once it has come, as the firmware main loop."""
+        if self.shadow_apply_us is None:
+            return
+        if (self.timebase.now_us() - self.shadow_apply_us) & 0x80000000:
+            return
+        self.shadow_apply_us = None
+        if not self.trigger_mode:
+            self.commit_shadow_timing()
+
+    def commit_shadow_timing(self) -> None:
+        """Apply staged timing (commit packet, or frame edge in hardware trigger mode)."""
+        if self.shadow_timing is not None and self.shadow_apply_us is None:
+            self.wait_ns, self.period_ns = self.shadow_timing
+            self.shadow_timing = None
+
     def packet_query(self, type_: int, data: list) -> Tuple[bool, list]:
         """
         Query device (write + read response).
@@ -153,7 +538,7 @@ class SimulatedStrobe:
         self.packet_write(type_, data)
 
         # Simulate reply delay (PIC processing time)
-        time.sleep(self.reply_pause_s)
+        clock.sleep(self.reply_pause_s)
 
         # Generate response based on packet type
         # Note: Real firmware returns [0] for success, then data
@@ -180,6 +565,135 @@ class SimulatedStrobe:
         elif type_ == self.PACKET_TYPE_SET_TRIGGER_MODE:
             # SET_TRIGGER_MODE: returns [0] for success
             response = [0]  # Success
+        elif type_ == self.PACKET_TYPE_SET_TIMING_SHADOW:
+            # SET_TIMING_SHADOW: returns [0] for success, then staged wait_ns, period_ns
+            wait_ns, period_ns = self.shadow_timing or (self.wait_ns, self.period_ns)
+            response = [0]  # Success
+            response.extend(list(wait_ns.to_bytes(4, "little", signed=False)))
+            response.extend(list(period_ns.to_bytes(4, "little", signed=False)))
+        elif type_ == self.PACKET_TYPE_COMMIT_TIMING:
+            # COMMIT_TIMING: returns [0] for success
+            response = [0]  # Success
+        elif type_ == self.PACKET_TYPE_SET_SEQ_ENTRY:
+            # SET_SEQ_ENTRY: returns [rc], then wait_ns (4 bytes), period_ns (4 bytes)
+            rc = self._set_seq_entry(data)
+            wait_ns, period_ns = (0, 0)
+            if rc == 0:
+                wait_ns, period_ns, _ = self.seq_entries[data[0]]
+            response = [rc]
+            response.extend(list(wait_ns.to_bytes(4, "little", signed=False)))
+            response.extend(list(period_ns.to_bytes(4, "little", signed=False)))
+        elif type_ == self.PACKET_TYPE_SET_SEQ:
+            # SET_SEQ: returns [rc, length, loop, active]
+            rc = self._set_seq(data)
+            response = [rc, self.seq_length, int(self.seq_loop), int(self.seq_active)]
+        elif type_ == self.PACKET_TYPE_GET_STROBE_STATS:
+            # GET_STROBE_STATS: returns [0], then 4 counters (4 bytes each)
+            if len(data) <= 1:
+                response = [0]
+                for counter in self.stats:
+                    response.extend(list(counter.to_bytes(4, "little", signed=False)))
+                if len(data) == 1 and data[0]:
+                    self.stats = [0, 0, 0, 0]
+            else:
+                response = [self.ERR_PACKET_INVALID]
+        elif type_ == self.PACKET_TYPE_GET_CAM_READ_STATS:
+            # GET_CAM_READ_STATS: returns [0], count (4), min/max/mean (2 each), 8 bins (2 each)
+            if len(data) <= 1:
+                response = [0] + self._cam_read_stats_response()
+            else:
+                response = [self.ERR_PACKET_INVALID]
+        elif type_ == self.PACKET_TYPE_SET_CAM_READ_HIST:
+            # SET_CAM_READ_HIST: returns [rc]
+            if len(data) == 3 and data[2] <= 15:
+                self.cam_hist_base_us = int.from_bytes(data[0:2], "little", signed=False)
+                self.cam_hist_bin_shift = data[2]
+                response = [0]
+            else:
+                response = [self.ERR_PACKET_INVALID]
+        elif type_ == self.PACKET_TYPE_GET_STROBE_EVENTS:
+            # GET_STROBE_EVENTS: returns [0, remaining, lost], then up to 3 * 7-byte events
+            if len(data) == 0:
+                batch = self.events[:STROBE_EVENTS_PER_PACKET]
+                self.events = self.events[STROBE_EVENTS_PER_PACKET:]
+                response = [0, len(self.events), self.events_lost]
+                self.events_lost = 0
+                for timestamp_us, gate_us, flags in batch:
+                    timestamp_us = (timestamp_us + self.timebase.offset_us) & 0xFFFFFFFF
+                    response.extend(list(timestamp_us.to_bytes(4, "little", signed=False)))
+                    response.extend(list(gate_us.to_bytes(2, "little", signed=False)))
+                    response.append(flags)
+            else:
+                response = [self.ERR_PACKET_INVALID]
+        elif type_ == self.PACKET_TYPE_GET_SPI_STATS:
+            # GET_SPI_STATS: returns [0], then 9 U16 (sizes, then counters that never move here)
+            if len(data) <= 1:
+                response = [0]
+                for value in self.SPI_BUF_SIZES + (0,) * 6:
+                    response.extend(list(value.to_bytes(2, "little", signed=False)))
+            else:
+                response = [self.ERR_PACKET_INVALID]
+        elif type_ == self.PACKET_TYPE_SET_PULSES:
+            # SET_PULSES: returns [rc, count], then gap_ns (4 bytes)
+            rc = self._set_pulses(data)
+            response = [rc, self.pulse_count]
+            response.extend(list(self.pulse_gap_ns.to_bytes(4, "little", signed=False)))
+        elif type_ == self.PACKET_TYPE_ECHO:
+            # ECHO: returns [0] and the payload, up to ECHO_PAYLOAD_MAX bytes
+            if len(data) <= self.ECHO_PAYLOAD_MAX:
+                response = [0] + list(data)
+            else:
+                response = [self.ERR_PACKET_INVALID]
+        elif type_ == self.PACKET_TYPE_TRIG_TEST:
+            # TRIG_TEST: returns [rc, state], then 11 U16 (see PiStrobe.parse_trigger_test())
+            rc = self._trig_test(data)
+            response = [rc, self.trig_test_state] + self.trig_test_report
+        elif type_ == self.PACKET_TYPE_SYNC_TIME:
+            # SYNC_TIME: returns [rc], then synced and local us (U32) and syncs (U16)
+            response = self.timebase.sync(data)
+        elif type_ == self.PACKET_TYPE_GET_CAPABILITIES:
+            # GET_CAPABILITIES: types 1 to 23 and 25, 32 byte buffers, no batching, no control loop
+            types = list(range(self.PACKET_TYPE_SET_ENABLE, self.PACKET_TYPE_SET_FRAME_CLOCK + 1))
+            types.append(self.PACKET_TYPE_SET_STROBE_B)
+            response = capabilities_report(1, 32, 32, 0, 0, types)
+        elif type_ == self.PACKET_TYPE_GET_LOAD_STATS:
+            # GET_LOAD_STATS: returns [0], then the 16 byte load report, all 0 as nothing is timed here
+            if len(data) <= 1:
+                response = [0] + [0] * 16
+            else:
+                response = [self.ERR_PACKET_INVALID]
+        elif type_ == self.PACKET_TYPE_SET_PHASE_LOCK:
+            # SET_PHASE_LOCK: returns [rc], then phase (U16), frame period and wait ns (U32)
+            if len(data) in (0, 2):
+                if len(data) == 2:
+                    self.phase_lock = int.from_bytes(data[0:2], "little")
+                    self.phase_lock_wait_ns = 0
+                response = [0] + list(self.phase_lock.to_bytes(2, "little"))
+                response.extend(list(self.frame_period_ns.to_bytes(4, "little", signed=False)))
+                response.extend(list(self.phase_lock_wait_ns.to_bytes(4, "little", signed=False)))
+            else:
+                response = [self.ERR_PACKET_INVALID]
+        elif type_ == self.PACKET_TYPE_SET_FRAME_CLOCK:
+            # SET_FRAME_CLOCK: returns [rc], then the period made (U32), 0 when stopped
+            rc = self._frame_clock(data)
+            response = [rc] + list(self.frame_clock_period_ns.to_bytes(4, "little", signed=False))
+        elif type_ == self.PACKET_TYPE_SET_STROBE_B:
+            # SET_STROBE_B: returns [rc], then the mode (U8), wait and duration ns as made (U32)
+            rc = self._strobe_b(data)
+            wait_ns, duration_ns = self.strobe_b_timing
+            response = [rc, self.strobe_b_mode]
+            response.extend(list(wait_ns.to_bytes(4, "little", signed=False)))
+            response.extend(list(duration_ns.to_bytes(4, "little", signed=False)))
+        elif type_ == self.PACKET_TYPE_SET_TIMING_RAW:
+            # SET_TIMING_RAW: returns [rc], then the wait_ns and period_ns the registers give
+            timing = self._raw_timing_ns(data)
+            if timing is None:
+                rc = self.ERR_PACKET_INVALID if len(data) not in (9, 13) else self.ERR_STROBE_TIMING_INVALID
+                response = [rc]
+            else:
+                response = [0]
+                for value in timing:
+                    response.extend(list(value.to_bytes(4, "little", signed=False)))
         else:
             valid = False
             response = []
@@ -308,21 +822,21 @@ class SimulatedStrobe:
             return True, cam_read_time_us
         return False, 0
 
-    def set_trigger_mode(self, hardware_trigger: bool) -> bool:
+    def set_trigger_mode(self, hardware_trigger: bool, chained: bool = False) -> bool:
         """
         Set trigger mode (hardware vs software).
 
         Args:
             hardware_trigger: True for hardware trigger mode (camera triggers strobe),
                             False for software trigger mode
+            chained: With hardware_trigger, start the strobe in hardware (mode 2)
 
         Returns:
             True if command was successful, False otherwise
         """
         try:
-            valid, data = self.packet_query(
-                self.PACKET_TYPE_SET_TRIGGER_MODE, [1 if hardware_trigger else 0]
-            )
+            mode = (2 if chained else 1) if hardware_trigger else 0
+            valid, data = self.packet_query(self.PACKET_TYPE_SET_TRIGGER_MODE, [mode])
             success = valid and len(data) > 0 and (data[0] == 0)
             if not success:
                 logger.warning(f"Failed to set trigger mode: hardware={hardware_trigger}")
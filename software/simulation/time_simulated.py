@@ -0,0 +1,52 @@
+"""
+Simulated synchronized timebase.
+
+Answers SYNC_TIME the way the shared rio_time firmware module (and the strobe PIC) does. The
+local clock counts us from when the simulated board was created, on the simulated monotonic
+clock (clock_simulated), so after a sync it matches drivers.spi_handler.host_time_us() exactly.
+"""
+
+from typing import List
+
+from . import clock_simulated as clock
+
+TIME_SYNC_SET = 0
+TIME_SYNC_ADJUST = 1
+
+ERR_PACKET_INVALID = 31
+
+
+class SimulatedTimebase:
+    def __init__(self):
+        self.start_ns = clock.monotonic_ns()
+        self.offset_us = 0
+        self.syncs = 0
+
+    def local_us(self, age_s: float = 0.0) -> int:
+        """The board's own clock, age_s seconds ago."""
+        elapsed_ns = clock.monotonic_ns() - self.start_ns - int(age_s * 1e9)
+        return (elapsed_ns // 1000) & 0xFFFFFFFF
+
+    def now_us(self, age_s: float = 0.0) -> int:
+        """The synchronized clock stamped on samples, age_s seconds ago."""
+        return (self.local_us(age_s) + self.offset_us) & 0xFFFFFFFF
+
+    def sync(self, data: List[int]) -> List[int]:
+        """SYNC_TIME: none, or [mode][value U32] -> [err][synced U32][local U32][syncs U16]."""
+        if data:
+            if len(data) != 5 or data[0] not in (TIME_SYNC_SET, TIME_SYNC_ADJUST):
+                return [ERR_PACKET_INVALID]
+            value = int.from_bytes(bytes(data[1:5]), "little")
+            if data[0] == TIME_SYNC_SET:
+                self.offset_us = (value - self.local_us()) & 0xFFFFFFFF
+            else:
+                self.offset_us = (self.offset_us + value) & 0xFFFFFFFF
+            self.syncs = min(self.syncs + 1, 0xFFFF)
+        local_us = self.local_us()
+        synced_us = (local_us + self.offset_us) & 0xFFFFFFFF
+        return (
+            [0]
+            + list(synced_us.to_bytes(4, "little"))
+            + list(local_us.to_bytes(4, "little"))
+            + list(self.syncs.to_bytes(2, "little"))
+        )
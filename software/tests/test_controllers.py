@@ -21,6 +21,14 @@ from threading import Event
 os.environ["RIO_SIMULATION"] = "true"
 
 
+def _numpy_available():
+    try:
+        import numpy  # noqa: F401
+    except ImportError:
+        return False
+    return True
+
+
 class TestFlowWeb(unittest.TestCase):
     """Test flow web controller"""
 
@@ -51,6 +59,163 @@ class TestFlowWeb(unittest.TestCase):
         # Should have 4 channels
         self.assertEqual(len(targets), 4)
 
+    def test_setpoint_kicks_poller(self):
+        """Test a setpoint makes the status due at once and fast, whatever the backoff"""
+        self.flow.poller.interval_s = self.flow.poller.slow_s
+        self.flow.poller.next_s = float("inf")
+        self.assertTrue(self.flow.set_pressure(0, 100))
+        self.assertTrue(self.flow.poller.due())
+        self.flow.update()
+        self.assertEqual(self.flow.poller.interval_s, self.flow.poller.fast_s)
+
+    def tearDown(self):
+        """Clean up"""
+        from drivers.spi_handler import spi_close
+
+        try:
+            spi_close()
+        except Exception:
+            pass
+
+
+class TestAdaptivePoller(unittest.TestCase):
+    """Test status polls back off once settled and speed up on activity"""
+
+    class FakeClock:
+        """Moved on by hand; the simulated clock cannot be wound back for later tests"""
+
+        def __init__(self):
+            self.now = 100.0
+
+        def monotonic(self):
+            return self.now
+
+        def step(self, seconds):
+            self.now += seconds
+
+    def setUp(self):
+        """Set up test fixtures"""
+        from unittest.mock import patch
+        from drivers import spi_handler
+        from controllers.adaptive_poller import AdaptivePoller
+
+        self.clock = self.FakeClock()
+        patcher = patch.object(spi_handler, "clock", self.clock)
+        patcher.start()
+        self.addCleanup(patcher.stop)
+        self.poller = AdaptivePoller(fast_s=0.25, slow_s=4.0, hold_s=1.0, backoff=2.0)
+
+    def _poll(self, settled):
+        self.assertTrue(self.poller.due())
+        self.poller.polled(settled)
+        interval = self.poller.interval_s
+        self.clock.step(interval - 0.125)
+        self.assertFalse(self.poller.due())
+        self.clock.step(0.125)
+        return interval
+
+    def test_backoff(self):
+        """Test exponential backoff to slow_s, fast again on moving readings or kick()"""
+        intervals = [self._poll(settled=True) for _ in range(6)]
+        self.assertEqual(intervals, [0.5, 1.0, 2.0, 4.0, 4.0, 4.0])
+        self.assertEqual(self._poll(settled=False), 0.25)
+        self.assertEqual(self._poll(settled=True), 0.5)
+
+        self.clock.step(0.1)
+        self.poller.kick()
+        # Held fast for hold_s even with settled readings, then backing off again
+        self.assertEqual([self._poll(settled=True) for _ in range(6)], [0.25] * 4 + [0.5, 1.0])
+
+
+class TestDropletSizeControl(unittest.TestCase):
+    """Test the droplet size loop steering the flow ratio on the simulated flow board"""
+
+    class FakeDropletController:
+        """Results and latency of a DropletDetectorController, without the detector"""
+
+        def __init__(self):
+            self.result_listeners = []
+            self.um_per_px = 2.0
+            self.actions = []
+            self.latency = {"trigger_to_action": {"count": 1, "p90": 150.0}}
+
+        def mark_action(self, frame_index=None, action_us=None):
+            self.actions.append((frame_index, action_us))
+            return True
+
+        def get_latency_metrics(self):
+            return self.latency
+
+        def result(self, frame, diameter_px, droplets):
+            from types import SimpleNamespace
+
+            metrics = [SimpleNamespace(equivalent_diameter=diameter_px)] * droplets
+            for listener in self.result_listeners:
+                listener(frame, metrics)
+
+    def setUp(self):
+        """Set up test fixtures"""
+        from drivers.spi_handler import spi_init, PORT_FLOW
+        from controllers.flow_web import FlowWeb
+        from controllers.droplet_size_control import DropletSizeController
+
+        spi_init(0, 2, 30000)
+        self.flow = FlowWeb(PORT_FLOW)
+        for index in (0, 1):
+            self.assertTrue(self.flow.set_control_mode(index, 2))  # UI Flow Closed Loop
+            self.assertTrue(self.flow.set_flow(index, 100))
+        self.droplets = self.FakeDropletController()
+        self.control = DropletSizeController(
+            self.droplets, self.flow, 0, 1, settle_s=0.0, min_droplets=20, min_window_s=0.0
+        )
+        self.control.min_frequency_hz = 0.0
+
+    def test_enable_needs_flow_closed_loop(self):
+        """Test enable() refuses a channel out of flow closed loop"""
+        self.assertTrue(self.flow.set_control_mode(1, 1))
+        self.assertFalse(self.control.enable(100.0))
+        self.assertFalse(self.control.enabled)
+
+    def test_step(self):
+        """Test a small diameter raises the ratio at the same total, staged, then holds off"""
+        from drivers import spi_handler
+
+        self.assertTrue(self.control.enable(120.0))
+        self.assertTrue(self.control.staged)
+        self.assertEqual(self.control.ratio, 1.0)
+
+        # 100 um measured: one step of gain * ln(1.2), not before min_droplets
+        self.droplets.result(1, 50.0, 10)
+        self.assertEqual(self.droplets.actions, [])
+        self.droplets.result(2, 50.0, 10)
+        self.assertEqual(self.control.measured_diameter_um, 100.0)
+        self.assertEqual(len(self.droplets.actions), 1)
+        frame, apply_us = self.droplets.actions[0]
+        self.assertEqual(frame, 2)
+        self.assertIsNotNone(apply_us)
+        self.assertAlmostEqual(self.control.ratio, 1.2**0.5)
+        self.assertEqual(self.control.last_change["flows_ul_hr"], [105, 95])
+        # Rate limited to the measured trigger to action latency
+        self.assertAlmostEqual(self.control.holdoff_s, 0.15)
+        self.droplets.result(3, 50.0, 20)
+        self.assertEqual(len(self.droplets.actions), 1)
+
+        # Applied by the firmware at the staged time
+        wait_us = spi_handler.time_diff_us(apply_us, spi_handler.host_time_us())
+        spi_handler.clock.sleep(max(0, wait_us) / 1e6 + 0.01)
+        self.assertEqual(self.flow.get_flow_targets()[:2], [105, 95])
+
+    def test_deadband_and_disable(self):
+        """Test diameters within the deadband, or with control disabled, change nothing"""
+        self.assertTrue(self.control.enable(100.0))
+        self.droplets.result(1, 50.5, 10)
+        self.droplets.result(2, 50.5, 10)
+        self.assertEqual(self.control.measured_diameter_um, 101.0)
+        self.control.disable()
+        self.droplets.result(3, 10.0, 20)
+        self.assertEqual(self.droplets.actions, [])
+        self.assertEqual(self.control.get_status()["changes"], 0)
+
     def tearDown(self):
         """Clean up"""
         from drivers.spi_handler import spi_close
@@ -86,6 +251,17 @@ class TestHeaterWeb(unittest.TestCase):
         temp = self.heater.temp_c_actual
         self.assertIsInstance(temp, (int, float))
 
+    def test_history(self):
+        """Test update() collects the firmware history records in order"""
+        import time
+
+        self.heater.update()
+        time.sleep(0.25)
+        self.heater.update()
+        seqs = [record["seq"] for record in self.heater.history]
+        self.assertGreaterEqual(len(seqs), 2)
+        self.assertEqual(seqs, list(range(seqs[0], seqs[0] + len(seqs))))
+
     def tearDown(self):
         """Clean up"""
         from drivers.spi_handler import spi_close
@@ -96,6 +272,421 @@ class TestHeaterWeb(unittest.TestCase):
             pass
 
 
+class TestTelemetryRecorder(unittest.TestCase):
+    """Test the binary telemetry recorder"""
+
+    def setUp(self):
+        """Set up test fixtures"""
+        import tempfile
+
+        self.directory = tempfile.TemporaryDirectory()
+        self.run = self.directory.name
+
+    def _samples(self, count, first=0):
+        # seq and time_us wrap after the first few samples
+        return [
+            {
+                "seq": (65533 + i) & 0xFFFF,
+                "time_us": (0xFFFFFFF0 + 10 * i) & 0xFFFFFFFF,
+                "frame": i,
+                "pressure_actual": [0.5 * i, 1.0, 2.0, 3.0],
+                "flow_actual": [i, -i, 0, 1],
+            }
+            for i in range(first, first + count)
+        ]
+
+    def _chunk_records(self, path, layout):
+        import struct
+        from controllers.telemetry_recorder import HEADER_SIZE
+
+        records = []
+        for name in sorted(os.listdir(path)):
+            if name.endswith(".rec"):
+                with open(os.path.join(path, name), "rb") as f:
+                    data = f.read()
+                count = struct.unpack_from("<Q", data, 16)[0]
+                end = HEADER_SIZE + count * layout.size
+                records.extend(layout.struct.iter_unpack(data[HEADER_SIZE:end]))
+        return records
+
+    def test_chunks(self):
+        """Test records are unwrapped and split over chunk files"""
+        import json
+        from controllers import telemetry_recorder as tr
+
+        layout = tr.flow_telemetry_layout(4)
+        recorder = tr.TelemetryRecorder(self.run, chunk_records=4)
+        self.assertEqual(recorder.record("flow_telemetry", layout, self._samples(3)), 3)
+        self.assertEqual(recorder.record("flow_telemetry", layout, self._samples(7, 3)), 7)
+        path = os.path.join(self.run, "flow_telemetry")
+
+        # Readable while still recording, from the counts in the chunk headers
+        records = self._chunk_records(path, layout)
+        self.assertEqual([r[0] for r in records], list(range(65533, 65543)))
+        self.assertEqual([r[1] for r in records], [0xFFFFFFF0 + 10 * i for i in range(10)])
+        self.assertEqual(records[9][3:7], (4.5, 1.0, 2.0, 3.0))
+        recorder.close()
+
+        with open(os.path.join(path, tr.INDEX_FILE)) as f:
+            index = json.load(f)
+        self.assertEqual([chunk["records"] for chunk in index["chunks"]], [4, 4, 2])
+        self.assertEqual(index["chunks"][1]["first_time_us"], 0xFFFFFFF0 + 40)
+
+        # A new recorder on the same run continues in a new chunk, of the same layout only
+        recorder = tr.TelemetryRecorder(self.run, chunk_records=4)
+        recorder.record("flow_telemetry", layout, self._samples(1))
+        recorder.close()
+        self.assertEqual(len(self._chunk_records(path, layout)), 11)
+        with self.assertRaises(ValueError):
+            recorder.record("flow_telemetry", tr.flow_telemetry_layout(2), self._samples(1))
+
+    @unittest.skipUnless(_numpy_available(), "numpy")
+    def test_read_stream(self):
+        """Test the reader maps the records into numpy"""
+        from controllers import telemetry_recorder as tr
+
+        recorder = tr.TelemetryRecorder(self.run, chunk_records=4)
+        recorder.record("flow_telemetry", tr.flow_telemetry_layout(4), self._samples(6))
+        recorder.close()
+        records = tr.read_run(self.run)["flow_telemetry"]
+        self.assertEqual(len(records), 6)
+        self.assertEqual(list(records["seq"]), list(range(65533, 65539)))
+        self.assertEqual(records["pressure_actual"].shape, (6, 4))
+        self.assertEqual(list(records["flow_actual"][:, 1]), [0, -1, -2, -3, -4, -5])
+
+    def test_controllers(self):
+        """Test the flow and heater controllers record their history"""
+        import time
+        from drivers.spi_handler import spi_init, spi_close, PORT_FLOW, PORT_HEATER1
+        from controllers.flow_web import FlowWeb
+        from controllers.heater_web import heater_web
+        from controllers.telemetry_recorder import TelemetryRecorder
+
+        spi_init(0, 2, 30000)
+        try:
+            flow = FlowWeb(PORT_FLOW)
+            heater = heater_web(1, PORT_HEATER1)
+            recorder = TelemetryRecorder(self.run)
+            self.assertTrue(flow.start_recording(recorder, telemetry_cycles=1))
+            heater.start_recording(recorder)
+            for _ in range(3):
+                flow.update()
+                heater.update()
+                time.sleep(0.15)
+            flow.stop_recording()
+            heater.stop_recording()
+            records = {name: stream.records for name, stream in recorder.streams.items()}
+            recorder.close()
+        finally:
+            spi_close()
+        self.assertGreater(records.get("flow_history", 0), 0)
+        self.assertGreater(records.get("flow_telemetry", 0), 0)
+        self.assertGreater(records.get("heater1_history", 0), 0)
+
+    def tearDown(self):
+        """Clean up"""
+        self.directory.cleanup()
+
+
+class TestHistoryPyramid(unittest.TestCase):
+    """Test the min/max/mean chart history"""
+
+    def setUp(self):
+        """Set up test fixtures"""
+        from controllers.history_pyramid import HistoryPyramid
+
+        # Buckets of 1, 4 and 16 s, 10 kept of each
+        self.pyramid = HistoryPyramid(base_s=1.0, factor=4, levels=3, keep=10)
+        for i in range(80):
+            self.pyramid.add("sig", 1000.0 + i * 0.5, float(i % 8))
+
+    def test_buckets(self):
+        """Test each bucket holds the min, max and mean of its samples"""
+        result = self.pyramid.query("sig", 1030.0, 1040.0, points=10)
+        self.assertEqual(result["level"], 0)
+        self.assertEqual(result["bucket_s"], 1.0)
+        self.assertEqual(result["t"][0], 1030.0)
+        self.assertEqual(len(result["t"]), 10)
+        self.assertEqual((result["min"][0], result["max"][0], result["mean"][0]), (4.0, 5.0, 4.5))
+
+    def test_level_choice(self):
+        """Test a wider or older window comes from a coarser level"""
+        # The 1 s level has dropped the buckets before 1030
+        self.assertEqual(self.pyramid.query("sig", 1000.0, 1040.0, points=100)["level"], 1)
+        self.assertEqual(self.pyramid.query("sig", 1000.0, 1040.0, points=5)["level"], 2)
+        everything = self.pyramid.query("sig")
+        self.assertEqual(everything["level"], 1)
+        self.assertEqual(everything["t"], [1000.0 + 4 * i for i in range(10)])
+        self.assertEqual(everything["min"], [0.0] * 10)
+        self.assertEqual(everything["max"], [7.0] * 10)
+        self.assertEqual(everything["mean"], [3.5] * 10)
+        self.assertIsNone(self.pyramid.query("other"))
+        self.assertEqual(self.pyramid.signals(), ["sig"])
+
+    def test_heater_feed(self):
+        """Test heater_web adds its history records to the charts"""
+        from controllers.history_pyramid import HistoryPyramid
+        from controllers.heater_web import heater_web
+        from drivers.spi_handler import spi_close, spi_init, PORT_HEATER1
+        import time
+
+        spi_init(0, 2, 30000)
+        try:
+            heater = heater_web(1, PORT_HEATER1)
+            heater.charts = HistoryPyramid()
+            heater.update()
+            time.sleep(0.25)
+            heater.update()
+        finally:
+            spi_close()
+        self.assertEqual(
+            heater.charts.signals(),
+            ["heater1.heater_output", "heater1.target_c", "heater1.temp_c"],
+        )
+        result = heater.charts.query("heater1.temp_c")
+        self.assertEqual(result["level"], 0)
+        self.assertGreaterEqual(len(result["t"]), 1)
+        self.assertLessEqual(result["t"][-1], time.time())
+
+
+class TestStateTable(unittest.TestCase):
+    """Test the shared memory device state table"""
+
+    def setUp(self):
+        """Set up test fixtures"""
+        from controllers.state_table import StateTable
+
+        self.name = f"rio_test_{os.getpid()}"
+        self.table = StateTable(self.name, create=True, slots=4, slot_size=1024)
+
+    def tearDown(self):
+        """Clean up"""
+        self.table.close()
+
+    def test_publish_read(self):
+        """Test a reader attached by name sees the latest state of each key"""
+        from controllers.state_table import StateTable
+
+        reader = StateTable(self.name)
+        try:
+            self.assertIsNone(reader.read("flows"))
+            self.assertEqual(self.table.publish("flows", [{"status": "Idle"}]), 2)
+            self.table.publish("heaters", [{"temp_c_actual": 21.5}])
+            self.assertEqual(self.table.publish("flows", [{"status": "Active"}]), 4)
+            seq, published, flows = reader.read("flows")
+            self.assertEqual((seq, flows), (4, [{"status": "Active"}]))
+            self.assertGreater(published, 0)
+            snapshot = reader.snapshot()
+            self.assertEqual(sorted(snapshot), ["flows", "heaters"])
+            self.assertEqual(snapshot["heaters"]["data"], [{"temp_c_actual": 21.5}])
+        finally:
+            reader.close()
+
+    def test_limits(self):
+        """Test a write in progress is not read, and oversized states are refused"""
+        from controllers.state_table import HEADER_SIZE
+
+        self.table.publish("strobe", {"period_ns": 100})
+        self.table._buf[HEADER_SIZE] += 1  # Odd seq, as while being written
+        self.assertIsNone(self.table.read("strobe"))
+        with self.assertRaises(ValueError):
+            self.table.publish("big", "x" * 1024)
+        for key in ("a", "b", "c"):
+            self.table.publish(key, 0)
+        with self.assertRaises(ValueError):
+            self.table.publish("d", 0)
+
+
+class TestPushHub(unittest.TestCase):
+    """Test the coalesced, delta-only Socket.IO pushes"""
+
+    class FakeSocketIO:
+        def __init__(self):
+            self.handlers = {}
+            self.emitted = []
+
+        def on(self, event):
+            def register(handler):
+                self.handlers[event] = handler
+                return handler
+
+            return register
+
+        def emit(self, event, data, to=None):
+            self.emitted.append((event, data, to))
+
+    def setUp(self):
+        """Set up test fixtures"""
+        from path_bootstrap import bootstrap_tests
+
+        bootstrap_tests()
+        from push_hub import PushHub
+
+        self.socketio = self.FakeSocketIO()
+        self.hub = PushHub(self.socketio, rate_hz=10)
+
+    def test_changes(self):
+        """Test only changed values are pushed, in one message per flush"""
+        from push_hub import state_changes
+
+        old = {"text": ["a", "b"], "target": 1.0, "modes": [0, 1]}
+        new = {"text": ["a", "c"], "target": 1.0, "modes": [0, 1, 2]}
+        self.assertEqual(
+            state_changes(old, new, [], []), [[["text", 1], "c"], [["modes"], [0, 1, 2]]]
+        )
+        self.assertEqual(state_changes({"on": 1}, {"on": True}, [], []), [[["on"], True]])
+        self.assertEqual(state_changes({"a": 1}, {"b": 1}, [], []), [[[], {"b": 1}]])
+
+        self.hub.publish("flows", {"text": ["a", "b"], "status": "ok"})
+        self.hub.publish("debug", {"update_count": 1})
+        self.assertEqual(self.socketio.emitted, [])  # Until the next push
+        self.assertTrue(self.hub.flush())
+        event, message, to = self.socketio.emitted[-1]
+        self.assertEqual((event, message["seq"], to), ("push", 1, None))
+        self.assertEqual(message["events"]["flows"], [[[], {"text": ["a", "b"], "status": "ok"}]])
+
+        # Coalesced: only the last of several updates, only what changed
+        self.hub.publish("flows", {"text": ["x", "b"], "status": "ok"})
+        self.hub.publish("flows", {"text": ["a", "d"], "status": "ok"})
+        self.hub.publish("debug", {"update_count": 1})
+        self.assertTrue(self.hub.flush())
+        message = self.socketio.emitted[-1][1]
+        self.assertEqual(message, {"seq": 2, "events": {"flows": [[["text", 1], "d"]]}})
+        self.assertEqual(self.hub.stats["published"], 5)
+
+        # Nothing changed, nothing sent
+        self.hub.publish("debug", {"update_count": 1})
+        self.assertFalse(self.hub.flush())
+        self.assertEqual(len(self.socketio.emitted), 2)
+
+    def test_sync(self):
+        """Test a client gets the whole state to itself on push:sync"""
+        self.hub.publish("heaters", [{"temp": 20.0}])
+        self.hub.flush()
+        self.hub.publish("heaters", [{"temp": 21.0}])
+        self.hub.sync("sid1")
+        pushed, synced = self.socketio.emitted[-2:]
+        self.assertEqual(pushed[1]["events"]["heaters"], [[[0, "temp"], 21.0]])
+        full = {"seq": 2, "full": True, "events": {"heaters": [{"temp": 21.0}]}}
+        self.assertEqual(synced, ("push", full, "sid1"))
+        self.assertIn("push:sync", self.socketio.handlers)
+
+    def test_immediate(self):
+        """Test rate 0 pushes each publish at once"""
+        from push_hub import PushHub
+
+        hub = PushHub(self.socketio, rate_hz=0)
+        hub.publish("cam", {"fps": 30})
+        self.assertEqual(self.socketio.emitted[-1][1]["events"], {"cam": [[[], {"fps": 30}]]})
+
+
+class TestFrameTags(unittest.TestCase):
+    """Test strobe events read as frame tags"""
+
+    class FakeStrobe:
+        def __init__(self):
+            self.events = []
+            self.lost = 0
+
+        def get_strobe_events(self):
+            events, self.events = self.events, []
+            lost, self.lost = self.lost, 0
+            return (True, events, lost)
+
+    def setUp(self):
+        """Set up test fixtures"""
+        from collections import OrderedDict
+        from controllers.strobe_cam import PiStrobeCam
+
+        # No camera or strobe board: only the tag state of PiStrobeCam
+        self.cam = PiStrobeCam.__new__(PiStrobeCam)
+        self.cam.strobe = self.FakeStrobe()
+        self.cam.hardware_trigger_mode = True
+        self.cam.strobe_wait_ns = 500
+        self.cam.strobe_period_ns = 2000
+        self.cam.trigger_count = self.cam.event_count = 0
+        self.cam.frame_tags = OrderedDict()
+
+    def test_tags(self):
+        """Test the n-th event tags frame n, fired on A or B, and a lost count resyncs"""
+        self.cam.trigger_count = 3
+        self.cam.strobe.events = [(100, 40, 0x01), (200, 40, 0x02), (300, 41, 0x18)]
+        tag = self.cam.frame_tag(1)
+        self.assertEqual((tag.frame, tag.strobed, tag.period_ns, tag.wait_ns), (1, True, 2000, 500))
+        self.assertEqual((self.cam.frame_tag(2).strobed, self.cam.frame_tag(2).period_ns), (False, 0))
+        self.assertTrue(self.cam.frame_tag(3).strobed)
+        self.assertTrue(self.cam.frame_tag(3).channel_b)
+        self.assertIsNone(self.cam.frame_tag(4))
+
+        # Events of frames 4 to 8 lost, those read are the latest frames'
+        self.cam.trigger_count = 10
+        self.cam.strobe.events = [(900, 40, 0x01), (1000, 40, 0x04)]
+        self.cam.strobe.lost = 5
+        self.assertEqual(self.cam.frame_tag(10).time_us, 1000)
+        self.assertFalse(self.cam.frame_tag(10).strobed)
+        self.assertEqual(self.cam.frame_tag(9).time_us, 900)
+        self.assertIsNone(self.cam.frame_tag(None))
+
+
+class TestSensorRoi(unittest.TestCase):
+    """Test a sensor ROI raising the framerate limit and retiming the strobe"""
+
+    class FakeStrobe:
+        def set_timing(self, wait_ns, period_ns):
+            return (True, wait_ns, period_ns)
+
+    class FakeCamera:
+        """Reads out 480 rows at 60fps"""
+
+        def __init__(self):
+            self.hardware_roi = None
+            self.config = {}
+
+        def validate_and_snap_roi(self, roi):
+            return (roi[0], roi[1], roi[2] - roi[2] % 2, roi[3] - roi[3] % 2)
+
+        def set_roi_hardware(self, roi):
+            self.hardware_roi = roi
+            return True
+
+        def get_max_resolution(self):
+            return (640, 480)
+
+        def get_max_framerate(self):
+            return 60 * 480 / self.hardware_roi[3]
+
+        def set_config(self, configs):
+            self.config.update(configs)
+
+    def setUp(self):
+        """Set up test fixtures"""
+        from controllers.strobe_cam import PiStrobeCam
+
+        self.cam = PiStrobeCam.__new__(PiStrobeCam)
+        self.cam.strobe = self.FakeStrobe()
+        self.cam.camera = self.FakeCamera()
+        self.cam.hardware_trigger_mode = True
+        self.cam.sensor_roi = None
+        self.cam.max_framerate = 60
+        self.cam.timing = None
+
+    def test_sensor_roi(self):
+        """Test the framerate follows the rows read out, and the full frame restores it"""
+        self.assertTrue(self.cam.set_timing(0, 2000, 0))
+        self.assertEqual(self.cam.camera.config["FrameRate"], 60)
+
+        self.assertTrue(self.cam.set_sensor_roi((10, 20, 101, 121)))
+        self.assertEqual(self.cam.sensor_roi, (10, 20, 100, 120))
+        self.assertEqual(self.cam.max_framerate, 240)
+        self.assertEqual(self.cam.camera.config["FrameRate"], 240)
+        self.assertEqual(self.cam.framerate_set, 240)
+
+        self.assertTrue(self.cam.set_sensor_roi(None))
+        self.assertIsNone(self.cam.sensor_roi)
+        self.assertEqual(self.cam.camera.hardware_roi, (0, 0, 640, 480))
+        self.assertEqual(self.cam.camera.config["FrameRate"], 60)
+
+
 class TestCameraController(unittest.TestCase):
     """Test camera controller"""
 
@@ -11,6 +11,7 @@ Usage:
 """
 
 import os
+import time
 import unittest
 
 # Mock imports available if needed for future tests
@@ -54,6 +55,343 @@ class TestSPIHandler(unittest.TestCase):
         self.spi_select_device(PORT_FLOW)
         self.spi_deselect_current()
 
+    def test_status_sweep(self):
+        """Test an addressed status sweep over two heaters and the flow board"""
+        from drivers import spi_handler
+        from drivers.flow import PiFlow
+        from drivers.heater import PiHolder
+
+        self.spi_init(0, 2, 30000)
+        ports = (spi_handler.PORT_HEATER1, spi_handler.PORT_HEATER2)
+        heaters = [PiHolder(port, 0.01) for port in ports]
+        flow = PiFlow(spi_handler.PORT_FLOW, 0.01)
+        self.assertTrue(heaters[0].set_module_addr(1))
+        self.assertTrue(heaters[1].set_module_addr(2))
+        results = spi_handler.status_sweep(heaters + [flow])
+        self.assertTrue(results[0][0])
+        self.assertTrue(results[1][0])
+        self.assertTrue(results[2][0])
+        self.assertIn("pressure_actual", results[2][1])
+
+        # Only the module of an address runs its batch, and says which it is
+        commands = [(heaters[0].PACKET_TYPE_TEMP_GET_ACTUAL, [])]
+        valid, data = heaters[1].packet_query(
+            heaters[1].PACKET_TYPE_BATCH, spi_handler.build_addressed_batch(1, commands)
+        )
+        self.assertEqual(data, [spi_handler.ERR_MODULE_ADDRESS])
+        valid, data = heaters[1].packet_query(
+            heaters[1].PACKET_TYPE_BATCH,
+            spi_handler.build_addressed_batch(spi_handler.MODULE_ADDR_ANY, commands),
+        )
+        self.assertEqual(spi_handler.parse_addressed_batch(valid, data)[:2], (True, 2))
+
+        # Boards swapped on their chip selects answer for the wrong address
+        heaters[0].module_addr, heaters[1].module_addr = 2, 1
+        results = spi_handler.status_sweep(heaters)
+        self.assertFalse(results[0][0])
+        self.assertFalse(results[1][0])
+        for heater in heaters:
+            self.assertTrue(heater.set_module_addr(spi_handler.MODULE_ADDR_ANY))
+
+    def test_time_diff_us(self):
+        """Test timestamp differences are signed and taken across the 2^32 us wrap"""
+        from drivers.spi_handler import time_diff_us
+
+        self.assertEqual(time_diff_us(5, 0xFFFFFFFB), 10)
+        self.assertEqual(time_diff_us(0xFFFFFFFB, 5), -10)
+        self.assertEqual(time_diff_us(1000, 1000), 0)
+
+    def test_pipeline_query(self):
+        """Test sequenced requests to several boards are matched to their replies"""
+        from drivers.spi_handler import PORT_HEATER1, PORT_FLOW, pipeline_query
+        from drivers.flow import PiFlow
+        from drivers.heater import PiHolder
+
+        self.spi_init(0, 2, 30000)
+        flow = PiFlow(PORT_FLOW, 0.01)
+        heater = PiHolder(PORT_HEATER1, 0.01)
+        results = pipeline_query(
+            [
+                (flow, flow.PACKET_TYPE_GET_CONTROL_MODE, []),
+                (heater, heater.PACKET_TYPE_GET_ID, []),
+                (flow, flow.PACKET_TYPE_GET_ID, []),
+            ]
+        )
+        self.assertTrue(all(valid for valid, _ in results))
+        self.assertEqual(len(results[0][1]), 1 + flow.NUM_CONTROLLERS)
+        self.assertIn(b"MICROFLOW", bytes(results[2][1]))
+
+    def test_stream_read(self):
+        """Test a streamed reply is read chunk by chunk as one transfer"""
+        import time
+        from drivers import spi_handler
+        from drivers.flow import PiFlow
+
+        self.spi_init(0, 2, 30000)
+        flow = PiFlow(spi_handler.PORT_FLOW, 0.01)
+        request = [0, 0, 0xFF, 0xFF]
+        valid, _ = spi_handler.stream_read(flow, flow.PACKET_TYPE_HISTORY_STREAM, request, 0.05)
+        self.assertTrue(valid)
+        time.sleep(0.65)
+        valid, data = spi_handler.stream_read(flow, flow.PACKET_TYPE_HISTORY_STREAM, request, 0.05)
+        self.assertTrue(valid)
+        record_size = 6 + 12 * flow.NUM_CONTROLLERS
+        self.assertEqual(len(data) % record_size, 0)
+        self.assertGreater(len(data), spi_handler.STREAM_HEADER_SIZE + 120)  # Several chunks
+        seqs = [
+            int.from_bytes(bytes(data[i : i + 2]), "little")
+            for i in range(0, len(data), record_size)
+        ]
+        self.assertTrue(all(((b - a) & 0xFFFF) == 1 for a, b in zip(seqs, seqs[1:])))
+
+        # The same records compact, across chunks and ended early by a total = offset chunk
+        valid, plain = spi_handler.stream_read(flow, flow.PACKET_TYPE_HISTORY_STREAM, request, 0.05)
+        valid, data = spi_handler.stream_read(
+            flow, flow.PACKET_TYPE_HISTORY_STREAM, request + [flow.RECORD_FORMAT_COMPACT], 0.05
+        )
+        self.assertTrue(valid)
+        self.assertLess(len(data), len(plain))
+        decoded = []
+        index = 0
+        words = None
+        while index < len(data):
+            index, words = spi_handler.delta_decode(data, words, record_size // 2, index)
+            decoded.extend(spi_handler.delta_record_bytes(words, "little"))
+        self.assertEqual(decoded[: len(plain)], plain)  # A record may have been added since
+
+        # An error reply ends the transfer
+        valid, data = spi_handler.stream_read(flow, flow.PACKET_TYPE_HISTORY_STREAM, [0], 0.05)
+        self.assertFalse(valid)
+        self.assertEqual(data, [])
+
+    def test_delta_decode(self):
+        """Test compact records decode to their words, and what cannot be decoded is not"""
+        import random
+        from drivers import spi_handler
+        from simulation.stream_simulated import delta_encode
+
+        rng = random.Random(87)
+        words = [rng.randrange(0x10000) for _ in range(13)]
+        prev = None
+        data = []
+        expected = []
+        for _ in range(50):
+            data.extend(delta_encode(words, prev))
+            expected.append(list(words))
+            prev = list(words)
+            for w in rng.sample(range(13), 3):
+                words[w] = (words[w] + rng.choice([1, -2, 300, -40000])) & 0xFFFF
+        decoded = []
+        index = 0
+        words = None
+        while index < len(data):
+            index, words = spi_handler.delta_decode(data, words, 13, index)
+            decoded.append(words)
+        self.assertEqual(decoded, expected)
+
+        # A record cut short, and one that needs the record before
+        second = delta_encode(expected[1], expected[0])
+        self.assertEqual(spi_handler.delta_decode(second[:-1], expected[0], 13), (0, None))
+        self.assertEqual(spi_handler.delta_decode(second, None, 13), (len(second), None))
+        self.assertEqual(spi_handler.delta_decode(second, expected[0], 13)[1], expected[1])
+
+    def test_read_frames(self):
+        """Test replies shifted in while writing are found, a cut off one completed"""
+        from drivers import spi_handler
+
+        class Device:
+            device_port = spi_handler.PORT_FLOW
+            crc_mode = spi_handler.CRC_NONE
+
+            def __init__(self, rest):
+                self.rest = list(rest)
+
+            def read_bytes(self, count):
+                data, self.rest = self.rest[:count], self.rest[count:]
+                return data
+
+        self.spi_init(0, 2, 30000)
+        first = spi_handler.build_frame(0xA1, [1, 0, 5])
+        second = spi_handler.build_frame(0xA1, [2, 0, 6, 7])
+        device = Device(second[3:])
+        frames = spi_handler.read_frames(device, [0, 0] + first + second[:3])
+        self.assertEqual(frames, [(True, 0xA1, [1, 0, 5]), (True, 0xA1, [2, 0, 6, 7])])
+        self.assertEqual(device.rest, [])
+
+    def test_spi_benchmark(self):
+        """Test the ECHO benchmark sweeps its cases and finds no errors in simulation"""
+        from drivers import spi_benchmark
+
+        results = spi_benchmark.main(
+            ["--device", "heater", "--sizes", "1,16,200", "--count", "8", "--reply-pause-ms", "0"]
+        )
+        cases = [c for c in results["cases"] if "skipped" not in c]
+        self.assertEqual(len(cases), 6)
+        self.assertIn("skipped", results["cases"][2])
+        for case in cases:
+            self.assertEqual(case["ok"], case["packets"])
+            self.assertEqual(case["firmware_invalid"], 0)
+            self.assertLessEqual(case["p50_ms"], case["p99_ms"])
+        self.assertEqual(spi_benchmark.percentile([4.0, 1.0, 3.0, 2.0], 50), 2.0)
+
+    def test_spi_capture_replay(self):
+        """Test a capture reads back with its replies paired, and replays with none lost"""
+        import tempfile
+        from drivers import spi_handler, spi_replay
+        from drivers.heater import PiHolder
+
+        self.spi_init(0, 2, 30000)
+        heater = PiHolder(spi_handler.PORT_HEATER1, 0)
+        with tempfile.TemporaryDirectory() as directory:
+            path = os.path.join(directory, "capture.bin")
+            spi_handler.capture_start(path)
+            for _ in range(3):
+                heater.get_temp_target()
+            spi_handler.pipeline_query([(heater, PiHolder.PACKET_TYPE_ECHO, [7])])
+            self.assertEqual(spi_handler.capture_stop(), 8)
+            with open(path, "ab") as f:
+                f.write(bytes(5))  # A record cut off is left out
+            records = spi_handler.read_capture(path)
+            self.assertEqual(len(records), 8)
+            self.assertEqual(records[0]["time_us"], 0)
+            requests = spi_replay.pair_replies(records)
+            self.assertEqual(len(requests), 4)
+            self.assertEqual(requests[3]["reply"]["data"][:2], requests[3]["data"][:1] + [0])
+
+            results = spi_replay.main([path, "--speed", "0", "--reply-pause-ms", "0"])
+        self.assertEqual(results["requests"], 4)
+        cases = {case["type"]: case for case in results["cases"]}
+        target = cases[PiHolder.PACKET_TYPE_TEMP_GET_TARGET]
+        self.assertEqual((target["count"], target["ok"]), (3, 3))
+        self.assertEqual(cases[PiHolder.PACKET_TYPE_ECHO | spi_handler.PACKET_SEQ_FLAG]["ok"], 1)
+        self.assertEqual(results["firmware_drops"]["heater1"]["packet_invalid"], 0)
+
+    def test_bench_report(self):
+        """Test a BENCHMARK reply decodes to cycles of the CPU clock, and a short one is refused"""
+        import struct
+        from drivers import spi_handler
+        from drivers.flow import PiFlow
+
+        report = list(struct.pack("<BBHIIIHH", 5, 2, 100, 1171875, 75000000, 1000, 9, 12))
+        valid, result = spi_handler.parse_bench_report(True, [0] + report, PiFlow.BENCH_NAMES)
+        self.assertTrue(valid)
+        self.assertEqual(
+            (result["kernel"], result["kernels"], result["runs"]), ("frame_crc", 5, 100)
+        )
+        self.assertEqual(result["mean_cycles"], 640.0)
+        self.assertEqual((result["min_cycles"], result["max_cycles"]), (576.0, 768.0))
+        names = PiFlow.BENCH_NAMES
+        self.assertFalse(spi_handler.parse_bench_report(True, [0] + report[:-1], names)[0])
+        self.assertFalse(spi_handler.parse_bench_report(True, [1] + report, names)[0])
+
+    def test_bulk_read(self):
+        """Test a reply read in one transfer matches one read a byte per transfer"""
+        from drivers import spi_handler
+        from drivers.heater import PiHolder
+
+        spi = self.spi_init(0, 2, 30000)
+        heater = PiHolder(spi_handler.PORT_HEATER1, 0.01)
+        replies = []
+        for bulk in (True, False):
+            heater.bulk_read_supported = bulk
+            spi_handler.packet_write(heater, heater.PACKET_TYPE_GET_ID, [])
+            transfers = len(spi._transfers)
+            replies.append(spi_handler.packet_read(heater))
+            replies[-1] += (len(spi._transfers) - transfers,)
+        self.assertEqual(replies[0][:3], replies[1][:3])
+        valid, type_read, data, _ = replies[0]
+        self.assertTrue(valid)
+        self.assertEqual(type_read, heater.PACKET_TYPE_GET_ID)
+        self.assertIn(b"SAMPLE_HOLDER", bytes(data))
+        self.assertEqual(replies[0][3], 3)
+        self.assertEqual(replies[1][3], len(data) + 4)
+
+    def test_wait_reply(self):
+        """Test a data-ready edge ends the reply wait early, and no edge times out"""
+        from drivers import spi_handler
+
+        class Device:
+            device_port = spi_handler.PORT_FLOW
+            reply_pause_s = 0.05
+
+        class GPIO:
+            edges = []
+
+            @classmethod
+            def event_detected(cls, pin):
+                return cls.edges.pop(0) if cls.edges else False
+
+        gpio = spi_handler.GPIO
+        spi_handler.GPIO = GPIO
+        spi_handler.READY_PINS[Device.device_port] = 16
+        try:
+            GPIO.edges = [False, False, True]
+            start = time.time()
+            self.assertTrue(spi_handler.wait_reply(Device()))
+            self.assertLess(time.time() - start, Device.reply_pause_s)
+            GPIO.edges = []
+            start = time.time()
+            self.assertFalse(spi_handler.wait_reply(Device()))
+            self.assertGreaterEqual(time.time() - start, Device.reply_pause_s)
+        finally:
+            spi_handler.GPIO = gpio
+            del spi_handler.READY_PINS[Device.device_port]
+
+    def test_crc_frames(self):
+        """Test CRC framing is negotiated per board and used for queries"""
+        from drivers import spi_handler
+        from drivers.heater import PiHolder
+        from drivers.strobe import PiStrobe
+
+        check = list(b"123456789")
+        self.assertEqual(spi_handler.frame_crc(check, spi_handler.CRC_8), [0xF4])
+        self.assertEqual(spi_handler.frame_crc(check, spi_handler.CRC_16), [0xB1, 0x29])
+        frame = spi_handler.build_frame(5, [1, 2], spi_handler.CRC_16)
+        self.assertEqual(spi_handler.parse_frame(frame, spi_handler.CRC_16), (True, [1, 2]))
+        frame[3], frame[4] = frame[4], frame[3]
+        self.assertFalse(spi_handler.parse_frame(frame, spi_handler.CRC_16)[0])
+
+        self.spi_init(0, 2, 30000)
+        heater = PiHolder(spi_handler.PORT_HEATER1, 0.01)
+        strobe = PiStrobe(spi_handler.PORT_STROBE, 0.01)
+        self.assertEqual(spi_handler.negotiate_crc(heater), spi_handler.CRC_16)
+        self.assertEqual(spi_handler.negotiate_crc(strobe), spi_handler.CRC_8)
+        self.assertTrue(heater.get_id()[2])
+        self.assertTrue(strobe.set_enable(False))
+
+    def test_discover(self):
+        """Test GET_CAPABILITIES sets the fast paths and supports() at connect time"""
+        from drivers import spi_handler
+        from drivers.heater import PiHolder
+        from drivers.strobe import PiStrobe
+
+        self.spi_init(0, 2, 30000)
+        heater = PiHolder(spi_handler.PORT_HEATER1, 0.01)
+        strobe = PiStrobe(spi_handler.PORT_STROBE, 0.01)
+        self.assertTrue(spi_handler.supports(strobe, strobe.PACKET_TYPE_SET_TRIGGER_MODE))
+
+        valid, caps = spi_handler.discover(heater)
+        self.assertTrue(valid)
+        self.assertEqual(heater.crc_mode, spi_handler.CRC_16)
+        self.assertTrue(heater.batch_supported)
+        self.assertEqual(caps["loop_period_us"], 100000)
+        self.assertIn(heater.PACKET_TYPE_STAGE, caps["packet_types"])
+        self.assertIn(heater.PACKET_TYPE_HEATER_ZONE, caps["packet_types"])
+        self.assertNotIn(heater.PACKET_TYPE_SUBSCRIBE + 1, caps["packet_types"])
+        self.assertTrue(heater.get_id()[2])
+
+        valid, caps = spi_handler.discover(strobe)
+        self.assertTrue(valid)
+        self.assertEqual(strobe.crc_mode, spi_handler.CRC_8)
+        self.assertEqual(caps["batch_buf"], 0)
+        self.assertTrue(strobe.set_trigger_mode(False))
+
+        # Firmware found without the packet: refused on the host, nothing sent
+        strobe.capabilities["packet_types"].discard(strobe.PACKET_TYPE_SET_TRIGGER_MODE)
+        self.assertFalse(strobe.set_trigger_mode(False))
+
+        self.assertFalse(spi_handler.parse_capabilities(True, [31])[0])
+
     def tearDown(self):
         """Clean up after tests"""
         try:
@@ -62,6 +400,114 @@ class TestSPIHandler(unittest.TestCase):
             pass
 
 
+class TestSPIScheduler(unittest.TestCase):
+    """Test the SPI scheduler's ordering, coalescing and pipelining"""
+
+    def setUp(self):
+        from drivers.spi_handler import spi_init
+        from drivers.spi_scheduler import SpiScheduler
+
+        spi_init(0, 2, 30000)
+        self.scheduler = SpiScheduler()
+
+    def tearDown(self):
+        self.scheduler.stop(1.0)
+
+    def test_priority_order(self):
+        """Test control requests run before UI ones queued earlier"""
+        from drivers.spi_scheduler import PRIORITY_CONTROL, PRIORITY_UI, PRIORITY_BACKGROUND
+
+        order = []
+        self.scheduler.call(order.append, "background", priority=PRIORITY_BACKGROUND)
+        self.scheduler.call(order.append, "ui", priority=PRIORITY_UI)
+        last = self.scheduler.call(order.append, "control", priority=PRIORITY_CONTROL)
+        self.scheduler.start()
+        self.scheduler.call(lambda: None, priority=PRIORITY_BACKGROUND).result(1.0)
+        self.assertTrue(last.done())
+        self.assertEqual(order, ["control", "ui", "background"])
+
+    def test_coalesce(self):
+        """Test a queued key is shared, and raised to the higher priority"""
+        from drivers.spi_scheduler import PRIORITY_CONTROL, PRIORITY_UI
+
+        order = []
+        first = self.scheduler.call(order.append, "update", priority=PRIORITY_UI, key="update")
+        self.scheduler.call(order.append, "command", priority=PRIORITY_UI)
+        second = self.scheduler.call(order.append, "again", priority=PRIORITY_CONTROL, key="update")
+        self.assertIs(first, second)
+        self.scheduler.start()
+        self.scheduler.call(lambda: None).result(1.0)
+        self.assertEqual(order, ["update", "command"])
+        self.assertEqual(self.scheduler.stats["coalesced"], 1)
+
+    def test_pipelined_queries(self):
+        """Test queries for different boards are pipelined and matched to their replies"""
+        from drivers.spi_handler import PORT_HEATER1, PORT_HEATER2
+        from drivers.heater import PiHolder
+
+        heaters = [PiHolder(PORT_HEATER1, 0.01), PiHolder(PORT_HEATER2, 0.01)]
+        futures = [
+            self.scheduler.query(heater, heater.PACKET_TYPE_GET_ID) for heater in heaters
+        ]
+        self.scheduler.start()
+        results = [future.result(2.0) for future in futures]
+        self.assertTrue(all(valid for valid, _ in results))
+        self.assertEqual(self.scheduler.stats["pipelined"], 2)
+
+    def test_exception(self):
+        """Test an exception in a call reaches its future and the worker carries on"""
+        self.scheduler.start()
+        failed = self.scheduler.call(lambda: 1 / 0)
+        with self.assertRaises(ZeroDivisionError):
+            failed.result(1.0)
+        self.assertEqual(self.scheduler.call(lambda: 42).result(1.0), 42)
+
+
+class TestProtocol(unittest.TestCase):
+    """Test the layouts generated from the pressure board's protocol.json"""
+
+    def test_generated_current(self):
+        """Test protocol.h and pressure_protocol.py match protocol.json"""
+        import subprocess
+        import sys
+
+        hardware = os.path.join(os.path.dirname(__file__), "..", "..", "hardware-modules")
+        generator = os.path.join(hardware, "common", "rio_protocol", "gen_protocol.py")
+        definition = os.path.join(
+            hardware, "pressure-flow-control", "pressure_and_flow_pic", "protocol.json"
+        )
+        if not os.path.exists(generator):
+            self.skipTest("hardware-modules not deployed")
+        result = subprocess.run(
+            [sys.executable, generator, "--check", definition], capture_output=True, text=True
+        )
+        self.assertEqual(result.returncode, 0, result.stderr)
+
+    def test_layout_roundtrip(self):
+        """Test a layout encodes and decodes per channel fields, sizes and channel counts"""
+        from drivers import pressure_protocol
+
+        layout = pressure_protocol.STATUS_SNAPSHOT_REPLY
+        self.assertEqual([layout.size(n) for n in (4, 8)], [11 + 4 * 12, 11 + 8 * 12])
+        self.assertEqual(layout.channels(11 + 8 * 12), 8)
+        self.assertIsNone(layout.channels(12))
+        values = {"rc": 0, "seq": 0xFFFE, "time_us": 0x12345678, "frame": 7}
+        for j, (name, _) in enumerate(layout.channel):
+            values[name] = [j * 10 + chan for chan in range(4)]
+        values["pressure_actual"] = [-1, -2, 3, 4]
+        data = layout.encode(values, 4)
+        self.assertEqual(data[:7], bytes([0, 0xFE, 0xFF, 0x78, 0x56, 0x34, 0x12]))
+        self.assertEqual(data[11:13], bytes([0xFF, 0xFF]))  # Channel 0 first, interleaved
+        self.assertEqual(data[13:15], bytes([10, 0]))
+        self.assertEqual(layout.decode(list(data), 4), values)
+
+        layout = pressure_protocol.HISTORY_RECORD
+        values = layout.decode(bytes(range(layout.size(4))), 4)
+        self.assertEqual(values["seq"], 0x0100)
+        self.assertEqual(values["pid_terms"][3][2], 0x3534)  # The last two bytes
+        self.assertEqual(layout.encode(values, 4), bytes(range(layout.size(4))))
+
+
 class TestFlowDriver(unittest.TestCase):
     """Test flow controller driver"""
 
@@ -88,6 +534,519 @@ class TestFlowDriver(unittest.TestCase):
         # In simulation, may return invalid, which is OK
         self.assertIsInstance(valid, bool)
 
+    def test_get_spi_stats(self):
+        """Test SPI diagnostic counters decode"""
+        from drivers.spi_handler import SPI_STATS_FIELDS
+
+        valid, stats = self.flow.get_spi_stats()
+        self.assertTrue(valid)
+        self.assertEqual(set(stats), set(SPI_STATS_FIELDS))
+        self.assertEqual(stats["read_size"], 256)
+        self.assertEqual(stats["packet_size"], 128)
+        self.assertEqual(stats["read_dropped"], 0)
+
+    def test_echo(self):
+        """Test the ECHO packet returns its payload"""
+        self.assertEqual(self.flow.echo(range(100)), (True, list(range(100))))
+        self.assertEqual(self.flow.echo([]), (True, []))
+
+    def test_get_probe_stats(self):
+        """Test the execution time probe report decodes to named probes"""
+        valid, stats = self.flow.get_probe_stats()
+        self.assertTrue(valid)
+        self.assertEqual(stats["timer_hz"], 1171875)
+        self.assertEqual(tuple(stats["probes"]), self.flow.PROBE_NAMES)
+        self.assertEqual(stats["load"]["load_pc"], 0)
+
+    def test_eeprom_status(self):
+        """Test a PID save shows up as committed in the EEPROM write queue status"""
+        valid, _ = self.flow.get_eeprom_status(reset=True)
+        self.assertTrue(valid)
+        self.flow.set_pressure_pid_consts([0], [[100, 10, 0]])
+        valid, status = self.flow.get_eeprom_status()
+        self.assertTrue(valid)
+        self.assertEqual(status["pending"], 0)
+        self.assertIn(status["committed"], (1, 4))  # One slot, four pages on the board
+        self.assertEqual(status["verify_failed"], 0)
+
+    def test_boot_status(self):
+        """Test the board reports boot done, with every flow sensor found"""
+        for _ in range(100):
+            valid, status = self.flow.get_boot_status()
+            if not valid or not status["booting"]:
+                break
+            time.sleep(0.01)  # Probing the flow sensors
+        self.assertTrue(valid)
+        self.assertFalse(status["booting"])
+        self.assertEqual(status["present"], 0x0F)
+        self.assertGreater(status["boot_ms"], 0)
+
+    def test_flow_autotune(self):
+        """Test the flow autotune status decodes and a finished test leaves its gains"""
+        valid, status = self.flow.get_flow_autotune()
+        self.assertTrue(valid)
+        self.assertEqual(len(status), 4)
+        self.assertEqual(set(status[0]), {"state", "fail", "transitions", "settled"})
+        valid, status = self.flow.flow_autotune([1], flow_ul_hr=500, relay_mbar=50)
+        self.assertTrue(valid)
+        self.assertIn(status[1]["state"], ("running", "finished"))
+        if status[1]["state"] == "finished":
+            self.assertEqual(status[1]["fail"], "none")
+            valid, consts = self.flow.get_flow_pid_consts()
+            self.assertTrue(valid)
+            self.assertGreater(consts[1][2], 0)
+        self.assertFalse(self.flow.flow_autotune([1], flow_ul_hr=500, relay_mbar=0)[0])
+
+    def test_pressure_cal(self):
+        """Test a zero capture starts only in mode 0, and a span trim reads back as the span"""
+        valid, cal = self.flow.get_pressure_cal()
+        self.assertTrue(valid)
+        self.assertEqual(len(cal), 4)
+        self.assertEqual(set(cal[0]), {"zero", "span", "state", "left"})
+        self.assertEqual(cal[0]["span"], 1.0)
+        valid, cal = self.flow.capture_pressure_zero([2], samples=8)
+        self.assertTrue(valid)
+        self.assertIn(cal[2]["state"], ("running", "finished"))
+        self.assertTrue(self.flow.set_control_mode([1], [1]))
+        self.assertFalse(self.flow.capture_pressure_zero([1])[0])
+        self.assertTrue(self.flow.set_control_mode([1], [0]))
+        self.assertTrue(self.flow.set_params({"pressure_cal_trim": 64})[0])
+        self.assertEqual(self.flow.get_pressure_cal()[1][0]["span"], 1.03125)
+        self.assertEqual(self.flow.set_params({"pressure_cal_trim": 128}), (False, 111))
+        self.assertTrue(self.flow.set_params({"pressure_cal_trim": 0})[0])
+
+    def test_flow_sched(self):
+        """Test a flow gain schedule is echoed, interpolated on the target and cleared"""
+        points = [(200, 100, 10, 1000), (800, 300, 30, 3000)]
+        self.assertTrue(self.flow.set_flow([2], [500]))
+        valid, sched = self.flow.set_flow_sched(2, points)
+        self.assertTrue(valid)
+        self.assertEqual(sched["points"], points)
+        self.assertTrue(100 <= sched["in_use"][0] <= 300)  # 200 once the setpoint is at 500
+        self.assertFalse(self.flow.set_flow_sched(2, list(reversed(points)))[0])
+        self.assertEqual(self.flow.get_flow_sched(2)[1]["points"], points)
+        valid, sched = self.flow.set_flow_sched(2, [])
+        self.assertTrue(valid)
+        self.assertEqual(sched["points"], [])
+        self.assertEqual(list(sched["in_use"]), self.flow.get_flow_pid_consts()[1][2])
+
+    def test_i2c_stats(self):
+        """Test the I2C bus counters decode per device, and the clock follows i2c_fast_plus"""
+        valid, stats = self.flow.get_i2c_stats(reset=True)
+        self.assertTrue(valid)
+        self.assertEqual(set(stats["adc"]), {"transfers", "nacks", "errors", "timeouts", "aborts"})
+        self.assertEqual(stats["flow"]["nacks"], 0)
+        self.assertEqual(stats["recovery_fails"], 0)
+        self.assertEqual(stats["clock_khz"], 400)
+        self.assertTrue(self.flow.set_params({"i2c_fast_plus": 1})[0])
+        self.assertEqual(self.flow.get_i2c_stats()[1]["clock_khz"], 1000)
+        self.assertTrue(self.flow.set_params({"i2c_fast_plus": 0})[0])
+
+    def test_latency_stats(self):
+        """Test the per channel latency and jitter report decodes, and a bad channel is refused"""
+        valid, stats = self.flow.get_latency_stats(1, reset=True)
+        self.assertTrue(valid)
+        self.assertEqual((stats["loops"], stats["loop"]), (4, 1))
+        self.assertEqual(len(stats["latency"]["bins"]), 16)
+        self.assertEqual(sum(stats["period"]["bins"]), stats["period"]["count"])
+        self.assertFalse(self.flow.get_latency_stats(4)[0])
+
+    def test_detect_channels(self):
+        """Test the channel count from the pressure reply, and the ids of channels 4-7"""
+        self.assertEqual(self.flow.detect_channels(), 4)
+        self.assertEqual(self.flow.HISTORY_REPLY_MAX, 4)
+        self.assertEqual(self.flow.param_id("pressure_limit", 1), 0x69)
+        self.assertEqual(self.flow.param_id("pressure_limit", 5), 0xE9)
+
+    def test_params(self):
+        """Test a configuration saved with get_params() restores with set_params()"""
+        valid, params = self.flow.list_params()
+        self.assertTrue(valid)
+        self.assertEqual(len(params), 113)  # Pages over seven PARAM_LIST replies
+        self.assertEqual(params[0x09]["flags"], 0x01)
+        self.assertEqual(params[0x7C]["max"], 6)
+        self.assertEqual(params[0x40]["type"], "i16")
+        self.assertEqual(self.flow.get_params(["warm_start", "ctrl_event"])[1], {0x06: 1, 0x07: 0})
+        valid, saved = self.flow.get_params()
+        self.assertTrue(valid)
+        writable = {i: v for i, v in saved.items() if not params[i]["flags"] & 0x01}
+        self.assertTrue(self.flow.set_params({"fpid_p": 500, "adc_period_ms": 50})[0])
+        values = self.flow.get_params(["fpid_p", 0x11, 0x01])[1]
+        self.assertEqual(values, {0x10: 500, 0x11: 0, 0x01: 50})
+        self.assertEqual(self.flow.set_params({"adc_period_ms": 2, "fpid_p": 7}), (False, 111))
+        self.assertEqual(self.flow.get_params([0x10])[1][0x10], 500)
+        self.assertEqual(self.flow.get_params(["adc_burst"])[1], {0x70: 1})
+        self.assertEqual(self.flow.set_params({"adc_burst": 17}), (False, 111))
+        self.assertEqual(self.flow.set_params(writable), (True, 0))
+        self.assertEqual(self.flow.get_params(list(writable))[1], writable)
+
+    def test_fault_log(self):
+        """Test the fault log pages newest first over GET_FAULT_LOG replies, with repeats merged"""
+        faults = self.flow._simulated_flow.faults
+        for _ in range(3):
+            faults.log(3)
+        for chan in range(5):
+            faults.log(2, chan)
+        valid, records, pending = self.flow.get_fault_log()
+        self.assertTrue(valid)
+        self.assertEqual(pending, 0)
+        names = [r["name"] for r in records]
+        self.assertEqual(names, ["flow_read_fail"] * 5 + ["i2c_abort", "reset"])
+        self.assertEqual([r["seq"] for r in records], list(range(6, -1, -1)))
+        self.assertEqual(records[0]["arg"], 4)
+        self.assertEqual(records[5]["count"], 3)
+        self.assertEqual(len(self.flow.get_fault_log(max_records=2)[1]), 2)
+
+    def test_batch_query(self):
+        """Test BATCH replies match the individual queries"""
+        valid, replies = self.flow.batch_query(
+            [(self.flow.PACKET_TYPE_GET_CONTROL_MODE, []), (self.flow.PACKET_TYPE_GET_ID, [])]
+        )
+        self.assertTrue(valid)
+        self.assertEqual([t for t, _ in replies], [9, 1])
+        self.assertEqual(replies[0][1], self.flow.packet_query(9, [])[1])
+
+        valid, status = self.flow.get_status()
+        self.assertTrue(valid)
+        self.assertEqual(len(status["flow_actual"]), self.flow.NUM_CONTROLLERS)
+        self.assertEqual(len(status["pid_consts"]), self.flow.NUM_CONTROLLERS)
+
+    def test_get_status_snapshot(self):
+        """Test the snapshot covers all channels and advances once per control cycle"""
+        valid, first = self.flow.get_status_snapshot()
+        self.assertTrue(valid)
+        self.assertEqual(len(first["pressure_output"]), self.flow.NUM_CONTROLLERS)
+        self.assertEqual(len(first["flow_ctrl_states"]), self.flow.NUM_CONTROLLERS)
+
+        valid, status = self.flow.get_status()
+        self.assertTrue(valid)
+        self.assertTrue(self.flow.snapshot_supported)
+        self.assertEqual(status["seq"], (first["seq"] + 1) & 0xFFFF)
+
+    def test_telemetry_stream(self):
+        """Test streamed samples arrive in seq order and stop when telemetry is off"""
+        valid, dropped = self.flow.set_telemetry(1)
+        self.assertTrue(valid)
+        time.sleep(0.35)
+        valid, samples = self.flow.read_telemetry()
+        self.assertTrue(valid)
+        self.assertGreater(len(samples), 0)
+        self.assertEqual(len(samples[0]["flow_actual"]), self.flow.NUM_CONTROLLERS)
+        steps = [(b["seq"] - a["seq"]) & 0xFFFF for a, b in zip(samples, samples[1:])]
+        self.assertTrue(all(step == 1 for step in steps))
+
+        # Compact samples decode to the same fields
+        valid, dropped = self.flow.set_telemetry(1, compact=True)
+        self.assertTrue(valid)
+        time.sleep(0.35)
+        valid, compact = self.flow.read_telemetry()
+        self.assertTrue(valid)
+        self.assertGreater(len(compact), 0)
+        self.assertEqual(compact[0].keys(), samples[0].keys())
+        steps = [(b["seq"] - a["seq"]) & 0xFFFF for a, b in zip(compact, compact[1:])]
+        self.assertTrue(all(step == 1 for step in steps))
+
+        valid, dropped = self.flow.set_telemetry(0)
+        self.assertTrue(valid)
+        time.sleep(0.15)
+        self.assertEqual(self.flow.read_telemetry(), (True, []))
+
+    def test_report_by_exception(self):
+        """Test a subscribed pressure is reported first, then only when it moves"""
+        self.assertFalse(self.flow.subscribe({"pressure9": (5, 0)})[0])
+        valid, status = self.flow.subscribe({"pressure0": (5, 0)})
+        self.assertTrue(valid)
+        self.assertEqual(status["subscribed"], 1)
+        valid, reports = self.flow.read_reports()
+        self.assertTrue(valid)
+        self.assertEqual(len(reports), 1)
+        self.assertEqual(list(reports[0]["values"]), ["pressure0"])
+        self.assertEqual(self.flow.read_reports(), (True, []))
+
+        self.assertTrue(self.flow.set_pressure([0], [120]))
+        time.sleep(0.2)
+        valid, reports = self.flow.read_reports()
+        self.assertTrue(valid)
+        self.assertGreater(reports[-1]["values"]["pressure0"], 5)
+
+        valid, status = self.flow.subscribe({})
+        self.assertTrue(valid)
+        self.assertEqual(status["subscribed"], 0)
+        self.assertEqual(self.flow.read_reports(), (True, []))
+
+    def test_history_drain(self):
+        """Test read_history returns consecutive records and resumes where it stopped"""
+        time.sleep(0.65)
+        valid, records, next_seq = self.flow.read_history(0)
+        self.assertTrue(valid)
+        self.assertGreater(len(records), self.flow.HISTORY_REPLY_MAX)
+        self.assertEqual(len(records[0]["pid_terms"]), self.flow.NUM_CONTROLLERS)
+        steps = [(b["seq"] - a["seq"]) & 0xFFFF for a, b in zip(records, records[1:])]
+        self.assertTrue(all(step == 1 for step in steps))
+        self.assertEqual(next_seq, (records[-1]["seq"] + 1) & 0xFFFF)
+
+        time.sleep(0.25)
+        valid, more, _ = self.flow.read_history(next_seq)
+        self.assertTrue(valid)
+        self.assertEqual(more[0]["seq"], next_seq)
+
+    def test_sync_time(self):
+        """Test the snapshot time is on the host clock, within the sync uncertainty"""
+        from drivers.spi_handler import host_time_us, time_diff_us
+
+        valid, result = self.flow.sync_time(rounds=3)
+        self.assertTrue(valid)
+        self.assertEqual(result["syncs"], 2)
+        start = host_time_us()
+        valid, snapshot = self.flow.get_status_snapshot()
+        end = host_time_us()
+        self.assertTrue(valid)
+        slack = result["uncertainty_us"] + 1000
+        self.assertGreaterEqual(time_diff_us(snapshot["time_us"], start), -slack)
+        self.assertGreaterEqual(time_diff_us(end, snapshot["time_us"]), -slack)
+
+        valid, report = self.flow.get_time()
+        self.assertTrue(valid)
+        self.assertEqual(report["syncs"], 2)
+        valid, data = self.flow.packet_query(self.flow.PACKET_TYPE_SYNC_TIME, [2, 0, 0, 0, 0])
+        self.assertEqual(data, [31])
+
+    def test_frame_sync(self):
+        """Test samples carry the frame that started their cycle only in frame sync mode"""
+        valid, snapshot = self.flow.get_status_snapshot()
+        self.assertTrue(valid)
+        self.assertEqual(snapshot["frame"], 0)
+        self.assertEqual(len(snapshot["flow_actual"]), self.flow.NUM_CONTROLLERS)
+
+        valid, status = self.flow.set_frame_sync(self.flow.FRAME_SYNC_RISING, 2)
+        self.assertTrue(valid)
+        self.assertEqual((status["mode"], status["divider"], status["frames"]), (1, 2, 0))
+        valid, snapshot = self.flow.get_status_snapshot()
+        self.assertEqual(snapshot["frame"], 2)
+        valid, dropped = self.flow.set_telemetry(1)
+        time.sleep(0.25)
+        valid, samples = self.flow.read_telemetry()
+        self.assertGreater(len(samples), 0)
+        frames = [sample["frame"] for sample in samples]
+        self.assertEqual(frames, list(range(4, 4 + 2 * len(frames), 2)))
+        self.flow.set_telemetry(0)
+
+        valid, status = self.flow.get_frame_sync()
+        self.assertTrue(valid)
+        self.assertEqual(status["frames"], frames[-1])
+        self.assertEqual(status["missed"], 0)
+        valid, status = self.flow.set_frame_sync(self.flow.FRAME_SYNC_OFF)
+        self.assertTrue(valid)
+        self.assertFalse(self.flow.set_frame_sync(3)[0])
+        self.assertFalse(self.flow.set_frame_sync(self.flow.FRAME_SYNC_RISING, 0)[0])
+
+    def test_stage(self):
+        """Test staged commands run at their time on the synchronized clock, with their replies dropped"""
+        from drivers import spi_handler
+
+        self.assertTrue(self.flow.sync_time(rounds=1)[0])
+        set_frame_sync = self.flow.PACKET_TYPE_SET_FRAME_SYNC
+        valid, result = spi_handler.stage_together(
+            [
+                lambda t: self.flow.stage(t, set_frame_sync, [self.flow.FRAME_SYNC_RISING, 3]),
+                lambda t: self.flow.stage(t, set_frame_sync, [self.flow.FRAME_SYNC_RISING, 0]),
+            ],
+            lead_us=600000,
+        )
+        self.assertTrue(valid)
+        self.assertEqual(result["staged"], 2)
+        self.assertGreater(result["margin_us"], 0)
+        valid, status = self.flow.get_stage_status()
+        self.assertTrue(valid)
+        self.assertEqual(status["pending"], 2)
+        self.assertEqual(self.flow.get_frame_sync()[1]["mode"], self.flow.FRAME_SYNC_OFF)
+
+        time.sleep(result["margin_us"] / 1e6)
+        valid, status = self.flow.get_frame_sync()
+        self.assertEqual((status["mode"], status["divider"]), (self.flow.FRAME_SYNC_RISING, 3))
+        valid, status = self.flow.get_stage_status()
+        self.assertEqual((status["pending"], status["applied"], status["failed"]), (0, 2, 1))
+        self.assertGreaterEqual(status["error_us"], 0)
+        self.flow.set_frame_sync(self.flow.FRAME_SYNC_OFF)
+
+        apply_us = spi_handler.stage_time_us(10000000)
+        self.assertEqual(self.flow.stage(apply_us, set_frame_sync, [0, 1])[1]["pending"], 1)
+        self.assertEqual(self.flow.cancel_staged()[1]["pending"], 0)
+        self.assertFalse(self.flow.stage(apply_us, self.flow.PACKET_TYPE_BATCH, [])[0])
+        self.assertFalse(self.flow.stage(apply_us, set_frame_sync, [0] * 25)[0])
+
+    def test_loop_config(self):
+        """Test the loop period and data rates round trip and show up in the loop stats"""
+        valid, config = self.flow.get_loop_config()
+        self.assertTrue(valid)
+        self.assertEqual(config, {"period_ms": 100, "data_rates_sps": [128] * 4})
+
+        valid, config = self.flow.set_loop_config(20, [860, 860, 475, 128])
+        self.assertTrue(valid)
+        self.assertEqual(config["data_rates_sps"], [860, 860, 475, 128])
+        self.assertFalse(self.flow.set_loop_config(20, [100] * 4)[0])
+        self.assertFalse(self.flow.set_loop_config(2, [860] * 4)[0])
+
+        valid, stats = self.flow.get_loop_stats(reset=True)
+        self.assertTrue(valid)
+        self.assertEqual(stats["period_ms_last"], 20)
+        self.assertEqual(stats["overruns"], 0)
+
+        valid, config = self.flow.set_loop_config(10, [128] * 4)
+        time.sleep(0.05)
+        valid, stats = self.flow.get_loop_stats()
+        self.assertTrue(valid)
+        self.assertGreater(stats["overruns"], 0)
+
+    def test_adc_config(self):
+        """Test the per-channel ADC gain, mux and data rate round trip, also as parameters"""
+        valid, configs = self.flow.get_adc_config()
+        self.assertTrue(valid)
+        self.assertEqual(configs[2], {"data_rate_sps": 128, "gain": 0, "mux": 5, "gain_in_use": 0})
+
+        config = {"data_rate_sps": 475, "gain": self.flow.ADC_GAIN_AUTO, "mux": 0}
+        valid, configs = self.flow.set_adc_config([1], [config])
+        self.assertTrue(valid)
+        self.assertEqual(configs[1]["gain"], self.flow.ADC_GAIN_AUTO)
+        self.assertEqual(self.flow.ADC_MUX_INPUTS[configs[1]["mux"]], "AIN0-AIN1")
+        self.assertEqual(self.flow.get_loop_config()[1]["data_rates_sps"][1], 475)
+        self.assertEqual(self.flow.get_params(["adc_gain"])[1], {0x38: 0})
+
+        valid, _ = self.flow.set_adc_config([0], [{"data_rate_sps": 8, "gain": 6, "mux": 4}])
+        self.assertFalse(valid)
+        self.assertTrue(self.flow.set_params({0x3D: 5})[0])
+        self.assertEqual(self.flow.get_adc_config()[1][1]["mux"], 5)
+
+    def test_flow_sensor_params(self):
+        """Test the LG16 resolution and CRC check parameters, and the read only error count"""
+        values = self.flow.get_params(["flow_resolution", "flow_crc_check", "flow_crc_errors"])[1]
+        self.assertEqual(values, {0x44: 16, 0x48: 1, 0x4C: 0})
+        self.assertTrue(self.flow.set_params({0x45: 12, 0x49: 0})[0])
+        self.assertEqual(self.flow.get_params([0x45, 0x49])[1], {0x45: 12, 0x49: 0})
+        self.assertEqual(self.flow.set_params({"flow_resolution": 8}), (False, 111))
+        self.assertEqual(self.flow.set_params({"flow_crc_errors": 0}), (False, 112))
+
+    def test_flow_flags_params(self):
+        """Test the sensor flags gate defaults on and the flag event counts are read only"""
+        values = self.flow.get_params(["flow_flags_gate", "flow_air_events", "flow_high_events"])[1]
+        self.assertEqual(values, {0x50: 1, 0x54: 0, 0x58: 0})
+        self.assertTrue(self.flow.set_params({0x51: 0})[0])
+        self.assertEqual(self.flow.get_params([0x51])[1], {0x51: 0})
+        self.assertEqual(self.flow.set_params({"flow_flags_gate": 2}), (False, 111))
+        self.assertEqual(self.flow.set_params({"flow_air_events": 0}), (False, 112))
+
+    def test_flow_res_params(self):
+        """Test the clog and leak watch is off by default, with its reference and limits settable"""
+        valid, values = self.flow.get_params(["flow_res_ref", "flow_res_state", 0x04, 0x05])
+        self.assertTrue(valid)
+        self.assertEqual(values, {0x60: 0, 0x64: 0, 0x04: 50, 0x05: 30})
+        self.assertEqual(self.flow.FLOW_RES_STATES[values[0x64]], "ok")
+        self.assertTrue(self.flow.set_params({0x61: 2000, 0x04: 80})[0])
+        self.assertEqual(self.flow.get_params([0x61, 0x04])[1], {0x61: 2000, 0x04: 80})
+        self.assertEqual(self.flow.set_params({0x05: 100}), (False, 111))
+        self.assertEqual(self.flow.set_params({"flow_res_state": 1}), (False, 112))
+        self.assertEqual(self.flow.FAULT_NAMES[10], "flow_clog")
+
+    def test_pressure_limit(self):
+        """Test a pressure over the channel limit cuts it to mode 0, counted and logged"""
+        self.assertEqual(self.flow.get_params(["pressure_limit"])[1], {0x68: 0})
+        self.assertTrue(self.flow.set_params({0x69: 500})[0])
+        self.assertTrue(self.flow.set_control_mode([1], [1]))
+        self.assertTrue(self.flow.set_pressure([1], [300]))
+        self.assertEqual(self.flow.get_params([0x6D])[1], {0x6D: 0})
+        self.assertTrue(self.flow.set_pressure([1], [1000]))
+        for _ in range(50):  # The regulator lags on the board
+            if self.flow.get_control_modes()[1][1] == 0:
+                break
+            time.sleep(0.05)
+        self.assertEqual(self.flow.get_control_modes()[1][1], 0)
+        self.assertEqual(self.flow.get_params([0x6D])[1], {0x6D: 1})
+        self.assertEqual(self.flow.FAULT_NAMES[12], "overpressure")
+        self.assertEqual(self.flow.set_params({"pressure_trips": 0}), (False, 112))
+
+    def test_pressure_pid_consts(self):
+        """Test the pressure PID gains have defaults and round trip apart from the flow ones"""
+        valid, consts = self.flow.get_pressure_pid_consts()
+        self.assertTrue(valid)
+        self.assertEqual(consts, [[2048, 256, 0]] * 4)
+
+        valid, flow_consts = self.flow.get_flow_pid_consts()
+        self.assertTrue(self.flow.set_pressure_pid_consts([1, 3], [[1000, 100, 10], [4096, 0, 0]]))
+        valid, consts = self.flow.get_pressure_pid_consts()
+        self.assertTrue(valid)
+        self.assertEqual(consts[1], [1000, 100, 10])
+        self.assertEqual(consts[3], [4096, 0, 0])
+        self.assertEqual(consts[0], [2048, 256, 0])
+        self.assertEqual(self.flow.get_flow_pid_consts()[1], flow_consts)
+
+    def test_flow_ff(self):
+        """Test the flow ramp and feedforward settings round trip per channel"""
+        valid, configs = self.flow.get_flow_ff()
+        self.assertTrue(valid)
+        off = {"resistance": 0, "ramp_ul_hr": 0, "feedforward": False, "learn": False}
+        self.assertEqual(configs[0], off)
+
+        config = {"resistance": 166, "ramp_ul_hr": 50, "feedforward": True, "learn": True}
+        valid, configs = self.flow.set_flow_ff([2], [config])
+        self.assertTrue(valid)
+        self.assertEqual(configs[2], config)
+        self.assertFalse(configs[1]["feedforward"])
+
+        valid, _ = self.flow.packet_query(self.flow.PACKET_TYPE_SET_FLOW_FF, [1, 0, 0, 0, 0, 0x80])
+        self.assertEqual(self.flow.get_flow_ff()[1][0]["resistance"], 0)
+
+    def test_signal_filter(self):
+        """Test the pressure and flow filters round trip, and unstable ones are refused"""
+        valid, filters = self.flow.get_signal_filters()
+        self.assertTrue(valid)
+        self.assertEqual(filters[0]["flow"], self.flow.FILTER_PASSTHROUGH)
+
+        coeffs = self.flow.lowpass_filter_coeffs(1.0, 20.0)
+        self.assertEqual(sum(coeffs[:3]) - coeffs[3] - coeffs[4], self.flow.FILTER_COEFF_ONE)
+        valid, filters = self.flow.set_signal_filter([1, 3], self.flow.FILTER_SIGNAL_FLOW, coeffs)
+        self.assertTrue(valid)
+        self.assertEqual(filters[3]["flow"], coeffs)
+        self.assertEqual(filters[3]["pressure"], self.flow.FILTER_PASSTHROUGH)
+        self.assertEqual(filters[2]["flow"], self.flow.FILTER_PASSTHROUGH)
+
+        unstable = (16384, 0, 0, -32768, 16384)
+        valid, _ = self.flow.set_signal_filter([0], self.flow.FILTER_SIGNAL_PRESSURE, unstable)
+        self.assertFalse(valid)
+        filters = self.flow.get_signal_filters()[1]
+        self.assertEqual(filters[0]["pressure"], self.flow.FILTER_PASSTHROUGH)
+        with self.assertRaises(ValueError):
+            self.flow.lowpass_filter_coeffs(10.0, 20.0)
+
+    def test_setpoint_profile(self):
+        """Test a profile uploads in chunks, runs to its end and refuses missing points"""
+        points = [(20, 100 * i) for i in range(12)]
+        self.assertTrue(self.flow.upload_profile(1, points))
+        self.assertFalse(self.flow.upload_profile(1, points * 2))
+
+        valid, status = self.flow.start_profile([3], 2)
+        self.assertFalse(valid)
+
+        valid, status = self.flow.start_profile([1], len(points))
+        self.assertTrue(valid)
+        self.assertTrue(status[1]["active"])
+        self.assertFalse(status[1]["pressure"])
+        time.sleep(0.3)
+        valid, status = self.flow.get_profile_status()
+        self.assertFalse(status[1]["active"])
+        self.assertEqual(status[1]["index"], len(points))
+
+        valid, status = self.flow.start_profile([1], 2, loop=True)
+        time.sleep(0.3)
+        self.assertTrue(self.flow.get_profile_status()[1][1]["active"])
+        valid, status = self.flow.stop_profile([1])
+        self.assertFalse(status[1]["active"])
+
+    def test_batch_rejects_nesting(self):
+        """Test a nested BATCH is refused without disabling batching"""
+        valid, replies = self.flow.batch_query([(self.flow.PACKET_TYPE_BATCH, [])])
+        self.assertFalse(valid)
+        self.assertTrue(self.flow.batch_supported)
+
     def tearDown(self):
         """Clean up"""
         from drivers.spi_handler import spi_close
@@ -123,6 +1082,271 @@ class TestHeaterDriver(unittest.TestCase):
         self.assertIsInstance(valid, bool)
         # In simulation, may not match, which is OK
 
+    def test_get_status(self):
+        """Test the batched status read"""
+        status = self.heater.get_status()
+        self.assertEqual(len(status), 8)
+        self.assertTrue(status[0])
+
+    def test_get_probe_stats(self):
+        """Test the execution time probe report decodes to named probes"""
+        valid, stats = self.heater.get_probe_stats(reset=True)
+        self.assertTrue(valid)
+        self.assertEqual(stats["timer_hz"], 1000000)
+        self.assertEqual(tuple(stats["probes"]), self.heater.PROBE_NAMES)
+        self.assertEqual(stats["probes"]["heater_pid"]["count"], 0)
+        self.assertEqual(stats["load"]["passes"], 0)
+
+    def test_eeprom_status(self):
+        """Test a PID save shows up as committed in the EEPROM write queue status"""
+        valid, _ = self.heater.get_eeprom_status(reset=True)
+        self.assertTrue(valid)
+        self.heater.set_pid_coeffs(100, 10, 0)
+        valid, status = self.heater.get_eeprom_status()
+        self.assertTrue(valid)
+        self.assertEqual(status["pending"], 0)
+        self.assertEqual(status["committed"], 1)
+
+    def test_boot_status(self):
+        """Test the board reports boot done, with the temperature sensor present"""
+        valid, status = self.heater.get_boot_status()
+        self.assertTrue(valid)
+        self.assertFalse(status["booting"])
+        self.assertEqual(status["present"], 1)
+        self.assertGreater(status["boot_ms"], 0)
+
+    def test_latency_stats(self):
+        """Test the heater and stirrer latency reports decode, each at its own period"""
+        for index, loop in enumerate(self.heater.LATENCY_LOOPS):
+            valid, stats = self.heater.get_latency_stats(loop, reset=True)
+            self.assertTrue(valid)
+            self.assertEqual((stats["loops"], stats["loop"]), (2, index))
+            self.assertEqual(stats["period_us"], (100000, 10000)[index])
+            self.assertEqual(sum(stats["latency"]["bins"]), stats["latency"]["count"])
+
+    def test_params(self):
+        """Test bulk parameter reads and writes, with the range checked before any is applied"""
+        valid, params = self.heater.list_params()
+        self.assertTrue(valid)
+        self.assertEqual(params[32], {"type": "i16", "flags": 0x01, "min": -32768, "max": 32767})
+        self.assertTrue(self.heater.set_params({"pid_p": 120, "temp_target": 3750})[0])
+        valid, values = self.heater.get_params(["pid_p", "temp_target", "temp_actual"])
+        self.assertTrue(valid)
+        self.assertEqual(values, {1: 120, 4: 3750, 32: 3750})
+        rejected = self.heater.set_params({"pid_i": 5, "heat_power_limit_pc": 101})
+        self.assertEqual(rejected, (False, 111))
+        self.assertEqual(self.heater.set_params({"temp_actual": 0}), (False, 112))
+        self.assertEqual(self.heater.get_params(["pid_i"])[1], {2: 0})
+        self.assertEqual(self.heater.get_params(["warm_start", "pwm_hires"])[1], {14: 1, 15: 1})
+        self.assertEqual(self.heater.get_params(["stir_period_ms"])[1], {17: 10})
+        self.assertEqual(self.heater.set_params({"stir_period_ms": 1}), (False, 111))
+        self.assertEqual(self.heater.get_params(["heater_output_cap"])[1], {34: 0xFFFF})
+        self.assertEqual(self.heater.set_params({"supply_budget_ma": 3636}), (True, 0))
+        self.assertEqual(self.heater.get_params(["heater_output_cap"])[1], {34: 32762})
+        self.assertEqual(self.heater.set_params({"heater_output_cap": 0}), (False, 112))
+        self.assertEqual(self.heater.set_params({"supply_budget_ma": 0}), (True, 0))
+        self.assertEqual(self.heater.set_params({"observer_shift": 11}), (False, 111))
+        self.assertTrue(self.heater.set_params({"observer_shift": 4})[0])
+        values = self.heater.get_params(["observer_temp", "temp_actual"])[1]
+        self.assertEqual(values[35], values[32])
+        self.assertTrue(self.heater.set_params({"observer_shift": 0})[0])
+
+    def test_set_trace(self):
+        """Test trace regions go to the firmware by name"""
+        self.assertEqual(self.heater.get_params(["trace_mask"])[1], {20: 0x02})
+        self.assertTrue(self.heater.set_trace(["isr_timer1", "heater_pid"]))
+        self.assertEqual(self.heater.get_params(["trace_mask"])[1], {20: 0x11})
+        self.assertFalse(self.heater.set_trace(["i2c_wait"]))
+        self.assertTrue(self.heater.set_trace(["isr_adc"]))
+
+    def test_fault_log(self):
+        """Test the fault log starts with the reset record"""
+        valid, records, pending = self.heater.get_fault_log()
+        self.assertTrue(valid)
+        self.assertEqual(records[-1]["name"], "reset")
+        self.assertEqual(records[-1]["count"], 1)
+
+    def test_get_task_stats(self):
+        """Test the control task report decodes to named tasks"""
+        valid, tasks = self.heater.get_task_stats(reset=True)
+        self.assertTrue(valid)
+        self.assertEqual(tuple(tasks), self.heater.TASK_NAMES)
+        self.assertEqual(tasks["heater"]["missed"], 0)
+
+    def test_pid_model(self):
+        """Test the plant model options round trip and keep unspecified ones"""
+        valid, model = self.heater.pid_model(feedforward=True, sp_weight_pc=60)
+        self.assertTrue(valid)
+        self.assertTrue(model["feedforward"])
+        self.assertEqual(model["sp_weight_pc"], 60)
+        valid, model = self.heater.pid_model(sp_weight_pc=100)
+        self.assertTrue(valid)
+        self.assertTrue(model["feedforward"])
+        self.assertEqual(model["sp_weight_pc"], 100)
+        self.assertFalse(model["boost"])
+        valid, model = self.heater.pid_model(boost=True)
+        self.assertTrue(valid)
+        self.assertTrue(model["feedforward"] and model["boost"])
+        valid, model = self.heater.pid_model(feedforward=False, boost=False)
+        self.assertTrue(valid)
+        self.assertFalse(model["feedforward"] or model["boost"])
+
+    def test_adc_filter(self):
+        """Test the ADC filter configuration round trips and the filtered noise is lower"""
+        valid, config = self.heater.adc_filter(mode="average", iir_shift=6)
+        self.assertTrue(valid)
+        self.assertEqual(config["mode"], "average")
+        self.assertEqual(config["result_bits"], 12)
+        self.assertLess(config["filtered_rms_c"], config["raw_rms_c"])
+        valid, config = self.heater.adc_filter(mode="oversample")
+        self.assertTrue(valid)
+        self.assertEqual(config["iir_shift"], 6)
+        self.assertEqual(config["result_bits"], 16)
+        valid, _ = self.heater.adc_filter(iir_shift=9)
+        self.assertFalse(valid)
+
+    def test_heater_zone(self):
+        """Test zone 1 needs gains to run, keeps them when stopped, and zone 0 is refused"""
+        valid, status = self.heater.heater_zone(1)
+        self.assertTrue(valid)
+        self.assertEqual(status["state"], "unconfigured")
+        self.assertFalse(self.heater.heater_zone(1, running=True, temp_c=37.0)[0])
+        self.assertFalse(self.heater.heater_zone(0)[0])
+        valid, status = self.heater.heater_zone(1, running=True, temp_c=37.0, pid=(2044, 385, 7230))
+        self.assertTrue(valid)
+        self.assertEqual((status["state"], status["target_c"]), ("running", 37.0))
+        self.assertEqual(status["pid"], (2044, 385, 7230))
+        valid, status = self.heater.heater_zone(1, running=False)
+        self.assertTrue(valid)
+        self.assertEqual((status["state"], status["target_c"]), ("ready", 37.0))
+        self.assertEqual(status["output"], 0)
+        self.assertFalse(self.heater.heater_zone(1, running=True, temp_c=81.0)[0])
+
+    def test_report_by_exception(self):
+        """Test heater reports come on the interval while the temperature holds still"""
+        import time
+
+        self.assertFalse(self.heater.subscribe({"zone2": (0.5, 0)})[0])
+        valid, status = self.heater.subscribe({"temp": (0.5, 100), "stir_speed": (None, 0)})
+        self.assertTrue(valid)
+        self.assertEqual(status["subscribed"], 1)
+        valid, reports = self.heater.read_reports()
+        self.assertTrue(valid)
+        self.assertEqual(list(reports[0]["values"]), ["temp"])
+        self.assertEqual(self.heater.read_reports(), (True, []))
+        time.sleep(0.15)
+        valid, reports = self.heater.read_reports()
+        self.assertEqual(len(reports), 1)
+        self.assertTrue(self.heater.subscribe({})[0])
+
+    def test_read_history(self):
+        """Test the heater history is read up to the newest record and resumes from there"""
+        import time
+
+        valid, history = self.heater.get_history(0)
+        self.assertTrue(valid)
+        time.sleep(0.35)
+        valid, records, next_seq = self.heater.read_history(history["oldest_seq"])
+        self.assertTrue(valid)
+        self.assertGreaterEqual(len(records), 3)
+        first = records[0]["seq"]
+        self.assertEqual([r["seq"] for r in records], list(range(first, first + len(records))))
+        self.assertEqual(next_seq, first + len(records))
+        self.assertAlmostEqual(records[-1]["temp_c"], 25.0)
+        valid, history = self.heater.get_history(next_seq + 100)
+        self.assertTrue(valid)
+        self.assertEqual(history["records"], [])
+
+    def test_history_time(self):
+        """Test heater history records are one heater period apart on the synced clock"""
+        import time
+        from drivers.spi_handler import time_diff_us
+
+        valid, _ = self.heater.sync_time(rounds=2)
+        self.assertTrue(valid)
+        valid, history = self.heater.get_history(0)
+        self.assertTrue(valid)
+        time.sleep(0.35)
+        valid, records, _ = self.heater.read_history(history["oldest_seq"])
+        self.assertTrue(valid)
+        steps = [time_diff_us(b["time_us"], a["time_us"]) for a, b in zip(records, records[1:])]
+        self.assertTrue(steps)
+        self.assertTrue(all(abs(step - 100000) < 1000 for step in steps))
+
+    def test_stir_ramp_status(self):
+        """Test the stirrer soft start status decodes the setpoint and stall count"""
+        self.assertTrue(self.heater.set_stir_running(1, 15, accel_rps_per_s=5))
+        valid, status = self.heater.get_stir_ramp_status()
+        self.assertTrue(valid)
+        self.assertEqual(status["phase"], "ramp")
+        self.assertEqual(status["stalls"], 0)
+        self.assertEqual(status["setpoint_rps"], 15)
+
+    def test_profile(self):
+        """Test a profile needs its segments and the PID, and reports its progress"""
+        self.assertTrue(self.heater.set_profile_segment(0, 37.0, 2.0, 600))
+        valid, _ = self.heater.set_profile_running(2)
+        self.assertFalse(valid)
+        self.assertTrue(self.heater.set_pid_running(1, 25.0))
+        valid, status = self.heater.set_profile_running(1)
+        self.assertTrue(valid)
+        self.assertEqual(status["state"], "ramp")
+        self.assertEqual(status["length"], 1)
+        self.assertEqual(status["hold_left_s"], 600)
+        self.assertFalse(self.heater.set_profile_segment(0, 40.0, 0, 60))
+        valid, status = self.heater.set_profile_running(0)
+        self.assertTrue(valid)
+        self.assertEqual(status["state"], "idle")
+
+    def test_get_autotune_remaining(self):
+        """Test the autotune time remaining decodes as 0 when not running"""
+        self.assertTrue(self.heater.set_autotune_running(0, 40.0, fast=True))
+        valid, remaining_s = self.heater.get_autotune_remaining_s()
+        self.assertTrue(valid)
+        self.assertEqual(remaining_s, 0)
+
+    def test_flasher(self):
+        """Test a firmware update from an Intel HEX file"""
+        import tempfile
+        from drivers import flasher
+
+        def record(addr, type_, payload):
+            raw = bytes([len(payload)]) + addr.to_bytes(2, "big") + bytes([type_]) + payload
+            return ":" + (raw + bytes([-sum(raw) & 0xFF])).hex().upper() + "\n"
+
+        # Six instructions from 0x000200 (byte address 0x400), the third erased, and a
+        # configuration word past the partition
+        code = b"".join(
+            (word | 0xAB000000).to_bytes(4, "little")
+            for word in (0x040200, 0x000000, 0xFFFFFF, 0xFFFFFF, 0x123456, 0xFE0000)
+        )
+        with tempfile.TemporaryDirectory() as directory:
+            path = os.path.join(directory, "image.hex")
+            with open(path, "w") as f:
+                f.write(record(0, 4, b"\x00\x00") + record(0x0400, 0, code))
+                f.write(record(0, 4, b"\x00\x05") + record(0x0000, 0, b"\x7F\xFF\xFF\x00"))
+                f.write(record(0, 1, b""))
+            words = flasher.read_hex(path)
+        self.assertEqual(words[0x0200], 0x040200)
+        self.assertEqual(words[0x0208], 0x123456)
+        self.assertEqual(words[0x028000], 0xFFFF7F)
+
+        chunks = flasher.image_chunks(words, 0x016000)
+        self.assertEqual(chunks, [(0x0200, [0x040200, 0x000000]), (0x0208, [0x123456, 0xFE0000])])
+        size, crc = flasher.image_crc(chunks)
+        self.assertEqual(size, 0x020C)
+
+        update = flasher.Flasher(self.heater, self.heater.PACKET_TYPE_FLASH, timeout_s=2.0)
+        before = update.status()["boot_seq"]
+        result = update.update(words)
+        self.assertTrue(result["ok"], result["error"])
+        self.assertEqual((result["words"], result["chunks"], result["crc"]), (4, 2, crc))
+        self.assertEqual(result["boot_seq_after"], before - 1 if before != 0xFFF else 0xFFE)
+
+        # A WRITE without a fresh ERASE is refused
+        with self.assertRaises(flasher.FlashError):
+            update.write(0x0200, [0x000000, 0x000000])
+
     def tearDown(self):
         """Clean up"""
         from drivers.spi_handler import spi_close
@@ -160,6 +1384,53 @@ class TestStrobeDriver(unittest.TestCase):
         result = self.strobe.set_enable(False)
         self.assertIsInstance(result, bool)
 
+    def test_echo(self):
+        """Test the ECHO packet returns its payload, up to ECHO_PAYLOAD_MAX bytes"""
+        payload = list(range(self.strobe.ECHO_PAYLOAD_MAX))
+        self.assertEqual(self.strobe.echo(payload), (True, payload))
+        self.assertFalse(self.strobe.echo(payload + [0])[0])
+
+    def test_sync_time(self):
+        """Test the strobe clock can be synced and read back"""
+        valid, result = self.strobe.sync_time(rounds=2)
+        self.assertTrue(valid)
+        self.assertEqual(result["syncs"], 2)
+        self.assertGreaterEqual(result["uncertainty_us"], 0)
+
+    def test_get_load_stats(self):
+        """Test the load report decodes, and the dsPIC layout decodes the same after the probes"""
+        from drivers import spi_handler
+
+        valid, load = self.strobe.get_load_stats(reset=True)
+        self.assertTrue(valid)
+        self.assertEqual(load["load_pc"], 0)
+
+        report = [0x6F, 1, 0x6F, 1, 125, 0, 100, 0, 100, 0, 0x90, 1, 0x6A, 0x18, 0, 0]
+        load = spi_handler.parse_load_report(report, 1000000)
+        self.assertEqual((load["load_pc"], load["isr_pc"], load["passes"]), (36.7, 12.5, 6250))
+        self.assertEqual(load["pass_max_us"], 400)
+        probes = [0] + list((1000000).to_bytes(4, "little")) + [1] + [0] * 10
+        self.assertEqual(spi_handler.parse_probe_stats(True, probes + report, ["a"])[1]["load"], load)
+        self.assertNotIn("load", spi_handler.parse_probe_stats(True, probes, ["a"])[1])
+        self.assertFalse(spi_handler.parse_probe_stats(True, probes + report[:8], ["a"])[0])
+
+    def test_trigger_test(self):
+        """Test the trigger self-test needs the strobe enabled and reports its latencies in ns"""
+        self.strobe.set_enable(False)
+        valid, report = self.strobe.start_trigger_test(100, 1000)
+        self.assertFalse(valid)
+        self.assertEqual(report["rc"], 42)
+        self.strobe.set_enable(True)
+        valid, report = self.strobe.run_trigger_test(100, 1000, poll_s=0)
+        self.assertTrue(valid)
+        self.assertEqual(report["state"], self.strobe.TRIG_TEST_IDLE)
+        self.assertEqual(report["edges"], 100)
+        self.assertEqual(report["period_us"], 1008)
+        self.assertLessEqual(report["isr_min_ns"], report["isr_mean_ns"])
+        self.assertEqual(report["isr_jitter_ns"], report["isr_max_ns"] - report["isr_min_ns"])
+        self.assertGreater(report["output_min_ns"], report["isr_min_ns"])
+        self.strobe.set_enable(False)
+
     def test_set_timing(self):
         """Test strobe timing configuration"""
         wait_ns = 1000
@@ -170,6 +1441,79 @@ class TestStrobeDriver(unittest.TestCase):
         self.assertEqual(len(result), 3)
         self.assertIsInstance(result[0], bool)
 
+    def test_plan_timing(self):
+        """Test the host timer planning gives the firmware's registers and ns (test_strobe.c)"""
+        from drivers import strobe
+
+        self.assertEqual(strobe.find_scalers_time(strobe.MAX_TIME_NS), (strobe.MAX_TIME_NS, 7, 15, 254))
+        self.assertEqual(strobe.find_scalers_time(strobe.MAX_TIME_NS + 1)[0], 0)
+        self.assertEqual(strobe.find_scalers_time(25000), (25000, 1, 15, 24))
+
+        timing = strobe.plan_timing(12345678, 1000)
+        self.assertEqual(timing.wait_ns, 12345687)
+        self.assertEqual(timing.smt_pr, 395062 - 98 - 1)
+        self.assertEqual((timing.pr2, timing.t2con), (1, 0))
+        self.assertEqual(strobe.plan_timing(strobe.MAX_LONG_TIME_NS, 1000).wait_ns, strobe.MAX_LONG_TIME_NS)
+        self.assertIsNone(strobe.plan_timing(strobe.MAX_LONG_TIME_NS + 1, 1000))
+        self.assertIsNone(strobe.plan_timing(1000, strobe.MAX_TIME_NS + 1))
+
+        # Planned registers decode to the ns planned, as decode_strobe_timing()
+        for wait_ns in (0, 100, 1000, 29985, 200000, 1000003, 16319999, 200000000):
+            timing = strobe.plan_timing(wait_ns, 312)
+            if timing is None:
+                continue
+            self.assertLessEqual(abs(timing.wait_ns - wait_ns), strobe.LONG_WAIT_ERR_NS)
+            self.assertEqual(strobe.raw_timing_ns(*timing[:5]), (timing.wait_ns, timing.duration_ns))
+        self.assertIsNone(strobe.raw_timing_ns(0, 0, 9, 0))
+        self.assertIsNone(strobe.raw_timing_ns(1, 0x80, 9, 0))
+        self.assertIsNone(strobe.raw_timing_ns(1, 0, 9, 0, strobe.LONG_WAIT_TICKS_MAX))
+
+    def test_phase_lock(self):
+        """Test phase lock is sent in 1/65536 and the frame period report decodes"""
+        valid, report = self.strobe.set_phase_lock(0.25)
+        self.assertTrue(valid)
+        self.assertEqual(report["phase"], 0.25)
+        self.assertEqual(self.strobe.set_phase_lock(2)[1]["phase"], 65535 / 65536)
+        valid, report = self.strobe.get_frame_period()
+        self.assertTrue(valid)
+        self.assertEqual(set(report), {"phase", "frame_period_ns", "wait_ns"})
+        self.assertEqual(self.strobe.set_phase_lock(0)[1]["phase"], 0)
+
+    def test_frame_clock(self):
+        """Test the frame clock period is rounded as the firmware makes it, and stops with 0"""
+        self.assertEqual(self.strobe.set_frame_clock(33333333), (True, 33333000))
+        self.assertEqual(self.strobe.get_frame_clock(), (True, 33333000))
+        self.assertFalse(self.strobe.set_frame_clock(self.strobe.FRAME_CLOCK_PERIOD_MIN_NS - 1)[0])
+        self.assertEqual(self.strobe.set_frame_clock(0), (True, 0))
+
+    def test_channel_b(self):
+        """Test channel B is planned as the firmware makes it, and the driver reports it"""
+        from drivers import strobe
+
+        self.assertEqual(strobe.plan_channel_b(10000, 5000), (119, 0x00, 320, 10000, 5000))
+        planned = strobe.plan_channel_b(1000000, 2000000)
+        self.assertEqual(planned, (187, 0x70, 250, 1000000, 2008000))
+        self.assertEqual(strobe.plan_channel_b(0, strobe.STROBE_B_MAX_TIME_NS)[3:], (4000, 4092000))
+        self.assertIsNone(strobe.plan_channel_b(1000, 0))
+        self.assertIsNone(strobe.plan_channel_b(1000, strobe.STROBE_B_MAX_TIME_NS))
+
+        valid, report = self.strobe.set_channel_b(self.strobe.STROBE_B_ALTERNATE, 1000000, 2000000)
+        self.assertTrue(valid)
+        self.assertEqual(report, {"mode": 2, "wait_ns": 1000000, "duration_ns": 2008000})
+        self.assertEqual(self.strobe.get_channel_b(), (True, report))
+        self.assertFalse(self.strobe.set_channel_b(3, 1000, 1000)[0])
+        self.assertEqual(self.strobe.set_channel_b(self.strobe.STROBE_B_OFF)[1]["mode"], 0)
+
+    def test_set_timing_raw(self):
+        """Test planned registers are sent as they are and the achieved ns come back"""
+        from drivers import strobe
+
+        timing = strobe.plan_timing(200000000, 1000)
+        self.assertEqual(self.strobe.set_timing_raw(timing), (True, timing.wait_ns, timing.duration_ns))
+        self.assertEqual(self.strobe.set_timing_raw(timing, shadow=True)[0], True)
+        self.assertTrue(self.strobe.commit_timing())
+        self.assertFalse(self.strobe.set_timing_raw((0, 0, 9, 0, 0))[0])
+
     def tearDown(self):
         """Clean up"""
         from drivers.spi_handler import spi_close
@@ -161,6 +161,26 @@ class TestPreprocessor(unittest.TestCase):
         mask = self.preprocessor.process(self.test_image)
         self.assertEqual(mask.dtype, np.uint8)
 
+    def test_buffer_reuse(self):
+        """Test pooled buffers and the fused open+close give the allocating path's mask."""
+        masks = {}
+        for reuse, fused in ((False, False), (True, False), (True, True)):
+            config = DropletDetectionConfig(
+                {
+                    "background_method": "highpass",
+                    "morph_operation": "both",
+                    "reuse_buffers": reuse,
+                    "fused_morphology": fused,
+                }
+            )
+            preprocessor = Preprocessor(config)
+            first = preprocessor.process(self.test_image)
+            masks[(reuse, fused)] = first.copy()
+            # Pooled: the same array is written again for the same ROI size
+            self.assertEqual(preprocessor.process(self.test_image) is first, reuse)
+        np.testing.assert_array_equal(masks[(True, False)], masks[(False, False)])
+        np.testing.assert_array_equal(masks[(True, True)], masks[(False, False)])
+
     def test_reset_background(self):
         """Test background reset."""
         for _ in range(5):
@@ -456,6 +476,38 @@ class TestDropletHistogram(unittest.TestCase):
         self.assertIn("diameter", stats)
         self.assertGreater(stats["width"]["mean"], 0)
 
+    def test_statistics_sliding_window(self):
+        """Incremental statistics match a computation over the window, through evictions."""
+        histogram = DropletHistogram(maxlen=10, bins=20, pixel_ratio=2.0, unit="um")
+        rng = np.random.default_rng(3)
+        for _ in range(57):
+            length = float(rng.integers(10, 20)) + float(rng.random())
+            histogram.update(
+                [
+                    DropletMetrics(
+                        area=length * 8.0,
+                        major_axis=length,
+                        equivalent_diameter=length * 0.7,
+                        centroid=(50.0, 50.0),
+                        bounding_box=(40, 40, int(length), 8),
+                        aspect_ratio=1.0,
+                    )
+                ]
+            )
+            stats = histogram.get_statistics()
+            self.assertEqual(stats["count"], len(histogram.widths))
+            window = np.array(histogram.widths)
+            values, counts = np.unique(np.round(window).astype(int), return_counts=True)
+            self.assertAlmostEqual(stats["width"]["mean"], window.mean() * 2.0, delta=1)
+            self.assertAlmostEqual(stats["width"]["std"], window.std() * 2.0, delta=1)
+            self.assertEqual(stats["width"]["min"], int(round(window.min() * 2.0)))
+            self.assertEqual(stats["width"]["max"], int(round(window.max() * 2.0)))
+            self.assertEqual(stats["width"]["mode"], int(round(values[counts.argmax()] * 2.0)))
+            self.assertEqual(stats["area"]["max"], int(round(max(histogram.areas) * 4.0)))
+
+        histogram.clear()
+        self.assertEqual(histogram.get_statistics()["width"]["mean"], 0)
+
     def test_to_json(self):
         """Test JSON serialization."""
         metrics = [
@@ -571,6 +623,28 @@ class TestDropletDetector(unittest.TestCase):
             # Measurement is only called if moving_contours exist after artifact rejection
             # It's possible all contours are filtered out, so measurement may not be present
 
+    def test_strobe_tags(self):
+        """Test frames tagged as not strobed are skipped, and the tagged exposure scales."""
+        from types import SimpleNamespace
+
+        unstrobed = SimpleNamespace(strobed=False, period_ns=0)
+        strobed = SimpleNamespace(strobed=True, period_ns=2000)
+
+        # Without gating an unstrobed frame is processed at the reference exposure
+        self.detector.process_frame(self.test_image, tag=unstrobed)
+        self.assertEqual((self.detector.frame_count, self.detector.unstrobed_skipped), (1, 0))
+
+        self.config.strobe_gating = True
+        self.config.reference_strobe_ns = 1000
+        self.assertEqual(self.detector.process_frame(self.test_image, tag=unstrobed), [])
+        self.assertEqual((self.detector.frame_count, self.detector.unstrobed_skipped), (1, 1))
+        self.assertEqual(self.detector.preprocessor.exposure_scale, 1.0)
+
+        self.detector.process_frame(self.test_image, tag=strobed)
+        self.assertEqual(self.detector.frame_count, 2)
+        self.assertEqual(self.detector.preprocessor.exposure_scale, 2.0)
+        self.assertEqual(self.detector.artifact_rejector.exposure_scale, 2.0)
+
     def test_reset(self):
         """Test detector reset."""
         # Initialize and process
@@ -633,6 +707,54 @@ class TestIntegration(unittest.TestCase):
         self.assertGreaterEqual(stats["count"], 0)
 
 
+class TestDetectionPipeline(unittest.TestCase):
+    """Test the multi-process pipeline over the shared-memory ring."""
+
+    def setUp(self):
+        """Set up test fixtures."""
+        import time
+
+        self.time = time
+        self.config = DropletDetectionConfig({"background_frames": 2})
+        self.roi = (0, 0, 200, 100)
+        self.pipeline = droplet_detection.DetectionPipeline(self.roi, self.config, workers=2)
+        self.test_image = np.zeros((100, 200, 3), dtype=np.uint8)
+        cv2.ellipse(self.test_image, (100, 50), (30, 10), 0, 0, 360, (255, 255, 255), -1)
+
+    def tearDown(self):
+        """Clean up."""
+        self.pipeline.close()
+
+    def _collect(self, count):
+        results = []
+        deadline = self.time.monotonic() + 10.0
+        while len(results) < count and self.time.monotonic() < deadline:
+            results.extend(self.pipeline.results(timeout=0.1))
+        return results
+
+    def test_results_in_order(self):
+        """Test every submitted frame comes back once, in submission order."""
+        frame_ids = []
+        for i in range(12):
+            while not self.pipeline.submit(self.test_image, frame_id=i):
+                frame_ids.extend(r[0] for r in self.pipeline.results(timeout=0.1))
+        frame_ids.extend(r[0] for r in self._collect(12 - len(frame_ids)))
+        self.assertEqual(frame_ids, list(range(12)))
+        self.assertEqual(self.pipeline.pending(), 0)
+
+    def test_drops(self):
+        """Test frames are dropped with the ring full or larger than a slot."""
+        self.assertFalse(self.pipeline.submit(np.zeros((200, 200, 3), dtype=np.uint8)))
+        submitted = sum(self.pipeline.submit(self.test_image) for _ in range(10))
+        self.assertEqual(submitted, self.pipeline.slots)
+        self.assertEqual(self.pipeline.dropped, 11 - submitted)
+        results = self._collect(submitted)
+        self.assertEqual(len(results), submitted)
+        for _, metrics, timings in results:
+            self.assertIsInstance(metrics, list)
+            self.assertIn("preprocessing", timings)
+
+
 if __name__ == "__main__":
     # Run tests
     unittest.main(verbosity=2)
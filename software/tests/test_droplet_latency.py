@@ -0,0 +1,61 @@
+"""
+Test the live pipeline latency kept by the droplet detector controller.
+
+Trigger, arrival, result and action stamps on spi_handler.host_time_us().
+"""
+
+import os
+import unittest
+
+os.environ["RIO_SIMULATION"] = "true"
+
+from controllers.droplet_detector_controller import LatencyTracker  # noqa: E402
+
+
+class TestLatencyTracker(unittest.TestCase):
+    """Test latency intervals and percentiles."""
+
+    def test_intervals(self):
+        """Test each interval is taken between the right stamps, in ms."""
+        tracker = LatencyTracker(max_samples=4)
+        tracker.result(7, trigger_us=1000, arrival_us=3000, result_us=8000)
+        self.assertTrue(tracker.action(7, action_us=9500))
+
+        stats = tracker.get_statistics()
+        self.assertEqual(stats["trigger_to_arrival"]["p50"], 2.0)
+        self.assertEqual(stats["arrival_to_result"]["p50"], 5.0)
+        self.assertEqual(stats["trigger_to_result"]["p50"], 7.0)
+        self.assertEqual(stats["result_to_action"]["p50"], 1.5)
+        self.assertEqual(stats["trigger_to_action"]["max"], 8.5)
+
+    def test_untagged_and_wrapping(self):
+        """Test frames without a trigger stamp, the latest result, and the 32-bit wrap."""
+        tracker = LatencyTracker(max_samples=4)
+        tracker.result(None, trigger_us=None, arrival_us=0xFFFFFC18, result_us=1000)
+        self.assertTrue(tracker.action(action_us=3000))
+        self.assertFalse(tracker.action(99))
+
+        stats = tracker.get_statistics()
+        self.assertEqual(stats["trigger_to_arrival"]["count"], 0)
+        self.assertEqual(stats["arrival_to_result"]["p50"], 2.0)
+        self.assertEqual(stats["result_to_action"]["p50"], 2.0)
+        self.assertEqual(stats["trigger_to_action"]["count"], 0)
+
+    def test_window(self):
+        """Test only the last max_samples samples and results are kept."""
+        tracker = LatencyTracker(max_samples=4)
+        for frame in range(10):
+            tracker.result(frame, None, 0, result_us=frame * 1000)
+        stats = tracker.get_statistics()
+        self.assertEqual(stats["arrival_to_result"]["count"], 4)
+        self.assertEqual(stats["arrival_to_result"]["max"], 9.0)
+        self.assertFalse(tracker.action(5))
+        self.assertTrue(tracker.action(6))
+
+        tracker.reset()
+        self.assertEqual(tracker.get_statistics()["arrival_to_result"]["count"], 0)
+        self.assertFalse(tracker.action())
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -9,11 +9,12 @@ from controllers.flow_web import FlowWeb
 
 
 def test_mapping_roundtrip_and_hidden_mode():
-    # Firmware modes 0,1,2,3 must map, with 2 hidden to UI 0.
+    # Firmware modes 0,1,2,3,4 must map, with 2 hidden to UI 0.
     assert CONTROL_MODE_FIRMWARE_TO_UI[0] == 0
     assert CONTROL_MODE_FIRMWARE_TO_UI[1] == 1
     assert CONTROL_MODE_FIRMWARE_TO_UI[2] == 0  # hidden / deprecated
     assert CONTROL_MODE_FIRMWARE_TO_UI[3] == 2
+    assert CONTROL_MODE_FIRMWARE_TO_UI[4] == 2  # cascade shows as flow closed loop
 
     # UI modes 0,1,2 must map back to valid firmware modes.
     assert CONTROL_MODE_UI_TO_FIRMWARE[0] == 0
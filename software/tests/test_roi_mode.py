@@ -95,3 +95,26 @@ def test_roi_hardware_mode_backend_missing_method(monkeypatch):
     assert ctrl.roi == {"x": 3, "y": 4, "width": 30, "height": 40}
     assert ctrl.socketio.events[-1][1]["mode"] == ROI_MODE_SOFTWARE
     assert getattr(ctrl, "_roi_hardware_unsupported_logged", False) is True
+
+
+def test_roi_hardware_mode_through_strobe_cam(monkeypatch):
+    class StrobeCam:
+        def __init__(self):
+            self.sensor_roi = None
+
+        def set_sensor_roi(self, roi):
+            self.sensor_roi = roi
+            return True
+
+    dummy = DummyCamera()
+    ctrl = _make_controller(ROI_MODE_HARDWARE, dummy)
+    ctrl.strobe_cam = StrobeCam()
+    ctrl._handle_roi_set({"parameters": {"x": 5, "y": 6, "width": 20, "height": 22}})
+
+    assert ctrl.strobe_cam.sensor_roi == (5, 6, 20, 22)  # retimed with the readout
+    assert dummy.set_calls == []
+    assert ctrl.roi_mode_active == ROI_MODE_HARDWARE
+
+    ctrl._handle_roi_clear()
+    assert ctrl.strobe_cam.sensor_roi is None
+    assert ctrl.roi_mode_active == ROI_MODE_SOFTWARE
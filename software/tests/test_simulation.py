@@ -11,6 +11,7 @@ Usage:
 """
 
 import os
+import time
 import unittest
 
 # Set simulation mode
@@ -184,6 +185,345 @@ class TestSimulatedStrobe(unittest.TestCase):
         self.assertEqual(self.strobe.wait_ns, wait_ns)
         self.assertEqual(self.strobe.period_ns, period_ns)
 
+    def test_shadow_timing_commit(self):
+        """Test staged timing is only applied on commit"""
+        self.strobe.packet_query(
+            self.strobe.PACKET_TYPE_SET_TIMING,
+            list((1000).to_bytes(4, "little")) + list((100000).to_bytes(4, "little")),
+        )
+        valid, response = self.strobe.packet_query(
+            self.strobe.PACKET_TYPE_SET_TIMING_SHADOW,
+            list((2000).to_bytes(4, "little")) + list((50000).to_bytes(4, "little")),
+        )
+        self.assertTrue(valid)
+        self.assertEqual(response[0], 0)
+        self.assertEqual(int.from_bytes(response[5:9], "little"), 50000)
+        self.assertEqual((self.strobe.wait_ns, self.strobe.period_ns), (1000, 100000))
+
+        valid, response = self.strobe.packet_query(self.strobe.PACKET_TYPE_COMMIT_TIMING, [])
+        self.assertTrue(valid)
+        self.assertEqual((self.strobe.wait_ns, self.strobe.period_ns), (2000, 50000))
+
+    def test_phase_lock(self):
+        """Test the wait follows a fixed phase of the measured frame period from the next edge"""
+        from drivers.strobe import PiStrobe
+
+        self.strobe.enabled = True
+        self.strobe.trigger_mode = True
+        phase = list((PiStrobe.PHASE_LOCK_SCALE // 4).to_bytes(2, "little"))
+        valid, response = self.strobe.packet_query(self.strobe.PACKET_TYPE_SET_PHASE_LOCK, phase)
+        self.assertEqual(response[0], 0)
+        self.assertEqual(int.from_bytes(response[3:7], "little"), 0)
+
+        self.strobe.frame_edge()
+        time.sleep(0.02)
+        self.strobe.frame_edge()
+        period_ns = self.strobe.frame_period_ns
+        self.assertGreaterEqual(period_ns, 20000000)
+        self.strobe.frame_edge()
+        self.assertEqual(self.strobe.wait_ns, period_ns // 4)
+
+        valid, response = self.strobe.packet_query(self.strobe.PACKET_TYPE_SET_PHASE_LOCK, [])
+        self.assertEqual(int.from_bytes(response[1:3], "little"), PiStrobe.PHASE_LOCK_SCALE // 4)
+        self.assertGreater(int.from_bytes(response[3:7], "little"), 0)
+
+    def test_frame_clock(self):
+        """Test the frame clock period, its measured frame period and the self-test exclusion"""
+        period = list((1000000).to_bytes(4, "little"))
+        valid, response = self.strobe.packet_query(self.strobe.PACKET_TYPE_SET_FRAME_CLOCK, period)
+        self.assertEqual(response, [0] + period)
+        self.assertEqual(self.strobe.frame_period_ns, 1000000)
+
+        self.strobe.enabled = True
+        valid, response = self.strobe.packet_query(self.strobe.PACKET_TYPE_TRIG_TEST, [1, 0, 100, 0])
+        self.assertEqual(response[0], self.strobe.ERR_TRIG_TEST_BUSY)
+
+        valid, response = self.strobe.packet_query(self.strobe.PACKET_TYPE_SET_FRAME_CLOCK, [0] * 4)
+        self.assertEqual(response, [0] * 5)
+        valid, response = self.strobe.packet_query(self.strobe.PACKET_TYPE_SET_FRAME_CLOCK, [1, 0, 0, 0])
+        self.assertEqual(response[0], self.strobe.ERR_STROBE_TIMING_INVALID)
+
+    def test_strobe_b(self):
+        """Test the second channel times as made, the alternate pattern flags and the self-test"""
+        data = [2] + list((10000).to_bytes(4, "little")) + list((5000).to_bytes(4, "little"))
+        valid, response = self.strobe.packet_query(self.strobe.PACKET_TYPE_SET_STROBE_B, data)
+        self.assertEqual(response, [0] + data)
+
+        self.strobe.enabled = True
+        self.strobe.trigger_mode = True
+        for _ in range(3):
+            self.strobe.frame_edge()
+        flags = [event[2] for event in self.strobe.events]
+        self.assertEqual(flags, [0x01, 0x01 | 0x08 | 0x10, 0x01])
+
+        query = self.strobe.packet_query
+        valid, response = query(self.strobe.PACKET_TYPE_TRIG_TEST, [1, 0, 100, 0])
+        self.assertEqual(response[0], self.strobe.ERR_TRIG_TEST_INVALID)
+        valid, response = query(self.strobe.PACKET_TYPE_SET_STROBE_B, [3] + [0] * 8)
+        self.assertEqual(response[0], self.strobe.ERR_PACKET_INVALID)
+        valid, response = query(self.strobe.PACKET_TYPE_SET_STROBE_B, [0] * 9)
+        self.assertEqual(response, [0] * 10)
+
+    def test_shadow_timing_held(self):
+        """Test staged timing with an apply time is held until then, or until committed"""
+        timing = list((2000).to_bytes(4, "little")) + list((50000).to_bytes(4, "little"))
+        apply_us = (self.strobe.timebase.now_us() + 200000) & 0xFFFFFFFF
+        data = timing + list(apply_us.to_bytes(4, "little"))
+        valid, response = self.strobe.packet_query(self.strobe.PACKET_TYPE_SET_TIMING_SHADOW, data)
+        self.assertEqual(response[0], 0)
+        self.strobe.enabled = True
+        self.strobe.trigger_mode = True
+        self.strobe.frame_edge()
+        self.assertNotEqual(self.strobe.period_ns, 50000)
+
+        # Released at its time, then committed by the next edge in hardware trigger mode
+        time.sleep(0.2)
+        self.strobe.packet_query(self.strobe.PACKET_TYPE_GET_CAM_READ_TIME, [])
+        self.assertNotEqual(self.strobe.period_ns, 50000)
+        self.strobe.frame_edge()
+        self.assertEqual(self.strobe.period_ns, 50000)
+
+        # Software trigger mode commits at its time, COMMIT_TIMING at once
+        self.strobe.trigger_mode = False
+        timing = list((1000).to_bytes(4, "little")) + list((20000).to_bytes(4, "little"))
+        apply_us = (self.strobe.timebase.now_us() + 10000000) & 0xFFFFFFFF
+        data = timing + list(apply_us.to_bytes(4, "little"))
+        self.strobe.packet_query(self.strobe.PACKET_TYPE_SET_TIMING_SHADOW, data)
+        self.assertEqual(self.strobe.period_ns, 50000)
+        self.strobe.packet_query(self.strobe.PACKET_TYPE_COMMIT_TIMING, [])
+        self.assertEqual(self.strobe.period_ns, 20000)
+
+    def test_sequence_table(self):
+        """Test sequence entries are stepped per frame edge with repeat and loop"""
+        for index, (wait_ns, period_ns, repeat) in enumerate([(1000, 10000, 2), (2000, 20000, 1)]):
+            data = [index] + list(wait_ns.to_bytes(4, "little"))
+            data += list(period_ns.to_bytes(4, "little")) + [repeat]
+            valid, response = self.strobe.packet_query(self.strobe.PACKET_TYPE_SET_SEQ_ENTRY, data)
+            self.assertEqual(response[0], 0)
+
+        # Entry 2 was never uploaded
+        valid, response = self.strobe.packet_query(self.strobe.PACKET_TYPE_SET_SEQ, [3, 1])
+        self.assertEqual(response[0], self.strobe.ERR_STROBE_SEQ_INVALID)
+
+        valid, response = self.strobe.packet_query(self.strobe.PACKET_TYPE_SET_SEQ, [2, 1])
+        self.assertEqual(response, [0, 2, 1, 1])
+        self.strobe.enabled = True
+        self.strobe.trigger_mode = True
+
+        periods = []
+        for _ in range(6):
+            self.strobe.frame_edge()
+            periods.append(self.strobe.period_ns)
+        self.assertEqual(periods, [10000, 10000, 20000, 10000, 10000, 20000])
+
+    def test_multi_pulse(self):
+        """Test pulses per frame packet validation and readback"""
+        data = [3] + list((5000).to_bytes(4, "little"))
+        valid, response = self.strobe.packet_query(self.strobe.PACKET_TYPE_SET_PULSES, data)
+        self.assertEqual(response[:2], [0, 3])
+        self.assertEqual(int.from_bytes(response[2:6], "little"), 5000)
+
+        data = [9] + list((5000).to_bytes(4, "little"))
+        valid, response = self.strobe.packet_query(self.strobe.PACKET_TYPE_SET_PULSES, data)
+        self.assertEqual(response[0], self.strobe.ERR_PACKET_INVALID)
+        self.assertEqual(self.strobe.pulse_count, 3)
+
+    def test_strobe_stats(self):
+        """Test trigger counters and reset"""
+        self.strobe.frame_edge()  # Strobe disabled -> dropped
+        self.strobe.enabled = True
+        self.strobe.trigger_mode = True
+        self.strobe.frame_edge()
+        self.strobe.frame_edge()
+
+        valid, response = self.strobe.packet_query(self.strobe.PACKET_TYPE_GET_STROBE_STATS, [1])
+        counters = [int.from_bytes(response[i : i + 4], "little") for i in range(1, 17, 4)]
+        self.assertEqual(counters, [3, 2, 0, 1])
+
+        valid, response = self.strobe.packet_query(self.strobe.PACKET_TYPE_GET_STROBE_STATS, [])
+        self.assertEqual(response[1:], [0] * 16)
+
+    def test_cam_read_stats(self):
+        """Test camera read time statistics packet layout"""
+        base_us = self.strobe.cam_read_time_us - 1000
+        data = list(base_us.to_bytes(2, "little")) + [9]  # 512us bins
+        valid, response = self.strobe.packet_query(self.strobe.PACKET_TYPE_SET_CAM_READ_HIST, data)
+        self.assertEqual(response, [0])
+
+        valid, response = self.strobe.packet_query(self.strobe.PACKET_TYPE_GET_CAM_READ_STATS, [])
+        self.assertEqual(len(response), 27)
+        self.assertEqual(int.from_bytes(response[9:11], "little"), self.strobe.cam_read_time_us)
+        bins = [int.from_bytes(response[i : i + 2], "little") for i in range(11, 27, 2)]
+        self.assertEqual(bins, [0, 1, 0, 0, 0, 0, 0, 0])
+
+    def test_strobe_event_fifo(self):
+        """Test trigger events are drained in order over several packets"""
+        self.strobe.frame_edge()  # Disabled
+        self.strobe.enabled = True
+        self.strobe.trigger_mode = True
+        for _ in range(4):
+            self.strobe.frame_edge()
+
+        valid, response = self.strobe.packet_query(self.strobe.PACKET_TYPE_GET_STROBE_EVENTS, [])
+        self.assertEqual(response[:3], [0, 2, 0])
+        self.assertEqual(len(response), 3 + 3 * 7)
+        self.assertEqual(response[3 + 6], self.strobe.EVENT_DROPPED_OFF)
+        self.assertEqual(response[3 + 7 + 6], self.strobe.EVENT_FIRED)
+
+        valid, response = self.strobe.packet_query(self.strobe.PACKET_TYPE_GET_STROBE_EVENTS, [])
+        self.assertEqual(response[:3], [0, 0, 0])
+        self.assertEqual(len(response), 3 + 2 * 7)
+
+
+class TestSimulatedClock(unittest.TestCase):
+    """Test the virtual clock shared by the simulated boards and the drivers"""
+
+    def tearDown(self):
+        """Clean up"""
+        from simulation import clock_simulated as clock
+
+        clock.set_real()
+
+    def test_stepped(self):
+        """Test a stepped clock moves on only by sleeps and steps, which return at once"""
+        from simulation import clock_simulated as clock
+        from simulation.heater_simulated import SimulatedHeater
+        from drivers import spi_handler
+        from drivers.spi_handler import PORT_HEATER1
+
+        clock.set_stepped()
+        heater = SimulatedHeater(device_port=PORT_HEATER1)
+        start_s, start_us, host_s = clock.monotonic(), heater.timebase.local_us(), time.monotonic()
+        self.assertEqual(clock.monotonic(), start_s)
+        spi_handler.pi_wait_s(600.0)
+        clock.step(0.5)
+        self.assertLess(time.monotonic() - host_s, 1.0)
+        self.assertAlmostEqual(clock.monotonic() - start_s, 600.5, places=3)
+        self.assertAlmostEqual((heater.timebase.local_us() - start_us) / 1e6, 600.5, places=3)
+        # Ten simulated minutes of heater periods in the history
+        heater._run_history()
+        self.assertEqual(heater.history_seq, int(600.5 / heater.HEATER_PERIOD_S))
+        self.assertEqual(len(heater.history), heater.HISTORY_LEN)
+
+    def test_accelerated(self):
+        """Test an accelerated clock runs faster than the host and its sleeps are shorter"""
+        from simulation import clock_simulated as clock
+
+        clock.set_rate(50.0)
+        start_s, host_s = clock.time(), time.monotonic()
+        clock.sleep(5.0)
+        self.assertGreaterEqual(clock.time() - start_s, 5.0)
+        self.assertLess(time.monotonic() - host_s, 1.0)
+        with self.assertRaises(ValueError):
+            clock.set_rate(0)
+
+
+def _firmware_built():
+    from simulation.firmware_simulated import firmware_available
+
+    return firmware_available("pressure") and firmware_available("heater")
+
+
+@unittest.skipUnless(_firmware_built(), "make -C hardware-modules/host_test fil")
+class TestFirmwareInTheLoop(unittest.TestCase):
+    """Test the real firmware over the simulated SPI, see simulation/firmware_simulated.py"""
+
+    def query(self, board, packet_type, data):
+        """Write a request and read its reply, as the drivers' packet_query()"""
+        from drivers import spi_handler
+
+        board.select(True)
+        board.xfer(spi_handler.build_frame(packet_type, data))
+        board.run_ms(5)
+        frame = []
+        for _ in range(50):
+            frame = board.xfer([0])
+            if frame[0] == spi_handler.STX:
+                break
+        frame += board.xfer([0, 0])
+        frame += board.xfer([0] * (frame[1] - 3))
+        board.select(False)
+        self.assertEqual(frame[2], packet_type)
+        return spi_handler.parse_frame(frame)
+
+    def test_protocol_through_spi_handler(self):
+        """PROTOCOL answered by rio_spi on the flow port with RIO_SIM_FIRMWARE set"""
+        from unittest import mock
+        from drivers import spi_handler
+        from simulation.spi_simulated import SimulatedSPIHandler, SimulatedGPIO
+
+        with mock.patch.dict(os.environ, {"RIO_SIM_FIRMWARE": "true"}):
+            handler = SimulatedSPIHandler(pin_mode=SimulatedGPIO.BOARD)
+            handler.initialize_port(spi_handler.PORT_FLOW, SimulatedGPIO.OUT, initial=1)
+            handler.spi_select_device(spi_handler.PORT_FLOW)
+            self.assertIsNotNone(handler.firmware_board())
+            handler.spi.xfer2(spi_handler.build_frame(spi_handler.PACKET_TYPE_PROTOCOL, []))
+            reply = []
+            for _ in range(50):
+                reply = handler.spi.xfer2([0])
+                if reply[0] == spi_handler.STX:
+                    break
+            reply += handler.spi.xfer2([0] * 6)
+            handler.spi_deselect_current()
+
+        valid, data = spi_handler.parse_frame(reply)
+        self.assertTrue(valid)
+        self.assertEqual(data[1:], [spi_handler.PROTOCOL_VERSION_CRC, spi_handler.CRC_16])
+
+    def test_pipelined_echo(self):
+        """Sequenced ECHOs in flight together all come back, including those clocked out early"""
+        from unittest import mock
+        from drivers import spi_handler
+        from drivers.flow import PiFlow
+
+        with mock.patch.dict(os.environ, {"RIO_SIM_FIRMWARE": "true"}):
+            spi_handler.spi_init(0, 2, 30000)
+            try:
+                flow = PiFlow(spi_handler.PORT_FLOW, 0.002)
+                payloads = [[i] * 20 for i in range(6)]
+                results = spi_handler.pipeline_query(
+                    [(flow, flow.PACKET_TYPE_ECHO, p) for p in payloads]
+                )
+            finally:
+                spi_handler.spi_close()
+
+        self.assertEqual(results, [(True, [0] + p) for p in payloads])
+
+    def test_pressure_step(self):
+        """Pressure loop of channel 0 closes on the plant, read back within 2 mbar of it"""
+        from drivers.flow import PiFlow
+        from simulation.firmware_simulated import FirmwareBoard
+
+        board = FirmwareBoard("pressure", realtime=False)
+        target = 500 * PiFlow.PRESSURE_SCALE
+        self.query(board, PiFlow.PACKET_TYPE_SET_CONTROL_MODE, [1, 2])  # CTRL_MODE_PRESSURE
+        target_data = [1] + list(target.to_bytes(2, "little"))
+        self.query(board, PiFlow.PACKET_TYPE_SET_PRESSURE_TARGET, target_data)
+        board.run_ms(3000)
+
+        valid, data = self.query(board, PiFlow.PACKET_TYPE_GET_PRESSURE_ACTUAL, [])
+        self.assertTrue(valid)
+        actual_mbar = int.from_bytes(data[1:3], "little", signed=True) / PiFlow.PRESSURE_SCALE
+        self.assertAlmostEqual(actual_mbar, board.pressure_mbar(0), delta=2)
+        self.assertAlmostEqual(actual_mbar, 500, delta=15)
+        self.assertGreater(board.flow_ul_hr(0), 0)
+
+    def test_heater_temp_readback(self):
+        """Each heater board runs its own firmware, reading back its own plant"""
+        from drivers.heater import PiHolder
+        from simulation.firmware_simulated import FirmwareBoard
+
+        boards = [FirmwareBoard("heater", realtime=False) for _ in range(2)]
+        boards[1].set_heater_plant(30, 40, 300, 15)
+        for board in boards:
+            board.run_ms(10000)
+
+        for board, temp_c in zip(boards, (22, 30)):
+            valid, data = self.query(board, PiHolder.PACKET_TYPE_TEMP_GET_ACTUAL, [])
+            self.assertTrue(valid)
+            actual_c = int.from_bytes(data[1:3], "big", signed=True) / PiHolder.TEMP_SCALE
+            self.assertAlmostEqual(actual_c, temp_c, delta=0.1)
+
 
 class TestSimulationConsistency(unittest.TestCase):
     """Test that simulation behaves consistently with real hardware"""